@@ -11,11 +11,13 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ellLib.h>
 
 #include <epicsMutex.h>
+#include <epicsAtomic.h>
 #include <epicsTypes.h>
 #include <epicsString.h>
 #include <ellLib.h>
@@ -28,22 +30,31 @@
 /** NDArray constructor, no parameters.
   * Initializes all fields to 0.  Creates the attribute linked list and linked list mutex. */
 NDArray::NDArray()
-  : referenceCount(0), pNDArrayPool(NULL),  
+  : referenceCount(0), bufferType(0), numaNode(0), pViewParent(NULL), pBufferOwner(NULL), pNDArrayPool(NULL),
     uniqueId(0), timeStamp(0.0), ndims(0), dataType(NDInt8),
-    dataSize(0),  pData(NULL)
+    dataSize(0),  pData(NULL), compressedSize(0), sparse(0), numEvents(0), pDevice(NULL), deviceStream(NULL)
 {
   this->epicsTS.secPastEpoch = 0;
   this->epicsTS.nsec = 0;
   memset(this->dims, 0, sizeof(this->dims));
+  memset(this->strides, 0, sizeof(this->strides));
   memset(&this->node, 0, sizeof(this->node));
-  this->pAttributeList = new NDAttributeList();
+  this->pAttributeList = new NDAttributeList(true);
 }
 
 /** NDArray destructor 
   * Frees the data array, deletes all attributes, frees the attribute list and destroys the mutex. */
 NDArray::~NDArray()
 {
-  if (this->pData) free(this->pData);
+  /* The buffer of a view belongs to its parent */
+  if (this->pViewParent) this->pData = NULL;
+  /* So does the memory that the array wraps */
+  if (this->pBufferOwner) {
+    this->pData = NULL;
+    delete this->pBufferOwner;
+  }
+  if (this->pNDArrayPool) this->pNDArrayPool->freeMemory(this);
+  else if (this->pData) free(this->pData);
   delete this->pAttributeList;
 }
 
@@ -80,13 +91,26 @@ int NDArray::getInfo(NDArrayInfo_t *pInfo)
     case NDFloat64:
       pInfo->bytesPerElement = sizeof(epicsFloat64);
       break;
+    case NDFloat16:
+      pInfo->bytesPerElement = sizeof(NDFloat16_t);
+      break;
+    case NDUInt10Packed:
+    case NDUInt12Packed:
+      pInfo->bytesPerElement = sizeof(epicsUInt16);
+      break;
     default:
       return(ND_ERROR);
       break;
   }
   pInfo->nElements = 1;
   for (i=0; i<this->ndims; i++) pInfo->nElements *= this->dims[i].size;
-  pInfo->totalBytes = pInfo->nElements * pInfo->bytesPerElement;
+  pInfo->bitsPerElement = NDPackedBits(this->dataType);
+  if (pInfo->bitsPerElement) {
+    pInfo->totalBytes = NDPackedBytes(pInfo->bitsPerElement, pInfo->nElements);
+  } else {
+    pInfo->bitsPerElement = 8 * pInfo->bytesPerElement;
+    pInfo->totalBytes = pInfo->nElements * pInfo->bytesPerElement;
+  }
   pInfo->colorMode = NDColorModeMono;
   pAttribute = this->pAttributeList->find("ColorMode");
   if (pAttribute) pAttribute->getValue(NDAttrInt32, &pInfo->colorMode);
@@ -175,6 +199,21 @@ int NDArray::reserve()
   return(pNDArrayPool->reserve(this));
 }
 
+/** Calls NDArrayPool::reserve() for this NDArray object on behalf of a consumer, which the pool counts
+  * against the quota of the consumer.
+  * \param[in] pConsumer The consumer.
+  * \return ND_SUCCESS, or ND_ERROR if the consumer is at its quota; the array is then not reserved. */
+int NDArray::reserve(NDPoolConsumer *pConsumer)
+{
+  const char *functionName = "NDArray::reserve";
+
+  if (!pNDArrayPool) {
+    printf("%s: WARNING, no owner\n", functionName);
+    return(ND_ERROR);
+  }
+  return(pNDArrayPool->reserve(this, pConsumer));
+}
+
 /** Calls NDArrayPool::release() for this object; decreases the reference count for this array. */
 int NDArray::release()
 {
@@ -187,6 +226,73 @@ int NDArray::release()
   return(pNDArrayPool->release(this));
 }
 
+/** Calls NDArrayPool::release() for this object on behalf of the consumer that reserved it.
+  * \param[in] pConsumer The consumer. */
+int NDArray::release(NDPoolConsumer *pConsumer)
+{
+  const char *functionName = "NDArray::release";
+
+  if (!pNDArrayPool) {
+    printf("%s: WARNING, no owner\n", functionName);
+    return(ND_ERROR);
+  }
+  return(pNDArrayPool->release(this, pConsumer));
+}
+
+/** Returns the reference count of this array.  Each view created with NDArrayPool::createView() also holds a
+  * reference to the array that owns its data, so a client whose count is 1 is the only one using the data. */
+int NDArray::getReferenceCount()
+{
+  return epicsAtomicGetIntT(&this->referenceCount);
+}
+
+/** Returns 1 if this array is a view of the data of another array created with NDArrayPool::createView(), 0 otherwise. */
+int NDArray::isView()
+{
+  return (this->pViewParent != NULL);
+}
+
+/** Returns 1 if pData belongs to this array, 0 if the array is a view or wraps memory of an NDArrayBufferOwner.
+  * Only the holders of an array that owns its data may write to it once they hold all of its references. */
+int NDArray::ownsData()
+{
+  return ((this->pViewParent == NULL) && (this->pBufferOwner == NULL));
+}
+
+/** Returns the strides of the array, i.e. the distance in elements between successive items of each dimension.
+  * For arrays that are not views these are the strides of the contiguous layout.
+  * \param[out] pStrides Array of strides, whose size must be at least ndims. */
+void NDArray::getStrides(size_t *pStrides)
+{
+  size_t stride = 1;
+  int dim;
+
+  for (dim=0; dim<this->ndims; dim++) {
+    if (this->pViewParent) {
+      pStrides[dim] = this->strides[dim];
+    } else {
+      pStrides[dim] = stride;
+      stride *= this->dims[dim].size;
+    }
+  }
+}
+
+/** Returns 1 if the data of the array is contiguous in pData in the order of dims[0] changing fastest, 0 otherwise.
+  * Only views can be non-contiguous; plugins that cannot handle strides call NDArrayPool::makeContiguous(). */
+int NDArray::isContiguous()
+{
+  size_t stride = 1;
+  int dim;
+
+  if (!this->pViewParent) return 1;
+  for (dim=0; dim<this->ndims; dim++) {
+    /* The stride of a dimension of size 1 does not matter */
+    if ((this->dims[dim].size > 1) && (this->strides[dim] != stride)) return 0;
+    stride *= this->dims[dim].size;
+  }
+  return 1;
+}
+
 /** Reports on the properties of the array.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; if >5 calls NDAttributeList::report().
@@ -203,6 +309,24 @@ int NDArray::report(FILE *fp, int details)
   fprintf(fp, "]\n");
   fprintf(fp, "  dataType=%d, dataSize=%d, pData=%p\n",
         this->dataType, (int)this->dataSize, this->pData);
+  if (!this->codec.empty()) {
+    fprintf(fp, "  codec=%s, compressedSize=%d\n", this->codec.name.c_str(), (int)this->compressedSize);
+  }
+  if (this->sparse) {
+    fprintf(fp, "  sparse, numEvents=%d\n", (int)this->numEvents);
+  }
+  if (this->pDevice) {
+    fprintf(fp, "  device=%s, deviceStream=%p\n", this->pDevice->name(), this->deviceStream);
+  }
+  if (!this->stackFrames.empty()) {
+    fprintf(fp, "  frame stack, frames=%d, last uniqueId=%d\n", (int)this->stackFrames.size(),
+            this->stackFrames.back().uniqueId);
+  }
+  if (this->pViewParent) {
+    fprintf(fp, "  view of array=%p, contiguous=%d, strides=[", this->pViewParent, isContiguous());
+    for (dim=0; dim<this->ndims; dim++) fprintf(fp, "%d ", (int)this->strides[dim]);
+    fprintf(fp, "]\n");
+  }
   fprintf(fp, "  uniqueId=%d, timeStamp=%f, referenceCount=%d\n",
         this->uniqueId, this->timeStamp, this->referenceCount);
   fprintf(fp, "  number of attributes=%d\n", this->pAttributeList->count());
@@ -13,15 +13,56 @@
 #define NDArray_H
 
 #include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
 #include <epicsTime.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
 
 #include "NDAttribute.h"
+#include "NDFloat16.h"
 #include "NDAttributeList.h"
+#include "NDNuma.h"
+#include "NDWorkerPool.h"
+#include "NDMemoryProvider.h"
 
 /** The maximum number of dimensions in an NDArray */
 #define ND_ARRAY_MAX_DIMS 10
 
+/** The number of size classes in the NDArrayPool free lists.
+  * Class 0 holds arrays with no data buffer, class n>0 holds arrays whose dataSize is in the range [2^(n-1), 2^n) */
+#define ND_ARRAY_POOL_SIZE_CLASSES (sizeof(size_t)*8 + 1)
+
+/** The number of bins in the NDArrayPool allocation time histogram.
+  * Bin 0 counts allocations that took less than 1 us, bin n counts those that took [10^(n-1), 10^n) us,
+  * and the last bin counts all of the slower ones */
+#define ND_POOL_ALLOC_HIST_BINS 6
+
+/** Enumeration of huge page modes for NDArrayPool buffers */
+typedef enum
+{
+    NDHugePagesNone,        /**< Ordinary pages */
+    NDHugePagesTransparent, /**< Advise the kernel to back large buffers with transparent huge pages (Linux only) */
+    NDHugePagesExplicit     /**< Map large buffers from the explicit huge page pool, fall back to transparent huge pages (Linux only) */
+} NDHugePages_t;
+
+/** Enumeration of the NUMA placement policies of the NDArrayPool data buffers */
+typedef enum {
+    NDNumaNone,     /**< No NUMA placement, the operating system decides */
+    NDNumaBind,     /**< Bind the buffers to a configured NUMA node */
+    NDNumaLocal     /**< Bind the buffers to the NUMA node of the thread that allocates the NDArray */
+} NDNumaPolicy_t;
+
+/** Enumeration of the policies that NDArrayPool::alloc() uses to choose the free buffers to evict when
+  * the pool has reached maxMemory */
+typedef enum {
+    NDPoolEvictSmallest,     /**< Evict the buffers in the smallest size classes first */
+    NDPoolEvictSizeDistance, /**< Evict the buffers whose size differs most from the request first */
+    NDPoolEvictLRU           /**< Evict the buffers that have been free for longest first */
+} NDPoolEviction_t;
+
 /** Enumeration of color modes for NDArray attribute "colorMode" */
 typedef enum
 {
@@ -47,6 +88,33 @@ typedef enum
     NDBayerBGGR        = 3     /**< First line BGBG, second line GRGR... */
 } NDBayerPattern_t;
 
+/** Enumeration of the compressors of the codec of an NDArray, see NDCodec_t */
+typedef enum {
+    NDCodecNone,    /**< The data is not compressed */
+    NDCodecJPEG,    /**< A JPEG image of an NDUInt8 array, which is lossy */
+    NDCodecBlosc,   /**< A blosc frame, as stored in the chunks of the blosc HDF5 filter */
+    NDCodecLZ4,     /**< An LZ4 block, without a header */
+    NDCodecBSLZ4    /**< A chunk of the bitshuffle HDF5 filter with LZ4 compression */
+} NDCodecCompressor_t;
+
+/** The names of the NDCodecCompressor_t compressors, which are the codec names of NTNDArray */
+static const char * const NDCodecName[] = {"", "jpeg", "blosc", "lz4", "bslz4"};
+
+/** The codec of the data of an NDArray.
+  * An array whose codec name is not empty has compressedSize bytes of compressed data in pData.  Its dims and
+  * dataType describe the data once it is decompressed, so NDArray::getInfo() returns the uncompressed totalBytes.
+  * Only plugins that set NDPluginDriver::supportsCompressedArrays_ receive compressed arrays. */
+typedef struct NDCodec {
+    std::string name;   /**< The name of the codec, one of NDCodecName, or empty if the data is not compressed */
+    int level;          /**< The compression level, or the JPEG quality */
+    int shuffle;        /**< The blosc shuffle, 0=none, 1=byte, 2=bit */
+    int compressor;     /**< The blosc compressor, BLOSC_BLOSCLZ etc. */
+
+    NDCodec() : level(0), shuffle(0), compressor(0) {}
+    bool empty() const { return name.empty(); }
+    void clear() { name.clear(); level = 0; shuffle = 0; compressor = 0; }
+} NDCodec_t;
+
 /** Structure defining a dimension of an NDArray */
 typedef struct NDDimension {
     size_t size;    /**< The number of elements in this dimension of the array */
@@ -68,7 +136,9 @@ typedef struct NDDimension {
 /** Structure returned by NDArray::getInfo */
 typedef struct NDArrayInfo {
     size_t nElements;       /**< The total number of elements in the array */
-    int bytesPerElement;    /**< The number of bytes per element in the array */
+    int bytesPerElement;    /**< The number of bytes per element in the array, rounded up to whole bytes for the
+                              *  packed data types, whose elements are unpacked to UInt16 */
+    int bitsPerElement;     /**< The number of bits per element, 8*bytesPerElement except for the packed types */
     size_t totalBytes;      /**< The total number of bytes required to hold the array;
                               *  this may be less than NDArray::dataSize. */
                             /**< The following are mostly useful for color images (RGB1, RGB2, RGB3) */
@@ -84,6 +154,96 @@ typedef struct NDArrayInfo {
     size_t colorStride;     /**< The number of array elements between color values */
 } NDArrayInfo_t;
 
+/** Returns the number of bits of each element of the packed data types NDUInt10Packed and NDUInt12Packed,
+  * or 0 for the other data types, whose elements are whole bytes. */
+inline int NDPackedBits(NDDataType_t dataType)
+{
+    if (dataType == NDUInt10Packed) return 10;
+    if (dataType == NDUInt12Packed) return 12;
+    return 0;
+}
+
+/** Returns the number of bytes of nElements elements of a packed data type. */
+inline size_t NDPackedBytes(int packedBits, size_t nElements)
+{
+    return (nElements * packedBits + 7) / 8;
+}
+
+/** Returns the byte offset in pData of the values of a sparse NDArray with numEvents events.
+  * A sparse array holds the numEvents ascending epicsUInt32 linear pixel indices (dims[0] changing fastest) of its
+  * non-zero elements, followed by their numEvents values of the dataType starting at a multiple of 8 bytes;
+  * every other element is zero.  Its dims and dataType describe the dense array, so NDArray::getInfo() returns
+  * the dense totalBytes.  Only plugins that set NDPluginDriver::supportsSparseArrays_ receive sparse arrays. */
+inline size_t NDSparseValueOffset(size_t numEvents)
+{
+    return (numEvents * sizeof(epicsUInt32) + 7) & ~(size_t)7;
+}
+
+/** Returns the number of bytes of the indices and values of numEvents events of a sparse NDArray. */
+inline size_t NDSparseBytes(size_t numEvents, int bytesPerElement)
+{
+    return NDSparseValueOffset(numEvents) + numEvents * bytesPerElement;
+}
+
+/** The identity of one frame of a frame stack, see NDArray::stackFrames */
+typedef struct NDStackFrame {
+    int            uniqueId;    /**< The uniqueId of the frame */
+    double         timeStamp;   /**< The timeStamp of the frame */
+    epicsTimeStamp epicsTS;     /**< The epicsTS of the frame */
+} NDStackFrame_t;
+
+/** Allocation statistics of an NDArrayPool, returned by NDArrayPool::getStats() */
+typedef struct NDArrayPoolStats {
+    size_t numAllocs;           /**< Number of calls to alloc() */
+    size_t freeListHits;        /**< Allocations that reused a free buffer that was large enough */
+    size_t newBuffers;          /**< Allocations that allocated a buffer for an array that had none */
+    size_t reallocations;       /**< Allocations that freed a free buffer that was too small and allocated a new one */
+    size_t newArrays;           /**< Allocations that had to create a new NDArray object */
+    size_t bufferLimitFailures; /**< Allocations that failed because maxBuffers was reached */
+    size_t memoryLimitFailures; /**< Allocations that failed because maxMemory was reached */
+    size_t allocFailures;       /**< Allocations that failed because the memory could not be allocated */
+    size_t evictions;           /**< Free buffers that alloc() freed to stay within maxMemory */
+    size_t trimmedBuffers;      /**< Idle free buffers that trim() freed */
+    int    maxBuffersInUse;     /**< High-water mark of the number of buffers in use */
+    size_t maxMemorySize;       /**< High-water mark of the memory allocated by the pool in bytes */
+    double minAllocTime;        /**< Shortest time taken by alloc() in seconds */
+    double maxAllocTime;        /**< Longest time taken by alloc() in seconds */
+    double totalAllocTime;      /**< Total time taken by alloc() in seconds */
+    size_t allocTimeHist[ND_POOL_ALLOC_HIST_BINS];  /**< Histogram of the time taken by alloc() */
+} NDArrayPoolStats_t;
+
+/** Abstract base class for the owner of memory that NDArrayPool::alloc() wraps in an NDArray without copying it,
+  * such as the value of a received NTNDArray.  The pool deletes the owner instead of freeing pData when the last
+  * reference to the array is released, so the owner gives the memory back in its destructor.
+  */
+class epicsShareClass NDArrayBufferOwner {
+public:
+    virtual ~NDArrayBufferOwner() {}
+};
+
+/** A consumer of the arrays of NDArrayPools, such as a plugin that queues them.  The pools attribute the
+  * reservations made with NDArrayPool::reserve(NDArray*, NDPoolConsumer*) to the consumer, and refuse one that
+  * would take the arrays of the pool that the consumer holds over its quota, so that one slow consumer cannot
+  * hold all of the buffers of a driver; the consumer then drops the array.
+  */
+class epicsShareClass NDPoolConsumer {
+public:
+    NDPoolConsumer(const char *consumerName) : name(consumerName), quota(0), held(0) {}
+    std::string name;   /**< The name of the consumer in the reports of the pools */
+    int quota;          /**< The most arrays of each pool that the consumer may hold; 0=unlimited */
+    int held;           /**< The arrays of all pools that the consumer holds.
+                          *  This is only modified with the epicsAtomic functions. */
+};
+
+/** The reservations of one consumer in an NDArrayPool, returned by NDArrayPool::getConsumerStats() */
+typedef struct NDPoolConsumerStats {
+    std::string name;
+    int    held;                /**< Arrays of the pool that the consumer holds */
+    int    maxHeld;             /**< High-water mark of held */
+    int    quota;               /**< The quota of the consumer at its last reservation; 0=unlimited */
+    size_t refused;             /**< Reservations refused because held was at the quota */
+} NDPoolConsumerStats_t;
+
 /** N-dimensional array class; each array has a set of dimensions, a data type, pointer to data, and optional attributes. 
   * An NDArray also has a uniqueId and timeStamp that to identify it. NDArray objects can be allocated
   * by an NDArrayPool object, which maintains a free list of NDArrays for efficient memory management. */
@@ -95,13 +255,29 @@ public:
     int          initDimension   (NDDimension_t *pDimension, size_t size);
     int          getInfo         (NDArrayInfo_t *pInfo);
     int          reserve();
+    int          reserve(NDPoolConsumer *pConsumer);
     int          release();
+    int          release(NDPoolConsumer *pConsumer);
+    int          getReferenceCount();
     int          report(FILE *fp, int details);
+    int          isView();
+    int          ownsData();
+    int          isContiguous();
+    void         getStrides(size_t *pStrides);
+    epicsUInt32* eventIndices() { return (epicsUInt32 *)pData; }
+    void*        eventValues() { return (char *)pData + NDSparseValueOffset(numEvents); }
     friend class NDArrayPool;
     
 private:
     ELLNODE      node;              /**< This must come first because ELLNODE must have the same address as NDArray object */
-    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it */
+    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it.
+                                      *  This is only modified with the epicsAtomic functions. */
+    int          bufferType;        /**< How the NDArrayPool allocated pData, so it can be freed the same way */
+    int          numaNode;          /**< The NUMA node of pData, which selects the free list of the NDArrayPool */
+    NDArray      *pViewParent;      /**< For a view, the array that owns pData; it is reserved while the view exists */
+    NDArrayBufferOwner *pBufferOwner; /**< For an array that wraps memory it does not own, the owner of pData;
+                                      *  it is deleted when the array is released */
+    epicsTimeStamp freeTime;        /**< When the array was last put on the free list of the NDArrayPool */
 
 public:
     class NDArrayPool *pNDArrayPool; /**< The NDArrayPool object that created this array */
@@ -118,7 +294,21 @@ public:
     void          *pData;       /**< Pointer to the array data.
                                   * The data is assumed to be stored in the order of dims[0] changing fastest, and 
                                   * dims[ndims-1] changing slowest. */
+    size_t        strides[ND_ARRAY_MAX_DIMS]; /**< For a view, the distance in elements between successive items
+                                  * of each dimension in pData; not used for other arrays, see getStrides(). */
     NDAttributeList *pAttributeList;  /**< Linked list of attributes */
+    NDCodec_t     codec;        /**< The codec of the data; its name is empty if pData is not compressed */
+    size_t        compressedSize; /**< The number of bytes of compressed data in pData if codec is not empty */
+    int           sparse;       /**< 1 if pData holds the numEvents events of a sparse array, see NDSparseValueOffset() */
+    size_t        numEvents;    /**< The number of events in pData if sparse is 1 */
+    NDDeviceMemory *pDevice;    /**< The device whose memory pData is in, or NULL if it is in host memory; only the
+                                  * plugins that set NDPluginDriver::supportsDeviceArrays_ receive device arrays */
+    void          *deviceStream; /**< For a device array, the stream of pDevice its data is written on, see
+                                  * NDDeviceMemory; NULL if the data is ready */
+    std::vector<NDStackFrame_t> stackFrames; /**< For a frame stack, the frames along its slowest dimension
+                                  * dims[ndims-1], each of which is an array of the other dimensions; empty for other
+                                  * arrays.  The uniqueId and time stamps of the stack are those of its first frame,
+                                  * and NDArrayPool::stackFrame() returns a view of one frame. */
 };
 
 /** The NDArrayPool class manages a free list (pool) of NDArray objects.
@@ -130,16 +320,32 @@ public:
   */
 class epicsShareClass NDArrayPool {
 public:
-    NDArrayPool  (int maxBuffers, size_t maxMemory);
-    NDArray*     alloc     (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData);
+    NDArrayPool  (int maxBuffers, size_t maxMemory, NDMemoryProvider *pMemoryProvider=NULL);
+    ~NDArrayPool ();
+    NDArray*     alloc     (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                            NDArrayBufferOwner *pBufferOwner=NULL);
+    NDArray*     allocSparse (int ndims, size_t *dims, NDDataType_t dataType, size_t numEvents);
     NDArray*     copy      (NDArray *pIn, NDArray *pOut, int copyData);
+    NDArray*     createView (NDArray *pParent, NDDimension_t *dims);
+    NDArray*     stackFrame (NDArray *pStack, size_t frame);
+    int          makeContiguous (NDArray *pIn, NDArray **ppOut);
+    int          makeSparse (NDArray *pIn, NDArray **ppOut);
+    int          makeDense  (NDArray *pIn, NDArray **ppOut);
+    int          preAllocate (int numBuffers, size_t dataSize);
 
     int          reserve   (NDArray *pArray);
+    int          reserve   (NDArray *pArray, NDPoolConsumer *pConsumer);
     int          release   (NDArray *pArray);
+    int          release   (NDArray *pArray, NDPoolConsumer *pConsumer);
     int          convert   (NDArray *pIn,
                             NDArray **ppOut,
                             NDDataType_t dataTypeOut,
                             NDDimension_t *outDims);
+    int          convert   (NDArray *pIn,
+                            NDArray **ppOut,
+                            NDDataType_t dataTypeOut,
+                            NDDimension_t *outDims,
+                            double scale);
     int          convert   (NDArray *pIn,
                             NDArray **ppOut,
                             NDDataType_t dataTypeOut);
@@ -149,14 +355,73 @@ public:
     size_t       maxMemory  ();
     size_t       memorySize ();
     int          numFree    ();
+    void         getStats   (NDArrayPoolStats_t *pStats);
+    void         resetStats ();
+    void         getConsumerStats (std::vector<NDPoolConsumerStats_t> &stats);
+    int          setMemoryProvider (NDMemoryProvider *pMemoryProvider);
+    NDMemoryProvider* memoryProvider ();
+    int          setAlignment (size_t alignment);
+    size_t       alignment  ();
+    int          setHugePages (NDHugePages_t mode, size_t threshold);
+    NDHugePages_t hugePages ();
+    int          setNumaPolicy (NDNumaPolicy_t policy, int node);
+    NDNumaPolicy_t numaPolicy ();
+    int          numaNode   ();
+    int          setConvertThreads (int numThreads, size_t minBytes);
+    int          convertThreads ();
+    size_t       convertMinBytes ();
+    void         setShareAttributes (bool share);
+    bool         shareAttributes ();
+    int          setEvictionPolicy (NDPoolEviction_t policy);
+    NDPoolEviction_t evictionPolicy ();
+    int          setTrimIdleTime (double idleTime);
+    double       trimIdleTime ();
+    size_t       trim       (double idleTime);
+    static size_t requiredBytes (int ndims, size_t *dims, NDDataType_t dataType);
+    void         freeMemory (NDArray *pArray);
 private:
-    ELLLIST      freeList_;      /**< Linked list of free NDArray objects that form the pool */
+    NDArray*     allocArray (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                             NDArrayBufferOwner *pBufferOwner, int sparse);
+    int          convertSparse (NDArray *pIn, NDArray **ppOut, NDDataType_t dataTypeOut, NDDimension_t *dimsOut,
+                                double scale);
+    void*        allocMemory (size_t dataSize, int *pBufferType, int node);
+    NDArray*     findFreeArray (size_t dataSize, void *pData, int node);
+    NDArray*     findFreeArrayOnNode (size_t dataSize, void *pData, int node);
+    int          allocNode  ();
+    void         addAllocTime (double allocTime);
+    void         addFreeArray  (NDArray *pArray);
+    void         evictFreeArrays (size_t dataSize);
+    NDArray*     evictionCandidate (size_t dataSize);
+    static void  trimTask   (void *pPvt);
+    void         removeFreeArray (NDArray *pArray);
+
+    ELLLIST      freeList_[ND_NUMA_MAX_NODES][ND_ARRAY_POOL_SIZE_CLASSES];  /**< Free NDArray objects that form the pool,
+                                   * one linked list per NUMA node and size class */
     epicsMutexId listLock_;      /**< Mutex to protect the free list */
     int          maxBuffers_;    /**< Maximum number of buffers this object is allowed to allocate; -1=unlimited */
     int          numBuffers_;    /**< Number of buffers this object has currently allocated */
     size_t       maxMemory_;     /**< Maximum bytes of memory this object is allowed to allocate; -1=unlimited */
     size_t       memorySize_;    /**< Number of bytes of memory this object has currently allocated */
     int          numFree_;       /**< Number of NDArray objects in the free list */
+    NDMemoryProvider *pMemoryProvider_; /**< Memory provider for the data buffers; NULL=malloc() */
+    size_t       alignment_;     /**< Alignment of the data buffers in bytes; 0=default malloc alignment */
+    NDHugePages_t hugePages_;    /**< Huge page mode for the data buffers */
+    size_t       hugePageThreshold_; /**< Minimum buffer size in bytes for which huge pages are used */
+    NDNumaPolicy_t numaPolicy_;  /**< NUMA placement policy for the data buffers */
+    int          numaNode_;      /**< NUMA node for the NDNumaBind policy */
+    int          convertThreads_;  /**< Number of worker threads for convert(); 0=convert in the calling thread */
+    size_t       convertMinBytes_; /**< Minimum output size in bytes for which convert() uses the worker threads */
+    NDWorkerPool *pConvertWorkers_; /**< Worker threads for convert() */
+    bool         shareAttributes_; /**< copy(), createView() and convert() share the attribute list rather than copying it */
+    NDPoolEviction_t evictionPolicy_; /**< How alloc() chooses the free buffers to evict at maxMemory */
+    double       trimIdleTime_;  /**< Free buffers idle for longer than this many seconds are trimmed; 0=never */
+    epicsThreadId trimThreadId_; /**< The trimmer thread, started by the first setTrimIdleTime() */
+    epicsEventId trimEvent_;     /**< Wakes the trimmer thread when the idle time changes or the pool is deleted */
+    epicsEventId trimExitEvent_; /**< Signalled by the trimmer thread when it exits */
+    bool         trimExit_;      /**< Tells the trimmer thread to exit */
+    NDArrayPoolStats_t stats_;   /**< Allocation statistics */
+    std::map<const NDPoolConsumer*, NDPoolConsumerStats_t> consumers_; /**< The reservations of each consumer */
+    epicsMutexId consumerLock_;  /**< Mutex to protect consumers_, so reservations do not contend with alloc() */
 };
 
 #endif
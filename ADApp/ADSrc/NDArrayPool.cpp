@@ -7,14 +7,42 @@
  */
 
 #include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+  #include <malloc.h>
+#endif
+#ifdef vxWorks
+  #include <memLib.h>
+#endif
+#ifdef __linux__
+  #include <sys/mman.h>
+#endif
 
 #include <cantProceed.h>
+#include <epicsAtomic.h>
+#include <epicsTime.h>
 #include <epicsExport.h>
 
 #include "NDArray.h"
+#include "NDConvertKernels.h"
 
 static const char *driverName = "NDArrayPool";
 
+/** The methods used by allocMemory() to allocate a buffer, saved in NDArray::bufferType */
+typedef enum {
+  NDBufferMalloc,   /**< malloc(), freed with free() */
+  NDBufferAligned,  /**< posix_memalign() or equivalent */
+  NDBufferMmap,     /**< mmap() from the explicit huge page pool, freed with munmap() */
+  NDBufferProvider  /**< The NDMemoryProvider of the pool */
+} NDBufferType_t;
+
+/** The size of a huge page, used to align and round up buffers allocated with huge pages */
+#define HUGE_PAGE_SIZE ((size_t)2*1024*1024)
+
+/** The minimum alignment of buffers that are bound to a NUMA node */
+#define ND_NUMA_PAGE_SIZE ((size_t)4096)
+
 
 /** eraseNDAttributes is a global flag the controls whether NDArray::clearAttributes() is called
   * each time a new array is allocated with NDArrayPool->alloc().
@@ -32,12 +60,210 @@ extern "C" {epicsExportAddress(int, eraseNDAttributes);}
   * \param[in] maxBuffers Maximum number of NDArray objects that the pool is allowed to contain; 0=unlimited.
   * \param[in] maxMemory Maxiumum number of bytes of memory the the pool is allowed to use, summed over
   * all of the NDArray objects; 0=unlimited.
+  * \param[in] pMemoryProvider The memory provider for the array buffers; NULL=malloc(), which honours the
+  * alignment, huge page and NUMA settings of the pool. The provider must outlive the pool and its arrays.
   */
-NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
-  : maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0)
+NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory, NDMemoryProvider *pMemoryProvider)
+  : maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0),
+    pMemoryProvider_(pMemoryProvider),
+    alignment_(0), hugePages_(NDHugePagesNone), hugePageThreshold_(HUGE_PAGE_SIZE),
+    numaPolicy_(NDNumaNone), numaNode_(0),
+    convertThreads_(0), convertMinBytes_(0), pConvertWorkers_(0), shareAttributes_(false),
+    evictionPolicy_(NDPoolEvictSmallest), trimIdleTime_(0.), trimThreadId_(0), trimEvent_(0), trimExitEvent_(0),
+    trimExit_(false)
 {
-  ellInit(&freeList_);
+  size_t i;
+  int node;
+
+  for (node=0; node<ND_NUMA_MAX_NODES; node++) {
+    for (i=0; i<ND_ARRAY_POOL_SIZE_CLASSES; i++) {
+      ellInit(&freeList_[node][i]);
+    }
+  }
   listLock_ = epicsMutexCreate();
+  consumerLock_ = epicsMutexCreate();
+  resetStats();
+}
+
+/** NDArrayPool destructor; stops the convert worker threads and the trimmer thread.
+  * The arrays and buffers on the free list are not freed. */
+NDArrayPool::~NDArrayPool()
+{
+  if (trimThreadId_) {
+    epicsMutexLock(listLock_);
+    trimExit_ = true;
+    epicsMutexUnlock(listLock_);
+    epicsEventSignal(trimEvent_);
+    epicsEventMustWait(trimExitEvent_);
+    epicsEventDestroy(trimEvent_);
+    epicsEventDestroy(trimExitEvent_);
+  }
+  delete pConvertWorkers_;
+  epicsMutexDestroy(listLock_);
+  epicsMutexDestroy(consumerLock_);
+}
+
+/** Returns the size class for a buffer of dataSize bytes.
+  * Class 0 is for arrays with no buffer, class n>0 is for buffers in the range [2^(n-1), 2^n). */
+static size_t sizeClass(size_t dataSize)
+{
+  size_t sc = 0;
+
+  while (dataSize) {
+    dataSize >>= 1;
+    sc++;
+  }
+  return sc;
+}
+
+/** Adds an array to the free list for its NUMA node and size class.  Must be called with listLock_ held. */
+void NDArrayPool::addFreeArray(NDArray *pArray)
+{
+  epicsTimeGetCurrent(&pArray->freeTime);
+  ellAdd(&freeList_[pArray->numaNode][sizeClass(pArray->dataSize)], &pArray->node);
+  numFree_++;
+}
+
+/** Removes an array from the free list for its NUMA node and size class.  Must be called with listLock_ held. */
+void NDArrayPool::removeFreeArray(NDArray *pArray)
+{
+  ellDelete(&freeList_[pArray->numaNode][sizeClass(pArray->dataSize)], &pArray->node);
+  numFree_--;
+}
+
+/** Returns the free array whose buffer the eviction policy selects to be freed next, or NULL if no free array
+  * has a buffer.  Must be called with listLock_ held.
+  * \param[in] dataSize The size of the buffer that alloc() needs. */
+NDArray* NDArrayPool::evictionCandidate(size_t dataSize)
+{
+  NDArray *pArray, *pBest = NULL;
+  size_t sc, distance, bestDistance = 0;
+  int node;
+
+  /* Class 0 holds the arrays with no buffer */
+  for (sc=1; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+    for (node=0; node<ND_NUMA_MAX_NODES; node++) {
+      pArray = (NDArray *)ellFirst(&freeList_[node][sc]);
+      if (!pArray) continue;
+      switch (evictionPolicy_) {
+        case NDPoolEvictSizeDistance:
+          for (; pArray; pArray = (NDArray *)ellNext(&pArray->node)) {
+            distance = (pArray->dataSize > dataSize) ? pArray->dataSize - dataSize : dataSize - pArray->dataSize;
+            if (!pBest || (distance > bestDistance)) {
+              pBest = pArray;
+              bestDistance = distance;
+            }
+          }
+          break;
+        case NDPoolEvictLRU:
+          /* Arrays are appended to the free lists when they are released, so the first is the oldest */
+          if (!pBest || epicsTimeLessThan(&pArray->freeTime, &pBest->freeTime)) pBest = pArray;
+          break;
+        default:
+          return pArray;
+      }
+    }
+  }
+  return pBest;
+}
+
+/** Frees the buffers of free arrays, in the order of the eviction policy, until alloc() can allocate a buffer of
+  * dataSize bytes within maxMemory.  Must be called with listLock_ held.
+  * \param[in] dataSize The size of the buffer that alloc() needs. */
+void NDArrayPool::evictFreeArrays(size_t dataSize)
+{
+  NDArray *pArray;
+
+  while (((memorySize_ + dataSize) > maxMemory_) && (pArray = evictionCandidate(dataSize))) {
+    removeFreeArray(pArray);
+    memorySize_ -= pArray->dataSize;
+    freeMemory(pArray);
+    // The array now has no buffer, so it moves to size class 0
+    addFreeArray(pArray);
+    stats_.evictions++;
+  }
+}
+
+/** Returns the NUMA node that the next buffer should be allocated on, according to the NUMA policy. */
+int NDArrayPool::allocNode()
+{
+  switch (numaPolicy_) {
+    case NDNumaBind:
+      return numaNode_;
+    case NDNumaLocal:
+      return NDNumaCurrentNode();
+    default:
+      return 0;
+  }
+}
+
+/** Finds the best free array for a request of dataSize bytes.  Must be called with listLock_ held.
+  * \param[in] dataSize The number of bytes required.
+  * \param[in] pData The caller-supplied buffer passed to alloc(), if any.
+  * \param[in] node The NUMA node whose free lists are searched first.
+  * \return Pointer to a free array, or NULL if the free lists are empty.
+  *
+  * If pData is not NULL the buffer of the array will not be used, so an array without a buffer
+  * is preferred. Otherwise the size class of dataSize is searched for the smallest buffer that is
+  * large enough, followed by the first array in the next non-empty larger size class. 
+  * If no buffer is large enough then the largest free buffer is returned; the caller must then
+  * reallocate it. If the free lists of the node are empty the other nodes are searched, and the
+  * caller must move the buffer of the array to the right node. */
+NDArray* NDArrayPool::findFreeArray(size_t dataSize, void *pData, int node)
+{
+  NDArray *pArray;
+  int i;
+
+  if (numFree_ == 0) return NULL;
+
+  for (i=0; i<ND_NUMA_MAX_NODES; i++) {
+    pArray = findFreeArrayOnNode(dataSize, pData, (node + i) % ND_NUMA_MAX_NODES);
+    if (pArray) return pArray;
+  }
+  return NULL;
+}
+
+/** Searches the free lists of one NUMA node for findFreeArray().  Must be called with listLock_ held. */
+NDArray* NDArrayPool::findFreeArrayOnNode(size_t dataSize, void *pData, int node)
+{
+  NDArray *pArray, *pBest=NULL;
+  ELLLIST *freeList = freeList_[node];
+  size_t sc, first;
+
+  if (pData) {
+    for (sc=0; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+      pArray = (NDArray *)ellFirst(&freeList[sc]);
+      if (pArray) return pArray;
+    }
+    return NULL;
+  }
+
+  /* Search the size class of the request for the best fit */
+  first = sizeClass(dataSize);
+  pArray = (NDArray *)ellFirst(&freeList[first]);
+  while (pArray) {
+    if ((pArray->dataSize >= dataSize) &&
+        (!pBest || (pArray->dataSize < pBest->dataSize))) {
+      pBest = pArray;
+      if (pBest->dataSize == dataSize) break;
+    }
+    pArray = (NDArray *)ellNext(&pArray->node);
+  }
+  if (pBest) return pBest;
+
+  /* Every buffer in a larger size class is big enough */
+  for (sc=first+1; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+    pArray = (NDArray *)ellFirst(&freeList[sc]);
+    if (pArray) return pArray;
+  }
+
+  /* Nothing fits.  Return the largest buffer that is too small, it will be reallocated */
+  sc = first + 1;
+  while (sc-- > 0) {
+    pArray = (NDArray *)ellFirst(&freeList[sc]);
+    if (pArray) return pArray;
+  }
+  return NULL;
 }
 
 /** Allocates a new NDArray object; the first 3 arguments are required.
@@ -48,9 +274,12 @@ NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
   * alloc() will compute the size required from ndims, dims, and dataType.
   * \param[in] pData Pointer to a data buffer; if NULL then alloc will allocate a new
   * array buffer; if not NULL then it is assumed to point to a valid buffer.
+  * \param[in] pBufferOwner The owner of pData, if the array wraps pData without owning it.
   * 
   * If pData is not NULL then dataSize must contain the actual number of bytes in the existing
   * array, and this array must be large enough to hold the array data. 
+  * If pBufferOwner is not NULL the pool never frees pData; it deletes pBufferOwner instead when the
+  * last reference to the array is released.  If alloc() fails the caller still owns pBufferOwner.
   * alloc() searches
   * its free list to find a free NDArray buffer. If is cannot find one then it will
   * allocate a new one and add it to the free list. If doing so would exceed maxBuffers
@@ -59,17 +288,70 @@ NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
   * maxMemory then an error will be returned. alloc() sets the reference count for the
   * returned NDArray to 1.
   */
-NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
+NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                            NDArrayBufferOwner *pBufferOwner)
+{
+  return allocArray(ndims, dims, dataType, dataSize, pData, pBufferOwner, 0);
+}
+
+/** Allocates a sparse NDArray with room for numEvents events, see NDSparseValueOffset().
+  * \param[in] ndims The number of dimensions in the NDArray.
+  * \param[in] dims Array of dimensions of the dense array, whose size must be at least ndims.
+  * \param[in] dataType Data type of the values; the packed data types cannot be sparse.
+  * \param[in] numEvents The number of events, which sets NDArray::numEvents.
+  *
+  * The caller fills in the indices and values of the events.
+  */
+NDArray* NDArrayPool::allocSparse(int ndims, size_t *dims, NDDataType_t dataType, size_t numEvents)
+{
+  NDArray *pArray;
+  size_t one = 1;
+  size_t nElements = 1;
+  int bytesPerElement = (int)NDArrayPool::requiredBytes(1, &one, dataType);
+  int i;
+  const char* functionName = "NDArrayPool::allocSparse:";
+
+  if (NDPackedBits(dataType) || (bytesPerElement == 0)) {
+    printf("%s: ERROR: data type %d cannot be sparse\n", functionName, dataType);
+    return NULL;
+  }
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) nElements *= dims[i];
+  if (nElements > 0xFFFFFFFFu) {
+    printf("%s: ERROR: %ld elements do not fit the 32-bit event indices\n", functionName, (long)nElements);
+    return NULL;
+  }
+  /* An array without events still gets a buffer, rather than the dense size alloc() uses for 0 */
+  pArray = allocArray(ndims, dims, dataType, NDSparseBytes(numEvents ? numEvents : 1, bytesPerElement),
+                      NULL, NULL, 1);
+  if (pArray) pArray->numEvents = numEvents;
+  return pArray;
+}
+
+/** Allocates an NDArray for alloc() and allocSparse(); sparse arrays are allowed a dataSize smaller than
+  * their dense totalBytes. */
+NDArray* NDArrayPool::allocArray(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                                 NDArrayBufferOwner *pBufferOwner, int sparse)
 {
   NDArray *pArray;
   NDArrayInfo_t arrayInfo;
+  size_t requiredSize;
   int i;
+  int node;
+  epicsTimeStamp startTime, endTime;
   const char* functionName = "NDArrayPool::alloc:";
 
+  epicsTimeGetCurrent(&startTime);
+  /* Compute the required size before taking the lock so we can pick a buffer of the right size class */
+  requiredSize = dataSize;
+  if (requiredSize == 0) {
+    requiredSize = NDArrayPool::requiredBytes(ndims, dims, dataType);
+  }
+  node = allocNode();
+
   epicsMutexLock(listLock_);
 
   /* Find a free image */
-  pArray = (NDArray *)ellFirst(&freeList_);
+  pArray = findFreeArray(requiredSize, pData, node);
 
   if (!pArray) {
     /* We did not find a free image.
@@ -77,16 +359,20 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     if ((maxBuffers_ > 0) && (numBuffers_ >= maxBuffers_)) {
       printf("%s: error: reached limit of %d buffers (memory use=%ld/%ld bytes)\n",
              functionName, maxBuffers_, (long)memorySize_, (long)maxMemory_);
+      stats_.bufferLimitFailures++;
     } else {
       numBuffers_++;
+      stats_.newArrays++;
       pArray = new NDArray;
-      ellAdd(&freeList_, &pArray->node);
-      numFree_++;
+      pArray->numaNode = node;
+      addFreeArray(pArray);
     }
   }
 
   if (pArray) {
     /* We have a frame */
+    /* Remove it from the free list now; it is put back if there is an error */
+    removeFreeArray(pArray);
     /* Initialize fields */
     pArray->pNDArrayPool = this;
     pArray->dataType = dataType;
@@ -98,13 +384,22 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
       pArray->dims[i].binning = 1;
       pArray->dims[i].reverse = 0;
     }
+    pArray->codec.clear();
+    pArray->compressedSize = 0;
+    pArray->sparse = sparse;
+    pArray->numEvents = 0;
+    pArray->stackFrames.clear();
+    /* The buffers of a device provider are in the memory of the device, and wrapped memory is host memory */
+    pArray->pDevice = (pMemoryProvider_ && !pData) ? pMemoryProvider_->device() : NULL;
+    pArray->deviceStream = NULL;
     /* Erase the attributes if that global flag is set */
     if (eraseNDAttributes) pArray->pAttributeList->clear();
     pArray->getInfo(&arrayInfo);
     if (dataSize == 0) dataSize = arrayInfo.totalBytes;
-    if (arrayInfo.totalBytes > dataSize) {
+    if (!sparse && (arrayInfo.totalBytes > dataSize)) {
       printf("%s: ERROR: required size=%d passed size=%d is too small\n",
       functionName, (int)arrayInfo.totalBytes, (int)dataSize);
+      addFreeArray(pArray);
       pArray=NULL;
     }
   }
@@ -112,61 +407,625 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   if (pArray) {
     /* If the caller passed a valid buffer use that, trust that its size is correct */
     if (pData) {
+      /* The buffer of the array would be lost, so free it */
+      if (pArray->pData) {
+        memorySize_ -= pArray->dataSize;
+        freeMemory(pArray);
+      }
       pArray->pData = pData;
+      pArray->pBufferOwner = pBufferOwner;
+      /* Wrapped memory is neither counted in memorySize_ nor freed by the pool, so its size can be kept */
+      if (pBufferOwner) pArray->dataSize = dataSize;
+      pArray->numaNode = node;
     } else {
-      /* See if the current buffer is big enough */
-      if (pArray->dataSize < dataSize) {
+      /* See if the current buffer is big enough and on the right NUMA node */
+      if (pArray->pData && (pArray->dataSize >= dataSize) && (pArray->numaNode == node)) {
+        stats_.freeListHits++;
+      } else {
         /* No, we need to free the current buffer and allocate a new one */
         /* See if there is enough room */
         if (pArray->pData) {
           memorySize_ -= pArray->dataSize;
-          free(pArray->pData);
-          pArray->pData = NULL;
-          pArray->dataSize = 0;
+          freeMemory(pArray);
+          stats_.reallocations++;
+        } else {
+          stats_.newBuffers++;
         }
         if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
           // We don't have enough memory to allocate the array
           // See if we can get memory by deleting arrays
-          NDArray *freeArray = (NDArray *)ellFirst(&freeList_);
-          while (freeArray && ((memorySize_ + dataSize) > maxMemory_)) {
-            if (freeArray->pData) {
-              memorySize_ -= freeArray->dataSize;
-              free(freeArray->pData);
-              freeArray->pData = NULL;
-              freeArray->dataSize = 0;
-            }
-            // Next array
-            freeArray = (NDArray *)ellNext(&freeArray->node);
-          }
+          evictFreeArrays(dataSize);
         }
         if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
           printf("%s: error: reached limit of %ld memory (%d/%d buffers)\n",
                  functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
-          pArray = NULL;
+          stats_.memoryLimitFailures++;
         } else {
-          pArray->pData = malloc(dataSize);
+          pArray->pData = allocMemory(dataSize, &pArray->bufferType, node);
+          pArray->numaNode = node;
           if (pArray->pData) {
             pArray->dataSize = dataSize;
             memorySize_ += dataSize;
+            if (memorySize_ > stats_.maxMemorySize) stats_.maxMemorySize = memorySize_;
           } else {
-            pArray = NULL;
+            stats_.allocFailures++;
           }
         }
       }
     }
-    // If we don't have a valid memory buffer see pArray to NULL to indicate error
-    if (pArray && (pArray->pData == NULL)) pArray = NULL;
+    // If we don't have a valid memory buffer put the array back on the free list and set pArray to NULL to indicate error
+    if (pArray->pData == NULL) {
+      addFreeArray(pArray);
+      pArray = NULL;
+    }
   }
   if (pArray) {
-    /* Set the reference count to 1, remove from free list */
-    pArray->referenceCount = 1;
-    ellDelete(&freeList_, &pArray->node);
-    numFree_--;
+    /* Set the reference count to 1 */
+    epicsAtomicSetIntT(&pArray->referenceCount, 1);
+    if (numBuffers_ - numFree_ > stats_.maxBuffersInUse) stats_.maxBuffersInUse = numBuffers_ - numFree_;
   }
+  epicsTimeGetCurrent(&endTime);
+  addAllocTime(epicsTimeDiffInSeconds(&endTime, &startTime));
   epicsMutexUnlock(listLock_);
   return (pArray);
 }
 
+/** Adds the time taken by one call to alloc() to the statistics.  Must be called with listLock_ held. */
+void NDArrayPool::addAllocTime(double allocTime)
+{
+  double limit = 1e-6;
+  int bin;
+
+  if (allocTime < 0.) allocTime = 0.;
+  stats_.numAllocs++;
+  stats_.totalAllocTime += allocTime;
+  if ((stats_.numAllocs == 1) || (allocTime < stats_.minAllocTime)) stats_.minAllocTime = allocTime;
+  if (allocTime > stats_.maxAllocTime) stats_.maxAllocTime = allocTime;
+  for (bin=0; bin<ND_POOL_ALLOC_HIST_BINS-1; bin++, limit *= 10.) {
+    if (allocTime < limit) break;
+  }
+  stats_.allocTimeHist[bin]++;
+}
+
+/** Returns the allocation statistics of the pool.
+  * \param[out] pStats The statistics. */
+void NDArrayPool::getStats(NDArrayPoolStats_t *pStats)
+{
+  epicsMutexLock(listLock_);
+  *pStats = stats_;
+  epicsMutexUnlock(listLock_);
+}
+
+/** Resets the allocation statistics of the pool, including the high-water marks and the refused reservations
+  * of the consumers. */
+void NDArrayPool::resetStats()
+{
+  std::map<const NDPoolConsumer*, NDPoolConsumerStats_t>::iterator it;
+
+  epicsMutexLock(listLock_);
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.maxBuffersInUse = numBuffers_ - numFree_;
+  stats_.maxMemorySize = memorySize_;
+  epicsMutexUnlock(listLock_);
+  epicsMutexLock(consumerLock_);
+  for (it=consumers_.begin(); it!=consumers_.end(); ++it) {
+    it->second.maxHeld = it->second.held;
+    it->second.refused = 0;
+  }
+  epicsMutexUnlock(consumerLock_);
+}
+
+/** Returns the reservations of the consumers that have reserved arrays of the pool with
+  * reserve(NDArray*, NDPoolConsumer*), in the order of their addresses.
+  * \param[out] stats The reservations of each consumer. */
+void NDArrayPool::getConsumerStats(std::vector<NDPoolConsumerStats_t> &stats)
+{
+  std::map<const NDPoolConsumer*, NDPoolConsumerStats_t>::iterator it;
+
+  stats.clear();
+  epicsMutexLock(consumerLock_);
+  for (it=consumers_.begin(); it!=consumers_.end(); ++it) {
+    stats.push_back(it->second);
+  }
+  epicsMutexUnlock(consumerLock_);
+}
+
+/** Returns the number of bytes required to hold the data of an array with these dimensions and data type.
+  * \param[in] ndims The number of dimensions.
+  * \param[in] dims Array of dimensions, whose size must be at least ndims.
+  * \param[in] dataType Data type of the data. */
+size_t NDArrayPool::requiredBytes(int ndims, size_t *dims, NDDataType_t dataType)
+{
+  size_t nElements = 1;
+  int bytesPerElement;
+  int i;
+
+  switch (dataType) {
+    case NDInt8:
+    case NDUInt8:
+      bytesPerElement = 1;
+      break;
+    case NDInt16:
+    case NDUInt16:
+    case NDFloat16:
+      bytesPerElement = 2;
+      break;
+    case NDInt32:
+    case NDUInt32:
+    case NDFloat32:
+      bytesPerElement = 4;
+      break;
+    case NDFloat64:
+      bytesPerElement = 8;
+      break;
+    case NDUInt10Packed:
+    case NDUInt12Packed:
+      bytesPerElement = 0;
+      break;
+    default:
+      return 0;
+  }
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) nElements *= dims[i];
+  if (bytesPerElement == 0) return NDPackedBytes(NDPackedBits(dataType), nElements);
+  return nElements * bytesPerElement;
+}
+
+/** Allocates the memory for an array buffer from the memory provider, or with the alignment, huge page and NUMA
+  * settings of the pool if there is no provider.
+  * \param[in] dataSize The number of bytes to allocate.
+  * \param[out] pBufferType The method used to allocate the buffer, which freeMemory() needs.
+  * \param[in] node The NUMA node to bind the buffer to; ignored if the NUMA policy is NDNumaNone.
+  * \return Pointer to the buffer, or NULL if the allocation failed. */
+void* NDArrayPool::allocMemory(size_t dataSize, int *pBufferType, int node)
+{
+  void *pData = NULL;
+  size_t alignment = alignment_;
+  bool hugePages = (hugePages_ != NDHugePagesNone) && (dataSize >= hugePageThreshold_);
+
+  if (pMemoryProvider_) {
+    *pBufferType = NDBufferProvider;
+    return pMemoryProvider_->allocate(dataSize);
+  }
+
+  /* mbind() needs a page aligned buffer */
+  if ((numaPolicy_ != NDNumaNone) && (alignment < ND_NUMA_PAGE_SIZE)) alignment = ND_NUMA_PAGE_SIZE;
+
+  #ifdef __linux__
+  if (hugePages && (hugePages_ == NDHugePagesExplicit)) {
+    size_t mapSize = (dataSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    pData = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pData != MAP_FAILED) {
+      *pBufferType = NDBufferMmap;
+    } else {
+      /* The explicit huge page pool is empty or not configured, use transparent huge pages */
+      pData = NULL;
+    }
+  }
+  if (hugePages && (alignment < HUGE_PAGE_SIZE)) alignment = HUGE_PAGE_SIZE;
+  #else
+  hugePages = false;
+  #endif
+
+  if (pData) {
+    /* Allocated from the explicit huge page pool */
+  } else if (alignment == 0) {
+    pData = malloc(dataSize);
+    *pBufferType = NDBufferMalloc;
+  } else {
+    #if defined(_WIN32)
+      pData = _aligned_malloc(dataSize, alignment);
+    #elif defined(vxWorks)
+      pData = memalign(alignment, dataSize);
+    #else
+      if (posix_memalign(&pData, alignment, dataSize) != 0) pData = NULL;
+    #endif
+    #ifdef __linux__
+    if (pData && hugePages) madvise(pData, dataSize, MADV_HUGEPAGE);
+    #endif
+    *pBufferType = NDBufferAligned;
+  }
+  /* Bind the pages before they are first touched so they are allocated on the node */
+  if (pData && (numaPolicy_ != NDNumaNone)) NDNumaBindMemory(pData, dataSize, node);
+  return pData;
+}
+
+/** Frees the data buffer of an array that was allocated with allocMemory().
+  * \param[in] pArray The array whose buffer is freed; pData is set to NULL and dataSize to 0. */
+void NDArrayPool::freeMemory(NDArray *pArray)
+{
+  if (pArray->pData) {
+    switch (pArray->bufferType) {
+      case NDBufferProvider:
+        pMemoryProvider_->free(pArray->pData, pArray->dataSize);
+        break;
+      #ifdef __linux__
+      case NDBufferMmap:
+        munmap(pArray->pData, (pArray->dataSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+        break;
+      #endif
+      #ifdef _WIN32
+      case NDBufferAligned:
+        _aligned_free(pArray->pData);
+        break;
+      #endif
+      default:
+        free(pArray->pData);
+        break;
+    }
+  }
+  pArray->pData = NULL;
+  pArray->dataSize = 0;
+  pArray->bufferType = NDBufferMalloc;
+}
+
+/** Sets the memory provider for the data buffers that the pool allocates.
+  * This can only be done before the pool has allocated any buffers, normally in the constructor of the driver.
+  * \param[in] pMemoryProvider The memory provider; NULL=malloc().  The provider must outlive the pool and its arrays.
+  */
+int NDArrayPool::setMemoryProvider(NDMemoryProvider *pMemoryProvider)
+{
+  const char *functionName = "setMemoryProvider";
+  int status = ND_SUCCESS;
+
+  epicsMutexLock(listLock_);
+  if (memorySize_ != 0) {
+    printf("%s:%s: ERROR, cannot change the memory provider after %lu bytes have been allocated\n",
+           driverName, functionName, (unsigned long)memorySize_);
+    status = ND_ERROR;
+  } else {
+    pMemoryProvider_ = pMemoryProvider;
+  }
+  epicsMutexUnlock(listLock_);
+  return status;
+}
+
+/** Returns the memory provider for the data buffers that the pool allocates; NULL=malloc() */
+NDMemoryProvider* NDArrayPool::memoryProvider()
+{
+  return pMemoryProvider_;
+}
+
+/** Sets the alignment of the data buffers that the pool allocates.
+  * \param[in] alignment The alignment in bytes, e.g. 64 for aligned SIMD loads or 4096 for O_DIRECT I/O.
+  *            It must be 0 (default malloc alignment) or a power of 2 that is a multiple of sizeof(void *).
+  *
+  * Buffers that are already allocated keep their alignment until they are reallocated, 
+  * so this should be called before the detector starts acquiring. */
+int NDArrayPool::setAlignment(size_t alignment)
+{
+  const char *functionName = "setAlignment";
+
+  if ((alignment != 0) && 
+      (((alignment & (alignment - 1)) != 0) || (alignment % sizeof(void *) != 0))) {
+    printf("%s:%s: ERROR, alignment=%lu must be 0 or a power of 2 that is a multiple of %d\n",
+           driverName, functionName, (unsigned long)alignment, (int)sizeof(void *));
+    return ND_ERROR;
+  }
+  epicsMutexLock(listLock_);
+  alignment_ = alignment;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the alignment of the data buffers that the pool allocates; 0=default malloc alignment */
+size_t NDArrayPool::alignment()
+{
+  return alignment_;
+}
+
+/** Sets the huge page mode for the data buffers that the pool allocates.
+  * \param[in] mode The huge page mode.  Huge pages are only supported on Linux.
+  * \param[in] threshold Buffers smaller than this number of bytes never use huge pages; 0 selects the huge page size (2 MB).
+  *
+  * Huge pages reduce the number of page faults and TLB misses for large frames. 
+  * Buffers that are already allocated are not changed until they are reallocated. */
+int NDArrayPool::setHugePages(NDHugePages_t mode, size_t threshold)
+{
+  const char *functionName = "setHugePages";
+
+  if ((mode < NDHugePagesNone) || (mode > NDHugePagesExplicit)) {
+    printf("%s:%s: ERROR, invalid huge page mode=%d\n",
+           driverName, functionName, mode);
+    return ND_ERROR;
+  }
+  #ifndef __linux__
+  if (mode != NDHugePagesNone) {
+    printf("%s:%s: WARNING, huge pages are only supported on Linux\n",
+           driverName, functionName);
+  }
+  #endif
+  if (threshold == 0) threshold = HUGE_PAGE_SIZE;
+  epicsMutexLock(listLock_);
+  hugePages_ = mode;
+  hugePageThreshold_ = threshold;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the huge page mode for the data buffers that the pool allocates */
+NDHugePages_t NDArrayPool::hugePages()
+{
+  return hugePages_;
+}
+
+/** Sets the NUMA placement policy for the data buffers that the pool allocates.
+  * Free arrays are kept on a separate free list for each NUMA node, and alloc() first looks for a free
+  * array on the node selected by the policy. A buffer taken from another node is reallocated on the right node.
+  * \param[in] policy The NUMA policy.  NUMA placement is only supported on Linux.
+  * \param[in] node The NUMA node for the NDNumaBind policy.
+  *
+  * Threads that use the arrays should run on the same node, see NDPluginDriver::setNumaNode().
+  */
+int NDArrayPool::setNumaPolicy(NDNumaPolicy_t policy, int node)
+{
+  const char *functionName = "setNumaPolicy";
+
+  if ((policy < NDNumaNone) || (policy > NDNumaLocal)) {
+    printf("%s:%s: ERROR, invalid NUMA policy=%d\n",
+           driverName, functionName, policy);
+    return ND_ERROR;
+  }
+  if ((policy == NDNumaBind) && ((node < 0) || (node >= NDNumaNumNodes()))) {
+    printf("%s:%s: ERROR, invalid NUMA node=%d, number of nodes=%d\n",
+           driverName, functionName, node, NDNumaNumNodes());
+    return ND_ERROR;
+  }
+  #ifndef __linux__
+  if (policy != NDNumaNone) {
+    printf("%s:%s: WARNING, NUMA placement is only supported on Linux\n",
+           driverName, functionName);
+  }
+  #endif
+  epicsMutexLock(listLock_);
+  numaPolicy_ = policy;
+  numaNode_ = (policy == NDNumaBind) ? node : 0;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the NUMA placement policy for the data buffers that the pool allocates */
+NDNumaPolicy_t NDArrayPool::numaPolicy()
+{
+  return numaPolicy_;
+}
+
+/** Returns the NUMA node for the NDNumaBind policy */
+int NDArrayPool::numaNode()
+{
+  return numaNode_;
+}
+
+/** Sets the number of worker threads that convert() uses when it extracts a region, bins or reverses
+  * an array.  The outermost dimension of the output array is split into blocks that the worker threads
+  * and the calling thread convert in parallel.
+  * \param[in] numThreads The number of worker threads; 0=convert in the calling thread.
+  * \param[in] minBytes The minimum size of the output array in bytes for which the worker threads are used;
+  * smaller arrays are converted in the calling thread because waking the threads costs more than it saves.
+  *
+  * The threads are created when they are first needed.  Changing the number of threads stops the old threads,
+  * so this should be done before arrays are being converted, normally in the startup script.
+  * If several threads call convert() at the same time only one of them uses the worker threads.
+  */
+int NDArrayPool::setConvertThreads(int numThreads, size_t minBytes)
+{
+  NDWorkerPool *pOldWorkers = 0;
+  const char *functionName = "setConvertThreads";
+
+  if (numThreads < 0) {
+    printf("%s:%s: ERROR, invalid number of threads=%d\n",
+           driverName, functionName, numThreads);
+    return ND_ERROR;
+  }
+  epicsMutexLock(listLock_);
+  if (numThreads != convertThreads_) {
+    pOldWorkers = pConvertWorkers_;
+    pConvertWorkers_ = (numThreads > 0) ? new NDWorkerPool("NDArrayPoolConvert", numThreads) : 0;
+    convertThreads_ = numThreads;
+  }
+  convertMinBytes_ = minBytes;
+  epicsMutexUnlock(listLock_);
+  delete pOldWorkers;
+  return ND_SUCCESS;
+}
+
+/** Returns the number of worker threads that convert() uses */
+int NDArrayPool::convertThreads()
+{
+  return convertThreads_;
+}
+
+/** Returns the minimum output size in bytes for which convert() uses the worker threads */
+size_t NDArrayPool::convertMinBytes()
+{
+  return convertMinBytes_;
+}
+
+/** Selects whether copy(), createView() and convert() share the attribute list of the input array with the
+  * output array rather than copying it.  The attributes are then copied only when one of the arrays modifies
+  * its list, see NDAttributeList::share().  Code that uses this must not modify attributes returned by
+  * NDAttributeList::find() or next(); it must change them with NDAttributeList::add().
+  * \param[in] share true to share the attribute lists, false to copy them.
+  */
+void NDArrayPool::setShareAttributes(bool share)
+{
+  shareAttributes_ = share;
+}
+
+/** Returns true if copy(), createView() and convert() share the attribute lists */
+bool NDArrayPool::shareAttributes()
+{
+  return shareAttributes_;
+}
+
+/** Sets the policy that alloc() uses to choose the free buffers to evict when the pool has reached maxMemory.
+  * \param[in] policy One of the NDPoolEviction_t values.
+  */
+int NDArrayPool::setEvictionPolicy(NDPoolEviction_t policy)
+{
+  const char *functionName = "setEvictionPolicy";
+
+  if ((policy < NDPoolEvictSmallest) || (policy > NDPoolEvictLRU)) {
+    printf("%s:%s: ERROR, invalid policy=%d\n", driverName, functionName, policy);
+    return ND_ERROR;
+  }
+  epicsMutexLock(listLock_);
+  evictionPolicy_ = policy;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the policy that alloc() uses to choose the free buffers to evict */
+NDPoolEviction_t NDArrayPool::evictionPolicy()
+{
+  return evictionPolicy_;
+}
+
+/** Sets the time after which a background thread frees the buffers of free arrays that have not been used,
+  * so that the memory of an idle pool is returned without alloc() having to evict buffers.
+  * The thread is started by the first call with idleTime>0; it checks the free lists every idleTime/2 seconds.
+  * \param[in] idleTime The idle time in seconds; 0 stops trimming.
+  */
+int NDArrayPool::setTrimIdleTime(double idleTime)
+{
+  const char *functionName = "setTrimIdleTime";
+
+  if (idleTime < 0.) {
+    printf("%s:%s: ERROR, invalid idle time=%f\n", driverName, functionName, idleTime);
+    return ND_ERROR;
+  }
+  epicsMutexLock(listLock_);
+  trimIdleTime_ = idleTime;
+  if (!trimThreadId_ && (idleTime > 0.)) {
+    trimEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    trimExitEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    trimThreadId_ = epicsThreadCreate("NDArrayPoolTrim", epicsThreadPriorityLow,
+                                      epicsThreadGetStackSize(epicsThreadStackSmall),
+                                      (EPICSTHREADFUNC)trimTask, this);
+  }
+  epicsMutexUnlock(listLock_);
+  if (trimThreadId_) epicsEventSignal(trimEvent_);
+  return ND_SUCCESS;
+}
+
+/** Returns the idle time after which free buffers are trimmed; 0=never */
+double NDArrayPool::trimIdleTime()
+{
+  return trimIdleTime_;
+}
+
+/** Frees the buffers of free arrays that have been on the free list for at least idleTime seconds.
+  * The lock is released after each buffer, so alloc() never waits for more than one buffer to be freed.
+  * \param[in] idleTime The idle time in seconds.
+  * \return The number of bytes freed.
+  */
+size_t NDArrayPool::trim(double idleTime)
+{
+  NDArray *pArray, *pIdle;
+  epicsTimeStamp now;
+  size_t sc, freedBytes = 0;
+  int node;
+
+  epicsTimeGetCurrent(&now);
+  do {
+    pIdle = NULL;
+    epicsMutexLock(listLock_);
+    /* Arrays are appended to the free lists when they are released, so only the first of each list needs checking */
+    for (sc=1; (sc<ND_ARRAY_POOL_SIZE_CLASSES) && !pIdle; sc++) {
+      for (node=0; (node<ND_NUMA_MAX_NODES) && !pIdle; node++) {
+        pArray = (NDArray *)ellFirst(&freeList_[node][sc]);
+        if (pArray && (epicsTimeDiffInSeconds(&now, &pArray->freeTime) >= idleTime)) pIdle = pArray;
+      }
+    }
+    if (pIdle) {
+      removeFreeArray(pIdle);
+      freedBytes += pIdle->dataSize;
+      memorySize_ -= pIdle->dataSize;
+      freeMemory(pIdle);
+      addFreeArray(pIdle);
+      stats_.trimmedBuffers++;
+    }
+    epicsMutexUnlock(listLock_);
+  } while (pIdle);
+  return freedBytes;
+}
+
+/** The trimmer thread, which calls trim() every trimIdleTime/2 seconds until the pool is deleted. */
+void NDArrayPool::trimTask(void *pPvt)
+{
+  NDArrayPool *pPool = (NDArrayPool *)pPvt;
+  double idleTime;
+  bool exit;
+
+  while (1) {
+    epicsMutexLock(pPool->listLock_);
+    idleTime = pPool->trimIdleTime_;
+    epicsMutexUnlock(pPool->listLock_);
+    if (idleTime > 0.) epicsEventWaitWithTimeout(pPool->trimEvent_, idleTime/2.);
+    else epicsEventMustWait(pPool->trimEvent_);
+    epicsMutexLock(pPool->listLock_);
+    exit = pPool->trimExit_;
+    idleTime = pPool->trimIdleTime_;
+    epicsMutexUnlock(pPool->listLock_);
+    if (exit) break;
+    if (idleTime > 0.) pPool->trim(idleTime);
+  }
+  epicsEventSignal(pPool->trimExitEvent_);
+}
+
+/** Copies the elements of a strided array to a contiguous buffer, one dimension at a time.
+  * \return Pointer to the output buffer after the last element copied. */
+static char* copyStridedDimension(const char *pIn, char *pOut, int dim, NDDimension_t *dims,
+                                  size_t *strides, int bytesPerElement)
+{
+  size_t i;
+  size_t step = strides[dim] * bytesPerElement;
+
+  if (dim == 0) {
+    if (strides[0] == 1) {
+      memcpy(pOut, pIn, dims[0].size * bytesPerElement);
+      return pOut + dims[0].size * bytesPerElement;
+    }
+    for (i=0; i<dims[0].size; i++) {
+      memcpy(pOut, pIn, bytesPerElement);
+      pIn += step;
+      pOut += bytesPerElement;
+    }
+    return pOut;
+  }
+  for (i=0; i<dims[dim].size; i++) {
+    pOut = copyStridedDimension(pIn, pOut, dim-1, dims, strides, bytesPerElement);
+    pIn += step;
+  }
+  return pOut;
+}
+
+/** Copies data for copy(), from and to host memory or the memory of a device.  A copy from a device waits for
+  * the work queued on its stream, and the copy is done when this returns.
+  * \param[in] pFromDevice The device of pFrom, or NULL for host memory.
+  * \param[in] fromStream The stream that pFrom is written on.
+  * \param[in] pToDevice The device of pTo, or NULL for host memory.
+  * \return ND_SUCCESS, or ND_ERROR if the device fails or the memory is on two devices. */
+static int copyBytes(NDDeviceMemory *pFromDevice, const void *pFrom, void *fromStream,
+                     NDDeviceMemory *pToDevice, void *pTo, size_t bytes)
+{
+  int status;
+
+  if (!pFromDevice && !pToDevice) {
+    memcpy(pTo, pFrom, bytes);
+    return ND_SUCCESS;
+  }
+  if (!pToDevice) return pFromDevice->toHost(pTo, pFrom, bytes, fromStream);
+  if (!pFromDevice) {
+    status = pToDevice->toDevice(pTo, pFrom, bytes, NULL);
+    if (status == ND_SUCCESS) status = pToDevice->synchronize(NULL);
+    return status;
+  }
+  if (pFromDevice != pToDevice) return ND_ERROR;
+  status = pToDevice->copyDevice(pTo, pFrom, bytes, fromStream);
+  if (status == ND_SUCCESS) status = pToDevice->synchronize(fromStream);
+  return status;
+}
+
 /** This method makes a copy of an NDArray object.
   * \param[in] pIn The input array to be copied.
   * \param[in] pOut The output array that will be copied to.
@@ -176,21 +1035,34 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   *
   * If pOut is NULL then it is first allocated. If the output array
   * object already exists (pOut!=NULL) then it must have sufficient memory allocated to
-  * it to hold the data.
+  * it to hold the data.  The codec is copied, and of a compressed array its compressedSize bytes.
+  * Either array can be in the memory of a device, see NDArray::pDevice; the output is allocated from this pool,
+  * so the copy of a device array from a pool of host memory is in host memory.  A strided view of a device array
+  * can only be copied to host memory.  If the data of a device array cannot be copied it returns NULL, and
+  * releases the output array if it allocated it.
   */
 NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, int copyData)
 {
-  //const char *functionName = "copy";
+  const char *functionName = "copy";
   size_t dimSizeOut[ND_ARRAY_MAX_DIMS];
   int i;
   size_t numCopy;
+  size_t dataSize = 0;
+  int status = ND_SUCCESS;
+  bool allocated = false;
   NDArrayInfo arrayInfo;
 
+  pIn->getInfo(&arrayInfo);
+  /* The compressed data can be larger than the array if it did not compress */
+  if (!pIn->codec.empty() && (pIn->compressedSize > arrayInfo.totalBytes)) dataSize = pIn->compressedSize;
+
   /* If the output array does not exist then create it */
   if (!pOut) {
     for (i=0; i<pIn->ndims; i++) dimSizeOut[i] = pIn->dims[i].size;
-    pOut = this->alloc(pIn->ndims, dimSizeOut, pIn->dataType, 0, NULL);
+    if (pIn->sparse) pOut = this->allocSparse(pIn->ndims, dimSizeOut, pIn->dataType, pIn->numEvents);
+    else pOut = this->alloc(pIn->ndims, dimSizeOut, pIn->dataType, dataSize, NULL);
     if(NULL==pOut) return NULL;
+    allocated = true;
   }
   pOut->uniqueId = pIn->uniqueId;
   pOut->timeStamp = pIn->timeStamp;
@@ -198,43 +1070,515 @@ NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, int copyData)
   pOut->ndims = pIn->ndims;
   memcpy(pOut->dims, pIn->dims, sizeof(pIn->dims));
   pOut->dataType = pIn->dataType;
-  if (copyData) {
-    pIn->getInfo(&arrayInfo);
+  pOut->codec = pIn->codec;
+  pOut->compressedSize = pIn->compressedSize;
+  pOut->sparse = pIn->sparse;
+  pOut->numEvents = pIn->numEvents;
+  pOut->stackFrames = pIn->stackFrames;
+  if (copyData && pIn->sparse) {
+    numCopy = NDSparseBytes(pIn->numEvents, arrayInfo.bytesPerElement);
+    if (pOut->dataSize >= numCopy) {
+      status = copyBytes(pIn->pDevice, pIn->pData, pIn->deviceStream, pOut->pDevice, pOut->pData, numCopy);
+    } else {
+      printf("%s:%s: ERROR, output array is too small for sparse data, size=%d, required=%d\n",
+             driverName, functionName, (int)pOut->dataSize, (int)numCopy);
+    }
+  } else if (copyData && !pIn->codec.empty()) {
+    numCopy = pIn->compressedSize;
+    if (pOut->dataSize >= numCopy) {
+      status = copyBytes(pIn->pDevice, pIn->pData, pIn->deviceStream, pOut->pDevice, pOut->pData, numCopy);
+    } else {
+      printf("%s:%s: ERROR, output array is too small for compressed data, size=%d, required=%d\n",
+             driverName, functionName, (int)pOut->dataSize, (int)numCopy);
+    }
+  } else if (copyData) {
     numCopy = arrayInfo.totalBytes;
-    if (pOut->dataSize < numCopy) numCopy = pOut->dataSize;
-    memcpy(pOut->pData, pIn->pData, numCopy);
+    if (pIn->isContiguous()) {
+      if (pOut->dataSize < numCopy) numCopy = pOut->dataSize;
+      status = copyBytes(pIn->pDevice, pIn->pData, pIn->deviceStream, pOut->pDevice, pOut->pData, numCopy);
+    } else if (pOut->pDevice) {
+      /* A strided view is only copied to host memory */
+      status = ND_ERROR;
+    } else if (pOut->dataSize >= numCopy) {
+      size_t strides[ND_ARRAY_MAX_DIMS];
+      const char *pFrom = (const char *)pIn->pData;
+      char *pHost = NULL;
+      if (pIn->pDevice) {
+        /* The elements of the view are copied from the region of the device that holds them */
+        pHost = (char *)malloc(pIn->dataSize);
+        if (!pHost || (pIn->pDevice->toHost(pHost, pIn->pData, pIn->dataSize, pIn->deviceStream) != ND_SUCCESS)) {
+          status = ND_ERROR;
+        }
+        pFrom = pHost;
+      }
+      pIn->getStrides(strides);
+      if (status == ND_SUCCESS) {
+        copyStridedDimension(pFrom, (char *)pOut->pData, pIn->ndims-1,
+                             pIn->dims, strides, arrayInfo.bytesPerElement);
+      }
+      free(pHost);
+    } else {
+      printf("%s:%s: ERROR, output array is too small for strided copy, size=%d, required=%d\n",
+             driverName, functionName, (int)pOut->dataSize, (int)numCopy);
+    }
+  }
+  if (status != ND_SUCCESS) {
+    printf("%s:%s: ERROR, cannot copy the data of a device array\n",
+           driverName, functionName);
+    if (allocated) pOut->release();
+    return NULL;
+  }
+  if (shareAttributes_) {
+    pIn->pAttributeList->share(pOut->pAttributeList);
+  } else {
+    pOut->pAttributeList->clear();
+    pIn->pAttributeList->copy(pOut->pAttributeList);
+  }
+  return(pOut);
+}
+
+/** Creates a view of a region of an array without copying the data.
+  * The view shares the buffer of the parent array, which is reserved until the view is released.
+  * The view is not contiguous unless the region consists of complete rows (planes, etc.), see NDArray::isContiguous().
+  * \param[in] pParent The array to create a view of; it can itself be a view.
+  * \param[in] dims The region of the parent, one NDDimension_t per dimension of the parent;
+  *            only offset and size are used, binning must be 1 and reverse must be 0.
+  * \return The view with a reference count of 1, or NULL if the region is invalid or no NDArray is available.
+  * A view of a compressed array must be of the whole array, and shares its compressed data and codec, as must a view
+  * of an array of a packed data type, whose elements cannot be addressed on their own.
+  * Sparse arrays have no views.
+  */
+NDArray* NDArrayPool::createView(NDArray *pParent, NDDimension_t *dims)
+{
+  NDArray *pView;
+  NDArray *pOwner = pParent->pViewParent ? pParent->pViewParent : pParent;
+  NDArrayInfo_t arrayInfo;
+  size_t parentStrides[ND_ARRAY_MAX_DIMS];
+  size_t dimSize[ND_ARRAY_MAX_DIMS];
+  size_t offset = 0, lastElement = 0;
+  int i;
+  const char *functionName = "createView";
+
+  if (pParent->sparse) {
+    printf("%s:%s: ERROR, cannot create a view of a sparse array\n",
+           driverName, functionName);
+    return NULL;
+  }
+  pParent->getInfo(&arrayInfo);
+  pParent->getStrides(parentStrides);
+  for (i=0; i<pParent->ndims; i++) {
+    if ((dims[i].size == 0) || (dims[i].offset + dims[i].size > pParent->dims[i].size) ||
+        (dims[i].binning > 1) || dims[i].reverse) {
+      printf("%s:%s: ERROR, invalid view dimension %d, offset=%d, size=%d, binning=%d, reverse=%d\n",
+             driverName, functionName, i, (int)dims[i].offset, (int)dims[i].size,
+             dims[i].binning, dims[i].reverse);
+      return NULL;
+    }
+    if (!pParent->codec.empty() && (dims[i].size != pParent->dims[i].size)) {
+      printf("%s:%s: ERROR, a view of an array compressed with codec %s must be of the whole array\n",
+             driverName, functionName, pParent->codec.name.c_str());
+      return NULL;
+    }
+    if (NDPackedBits(pParent->dataType) && (dims[i].size != pParent->dims[i].size)) {
+      printf("%s:%s: ERROR, a view of an array of packed data type %d must be of the whole array\n",
+             driverName, functionName, pParent->dataType);
+      return NULL;
+    }
+    dimSize[i] = dims[i].size;
+    offset += dims[i].offset * parentStrides[i];
+    lastElement += (dims[i].size - 1) * parentStrides[i];
+  }
+  pView = alloc(pParent->ndims, dimSize, pParent->dataType, 0,
+                (char *)pParent->pData + offset * arrayInfo.bytesPerElement);
+  if (!pView) return NULL;
+
+  /* The parent must be reserved before the view can be released */
+  pOwner->reserve();
+  pView->pViewParent = pOwner;
+  pView->dataSize = (lastElement + 1) * arrayInfo.bytesPerElement;
+  if (!pParent->codec.empty()) {
+    pView->codec = pParent->codec;
+    pView->compressedSize = pParent->compressedSize;
+    pView->dataSize = pParent->dataSize;
+  } else if (NDPackedBits(pParent->dataType)) {
+    pView->dataSize = arrayInfo.totalBytes;
+  }
+  for (i=0; i<pParent->ndims; i++) {
+    pView->strides[i] = parentStrides[i];
+    pView->dims[i].offset = pParent->dims[i].offset + dims[i].offset;
+    pView->dims[i].binning = pParent->dims[i].binning;
+    pView->dims[i].reverse = pParent->dims[i].reverse;
+  }
+  pView->pDevice = pParent->pDevice;
+  pView->deviceStream = pParent->deviceStream;
+  pView->uniqueId = pParent->uniqueId;
+  pView->timeStamp = pParent->timeStamp;
+  pView->epicsTS = pParent->epicsTS;
+  i = pParent->ndims - 1;
+  if (pParent->stackFrames.size() >= dims[i].offset + dims[i].size) {
+    /* A view of a frame stack holds the frames of its range of the slowest dimension */
+    pView->stackFrames.assign(pParent->stackFrames.begin() + dims[i].offset,
+                              pParent->stackFrames.begin() + dims[i].offset + dims[i].size);
+  }
+  if (shareAttributes_) {
+    pParent->pAttributeList->share(pView->pAttributeList);
+  } else {
+    pView->pAttributeList->clear();
+    pParent->pAttributeList->copy(pView->pAttributeList);
+  }
+  return pView;
+}
+
+/** Creates a view of one frame of a frame stack without copying the data, see NDArray::stackFrames.
+  * The view has the dimensions of the frame, all but the slowest of the stack, and the uniqueId and time stamps
+  * of the frame.  It shares the buffer of the stack, which is reserved until the view is released.
+  * \param[in] pStack The frame stack; it can itself be a view.
+  * \param[in] frame The index of the frame in the stack.
+  * \return The view with a reference count of 1, or NULL if the frame is not in the stack or no NDArray is
+  * available.  Frame stacks that are sparse, compressed or of a packed data type have no views of their frames.
+  */
+NDArray* NDArrayPool::stackFrame(NDArray *pStack, size_t frame)
+{
+  NDArray *pView;
+  NDArray *pOwner = pStack->pViewParent ? pStack->pViewParent : pStack;
+  NDArrayInfo_t arrayInfo;
+  size_t strides[ND_ARRAY_MAX_DIMS];
+  size_t dimSize[ND_ARRAY_MAX_DIMS];
+  size_t lastElement = 0;
+  int ndims = pStack->ndims - 1;
+  int i;
+  const char *functionName = "stackFrame";
+
+  if ((ndims < 1) || (frame >= pStack->stackFrames.size()) || (frame >= pStack->dims[ndims].size) ||
+      pStack->sparse || !pStack->codec.empty() || NDPackedBits(pStack->dataType)) {
+    printf("%s:%s: ERROR, cannot create a view of frame %d of the array\n",
+           driverName, functionName, (int)frame);
+    return NULL;
+  }
+  pStack->getInfo(&arrayInfo);
+  pStack->getStrides(strides);
+  for (i=0; i<ndims; i++) {
+    dimSize[i] = pStack->dims[i].size;
+    lastElement += (dimSize[i] - 1) * strides[i];
+  }
+  pView = alloc(ndims, dimSize, pStack->dataType, 0,
+                (char *)pStack->pData + frame * strides[ndims] * arrayInfo.bytesPerElement);
+  if (!pView) return NULL;
+
+  /* The stack must be reserved before the view can be released */
+  pOwner->reserve();
+  pView->pViewParent = pOwner;
+  pView->dataSize = (lastElement + 1) * arrayInfo.bytesPerElement;
+  for (i=0; i<ndims; i++) {
+    pView->strides[i] = strides[i];
+    pView->dims[i] = pStack->dims[i];
+  }
+  pView->pDevice = pStack->pDevice;
+  pView->deviceStream = pStack->deviceStream;
+  pView->uniqueId = pStack->stackFrames[frame].uniqueId;
+  pView->timeStamp = pStack->stackFrames[frame].timeStamp;
+  pView->epicsTS = pStack->stackFrames[frame].epicsTS;
+  if (shareAttributes_) {
+    pStack->pAttributeList->share(pView->pAttributeList);
+  } else {
+    pView->pAttributeList->clear();
+    pStack->pAttributeList->copy(pView->pAttributeList);
+  }
+  return pView;
+}
+
+/* Counts the non-zero elements of a dense array, then allocates the sparse array and fills in its events */
+template <typename epicsType> NDArray* sparseFromDense(NDArrayPool *pPool, NDArray *pIn)
+{
+  const epicsType *pData = (const epicsType *)pIn->pData;
+  size_t dimSize[ND_ARRAY_MAX_DIMS];
+  NDArrayInfo_t arrayInfo;
+  epicsUInt32 *pIndices;
+  epicsType *pValues;
+  NDArray *pOut;
+  size_t numEvents = 0;
+  size_t i;
+  int dim;
+
+  pIn->getInfo(&arrayInfo);
+  for (i=0; i<arrayInfo.nElements; i++) {
+    if (pData[i] != 0) numEvents++;
+  }
+  for (dim=0; dim<pIn->ndims; dim++) dimSize[dim] = pIn->dims[dim].size;
+  pOut = pPool->allocSparse(pIn->ndims, dimSize, pIn->dataType, numEvents);
+  if (!pOut) return NULL;
+  pIndices = pOut->eventIndices();
+  pValues = (epicsType *)pOut->eventValues();
+  for (i=0; i<arrayInfo.nElements; i++) {
+    if (pData[i] != 0) {
+      *pIndices++ = (epicsUInt32)i;
+      *pValues++ = pData[i];
+    }
+  }
+  return pOut;
+}
+
+/* Writes the values of the events of a sparse array into the zeroed elements of a dense array.  The values are
+ * copied as unsigned integers of their size, since they are not converted. */
+template <typename elementType> void scatterEvents(NDArray *pIn, void *pDataOut)
+{
+  const epicsUInt32 *pIndices = pIn->eventIndices();
+  const elementType *pValues = (const elementType *)pIn->eventValues();
+  elementType *pOut = (elementType *)pDataOut;
+  size_t i;
+
+  for (i=0; i<pIn->numEvents; i++) pOut[pIndices[i]] = pValues[i];
+}
+
+/** Returns an array with the same contents as the input whose data is contiguous.
+  * If the input is already contiguous it is reserved and returned, otherwise a contiguous copy is allocated.
+  * The caller must release the output array.
+  * \param[in] pIn The input array, normally a view.
+  * \param[out] ppOut The contiguous array.
+  */
+int NDArrayPool::makeContiguous(NDArray *pIn, NDArray **ppOut)
+{
+  const char *functionName = "makeContiguous";
+
+  if (pIn->isContiguous()) {
+    pIn->reserve();
+    *ppOut = pIn;
+    return ND_SUCCESS;
+  }
+  *ppOut = copy(pIn, NULL, 1);
+  if (!*ppOut) {
+    printf("%s:%s: ERROR, cannot allocate contiguous array\n",
+           driverName, functionName);
+    return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Returns a sparse array with the same contents as the input, whose non-zero elements are its events.
+  * If the input is already sparse it is reserved and returned, otherwise a sparse copy is allocated.
+  * The caller must release the output array.
+  * \param[in] pIn The input array; it cannot be compressed or of a packed data type.
+  * \param[out] ppOut The sparse array.
+  */
+int NDArrayPool::makeSparse(NDArray *pIn, NDArray **ppOut)
+{
+  NDArray *pContiguous;
+  NDArray *pOut = NULL;
+  size_t numEvents;
+  int status;
+  const char *functionName = "makeSparse";
+
+  *ppOut = NULL;
+  if (pIn->sparse) {
+    pIn->reserve();
+    *ppOut = pIn;
+    return ND_SUCCESS;
+  }
+  if (!pIn->codec.empty() || NDPackedBits(pIn->dataType)) {
+    printf("%s:%s: ERROR, compressed arrays and packed data types cannot be made sparse\n",
+           driverName, functionName);
+    return ND_ERROR;
+  }
+  status = makeContiguous(pIn, &pContiguous);
+  if (status != ND_SUCCESS) return status;
+  switch(pIn->dataType) {
+    case NDInt8:
+      pOut = sparseFromDense <epicsInt8> (this, pContiguous);
+      break;
+    case NDUInt8:
+      pOut = sparseFromDense <epicsUInt8> (this, pContiguous);
+      break;
+    case NDInt16:
+      pOut = sparseFromDense <epicsInt16> (this, pContiguous);
+      break;
+    case NDUInt16:
+      pOut = sparseFromDense <epicsUInt16> (this, pContiguous);
+      break;
+    case NDInt32:
+      pOut = sparseFromDense <epicsInt32> (this, pContiguous);
+      break;
+    case NDUInt32:
+      pOut = sparseFromDense <epicsUInt32> (this, pContiguous);
+      break;
+    case NDFloat32:
+      pOut = sparseFromDense <epicsFloat32> (this, pContiguous);
+      break;
+    case NDFloat64:
+      pOut = sparseFromDense <epicsFloat64> (this, pContiguous);
+      break;
+    case NDFloat16:
+      pOut = sparseFromDense <NDFloat16_t> (this, pContiguous);
+      break;
+    default:
+      break;
+  }
+  if (!pOut) {
+    printf("%s:%s: ERROR, cannot allocate sparse array\n",
+           driverName, functionName);
+    pContiguous->release();
+    return ND_ERROR;
+  }
+  /* Copy the rest of the fields, which also copies the sparse fields of the dense input */
+  numEvents = pOut->numEvents;
+  copy(pContiguous, pOut, 0);
+  pOut->sparse = 1;
+  pOut->numEvents = numEvents;
+  pContiguous->release();
+  *ppOut = pOut;
+  return ND_SUCCESS;
+}
+
+/** Returns a dense array with the same contents as the input, for the plugins that do not support sparse arrays.
+  * If the input is not sparse it is reserved and returned, otherwise a dense copy is allocated.
+  * The caller must release the output array.
+  * \param[in] pIn The input array.
+  * \param[out] ppOut The dense array.
+  */
+int NDArrayPool::makeDense(NDArray *pIn, NDArray **ppOut)
+{
+  NDArrayInfo_t arrayInfo;
+  size_t dimSize[ND_ARRAY_MAX_DIMS];
+  NDArray *pOut;
+  int i;
+  const char *functionName = "makeDense";
+
+  *ppOut = NULL;
+  if (!pIn->sparse) {
+    pIn->reserve();
+    *ppOut = pIn;
+    return ND_SUCCESS;
+  }
+  for (i=0; i<pIn->ndims; i++) dimSize[i] = pIn->dims[i].size;
+  pOut = alloc(pIn->ndims, dimSize, pIn->dataType, 0, NULL);
+  if (!pOut) {
+    printf("%s:%s: ERROR, cannot allocate dense array\n",
+           driverName, functionName);
+    return ND_ERROR;
+  }
+  copy(pIn, pOut, 0);
+  pOut->sparse = 0;
+  pOut->numEvents = 0;
+  pOut->getInfo(&arrayInfo);
+  memset(pOut->pData, 0, arrayInfo.totalBytes);
+  switch(arrayInfo.bytesPerElement) {
+    case 1:
+      scatterEvents <epicsUInt8> (pIn, pOut->pData);
+      break;
+    case 2:
+      scatterEvents <epicsUInt16> (pIn, pOut->pData);
+      break;
+    case 4:
+      scatterEvents <epicsUInt32> (pIn, pOut->pData);
+      break;
+    default:
+      scatterEvents <epicsUInt64> (pIn, pOut->pData);
+      break;
+  }
+  *ppOut = pOut;
+  return ND_SUCCESS;
+}
+
+/** Pre-allocates NDArray objects and their buffers and places them on the free list, so that later calls to
+  * alloc() do not have to create them.
+  * \param[in] numBuffers The number of buffers.
+  * \param[in] dataSize The size of each buffer in bytes.
+  *
+  * Each buffer is written once so the operating system maps its pages now rather than on first use.
+  * Free buffers that are already large enough are reused, so after this call the pool has at least numBuffers
+  * free buffers of dataSize bytes.  This should be done before acquisition starts.
+  */
+int NDArrayPool::preAllocate(int numBuffers, size_t dataSize)
+{
+  std::vector<NDArray *> arrays;
+  NDArray *pArray;
+  size_t dims[1];
+  int status = ND_SUCCESS;
+  int i;
+  const char *functionName = "preAllocate";
+
+  if ((numBuffers < 0) || (dataSize == 0)) {
+    printf("%s:%s: ERROR, invalid numBuffers=%d or dataSize=%lu\n",
+           driverName, functionName, numBuffers, (unsigned long)dataSize);
+    return ND_ERROR;
+  }
+  dims[0] = dataSize;
+  for (i=0; i<numBuffers; i++) {
+    pArray = alloc(1, dims, NDInt8, dataSize, NULL);
+    if (!pArray) {
+      printf("%s:%s: ERROR, only allocated %d of %d buffers\n",
+             driverName, functionName, i, numBuffers);
+      status = ND_ERROR;
+      break;
+    }
+    memset(pArray->pData, 0, dataSize);
+    arrays.push_back(pArray);
+  }
+  for (i=0; i<(int)arrays.size(); i++) arrays[i]->release();
+  return status;
+}
+
+/** This method increases the reference count for the NDArray object.
+  * \param[in] pArray The array on which to increase the reference count.
+  *
+  * Plugins must call reserve() when an NDArray is placed on a queue for later
+  * processing.
+  * The reference count is incremented atomically, the pool mutex is not taken.
+  */
+int NDArrayPool::reserve(NDArray *pArray)
+{
+  int referenceCount;
+  const char *functionName = "reserve";
+
+  /* Make sure we own this array */
+  if (pArray->pNDArrayPool != this) {
+    printf("%s:%s: ERROR, not owner!  owner=%p, should be this=%p\n",
+         driverName, functionName, pArray->pNDArrayPool, this);
+    return(ND_ERROR);
+  }
+  referenceCount = epicsAtomicIncrIntT(&pArray->referenceCount);
+  //printf("NDArrayPool::reserve pArray=%p, count=%d\n", pArray, referenceCount);
+  // If the reference count was less than 1 then something is wrong, this NDArray has been released.
+  if (referenceCount < 2) {
+    cantProceed("%s:reserve ERROR, reference count = %d, should be >= 1, pArray=%p\n",
+           driverName, referenceCount-1, pArray);
   }
-  pOut->pAttributeList->clear();
-  pIn->pAttributeList->copy(pOut->pAttributeList);
-  return(pOut);
+  return ND_SUCCESS;
 }
 
-/** This method increases the reference count for the NDArray object.
+/** This method increases the reference count for the NDArray object on behalf of a consumer, and counts the
+  * array in the arrays of the pool that the consumer holds.  If the consumer already holds its quota of arrays
+  * of the pool the array is not reserved and the refusal is counted, so the consumer drops the array rather
+  * than take the buffers that the driver needs.  The consumer must release the array with
+  * release(NDArray*, NDPoolConsumer*).
   * \param[in] pArray The array on which to increase the reference count.
-  *
-  * Plugins must call reserve() when an NDArray is placed on a queue for later
-  * processing.
+  * \param[in] pConsumer The consumer; NULL is the same as reserve(NDArray*).
+  * \return ND_SUCCESS, or ND_ERROR if the consumer is at its quota or the pool does not own the array.
   */
-int NDArrayPool::reserve(NDArray *pArray)
+int NDArrayPool::reserve(NDArray *pArray, NDPoolConsumer *pConsumer)
 {
+  NDPoolConsumerStats_t *pStats;
   const char *functionName = "reserve";
 
-  /* Make sure we own this array */
+  if (!pConsumer) return reserve(pArray);
   if (pArray->pNDArrayPool != this) {
     printf("%s:%s: ERROR, not owner!  owner=%p, should be this=%p\n",
          driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  //printf("NDArrayPool::reserve pArray=%p, count=%d\n", pArray, pArray->referenceCount);
-  epicsMutexLock(listLock_);
-  // If the reference count is less than 1 then something is wrong, this NDArray has been released.
-  if (pArray->referenceCount < 1) {
-    cantProceed("%s:reserve ERROR, reference count = %d, should be >= 1, pArray=%p\n",
-           driverName, pArray->referenceCount, pArray);
+  epicsMutexLock(consumerLock_);
+  pStats = &consumers_[pConsumer];
+  if (pStats->name != pConsumer->name) pStats->name = pConsumer->name;
+  pStats->quota = pConsumer->quota;
+  if ((pConsumer->quota > 0) && (pStats->held >= pConsumer->quota)) {
+    pStats->refused++;
+    epicsMutexUnlock(consumerLock_);
+    return ND_ERROR;
   }
-  pArray->referenceCount++;
-  epicsMutexUnlock(listLock_);
-  return ND_SUCCESS;
+  pStats->held++;
+  if (pStats->held > pStats->maxHeld) pStats->maxHeld = pStats->held;
+  epicsMutexUnlock(consumerLock_);
+  epicsAtomicIncrIntT(&pConsumer->held);
+  return reserve(pArray);
 }
 
 /** This method decreases the reference count for the NDArray object.
@@ -244,9 +1588,12 @@ int NDArrayPool::reserve(NDArray *pArray)
   * Plugins must call release() when an NDArray is removed from the queue and
   * processing on it is complete. Drivers must call release() after calling all
   * plugins.
+  * The reference count is decremented atomically, the pool mutex is only taken
+  * when the count reaches 0 and the array is put back on the free list.
   */
 int NDArrayPool::release(NDArray *pArray)
 {
+  int referenceCount;
   const char *functionName = "release";
 
   /* Make sure we own this array */
@@ -255,22 +1602,56 @@ int NDArrayPool::release(NDArray *pArray)
            driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  //printf("NDArrayPool::release pArray=%p, count=%d\n", pArray, pArray->referenceCount);
-  epicsMutexLock(listLock_);
-  pArray->referenceCount--;
-  if (pArray->referenceCount == 0) {
+  referenceCount = epicsAtomicDecrIntT(&pArray->referenceCount);
+  //printf("NDArrayPool::release pArray=%p, count=%d\n", pArray, referenceCount);
+  if (referenceCount == 0) {
     /* The last user has released this image, add it back to the free list */
-    ellAdd(&freeList_, &pArray->node);
-    numFree_++;
+    NDArray *pViewParent = pArray->pViewParent;
+    NDArrayBufferOwner *pBufferOwner = pArray->pBufferOwner;
+    epicsMutexLock(listLock_);
+    if (pViewParent || pBufferOwner) {
+      /* The buffer of a view belongs to its parent, and wrapped memory to its owner */
+      pArray->pViewParent = NULL;
+      pArray->pBufferOwner = NULL;
+      pArray->pData = NULL;
+      pArray->dataSize = 0;
+    }
+    addFreeArray(pArray);
+    epicsMutexUnlock(listLock_);
+    if (pViewParent) pViewParent->release();
+    delete pBufferOwner;
   }
-  if (pArray->referenceCount < 0) {
+  if (referenceCount < 0) {
     cantProceed("%s:release ERROR, reference count < 0 pArray=%p\n",
            driverName, pArray);
   }
-  epicsMutexUnlock(listLock_);
   return ND_SUCCESS;
 }
 
+/** This method decreases the reference count for an NDArray object that a consumer reserved with
+  * reserve(NDArray*, NDPoolConsumer*), and removes it from the arrays that the consumer holds.
+  * \param[in] pArray The array on which to decrease the reference count.
+  * \param[in] pConsumer The consumer; NULL is the same as release(NDArray*).
+  */
+int NDArrayPool::release(NDArray *pArray, NDPoolConsumer *pConsumer)
+{
+  std::map<const NDPoolConsumer*, NDPoolConsumerStats_t>::iterator it;
+  const char *functionName = "release";
+
+  if (!pConsumer) return release(pArray);
+  if (pArray->pNDArrayPool != this) {
+    printf("%s:%s: ERROR, not owner!  owner=%p, should be this=%p\n",
+         driverName, functionName, pArray->pNDArrayPool, this);
+    return(ND_ERROR);
+  }
+  epicsMutexLock(consumerLock_);
+  it = consumers_.find(pConsumer);
+  if ((it != consumers_.end()) && (it->second.held > 0)) it->second.held--;
+  epicsMutexUnlock(consumerLock_);
+  epicsAtomicDecrIntT(&pConsumer->held);
+  return release(pArray);
+}
+
 template <typename dataTypeIn, typename dataTypeOut> void convertType(NDArray *pIn, NDArray *pOut)
 {
   size_t i;
@@ -313,6 +1694,9 @@ template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pO
     case NDFloat64:
       convertType<epicsFloat64, dataTypeOut> (pIn, pOut);
       break;
+    case NDFloat16:
+      convertType<NDFloat16_t, dataTypeOut> (pIn, pOut);
+      break;
     default:
       status = ND_ERROR;
       break;
@@ -322,7 +1706,8 @@ template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pO
 
 
 template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pIn, NDArray *pOut,
-                                                     void *pDataIn, void *pDataOut, int dim)
+                                                     void *pDataIn, void *pDataOut, int dim,
+                                                     size_t outStart, size_t outEnd)
 {
   dataTypeOut *pDOut = (dataTypeOut *)pDataOut;
   dataTypeIn *pDIn = (dataTypeIn *)pDataIn;
@@ -346,11 +1731,12 @@ template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pI
     inDir = -1;
   }
   inc = inDir * inStep;
-  pDIn += inOffset*inStep;
-  for (in=0, out=0; out<pOutDims[dim].size; out++, in++) {
+  pDIn += inOffset*inStep + outStart*pOutDims[dim].binning*inc;
+  pDOut += outStart*outStep;
+  for (in=outStart, out=outStart; out<outEnd; out++, in++) {
     for (bin=0; bin<pOutDims[dim].binning; bin++) {
       if (dim > 0) {
-        convertDim <dataTypeIn, dataTypeOut> (pIn, pOut, pDIn, pDOut, dim-1);
+        convertDim <dataTypeIn, dataTypeOut> (pIn, pOut, pDIn, pDOut, dim-1, 0, pOutDims[dim-1].size);
       } else {
         *pDOut += (dataTypeOut)*pDIn;
       }
@@ -361,34 +1747,38 @@ template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pI
 }
 
 template <typename dataTypeOut> int convertDimensionSwitch(NDArray *pIn, NDArray *pOut,
-                                                           void *pDataIn, void *pDataOut, int dim)
+                                                           void *pDataIn, void *pDataOut, int dim,
+                                                           size_t outStart, size_t outEnd)
 {
   int status = ND_SUCCESS;
 
   switch(pIn->dataType) {
     case NDInt8:
-      convertDim <epicsInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt8:
-      convertDim <epicsUInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt16:
-      convertDim <epicsInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt16:
-      convertDim <epicsUInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt32:
-      convertDim <epicsInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt32:
-      convertDim <epicsUInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat32:
-      convertDim <epicsFloat32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsFloat32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat64:
-      convertDim <epicsFloat64, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsFloat64, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDFloat16:
+      convertDim <NDFloat16_t, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     default:
       status = ND_ERROR;
@@ -401,38 +1791,197 @@ static int convertDimension(NDArray *pIn,
                             NDArray *pOut,
                             void *pDataIn,
                             void *pDataOut,
-                            int dim)
+                            int dim,
+                            size_t outStart,
+                            size_t outEnd)
 {
   int status = ND_SUCCESS;
   /* This routine is passed:
    * A pointer to the start of the input data
    * A pointer to the start of the output data
    * An array of dimensions
-   * A dimension index */
+   * A dimension index
+   * The range of output elements to compute in that dimension */
+  switch(pOut->dataType) {
+    case NDInt8:
+      convertDimensionSwitch <epicsInt8>(pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDUInt8:
+      convertDimensionSwitch <epicsUInt8> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDInt16:
+      convertDimensionSwitch <epicsInt16> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDUInt16:
+      convertDimensionSwitch <epicsUInt16> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDInt32:
+      convertDimensionSwitch <epicsInt32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDUInt32:
+      convertDimensionSwitch <epicsUInt32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDFloat32:
+      convertDimensionSwitch <epicsFloat32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDFloat64:
+      convertDimensionSwitch <epicsFloat64> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    case NDFloat16:
+      convertDimensionSwitch <NDFloat16_t> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
+      break;
+    default:
+      status = ND_ERROR;
+      break;
+  }
+  return(status);
+}
+
+/* The types that convertScaledDim() sums the binned elements of each input data type in before scaling */
+template <typename dataTypeIn> struct convertAccumulator {
+  typedef epicsInt64 type;
+};
+template <> struct convertAccumulator<epicsInt8> {
+  typedef epicsInt32 type;
+};
+template <> struct convertAccumulator<epicsUInt8> {
+  typedef epicsInt32 type;
+};
+template <> struct convertAccumulator<epicsFloat32> {
+  typedef double type;
+};
+template <> struct convertAccumulator<epicsFloat64> {
+  typedef double type;
+};
+template <> struct convertAccumulator<NDFloat16_t> {
+  typedef double type;
+};
+
+/* Computes the elements outStart to outEnd-1 of the outermost output dimension with scaling.
+ * The bins of each output slab are summed in a slab of the accumulator type, which is then divided by scale
+ * and written in the output type, so no intermediate array of the whole output is needed. */
+template <typename dataTypeIn, typename dataTypeOut> int convertScaledDim(NDArray *pIn, NDArray *pOut,
+                                                                          double scale,
+                                                                          size_t outStart, size_t outEnd)
+{
+  typedef typename convertAccumulator<dataTypeIn>::type accType;
+  NDDimension_t *pOutDims = pOut->dims;
+  NDDimension_t *pInDims = pIn->dims;
+  int dim = pOut->ndims-1;
+  size_t inStep, outStep, inOffset;
+  int inDir;
+  int i, bin;
+  size_t inc, out, j;
+  dataTypeIn *pDIn = (dataTypeIn *)pIn->pData;
+  dataTypeOut *pDOut = (dataTypeOut *)pOut->pData;
+  accType *pAcc;
+
+  inStep = 1;
+  outStep = 1;
+  inDir = 1;
+  inOffset = pOutDims[dim].offset;
+  for (i=0; i<dim; i++) {
+    inStep  *= pInDims[i].size;
+    outStep *= pOutDims[i].size;
+  }
+  if (pOutDims[dim].reverse) {
+    inOffset += pOutDims[dim].size * pOutDims[dim].binning - 1;
+    inDir = -1;
+  }
+  pAcc = (accType *)malloc(outStep * sizeof(accType));
+  if (!pAcc) return ND_ERROR;
+  inc = inDir * inStep;
+  pDIn += inOffset*inStep + outStart*pOutDims[dim].binning*inc;
+  pDOut += outStart*outStep;
+  for (out=outStart; out<outEnd; out++) {
+    memset(pAcc, 0, outStep * sizeof(accType));
+    for (bin=0; bin<pOutDims[dim].binning; bin++) {
+      if (dim > 0) {
+        convertDim <dataTypeIn, accType> (pIn, pOut, pDIn, pAcc, dim-1, 0, pOutDims[dim-1].size);
+      } else {
+        *pAcc += (accType)*pDIn;
+      }
+      pDIn += inc;
+    }
+    for (j=0; j<outStep; j++) {
+      *pDOut++ = (dataTypeOut)(pAcc[j] / scale);
+    }
+  }
+  free(pAcc);
+  return ND_SUCCESS;
+}
+
+template <typename dataTypeOut> int convertScaledSwitch(NDArray *pIn, NDArray *pOut, double scale,
+                                                        size_t outStart, size_t outEnd)
+{
+  int status = ND_SUCCESS;
+
+  switch(pIn->dataType) {
+    case NDInt8:
+      status = convertScaledDim <epicsInt8, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDUInt8:
+      status = convertScaledDim <epicsUInt8, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDInt16:
+      status = convertScaledDim <epicsInt16, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDUInt16:
+      status = convertScaledDim <epicsUInt16, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDInt32:
+      status = convertScaledDim <epicsInt32, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDUInt32:
+      status = convertScaledDim <epicsUInt32, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDFloat32:
+      status = convertScaledDim <epicsFloat32, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDFloat64:
+      status = convertScaledDim <epicsFloat64, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDFloat16:
+      status = convertScaledDim <NDFloat16_t, dataTypeOut> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    default:
+      status = ND_ERROR;
+      break;
+  }
+  return(status);
+}
+
+static int convertScaled(NDArray *pIn, NDArray *pOut, double scale, size_t outStart, size_t outEnd)
+{
+  int status = ND_SUCCESS;
+
   switch(pOut->dataType) {
     case NDInt8:
-      convertDimensionSwitch <epicsInt8>(pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsInt8> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDUInt8:
-      convertDimensionSwitch <epicsUInt8> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsUInt8> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDInt16:
-      convertDimensionSwitch <epicsInt16> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsInt16> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDUInt16:
-      convertDimensionSwitch <epicsUInt16> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsUInt16> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDInt32:
-      convertDimensionSwitch <epicsInt32> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsInt32> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDUInt32:
-      convertDimensionSwitch <epicsUInt32> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsUInt32> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDFloat32:
-      convertDimensionSwitch <epicsFloat32> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsFloat32> (pIn, pOut, scale, outStart, outEnd);
       break;
     case NDFloat64:
-      convertDimensionSwitch <epicsFloat64> (pIn, pOut, pDataIn, pDataOut, dim);
+      status = convertScaledSwitch <epicsFloat64> (pIn, pOut, scale, outStart, outEnd);
+      break;
+    case NDFloat16:
+      status = convertScaledSwitch <NDFloat16_t> (pIn, pOut, scale, outStart, outEnd);
       break;
     default:
       status = ND_ERROR;
@@ -441,6 +1990,161 @@ static int convertDimension(NDArray *pIn,
   return(status);
 }
 
+/* The parallel form of convertDimension; each task computes a block of the outermost output dimension */
+typedef struct {
+  NDArray *pIn;
+  NDArray *pOut;
+  size_t outStep;
+  size_t elementSize;
+  double scale;       /* 1 for convertDimension(), otherwise the divisor for convertScaled() */
+  int numBlocks;
+  int status;         /* ND_ERROR if any block could not be converted */
+} convertBlocks_t;
+
+static void convertBlock(void *pArg, int task)
+{
+  convertBlocks_t *pBlocks = (convertBlocks_t *)pArg;
+  NDArray *pOut = pBlocks->pOut;
+  int dim = pOut->ndims-1;
+  size_t size = pOut->dims[dim].size;
+  size_t outStart = size * task / pBlocks->numBlocks;
+  size_t outEnd = size * (task+1) / pBlocks->numBlocks;
+
+  if (pBlocks->scale != 1.) {
+    /* convertScaled() writes every output element, and allocates its own accumulators */
+    if (convertScaled(pBlocks->pIn, pOut, pBlocks->scale, outStart, outEnd) != ND_SUCCESS)
+      pBlocks->status = ND_ERROR;
+    return;
+  }
+  /* Each task clears its own part of the output array */
+  memset((char *)pOut->pData + outStart*pBlocks->outStep*pBlocks->elementSize, 0,
+         (outEnd-outStart)*pBlocks->outStep*pBlocks->elementSize);
+  convertDimension(pBlocks->pIn, pOut, pBlocks->pIn->pData, pOut->pData, dim, outStart, outEnd);
+}
+
+/* An event of a sparse array that convert() maps to the output: its output index and its number in the input */
+typedef struct {
+  epicsUInt32 outIndex;
+  epicsUInt32 event;
+} sparseEvent_t;
+
+static bool sparseEventLess(const sparseEvent_t &a, const sparseEvent_t &b)
+{
+  return a.outIndex < b.outIndex;
+}
+
+/* Sums the values of the events with the same output index, as convertDim() and convertScaledDim() sum the binned
+ * elements, and allocates the sparse output array; the output sums that are zero are not kept as events */
+template <typename dataTypeIn, typename dataTypeOut> NDArray* convertEvents(NDArrayPool *pPool, NDArray *pIn,
+                                                                    size_t *dimSizeOut, NDDataType_t outType,
+                                                                    const std::vector<sparseEvent_t> &events,
+                                                                    double scale)
+{
+  typedef typename convertAccumulator<dataTypeIn>::type accType;
+  const dataTypeIn *pValues = (const dataTypeIn *)pIn->eventValues();
+  std::vector<epicsUInt32> outIndices;
+  std::vector<dataTypeOut> outValues;
+  NDArray *pOut;
+  size_t i, j;
+
+  outIndices.reserve(events.size());
+  outValues.reserve(events.size());
+  for (i=0; i<events.size(); i=j) {
+    dataTypeOut value;
+    if (scale != 1.) {
+      accType acc = 0;
+      for (j=i; (j<events.size()) && (events[j].outIndex == events[i].outIndex); j++) {
+        acc += (accType)pValues[events[j].event];
+      }
+      value = (dataTypeOut)(acc / scale);
+    } else {
+      value = (dataTypeOut)0;
+      for (j=i; (j<events.size()) && (events[j].outIndex == events[i].outIndex); j++) {
+        value += (dataTypeOut)pValues[events[j].event];
+      }
+    }
+    if ((double)value == 0.) continue;
+    outIndices.push_back(events[i].outIndex);
+    outValues.push_back(value);
+  }
+  pOut = pPool->allocSparse(pIn->ndims, dimSizeOut, outType, outIndices.size());
+  if (!pOut) return NULL;
+  if (!outIndices.empty()) {
+    memcpy(pOut->eventIndices(), &outIndices[0], outIndices.size() * sizeof(epicsUInt32));
+    memcpy(pOut->eventValues(), &outValues[0], outValues.size() * sizeof(dataTypeOut));
+  }
+  return pOut;
+}
+
+template <typename dataTypeOut> NDArray* convertEventsSwitch(NDArrayPool *pPool, NDArray *pIn,
+                                                             size_t *dimSizeOut, NDDataType_t outType,
+                                                             const std::vector<sparseEvent_t> &events,
+                                                             double scale)
+{
+  switch(pIn->dataType) {
+    case NDInt8:
+      return convertEvents <epicsInt8, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDUInt8:
+      return convertEvents <epicsUInt8, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDInt16:
+      return convertEvents <epicsInt16, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDUInt16:
+      return convertEvents <epicsUInt16, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDInt32:
+      return convertEvents <epicsInt32, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDUInt32:
+      return convertEvents <epicsUInt32, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDFloat32:
+      return convertEvents <epicsFloat32, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDFloat64:
+      return convertEvents <epicsFloat64, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    case NDFloat16:
+      return convertEvents <NDFloat16_t, dataTypeOut> (pPool, pIn, dimSizeOut, outType, events, scale);
+    default:
+      return NULL;
+  }
+}
+
+/* Gives a converted frame stack the frames that its slowest dimension still holds one by one, in their new order;
+ * binning frames together makes it an ordinary array */
+static void selectStackFrames(NDArray *pIn, NDArray *pOut, NDDimension_t *dimsOut)
+{
+  NDDimension_t *pDim;
+
+  pOut->stackFrames.clear();
+  if (pIn->stackFrames.empty()) return;
+  pDim = &dimsOut[pIn->ndims-1];
+  if ((pDim->binning != 1) || (pDim->offset + pDim->size > pIn->stackFrames.size()))
+    return;
+  pOut->stackFrames.assign(pIn->stackFrames.begin() + pDim->offset,
+                           pIn->stackFrames.begin() + pDim->offset + pDim->size);
+  if (pDim->reverse) std::reverse(pOut->stackFrames.begin(), pOut->stackFrames.end());
+}
+
+/* Sets the offset, binning and reverse of the dimensions of a converted array relative to the original data source,
+ * and makes it Mono if it was an RGBx array whose color dimension was collapsed */
+static void setConvertedDims(NDArray *pIn, NDArray *pOut, NDDimension_t *dimsOut)
+{
+  NDAttribute *pAttribute;
+  int colorMode, colorModeMono = NDColorModeMono;
+  int i;
+
+  for (i=0; i<pIn->ndims; i++) {
+    pOut->dims[i].offset = pIn->dims[i].offset + dimsOut[i].offset;
+    pOut->dims[i].binning = pIn->dims[i].binning * dimsOut[i].binning;
+    if (pIn->dims[i].reverse) pOut->dims[i].reverse = !pOut->dims[i].reverse;
+  }
+
+  /* The value is changed with add() because the attribute may be shared with the input array. */
+  pAttribute = pOut->pAttributeList->find("ColorMode");
+  if (pAttribute && pAttribute->getValue(NDAttrInt32, &colorMode)) {
+    if (((colorMode == NDColorModeRGB1) && (pOut->dims[0].size != 3)) ||
+        ((colorMode == NDColorModeRGB2) && (pOut->dims[1].size != 3)) ||
+        ((colorMode == NDColorModeRGB3) && (pOut->dims[2].size != 3)))
+      pOut->pAttributeList->add("ColorMode", pAttribute->getDescription(), NDAttrInt32, &colorModeMono);
+  }
+}
+
 /** Creates a new output NDArray from an input NDArray, performing
   * conversion operations.
   * This form of the function is for changing the data type only, not the dimensions,
@@ -481,23 +2185,72 @@ int NDArrayPool::convert(NDArray *pIn,
                          NDArray **ppOut,
                          NDDataType_t dataTypeOut,
                          NDDimension_t *dimsOut)
+{
+  return this->convert(pIn, ppOut, dataTypeOut, dimsOut, 1.);
+}
+
+/** Creates a new output NDArray from an input NDArray, performing
+  * conversion operations and dividing each output element by a scale.
+  * The elements of each bin are summed in a type wide enough that integer data is not truncated:
+  * 32-bit integers for 8-bit data, 64-bit integers for other integers, and double for floating point.
+  * The sums are then divided by scale and converted to the output data type in the same pass,
+  * so binning an integer array with a scale equal to the number of elements in a bin gives the average
+  * without an intermediate Float64 array.
+  * Arrays of the packed data types are converted through UInt16; values too large for a packed output saturate.
+  * \param[in] pIn The input array, source of the conversion.
+  * \param[out] ppOut The output array, result of the conversion.
+  * \param[in] dataTypeOut The data type of the output array.
+  * \param[in] dimsOut The dimensions of the output array.
+  * \param[in] scale The divisor of the output elements; 0 and 1 do not scale.
+  */
+int NDArrayPool::convert(NDArray *pIn,
+                         NDArray **ppOut,
+                         NDDataType_t dataTypeOut,
+                         NDDimension_t *dimsOut,
+                         double scale)
 {
   int dimsUnchanged;
   size_t dimSizeOut[ND_ARRAY_MAX_DIMS];
   NDDimension_t dimsOutCopy[ND_ARRAY_MAX_DIMS];
   int i;
   NDArray *pOut;
-  NDArrayInfo_t arrayInfo;
-  NDAttribute *pAttribute;
-  int colorMode, colorModeMono = NDColorModeMono;
+  NDArrayInfo_t arrayInfo, inInfo;
+  NDWorkerPool *pWorkers;
+  convertBlocks_t blocks;
+  int numBlocks;
+  int lastDim = pIn->ndims-1;
+  const char *pRange = NULL;
+  int status = ND_SUCCESS;
   const char *functionName = "convert";
 
   /* Initialize failure */
   *ppOut = NULL;
 
+  if (!pIn->codec.empty()) {
+    printf("%s:%s: ERROR, cannot convert an array compressed with codec %s\n",
+           driverName, functionName, pIn->codec.name.c_str());
+    return ND_ERROR;
+  }
+  if (pIn->pDevice) {
+    printf("%s:%s: ERROR, cannot convert an array in device memory\n",
+           driverName, functionName);
+    return ND_ERROR;
+  }
+
+  /* The conversion functions need contiguous input */
+  if (!pIn->isContiguous()) {
+    NDArray *pContiguous;
+    status = makeContiguous(pIn, &pContiguous);
+    if (status != ND_SUCCESS) return status;
+    status = convert(pContiguous, ppOut, dataTypeOut, dimsOut, scale);
+    pContiguous->release();
+    return status;
+  }
+
   /* Copy the input dimension array because we need to modify it
    * but don't want to affect caller */
   memcpy(dimsOutCopy, dimsOut, pIn->ndims*sizeof(NDDimension_t));
+  if (scale == 0.) scale = 1.;
   /* Compute the dimensions of the output array */
   dimsUnchanged = 1;
   for (i=0; i<pIn->ndims; i++) {
@@ -514,6 +2267,37 @@ int NDArrayPool::convert(NDArray *pIn,
       (dimsOutCopy[i].reverse != 0)) dimsUnchanged = 0;
   }
 
+  /* Sparse arrays are converted event by event into sparse arrays, except to the packed types */
+  if (pIn->sparse) {
+    NDArray *pDense;
+    if (!NDPackedBits(dataTypeOut)) return convertSparse(pIn, ppOut, dataTypeOut, dimsOutCopy, scale);
+    status = makeDense(pIn, &pDense);
+    if (status != ND_SUCCESS) return status;
+    status = convert(pDense, ppOut, dataTypeOut, dimsOut, scale);
+    pDense->release();
+    return status;
+  }
+
+  /* The elements of the packed types cannot be addressed on their own.  A packed input is unpacked to UInt16 and
+   * then converted, and a packed output is converted to UInt16 and then packed.  Only the contiguous unpacking and
+   * packing of the whole array are done in one step, by NDConvertContiguous(). */
+  if ((NDPackedBits(pIn->dataType) || NDPackedBits(dataTypeOut)) &&
+      !(dimsUnchanged && (scale == 1.) &&
+        ((pIn->dataType == dataTypeOut) || (pIn->dataType == NDUInt16) || (dataTypeOut == NDUInt16)))) {
+    NDArray *pUnpacked;
+    if (NDPackedBits(pIn->dataType)) {
+      status = convert(pIn, &pUnpacked, NDUInt16);
+      if (status != ND_SUCCESS) return status;
+      status = convert(pUnpacked, ppOut, dataTypeOut, dimsOut, scale);
+    } else {
+      status = convert(pIn, &pUnpacked, NDUInt16, dimsOut, scale);
+      if (status != ND_SUCCESS) return status;
+      status = convert(pUnpacked, ppOut, dataTypeOut);
+    }
+    pUnpacked->release();
+    return status;
+  }
+
   /* We now know the datatype and dimensions of the output array.
    * Allocate it */
   pOut = alloc(pIn->ndims, dimSizeOut, dataTypeOut, 0, NULL);
@@ -529,18 +2313,41 @@ int NDArrayPool::convert(NDArray *pIn,
   pOut->uniqueId = pIn->uniqueId;
   /* Replace the dimensions with those passed to this function */
   memcpy(pOut->dims, dimsOutCopy, pIn->ndims*sizeof(NDDimension_t));
-  pIn->pAttributeList->copy(pOut->pAttributeList);
+  selectStackFrames(pIn, pOut, dimsOutCopy);
+  if (shareAttributes_) pIn->pAttributeList->share(pOut->pAttributeList);
+  else pIn->pAttributeList->copy(pOut->pAttributeList);
 
   pOut->getInfo(&arrayInfo);
 
-  if (dimsUnchanged) {
+  /* A region that is a range of the outermost dimension, with all of each of the inner dimensions,
+   * is a contiguous range of the input.  It is copied or converted with the contiguous kernels rather than
+   * element by element. */
+  if (!dimsUnchanged && (scale == 1.) && (lastDim >= 0)) {
+    size_t inStep = 1;
+    pRange = (const char *)pIn->pData;
+    for (i=0; i<pIn->ndims; i++) {
+      if ((dimsOutCopy[i].binning != 1) || dimsOutCopy[i].reverse ||
+          ((i < lastDim) && ((dimsOutCopy[i].offset != 0) || (dimsOutCopy[i].size != pIn->dims[i].size)))) {
+        pRange = NULL;
+        break;
+      }
+      if (i < lastDim) inStep *= pIn->dims[i].size;
+    }
+    if (pRange) {
+      pIn->getInfo(&inInfo);
+      pRange += dimsOutCopy[lastDim].offset * inStep * inInfo.bytesPerElement;
+    }
+  }
+
+  if (dimsUnchanged && (scale == 1.)) {
     if (pIn->dataType == pOut->dataType) {
       /* The dimensions are the same and the data type is the same,
        * then just copy the input image to the output image */
       memcpy(pOut->pData, pIn->pData, arrayInfo.totalBytes);
       return ND_SUCCESS;
-    } else {
-      /* We need to convert data types */
+    } else if (NDConvertContiguous(pIn->dataType, pIn->pData, pOut->dataType, pOut->pData,
+                                   arrayInfo.nElements) != ND_SUCCESS) {
+      /* There is no vectorized kernel for this pair of data types, convert them element by element */
       switch(pOut->dataType) {
         case NDInt8:
           convertTypeSwitch <epicsInt8> (pIn, pOut);
@@ -566,36 +2373,151 @@ int NDArrayPool::convert(NDArray *pIn,
         case NDFloat64:
           convertTypeSwitch <epicsFloat64> (pIn, pOut);
           break;
+        case NDFloat16:
+          convertTypeSwitch <NDFloat16_t> (pIn, pOut);
+          break;
         default:
           //status = ND_ERROR;
           break;
       }
     }
+  } else if (pRange && (pIn->dataType == pOut->dataType)) {
+    memcpy(pOut->pData, pRange, arrayInfo.totalBytes);
+  } else if (pRange && (NDConvertContiguous(pIn->dataType, pRange, pOut->dataType, pOut->pData,
+                                            arrayInfo.nElements) == ND_SUCCESS)) {
+    /* The range was converted with a vectorized kernel */
   } else {
     /* The input and output dimensions are not the same, so we are extracting a region
-     * and/or binning */
-    /* Clear entire output array */
-    memset(pOut->pData, 0, arrayInfo.totalBytes);
-    convertDimension(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1);
+     * and/or binning, or the elements are scaled */
+    epicsMutexLock(listLock_);
+    pWorkers = pConvertWorkers_;
+    numBlocks = (pWorkers && (arrayInfo.totalBytes >= convertMinBytes_)) ? 4*(convertThreads_+1) : 1;
+    epicsMutexUnlock(listLock_);
+    if ((size_t)numBlocks > pOut->dims[pIn->ndims-1].size) numBlocks = (int)pOut->dims[pIn->ndims-1].size;
+    if (numBlocks > 1) {
+      /* Split the outermost output dimension into blocks converted by the worker threads */
+      blocks.pIn = pIn;
+      blocks.pOut = pOut;
+      blocks.outStep = arrayInfo.nElements / pOut->dims[pIn->ndims-1].size;
+      blocks.elementSize = arrayInfo.bytesPerElement;
+      blocks.scale = scale;
+      blocks.numBlocks = numBlocks;
+      blocks.status = ND_SUCCESS;
+      pWorkers->run(convertBlock, &blocks, numBlocks);
+      status = blocks.status;
+    } else if (scale != 1.) {
+      status = convertScaled(pIn, pOut, scale, 0, pOut->dims[pIn->ndims-1].size);
+    } else {
+      /* Clear entire output array */
+      memset(pOut->pData, 0, arrayInfo.totalBytes);
+      convertDimension(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1, 0, pOut->dims[pIn->ndims-1].size);
+    }
+    if (status != ND_SUCCESS) {
+      printf("%s:%s: ERROR, cannot allocate the accumulators for scaling\n",
+             driverName, functionName);
+      pOut->release();
+      *ppOut = NULL;
+      return(ND_ERROR);
+    }
   }
 
   /* Set fields in the output array */
-  for (i=0; i<pIn->ndims; i++) {
-    pOut->dims[i].offset = pIn->dims[i].offset + dimsOutCopy[i].offset;
-    pOut->dims[i].binning = pIn->dims[i].binning * dimsOutCopy[i].binning;
-    if (pIn->dims[i].reverse) pOut->dims[i].reverse = !pOut->dims[i].reverse;
+  setConvertedDims(pIn, pOut, dimsOutCopy);
+  return ND_SUCCESS;
+}
+
+/** Converts a sparse array event by event for convert(), into a sparse array of dataTypeOut.
+  * Each event is mapped to the output element whose bin holds it, and dropped if it is outside the region.
+  * \param[in] pIn The sparse input array.
+  * \param[out] ppOut The sparse output array.
+  * \param[in] dataTypeOut The data type of the output array, which cannot be a packed type.
+  * \param[in] dimsOut The dimensions of the output array, whose sizes are already divided by the binning.
+  * \param[in] scale The divisor of the sums of the events, 1 for none.
+  */
+int NDArrayPool::convertSparse(NDArray *pIn, NDArray **ppOut, NDDataType_t dataTypeOut, NDDimension_t *dimsOut,
+                               double scale)
+{
+  std::vector<sparseEvent_t> events;
+  sparseEvent_t event;
+  size_t dimSizeOut[ND_ARRAY_MAX_DIMS];
+  const epicsUInt32 *pIndices = pIn->eventIndices();
+  size_t index, coord, outIndex, outStep;
+  bool sorted = true;
+  NDArray *pOut = NULL;
+  size_t n;
+  int i;
+  const char *functionName = "convertSparse";
+
+  for (i=0; i<pIn->ndims; i++) dimSizeOut[i] = dimsOut[i].size;
+  events.reserve(pIn->numEvents);
+  for (n=0; n<pIn->numEvents; n++) {
+    index = pIndices[n];
+    outIndex = 0;
+    outStep = 1;
+    for (i=0; i<pIn->ndims; i++) {
+      coord = index % pIn->dims[i].size;
+      index /= pIn->dims[i].size;
+      if ((coord < dimsOut[i].offset) ||
+          (coord - dimsOut[i].offset >= dimsOut[i].size * dimsOut[i].binning)) break;
+      coord = (coord - dimsOut[i].offset) / dimsOut[i].binning;
+      if (dimsOut[i].reverse) coord = dimsOut[i].size - 1 - coord;
+      outIndex += coord * outStep;
+      outStep *= dimsOut[i].size;
+    }
+    if (i < pIn->ndims) continue;
+    event.outIndex = (epicsUInt32)outIndex;
+    event.event = (epicsUInt32)n;
+    if (!events.empty() && (event.outIndex < events.back().outIndex)) sorted = false;
+    events.push_back(event);
   }
+  /* Reversed dimensions change the order of the events; the stable sort keeps the order of the summation */
+  if (!sorted) std::stable_sort(events.begin(), events.end(), sparseEventLess);
 
-  /* If the frame is an RGBx frame and we have collapsed that dimension then change the colorMode */
-  pAttribute = pOut->pAttributeList->find("ColorMode");
-  if (pAttribute && pAttribute->getValue(NDAttrInt32, &colorMode)) {
-    if      ((colorMode == NDColorModeRGB1) && (pOut->dims[0].size != 3)) 
-      pAttribute->setValue(&colorModeMono);
-    else if ((colorMode == NDColorModeRGB2) && (pOut->dims[1].size != 3)) 
-      pAttribute->setValue(&colorModeMono);
-    else if ((colorMode == NDColorModeRGB3) && (pOut->dims[2].size != 3))
-      pAttribute->setValue(&colorModeMono);
+  switch(dataTypeOut) {
+    case NDInt8:
+      pOut = convertEventsSwitch <epicsInt8> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDUInt8:
+      pOut = convertEventsSwitch <epicsUInt8> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDInt16:
+      pOut = convertEventsSwitch <epicsInt16> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDUInt16:
+      pOut = convertEventsSwitch <epicsUInt16> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDInt32:
+      pOut = convertEventsSwitch <epicsInt32> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDUInt32:
+      pOut = convertEventsSwitch <epicsUInt32> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDFloat32:
+      pOut = convertEventsSwitch <epicsFloat32> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDFloat64:
+      pOut = convertEventsSwitch <epicsFloat64> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    case NDFloat16:
+      pOut = convertEventsSwitch <NDFloat16_t> (this, pIn, dimSizeOut, dataTypeOut, events, scale);
+      break;
+    default:
+      break;
+  }
+  if (!pOut) {
+    printf("%s:%s: ERROR, cannot allocate output array\n",
+           driverName, functionName);
+    return ND_ERROR;
   }
+  pOut->timeStamp = pIn->timeStamp;
+  pOut->epicsTS = pIn->epicsTS;
+  pOut->uniqueId = pIn->uniqueId;
+  memcpy(pOut->dims, dimsOut, pIn->ndims*sizeof(NDDimension_t));
+  selectStackFrames(pIn, pOut, dimsOut);
+  if (shareAttributes_) pIn->pAttributeList->share(pOut->pAttributeList);
+  else pIn->pAttributeList->copy(pOut->pAttributeList);
+  setConvertedDims(pIn, pOut, dimsOut);
+  *ppOut = pOut;
   return ND_SUCCESS;
 }
 
@@ -644,6 +2566,56 @@ int NDArrayPool::report(FILE *fp, int details)
         (long)memorySize_, (long)maxMemory_);
   fprintf(fp, "  numFree=%d\n",
          numFree_);
+  fprintf(fp, "  memoryProvider=%s\n",
+         pMemoryProvider_ ? pMemoryProvider_->name() : "malloc");
+  fprintf(fp, "  alignment=%lu, hugePages=%d, hugePageThreshold=%lu\n",
+         (unsigned long)alignment_, hugePages_, (unsigned long)hugePageThreshold_);
+  fprintf(fp, "  allocs=%lu, free list hits=%lu, new buffers=%lu, reallocations=%lu, new arrays=%lu\n",
+         (unsigned long)stats_.numAllocs, (unsigned long)stats_.freeListHits, (unsigned long)stats_.newBuffers,
+         (unsigned long)stats_.reallocations, (unsigned long)stats_.newArrays);
+  fprintf(fp, "  failures: buffer limit=%lu, memory limit=%lu, allocation=%lu\n",
+         (unsigned long)stats_.bufferLimitFailures, (unsigned long)stats_.memoryLimitFailures,
+         (unsigned long)stats_.allocFailures);
+  fprintf(fp, "  high-water: buffers in use=%d, memorySize=%ld\n",
+         stats_.maxBuffersInUse, (long)stats_.maxMemorySize);
+  fprintf(fp, "  eviction policy=%d, evictions=%lu, trim idle time=%.1f s, trimmed buffers=%lu\n",
+         evictionPolicy_, (unsigned long)stats_.evictions, trimIdleTime_, (unsigned long)stats_.trimmedBuffers);
+  fprintf(fp, "  alloc time (us): min=%.1f, avg=%.1f, max=%.1f\n",
+         stats_.minAllocTime*1e6,
+         stats_.numAllocs ? stats_.totalAllocTime*1e6/stats_.numAllocs : 0.,
+         stats_.maxAllocTime*1e6);
+  fprintf(fp, "  numaPolicy=%d, numaNode=%d, numNodes=%d\n",
+         numaPolicy_, numaNode_, NDNumaNumNodes());
+  fprintf(fp, "  convert SIMD level=%s, convert threads=%d, convert minBytes=%lu\n",
+         NDSimdLevelName(NDSimdLevel()), convertThreads_, (unsigned long)convertMinBytes_);
+  fprintf(fp, "  share attributes=%s\n", shareAttributes_ ? "Yes" : "No");
+  {
+    std::vector<NDPoolConsumerStats_t> consumers;
+    size_t i;
+    getConsumerStats(consumers);
+    for (i=0; i<consumers.size(); i++) {
+      fprintf(fp, "  consumer %s: held=%d, max held=%d, quota=%d, refused=%lu\n",
+             consumers[i].name.c_str(), consumers[i].held, consumers[i].maxHeld, consumers[i].quota,
+             (unsigned long)consumers[i].refused);
+    }
+  }
+  if (details > 0) {
+    size_t sc;
+    int node;
+    epicsMutexLock(listLock_);
+    for (node=0; node<ND_NUMA_MAX_NODES; node++) {
+      for (sc=0; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+        int count = ellCount(&freeList_[node][sc]);
+        if (count == 0) continue;
+        if (sc == 0)
+          fprintf(fp, "    node %d size class 0 (no buffer): numFree=%d\n", node, count);
+        else
+          fprintf(fp, "    node %d size class %d (%lu-%lu bytes): numFree=%d\n", node, (int)sc,
+                  (unsigned long)((size_t)1 << (sc-1)), (unsigned long)(((size_t)1 << (sc-1))*2 - 1), count);
+      }
+    }
+    epicsMutexUnlock(listLock_);
+  }
       
   return ND_SUCCESS;
 }
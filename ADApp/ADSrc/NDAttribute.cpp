@@ -10,6 +10,7 @@
 #include <stdlib.h>
 
 #include <epicsString.h>
+#include <epicsAtomic.h>
 
 #include <epicsExport.h>
 
@@ -23,11 +24,20 @@ static const char *NDAttrSourceStrings[] = {
     "FUNCTION"
 };
 
+/** The last version given to the value of an attribute */
+static size_t lastVersion = 0;
+
 const char *NDAttribute::attrSourceString(NDAttrSource_t type)
 {
   return NDAttrSourceStrings[type];
 }
 
+/** Returns a version that no attribute value has had before. */
+size_t NDAttribute::newVersion()
+{
+  return epicsAtomicIncrSizeT(&lastVersion);
+}
+
 /** NDAttribute constructor
   * \param[in] pName The name of the attribute to be created. 
   * \param[in] sourceType The source type of the attribute (NDAttrSource_t).
@@ -66,11 +76,14 @@ const char *NDAttribute::attrSourceString(NDAttrSource_t type)
   }
   this->source_ = pSource ? pSource : "";
   this->string_ = "";
+  this->version_ = newVersion();
   if (pValue) {
     this->setDataType(dataType);
     this->setValue(pValue);
   }
   this->listNode_.pNDAttribute = this;
+  this->hash_ = 0;
+  this->pHashNext_ = NULL;
 }
 
 /** NDAttribute copy constructor
@@ -89,7 +102,10 @@ NDAttribute::NDAttribute(NDAttribute& attribute)
   if (attribute.dataType_ == NDAttrString) pValue = (void *)attribute.string_.c_str();
   else pValue = &attribute.value_;
   this->setValue(pValue);
+  this->version_ = attribute.version_;
   this->listNode_.pNDAttribute = this;
+  this->hash_ = 0;
+  this->pHashNext_ = NULL;
 }
 
 
@@ -101,7 +117,8 @@ NDAttribute::~NDAttribute()
 /** Copies properties from <b>this</b> to pOut.
   * \param[in] pOut A pointer to the output attribute
   *         If NULL the output attribute will be created using the copy constructor
-  * Only the value is copied, all other fields are assumed to already be the same in pOut
+  * Only the value is copied, all other fields are assumed to already be the same in pOut.
+  * Nothing is copied if pOut already has the version of the value of <b>this</b>.
   * \return  Returns a pointer to the copy
   */
 NDAttribute* NDAttribute::copy(NDAttribute *pOut)
@@ -110,10 +127,14 @@ NDAttribute* NDAttribute::copy(NDAttribute *pOut)
   
   if (!pOut) 
     pOut = new NDAttribute(*this);
-  else {
-    if (this->dataType_ == NDAttrString) pValue = (void *)this->string_.c_str();
-    else pValue = &this->value_;
-    pOut->setValue(pValue);
+  else if (pOut->version_ != this->version_) {
+    /* Assigning the string reuses the capacity of the string in pOut */
+    if (this->dataType_ == NDAttrString) pOut->setValue(this->string_);
+    else {
+      pValue = &this->value_;
+      pOut->setValue(pValue);
+    }
+    pOut->version_ = this->version_;
   }
   return pOut;
 }
@@ -142,6 +163,7 @@ int NDAttribute::setDataType(NDAttrDataType_t type)
     return ND_ERROR;
   }
   this->dataType_ = type;
+  this->version_ = newVersion();
   return ND_SUCCESS;
 }
 
@@ -176,7 +198,7 @@ const char *NDAttribute::getSourceInfo(NDAttrSource_t *pSourceType)
   return sourceTypeString_.c_str();
 }
 
-/** Sets the value for this attribute. 
+/** Sets the value for this attribute; a value that differs from the current one gives the attribute a new version.
   * \param[in] pValue Pointer to the value. */
 int NDAttribute::setValue(const void *pValue)
 {
@@ -190,32 +212,42 @@ int NDAttribute::setValue(const void *pValue)
      * If not the same free the old string and copy new one. */
     if (this->string_ == (char *)pValue) return ND_SUCCESS;
     this->string_ = (char *)pValue;
+    this->version_ = newVersion();
     return ND_SUCCESS;
   }
+  NDAttrValue oldValue = this->value_;
   switch (dataType_) {
     case NDAttrInt8:
       this->value_.i8 = *(epicsInt8 *)pValue;
+      if (this->value_.i8 != oldValue.i8) this->version_ = newVersion();
       break;
     case NDAttrUInt8:
       this->value_.ui8 = *(epicsUInt8 *)pValue;
+      if (this->value_.ui8 != oldValue.ui8) this->version_ = newVersion();
       break;
     case NDAttrInt16:
       this->value_.i16 = *(epicsInt16 *)pValue;
+      if (this->value_.i16 != oldValue.i16) this->version_ = newVersion();
       break;
     case NDAttrUInt16:
       this->value_.ui16 = *(epicsUInt16 *)pValue;
+      if (this->value_.ui16 != oldValue.ui16) this->version_ = newVersion();
       break;
     case NDAttrInt32:
       this->value_.i32 = *(epicsInt32*)pValue;
+      if (this->value_.i32 != oldValue.i32) this->version_ = newVersion();
       break;
     case NDAttrUInt32:
       this->value_.ui32 = *(epicsUInt32 *)pValue;
+      if (this->value_.ui32 != oldValue.ui32) this->version_ = newVersion();
       break;
     case NDAttrFloat32:
       this->value_.f32 = *(epicsFloat32 *)pValue;
+      if (this->value_.f32 != oldValue.f32) this->version_ = newVersion();
       break;
     case NDAttrFloat64:
       this->value_.f64 = *(epicsFloat64 *)pValue;
+      if (this->value_.f64 != oldValue.f64) this->version_ = newVersion();
       break;
     case NDAttrUndefined:
       break;
@@ -226,13 +258,15 @@ int NDAttribute::setValue(const void *pValue)
   return ND_SUCCESS;
 }
 
-/** Sets the value for this attribute. 
+/** Sets the value for this attribute; a value that differs from the current one gives the attribute a new version.
   * \param[in] value value of this attribute. */
 int NDAttribute::setValue(const std::string& value)
 {
   /* Data type must be string */
   if (dataType_ == NDAttrString) {
+    if (this->string_ == value) return ND_SUCCESS;
     this->string_ = value;
+    this->version_ = newVersion();
     return ND_SUCCESS;
   }
   return ND_ERROR;
@@ -389,6 +423,15 @@ int NDAttribute::updateValue()
   return ND_SUCCESS;
 }
 
+/** Returns the version of the value of this attribute.
+  * The version changes whenever the value changes, and a copy of the attribute has the version of the
+  * value it was copied from, so two attributes with the same version have the same value.
+  */
+size_t NDAttribute::getVersion()
+{
+  return this->version_;
+}
+
 /** Reports on the properties of the attribute.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; currently does nothing
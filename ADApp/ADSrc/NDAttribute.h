@@ -23,7 +23,9 @@
 #define ND_ERROR -1
 
 
-/** Enumeration of NDArray data types */
+/** Enumeration of NDArray data types.  NDFloat16 and the packed types come last so that the other types keep the
+  * values the records and files use; there is no NDAttrDataType_t for them.  The elements of the packed types are
+  * stored without gaps, least significant bit first, as in the GenICam Mono10p and Mono12p pixel formats */
 typedef enum
 {
     NDInt8,     /**< Signed 8-bit integer */
@@ -33,7 +35,10 @@ typedef enum
     NDInt32,    /**< Signed 32-bit integer */
     NDUInt32,   /**< Unsigned 32-bit integer */
     NDFloat32,  /**< 32-bit float */
-    NDFloat64   /**< 64-bit float */
+    NDFloat64,  /**< 64-bit float */
+    NDFloat16,  /**< 16-bit (half precision) float, of NDFloat16_t elements */
+    NDUInt10Packed, /**< Unsigned 10-bit integer, 4 elements in 5 bytes */
+    NDUInt12Packed  /**< Unsigned 12-bit integer, 2 elements in 3 bytes */
 } NDDataType_t;
 
 /** Enumeration of NDAttribute attribute data types */
@@ -83,6 +88,9 @@ typedef struct NDAttributeListNode {
 
 /** NDAttribute class; an attribute has a name, description, source type, source string,
   * data type, and value.
+  * Every change of the value gives the attribute a new version, a number that is unique among all the
+  * attributes; copy() gives the copy the version of the original, so an attribute that already has the
+  * version of the original is not copied again.
   */
 class epicsShareClass NDAttribute {
 public:
@@ -105,6 +113,7 @@ public:
     virtual int setValue(const void *pValue);
     virtual int setValue(const std::string&);
     virtual int updateValue();
+    size_t getVersion();
     virtual int report(FILE *fp, int details);
     friend class NDArray;
     friend class NDAttributeList;
@@ -112,6 +121,7 @@ public:
 
 private:
     template <typename epicsType> int getValueT(void *pValue, size_t dataSize);
+    static size_t newVersion();
     std::string name_;              /**< Name string */
     std::string description_;       /**< Description string */
     NDAttrDataType_t dataType_;     /**< Data type of attribute */
@@ -119,8 +129,11 @@ private:
     std::string string_;            /**< Value of attribute for strings */
     std::string source_;            /**< Source string - EPICS PV name or DRV_INFO string */
     NDAttrSource_t sourceType_;     /**< Source type */
+    size_t version_;                /**< Version of the value, changed by every change of the value */
     std::string sourceTypeString_;  /**< Source type string */
     NDAttributeListNode listNode_;  /**< Used for NDAttributeList */
+    size_t hash_;                   /**< Hash of the name, used for the NDAttributeList index */
+    NDAttribute *pHashNext_;        /**< Next attribute in the same NDAttributeList hash bucket */
 };
 
 #endif
@@ -8,23 +8,48 @@
  
 #include <stdlib.h>
 
+#include <epicsAtomic.h>
 #include <epicsExport.h>
 
 #include "NDAttributeList.h"
 
+/** The initial number of hash buckets; the table doubles when there are more attributes than buckets */
+#define HASH_INITIAL_BUCKETS 16
+
+/** FNV-1a hash of an attribute name */
+static size_t hashName(const char *pName)
+{
+  size_t hash = 2166136261u;
+
+  while (*pName) {
+    hash ^= (unsigned char)*pName++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
 /** NDAttributeList constructor
+  * \param[in] recycle If true clear() keeps the attributes as spares for reuse instead of deleting them.
+  * This is used for the attribute lists of NDArrays, which are cleared and refilled with the same
+  * attributes for every array.
   */
-NDAttributeList::NDAttributeList()
+NDAttributeList::NDAttributeList(bool recycle)
+  : recycle_(recycle), pShared_(NULL), shareCount_(0)
 {
   ellInit(&this->list_);
+  ellInit(&this->spareList_);
   this->lock_ = epicsMutexCreate();
+  this->hashTable_.resize(HASH_INITIAL_BUCKETS, NULL);
+  this->spareTable_.resize(HASH_INITIAL_BUCKETS, NULL);
 }
 
 /** NDAttributeList destructor
   */
 NDAttributeList::~NDAttributeList()
 {
+  this->recycle_ = false;
   this->clear();
+  this->deleteSpares();
   ellFree(&this->list_);
   epicsMutexDestroy(this->lock_);
 }
@@ -39,9 +64,11 @@ int NDAttributeList::add(NDAttribute *pAttribute)
   //const char *functionName = "NDAttributeList::add";
 
   epicsMutexLock(this->lock_);
+  this->unshare();
   /* Remove any existing attribute with this name */
   this->remove(pAttribute->name_.c_str());
   ellAdd(&this->list_, &pAttribute->listNode_.node);
+  this->hashAdd(this->hashTable_, pAttribute);
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
 }
@@ -68,12 +95,15 @@ NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, N
   NDAttribute *pAttribute;
 
   epicsMutexLock(this->lock_);
+  this->unshare();
   pAttribute = this->find(pName);
+  if (!pAttribute) pAttribute = this->takeSpare(pName, typeid(NDAttribute), pValue ? dataType : NDAttrUndefined);
   if (pAttribute) {
     pAttribute->setValue(pValue);
   } else {
     pAttribute = new NDAttribute(pName, pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
     ellAdd(&this->list_, &pAttribute->listNode_.node);
+    this->hashAdd(this->hashTable_, pAttribute);
   }
   epicsMutexUnlock(this->lock_);
   return(pAttribute);
@@ -84,23 +114,18 @@ NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, N
 /** Finds an attribute by name; the search is now case sensitive (R1-10)
   * \param[in] pName The name of the attribute to be found.
   * \return Returns a pointer to the attribute if found, NULL if not found. 
+  *
+  * If the list shares its attributes with other lists the attribute must not be modified
+  * through this pointer; use add() to change its value.
   */
 NDAttribute* NDAttributeList::find(const char *pName)
 {
   NDAttribute *pAttribute;
-  NDAttributeListNode *pListNode;
   //const char *functionName = "NDAttributeList::find";
 
   epicsMutexLock(this->lock_);
-  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
-  while (pListNode) {
-    pAttribute = pListNode->pNDAttribute;
-    if (pAttribute->name_ == pName) goto done;
-    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
-  }
-  pAttribute = NULL;
-
-  done:
+  if (this->pShared_) pAttribute = this->pShared_->find(pName);
+  else pAttribute = this->hashFind(this->hashTable_, pName);
   epicsMutexUnlock(this->lock_);
   return(pAttribute);
 }
@@ -117,6 +142,11 @@ NDAttribute* NDAttributeList::next(NDAttribute *pAttributeIn)
   //const char *functionName = "NDAttributeList::next";
 
   epicsMutexLock(this->lock_);
+  if (this->pShared_) {
+    pAttribute = this->pShared_->next(pAttributeIn);
+    epicsMutexUnlock(this->lock_);
+    return(pAttribute);
+  }
   if (!pAttributeIn) {
     pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
    }
@@ -133,8 +163,12 @@ NDAttribute* NDAttributeList::next(NDAttribute *pAttributeIn)
 int NDAttributeList::count()
 {
   //const char *functionName = "NDAttributeList::count";
+  int numAttributes;
 
-  return ellCount(&this->list_);
+  epicsMutexLock(this->lock_);
+  numAttributes = this->pShared_ ? this->pShared_->count() : ellCount(&this->list_);
+  epicsMutexUnlock(this->lock_);
+  return numAttributes;
 }
 
 /** Removes an attribute from the list.
@@ -148,9 +182,11 @@ int NDAttributeList::remove(const char *pName)
   //const char *functionName = "NDAttributeList::remove";
 
   epicsMutexLock(this->lock_);
+  this->unshare();
   pAttribute = this->find(pName);
   if (!pAttribute) goto done;
   ellDelete(&this->list_, &pAttribute->listNode_.node);
+  this->hashRemove(this->hashTable_, pAttribute);
   delete pAttribute;
   status = ND_SUCCESS;
 
@@ -159,7 +195,10 @@ int NDAttributeList::remove(const char *pName)
   return(status);
 }
 
-/** Deletes all attributes from the list. */
+/** Deletes all attributes from the list.
+  * If the list recycles its attributes they become spares instead.  The spares left over from the previous
+  * clear() were not reused since then, so they are deleted; this stops the spares from growing without limit.
+  */
 int NDAttributeList::clear()
 {
   NDAttribute *pAttribute;
@@ -167,20 +206,63 @@ int NDAttributeList::clear()
   //const char *functionName = "NDAttributeList::clear";
 
   epicsMutexLock(this->lock_);
+  if (this->pShared_) {
+    releaseShared(this->pShared_);
+    this->pShared_ = NULL;
+  }
+  if (this->recycle_) this->deleteSpares();
   pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
   while (pListNode) {
     pAttribute = pListNode->pNDAttribute;
     ellDelete(&this->list_, &pListNode->node);
-    delete pAttribute;
+    if (this->recycle_) {
+      ellAdd(&this->spareList_, &pListNode->node);
+      this->hashAdd(this->spareTable_, pAttribute);
+    } else {
+      delete pAttribute;
+    }
     pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
   }
+  this->hashTable_.assign(this->hashTable_.size(), (NDAttribute *)NULL);
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
 }
 
+/** Deletes the spare attributes.  Must be called with lock_ held. */
+void NDAttributeList::deleteSpares()
+{
+  NDAttributeListNode *pListNode;
+
+  while ((pListNode = (NDAttributeListNode *)ellFirst(&this->spareList_))) {
+    ellDelete(&this->spareList_, &pListNode->node);
+    delete pListNode->pNDAttribute;
+  }
+  this->spareTable_.assign(this->spareTable_.size(), (NDAttribute *)NULL);
+}
+
+/** Moves a spare attribute back into the list so it can be reused.
+  * The spare must have the same name, class and data type, because only the value of a reused attribute
+  * is set.  Must be called with lock_ held.
+  * \param[in] pName The name of the attribute.
+  * \param[in] type The class of the attribute.
+  * \param[in] dataType The data type of the attribute.
+  * \return Returns a pointer to the attribute, or NULL if there is no suitable spare. */
+NDAttribute* NDAttributeList::takeSpare(const char *pName, const std::type_info& type, NDAttrDataType_t dataType)
+{
+  NDAttribute *pAttribute = this->hashFind(this->spareTable_, pName);
+
+  if (!pAttribute || (typeid(*pAttribute) != type) || (pAttribute->dataType_ != dataType)) return NULL;
+  ellDelete(&this->spareList_, &pAttribute->listNode_.node);
+  this->hashRemove(this->spareTable_, pAttribute);
+  ellAdd(&this->list_, &pAttribute->listNode_.node);
+  this->hashAdd(this->hashTable_, pAttribute);
+  return pAttribute;
+}
+
 /** Copies all attributes from one attribute list to another.
   * It is efficient so that if the attribute already exists in the output
-  * list it just copies the properties, and memory allocation is minimized.
+  * list it just copies the properties, and memory allocation is minimized;
+  * an output attribute that already has the version of the value of the input is left unchanged.
   * The attributes are added to any existing attributes already present in the output list.
   * \param[out] pListOut A pointer to the output attribute list to copy to.
   */
@@ -190,12 +272,27 @@ int NDAttributeList::copy(NDAttributeList *pListOut)
   NDAttributeListNode *pListNode;
   //const char *functionName = "NDAttributeList::copy";
 
+  if (pListOut == this) return(ND_SUCCESS);
+  /* The output list is modified, so it needs its own attributes */
+  epicsMutexLock(pListOut->lock_);
+  pListOut->unshare();
+  epicsMutexUnlock(pListOut->lock_);
   epicsMutexLock(this->lock_);
+  if (this->pShared_) {
+    this->pShared_->copy(pListOut);
+    epicsMutexUnlock(this->lock_);
+    return(ND_SUCCESS);
+  }
   pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
   while (pListNode) {
     pAttrIn = pListNode->pNDAttribute;
-    /* See if there is already an attribute of this name in the output list */
+    /* See if there is already an attribute of this name in the output list, or a spare that can be reused */
     pFound = pListOut->find(pAttrIn->name_.c_str());
+    if (!pFound) {
+      epicsMutexLock(pListOut->lock_);
+      pFound = pListOut->takeSpare(pAttrIn->name_.c_str(), typeid(*pAttrIn), pAttrIn->dataType_);
+      epicsMutexUnlock(pListOut->lock_);
+    }
     /* The copy function will copy the properties, and will create the attribute if pFound is NULL */
     pAttrOut = pAttrIn->copy(pFound);
     /* If pFound is NULL, then a copy created a new attribute, need to add it to the list */
@@ -206,7 +303,67 @@ int NDAttributeList::copy(NDAttributeList *pListOut)
   return(ND_SUCCESS);
 }
 
+/** Makes another list reference the attributes of this list rather than copying them.
+  * Any attributes already in the output list are removed first.
+  * The attributes are moved to a block that is shared by both lists, and by any other list that they are
+  * shared with later; they are deleted when the last of these lists is cleared, deleted or modified.
+  * A list that is modified with add(), remove() or updateValues() first makes its own copy of the attributes,
+  * so changes to one list are not seen by the others.
+  * \param[out] pListOut A pointer to the output attribute list.
+  */
+int NDAttributeList::share(NDAttributeList *pListOut)
+{
+  NDAttributeList *pShared;
+  //const char *functionName = "NDAttributeList::share";
+
+  if (pListOut == this) return(ND_SUCCESS);
+  pListOut->clear();
+  epicsMutexLock(this->lock_);
+  if (!this->pShared_ && (ellCount(&this->list_) > 0)) {
+    /* Move the attributes of this list to a new shared block */
+    pShared = new NDAttributeList;
+    ellConcat(&pShared->list_, &this->list_);
+    pShared->hashTable_ = this->hashTable_;
+    pShared->spareTable_.assign(pShared->hashTable_.size(), (NDAttribute *)NULL);
+    this->hashTable_.assign(this->hashTable_.size(), (NDAttribute *)NULL);
+    pShared->shareCount_ = 1;
+    this->pShared_ = pShared;
+  }
+  if (this->pShared_) {
+    epicsAtomicIncrIntT(&this->pShared_->shareCount_);
+    epicsMutexLock(pListOut->lock_);
+    pListOut->pShared_ = this->pShared_;
+    epicsMutexUnlock(pListOut->lock_);
+  }
+  epicsMutexUnlock(this->lock_);
+  return(ND_SUCCESS);
+}
+
+/** Returns true if the list references attributes that are shared with other lists. */
+bool NDAttributeList::isShared()
+{
+  return this->pShared_ != NULL;
+}
+
+/** Replaces the reference to shared attributes with a private copy of them.  Must be called with lock_ held. */
+void NDAttributeList::unshare()
+{
+  NDAttributeList *pShared = this->pShared_;
+
+  if (!pShared) return;
+  this->pShared_ = NULL;
+  pShared->copy(this);
+  releaseShared(pShared);
+}
+
+/** Releases a reference to a block of shared attributes, and deletes the block when it is no longer used. */
+void NDAttributeList::releaseShared(NDAttributeList *pShared)
+{
+  if (epicsAtomicDecrIntT(&pShared->shareCount_) == 0) delete pShared;
+}
+
 /** Updates all attribute values in the list; calls NDAttribute::updateValue() for each attribute in the list.
+  * The attributes whose source can tell that it did not change since their last update return without reading it.
   */
 int NDAttributeList::updateValues()
 {
@@ -215,6 +372,7 @@ int NDAttributeList::updateValues()
   //const char *functionName = "NDAttributeList::updateValues";
 
   epicsMutexLock(this->lock_);
+  this->unshare();
   pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
   while (pListNode) {
     pAttribute = pListNode->pNDAttribute;
@@ -225,6 +383,74 @@ int NDAttributeList::updateValues()
   return(ND_SUCCESS);
 }
 
+/** Finds an attribute by name in a hash index.  Must be called with lock_ held.
+  * \param[in] table The index of the list or of the spares.
+  * \param[in] pName The name of the attribute. */
+NDAttribute* NDAttributeList::hashFind(std::vector<NDAttribute *>& table, const char *pName)
+{
+  size_t hash = hashName(pName);
+  NDAttribute *pAttribute = table[hash & (table.size()-1)];
+
+  while (pAttribute) {
+    if ((pAttribute->hash_ == hash) && (pAttribute->name_ == pName)) break;
+    pAttribute = pAttribute->pHashNext_;
+  }
+  return pAttribute;
+}
+
+/** Adds an attribute to a hash index; the attribute must already be in the corresponding list.
+  * Must be called with lock_ held. */
+void NDAttributeList::hashAdd(std::vector<NDAttribute *>& table, NDAttribute *pAttribute)
+{
+  size_t bucket;
+
+  if ((size_t)(ellCount(&this->list_) + ellCount(&this->spareList_)) > table.size()) {
+    this->hashResize(table.size()*2);
+  }
+  pAttribute->hash_ = hashName(pAttribute->name_.c_str());
+  bucket = pAttribute->hash_ & (table.size()-1);
+  pAttribute->pHashNext_ = table[bucket];
+  table[bucket] = pAttribute;
+}
+
+/** Removes an attribute from a hash index.  Must be called with lock_ held. */
+void NDAttributeList::hashRemove(std::vector<NDAttribute *>& table, NDAttribute *pAttribute)
+{
+  NDAttribute **ppNext = &table[pAttribute->hash_ & (table.size()-1)];
+
+  while (*ppNext) {
+    if (*ppNext == pAttribute) {
+      *ppNext = pAttribute->pHashNext_;
+      break;
+    }
+    ppNext = &(*ppNext)->pHashNext_;
+  }
+  pAttribute->pHashNext_ = NULL;
+}
+
+/** Rebuilds the hash indexes of the list and of the spares with a new number of buckets,
+  * which must be a power of 2.  Must be called with lock_ held. */
+void NDAttributeList::hashResize(size_t numBuckets)
+{
+  std::vector<NDAttribute *> *tables[2] = {&this->hashTable_, &this->spareTable_};
+  NDAttribute *pAttribute, *pNext;
+  size_t i, bucket;
+  int t;
+
+  for (t=0; t<2; t++) {
+    std::vector<NDAttribute *> oldTable(numBuckets, (NDAttribute *)NULL);
+    tables[t]->swap(oldTable);
+    for (i=0; i<oldTable.size(); i++) {
+      for (pAttribute=oldTable[i]; pAttribute; pAttribute=pNext) {
+        pNext = pAttribute->pHashNext_;
+        bucket = pAttribute->hash_ & (numBuckets-1);
+        pAttribute->pHashNext_ = (*tables[t])[bucket];
+        (*tables[t])[bucket] = pAttribute;
+      }
+    }
+  }
+}
+
 /** Reports on the properties of the attribute list.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; if >10 calls NDAttribute::report() for each attribute.
@@ -237,7 +463,8 @@ int NDAttributeList::report(FILE *fp, int details)
   epicsMutexLock(this->lock_);
   fprintf(fp, "\n");
   fprintf(fp, "NDAttributeList: address=%p:\n", this);
-  fprintf(fp, "  number of attributes=%d\n", this->count());
+  fprintf(fp, "  number of attributes=%d, spares=%d, shared=%s\n", this->count(), ellCount(&this->spareList_),
+          this->pShared_ ? "Yes" : "No");
   if (details > 10) {
     pListNode = (NDAttributeListNode *) ellFirst(&this->list_);
     while (pListNode) {
@@ -10,6 +10,8 @@
 #define NDAttributeList_H
 
 #include <stdio.h>
+#include <vector>
+#include <typeinfo>
 #include <ellLib.h>
 #include <epicsMutex.h>
  
@@ -17,10 +19,16 @@
 
 
 /** NDAttributeList class; this is a linked list of attributes.
+  * A hash index of the names is kept alongside the list so that find() does not have to search
+  * the list, while next() still returns the attributes in the order they were added.
+  * A list that recycles its attributes keeps them as spares when it is cleared, and copy() and add()
+  * reuse a spare with the same name and class instead of allocating a new attribute.
+  * share() lets several lists reference the same attributes rather than copying them; a list that shares
+  * its attributes makes a private copy of them the first time it is modified.
   */
 class epicsShareClass NDAttributeList {
 public:
-    NDAttributeList();
+    NDAttributeList(bool recycle=false);
     ~NDAttributeList();
     int          add(NDAttribute *pAttribute);
     NDAttribute* add(const char *pName, const char *pDescription="", 
@@ -31,12 +39,29 @@ public:
     int          remove(const char *pName);
     int          clear();
     int          copy(NDAttributeList *pOut);
+    int          share(NDAttributeList *pOut);
+    bool         isShared();
     int          updateValues();
     int          report(FILE *fp, int details);
     
 private:
+    NDAttribute* hashFind(std::vector<NDAttribute *>& table, const char *pName);
+    void         hashAdd(std::vector<NDAttribute *>& table, NDAttribute *pAttribute);
+    void         hashRemove(std::vector<NDAttribute *>& table, NDAttribute *pAttribute);
+    void         hashResize(size_t numBuckets);
+    NDAttribute* takeSpare(const char *pName, const std::type_info& type, NDAttrDataType_t dataType);
+    void         deleteSpares();
+    void         unshare();
+    static void  releaseShared(NDAttributeList *pShared);
+
     ELLLIST      list_;   /**< The EPICS ELLLIST  */
     epicsMutexId lock_;  /**< Mutex to protect the ELLLIST */
+    std::vector<NDAttribute *> hashTable_;  /**< Hash buckets of the attributes, the size is a power of 2 */
+    bool         recycle_;  /**< Keep the attributes as spares when the list is cleared */
+    ELLLIST      spareList_;  /**< Attributes kept for reuse by clear() */
+    std::vector<NDAttribute *> spareTable_;  /**< Hash buckets of the spares, the same size as hashTable_ */
+    NDAttributeList *pShared_;  /**< The shared attributes this list references; NULL if the list has its own */
+    int          shareCount_;  /**< Number of lists that reference this list if it holds shared attributes */
 };
 
 #endif
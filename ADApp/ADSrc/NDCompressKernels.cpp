@@ -0,0 +1,671 @@
+/** NDCompressKernels.cpp
+ *
+ * Byte and bit shuffles and LZ4 block compression for the compressed pre-trigger ring of NDPluginCircularBuff,
+ * and the lz4 and bslz4 codecs of NDArrays.
+ * The built-in compressor is the greedy single-probe matcher of the LZ4 reference compressor: a hash table of the
+ * positions of recent 4-byte sequences finds matches, and the step between probes grows over incompressible data.
+ * Its output is a valid LZ4 block, which the LZ4 library can decompress, and the built-in decompressor checks
+ * every length and offset against the sizes of the buffers.
+ *
+ */
+
+#include <string.h>
+#include <limits.h>
+
+#include <epicsTypes.h>
+
+#include <NDConvertKernels.h>
+
+#ifdef ND_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDCompressKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* The modes of a compressed block, its first byte */
+#define BLOCK_STORED 0  /* The bytes of the block follow */
+#define BLOCK_LZ4    1  /* Plus the NDShuffle_t: the shuffled bytes of the block follow as an LZ4 block */
+
+/* The constants of the LZ4 block format */
+#define LZ4_MIN_MATCH      4    /* The shortest match */
+#define LZ4_LAST_LITERALS  5    /* The last bytes of a block are always literals */
+#define LZ4_MATCH_LIMIT    12   /* The last match starts at least this many bytes before the end */
+#define LZ4_MAX_OFFSET     65535
+#define LZ4_HASH_LOG       12
+
+/* Shuffles 2-byte elements, the low bytes then the high bytes */
+typedef void (*shuffle2Func)(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut);
+
+static void shuffle2Scalar(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  size_t i;
+
+  for (i=0; i<n; i++) {
+    pOut[i]     = pIn[2*i];
+    pOut[n + i] = pIn[2*i + 1];
+  }
+}
+
+static void unshuffle2Scalar(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  size_t i;
+
+  for (i=0; i<n; i++) {
+    pOut[2*i]     = pIn[i];
+    pOut[2*i + 1] = pIn[n + i];
+  }
+}
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("sse2") static void shuffle2SSE2(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  size_t i, n16 = n/16*16;
+
+  for (i=0; i<n16; i+=16) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *)(pIn + 2*i));
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(pIn + 2*i + 16));
+    __m128i lo = _mm_packus_epi16(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask));
+    __m128i hi = _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8));
+    _mm_storeu_si128((__m128i *)(pOut + i), lo);
+    _mm_storeu_si128((__m128i *)(pOut + n + i), hi);
+  }
+  for (; i<n; i++) {
+    pOut[i]     = pIn[2*i];
+    pOut[n + i] = pIn[2*i + 1];
+  }
+}
+
+ND_TARGET("sse2") static void unshuffle2SSE2(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  size_t i, n16 = n/16*16;
+
+  for (i=0; i<n16; i+=16) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(pIn + i));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(pIn + n + i));
+    _mm_storeu_si128((__m128i *)(pOut + 2*i), _mm_unpacklo_epi8(lo, hi));
+    _mm_storeu_si128((__m128i *)(pOut + 2*i + 16), _mm_unpackhi_epi8(lo, hi));
+  }
+  for (; i<n; i++) {
+    pOut[2*i]     = pIn[i];
+    pOut[2*i + 1] = pIn[n + i];
+  }
+}
+
+#endif
+
+/* Transposes the 8x8 bit matrix whose row i is byte i: bit j of byte i becomes bit i of byte j */
+static inline epicsUInt64 transpose8(epicsUInt64 x)
+{
+  epicsUInt64 t;
+
+  t = (x ^ (x >> 7))  & 0x00AA00AA00AA00AAULL;  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+/* Shuffles the bits of n elements, n a multiple of 8: plane 8*b+k holds bit k of byte b of every element, the
+ * bits of 8 elements in each byte */
+static void bitShuffle(size_t elementSize, const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  size_t m = n/8, b, g, j, k;
+
+  for (b=0; b<elementSize; b++) {
+    for (g=0; g<m; g++) {
+      const epicsUInt8 *pGroup = pIn + 8*g*elementSize + b;
+      epicsUInt64 x = 0;
+      for (j=0; j<8; j++) x |= (epicsUInt64)pGroup[j*elementSize] << (8*j);
+      x = transpose8(x);
+      for (k=0; k<8; k++) pOut[(8*b + k)*m + g] = (epicsUInt8)(x >> (8*k));
+    }
+  }
+}
+
+static void bitUnshuffle(size_t elementSize, const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut)
+{
+  size_t m = n/8, b, g, j, k;
+
+  for (b=0; b<elementSize; b++) {
+    for (g=0; g<m; g++) {
+      epicsUInt8 *pGroup = pOut + 8*g*elementSize + b;
+      epicsUInt64 x = 0;
+      for (k=0; k<8; k++) x |= (epicsUInt64)pIn[(8*b + k)*m + g] << (8*k);
+      x = transpose8(x);
+      for (j=0; j<8; j++) pGroup[j*elementSize] = (epicsUInt8)(x >> (8*j));
+    }
+  }
+}
+
+/** Shuffles the elements of a buffer.
+  * The byte shuffle stores byte 0 of every element, then byte 1, and so on.  The bit shuffle applies to the
+  * elements up to the last multiple of 8: it stores bit 0 of byte 0 of every element, 8 elements to a byte, then
+  * bit 1, and so on, then the other elements unchanged.  The bytes after the last whole element are copied
+  * unchanged to the end.
+  * \param[in] shuffle The shuffle.
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] pIn The input bytes.
+  * \param[in] nBytes The number of bytes.
+  * \param[out] pOut The shuffled bytes; must not overlap pIn. */
+int NDShuffle(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes, void *pOut)
+{
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  size_t n, done, i, b;
+  shuffle2Func shuffle2 = shuffle2Scalar;
+
+  if (!pIn || !pOut || (elementSize == 0)) return ND_ERROR;
+  n = nBytes / elementSize;
+  switch (shuffle) {
+    case NDShuffleNone:
+      done = 0;
+      break;
+    case NDShuffleByte:
+      if (elementSize == 1) {
+        done = 0;
+      } else if (elementSize == 2) {
+#if defined(ND_SIMD_X86)
+        if (NDSimdLevel() >= NDSimdSSE2) shuffle2 = shuffle2SSE2;
+#endif
+        shuffle2(pSrc, n, pDst);
+        done = n*elementSize;
+      } else {
+        for (i=0; i<n; i++)
+          for (b=0; b<elementSize; b++) pDst[b*n + i] = pSrc[i*elementSize + b];
+        done = n*elementSize;
+      }
+      break;
+    case NDShuffleBit:
+      bitShuffle(elementSize, pSrc, n/8*8, pDst);
+      done = n/8*8*elementSize;
+      break;
+    default:
+      return ND_ERROR;
+  }
+  memcpy(pDst + done, pSrc + done, nBytes - done);
+  return ND_SUCCESS;
+}
+
+/** Restores the elements shuffled by NDShuffle().
+  * \param[in] shuffle The shuffle of NDShuffle().
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] pIn The shuffled bytes.
+  * \param[in] nBytes The number of bytes.
+  * \param[out] pOut The elements; must not overlap pIn. */
+int NDUnshuffle(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes, void *pOut)
+{
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  size_t n, done, i, b;
+  shuffle2Func unshuffle2 = unshuffle2Scalar;
+
+  if (!pIn || !pOut || (elementSize == 0)) return ND_ERROR;
+  n = nBytes / elementSize;
+  switch (shuffle) {
+    case NDShuffleNone:
+      done = 0;
+      break;
+    case NDShuffleByte:
+      if (elementSize == 1) {
+        done = 0;
+      } else if (elementSize == 2) {
+#if defined(ND_SIMD_X86)
+        if (NDSimdLevel() >= NDSimdSSE2) unshuffle2 = unshuffle2SSE2;
+#endif
+        unshuffle2(pSrc, n, pDst);
+        done = n*elementSize;
+      } else {
+        for (i=0; i<n; i++)
+          for (b=0; b<elementSize; b++) pDst[i*elementSize + b] = pSrc[b*n + i];
+        done = n*elementSize;
+      }
+      break;
+    case NDShuffleBit:
+      bitUnshuffle(elementSize, pSrc, n/8*8, pDst);
+      done = n/8*8*elementSize;
+      break;
+    default:
+      return ND_ERROR;
+  }
+  memcpy(pDst + done, pSrc + done, nBytes - done);
+  return ND_SUCCESS;
+}
+
+#ifndef ND_WITH_LZ4
+
+static inline epicsUInt32 read32(const epicsUInt8 *p)
+{
+  epicsUInt32 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline size_t hash32(epicsUInt32 value)
+{
+  return (size_t)((value * 2654435761u) >> (32 - LZ4_HASH_LOG));
+}
+
+/* Writes the extension bytes of a length of 15 or more */
+static inline epicsUInt8* writeLength(epicsUInt8 *pOut, size_t length)
+{
+  for (; length >= 255; length -= 255) *pOut++ = 255;
+  *pOut++ = (epicsUInt8)length;
+  return pOut;
+}
+
+/* Writes a sequence: the literals from pAnchor, then the match, if matchLength is not 0.
+ * Returns NULL if it does not fit before pEnd. */
+static epicsUInt8* writeSequence(epicsUInt8 *pOut, epicsUInt8 *pEnd, const epicsUInt8 *pAnchor,
+                                 size_t literals, size_t offset, size_t matchLength)
+{
+  size_t needed = 1 + literals + literals/255 + 1 + (matchLength ? 2 + matchLength/255 + 1 : 0);
+  epicsUInt8 *pToken = pOut++;
+  size_t matchCode = matchLength ? matchLength - LZ4_MIN_MATCH : 0;
+
+  if (needed > (size_t)(pEnd - pToken)) return NULL;
+  *pToken = (epicsUInt8)(((literals < 15) ? literals : 15) << 4);
+  if (literals >= 15) pOut = writeLength(pOut, literals - 15);
+  memcpy(pOut, pAnchor, literals);
+  pOut += literals;
+  if (!matchLength) return pOut;
+  *pOut++ = (epicsUInt8)(offset & 0xFF);
+  *pOut++ = (epicsUInt8)(offset >> 8);
+  *pToken |= (epicsUInt8)((matchCode < 15) ? matchCode : 15);
+  if (matchCode >= 15) pOut = writeLength(pOut, matchCode - 15);
+  return pOut;
+}
+
+/* Compresses n bytes into an LZ4 block of at most capacity bytes; returns its size, 0 if it does not fit */
+static size_t lz4Compress(const epicsUInt8 *pIn, size_t n, epicsUInt8 *pOut, size_t capacity)
+{
+  epicsUInt32 table[1 << LZ4_HASH_LOG];
+  const epicsUInt8 *pAnchor = pIn;
+  epicsUInt8 *pOp = pOut, *pEnd = pOut + capacity;
+  size_t ip = 0, ref, length, misses = 0, h;
+
+  memset(table, 0, sizeof(table));
+  if (n > LZ4_MATCH_LIMIT) {
+    while (ip <= n - LZ4_MATCH_LIMIT) {
+      epicsUInt32 sequence = read32(pIn + ip);
+      h = hash32(sequence);
+      ref = table[h];
+      table[h] = (epicsUInt32)ip;
+      if ((ref >= ip) || (ip - ref > LZ4_MAX_OFFSET) || (read32(pIn + ref) != sequence)) {
+        /* The step grows by one every 64 misses, so incompressible data is skipped quickly */
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+      length = LZ4_MIN_MATCH;
+      while ((ip + length < n - LZ4_LAST_LITERALS) && (pIn[ref + length] == pIn[ip + length])) length++;
+      pOp = writeSequence(pOp, pEnd, pAnchor, (pIn + ip) - pAnchor, ip - ref, length);
+      if (!pOp) return 0;
+      ip += length;
+      pAnchor = pIn + ip;
+      /* Index a position inside the match, which helps the runs of equal bytes */
+      if (ip >= 2) table[hash32(read32(pIn + ip - 2))] = (epicsUInt32)(ip - 2);
+    }
+  }
+  pOp = writeSequence(pOp, pEnd, pAnchor, (pIn + n) - pAnchor, 0, 0);
+  if (!pOp) return 0;
+  return pOp - pOut;
+}
+
+/* Reads the extension bytes of a length; returns false if the input ends first */
+static inline bool readLength(const epicsUInt8 **ppIn, const epicsUInt8 *pEnd, size_t *pLength)
+{
+  epicsUInt8 byte;
+
+  do {
+    if (*ppIn >= pEnd) return false;
+    byte = *(*ppIn)++;
+    *pLength += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/* Decompresses an LZ4 block that must decode to exactly n bytes */
+static int lz4Decompress(const epicsUInt8 *pIn, size_t inBytes, epicsUInt8 *pOut, size_t n)
+{
+  const epicsUInt8 *pEnd = pIn + inBytes;
+  size_t op = 0, literals, offset, length, i;
+  epicsUInt8 token;
+
+  while (pIn < pEnd) {
+    token = *pIn++;
+    literals = token >> 4;
+    if ((literals == 15) && !readLength(&pIn, pEnd, &literals)) return ND_ERROR;
+    if ((literals > (size_t)(pEnd - pIn)) || (literals > n - op)) return ND_ERROR;
+    memcpy(pOut + op, pIn, literals);
+    pIn += literals;
+    op += literals;
+    /* The last sequence has no match */
+    if (pIn == pEnd) break;
+    if (pEnd - pIn < 2) return ND_ERROR;
+    offset = pIn[0] | ((size_t)pIn[1] << 8);
+    pIn += 2;
+    if ((offset == 0) || (offset > op)) return ND_ERROR;
+    length = token & 15;
+    if ((length == 15) && !readLength(&pIn, pEnd, &length)) return ND_ERROR;
+    length += LZ4_MIN_MATCH;
+    if (length > n - op) return ND_ERROR;
+    if (offset >= length) {
+      memcpy(pOut + op, pOut + op - offset, length);
+    } else {
+      /* The match overlaps the bytes it writes, a run of the last offset bytes */
+      for (i=0; i<length; i++) pOut[op + i] = pOut[op - offset + i];
+    }
+    op += length;
+  }
+  return (op == n) ? ND_SUCCESS : ND_ERROR;
+}
+
+#endif
+
+/** Returns the largest size of a block of nBytes compressed by NDCompressBlock(). */
+size_t NDCompressBound(size_t nBytes)
+{
+  return 1 + nBytes;
+}
+
+/** Compresses a block of elements: shuffles them and compresses them in the LZ4 block format, or stores them
+  * unchanged if that is not smaller.
+  * \param[in] shuffle The shuffle of the elements.
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] pIn The block.
+  * \param[in] nBytes The size of the block in bytes.
+  * \param[in] pScratch Work space of nBytes, used if the elements are shuffled.
+  * \param[out] pOut The compressed block.
+  * \param[in] outCapacity The size of pOut, at least NDCompressBound(nBytes).
+  * \param[out] pOutBytes The size of the compressed block. */
+int NDCompressBlock(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes,
+                    void *pScratch, void *pOut, size_t outCapacity, size_t *pOutBytes)
+{
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+  size_t compressed = 0;
+
+  if (!pIn || !pOut || !pOutBytes || (elementSize == 0) || (nBytes > INT_MAX) ||
+      (outCapacity < NDCompressBound(nBytes)) || (shuffle < NDShuffleNone) || (shuffle > NDShuffleBit))
+    return ND_ERROR;
+  if (shuffle != NDShuffleNone) {
+    if (!pScratch) return ND_ERROR;
+    NDShuffle(shuffle, elementSize, pIn, nBytes, pScratch);
+    pSrc = (const epicsUInt8 *)pScratch;
+  }
+  /* The compressed block must be smaller than the block to be worth decompressing */
+  if (nBytes > 1) {
+#ifdef ND_WITH_LZ4
+    compressed = LZ4_compress_default((const char *)pSrc, (char *)pDst + 1, (int)nBytes, (int)(nBytes - 1));
+#else
+    compressed = lz4Compress(pSrc, nBytes, pDst + 1, nBytes - 1);
+#endif
+  }
+  if (compressed > 0) {
+    pDst[0] = (epicsUInt8)(BLOCK_LZ4 + shuffle);
+  } else {
+    pDst[0] = BLOCK_STORED;
+    memcpy(pDst + 1, pIn, nBytes);
+    compressed = nBytes;
+  }
+  *pOutBytes = 1 + compressed;
+  return ND_SUCCESS;
+}
+
+/** Decompresses a block compressed by NDCompressBlock().
+  * \param[in] elementSize The size of an element in bytes, the same as for NDCompressBlock().
+  * \param[in] pIn The compressed block.
+  * \param[in] inBytes The size of the compressed block.
+  * \param[in] pScratch Work space of nBytes, used if the elements were shuffled.
+  * \param[out] pOut The block.
+  * \param[in] nBytes The size of the block; it is an error if the compressed block decodes to another size. */
+int NDDecompressBlock(size_t elementSize, const void *pIn, size_t inBytes, void *pScratch,
+                      void *pOut, size_t nBytes)
+{
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  NDShuffle_t shuffle;
+
+  if (!pIn || !pOut || (elementSize == 0) || (inBytes < 1) || (nBytes > INT_MAX)) return ND_ERROR;
+  if (pSrc[0] == BLOCK_STORED) {
+    if (inBytes - 1 != nBytes) return ND_ERROR;
+    memcpy(pDst, pSrc + 1, nBytes);
+    return ND_SUCCESS;
+  }
+  if ((pSrc[0] < BLOCK_LZ4 + NDShuffleNone) || (pSrc[0] > BLOCK_LZ4 + NDShuffleBit)) return ND_ERROR;
+  shuffle = (NDShuffle_t)(pSrc[0] - BLOCK_LZ4);
+  if (shuffle != NDShuffleNone) {
+    if (!pScratch) return ND_ERROR;
+    pDst = (epicsUInt8 *)pScratch;
+  }
+#ifdef ND_WITH_LZ4
+  if (LZ4_decompress_safe((const char *)pSrc + 1, (char *)pDst, (int)(inBytes - 1), (int)nBytes) != (int)nBytes)
+    return ND_ERROR;
+#else
+  if (lz4Decompress(pSrc + 1, inBytes - 1, pDst, nBytes) != ND_SUCCESS) return ND_ERROR;
+#endif
+  if (shuffle != NDShuffleNone) NDUnshuffle(shuffle, elementSize, pScratch, nBytes, pOut);
+  return ND_SUCCESS;
+}
+
+/** Returns the name of the library that compresses the blocks. */
+const char* NDCompressBackend(void)
+{
+#ifdef ND_WITH_LZ4
+  return "LZ4";
+#else
+  return "Built-in LZ4";
+#endif
+}
+
+/* The largest size of an LZ4 block of n bytes, as LZ4_COMPRESSBOUND() */
+static inline size_t lz4Bound(size_t n)
+{
+  return n + n/255 + 16;
+}
+
+/** Returns the largest size of an LZ4 block of nBytes compressed by NDLZ4Compress(). */
+size_t NDLZ4Bound(size_t nBytes)
+{
+  return lz4Bound(nBytes);
+}
+
+/** Compresses bytes to one LZ4 block, without a header, as the lz4 codec of NDPluginCodec.
+  * \param[in] pIn The bytes.
+  * \param[in] nBytes The number of bytes, at most INT_MAX.
+  * \param[out] pOut The LZ4 block.
+  * \param[in] outCapacity The size of pOut, at least NDLZ4Bound(nBytes).
+  * \param[out] pOutBytes The size of the LZ4 block. */
+int NDLZ4Compress(const void *pIn, size_t nBytes, void *pOut, size_t outCapacity, size_t *pOutBytes)
+{
+  size_t compressed;
+
+  if (!pIn || !pOut || !pOutBytes || (nBytes > INT_MAX) || (outCapacity < lz4Bound(nBytes))) return ND_ERROR;
+#ifdef ND_WITH_LZ4
+  compressed = LZ4_compress_default((const char *)pIn, (char *)pOut, (int)nBytes, (int)outCapacity);
+#else
+  compressed = lz4Compress((const epicsUInt8 *)pIn, nBytes, (epicsUInt8 *)pOut, outCapacity);
+#endif
+  if (compressed == 0) return ND_ERROR;
+  *pOutBytes = compressed;
+  return ND_SUCCESS;
+}
+
+/** Decompresses an LZ4 block written by NDLZ4Compress() or by the LZ4 library.
+  * \param[in] pIn The LZ4 block.
+  * \param[in] inBytes The size of the LZ4 block.
+  * \param[out] pOut The bytes.
+  * \param[in] nBytes The number of bytes; it is an error if the block decodes to another size. */
+int NDLZ4Decompress(const void *pIn, size_t inBytes, void *pOut, size_t nBytes)
+{
+  if (!pIn || !pOut || (inBytes > INT_MAX) || (nBytes > INT_MAX)) return ND_ERROR;
+#ifdef ND_WITH_LZ4
+  if (LZ4_decompress_safe((const char *)pIn, (char *)pOut, (int)inBytes, (int)nBytes) != (int)nBytes)
+    return ND_ERROR;
+  return ND_SUCCESS;
+#else
+  return lz4Decompress((const epicsUInt8 *)pIn, inBytes, (epicsUInt8 *)pOut, nBytes);
+#endif
+}
+
+static inline void write32BE(epicsUInt8 *p, epicsUInt32 value)
+{
+  p[0] = (epicsUInt8)(value >> 24);
+  p[1] = (epicsUInt8)(value >> 16);
+  p[2] = (epicsUInt8)(value >> 8);
+  p[3] = (epicsUInt8)value;
+}
+
+static inline epicsUInt32 read32BE(const epicsUInt8 *p)
+{
+  return ((epicsUInt32)p[0] << 24) | ((epicsUInt32)p[1] << 16) | ((epicsUInt32)p[2] << 8) | p[3];
+}
+
+/** Returns the number of elements in a block of a bitshuffle chunk: blockSize, or if it is 0 the default of
+  * the bitshuffle filter, about 8 kB of elements.
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] blockSize The requested number of elements in a block, a multiple of 8, or 0. */
+size_t NDBitshuffleBlockSize(size_t elementSize, size_t blockSize)
+{
+  if (blockSize > 0) return blockSize;
+  if (elementSize == 0) return 128;
+  blockSize = 8192 / elementSize / 8 * 8;
+  return (blockSize < 128) ? 128 : blockSize;
+}
+
+/** Returns the largest size of a chunk of nBytes compressed by NDBitshuffleLZ4Compress().
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] blockSize The number of elements in a block, or 0 for the default.
+  * \param[in] nBytes The size of the chunk. */
+size_t NDBitshuffleLZ4Bound(size_t elementSize, size_t blockSize, size_t nBytes)
+{
+  size_t n, last, bound = ND_BITSHUFFLE_HEADER_SIZE + nBytes;
+
+  if (elementSize == 0) return bound;
+  blockSize = NDBitshuffleBlockSize(elementSize, blockSize);
+  n = nBytes / elementSize;
+  last = n % blockSize / 8 * 8;
+  bound += (n / blockSize) * (4 + lz4Bound(blockSize*elementSize) - blockSize*elementSize);
+  if (last > 0) bound += 4 + lz4Bound(last*elementSize) - last*elementSize;
+  return bound;
+}
+
+/** Compresses a chunk in the format of the bitshuffle HDF5 filter with LZ4 compression.
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] blockSize The number of elements in a block, a multiple of 8, or 0 for the default.
+  * \param[in] pIn The chunk.
+  * \param[in] nBytes The size of the chunk in bytes, a multiple of elementSize.
+  * \param[in] pScratch Work space for one block of elements.
+  * \param[out] pOut The compressed chunk.
+  * \param[in] outCapacity The size of pOut, at least NDBitshuffleLZ4Bound().
+  * \param[out] pOutBytes The size of the compressed chunk. */
+int NDBitshuffleLZ4Compress(size_t elementSize, size_t blockSize, const void *pIn, size_t nBytes,
+                            void *pScratch, void *pOut, size_t outCapacity, size_t *pOutBytes)
+{
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  size_t n, done = 0, count, blockBytes, compressed;
+
+  if (!pIn || !pOut || !pScratch || !pOutBytes || (elementSize == 0) || (nBytes % elementSize) ||
+      (blockSize % 8) || (outCapacity < NDBitshuffleLZ4Bound(elementSize, blockSize, nBytes)))
+    return ND_ERROR;
+  blockSize = NDBitshuffleBlockSize(elementSize, blockSize);
+  if (blockSize*elementSize > INT_MAX) return ND_ERROR;
+  n = nBytes / elementSize;
+  write32BE(pDst, (epicsUInt32)((epicsUInt64)nBytes >> 32));
+  write32BE(pDst + 4, (epicsUInt32)nBytes);
+  write32BE(pDst + 8, (epicsUInt32)(blockSize*elementSize));
+  pDst += ND_BITSHUFFLE_HEADER_SIZE;
+  while (done < n) {
+    count = (n - done >= blockSize) ? blockSize : (n - done) / 8 * 8;
+    if (count == 0) break;
+    blockBytes = count*elementSize;
+    NDShuffle(NDShuffleBit, elementSize, pSrc + done*elementSize, blockBytes, pScratch);
+#ifdef ND_WITH_LZ4
+    compressed = LZ4_compress_default((const char *)pScratch, (char *)pDst + 4, (int)blockBytes,
+                                      (int)lz4Bound(blockBytes));
+#else
+    compressed = lz4Compress((const epicsUInt8 *)pScratch, blockBytes, pDst + 4, lz4Bound(blockBytes));
+#endif
+    if (compressed == 0) return ND_ERROR;
+    write32BE(pDst, (epicsUInt32)compressed);
+    pDst += 4 + compressed;
+    done += count;
+  }
+  /* The elements after the last multiple of 8 */
+  memcpy(pDst, pSrc + done*elementSize, nBytes - done*elementSize);
+  pDst += nBytes - done*elementSize;
+  *pOutBytes = pDst - (epicsUInt8 *)pOut;
+  return ND_SUCCESS;
+}
+
+/** Returns the size of the work space NDBitshuffleLZ4Decompress() needs for a chunk, one block, from the header
+  * of the chunk, or 0 if the chunk has no header.
+  * \param[in] pIn The compressed chunk.
+  * \param[in] inBytes The size of the compressed chunk.
+  * \param[in] nBytes The size of the chunk. */
+size_t NDBitshuffleLZ4ScratchSize(const void *pIn, size_t inBytes, size_t nBytes)
+{
+  size_t blockBytes;
+
+  if (!pIn || (inBytes < ND_BITSHUFFLE_HEADER_SIZE)) return 0;
+  blockBytes = read32BE((const epicsUInt8 *)pIn + 8);
+  return ((blockBytes < nBytes) ? blockBytes : nBytes) + 1;
+}
+
+/** Decompresses a chunk in the format of the bitshuffle HDF5 filter with LZ4 compression.
+  * \param[in] elementSize The size of an element in bytes.
+  * \param[in] pIn The compressed chunk.
+  * \param[in] inBytes The size of the compressed chunk.
+  * \param[in] pScratch Work space for one block of elements, NDBitshuffleLZ4ScratchSize() bytes.
+  * \param[out] pOut The chunk.
+  * \param[in] nBytes The size of the chunk; it is an error if the compressed chunk decodes to another size. */
+int NDBitshuffleLZ4Decompress(size_t elementSize, const void *pIn, size_t inBytes, void *pScratch,
+                              void *pOut, size_t nBytes)
+{
+  const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn, *pEnd = pSrc + inBytes;
+  epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+  size_t n, done = 0, count, blockSize, blockBytes, compressed;
+
+  if (!pIn || !pOut || !pScratch || (elementSize == 0) || (nBytes % elementSize) ||
+      (inBytes < ND_BITSHUFFLE_HEADER_SIZE))
+    return ND_ERROR;
+  if ((((epicsUInt64)read32BE(pSrc) << 32) | read32BE(pSrc + 4)) != (epicsUInt64)nBytes) return ND_ERROR;
+  blockBytes = read32BE(pSrc + 8);
+  if ((blockBytes == 0) || (blockBytes % elementSize) || (blockBytes / elementSize % 8) || (blockBytes > INT_MAX))
+    return ND_ERROR;
+  blockSize = blockBytes / elementSize;
+  pSrc += ND_BITSHUFFLE_HEADER_SIZE;
+  n = nBytes / elementSize;
+  while (done < n) {
+    count = (n - done >= blockSize) ? blockSize : (n - done) / 8 * 8;
+    if (count == 0) break;
+    if (pEnd - pSrc < 4) return ND_ERROR;
+    compressed = read32BE(pSrc);
+    pSrc += 4;
+    if (compressed > (size_t)(pEnd - pSrc)) return ND_ERROR;
+#ifdef ND_WITH_LZ4
+    if (LZ4_decompress_safe((const char *)pSrc, (char *)pScratch, (int)compressed, (int)(count*elementSize)) !=
+        (int)(count*elementSize))
+      return ND_ERROR;
+#else
+    if (lz4Decompress(pSrc, compressed, (epicsUInt8 *)pScratch, count*elementSize) != ND_SUCCESS) return ND_ERROR;
+#endif
+    NDUnshuffle(NDShuffleBit, elementSize, pScratch, count*elementSize, pDst + done*elementSize);
+    pSrc += compressed;
+    done += count;
+  }
+  if ((size_t)(pEnd - pSrc) != nBytes - done*elementSize) return ND_ERROR;
+  memcpy(pDst + done*elementSize, pSrc, nBytes - done*elementSize);
+  return ND_SUCCESS;
+}
@@ -0,0 +1,74 @@
+/** NDCompressKernels.h
+ *
+ * Lossless compression of array data kept in memory, for the compressed pre-trigger ring of NDPluginCircularBuff.
+ * The elements of a block are first shuffled, so that the bits that do not change from element to element form
+ * long runs: the byte shuffle stores byte 0 of every element, then byte 1, and so on; the bit shuffle stores bit 0
+ * of every element, then bit 1, and so on, which also separates the noise bits of the low byte from the constant
+ * ones.  The shuffled block is then compressed in the LZ4 block format.  The blocks are compressed independently,
+ * so threads can share the blocks of one array.  When ADCore is built with WITH_LZ4=YES, which defines
+ * ND_WITH_LZ4, the LZ4 library compresses the blocks; otherwise a built-in compressor writes the same format.
+ * A block that does not compress is stored as it is.  The 2-byte shuffles use the instruction set NDSimdLevel()
+ * returns, and the bit shuffle transposes 8x8 bit matrices in 64-bit registers.
+ *
+ * The same bit shuffle and LZ4 compressor also write the chunks of the bitshuffle HDF5 filter (filter 32008 with
+ * LZ4 compression), for the direct chunk writes of NDFileHDF5: a big-endian 8-byte size of the chunk and 4-byte
+ * size of a block in bytes, then for each block a big-endian 4-byte size and the LZ4 block of its bit shuffled
+ * elements.  The last block is rounded down to a multiple of 8 elements and the elements after it are stored as
+ * they are.
+ *
+ * NDPluginCodec compresses arrays with the same kernels: the lz4 codec is one LZ4 block of the whole array,
+ * without a header, and the bslz4 codec is a bitshuffle chunk of the whole array.  The kernels are in ADBase so
+ * that NTNDArrayConverter can also decompress the arrays it receives.
+ *
+ */
+
+#ifndef NDCompressKernels_H
+#define NDCompressKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+#define ND_COMPRESS_BLOCK_SIZE (256*1024)   /**< The bytes of the blocks that NDPluginCircularBuff compresses */
+#define ND_BITSHUFFLE_HEADER_SIZE 12        /**< The bytes before the first block of a bitshuffle chunk */
+
+/** Shuffles of the elements of a block */
+typedef enum {
+  NDShuffleNone,  /**< The elements are compressed as they are */
+  NDShuffleByte,  /**< Byte 0 of every element, then byte 1, and so on */
+  NDShuffleBit    /**< Bit 0 of every group of 8 elements, then bit 1, and so on */
+} NDShuffle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc size_t NDCompressBound(size_t nBytes);
+epicsShareFunc int NDCompressBlock(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes,
+                                   void *pScratch, void *pOut, size_t outCapacity, size_t *pOutBytes);
+epicsShareFunc int NDDecompressBlock(size_t elementSize, const void *pIn, size_t inBytes, void *pScratch,
+                                     void *pOut, size_t nBytes);
+epicsShareFunc int NDShuffle(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes, void *pOut);
+epicsShareFunc int NDUnshuffle(NDShuffle_t shuffle, size_t elementSize, const void *pIn, size_t nBytes,
+                               void *pOut);
+epicsShareFunc const char* NDCompressBackend(void);
+
+epicsShareFunc size_t NDLZ4Bound(size_t nBytes);
+epicsShareFunc int NDLZ4Compress(const void *pIn, size_t nBytes, void *pOut, size_t outCapacity, size_t *pOutBytes);
+epicsShareFunc int NDLZ4Decompress(const void *pIn, size_t inBytes, void *pOut, size_t nBytes);
+
+epicsShareFunc size_t NDBitshuffleBlockSize(size_t elementSize, size_t blockSize);
+epicsShareFunc size_t NDBitshuffleLZ4Bound(size_t elementSize, size_t blockSize, size_t nBytes);
+epicsShareFunc int NDBitshuffleLZ4Compress(size_t elementSize, size_t blockSize, const void *pIn, size_t nBytes,
+                                           void *pScratch, void *pOut, size_t outCapacity, size_t *pOutBytes);
+epicsShareFunc size_t NDBitshuffleLZ4ScratchSize(const void *pIn, size_t inBytes, size_t nBytes);
+epicsShareFunc int NDBitshuffleLZ4Decompress(size_t elementSize, const void *pIn, size_t inBytes, void *pScratch,
+                                             void *pOut, size_t nBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
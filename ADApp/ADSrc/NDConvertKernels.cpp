@@ -0,0 +1,527 @@
+/** NDConvertKernels.cpp
+ *
+ * Vectorized kernels for converting contiguous arrays between the NDArray data types.
+ * The kernels for each instruction set are compiled with function target attributes, so no special
+ * compiler flags are needed, and the fastest one the CPU supports is selected the first time it is needed.
+ *
+ */
+
+#include <string.h>
+
+#include <epicsTypes.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDConvertKernels.h"
+#include "NDFloat16.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+/* Scalar kernels, which also handle the elements left over by the vector loops */
+
+static void convertUInt16Float64Scalar(const epicsUInt16 *pIn, epicsFloat64 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = pIn[i];
+}
+
+static void convertUInt16Float32Scalar(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = pIn[i];
+}
+
+static void convertUInt8UInt16Scalar(const epicsUInt8 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = pIn[i];
+}
+
+/* Values below 0 and NaN become 0, values above 65535 become 65535, others are truncated */
+static void convertFloat64UInt16Scalar(const epicsFloat64 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsFloat64 value = pIn[i];
+    pOut[i] = (value > 0.) ? ((value < 65535.) ? (epicsUInt16)value : 65535) : 0;
+  }
+}
+
+static void convertFloat16Float32Scalar(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = NDFloat16ToFloat32(pIn[i]);
+}
+
+static void convertFloat32Float16Scalar(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = NDFloat32ToFloat16(pIn[i]);
+}
+
+/* The number of bits of the elements of the packed types, which are stored least significant bit first */
+static int packedBits(NDDataType_t dataType)
+{
+  if (dataType == NDUInt10Packed) return 10;
+  if (dataType == NDUInt12Packed) return 12;
+  return 0;
+}
+
+/* Unpacks the elements from element start on.  Each element spans two bytes, since the 10 and 12-bit elements
+ * start at bit 0, 2, 4 or 6 of a byte. */
+static void unpackScalar(const epicsUInt8 *pIn, int bits, size_t start, epicsUInt16 *pOut, size_t n)
+{
+  epicsUInt32 mask = (1u << bits) - 1;
+  size_t bit = start * bits;
+  size_t i;
+  for (i=0; i<n; i++, bit+=bits) {
+    const epicsUInt8 *p = pIn + (bit >> 3);
+    pOut[i] = (epicsUInt16)(((p[0] | ((epicsUInt32)p[1] << 8)) >> (bit & 7)) & mask);
+  }
+}
+
+/* Values that do not fit in the packed type saturate */
+static void packScalar(const epicsUInt16 *pIn, int bits, epicsUInt8 *pOut, size_t n)
+{
+  epicsUInt32 maxValue = (1u << bits) - 1;
+  epicsUInt32 buffer = 0;
+  int bufferBits = 0;
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsUInt32 value = (pIn[i] < maxValue) ? pIn[i] : maxValue;
+    buffer |= value << bufferBits;
+    for (bufferBits+=bits; bufferBits>=8; bufferBits-=8) {
+      *pOut++ = (epicsUInt8)buffer;
+      buffer >>= 8;
+    }
+  }
+  if (bufferBits > 0) *pOut = (epicsUInt8)buffer;
+}
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("sse2")
+static size_t convertUInt16Float64SSE2(const epicsUInt16 *pIn, epicsFloat64 *pOut, size_t n)
+{
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  for (i=0; i+8<=n; i+=8) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(pIn + i));
+    __m128i lo = _mm_unpacklo_epi16(in, zero);
+    __m128i hi = _mm_unpackhi_epi16(in, zero);
+    _mm_storeu_pd(pOut + i,     _mm_cvtepi32_pd(lo));
+    _mm_storeu_pd(pOut + i + 2, _mm_cvtepi32_pd(_mm_srli_si128(lo, 8)));
+    _mm_storeu_pd(pOut + i + 4, _mm_cvtepi32_pd(hi));
+    _mm_storeu_pd(pOut + i + 6, _mm_cvtepi32_pd(_mm_srli_si128(hi, 8)));
+  }
+  return i;
+}
+
+ND_TARGET("sse2")
+static size_t convertUInt16Float32SSE2(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  for (i=0; i+8<=n; i+=8) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(pIn + i));
+    _mm_storeu_ps(pOut + i,     _mm_cvtepi32_ps(_mm_unpacklo_epi16(in, zero)));
+    _mm_storeu_ps(pOut + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(in, zero)));
+  }
+  return i;
+}
+
+ND_TARGET("sse2")
+static size_t convertUInt8UInt16SSE2(const epicsUInt8 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  for (i=0; i+16<=n; i+=16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(pIn + i));
+    _mm_storeu_si128((__m128i *)(pOut + i),     _mm_unpacklo_epi8(in, zero));
+    _mm_storeu_si128((__m128i *)(pOut + i + 8), _mm_unpackhi_epi8(in, zero));
+  }
+  return i;
+}
+
+ND_TARGET("sse4.1")
+static size_t convertFloat64UInt16SSE41(const epicsFloat64 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m128d zero = _mm_setzero_pd();
+  __m128d maxValue = _mm_set1_pd(65535.);
+  for (i=0; i+8<=n; i+=8) {
+    /* _mm_max_pd returns the second operand for NaN, so NaN becomes 0 */
+    __m128i a = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(pIn + i),     zero), maxValue));
+    __m128i b = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(pIn + i + 2), zero), maxValue));
+    __m128i c = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(pIn + i + 4), zero), maxValue));
+    __m128i d = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(pIn + i + 6), zero), maxValue));
+    __m128i ab = _mm_unpacklo_epi64(a, b);
+    __m128i cd = _mm_unpacklo_epi64(c, d);
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packus_epi32(ab, cd));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t convertUInt16Float64AVX2(const epicsUInt16 *pIn, epicsFloat64 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m256i in = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pIn + i)));
+    _mm256_storeu_pd(pOut + i,     _mm256_cvtepi32_pd(_mm256_castsi256_si128(in)));
+    _mm256_storeu_pd(pOut + i + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(in, 1)));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t convertUInt16Float32AVX2(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m256i in = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pIn + i)));
+    _mm256_storeu_ps(pOut + i, _mm256_cvtepi32_ps(in));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t convertUInt8UInt16AVX2(const epicsUInt8 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m256i out = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(pIn + i)));
+    _mm256_storeu_si256((__m256i *)(pOut + i), out);
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t convertFloat64UInt16AVX2(const epicsFloat64 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m256d zero = _mm256_setzero_pd();
+  __m256d maxValue = _mm256_set1_pd(65535.);
+  for (i=0; i+8<=n; i+=8) {
+    __m128i a = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(pIn + i),     zero), maxValue));
+    __m128i b = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(pIn + i + 4), zero), maxValue));
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packus_epi32(a, b));
+  }
+  return i;
+}
+
+/* Every CPU with AVX2 also has the F16C conversion instructions */
+ND_TARGET("avx2,f16c")
+static size_t convertFloat16Float32F16C(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    _mm256_storeu_ps(pOut + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(pIn + i))));
+  }
+  return i;
+}
+
+ND_TARGET("avx2,f16c")
+static size_t convertFloat32Float16F16C(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m128i out = _mm256_cvtps_ph(_mm256_loadu_ps(pIn + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128((__m128i *)(pOut + i), out);
+  }
+  return i;
+}
+
+/* 8 packed elements are 'bits' bytes.  The shuffle puts the two bytes that hold each element in its 16-bit lane,
+ * and as SSE has no shift by a different count in each lane the lanes are shifted left by the multiply, which drops
+ * the bits of the next element, and then right by 16-bits.  The loads read 16 bytes, so the loop stops while they
+ * are inside the input. */
+ND_TARGET("sse4.1")
+static size_t unpackSSE41(const epicsUInt8 *pIn, size_t inBytes, int bits, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m128i shuffle = (bits == 12) ? _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11) :
+                                   _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+  __m128i scale = (bits == 12) ? _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1) :
+                                 _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+  __m128i shift = _mm_cvtsi32_si128(16 - bits);
+  for (i=0; (i+8<=n) && (i/8*bits + 16<=inBytes); i+=8) {
+    __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pIn + i/8*bits)), shuffle);
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_srl_epi16(_mm_mullo_epi16(in, scale), shift));
+  }
+  return i;
+}
+
+/* The same as unpackSSE41(), with the second 8 elements loaded into the upper 128-bit lane */
+ND_TARGET("avx2")
+static size_t unpackAVX2(const epicsUInt8 *pIn, size_t inBytes, int bits, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m256i shuffle = (bits == 12) ?
+    _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11, 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11) :
+    _mm256_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9, 0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+  __m256i scale = (bits == 12) ? _mm256_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1) :
+                                 _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+  __m128i shift = _mm_cvtsi32_si128(16 - bits);
+  for (i=0; (i+16<=n) && (i/8*bits + bits + 16<=inBytes); i+=16) {
+    const epicsUInt8 *p = pIn + i/8*bits;
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                         _mm_loadu_si128((const __m128i *)(p + bits)), 1);
+    in = _mm256_shuffle_epi8(in, shuffle);
+    _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_srl_epi16(_mm256_mullo_epi16(in, scale), shift));
+  }
+  return i;
+}
+
+ND_TARGET("avx512f")
+static size_t convertUInt16Float64AVX512(const epicsUInt16 *pIn, epicsFloat64 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m512i in = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(pIn + i)));
+    _mm512_storeu_pd(pOut + i,     _mm512_cvtepi32_pd(_mm512_castsi512_si256(in)));
+    _mm512_storeu_pd(pOut + i + 8, _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(in, 1)));
+  }
+  return i;
+}
+
+ND_TARGET("avx512f")
+static size_t convertUInt16Float32AVX512(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m512i in = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(pIn + i)));
+    _mm512_storeu_ps(pOut + i, _mm512_cvtepi32_ps(in));
+  }
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static size_t convertUInt16Float64NEON(const epicsUInt16 *pIn, epicsFloat64 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+4<=n; i+=4) {
+    uint32x4_t in = vmovl_u16(vld1_u16(pIn + i));
+    vst1q_f64(pOut + i,     vcvtq_f64_u64(vmovl_u32(vget_low_u32(in))));
+    vst1q_f64(pOut + i + 2, vcvtq_f64_u64(vmovl_u32(vget_high_u32(in))));
+  }
+  return i;
+}
+
+static size_t convertUInt16Float32NEON(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    uint16x8_t in = vld1q_u16(pIn + i);
+    vst1q_f32(pOut + i,     vcvtq_f32_u32(vmovl_u16(vget_low_u16(in))));
+    vst1q_f32(pOut + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(in))));
+  }
+  return i;
+}
+
+static size_t convertUInt8UInt16NEON(const epicsUInt8 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    uint8x16_t in = vld1q_u8(pIn + i);
+    vst1q_u16(pOut + i,     vmovl_u8(vget_low_u8(in)));
+    vst1q_u16(pOut + i + 8, vmovl_u8(vget_high_u8(in)));
+  }
+  return i;
+}
+
+static size_t convertFloat64UInt16NEON(const epicsFloat64 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  float64x2_t zero = vdupq_n_f64(0.);
+  float64x2_t maxValue = vdupq_n_f64(65535.);
+  for (i=0; i+4<=n; i+=4) {
+    /* vmaxnmq_f64 returns the number when the other operand is NaN, so NaN becomes 0 */
+    uint64x2_t a = vcvtq_u64_f64(vminq_f64(vmaxnmq_f64(vld1q_f64(pIn + i),     zero), maxValue));
+    uint64x2_t b = vcvtq_u64_f64(vminq_f64(vmaxnmq_f64(vld1q_f64(pIn + i + 2), zero), maxValue));
+    uint32x4_t ab = vcombine_u32(vmovn_u64(a), vmovn_u64(b));
+    vst1_u16(pOut + i, vmovn_u32(ab));
+  }
+  return i;
+}
+
+static size_t convertFloat16Float32NEON(const epicsUInt16 *pIn, epicsFloat32 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+4<=n; i+=4) {
+    vst1q_f32(pOut + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(pIn + i))));
+  }
+  return i;
+}
+
+/* The conversion rounds to nearest even with the default rounding mode */
+static size_t convertFloat32Float16NEON(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+4<=n; i+=4) {
+    vst1_u16(pOut + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(pIn + i))));
+  }
+  return i;
+}
+
+/* As unpackSSE41(), but NEON shifts each lane by its own count */
+static size_t unpackNEON(const epicsUInt8 *pIn, size_t inBytes, int bits, epicsUInt16 *pOut, size_t n)
+{
+  static const epicsUInt8 shuffle12[16] = {0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11};
+  static const epicsUInt8 shuffle10[16] = {0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9};
+  static const epicsInt16 shift12[8] = {0, -4, 0, -4, 0, -4, 0, -4};
+  static const epicsInt16 shift10[8] = {0, -2, -4, -6, 0, -2, -4, -6};
+  size_t i;
+  uint8x16_t shuffle = vld1q_u8((bits == 12) ? shuffle12 : shuffle10);
+  int16x8_t shift = vld1q_s16((bits == 12) ? shift12 : shift10);
+  uint16x8_t mask = vdupq_n_u16((epicsUInt16)((1u << bits) - 1));
+  for (i=0; (i+8<=n) && (i/8*bits + 16<=inBytes); i+=8) {
+    uint16x8_t in = vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(pIn + i/8*bits), shuffle));
+    vst1q_u16(pOut + i, vandq_u16(vshlq_u16(in, shift), mask));
+  }
+  return i;
+}
+
+#endif
+
+/** Converts a contiguous array between data types with the fastest kernel the CPU supports.
+  * Only the pairs that are common in plugins have vectorized kernels: UInt16 to Float64 and Float32,
+  * UInt8 to UInt16, Float64 to UInt16, Float16 to and from Float32, and the packed types to UInt16; arrays of the
+  * same type are copied with memcpy().  Float64 to UInt16 saturates, values below 0 and NaN become 0 and values
+  * above 65535 become 65535.  Float32 to Float16 rounds to nearest even, and values of 65520 and above become
+  * infinity.  UInt16 is packed to the packed types by scalar code, and values that do not fit saturate.
+  * \param[in] dataTypeIn The data type of the input.
+  * \param[in] pIn The input elements.
+  * \param[in] dataTypeOut The data type of the output.
+  * \param[out] pOut The output elements.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS if the conversion was done, ND_ERROR if there is no kernel for this pair of data types
+  * and the caller must do it.
+  */
+int NDConvertContiguous(NDDataType_t dataTypeIn, const void *pIn,
+                        NDDataType_t dataTypeOut, void *pOut, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t done = 0;
+
+  if (dataTypeIn == dataTypeOut) {
+    static const size_t elementSize[] = {1, 1, 2, 2, 4, 4, 4, 8, 2};
+    int bits = packedBits(dataTypeIn);
+    if (bits) {
+      memcpy(pOut, pIn, (nElements * bits + 7) / 8);
+      return ND_SUCCESS;
+    }
+    if ((dataTypeIn < NDInt8) || (dataTypeIn > NDFloat16)) return ND_ERROR;
+    memcpy(pOut, pIn, nElements * elementSize[dataTypeIn]);
+    return ND_SUCCESS;
+  }
+
+  if (packedBits(dataTypeIn) && (dataTypeOut == NDUInt16)) {
+    const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+    int bits = packedBits(dataTypeIn);
+    size_t inBytes = (nElements * bits + 7) / 8;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       done = unpackAVX2(pSrc, inBytes, bits, pDst, nElements);
+    else if (level >= NDSimdSSE41) done = unpackSSE41(pSrc, inBytes, bits, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = unpackNEON(pSrc, inBytes, bits, pDst, nElements);
+#endif
+    unpackScalar(pSrc, bits, done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDUInt16) && packedBits(dataTypeOut)) {
+    packScalar((const epicsUInt16 *)pIn, packedBits(dataTypeOut), (epicsUInt8 *)pOut, nElements);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDUInt16) && (dataTypeOut == NDFloat64)) {
+    const epicsUInt16 *pSrc = (const epicsUInt16 *)pIn;
+    epicsFloat64 *pDst = (epicsFloat64 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX512)    done = convertUInt16Float64AVX512(pSrc, pDst, nElements);
+    else if (level >= NDSimdAVX2) done = convertUInt16Float64AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE2) done = convertUInt16Float64SSE2(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertUInt16Float64NEON(pSrc, pDst, nElements);
+#endif
+    convertUInt16Float64Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDUInt16) && (dataTypeOut == NDFloat32)) {
+    const epicsUInt16 *pSrc = (const epicsUInt16 *)pIn;
+    epicsFloat32 *pDst = (epicsFloat32 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX512)    done = convertUInt16Float32AVX512(pSrc, pDst, nElements);
+    else if (level >= NDSimdAVX2) done = convertUInt16Float32AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE2) done = convertUInt16Float32SSE2(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertUInt16Float32NEON(pSrc, pDst, nElements);
+#endif
+    convertUInt16Float32Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDUInt8) && (dataTypeOut == NDUInt16)) {
+    const epicsUInt8 *pSrc = (const epicsUInt8 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      done = convertUInt8UInt16AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE2) done = convertUInt8UInt16SSE2(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertUInt8UInt16NEON(pSrc, pDst, nElements);
+#endif
+    convertUInt8UInt16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDFloat64) && (dataTypeOut == NDUInt16)) {
+    const epicsFloat64 *pSrc = (const epicsFloat64 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       done = convertFloat64UInt16AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE41) done = convertFloat64UInt16SSE41(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertFloat64UInt16NEON(pSrc, pDst, nElements);
+#endif
+    convertFloat64UInt16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDFloat16) && (dataTypeOut == NDFloat32)) {
+    const epicsUInt16 *pSrc = (const epicsUInt16 *)pIn;
+    epicsFloat32 *pDst = (epicsFloat32 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2) done = convertFloat16Float32F16C(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertFloat16Float32NEON(pSrc, pDst, nElements);
+#endif
+    convertFloat16Float32Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDFloat32) && (dataTypeOut == NDFloat16)) {
+    const epicsFloat32 *pSrc = (const epicsFloat32 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2) done = convertFloat32Float16F16C(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = convertFloat32Float16NEON(pSrc, pDst, nElements);
+#endif
+    convertFloat32Float16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  return ND_ERROR;
+}
@@ -0,0 +1,29 @@
+/** NDConvertKernels.h
+ *
+ * Vectorized kernels for converting contiguous arrays between the NDArray data types.
+ * The instruction set is selected at run time from the features of the CPU, see NDSimdKernels.h.
+ *
+ */
+
+#ifndef NDConvertKernels_H
+#define NDConvertKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+#include "NDSimdKernels.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDConvertContiguous(NDDataType_t dataTypeIn, const void *pIn,
+                                       NDDataType_t dataTypeOut, void *pOut, size_t nElements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
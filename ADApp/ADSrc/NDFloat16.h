@@ -0,0 +1,83 @@
+/** NDFloat16.h
+ *
+ * The element type of NDFloat16 arrays, an IEEE 754 binary16 (half precision) float.
+ *
+ */
+
+#ifndef NDFloat16_H
+#define NDFloat16_H
+
+#include <string.h>
+
+#include <epicsTypes.h>
+
+/** Converts the bits of a half precision float to a float; every half precision value is exact as a float. */
+inline epicsFloat32 NDFloat16ToFloat32(epicsUInt16 half)
+{
+    epicsUInt32 sign = (epicsUInt32)(half & 0x8000) << 16;
+    epicsUInt32 exponent = (half >> 10) & 0x1f;
+    epicsUInt32 mantissa = half & 0x3ff;
+    epicsUInt32 bits;
+    epicsFloat32 value;
+
+    if (exponent == 0x1f) {
+        /* Infinity, and NaN which is made quiet as the hardware conversions do */
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else {
+        /* Zero and the subnormals, mantissa * 2^-24 */
+        value = (epicsFloat32)mantissa * 5.9604644775390625e-8f;
+        return sign ? -value : value;
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/** Converts a float to the bits of the nearest half precision float, rounding ties to even as the
+  * hardware conversions do.  Values of 65520 and above become infinity, and NaN becomes a quiet NaN. */
+inline epicsUInt16 NDFloat32ToFloat16(epicsFloat32 value)
+{
+    epicsUInt32 bits, absBits, sign, result, remainder, halfway;
+    int shift;
+
+    memcpy(&bits, &value, sizeof(bits));
+    sign = (bits >> 16) & 0x8000;
+    absBits = bits & 0x7fffffff;
+    if (absBits > 0x7f800000) return (epicsUInt16)(sign | 0x7e00 | ((absBits >> 13) & 0x3ff));
+    if (absBits >= 0x477ff000) return (epicsUInt16)(sign | 0x7c00);
+    if (absBits < 0x38800000) {
+        /* Below 2^-14 the result is subnormal, and below 2^-25 it rounds to zero */
+        if (absBits <= 0x33000000) return (epicsUInt16)sign;
+        shift = 126 - (int)(absBits >> 23);
+        bits = (absBits & 0x7fffff) | 0x800000;
+        result = bits >> shift;
+        remainder = bits & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        result = (absBits >> 13) - (112 << 10);
+        remainder = absBits & 0x1fff;
+        halfway = 0x1000;
+    }
+    /* A carry out of the mantissa correctly increments the exponent */
+    if ((remainder > halfway) || ((remainder == halfway) && (result & 1))) result++;
+    return (epicsUInt16)(sign | result);
+}
+
+/** An element of an NDFloat16 array.  It converts to and from float, so the templates that handle the other
+  * data types also handle NDFloat16 arrays, doing their arithmetic in single precision.  Contiguous arrays are
+  * converted much faster by NDConvertContiguous(), which uses the F16C or NEON conversion instructions. */
+class NDFloat16_t {
+public:
+    NDFloat16_t() {}
+    NDFloat16_t(epicsFloat32 value) : bits(NDFloat32ToFloat16(value)) {}
+    operator epicsFloat32() const { return NDFloat16ToFloat32(bits); }
+    NDFloat16_t& operator+=(epicsFloat32 value) { bits = NDFloat32ToFloat16(*this + value); return *this; }
+    NDFloat16_t& operator-=(epicsFloat32 value) { bits = NDFloat32ToFloat16(*this - value); return *this; }
+    NDFloat16_t& operator*=(epicsFloat32 value) { bits = NDFloat32ToFloat16(*this * value); return *this; }
+    NDFloat16_t& operator/=(epicsFloat32 value) { bits = NDFloat32ToFloat16(*this / value); return *this; }
+
+    epicsUInt16 bits;   /**< The IEEE 754 binary16 bits */
+};
+
+#endif
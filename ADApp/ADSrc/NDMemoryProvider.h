@@ -0,0 +1,70 @@
+/** NDMemoryProvider.h
+ *
+ * Interface for the memory that an NDArrayPool allocates NDArray buffers from.
+ *
+ */
+
+#ifndef NDMemoryProvider_H
+#define NDMemoryProvider_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+class NDDeviceMemory;
+
+/** Abstract base class for memory providers.
+  * An NDArrayPool that is given a memory provider draws all of its NDArray buffers from it instead of malloc(),
+  * so drivers and plugins can work directly in memory such as CUDA pinned host memory, RDMA registered
+  * regions or POSIX shared memory.
+  * A provider may be called from any thread, but the NDArrayPool never calls it concurrently for the same pool.
+  */
+class epicsShareClass NDMemoryProvider {
+public:
+    virtual ~NDMemoryProvider() {}
+    /** Allocates a buffer.
+      * \param[in] size The number of bytes required.
+      * \return Pointer to the buffer, or NULL if the memory is exhausted. */
+    virtual void* allocate(size_t size) = 0;
+    /** Frees a buffer that allocate() returned.
+      * \param[in] pData Pointer to the buffer.
+      * \param[in] size The size that was passed to allocate(). */
+    virtual void free(void *pData, size_t size) = 0;
+    /** Returns the name of the provider, which NDArrayPool::report() prints. */
+    virtual const char* name() = 0;
+    /** Returns the provider if its memory is that of a device, or NULL if it is host memory. */
+    virtual NDDeviceMemory* device() { return NULL; }
+};
+
+/** Abstract base class for the memory of a device, such as a GPU, that the host cannot read or write.
+  * The arrays of an NDArrayPool that is given a device provider are device-resident: their pData is a device
+  * pointer and their NDArray::pDevice is the provider.  The work on the data of the device is queued on streams,
+  * handles that the provider creates, and is done in order on each stream.  The NDArray::deviceStream of an array
+  * is the stream its data is being written on; the data is ready when the work queued on it so far is done.
+  * NDArrayPool::copy() copies arrays to, from and on the device, and NDPluginDevice is the base class of the
+  * plugins that process device-resident arrays.
+  * The methods return ND_SUCCESS or ND_ERROR, and may be called from any thread.
+  */
+class epicsShareClass NDDeviceMemory : public NDMemoryProvider {
+public:
+    NDDeviceMemory* device() { return this; }
+    /** Creates a stream.
+      * \return The stream, or NULL if it cannot be created. */
+    virtual void* createStream() = 0;
+    /** Destroys a stream that createStream() returned, after the work queued on it is done. */
+    virtual void destroyStream(void *stream) = 0;
+    /** Queues a copy from host memory to the device on a stream.  The host memory must not change until the
+      * stream is synchronized. */
+    virtual int toDevice(void *pDevice, const void *pHost, size_t size, void *stream) = 0;
+    /** Copies device memory to the host once the work queued on a stream is done, and returns when the copy is done. */
+    virtual int toHost(void *pHost, const void *pDevice, size_t size, void *stream) = 0;
+    /** Queues a copy of device memory on a stream. */
+    virtual int copyDevice(void *pTo, const void *pFrom, size_t size, void *stream) = 0;
+    /** Makes the work queued on a stream from now on wait for the work queued so far on another stream,
+      * without waiting in the host. */
+    virtual int waitStream(void *stream, void *otherStream) = 0;
+    /** Waits in the host for the work queued on a stream to be done. */
+    virtual int synchronize(void *stream) = 0;
+};
+
+#endif
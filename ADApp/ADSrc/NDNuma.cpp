@@ -0,0 +1,175 @@
+/** NDNuma.cpp
+ *
+ * Helper functions for placing NDArray memory and plugin threads on NUMA nodes.
+ * These use the Linux system calls directly so there is no dependency on libnuma.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+  #include <sched.h>
+  #include <pthread.h>
+  #include <unistd.h>
+  #include <sys/syscall.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDAttribute.h"
+#include "NDNuma.h"
+
+#ifdef __linux__
+/* From <numaif.h>, which is only installed with libnuma */
+#define ND_MPOL_BIND 2
+#define ND_MPOL_MF_MOVE (1<<1)
+#endif
+
+/** Returns the number of NUMA nodes on this computer, limited to ND_NUMA_MAX_NODES; 1 if NUMA is not supported. */
+int NDNumaNumNodes(void)
+{
+  static int numNodes = 0;
+
+  if (numNodes == 0) {
+    int n = 1;
+    #ifdef __linux__
+    char path[64];
+    FILE *fp;
+    while (n < ND_NUMA_MAX_NODES) {
+      sprintf(path, "/sys/devices/system/node/node%d/cpulist", n);
+      fp = fopen(path, "r");
+      if (!fp) break;
+      fclose(fp);
+      n++;
+    }
+    #endif
+    numNodes = n;
+  }
+  return numNodes;
+}
+
+/** Returns the NUMA node of the CPU that the calling thread is running on; 0 if NUMA is not supported. */
+int NDNumaCurrentNode(void)
+{
+  #if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu, node;
+  if ((syscall(SYS_getcpu, &cpu, &node, NULL) == 0) && ((int)node < ND_NUMA_MAX_NODES)) return node;
+  #endif
+  return 0;
+}
+
+/** Binds the physical pages of a memory region to a NUMA node.
+  * This must be done before the memory is first touched, which is when the pages are allocated.
+  * \param[in] pData Start of the region; must be aligned to the page size.
+  * \param[in] size Size of the region in bytes.
+  * \param[in] node The NUMA node.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDNumaBindMemory(void *pData, size_t size, int node)
+{
+  #if defined(__linux__) && defined(SYS_mbind)
+  unsigned long nodeMask = 1UL << node;
+  if ((node < 0) || (node >= ND_NUMA_MAX_NODES)) return ND_ERROR;
+  if (syscall(SYS_mbind, pData, size, ND_MPOL_BIND, &nodeMask, sizeof(nodeMask)*8, ND_MPOL_MF_MOVE) == 0)
+    return ND_SUCCESS;
+  #endif
+  return ND_ERROR;
+}
+
+#ifdef __linux__
+/** Adds the CPUs of a list of the form "0-7,16-23" to a CPU set; returns the number of CPUs in the set. */
+static int parseCpuList(const char *cpuList, cpu_set_t *pCpuSet)
+{
+  char list[1024];
+  char *pToken, *pSave;
+  int first, last, cpu;
+
+  strncpy(list, cpuList, sizeof(list)-1);
+  list[sizeof(list)-1] = 0;
+  for (pToken = strtok_r(list, ", \n", &pSave); pToken; pToken = strtok_r(NULL, ", \n", &pSave)) {
+    int n = sscanf(pToken, "%d-%d", &first, &last);
+    if (n < 1) continue;
+    if (n == 1) last = first;
+    for (cpu=first; (cpu<=last) && (cpu<CPU_SETSIZE); cpu++) {
+      if (cpu >= 0) CPU_SET(cpu, pCpuSet);
+    }
+  }
+  return CPU_COUNT(pCpuSet);
+}
+#endif
+
+/** Sets the CPU affinity of the calling thread to the CPUs of a NUMA node.
+  * \param[in] node The NUMA node; -1 allows the thread to run on all CPUs.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDNumaPinThread(int node)
+{
+  #ifdef __linux__
+  cpu_set_t cpuSet;
+  char path[64];
+  char cpuList[1024];
+  FILE *fp;
+  int cpu;
+
+  CPU_ZERO(&cpuSet);
+  if (node < 0) {
+    long numCpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (cpu=0; (cpu<numCpus) && (cpu<CPU_SETSIZE); cpu++) CPU_SET(cpu, &cpuSet);
+  } else {
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(path, "r");
+    if (!fp) return ND_ERROR;
+    if (!fgets(cpuList, sizeof(cpuList), fp)) cpuList[0] = 0;
+    fclose(fp);
+    /* The list has the form "0-7,16-23" */
+    if (parseCpuList(cpuList, &cpuSet) == 0) return ND_ERROR;
+  }
+  if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0) return ND_SUCCESS;
+  #endif
+  return ND_ERROR;
+}
+
+/** Sets the CPU affinity of the calling thread to a list of CPUs.
+  * \param[in] cpuList The CPUs, in the form "2,4-7"; an empty list allows the thread to run on all CPUs.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDNumaPinThreadToCpus(const char *cpuList)
+{
+  #ifdef __linux__
+  cpu_set_t cpuSet;
+
+  if (!cpuList || (strspn(cpuList, " \t\n") == strlen(cpuList))) return NDNumaPinThread(-1);
+  CPU_ZERO(&cpuSet);
+  if (parseCpuList(cpuList, &cpuSet) == 0) return ND_ERROR;
+  if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0) return ND_SUCCESS;
+  #endif
+  return ND_ERROR;
+}
+
+/** Sets the scheduling policy and priority of the calling thread.
+  * The real-time policies need the CAP_SYS_NICE capability or an RLIMIT_RTPRIO limit.
+  * \param[in] policy One of the NDSchedPolicy_t values.
+  * \param[in] priority The real-time priority, 1 to 99; ignored for NDSchedDefault.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDNumaSetScheduler(int policy, int priority)
+{
+  #ifdef __linux__
+  struct sched_param param;
+  int osPolicy;
+
+  switch (policy) {
+    case NDSchedDefault: osPolicy = SCHED_OTHER; priority = 0; break;
+    case NDSchedFIFO:    osPolicy = SCHED_FIFO; break;
+    case NDSchedRR:      osPolicy = SCHED_RR; break;
+    default: return ND_ERROR;
+  }
+  if ((osPolicy != SCHED_OTHER) &&
+      ((priority < sched_get_priority_min(osPolicy)) || (priority > sched_get_priority_max(osPolicy)))) return ND_ERROR;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  if (pthread_setschedparam(pthread_self(), osPolicy, &param) == 0) return ND_SUCCESS;
+  #endif
+  return ND_ERROR;
+}
@@ -0,0 +1,41 @@
+/** NDNuma.h
+ *
+ * Helper functions for placing NDArray memory and plugin threads on NUMA nodes,
+ * and for setting the CPU affinity and scheduling policy of plugin threads.
+ * These are only supported on Linux; on other platforms there is a single node 0.
+ *
+ */
+
+#ifndef NDNuma_H
+#define NDNuma_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+/** Maximum number of NUMA nodes that the NDArrayPool keeps separate free lists for */
+#define ND_NUMA_MAX_NODES 8
+
+/** Scheduling policies for NDNumaSetScheduler() */
+typedef enum {
+    NDSchedDefault,     /**< The normal time-sharing policy, SCHED_OTHER */
+    NDSchedFIFO,        /**< Real-time first-in first-out, SCHED_FIFO */
+    NDSchedRR           /**< Real-time round-robin, SCHED_RR */
+} NDSchedPolicy_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDNumaNumNodes(void);
+epicsShareFunc int NDNumaCurrentNode(void);
+epicsShareFunc int NDNumaBindMemory(void *pData, size_t size, int node);
+epicsShareFunc int NDNumaPinThread(int node);
+epicsShareFunc int NDNumaPinThreadToCpus(const char *cpuList);
+epicsShareFunc int NDNumaSetScheduler(int policy, int priority);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1059 @@
+/** NDSimdKernels.cpp
+ *
+ * Vectorized primitives that the kernels of ADCore and of the plugins share.
+ * The kernels for each instruction set are compiled with function target attributes, so no special
+ * compiler flags are needed, and the fastest one the CPU supports is selected the first time it is needed.
+ *
+ */
+
+#include <string.h>
+
+#include <epicsTypes.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDSimdKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+/* -1 until the CPU features are detected */
+static int simdLevel = -1;
+static int simdMaxLevel = NDSimdNEON;
+
+static NDSimdLevel_t detectSimdLevel(void)
+{
+#if defined(ND_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return NDSimdAVX512;
+  if (__builtin_cpu_supports("avx2"))    return NDSimdAVX2;
+  if (__builtin_cpu_supports("sse4.1"))  return NDSimdSSE41;
+  if (__builtin_cpu_supports("sse2"))    return NDSimdSSE2;
+#elif defined(ND_SIMD_NEON)
+  return NDSimdNEON;
+#endif
+  return NDSimdNone;
+}
+
+/** Returns the SIMD instruction set that the kernels use on this CPU. */
+NDSimdLevel_t NDSimdLevel(void)
+{
+  if (simdLevel < 0) simdLevel = detectSimdLevel();
+  return (NDSimdLevel_t)((simdLevel < simdMaxLevel) ? simdLevel : simdMaxLevel);
+}
+
+/** Returns the name of a SIMD instruction set. */
+const char* NDSimdLevelName(NDSimdLevel_t level)
+{
+  switch (level) {
+    case NDSimdSSE2:   return "SSE2";
+    case NDSimdSSE41:  return "SSE4.1";
+    case NDSimdAVX2:   return "AVX2";
+    case NDSimdAVX512: return "AVX-512";
+    case NDSimdNEON:   return "NEON";
+    default:           return "none";
+  }
+}
+
+/** Limits the SIMD instruction set that the kernels use, e.g. to compare the results with the scalar code.
+  * \param[in] level The highest instruction set to use; NDSimdNone disables the vectorized kernels. */
+void NDSimdSetMaxLevel(NDSimdLevel_t level)
+{
+  simdMaxLevel = level;
+}
+
+/*
+ * Minimum, maximum and widening sums.
+ *
+ * The array is processed in chunks that are small enough for the integer accumulators of the vector lanes
+ * not to overflow.  The chunk that first lowers the minimum or raises the maximum is remembered, and only
+ * that chunk is searched again for the index of the first element with the value, so the array is read once.
+ */
+
+/* The number of elements in each chunk; the 32-bit lane sums of 16-bit values cannot overflow */
+#define STATS_CHUNK 4096
+
+/* The statistics of a chunk, exact because they are integers */
+typedef struct {
+  epicsUInt32 min;
+  epicsUInt32 max;
+  epicsUInt64 sum;
+  epicsUInt64 sumSquares;
+} statsRange_t;
+
+/* Scalar kernels, which also handle the elements left over by the vector loops */
+
+template <typename epicsType>
+static void statsRangeScalar(const epicsType *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsUInt32 value = pData[i];
+    if (value < pRange->min) pRange->min = value;
+    if (value > pRange->max) pRange->max = value;
+    pRange->sum += value;
+    pRange->sumSquares += (epicsUInt64)value * value;
+  }
+}
+
+#if defined(ND_SIMD_X86)
+
+/* Reduces the lanes of the vector accumulators; the 64-bit lane sums are added to the range */
+static void reduceUInt64(const epicsUInt64 *pLanes, int nLanes, epicsUInt64 *pSum)
+{
+  for (int i=0; i<nLanes; i++) *pSum += pLanes[i];
+}
+
+ND_TARGET("sse4.1")
+static size_t statsUInt16SSE41(const epicsUInt16 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  __m128i vmin = _mm_set1_epi16((short)pRange->min);
+  __m128i vmax = _mm_set1_epi16((short)pRange->max);
+  __m128i sum32 = zero, sumSquares64 = zero;
+  epicsUInt16 mins[8], maxs[8];
+  epicsUInt32 sums[4];
+  epicsUInt64 squares[2];
+  int j;
+
+  for (i=0; i+8<=n; i+=8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pData + i));
+    vmin = _mm_min_epu16(vmin, v);
+    vmax = _mm_max_epu16(vmax, v);
+    __m128i lo = _mm_unpacklo_epi16(v, zero);
+    __m128i hi = _mm_unpackhi_epi16(v, zero);
+    sum32 = _mm_add_epi32(sum32, _mm_add_epi32(lo, hi));
+    /* _mm_mul_epu32 multiplies the even 32-bit lanes into 64-bit products */
+    sumSquares64 = _mm_add_epi64(sumSquares64, _mm_mul_epu32(lo, lo));
+    sumSquares64 = _mm_add_epi64(sumSquares64, _mm_mul_epu32(_mm_srli_epi64(lo, 32), _mm_srli_epi64(lo, 32)));
+    sumSquares64 = _mm_add_epi64(sumSquares64, _mm_mul_epu32(hi, hi));
+    sumSquares64 = _mm_add_epi64(sumSquares64, _mm_mul_epu32(_mm_srli_epi64(hi, 32), _mm_srli_epi64(hi, 32)));
+  }
+  _mm_storeu_si128((__m128i *)mins, vmin);
+  _mm_storeu_si128((__m128i *)maxs, vmax);
+  _mm_storeu_si128((__m128i *)sums, sum32);
+  _mm_storeu_si128((__m128i *)squares, sumSquares64);
+  for (j=0; j<8; j++) {
+    if (mins[j] < pRange->min) pRange->min = mins[j];
+    if (maxs[j] > pRange->max) pRange->max = maxs[j];
+  }
+  for (j=0; j<4; j++) pRange->sum += sums[j];
+  reduceUInt64(squares, 2, &pRange->sumSquares);
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t statsUInt16AVX2(const epicsUInt16 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i vmin = _mm256_set1_epi16((short)pRange->min);
+  __m256i vmax = _mm256_set1_epi16((short)pRange->max);
+  __m256i sum32 = zero, sumSquares64 = zero;
+  epicsUInt16 mins[16], maxs[16];
+  epicsUInt32 sums[8];
+  epicsUInt64 squares[4];
+  int j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(pData + i));
+    vmin = _mm256_min_epu16(vmin, v);
+    vmax = _mm256_max_epu16(vmax, v);
+    /* The unpacks work within each 128-bit half, which does not matter for the sums */
+    __m256i lo = _mm256_unpacklo_epi16(v, zero);
+    __m256i hi = _mm256_unpackhi_epi16(v, zero);
+    sum32 = _mm256_add_epi32(sum32, _mm256_add_epi32(lo, hi));
+    sumSquares64 = _mm256_add_epi64(sumSquares64, _mm256_mul_epu32(lo, lo));
+    sumSquares64 = _mm256_add_epi64(sumSquares64,
+                                    _mm256_mul_epu32(_mm256_srli_epi64(lo, 32), _mm256_srli_epi64(lo, 32)));
+    sumSquares64 = _mm256_add_epi64(sumSquares64, _mm256_mul_epu32(hi, hi));
+    sumSquares64 = _mm256_add_epi64(sumSquares64,
+                                    _mm256_mul_epu32(_mm256_srli_epi64(hi, 32), _mm256_srli_epi64(hi, 32)));
+  }
+  _mm256_storeu_si256((__m256i *)mins, vmin);
+  _mm256_storeu_si256((__m256i *)maxs, vmax);
+  _mm256_storeu_si256((__m256i *)sums, sum32);
+  _mm256_storeu_si256((__m256i *)squares, sumSquares64);
+  for (j=0; j<16; j++) {
+    if (mins[j] < pRange->min) pRange->min = mins[j];
+    if (maxs[j] > pRange->max) pRange->max = maxs[j];
+  }
+  for (j=0; j<8; j++) pRange->sum += sums[j];
+  reduceUInt64(squares, 4, &pRange->sumSquares);
+  return i;
+}
+
+ND_TARGET("sse2")
+static size_t statsUInt8SSE2(const epicsUInt8 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  __m128i vmin = _mm_set1_epi8((char)pRange->min);
+  __m128i vmax = _mm_set1_epi8((char)pRange->max);
+  __m128i sum64 = zero, sumSquares32 = zero;
+  epicsUInt8 mins[16], maxs[16];
+  epicsUInt64 sums[2];
+  epicsUInt32 squares[4];
+  int j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pData + i));
+    vmin = _mm_min_epu8(vmin, v);
+    vmax = _mm_max_epu8(vmax, v);
+    /* The sum of absolute differences from 0 adds each group of 8 bytes into a 64-bit lane */
+    sum64 = _mm_add_epi64(sum64, _mm_sad_epu8(v, zero));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    sumSquares32 = _mm_add_epi32(sumSquares32, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+  }
+  _mm_storeu_si128((__m128i *)mins, vmin);
+  _mm_storeu_si128((__m128i *)maxs, vmax);
+  _mm_storeu_si128((__m128i *)sums, sum64);
+  _mm_storeu_si128((__m128i *)squares, sumSquares32);
+  for (j=0; j<16; j++) {
+    if (mins[j] < pRange->min) pRange->min = mins[j];
+    if (maxs[j] > pRange->max) pRange->max = maxs[j];
+  }
+  reduceUInt64(sums, 2, &pRange->sum);
+  for (j=0; j<4; j++) pRange->sumSquares += squares[j];
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t statsUInt8AVX2(const epicsUInt8 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i vmin = _mm256_set1_epi8((char)pRange->min);
+  __m256i vmax = _mm256_set1_epi8((char)pRange->max);
+  __m256i sum64 = zero, sumSquares32 = zero;
+  epicsUInt8 mins[32], maxs[32];
+  epicsUInt64 sums[4];
+  epicsUInt32 squares[8];
+  int j;
+
+  for (i=0; i+32<=n; i+=32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(pData + i));
+    vmin = _mm256_min_epu8(vmin, v);
+    vmax = _mm256_max_epu8(vmax, v);
+    sum64 = _mm256_add_epi64(sum64, _mm256_sad_epu8(v, zero));
+    __m256i lo = _mm256_unpacklo_epi8(v, zero);
+    __m256i hi = _mm256_unpackhi_epi8(v, zero);
+    sumSquares32 = _mm256_add_epi32(sumSquares32,
+                                    _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+  }
+  _mm256_storeu_si256((__m256i *)mins, vmin);
+  _mm256_storeu_si256((__m256i *)maxs, vmax);
+  _mm256_storeu_si256((__m256i *)sums, sum64);
+  _mm256_storeu_si256((__m256i *)squares, sumSquares32);
+  for (j=0; j<32; j++) {
+    if (mins[j] < pRange->min) pRange->min = mins[j];
+    if (maxs[j] > pRange->max) pRange->max = maxs[j];
+  }
+  reduceUInt64(sums, 4, &pRange->sum);
+  for (j=0; j<8; j++) pRange->sumSquares += squares[j];
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static size_t statsUInt16NEON(const epicsUInt16 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  uint16x8_t vmin = vdupq_n_u16((epicsUInt16)pRange->min);
+  uint16x8_t vmax = vdupq_n_u16((epicsUInt16)pRange->max);
+  uint32x4_t sum32 = vdupq_n_u32(0);
+  uint64x2_t sumSquares64 = vdupq_n_u64(0);
+
+  for (i=0; i+8<=n; i+=8) {
+    uint16x8_t v = vld1q_u16(pData + i);
+    vmin = vminq_u16(vmin, v);
+    vmax = vmaxq_u16(vmax, v);
+    sum32 = vpadalq_u16(sum32, v);
+    sumSquares64 = vpadalq_u32(sumSquares64, vmull_u16(vget_low_u16(v), vget_low_u16(v)));
+    sumSquares64 = vpadalq_u32(sumSquares64, vmull_u16(vget_high_u16(v), vget_high_u16(v)));
+  }
+  if (vminvq_u16(vmin) < pRange->min) pRange->min = vminvq_u16(vmin);
+  if (vmaxvq_u16(vmax) > pRange->max) pRange->max = vmaxvq_u16(vmax);
+  pRange->sum += vaddvq_u32(sum32);
+  pRange->sumSquares += vaddvq_u64(sumSquares64);
+  return i;
+}
+
+static size_t statsUInt8NEON(const epicsUInt8 *pData, size_t n, statsRange_t *pRange)
+{
+  size_t i;
+  uint8x16_t vmin = vdupq_n_u8((epicsUInt8)pRange->min);
+  uint8x16_t vmax = vdupq_n_u8((epicsUInt8)pRange->max);
+  uint32x4_t sum32 = vdupq_n_u32(0);
+  uint32x4_t sumSquares32 = vdupq_n_u32(0);
+
+  for (i=0; i+16<=n; i+=16) {
+    uint8x16_t v = vld1q_u8(pData + i);
+    vmin = vminq_u8(vmin, v);
+    vmax = vmaxq_u8(vmax, v);
+    sum32 = vpadalq_u16(sum32, vpaddlq_u8(v));
+    sumSquares32 = vpadalq_u16(sumSquares32, vmull_u8(vget_low_u8(v), vget_low_u8(v)));
+    sumSquares32 = vpadalq_u16(sumSquares32, vmull_u8(vget_high_u8(v), vget_high_u8(v)));
+  }
+  if (vminvq_u8(vmin) < pRange->min) pRange->min = vminvq_u8(vmin);
+  if (vmaxvq_u8(vmax) > pRange->max) pRange->max = vmaxvq_u8(vmax);
+  pRange->sum += vaddvq_u32(sum32);
+  pRange->sumSquares += vaddvq_u32(sumSquares32);
+  return i;
+}
+
+#endif
+
+/* Computes the statistics chunk by chunk with a vector kernel, which may be NULL, and the scalar kernel */
+template <typename epicsType>
+static void statsChunked(const epicsType *pData, size_t nElements,
+                         size_t (*vectorKernel)(const epicsType *, size_t, statsRange_t *), NDSimdStats_t *pStats)
+{
+  epicsUInt32 min = pData[0], max = pData[0];
+  size_t minChunk = 0, maxChunk = 0;
+  size_t start, n, done, i;
+  epicsUInt64 sum = 0, sumSquares = 0;
+
+  for (start=0; start<nElements; start+=STATS_CHUNK) {
+    statsRange_t range;
+    n = nElements - start;
+    if (n > STATS_CHUNK) n = STATS_CHUNK;
+    range.min = pData[start];
+    range.max = pData[start];
+    range.sum = 0;
+    range.sumSquares = 0;
+    done = vectorKernel ? vectorKernel(pData + start, n, &range) : 0;
+    statsRangeScalar(pData + start + done, n - done, &range);
+    /* Strict comparisons, so that the chunk with the first occurrence is kept */
+    if (range.min < min) {
+      min = range.min;
+      minChunk = start;
+    }
+    if (range.max > max) {
+      max = range.max;
+      maxChunk = start;
+    }
+    sum += range.sum;
+    sumSquares += range.sumSquares;
+  }
+
+  for (i=minChunk; (i<nElements) && (pData[i] != min); i++);
+  pStats->minIndex = i;
+  for (i=maxChunk; (i<nElements) && (pData[i] != max); i++);
+  pStats->maxIndex = i;
+  pStats->min = min;
+  pStats->max = max;
+  pStats->sum = sum;
+  pStats->sumSquares = sumSquares;
+}
+
+/** Computes the minimum and maximum with the positions of their first occurrences, and the sum and the sum of
+  * squares of a contiguous array, in one pass with the fastest kernel the CPU supports.
+  * The sums are exact 64-bit integers.
+  * \param[in] dataType The data type of the array, NDUInt8 or NDUInt16.
+  * \param[in] pData The elements.
+  * \param[in] nElements The number of elements.
+  * \param[out] pStats The statistics.
+  * \return ND_SUCCESS, or ND_ERROR for the other data types and empty arrays.
+  */
+int NDSimdStats(NDDataType_t dataType, const void *pData, size_t nElements, NDSimdStats_t *pStats)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+
+  if (nElements == 0) return ND_ERROR;
+
+  if (dataType == NDUInt16) {
+    size_t (*kernel)(const epicsUInt16 *, size_t, statsRange_t *) = 0;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       kernel = statsUInt16AVX2;
+    else if (level >= NDSimdSSE41) kernel = statsUInt16SSE41;
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) kernel = statsUInt16NEON;
+#endif
+    statsChunked((const epicsUInt16 *)pData, nElements, kernel, pStats);
+    return ND_SUCCESS;
+  }
+
+  if (dataType == NDUInt8) {
+    size_t (*kernel)(const epicsUInt8 *, size_t, statsRange_t *) = 0;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      kernel = statsUInt8AVX2;
+    else if (level >= NDSimdSSE2) kernel = statsUInt8SSE2;
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) kernel = statsUInt8NEON;
+#endif
+    statsChunked((const epicsUInt8 *)pData, nElements, kernel, pStats);
+    return ND_SUCCESS;
+  }
+
+  return ND_ERROR;
+}
+
+/*
+ * Saturating narrowing conversions.
+ *
+ * Values that do not fit the output type become its smallest or largest value.  Floating point values are
+ * truncated toward zero, as in NDConvertContiguous(), and NaN becomes 0.
+ */
+
+static void narrowUInt16UInt8Scalar(const epicsUInt16 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) pOut[i] = (pIn[i] < 255) ? (epicsUInt8)pIn[i] : 255;
+}
+
+static void narrowInt32UInt16Scalar(const epicsInt32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsInt32 value = pIn[i];
+    pOut[i] = (value > 0) ? ((value < 65535) ? (epicsUInt16)value : 65535) : 0;
+  }
+}
+
+static void narrowInt32Int16Scalar(const epicsInt32 *pIn, epicsInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsInt32 value = pIn[i];
+    pOut[i] = (value > -32768) ? ((value < 32767) ? (epicsInt16)value : 32767) : -32768;
+  }
+}
+
+static void narrowFloat32UInt16Scalar(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsFloat32 value = pIn[i];
+    pOut[i] = (value > 0.f) ? ((value < 65535.f) ? (epicsUInt16)value : 65535) : 0;
+  }
+}
+
+static void narrowFloat32UInt8Scalar(const epicsFloat32 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    epicsFloat32 value = pIn[i];
+    pOut[i] = (value > 0.f) ? ((value < 255.f) ? (epicsUInt8)value : 255) : 0;
+  }
+}
+
+#if defined(ND_SIMD_X86)
+
+/* The 32-bit lanes of the result of packing 4 vectors of 32-bit lanes to bytes with _mm256_packs_epi32() and
+ * _mm256_packus_epi16(), in the order of the input lanes */
+#define ND_PACK_ORDER_AVX2 _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)
+
+ND_TARGET("sse4.1")
+static size_t narrowUInt16UInt8SSE41(const epicsUInt16 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  __m128i max = _mm_set1_epi16(255);
+  for (i=0; i+16<=n; i+=16) {
+    __m128i a = _mm_min_epu16(_mm_loadu_si128((const __m128i *)(pIn + i)), max);
+    __m128i b = _mm_min_epu16(_mm_loadu_si128((const __m128i *)(pIn + i + 8)), max);
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packus_epi16(a, b));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t narrowUInt16UInt8AVX2(const epicsUInt16 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  __m256i max = _mm256_set1_epi16(255);
+  for (i=0; i+32<=n; i+=32) {
+    __m256i a = _mm256_min_epu16(_mm256_loadu_si256((const __m256i *)(pIn + i)), max);
+    __m256i b = _mm256_min_epu16(_mm256_loadu_si256((const __m256i *)(pIn + i + 16)), max);
+    /* The packs work within each 128-bit lane, so the 64-bit quarters are put back in order */
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i *)(pOut + i), packed);
+  }
+  return i;
+}
+
+ND_TARGET("sse4.1")
+static size_t narrowInt32UInt16SSE41(const epicsInt32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(pIn + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(pIn + i + 4));
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packus_epi32(a, b));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t narrowInt32UInt16AVX2(const epicsInt32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(pIn + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(pIn + i + 8));
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i *)(pOut + i), packed);
+  }
+  return i;
+}
+
+ND_TARGET("sse2")
+static size_t narrowInt32Int16SSE2(const epicsInt32 *pIn, epicsInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(pIn + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(pIn + i + 4));
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packs_epi32(a, b));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t narrowInt32Int16AVX2(const epicsInt32 *pIn, epicsInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(pIn + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(pIn + i + 8));
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i *)(pOut + i), packed);
+  }
+  return i;
+}
+
+/* The floating point values are clamped before they are converted; _mm_max_ps() returns its second operand
+ * if either is NaN, so NaN becomes 0 */
+
+ND_TARGET("sse4.1")
+static size_t narrowFloat32UInt16SSE41(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m128 zero = _mm_setzero_ps(), max = _mm_set1_ps(65535.f);
+  for (i=0; i+8<=n; i+=8) {
+    __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pIn + i), zero), max);
+    __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pIn + i + 4), zero), max);
+    _mm_storeu_si128((__m128i *)(pOut + i), _mm_packus_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t narrowFloat32UInt16AVX2(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  __m256 zero = _mm256_setzero_ps(), max = _mm256_set1_ps(65535.f);
+  for (i=0; i+16<=n; i+=16) {
+    __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pIn + i), zero), max);
+    __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pIn + i + 8), zero), max);
+    __m256i packed = _mm256_packus_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+    _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  return i;
+}
+
+ND_TARGET("sse2")
+static size_t narrowFloat32UInt8SSE2(const epicsFloat32 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  __m128 zero = _mm_setzero_ps(), max = _mm_set1_ps(255.f);
+  for (i=0; i+16<=n; i+=16) {
+    __m128i v[4];
+    for (int j=0; j<4; j++) {
+      __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pIn + i + 4*j), zero), max);
+      v[j] = _mm_cvttps_epi32(f);
+    }
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+    _mm_storeu_si128((__m128i *)(pOut + i), packed);
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t narrowFloat32UInt8AVX2(const epicsFloat32 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  __m256 zero = _mm256_setzero_ps(), max = _mm256_set1_ps(255.f);
+  __m256i order = ND_PACK_ORDER_AVX2;
+  for (i=0; i+32<=n; i+=32) {
+    __m256i v[4];
+    for (int j=0; j<4; j++) {
+      __m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pIn + i + 8*j), zero), max);
+      v[j] = _mm256_cvttps_epi32(f);
+    }
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+    _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static size_t narrowUInt16UInt8NEON(const epicsUInt16 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    uint8x8_t a = vqmovn_u16(vld1q_u16(pIn + i));
+    uint8x8_t b = vqmovn_u16(vld1q_u16(pIn + i + 8));
+    vst1q_u8(pOut + i, vcombine_u8(a, b));
+  }
+  return i;
+}
+
+static size_t narrowInt32UInt16NEON(const epicsInt32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    uint16x4_t a = vqmovun_s32(vld1q_s32(pIn + i));
+    uint16x4_t b = vqmovun_s32(vld1q_s32(pIn + i + 4));
+    vst1q_u16(pOut + i, vcombine_u16(a, b));
+  }
+  return i;
+}
+
+static size_t narrowInt32Int16NEON(const epicsInt32 *pIn, epicsInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    int16x4_t a = vqmovn_s32(vld1q_s32(pIn + i));
+    int16x4_t b = vqmovn_s32(vld1q_s32(pIn + i + 4));
+    vst1q_s16(pOut + i, vcombine_s16(a, b));
+  }
+  return i;
+}
+
+/* vcvtq_u32_f32() truncates toward zero, saturates, and converts NaN to 0 */
+
+static size_t narrowFloat32UInt16NEON(const epicsFloat32 *pIn, epicsUInt16 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    uint16x4_t a = vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i)));
+    uint16x4_t b = vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i + 4)));
+    vst1q_u16(pOut + i, vcombine_u16(a, b));
+  }
+  return i;
+}
+
+static size_t narrowFloat32UInt8NEON(const epicsFloat32 *pIn, epicsUInt8 *pOut, size_t n)
+{
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    uint16x8_t lo = vcombine_u16(vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i))),
+                                 vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i + 4))));
+    uint16x8_t hi = vcombine_u16(vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i + 8))),
+                                 vqmovn_u32(vcvtq_u32_f32(vld1q_f32(pIn + i + 12))));
+    vst1q_u8(pOut + i, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+  }
+  return i;
+}
+
+#endif
+
+/** Converts a contiguous array to a narrower data type with saturation, with the fastest kernel the CPU supports.
+  * The pairs are UInt16 to UInt8, Int32 to UInt16 and Int16, and Float32 to UInt16 and UInt8.
+  * Values below the range of the output type become its smallest value and values above it become its largest.
+  * Floating point values are truncated toward zero and NaN becomes 0.
+  * \param[in] dataTypeIn The data type of the input.
+  * \param[in] pIn The input elements.
+  * \param[in] dataTypeOut The data type of the output.
+  * \param[out] pOut The output elements.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS, or ND_ERROR for the other pairs of data types.
+  */
+int NDSimdNarrow(NDDataType_t dataTypeIn, const void *pIn, NDDataType_t dataTypeOut, void *pOut, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t done = 0;
+
+  if ((dataTypeIn == NDUInt16) && (dataTypeOut == NDUInt8)) {
+    const epicsUInt16 *pSrc = (const epicsUInt16 *)pIn;
+    epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       done = narrowUInt16UInt8AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE41) done = narrowUInt16UInt8SSE41(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = narrowUInt16UInt8NEON(pSrc, pDst, nElements);
+#endif
+    narrowUInt16UInt8Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDInt32) && (dataTypeOut == NDUInt16)) {
+    const epicsInt32 *pSrc = (const epicsInt32 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       done = narrowInt32UInt16AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE41) done = narrowInt32UInt16SSE41(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = narrowInt32UInt16NEON(pSrc, pDst, nElements);
+#endif
+    narrowInt32UInt16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDInt32) && (dataTypeOut == NDInt16)) {
+    const epicsInt32 *pSrc = (const epicsInt32 *)pIn;
+    epicsInt16 *pDst = (epicsInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      done = narrowInt32Int16AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE2) done = narrowInt32Int16SSE2(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = narrowInt32Int16NEON(pSrc, pDst, nElements);
+#endif
+    narrowInt32Int16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDFloat32) && (dataTypeOut == NDUInt16)) {
+    const epicsFloat32 *pSrc = (const epicsFloat32 *)pIn;
+    epicsUInt16 *pDst = (epicsUInt16 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)       done = narrowFloat32UInt16AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE41) done = narrowFloat32UInt16SSE41(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = narrowFloat32UInt16NEON(pSrc, pDst, nElements);
+#endif
+    narrowFloat32UInt16Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  if ((dataTypeIn == NDFloat32) && (dataTypeOut == NDUInt8)) {
+    const epicsFloat32 *pSrc = (const epicsFloat32 *)pIn;
+    epicsUInt8 *pDst = (epicsUInt8 *)pOut;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      done = narrowFloat32UInt8AVX2(pSrc, pDst, nElements);
+    else if (level >= NDSimdSSE2) done = narrowFloat32UInt8SSE2(pSrc, pDst, nElements);
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) done = narrowFloat32UInt8NEON(pSrc, pDst, nElements);
+#endif
+    narrowFloat32UInt8Scalar(pSrc + done, pDst + done, nElements - done);
+    return ND_SUCCESS;
+  }
+
+  return ND_ERROR;
+}
+
+/*
+ * Transposes.
+ *
+ * The array is transposed in tiles of TRANSPOSE_TILE x TRANSPOSE_TILE elements, so that the rows of the tile
+ * that are read and the rows of the transposed tile that are written stay in the cache.  The tiles are
+ * transposed in square blocks of vector registers, and the blocks at the edges of the array element by element.
+ */
+
+#define TRANSPOSE_TILE 64
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("sse2")
+static void transposeBlock16SSE2(const epicsUInt16 *pIn, size_t inRowStride, epicsUInt16 *pOut, size_t outRowStride)
+{
+  __m128i a[8], t[8], u[8];
+  int i;
+
+  for (i=0; i<8; i++) a[i] = _mm_loadu_si128((const __m128i *)(pIn + i*inRowStride));
+  for (i=0; i<4; i++) {
+    t[2*i]   = _mm_unpacklo_epi16(a[2*i], a[2*i+1]);
+    t[2*i+1] = _mm_unpackhi_epi16(a[2*i], a[2*i+1]);
+  }
+  /* u[0] and u[1] hold columns 0-1 and 2-3 of rows 0-3, u[2] and u[3] columns 4-5 and 6-7, u[4] to u[7] rows 4-7 */
+  u[0] = _mm_unpacklo_epi32(t[0], t[2]);
+  u[1] = _mm_unpackhi_epi32(t[0], t[2]);
+  u[2] = _mm_unpacklo_epi32(t[1], t[3]);
+  u[3] = _mm_unpackhi_epi32(t[1], t[3]);
+  u[4] = _mm_unpacklo_epi32(t[4], t[6]);
+  u[5] = _mm_unpackhi_epi32(t[4], t[6]);
+  u[6] = _mm_unpacklo_epi32(t[5], t[7]);
+  u[7] = _mm_unpackhi_epi32(t[5], t[7]);
+  for (i=0; i<4; i++) {
+    _mm_storeu_si128((__m128i *)(pOut + (2*i)*outRowStride),   _mm_unpacklo_epi64(u[i], u[i+4]));
+    _mm_storeu_si128((__m128i *)(pOut + (2*i+1)*outRowStride), _mm_unpackhi_epi64(u[i], u[i+4]));
+  }
+}
+
+ND_TARGET("sse2")
+static void transposeBlock32SSE2(const epicsUInt32 *pIn, size_t inRowStride, epicsUInt32 *pOut, size_t outRowStride)
+{
+  __m128i a0 = _mm_loadu_si128((const __m128i *)pIn);
+  __m128i a1 = _mm_loadu_si128((const __m128i *)(pIn + inRowStride));
+  __m128i a2 = _mm_loadu_si128((const __m128i *)(pIn + 2*inRowStride));
+  __m128i a3 = _mm_loadu_si128((const __m128i *)(pIn + 3*inRowStride));
+  __m128i t0 = _mm_unpacklo_epi32(a0, a1);
+  __m128i t1 = _mm_unpackhi_epi32(a0, a1);
+  __m128i t2 = _mm_unpacklo_epi32(a2, a3);
+  __m128i t3 = _mm_unpackhi_epi32(a2, a3);
+  _mm_storeu_si128((__m128i *)pOut,                    _mm_unpacklo_epi64(t0, t2));
+  _mm_storeu_si128((__m128i *)(pOut + outRowStride),   _mm_unpackhi_epi64(t0, t2));
+  _mm_storeu_si128((__m128i *)(pOut + 2*outRowStride), _mm_unpacklo_epi64(t1, t3));
+  _mm_storeu_si128((__m128i *)(pOut + 3*outRowStride), _mm_unpackhi_epi64(t1, t3));
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static void transposeBlock16NEON(const epicsUInt16 *pIn, size_t inRowStride, epicsUInt16 *pOut, size_t outRowStride)
+{
+  uint16x8_t a[8], t[8];
+  uint32x4_t u[8];
+  int i;
+
+  for (i=0; i<8; i++) a[i] = vld1q_u16(pIn + i*inRowStride);
+  for (i=0; i<4; i++) {
+    t[2*i]   = vtrn1q_u16(a[2*i], a[2*i+1]);
+    t[2*i+1] = vtrn2q_u16(a[2*i], a[2*i+1]);
+  }
+  /* u[0] holds columns 0 and 4 of rows 0-3, u[1] columns 1 and 5, u[2] columns 2 and 6, u[3] columns 3 and 7,
+   * and u[4] to u[7] the same columns of rows 4-7 */
+  for (i=0; i<2; i++) {
+    u[4*i]   = vtrn1q_u32(vreinterpretq_u32_u16(t[4*i]),   vreinterpretq_u32_u16(t[4*i+2]));
+    u[4*i+2] = vtrn2q_u32(vreinterpretq_u32_u16(t[4*i]),   vreinterpretq_u32_u16(t[4*i+2]));
+    u[4*i+1] = vtrn1q_u32(vreinterpretq_u32_u16(t[4*i+1]), vreinterpretq_u32_u16(t[4*i+3]));
+    u[4*i+3] = vtrn2q_u32(vreinterpretq_u32_u16(t[4*i+1]), vreinterpretq_u32_u16(t[4*i+3]));
+  }
+  for (i=0; i<4; i++) {
+    uint64x2_t lo = vreinterpretq_u64_u32(u[i]), hi = vreinterpretq_u64_u32(u[i+4]);
+    vst1q_u16(pOut + i*outRowStride,     vreinterpretq_u16_u64(vtrn1q_u64(lo, hi)));
+    vst1q_u16(pOut + (i+4)*outRowStride, vreinterpretq_u16_u64(vtrn2q_u64(lo, hi)));
+  }
+}
+
+static void transposeBlock32NEON(const epicsUInt32 *pIn, size_t inRowStride, epicsUInt32 *pOut, size_t outRowStride)
+{
+  uint32x4_t a0 = vld1q_u32(pIn);
+  uint32x4_t a1 = vld1q_u32(pIn + inRowStride);
+  uint32x4_t a2 = vld1q_u32(pIn + 2*inRowStride);
+  uint32x4_t a3 = vld1q_u32(pIn + 3*inRowStride);
+  uint64x2_t t0 = vreinterpretq_u64_u32(vtrn1q_u32(a0, a1));
+  uint64x2_t t1 = vreinterpretq_u64_u32(vtrn2q_u32(a0, a1));
+  uint64x2_t t2 = vreinterpretq_u64_u32(vtrn1q_u32(a2, a3));
+  uint64x2_t t3 = vreinterpretq_u64_u32(vtrn2q_u32(a2, a3));
+  vst1q_u32(pOut,                    vreinterpretq_u32_u64(vtrn1q_u64(t0, t2)));
+  vst1q_u32(pOut + outRowStride,     vreinterpretq_u32_u64(vtrn1q_u64(t1, t3)));
+  vst1q_u32(pOut + 2*outRowStride,   vreinterpretq_u32_u64(vtrn2q_u64(t0, t2)));
+  vst1q_u32(pOut + 3*outRowStride,   vreinterpretq_u32_u64(vtrn2q_u64(t1, t3)));
+}
+
+#endif
+
+/* Transposes an array tile by tile; blockKernel, which may be NULL, transposes blocks of blockSize x blockSize */
+template <typename epicsType>
+static void transposeTiled(const epicsType *pIn, size_t inRowStride, epicsType *pOut, size_t outRowStride,
+                           size_t numColumns, size_t numRows,
+                           void (*blockKernel)(const epicsType *, size_t, epicsType *, size_t), size_t blockSize)
+{
+  size_t tileRow, tileColumn, row, column, r, c, rowEnd, columnEnd, tileRowEnd, tileColumnEnd;
+
+  if (!blockKernel) blockSize = 1;
+  for (tileRow=0; tileRow<numRows; tileRow+=TRANSPOSE_TILE) {
+    tileRowEnd = (tileRow + TRANSPOSE_TILE < numRows) ? tileRow + TRANSPOSE_TILE : numRows;
+    for (tileColumn=0; tileColumn<numColumns; tileColumn+=TRANSPOSE_TILE) {
+      tileColumnEnd = (tileColumn + TRANSPOSE_TILE < numColumns) ? tileColumn + TRANSPOSE_TILE : numColumns;
+      for (row=tileRow; row<tileRowEnd; row+=blockSize) {
+        rowEnd = (row + blockSize < tileRowEnd) ? row + blockSize : tileRowEnd;
+        for (column=tileColumn; column<tileColumnEnd; column+=blockSize) {
+          columnEnd = (column + blockSize < tileColumnEnd) ? column + blockSize : tileColumnEnd;
+          if (blockKernel && (rowEnd - row == blockSize) && (columnEnd - column == blockSize)) {
+            blockKernel(pIn + row*inRowStride + column, inRowStride, pOut + column*outRowStride + row, outRowStride);
+            continue;
+          }
+          for (r=row; r<rowEnd; r++) {
+            for (c=column; c<columnEnd; c++) pOut[c*outRowStride + r] = pIn[r*inRowStride + c];
+          }
+        }
+      }
+    }
+  }
+}
+
+/** Transposes a 2-D array with the fastest kernel the CPU supports: element [row][column] of the input
+  * becomes element [column][row] of the output.  The input and the output must not overlap.
+  * \param[in] elementSize The size of the elements in bytes, 1, 2, 4 or 8; 2 and 4 have vectorized kernels.
+  * \param[in] pIn The input array.
+  * \param[in] inRowStride The distance between the rows of the input in elements, at least numColumns.
+  * \param[out] pOut The output array.
+  * \param[in] outRowStride The distance between the rows of the output in elements, at least numRows.
+  * \param[in] numColumns The number of columns of the input, which is the number of rows of the output.
+  * \param[in] numRows The number of rows of the input, which is the number of columns of the output.
+  * \return ND_SUCCESS, or ND_ERROR for the other element sizes.
+  */
+int NDSimdTranspose(size_t elementSize, const void *pIn, size_t inRowStride,
+                    void *pOut, size_t outRowStride, size_t numColumns, size_t numRows)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+
+  switch (elementSize) {
+    case 1:
+      transposeTiled((const epicsUInt8 *)pIn, inRowStride, (epicsUInt8 *)pOut, outRowStride,
+                     numColumns, numRows, (void (*)(const epicsUInt8 *, size_t, epicsUInt8 *, size_t))0, 1);
+      return ND_SUCCESS;
+    case 2: {
+      void (*kernel)(const epicsUInt16 *, size_t, epicsUInt16 *, size_t) = 0;
+#if defined(ND_SIMD_X86)
+      if (level >= NDSimdSSE2) kernel = transposeBlock16SSE2;
+#elif defined(ND_SIMD_NEON)
+      if (level == NDSimdNEON) kernel = transposeBlock16NEON;
+#endif
+      transposeTiled((const epicsUInt16 *)pIn, inRowStride, (epicsUInt16 *)pOut, outRowStride,
+                     numColumns, numRows, kernel, 8);
+      return ND_SUCCESS;
+    }
+    case 4: {
+      void (*kernel)(const epicsUInt32 *, size_t, epicsUInt32 *, size_t) = 0;
+#if defined(ND_SIMD_X86)
+      if (level >= NDSimdSSE2) kernel = transposeBlock32SSE2;
+#elif defined(ND_SIMD_NEON)
+      if (level == NDSimdNEON) kernel = transposeBlock32NEON;
+#endif
+      transposeTiled((const epicsUInt32 *)pIn, inRowStride, (epicsUInt32 *)pOut, outRowStride,
+                     numColumns, numRows, kernel, 4);
+      return ND_SUCCESS;
+    }
+    case 8:
+      transposeTiled((const epicsUInt64 *)pIn, inRowStride, (epicsUInt64 *)pOut, outRowStride,
+                     numColumns, numRows, (void (*)(const epicsUInt64 *, size_t, epicsUInt64 *, size_t))0, 1);
+      return ND_SUCCESS;
+    default:
+      return ND_ERROR;
+  }
+}
+
+/*
+ * Table lookups.
+ */
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("avx2")
+static size_t lookupUInt8AVX2(const epicsUInt8 *pIn, const epicsUInt8 *pTable, epicsUInt8 *pOut, size_t n)
+{
+  /* The table is widened to 32-bit entries for the gathers, which only pays for itself on long arrays */
+  epicsUInt32 wideTable[256];
+  __m256i order = ND_PACK_ORDER_AVX2;
+  size_t i;
+  int j;
+
+  if (n < 256) return 0;
+  for (j=0; j<256; j++) wideTable[j] = pTable[j];
+  for (i=0; i+32<=n; i+=32) {
+    __m256i v[4];
+    for (j=0; j<4; j++) {
+      __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pIn + i + 8*j)));
+      v[j] = _mm256_i32gather_epi32((const int *)wideTable, index, 4);
+    }
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+    _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  return i;
+}
+
+ND_TARGET("avx2")
+static size_t lookupUInt16AVX2(const epicsUInt16 *pIn, const epicsUInt32 *pTable, size_t tableSize,
+                               epicsUInt32 *pOut, size_t n)
+{
+  __m256i last = _mm256_set1_epi32((int)(tableSize - 1));
+  size_t i;
+  for (i=0; i+8<=n; i+=8) {
+    __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pIn + i)));
+    index = _mm256_min_epu32(index, last);
+    _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_i32gather_epi32((const int *)pTable, index, 4));
+  }
+  return i;
+}
+
+ND_TARGET("avx512f")
+static size_t lookupUInt16AVX512(const epicsUInt16 *pIn, const epicsUInt32 *pTable, size_t tableSize,
+                                 epicsUInt32 *pOut, size_t n)
+{
+  __m512i last = _mm512_set1_epi32((int)(tableSize - 1));
+  size_t i;
+  for (i=0; i+16<=n; i+=16) {
+    __m512i index = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(pIn + i)));
+    index = _mm512_min_epu32(index, last);
+    _mm512_storeu_si512((void *)(pOut + i), _mm512_i32gather_epi32(index, (const void *)pTable, 4));
+  }
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static size_t lookupUInt8NEON(const epicsUInt8 *pIn, const epicsUInt8 *pTable, epicsUInt8 *pOut, size_t n)
+{
+  uint8x16x4_t table[4];
+  uint8x16_t offset = vdupq_n_u8(64);
+  size_t i;
+  int j, k;
+
+  for (j=0; j<4; j++) {
+    for (k=0; k<4; k++) table[j].val[k] = vld1q_u8(pTable + 64*j + 16*k);
+  }
+  for (i=0; i+16<=n; i+=16) {
+    /* Each lookup covers 64 entries; the indices outside them leave the result unchanged */
+    uint8x16_t index = vld1q_u8(pIn + i);
+    uint8x16_t value = vqtbl4q_u8(table[0], index);
+    index = vsubq_u8(index, offset);
+    value = vqtbx4q_u8(value, table[1], index);
+    index = vsubq_u8(index, offset);
+    value = vqtbx4q_u8(value, table[2], index);
+    index = vsubq_u8(index, offset);
+    value = vqtbx4q_u8(value, table[3], index);
+    vst1q_u8(pOut + i, value);
+  }
+  return i;
+}
+
+#endif
+
+/** Looks up each element of an 8-bit array in a table of 256 entries with the fastest kernel the CPU supports.
+  * \param[in] pIn The input elements.
+  * \param[in] pTable The table.
+  * \param[out] pOut The output elements, pTable[pIn[i]].
+  * \param[in] nElements The number of elements.
+  */
+void NDSimdLookupUInt8(const epicsUInt8 *pIn, const epicsUInt8 *pTable, epicsUInt8 *pOut, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t done = 0, i;
+
+#if defined(ND_SIMD_X86)
+  if (level >= NDSimdAVX2) done = lookupUInt8AVX2(pIn, pTable, pOut, nElements);
+#elif defined(ND_SIMD_NEON)
+  if (level == NDSimdNEON) done = lookupUInt8NEON(pIn, pTable, pOut, nElements);
+#endif
+  for (i=done; i<nElements; i++) pOut[i] = pTable[pIn[i]];
+}
+
+/** Looks up each element of a 16-bit array in a table of 32-bit entries with the fastest kernel the CPU supports.
+  * The elements beyond the end of the table are clamped to its last entry.
+  * \param[in] pIn The input elements.
+  * \param[in] pTable The table.
+  * \param[in] tableSize The number of entries in the table; the output is 0 if the table is empty.
+  * \param[out] pOut The output elements, pTable[min(pIn[i], tableSize-1)].
+  * \param[in] nElements The number of elements.
+  */
+void NDSimdLookupUInt16(const epicsUInt16 *pIn, const epicsUInt32 *pTable, size_t tableSize,
+                        epicsUInt32 *pOut, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t done = 0, i, last;
+
+  if (tableSize == 0) {
+    memset(pOut, 0, nElements * sizeof(*pOut));
+    return;
+  }
+  if (tableSize > 65536) tableSize = 65536;
+  last = tableSize - 1;
+#if defined(ND_SIMD_X86)
+  if (level >= NDSimdAVX512)    done = lookupUInt16AVX512(pIn, pTable, tableSize, pOut, nElements);
+  else if (level >= NDSimdAVX2) done = lookupUInt16AVX2(pIn, pTable, tableSize, pOut, nElements);
+#endif
+  for (i=done; i<nElements; i++) pOut[i] = pTable[(pIn[i] < last) ? pIn[i] : last];
+}
@@ -0,0 +1,62 @@
+/** NDSimdKernels.h
+ *
+ * Vectorized primitives that the kernels of ADCore and of the plugins share: the minimum and maximum with their
+ * positions and the widening sums of an array, saturating narrowing conversions, transposes and table lookups.
+ * The instruction set is selected at run time from the features of the CPU, and every primitive has scalar code
+ * that gives the same results, which NDSimdSetMaxLevel(NDSimdNone) selects.
+ *
+ */
+
+#ifndef NDSimdKernels_H
+#define NDSimdKernels_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** Enumeration of the SIMD instruction sets used by the kernels */
+typedef enum {
+    NDSimdNone,     /**< Scalar code only */
+    NDSimdSSE2,     /**< x86 SSE2 */
+    NDSimdSSE41,    /**< x86 SSE4.1 */
+    NDSimdAVX2,     /**< x86 AVX2 */
+    NDSimdAVX512,   /**< x86 AVX-512F */
+    NDSimdNEON      /**< ARM NEON (AArch64) */
+} NDSimdLevel_t;
+
+/** The minimum and maximum of an array with their positions, and its sums, which are exact */
+typedef struct {
+    epicsUInt32 min;
+    size_t minIndex;        /**< Index of the first element with the minimum value */
+    epicsUInt32 max;
+    size_t maxIndex;        /**< Index of the first element with the maximum value */
+    epicsUInt64 sum;
+    epicsUInt64 sumSquares;
+} NDSimdStats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc NDSimdLevel_t NDSimdLevel(void);
+epicsShareFunc const char* NDSimdLevelName(NDSimdLevel_t level);
+epicsShareFunc void NDSimdSetMaxLevel(NDSimdLevel_t level);
+
+epicsShareFunc int NDSimdStats(NDDataType_t dataType, const void *pData, size_t nElements, NDSimdStats_t *pStats);
+epicsShareFunc int NDSimdNarrow(NDDataType_t dataTypeIn, const void *pIn, NDDataType_t dataTypeOut, void *pOut,
+                                size_t nElements);
+epicsShareFunc int NDSimdTranspose(size_t elementSize, const void *pIn, size_t inRowStride,
+                                   void *pOut, size_t outRowStride, size_t numColumns, size_t numRows);
+epicsShareFunc void NDSimdLookupUInt8(const epicsUInt8 *pIn, const epicsUInt8 *pTable, epicsUInt8 *pOut,
+                                      size_t nElements);
+epicsShareFunc void NDSimdLookupUInt16(const epicsUInt16 *pIn, const epicsUInt32 *pTable, size_t tableSize,
+                                       epicsUInt32 *pOut, size_t nElements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
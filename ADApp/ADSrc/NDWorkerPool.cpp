@@ -0,0 +1,205 @@
+/** NDWorkerPool.cpp
+ *
+ * A group of worker threads that executes the tasks of a parallel loop.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDWorkerPool.h"
+
+static void workerTaskC(void *drvPvt)
+{
+  NDWorkerPool *pPool = (NDWorkerPool *)drvPvt;
+  pPool->workerTask();
+}
+
+typedef struct {
+  NDStripeTask func;
+  void *pArg;
+  size_t numRows;
+  int numStripes;
+} stripeLoop_t;
+
+static void stripeTask(void *pArg, int task)
+{
+  stripeLoop_t *pLoop = (stripeLoop_t *)pArg;
+  size_t firstRow = pLoop->numRows * task / pLoop->numStripes;
+  size_t endRow = pLoop->numRows * (task + 1) / pLoop->numStripes;
+
+  pLoop->func(pLoop->pArg, firstRow, endRow - firstRow, task);
+}
+
+/** Constructor for the NDWorkerPool class.
+  * \param[in] name The prefix of the names of the threads.
+  * \param[in] numThreads The number of worker threads; 0 runs all tasks in the calling thread.
+  */
+NDWorkerPool::NDWorkerPool(const char *name, int numThreads)
+  : numThreads_(numThreads > 0 ? numThreads : 0), started_(false), exiting_(false),
+    func_(0), pArg_(0), numTasks_(0), nextTask_(0), tasksRemaining_(0), numStarted_(0), numRunning_(0)
+{
+  strncpy(name_, name, sizeof(name_)-1);
+  name_[sizeof(name_)-1] = 0;
+  runLock_ = epicsMutexMustCreate();
+  taskLock_ = epicsMutexMustCreate();
+  doneEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  exitEvent_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/** Destructor for the NDWorkerPool class; waits for the threads to exit. */
+NDWorkerPool::~NDWorkerPool()
+{
+  size_t i;
+
+  epicsMutexLock(runLock_);
+  exiting_ = true;
+  for (i=0; i<startEvents_.size(); i++) epicsEventSignal(startEvents_[i]);
+  if (!startEvents_.empty()) epicsEventWait(exitEvent_);
+  for (i=0; i<startEvents_.size(); i++) epicsEventDestroy(startEvents_[i]);
+  epicsMutexUnlock(runLock_);
+  epicsEventDestroy(doneEvent_);
+  epicsEventDestroy(exitEvent_);
+  epicsMutexDestroy(taskLock_);
+  epicsMutexDestroy(runLock_);
+}
+
+/** Returns the number of worker threads. */
+int NDWorkerPool::numThreads()
+{
+  return numThreads_;
+}
+
+void NDWorkerPool::startThreads()
+{
+  char threadName[48];
+  int i;
+
+  started_ = true;
+  /* Create all of the events before the threads look them up */
+  for (i=0; i<numThreads_; i++) {
+    startEvents_.push_back(epicsEventMustCreate(epicsEventEmpty));
+  }
+  numRunning_ = numThreads_;
+  for (i=0; i<numThreads_; i++) {
+    epicsSnprintf(threadName, sizeof(threadName), "%s_%d", name_, i);
+    epicsThreadMustCreate(threadName, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          workerTaskC, this);
+  }
+}
+
+/** Gets the index of the next task of the current loop.  Returns false when there are none left. */
+bool NDWorkerPool::nextTask(int *pTask)
+{
+  bool haveTask = false;
+
+  epicsMutexLock(taskLock_);
+  if (nextTask_ < numTasks_) {
+    *pTask = nextTask_++;
+    haveTask = true;
+  }
+  epicsMutexUnlock(taskLock_);
+  return haveTask;
+}
+
+/** Runs func(pArg, task) for task=0 to numTasks-1 in the worker threads and the calling thread,
+  * and returns when they are all done.
+  * If another thread is already running a loop on this pool the tasks are all run in the calling thread
+  * rather than waiting for the pool to become free.
+  * \param[in] func The function that executes one task.
+  * \param[in] pArg The argument passed to func.
+  * \param[in] numTasks The number of tasks.
+  */
+void NDWorkerPool::run(NDWorkerTask func, void *pArg, int numTasks)
+{
+  int task;
+  size_t i;
+
+  if ((numThreads_ == 0) || (numTasks <= 1)) {
+    for (task=0; task<numTasks; task++) func(pArg, task);
+    return;
+  }
+
+  if (epicsMutexTryLock(runLock_) != epicsMutexLockOK) {
+    for (task=0; task<numTasks; task++) func(pArg, task);
+    return;
+  }
+  if (!started_) startThreads();
+  epicsMutexLock(taskLock_);
+  func_ = func;
+  pArg_ = pArg;
+  numTasks_ = numTasks;
+  nextTask_ = 0;
+  tasksRemaining_ = numTasks;
+  epicsMutexUnlock(taskLock_);
+  /* Wake no more threads than there are tasks for, the calling thread does one of them */
+  for (i=0; (i<startEvents_.size()) && ((int)i<numTasks-1); i++) epicsEventSignal(startEvents_[i]);
+
+  while (nextTask(&task)) {
+    func(pArg, task);
+    epicsMutexLock(taskLock_);
+    tasksRemaining_--;
+    if (tasksRemaining_ == 0) epicsEventSignal(doneEvent_);
+    epicsMutexUnlock(taskLock_);
+  }
+  epicsEventWait(doneEvent_);
+  epicsMutexUnlock(runLock_);
+}
+
+/** Splits rows 0 to numRows-1 into numStripes stripes of nearly equal size and runs func on each stripe
+  * with run(), so the stripes are processed in the worker threads and the calling thread.
+  * The caller keeps any per-stripe results in an array of numStripes elements indexed by the stripe argument
+  * of func, and combines them after this returns.
+  * \param[in] func The function that processes one stripe.
+  * \param[in] pArg The argument passed to func.
+  * \param[in] numRows The number of rows.
+  * \param[in] numStripes The number of stripes; it is reduced to numRows if there are fewer rows.
+  */
+void NDWorkerPool::runStripes(NDStripeTask func, void *pArg, size_t numRows, int numStripes)
+{
+  stripeLoop_t loop;
+
+  if ((size_t)numStripes > numRows) numStripes = (int)numRows;
+  if (numStripes < 1) return;
+  loop.func = func;
+  loop.pArg = pArg;
+  loop.numRows = numRows;
+  loop.numStripes = numStripes;
+  run(stripeTask, &loop, numStripes);
+}
+
+/** The loop of each worker thread.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDWorkerPool::workerTask()
+{
+  epicsEventId startEvent;
+  int task;
+  bool last;
+
+  /* Each thread takes the next start event in the order it was created */
+  epicsMutexLock(taskLock_);
+  startEvent = startEvents_[numStarted_++];
+  epicsMutexUnlock(taskLock_);
+
+  while (1) {
+    epicsEventWait(startEvent);
+    if (exiting_) break;
+    while (nextTask(&task)) {
+      func_(pArg_, task);
+      epicsMutexLock(taskLock_);
+      tasksRemaining_--;
+      if (tasksRemaining_ == 0) epicsEventSignal(doneEvent_);
+      epicsMutexUnlock(taskLock_);
+    }
+  }
+  /* The last thread to exit tells the destructor, after it has finished with the mutex */
+  epicsMutexLock(taskLock_);
+  last = (--numRunning_ == 0);
+  epicsMutexUnlock(taskLock_);
+  if (last) epicsEventSignal(exitEvent_);
+}
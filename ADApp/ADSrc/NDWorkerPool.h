@@ -0,0 +1,64 @@
+/** NDWorkerPool.h
+ *
+ * A group of worker threads that executes the tasks of a parallel loop.
+ *
+ */
+
+#ifndef NDWorkerPool_H
+#define NDWorkerPool_H
+
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <shareLib.h>
+
+/** Function that executes one task of NDWorkerPool::run()
+  * \param[in] pArg The argument passed to NDWorkerPool::run().
+  * \param[in] task The index of the task, 0 to numTasks-1. */
+typedef void (*NDWorkerTask)(void *pArg, int task);
+
+/** Function that processes one stripe of rows for NDWorkerPool::runStripes()
+  * \param[in] pArg The argument passed to NDWorkerPool::runStripes().
+  * \param[in] firstRow The first row of the stripe.
+  * \param[in] numRows The number of rows in the stripe.
+  * \param[in] stripe The index of the stripe, 0 to numStripes-1, for storing per-stripe results. */
+typedef void (*NDStripeTask)(void *pArg, size_t firstRow, size_t numRows, int stripe);
+
+/** A group of worker threads that executes the tasks of a parallel loop.
+  * The calling thread takes part, so a pool of N threads runs up to N+1 tasks at the same time.
+  * The threads are created the first time they are needed.
+  */
+class epicsShareClass NDWorkerPool {
+public:
+    NDWorkerPool(const char *name, int numThreads);
+    ~NDWorkerPool();
+    void run(NDWorkerTask func, void *pArg, int numTasks);
+    void runStripes(NDStripeTask func, void *pArg, size_t numRows, int numStripes);
+    int numThreads();
+    void workerTask();
+
+private:
+    bool nextTask(int *pTask);
+    void startThreads();
+
+    char name_[32];
+    int numThreads_;
+    bool started_;
+    bool exiting_;
+    epicsMutexId runLock_;       /**< Only one loop runs at a time */
+    epicsMutexId taskLock_;      /**< Protects the fields of the current loop */
+    epicsEventId doneEvent_;     /**< Signalled when the last task of the loop is done */
+    std::vector<epicsEventId> startEvents_;  /**< One per thread, signalled when a loop starts */
+    epicsEventId exitEvent_;     /**< Signalled by the last thread to exit */
+    NDWorkerTask func_;
+    void *pArg_;
+    int numTasks_;
+    int nextTask_;
+    int tasksRemaining_;
+    int numStarted_;             /**< Number of threads that have picked up their start event */
+    int numRunning_;             /**< Number of threads that have not exited */
+};
+
+#endif
@@ -12,11 +12,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <string>
+#include <map>
+
 #include <ellLib.h>
 #include <epicsMutex.h>
 #include <epicsString.h>
 #include <cadef.h>
 #include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
 
 #include <asynDriver.h>
 
@@ -27,6 +32,7 @@
 static const char *driverName = "PVAttribute";
 static ca_client_context *pCaInputContext=NULL;
 static void connectCallbackC(struct connection_handler_args cha);
+static void monitorCallbackC(struct event_handler_args cha);
 
 /* This asynUser is not attached to any device.  
  * It lets one turn on debugging by settings the global asynTrace flag bits
@@ -34,6 +40,107 @@ static void connectCallbackC(struct connection_handler_args cha);
 
 static asynUser *pasynUserSelf = NULL;
 
+/** The channel access channel and monitor of an EPICS PV, shared by all of the PVAttributes of the IOC
+  * with the same PV and dbrType.  They are kept in a registry and counted, and the channel is cleared when
+  * the last of these attributes is deleted.
+  */
+class PVAttributeSource {
+public:
+    static PVAttributeSource* acquire(const char *pSource, chtype dbrType);
+    void release();
+    void connectCallback(struct connection_handler_args cha);
+    void monitorCallback(struct event_handler_args cha);
+
+    std::string pvName;
+    chtype      dbrType;
+    chid        chanId;
+    evid        eventId;
+    NDAttrDataType_t dataType;    /**< NDAttrUndefined until the PV connects */
+    NDAttrValue callbackValue;
+    char        *callbackString;  /**< Slot for the string values of the monitor callbacks */
+    size_t      stringCapacity;   /**< Size of callbackString */
+    int         callbackVersion;  /**< Incremented before and after every monitor callback writes a value */
+    bool        connectedOnce;
+    epicsMutexId lock;
+
+private:
+    PVAttributeSource(const char *pSource, chtype dbrType);
+    ~PVAttributeSource();
+    int referenceCount;           /**< The PVAttributes using the source; protected by registryLock */
+};
+
+typedef std::map<std::pair<std::string, chtype>, PVAttributeSource*> PVAttributeSourceMap;
+static PVAttributeSourceMap *pRegistry = NULL;
+static epicsMutexId registryLock = NULL;
+static epicsThreadOnceId registryOnce = EPICS_THREAD_ONCE_INIT;
+
+static void registryInit(void *)
+{
+    registryLock = epicsMutexMustCreate();
+    pRegistry = new PVAttributeSourceMap;
+}
+
+/** Returns the source of a PV and dbrType, creating it and its channel if no attribute uses it yet.
+  * \param[in] pSource The name of the EPICS PV.
+  * \param[in] dbrType The EPICS DBR_XXX type, or DBR_NATIVE. */
+PVAttributeSource* PVAttributeSource::acquire(const char *pSource, chtype dbrType)
+{
+    PVAttributeSource *pPVSource;
+    PVAttributeSourceMap::iterator it;
+
+    epicsThreadOnce(&registryOnce, registryInit, NULL);
+    epicsMutexMustLock(registryLock);
+    it = pRegistry->find(std::make_pair(std::string(pSource), dbrType));
+    if (it != pRegistry->end()) {
+        pPVSource = it->second;
+    } else {
+        pPVSource = new PVAttributeSource(pSource, dbrType);
+        (*pRegistry)[std::make_pair(pPVSource->pvName, dbrType)] = pPVSource;
+    }
+    pPVSource->referenceCount++;
+    epicsMutexUnlock(registryLock);
+    return pPVSource;
+}
+
+/** Releases the source for an attribute, deleting it when no attribute uses it any more */
+void PVAttributeSource::release()
+{
+    epicsMutexMustLock(registryLock);
+    if (--this->referenceCount == 0) {
+        pRegistry->erase(std::make_pair(this->pvName, this->dbrType));
+        delete this;
+    }
+    epicsMutexUnlock(registryLock);
+}
+
+PVAttributeSource::PVAttributeSource(const char *pSource, chtype dbrType)
+    : pvName(pSource), dbrType(dbrType), chanId(0), eventId(0), dataType(NDAttrUndefined), callbackString(0),
+    stringCapacity(0), callbackVersion(0), connectedOnce(false), referenceCount(0)
+{
+    /* Create the ca_context if not already done */
+    if (pCaInputContext == NULL) {
+        SEVCHK(ca_context_create(ca_enable_preemptive_callback),"ca_context_create");
+        while (pCaInputContext == NULL) {
+            epicsThreadSleep(epicsThreadSleepQuantum());
+            pCaInputContext = ca_current_context();
+        }
+    }
+    /* Need to attach to the ca_context because this method could be called in a different thread from
+     * that which created the context */
+    ca_attach_context(pCaInputContext);
+    this->lock = epicsMutexCreate();
+    /* Set connection callback on this PV */
+    SEVCHK(ca_create_channel(pSource, connectCallbackC, this, 10 ,&this->chanId),
+           "ca_create_channel");
+}
+
+PVAttributeSource::~PVAttributeSource()
+{
+    if (this->chanId) SEVCHK(ca_clear_channel(this->chanId),"ca_clear_channel");
+    if (this->lock) epicsMutexDestroy(this->lock);
+    delete [] this->callbackString;
+}
+
 /** Constructor for an EPICS PV attribute
   * \param[in] pName The name of the attribute to be created; case-insensitive. 
   * \param[in] pDescription The description of the attribute.
@@ -41,38 +148,25 @@ static asynUser *pasynUserSelf = NULL;
   * \param[in] dbrType The EPICS DBR_XXX type to be used (DBR_STRING, DBR_DOUBLE, etc).
   *                    In addition to the normal DBR types a special type, DBR_NATIVE, may be used,
   *                    which means to use the native data type returned by Channel Access for this PV.
+  *                    The attribute shares the channel of any other PVAttribute with the same PV and dbrType.
   */
 PVAttribute::PVAttribute(const char *pName, const char *pDescription,
                          const char *pSource, chtype dbrType)
     : NDAttribute(pName, pDescription, NDAttrSourceEPICSPV, pSource, NDAttrUndefined, 0),
-    dbrType(dbrType), callbackString(0), connectedOnce(false)
+    pPVSource(0), dbrType(dbrType), updateString(0), updateCapacity(0), updateVersion(0)
 {
     static const char *functionName = "PVAttribute";
     
     /* Create the static pasynUser if not already done */
     if (!pasynUserSelf) pasynUserSelf = pasynManager->createAsynUser(0,0);
 
-    /* Create the ca_context if not already done */
-    if (pCaInputContext == NULL) {
-        SEVCHK(ca_context_create(ca_enable_preemptive_callback),"ca_context_create");
-        while (pCaInputContext == NULL) {
-            epicsThreadSleep(epicsThreadSleepQuantum());
-            pCaInputContext = ca_current_context();
-        }
-    }
-    /* Need to attach to the ca_context because this method could be called in a different thread from
-     * that which created the context */
-    ca_attach_context(pCaInputContext);
-    this->lock = epicsMutexCreate();
     if (!pSource) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s: ERROR, must specify source string\n",
             driverName, functionName);
         return;
     }
-    /* Set connection callback on this PV */
-    SEVCHK(ca_create_channel(pSource, connectCallbackC, this, 10 ,&this->chanId),
-           "ca_create_channel");
+    this->pPVSource = PVAttributeSource::acquire(pSource, dbrType);
 }
 
 /** Copy constructor for an EPICS PV attribute
@@ -82,17 +176,18 @@ PVAttribute::PVAttribute(const char *pName, const char *pDescription,
 PVAttribute::PVAttribute(PVAttribute& attribute)
     : NDAttribute(attribute)
 {
+    pPVSource = 0;
     dbrType = attribute.dbrType;
-    eventId = 0;
-    chanId = 0;
-    lock = 0;
+    updateString = 0;
+    updateCapacity = 0;
+    updateVersion = 0;
 }
 
 
 PVAttribute::~PVAttribute()
 {
-    if (this->chanId) SEVCHK(ca_clear_channel(this->chanId),"ca_clear_channel");
-    if (this->lock) epicsMutexDestroy(this->lock);
+    if (this->pPVSource) this->pPVSource->release();
+    delete [] this->updateString;
 }
 
 
@@ -111,25 +206,29 @@ PVAttribute* PVAttribute::copy(NDAttribute *pAttr)
 
 static void monitorCallbackC(struct event_handler_args cha)
 {
-    PVAttribute *pAttribute = (PVAttribute *)ca_puser(cha.chid);
-    if (!pAttribute) return;
-    pAttribute->monitorCallback(cha);
+    PVAttributeSource *pPVSource = (PVAttributeSource *)ca_puser(cha.chid);
+    if (!pPVSource) return;
+    pPVSource->monitorCallback(cha);
 }
 
 /** Monitor callback called whenever an EPICS PV changes value.
-  * Calls NDAttribute::setValue to store the new value.
+  * Stores the new value in callbackValue or callbackString for the updateValue() of the attributes.
+  * callbackVersion is odd while the value is written and even again when it is complete, so updateValue()
+  * can read the value without the lock and tell whether it read a complete value.
   * \param[in] eha Event handler argument structure passed by channel access. 
   */
-void PVAttribute::monitorCallback(struct event_handler_args eha)
+void PVAttributeSource::monitorCallback(struct event_handler_args eha)
 {
     //chid  chanId = eha.chid;
-    NDAttrDataType_t dataType = this->getDataType();
+    NDAttrDataType_t dataType = this->dataType;
     const char *functionName = "monitorCallback";
+    const char *pString;
+    size_t length, maxLength;
 
     epicsMutexLock(this->lock);
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
         "%s:%s: PV=%s\n", 
-        driverName, functionName, this->getSource());
+        driverName, functionName, this->pvName.c_str());
 
     if (eha.status != ECA_NORMAL) {
         asynPrint(pasynUserSelf,  ASYN_TRACE_ERROR,
@@ -137,11 +236,18 @@ void PVAttribute::monitorCallback(struct event_handler_args eha)
         driverName, functionName, eha.status);
         goto done;
     }
+    if ((dataType == NDAttrUndefined) || (dataType > NDAttrString)) goto done;
+    if ((dataType == NDAttrString) && !this->callbackString) goto done;
+    epicsAtomicIncrIntT(&this->callbackVersion);
     /* Treat strings specially */
     if (dataType == NDAttrString) {
-      if (this->callbackString) free(this->callbackString);
-      this->callbackString = epicsStrDup((char *)eha.dbr);
-      goto done;
+      /* Strings are copied into the slot allocated on connection, truncated to its capacity */
+      pString = (const char *)eha.dbr;
+      maxLength = (eha.type == DBR_STRING) ? MAX_STRING_SIZE : (size_t)eha.count;
+      if (maxLength > this->stringCapacity - 1) maxLength = this->stringCapacity - 1;
+      for (length=0; (length < maxLength) && pString[length]; length++);
+      memcpy(this->callbackString, pString, length);
+      this->callbackString[length] = 0;
     }
     switch (dataType) {
       case NDAttrInt8:
@@ -168,29 +274,53 @@ void PVAttribute::monitorCallback(struct event_handler_args eha)
       case NDAttrFloat64:
         callbackValue.f64 = *(epicsFloat64 *)eha.dbr;
         break;
-      case NDAttrUndefined:
-        break;
       default:
         break;
     }
+    epicsAtomicIncrIntT(&this->callbackVersion);
     done:
     epicsMutexUnlock(this->lock);
 }
 
+/** Updates the value of the attribute with the last value of the PV.
+  * It does not take the lock of the source: the value is read while callbackVersion is even and used only if
+  * callbackVersion did not change meanwhile.  If a monitor callback is writing a new value the attribute keeps
+  * its previous value, and the next update gets the new one.  The string copy is allocated by the first update
+  * of a string PV.
+  */
 int PVAttribute::updateValue()
 {
     //static const char *functionName = "updateValue"
     
-    void *pValue;
-    NDAttrDataType_t dataType = this->getDataType();
+    NDAttrValue value;
+    NDAttrDataType_t dataType;
+    PVAttributeSource *pPVSource = this->pPVSource;
+    int version;
     
-    epicsMutexLock(this->lock);
-    if (dataType == NDAttrString)
-        pValue = callbackString;
-    else
-        pValue = &callbackValue;
-    this->setValue(pValue);
-    epicsMutexUnlock(this->lock);
+    if (!pPVSource) return asynSuccess;
+    version = epicsAtomicGetIntT(&pPVSource->callbackVersion);
+    if ((version == this->updateVersion) || (version & 1)) return asynSuccess;
+    epicsAtomicReadMemoryBarrier();
+    dataType = pPVSource->dataType;
+    if (this->getDataType() != dataType) this->setDataType(dataType);
+    if (dataType == NDAttrString) {
+        if (this->updateCapacity != pPVSource->stringCapacity) {
+            delete [] this->updateString;
+            this->updateCapacity = pPVSource->stringCapacity;
+            this->updateString = new char[this->updateCapacity]();
+        }
+        memcpy(this->updateString, pPVSource->callbackString, this->updateCapacity);
+    } else {
+        value = pPVSource->callbackValue;
+    }
+    if (epicsAtomicGetIntT(&pPVSource->callbackVersion) != version) return asynSuccess;
+    this->updateVersion = version;
+    if (dataType == NDAttrString) {
+        /* The last byte of the slot is always 0, so even a string copied while it changed is terminated */
+        this->setValue(this->updateString);
+    } else {
+        this->setValue(&value);
+    }
     return asynSuccess;
 }
 
@@ -198,9 +328,9 @@ int PVAttribute::updateValue()
 
 static void connectCallbackC(struct connection_handler_args cha)
 {
-    PVAttribute    *pAttribute = (PVAttribute *)ca_puser(cha.chid);
-    if (!pAttribute) return;
-    pAttribute->connectCallback(cha);
+    PVAttributeSource *pPVSource = (PVAttributeSource *)ca_puser(cha.chid);
+    if (!pPVSource) return;
+    pPVSource->connectCallback(cha);
 }
 
 /** Connection callback called whenever an EPICS PV connects or disconnects.
@@ -208,7 +338,7 @@ static void connectCallbackC(struct connection_handler_args cha)
   * callbacks whenever the value changes.
   * \param[in] cha Connection handler argument structure passed by channel access. 
   */
-void PVAttribute::connectCallback(struct connection_handler_args cha)
+void PVAttributeSource::connectCallback(struct connection_handler_args cha)
 {
     chid  chanId = cha.chid;
     const char *functionName = "connectCallback";
@@ -227,7 +357,7 @@ void PVAttribute::connectCallback(struct connection_handler_args cha)
         elementCount = ca_element_count(chanId);
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: Connect event, PV=%s, chanId=%p, dbfType=%ld, elementCount=%d, dbrType=%ld\n", 
-            driverName, functionName, this->getSource(), chanId, dbfType, elementCount, dbrType);
+            driverName, functionName, this->pvName.c_str(), chanId, dbfType, elementCount, dbrType);
         switch(dbfType) {
             case DBF_STRING:
                 if (this->dbrType == DBR_NATIVE) dbrType = DBR_STRING;
@@ -295,8 +425,15 @@ void PVAttribute::connectCallback(struct connection_handler_args cha)
         }
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: Connect event, PV=%s, chanId=%p, type=%d\n", 
-            driverName, functionName, this->getSource(), chanId, dataType);
-        this->setDataType(dataType);
+            driverName, functionName, this->pvName.c_str(), chanId, dataType);
+        /* The string slot is allocated once, so the callbacks do not allocate */
+        if ((dataType == NDAttrString) && !this->callbackString) {
+            this->stringCapacity = ((nRequest > MAX_STRING_SIZE) ? nRequest : MAX_STRING_SIZE) + 1;
+            this->callbackString = new char[this->stringCapacity]();
+        }
+        /* The attributes read dataType once they see a callbackVersion other than 0 */
+        this->dataType = dataType;
+        epicsAtomicWriteMemoryBarrier();
             
         /* Set value change callback on this PV */
         SEVCHK(ca_add_masked_array_event(
@@ -311,7 +448,7 @@ void PVAttribute::connectCallback(struct connection_handler_args cha)
         /* This is a disconnection event */
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: Disconnect event, PV=%s, chanId=%p\n", 
-            driverName, functionName, this->getSource(), chanId);
+            driverName, functionName, this->pvName.c_str(), chanId);
     }
     done:
     epicsMutexUnlock(this->lock);
@@ -327,8 +464,10 @@ int PVAttribute::report(FILE *fp, int details)
     NDAttribute::report(fp, details);
     fprintf(fp, "  PVAttribute\n");
     fprintf(fp, "    dbrType=%s\n", dbr_type_to_text(this->dbrType));
-    fprintf(fp, "    chanId=%p\n", this->chanId);
-    fprintf(fp, "    eventId=%p\n", this->eventId);
+    if (this->pPVSource) {
+        fprintf(fp, "    chanId=%p\n", this->pPVSource->chanId);
+        fprintf(fp, "    eventId=%p\n", this->pPVSource->eventId);
+    }
     return(ND_SUCCESS);
 }
     
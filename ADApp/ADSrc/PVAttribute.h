@@ -20,7 +20,12 @@
 /** Use native type for channel access */
 #define DBR_NATIVE -1
 
+class PVAttributeSource;
+
 /** Attribute that gets its value from an EPICS PV.
+  * All of the PVAttributes of the IOC with the same PV and dbrType share one PVAttributeSource, which holds one
+  * channel access channel and monitor for the PV, so the attribute files of many drivers and plugins can
+  * use the same PVs without each creating its own channel.
   */
 class PVAttribute : public NDAttribute {
 public:
@@ -29,19 +34,14 @@ public:
     ~PVAttribute();
     PVAttribute* copy(NDAttribute *pAttribute);
     virtual int updateValue();
-    /* These callbacks must be public because they are called from C */
-    void connectCallback(struct connection_handler_args cha);
-    void monitorCallback(struct event_handler_args cha);
     int report(FILE *fp, int details);
 
 private:
-    chid        chanId;
-    evid        eventId;
+    PVAttributeSource *pPVSource; /**< The shared source of the value, NULL for a copy */
     chtype      dbrType;
-    NDAttrValue callbackValue;
-    char        *callbackString;
-    bool        connectedOnce;
-    epicsMutexId lock;
+    char        *updateString;    /**< Copy of the string value of the source made by updateValue() */
+    size_t      updateCapacity;   /**< Size of updateString */
+    int         updateVersion;    /**< The callbackVersion of the source at the last updateValue() */
 };
 
 #endif /*INCPVAttributeH*/
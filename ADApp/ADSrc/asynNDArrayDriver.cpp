@@ -24,6 +24,7 @@
 #include <epicsMutex.h>
 #include <macLib.h>
 #include <cantProceed.h>
+#include <iocsh.h>
 
 #include <asynDriver.h>
 
@@ -34,6 +35,7 @@
 #include "paramAttribute.h"
 #include "functAttribute.h"
 #include "asynNDArrayDriver.h"
+#include <epicsExport.h>
 
 #define MAX_PATH_PARTS 32
 
@@ -563,10 +565,15 @@ asynStatus asynNDArrayDriver::readGenericPointer(asynUser *pasynUser, void *gene
                     driverName, functionName, pArray->pData);
         status = asynError;
     } else {
-        this->pNDArrayPool->copy(myArray, pArray, 0);
         myArray->getInfo(&arrayInfo);
-        if (arrayInfo.totalBytes > pArray->dataSize) arrayInfo.totalBytes = pArray->dataSize;
-        memcpy(pArray->pData, myArray->pData, arrayInfo.totalBytes);
+        if (myArray->isContiguous()) {
+            this->pNDArrayPool->copy(myArray, pArray, 0);
+            if (arrayInfo.totalBytes > pArray->dataSize) arrayInfo.totalBytes = pArray->dataSize;
+            memcpy(pArray->pData, myArray->pData, arrayInfo.totalBytes);
+        } else {
+            /* A strided view is copied element by element into the contiguous array */
+            this->pNDArrayPool->copy(myArray, pArray, 1);
+        }
         pasynUser->timestamp = myArray->epicsTS;
     }
     if (!status)
@@ -593,6 +600,51 @@ asynStatus asynNDArrayDriver::writeGenericPointer(asynUser *pasynUser, void *gen
     return status;
 }
 
+/** Called when asyn clients call pasynInt32->write().
+  * This function performs actions for some parameters, including NDPoolPreAllocate.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus asynNDArrayDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int addr=0;
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    const char *functionName = "writeInt32";
+
+    status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
+    /* Set the parameter in the parameter library. */
+    status = (asynStatus)setIntegerParam(addr, function, value);
+
+    if ((function == NDPoolPreAllocate) && value) {
+        int numBuffers, dataSize;
+        getIntegerParam(NDPoolPreAllocBuffers, &numBuffers);
+        getIntegerParam(NDPoolPreAllocSize, &dataSize);
+        if (dataSize <= 0) getIntegerParam(NDArraySize, &dataSize);
+        if ((dataSize <= 0) ||
+            (this->pNDArrayPool->preAllocate(numBuffers, dataSize) != ND_SUCCESS)) status = asynError;
+        setIntegerParam(NDPoolAllocBuffers, this->pNDArrayPool->numBuffers());
+        setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->numFree());
+        setIntegerParam(NDPoolPreAllocate, 0);
+    } else if ((function == NDPoolResetStats) && value) {
+        this->pNDArrayPool->resetStats();
+        setPoolStatsParams();
+        setIntegerParam(NDPoolResetStats, 0);
+    }
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks(addr, addr);
+
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
 asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
 {
     int function = pasynUser->reason;
@@ -623,6 +675,9 @@ asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *val
         setDoubleParam(function, this->pNDArrayPool->maxMemory() / MEGABYTE_DBL);
     } else if (function == NDPoolUsedMemory) {
         setDoubleParam(function, this->pNDArrayPool->memorySize() / MEGABYTE_DBL);
+        // This is read periodically, so also update the allocation statistics
+        setPoolStatsParams();
+        callParamCallbacks();
     }
 
     // Call base class
@@ -630,6 +685,99 @@ asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *val
     return status;
 }
 
+/** Copies the allocation statistics of the NDArrayPool to the parameter library.
+  * The caller must call callParamCallbacks() to publish them. */
+void asynNDArrayDriver::setPoolStatsParams()
+{
+    NDArrayPoolStats_t stats;
+    int i;
+
+    this->pNDArrayPool->getStats(&stats);
+    setIntegerParam(NDPoolFreeListHits,        (int)stats.freeListHits);
+    setIntegerParam(NDPoolNewBuffers,          (int)stats.newBuffers);
+    setIntegerParam(NDPoolReallocations,       (int)stats.reallocations);
+    setIntegerParam(NDPoolBufferLimitFailures, (int)stats.bufferLimitFailures);
+    setIntegerParam(NDPoolMemoryLimitFailures, (int)stats.memoryLimitFailures);
+    setIntegerParam(NDPoolAllocFailures,       (int)stats.allocFailures);
+    setIntegerParam(NDPoolEvictions,           (int)stats.evictions);
+    setIntegerParam(NDPoolTrimmedBuffers,      (int)stats.trimmedBuffers);
+    setIntegerParam(NDPoolMaxBuffersInUse,     stats.maxBuffersInUse);
+    setDoubleParam (NDPoolMaxUsedMemory,       stats.maxMemorySize / MEGABYTE_DBL);
+    setDoubleParam (NDPoolAllocTimeMin,        stats.minAllocTime * 1e6);
+    setDoubleParam (NDPoolAllocTimeAvg,        stats.numAllocs ? stats.totalAllocTime * 1e6 / stats.numAllocs : 0.);
+    setDoubleParam (NDPoolAllocTimeMax,        stats.maxAllocTime * 1e6);
+    for (i=0; i<ND_POOL_ALLOC_HIST_BINS; i++) {
+        setIntegerParam(NDPoolAllocHist[i], (int)stats.allocTimeHist[i]);
+    }
+}
+
+
+/** Sets the value of an integer parameter; overrides asynPortDriver::setIntegerParam to change the
+  * version of the parameter, see getParamVersion().
+  * \param[in] list The parameter list number.  Must be < maxAddr passed to asynPortDriver::asynPortDriver.
+  * \param[in] index The parameter number
+  * \param[in] value Value to set. */
+asynStatus asynNDArrayDriver::setIntegerParam(int list, int index, int value)
+{
+    this->changeParamVersion(list, index);
+    return asynPortDriver::setIntegerParam(list, index, value);
+}
+
+/** Sets the value of a double parameter; overrides asynPortDriver::setDoubleParam to change the
+  * version of the parameter, see getParamVersion().
+  * \param[in] list The parameter list number.  Must be < maxAddr passed to asynPortDriver::asynPortDriver.
+  * \param[in] index The parameter number
+  * \param[in] value Value to set. */
+asynStatus asynNDArrayDriver::setDoubleParam(int list, int index, double value)
+{
+    this->changeParamVersion(list, index);
+    return asynPortDriver::setDoubleParam(list, index, value);
+}
+
+/** Sets the value of a string parameter; overrides asynPortDriver::setStringParam to change the
+  * version of the parameter, see getParamVersion().
+  * \param[in] list The parameter list number.  Must be < maxAddr passed to asynPortDriver::asynPortDriver.
+  * \param[in] index The parameter number
+  * \param[in] value Address of value to set. */
+asynStatus asynNDArrayDriver::setStringParam(int list, int index, const char *value)
+{
+    this->changeParamVersion(list, index);
+    return asynPortDriver::setStringParam(list, index, value);
+}
+
+/** Sets the value of a string parameter; overrides asynPortDriver::setStringParam to change the
+  * version of the parameter, see getParamVersion().
+  * \param[in] list The parameter list number.  Must be < maxAddr passed to asynPortDriver::asynPortDriver.
+  * \param[in] index The parameter number
+  * \param[in] value Value to set. */
+asynStatus asynNDArrayDriver::setStringParam(int list, int index, const std::string& value)
+{
+    this->changeParamVersion(list, index);
+    return asynPortDriver::setStringParam(list, index, value);
+}
+
+/** Returns the version of a parameter, a number that changes whenever the parameter is set.
+  * paramAttribute uses it to read the parameter only when it was set since its last update.
+  * Must be called with the driver locked.
+  * \param[in] list The parameter list number.
+  * \param[in] index The parameter number */
+int asynNDArrayDriver::getParamVersion(int list, int index)
+{
+    if ((list < 0) || ((size_t)list >= this->paramVersions_.size()) ||
+        (index < 0) || ((size_t)index >= this->paramVersions_[list].size())) return 0;
+    return this->paramVersions_[list][index];
+}
+
+/** Changes the version of a parameter.  Must be called with the driver locked. */
+void asynNDArrayDriver::changeParamVersion(int list, int index)
+{
+    if ((list < 0) || (list >= this->maxAddr) || (index < 0)) return;
+    if ((size_t)list >= this->paramVersions_.size()) this->paramVersions_.resize(this->maxAddr);
+    std::vector<int>& versions = this->paramVersions_[list];
+    if ((size_t)index >= versions.size()) versions.resize(index + 1, 0);
+    versions[index]++;
+}
+
 
 /** Report status of the driver.
   * This method calls the report function in the asynPortDriver base class. It then
@@ -748,6 +896,28 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     createParam(NDPoolFreeBuffersString,      asynParamInt32,           &NDPoolFreeBuffers);
     createParam(NDPoolMaxMemoryString,        asynParamFloat64,         &NDPoolMaxMemory);
     createParam(NDPoolUsedMemoryString,       asynParamFloat64,         &NDPoolUsedMemory);
+    createParam(NDPoolFreeListHitsString,        asynParamInt32,        &NDPoolFreeListHits);
+    createParam(NDPoolNewBuffersString,          asynParamInt32,        &NDPoolNewBuffers);
+    createParam(NDPoolReallocationsString,       asynParamInt32,        &NDPoolReallocations);
+    createParam(NDPoolBufferLimitFailuresString, asynParamInt32,        &NDPoolBufferLimitFailures);
+    createParam(NDPoolMemoryLimitFailuresString, asynParamInt32,        &NDPoolMemoryLimitFailures);
+    createParam(NDPoolAllocFailuresString,       asynParamInt32,        &NDPoolAllocFailures);
+    createParam(NDPoolEvictionsString,           asynParamInt32,        &NDPoolEvictions);
+    createParam(NDPoolTrimmedBuffersString,      asynParamInt32,        &NDPoolTrimmedBuffers);
+    createParam(NDPoolMaxBuffersInUseString,     asynParamInt32,        &NDPoolMaxBuffersInUse);
+    createParam(NDPoolMaxUsedMemoryString,       asynParamFloat64,      &NDPoolMaxUsedMemory);
+    createParam(NDPoolAllocTimeMinString,        asynParamFloat64,      &NDPoolAllocTimeMin);
+    createParam(NDPoolAllocTimeAvgString,        asynParamFloat64,      &NDPoolAllocTimeAvg);
+    createParam(NDPoolAllocTimeMaxString,        asynParamFloat64,      &NDPoolAllocTimeMax);
+    for (int i=0; i<ND_POOL_ALLOC_HIST_BINS; i++) {
+        char histName[32];
+        epicsSnprintf(histName, sizeof(histName), "%s%d", NDPoolAllocHistString, i);
+        createParam(histName,                    asynParamInt32,        &NDPoolAllocHist[i]);
+    }
+    createParam(NDPoolResetStatsString,          asynParamInt32,        &NDPoolResetStats);
+    createParam(NDPoolPreAllocBuffersString,  asynParamInt32,           &NDPoolPreAllocBuffers);
+    createParam(NDPoolPreAllocSizeString,     asynParamInt32,           &NDPoolPreAllocSize);
+    createParam(NDPoolPreAllocateString,      asynParamInt32,           &NDPoolPreAllocate);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -797,10 +967,19 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     setIntegerParam(NDPoolMaxBuffers, this->pNDArrayPool->maxBuffers());
     setIntegerParam(NDPoolAllocBuffers, this->pNDArrayPool->numBuffers());
     setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->numFree());
+    setIntegerParam(NDPoolPreAllocate, 0);
+    setIntegerParam(NDPoolResetStats, 0);
+    setPoolStatsParams();
 
 }
 
 
+/** Returns the NDArrayPool object that this driver uses to allocate NDArrays. */
+NDArrayPool* asynNDArrayDriver::getNDArrayPool()
+{
+    return this->pNDArrayPool;
+}
+
 asynNDArrayDriver::~asynNDArrayDriver()
 { 
     delete this->pNDArrayPool;
@@ -808,3 +987,227 @@ asynNDArrayDriver::~asynNDArrayDriver()
     delete this->pAttributeList;
 }    
 
+
+
+static NDArrayPool *findNDArrayPool(const char *portName, const char *functionName)
+{
+    asynNDArrayDriver *pDriver = (asynNDArrayDriver *)findAsynPortDriver(portName);
+
+    if (!pDriver) {
+        printf("%s: cannot find port %s\n", functionName, portName);
+        return NULL;
+    }
+    return pDriver->getNDArrayPool();
+}
+
+/** Sets the alignment of the NDArray buffers that a driver or plugin allocates.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] alignment The alignment in bytes; 0 selects the default malloc alignment.
+  */
+extern "C" int NDArrayPoolSetAlignment(const char *portName, int alignment)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetAlignment");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setAlignment(alignment);
+}
+
+/** Selects whether large NDArray buffers that a driver or plugin allocates are backed by huge pages.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] mode 0=none, 1=transparent huge pages, 2=explicit (hugetlbfs) huge pages.
+  * \param[in] threshold Buffers smaller than this many bytes never use huge pages.
+  */
+extern "C" int NDArrayPoolSetHugePages(const char *portName, int mode, int threshold)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetHugePages");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setHugePages((NDHugePages_t)mode, threshold);
+}
+
+/** Sets the NUMA placement policy of the NDArray buffers that a driver or plugin allocates.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] policy 0=none, 1=bind to node, 2=bind to the node of the allocating thread.
+  * \param[in] node The NUMA node for policy=1.
+  */
+extern "C" int NDArrayPoolSetNumaPolicy(const char *portName, int policy, int node)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetNumaPolicy");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setNumaPolicy((NDNumaPolicy_t)policy, node);
+}
+
+/** Sets the number of worker threads that a driver or plugin uses to convert large NDArrays,
+  * when it extracts a region, bins or reverses them.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] numThreads The number of worker threads; 0=no worker threads.
+  * \param[in] minBytes Output arrays smaller than this many bytes are converted without the worker threads.
+  */
+extern "C" int NDArrayPoolSetConvertThreads(const char *portName, int numThreads, int minBytes)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetConvertThreads");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setConvertThreads(numThreads, minBytes);
+}
+
+/** Pre-allocates NDArray buffers for a driver or plugin and maps their pages, so that the first arrays
+  * of an acquisition do not have to allocate memory.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] numBuffers The number of buffers.
+  * \param[in] dataSize The size of each buffer in bytes.
+  */
+extern "C" int NDArrayPoolPreAllocate(const char *portName, int numBuffers, int dataSize)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolPreAllocate");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->preAllocate(numBuffers, dataSize);
+}
+
+/** Selects whether a driver or plugin shares the attribute lists of NDArrays with the arrays it copies,
+  * converts or makes views of, rather than copying the attributes.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] enable 1 to share the attribute lists, 0 to copy them.
+  */
+extern "C" int NDArrayPoolSetShareAttributes(const char *portName, int enable)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetShareAttributes");
+
+    if (!pPool) return ND_ERROR;
+    pPool->setShareAttributes(enable != 0);
+    return ND_SUCCESS;
+}
+
+/** Sets the policy that a driver or plugin uses to choose the free NDArray buffers to evict when its pool
+  * has reached maxMemory.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] policy 0=smallest size classes first, 1=size that differs most from the request first,
+  *            2=least recently used first.
+  */
+extern "C" int NDArrayPoolSetEvictionPolicy(const char *portName, int policy)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetEvictionPolicy");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setEvictionPolicy((NDPoolEviction_t)policy);
+}
+
+/** Starts a background thread that frees the NDArray buffers of a driver or plugin that have been free
+  * for longer than an idle time.
+  * \param[in] portName The name of the asynNDArrayDriver port.
+  * \param[in] idleTime The idle time in seconds; 0 stops trimming.
+  */
+extern "C" int NDArrayPoolSetTrimIdleTime(const char *portName, double idleTime)
+{
+    NDArrayPool *pPool = findNDArrayPool(portName, "NDArrayPoolSetTrimIdleTime");
+
+    if (!pPool) return ND_ERROR;
+    return pPool->setTrimIdleTime(idleTime);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg setAlignmentArg0 = {"portName", iocshArgString};
+static const iocshArg setAlignmentArg1 = {"alignment", iocshArgInt};
+static const iocshArg * const setAlignmentArgs[] = {&setAlignmentArg0,
+                                                    &setAlignmentArg1};
+static const iocshFuncDef setAlignmentFuncDef = {"NDArrayPoolSetAlignment", 2, setAlignmentArgs};
+static void setAlignmentCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetAlignment(args[0].sval, args[1].ival);
+}
+
+static const iocshArg setHugePagesArg0 = {"portName", iocshArgString};
+static const iocshArg setHugePagesArg1 = {"mode", iocshArgInt};
+static const iocshArg setHugePagesArg2 = {"threshold", iocshArgInt};
+static const iocshArg * const setHugePagesArgs[] = {&setHugePagesArg0,
+                                                    &setHugePagesArg1,
+                                                    &setHugePagesArg2};
+static const iocshFuncDef setHugePagesFuncDef = {"NDArrayPoolSetHugePages", 3, setHugePagesArgs};
+static void setHugePagesCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetHugePages(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg setNumaPolicyArg0 = {"portName", iocshArgString};
+static const iocshArg setNumaPolicyArg1 = {"policy", iocshArgInt};
+static const iocshArg setNumaPolicyArg2 = {"node", iocshArgInt};
+static const iocshArg * const setNumaPolicyArgs[] = {&setNumaPolicyArg0,
+                                                     &setNumaPolicyArg1,
+                                                     &setNumaPolicyArg2};
+static const iocshFuncDef setNumaPolicyFuncDef = {"NDArrayPoolSetNumaPolicy", 3, setNumaPolicyArgs};
+static void setNumaPolicyCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetNumaPolicy(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg setConvertThreadsArg0 = {"portName", iocshArgString};
+static const iocshArg setConvertThreadsArg1 = {"numThreads", iocshArgInt};
+static const iocshArg setConvertThreadsArg2 = {"minBytes", iocshArgInt};
+static const iocshArg * const setConvertThreadsArgs[] = {&setConvertThreadsArg0,
+                                                         &setConvertThreadsArg1,
+                                                         &setConvertThreadsArg2};
+static const iocshFuncDef setConvertThreadsFuncDef = {"NDArrayPoolSetConvertThreads", 3, setConvertThreadsArgs};
+static void setConvertThreadsCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetConvertThreads(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg preAllocateArg0 = {"portName", iocshArgString};
+static const iocshArg preAllocateArg1 = {"numBuffers", iocshArgInt};
+static const iocshArg preAllocateArg2 = {"dataSize", iocshArgInt};
+static const iocshArg * const preAllocateArgs[] = {&preAllocateArg0,
+                                                   &preAllocateArg1,
+                                                   &preAllocateArg2};
+static const iocshFuncDef preAllocateFuncDef = {"NDArrayPoolPreAllocate", 3, preAllocateArgs};
+static void preAllocateCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolPreAllocate(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg setShareAttributesArg0 = {"portName", iocshArgString};
+static const iocshArg setShareAttributesArg1 = {"enable", iocshArgInt};
+static const iocshArg * const setShareAttributesArgs[] = {&setShareAttributesArg0,
+                                                          &setShareAttributesArg1};
+static const iocshFuncDef setShareAttributesFuncDef = {"NDArrayPoolSetShareAttributes", 2, setShareAttributesArgs};
+static void setShareAttributesCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetShareAttributes(args[0].sval, args[1].ival);
+}
+
+static const iocshArg setEvictionPolicyArg0 = {"portName", iocshArgString};
+static const iocshArg setEvictionPolicyArg1 = {"policy", iocshArgInt};
+static const iocshArg * const setEvictionPolicyArgs[] = {&setEvictionPolicyArg0,
+                                                         &setEvictionPolicyArg1};
+static const iocshFuncDef setEvictionPolicyFuncDef = {"NDArrayPoolSetEvictionPolicy", 2, setEvictionPolicyArgs};
+static void setEvictionPolicyCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetEvictionPolicy(args[0].sval, args[1].ival);
+}
+
+static const iocshArg setTrimIdleTimeArg0 = {"portName", iocshArgString};
+static const iocshArg setTrimIdleTimeArg1 = {"idleTime", iocshArgDouble};
+static const iocshArg * const setTrimIdleTimeArgs[] = {&setTrimIdleTimeArg0,
+                                                       &setTrimIdleTimeArg1};
+static const iocshFuncDef setTrimIdleTimeFuncDef = {"NDArrayPoolSetTrimIdleTime", 2, setTrimIdleTimeArgs};
+static void setTrimIdleTimeCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolSetTrimIdleTime(args[0].sval, args[1].dval);
+}
+
+extern "C" void asynNDArrayDriverRegister(void)
+{
+    iocshRegister(&setAlignmentFuncDef, setAlignmentCallFunc);
+    iocshRegister(&setHugePagesFuncDef, setHugePagesCallFunc);
+    iocshRegister(&setNumaPolicyFuncDef, setNumaPolicyCallFunc);
+    iocshRegister(&setConvertThreadsFuncDef, setConvertThreadsCallFunc);
+    iocshRegister(&preAllocateFuncDef, preAllocateCallFunc);
+    iocshRegister(&setShareAttributesFuncDef, setShareAttributesCallFunc);
+    iocshRegister(&setEvictionPolicyFuncDef, setEvictionPolicyCallFunc);
+    iocshRegister(&setTrimIdleTimeFuncDef, setTrimIdleTimeCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(asynNDArrayDriverRegister);
+}
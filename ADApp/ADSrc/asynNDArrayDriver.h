@@ -1,6 +1,9 @@
 #ifndef asynNDArrayDriver_H
 #define asynNDArrayDriver_H
 
+#include <string>
+#include <vector>
+
 #include "asynPortDriver.h"
 #include "NDArray.h"
 #include "ADCoreVersion.h"
@@ -102,6 +105,29 @@ typedef enum {
 #define NDPoolMaxMemoryString       "POOL_MAX_MEMORY"
 #define NDPoolUsedMemoryString      "POOL_USED_MEMORY"
 
+/* NDArray Pool allocation statistics, updated each time POOL_USED_MEMORY is read */
+#define NDPoolFreeListHitsString        "POOL_FREE_LIST_HITS"       /**< (asynInt32,    r/o) Allocations that reused a free buffer */
+#define NDPoolNewBuffersString          "POOL_NEW_BUFFERS"          /**< (asynInt32,    r/o) Allocations that allocated a new buffer */
+#define NDPoolReallocationsString       "POOL_REALLOCATIONS"        /**< (asynInt32,    r/o) Allocations that reallocated a buffer that was too small */
+#define NDPoolBufferLimitFailuresString "POOL_BUFFER_LIMIT_FAILURES" /**< (asynInt32,   r/o) Allocations that failed because of maxBuffers */
+#define NDPoolMemoryLimitFailuresString "POOL_MEMORY_LIMIT_FAILURES" /**< (asynInt32,   r/o) Allocations that failed because of maxMemory */
+#define NDPoolAllocFailuresString       "POOL_ALLOC_FAILURES"       /**< (asynInt32,    r/o) Allocations that failed to get memory */
+#define NDPoolEvictionsString           "POOL_EVICTIONS"            /**< (asynInt32,    r/o) Free buffers freed to stay within maxMemory */
+#define NDPoolTrimmedBuffersString      "POOL_TRIMMED_BUFFERS"      /**< (asynInt32,    r/o) Idle free buffers freed by the trimmer */
+#define NDPoolMaxBuffersInUseString     "POOL_MAX_BUFFERS_IN_USE"   /**< (asynInt32,    r/o) High-water mark of the buffers in use */
+#define NDPoolMaxUsedMemoryString       "POOL_MAX_USED_MEMORY"      /**< (asynFloat64,  r/o) High-water mark of the memory in MB */
+#define NDPoolAllocTimeMinString        "POOL_ALLOC_TIME_MIN"       /**< (asynFloat64,  r/o) Shortest alloc() time in us */
+#define NDPoolAllocTimeAvgString        "POOL_ALLOC_TIME_AVG"       /**< (asynFloat64,  r/o) Average alloc() time in us */
+#define NDPoolAllocTimeMaxString        "POOL_ALLOC_TIME_MAX"       /**< (asynFloat64,  r/o) Longest alloc() time in us */
+#define NDPoolAllocHistString           "POOL_ALLOC_HIST"           /**< (asynInt32,    r/o) Prefix of the alloc() time histogram bins
+                                                                      *  POOL_ALLOC_HIST0 to POOL_ALLOC_HIST5 */
+#define NDPoolResetStatsString          "POOL_RESET_STATS"          /**< (asynInt32,    r/w) Reset the allocation statistics */
+
+#define NDPoolPreAllocBuffersString "POOL_PREALLOC_BUFFERS"  /**< (asynInt32,    r/w) Number of buffers to pre-allocate */
+#define NDPoolPreAllocSizeString    "POOL_PREALLOC_SIZE"     /**< (asynInt32,    r/w) Size of the buffers to pre-allocate in bytes;
+                                                               *  0=use ARRAY_SIZE */
+#define NDPoolPreAllocateString     "POOL_PREALLOCATE"       /**< (asynInt32,    r/w) Pre-allocate the buffers (1=Allocate) */
+
 /** This is the class from which NDArray drivers are derived; implements the asynGenericPointer functions 
   * for NDArray objects. 
   * For areaDetector, both plugins and detector drivers are indirectly derived from this class.
@@ -118,8 +144,16 @@ public:
                           size_t *nActual);
     virtual asynStatus readGenericPointer(asynUser *pasynUser, void *genericPointer);
     virtual asynStatus writeGenericPointer(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
     virtual asynStatus readFloat64(asynUser *pasynUser, epicsFloat64 *value);
+    virtual asynStatus setIntegerParam(int list, int index, int value);
+    virtual asynStatus setDoubleParam(int list, int index, double value);
+    virtual asynStatus setStringParam(int list, int index, const char *value);
+    virtual asynStatus setStringParam(int list, int index, const std::string& value);
+    using asynPortDriver::setIntegerParam;
+    using asynPortDriver::setDoubleParam;
+    using asynPortDriver::setStringParam;
     virtual void report(FILE *fp, int details);
 
     /* These are the methods that are new to this class */
@@ -129,6 +163,9 @@ public:
     virtual asynStatus createFileName(int maxChars, char *filePath, char *fileName);
     virtual asynStatus readNDAttributesFile();
     virtual asynStatus getAttributes(NDAttributeList *pAttributeList);
+    NDArrayPool *getNDArrayPool();
+    void setPoolStatsParams();
+    int getParamVersion(int list, int index);
 
 protected:
     int NDPortNameSelf;
@@ -180,6 +217,24 @@ protected:
     int NDPoolFreeBuffers;
     int NDPoolMaxMemory;
     int NDPoolUsedMemory;
+    int NDPoolFreeListHits;
+    int NDPoolNewBuffers;
+    int NDPoolReallocations;
+    int NDPoolBufferLimitFailures;
+    int NDPoolMemoryLimitFailures;
+    int NDPoolAllocFailures;
+    int NDPoolEvictions;
+    int NDPoolTrimmedBuffers;
+    int NDPoolMaxBuffersInUse;
+    int NDPoolMaxUsedMemory;
+    int NDPoolAllocTimeMin;
+    int NDPoolAllocTimeAvg;
+    int NDPoolAllocTimeMax;
+    int NDPoolAllocHist[ND_POOL_ALLOC_HIST_BINS];
+    int NDPoolResetStats;
+    int NDPoolPreAllocBuffers;
+    int NDPoolPreAllocSize;
+    int NDPoolPreAllocate;
 
     NDArray **pArrays;             /**< An array of NDArray pointers used to store data in the driver */
     NDArrayPool *pNDArrayPool;     /**< An NDArrayPool object used to allocate and manipulate NDArray objects */
@@ -188,6 +243,9 @@ protected:
     int threadStackSize_;
     int threadPriority_;
 
+private:
+    void changeParamVersion(int list, int index);
+    std::vector<std::vector<int> > paramVersions_;  /**< Versions of the parameters of each address, see getParamVersion() */
 };
 
 #endif
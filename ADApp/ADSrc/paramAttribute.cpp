@@ -44,7 +44,7 @@ static asynUser *pasynUserSelf = NULL;
 paramAttribute::paramAttribute(const char *pName, const char *pDescription, const char *pSource, int addr, 
                                class asynNDArrayDriver *pDriver, const char *dataType)
     : NDAttribute(pName, pDescription, NDAttrSourceParam, pSource, NDAttrUndefined, 0),
-    paramAddr(addr), paramType(paramAttrTypeUnknown), pDriver(pDriver)
+    paramAddr(addr), paramType(paramAttrTypeUnknown), paramVersion(0), updated(false), pDriver(pDriver)
 {
     static const char *functionName = "paramAttribute";
     asynUser *pasynUser=NULL;
@@ -108,6 +108,8 @@ paramAttribute::paramAttribute(paramAttribute& attribute)
     paramAddr = attribute.paramAddr;
     pDriver = attribute.pDriver;
     paramId = attribute.paramId;
+    paramVersion = attribute.paramVersion;
+    updated = attribute.updated;
 }
 
 /** Destructor for driver/plugin attribute
@@ -118,6 +120,7 @@ paramAttribute::~paramAttribute()
 
 /** Updates the current value of this attribute; sets the attribute value to the current value of the
   * driver/plugin parameter in the parameter library.
+  * The parameter is not read again if it was not set since the previous update.
   */
 int paramAttribute::updateValue()
 {
@@ -126,7 +129,11 @@ int paramAttribute::updateValue()
     epicsInt32 i32Value=0;
     epicsFloat64 f64Value=0.;
     static const char *functionName = "updateValue";
+    int version = this->pDriver->getParamVersion(this->paramAddr, this->paramId);
     
+    if (this->updated && (version == this->paramVersion)) return asynSuccess;
+    this->paramVersion = version;
+    this->updated = true;
     switch (this->paramType) {
         case paramAttrTypeInt:
             status = this->pDriver->getIntegerParam(this->paramAddr, this->paramId, 
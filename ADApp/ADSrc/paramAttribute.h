@@ -24,7 +24,8 @@ typedef enum {
 } paramAttrType_t;
 
 /** Attribute that gets its value from an asynNDArrayDriver driver parameter.
-  * The updateValue() method for this class retrieves the current value of the driver parameter.
+  * The updateValue() method for this class retrieves the current value of the driver parameter
+  * if the parameter was set since the previous update.
   */
 class paramAttribute : public NDAttribute {
 public:
@@ -40,6 +41,8 @@ private:
     int         paramId;
     int         paramAddr;
     paramAttrType_t paramType;
+    int         paramVersion;  /**< Version of the parameter at the last update, see asynNDArrayDriver::getParamVersion() */
+    bool        updated;       /**< The value was read at least once */
     class asynNDArrayDriver *pDriver;
 };
 
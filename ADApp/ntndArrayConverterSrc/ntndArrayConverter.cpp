@@ -1,12 +1,20 @@
 #include <math.h>
+#include <limits.h>
+
+#ifdef ND_WITH_BLOSC
+#include <blosc.h>
+#endif
 
 #include <epicsExport.h>
+#include <NDCompressKernels.h>
+#include <NDConvertKernels.h>
 #include "ntndArrayConverter.h"
 
 using namespace std;
 using namespace epics::nt;
 using namespace epics::pvData;
 using tr1::static_pointer_cast;
+using tr1::dynamic_pointer_cast;
 
 // Maps the selected index of the value field to its type.
 static const NDDataType_t scalarToNDDataType[pvString+1] = {
@@ -40,6 +48,19 @@ static const NDAttrDataType_t scalarToNDAttrDataType[pvString+1] = {
         NDAttrString,   // 11: pvString
 };
 
+// Maps NDDataType_t to the ScalarType of the value of an uncompressed array
+static const ScalarType NDDataTypeToScalar[NDFloat16+1] = {
+        pvByte,     // NDInt8
+        pvUByte,    // NDUInt8
+        pvShort,    // NDInt16
+        pvUShort,   // NDUInt16
+        pvInt,      // NDInt32
+        pvUInt,     // NDUInt32
+        pvFloat,    // NDFloat32
+        pvDouble,   // NDFloat64
+        pvUShort,   // NDFloat16, the binary16 bits of the elements
+};
+
 static const PVDataCreatePtr PVDC = getPVDataCreate();
 
 template <typename dataType>
@@ -67,6 +88,23 @@ ScalarType NTNDArrayConverter::getValueType (void)
     return ScalarTypeFunc::getScalarType(typeName);
 }
 
+/*
+ * The type of the uncompressed data.  The value of a compressed array is a ubyte
+ * array, so the type is in codec.parameters, as NDPluginPva publishes it.
+ */
+ScalarType NTNDArrayConverter::getDataType (void)
+{
+    PVStructurePtr codec(m_array->getCodec());
+
+    if(codec->getSubField<PVString>("name")->get().empty())
+        return getValueType();
+
+    PVScalarPtr type(dynamic_pointer_cast<PVScalar>(codec->getSubField<PVUnion>("parameters")->get()));
+    if(!type)
+        throw std::runtime_error("no uncompressed data type in codec.parameters");
+    return static_cast<ScalarType>(type->getAs<int32>());
+}
+
 NDColorMode_t NTNDArrayConverter::getColorMode (void)
 {
     NDColorMode_t colorMode = NDColorModeMono;
@@ -103,7 +141,7 @@ NTNDArrayInfo_t NTNDArrayConverter::getInfo (void)
 
     NDDataType_t dt;
     int bpe;
-    switch(getValueType())
+    switch(getDataType())
     {
     case pvByte:    dt = NDInt8;     bpe = sizeof(epicsInt8);    break;
     case pvUByte:   dt = NDUInt8;    bpe = sizeof(epicsUInt8);   break;
@@ -190,9 +228,83 @@ NTNDArrayInfo_t NTNDArrayConverter::getInfo (void)
     return info;
 }
 
+/*
+ * Holds a reference to the value of a received NTNDArray for the NDArray that
+ * importArray() wraps around it, until the NDArrayPool releases the array.
+ */
+class NTNDArrayValueOwner : public NDArrayBufferOwner
+{
+public:
+    NTNDArrayValueOwner (const shared_vector<const void> & value) : m_value(value) {}
+
+private:
+    shared_vector<const void> m_value;
+};
+
+/*
+ * Returns an NDArray from pPool, holding a reference to the NTNDArray, whose
+ * pData is the value of the NTNDArray rather than a copy of it.  The value is
+ * frozen, so the array must not be changed, as for any array sent to plugins.
+ * A compressed value is decompressed into an array of the pool, as by toArray().
+ * Returns NULL if the pool cannot allocate the array.
+ */
+NDArray *NTNDArrayConverter::importArray (NDArrayPool *pPool)
+{
+    NTNDArrayInfo_t info(getInfo());
+    NDArray *pArray;
+
+    if(!m_array->getCodec()->getSubField<PVString>("name")->get().empty())
+    {
+        pArray = pPool->alloc(info.ndims, info.dims, info.dataType, 0, NULL);
+        if(!pArray)
+            return NULL;
+
+        try
+        {
+            toArray(pArray);
+        }
+        catch(...)
+        {
+            pArray->release();
+            throw;
+        }
+        return pArray;
+    }
+
+    shared_vector<const void> value;
+    m_array->getValue()->get<PVScalarArray>()->getAs<void>(value);
+    if(value.size() < info.totalBytes)
+        throw std::runtime_error("the value is smaller than its dimensions");
+
+    NTNDArrayValueOwner *pOwner = new NTNDArrayValueOwner(value);
+    pArray = pPool->alloc(info.ndims, info.dims, info.dataType, value.size(),
+            const_cast<void *>(value.data()), pOwner);
+    if(!pArray)
+    {
+        delete pOwner;
+        return NULL;
+    }
+
+    try
+    {
+        toMetaData(pArray);
+    }
+    catch(...)
+    {
+        pArray->release();
+        throw;
+    }
+    return pArray;
+}
+
 void NTNDArrayConverter::toArray (NDArray *dest)
 {
     toValue(dest);
+    toMetaData(dest);
+}
+
+void NTNDArrayConverter::toMetaData (NDArray *dest)
+{
     toDimensions(dest);
     toTimeStamp(dest);
     toDataTimeStamp(dest);
@@ -212,7 +324,7 @@ void NTNDArrayConverter::fromArray (NDArray *src)
     fromDataTimeStamp(src);
     fromAttributes(src);
 
-    m_array->getCodec()->getSubField<PVString>("name")->put("");
+    fromCodec(src);
 
     // getUniqueId not implemented yet
     // m_array->getUniqueId()->put(src->uniqueId);
@@ -231,8 +343,64 @@ void NTNDArrayConverter::toValue (NDArray *dest)
     memcpy(dest->pData, srcVec.data(), srcVec.size()*sizeof(arrayValType));
 }
 
+/*
+ * Decompresses the ubyte value of a compressed array into dest, which has the
+ * dimensions and data type of the uncompressed data.
+ */
+void NTNDArrayConverter::toCompressedValue (NDArray *dest)
+{
+    string name(m_array->getCodec()->getSubField<PVString>("name")->get());
+    NDArrayInfo_t arrayInfo;
+    int status = ND_ERROR;
+
+    if(getValueType() != pvUByte)
+        throw std::runtime_error("the value of a compressed array is not a ubyte array");
+
+    PVUByteArray::const_svector srcVec(m_array->getValue()->get<PVUByteArray>()->view());
+    dest->getInfo(&arrayInfo);
+    if(dest->dataSize < arrayInfo.totalBytes)
+        throw std::runtime_error("the array is too small for the decompressed data");
+
+    if(name == NDCodecName[NDCodecLZ4])
+    {
+        status = NDLZ4Decompress(srcVec.data(), srcVec.size(), dest->pData, arrayInfo.totalBytes);
+    }
+    else if(name == NDCodecName[NDCodecBSLZ4])
+    {
+        size_t scratchSize = NDBitshuffleLZ4ScratchSize(srcVec.data(), srcVec.size(), arrayInfo.totalBytes);
+        if(scratchSize > 0)
+        {
+            vector<char> scratch(scratchSize);
+            status = NDBitshuffleLZ4Decompress(arrayInfo.bytesPerElement, srcVec.data(), srcVec.size(),
+                    &scratch[0], dest->pData, arrayInfo.totalBytes);
+        }
+    }
+#ifdef ND_WITH_BLOSC
+    else if(name == NDCodecName[NDCodecBlosc])
+    {
+        if(arrayInfo.totalBytes <= INT_MAX &&
+           blosc_decompress_ctx(srcVec.data(), dest->pData, arrayInfo.totalBytes, 1) ==
+           static_cast<int>(arrayInfo.totalBytes))
+            status = ND_SUCCESS;
+    }
+#endif
+    else
+        throw std::runtime_error("unsupported codec " + name);
+
+    if(status != ND_SUCCESS)
+        throw std::runtime_error("cannot decompress the " + name + " array");
+    dest->codec.clear();
+    dest->compressedSize = 0;
+}
+
 void NTNDArrayConverter::toValue (NDArray *dest)
 {
+    if(!m_array->getCodec()->getSubField<PVString>("name")->get().empty())
+    {
+        toCompressedValue(dest);
+        return;
+    }
+
     switch(getValueType())
     {
     case pvByte:    toValue<PVByteArray>  (dest); break;
@@ -385,9 +553,14 @@ void NTNDArrayConverter::fromValue (NDArray *src)
     src->getInfo(&arrayInfo);
     count = arrayInfo.nElements;
     nBytes = arrayInfo.totalBytes;
+    if (!src->codec.empty()) {
+        // The compressed bytes are published as a ubyte array
+        count = src->compressedSize / sizeof(srcDataType);
+        nBytes = src->compressedSize;
+    }
 
     m_array->getCompressedDataSize()->put(static_cast<int64>(nBytes));
-    m_array->getUncompressedDataSize()->put(static_cast<int64>(nBytes));
+    m_array->getUncompressedDataSize()->put(static_cast<int64>(arrayInfo.totalBytes));
 
     src->reserve();
     shared_vector<arrayValType> temp((srcDataType*)src->pData,
@@ -398,8 +571,29 @@ void NTNDArrayConverter::fromValue (NDArray *src)
     dest->postPut();
 }
 
+// pvData has no half precision type, so the value of an uncompressed NDFloat16 array is published as float
+void NTNDArrayConverter::fromFloat16Value (NDArray *src)
+{
+    NDArrayInfo_t arrayInfo;
+
+    src->getInfo(&arrayInfo);
+    PVFloatArray::svector temp(arrayInfo.nElements);
+    NDConvertContiguous(NDFloat16, src->pData, NDFloat32, temp.data(), arrayInfo.nElements);
+
+    m_array->getCompressedDataSize()->put(static_cast<int64>(temp.size() * sizeof(float)));
+    m_array->getUncompressedDataSize()->put(static_cast<int64>(temp.size() * sizeof(float)));
+
+    PVUnionPtr dest = m_array->getValue();
+    dest->select<PVFloatArray>("floatValue")->replace(freeze(temp));
+    dest->postPut();
+}
+
 void NTNDArrayConverter::fromValue (NDArray *src)
 {
+    if (!src->codec.empty()) {
+        fromValue<PVUByteArray, uint8_t>(src);
+        return;
+    }
     switch(src->dataType)
     {
     case NDInt8:    fromValue<PVByteArray,   int8_t>   (src); break;
@@ -410,9 +604,23 @@ void NTNDArrayConverter::fromValue (NDArray *src)
     case NDUInt32:  fromValue<PVUIntArray,   uint32_t> (src); break;
     case NDFloat32: fromValue<PVFloatArray,  float>    (src); break;
     case NDFloat64: fromValue<PVDoubleArray, double>   (src); break;
+    case NDFloat16: fromFloat16Value(src); break;
     }
 }
 
+void NTNDArrayConverter::fromCodec (NDArray *src)
+{
+    PVStructurePtr codec(m_array->getCodec());
+    PVIntPtr uncompressedType;
+
+    codec->getSubField<PVString>("name")->put(src->codec.name);
+    if (src->codec.empty()) return;
+    // The ubyte value of a compressed array would lose the type of the uncompressed data
+    uncompressedType = static_pointer_cast<PVInt>(PVDC->createPVScalar(pvInt));
+    uncompressedType->put(NDDataTypeToScalar[src->dataType]);
+    codec->getSubField<PVUnion>("parameters")->set(uncompressedType);
+}
+
 void NTNDArrayConverter::fromDimensions (NDArray *src)
 {
     PVStructureArrayPtr dest(m_array->getDimension());
@@ -473,6 +681,181 @@ void NTNDArrayConverter::fromAttribute (PVStructurePtr dest, NDAttribute *src)
     static_pointer_cast<pvAttrType>(destUnion->get())->put(value);
 }
 
+void NTNDArrayConverter::fromStringAttribute (PVStructurePtr dest, NDAttribute *src)
+{
+    NDAttrDataType_t attrDataType;
+    size_t attrDataSize;
+
+    src->getValueInfo(&attrDataType, &attrDataSize);
+
+    // The buffer is kept between arrays so the value of a string is copied without an allocation
+    if(m_attrString.size() < attrDataSize)
+        m_attrString.resize(attrDataSize);
+    src->getValue(attrDataType, &m_attrString[0], attrDataSize);
+
+    PVUnionPtr destUnion(dest->getSubField<PVUnion>("value"));
+
+    if(!destUnion->get())
+        destUnion->set(PVDC->createPVScalar<PVString>());
+
+    static_pointer_cast<PVString>(destUnion->get())->put(&m_attrString[0]);
+}
+
+void NTNDArrayConverter::fromUndefinedAttribute (PVStructurePtr dest)
+{
+    dest->getSubField<PVUnion>("value")->get().reset();
+}
+
+void NTNDArrayConverter::fromAttributeValue (PVStructurePtr dest, NDAttribute *src)
+{
+    switch(src->getDataType())
+    {
+    case NDAttrInt8:      fromAttribute <PVByte,   int8_t>  (dest, src); break;
+    case NDAttrUInt8:     fromAttribute <PVUByte,  uint8_t> (dest, src); break;
+    case NDAttrInt16:     fromAttribute <PVShort,  int16_t> (dest, src); break;
+    case NDAttrUInt16:    fromAttribute <PVUShort, uint16_t>(dest, src); break;
+    case NDAttrInt32:     fromAttribute <PVInt,    int32_t> (dest, src); break;
+    case NDAttrUInt32:    fromAttribute <PVUInt,   uint32_t>(dest, src); break;
+    case NDAttrFloat32:   fromAttribute <PVFloat,  float>   (dest, src); break;
+    case NDAttrFloat64:   fromAttribute <PVDouble, double>  (dest, src); break;
+    case NDAttrString:    fromStringAttribute(dest, src); break;
+    case NDAttrUndefined: fromUndefinedAttribute(dest); break;
+    default:              throw std::runtime_error("invalid attribute data type");
+    }
+}
+
+/*
+ * A set of attribute structures can be updated in place when nothing but
+ * m_attrSets refers to it, i.e. it is neither the published attribute field
+ * nor held by a monitor that has yet to send it.
+ */
+static bool attributeSetFree (const PVStructureArray::const_svector & set)
+{
+    if(!set.unique())
+        return false;
+
+    for(PVStructureArray::const_svector::const_iterator it(set.begin());
+            it != set.end(); ++it)
+    {
+        if(!it->unique())
+            return false;
+    }
+
+    return true;
+}
+
+void NTNDArrayConverter::fromAttributes (NDArray *src)
+{
+    PVStructureArrayPtr dest(m_array->getAttribute());
+    NDAttributeList *srcList = src->pAttributeList;
+    NDAttribute *attr = NULL;
+    size_t i = 0;
+
+    // The layout is the names and data types of the attributes, in order
+    bool sameLayout = (size_t) srcList->count() == m_attrNames.size();
+    while(sameLayout && (attr = srcList->next(attr)))
+    {
+        sameLayout = attr->getDataType() == m_attrTypes[i] && m_attrNames[i] == attr->getName();
+        ++i;
+    }
+
+    if(!sameLayout)
+    {
+        m_attrSets.clear();
+        m_attrNames.clear();
+        m_attrTypes.clear();
+        attr = NULL;
+        while((attr = srcList->next(attr)))
+        {
+            m_attrNames.push_back(attr->getName());
+            m_attrTypes.push_back(attr->getDataType());
+        }
+    }
+
+    // Only the values of a free set are updated; its names, descriptors and sources are those of the layout
+    for(vector<PVStructureArray::const_svector>::iterator it(m_attrSets.begin());
+            it != m_attrSets.end(); ++it)
+    {
+        if(attributeSetFree(*it))
+        {
+            i = 0;
+            attr = NULL;
+            while((attr = srcList->next(attr)))
+                fromAttributeValue((*it)[i++], attr);
+
+            dest->replace(*it);
+            return;
+        }
+    }
+
+    // Every set is still in use, so a new one is built
+    StructureConstPtr structure(dest->getStructureArray()->getStructure());
+    PVStructureArray::svector destVec(srcList->count());
+
+    i = 0;
+    attr = NULL;
+    while((attr = srcList->next(attr)))
+    {
+        PVStructurePtr pvAttr(PVDC->createPVStructure(structure));
+
+        pvAttr->getSubField<PVString>("name")->put(attr->getName());
+        pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
+        pvAttr->getSubField<PVString>("source")->put(attr->getSource());
+
+        NDAttrSource_t sourceType;
+        attr->getSourceInfo(&sourceType);
+        pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+
+        fromAttributeValue(pvAttr, attr);
+        destVec[i++] = pvAttr;
+    }
+
+    PVStructureArray::const_svector set(freeze(destVec));
+    if(m_attrSets.size() < maxAttributeSets)
+        m_attrSets.push_back(set);
+
+    dest->replace(set);
+}
+
+void NTNDArrayConverter::fromDataTimeStamp (NDArray *src)
+{
+    PVStructurePtr dest(m_array->getDataTimeStamp());
+
+    double seconds = floor(src->timeStamp);
+    double nanoseconds = (src->timeStamp - seconds)*1e9;
+
+    PVTimeStamp pvDest;
+    pvDest.attach(dest);
+
+    TimeStamp ts((int64_t)seconds, (int32_t)nanoseconds);
+    pvDest.set(ts);
+}
+
+void NTNDArrayConverter::fromTimeStamp (NDArray *src)
+{
+    PVStructurePtr dest(m_array->getTimeStamp());
+
+    PVTimeStamp pvDest;
+    pvDest.attach(dest);
+
+    TimeStamp ts(src->epicsTS.secPastEpoch, src->epicsTS.nsec);
+    pvDest.set(ts);
+}
+
+template <typename pvAttrType, typename valueType>
+void NTNDArrayConverter::fromAttribute (PVStructurePtr dest, NDAttribute *src)
+{
+    valueType value;
+    src->getValue(src->getDataType(), (void*)&value);
+
+    PVUnionPtr destUnion(dest->getSubField<PVUnion>("value"));
+
+    if(!destUnion->get())
+        destUnion->set(PVDC->createPVScalar<pvAttrType>());
+
+    static_pointer_cast<pvAttrType>(destUnion->get())->put(value);
+}
+
 void NTNDArrayConverter::fromStringAttribute (PVStructurePtr dest, NDAttribute *src)
 {
     NDAttrDataType_t attrDataType;
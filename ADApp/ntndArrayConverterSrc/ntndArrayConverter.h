@@ -24,18 +24,32 @@ public:
 
     NTNDArrayInfo_t getInfo (void);
     void toArray (NDArray *dest);
+    NDArray *importArray (NDArrayPool *pPool);
     void fromArray (NDArray *src);
 
 private:
+    /* The most sets of attribute structures kept for reuse, enough for the monitors of a few clients */
+    static const size_t maxAttributeSets = 4;
+
     epics::nt::NTNDArrayPtr m_array;
 
+    /* The names and data types of the attributes of the last array, and sets of attribute structures
+     * for them that are updated in place rather than built again for each array */
+    std::vector<std::string> m_attrNames;
+    std::vector<NDAttrDataType_t> m_attrTypes;
+    std::vector<epics::pvData::PVStructureArray::const_svector> m_attrSets;
+    std::vector<char> m_attrString;
+
     epics::pvData::ScalarType getValueType (void);
+    epics::pvData::ScalarType getDataType (void);
     NDColorMode_t getColorMode (void);
 
     template <typename arrayType>
     void toValue (NDArray *dest);
     void toValue (NDArray *dest);
+    void toCompressedValue (NDArray *dest);
 
+    void toMetaData (NDArray *dest);
     void toDimensions (NDArray *dest);
     void toTimeStamp (NDArray *dest);
     void toDataTimeStamp (NDArray *dest);
@@ -49,6 +63,8 @@ private:
     template <typename arrayType, typename srcDataType>
     void fromValue (NDArray *src);
     void fromValue (NDArray *src);
+    void fromFloat16Value (NDArray *src);
+    void fromCodec (NDArray *src);
 
     void fromDimensions (NDArray *src);
     void fromTimeStamp (NDArray *src);
@@ -58,6 +74,7 @@ private:
     void fromAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
     void fromStringAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
     void fromUndefinedAttribute (epics::pvData::PVStructurePtr dest);
+    void fromAttributeValue (epics::pvData::PVStructurePtr dest, NDAttribute *src);
     void fromAttributes (NDArray *src);
 };
 
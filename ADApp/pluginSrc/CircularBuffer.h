@@ -44,6 +44,15 @@ public:
         return buffer_[(cpos_ + i) % size_];
     }
 
+    /** Copies the last n elements, the oldest first, and returns how many were copied */
+    size_t copy_last_to_array(T * const buffer, size_t n) const {
+        n = std::min(n, size_);
+        for (size_t i = 0; i < n; ++i) {
+            buffer[i] = (*this)[size_ - n + i];
+        }
+        return n;
+    }
+
     void clear() {
         cpos_ = 0;
         size_ = 0;
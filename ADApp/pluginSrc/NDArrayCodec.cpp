@@ -0,0 +1,264 @@
+/** NDArrayCodec.cpp
+ *
+ * Compresses NDArrays with a codec and decompresses them, for NDPluginCodec and NDPluginPva.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <epicsTypes.h>
+
+#ifdef ND_WITH_BLOSC
+  #include <blosc.h>
+#endif
+
+#include "NDCompressKernels.h"
+#ifdef ND_WITH_JPEG
+  #include "NDJPEGEncoder.h"
+  #include "NDJPEGDecoder.h"
+#endif
+#include "NDArrayCodec.h"
+
+NDArrayCodec::NDArrayCodec()
+{
+}
+
+NDArrayCodec::~NDArrayCodec()
+{
+#ifdef ND_WITH_JPEG
+    size_t i;
+
+    for (i=0; i<jpegEncoders_.size(); i++) delete jpegEncoders_[i];
+    for (i=0; i<jpegDecoders_.size(); i++) delete jpegDecoders_[i];
+#endif
+}
+
+/** Returns true if ADCore was built with the compressor.
+  * \param[in] compressor The NDCodecCompressor_t. */
+bool NDArrayCodec::compressorSupported(int compressor)
+{
+    switch (compressor) {
+        case NDCodecNone:
+        case NDCodecLZ4:
+        case NDCodecBSLZ4:
+            return true;
+#ifdef ND_WITH_JPEG
+        case NDCodecJPEG:
+            return true;
+#endif
+#ifdef ND_WITH_BLOSC
+        case NDCodecBlosc:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+/** Returns the NDCodecCompressor_t of the name of a codec, or -1 if it is not one of NDCodecName.
+  * \param[in] name The NDCodec_t::name. */
+int NDArrayCodec::compressorOf(const std::string &name)
+{
+    int i;
+
+    for (i=NDCodecNone; i<=NDCodecBSLZ4; i++) {
+        if (name == NDCodecName[i]) return i;
+    }
+    return -1;
+}
+
+/** Allocates an output array for an input array, with its dims, dataType, time stamps, stack frames and attributes.
+  * \param[in] pArray The input array.
+  * \param[in] dataSize The bytes the output needs, at least the uncompressed size.
+  * \param[in] pPool The pool of the output. */
+NDArray* NDArrayCodec::allocOutput(NDArray *pArray, size_t dataSize, NDArrayPool *pPool)
+{
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pArrayOut;
+    int i;
+
+    for (i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+    pArrayOut = pPool->alloc(pArray->ndims, dims, pArray->dataType, dataSize, NULL);
+    if (!pArrayOut) return NULL;
+    memcpy(pArrayOut->dims, pArray->dims, sizeof(pArray->dims));
+    pArrayOut->uniqueId = pArray->uniqueId;
+    pArrayOut->timeStamp = pArray->timeStamp;
+    pArrayOut->epicsTS = pArray->epicsTS;
+    pArrayOut->stackFrames = pArray->stackFrames;
+    pArray->pAttributeList->copy(pArrayOut->pAttributeList);
+    return pArrayOut;
+}
+
+/** Compresses an array.
+  * \param[in] pArray The uncompressed array.
+  * \param[in] codec The codec of the output.
+  * \param[in] bloscThreads The threads blosc uses.
+  * \param[in] pPool The pool of the output.
+  * \param[out] pError Why the array could not be compressed.
+  * \return The compressed array, or NULL. */
+NDArray* NDArrayCodec::compress(NDArray *pArray, const NDCodec_t &codec, int bloscThreads, NDArrayPool *pPool,
+                                const char **pError)
+{
+    NDArrayInfo_t arrayInfo;
+    NDArray *pArrayOut = NULL;
+    size_t compressedSize = 0;
+    int status = ND_ERROR;
+
+    pArray->getInfo(&arrayInfo);
+    if (codec.name == NDCodecName[NDCodecJPEG]) {
+#ifdef ND_WITH_JPEG
+        NDJPEGEncoder *pEncoder = NULL;
+        std::vector<unsigned char> jpeg;
+        if (((pArray->dataType != NDInt8) && (pArray->dataType != NDUInt8)) ||
+            ((pArray->ndims != 2) && ((pArray->ndims != 3) || (pArray->dims[0].size != 3)))) {
+            *pError = "jpeg needs 8-bit Mono or RGB1 arrays";
+            return NULL;
+        }
+        mutex_.lock();
+        if (!jpegEncoders_.empty()) {
+            pEncoder = jpegEncoders_.back();
+            jpegEncoders_.pop_back();
+        }
+        mutex_.unlock();
+        if (!pEncoder) pEncoder = new NDJPEGEncoder;
+        status = pEncoder->encode(pArray, codec.level, jpeg);
+        mutex_.lock();
+        jpegEncoders_.push_back(pEncoder);
+        mutex_.unlock();
+        if (status != ND_SUCCESS) {
+            *pError = "jpeg compression failed";
+            return NULL;
+        }
+        pArrayOut = allocOutput(pArray, (jpeg.size() > arrayInfo.totalBytes) ? jpeg.size() : arrayInfo.totalBytes,
+                                pPool);
+        if (!pArrayOut) {
+            *pError = "cannot allocate output array";
+            return NULL;
+        }
+        memcpy(pArrayOut->pData, &jpeg[0], jpeg.size());
+        compressedSize = jpeg.size();
+#endif
+    } else if (codec.name == NDCodecName[NDCodecBlosc]) {
+#ifdef ND_WITH_BLOSC
+        const char *compname = NULL;
+        size_t bound = arrayInfo.totalBytes + BLOSC_MAX_OVERHEAD;
+        int typesize = arrayInfo.bytesPerElement;
+        int nBytes;
+        if (typesize > BLOSC_MAX_TYPESIZE) typesize = 1;
+        if ((arrayInfo.totalBytes > (size_t)(INT_MAX - BLOSC_MAX_OVERHEAD)) ||
+            (blosc_compcode_to_compname(codec.compressor, &compname) < 0)) {
+            *pError = "blosc cannot compress this array";
+            return NULL;
+        }
+        pArrayOut = allocOutput(pArray, bound, pPool);
+        if (!pArrayOut) {
+            *pError = "cannot allocate output array";
+            return NULL;
+        }
+        nBytes = blosc_compress_ctx(codec.level, codec.shuffle, typesize, arrayInfo.totalBytes, pArray->pData,
+                                    pArrayOut->pData, bound, compname, 0, bloscThreads);
+        if (nBytes > 0) {
+            compressedSize = nBytes;
+            status = ND_SUCCESS;
+        }
+#endif
+    } else if (codec.name == NDCodecName[NDCodecLZ4]) {
+        pArrayOut = allocOutput(pArray, NDLZ4Bound(arrayInfo.totalBytes), pPool);
+        if (!pArrayOut) {
+            *pError = "cannot allocate output array";
+            return NULL;
+        }
+        status = NDLZ4Compress(pArray->pData, arrayInfo.totalBytes, pArrayOut->pData, pArrayOut->dataSize,
+                               &compressedSize);
+    } else if (codec.name == NDCodecName[NDCodecBSLZ4]) {
+        std::vector<char> scratch(NDBitshuffleBlockSize(arrayInfo.bytesPerElement, 0) * arrayInfo.bytesPerElement);
+        pArrayOut = allocOutput(pArray, NDBitshuffleLZ4Bound(arrayInfo.bytesPerElement, 0, arrayInfo.totalBytes),
+                                pPool);
+        if (!pArrayOut) {
+            *pError = "cannot allocate output array";
+            return NULL;
+        }
+        status = NDBitshuffleLZ4Compress(arrayInfo.bytesPerElement, 0, pArray->pData, arrayInfo.totalBytes,
+                                         &scratch[0], pArrayOut->pData, pArrayOut->dataSize, &compressedSize);
+    }
+    if (!pArrayOut) {
+        *pError = "the compressor is not supported";
+        return NULL;
+    }
+    if (status != ND_SUCCESS) {
+        pArrayOut->release();
+        *pError = "compression failed";
+        return NULL;
+    }
+    pArrayOut->codec = codec;
+    pArrayOut->compressedSize = compressedSize;
+    return pArrayOut;
+}
+
+/** Decompresses an array.
+  * \param[in] pArray The compressed array.
+  * \param[in] bloscThreads The threads blosc uses.
+  * \param[in] pPool The pool of the output.
+  * \param[out] pError Why the array could not be decompressed.
+  * \return The uncompressed array, or NULL. */
+NDArray* NDArrayCodec::decompress(NDArray *pArray, int bloscThreads, NDArrayPool *pPool, const char **pError)
+{
+    NDArrayInfo_t arrayInfo;
+    NDArray *pArrayOut;
+    const std::string &name = pArray->codec.name;
+    int compressor = compressorOf(name);
+    int status = ND_ERROR;
+
+    pArray->getInfo(&arrayInfo);
+    if ((compressor <= NDCodecNone) || !compressorSupported(compressor)) {
+        *pError = "the codec of the array is not supported";
+        return NULL;
+    }
+    pArrayOut = allocOutput(pArray, arrayInfo.totalBytes, pPool);
+    if (!pArrayOut) {
+        *pError = "cannot allocate output array";
+        return NULL;
+    }
+    if (compressor == NDCodecJPEG) {
+#ifdef ND_WITH_JPEG
+        NDJPEGDecoder *pDecoder = NULL;
+        mutex_.lock();
+        if (!jpegDecoders_.empty()) {
+            pDecoder = jpegDecoders_.back();
+            jpegDecoders_.pop_back();
+        }
+        mutex_.unlock();
+        if (!pDecoder) pDecoder = new NDJPEGDecoder;
+        status = pDecoder->decode((const unsigned char *)pArray->pData, pArray->compressedSize, pArrayOut);
+        mutex_.lock();
+        jpegDecoders_.push_back(pDecoder);
+        mutex_.unlock();
+#endif
+    } else if (compressor == NDCodecBlosc) {
+#ifdef ND_WITH_BLOSC
+        if ((arrayInfo.totalBytes <= INT_MAX) &&
+            (blosc_decompress_ctx(pArray->pData, pArrayOut->pData, arrayInfo.totalBytes, bloscThreads) ==
+             (int)arrayInfo.totalBytes)) {
+            status = ND_SUCCESS;
+        }
+#endif
+    } else if (compressor == NDCodecLZ4) {
+        status = NDLZ4Decompress(pArray->pData, pArray->compressedSize, pArrayOut->pData, arrayInfo.totalBytes);
+    } else {
+        size_t scratchSize = NDBitshuffleLZ4ScratchSize(pArray->pData, pArray->compressedSize,
+                                                        arrayInfo.totalBytes);
+        if (scratchSize > 0) {
+            std::vector<char> scratch(scratchSize);
+            status = NDBitshuffleLZ4Decompress(arrayInfo.bytesPerElement, pArray->pData, pArray->compressedSize,
+                                               &scratch[0], pArrayOut->pData, arrayInfo.totalBytes);
+        }
+    }
+    if (status != ND_SUCCESS) {
+        pArrayOut->release();
+        *pError = "decompression failed";
+        return NULL;
+    }
+    return pArrayOut;
+}
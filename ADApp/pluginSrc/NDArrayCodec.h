@@ -0,0 +1,45 @@
+/** NDArrayCodec.h
+ *
+ * Compresses NDArrays with a codec and decompresses them, for NDPluginCodec and NDPluginPva.
+ *
+ */
+
+#ifndef NDArrayCodec_H
+#define NDArrayCodec_H
+
+#include <vector>
+
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+class NDJPEGEncoder;
+class NDJPEGDecoder;
+
+/** Compresses NDArrays into new arrays of a pool, which keep the dims and dataType of the input and hold
+  * NDArray::compressedSize bytes of compressed data along with their NDArray::codec, and decompresses them again.
+  * The codecs are jpeg (lossy, 8-bit Mono and RGB1 arrays) with WITH_JPEG, blosc with WITH_BLOSC, lz4, and bslz4.
+  * Any number of threads can compress and decompress at once; each takes a JPEG coder from a list that the
+  * mutex protects, so the coders are only created once.
+  */
+class epicsShareClass NDArrayCodec {
+public:
+    NDArrayCodec();
+    ~NDArrayCodec();
+    NDArray* compress(NDArray *pArray, const NDCodec_t &codec, int bloscThreads, NDArrayPool *pPool,
+                      const char **pError);
+    NDArray* decompress(NDArray *pArray, int bloscThreads, NDArrayPool *pPool, const char **pError);
+
+    static bool compressorSupported(int compressor);
+    static int compressorOf(const std::string &name);
+
+private:
+    NDArray* allocOutput(NDArray *pArray, size_t dataSize, NDArrayPool *pPool);
+
+    epicsMutex mutex_;
+    std::vector<NDJPEGEncoder*> jpegEncoders_;  /**< Encoders that no thread is using */
+    std::vector<NDJPEGDecoder*> jpegDecoders_;  /**< Decoders that no thread is using */
+};
+
+#endif
@@ -0,0 +1,327 @@
+/** NDBayerKernels.cpp
+ *
+ * Bayer demosaicing for NDPluginColorConvert.
+ * Each output pixel takes its own color from the input pixel and the other two colors from 5 candidates, computed
+ * from the pixel and its 8 neighbours: the pixel itself, the average of its left and right neighbours, the average
+ * of the pixels above and below, the average of those two, and the average of the 4 diagonal neighbours.  Which
+ * candidate gives which color depends only on the Bayer pattern and on the parity of the row and of the column, so
+ * a vector kernel computes all 5 candidates for a vector of pixels and selects the even and odd lanes of each color
+ * with a constant mask.  The edge-aware interpolation uses the left and right average instead of the average of
+ * 4 for green when the horizontal gradient is smaller than the vertical one, and the opposite when it is larger.
+ *
+ * The averages are rounded up, as the vector average instructions of SSE2, AVX2 and NEON do, and the averages of
+ * 4 pixels are averages of averages of 2, so they can be 1 above the rounded exact average.  The scalar kernels
+ * round the same way, so the results do not depend on the instruction set.  The pixels outside the array are
+ * mirrored about the first and last rows and columns, which keeps their colors.
+ *
+ */
+
+#include <stdlib.h>
+
+#include <epicsTypes.h>
+
+#include <NDArray.h>
+#include <NDConvertKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDBayerKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+#define BAYER_RED   0
+#define BAYER_GREEN 1
+#define BAYER_BLUE  2
+
+/* The colors of the even and odd pixels of the even and odd rows of each NDBayerPattern_t */
+static const int bayerColors[4][2][2] = {
+  {{BAYER_RED,   BAYER_GREEN}, {BAYER_GREEN, BAYER_BLUE}},    /* NDBayerRGGB */
+  {{BAYER_GREEN, BAYER_BLUE},  {BAYER_RED,   BAYER_GREEN}},   /* NDBayerGBRG */
+  {{BAYER_GREEN, BAYER_RED},   {BAYER_BLUE,  BAYER_GREEN}},   /* NDBayerGRBG */
+  {{BAYER_BLUE,  BAYER_GREEN}, {BAYER_GREEN, BAYER_RED}}      /* NDBayerBGGR */
+};
+
+/* The candidates for the colors of a pixel */
+#define CANDIDATE_CENTER     0
+#define CANDIDATE_HORIZONTAL 1
+#define CANDIDATE_VERTICAL   2
+#define CANDIDATE_CROSS      3
+#define CANDIDATE_DIAGONAL   4
+#define CANDIDATES           5
+
+/* One output row */
+typedef struct {
+  const void *pAbove;       /* The input row above, mirrored on the first row */
+  const void *pRow;         /* The input row */
+  const void *pBelow;       /* The input row below, mirrored on the last row */
+  void *pOut[3];            /* The red, green and blue output rows, contiguous */
+  int sources[3][2];        /* The candidate of each color for the even and odd pixels */
+  int edgeAware;
+} bayerRow_t;
+
+/* The candidate of each color for the pixels of one input row */
+static void rowSources(int bayerPattern, size_t y, int sources[3][2])
+{
+  const int *colors = bayerColors[bayerPattern][y & 1];
+  int parity;
+
+  for (parity=0; parity<2; parity++) {
+    int color = colors[parity], other = colors[1 - parity];
+    if (color == BAYER_GREEN) {
+      /* The neighbours to the left and right have the other color of the row, those above and below the third */
+      sources[BAYER_GREEN][parity] = CANDIDATE_CENTER;
+      sources[other][parity] = CANDIDATE_HORIZONTAL;
+      sources[2 - other][parity] = CANDIDATE_VERTICAL;
+    } else {
+      sources[color][parity] = CANDIDATE_CENTER;
+      sources[BAYER_GREEN][parity] = CANDIDATE_CROSS;
+      sources[2 - color][parity] = CANDIDATE_DIAGONAL;
+    }
+  }
+}
+
+template <typename epicsType>
+static inline epicsType bayerAverage(epicsType a, epicsType b)
+{
+  return (epicsType)(((int)a + (int)b + 1) >> 1);
+}
+
+template <typename epicsType>
+static inline int bayerDifference(epicsType a, epicsType b)
+{
+  return (a > b) ? (int)a - (int)b : (int)b - (int)a;
+}
+
+/* Computes the output pixels start to end-1 of a row, with the neighbours mirrored at the first and last column */
+template <typename epicsType>
+static void demosaicScalarT(const bayerRow_t *pR, size_t sizeX, size_t start, size_t end)
+{
+  const epicsType *pA = (const epicsType *)pR->pAbove;
+  const epicsType *pC = (const epicsType *)pR->pRow;
+  const epicsType *pB = (const epicsType *)pR->pBelow;
+  epicsType candidates[CANDIDATES];
+  size_t x;
+  int color;
+
+  for (x=start; x<end; x++) {
+    size_t left = (x == 0) ? 1 : x - 1, right = (x == sizeX - 1) ? sizeX - 2 : x + 1;
+    candidates[CANDIDATE_CENTER] = pC[x];
+    candidates[CANDIDATE_HORIZONTAL] = bayerAverage(pC[left], pC[right]);
+    candidates[CANDIDATE_VERTICAL] = bayerAverage(pA[x], pB[x]);
+    candidates[CANDIDATE_CROSS] = bayerAverage(candidates[CANDIDATE_HORIZONTAL], candidates[CANDIDATE_VERTICAL]);
+    if (pR->edgeAware) {
+      int gh = bayerDifference(pC[left], pC[right]), gv = bayerDifference(pA[x], pB[x]);
+      if (gh < gv)      candidates[CANDIDATE_CROSS] = candidates[CANDIDATE_HORIZONTAL];
+      else if (gv < gh) candidates[CANDIDATE_CROSS] = candidates[CANDIDATE_VERTICAL];
+    }
+    candidates[CANDIDATE_DIAGONAL] = bayerAverage(bayerAverage(pA[left], pA[right]),
+                                                  bayerAverage(pB[left], pB[right]));
+    for (color=0; color<3; color++)
+      ((epicsType *)pR->pOut[color])[x] = candidates[pR->sources[color][x & 1]];
+  }
+}
+
+/* Vector kernels.  They process whole vectors from start, which is even, while the pixels to the right of the
+ * vector are in the row, and return the index of the first pixel they did not process.
+ * less(a, b) and select(mask, a, b) are the unsigned a < b and mask ? a : b of each lane. */
+#define DEMOSAIC_KERNEL(name, epicsType, vector_t, width, load, store, average, difference, less, select, oddMask) \
+static size_t name(const bayerRow_t *pR, size_t sizeX, size_t start)                                           \
+{                                                                                                              \
+  const epicsType *pA = (const epicsType *)pR->pAbove;                                                         \
+  const epicsType *pC = (const epicsType *)pR->pRow;                                                           \
+  const epicsType *pB = (const epicsType *)pR->pBelow;                                                         \
+  vector_t candidates[CANDIDATES], odd = (oddMask);                                                            \
+  size_t x;                                                                                                    \
+  int color;                                                                                                   \
+                                                                                                               \
+  for (x=start; x+(width)<sizeX; x+=(width)) {                                                                 \
+    vector_t left = load(pC + x - 1), right = load(pC + x + 1);                                                \
+    vector_t above = load(pA + x), below = load(pB + x);                                                       \
+    candidates[CANDIDATE_CENTER] = load(pC + x);                                                               \
+    candidates[CANDIDATE_HORIZONTAL] = average(left, right);                                                   \
+    candidates[CANDIDATE_VERTICAL] = average(above, below);                                                    \
+    candidates[CANDIDATE_CROSS] = average(candidates[CANDIDATE_HORIZONTAL], candidates[CANDIDATE_VERTICAL]);   \
+    if (pR->edgeAware) {                                                                                       \
+      vector_t gh = difference(left, right), gv = difference(above, below);                                    \
+      candidates[CANDIDATE_CROSS] = select(less(gh, gv), candidates[CANDIDATE_HORIZONTAL],                     \
+                                           select(less(gv, gh), candidates[CANDIDATE_VERTICAL],                \
+                                                  candidates[CANDIDATE_CROSS]));                               \
+    }                                                                                                          \
+    candidates[CANDIDATE_DIAGONAL] = average(average(load(pA + x - 1), load(pA + x + 1)),                      \
+                                             average(load(pB + x - 1), load(pB + x + 1)));                     \
+    for (color=0; color<3; color++)                                                                            \
+      store((epicsType *)pR->pOut[color] + x, select(odd, candidates[pR->sources[color][1]],                   \
+                                                          candidates[pR->sources[color][0]]));                 \
+  }                                                                                                            \
+  return x;                                                                                                    \
+}
+
+typedef size_t (*demosaicKernel)(const bayerRow_t *pR, size_t sizeX, size_t start);
+
+#if defined(ND_SIMD_X86)
+
+#define SSE2_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define SSE2_STORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define SSE2_SELECT(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+/* SSE2 has no unsigned compares, so the values are offset by half their range and compared as signed */
+#define SSE2_LESS_U8(a, b)  _mm_cmpgt_epi8(_mm_xor_si128(b, _mm_set1_epi8((char)0x80)), \
+                                           _mm_xor_si128(a, _mm_set1_epi8((char)0x80)))
+#define SSE2_LESS_U16(a, b) _mm_cmpgt_epi16(_mm_xor_si128(b, _mm_set1_epi16((short)0x8000)), \
+                                            _mm_xor_si128(a, _mm_set1_epi16((short)0x8000)))
+#define SSE2_DIFF_U8(a, b)  _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a))
+#define SSE2_DIFF_U16(a, b) _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a))
+
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define AVX2_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define AVX2_SELECT(m, a, b) _mm256_blendv_epi8(b, a, m)
+#define AVX2_LESS_U8(a, b)  _mm256_cmpgt_epi8(_mm256_xor_si256(b, _mm256_set1_epi8((char)0x80)), \
+                                              _mm256_xor_si256(a, _mm256_set1_epi8((char)0x80)))
+#define AVX2_LESS_U16(a, b) _mm256_cmpgt_epi16(_mm256_xor_si256(b, _mm256_set1_epi16((short)0x8000)), \
+                                               _mm256_xor_si256(a, _mm256_set1_epi16((short)0x8000)))
+#define AVX2_DIFF_U8(a, b)  _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a))
+#define AVX2_DIFF_U16(a, b) _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a))
+
+ND_TARGET("sse2") DEMOSAIC_KERNEL(demosaicUInt8SSE2, epicsUInt8, __m128i, 16, SSE2_LOAD, SSE2_STORE,
+                                  _mm_avg_epu8, SSE2_DIFF_U8, SSE2_LESS_U8, SSE2_SELECT,
+                                  _mm_set1_epi16((short)0xff00))
+ND_TARGET("sse2") DEMOSAIC_KERNEL(demosaicUInt16SSE2, epicsUInt16, __m128i, 8, SSE2_LOAD, SSE2_STORE,
+                                  _mm_avg_epu16, SSE2_DIFF_U16, SSE2_LESS_U16, SSE2_SELECT,
+                                  _mm_set1_epi32((int)0xffff0000))
+ND_TARGET("avx2") DEMOSAIC_KERNEL(demosaicUInt8AVX2, epicsUInt8, __m256i, 32, AVX2_LOAD, AVX2_STORE,
+                                  _mm256_avg_epu8, AVX2_DIFF_U8, AVX2_LESS_U8, AVX2_SELECT,
+                                  _mm256_set1_epi16((short)0xff00))
+ND_TARGET("avx2") DEMOSAIC_KERNEL(demosaicUInt16AVX2, epicsUInt16, __m256i, 16, AVX2_LOAD, AVX2_STORE,
+                                  _mm256_avg_epu16, AVX2_DIFF_U16, AVX2_LESS_U16, AVX2_SELECT,
+                                  _mm256_set1_epi32((int)0xffff0000))
+
+#elif defined(ND_SIMD_NEON)
+
+DEMOSAIC_KERNEL(demosaicUInt8NEON, epicsUInt8, uint8x16_t, 16, vld1q_u8, vst1q_u8,
+                vrhaddq_u8, vabdq_u8, vcltq_u8, vbslq_u8, vreinterpretq_u8_u16(vdupq_n_u16(0xff00)))
+DEMOSAIC_KERNEL(demosaicUInt16NEON, epicsUInt16, uint16x8_t, 8, vld1q_u16, vst1q_u16,
+                vrhaddq_u16, vabdq_u16, vcltq_u16, vbslq_u16, vreinterpretq_u16_u32(vdupq_n_u32(0xffff0000)))
+
+#endif
+
+template <typename epicsType>
+static void demosaicT(int bayerPattern, int edgeAware, demosaicKernel kernel, const void *pInVoid,
+                      size_t sizeX, size_t sizeY, void *pRed, void *pGreen, void *pBlue,
+                      size_t pixelStride, size_t rowStride, size_t firstRow, size_t numRows, epicsType *pBuffer)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  epicsType *pPlanes[3] = {(epicsType *)pRed, (epicsType *)pGreen, (epicsType *)pBlue};
+  bayerRow_t row;
+  size_t y, x, start;
+  int color;
+
+  row.edgeAware = edgeAware;
+  for (y=firstRow; y<firstRow+numRows; y++) {
+    row.pRow = pIn + y*sizeX;
+    row.pAbove = pIn + ((y == 0) ? 1 : y - 1)*sizeX;
+    row.pBelow = pIn + ((y == sizeY - 1) ? sizeY - 2 : y + 1)*sizeX;
+    rowSources(bayerPattern, y, row.sources);
+    /* Interleaved outputs are computed into the buffer and copied */
+    for (color=0; color<3; color++)
+      row.pOut[color] = pBuffer ? pBuffer + color*sizeX : pPlanes[color] + y*rowStride;
+    demosaicScalarT<epicsType>(&row, sizeX, 0, 2);
+    start = kernel ? kernel(&row, sizeX, 2) : 2;
+    demosaicScalarT<epicsType>(&row, sizeX, start, sizeX);
+    if (pBuffer) {
+      for (color=0; color<3; color++) {
+        epicsType *pOut = pPlanes[color] + y*rowStride;
+        for (x=0; x<sizeX; x++) pOut[x*pixelStride] = pBuffer[color*sizeX + x];
+      }
+    }
+  }
+}
+
+/** Computes rows of the red, green and blue planes of a Bayer array.
+  * \param[in] dataType The data type of the input and the output, NDInt8, NDUInt8, NDInt16 or NDUInt16.
+  * \param[in] bayerPattern The NDBayerPattern_t of the first pixel of the array.
+  * \param[in] method The interpolation.
+  * \param[in] pIn The Bayer array, sizeX by sizeY, contiguous.
+  * \param[in] sizeX The number of pixels in a row, at least 2.
+  * \param[in] sizeY The number of rows, at least 2.
+  * \param[out] pRed The first red output pixel.
+  * \param[out] pGreen The first green output pixel.
+  * \param[out] pBlue The first blue output pixel.
+  * \param[in] pixelStride The number of elements between output pixels in a row: 3 for RGB1, 1 for RGB2 and RGB3.
+  * \param[in] rowStride The number of elements between output rows.
+  * \param[in] firstRow The first output row to compute.
+  * \param[in] numRows The number of output rows to compute.
+  * \return ND_SUCCESS, or ND_ERROR if the data type, the pattern or the size is not valid or there is no memory.
+  */
+int NDBayerDemosaic(NDDataType_t dataType, int bayerPattern, NDBayerMethod_t method,
+                    const void *pIn, size_t sizeX, size_t sizeY,
+                    void *pRed, void *pGreen, void *pBlue, size_t pixelStride, size_t rowStride,
+                    size_t firstRow, size_t numRows)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  demosaicKernel kernel = 0;
+  int edgeAware = (method == NDBayerEdgeAware);
+  size_t elementSize;
+  void *pBuffer = 0;
+
+  if ((bayerPattern < NDBayerRGGB) || (bayerPattern > NDBayerBGGR) || (sizeX < 2) || (sizeY < 2)) return ND_ERROR;
+  switch (dataType) {
+    case NDInt8:
+    case NDUInt8:
+      elementSize = 1;
+      break;
+    case NDInt16:
+    case NDUInt16:
+      elementSize = 2;
+      break;
+    default:
+      return ND_ERROR;
+  }
+  if (pixelStride != 1) {
+    pBuffer = malloc(3 * sizeX * elementSize);
+    if (!pBuffer) return ND_ERROR;
+  }
+
+#if defined(ND_SIMD_X86)
+  if (dataType == NDUInt8) {
+    if (level >= NDSimdAVX2)      kernel = demosaicUInt8AVX2;
+    else if (level >= NDSimdSSE2) kernel = demosaicUInt8SSE2;
+  } else if (dataType == NDUInt16) {
+    if (level >= NDSimdAVX2)      kernel = demosaicUInt16AVX2;
+    else if (level >= NDSimdSSE2) kernel = demosaicUInt16SSE2;
+  }
+#elif defined(ND_SIMD_NEON)
+  if (level == NDSimdNEON) {
+    if (dataType == NDUInt8)       kernel = demosaicUInt8NEON;
+    else if (dataType == NDUInt16) kernel = demosaicUInt16NEON;
+  }
+#endif
+  (void)level;
+
+  switch (dataType) {
+    case NDInt8:
+      demosaicT<epicsInt8>(bayerPattern, edgeAware, 0, pIn, sizeX, sizeY, pRed, pGreen, pBlue,
+                           pixelStride, rowStride, firstRow, numRows, (epicsInt8 *)pBuffer);
+      break;
+    case NDUInt8:
+      demosaicT<epicsUInt8>(bayerPattern, edgeAware, kernel, pIn, sizeX, sizeY, pRed, pGreen, pBlue,
+                            pixelStride, rowStride, firstRow, numRows, (epicsUInt8 *)pBuffer);
+      break;
+    case NDInt16:
+      demosaicT<epicsInt16>(bayerPattern, edgeAware, 0, pIn, sizeX, sizeY, pRed, pGreen, pBlue,
+                            pixelStride, rowStride, firstRow, numRows, (epicsInt16 *)pBuffer);
+      break;
+    default:
+      demosaicT<epicsUInt16>(bayerPattern, edgeAware, kernel, pIn, sizeX, sizeY, pRed, pGreen, pBlue,
+                             pixelStride, rowStride, firstRow, numRows, (epicsUInt16 *)pBuffer);
+      break;
+  }
+  free(pBuffer);
+  return ND_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/** NDBayerKernels.h
+ *
+ * Demosaicing of Bayer arrays for NDPluginColorConvert, with bilinear interpolation or with an edge-aware
+ * interpolation of green.  Each output row needs only the input rows above and below it, so rows can be
+ * computed in independent stripes.  The UInt8 and UInt16 kernels are vectorized with the instruction set
+ * NDSimdLevel() returns.
+ *
+ */
+
+#ifndef NDBayerKernels_H
+#define NDBayerKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The interpolations of NDBayerDemosaic() */
+typedef enum {
+    NDBayerBilinear,    /**< Each missing color is the average of the nearest pixels of that color */
+    NDBayerEdgeAware    /**< As bilinear, but green at red and blue pixels is averaged along the direction
+                          *  with the smaller gradient */
+} NDBayerMethod_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDBayerDemosaic(NDDataType_t dataType, int bayerPattern, NDBayerMethod_t method,
+                                   const void *pIn, size_t sizeX, size_t sizeY,
+                                   void *pRed, void *pGreen, void *pBlue, size_t pixelStride, size_t rowStride,
+                                   size_t firstRow, size_t numRows);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,664 @@
+/** NDColorKernels.cpp
+ *
+ * Color layout conversions for NDPluginColorConvert.
+ * The interleave, the deinterleave and the unpacking of YUV pixels all gather the bytes of 3 output vectors from
+ * a block of 48 input bytes, so the vector kernels share one primitive: a table gives the input byte of each
+ * output byte, and this is done with 9 byte shuffles (SSSE3) or 3 table lookups (NEON) for each 48 bytes, the
+ * technique of libyuv.  A block holds 16 RGB1 pixels of 8-bit elements, 8 of 16-bit, 4 of 32-bit and 2 of
+ * 64-bit, so one table per element size handles all the data types.
+ *
+ * YUV is converted to RGB with the full-range ITU-R BT.601 matrix of JFIF and of the IIDC cameras:
+ * R = Y + 1.402 V, G = Y - 0.344 U - 0.714 V and B = Y + 1.772 U, with U and V centered on 128.  Each product is
+ * done in fixed point with 9 fractional bits and rounded, in the scalar and in the vector kernels alike, so the
+ * results do not depend on the instruction set.
+ *
+ * The false color of 16-bit data maps each value through a table of 65536 entries that holds the RGB bytes of
+ * the color map for the display window, so the window and the color map cost nothing per pixel.  AVX2 gathers
+ * 8 entries at a time and packs them into 24 bytes of RGB1 pixels.
+ *
+ */
+
+#include <string.h>
+
+#include <epicsTypes.h>
+
+#include <NDArray.h>
+#include <NDConvertKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDColorKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+#define GATHER_NONE 0xff
+
+/* The coefficients of the YUV to RGB matrix, times 512 */
+#define YUV_RED_V    718
+#define YUV_GREEN_U  176
+#define YUV_GREEN_V  366
+#define YUV_BLUE_U   907
+
+/* The bytes of 3 output vectors gathered from a block of 48 input bytes */
+typedef struct {
+  unsigned char index[3][16];     /* The input byte of each byte of each output vector, GATHER_NONE for 0 */
+  unsigned char masks[3][3][16];  /* The same as byte shuffles of each of the 3 input vectors */
+} byteGather;
+
+static void gatherMasks(byteGather *pG)
+{
+  int v, k, j;
+
+  for (v=0; v<3; v++) {
+    for (k=0; k<3; k++) {
+      for (j=0; j<16; j++) {
+        int index = pG->index[v][j];
+        pG->masks[v][k][j] = ((index != GATHER_NONE) && (index/16 == k)) ? (unsigned char)(index%16) : 0x80;
+      }
+    }
+  }
+}
+
+/* Output vector p is plane p of the pixels of the input block */
+static void deinterleaveGather(size_t e, byteGather *pG)
+{
+  size_t p, j;
+
+  for (p=0; p<3; p++) {
+    for (j=0; j<16; j++) pG->index[p][j] = (unsigned char)((j/e)*3*e + p*e + j%e);
+  }
+  gatherMasks(pG);
+}
+
+/* The input block is the 3 planes, 16 bytes each, and the output vectors are the block of interleaved pixels */
+static void interleaveGather(size_t e, byteGather *pG)
+{
+  size_t v, k;
+
+  for (v=0; v<3; v++) {
+    for (k=0; k<16; k++) {
+      size_t s = 16*v + k;
+      size_t pixel = s/(3*e), plane = (s%(3*e))/e;
+      pG->index[v][k] = (unsigned char)(16*plane + pixel*e + s%e);
+    }
+  }
+  gatherMasks(pG);
+}
+
+/* The number of pixels and of bytes of a group of YUV pixels that share U and V */
+static void yuvGroup(NDColorMode_t mode, size_t *pPixels, size_t *pBytes)
+{
+  switch (mode) {
+    case NDColorModeYUV444: *pPixels = 1; *pBytes = 3; break;
+    case NDColorModeYUV422: *pPixels = 2; *pBytes = 4; break;
+    default:                *pPixels = 4; *pBytes = 6; break;
+  }
+}
+
+/* The bytes of Y, U and V of pixel x of a row: UYV, UYVY or UYYVYY */
+static void yuvOffsets(NDColorMode_t mode, size_t x, size_t *pY, size_t *pU, size_t *pV)
+{
+  static const size_t y411[4] = {1, 2, 4, 5};
+
+  switch (mode) {
+    case NDColorModeYUV444:
+      *pU = 3*x;
+      *pY = *pU + 1;
+      *pV = *pU + 2;
+      break;
+    case NDColorModeYUV422:
+      *pU = 4*(x/2);
+      *pY = *pU + 1 + 2*(x%2);
+      *pV = *pU + 2;
+      break;
+    default:
+      *pU = 6*(x/4);
+      *pY = *pU + y411[x%4];
+      *pV = *pU + 3;
+      break;
+  }
+}
+
+/* Output vectors 0, 1 and 2 are Y, U and V of 16 pixels */
+static void yuvGather(NDColorMode_t mode, byteGather *pG)
+{
+  size_t j, y, u, v;
+
+  for (j=0; j<16; j++) {
+    yuvOffsets(mode, j, &y, &u, &v);
+    pG->index[0][j] = (unsigned char)y;
+    pG->index[1][j] = (unsigned char)u;
+    pG->index[2][j] = (unsigned char)v;
+  }
+  gatherMasks(pG);
+}
+
+/* (d * c) / 512 rounded, with d * c >= -2^20; the offset keeps the shifted value positive */
+static inline int yuvTerm(int d, int c)
+{
+  return ((d*c + 256 + (1 << 20)) >> 9) - (1 << 11);
+}
+
+static inline epicsUInt8 clampUInt8(int value)
+{
+  return (epicsUInt8)((value < 0) ? 0 : (value > 255) ? 255 : value);
+}
+
+template <typename epicsType>
+static void deinterleaveScalarT(const void *pIn, void *pRed, void *pGreen, void *pBlue, size_t x0, size_t sizeX)
+{
+  const epicsType *pI = (const epicsType *)pIn;
+  epicsType *pR = (epicsType *)pRed, *pG = (epicsType *)pGreen, *pB = (epicsType *)pBlue;
+  size_t x;
+
+  for (x=x0; x<sizeX; x++) {
+    pR[x] = pI[3*x];
+    pG[x] = pI[3*x + 1];
+    pB[x] = pI[3*x + 2];
+  }
+}
+
+template <typename epicsType>
+static void interleaveScalarT(const void *pRed, const void *pGreen, const void *pBlue, void *pOut,
+                              size_t x0, size_t sizeX)
+{
+  const epicsType *pR = (const epicsType *)pRed, *pG = (const epicsType *)pGreen, *pB = (const epicsType *)pBlue;
+  epicsType *pO = (epicsType *)pOut;
+  size_t x;
+
+  for (x=x0; x<sizeX; x++) {
+    pO[3*x]     = pR[x];
+    pO[3*x + 1] = pG[x];
+    pO[3*x + 2] = pB[x];
+  }
+}
+
+typedef void (*deinterleaveScalar)(const void *pIn, void *pRed, void *pGreen, void *pBlue, size_t x0, size_t sizeX);
+typedef void (*interleaveScalar)(const void *pRed, const void *pGreen, const void *pBlue, void *pOut,
+                                 size_t x0, size_t sizeX);
+
+static void yuvScalar(NDColorMode_t mode, const epicsUInt8 *pIn, epicsUInt8 *pRed, epicsUInt8 *pGreen,
+                      epicsUInt8 *pBlue, size_t pixelStride, size_t x0, size_t sizeX)
+{
+  size_t x, oy, ou, ov;
+
+  for (x=x0; x<sizeX; x++) {
+    yuvOffsets(mode, x, &oy, &ou, &ov);
+    int y = pIn[oy], u = pIn[ou] - 128, v = pIn[ov] - 128;
+    pRed[x*pixelStride]   = clampUInt8(y + yuvTerm(v, YUV_RED_V));
+    pGreen[x*pixelStride] = clampUInt8(y - yuvTerm(u, YUV_GREEN_U) - yuvTerm(v, YUV_GREEN_V));
+    pBlue[x*pixelStride]  = clampUInt8(y + yuvTerm(u, YUV_BLUE_U));
+  }
+}
+
+/* Each vector kernel converts the first pixels of a row in blocks of 48 bytes and returns the number it did */
+typedef size_t (*deinterleaveKernel)(const byteGather *pG, size_t e, const char *pIn, char *pRed, char *pGreen,
+                                     char *pBlue, size_t sizeX);
+typedef size_t (*interleaveKernel)(const byteGather *pG, size_t e, const char *pRed, const char *pGreen,
+                                   const char *pBlue, char *pOut, size_t sizeX);
+typedef size_t (*yuvKernel)(const byteGather *pG, const byteGather *pInterleave, NDColorMode_t mode,
+                            const epicsUInt8 *pIn, epicsUInt8 *pRed, epicsUInt8 *pGreen, epicsUInt8 *pBlue,
+                            size_t pixelStride, size_t sizeX);
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("ssse3")
+static inline __m128i gatherSSSE3(const byteGather *pG, int v, __m128i a, __m128i b, __m128i c)
+{
+  __m128i r = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)pG->masks[v][0]));
+  r = _mm_or_si128(r, _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)pG->masks[v][1])));
+  return _mm_or_si128(r, _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)pG->masks[v][2])));
+}
+
+ND_TARGET("ssse3")
+static size_t deinterleaveSSSE3(const byteGather *pG, size_t e, const char *pIn, char *pRed, char *pGreen,
+                                char *pBlue, size_t sizeX)
+{
+  size_t pixels = 16/e, x;
+
+  for (x=0; x+pixels<=sizeX; x+=pixels) {
+    const char *p = pIn + 3*e*x;
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    _mm_storeu_si128((__m128i *)(pRed + e*x),   gatherSSSE3(pG, 0, a, b, c));
+    _mm_storeu_si128((__m128i *)(pGreen + e*x), gatherSSSE3(pG, 1, a, b, c));
+    _mm_storeu_si128((__m128i *)(pBlue + e*x),  gatherSSSE3(pG, 2, a, b, c));
+  }
+  return x;
+}
+
+ND_TARGET("ssse3")
+static size_t interleaveSSSE3(const byteGather *pG, size_t e, const char *pRed, const char *pGreen,
+                              const char *pBlue, char *pOut, size_t sizeX)
+{
+  size_t pixels = 16/e, x;
+
+  for (x=0; x+pixels<=sizeX; x+=pixels) {
+    char *p = pOut + 3*e*x;
+    __m128i r = _mm_loadu_si128((const __m128i *)(pRed + e*x));
+    __m128i g = _mm_loadu_si128((const __m128i *)(pGreen + e*x));
+    __m128i b = _mm_loadu_si128((const __m128i *)(pBlue + e*x));
+    _mm_storeu_si128((__m128i *)p,        gatherSSSE3(pG, 0, r, g, b));
+    _mm_storeu_si128((__m128i *)(p + 16), gatherSSSE3(pG, 1, r, g, b));
+    _mm_storeu_si128((__m128i *)(p + 32), gatherSSSE3(pG, 2, r, g, b));
+  }
+  return x;
+}
+
+/* Red, green and blue of 8 pixels from their Y and their U and V minus 128, times 64 */
+ND_TARGET("ssse3")
+static inline void yuvPixelsSSSE3(__m128i y, __m128i u, __m128i v, __m128i *pR, __m128i *pG, __m128i *pB)
+{
+  *pR = _mm_add_epi16(y, _mm_mulhrs_epi16(v, _mm_set1_epi16(YUV_RED_V)));
+  *pG = _mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhrs_epi16(u, _mm_set1_epi16(YUV_GREEN_U))),
+                      _mm_mulhrs_epi16(v, _mm_set1_epi16(YUV_GREEN_V)));
+  *pB = _mm_add_epi16(y, _mm_mulhrs_epi16(u, _mm_set1_epi16(YUV_BLUE_U)));
+}
+
+ND_TARGET("ssse3")
+static size_t yuvSSSE3(const byteGather *pG, const byteGather *pInterleave, NDColorMode_t mode,
+                       const epicsUInt8 *pIn, epicsUInt8 *pRed, epicsUInt8 *pGreen, epicsUInt8 *pBlue,
+                       size_t pixelStride, size_t sizeX)
+{
+  const __m128i zero = _mm_setzero_si128(), center = _mm_set1_epi16(128);
+  size_t groupPixels, groupBytes, x;
+  yuvGroup(mode, &groupPixels, &groupBytes);
+  // The whole 16-byte input vectors must be in the row
+  size_t rowBytes = sizeX/groupPixels*groupBytes, blockBytes = 16/groupPixels*groupBytes;
+  size_t loadBytes = (blockBytes + 15)/16*16;
+
+  for (x=0; x/groupPixels*groupBytes + loadBytes<=rowBytes; x+=16) {
+    const epicsUInt8 *p = pIn + x/groupPixels*groupBytes;
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = (loadBytes > 32) ? _mm_loadu_si128((const __m128i *)(p + 32)) : zero;
+    __m128i y = gatherSSSE3(pG, 0, a, b, c);
+    __m128i u = gatherSSSE3(pG, 1, a, b, c);
+    __m128i v = gatherSSSE3(pG, 2, a, b, c);
+    __m128i rl, gl, bl, rh, gh, bh;
+    yuvPixelsSSSE3(_mm_unpacklo_epi8(y, zero),
+                   _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(u, zero), center), 6),
+                   _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), center), 6), &rl, &gl, &bl);
+    yuvPixelsSSSE3(_mm_unpackhi_epi8(y, zero),
+                   _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(u, zero), center), 6),
+                   _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v, zero), center), 6), &rh, &gh, &bh);
+    __m128i red = _mm_packus_epi16(rl, rh), green = _mm_packus_epi16(gl, gh), blue = _mm_packus_epi16(bl, bh);
+    if (pixelStride == 1) {
+      _mm_storeu_si128((__m128i *)(pRed + x),   red);
+      _mm_storeu_si128((__m128i *)(pGreen + x), green);
+      _mm_storeu_si128((__m128i *)(pBlue + x),  blue);
+    } else {
+      epicsUInt8 *pOut = pRed + 3*x;
+      _mm_storeu_si128((__m128i *)pOut,        gatherSSSE3(pInterleave, 0, red, green, blue));
+      _mm_storeu_si128((__m128i *)(pOut + 16), gatherSSSE3(pInterleave, 1, red, green, blue));
+      _mm_storeu_si128((__m128i *)(pOut + 32), gatherSSSE3(pInterleave, 2, red, green, blue));
+    }
+  }
+  return x;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static inline uint8x16_t gatherNEON(const byteGather *pG, int v, uint8x16x3_t block)
+{
+  // The table lookup gives 0 for the indices of GATHER_NONE, which are outside the 48 bytes
+  return vqtbl3q_u8(block, vld1q_u8(pG->index[v]));
+}
+
+static size_t deinterleaveNEON(const byteGather *pG, size_t e, const char *pIn, char *pRed, char *pGreen,
+                               char *pBlue, size_t sizeX)
+{
+  size_t pixels = 16/e, x;
+
+  for (x=0; x+pixels<=sizeX; x+=pixels) {
+    const uint8_t *p = (const uint8_t *)pIn + 3*e*x;
+    uint8x16x3_t block;
+    block.val[0] = vld1q_u8(p);
+    block.val[1] = vld1q_u8(p + 16);
+    block.val[2] = vld1q_u8(p + 32);
+    vst1q_u8((uint8_t *)pRed + e*x,   gatherNEON(pG, 0, block));
+    vst1q_u8((uint8_t *)pGreen + e*x, gatherNEON(pG, 1, block));
+    vst1q_u8((uint8_t *)pBlue + e*x,  gatherNEON(pG, 2, block));
+  }
+  return x;
+}
+
+static size_t interleaveNEON(const byteGather *pG, size_t e, const char *pRed, const char *pGreen,
+                             const char *pBlue, char *pOut, size_t sizeX)
+{
+  size_t pixels = 16/e, x;
+
+  for (x=0; x+pixels<=sizeX; x+=pixels) {
+    uint8_t *p = (uint8_t *)pOut + 3*e*x;
+    uint8x16x3_t block;
+    block.val[0] = vld1q_u8((const uint8_t *)pRed + e*x);
+    block.val[1] = vld1q_u8((const uint8_t *)pGreen + e*x);
+    block.val[2] = vld1q_u8((const uint8_t *)pBlue + e*x);
+    vst1q_u8(p,      gatherNEON(pG, 0, block));
+    vst1q_u8(p + 16, gatherNEON(pG, 1, block));
+    vst1q_u8(p + 32, gatherNEON(pG, 2, block));
+  }
+  return x;
+}
+
+/* Red, green and blue of 8 pixels from their Y and their U and V minus 128, times 64 */
+static inline void yuvPixelsNEON(int16x8_t y, int16x8_t u, int16x8_t v, int16x8_t *pR, int16x8_t *pG,
+                                 int16x8_t *pB)
+{
+  // vqrdmulhq_s16 rounds (u * c) / 2^15 as _mm_mulhrs_epi16 does
+  *pR = vaddq_s16(y, vqrdmulhq_s16(v, vdupq_n_s16(YUV_RED_V)));
+  *pG = vsubq_s16(vsubq_s16(y, vqrdmulhq_s16(u, vdupq_n_s16(YUV_GREEN_U))),
+                  vqrdmulhq_s16(v, vdupq_n_s16(YUV_GREEN_V)));
+  *pB = vaddq_s16(y, vqrdmulhq_s16(u, vdupq_n_s16(YUV_BLUE_U)));
+}
+
+static inline int16x8_t yuvCenterNEON(uint8x8_t c)
+{
+  return vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(c)), vdupq_n_s16(128)), 6);
+}
+
+static size_t yuvNEON(const byteGather *pG, const byteGather *pInterleave, NDColorMode_t mode,
+                      const epicsUInt8 *pIn, epicsUInt8 *pRed, epicsUInt8 *pGreen, epicsUInt8 *pBlue,
+                      size_t pixelStride, size_t sizeX)
+{
+  size_t groupPixels, groupBytes, x;
+  yuvGroup(mode, &groupPixels, &groupBytes);
+  // The whole 16-byte input vectors must be in the row
+  size_t rowBytes = sizeX/groupPixels*groupBytes, blockBytes = 16/groupPixels*groupBytes;
+  size_t loadBytes = (blockBytes + 15)/16*16;
+
+  for (x=0; x/groupPixels*groupBytes + loadBytes<=rowBytes; x+=16) {
+    const uint8_t *p = pIn + x/groupPixels*groupBytes;
+    uint8x16x3_t block;
+    block.val[0] = vld1q_u8(p);
+    block.val[1] = vld1q_u8(p + 16);
+    block.val[2] = (loadBytes > 32) ? vld1q_u8(p + 32) : vdupq_n_u8(0);
+    uint8x16_t y = gatherNEON(pG, 0, block), u = gatherNEON(pG, 1, block), v = gatherNEON(pG, 2, block);
+    int16x8_t rl, gl, bl, rh, gh, bh;
+    yuvPixelsNEON(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y))), yuvCenterNEON(vget_low_u8(u)),
+                  yuvCenterNEON(vget_low_u8(v)), &rl, &gl, &bl);
+    yuvPixelsNEON(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y))), yuvCenterNEON(vget_high_u8(u)),
+                  yuvCenterNEON(vget_high_u8(v)), &rh, &gh, &bh);
+    uint8x16x3_t rgb;
+    rgb.val[0] = vcombine_u8(vqmovun_s16(rl), vqmovun_s16(rh));
+    rgb.val[1] = vcombine_u8(vqmovun_s16(gl), vqmovun_s16(gh));
+    rgb.val[2] = vcombine_u8(vqmovun_s16(bl), vqmovun_s16(bh));
+    if (pixelStride == 1) {
+      vst1q_u8(pRed + x,   rgb.val[0]);
+      vst1q_u8(pGreen + x, rgb.val[1]);
+      vst1q_u8(pBlue + x,  rgb.val[2]);
+    } else {
+      uint8_t *pOut = pRed + 3*x;
+      vst1q_u8(pOut,      gatherNEON(pInterleave, 0, rgb));
+      vst1q_u8(pOut + 16, gatherNEON(pInterleave, 1, rgb));
+      vst1q_u8(pOut + 32, gatherNEON(pInterleave, 2, rgb));
+    }
+  }
+  return x;
+}
+
+#endif
+
+/* An entry of a false color table holds red, green and blue in its 3 low bytes */
+static void falseColorScalar(const epicsUInt32 *pTable, const epicsUInt16 *pIn, epicsUInt8 *pRed,
+                             epicsUInt8 *pGreen, epicsUInt8 *pBlue, size_t pixelStride, size_t x0, size_t nPixels)
+{
+  size_t x;
+
+  for (x=x0; x<nPixels; x++) {
+    epicsUInt32 entry = pTable[pIn[x]];
+    pRed[x*pixelStride]   = (epicsUInt8)entry;
+    pGreen[x*pixelStride] = (epicsUInt8)(entry >> 8);
+    pBlue[x*pixelStride]  = (epicsUInt8)(entry >> 16);
+  }
+}
+
+#if defined(ND_SIMD_X86)
+
+/* RGB1 pixels only; each iteration stores 28 bytes, 4 past its 8 pixels, which the next one overwrites */
+ND_TARGET("avx2")
+static size_t falseColorAVX2(const epicsUInt32 *pTable, const epicsUInt16 *pIn, epicsUInt8 *pOut, size_t nPixels)
+{
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  size_t x;
+
+  for (x=0; x+10<=nPixels; x+=8) {
+    __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pIn + x)));
+    __m256i rgb = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)pTable, index, 4), pack);
+    _mm_storeu_si128((__m128i *)(pOut + 3*x), _mm256_castsi256_si128(rgb));
+    _mm_storeu_si128((__m128i *)(pOut + 3*x + 12), _mm256_extracti128_si256(rgb, 1));
+  }
+  return x;
+}
+
+#endif
+
+static int scalarKernels(size_t elementSize, deinterleaveScalar *pDeinterleave, interleaveScalar *pInterleave)
+{
+  switch (elementSize) {
+    case 1:
+      *pDeinterleave = deinterleaveScalarT<epicsUInt8>;
+      *pInterleave = interleaveScalarT<epicsUInt8>;
+      break;
+    case 2:
+      *pDeinterleave = deinterleaveScalarT<epicsUInt16>;
+      *pInterleave = interleaveScalarT<epicsUInt16>;
+      break;
+    case 4:
+      *pDeinterleave = deinterleaveScalarT<epicsUInt32>;
+      *pInterleave = interleaveScalarT<epicsUInt32>;
+      break;
+    case 8:
+      *pDeinterleave = deinterleaveScalarT<epicsUInt64>;
+      *pInterleave = interleaveScalarT<epicsUInt64>;
+      break;
+    default:
+      return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Interleaves rows of three color planes into rows of RGB1 pixels, for the RGB2 and RGB3 to RGB1 conversions.
+  * \param[in] elementSize The size of an element in bytes, 1, 2, 4 or 8.
+  * \param[in] pRed The first red element of the first row.
+  * \param[in] pGreen The first green element of the first row.
+  * \param[in] pBlue The first blue element of the first row.
+  * \param[in] inRowStride The distance between the rows of a plane, in elements.
+  * \param[out] pOut The first pixel of the first output row.
+  * \param[in] outRowStride The distance between the output rows, in elements.
+  * \param[in] sizeX The number of pixels of a row.
+  * \param[in] numRows The number of rows.
+  * \return ND_SUCCESS, or ND_ERROR if the element size is not supported. */
+int NDColorInterleave(size_t elementSize, const void *pRed, const void *pGreen, const void *pBlue,
+                      size_t inRowStride, void *pOut, size_t outRowStride, size_t sizeX, size_t numRows)
+{
+  deinterleaveScalar deinterleave;
+  interleaveScalar scalar;
+  interleaveKernel kernel = 0;
+  NDSimdLevel_t level = NDSimdLevel();
+  byteGather gather;
+  size_t row;
+
+  if (scalarKernels(elementSize, &deinterleave, &scalar) != ND_SUCCESS) return ND_ERROR;
+#if defined(ND_SIMD_X86)
+  // SSE4.1 implies the byte shuffle of SSSE3
+  if (level >= NDSimdSSE41) kernel = interleaveSSSE3;
+#elif defined(ND_SIMD_NEON)
+  if (level == NDSimdNEON) kernel = interleaveNEON;
+#endif
+  (void)level;
+  if (kernel) interleaveGather(elementSize, &gather);
+  for (row=0; row<numRows; row++) {
+    size_t inOffset = row*inRowStride*elementSize, outOffset = row*outRowStride*elementSize;
+    const char *pR = (const char *)pRed + inOffset;
+    const char *pG = (const char *)pGreen + inOffset;
+    const char *pB = (const char *)pBlue + inOffset;
+    char *pO = (char *)pOut + outOffset;
+    size_t x = kernel ? kernel(&gather, elementSize, pR, pG, pB, pO, sizeX) : 0;
+    scalar(pR, pG, pB, pO, x, sizeX);
+  }
+  return ND_SUCCESS;
+}
+
+/** Deinterleaves rows of RGB1 pixels into rows of three color planes, for the RGB1 to RGB2 and RGB3 conversions.
+  * \param[in] elementSize The size of an element in bytes, 1, 2, 4 or 8.
+  * \param[in] pIn The first pixel of the first input row.
+  * \param[in] inRowStride The distance between the input rows, in elements.
+  * \param[out] pRed The first red element of the first row.
+  * \param[out] pGreen The first green element of the first row.
+  * \param[out] pBlue The first blue element of the first row.
+  * \param[in] outRowStride The distance between the rows of a plane, in elements.
+  * \param[in] sizeX The number of pixels of a row.
+  * \param[in] numRows The number of rows.
+  * \return ND_SUCCESS, or ND_ERROR if the element size is not supported. */
+int NDColorDeinterleave(size_t elementSize, const void *pIn, size_t inRowStride,
+                        void *pRed, void *pGreen, void *pBlue, size_t outRowStride, size_t sizeX, size_t numRows)
+{
+  deinterleaveScalar scalar;
+  interleaveScalar interleave;
+  deinterleaveKernel kernel = 0;
+  NDSimdLevel_t level = NDSimdLevel();
+  byteGather gather;
+  size_t row;
+
+  if (scalarKernels(elementSize, &scalar, &interleave) != ND_SUCCESS) return ND_ERROR;
+#if defined(ND_SIMD_X86)
+  if (level >= NDSimdSSE41) kernel = deinterleaveSSSE3;
+#elif defined(ND_SIMD_NEON)
+  if (level == NDSimdNEON) kernel = deinterleaveNEON;
+#endif
+  (void)level;
+  if (kernel) deinterleaveGather(elementSize, &gather);
+  for (row=0; row<numRows; row++) {
+    size_t inOffset = row*inRowStride*elementSize, outOffset = row*outRowStride*elementSize;
+    const char *pI = (const char *)pIn + inOffset;
+    char *pR = (char *)pRed + outOffset;
+    char *pG = (char *)pGreen + outOffset;
+    char *pB = (char *)pBlue + outOffset;
+    size_t x = kernel ? kernel(&gather, elementSize, pI, pR, pG, pB, sizeX) : 0;
+    scalar(pI, pR, pG, pB, x, sizeX);
+  }
+  return ND_SUCCESS;
+}
+
+/** Converts rows of 8-bit YUV pixels to RGB.
+  * The bytes of a row are U Y V for each pixel with YUV444, U Y0 V Y1 for each 2 pixels with YUV422 and
+  * U Y0 Y1 V Y2 Y3 for each 4 pixels with YUV411.
+  * \param[in] yuvMode NDColorModeYUV444, NDColorModeYUV422 or NDColorModeYUV411.
+  * \param[in] pIn The first byte of the first input row.
+  * \param[in] inRowStride The distance between the input rows, in bytes.
+  * \param[out] pRed The red element of the first pixel of the first row.
+  * \param[out] pGreen The green element of the first pixel of the first row.
+  * \param[out] pBlue The blue element of the first pixel of the first row.
+  * \param[in] pixelStride The distance between the elements of a color of adjacent pixels, 3 for RGB1 and 1
+  *            for RGB2 and RGB3.
+  * \param[in] outRowStride The distance between the rows of a color, in elements.
+  * \param[in] sizeX The number of pixels of a row, a multiple of the pixels that share U and V.
+  * \param[in] numRows The number of rows.
+  * \return ND_SUCCESS, or ND_ERROR if the mode is not a YUV mode or sizeX is not a multiple of its group. */
+int NDColorYUVToRGB(NDColorMode_t yuvMode, const void *pIn, size_t inRowStride,
+                    void *pRed, void *pGreen, void *pBlue, size_t pixelStride, size_t outRowStride,
+                    size_t sizeX, size_t numRows)
+{
+  yuvKernel kernel = 0;
+  NDSimdLevel_t level = NDSimdLevel();
+  byteGather gather, interleave;
+  size_t groupPixels, groupBytes, row;
+
+  if ((yuvMode != NDColorModeYUV444) && (yuvMode != NDColorModeYUV422) && (yuvMode != NDColorModeYUV411)) {
+    return ND_ERROR;
+  }
+  yuvGroup(yuvMode, &groupPixels, &groupBytes);
+  if (sizeX % groupPixels) return ND_ERROR;
+#if defined(ND_SIMD_X86)
+  if (level >= NDSimdSSE41) kernel = yuvSSSE3;
+#elif defined(ND_SIMD_NEON)
+  if (level == NDSimdNEON) kernel = yuvNEON;
+#endif
+  (void)level;
+  // The vector kernels write planes, or RGB1 pixels with the colors in order
+  if ((pixelStride != 1) && ((pixelStride != 3) || ((char *)pGreen != (char *)pRed + 1) ||
+                             ((char *)pBlue != (char *)pRed + 2))) {
+    kernel = 0;
+  }
+  if (kernel) {
+    yuvGather(yuvMode, &gather);
+    interleaveGather(1, &interleave);
+  }
+  for (row=0; row<numRows; row++) {
+    const epicsUInt8 *pI = (const epicsUInt8 *)pIn + row*inRowStride;
+    epicsUInt8 *pR = (epicsUInt8 *)pRed + row*outRowStride;
+    epicsUInt8 *pG = (epicsUInt8 *)pGreen + row*outRowStride;
+    epicsUInt8 *pB = (epicsUInt8 *)pBlue + row*outRowStride;
+    size_t x = kernel ? kernel(&gather, &interleave, yuvMode, pI, pR, pG, pB, pixelStride, sizeX) : 0;
+    yuvScalar(yuvMode, pI, pR, pG, pB, pixelStride, x, sizeX);
+  }
+  return ND_SUCCESS;
+}
+
+/** Computes the false color table of 16-bit data for a display window.
+  * Values up to minValue get the first color of the map, values from maxValue the last, and the values between
+  * the color of their rounded position in the window.
+  * \param[in] pColorMapRGB The 256 colors of the map, 3 bytes each, as the tables of colorMaps.h.
+  * \param[in] isSigned The table is for Int16 data, else for UInt16 data; the table is indexed by the bits of
+  *            the values in both cases.
+  * \param[in] minValue The value of the first color.
+  * \param[in] maxValue The value of the last color.
+  * \param[out] pTable The ND_FALSE_COLOR_TABLE_SIZE entries of the table.
+  * \return ND_SUCCESS. */
+int NDColorFalseColorTable(const unsigned char *pColorMapRGB, int isSigned, double minValue, double maxValue,
+                           epicsUInt32 *pTable)
+{
+  size_t i;
+
+  for (i=0; i<ND_FALSE_COLOR_TABLE_SIZE; i++) {
+    double value = isSigned ? (double)(epicsInt16)(epicsUInt16)i : (double)i;
+    int color;
+    if (value <= minValue) color = 0;
+    else if (value >= maxValue) color = 255;
+    else color = (int)((value - minValue) * 255. / (maxValue - minValue) + 0.5);
+    if (color > 255) color = 255;
+    const unsigned char *pColor = pColorMapRGB + 3*color;
+    pTable[i] = (epicsUInt32)pColor[0] | ((epicsUInt32)pColor[1] << 8) | ((epicsUInt32)pColor[2] << 16);
+  }
+  return ND_SUCCESS;
+}
+
+/** Maps 16-bit values to UInt8 RGB through a table from NDColorFalseColorTable().
+  * \param[in] pTable The table.
+  * \param[in] pIn The UInt16 or Int16 values.
+  * \param[out] pRed The red element of the first pixel.
+  * \param[out] pGreen The green element of the first pixel.
+  * \param[out] pBlue The blue element of the first pixel.
+  * \param[in] pixelStride The distance between the elements of a color of adjacent pixels, 3 for RGB1 and 1
+  *            for the planes of RGB2 and RGB3.
+  * \param[in] nPixels The number of values.
+  * \return ND_SUCCESS. */
+int NDColorFalseColor16(const epicsUInt32 *pTable, const void *pIn, void *pRed, void *pGreen, void *pBlue,
+                        size_t pixelStride, size_t nPixels)
+{
+  const epicsUInt16 *pI = (const epicsUInt16 *)pIn;
+  epicsUInt8 *pR = (epicsUInt8 *)pRed, *pG = (epicsUInt8 *)pGreen, *pB = (epicsUInt8 *)pBlue;
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t x = 0;
+
+#if defined(ND_SIMD_X86)
+  // The vector kernel writes RGB1 pixels with the colors in order
+  if ((level >= NDSimdAVX2) && (pixelStride == 3) && (pG == pR + 1) && (pB == pR + 2)) {
+    x = falseColorAVX2(pTable, pI, pR, nPixels);
+  }
+#endif
+  (void)level;
+  falseColorScalar(pTable, pI, pR, pG, pB, pixelStride, x, nPixels);
+  return ND_SUCCESS;
+}
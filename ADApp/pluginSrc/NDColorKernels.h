@@ -0,0 +1,44 @@
+/** NDColorKernels.h
+ *
+ * Color layout conversions for NDPluginColorConvert: the interleave of three color planes into RGB1 pixels, the
+ * deinterleave of RGB1 pixels into planes, and the conversion of the YUV444, YUV422 and YUV411 byte layouts to
+ * RGB, and the false color of 16-bit arrays through a precomputed table.  The layout conversions only move
+ * elements, so they depend only on the element size; they, the UInt8 YUV conversion and the false color table
+ * lookups are vectorized with the instruction set NDSimdLevel() returns.
+ *
+ */
+
+#ifndef NDColorKernels_H
+#define NDColorKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+#define ND_FALSE_COLOR_TABLE_SIZE 65536    /**< The entries of a 16-bit false color table, one per value */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDColorInterleave(size_t elementSize, const void *pRed, const void *pGreen, const void *pBlue,
+                                     size_t inRowStride, void *pOut, size_t outRowStride,
+                                     size_t sizeX, size_t numRows);
+epicsShareFunc int NDColorDeinterleave(size_t elementSize, const void *pIn, size_t inRowStride,
+                                       void *pRed, void *pGreen, void *pBlue, size_t outRowStride,
+                                       size_t sizeX, size_t numRows);
+epicsShareFunc int NDColorYUVToRGB(NDColorMode_t yuvMode, const void *pIn, size_t inRowStride,
+                                   void *pRed, void *pGreen, void *pBlue, size_t pixelStride, size_t outRowStride,
+                                   size_t sizeX, size_t numRows);
+epicsShareFunc int NDColorFalseColorTable(const unsigned char *pColorMapRGB, int isSigned,
+                                          double minValue, double maxValue, epicsUInt32 *pTable);
+epicsShareFunc int NDColorFalseColor16(const epicsUInt32 *pTable, const void *pIn, void *pRed, void *pGreen,
+                                       void *pBlue, size_t pixelStride, size_t nPixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,920 @@
+/** NDCudaKernels.cu
+ *
+ * CUDA kernels for NDPluginProcess and NDPluginStats.
+ *
+ * The frames are copied to the device in chunks on two streams, so the copy of one chunk overlaps the kernel
+ * and the copy back of the previous one.  Host memory that is not pinned cannot be copied asynchronously, so it
+ * goes through a pinned staging buffer of each stream; the plugins allocate their own arrays from pinned memory
+ * with NDCudaPinnedMemory(), and the copies of those need no staging.
+ *
+ * The Process kernel applies the corrections and the recursive filter to each element in Float32, with the
+ * rounding intrinsics so that nvcc does not fuse the multiplies and adds, and the results are those of
+ * NDProcessCorrect() and filterBlockT().  The background, the gain and bias maps and the filter stay on the
+ * device between frames.
+ *
+ * The Stats kernel reduces each row with one block of threads to the results NDStatsRow() and the centroid
+ * loop of computeStatsStripeT() compute for a row, and the host combines the rows in order, so the minimum and
+ * maximum are the first occurrences as on the CPU.  The column profiles and the histogram are added with atomic
+ * operations, the histogram in shared memory when it is small enough.  The atomic additions of doubles need
+ * compute capability 6.0.
+ *
+ * NDCudaDeviceMemory() is the memory of a device for the pools of NDPluginDevice, whose arrays stay on the device
+ * between the plugins of a chain.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cuda_runtime.h>
+
+#include <epicsTypes.h>
+#include <epicsStdio.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDCudaKernels.h"
+
+#define ND_CUDA_STREAMS       2
+#define ND_CUDA_THREADS     256         /* Threads per block */
+#define ND_CUDA_CHUNK_BYTES (4 << 20)   /* Bytes of a frame copied at a time */
+#define ND_CUDA_SHARED_BINS 4096        /* The largest histogram that is counted in shared memory */
+#define ND_CUDA_NO_INDEX    (~0ull)     /* The index of a thread that has no elements */
+#define ND_CUDA_MAX_DEVICES 16          /* The devices of NDCudaDeviceMemory() */
+
+/* The results of one row, or of the elements of one thread of the row */
+typedef struct {
+    double min;
+    double max;
+    double total;
+    double sumSquares;
+    double sum;
+    double thresh;
+    double M11;
+    double histBelow;
+    double histAbove;
+    unsigned long long minIndex;
+    unsigned long long maxIndex;
+} rowResult_t;
+
+struct NDCudaContext {
+    int device;
+    cudaStream_t streams[ND_CUDA_STREAMS];
+    char error[256];
+    /* Staging, per stream */
+    size_t stageBytes;
+    void *hIn[ND_CUDA_STREAMS];         /* Pinned buffers for input that is not pinned */
+    void *hOut[ND_CUDA_STREAMS];        /* Pinned buffers for output that is not pinned */
+    void *dIn[ND_CUDA_STREAMS];
+    void *dOut[ND_CUDA_STREAMS];
+    void *pPendingOut[ND_CUDA_STREAMS]; /* Where the output in hOut is copied when the stream is done */
+    size_t pendingBytes[ND_CUDA_STREAMS];
+    /* NDPluginProcess */
+    int mapGeneration;
+    int mapsPresent;
+    size_t nMapElements;
+    float *dBackground;
+    float *dGain;
+    float *dBias;
+    float *dFilter;
+    size_t nFilterElements;
+    /* NDPluginStats */
+    size_t statsBytes;
+    void *dStats;
+    void *hStats;
+};
+
+/* The corrections and filter in the arithmetic type of the kernel */
+typedef struct {
+    int enableBackground, enableGain, enableOffsetScale, enableHighClip, enableLowClip;
+    int enableFilter, initFilter, resetFilter;
+    float offset, scale, highClip, lowClip;
+    float rOffset, rc1, rc2;
+    float oOffset, O1, O2;
+    float fOffset, F1, F2;
+} processParams_t;
+
+typedef struct {
+    int computeStatistics, computeCentroid, computeHistogram;
+    double shift;
+    double centroidThreshold;
+    double histMin, histMax, histScale;
+    int histSize;
+    int sharedBins;
+} statsParams_t;
+
+/* Records the error of a CUDA call; returns 1 if it succeeded */
+static int checkCuda(NDCudaContext_t *pContext, cudaError_t status, const char *what)
+{
+    if (status == cudaSuccess) return 1;
+    epicsSnprintf(pContext->error, sizeof(pContext->error), "%s: %s", what, cudaGetErrorString(status));
+    return 0;
+}
+
+/* Makes a device buffer at least bytes long, keeping it if it already is */
+static cudaError_t ensureDevice(void **ppBuffer, size_t *pSize, size_t bytes)
+{
+    cudaError_t status;
+
+    if (*ppBuffer && (*pSize >= bytes)) return cudaSuccess;
+    cudaFree(*ppBuffer);
+    *ppBuffer = NULL;
+    *pSize = 0;
+    status = cudaMalloc(ppBuffer, bytes);
+    if (status == cudaSuccess) *pSize = bytes;
+    return status;
+}
+
+/* Makes the staging buffers of the streams at least bytes long */
+static cudaError_t ensureStaging(NDCudaContext_t *pContext, size_t bytes)
+{
+    cudaError_t status = cudaSuccess;
+    int s;
+
+    if (pContext->stageBytes >= bytes) return cudaSuccess;
+    for (s=0; s<ND_CUDA_STREAMS; s++) {
+        cudaFreeHost(pContext->hIn[s]);
+        cudaFreeHost(pContext->hOut[s]);
+        cudaFree(pContext->dIn[s]);
+        cudaFree(pContext->dOut[s]);
+        pContext->hIn[s] = pContext->hOut[s] = pContext->dIn[s] = pContext->dOut[s] = NULL;
+    }
+    pContext->stageBytes = 0;
+    for (s=0; (s<ND_CUDA_STREAMS) && (status == cudaSuccess); s++) {
+        status = cudaHostAlloc(&pContext->hIn[s], bytes, cudaHostAllocDefault);
+        if (status == cudaSuccess) status = cudaHostAlloc(&pContext->hOut[s], bytes, cudaHostAllocDefault);
+        if (status == cudaSuccess) status = cudaMalloc(&pContext->dIn[s], bytes);
+        if (status == cudaSuccess) status = cudaMalloc(&pContext->dOut[s], bytes);
+    }
+    if (status == cudaSuccess) pContext->stageBytes = bytes;
+    return status;
+}
+
+/* Returns 1 if host memory is pinned, so that it can be copied asynchronously */
+static int isPinned(const void *pData)
+{
+    cudaPointerAttributes attributes;
+
+    if (cudaPointerGetAttributes(&attributes, pData) != cudaSuccess) {
+        /* Older runtimes fail for memory they do not know; this clears the error */
+        cudaGetLastError();
+        return 0;
+    }
+#if CUDART_VERSION >= 10000
+    return attributes.type == cudaMemoryTypeHost;
+#else
+    return attributes.memoryType == cudaMemoryTypeHost;
+#endif
+}
+
+/* Waits for the work queued on a stream and copies its staged output to where it belongs */
+static cudaError_t finishStream(NDCudaContext_t *pContext, int s)
+{
+    cudaError_t status = cudaStreamSynchronize(pContext->streams[s]);
+
+    if ((status == cudaSuccess) && pContext->pPendingOut[s])
+        memcpy(pContext->pPendingOut[s], pContext->hOut[s], pContext->pendingBytes[s]);
+    pContext->pPendingOut[s] = NULL;
+    return status;
+}
+
+/* Queues the copy of bytes of host memory to the device on a stream, through its staging buffer if necessary.
+ * The staging buffer must not be in use, see finishStream(). */
+static cudaError_t upload(NDCudaContext_t *pContext, int s, void *pDevice, const void *pHost, size_t bytes,
+                          int pinned)
+{
+    if (!pinned) {
+        memcpy(pContext->hIn[s], pHost, bytes);
+        pHost = pContext->hIn[s];
+    }
+    return cudaMemcpyAsync(pDevice, pHost, bytes, cudaMemcpyHostToDevice, pContext->streams[s]);
+}
+
+static size_t dataTypeSize(NDDataType_t dataType)
+{
+    switch (dataType) {
+        case NDInt8:
+        case NDUInt8:   return 1;
+        case NDInt16:
+        case NDUInt16:  return 2;
+        case NDInt32:
+        case NDUInt32:
+        case NDFloat32: return 4;
+        case NDFloat64: return 8;
+        default:        return 0;
+    }
+}
+
+/** Makes a context for a device, with its streams.
+  * \param[in] device The CUDA device; CUDA_VISIBLE_DEVICES selects which devices this is among.
+  * \param[out] pError Why there is no context, if it returns NULL.
+  * \param[in] errorSize The size of pError.
+  * \return The context, or NULL if there is no usable device. */
+NDCudaContext_t* NDCudaCreate(int device, char *pError, size_t errorSize)
+{
+    NDCudaContext_t *pContext = (NDCudaContext_t *)calloc(1, sizeof(NDCudaContext_t));
+    int s, ok = 1;
+
+    if (!pContext) {
+        epicsSnprintf(pError, errorSize, "Cannot allocate the CUDA context");
+        return NULL;
+    }
+    pContext->device = device;
+    pContext->mapGeneration = -1;
+    ok = checkCuda(pContext, cudaSetDevice(device), "cudaSetDevice");
+    for (s=0; ok && (s<ND_CUDA_STREAMS); s++)
+        ok = checkCuda(pContext, cudaStreamCreateWithFlags(&pContext->streams[s], cudaStreamNonBlocking),
+                       "cudaStreamCreate");
+    if (!ok) {
+        epicsSnprintf(pError, errorSize, "%s", pContext->error);
+        NDCudaDestroy(pContext);
+        return NULL;
+    }
+    return pContext;
+}
+
+/** Releases a context and the arrays it keeps on the device */
+void NDCudaDestroy(NDCudaContext_t *pContext)
+{
+    int s;
+
+    if (!pContext) return;
+    cudaSetDevice(pContext->device);
+    for (s=0; s<ND_CUDA_STREAMS; s++) {
+        if (pContext->streams[s]) cudaStreamDestroy(pContext->streams[s]);
+        cudaFreeHost(pContext->hIn[s]);
+        cudaFreeHost(pContext->hOut[s]);
+        cudaFree(pContext->dIn[s]);
+        cudaFree(pContext->dOut[s]);
+    }
+    cudaFree(pContext->dBackground);
+    cudaFree(pContext->dGain);
+    cudaFree(pContext->dBias);
+    cudaFree(pContext->dFilter);
+    cudaFree(pContext->dStats);
+    cudaFreeHost(pContext->hStats);
+    free(pContext);
+}
+
+/** Returns the message of the last error of a context */
+const char* NDCudaError(NDCudaContext_t *pContext)
+{
+    return pContext->error;
+}
+
+/* Copies a map to the device, or releases it if there is none */
+static int uploadMap(NDCudaContext_t *pContext, float **ppDevice, const float *pMap, size_t nElements)
+{
+    size_t size = 0;
+
+    cudaFree(*ppDevice);
+    *ppDevice = NULL;
+    if (!pMap) return 1;
+    return checkCuda(pContext, ensureDevice((void **)ppDevice, &size, nElements*sizeof(float)), "cudaMalloc") &&
+           checkCuda(pContext, cudaMemcpy(*ppDevice, pMap, nElements*sizeof(float), cudaMemcpyHostToDevice),
+                     "cudaMemcpy");
+}
+
+/** Makes the maps on the device those of NDPluginProcess.  They are only copied when the generation, which the
+  * plugin changes whenever it changes a map, or the set of maps changes.
+  * \param[in] pContext The context.
+  * \param[in] generation The generation of the maps.
+  * \param[in] pBackground The background, or NULL.
+  * \param[in] pGain The gain map, or NULL.
+  * \param[in] pBias The bias map, or NULL.
+  * \param[in] nElements The number of elements of the maps. */
+int NDCudaProcessMaps(NDCudaContext_t *pContext, int generation, const float *pBackground,
+                      const float *pGain, const float *pBias, size_t nElements)
+{
+    int present = (pBackground ? 1 : 0) | (pGain ? 2 : 0) | (pBias ? 4 : 0);
+
+    if ((generation == pContext->mapGeneration) && (present == pContext->mapsPresent) &&
+        (nElements == pContext->nMapElements)) return ND_SUCCESS;
+    pContext->mapGeneration = -1;
+    if (!checkCuda(pContext, cudaSetDevice(pContext->device), "cudaSetDevice") ||
+        !uploadMap(pContext, &pContext->dBackground, pBackground, nElements) ||
+        !uploadMap(pContext, &pContext->dGain, pGain, nElements) ||
+        !uploadMap(pContext, &pContext->dBias, pBias, nElements)) return ND_ERROR;
+    pContext->mapGeneration = generation;
+    pContext->mapsPresent = present;
+    pContext->nMapElements = nElements;
+    return ND_SUCCESS;
+}
+
+/** Copies the recursive filter of NDPluginProcess to the device, where NDCudaProcess() updates it */
+int NDCudaProcessSetFilter(NDCudaContext_t *pContext, const float *pFilter, size_t nElements)
+{
+    size_t size = pContext->dFilter ? pContext->nFilterElements*sizeof(float) : 0;
+
+    pContext->nFilterElements = 0;
+    if (!checkCuda(pContext, cudaSetDevice(pContext->device), "cudaSetDevice") ||
+        !checkCuda(pContext, ensureDevice((void **)&pContext->dFilter, &size, nElements*sizeof(float)),
+                   "cudaMalloc") ||
+        !checkCuda(pContext, cudaMemcpy(pContext->dFilter, pFilter, nElements*sizeof(float),
+                                        cudaMemcpyHostToDevice), "cudaMemcpy")) return ND_ERROR;
+    pContext->nFilterElements = nElements;
+    return ND_SUCCESS;
+}
+
+/** Copies the recursive filter on the device back to the host */
+int NDCudaProcessGetFilter(NDCudaContext_t *pContext, float *pFilter, size_t nElements)
+{
+    if (nElements != pContext->nFilterElements) {
+        epicsSnprintf(pContext->error, sizeof(pContext->error), "The filter on the device has %lu elements",
+                      (unsigned long)pContext->nFilterElements);
+        return ND_ERROR;
+    }
+    if (!checkCuda(pContext, cudaSetDevice(pContext->device), "cudaSetDevice") ||
+        !checkCuda(pContext, cudaMemcpy(pFilter, pContext->dFilter, nElements*sizeof(float),
+                                        cudaMemcpyDeviceToHost), "cudaMemcpy")) return ND_ERROR;
+    return ND_SUCCESS;
+}
+
+/* The corrections of NDProcessCorrect() and the filter of filterBlockT() for the elements of a chunk.
+ * The maps and the filter are indexed from the start of the frame, the chunk from its own start. */
+template <typename inType, typename outType>
+__global__ void processKernel(const inType *pIn, outType *pOut, const float *pBackground, const float *pGain,
+                              const float *pBias, float *pFilter, size_t offset, size_t nElements,
+                              processParams_t p)
+{
+    size_t i, j;
+    float value, newData, newFilter, filter;
+
+    for (i=blockIdx.x*(size_t)blockDim.x + threadIdx.x; i<nElements; i+=(size_t)gridDim.x*blockDim.x) {
+        j = offset + i;
+        value = (float)pIn[i];
+        if (p.enableBackground) value = __fsub_rn(value, pBackground[j]);
+        if (p.enableGain) value = __fadd_rn(__fmul_rn(value, pGain[j]), pBias[j]);
+        if (p.enableOffsetScale) value = __fmul_rn(__fadd_rn(value, p.offset), p.scale);
+        if (p.enableHighClip && (value > p.highClip)) value = p.highClip;
+        if (p.enableLowClip && (value < p.lowClip)) value = p.lowClip;
+        if (p.enableFilter) {
+            filter = p.initFilter ? value : pFilter[j];
+            if (p.resetFilter) {
+                newFilter = p.rOffset;
+                if (p.rc1 != 0.f) newFilter = __fadd_rn(newFilter, __fmul_rn(p.rc1, filter));
+                if (p.rc2 != 0.f) newFilter = __fadd_rn(newFilter, __fmul_rn(p.rc2, value));
+                filter = newFilter;
+            }
+            newData = p.oOffset;
+            if (p.O1 != 0.f) newData = __fadd_rn(newData, __fmul_rn(p.O1, filter));
+            if (p.O2 != 0.f) newData = __fadd_rn(newData, __fmul_rn(p.O2, value));
+            newFilter = p.fOffset;
+            if (p.F1 != 0.f) newFilter = __fadd_rn(newFilter, __fmul_rn(p.F1, filter));
+            if (p.F2 != 0.f) newFilter = __fadd_rn(newFilter, __fmul_rn(p.F2, value));
+            pFilter[j] = newFilter;
+            value = newData;
+        }
+        if (pOut) pOut[i] = (outType)value;
+    }
+}
+
+template <typename inType, typename outType>
+static void launchProcessT(cudaStream_t stream, const void *pIn, void *pOut, const NDCudaContext_t *pContext,
+                           size_t offset, size_t nElements, const processParams_t& p)
+{
+    size_t blocks = (nElements + ND_CUDA_THREADS - 1) / ND_CUDA_THREADS;
+
+    if (blocks > 65535) blocks = 65535;
+    processKernel<inType, outType><<<(unsigned int)blocks, ND_CUDA_THREADS, 0, stream>>>(
+        (const inType *)pIn, (outType *)pOut, pContext->dBackground, pContext->dGain, pContext->dBias,
+        pContext->dFilter, offset, nElements, p);
+}
+
+template <typename inType>
+static void launchProcessIn(NDDataType_t outType, cudaStream_t stream, const void *pIn, void *pOut,
+                            const NDCudaContext_t *pContext, size_t offset, size_t nElements,
+                            const processParams_t& p)
+{
+    switch (outType) {
+        case NDInt8:    launchProcessT<inType, epicsInt8>   (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt8:   launchProcessT<inType, epicsUInt8>  (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDInt16:   launchProcessT<inType, epicsInt16>  (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt16:  launchProcessT<inType, epicsUInt16> (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDInt32:   launchProcessT<inType, epicsInt32>  (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt32:  launchProcessT<inType, epicsUInt32> (stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDFloat32: launchProcessT<inType, epicsFloat32>(stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDFloat64: launchProcessT<inType, epicsFloat64>(stream, pIn, pOut, pContext, offset, nElements, p); break;
+        default: break;
+    }
+}
+
+static void launchProcess(NDDataType_t inType, NDDataType_t outType, cudaStream_t stream, const void *pIn,
+                          void *pOut, const NDCudaContext_t *pContext, size_t offset, size_t nElements,
+                          const processParams_t& p)
+{
+    switch (inType) {
+        case NDInt8:    launchProcessIn<epicsInt8>   (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt8:   launchProcessIn<epicsUInt8>  (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDInt16:   launchProcessIn<epicsInt16>  (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt16:  launchProcessIn<epicsUInt16> (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDInt32:   launchProcessIn<epicsInt32>  (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDUInt32:  launchProcessIn<epicsUInt32> (outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDFloat32: launchProcessIn<epicsFloat32>(outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        case NDFloat64: launchProcessIn<epicsFloat64>(outType, stream, pIn, pOut, pContext, offset, nElements, p); break;
+        default: break;
+    }
+}
+
+/** Applies the corrections and the recursive filter of NDPluginProcess to a frame in Float32 and converts it to
+  * the output type.  The background, gain and bias maps must have been copied with NDCudaProcessMaps(), and the
+  * filter with NDCudaProcessSetFilter(), unless initFilter is set.
+  * \param[in] pContext The context.
+  * \param[in] pArgs The corrections and the filter.
+  * \param[in] inType The type of the input.
+  * \param[in] pIn The input elements.
+  * \param[in] outType The type of the output.
+  * \param[out] pOut The output elements, or NULL to only update the filter.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS, or ND_ERROR with the reason in NDCudaError(). */
+int NDCudaProcess(NDCudaContext_t *pContext, const NDCudaProcessArgs_t *pArgs, NDDataType_t inType,
+                  const void *pIn, NDDataType_t outType, void *pOut, size_t nElements)
+{
+    const NDProcessCorrection_t *pCorrection = &pArgs->correction;
+    size_t inBytes = dataTypeSize(inType), outBytes = dataTypeSize(outType);
+    size_t chunk, start, n, size;
+    int inPinned, outPinned, s, chunkIndex;
+    cudaError_t status;
+    processParams_t p;
+
+    if ((inBytes == 0) || (outBytes == 0)) {
+        epicsSnprintf(pContext->error, sizeof(pContext->error), "Unsupported data type");
+        return ND_ERROR;
+    }
+    if ((pCorrection->enableBackground && (!pContext->dBackground || (pContext->nMapElements != nElements))) ||
+        (pCorrection->enableGain && (!pContext->dGain || (pContext->nMapElements != nElements)))) {
+        epicsSnprintf(pContext->error, sizeof(pContext->error), "The maps are not on the device");
+        return ND_ERROR;
+    }
+    if (!checkCuda(pContext, cudaSetDevice(pContext->device), "cudaSetDevice")) return ND_ERROR;
+    if (pArgs->enableFilter && pArgs->initFilter && (pContext->nFilterElements != nElements)) {
+        size = pContext->dFilter ? pContext->nFilterElements*sizeof(float) : 0;
+        pContext->nFilterElements = 0;
+        if (!checkCuda(pContext, ensureDevice((void **)&pContext->dFilter, &size, nElements*sizeof(float)),
+                       "cudaMalloc")) return ND_ERROR;
+        pContext->nFilterElements = nElements;
+    }
+    if (pArgs->enableFilter && (pContext->nFilterElements != nElements)) {
+        epicsSnprintf(pContext->error, sizeof(pContext->error), "The filter is not on the device");
+        return ND_ERROR;
+    }
+    if (!checkCuda(pContext, ensureStaging(pContext, ND_CUDA_CHUNK_BYTES), "cudaHostAlloc")) return ND_ERROR;
+
+    p.enableBackground  = pCorrection->enableBackground;
+    p.enableGain        = pCorrection->enableGain;
+    p.enableOffsetScale = pCorrection->enableOffsetScale;
+    p.enableHighClip    = pCorrection->enableHighClip;
+    p.enableLowClip     = pCorrection->enableLowClip;
+    p.offset   = (float)pCorrection->offset;
+    p.scale    = (float)pCorrection->scale;
+    p.highClip = (float)pCorrection->highClip;
+    p.lowClip  = (float)pCorrection->lowClip;
+    p.enableFilter = pArgs->enableFilter;
+    p.initFilter   = pArgs->initFilter;
+    p.resetFilter  = pArgs->resetFilter;
+    p.rOffset = (float)pArgs->rOffset;
+    p.rc1     = (float)pArgs->rc1;
+    p.rc2     = (float)pArgs->rc2;
+    p.oOffset = (float)pArgs->oOffset;
+    p.O1      = (float)pArgs->O1;
+    p.O2      = (float)pArgs->O2;
+    p.fOffset = (float)pArgs->fOffset;
+    p.F1      = (float)pArgs->F1;
+    p.F2      = (float)pArgs->F2;
+
+    inPinned = isPinned(pIn);
+    outPinned = pOut ? isPinned(pOut) : 0;
+    chunk = ND_CUDA_CHUNK_BYTES / ((inBytes > outBytes) ? inBytes : outBytes);
+    status = cudaSuccess;
+    for (start=0, chunkIndex=0; (start<nElements) && (status == cudaSuccess); start+=n, chunkIndex++) {
+        n = (nElements - start > chunk) ? chunk : nElements - start;
+        s = chunkIndex % ND_CUDA_STREAMS;
+        /* The staging buffers of the stream are free once its previous chunk is done */
+        status = finishStream(pContext, s);
+        if (status == cudaSuccess)
+            status = upload(pContext, s, pContext->dIn[s], (const char *)pIn + start*inBytes, n*inBytes, inPinned);
+        if (status != cudaSuccess) break;
+        launchProcess(inType, outType, pContext->streams[s], pContext->dIn[s], pOut ? pContext->dOut[s] : NULL,
+                      pContext, start, n, p);
+        status = cudaGetLastError();
+        if ((status == cudaSuccess) && pOut) {
+            char *pDest = (char *)pOut + start*outBytes;
+            status = cudaMemcpyAsync(outPinned ? pDest : pContext->hOut[s], pContext->dOut[s], n*outBytes,
+                                     cudaMemcpyDeviceToHost, pContext->streams[s]);
+            if (!outPinned) {
+                pContext->pPendingOut[s] = pDest;
+                pContext->pendingBytes[s] = n*outBytes;
+            }
+        }
+    }
+    for (s=0; s<ND_CUDA_STREAMS; s++) {
+        cudaError_t streamStatus = finishStream(pContext, s);
+        if (status == cudaSuccess) status = streamStatus;
+    }
+    return checkCuda(pContext, status, "NDCudaProcess") ? ND_SUCCESS : ND_ERROR;
+}
+
+/* Adds the results of b to those of a; b has the higher thread index or row, so ties go to the lower index */
+__device__ static void combineRows(rowResult_t *a, const rowResult_t *b)
+{
+    if ((b->minIndex != ND_CUDA_NO_INDEX) &&
+        ((a->minIndex == ND_CUDA_NO_INDEX) || (b->min < a->min) ||
+         ((b->min == a->min) && (b->minIndex < a->minIndex)))) {
+        a->min = b->min;
+        a->minIndex = b->minIndex;
+    }
+    if ((b->maxIndex != ND_CUDA_NO_INDEX) &&
+        ((a->maxIndex == ND_CUDA_NO_INDEX) || (b->max > a->max) ||
+         ((b->max == a->max) && (b->maxIndex < a->maxIndex)))) {
+        a->max = b->max;
+        a->maxIndex = b->maxIndex;
+    }
+    a->total      += b->total;
+    a->sumSquares += b->sumSquares;
+    a->sum        += b->sum;
+    a->thresh     += b->thresh;
+    a->M11        += b->M11;
+    a->histBelow  += b->histBelow;
+    a->histAbove  += b->histAbove;
+}
+
+/* Reduces one row of a chunk with one block.  The column profiles and the histogram are added atomically, the
+ * results of the row are written to pRows[firstRow + blockIdx.x]. */
+template <typename epicsType>
+__global__ void statsKernel(const epicsType *pData, size_t sizeX, size_t firstRow, statsParams_t p,
+                            rowResult_t *pRows, double *pProfileX, double *pThreshX, unsigned int *pHistogram)
+{
+    __shared__ rowResult_t partial[ND_CUDA_THREADS];
+    __shared__ unsigned int bins[ND_CUDA_SHARED_BINS];
+    const epicsType *pRow = pData + blockIdx.x*sizeX;
+    size_t iy = firstRow + blockIdx.x, ix;
+    rowResult_t r;
+    double value, delta;
+    int bin, i, stride;
+
+    if (p.sharedBins) {
+        for (i=threadIdx.x; i<p.histSize; i+=blockDim.x) bins[i] = 0;
+        __syncthreads();
+    }
+    memset(&r, 0, sizeof(r));
+    r.minIndex = r.maxIndex = ND_CUDA_NO_INDEX;
+    for (ix=threadIdx.x; ix<sizeX; ix+=blockDim.x) {
+        value = (double)pRow[ix];
+        if (p.computeStatistics) {
+            /* The elements of a thread are in order, so strict comparisons keep the first occurrence */
+            if ((r.minIndex == ND_CUDA_NO_INDEX) || (value < r.min)) {
+                r.min = value;
+                r.minIndex = iy*sizeX + ix;
+            }
+            if ((r.maxIndex == ND_CUDA_NO_INDEX) || (value > r.max)) {
+                r.max = value;
+                r.maxIndex = iy*sizeX + ix;
+            }
+            delta = value - p.shift;
+            r.total += delta;
+            r.sumSquares += delta * delta;
+        }
+        if (p.computeCentroid) {
+            atomicAdd(&pProfileX[ix], value);
+            r.sum += value;
+            if (value >= p.centroidThreshold) {
+                atomicAdd(&pThreshX[ix], value);
+                r.thresh += value;
+                r.M11 += value * ix * iy;
+            }
+        }
+        if (p.computeHistogram) {
+            bin = (int)(((value - p.histMin) * p.histScale) + 0.5);
+            if ((bin < 0) || (value < p.histMin))
+                r.histBelow++;
+            else if ((bin > p.histSize-1) || (value > p.histMax))
+                r.histAbove++;
+            else if (p.sharedBins)
+                atomicAdd(&bins[bin], 1u);
+            else
+                atomicAdd(&pHistogram[bin], 1u);
+        }
+    }
+    partial[threadIdx.x] = r;
+    __syncthreads();
+    for (stride=blockDim.x/2; stride>0; stride/=2) {
+        if ((int)threadIdx.x < stride) combineRows(&partial[threadIdx.x], &partial[threadIdx.x + stride]);
+        __syncthreads();
+    }
+    if (threadIdx.x == 0) pRows[iy] = partial[0];
+    if (p.sharedBins) {
+        for (i=threadIdx.x; i<p.histSize; i+=blockDim.x) {
+            if (bins[i]) atomicAdd(&pHistogram[i], bins[i]);
+        }
+    }
+}
+
+static void launchStats(NDDataType_t dataType, cudaStream_t stream, const void *pData, size_t sizeX,
+                        size_t firstRow, size_t numRows, const statsParams_t& p, rowResult_t *pRows,
+                        double *pProfileX, double *pThreshX, unsigned int *pHistogram)
+{
+    unsigned int blocks = (unsigned int)numRows;
+
+    switch (dataType) {
+        case NDInt8:
+            statsKernel<epicsInt8><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsInt8 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDUInt8:
+            statsKernel<epicsUInt8><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsUInt8 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDInt16:
+            statsKernel<epicsInt16><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsInt16 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDUInt16:
+            statsKernel<epicsUInt16><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsUInt16 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDInt32:
+            statsKernel<epicsInt32><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsInt32 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDUInt32:
+            statsKernel<epicsUInt32><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsUInt32 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDFloat32:
+            statsKernel<epicsFloat32><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsFloat32 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        case NDFloat64:
+            statsKernel<epicsFloat64><<<blocks, ND_CUDA_THREADS, 0, stream>>>((const epicsFloat64 *)pData, sizeX,
+                firstRow, p, pRows, pProfileX, pThreshX, pHistogram);
+            break;
+        default:
+            break;
+    }
+}
+
+/** Computes the statistics, centroid sums and histogram of NDPluginStats that are enabled for a 1-D or 2-D array.
+  * \param[in] pContext The context.
+  * \param[in] pArgs The quantities to compute.
+  * \param[in] dataType The type of the elements.
+  * \param[in] pData The elements.
+  * \param[in] sizeX The number of elements of a row.
+  * \param[in] sizeY The number of rows.
+  * \param[in,out] pResult The results; the profiles and the histogram are added to.
+  * \return ND_SUCCESS, or ND_ERROR with the reason in NDCudaError(). */
+int NDCudaStats(NDCudaContext_t *pContext, const NDCudaStatsArgs_t *pArgs, NDDataType_t dataType,
+                const void *pData, size_t sizeX, size_t sizeY, NDCudaStatsResult_t *pResult)
+{
+    size_t bytes = dataTypeSize(dataType), rowBytes = sizeX * bytes;
+    size_t rowsPerChunk, firstRow, numRows, iy, ix, i;
+    size_t histSize = pArgs->computeHistogram ? pArgs->histSize : 0;
+    size_t profileSize = pArgs->computeCentroid ? sizeX : 0;
+    size_t statsBytes = sizeY*sizeof(rowResult_t) + 2*profileSize*sizeof(double) + histSize*sizeof(unsigned int);
+    rowResult_t *pRows, *dRows, total;
+    double *dProfileX, *dThreshX, *pProfileX, *pThreshX;
+    unsigned int *dHistogram, *pHistogram;
+    int pinned, s, chunkIndex;
+    cudaError_t status;
+    statsParams_t p;
+
+    if ((bytes == 0) || (sizeX == 0) || (sizeY == 0)) {
+        epicsSnprintf(pContext->error, sizeof(pContext->error), "Unsupported array");
+        return ND_ERROR;
+    }
+    if (!checkCuda(pContext, cudaSetDevice(pContext->device), "cudaSetDevice") ||
+        !checkCuda(pContext, ensureStaging(pContext, (rowBytes > ND_CUDA_CHUNK_BYTES) ? rowBytes :
+                                                      ND_CUDA_CHUNK_BYTES), "cudaHostAlloc")) return ND_ERROR;
+    if (pContext->statsBytes < statsBytes) {
+        cudaFree(pContext->dStats);
+        cudaFreeHost(pContext->hStats);
+        pContext->dStats = pContext->hStats = NULL;
+        pContext->statsBytes = 0;
+        if (!checkCuda(pContext, cudaMalloc(&pContext->dStats, statsBytes), "cudaMalloc") ||
+            !checkCuda(pContext, cudaHostAlloc(&pContext->hStats, statsBytes, cudaHostAllocDefault),
+                       "cudaHostAlloc")) return ND_ERROR;
+        pContext->statsBytes = statsBytes;
+    }
+    /* The results are laid out the same way on the device and in the pinned copy on the host */
+    dRows = (rowResult_t *)pContext->dStats;
+    dProfileX = (double *)(dRows + sizeY);
+    dThreshX = dProfileX + profileSize;
+    dHistogram = (unsigned int *)(dThreshX + profileSize);
+    pRows = (rowResult_t *)pContext->hStats;
+    pProfileX = (double *)(pRows + sizeY);
+    pThreshX = pProfileX + profileSize;
+    pHistogram = (unsigned int *)(pThreshX + profileSize);
+
+    p.computeStatistics = pArgs->computeStatistics;
+    p.computeCentroid   = pArgs->computeCentroid;
+    p.computeHistogram  = pArgs->computeHistogram;
+    p.shift             = pArgs->shift;
+    p.centroidThreshold = pArgs->centroidThreshold;
+    p.histMin   = pArgs->histMin;
+    p.histMax   = pArgs->histMax;
+    p.histScale = histSize ? histSize / (pArgs->histMax - pArgs->histMin) : 0.;
+    p.histSize  = (int)histSize;
+    p.sharedBins = (histSize > 0) && (histSize <= ND_CUDA_SHARED_BINS);
+
+    /* The sums in the results start at 0 */
+    status = cudaMemsetAsync(dProfileX, 0, statsBytes - sizeY*sizeof(rowResult_t), pContext->streams[0]);
+    if (status == cudaSuccess) status = cudaStreamSynchronize(pContext->streams[0]);
+    pinned = isPinned(pData);
+    rowsPerChunk = (rowBytes >= ND_CUDA_CHUNK_BYTES) ? 1 : ND_CUDA_CHUNK_BYTES / rowBytes;
+    for (firstRow=0, chunkIndex=0; (firstRow<sizeY) && (status == cudaSuccess); firstRow+=numRows, chunkIndex++) {
+        numRows = (sizeY - firstRow > rowsPerChunk) ? rowsPerChunk : sizeY - firstRow;
+        s = chunkIndex % ND_CUDA_STREAMS;
+        status = finishStream(pContext, s);
+        if (status == cudaSuccess)
+            status = upload(pContext, s, pContext->dIn[s], (const char *)pData + firstRow*rowBytes,
+                            numRows*rowBytes, pinned);
+        if (status != cudaSuccess) break;
+        launchStats(dataType, pContext->streams[s], pContext->dIn[s], sizeX, firstRow, numRows, p, dRows,
+                    dProfileX, dThreshX, dHistogram);
+        status = cudaGetLastError();
+    }
+    for (s=0; s<ND_CUDA_STREAMS; s++) {
+        cudaError_t streamStatus = finishStream(pContext, s);
+        if (status == cudaSuccess) status = streamStatus;
+    }
+    if (status == cudaSuccess) status = cudaMemcpy(pContext->hStats, pContext->dStats, statsBytes,
+                                                   cudaMemcpyDeviceToHost);
+    if (!checkCuda(pContext, status, "NDCudaStats")) return ND_ERROR;
+
+    /* The rows are combined in order, as the stripes are in doComputeFusedT() */
+    total = pRows[0];
+    for (iy=0; iy<sizeY; iy++) {
+        if (iy > 0) {
+            if (pRows[iy].min < total.min) {
+                total.min = pRows[iy].min;
+                total.minIndex = pRows[iy].minIndex;
+            }
+            if (pRows[iy].max > total.max) {
+                total.max = pRows[iy].max;
+                total.maxIndex = pRows[iy].maxIndex;
+            }
+            total.total      += pRows[iy].total;
+            total.sumSquares += pRows[iy].sumSquares;
+            total.M11        += pRows[iy].M11;
+            total.histBelow  += pRows[iy].histBelow;
+            total.histAbove  += pRows[iy].histAbove;
+        }
+        if (pArgs->computeCentroid) {
+            pResult->profileY[iy] += pRows[iy].sum;
+            pResult->threshY[iy]  += pRows[iy].thresh;
+        }
+    }
+    pResult->min        = total.min;
+    pResult->minIndex   = (size_t)total.minIndex;
+    pResult->max        = total.max;
+    pResult->maxIndex   = (size_t)total.maxIndex;
+    pResult->total      = total.total;
+    pResult->sumSquares = total.sumSquares;
+    pResult->M11        = total.M11;
+    pResult->histBelow  = (epicsInt32)total.histBelow;
+    pResult->histAbove  = (epicsInt32)total.histAbove;
+    for (ix=0; ix<profileSize; ix++) {
+        pResult->profileX[ix] += pProfileX[ix];
+        pResult->threshX[ix]  += pThreshX[ix];
+    }
+    for (i=0; i<histSize; i++) pResult->histogram[i] += pHistogram[i];
+    return ND_SUCCESS;
+}
+
+/* Pinned host memory for the NDArrayPool of a plugin, so that its arrays are copied to and from the device
+ * without staging */
+class NDCudaPinnedProvider : public NDMemoryProvider {
+public:
+    void* allocate(size_t size)
+    {
+        void *pData;
+        if (cudaHostAlloc(&pData, size, cudaHostAllocPortable) != cudaSuccess) {
+            cudaGetLastError();
+            return NULL;
+        }
+        return pData;
+    }
+    void free(void *pData, size_t size)
+    {
+        cudaFreeHost(pData);
+    }
+    const char* name()
+    {
+        return "CUDA pinned";
+    }
+};
+
+/** Returns a memory provider of pinned host memory, which can be shared by any number of pools */
+NDMemoryProvider* NDCudaPinnedMemory()
+{
+    static NDCudaPinnedProvider provider;
+    return &provider;
+}
+
+/* The memory of a CUDA device for the NDArrayPool of the device arrays of NDPluginDevice.  The streams do not
+ * synchronize with the default stream, which is only used for the copies that NDArrayPool::copy() waits for. */
+class NDCudaDeviceProvider : public NDDeviceMemory {
+public:
+    NDCudaDeviceProvider(int device) : device_(device)
+    {
+        epicsSnprintf(name_, sizeof(name_), "CUDA device %d", device);
+    }
+    void* allocate(size_t size)
+    {
+        void *pData;
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return NULL;
+        if (cudaMalloc(&pData, size) != cudaSuccess) {
+            cudaGetLastError();
+            return NULL;
+        }
+        return pData;
+    }
+    void free(void *pData, size_t size)
+    {
+        cudaSetDevice(device_);
+        cudaFree(pData);
+    }
+    const char* name()
+    {
+        return name_;
+    }
+    void* createStream()
+    {
+        cudaStream_t stream;
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return NULL;
+        if (!check(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), "cudaStreamCreate")) return NULL;
+        return stream;
+    }
+    void destroyStream(void *stream)
+    {
+        cudaSetDevice(device_);
+        cudaStreamSynchronize((cudaStream_t)stream);
+        cudaStreamDestroy((cudaStream_t)stream);
+    }
+    int toDevice(void *pDevice, const void *pHost, size_t size, void *stream)
+    {
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return ND_ERROR;
+        return check(cudaMemcpyAsync(pDevice, pHost, size, cudaMemcpyHostToDevice, (cudaStream_t)stream),
+                     "cudaMemcpyAsync to the device") ? ND_SUCCESS : ND_ERROR;
+    }
+    int toHost(void *pHost, const void *pDevice, size_t size, void *stream)
+    {
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return ND_ERROR;
+        if (!check(cudaMemcpyAsync(pHost, pDevice, size, cudaMemcpyDeviceToHost, (cudaStream_t)stream),
+                   "cudaMemcpyAsync to the host")) return ND_ERROR;
+        return synchronize(stream);
+    }
+    int copyDevice(void *pTo, const void *pFrom, size_t size, void *stream)
+    {
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return ND_ERROR;
+        return check(cudaMemcpyAsync(pTo, pFrom, size, cudaMemcpyDeviceToDevice, (cudaStream_t)stream),
+                     "cudaMemcpyAsync on the device") ? ND_SUCCESS : ND_ERROR;
+    }
+    int waitStream(void *stream, void *otherStream)
+    {
+        cudaEvent_t event;
+        int status;
+
+        if (!otherStream || (otherStream == stream)) return ND_SUCCESS;
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return ND_ERROR;
+        if (!check(cudaEventCreateWithFlags(&event, cudaEventDisableTiming), "cudaEventCreate")) return ND_ERROR;
+        status = check(cudaEventRecord(event, (cudaStream_t)otherStream), "cudaEventRecord") &&
+                 check(cudaStreamWaitEvent((cudaStream_t)stream, event, 0), "cudaStreamWaitEvent");
+        /* The event is freed once the stream has waited for it */
+        cudaEventDestroy(event);
+        return status ? ND_SUCCESS : ND_ERROR;
+    }
+    int synchronize(void *stream)
+    {
+        if (!check(cudaSetDevice(device_), "cudaSetDevice")) return ND_ERROR;
+        return check(cudaStreamSynchronize((cudaStream_t)stream), "cudaStreamSynchronize") ? ND_SUCCESS : ND_ERROR;
+    }
+
+private:
+    /* Prints the error of a CUDA call; returns 1 if it succeeded */
+    int check(cudaError_t status, const char *what)
+    {
+        if (status == cudaSuccess) return 1;
+        fprintf(stderr, "%s: %s: %s\n", name_, what, cudaGetErrorString(status));
+        return 0;
+    }
+
+    int device_;
+    char name_[32];
+};
+
+/** Returns the memory provider of a CUDA device, which can be shared by any number of pools, or NULL if there
+  * is no such device.  This is called from the IOC startup script. */
+NDDeviceMemory* NDCudaDeviceMemory(int device)
+{
+    static NDCudaDeviceProvider *providers[ND_CUDA_MAX_DEVICES];
+    int numDevices;
+
+    if ((device < 0) || (device >= ND_CUDA_MAX_DEVICES)) return NULL;
+    if ((cudaGetDeviceCount(&numDevices) != cudaSuccess) || (device >= numDevices)) {
+        cudaGetLastError();
+        return NULL;
+    }
+    if (!providers[device]) providers[device] = new NDCudaDeviceProvider(device);
+    return providers[device];
+}
@@ -0,0 +1,92 @@
+/** NDCudaKernels.h
+ *
+ * CUDA kernels for the corrections and the recursive filter of NDPluginProcess and for the fused statistics,
+ * centroid and histogram pass of NDPluginStats.  They are only built when WITH_CUDA=YES, which defines
+ * ND_WITH_CUDA for the plugins.
+ * Each plugin has its own context, with its streams and the arrays it keeps on the device: the background,
+ * gain and bias maps and the filter of NDPluginProcess stay there between frames, so only the frames are copied.
+ * NDCudaDeviceMemory() is the memory of a device for the device-resident arrays of NDPluginDevice.
+ *
+ */
+
+#ifndef NDCudaKernels_H
+#define NDCudaKernels_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+#include "NDMemoryProvider.h"
+#include "NDProcessKernels.h"
+
+/** A CUDA device and the streams and device arrays of one plugin */
+typedef struct NDCudaContext NDCudaContext_t;
+
+/** The processing of NDCudaProcess(), which is that of processStripeT() in NDPluginProcess.cpp in Float32 */
+typedef struct {
+    NDProcessCorrection_t correction;   /**< The corrections, with the maps of NDCudaProcessMaps() */
+    int    enableFilter;        /**< Apply the recursive filter, whose state is kept on the device */
+    int    initFilter;          /**< Set the filter to the processed input before it is reset */
+    int    resetFilter;         /**< Reset the filter */
+    double rOffset, rc1, rc2;   /**< The reset of the filter */
+    double oOffset, O1, O2;     /**< The output of the filter */
+    double fOffset, F1, F2;     /**< The new filter */
+} NDCudaProcessArgs_t;
+
+/** The quantities NDCudaStats() computes */
+typedef struct {
+    int    computeStatistics;
+    int    computeCentroid;
+    int    computeHistogram;
+    double shift;               /**< Subtracted from the elements for the sums of squares, from NDStatsShift() */
+    double centroidThreshold;
+    double histMin;
+    double histMax;
+    size_t histSize;
+} NDCudaStatsArgs_t;
+
+/** The results of NDCudaStats().  The profiles and the histogram are added to the arrays they point to. */
+typedef struct {
+    double min;
+    size_t minIndex;            /**< The first element with the minimum */
+    double max;
+    size_t maxIndex;            /**< The first element with the maximum */
+    double total;
+    double sumSquares;          /**< The sum of the squares of the shifted elements */
+    double M11;
+    double *profileX;           /**< Column sums, sizeX elements */
+    double *threshX;            /**< Column sums of the elements at or above the threshold */
+    double *profileY;           /**< Row sums, sizeY elements */
+    double *threshY;            /**< Row sums of the elements at or above the threshold */
+    double *histogram;          /**< Bin counts, histSize elements */
+    epicsInt32 histBelow;
+    epicsInt32 histAbove;
+} NDCudaStatsResult_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc NDCudaContext_t* NDCudaCreate(int device, char *pError, size_t errorSize);
+epicsShareFunc void NDCudaDestroy(NDCudaContext_t *pContext);
+epicsShareFunc const char* NDCudaError(NDCudaContext_t *pContext);
+epicsShareFunc int NDCudaProcessMaps(NDCudaContext_t *pContext, int generation, const float *pBackground,
+                                     const float *pGain, const float *pBias, size_t nElements);
+epicsShareFunc int NDCudaProcessSetFilter(NDCudaContext_t *pContext, const float *pFilter, size_t nElements);
+epicsShareFunc int NDCudaProcessGetFilter(NDCudaContext_t *pContext, float *pFilter, size_t nElements);
+epicsShareFunc int NDCudaProcess(NDCudaContext_t *pContext, const NDCudaProcessArgs_t *pArgs,
+                                 NDDataType_t inType, const void *pIn, NDDataType_t outType, void *pOut,
+                                 size_t nElements);
+epicsShareFunc int NDCudaStats(NDCudaContext_t *pContext, const NDCudaStatsArgs_t *pArgs, NDDataType_t dataType,
+                               const void *pData, size_t sizeX, size_t sizeY, NDCudaStatsResult_t *pResult);
+
+#ifdef __cplusplus
+}
+
+epicsShareFunc NDMemoryProvider* NDCudaPinnedMemory();
+epicsShareFunc NDDeviceMemory* NDCudaDeviceMemory(int device);
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+/** NDDecimationKernels.cpp
+ *
+ * Min/max envelope and Largest-Triangle-Three-Buckets decimation.  Both split the points into buckets of equal
+ * numbers of points, bucket b holding the points b*nIn/nBuckets to (b+1)*nIn/nBuckets-1, and read every point
+ * once.  LTTB keeps the first and the last point and, in each bucket between them, the point that forms the
+ * largest triangle with the point kept in the previous bucket and the average of the next bucket (Steinarsson,
+ * "Downsampling Time Series for Visual Representation", 2013).
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <epicsMath.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDDecimationKernels.h"
+
+/** Writes the minimum and the maximum of each bucket of points, in the order they occur in the bucket, so the
+  * output of a series that only increases, such as the unique IDs, is the first and the last point of each bucket.
+  * A bucket of NaN values gives two NaN values.
+  * \param[in] pIn The points.
+  * \param[in] nIn The number of points.
+  * \param[in] nBuckets The number of buckets; pOut must hold 2*nBuckets values.
+  * \param[out] pOut The decimated points.
+  * \return The number of points written, 2*nBuckets, or nIn if the points are copied because nIn <= 2*nBuckets.
+  */
+size_t NDDecimateMinMax(const double *pIn, size_t nIn, size_t nBuckets, double *pOut)
+{
+  size_t bucket, i;
+
+  if (nIn <= 2*nBuckets) {
+    if (nIn) memcpy(pOut, pIn, nIn*sizeof(double));
+    return nIn;
+  }
+  for (bucket=0; bucket<nBuckets; bucket++) {
+    size_t first = bucket*nIn/nBuckets, end = (bucket + 1)*nIn/nBuckets;
+    size_t iMin = end, iMax = end;
+    for (i=first; i<end; i++) {
+      double value = pIn[i];
+      if (isnan(value)) continue;
+      if ((iMin == end) || (value < pIn[iMin])) iMin = i;
+      if ((iMax == end) || (value > pIn[iMax])) iMax = i;
+    }
+    if (iMin == end) {
+      pOut[2*bucket] = epicsNAN;
+      pOut[2*bucket + 1] = epicsNAN;
+    } else if (iMin <= iMax) {
+      pOut[2*bucket] = pIn[iMin];
+      pOut[2*bucket + 1] = pIn[iMax];
+    } else {
+      pOut[2*bucket] = pIn[iMax];
+      pOut[2*bucket + 1] = pIn[iMin];
+    }
+  }
+  return 2*nBuckets;
+}
+
+/** Selects the points of a curve to plot with the Largest-Triangle-Three-Buckets algorithm.
+  * \param[in] pX The X values of the points, or NULL to use the indices.
+  * \param[in] pY The Y values of the points.  In a bucket whose values are all NaN the first point is kept.
+  * \param[in] nIn The number of points.
+  * \param[in] nOut The number of points to select; the first and the last point are always selected.
+  * \param[out] pIndices The increasing indices of the selected points; it must hold nOut values.
+  * \return The number of indices written, the smaller of nIn and nOut.
+  */
+size_t NDDecimateLTTB(const double *pX, const double *pY, size_t nIn, size_t nOut, size_t *pIndices)
+{
+  size_t nBuckets, bucket, i, kept = 0;
+
+  if (nIn <= nOut) {
+    for (i=0; i<nIn; i++) pIndices[i] = i;
+    return nIn;
+  }
+  if (nOut < 3) {
+    if (nOut > 0) pIndices[0] = 0;
+    if (nOut > 1) pIndices[1] = nIn - 1;
+    return nOut;
+  }
+  // The first and the last point are buckets of their own
+  nBuckets = nOut - 2;
+  pIndices[0] = 0;
+  for (bucket=0; bucket<nBuckets; bucket++) {
+    size_t first = 1 + bucket*(nIn - 2)/nBuckets, end = 1 + (bucket + 1)*(nIn - 2)/nBuckets;
+    size_t nextFirst = end, nextEnd = (bucket + 1 < nBuckets) ? 1 + (bucket + 2)*(nIn - 2)/nBuckets : nIn;
+    double xKept = pX ? pX[kept] : (double)kept, yKept = pY[kept];
+    double xNext = 0., yNext = 0., maxArea = -1.;
+    size_t nNext = 0, best = first;
+    for (i=nextFirst; i<nextEnd; i++) {
+      if (isnan(pY[i])) continue;
+      xNext += pX ? pX[i] : (double)i;
+      yNext += pY[i];
+      nNext++;
+    }
+    if (nNext) {
+      xNext /= nNext;
+      yNext /= nNext;
+    } else {
+      xNext = pX ? pX[nextEnd - 1] : (double)(nextEnd - 1);
+      yNext = pY[nextEnd - 1];
+    }
+    for (i=first; i<end; i++) {
+      double x = pX ? pX[i] : (double)i;
+      // Twice the area of the triangle; NaN areas are never larger
+      double area = fabs((xKept - xNext)*(pY[i] - yKept) - (xKept - x)*(yNext - yKept));
+      if (area > maxArea) {
+        maxArea = area;
+        best = i;
+      }
+    }
+    pIndices[bucket + 1] = best;
+    kept = best;
+  }
+  pIndices[nOut - 1] = nIn - 1;
+  return nOut;
+}
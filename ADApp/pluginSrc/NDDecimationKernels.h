@@ -0,0 +1,30 @@
+/** NDDecimationKernels.h
+ *
+ * Display decimation of long series of points for NDPluginAttrPlot.  NDDecimateMinMax() keeps the envelope of a
+ * series, the minimum and the maximum of each of a number of equal buckets of points, in the order they occur.
+ * NDDecimateLTTB() selects the points that keep the shape of a curve with the Largest-Triangle-Three-Buckets
+ * algorithm and returns their indices, so that the same points can be taken from the other series of a plot.
+ * NaN values, which are missing points, are skipped by both.
+ *
+ */
+
+#ifndef NDDecimationKernels_H
+#define NDDecimationKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc size_t NDDecimateMinMax(const double *pIn, size_t nIn, size_t nBuckets, double *pOut);
+epicsShareFunc size_t NDDecimateLTTB(const double *pX, const double *pY, size_t nIn, size_t nOut,
+                                     size_t *pIndices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
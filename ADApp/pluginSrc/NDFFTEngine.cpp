@@ -0,0 +1,926 @@
+/** NDFFTEngine.cpp
+ *
+ * Plan-based complex FFTs for NDPluginFFT.
+ * The built-in FFT is a recursive split-radix decimation in time: a transform of n points is the transform of
+ * the n/2 even points and the transforms of the n/4 points at 1 and 3 modulo 4, combined with the twiddle
+ * factors w^k and w^3k.  This needs fewer multiplications than radix 2 or radix 4, and the twiddle factors are
+ * computed once per dimension by the plan instead of by a recurrence in each transform, which is also more
+ * accurate.  Other lengths are decimated by their odd prime factors p: the transform is the combination of the
+ * transforms of the points at each r modulo p, which for each output is a transform of p points, computed
+ * directly for the small primes and with Bluestein's algorithm, a convolution computed with FFTs of a power of
+ * 2, for the large ones.  Each line of a multi-dimensional array is transformed into a buffer and copied back;
+ * the lines of the later dimensions are columns, so they are copied in transposed tiles of adjacent lines.
+ * The transform of n real points is the complex transform of the n/2 pairs of points, whose even and odd parts
+ * are the transforms of the even and odd points, combined with the twiddle factors w^k.  Only the n/2+1 values
+ * that are not complex conjugates of others are computed, then the other dimensions of those values.
+ *
+ * The Welch estimator copies the stream into a ring buffer of one segment.  Once the ring is full, a segment is
+ * added every hop = length - overlap points; it is the ring from its oldest point, where the next point goes.
+ *
+ * With ND_WITH_FFTW the plans are FFTW plans for unaligned in-place arrays, executed with fftw_execute_dft(),
+ * which FFTW allows from any thread.  The FFTW planner is not thread safe, so plans are only created and
+ * destroyed with the cache lock held.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <NDAttribute.h>
+
+#ifdef ND_WITH_FFTW
+  #include <fftw3.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDFFTEngine.h"
+
+/* Some systems do not define M_PI in math.h */
+#ifndef M_PI
+  #define M_PI 3.14159265358979323846
+#endif
+
+#ifndef ND_WITH_FFTW
+
+#define MAX_FACTORS 41      /* 3^41 is above the largest size_t */
+#define MAX_DIRECT  64      /* The largest prime factor transformed directly, as a sum of p terms per point */
+#define TILE_LINES  8       /* The lines of the dimensions after the first that are transformed together */
+
+#define SIN_PI_3  0.86602540378443864676
+#define COS_2PI_5 0.30901699437494742410
+#define COS_4PI_5 -0.80901699437494742410
+#define SIN_2PI_5 0.95105651629515357212
+#define SIN_4PI_5 0.58778525229247312917
+
+/* Bluestein's algorithm for a prime length n: with c_k = exp(-pi i k^2/n), X_k = c_k times the convolution of
+ * x_j c_j with conj(c_j) */
+typedef struct {
+  size_t n;
+  size_t m;                         /* The power of 2 of the convolution, at least 2n-1 */
+  double *pChirp;                   /* c_k for k < n */
+  double *pFilter;                  /* The FFT of conj(c_j) for -n < j < n over m points, divided by m */
+  double *pTwiddles;                /* exp(-2 pi i k/m) for k < m */
+} bluestein_t;
+
+#endif
+
+struct NDFFTPlan {
+  int rank;
+  size_t dims[ND_FFT_MAX_RANK];     /* dims[0] varies fastest */
+  int isReal;                       /* The input is dims real values, the output (dims[0]/2+1) x ... complex */
+  size_t nElements;                 /* The complex elements of the transform */
+  int refs;                         /* The arrays using the plan, and 1 while it is in the cache */
+  struct NDFFTPlan *pNext;          /* The next plan of the cache, in order of use */
+#ifdef ND_WITH_FFTW
+  fftw_plan forward;                /* The plan with exp(-2 pi i jk/n), for isign = -1, or the real plan */
+  fftw_plan backward;               /* The plan with exp(+2 pi i jk/n), for isign = 1 */
+#else
+  double *twiddles[ND_FFT_MAX_RANK];  /* exp(-2 pi i k/n) for k < n, as real and imaginary parts */
+  size_t factors[ND_FFT_MAX_RANK][MAX_FACTORS + 1];  /* The odd prime factors of the dimensions, then 0 */
+  bluestein_t *pBluestein;          /* The prime factors above MAX_DIRECT */
+  int nBluestein;
+  size_t maxDim;
+  size_t maxPrime;                  /* The largest odd prime factor */
+  size_t maxConvolution;            /* The largest m of the Bluestein transforms */
+#endif
+};
+
+static epicsThreadOnceId planOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId planLock;      /* Protects the cache, the reference counts and the FFTW planner */
+static NDFFTPlan_t *pPlans = 0;
+
+static void planInit(void *)
+{
+  planLock = epicsMutexMustCreate();
+}
+
+#ifndef ND_WITH_FFTW
+
+/* Transforms n points of pIn, stride complex elements apart, into pOut.  tw is the step in the twiddle table of
+ * the dimension for a transform of n points. */
+static void splitRadix(const double *pW, const double *pIn, size_t stride, double *pOut, size_t n, size_t tw,
+                       int isign)
+{
+  size_t q, k;
+
+  if (n == 1) {
+    pOut[0] = pIn[0];
+    pOut[1] = pIn[1];
+    return;
+  }
+  if (n == 2) {
+    double re = pIn[2*stride], im = pIn[2*stride + 1];
+    pOut[0] = pIn[0] + re;
+    pOut[1] = pIn[1] + im;
+    pOut[2] = pIn[0] - re;
+    pOut[3] = pIn[1] - im;
+    return;
+  }
+  if (n == 4) {
+    /* The twiddle factors are 1 and -i or i */
+    const double *p1 = pIn + 2*stride, *p2 = pIn + 4*stride, *p3 = pIn + 6*stride;
+    double ar = pIn[0] + p2[0], ai = pIn[1] + p2[1], br = pIn[0] - p2[0], bi = pIn[1] - p2[1];
+    double cr = p1[0] + p3[0], ci = p1[1] + p3[1], dr = p1[0] - p3[0], di = p1[1] - p3[1];
+    double sign = (isign > 0) ? 1. : -1.;
+    pOut[0] = ar + cr;
+    pOut[1] = ai + ci;
+    pOut[4] = ar - cr;
+    pOut[5] = ai - ci;
+    /* X1 = b + i d for exp(+...), b - i d for exp(-...) */
+    pOut[2] = br - sign*di;
+    pOut[3] = bi + sign*dr;
+    pOut[6] = br + sign*di;
+    pOut[7] = bi - sign*dr;
+    return;
+  }
+  q = n/4;
+  splitRadix(pW, pIn, 2*stride, pOut, n/2, 2*tw, isign);
+  splitRadix(pW, pIn + 2*stride, 4*stride, pOut + n, q, 4*tw, isign);
+  splitRadix(pW, pIn + 6*stride, 4*stride, pOut + 3*n/2, q, 4*tw, isign);
+  /* The sign of the imaginary part of the twiddle factors is the sign of the exponent */
+  double sign = (isign > 0) ? -1. : 1.;
+  for (k=0; k<q; k++) {
+    double w1r = pW[2*k*tw], w1i = sign*pW[2*k*tw + 1];
+    double w3r = pW[6*k*tw], w3i = sign*pW[6*k*tw + 1];
+    double *p0 = pOut + 2*k, *p1 = p0 + n/2, *p2 = p0 + n, *p3 = p0 + 3*n/2;
+    double z1r = w1r*p2[0] - w1i*p2[1], z1i = w1r*p2[1] + w1i*p2[0];
+    double z3r = w3r*p3[0] - w3i*p3[1], z3i = w3r*p3[1] + w3i*p3[0];
+    double sr = z1r + z3r, si = z1i + z3i;
+    /* i (z1 - z3) for exp(+...), -i (z1 - z3) for exp(-...) */
+    double dr = -sign*(z1i - z3i), di = sign*(z1r - z3r);
+    double u0r = p0[0], u0i = p0[1], u1r = p1[0], u1i = p1[1];
+    p0[0] = u0r + sr;
+    p0[1] = u0i + si;
+    p2[0] = u0r - sr;
+    p2[1] = u0i - si;
+    p1[0] = u1r - dr;
+    p1[1] = u1i - di;
+    p3[0] = u1r + dr;
+    p3[1] = u1i + di;
+  }
+}
+
+/* What the transforms of the lines of a dimension use */
+typedef struct {
+  const NDFFTPlan_t *pPlan;
+  const double *pW;                 /* The twiddle factors of the dimension */
+  double *pCombine;                 /* The p points of a radix p */
+  double *pConvolution;             /* The 2 arrays of m points of a Bluestein transform */
+  int isign;
+} fftLine_t;
+
+/* Transforms in place n contiguous points, n a prime with a Bluestein transform in the plan */
+static void bluestein(const fftLine_t *pL, double *pData, size_t n)
+{
+  const bluestein_t *pB = pL->pPlan->pBluestein;
+  double *pA = pL->pConvolution, *pC;
+  /* The transform with exp(+...) is the conjugate of the one with exp(-...) of the conjugate points */
+  double sign = (pL->isign > 0) ? -1. : 1.;
+  size_t k, m;
+
+  while (pB->n != n) pB++;
+  m = pB->m;
+  pC = pA + 2*m;
+  for (k=0; k<n; k++) {
+    double xr = pData[2*k], xi = sign*pData[2*k + 1], cr = pB->pChirp[2*k], ci = pB->pChirp[2*k + 1];
+    pA[2*k]     = xr*cr - xi*ci;
+    pA[2*k + 1] = xr*ci + xi*cr;
+  }
+  memset(pA + 2*n, 0, 2*(m - n)*sizeof(double));
+  splitRadix(pB->pTwiddles, pA, 1, pC, m, 1, -1);
+  for (k=0; k<m; k++) {
+    double ar = pC[2*k], ai = pC[2*k + 1], fr = pB->pFilter[2*k], fi = pB->pFilter[2*k + 1];
+    pC[2*k]     = ar*fr - ai*fi;
+    pC[2*k + 1] = ar*fi + ai*fr;
+  }
+  splitRadix(pB->pTwiddles, pC, 1, pA, m, 1, 1);
+  for (k=0; k<n; k++) {
+    double ar = pA[2*k], ai = pA[2*k + 1], cr = pB->pChirp[2*k], ci = pB->pChirp[2*k + 1];
+    pData[2*k]     = ar*cr - ai*ci;
+    pData[2*k + 1] = sign*(ar*ci + ai*cr);
+  }
+}
+
+/* Transforms n points of pIn, stride complex elements apart, into pOut, decimating by the odd prime factors from
+ * pFactors, then with the split-radix FFT.  tw is the step in the twiddle table for a transform of n points. */
+static void mixedRadix(const fftLine_t *pL, const size_t *pFactors, const double *pIn, size_t stride,
+                       double *pOut, size_t n, size_t tw)
+{
+  const double *pW = pL->pW;
+  double *pT = pL->pCombine;
+  size_t p = pFactors[0], m, r, q, k;
+  double sign = (pL->isign > 0) ? -1. : 1.;
+
+  if (p == 0) {
+    splitRadix(pW, pIn, stride, pOut, n, tw, pL->isign);
+    return;
+  }
+  m = n/p;
+  /* Y_r, the transforms of the points at r modulo p, are at pOut + r*m */
+  for (r=0; r<p; r++) {
+    mixedRadix(pL, pFactors + 1, pIn + 2*r*stride, p*stride, pOut + 2*r*m, m, p*tw);
+  }
+  /* X_k+qm is the transform of the p points w^rk Y_r(k), w^rk being twiddles[rk*tw] */
+  for (k=0; k<m; k++) {
+    for (r=0; r<p; r++) {
+      const double *pY = pOut + 2*(r*m + k), *pWr = pW + 2*r*k*tw;
+      double wr = pWr[0], wi = sign*pWr[1];
+      pT[2*r]     = wr*pY[0] - wi*pY[1];
+      pT[2*r + 1] = wr*pY[1] + wi*pY[0];
+    }
+    double *p0 = pOut + 2*k;
+    if (p == 3) {
+      /* With s = t1 + t2 and d = t1 - t2, X1 and X2 are t0 - s/2 -+ i sin(pi/3) d for exp(-...) */
+      double sr = pT[2] + pT[4], si = pT[3] + pT[5];
+      double dr = sign*SIN_PI_3*(pT[2] - pT[4]), di = sign*SIN_PI_3*(pT[3] - pT[5]);
+      double hr = pT[0] - 0.5*sr, hi = pT[1] - 0.5*si;
+      double *p1 = p0 + 2*m, *p2 = p1 + 2*m;
+      p0[0] = pT[0] + sr;
+      p0[1] = pT[1] + si;
+      p1[0] = hr + di;
+      p1[1] = hi - dr;
+      p2[0] = hr - di;
+      p2[1] = hi + dr;
+    } else if (p == 5) {
+      /* With a1 = t1 + t4, b1 = t1 - t4, a2 = t2 + t3 and b2 = t2 - t3, X1 and X4 are
+       * t0 + cos(2pi/5) a1 + cos(4pi/5) a2 -+ i (sin(2pi/5) b1 + sin(4pi/5) b2), and X2 and X3
+       * t0 + cos(4pi/5) a1 + cos(2pi/5) a2 -+ i (sin(4pi/5) b1 - sin(2pi/5) b2) for exp(-...) */
+      double a1r = pT[2] + pT[8], a1i = pT[3] + pT[9], b1r = pT[2] - pT[8], b1i = pT[3] - pT[9];
+      double a2r = pT[4] + pT[6], a2i = pT[5] + pT[7], b2r = pT[4] - pT[6], b2i = pT[5] - pT[7];
+      double c1r = pT[0] + COS_2PI_5*a1r + COS_4PI_5*a2r, c1i = pT[1] + COS_2PI_5*a1i + COS_4PI_5*a2i;
+      double c2r = pT[0] + COS_4PI_5*a1r + COS_2PI_5*a2r, c2i = pT[1] + COS_4PI_5*a1i + COS_2PI_5*a2i;
+      double s1r = sign*(SIN_2PI_5*b1r + SIN_4PI_5*b2r), s1i = sign*(SIN_2PI_5*b1i + SIN_4PI_5*b2i);
+      double s2r = sign*(SIN_4PI_5*b1r - SIN_2PI_5*b2r), s2i = sign*(SIN_4PI_5*b1i - SIN_2PI_5*b2i);
+      double *p1 = p0 + 2*m, *p2 = p1 + 2*m, *p3 = p2 + 2*m, *p4 = p3 + 2*m;
+      p0[0] = pT[0] + a1r + a2r;
+      p0[1] = pT[1] + a1i + a2i;
+      p1[0] = c1r + s1i;
+      p1[1] = c1i - s1r;
+      p4[0] = c1r - s1i;
+      p4[1] = c1i + s1r;
+      p2[0] = c2r + s2i;
+      p2[1] = c2i - s2r;
+      p3[0] = c2r - s2i;
+      p3[1] = c2i + s2r;
+    } else if (p <= MAX_DIRECT) {
+      for (q=0; q<p; q++) {
+        double sr = 0., si = 0.;
+        size_t j = 0;
+        /* exp(-2 pi i rq/p) is twiddles[(rq mod p)*m*tw] */
+        for (r=0; r<p; r++) {
+          const double *pWr = pW + 2*j*m*tw;
+          double wr = pWr[0], wi = sign*pWr[1];
+          sr += wr*pT[2*r] - wi*pT[2*r + 1];
+          si += wr*pT[2*r + 1] + wi*pT[2*r];
+          j += q;
+          if (j >= p) j -= p;
+        }
+        p0[2*q*m]     = sr;
+        p0[2*q*m + 1] = si;
+      }
+    } else {
+      bluestein(pL, pT, p);
+      for (q=0; q<p; q++) {
+        p0[2*q*m]     = pT[2*q];
+        p0[2*q*m + 1] = pT[2*q + 1];
+      }
+    }
+  }
+}
+
+/* The scratch buffer of a transform in one thread: a line, a second line for the odd lengths of the real
+ * transforms, a tile of TILE_LINES lines, then the buffers of fftLine_t */
+static size_t scratchSize(const NDFFTPlan_t *pPlan)
+{
+  return (4 + 2*TILE_LINES)*pPlan->maxDim + 2*pPlan->maxPrime + 4*pPlan->maxConvolution;
+}
+
+static void initLine(fftLine_t *pL, const NDFFTPlan_t *pPlan, int dim, double *pScratch, int isign)
+{
+  pL->pPlan = pPlan;
+  pL->pW = pPlan->twiddles[dim];
+  pL->pCombine = pScratch + (4 + 2*TILE_LINES)*pPlan->maxDim;
+  pL->pConvolution = pL->pCombine + 2*pPlan->maxPrime;
+  pL->isign = isign;
+}
+
+/* Transforms in place lines firstLine to firstLine+numLines-1 of dimension dim, whose elements are stride complex
+ * elements apart, and conjugates the results if conjugate is set.  When stride > 1 the lines next to each other
+ * are copied to a tile, one after the other, so the copies read and write rows instead of columns. */
+static void transformRange(const NDFFTPlan_t *pPlan, int dim, size_t stride, double *pData, double *pScratch,
+                           int isign, int conjugate, size_t firstLine, size_t numLines)
+{
+  size_t n = pPlan->dims[dim], line = firstLine, end = firstLine + numLines, j, c;
+  double *pLine = pScratch, *pTile = pScratch + 4*pPlan->maxDim;
+  double sign = conjugate ? -1. : 1.;
+  fftLine_t lineInfo;
+
+  initLine(&lineInfo, pPlan, dim, pScratch, isign);
+  while (line < end) {
+    /* Line i starts at element (i / stride) * n * stride + i % stride */
+    size_t column = line % stride, width = stride - column;
+    double *pStart = pData + 2*((line / stride) * n * stride + column);
+    if (width > end - line) width = end - line;
+    if (width > TILE_LINES) width = TILE_LINES;
+    if (width == 1) {
+      mixedRadix(&lineInfo, pPlan->factors[dim], pStart, stride, pLine, n, 1);
+      for (j=0; j<n; j++) {
+        pStart[2*j*stride]     = pLine[2*j];
+        pStart[2*j*stride + 1] = sign*pLine[2*j + 1];
+      }
+    } else {
+      for (j=0; j<n; j++) {
+        const double *pRow = pStart + 2*j*stride;
+        for (c=0; c<width; c++) {
+          pTile[2*(c*n + j)]     = pRow[2*c];
+          pTile[2*(c*n + j) + 1] = pRow[2*c + 1];
+        }
+      }
+      for (c=0; c<width; c++) {
+        mixedRadix(&lineInfo, pPlan->factors[dim], pTile + 2*c*n, 1, pLine, n, 1);
+        memcpy(pTile + 2*c*n, pLine, 2 * n * sizeof(double));
+      }
+      for (j=0; j<n; j++) {
+        double *pRow = pStart + 2*j*stride;
+        for (c=0; c<width; c++) {
+          pRow[2*c]     = pTile[2*(c*n + j)];
+          pRow[2*c + 1] = sign*pTile[2*(c*n + j) + 1];
+        }
+      }
+    }
+    line += width;
+  }
+}
+
+/* Transforms rows firstRow to firstRow+numRows-1 of a real plan with exp(-...), and conjugates the results if
+ * conjugate is set */
+static void transformRealRows(const NDFFTPlan_t *pPlan, const double *pIn, double *pOut, double *pScratch,
+                              int conjugate, size_t firstRow, size_t numRows)
+{
+  size_t n = pPlan->dims[0], half = n/2 + 1, m = n/2, row, k;
+  const double *pW = pPlan->twiddles[0];
+  double *pLine = pScratch, *pComplex = pScratch + 2*pPlan->maxDim;
+  fftLine_t lineInfo;
+
+  initLine(&lineInfo, pPlan, 0, pScratch, -1);
+  for (row=firstRow; row<firstRow + numRows; row++) {
+    const double *pRow = pIn + row*n;
+    double *pHalf = pOut + 2*row*half;
+    if (n % 2) {
+      /* Odd lengths are complex transforms of the real points */
+      for (k=0; k<n; k++) {
+        pComplex[2*k]     = pRow[k];
+        pComplex[2*k + 1] = 0.;
+      }
+      mixedRadix(&lineInfo, pPlan->factors[0], pComplex, 1, pLine, n, 1);
+      memcpy(pHalf, pLine, 2 * half * sizeof(double));
+    } else {
+      /* The pairs of points are the complex points z_j = x_2j + i x_2j+1, whose transform is Z = E + i O.
+       * m has the odd factors of n. */
+      mixedRadix(&lineInfo, pPlan->factors[0], pRow, 1, pLine, m, 2);
+      for (k=0; k<=m/2; k++) {
+        /* X_k = E_k + w^k O_k and X_m-k = conj(E_k) - w^(m-k) conj(O_k), with E_k = (Z_k + conj(Z_m-k))/2 and
+         * O_k = (Z_k - conj(Z_m-k))/2i */
+        size_t j = (m - k) % m;
+        double zr = pLine[2*(k % m)], zi = pLine[2*(k % m) + 1], cr = pLine[2*j], ci = -pLine[2*j + 1];
+        double er = 0.5*(zr + cr), ei = 0.5*(zi + ci), odr = 0.5*(zi - ci), odi = -0.5*(zr - cr);
+        double wr = pW[2*k], wi = pW[2*k + 1];
+        double tr = wr*odr - wi*odi, ti = wr*odi + wi*odr;
+        pHalf[2*k]     = er + tr;
+        pHalf[2*k + 1] = ei + ti;
+        /* w^(m-k) = -conj(w^k) */
+        pHalf[2*(m - k)]     = er - tr;
+        pHalf[2*(m - k) + 1] = -ei + ti;
+      }
+    }
+    if (conjugate) {
+      for (k=0; k<half; k++) pHalf[2*k + 1] = -pHalf[2*k + 1];
+    }
+  }
+}
+
+/* Adds the Bluestein transform of a prime to a plan */
+static int addBluestein(NDFFTPlan_t *pPlan, size_t n)
+{
+  bluestein_t *pB;
+  size_t m = 1, k;
+  int i;
+
+  for (i=0; i<pPlan->nBluestein; i++) {
+    if (pPlan->pBluestein[i].n == n) return ND_SUCCESS;
+  }
+  pB = (bluestein_t *)realloc(pPlan->pBluestein, (pPlan->nBluestein + 1) * sizeof(bluestein_t));
+  if (!pB) return ND_ERROR;
+  pPlan->pBluestein = pB;
+  pB += pPlan->nBluestein++;
+  while (m < 2*n - 1) m *= 2;
+  pB->n = n;
+  pB->m = m;
+  pB->pChirp = (double *)malloc(2 * n * sizeof(double));
+  pB->pFilter = (double *)calloc(2 * m, sizeof(double));
+  pB->pTwiddles = (double *)malloc(2 * m * sizeof(double));
+  double *pConjugate = (double *)calloc(2 * m, sizeof(double));
+  if (!pB->pChirp || !pB->pFilter || !pB->pTwiddles || !pConjugate) {
+    free(pConjugate);
+    return ND_ERROR;
+  }
+  for (k=0; k<m; k++) {
+    double theta = -2. * M_PI * (double)k / (double)m;
+    pB->pTwiddles[2*k]     = cos(theta);
+    pB->pTwiddles[2*k + 1] = sin(theta);
+  }
+  for (k=0; k<n; k++) {
+    /* k^2 modulo 2n keeps the angle small */
+    double theta = -M_PI * (double)((k*k) % (2*n)) / (double)n;
+    pB->pChirp[2*k]     = cos(theta);
+    pB->pChirp[2*k + 1] = sin(theta);
+    pConjugate[2*k]     = pB->pChirp[2*k] / m;
+    pConjugate[2*k + 1] = -pB->pChirp[2*k + 1] / m;
+    if (k > 0) {
+      pConjugate[2*(m - k)]     = pConjugate[2*k];
+      pConjugate[2*(m - k) + 1] = pConjugate[2*k + 1];
+    }
+  }
+  splitRadix(pB->pTwiddles, pConjugate, 1, pB->pFilter, m, 1, -1);
+  free(pConjugate);
+  if (m > pPlan->maxConvolution) pPlan->maxConvolution = m;
+  return ND_SUCCESS;
+}
+
+#endif
+
+static void destroyPlan(NDFFTPlan_t *pPlan)
+{
+#ifdef ND_WITH_FFTW
+  if (pPlan->forward) fftw_destroy_plan(pPlan->forward);
+  if (pPlan->backward) fftw_destroy_plan(pPlan->backward);
+#else
+  int d, i;
+  for (d=0; d<pPlan->rank; d++) free(pPlan->twiddles[d]);
+  for (i=0; i<pPlan->nBluestein; i++) {
+    free(pPlan->pBluestein[i].pChirp);
+    free(pPlan->pBluestein[i].pFilter);
+    free(pPlan->pBluestein[i].pTwiddles);
+  }
+  free(pPlan->pBluestein);
+#endif
+  free(pPlan);
+}
+
+/* Called with planLock taken */
+static NDFFTPlan_t* createPlan(int rank, const size_t *dims, int isReal)
+{
+  NDFFTPlan_t *pPlan = (NDFFTPlan_t *)calloc(1, sizeof(NDFFTPlan_t));
+  int d;
+
+  if (!pPlan) return NULL;
+  pPlan->rank = rank;
+  pPlan->isReal = isReal;
+  pPlan->nElements = 1;
+  for (d=0; d<rank; d++) {
+    pPlan->dims[d] = dims[d];
+    pPlan->nElements *= ((d == 0) && isReal) ? dims[d]/2 + 1 : dims[d];
+  }
+#ifdef ND_WITH_FFTW
+  int n[ND_FFT_MAX_RANK];
+  /* FFTW dimensions are in row-major order */
+  for (d=0; d<rank; d++) n[d] = (int)dims[rank - 1 - d];
+  fftw_complex *pData = (fftw_complex *)fftw_malloc(pPlan->nElements * sizeof(fftw_complex));
+  double *pReal = isReal ? (double *)fftw_malloc(pPlan->nElements / (dims[0]/2 + 1) * dims[0] * sizeof(double)) : 0;
+  if (!pData || (isReal && !pReal)) {
+    fftw_free(pData);
+    fftw_free(pReal);
+    free(pPlan);
+    return NULL;
+  }
+  /* FFTW_ESTIMATE does not write the arrays, and FFTW_UNALIGNED allows the arrays of any alignment */
+  if (isReal) {
+    pPlan->forward = fftw_plan_dft_r2c(rank, n, pReal, pData, FFTW_ESTIMATE | FFTW_UNALIGNED);
+  } else {
+    pPlan->forward = fftw_plan_dft(rank, n, pData, pData, FFTW_FORWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+    pPlan->backward = fftw_plan_dft(rank, n, pData, pData, FFTW_BACKWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+  }
+  fftw_free(pData);
+  fftw_free(pReal);
+  if (!pPlan->forward || (!isReal && !pPlan->backward)) {
+    destroyPlan(pPlan);
+    return NULL;
+  }
+#else
+  for (d=0; d<rank; d++) {
+    size_t k, p, size = dims[d], rest = size;
+    int nFactors = 0;
+    if (size > pPlan->maxDim) pPlan->maxDim = size;
+    while ((rest % 2) == 0) rest /= 2;
+    for (p=3; rest>1; p+=2) {
+      if (p*p > rest) p = rest;
+      while ((rest % p) == 0) {
+        pPlan->factors[d][nFactors++] = p;
+        rest /= p;
+        if (p > pPlan->maxPrime) pPlan->maxPrime = p;
+        if ((p > MAX_DIRECT) && (addBluestein(pPlan, p) != ND_SUCCESS)) {
+          destroyPlan(pPlan);
+          return NULL;
+        }
+      }
+    }
+    pPlan->twiddles[d] = (double *)malloc(2 * size * sizeof(double));
+    if (!pPlan->twiddles[d]) {
+      destroyPlan(pPlan);
+      return NULL;
+    }
+    for (k=0; k<size; k++) {
+      double theta = -2. * M_PI * (double)k / (double)size;
+      pPlan->twiddles[d][2*k]     = cos(theta);
+      pPlan->twiddles[d][2*k + 1] = sin(theta);
+    }
+  }
+#endif
+  return pPlan;
+}
+
+static NDFFTPlan_t* acquirePlan(int rank, const size_t *dims, int isReal)
+{
+  NDFFTPlan_t *pPlan, *pPrev = 0, *pFree = 0;
+  int d, count;
+
+  if ((rank < 1) || (rank > ND_FFT_MAX_RANK)) return NULL;
+  for (d=0; d<rank; d++) {
+    if (dims[d] < 1) return NULL;
+  }
+  epicsThreadOnce(&planOnce, planInit, 0);
+  epicsMutexLock(planLock);
+  for (pPlan=pPlans; pPlan; pPrev=pPlan, pPlan=pPlan->pNext) {
+    if ((pPlan->rank == rank) && (pPlan->isReal == isReal) &&
+        (memcmp(pPlan->dims, dims, rank*sizeof(size_t)) == 0)) break;
+  }
+  if (pPlan) {
+    /* Move the plan to the front, so the cache keeps the plans used last */
+    if (pPrev) {
+      pPrev->pNext = pPlan->pNext;
+      pPlan->pNext = pPlans;
+      pPlans = pPlan;
+    }
+  } else {
+    pPlan = createPlan(rank, dims, isReal);
+    if (!pPlan) {
+      epicsMutexUnlock(planLock);
+      return NULL;
+    }
+    pPlan->refs = 1;
+    pPlan->pNext = pPlans;
+    pPlans = pPlan;
+    /* The plans after the first ND_FFT_CACHED_PLANS leave the cache, and are freed when no array uses them */
+    for (count=1, pPrev=pPlans; pPrev->pNext; count++, pPrev=pPrev->pNext) {
+      if (count == ND_FFT_CACHED_PLANS) {
+        pFree = pPrev->pNext;
+        pPrev->pNext = 0;
+        break;
+      }
+    }
+    while (pFree) {
+      NDFFTPlan_t *pNext = pFree->pNext;
+      if (--pFree->refs == 0) destroyPlan(pFree);
+      pFree = pNext;
+    }
+  }
+  pPlan->refs++;
+  epicsMutexUnlock(planLock);
+  return pPlan;
+}
+
+/** Returns the plan of the complex transforms of a set of dimensions, from the cache or created and added to it.
+  * The plan stays valid until NDFFTPlanRelease().
+  * \param[in] rank The number of dimensions, 1 to ND_FFT_MAX_RANK.
+  * \param[in] dims The dimensions, dims[0] varying fastest as in an NDArray.
+  * \return The plan, or NULL if the dimensions are not valid or the plan cannot be allocated. */
+NDFFTPlan_t* NDFFTPlanAcquire(int rank, const size_t *dims)
+{
+  return acquirePlan(rank, dims, 0);
+}
+
+/** Returns the plan of the transforms of real arrays of a set of dimensions, for NDFFTExecuteReal().
+  * \param[in] rank The number of dimensions, 1 to ND_FFT_MAX_RANK.
+  * \param[in] dims The dimensions of the real arrays, dims[0] varying fastest.
+  * \return The plan, or NULL if the dimensions are not valid or the plan cannot be allocated. */
+NDFFTPlan_t* NDFFTPlanAcquireReal(int rank, const size_t *dims)
+{
+  return acquirePlan(rank, dims, 1);
+}
+
+/** Releases a plan from NDFFTPlanAcquire() or NDFFTPlanAcquireReal(), and frees it if it is no longer in the
+  * cache. */
+void NDFFTPlanRelease(NDFFTPlan_t *pPlan)
+{
+  epicsMutexLock(planLock);
+  if (--pPlan->refs == 0) destroyPlan(pPlan);
+  epicsMutexUnlock(planLock);
+}
+
+/** Returns the number of passes of the transforms of a plan, for NDFFTExecutePass().
+  * The built-in FFT has a pass per dimension; FFTW, which has its own threads, does a transform in one pass. */
+int NDFFTPasses(const NDFFTPlan_t *pPlan)
+{
+#ifdef ND_WITH_FFTW
+  return 1;
+#else
+  return pPlan->rank;
+#endif
+}
+
+/** Returns the number of lines of a pass of the transforms of a plan, which NDFFTExecutePass() can transform in
+  * any order and from different threads. */
+size_t NDFFTPassLines(const NDFFTPlan_t *pPlan, int pass)
+{
+  if ((pass < 0) || (pass >= NDFFTPasses(pPlan))) return 0;
+#ifdef ND_WITH_FFTW
+  return 1;
+#else
+  if (pPlan->isReal && (pass == 0)) return pPlan->nElements / (pPlan->dims[0]/2 + 1);
+  return pPlan->nElements / pPlan->dims[pass];
+#endif
+}
+
+/** Computes lines of a pass of an FFT.  The passes must be done in order, each one after all the lines of the
+  * previous one, and their results are those of NDFFTExecute() or NDFFTExecuteReal().
+  * \param[in] pPlan The plan.
+  * \param[in] pass The pass, 0 to NDFFTPasses()-1.
+  * \param[in] pIn The input of the transform, real elements for a real plan, only read by pass 0.  With a complex
+  *            plan it can be pOut.
+  * \param[in,out] pOut The result of the transform, which the passes after 0 transform in place.
+  * \param[in] isign 1 or -1.
+  * \param[in] firstLine The first line of the pass.
+  * \param[in] numLines The number of lines, firstLine+numLines at most NDFFTPassLines().
+  * \return ND_SUCCESS, or ND_ERROR if the lines are not valid or a buffer cannot be allocated. */
+int NDFFTExecutePass(const NDFFTPlan_t *pPlan, int pass, const double *pIn, double *pOut, int isign,
+                     size_t firstLine, size_t numLines)
+{
+  size_t lines = NDFFTPassLines(pPlan, pass);
+
+  if ((pass < 0) || (firstLine > lines) || (numLines > lines - firstLine)) return ND_ERROR;
+  if (numLines == 0) return ND_SUCCESS;
+#ifdef ND_WITH_FFTW
+  if (pPlan->isReal) {
+    size_t k;
+    fftw_execute_dft_r2c(pPlan->forward, (double *)pIn, (fftw_complex *)pOut);
+    /* The transform with exp(+...) of real values is the complex conjugate of the one with exp(-...) */
+    if (isign > 0) {
+      for (k=0; k<pPlan->nElements; k++) pOut[2*k + 1] = -pOut[2*k + 1];
+    }
+  } else {
+    /* The plans are in place */
+    if (pIn != pOut) memcpy(pOut, pIn, 2 * pPlan->nElements * sizeof(double));
+    fftw_execute_dft((isign > 0) ? pPlan->backward : pPlan->forward, (fftw_complex *)pOut, (fftw_complex *)pOut);
+  }
+  return ND_SUCCESS;
+#else
+  double *pScratch = (double *)malloc(scratchSize(pPlan) * sizeof(double));
+  /* Real transforms are done with exp(-...), and the last pass conjugates them for exp(+...) */
+  int conjugate = pPlan->isReal && (isign > 0) && (pass == pPlan->rank - 1);
+  size_t stride = 1;
+  int d;
+
+  if (!pScratch) return ND_ERROR;
+  if (pPlan->isReal && (pass == 0)) {
+    transformRealRows(pPlan, pIn, pOut, pScratch, conjugate, firstLine, numLines);
+  } else {
+    if ((pass == 0) && (pIn != pOut)) {
+      /* The lines of pass 0 are rows */
+      size_t n = pPlan->dims[0];
+      memcpy(pOut + 2*firstLine*n, pIn + 2*firstLine*n, 2 * numLines * n * sizeof(double));
+    }
+    for (d=0; d<pass; d++) stride *= (pPlan->isReal && (d == 0)) ? pPlan->dims[0]/2 + 1 : pPlan->dims[d];
+    transformRange(pPlan, pass, stride, pOut, pScratch, pPlan->isReal ? -1 : isign, conjugate, firstLine,
+                   numLines);
+  }
+  free(pScratch);
+  return ND_SUCCESS;
+#endif
+}
+
+/** Computes the FFT of an array in place, without normalization.
+  * Element k of the result is the sum over j of the elements j times exp(isign 2 pi i jk/n), in each dimension,
+  * with the sign convention of Numerical Recipes.
+  * \param[in] pPlan The plan of the dimensions of the array.
+  * \param[in,out] pData The complex elements, as pairs of real and imaginary parts, dims[0] varying fastest.
+  * \param[in] isign 1 or -1.
+  * \return ND_SUCCESS, or ND_ERROR if pPlan is a real plan or a buffer cannot be allocated. */
+int NDFFTExecute(const NDFFTPlan_t *pPlan, double *pData, int isign)
+{
+  int pass;
+
+  if (pPlan->isReal) return ND_ERROR;
+  for (pass=0; pass<NDFFTPasses(pPlan); pass++) {
+    if (NDFFTExecutePass(pPlan, pass, pData, pData, isign, 0, NDFFTPassLines(pPlan, pass)) != ND_SUCCESS) {
+      return ND_ERROR;
+    }
+  }
+  return ND_SUCCESS;
+}
+
+/** Computes the FFT of a real array, without normalization.
+  * The result is the first dims[0]/2+1 elements of each line along dims[0] of the complex FFT of NDFFTExecute();
+  * the other elements are the complex conjugates of these.
+  * \param[in] pPlan The plan from NDFFTPlanAcquireReal() of the dimensions of the array.
+  * \param[in] pIn The real elements, dims[0] varying fastest.
+  * \param[out] pOut The (dims[0]/2+1) x dims[1] x ... complex elements, as pairs of real and imaginary parts.
+  * \param[in] isign 1 or -1.
+  * \return ND_SUCCESS, or ND_ERROR if pPlan is not a real plan or a buffer cannot be allocated. */
+int NDFFTExecuteReal(const NDFFTPlan_t *pPlan, const double *pIn, double *pOut, int isign)
+{
+  int pass;
+
+  if (!pPlan->isReal) return ND_ERROR;
+  for (pass=0; pass<NDFFTPasses(pPlan); pass++) {
+    if (NDFFTExecutePass(pPlan, pass, pIn, pOut, isign, 0, NDFFTPassLines(pPlan, pass)) != ND_SUCCESS) {
+      return ND_ERROR;
+    }
+  }
+  return ND_SUCCESS;
+}
+
+/** Computes a window function, in its periodic form for spectral analysis: the window of n+1 points without its
+  * last point.
+  * \param[in] window The window function.
+  * \param[in] n The number of points.
+  * \param[out] pWindow The n values of the window.
+  * \return ND_SUCCESS, or ND_ERROR if the window is not valid. */
+int NDFFTWindow(NDFFTWindow_t window, size_t n, double *pWindow)
+{
+  /* The windows are sums of cosines a0 - a1 cos(2 pi j/n) + a2 cos(4 pi j/n) - a3 cos(6 pi j/n) */
+  static const double coefficients[][4] = {
+    {1.,      0.,      0.,      0.},
+    {0.5,     0.5,     0.,      0.},
+    {0.54,    0.46,    0.,      0.},
+    {0.42,    0.5,     0.08,    0.},
+    {0.35875, 0.48829, 0.14128, 0.01168}
+  };
+  const double *a;
+  size_t j;
+
+  if ((window < NDFFTWindowRectangular) || (window > NDFFTWindowBlackmanHarris)) return ND_ERROR;
+  a = coefficients[window];
+  for (j=0; j<n; j++) {
+    double theta = 2. * M_PI * (double)j / (double)n;
+    pWindow[j] = a[0] - a[1]*cos(theta) + a[2]*cos(2.*theta) - a[3]*cos(3.*theta);
+  }
+  return ND_SUCCESS;
+}
+
+struct NDFFTWelch {
+  size_t length;                    /* The points of a segment */
+  size_t hop;                       /* The points between the starts of consecutive segments */
+  NDFFTPlan_t *pPlan;
+  double *pWindow;
+  double windowPower;               /* The sum of the squares of the window */
+  double *pRing;                    /* The last length points of the stream */
+  size_t next;                      /* The position in pRing of the next point */
+  size_t untilSegment;              /* The points until the next segment */
+  double *pSegment;                 /* The segment times the window */
+  double *pSpectrum;                /* The length/2+1 complex values of its transform */
+  double *pSum;                     /* The sums of the power spectra of the segments */
+  size_t segments;                  /* The segments in pSum */
+};
+
+/** Creates a Welch estimator.
+  * \param[in] segmentLength The points of each segment, which are the points of the FFT.
+  * \param[in] overlap The points each segment shares with the previous one, less than segmentLength.
+  * \param[in] window The window function of the segments.
+  * \return The estimator, or NULL if the parameters are not valid or it cannot be allocated. */
+NDFFTWelch_t* NDFFTWelchCreate(size_t segmentLength, size_t overlap, NDFFTWindow_t window)
+{
+  NDFFTWelch_t *pWelch;
+  size_t j, half = segmentLength/2 + 1;
+
+  if ((segmentLength < 1) || (overlap >= segmentLength)) return NULL;
+  pWelch = (NDFFTWelch_t *)calloc(1, sizeof(NDFFTWelch_t));
+  if (!pWelch) return NULL;
+  pWelch->length = segmentLength;
+  pWelch->hop = segmentLength - overlap;
+  pWelch->pPlan = NDFFTPlanAcquireReal(1, &segmentLength);
+  pWelch->pWindow = (double *)malloc(segmentLength * sizeof(double));
+  pWelch->pRing = (double *)malloc(segmentLength * sizeof(double));
+  pWelch->pSegment = (double *)malloc(segmentLength * sizeof(double));
+  pWelch->pSpectrum = (double *)malloc(2 * half * sizeof(double));
+  pWelch->pSum = (double *)malloc(half * sizeof(double));
+  if (!pWelch->pPlan || !pWelch->pWindow || !pWelch->pRing || !pWelch->pSegment || !pWelch->pSpectrum ||
+      !pWelch->pSum || (NDFFTWindow(window, segmentLength, pWelch->pWindow) != ND_SUCCESS)) {
+    NDFFTWelchDestroy(pWelch);
+    return NULL;
+  }
+  for (j=0; j<segmentLength; j++) pWelch->windowPower += pWelch->pWindow[j] * pWelch->pWindow[j];
+  NDFFTWelchReset(pWelch);
+  return pWelch;
+}
+
+/** Destroys a Welch estimator. */
+void NDFFTWelchDestroy(NDFFTWelch_t *pWelch)
+{
+  if (pWelch->pPlan) NDFFTPlanRelease(pWelch->pPlan);
+  free(pWelch->pWindow);
+  free(pWelch->pRing);
+  free(pWelch->pSegment);
+  free(pWelch->pSpectrum);
+  free(pWelch->pSum);
+  free(pWelch);
+}
+
+/** Discards the points of a Welch estimator and the spectra of its segments, so the next segment starts with the
+  * next point. */
+void NDFFTWelchReset(NDFFTWelch_t *pWelch)
+{
+  pWelch->next = 0;
+  pWelch->untilSegment = pWelch->length;
+  pWelch->segments = 0;
+  memset(pWelch->pSum, 0, (pWelch->length/2 + 1) * sizeof(double));
+}
+
+/* Adds the power spectrum of the segment in the ring */
+static void addSegment(NDFFTWelch_t *pWelch)
+{
+  size_t j, length = pWelch->length, first = length - pWelch->next;
+
+  for (j=0; j<first; j++) pWelch->pSegment[j] = pWelch->pRing[pWelch->next + j] * pWelch->pWindow[j];
+  for (; j<length; j++) pWelch->pSegment[j] = pWelch->pRing[j - first] * pWelch->pWindow[j];
+  if (NDFFTExecuteReal(pWelch->pPlan, pWelch->pSegment, pWelch->pSpectrum, -1) != ND_SUCCESS) return;
+  for (j=0; j<=length/2; j++) {
+    double re = pWelch->pSpectrum[2*j], im = pWelch->pSpectrum[2*j + 1];
+    pWelch->pSum[j] += re*re + im*im;
+  }
+  pWelch->segments++;
+}
+
+/** Adds points of the stream to a Welch estimator, and the spectra of the segments they complete.
+  * \param[in] pWelch The estimator.
+  * \param[in] pData The points.
+  * \param[in] n The number of points.
+  * \param[in] maxSegments The estimator stops taking points when it has this number of segments, so a spectrum
+  *            averages a fixed number of segments even when the points complete more.
+  * \return The number of points taken, n unless maxSegments segments were reached; NDFFTWelchPSD() takes the
+  *         segments and the rest of the points can then be added. */
+size_t NDFFTWelchAdd(NDFFTWelch_t *pWelch, const double *pData, size_t n, size_t maxSegments)
+{
+  size_t used = 0, length = pWelch->length;
+
+  while ((used < n) && (pWelch->segments < maxSegments)) {
+    size_t chunk = n - used, first;
+    if (chunk > pWelch->untilSegment) chunk = pWelch->untilSegment;
+    /* The chunk is at most length points, so it wraps around the ring at most once */
+    first = length - pWelch->next;
+    if (first > chunk) first = chunk;
+    memcpy(pWelch->pRing + pWelch->next, pData + used, first * sizeof(double));
+    memcpy(pWelch->pRing, pData + used + first, (chunk - first) * sizeof(double));
+    pWelch->next = (pWelch->next + chunk) % length;
+    pWelch->untilSegment -= chunk;
+    used += chunk;
+    if (pWelch->untilSegment == 0) {
+      addSegment(pWelch);
+      pWelch->untilSegment = pWelch->hop;
+    }
+  }
+  return used;
+}
+
+/** Returns the number of segments a Welch estimator has added since the last spectrum. */
+size_t NDFFTWelchSegments(const NDFFTWelch_t *pWelch)
+{
+  return pWelch->segments;
+}
+
+/** Computes the one-sided power spectral density of the segments of a Welch estimator, and starts the average of the
+  * next segments.
+  * \param[in] pWelch The estimator.
+  * \param[in] sampleRate The points per unit of time, so the density is in units squared per unit of frequency.
+  * \param[out] pPSD The density at the segmentLength/2+1 frequencies k*sampleRate/segmentLength.
+  * \return ND_SUCCESS, or ND_ERROR if there are no segments. */
+int NDFFTWelchPSD(NDFFTWelch_t *pWelch, double sampleRate, double *pPSD)
+{
+  size_t k, length = pWelch->length;
+  double scale;
+
+  if (pWelch->segments == 0) return ND_ERROR;
+  scale = 1. / ((double)pWelch->segments * sampleRate * pWelch->windowPower);
+  for (k=0; k<=length/2; k++) {
+    /* The negative frequencies double the density, except at 0 and at the Nyquist frequency */
+    double factor = ((k > 0) && (2*k < length)) ? 2. : 1.;
+    pPSD[k] = pWelch->pSum[k] * scale * factor;
+    pWelch->pSum[k] = 0.;
+  }
+  pWelch->segments = 0;
+  return ND_SUCCESS;
+}
+
+/** Returns the name of the library that computes the transforms. */
+const char* NDFFTBackend(void)
+{
+#ifdef ND_WITH_FFTW
+  return "FFTW";
+#else
+  return "Split-radix";
+#endif
+}
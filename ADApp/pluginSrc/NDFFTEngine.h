@@ -0,0 +1,73 @@
+/** NDFFTEngine.h
+ *
+ * Complex FFTs of 1 to ND_FFT_MAX_RANK dimensions for NDPluginFFT, computed with plans.
+ * A plan holds what only depends on the dimensions, the twiddle factors of the built-in split-radix FFT or the
+ * plans of FFTW, so an array only pays for the transform.  Plans are kept in a cache shared by all the plugins
+ * and are not modified by NDFFTExecute(), so threads can transform different arrays with the same plan.
+ * NDFFTExecutePass() splits a transform into passes over independent lines, the rows then the columns, so threads
+ * can also share the lines of one transform.
+ *
+ * The built-in FFT handles dimensions of any size, fastest for the powers of 2 and the products of small primes.
+ * When ADCore is built with WITH_FFTW=YES, which defines ND_WITH_FFTW, FFTW, or a library with its interface such
+ * as MKL, computes the transforms.
+ * The transforms of real arrays only compute the half of the spectrum that is not redundant, in half the time.
+ *
+ * A Welch estimator computes the power spectral density of a stream of real values: it splits the stream into
+ * overlapping segments, which it keeps in a ring buffer, and averages the power spectra of the segments times a
+ * window function.
+ *
+ */
+
+#ifndef NDFFTEngine_H
+#define NDFFTEngine_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#define ND_FFT_MAX_RANK     3   /**< The maximum number of dimensions of a transform */
+#define ND_FFT_CACHED_PLANS 8   /**< The plans the cache keeps when no array is using them */
+
+/** The transform of a set of dimensions */
+typedef struct NDFFTPlan NDFFTPlan_t;
+
+/** A Welch power spectral density estimator */
+typedef struct NDFFTWelch NDFFTWelch_t;
+
+/** Window functions */
+typedef enum {
+  NDFFTWindowRectangular,
+  NDFFTWindowHann,
+  NDFFTWindowHamming,
+  NDFFTWindowBlackman,
+  NDFFTWindowBlackmanHarris
+} NDFFTWindow_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc NDFFTPlan_t* NDFFTPlanAcquire(int rank, const size_t *dims);
+epicsShareFunc NDFFTPlan_t* NDFFTPlanAcquireReal(int rank, const size_t *dims);
+epicsShareFunc void NDFFTPlanRelease(NDFFTPlan_t *pPlan);
+epicsShareFunc int NDFFTExecute(const NDFFTPlan_t *pPlan, double *pData, int isign);
+epicsShareFunc int NDFFTExecuteReal(const NDFFTPlan_t *pPlan, const double *pIn, double *pOut, int isign);
+epicsShareFunc int NDFFTPasses(const NDFFTPlan_t *pPlan);
+epicsShareFunc size_t NDFFTPassLines(const NDFFTPlan_t *pPlan, int pass);
+epicsShareFunc int NDFFTExecutePass(const NDFFTPlan_t *pPlan, int pass, const double *pIn, double *pOut, int isign,
+                                    size_t firstLine, size_t numLines);
+epicsShareFunc const char* NDFFTBackend(void);
+
+epicsShareFunc int NDFFTWindow(NDFFTWindow_t window, size_t n, double *pWindow);
+epicsShareFunc NDFFTWelch_t* NDFFTWelchCreate(size_t segmentLength, size_t overlap, NDFFTWindow_t window);
+epicsShareFunc void NDFFTWelchDestroy(NDFFTWelch_t *pWelch);
+epicsShareFunc void NDFFTWelchReset(NDFFTWelch_t *pWelch);
+epicsShareFunc size_t NDFFTWelchAdd(NDFFTWelch_t *pWelch, const double *pData, size_t n, size_t maxSegments);
+epicsShareFunc size_t NDFFTWelchSegments(const NDFFTWelch_t *pWelch);
+epicsShareFunc int NDFFTWelchPSD(NDFFTWelch_t *pWelch, double sampleRate, double *pPSD);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,11 +30,7 @@ static const char *driverName = "NDFileFITS";
 asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
 {
     static const char *functionName = "openFile";
-    int naxis = 0;
-    long *naxes = NULL;
     int status = 0;
-    int numAttributes = 0;
-    NDAttribute *pAttribute = NULL;
 
     /* We don't support reading yet */
     if (openMode & NDFileModeRead) return (asynError);
@@ -42,6 +38,11 @@ asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* We don't support opening an existing file for appending yet */
     if (openMode & NDFileModeAppend) return (asynError);
 
+    /* Use the same row order for all of the arrays in the file */
+    this->lock();
+    getIntegerParam(NDFileFITSFlip, &this->flip);
+    this->unlock();
+
     /* Create empty FITS file */
     fits_create_file(&(this->pFits), fileName, &status);
 
@@ -51,18 +52,28 @@ asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode,
             driverName, functionName, fileName);
         return (asynError);
     }
+    this->numImages = 0;
+
+    /* The primary HDU holds the first array */
+    return createImage(pArray);
+}
+
+/** Creates an image HDU for an NDArray, and writes the attributes of the array as its keywords.
+  * The first HDU of a file is the primary HDU; the others are image extensions.
+  * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  */
+asynStatus NDFileFITS::createImage(NDArray *pArray)
+{
+    static const char *functionName = "createImage";
+    int naxis = 0;
+    long naxes[ND_ARRAY_MAX_DIMS];
+    int status = 0;
+    int numAttributes = 0;
+    NDAttribute *pAttribute = NULL;
 
     naxis = pArray->ndims;
     if (naxis == 0) return (asynError);
 
-    naxes = (long *) malloc(naxis * sizeof(long));
-    if (naxes == NULL) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error, naxes malloc failed. file: %s\n",
-            driverName, functionName, fileName);
-        return (asynError);
-    }
-
     for (int i = 0; i < naxis; i++) {
         naxes[i] = pArray->dims[i].size;
     }
@@ -106,8 +117,6 @@ asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode,
             break;
     }
 
-    free(naxes);
-
     /* Save attributes */
     if (pArray->pAttributeList != NULL) {
 
@@ -195,8 +204,8 @@ asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
         if (status > 0) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s error, fits_write_key failed. file: %s\n",
-                driverName, functionName, fileName);
+                "%s:%s error, fits_write_key failed.\n",
+                driverName, functionName);
             return (asynError);
         }
     }
@@ -205,180 +214,61 @@ asynStatus NDFileFITS::openFile(const char *fileName, NDFileOpenMode_t openMode,
 }
 
 /** Writes single NDArray to the FITS file.
+  * In Capture and Stream mode with MultiHDU=Yes this is called for each array, and each array after the first one
+  * is written to a new image extension.
+  * The rows are written directly from the array.  cfitsio handles arrays in FORTRAN style, with the first row at
+  * the bottom, so if Flip is Yes the rows of each 2-D plane are written in reverse order.  Arrays with more than
+  * 3 dimensions are not flipped.
   * \param[in] pArray Pointer to the NDArray to be written
   */
 asynStatus NDFileFITS::writeFile(NDArray *pArray)
 {
     static const char *functionName = "writeFile";
-    unsigned long nElements = 1;
-    int w = 0;
-    int h = 0;
-    int d = 0;
-    int y = 0;
-    int z = 0;
+    NDArrayInfo_t arrayInfo;
+    size_t w = 0;
+    size_t h = 0;
+    size_t d = 0;
+    size_t y = 0;
+    size_t z = 0;
+    int dataType = 0;
     int status = 0;
-    void *pOut = NULL;
-
-    for (int i = 0; i < pArray->ndims; i++) {
-        nElements *= pArray->dims[i].size;
-    }
+    char *pSrc = NULL;
 
-    /* cfitsio handle array with FORTRAN style, we need to vertically flip it */
-    if (pArray->ndims > 3) {
-        /* Avoid transposing */
-        w = 1;
-        h = 1;
-        d = 1;
-    } else if (pArray->ndims == 3) {
-        w = pArray->dims[0].size;
-        h = pArray->dims[1].size;
-        d = pArray->dims[2].size;
-    } else if (pArray->ndims == 2) {
-        w = pArray->dims[0].size;
-        h = pArray->dims[1].size;
-        d = 1;
-    } else if (pArray->ndims == 1) {
-        w = pArray->dims[0].size;
-        h = 1;
-        d = 1;
-    }
-
-    pOut = malloc(pArray->dataSize);
-    if (pOut == NULL) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error, pOut malloc failed.\n",
-            driverName, functionName);
-        return (asynError);
+    if (this->numImages > 0) {
+        if (createImage(pArray) != asynSuccess) return (asynError);
     }
 
-    /* Write the image */
     switch (pArray->dataType) {
-        case NDInt8:
-            {
-                epicsInt8 *pDst = (epicsInt8 *) pOut;
-                epicsInt8 *pSrc = (epicsInt8 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsInt8));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TSBYTE, 1, nElements, pOut, &status);
-            break;
-
-        case NDUInt8:
-            {
-                epicsUInt8 *pDst = (epicsUInt8 *) pOut;
-                epicsUInt8 *pSrc = (epicsUInt8 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsUInt8));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TBYTE, 1, nElements, pOut, &status);
-            break;
-
-        case NDInt16:
-            {
-                epicsInt16 *pDst = (epicsInt16 *) pOut;
-                epicsInt16 *pSrc = (epicsInt16 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsInt16));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TSHORT, 1, nElements, pOut, &status);
-            break;
-
-        case NDUInt16:
-            {
-                epicsUInt16 *pDst = (epicsUInt16 *) pOut;
-                epicsUInt16 *pSrc = (epicsUInt16 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsUInt16));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TUSHORT, 1, nElements, pOut, &status);
-            break;
-
-        case NDInt32:
-            {
-                epicsInt32 *pDst = (epicsInt32 *) pOut;
-                epicsInt32 *pSrc = (epicsInt32 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsInt32));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TINT, 1, nElements, pOut, &status);
-            break;
-
-        case NDUInt32:
-            {
-                epicsUInt32 *pDst = (epicsUInt32 *) pOut;
-                epicsUInt32 *pSrc = (epicsUInt32 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsUInt32));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TUINT, 1, nElements, pOut, &status);
-            break;
-
-        case NDFloat32:
-            {
-                epicsFloat32 *pDst = (epicsFloat32 *) pOut;
-                epicsFloat32 *pSrc = (epicsFloat32 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsFloat32));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TFLOAT, 1, nElements, pOut, &status);
-            break;
-
-        case NDFloat64:
-            {
-                epicsFloat64 *pDst = (epicsFloat64 *) pOut;
-                epicsFloat64 *pSrc = (epicsFloat64 *) pArray->pData;
-
-                for (z = 0; z < d; z++) {
-                    for (y = 0; y < h; y++) {
-                        memcpy(&pDst[z * (w * h) + (h - 1 - y) * w], &pSrc[z * (w * h) + y * w], w * sizeof(epicsFloat64));
-                    }
-                }
-            }
-
-            fits_write_img(this->pFits, TDOUBLE, 1, nElements, pOut, &status);
-            break;
-
+        case NDInt8:    dataType = TSBYTE;  break;
+        case NDUInt8:   dataType = TBYTE;   break;
+        case NDInt16:   dataType = TSHORT;  break;
+        case NDUInt16:  dataType = TUSHORT; break;
+        case NDInt32:   dataType = TINT;    break;
+        case NDUInt32:  dataType = TUINT;   break;
+        case NDFloat32: dataType = TFLOAT;  break;
+        case NDFloat64: dataType = TDOUBLE; break;
         default:
             return (asynError);
             break;
     }
+    pArray->getInfo(&arrayInfo);
 
-    free(pOut);
+    /* Write the image */
+    if (!this->flip || (pArray->ndims < 2) || (pArray->ndims > 3)) {
+        fits_write_img(this->pFits, dataType, 1, arrayInfo.nElements, pArray->pData, &status);
+    } else {
+        w = pArray->dims[0].size;
+        h = pArray->dims[1].size;
+        d = (pArray->ndims == 3) ? pArray->dims[2].size : 1;
+        /* The rows are written in the order of the file, so cfitsio writes the file sequentially */
+        for (z = 0; (z < d) && (status <= 0); z++) {
+            for (y = 0; (y < h) && (status <= 0); y++) {
+                pSrc = (char *)pArray->pData + (z * h + (h - 1 - y)) * w * arrayInfo.bytesPerElement;
+                fits_write_img(this->pFits, dataType, (LONGLONG)((z * h + y) * w) + 1, (LONGLONG)w, pSrc, &status);
+            }
+        }
+    }
+    this->numImages++;
 
     if (status > 0) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -408,10 +298,49 @@ asynStatus NDFileFITS::closeFile()
 
     fits_close_file(this->pFits, &status);
     this->pFits = NULL;
+    this->numImages = 0;
 
     return (asynSuccess);
 }
 
+/** Called when asyn clients call pasynInt32->write().
+  * This function performs actions for some parameters.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileFITS::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0, capture = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_FITS_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    getIntegerParam(NDFileCapture, &capture);
+    if (function == NDFileFITSMultiHDU) {
+        /* NDPluginFile decides from this whether it opens a file for each array */
+        if (capture) status = asynError;
+        else this->supportsMultipleArrays = value ? 1 : 0;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
 /** Constructor for NDFileFITS; all parameters are simply passed to NDPluginFile::NDPluginFile.
   * \param[in] portName The name of the asyn port driver to be created.
   * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when 
@@ -437,8 +366,13 @@ NDFileFITS::NDFileFITS(const char *portName, int queueSize, int blockingCallback
                    2, 0, asynGenericPointerMask, asynGenericPointerMask, 
                    ASYN_CANBLOCK, 1, priority, stackSize, 1)
 {
+    createParam(NDFileFITSFlipString,     asynParamInt32, &NDFileFITSFlip);
+    createParam(NDFileFITSMultiHDUString, asynParamInt32, &NDFileFITSMultiHDU);
+
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileFITS");
+    setIntegerParam(NDFileFITSFlip, 1);
+    setIntegerParam(NDFileFITSMultiHDU, 0);
     this->supportsMultipleArrays = 0;
 }
 
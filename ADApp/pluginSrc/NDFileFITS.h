@@ -12,6 +12,11 @@
 
 #include "NDPluginFile.h"
 
+#define NDFileFITSFlipString     "FITS_FLIP"       /* (asynInt32, r/w) Flip the arrays vertically into the FORTRAN row
+                                                    * order of FITS (1=Yes, 0=No, for arrays that are already flipped) */
+#define NDFileFITSMultiHDUString "FITS_MULTI_HDU"  /* (asynInt32, r/w) Write the frames of Capture and Stream mode
+                                                    * as the image HDUs of one file (1=Yes, 0=No) */
+
 /** Writes NDArrays in the FITS file format.
     Flexible Image Transport System is a file format used in astronomy endorsed by NASA and the International Astronomical Union.
     Used for the transport, analysis, and archival storage of scientific data sets
@@ -19,6 +24,10 @@
     - Tables containing rows and columns of information
     - Header keywords provide descriptive information about the data
     https://fits.gsfc.nasa.gov/
+
+    The rows are written directly from the NDArray, in reverse order when Flip is Yes, so no copy of the array
+    is made.  With MultiHDU=Yes each array of Capture and Stream mode is written as an image extension of one
+    file, with its attributes as the keywords of the extension.
     */
 
 class epicsShareClass NDFileFITS : public NDPluginFile {
@@ -32,9 +41,19 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileFITSFlip;
+    #define FIRST_NDFILE_FITS_PARAM NDFileFITSFlip
+    int NDFileFITSMultiHDU;
 
 private:
+    asynStatus createImage(NDArray *pArray);
+
     fitsfile *pFits = NULL;
+    int flip = 1;        /**< Flip when the file was opened */
+    int numImages = 0;   /**< Number of image HDUs written to the open file */
 };
 
 #endif
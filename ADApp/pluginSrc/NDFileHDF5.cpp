@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <list>
+#include <map>
 #include <cmath>
 #include <iostream>
 #include <sstream>
@@ -25,6 +26,8 @@
 #include <epicsEvent.h>
 #include <epicsTime.h>
 #include <epicsString.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
 #include <iocsh.h>
 #ifdef epicsAssertAuthor
   #undef epicsAssertAuthor
@@ -37,18 +40,49 @@
 
 #include <epicsExport.h>
 #include "NDFileHDF5.h"
+#include "NDCompressKernels.h"
+
+#ifdef ND_WITH_ZLIB
+  #include <zlib.h>
+#endif
+#ifdef ND_WITH_BLOSC
+  #include <blosc.h>
+#endif
+#ifdef ND_WITH_ZSTD
+  #include <zstd.h>
+#endif
+#ifdef ND_WITH_HDF5_MPI
+  #include <mpi.h>
+  #include <epicsExit.h>
+#endif
 
 #define METADATA_NDIMS 1
 #define MAX_LAYOUT_LEN 1048576
 
-enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZip, HDF5CompressZlib, HDF5CompressBlosc};
+enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZip, HDF5CompressZlib, HDF5CompressBlosc,
+                        HDF5CompressBshufLZ4, HDF5CompressZstd};
+enum HDF5ChunkTune_t {HDF5ChunkTuneOff=0, HDF5ChunkTuneOn, HDF5ChunkTuneAdapt};
 /* Filter ID officially assigned to blosc */
 #define FILTER_BLOSC 32001
+/* Filter IDs officially assigned to bitshuffle and zstd */
+#define FILTER_BSHUF 32008
+#define FILTER_ZSTD 32015
+/* The compression of the bitshuffle filter that follows the bit shuffle */
+#define BSHUF_H5_COMPRESS_LZ4 2
 
 #define DIMSREPORTSIZE 512
 #define DIMNAMESIZE 40
 #define ALIGNMENT_BOUNDARY 1048576
 #define INFINITE_FRAMES_CAPTURE 10000 /* Used to calculate istorek (the size of the chunk index binar search tree) when capturing infinite number of frames */
+#define HDF5_EXTEND_BLOCK_FRAMES 64 /* Minimum number of frames the detector datasets are extended by at a time */
+#define DIRECT_IO_BLOCK_SIZE 4096 /* Memory alignment and file system block size for the direct I/O file driver */
+#define DIRECT_IO_COPY_BUFFER (16*1048576) /* Copy buffer of the direct I/O file driver for unaligned writes */
+#define PERFORMANCE_COLUMNS 10 /* Values stored for each frame in the performance dataset */
+#define EVENT_CHUNK_SIZE 65536 /* Events in a chunk of the event datasets of sparse frames */
+#define CHUNK_TUNE_TARGET_BYTES 4194304 /* Default size of the stored chunks picked by the chunk auto-tune */
+#define CHUNK_TUNE_MIN_BYTES 262144     /* Smallest and largest target chunk size of the Adapt mode */
+#define CHUNK_TUNE_MAX_BYTES 67108864
+#define CHUNK_TUNE_COMPRESSION_RATIO 2.0 /* Expected compression ratio of the compression filters other than N-bit */
 
 #ifdef HDF5_BTREE_IK_MAX_ENTRIES
   #define  MAX_ISTOREK ((HDF5_BTREE_IK_MAX_ENTRIES/2)-1)
@@ -59,6 +93,31 @@ enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZi
 static const char *driverName = "NDFileHDF5";
 static const char *uniqueIDName = "NDArrayUniqueId";
 
+/* The arguments of NDFileHDF5::compressChunkTask() */
+typedef struct {
+  NDFileHDF5 *pPlugin;
+  const char *pData;      /* The frame */
+  size_t frameBytes;      /* The size of the frame */
+  int elementSize;        /* The size of one element of the frame */
+} hdf5ChunkTaskArgs_t;
+
+/* The source files of the VDS master files that the writers of a multi-writer group have opened so far,
+ * by the name of the master file.  The writers can be in different threads, so this is locked. */
+static epicsMutex vdsWritersLock;
+static std::map<std::string, std::vector<std::string> > vdsWriters;
+
+#ifdef ND_WITH_HDF5_MPI
+/* MPI is initialised once for all of the plugins if the IOC has not done it */
+static epicsMutex mpiInitLock;
+
+static void finalizeMPI(void *arg)
+{
+  int finalized = 0;
+  MPI_Finalized(&finalized);
+  if (!finalized) MPI_Finalize();
+}
+#endif
+
 // Not required if SWMR is not supported
 #if H5_VERSION_GE(1,9,178)
 // This is a callback function for object flushing when in SWMR mode
@@ -72,6 +131,18 @@ static herr_t cFlushCallback(hid_t objectID, void *data)
 }
 #endif
 
+static void flushTaskC(void *drvPvt)
+{
+  NDFileHDF5 *pPvt = (NDFileHDF5 *)drvPvt;
+  pPvt->flushTask();
+}
+
+static void nextFileTaskC(void *drvPvt)
+{
+  NDFileHDF5 *pPvt = (NDFileHDF5 *)drvPvt;
+  pPvt->nextFileTask();
+}
+
 const char *NDFileHDF5::str_NDFileHDF5_extraDimSize[MAXEXTRADIMS] = {
     "HDF5_extraDimSizeN",
     "HDF5_extraDimSizeX",
@@ -136,7 +207,9 @@ const char *NDFileHDF5::str_NDFileHDF5_posIndex[MAXEXTRADIMS] = {
 /** Opens a HDF5 file.  
  * In write mode if NDFileModeMultiple is set then the first dataspace dimension is set to H5S_UNLIMITED to allow 
  * multiple arrays to be written to the same file.
- * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
+ * In read mode the detector dataset HDF5_readDataset is opened with an NDFileHDF5Reader, which starts to read
+ * its frames ahead of NDFileHDF5::readFile; pArray is NULL.
+ * NOTE: Does not currently support NDFileModeAppend.
  * \param[in] fileName  Absolute path name of the file to open.
  * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
  *           May also have the bit NDFileModeMultiple set if the file is to be opened to write or read multiple 
@@ -153,6 +226,43 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Filename: %s\n", driverName, functionName, fileName);
 
+  if (openMode & NDFileModeRead) {
+    char datasetName[MAX_FILENAME_LEN];
+    int readAhead, readChunks;
+    this->lock();
+    getStringParam(NDFileHDF5_readDataset, sizeof(datasetName), datasetName);
+    getIntegerParam(NDFileHDF5_readAhead, &readAhead);
+    getIntegerParam(NDFileHDF5_readChunks, &readChunks);
+    setIntegerParam(NDFileHDF5_readNumFrames, 0);
+    setIntegerParam(NDFileHDF5_readFrame, 0);
+    setDoubleParam(NDFileHDF5_readSpeed, 0.0);
+    this->unlock();
+    if (!this->pReader) this->pReader = new NDFileHDF5Reader(this->pasynUserSelf, this->pNDArrayPool);
+    epicsTimeGetCurrent(&this->readStart);
+    status = this->pReader->open(fileName, datasetName, readChunks != 0, readAhead);
+    this->lock();
+    setIntegerParam(NDFileHDF5_readNumFrames, (int)this->pReader->getNumFrames());
+    callParamCallbacks();
+    this->unlock();
+    return status;
+  }
+
+  // A file of frame stacks is a file of their frames, see NDArray::stackFrames, and NumCapture counts the stacks
+  if (!pArray->stackFrames.empty()){
+    NDArray *pFrame = this->pNDArrayPool->stackFrame(pArray, 0);
+    if (!pFrame){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: cannot get the first frame of the frame stack\n",
+                driverName, functionName);
+      return asynError;
+    }
+    this->framesPerArray = (int)pArray->dims[pArray->ndims-1].size;
+    status = this->openFile(fileName, openMode, pFrame);
+    pFrame->release();
+    if (status != asynSuccess) this->framesPerArray = 1;
+    return status;
+  }
+
   /* These operations are accessing parameter library, must take lock */
   this->lock();
   // Reset flush counter
@@ -161,13 +271,6 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
 
-  // We don't support reading yet
-  if (openMode & NDFileModeRead) {
-    setIntegerParam(NDFileCapture, 0);
-    setIntegerParam(NDWriteFile, 0);
-    status = asynError;
-  }
-  
   // We don't support opening an existing file for appending yet
   if (openMode & NDFileModeAppend) {
     setIntegerParam(NDFileCapture, 0);
@@ -209,6 +312,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   pArray->getInfo(&info);
   this->frameSize = (8.0 * info.totalBytes)/(1024.0 * 1024.0);
   this->bytesPerElement = info.bytesPerElement;
+  this->packedBits = NDPackedBits(pArray->dataType);
 
   // Construct an attribute list. We use a separate attribute list from the one in pArray
   // to avoid the need to copy the array.
@@ -231,6 +335,11 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   
   // Set the next record in the file to 0
   this->nextRecord = 0;
+  this->fileWriteMB = 0.0;
+  this->fileWriteSeconds = 0.0;
+
+  // Pick the chunking from the frames when the chunk auto-tune is enabled
+  this->tuneChunking(pArray);
 
   // Work out the various dimensions used for the incoming data
   if (this->configureDims(pArray)){
@@ -240,6 +349,17 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     return asynError;
   }
 
+  // Write the file together with the other MPI ranks if MPIMode is set
+  if (this->configureMPI(openMode)){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Failed to configure the parallel MPI mode\n",
+              driverName, functionName);
+    return asynError;
+  }
+
+  // Sparse frames are written as events, except by the MPI ranks which write the frames in place
+  this->sparse = pArray->sparse && !this->mpi;
+
   // Create the new file
   if (this->createNewFile(fileName)){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -256,6 +376,19 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     return asynError;
   }
 
+  // Compress the frames in this plugin if the layout of the chunks allows it
+  this->directChunk = !this->sparse && this->configureDirectChunk(pArray);
+  this->lock();
+  setIntegerParam(NDFileHDF5_directChunkActive, this->directChunk ? 1 : 0);
+  this->unlock();
+
+  // A file of a multi-writer group is written as usual, the VDS master file only refers to it
+  if (this->registerVdsWriter(fileName) != asynSuccess){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Failed to create the VDS master file, continuing with %s\n",
+              driverName, functionName, fileName);
+  }
+
   // Set up the dimensions for each of the available datasets
   if (this->configureDatasetDims(pArray)){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -264,6 +397,10 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     return asynError;
   }
 
+  if (this->sparse && this->createEventDatasets() != asynSuccess){
+    return asynError;
+  }
+
   if (storeAttributes == 1){
     this->createAttributeDataset(pArray);
     this->writeAttributeDataset(hdf5::OnFileOpen, 0, NULL);
@@ -291,6 +428,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   this->createHardLinks(root);
 
   // Check if we are in SWMR mode
+  this->timedFlush = false;
   if (checkForSWMRMode()){
     // Call the method to place the file into SWMR  
     if (startSWMR() == asynError){
@@ -302,8 +440,37 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
       // SWMR Mode is now active on the file, so we can notify external readers
       setIntegerParam(NDFileHDF5_SWMRRunning, 1);
     }
+
+    // With a FlushPeriod or a FlushMaxPeriod the flushes are made by the flush thread
+    int period = 0, maxPeriod = 0;
+    this->lock();
+    getIntegerParam(NDFileHDF5_flushPeriod, &period);
+    getIntegerParam(NDFileHDF5_flushMaxPeriod, &maxPeriod);
+    getIntegerParam(NDFileHDF5_flushNthFrame, &this->flushFrames);
+    this->unlock();
+    this->flushPeriod = period / 1000.0;
+    this->flushMaxPeriod = maxPeriod / 1000.0;
+    this->framesUnflushed = 0;
+    epicsTimeGetCurrent(&this->lastFlush);
+    if ((period > 0 || maxPeriod > 0) && this->flushThreadId == 0){
+      char taskName[256];
+      epicsSnprintf(taskName, sizeof(taskName)-1, "%s_HDF5_Flush", this->portName);
+      this->flushThreadId = epicsThreadCreate(taskName,
+                                              epicsThreadPriorityMedium,
+                                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                                              (EPICSTHREADFUNC)flushTaskC, this);
+      if (this->flushThreadId == 0){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR creating the flush thread, flushing every %d frames\n",
+                  driverName, functionName, this->flushFrames);
+      }
+    }
+    this->timedFlush = (period > 0 || maxPeriod > 0) && this->flushThreadId != 0;
   }
 
+  // Create the next file of a stream in advance
+  this->prepareNextFile(fileName);
+
   return asynSuccess;
 }
 
@@ -339,6 +506,94 @@ asynStatus NDFileHDF5::startSWMR()
   #endif
 }
 
+/** Task that makes the SWMR flushes when FlushPeriod or FlushMaxPeriod is set, so that the flushes are not
+ * part of the time taken to write a frame.  writeFile signals it when a flush might be due, and it waits for
+ * the remaining time of a flush with FlushMaxPeriod.  The flushes are made with the file mutex, between frames.
+ */
+void NDFileHDF5::flushTask()
+{
+  epicsTimeStamp now;
+  double delay = -1.0;
+
+  while (1){
+    if (delay < 0.0){
+      epicsEventWait(this->flushEvent);
+    } else if (delay > 0.0){
+      epicsEventWaitWithTimeout(this->flushEvent, delay);
+    }
+    epicsMutexLock(this->fileMutexId);
+    delay = -1.0;
+    if (this->file != 0 && this->timedFlush){
+      epicsTimeGetCurrent(&now);
+      delay = this->timeToFlush(&now);
+      if (delay == 0.0){
+        this->flushDatasets();
+        delay = -1.0;
+      }
+    }
+    epicsMutexUnlock(this->fileMutexId);
+  }
+}
+
+/** Returns the time in seconds until the next time-based SWMR flush is due, 0 if it is due now,
+ * or -1 if no flush is due until more frames are written.  A flush is due when flushFrames frames
+ * have been written and flushPeriod has passed since the last flush, or when any frame has been
+ * written and flushMaxPeriod has passed.  Called with the file mutex.
+ * \param[in] now The current time.
+ */
+double NDFileHDF5::timeToFlush(const epicsTimeStamp *now)
+{
+  double since, maxDelay, delay = 0.0;
+  bool due = false;
+
+  if (this->framesUnflushed == 0) return -1.0;
+  since = epicsTimeDiffInSeconds(now, &this->lastFlush);
+  if (this->framesUnflushed >= this->flushFrames){
+    delay = this->flushPeriod - since;
+    due = true;
+  }
+  if (this->flushMaxPeriod > 0.0){
+    maxDelay = this->flushMaxPeriod - since;
+    if (!due || maxDelay < delay) delay = maxDelay;
+    due = true;
+  }
+  if (!due) return -1.0;
+  return (delay > 0.0) ? delay : 0.0;
+}
+
+/** Flushes the detector datasets and the NDAttribute datasets for SWMR readers.
+ * Called by the flush thread with the file mutex.
+ */
+asynStatus NDFileHDF5::flushDatasets()
+{
+  asynStatus status = asynSuccess;
+  epicsTimeStamp startts;
+  static const char *functionName = "flushDatasets";
+
+  epicsTimeGetCurrent(&startts);
+  for (std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset = this->detDataMap.begin();
+       it_dset != this->detDataMap.end(); ++it_dset){
+    if (it_dset->second->flushDataset() != asynSuccess) status = asynError;
+  }
+  for (std::list<NDFileHDF5AttributeDataset*>::iterator it_node = this->attrList.begin();
+       it_node != this->attrList.end(); ++it_node){
+    if ((*it_node)->flushDataset() != asynSuccess) status = asynError;
+  }
+  if (this->pPackedAttributes && this->pPackedAttributes->flushDataset() != asynSuccess) status = asynError;
+  if (this->sparse && this->flushEventDatasets() != asynSuccess) status = asynError;
+  epicsTimeGetCurrent(&this->lastFlush);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s flushed %d frames\n",
+            driverName, functionName, this->framesUnflushed);
+  this->framesUnflushed = 0;
+
+  this->lock();
+  setDoubleParam(NDFileHDF5_flushTime, epicsTimeDiffInSeconds(&this->lastFlush, &startts) * 1000.0);
+  callParamCallbacks();
+  this->unlock();
+  return status;
+}
+
 asynStatus NDFileHDF5::flushCallback()
 {
   int counter = 0;
@@ -1242,11 +1497,13 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   int dimAttDataset = 0;
   int posRunning = 0;
   char posName[MAXEXTRADIMS][MAX_STRING_SIZE];
-  epicsTimeStamp startts, endts;
+  epicsTimeStamp startts, markts, nextts, endts;
   epicsInt32 numCaptured;
   double dt=0.0, period=0.0, runtime = 0.0;
+  double extendTime=0.0, writeTime=0.0, compressTime=0.0, attributeTime=0.0, flushTime=0.0;
   int extradims = 0;
   hsize_t offsets[MAXEXTRADIMS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  hsize_t numFrames = 0, frame;
   static const char *functionName = "writeFile";
 
   if (this->file == 0) {
@@ -1256,6 +1513,20 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     return asynError;
   }
 
+  // A sparse frame in a file of dense frames is written densified
+  if (pArray->sparse && !this->sparse){
+    NDArray *pDense;
+    if (this->pNDArrayPool->makeDense(pArray, &pDense) != ND_SUCCESS){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: cannot densify array\n",
+                driverName, functionName);
+      return asynError;
+    }
+    status = this->writeFile(pDense);
+    pDense->release();
+    return status;
+  }
+
   this->lock();
   getIntegerParam(NDFileHDF5_dimAttDatasets, &dimAttDataset);
   getIntegerParam(NDFileNumCaptured, &numCaptured);
@@ -1276,6 +1547,19 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   getStringParam(NDFileHDF5_posName[9], MAX_STRING_SIZE, posName[9]);
   this->unlock();
 
+  // The frames of a frame stack are written with one hyperslab when they simply follow the last frame
+  // in the detector dataset, otherwise they are written one by one
+  if (!pArray->stackFrames.empty()){
+    if (this->multiFrameFile && extradims == 0 && posRunning == 0 && !this->mpi && !this->sparse &&
+        !this->directChunk && this->ndDsetName == "" && pArray->codec.empty() && !NDPackedBits(pArray->dataType) &&
+        pArray->isContiguous() && pArray->ndims == this->rank &&
+        pArray->dims[pArray->ndims-1].size == pArray->stackFrames.size()){
+      numFrames = pArray->stackFrames.size();
+    } else {
+      return this->writeStackFrames(pArray);
+    }
+  }
+
   if (numCaptured == 1) epicsTimeGetCurrent(&this->firstFrame);
 
   if (storeAttributes == 1){
@@ -1313,7 +1597,9 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   // If we have a defined dataset destination NDAttribute name then we need to find the
   // destination of this frame
   std::string destination = this->defDsetName;
-  if (this->ndDsetName != ""){
+  // In MPI mode all of the ranks must write to the same dataset, so the frames go to the default dataset.
+  // The events of sparse frames all go to the event datasets of the default dataset
+  if (this->ndDsetName != "" && !this->mpi && !this->sparse){
     NDAttribute *destAtt = pArray->pAttributeList->find(this->ndDsetName.c_str());
     if (destAtt){
       char pValue[128];
@@ -1358,7 +1644,15 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     }
   }
 
-  if (status == asynSuccess){
+  if (status == asynSuccess && this->mpi){
+    // Each rank writes its frames to its own places in the dataset
+    hsize_t frameIndex = 0;
+    status = this->findMPIFrameIndex(pArray, &frameIndex);
+    if (status == asynSuccess){
+      status = this->detDataMap[destination]->placeFrame(frameIndex);
+    }
+    this->mpiFrames++;
+  } else if (status == asynSuccess && !this->sparse && numFrames == 0){
     if (destination == this->defDsetName){
       // Check to see if we are positional placement mode
       if (posRunning == 1){
@@ -1380,8 +1674,51 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     }
   }
 
+  epicsTimeGetCurrent(&markts);
+  extendTime = epicsTimeDiffInSeconds(&markts, &startts);
+
   if (status == asynSuccess){
-    status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+    if (this->sparse){
+      status = this->writeEventDatasets(pArray);
+    } else if (numFrames > 0){
+      status = this->detDataMap[destination]->writeFrames(pArray->pData, this->datatype, numFrames, this->framesize);
+    } else if (this->directChunk){
+      status = this->compressDirectChunks(pArray);
+      epicsTimeGetCurrent(&nextts);
+      compressTime = epicsTimeDiffInSeconds(&nextts, &markts);
+      markts = nextts;
+      if (status == asynSuccess){
+        status = this->writeDirectChunks(pArray, this->detDataMap[destination]);
+      }
+    } else if (!pArray->codec.empty()){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: arrays compressed with codec %s can only be written as direct chunks\n",
+                driverName, functionName, pArray->codec.name.c_str());
+      status = asynError;
+    } else if (NDPackedBits(pArray->dataType)){
+      // The N-bit filter of the dataset packs the elements again
+      NDArray *pUnpacked;
+      if (this->pNDArrayPool->convert(pArray, &pUnpacked, NDUInt16) != ND_SUCCESS){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR: cannot unpack array\n",
+                  driverName, functionName);
+        status = asynError;
+      } else {
+        status = this->detDataMap[destination]->writeFile(pUnpacked, this->datatype, this->dataspace,
+                                                          this->framesize);
+        pUnpacked->release();
+      }
+    } else {
+      status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+    }
+    // The dataset is extended in the file as part of the write when the frame does not fit
+    epicsTimeGetCurrent(&nextts);
+    writeTime = epicsTimeDiffInSeconds(&nextts, &markts);
+    if (!this->sparse){
+      writeTime -= this->detDataMap[destination]->getExtendTime();
+      extendTime += this->detDataMap[destination]->getExtendTime();
+    }
+    markts = nextts;
   }
   if (status != asynSuccess){
     // If dataset creation fails then close file and abort as all following writes will fail as well
@@ -1420,7 +1757,12 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     return asynError;
   }
 
-  if (storeAttributes == 1){
+  // The attributes of each frame of a frame stack have the uniqueId and time stamps of the frame
+  for (frame=0; storeAttributes == 1 && (frame == 0 || frame < numFrames); frame++){
+    if (numFrames > 0){
+      const NDStackFrame_t& stackFrame = pArray->stackFrames[frame];
+      this->addDefaultAttributes(stackFrame.uniqueId, stackFrame.timeStamp, stackFrame.epicsTS);
+    }
     if (dimAttDataset == 1){
       // If attribute datasets are following dimensions of the main dataset
       // check to ensure this NDArray is destined for the default dataset
@@ -1436,9 +1778,49 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
       return status;
     }
   }
-  if (storePerformance == 1 && numCaptured <= this->numPerformancePoints){
-    epicsTimeGetCurrent(&endts);
-    dt = epicsTimeDiffInSeconds(&endts, &startts);
+  epicsTimeGetCurrent(&nextts);
+  attributeTime = epicsTimeDiffInSeconds(&nextts, &markts);
+  markts = nextts;
+
+  if (checkForSWMRMode()){
+    if (this->timedFlush){
+      // The flush thread makes the flush.  It is told about the first frame since the last flush
+      // and when the number of frames is reached, so it can wait for the time until it is due.
+      int framesWritten = (numFrames > 0) ? (int)numFrames : 1;
+      bool firstUnflushed = (this->framesUnflushed == 0);
+      bool reached = (this->framesUnflushed < this->flushFrames) &&
+                     (this->framesUnflushed + framesWritten >= this->flushFrames);
+      this->framesUnflushed += framesWritten;
+      if (firstUnflushed || reached || this->timeToFlush(&markts) == 0.0){
+        epicsEventSignal(this->flushEvent);
+      }
+    } else if ((numCaptured+1) % flush == 0) {
+      // We are in SWMR mode so flush the dataset on every <flush> frames
+      if (this->sparse){
+        status = this->flushEventDatasets();
+      } else {
+        status = this->detDataMap[destination]->flushDataset();
+      }
+    }
+  }
+
+  epicsTimeGetCurrent(&endts);
+  flushTime = epicsTimeDiffInSeconds(&endts, &markts);
+  dt = epicsTimeDiffInSeconds(&endts, &startts);
+  this->lock();
+  setDoubleParam(NDFileHDF5_frameWriteTime, dt * 1000.0);
+  setDoubleParam(NDFileHDF5_extendTime,     extendTime * 1000.0);
+  setDoubleParam(NDFileHDF5_writeTime,      writeTime * 1000.0);
+  setDoubleParam(NDFileHDF5_compressTime,   compressTime * 1000.0);
+  setDoubleParam(NDFileHDF5_attributeTime,  attributeTime * 1000.0);
+  if (!this->timedFlush) setDoubleParam(NDFileHDF5_flushTime, flushTime * 1000.0);
+  this->unlock();
+  this->fileWriteMB += (this->frameSize / 8.0) * ((numFrames > 0) ? numFrames : 1);
+  this->fileWriteSeconds += dt;
+
+  // The frames of a frame stack that are written one by one each add a point, so the buffer can be full
+  if (storePerformance == 1 && numCaptured <= this->numPerformancePoints &&
+      this->performancePtr < this->performanceBuf + PERFORMANCE_COLUMNS * this->numPerformancePoints){
     *this->performancePtr = dt;
     this->performancePtr++;
     period = epicsTimeDiffInSeconds(&endts, &this->prevts);
@@ -1452,13 +1834,16 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     this->performancePtr++;
     *this->performancePtr = (numCaptured * this->frameSize)/runtime;
     this->performancePtr++;
-  }
-
-  if (checkForSWMRMode()){
-    if ((numCaptured+1) % flush == 0) {
-      // We are in SWMR mode so flush the dataset on every <flush> frames
-      status = this->detDataMap[destination]->flushDataset();
-    }
+    *this->performancePtr = extendTime;
+    this->performancePtr++;
+    *this->performancePtr = writeTime;
+    this->performancePtr++;
+    *this->performancePtr = compressTime;
+    this->performancePtr++;
+    *this->performancePtr = attributeTime;
+    this->performancePtr++;
+    *this->performancePtr = flushTime;
+    this->performancePtr++;
   }
 
   if (status != asynSuccess){
@@ -1478,17 +1863,82 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
               "%s::%s wrote frame. dt=%.5fs (T=%.5fs)\n",
               driverName, functionName, dt, period);
 
-    this->nextRecord++;
+    this->nextRecord += (numFrames > 0) ? (int)numFrames : 1;
+  }
+  return status;
+}
+
+/** Writes the frames of a frame stack one by one, see NDArray::stackFrames.
+  * \param[in] pArray Pointer to the frame stack.
+  */
+asynStatus NDFileHDF5::writeStackFrames(NDArray *pArray)
+{
+  asynStatus status = asynSuccess;
+  NDArray *pFrame;
+  size_t frame;
+  static const char *functionName = "writeStackFrames";
+
+  for (frame=0; frame<pArray->stackFrames.size() && status == asynSuccess; frame++){
+    pFrame = this->pNDArrayPool->stackFrame(pArray, frame);
+    if (!pFrame){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: cannot get frame %d of the frame stack\n",
+                driverName, functionName, (int)frame);
+      return asynError;
+    }
+    status = this->writeFile(pFrame);
+    pFrame->release();
   }
   return status;
 }
 
-/** Read NDArray data from a HDF5 file; NOTE: not implemented yet.
-  * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */ 
+/** Reads the frames of the dataset of the file opened with NDFileModeRead.
+  * The frames come from the read-ahead thread of the NDFileHDF5Reader; each frame but the last is passed to the
+  * callbacks here, with the NDAttributes and the uniqueId and time stamps it was written with.
+  * \param[in] pArray Pointer to the address of an NDArray; set to the last frame, which NDPluginFile::readFileBase
+  *            passes to the callbacks.  */ 
 asynStatus NDFileHDF5::readFile(NDArray **pArray)
 {
-  //static const char *functionName = "readFile";
-  return asynError;
+  NDArray *pFrame, *pNext;
+  epicsTimeStamp now;
+  double seconds;
+  int numFrames = 0;
+  static const char *functionName = "readFile";
+
+  *pArray = NULL;
+  if (!this->pReader || this->pReader->getNumFrames() == 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s ERROR no file with frames is open for reading\n",
+              driverName, functionName);
+    return asynError;
+  }
+  // The frame after the one that is passed on is received first, so the last frame is known
+  pFrame = this->pReader->next();
+  while (pFrame){
+    pNext = this->pReader->next();
+    numFrames++;
+    epicsTimeGetCurrent(&now);
+    seconds = epicsTimeDiffInSeconds(&now, &this->readStart);
+    this->lock();
+    setIntegerParam(NDFileHDF5_readFrame, numFrames);
+    if (seconds > 0.0) setDoubleParam(NDFileHDF5_readSpeed, this->pReader->getMBytesRead() / seconds);
+    if (pNext){
+      NDPluginDriver::endProcessCallbacks(pFrame, false, true);
+      callParamCallbacks();
+    } else {
+      *pArray = pFrame;
+    }
+    this->unlock();
+    pFrame = pNext;
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s read %d frames\n", driverName, functionName, numFrames);
+  if (this->pReader->failed()){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s ERROR reading the frames stopped after %d of %d\n",
+              driverName, functionName, numFrames, (int)this->pReader->getNumFrames());
+    if (*pArray) (*pArray)->release();
+    *pArray = NULL;
+    return asynError;
+  }
+  return asynSuccess;
 }
 
 /** Closes the HDF5 file opened with NDFileHDF5::openFile 
@@ -1497,10 +1947,17 @@ asynStatus NDFileHDF5::closeFile()
 {
   int storeAttributes, storePerformance;
   epicsTimeStamp now;
-  double runtime = 0.0, writespeed = 0.0;
+  double runtime = 0.0, writespeed = 0.0, achievedSpeed = 0.0;
   epicsInt32 numCaptured;
   static const char *functionName = "closeFile";
 
+  if (this->pReader){
+    this->pReader->close();
+    delete this->pReader;
+    this->pReader = NULL;
+    return asynSuccess;
+  }
+
   if (this->file == 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s::%s file was not open! Ignoring close command.\n", 
@@ -1511,6 +1968,9 @@ asynStatus NDFileHDF5::closeFile()
   this->lock();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  // The achieved speed leaves out the time between the frames, so the files with different chunking compare
+  if (this->fileWriteSeconds > 0.0) achievedSpeed = this->fileWriteMB / this->fileWriteSeconds;
+  setDoubleParam(NDFileHDF5_chunkAchievedSpeed, achievedSpeed);
   this->unlock();
   if (storeAttributes == 1) {
      this->writeAttributeDataset(hdf5::OnFileClose, 0, NULL);
@@ -1538,13 +1998,20 @@ asynStatus NDFileHDF5::closeFile()
   // Iterate over the stored detector data sets and close them
   std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
-    H5Dclose(it_dset->second->getHandle());
+    it_dset->second->closeDataset();
   }
   std::map<std::string, hid_t>::iterator it_hid;
   // Iterate over the stored attribute data sets and close them
   for (it_hid = this->attDataMap.begin(); it_hid != this->attDataMap.end(); ++it_hid){
     H5Dclose(it_hid->second);
   }
+  if (this->sparse){
+    H5Dclose(this->eventIdDataset);
+    H5Dclose(this->eventValueDataset);
+    H5Dclose(this->eventIndexDataset);
+    this->sparse = false;
+  }
+  this->framesPerArray = 1;
 
   // Just before closing the file lets ensure there are no hanging references
   int obj_count = (int)H5Fget_obj_count(this->file, H5F_OBJ_GROUP);
@@ -1573,9 +2040,11 @@ asynStatus NDFileHDF5::closeFile()
   // At this point we can clear the SWMR active flag, whether we were running
   // in SWMR mode or not
   setIntegerParam(NDFileHDF5_SWMRRunning, 0);
+  this->directChunk = false;
+  setIntegerParam(NDFileHDF5_directChunkActive, 0);
+  this->mpi = false;
 
-  // Unload the XML layout
-  this->layout.unload_xml();
+  // The XML layout tree is kept loaded, the next file reuses it unless the layout has changed
 
   // Reset the default data set and clear out the maps of handles to stale datasets
   detDataMap.clear();
@@ -1594,6 +2063,7 @@ asynStatus NDFileHDF5::closeFile()
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s::%s file closed! runtime=%.3f s overall acquisition performance=%.2f Mbit/s\n",
             driverName, functionName, runtime, writespeed);
+  this->adaptChunkTarget(achievedSpeed);
 
   return asynSuccess;
 }
@@ -1684,6 +2154,12 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
   }
 
+  else if (function == NDFileHDF5_chunkAutoTune ||
+           function == NDFileHDF5_chunkTargetBytes){
+    // The Adapt mode starts again from the new settings
+    this->tunePrevSpeed = 0.0;
+    this->tuneDirection = 1;
+  }
   else if (function == NDFileHDF5_flushNthFrame){
     // You cannot set the flush parameter to less than nFramesChunks
     getIntegerParam(NDFileHDF5_nFramesChunks, &tmp);
@@ -1764,6 +2240,12 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       case HDF5CompressBlosc:
         filterId = FILTER_BLOSC;
         break;
+      case HDF5CompressBshufLZ4:
+        filterId = FILTER_BSHUF;
+        break;
+      case HDF5CompressZstd:
+        filterId = FILTER_ZSTD;
+        break;
       default:
         filterId = H5Z_FILTER_NONE;
         status = asynError;
@@ -1835,6 +2317,74 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
+  } else if (function == NDFileHDF5_bshufBlockSize) {
+    // The bitshuffle block size is a number of elements, a multiple of 8; 0 selects the default of the filter
+    if (this->file != 0 || value < 0 || value % 8)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_zstdCompressLevel) {
+    if (this->file != 0 || value < 1 || value > 22)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_metaBlockSize ||
+             function == NDFileHDF5_sieveBufSize) {
+    // These are file access properties, 0 keeps the default of the HDF5 library
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_directIO) {
+    // Reject direct I/O if the HDF5 library was built without the direct file driver
+    #ifdef H5_HAVE_DIRECT
+    if (this->file != 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+    #else
+    status = asynError;
+    setIntegerParam(function, 0);
+    #endif
+  } else if (function == NDFileHDF5_mpiMode) {
+    // Reject the parallel mode if the plugin was built without MPI
+    #ifdef ND_WITH_HDF5_MPI
+    if (this->file != 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+    #else
+    status = asynError;
+    setIntegerParam(function, 0);
+    #endif
+  } else if (function == NDFileHDF5_vdsNumWriters ||
+             function == NDFileHDF5_vdsWriterIndex) {
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_flushPeriod ||
+             function == NDFileHDF5_flushMaxPeriod) {
+    // The flush policy is set when the file is opened
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_NDAttributeBatch ||
+             function == NDFileHDF5_NDAttributePacked) {
+    // The attribute datasets are created with the batch size and the packing when the file is opened
+    if (this->file != 0 || value < 0 || (function == NDFileHDF5_NDAttributeBatch && value < 1))
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
   } else if (function == NDFileHDF5_SWMRMode){
 
     // Reject SWMR mode if the HDF version doesn't support it
@@ -1968,8 +2518,10 @@ int NDFileHDF5::verifyLayoutXMLFile()
     }
   }
 
+  // Verify with a separate parser so that the layout tree loaded for the files is left alone
   std::string strFileName = std::string(fileName);
-  if (this->layout.verify_xml(strFileName)){
+  hdf5::LayoutXML verifier;
+  if (verifier.verify_xml(strFileName)){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
               "%s::%s XML description file parser error.\n", 
               driverName, functionName);
@@ -2008,7 +2560,12 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_nFramesChunks,   asynParamInt32,   &NDFileHDF5_nFramesChunks);
   this->createParam(str_NDFileHDF5_chunkBoundaryAlign, asynParamInt32,&NDFileHDF5_chunkBoundaryAlign);
   this->createParam(str_NDFileHDF5_chunkBoundaryThreshold, asynParamInt32,&NDFileHDF5_chunkBoundaryThreshold);
+  this->createParam(str_NDFileHDF5_chunkAutoTune,   asynParamInt32,   &NDFileHDF5_chunkAutoTune);
+  this->createParam(str_NDFileHDF5_chunkTargetBytes, asynParamInt32,  &NDFileHDF5_chunkTargetBytes);
+  this->createParam(str_NDFileHDF5_chunkAchievedSpeed, asynParamFloat64, &NDFileHDF5_chunkAchievedSpeed);
   this->createParam(str_NDFileHDF5_NDAttributeChunk,asynParamInt32,   &NDFileHDF5_NDAttributeChunk);
+  this->createParam(str_NDFileHDF5_NDAttributeBatch,asynParamInt32,   &NDFileHDF5_NDAttributeBatch);
+  this->createParam(str_NDFileHDF5_NDAttributePacked,asynParamInt32,  &NDFileHDF5_NDAttributePacked);
   this->createParam(str_NDFileHDF5_nExtraDims,      asynParamInt32,   &NDFileHDF5_nExtraDims);
   this->createParam(str_NDFileHDF5_extraDimOffsetX, asynParamInt32,   &NDFileHDF5_extraDimOffsetX);
   this->createParam(str_NDFileHDF5_extraDimOffsetY, asynParamInt32,   &NDFileHDF5_extraDimOffsetY);
@@ -2021,7 +2578,16 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_storePerformance,asynParamInt32,   &NDFileHDF5_storePerformance);
   this->createParam(str_NDFileHDF5_totalRuntime,    asynParamFloat64, &NDFileHDF5_totalRuntime);
   this->createParam(str_NDFileHDF5_totalIoSpeed,    asynParamFloat64, &NDFileHDF5_totalIoSpeed);
+  this->createParam(str_NDFileHDF5_frameWriteTime,  asynParamFloat64, &NDFileHDF5_frameWriteTime);
+  this->createParam(str_NDFileHDF5_extendTime,      asynParamFloat64, &NDFileHDF5_extendTime);
+  this->createParam(str_NDFileHDF5_writeTime,       asynParamFloat64, &NDFileHDF5_writeTime);
+  this->createParam(str_NDFileHDF5_compressTime,    asynParamFloat64, &NDFileHDF5_compressTime);
+  this->createParam(str_NDFileHDF5_attributeTime,   asynParamFloat64, &NDFileHDF5_attributeTime);
+  this->createParam(str_NDFileHDF5_flushTime,       asynParamFloat64, &NDFileHDF5_flushTime);
   this->createParam(str_NDFileHDF5_flushNthFrame,   asynParamInt32,   &NDFileHDF5_flushNthFrame);
+  this->createParam(str_NDFileHDF5_flushPeriod,     asynParamInt32,   &NDFileHDF5_flushPeriod);
+  this->createParam(str_NDFileHDF5_flushMaxPeriod,  asynParamInt32,   &NDFileHDF5_flushMaxPeriod);
+  this->createParam(str_NDFileHDF5_preCreateFile,   asynParamInt32,   &NDFileHDF5_preCreateFile);
   this->createParam(str_NDFileHDF5_compressionType, asynParamInt32,   &NDFileHDF5_compressionType);
   this->createParam(str_NDFileHDF5_nbitsPrecision,  asynParamInt32,   &NDFileHDF5_nbitsPrecision);
   this->createParam(str_NDFileHDF5_nbitsOffset,     asynParamInt32,   &NDFileHDF5_nbitsOffset);
@@ -2030,6 +2596,8 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_bloscShuffleType,   asynParamInt32,   &NDFileHDF5_bloscShuffleType);
   this->createParam(str_NDFileHDF5_bloscCompressor,    asynParamInt32,   &NDFileHDF5_bloscCompressor);
   this->createParam(str_NDFileHDF5_bloscCompressLevel, asynParamInt32,   &NDFileHDF5_bloscCompressLevel);
+  this->createParam(str_NDFileHDF5_bshufBlockSize,     asynParamInt32,   &NDFileHDF5_bshufBlockSize);
+  this->createParam(str_NDFileHDF5_zstdCompressLevel,  asynParamInt32,   &NDFileHDF5_zstdCompressLevel);
   this->createParam(str_NDFileHDF5_dimAttDatasets,  asynParamInt32,   &NDFileHDF5_dimAttDatasets);
   this->createParam(str_NDFileHDF5_layoutErrorMsg,  asynParamOctet,   &NDFileHDF5_layoutErrorMsg);
   this->createParam(str_NDFileHDF5_layoutValid,     asynParamInt32,   &NDFileHDF5_layoutValid);
@@ -2044,13 +2612,38 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_SWMRSupported,   asynParamInt32,   &NDFileHDF5_SWMRSupported);
   this->createParam(str_NDFileHDF5_SWMRMode,        asynParamInt32,   &NDFileHDF5_SWMRMode);
   this->createParam(str_NDFileHDF5_SWMRRunning,     asynParamInt32,   &NDFileHDF5_SWMRRunning);
+  this->createParam(str_NDFileHDF5_directChunk,     asynParamInt32,   &NDFileHDF5_directChunk);
+  this->createParam(str_NDFileHDF5_directChunkActive, asynParamInt32, &NDFileHDF5_directChunkActive);
+  this->createParam(str_NDFileHDF5_metaBlockSize,   asynParamInt32,   &NDFileHDF5_metaBlockSize);
+  this->createParam(str_NDFileHDF5_sieveBufSize,    asynParamInt32,   &NDFileHDF5_sieveBufSize);
+  this->createParam(str_NDFileHDF5_directIO,        asynParamInt32,   &NDFileHDF5_directIO);
+  this->createParam(str_NDFileHDF5_directIOSupported, asynParamInt32, &NDFileHDF5_directIOSupported);
+  this->createParam(str_NDFileHDF5_vdsNumWriters,   asynParamInt32,   &NDFileHDF5_vdsNumWriters);
+  this->createParam(str_NDFileHDF5_vdsWriterIndex,  asynParamInt32,   &NDFileHDF5_vdsWriterIndex);
+  this->createParam(str_NDFileHDF5_vdsFileName,     asynParamOctet,   &NDFileHDF5_vdsFileName);
+  this->createParam(str_NDFileHDF5_mpiMode,         asynParamInt32,   &NDFileHDF5_mpiMode);
+  this->createParam(str_NDFileHDF5_mpiSupported,    asynParamInt32,   &NDFileHDF5_mpiSupported);
+  this->createParam(str_NDFileHDF5_mpiRank,         asynParamInt32,   &NDFileHDF5_mpiRank);
+  this->createParam(str_NDFileHDF5_mpiSize,         asynParamInt32,   &NDFileHDF5_mpiSize);
+  this->createParam(str_NDFileHDF5_mpiFrameAttribute, asynParamOctet, &NDFileHDF5_mpiFrameAttribute);
+  this->createParam(str_NDFileHDF5_readDataset,     asynParamOctet,   &NDFileHDF5_readDataset);
+  this->createParam(str_NDFileHDF5_readAhead,       asynParamInt32,   &NDFileHDF5_readAhead);
+  this->createParam(str_NDFileHDF5_readChunks,      asynParamInt32,   &NDFileHDF5_readChunks);
+  this->createParam(str_NDFileHDF5_readNumFrames,   asynParamInt32,   &NDFileHDF5_readNumFrames);
+  this->createParam(str_NDFileHDF5_readFrame,       asynParamInt32,   &NDFileHDF5_readFrame);
+  this->createParam(str_NDFileHDF5_readSpeed,       asynParamFloat64, &NDFileHDF5_readSpeed);
 
   setIntegerParam(NDFileHDF5_nRowChunks,      0);
   setIntegerParam(NDFileHDF5_nColChunks,      0);
   setIntegerParam(NDFileHDF5_nFramesChunks,   0);
   setIntegerParam(NDFileHDF5_NDAttributeChunk,0);
+  setIntegerParam(NDFileHDF5_NDAttributeBatch,1);
+  setIntegerParam(NDFileHDF5_NDAttributePacked,0);
   setIntegerParam(NDFileHDF5_chunkBoundaryAlign, 0);
   setIntegerParam(NDFileHDF5_chunkBoundaryThreshold, 65536);
+  setIntegerParam(NDFileHDF5_chunkAutoTune,   HDF5ChunkTuneOff);
+  setIntegerParam(NDFileHDF5_chunkTargetBytes, CHUNK_TUNE_TARGET_BYTES);
+  setDoubleParam (NDFileHDF5_chunkAchievedSpeed, 0.0);
   setIntegerParam(NDFileHDF5_nExtraDims,      0);
   setIntegerParam(NDFileHDF5_extraDimOffsetX, 0);
   setIntegerParam(NDFileHDF5_extraDimOffsetY, 0);
@@ -2062,7 +2655,16 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_storePerformance,1);
   setDoubleParam (NDFileHDF5_totalRuntime,    0.0);
   setDoubleParam (NDFileHDF5_totalIoSpeed,    0.0);
+  setDoubleParam (NDFileHDF5_frameWriteTime,  0.0);
+  setDoubleParam (NDFileHDF5_extendTime,      0.0);
+  setDoubleParam (NDFileHDF5_writeTime,       0.0);
+  setDoubleParam (NDFileHDF5_compressTime,    0.0);
+  setDoubleParam (NDFileHDF5_attributeTime,   0.0);
+  setDoubleParam (NDFileHDF5_flushTime,       0.0);
   setIntegerParam(NDFileHDF5_flushNthFrame,   0);
+  setIntegerParam(NDFileHDF5_flushPeriod,     0);
+  setIntegerParam(NDFileHDF5_flushMaxPeriod,  0);
+  setIntegerParam(NDFileHDF5_preCreateFile,   0);
   setIntegerParam(NDFileHDF5_compressionType, HDF5CompressNone);
   setIntegerParam(NDFileHDF5_nbitsPrecision,  8);
   setIntegerParam(NDFileHDF5_nbitsOffset,     0);
@@ -2071,6 +2673,8 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_bloscShuffleType, 1);
   setIntegerParam(NDFileHDF5_bloscCompressor, 0);
   setIntegerParam(NDFileHDF5_bloscCompressLevel, 5);
+  setIntegerParam(NDFileHDF5_bshufBlockSize,  0);
+  setIntegerParam(NDFileHDF5_zstdCompressLevel, 3);
   setIntegerParam(NDFileHDF5_dimAttDatasets,  0);
   setStringParam (NDFileHDF5_layoutErrorMsg,  "");
   setIntegerParam(NDFileHDF5_layoutValid,     1);
@@ -2084,6 +2688,34 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_SWMRCbCounter,   0);
   setIntegerParam(NDFileHDF5_SWMRMode,        0);
   setIntegerParam(NDFileHDF5_SWMRRunning,     0);
+  setIntegerParam(NDFileHDF5_directChunk,     0);
+  setIntegerParam(NDFileHDF5_directChunkActive, 0);
+  setIntegerParam(NDFileHDF5_metaBlockSize,   0);
+  setIntegerParam(NDFileHDF5_sieveBufSize,    0);
+  setIntegerParam(NDFileHDF5_directIO,        0);
+  setIntegerParam(NDFileHDF5_vdsNumWriters,   0);
+  setIntegerParam(NDFileHDF5_vdsWriterIndex,  0);
+  setStringParam (NDFileHDF5_vdsFileName,     "");
+  setIntegerParam(NDFileHDF5_mpiMode,         0);
+  setIntegerParam(NDFileHDF5_mpiRank,         0);
+  setIntegerParam(NDFileHDF5_mpiSize,         1);
+  setStringParam (NDFileHDF5_mpiFrameAttribute, "");
+  setStringParam (NDFileHDF5_readDataset,     "/entry/data/data");
+  setIntegerParam(NDFileHDF5_readAhead,       16);
+  setIntegerParam(NDFileHDF5_readChunks,      0);
+  setIntegerParam(NDFileHDF5_readNumFrames,   0);
+  setIntegerParam(NDFileHDF5_readFrame,       0);
+  setDoubleParam (NDFileHDF5_readSpeed,       0.0);
+#ifdef ND_WITH_HDF5_MPI
+  setIntegerParam(NDFileHDF5_mpiSupported,    1);
+#else
+  setIntegerParam(NDFileHDF5_mpiSupported,    0);
+#endif
+#ifdef H5_HAVE_DIRECT
+  setIntegerParam(NDFileHDF5_directIOSupported, 1);
+#else
+  setIntegerParam(NDFileHDF5_directIOSupported, 0);
+#endif
   if (checkForSWMRSupported()){
     setIntegerParam(NDFileHDF5_SWMRSupported, 1);
   } else {
@@ -2132,6 +2764,32 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->performanceBuf       = NULL;
   this->performancePtr       = NULL;
   this->numPerformancePoints = 0;
+  this->directChunk          = false;
+  // Arrays compressed by NDPluginCodec are written as direct chunks, as are packed arrays.  Sparse arrays
+  // are written as events.
+  supportsCompressedArrays_  = true;
+  supportsPackedArrays_      = true;
+  supportsSparseArrays_      = true;
+  this->sparse               = false;
+  this->framesPerArray       = 1;
+  this->packedBits           = 0;
+  this->fileWriteMB          = 0.0;
+  this->fileWriteSeconds     = 0.0;
+  this->tunePrevSpeed        = 0.0;
+  this->tuneDirection        = 1;
+  this->timedFlush           = false;
+  this->framesUnflushed      = 0;
+  this->flushEvent           = epicsEventCreate(epicsEventEmpty);
+  this->flushThreadId        = 0;
+  this->nextFile             = 0;
+  this->nextFileEvent        = epicsEventCreate(epicsEventEmpty);
+  this->nextFileThreadId     = 0;
+  this->mpi                  = false;
+  this->mpiRank              = 0;
+  this->mpiSize              = 1;
+  this->mpiFrames            = 0;
+  this->pReader              = NULL;
+  this->pPackedAttributes    = NULL;
 
   this->hostname = (char*)calloc(MAXHOSTNAMELEN, sizeof(char));
   gethostname(this->hostname, MAXHOSTNAMELEN);
@@ -2256,6 +2914,127 @@ hsize_t NDFileHDF5::calcChunkCacheSlots()
   return nslots;
 }
 
+/** Pick the chunking of the detector datasets from the frames, when the chunk auto-tune is enabled.
+ * The chunks are sized so that they are stored in about ChunkTargetBytes, rounded to the BoundaryAlign
+ * of the file system; the uncompressed chunks are larger by the expected compression ratio.  A chunk holds
+ * whole frames when they are smaller than that, otherwise whole rows or, for very wide frames, part of a
+ * row.  Direct chunk writes need chunks of whole rows of one frame.  The chunking parameters are set to
+ * the values that are picked.
+ */
+void NDFileHDF5::tuneChunking(NDArray *pArray)
+{
+  int autoTune = 0, targetBytes = 0, align = 0, compressionScheme = HDF5CompressNone;
+  int precision = 0, directChunk = 0, fileWriteMode = 0, numCapture = 0, flush = 0;
+  bool swmr;
+  static const char *functionName = "tuneChunking";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &autoTune);
+  getIntegerParam(NDFileHDF5_chunkTargetBytes, &targetBytes);
+  getIntegerParam(NDFileHDF5_chunkBoundaryAlign, &align);
+  getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
+  getIntegerParam(NDFileHDF5_nbitsPrecision, &precision);
+  getIntegerParam(NDFileHDF5_directChunk, &directChunk);
+  getIntegerParam(NDFileWriteMode, &fileWriteMode);
+  getIntegerParam(NDFileNumCapture, &numCapture);
+  getIntegerParam(NDFileHDF5_flushNthFrame, &flush);
+  swmr = checkForSWMRMode();
+  this->unlock();
+  if (autoTune == HDF5ChunkTuneOff) return;
+  if (pArray->ndims != 2){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s only the chunking of 2-D frames is tuned, using the chunking parameters\n",
+              driverName, functionName);
+    return;
+  }
+
+  double stored = (targetBytes > 0) ? targetBytes : CHUNK_TUNE_TARGET_BYTES;
+  if (align > 0) stored = (stored > align) ? floor(stored / align) * align : align;
+  double ratio = 1.0;
+  if (compressionScheme == HDF5CompressNumBits){
+    if (precision > 0) ratio = (8.0 * this->bytesPerElement) / precision;
+  } else if (compressionScheme != HDF5CompressNone){
+    ratio = CHUNK_TUNE_COMPRESSION_RATIO;
+  }
+  if (ratio < 1.0) ratio = 1.0;
+  double raw = stored * ratio;
+
+  int numCols = (int)pArray->dims[0].size;
+  int numRows = (int)pArray->dims[1].size;
+  double rowBytes = (double)numCols * this->bytesPerElement;
+  double frameBytes = rowBytes * numRows;
+  bool direct = directChunk || !pArray->codec.empty() || this->packedBits;
+  int colChunks = numCols, rowChunks = numRows, framesChunks = 1;
+  if (this->packedBits){
+    // Packed arrays are written as direct chunks of one frame
+  } else if (frameBytes <= raw && !direct){
+    framesChunks = (int)(raw / frameBytes);
+    if (fileWriteMode == NDFileModeSingle) framesChunks = 1;
+    if (fileWriteMode == NDFileModeCapture && numCapture > 0 &&
+        framesChunks > numCapture * this->framesPerArray) framesChunks = numCapture * this->framesPerArray;
+    // SWMR readers see the frames of a chunk when it is flushed
+    if (swmr && flush > 0 && framesChunks > flush) framesChunks = flush;
+    if (framesChunks < 1) framesChunks = 1;
+  } else if (rowBytes <= raw || direct){
+    // Chunks of equal numbers of rows, so the last chunk is not much smaller than the others
+    rowChunks = (int)(raw / rowBytes);
+    if (rowChunks < 1) rowChunks = 1;
+    if (rowChunks > numRows) rowChunks = numRows;
+    int numChunks = (numRows + rowChunks - 1) / rowChunks;
+    rowChunks = (numRows + numChunks - 1) / numChunks;
+  } else {
+    rowChunks = 1;
+    colChunks = (int)(raw / this->bytesPerElement);
+    if (colChunks < 1) colChunks = 1;
+    int numChunks = (numCols + colChunks - 1) / colChunks;
+    colChunks = (numCols + numChunks - 1) / numChunks;
+  }
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s frame %dx%d of %d bytes/element, target %.0f bytes stored (%.0f uncompressed): "
+            "chunks of %d cols, %d rows, %d frames\n",
+            driverName, functionName, numCols, numRows, this->bytesPerElement, stored, raw,
+            colChunks, rowChunks, framesChunks);
+  this->lock();
+  setIntegerParam(NDFileHDF5_nColChunks, colChunks);
+  setIntegerParam(NDFileHDF5_nRowChunks, rowChunks);
+  setIntegerParam(NDFileHDF5_nFramesChunks, framesChunks);
+  this->unlock();
+}
+
+/** Adapt the target chunk size for the next file of a series in the Adapt mode of the chunk auto-tune.
+ * The target is doubled or halved after each file, and it is changed the other way when the file was
+ * written slower than the previous one, so it settles about the chunk size that is written fastest.
+ * \param[in] achievedSpeed The MB/s the file was written with.
+ */
+void NDFileHDF5::adaptChunkTarget(double achievedSpeed)
+{
+  int autoTune = 0, targetBytes = 0;
+  static const char *functionName = "adaptChunkTarget";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &autoTune);
+  getIntegerParam(NDFileHDF5_chunkTargetBytes, &targetBytes);
+  if (autoTune != HDF5ChunkTuneAdapt || achievedSpeed <= 0.0){
+    this->unlock();
+    return;
+  }
+  if (targetBytes <= 0) targetBytes = CHUNK_TUNE_TARGET_BYTES;
+  if (this->tunePrevSpeed > 0.0 && achievedSpeed < this->tunePrevSpeed) this->tuneDirection = -this->tuneDirection;
+  this->tunePrevSpeed = achievedSpeed;
+  if ((this->tuneDirection > 0 && targetBytes >= CHUNK_TUNE_MAX_BYTES) ||
+      (this->tuneDirection < 0 && targetBytes <= CHUNK_TUNE_MIN_BYTES)) this->tuneDirection = -this->tuneDirection;
+  targetBytes = (this->tuneDirection > 0) ? targetBytes * 2 : targetBytes / 2;
+  if (targetBytes > CHUNK_TUNE_MAX_BYTES) targetBytes = CHUNK_TUNE_MAX_BYTES;
+  if (targetBytes < CHUNK_TUNE_MIN_BYTES) targetBytes = CHUNK_TUNE_MIN_BYTES;
+  setIntegerParam(NDFileHDF5_chunkTargetBytes, targetBytes);
+  callParamCallbacks();
+  this->unlock();
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s file written with %.1f MB/s, target chunk size of the next file %d bytes\n",
+            driverName, functionName, achievedSpeed, targetBytes);
+}
+
 /** Setup the required allocation for the performance dataset
  */
 asynStatus NDFileHDF5::configurePerformanceDataset()
@@ -2275,7 +3054,7 @@ asynStatus NDFileHDF5::configurePerformanceDataset()
     this->numPerformancePoints = numCaptureFrames;
     if (this->performanceBuf != NULL) {free(this->performanceBuf); this->performanceBuf = NULL;}
     if (this->performanceBuf == NULL)
-      this->performanceBuf = (epicsFloat64*)  calloc(5 * this->numPerformancePoints, sizeof(double));
+      this->performanceBuf = (epicsFloat64*)  calloc(PERFORMANCE_COLUMNS * this->numPerformancePoints, sizeof(double));
   }
   this->performancePtr  = this->performanceBuf;
 
@@ -2311,7 +3090,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
       }
     }
     dims[0] = 1;
-    dims[1] = 5;
+    dims[1] = PERFORMANCE_COLUMNS;
 
     if(perf_group == NULL)
     {
@@ -2336,7 +3115,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
     // Check the chunking value
     calculateAttributeChunking(&chunking, mdchunking);
     hid_t hdfcparm   = H5Pcreate(H5P_DATASET_CREATE);
-    hsize_t chunk[2] = {chunking, 5};
+    hsize_t chunk[2] = {chunking, PERFORMANCE_COLUMNS};
     int hdfrank  = 2;
     H5Pset_chunk(hdfcparm, hdfrank, chunk);
 
@@ -2368,11 +3147,13 @@ asynStatus NDFileHDF5::writePerformanceDataset()
 {
   hsize_t dims[2];
   epicsInt32 numCaptured;
+  double achievedSpeed = 0.0;
 
   this->lock();
   getIntegerParam(NDFileNumCaptured, &numCaptured);
+  getDoubleParam(NDFileHDF5_chunkAchievedSpeed, &achievedSpeed);
   this->unlock();
-  dims[1] = 5;
+  dims[1] = PERFORMANCE_COLUMNS;
   if (numCaptured < this->numPerformancePoints) dims[0] = numCaptured;
   else dims[0] = this->numPerformancePoints;
 
@@ -2385,6 +3166,14 @@ asynStatus NDFileHDF5::writePerformanceDataset()
              H5S_ALL, H5S_ALL,
              H5P_DEFAULT, this->performanceBuf);
 
+    // The chunking of the detector datasets and the speed it achieved, to compare the files of a series
+    std::stringstream chunking;
+    for (int i=0; i<this->rank; i++) chunking << (i ? "," : "") << this->chunkdims[i];
+    std::stringstream speed;
+    speed << achievedSpeed;
+    this->writeH5attrInt32(this->perf_dataset_id, "chunk_dims", chunking.str());
+    this->writeH5attrFloat64(this->perf_dataset_id, "achieved_MBps", speed.str());
+
     /* Close the second dataset */
     H5Dclose(this->perf_dataset_id);
   }
@@ -2402,6 +3191,8 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
   int chunking = 0;
   //int fileWriteMode = 0;
   int dimAttDataset = 0;
+  int batchSize = 1;
+  int packed = 0;
   int posRunning = 0;
   hid_t groupDefault = -1;
   const char *attrNames[5] = {"NDAttrName", "NDAttrDescription", "NDAttrSourceType", "NDAttrSource", NULL};
@@ -2415,6 +3206,8 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
   getIntegerParam(NDFileHDF5_dimAttDatasets, &dimAttDataset);
   getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
   getIntegerParam(NDFileHDF5_posRunning, &posRunning);
+  getIntegerParam(NDFileHDF5_NDAttributeBatch, &batchSize);
+  getIntegerParam(NDFileHDF5_NDAttributePacked, &packed);
 
   if (this->multiFrameFile){
     struct extradimdefs_t {
@@ -2471,6 +3264,16 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
     }
   }
 
+  // The numeric NDAttributes of the default group are packed into the records of one dataset, except for the
+  // identity of the frames, which keeps its datasets, and the NDAttributes of multi-dimensional or index datasets
+  if (packed == 1 && dimAttDataset == 0 && groupDefault > -1){
+    this->pPackedAttributes = new NDFileHDF5PackedAttributeDataset(this->file, "NDAttributes");
+    if (def_group != NULL) {
+      this->pPackedAttributes->setParentGroupName(def_group->get_full_name());
+    }
+    this->pPackedAttributes->setBatchSize(batchSize);
+  }
+
   ndAttr = this->pFileAttributes->next(ndAttr); // get the first NDAttribute
   while(ndAttr != NULL)
   {
@@ -2490,6 +3293,7 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
       attDset->setDsetName(dset->get_name());
       attDset->setWhenToSave(dsource.get_when_to_save());
       attDset->setParentGroupName(dset->get_parent()->get_full_name());
+      attDset->setBatchSize(batchSize);
       if (dimAttDataset == 1){
         if (isAttributeIndex(atName) > -1 && posRunning == 1){
           // This dataset is specified as an index dataset
@@ -2517,12 +3321,18 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
       attrList.push_back(attDset);
 
     } else {
-      if(groupDefault > -1) {
+      if (this->pPackedAttributes && NDFileHDF5PackedAttributeDataset::isPackable(ndAttr) &&
+          strcmp(ndAttr->getName(), uniqueIDName) && strcmp(ndAttr->getName(), "NDArrayTimeStamp") &&
+          strcmp(ndAttr->getName(), "NDArrayEpicsTSSec") && strcmp(ndAttr->getName(), "NDArrayEpicsTSnSec") &&
+          isAttributeIndex(ndAttr->getName()) < 0) {
+        this->pPackedAttributes->addMember(ndAttr);
+      } else if(groupDefault > -1) {
         std::string atName = std::string(epicsStrDup(ndAttr->getName()));
         NDFileHDF5AttributeDataset *attDset = new NDFileHDF5AttributeDataset(this->file, atName, ndAttr->getDataType());
         if(def_group != NULL) {
           attDset->setParentGroupName(def_group->get_full_name().c_str());
         }
+        attDset->setBatchSize(batchSize);
         if (dimAttDataset == 1){
           if (isAttributeIndex(atName) > -1 && posRunning == 1){
             // This dataset is specified as an index dataset
@@ -2548,6 +3358,21 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
     }
     ndAttr = this->pFileAttributes->next(ndAttr);
   }
+  if (this->pPackedAttributes){
+    if (this->pPackedAttributes->getNumMembers() == 0 ||
+        this->pPackedAttributes->createDataset(chunking) != asynSuccess){
+      if (this->pPackedAttributes->getNumMembers() > 0){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s ERROR creating the packed NDAttributes dataset\n",
+                  driverName, functionName);
+      }
+      this->pPackedAttributes->closeAttributeDataset();
+      delete this->pPackedAttributes;
+      this->pPackedAttributes = NULL;
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s packed %d NDAttributes into one dataset\n",
+                driverName, functionName, this->pPackedAttributes->getNumMembers());
+    }
+  }
   if(def_group != NULL){
     H5Gclose(groupDefault);
   }
@@ -2577,6 +3402,7 @@ asynStatus NDFileHDF5::calculateAttributeChunking(int *chunking, int *mdim_chunk
     } else {
       // We aren't in single mode so read the number of frames
       getIntegerParam(NDFileNumCapture, chunking);
+      *chunking *= this->framesPerArray;
       if (*chunking <= 0) {
         // Special case: writing infinite number of frames, so we guess a good(ish) chunk number
         *chunking = 16*1024;
@@ -2619,8 +3445,8 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
   NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
   static const char *functionName = "writeAttributeDataset";
 
-  // Check if we need to force a flush of the datasets
-  if (checkForSWMRMode()){
+  // Check if we need to force a flush of the datasets, unless the flush thread flushes them
+  if (checkForSWMRMode() && !this->timedFlush){
     int numCaptured = 0;
     this->lock();
     getIntegerParam(NDFileNumCaptured, &numCaptured);
@@ -2664,6 +3490,13 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
     }
   }
 
+  // The packed NDAttributes are all per frame, and are also written before the unique ID
+  if (whenToSave == hdf5::OnFrame && this->pPackedAttributes){
+    if (this->pPackedAttributes->writeAttributeDataset(this->pFileAttributes, flush) != asynSuccess){
+      status = asynError;
+    }
+  }
+
   // Now locate and write the unique ID attribute ensuring it is the last attribute written
   ndAttr = this->pFileAttributes->find(uniqueIDName);
   if (ndAttr == NULL || uniqueIDNode == NULL){
@@ -2698,6 +3531,11 @@ asynStatus NDFileHDF5::closeAttributeDataset()
     dsetPtr->closeAttributeDataset();
     delete(dsetPtr);
   }
+  if (this->pPackedAttributes){
+    if (this->pPackedAttributes->closeAttributeDataset() != asynSuccess) status = asynError;
+    delete this->pPackedAttributes;
+    this->pPackedAttributes = NULL;
+  }
 
   return status;
 }
@@ -2770,12 +3608,32 @@ asynStatus NDFileHDF5::configureDatasetDims(NDArray *pArray)
   getIntegerParam(NDFileHDF5_nFramesChunks, &user_chunking[2]);
   getIntegerParam(NDFileHDF5_nRowChunks,    &user_chunking[1]);
   getIntegerParam(NDFileHDF5_nColChunks,    &user_chunking[0]);
+
+  // Extend the datasets by whole blocks of frames rather than one frame at a time: all of the frames
+  // in Capture mode, otherwise whole chunks of at least HDF5_EXTEND_BLOCK_FRAMES frames.  SWMR readers
+  // take the size of the dataset as the frames that are written, so they are extended by one frame.
+  int fileWriteMode = 0, numFrames = 0;
+  hsize_t extendBlock = 1;
+  getIntegerParam(NDFileWriteMode, &fileWriteMode);
+  getIntegerParam(NDFileNumCapture, &numFrames);
+  numFrames *= this->framesPerArray;
+  if (!checkForSWMRMode()){
+    hsize_t framesChunk = (user_chunking[2] > 1) ? user_chunking[2] : 1;
+    extendBlock = ((HDF5_EXTEND_BLOCK_FRAMES + framesChunk - 1) / framesChunk) * framesChunk;
+    if (fileWriteMode == NDFileModeCapture && numFrames > 0) extendBlock = numFrames;
+    // All of the MPI ranks write NumCapture frames to the same datasets
+    if (this->mpi && fileWriteMode == NDFileModeCapture && numFrames > 0) extendBlock = (hsize_t)numFrames * this->mpiSize;
+  }
   this->unlock();
 
   // Iterate over the stored detector data sets and configure the dimensions
   std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
     it_dset->second->configureDims(pArray, this->multiFrameFile, extradims, numCapture, user_chunking);
+    it_dset->second->setExtendBlock(extendBlock);
+#ifdef ND_WITH_HDF5_MPI
+    if (this->mpi && it_dset->second->setParallel(MPI_COMM_WORLD) != asynSuccess) status = asynError;
+#endif
   }
   
   if (numCapture != NULL) free( numCapture );
@@ -2866,6 +3724,7 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
       if (extradims == 1 && i == 0){
         // Special case, no extra dims so numCapture is equal to specified number of frames
         getIntegerParam(NDFileNumCapture, &numCapture);
+        numCapture *= this->framesPerArray;
       } else {
         getIntegerParam(extradimdefs[MAXEXTRADIMS - extradims + i].sizeParamId, &numCapture);
       }
@@ -2987,6 +3846,8 @@ asynStatus NDFileHDF5::configureCompression()
   int bloscShuffle = 0;
   int bloscCompressor = 0;
   int bloscLevel = 0;
+  int bshufBlockSize = 0;
+  int zstdLevel = 0;
   static const char * functionName = "configureCompression";
 
   this->lock();
@@ -2998,6 +3859,8 @@ asynStatus NDFileHDF5::configureCompression()
   getIntegerParam(NDFileHDF5_bloscShuffleType, &bloscShuffle);
   getIntegerParam(NDFileHDF5_bloscCompressor, &bloscCompressor);
   getIntegerParam(NDFileHDF5_bloscCompressLevel, &bloscLevel);
+  getIntegerParam(NDFileHDF5_bshufBlockSize, &bshufBlockSize);
+  getIntegerParam(NDFileHDF5_zstdCompressLevel, &zstdLevel);
   this->unlock();
   switch (compressionScheme)
   {
@@ -3043,10 +3906,657 @@ asynStatus NDFileHDF5::configureCompression()
           H5Pset_filter(this->cparms, FILTER_BLOSC, H5Z_FLAG_OPTIONAL, 7, cds);
       }
       break;
+    case HDF5CompressBshufLZ4:
+      {
+          /* 0 to 2 (inclusive) param slots are reserved. */
+          unsigned int cds[5] = {0, 0, 0, 0, BSHUF_H5_COMPRESS_LZ4};
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+                    "%s::%s Setting bitshuffle/LZ4 compression filter block size=%d\n",
+                    driverName, functionName, bshufBlockSize);
+          cds[3] = bshufBlockSize;
+          H5Pset_filter(this->cparms, FILTER_BSHUF, H5Z_FLAG_OPTIONAL, 5, cds);
+      }
+      break;
+    case HDF5CompressZstd:
+      {
+          unsigned int cds[1];
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+                    "%s::%s Setting zstd compression filter level=%d\n",
+                    driverName, functionName, zstdLevel);
+          cds[0] = zstdLevel;
+          H5Pset_filter(this->cparms, FILTER_ZSTD, H5Z_FLAG_OPTIONAL, 1, cds);
+      }
+      break;
   }
   return status;
 }
 
+/** Decide whether the frames can be compressed by this plugin and written with H5Dwrite_chunk,
+ * which moves the compression out of the HDF5 library and into the IntraFrameThreads threads.
+ * This needs HDF5 1.10.3 or later, no compression, bitshuffle/LZ4 or a zlib, blosc or zstd compression
+ * that this plugin was built with, and chunks that hold whole rows of exactly one frame.
+ * Arrays that NDPluginCodec has compressed with the blosc or bslz4 codec are always written as direct chunks,
+ * without being compressed again, if the dataset has the same compression and each chunk is a whole frame.
+ * So are the arrays of the packed data types when each chunk is a whole frame, repacked into the chunk format
+ * of the N-bit filter; otherwise they are unpacked and written with H5Dwrite.
+ * Must be called after the dimensions and the compression have been configured.
+ * \param[in] pArray The first frame of the file.
+ * \return true if the frames of this file are written as direct chunks.
+ */
+bool NDFileHDF5::configureDirectChunk(NDArray *pArray)
+{
+  int enable = 0;
+  int compressionScheme = HDF5CompressNone;
+  int extradims = 0;
+  int i;
+  size_t frameBytes;
+  static const char *functionName = "configureDirectChunk";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_directChunk, &enable);
+  getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
+  getIntegerParam(NDFileHDF5_zCompressLevel, &this->directLevel);
+  if (compressionScheme == HDF5CompressBlosc){
+    getIntegerParam(NDFileHDF5_bloscCompressLevel, &this->directLevel);
+  } else if (compressionScheme == HDF5CompressZstd){
+    getIntegerParam(NDFileHDF5_zstdCompressLevel, &this->directLevel);
+  }
+  getIntegerParam(NDFileHDF5_bshufBlockSize, &this->directBlockSize);
+  getIntegerParam(NDFileHDF5_bloscShuffleType, &this->directShuffle);
+  getIntegerParam(NDFileHDF5_bloscCompressor, &this->directCompressor);
+  this->unlock();
+  // Compressed arrays can only be written as direct chunks
+  if (!pArray->codec.empty()) enable = 1;
+  if (this->packedBits){
+    enable = 1;
+    compressionScheme = HDF5CompressNumBits;
+  }
+  if (!enable) return false;
+  if (this->mpi){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s Direct chunk writes are not used in MPI mode\n",
+              driverName, functionName);
+    return false;
+  }
+
+#if H5_VERSION_GE(1,10,3)
+  switch (compressionScheme)
+  {
+    case HDF5CompressNone:
+      break;
+    case HDF5CompressNumBits:
+      // Only the packed arrays, which are repacked rather than compressed
+      if (this->packedBits) break;
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s compression %d is not supported for direct chunk writes, using H5Dwrite\n",
+                driverName, functionName, compressionScheme);
+      return false;
+#ifdef ND_WITH_ZLIB
+    case HDF5CompressZlib:
+      break;
+#endif
+#ifdef ND_WITH_BLOSC
+    case HDF5CompressBlosc:
+      break;
+#endif
+    case HDF5CompressBshufLZ4:
+      break;
+#ifdef ND_WITH_ZSTD
+    case HDF5CompressZstd:
+      break;
+#endif
+    default:
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s compression %d is not supported for direct chunk writes, using H5Dwrite\n",
+                driverName, functionName, compressionScheme);
+      return false;
+  }
+
+  // Each chunk must hold part of one frame, split only in the slowest frame dimension,
+  // so the chunks are contiguous blocks of the NDArray
+  extradims = this->rank - pArray->ndims;
+  for (i=0; i<this->rank; i++){
+    if ((i < extradims && this->chunkdims[i] != 1) ||
+        (i > extradims && this->chunkdims[i] != this->framesize[i])){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s the chunks must hold whole rows of one frame for direct chunk writes, using H5Dwrite\n",
+                driverName, functionName);
+      return false;
+    }
+  }
+
+  if (this->packedBits && this->chunkdims[extradims] != this->framesize[extradims]){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s packed arrays need chunks of one frame for direct chunk writes, unpacking them\n",
+              driverName, functionName);
+    return false;
+  }
+
+  frameBytes = this->bytesPerElement;
+  for (i=extradims; i<this->rank; i++) frameBytes *= (size_t)this->framesize[i];
+  if (this->packedBits) frameBytes = NDPackedBytes(this->packedBits, frameBytes / this->bytesPerElement);
+  this->directCompression = compressionScheme;
+  this->directFrameBytes = frameBytes;
+  this->directChunkBytes = frameBytes / (size_t)this->framesize[extradims] * (size_t)this->chunkdims[extradims];
+  if (this->packedBits) this->directChunkBytes = frameBytes;
+  this->directNumChunks = (int)((this->framesize[extradims] + this->chunkdims[extradims] - 1) / this->chunkdims[extradims]);
+  this->directBoundBytes = 0;
+  // The N-bit filter stores the bits of the elements and at most one more byte
+  if (compressionScheme == HDF5CompressNumBits) this->directBoundBytes = frameBytes + 1;
+#ifdef ND_WITH_ZLIB
+  if (compressionScheme == HDF5CompressZlib) this->directBoundBytes = compressBound((uLong)this->directChunkBytes);
+#endif
+#ifdef ND_WITH_BLOSC
+  if (compressionScheme == HDF5CompressBlosc) this->directBoundBytes = this->directChunkBytes + BLOSC_MAX_OVERHEAD;
+#endif
+#ifdef ND_WITH_ZSTD
+  if (compressionScheme == HDF5CompressZstd) this->directBoundBytes = ZSTD_compressBound(this->directChunkBytes);
+#endif
+  if (compressionScheme == HDF5CompressBshufLZ4){
+    this->directBoundBytes = NDBitshuffleLZ4Bound(this->bytesPerElement, this->directBlockSize, this->directChunkBytes);
+    this->directScratch.resize(NDBitshuffleBlockSize(this->bytesPerElement, this->directBlockSize) *
+                               this->bytesPerElement * this->directNumChunks);
+  }
+  if (this->directBuffer.size() < this->directBoundBytes * this->directNumChunks){
+    this->directBuffer.resize(this->directBoundBytes * this->directNumChunks);
+  }
+  if (frameBytes % this->directChunkBytes) this->directPadBuffer.assign(this->directChunkBytes, 0);
+  this->directChunkData.resize(this->directNumChunks);
+  this->directChunkSizes.resize(this->directNumChunks);
+  this->directChunkMasks.resize(this->directNumChunks);
+  if (!pArray->codec.empty() && !this->codecMatchesDirectChunk(pArray)){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s arrays compressed with codec %s need the same compression and chunks of one frame\n",
+              driverName, functionName, pArray->codec.name.c_str());
+    return false;
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s direct chunk writes, %d chunks of %lu bytes per frame\n",
+            driverName, functionName, this->directNumChunks, (unsigned long)this->directChunkBytes);
+  return true;
+#else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s direct chunk writes need HDF5 1.10.3 or later, using H5Dwrite\n",
+            driverName, functionName);
+  return false;
+#endif
+}
+
+/** Compresses one chunk of a frame, for parallelForTasks().  Each task writes only its own chunk.
+ * A chunk that does not get smaller is stored uncompressed, with the filter skipped in its filter mask.
+ * \param[in] pArg The hdf5ChunkTaskArgs_t
+ * \param[in] task The index of the chunk
+ */
+void NDFileHDF5::compressChunkTask(void *pArg, int task)
+{
+  hdf5ChunkTaskArgs_t *pArgs = (hdf5ChunkTaskArgs_t *)pArg;
+  NDFileHDF5 *pPlugin = pArgs->pPlugin;
+  size_t chunkBytes = pPlugin->directChunkBytes;
+  size_t offset = (size_t)task * chunkBytes;
+  const char *pSrc = pArgs->pData + offset;
+  char *pDest;
+  size_t compressedBytes = 0;
+
+  // The last chunk may be only partly filled, but HDF5 always stores whole chunks
+  if (pArgs->frameBytes - offset < chunkBytes){
+    memcpy(&pPlugin->directPadBuffer[0], pSrc, pArgs->frameBytes - offset);
+    pSrc = &pPlugin->directPadBuffer[0];
+  }
+  pPlugin->directChunkData[task] = pSrc;
+  pPlugin->directChunkSizes[task] = chunkBytes;
+  pPlugin->directChunkMasks[task] = 0;
+  if (pPlugin->directCompression == HDF5CompressNone) return;
+  pDest = &pPlugin->directBuffer[0] + (size_t)task * pPlugin->directBoundBytes;
+
+#ifdef ND_WITH_ZLIB
+  if (pPlugin->directCompression == HDF5CompressZlib){
+    uLongf destLen = (uLongf)pPlugin->directBoundBytes;
+    if (compress2((Bytef *)pDest, &destLen, (const Bytef *)pSrc, (uLong)chunkBytes, pPlugin->directLevel) == Z_OK){
+      compressedBytes = destLen;
+    }
+  }
+#endif
+#ifdef ND_WITH_BLOSC
+  if (pPlugin->directCompression == HDF5CompressBlosc){
+    const char *compname = NULL;
+    int typesize = pArgs->elementSize;
+    int nBytes;
+    if (typesize > BLOSC_MAX_TYPESIZE) typesize = 1;
+    blosc_compcode_to_compname(pPlugin->directCompressor, &compname);
+    nBytes = blosc_compress_ctx(pPlugin->directLevel, pPlugin->directShuffle, typesize, chunkBytes, pSrc,
+                                pDest, pPlugin->directBoundBytes, compname, 0, 1);
+    if (nBytes > 0) compressedBytes = nBytes;
+  }
+#endif
+#ifdef ND_WITH_ZSTD
+  if (pPlugin->directCompression == HDF5CompressZstd){
+    size_t nBytes = ZSTD_compress(pDest, pPlugin->directBoundBytes, pSrc, chunkBytes, pPlugin->directLevel);
+    if (!ZSTD_isError(nBytes)) compressedBytes = nBytes;
+  }
+#endif
+  if (pPlugin->directCompression == HDF5CompressBshufLZ4){
+    size_t scratchBytes = pPlugin->directScratch.size() / pPlugin->directNumChunks;
+    if (NDBitshuffleLZ4Compress(pArgs->elementSize, pPlugin->directBlockSize, pSrc, chunkBytes,
+                                &pPlugin->directScratch[0] + (size_t)task * scratchBytes, pDest,
+                                pPlugin->directBoundBytes, &compressedBytes) != ND_SUCCESS){
+      compressedBytes = 0;
+    }
+  }
+  if (compressedBytes > 0 && compressedBytes < chunkBytes){
+    pPlugin->directChunkData[task] = pDest;
+    pPlugin->directChunkSizes[task] = compressedBytes;
+  } else {
+    // Skip the only filter of the pipeline for this chunk
+    pPlugin->directChunkMasks[task] = 0x1;
+  }
+}
+
+/** Returns true if the data of a compressed array is the one chunk of a frame of the dataset: its codec is the
+ * compression of the dataset, blosc or bslz4, which store the chunks in the same format, and a chunk is one frame.
+ * \param[in] pArray The compressed frame.
+ */
+bool NDFileHDF5::codecMatchesDirectChunk(NDArray *pArray)
+{
+  if (this->directNumChunks != 1) return false;
+  if (pArray->codec.name == NDCodecName[NDCodecBSLZ4]) return this->directCompression == HDF5CompressBshufLZ4;
+  if (pArray->codec.name == NDCodecName[NDCodecBlosc]) return this->directCompression == HDF5CompressBlosc;
+  return false;
+}
+
+/** Repacks the elements of one frame of a packed data type, which are stored least significant bit first, into the
+ * chunk format of the HDF5 N-bit filter, which stores them one after the other from the most significant bit of the
+ * first byte.  The output has the size that the filter gives it: the bytes that hold the bits, and one more if the
+ * bits end at a byte boundary.
+ * \param[in] pIn The packed elements.
+ * \param[in] bits The bits of each element.
+ * \param[in] nElements The number of elements.
+ * \param[out] pOut The chunk, of at least NDPackedBytes(bits, nElements) + 1 bytes.
+ * \return The size of the chunk.
+ */
+static size_t packNbitChunk(const epicsUInt8 *pIn, int bits, size_t nElements, char *pOut)
+{
+  epicsUInt32 mask = (1u << bits) - 1;
+  epicsUInt32 buffer = 0;
+  int bufferBits = 0;
+  size_t i, bit, n = 0;
+
+  for (i=0, bit=0; i<nElements; i++, bit+=bits){
+    const epicsUInt8 *p = pIn + (bit >> 3);
+    epicsUInt32 value = ((p[0] | ((epicsUInt32)p[1] << 8)) >> (bit & 7)) & mask;
+    buffer = (buffer << bits) | value;
+    for (bufferBits+=bits; bufferBits>=8; bufferBits-=8){
+      pOut[n++] = (char)(buffer >> (bufferBits - 8));
+    }
+    buffer &= (1u << bufferBits) - 1;
+  }
+  pOut[n++] = (char)(buffer << (8 - bufferBits));
+  return n;
+}
+
+/** Compresses the chunks of a frame in the IntraFrameThreads threads, ready for writeDirectChunks.
+ * The data of a compressed array is written as it is, see codecMatchesDirectChunk(), and the data of a packed array
+ * is repacked for the N-bit filter.
+ * \param[in] pArray The frame.
+ */
+asynStatus NDFileHDF5::compressDirectChunks(NDArray *pArray)
+{
+  NDArrayInfo_t info;
+  hdf5ChunkTaskArgs_t args;
+  static const char *functionName = "compressDirectChunks";
+
+  pArray->getInfo(&info);
+  if (info.totalBytes != this->directFrameBytes){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: array size %lu does not match the dataset\n",
+              driverName, functionName, (unsigned long)info.totalBytes);
+    return asynError;
+  }
+  if (!pArray->codec.empty()){
+    if (!this->codecMatchesDirectChunk(pArray)){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: codec %s of the array does not match the compression of the dataset\n",
+                driverName, functionName, pArray->codec.name.c_str());
+      return asynError;
+    }
+    this->directChunkData[0] = pArray->pData;
+    this->directChunkSizes[0] = pArray->compressedSize;
+    this->directChunkMasks[0] = 0;
+    return asynSuccess;
+  }
+  if (this->packedBits){
+    if (NDPackedBits(pArray->dataType) != this->packedBits){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: data type %d of the array does not match the dataset\n",
+                driverName, functionName, pArray->dataType);
+      return asynError;
+    }
+    this->directChunkData[0] = &this->directBuffer[0];
+    this->directChunkSizes[0] = packNbitChunk((const epicsUInt8 *)pArray->pData, this->packedBits, info.nElements,
+                                              &this->directBuffer[0]);
+    this->directChunkMasks[0] = 0;
+    return asynSuccess;
+  }
+  args.pPlugin = this;
+  args.pData = (const char *)pArray->pData;
+  args.frameBytes = info.totalBytes;
+  args.elementSize = info.bytesPerElement;
+  this->parallelForTasks(compressChunkTask, &args, this->directNumChunks);
+
+  return asynSuccess;
+}
+
+/** Writes the chunks of a frame that compressDirectChunks has compressed to a dataset with H5Dwrite_chunk.
+ * \param[in] pArray The frame.
+ * \param[in] pDataset The dataset, which has already been extended for the frame.
+ */
+asynStatus NDFileHDF5::writeDirectChunks(NDArray *pArray, NDFileHDF5Dataset *pDataset)
+{
+  int chunkDim = this->rank - pArray->ndims;
+
+  return pDataset->writeChunks(this->directNumChunks, chunkDim, this->chunkdims[chunkDim], &this->directChunkData[0],
+                               &this->directChunkSizes[0], &this->directChunkMasks[0]);
+}
+
+/** Creates the event datasets of a file of sparse frames next to the default dataset, as the NeXus
+ * NXevent_data does: <dataset>_event_id holds the linear index in the frame of each event (the first
+ * dimension of the NDArray fastest), <dataset>_event_value its value, and <dataset>_event_index the
+ * first event of each frame.  The default dataset itself is left empty.
+ */
+asynStatus NDFileHDF5::createEventDatasets()
+{
+  hsize_t dims = 0;
+  hsize_t maxdims = H5S_UNLIMITED;
+  hsize_t eventChunk = EVENT_CHUNK_SIZE;
+  hsize_t frameChunk;
+  int chunking = 0;
+  int mdchunking[MAXEXTRADIMS];
+  static const char *functionName = "createEventDatasets";
+
+  for (int index = 0; index < MAXEXTRADIMS; index++){
+    mdchunking[index] = 0;
+  }
+  calculateAttributeChunking(&chunking, mdchunking);
+  frameChunk = (chunking > 0) ? chunking : 1;
+
+  hid_t dataspace = H5Screate_simple(1, &dims, &maxdims);
+  hid_t eventParms = H5Pcreate(H5P_DATASET_CREATE);
+  hid_t frameParms = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(eventParms, 1, &eventChunk);
+  H5Pset_chunk(frameParms, 1, &frameChunk);
+  this->eventIdDataset = H5Dcreate2(this->file, (this->defDsetName + "_event_id").c_str(), H5T_NATIVE_UINT32,
+                                    dataspace, H5P_DEFAULT, eventParms, H5P_DEFAULT);
+  this->eventValueDataset = H5Dcreate2(this->file, (this->defDsetName + "_event_value").c_str(), this->datatype,
+                                       dataspace, H5P_DEFAULT, eventParms, H5P_DEFAULT);
+  this->eventIndexDataset = H5Dcreate2(this->file, (this->defDsetName + "_event_index").c_str(), H5T_NATIVE_UINT64,
+                                       dataspace, H5P_DEFAULT, frameParms, H5P_DEFAULT);
+  H5Pclose(frameParms);
+  H5Pclose(eventParms);
+  H5Sclose(dataspace);
+  this->eventsWritten = 0;
+  this->eventFrames = 0;
+  if (this->eventIdDataset < 0 || this->eventValueDataset < 0 || this->eventIndexDataset < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: unable to create the event datasets of %s\n",
+              driverName, functionName, this->defDsetName.c_str());
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** Flushes the event datasets for SWMR readers; a no-op if the HDF version doesn't support it.
+ */
+asynStatus NDFileHDF5::flushEventDatasets()
+{
+#if H5_VERSION_GE(1,9,178)
+  static const char *functionName = "flushEventDatasets";
+
+  if (H5Dflush(this->eventIdDataset) < 0 || H5Dflush(this->eventValueDataset) < 0 ||
+      H5Dflush(this->eventIndexDataset) < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to flush the event datasets\n",
+              driverName, functionName);
+    return asynError;
+  }
+#endif
+  return asynSuccess;
+}
+
+/** Appends elements to the end of a one dimensional dataset.
+ * \param[in] dataset The dataset.
+ * \param[in] memType The type of the elements in memory.
+ * \param[in] pData The elements.
+ * \param[in] offset The elements already in the dataset.
+ * \param[in] count The elements to append.
+ */
+static herr_t appendToDataset(hid_t dataset, hid_t memType, const void *pData, hsize_t offset, hsize_t count)
+{
+  hsize_t size = offset + count;
+  herr_t hdfstatus;
+
+  hdfstatus = H5Dset_extent(dataset, &size);
+  if (hdfstatus < 0) return hdfstatus;
+  hid_t filespace = H5Dget_space(dataset);
+  hid_t memspace = H5Screate_simple(1, &count, NULL);
+  hdfstatus = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &offset, NULL, &count, NULL);
+  if (hdfstatus >= 0){
+    hdfstatus = H5Dwrite(dataset, memType, memspace, filespace, H5P_DEFAULT, pData);
+  }
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  return hdfstatus;
+}
+
+/** Writes the events of a frame to the event datasets, converting a dense frame to events first.
+ * \param[in] pArray The frame.
+ */
+asynStatus NDFileHDF5::writeEventDatasets(NDArray *pArray)
+{
+  NDArray *pSparse;
+  herr_t hdfstatus;
+  static const char *functionName = "writeEventDatasets";
+
+  if (this->pNDArrayPool->makeSparse(pArray, &pSparse) != ND_SUCCESS){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: cannot convert the frame to events\n",
+              driverName, functionName);
+    return asynError;
+  }
+  hsize_t numEvents = pSparse->numEvents;
+  epicsUInt64 firstEvent = this->eventsWritten;
+  hdfstatus = appendToDataset(this->eventIndexDataset, H5T_NATIVE_UINT64, &firstEvent, this->eventFrames, 1);
+  if (hdfstatus >= 0 && numEvents > 0){
+    hdfstatus = appendToDataset(this->eventIdDataset, H5T_NATIVE_UINT32, pSparse->eventIndices(),
+                                this->eventsWritten, numEvents);
+  }
+  if (hdfstatus >= 0 && numEvents > 0){
+    hdfstatus = appendToDataset(this->eventValueDataset, this->datatype, pSparse->eventValues(),
+                                this->eventsWritten, numEvents);
+  }
+  pSparse->release();
+  if (hdfstatus < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: cannot write %llu events\n",
+              driverName, functionName, (unsigned long long)numEvents);
+    return asynError;
+  }
+  this->eventsWritten += numEvents;
+  this->eventFrames++;
+  return asynSuccess;
+}
+
+/** Registers the file of this plugin as a source of the VDS master file of its multi-writer group.
+ * With VdsNumWriters N > 1, N NDFileHDF5 plugins fed in turn by NDPluginScatter (Method=Round robin)
+ * each write every N'th frame to their own file, and give the same VdsFileName.  The writer that opens
+ * its file last creates the master file, in which the default dataset maps the frames of all of the
+ * files back into one dataset in frame order.  Writer VdsWriterIndex i holds frames i, i+N, i+2N, ...
+ * Must be called after the file layout has been created.
+ * \param[in] fileName The name of the file of this plugin.
+ */
+asynStatus NDFileHDF5::registerVdsWriter(const char *fileName)
+{
+  int numWriters = 0;
+  int writerIndex = 0;
+  int extradims = 0;
+  int posRunning = 0;
+  char vdsFileName[MAX_FILENAME_LEN];
+  std::vector<std::string> sources;
+  bool complete = true;
+  static const char *functionName = "registerVdsWriter";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_vdsNumWriters, &numWriters);
+  getIntegerParam(NDFileHDF5_vdsWriterIndex, &writerIndex);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extradims);
+  getIntegerParam(NDFileHDF5_posRunning, &posRunning);
+  getStringParam(NDFileHDF5_vdsFileName, sizeof(vdsFileName), vdsFileName);
+  this->unlock();
+
+  if (numWriters < 2) return asynSuccess;
+  if (writerIndex < 0 || writerIndex >= numWriters || strlen(vdsFileName) == 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: VdsWriterIndex=%d must be less than VdsNumWriters=%d and VdsFileName must be set\n",
+              driverName, functionName, writerIndex, numWriters);
+    return asynError;
+  }
+  // The frames are interleaved in the frame number dimension only
+  if (!this->multiFrameFile || extradims != 0 || posRunning == 1){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: multiple writers need a multi frame file without extra dimensions or positions\n",
+              driverName, functionName);
+    return asynError;
+  }
+
+  vdsWritersLock.lock();
+  std::vector<std::string>& group = vdsWriters[vdsFileName];
+  if ((int)group.size() != numWriters) group.assign(numWriters, "");
+  group[writerIndex] = fileName;
+  for (int i=0; i<numWriters; i++){
+    if (group[i].empty()) complete = false;
+  }
+  if (complete){
+    sources = group;
+    vdsWriters.erase(vdsFileName);
+  }
+  vdsWritersLock.unlock();
+
+  if (!complete){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s::%s writer %d of %d registered for %s\n",
+              driverName, functionName, writerIndex, numWriters, vdsFileName);
+    return asynSuccess;
+  }
+  return this->createVdsFile(vdsFileName, sources);
+}
+
+/** Creates the VDS master file of a multi-writer group.  Its default dataset is a virtual dataset with an
+ * unlimited frame number dimension, in which frame k is frame k/N of the default dataset of source k%N.
+ * The sources are mapped with unlimited selections, so the master grows as the writers write frames.
+ * \param[in] vdsFileName The name of the master file.
+ * \param[in] sources The files of the N writers, by writer index.
+ */
+asynStatus NDFileHDF5::createVdsFile(const std::string& vdsFileName, const std::vector<std::string>& sources)
+{
+  static const char *functionName = "createVdsFile";
+
+#if H5_VERSION_GE(1,10,0)
+  asynStatus status = asynSuccess;
+  int numWriters = (int)sources.size();
+  std::vector<hsize_t> dims(this->rank), maxdims(this->rank), start(this->rank, 0), stride(this->rank, 1);
+  std::vector<hsize_t> count(this->rank, 1), block(this->rank);
+  char fillValue[16] = {0};
+  int i;
+
+  // The frame dimensions are whole frames, the frame number dimension is interleaved
+  for (i=1; i<this->rank; i++){
+    dims[i] = maxdims[i] = block[i] = this->maxdims[i];
+  }
+  dims[0] = 0;
+  maxdims[0] = H5S_UNLIMITED;
+  count[0] = H5S_UNLIMITED;
+  block[0] = 1;
+
+  hid_t access_plist = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_libver_bounds(access_plist, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+  hid_t vdsFile = H5Fcreate(vdsFileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, access_plist);
+  H5Pclose(access_plist);
+  if (vdsFile < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s Unable to create VDS file: %s\n",
+              driverName, functionName, vdsFileName.c_str());
+    return asynError;
+  }
+
+  hid_t vspace = H5Screate_simple(this->rank, &dims[0], &maxdims[0]);
+  hid_t srcspace = H5Screate_simple(this->rank, &dims[0], &maxdims[0]);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_fill_value(dcpl, this->datatype, fillValue);
+  H5Sselect_hyperslab(srcspace, H5S_SELECT_SET, &start[0], NULL, &count[0], &block[0]);
+  stride[0] = numWriters;
+  for (i=0; i<numWriters; i++){
+    start[0] = i;
+    H5Sselect_hyperslab(vspace, H5S_SELECT_SET, &start[0], &stride[0], &count[0], &block[0]);
+    if (H5Pset_virtual(dcpl, vspace, sources[i].c_str(), this->defDsetName.c_str(), srcspace) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Unable to map %s to the VDS\n",
+                driverName, functionName, sources[i].c_str());
+      status = asynError;
+    }
+  }
+  H5Sselect_all(vspace);
+
+  if (status == asynSuccess){
+    hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    hid_t vdset = H5Dcreate2(vdsFile, this->defDsetName.c_str(), this->datatype, vspace, lcpl, dcpl, H5P_DEFAULT);
+    if (vdset < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Unable to create the virtual dataset %s in %s\n",
+                driverName, functionName, this->defDsetName.c_str(), vdsFileName.c_str());
+      status = asynError;
+    } else {
+      H5Dclose(vdset);
+    }
+    H5Pclose(lcpl);
+  }
+  H5Pclose(dcpl);
+  H5Sclose(srcspace);
+  H5Sclose(vspace);
+  H5Fclose(vdsFile);
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s created %s from %d writers\n",
+            driverName, functionName, vdsFileName.c_str(), numWriters);
+  return status;
+#else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR Virtual datasets need HDF5 1.10.0 or later, %s is not created\n",
+            driverName, functionName, vdsFileName.c_str());
+  return asynError;
+#endif
+}
+
+/** Returns the HDF5 datatype of NDFloat16 elements: H5T_NATIVE_FLOAT16 when HDF5 (1.14.4 and later) has it,
+  * otherwise an IEEE binary16 type in the native byte order built from H5T_NATIVE_FLOAT, which HDF5 1.10 and
+  * later read and convert.  The type is created once and never closed, like the predefined types.
+  */
+static hid_t float16Type()
+{
+  static hid_t type = -1;
+
+  if (type >= 0) return type;
+#ifdef H5T_NATIVE_FLOAT16
+  if (H5T_NATIVE_FLOAT16 >= 0) {
+    type = H5T_NATIVE_FLOAT16;
+    return type;
+  }
+#endif
+  type = H5Tcopy(H5T_NATIVE_FLOAT);
+  H5Tset_fields(type, 15, 10, 5, 0, 10);
+  H5Tset_size(type, 2);
+  H5Tset_ebias(type, 15);
+  return type;
+}
+
 /** Translate the NDArray datatype to HDF5 datatypes 
  */
 hid_t NDFileHDF5::typeNd2Hdf(NDDataType_t datatype)
@@ -3089,6 +4599,16 @@ hid_t NDFileHDF5::typeNd2Hdf(NDDataType_t datatype)
       result = H5T_NATIVE_DOUBLE;
       *(epicsFloat64*)this->ptrFillValue = (epicsFloat64)fillvalue;
       break;
+    case NDFloat16:
+      result = float16Type();
+      *(NDFloat16_t*)this->ptrFillValue = (NDFloat16_t)fillvalue;
+      break;
+    case NDUInt10Packed:
+    case NDUInt12Packed:
+      // Stored as UInt16 with the precision of the packed type, see createFileLayout()
+      result = H5T_NATIVE_UINT16;
+      *(epicsUInt16*)this->ptrFillValue = (epicsUInt16)fillvalue;
+      break;
     default:
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s::%s cannot convert NDArrayType: %d to HDF5 datatype\n",
@@ -3214,19 +4734,26 @@ bool NDFileHDF5::checkForSWMRSupported()
  * epicsTS.nsec.
  */
 void NDFileHDF5::addDefaultAttributes(NDArray *pArray)
+{
+  this->addDefaultAttributes(pArray->uniqueId, pArray->timeStamp, pArray->epicsTS);
+}
+
+/** Add the default attributes of one frame into the local NDAttribute list, for the frames of frame stacks.
+ */
+void NDFileHDF5::addDefaultAttributes(epicsInt32 uniqueId, double timeStamp, const epicsTimeStamp& epicsTS)
 {
   this->pFileAttributes->add("NDArrayUniqueId",
                              "The unique ID of the NDArray",
-                             NDAttrInt32, (void*)&(pArray->uniqueId));
+                             NDAttrInt32, (void*)&uniqueId);
   this->pFileAttributes->add("NDArrayTimeStamp",
                              "The timestamp of the NDArray as float64",
-                             NDAttrFloat64, (void*)&(pArray->timeStamp));
+                             NDAttrFloat64, (void*)&timeStamp);
   this->pFileAttributes->add("NDArrayEpicsTSSec",
                              "The NDArray EPICS timestamp seconds past epoch",
-                             NDAttrUInt32, (void*)&(pArray->epicsTS.secPastEpoch));
+                             NDAttrUInt32, (void*)&epicsTS.secPastEpoch);
   this->pFileAttributes->add("NDArrayEpicsTSnSec",
                              "The NDArray EPICS timestamp nanoseconds",
-                             NDAttrUInt32, (void*)&(pArray->epicsTS.nsec));
+                             NDAttrUInt32, (void*)&epicsTS.nsec);
 }
 
 /** Helper function to create a comma separated list of integers in a string
@@ -3299,7 +4826,8 @@ asynStatus NDFileHDF5::writeDefaultDatasetAttributes(NDArray *pArray)
          it_default_ndarray_attributes != default_ndarray_attributes.end();
          ++it_default_ndarray_attributes)
     {
-      it_det_dsets->second->add_attribute(*it_default_ndarray_attributes);
+      // Replace the values set for a previous file when the layout tree is reused
+      it_det_dsets->second->set_attribute(*it_default_ndarray_attributes);
     }
   }
 
@@ -3307,18 +4835,57 @@ asynStatus NDFileHDF5::writeDefaultDatasetAttributes(NDArray *pArray)
 }
 
 asynStatus NDFileHDF5::createNewFile(const char *fileName)
+{
+  static const char *functionName = "createNewFile";
+
+  // Use the file that the next file thread has created for this name, if there is one
+  if (this->nextFile > 0 && this->nextFileName == fileName){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s::%s Using the file created in advance: %s\n",
+              driverName, functionName, fileName);
+    this->file = this->nextFile;
+    this->nextFile = 0;
+    this->nextFileName = "";
+    return asynSuccess;
+  }
+  this->discardNextFile();
+
+  this->file = this->createH5File(fileName, H5F_ACC_TRUNC);
+  if (this->file <= 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s Unable to create HDF5 file: %s\n", 
+              driverName, functionName, fileName);
+    this->file = 0;
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** Creates an HDF5 file with the file creation and access properties of the current settings.
+ * \param[in] fileName The name of the file.
+ * \param[in] flags The H5Fcreate flags, H5F_ACC_TRUNC or H5F_ACC_EXCL.
+ * \return The file handle, or a negative value if the file could not be created.
+ */
+hid_t NDFileHDF5::createH5File(const char *fileName, unsigned flags)
 {
   herr_t hdfstatus;
+  hid_t file;
   int tempAlign = 0;
   int tempThreshold = 0;
   int SWMRMode = 0;
-  static const char *functionName = "createNewFile";
+  int metaBlockSize = 0;
+  int sieveBufSize = 0;
+  int directIO = 0;
+  static const char *functionName = "createH5File";
 
   this->lock();
   getIntegerParam(NDFileHDF5_chunkBoundaryAlign, &tempAlign);
   getIntegerParam(NDFileHDF5_chunkBoundaryThreshold, (int*)&tempThreshold);
   // Check if we are in SWMR mode
   getIntegerParam(NDFileHDF5_SWMRMode, &SWMRMode);
+  getIntegerParam(NDFileHDF5_metaBlockSize, &metaBlockSize);
+  getIntegerParam(NDFileHDF5_sieveBufSize, &sieveBufSize);
+  getIntegerParam(NDFileHDF5_directIO, &directIO);
   this->unlock();
 
   /* File access property list: set the alignment boundary to a user defined block size
@@ -3347,6 +4914,67 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
     }
   }
 
+  /* Metadata is allocated in blocks of this size, so it is written in fewer, larger pieces
+   * between the aligned chunks, and raw data smaller than the sieve buffer is gathered before it is written */
+  if (metaBlockSize > 0){
+    if (H5Pset_meta_block_size(access_plist, (hsize_t)metaBlockSize) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s%s Warning: failed to set metadata block size=%d bytes\n",
+          driverName, functionName, metaBlockSize);
+    }
+  }
+  if (sieveBufSize > 0){
+    if (H5Pset_sieve_buf_size(access_plist, (size_t)sieveBufSize) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s%s Warning: failed to set sieve buffer size=%d bytes\n",
+          driverName, functionName, sieveBufSize);
+    }
+  }
+
+  /* The direct I/O file driver opens the file with O_DIRECT, so the data does not go through the
+   * page cache.  Writes of buffers that are aligned to DIRECT_IO_BLOCK_SIZE, to aligned offsets in the file,
+   * go straight to the disk; others go through the copy buffer of the driver.  BoundaryAlign should be a
+   * multiple of DIRECT_IO_BLOCK_SIZE, and NDArrayPoolSetAlignment can align the NDArray buffers. */
+  #ifdef H5_HAVE_DIRECT
+  if (directIO == 1){
+    if (this->mpi){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+          "%s%s Direct I/O is not used in MPI mode\n",
+          driverName, functionName);
+    } else if (SWMRMode == 1){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+          "%s%s Direct I/O is not used in SWMR mode\n",
+          driverName, functionName);
+    } else if (H5Pset_fapl_direct(access_plist, DIRECT_IO_BLOCK_SIZE, DIRECT_IO_BLOCK_SIZE, DIRECT_IO_COPY_BUFFER) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s%s Warning: failed to select the direct I/O file driver\n",
+          driverName, functionName);
+    } else if ((align == 0) || (align % DIRECT_IO_BLOCK_SIZE)){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+          "%s%s BoundaryAlign=%llu is not a multiple of %d, chunks are written through the copy buffer\n",
+          driverName, functionName, align, DIRECT_IO_BLOCK_SIZE);
+    }
+  }
+  #endif
+
+  /* In MPI mode all of the ranks open the file with the MPI-IO driver, and every rank takes part in
+   * the operations that read or change the metadata, so they are made collectively */
+  #ifdef ND_WITH_HDF5_MPI
+  if (this->mpi){
+    if (H5Pset_fapl_mpio(access_plist, MPI_COMM_WORLD, MPI_INFO_NULL) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s%s ERROR: failed to select the MPI-IO file driver\n",
+          driverName, functionName);
+      H5Pclose(access_plist);
+      return -1;
+    }
+    #if H5_VERSION_GE(1,10,0)
+    H5Pset_all_coll_metadata_ops(access_plist, true);
+    H5Pset_coll_metadata_write(access_plist, true);
+    #endif
+  }
+  #endif
+
   /* File creation property list: set the i-storek according to HDF group recommendations */
   H5Pset_fclose_degree(access_plist, H5F_CLOSE_STRONG);
   
@@ -3396,14 +5024,277 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
     }
   }
 
-  this->file = H5Fcreate(fileName, H5F_ACC_TRUNC, create_plist, access_plist);
-  if (this->file <= 0){
+  file = H5Fcreate(fileName, flags, create_plist, access_plist);
+  H5Pclose(create_plist);
+  H5Pclose(access_plist);
+  return file;
+}
+
+/** Asks the next file thread to create the file that is expected to follow this one in a stream, so that
+ * creating it is not part of the gap between the files.  The expected file has the next file number.
+ * It is only created if no file of that name exists.  The next openFile uses it if the name matches,
+ * and deletes it otherwise.  Called with the file mutex.
+ * \param[in] fileName The name of the file that has just been opened.
+ */
+void NDFileHDF5::prepareNextFile(const char *fileName)
+{
+  int preCreate = 0;
+  int fileWriteMode = 0;
+  int fileNumber = 0;
+  int autoIncrement = 0;
+  char filePath[MAX_FILENAME_LEN];
+  char name[MAX_FILENAME_LEN];
+  char fileTemplate[MAX_FILENAME_LEN];
+  char next[MAX_FILENAME_LEN];
+  char taskName[256];
+  int len;
+  static const char *functionName = "prepareNextFile";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_preCreateFile, &preCreate);
+  getIntegerParam(NDFileWriteMode, &fileWriteMode);
+  // The directory of the next file, which is not NDFilePath when the files are striped across StripePaths
+  this->stripeFilePath(0, sizeof(filePath), filePath);
+  getStringParam(NDFileName, sizeof(name), name);
+  getStringParam(NDFileTemplate, sizeof(fileTemplate), fileTemplate);
+  getIntegerParam(NDFileNumber, &fileNumber);
+  getIntegerParam(NDAutoIncrement, &autoIncrement);
+  this->unlock();
+
+  // In MPI mode creating a file is collective, so it cannot be done by the thread of one rank
+  if (preCreate == 0 || fileWriteMode != NDFileModeStream || this->mpi) return;
+  // With AutoIncrement the file number has already been incremented for the next file
+  len = epicsSnprintf(next, sizeof(next), fileTemplate, filePath, name, autoIncrement ? fileNumber : fileNumber+1);
+  if (len < 0 || len >= (int)sizeof(next) || strcmp(next, fileName) == 0) return;
+
+  if (this->nextFileThreadId == 0){
+    epicsSnprintf(taskName, sizeof(taskName)-1, "%s_HDF5_NextFile", this->portName);
+    this->nextFileThreadId = epicsThreadCreate(taskName,
+                                               epicsThreadPriorityMedium,
+                                               epicsThreadGetStackSize(epicsThreadStackMedium),
+                                               (EPICSTHREADFUNC)nextFileTaskC, this);
+    if (this->nextFileThreadId == 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR creating the next file thread\n",
+                driverName, functionName);
+      return;
+    }
+  }
+  this->pendingFileName = next;
+  epicsEventSignal(this->nextFileEvent);
+}
+
+/** Task that creates the next file of a stream while the current one is written, see prepareNextFile.
+ * The file is created with the file mutex, between frames.
+ */
+void NDFileHDF5::nextFileTask()
+{
+  char fileName[MAX_FILENAME_LEN];
+  hid_t file;
+  static const char *functionName = "nextFileTask";
+
+  while (1){
+    epicsEventWait(this->nextFileEvent);
+    epicsMutexLock(this->fileMutexId);
+    if (this->nextFile == 0 && !this->pendingFileName.empty()){
+      strncpy(fileName, this->pendingFileName.c_str(), sizeof(fileName)-1);
+      fileName[sizeof(fileName)-1] = 0;
+      // A file that exists is never replaced by a file created in advance
+      if (!this->fileExists(fileName)){
+        file = this->createH5File(fileName, H5F_ACC_EXCL);
+        if (file > 0){
+          this->nextFile = file;
+          this->nextFileName = fileName;
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                    "%s::%s Created %s in advance\n",
+                    driverName, functionName, fileName);
+        } else {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                    "%s::%s Unable to create %s in advance\n",
+                    driverName, functionName, fileName);
+        }
+      }
+    }
+    this->pendingFileName = "";
+    epicsMutexUnlock(this->fileMutexId);
+  }
+}
+
+/** Closes and deletes the file created in advance, if there is one.  Called with the file mutex.
+ */
+void NDFileHDF5::discardNextFile()
+{
+  static const char *functionName = "discardNextFile";
+
+  this->pendingFileName = "";
+  if (this->nextFile <= 0) return;
+  H5Fclose(this->nextFile);
+  if (remove(this->nextFileName.c_str()) != 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s::%s Unable to create HDF5 file: %s\n", 
-              driverName, functionName, fileName);
-    this->file = 0;
+              "%s::%s ERROR Unable to delete the unused file %s\n",
+              driverName, functionName, this->nextFileName.c_str());
+  } else {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s::%s Deleted the unused file %s\n",
+              driverName, functionName, this->nextFileName.c_str());
+  }
+  this->nextFile = 0;
+  this->nextFileName = "";
+}
+
+/** Called by NDPluginFile when a stream has stopped.  The file created in advance for the next
+ * file of the stream is not needed, so it is deleted.  Called with the lock.
+ */
+void NDFileHDF5::captureStopped()
+{
+  this->unlock();
+  epicsMutexLock(this->fileMutexId);
+  this->discardNextFile();
+  epicsMutexUnlock(this->fileMutexId);
+  this->lock();
+}
+
+/** Sets up the parallel MPI mode for the file that is being opened, if MPIMode is set.
+ * In MPI mode the NDFileHDF5 plugins of all of the MPI ranks open the same file with the MPI-IO
+ * driver, and each writes its frames to its own places in the default detector dataset.  Frame k of
+ * rank r goes to index k*size+r, or to the index in the MPIFrameAttribute NDAttribute of the frame.
+ * The ranks make all of the metadata operations together, so they must open the same file name with
+ * the same layout and frame size, and write the same number of frames.  The NDAttribute and performance
+ * datasets, SWMR mode, extra dimensions, positional placement and the VDS multi-writer mode are not
+ * supported in MPI mode.
+ * \param[in] openMode The mode the file is opened with.
+ */
+asynStatus NDFileHDF5::configureMPI(NDFileOpenMode_t openMode)
+{
+  int mpiMode = 0;
+  int SWMRMode = 0;
+  int storeAttributes = 0;
+  int storePerformance = 0;
+  int extradims = 0;
+  int posRunning = 0;
+  int numWriters = 0;
+  char frameAttribute[MAX_STRING_SIZE];
+  asynStatus status = asynSuccess;
+  static const char *functionName = "configureMPI";
+
+  this->mpi = false;
+  this->mpiFrames = 0;
+  this->lock();
+  getIntegerParam(NDFileHDF5_mpiMode, &mpiMode);
+  getIntegerParam(NDFileHDF5_SWMRMode, &SWMRMode);
+  getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
+  getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extradims);
+  getIntegerParam(NDFileHDF5_posRunning, &posRunning);
+  getIntegerParam(NDFileHDF5_vdsNumWriters, &numWriters);
+  getStringParam(NDFileHDF5_mpiFrameAttribute, sizeof(frameAttribute), frameAttribute);
+  this->unlock();
+  if (mpiMode == 0) return asynSuccess;
+
+  if (!(openMode & NDFileModeMultiple)){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: MPI mode needs Capture or Stream mode\n",
+              driverName, functionName);
+    status = asynError;
+  }
+  if (SWMRMode == 1){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: SWMR mode is not supported in MPI mode\n",
+              driverName, functionName);
+    status = asynError;
+  }
+  if (storeAttributes == 1 || storePerformance == 1){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: StoreAttr and StorePerform must be No in MPI mode\n",
+              driverName, functionName);
+    status = asynError;
+  }
+  if (extradims != 0 || posRunning == 1 || numWriters > 1){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: extra dimensions, positional placement and VDS writers are not supported in MPI mode\n",
+              driverName, functionName);
+    status = asynError;
+  }
+  if (status != asynSuccess) return status;
+
+  status = this->startMPI();
+  if (status != asynSuccess) return status;
+  this->mpiFrameAttribute = frameAttribute;
+  this->mpi = true;
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s Writing the file as MPI rank %d of %d\n",
+            driverName, functionName, this->mpiRank, this->mpiSize);
+  return asynSuccess;
+}
+
+/** Initialises MPI if the IOC has not done it already, and reads the rank and the number of ranks.
+ * The MPI calls are made from the threads of the plugins, so MPI is initialised with MPI_THREAD_MULTIPLE,
+ * and finalised when the IOC exits.
+ */
+asynStatus NDFileHDF5::startMPI()
+{
+  static const char *functionName = "startMPI";
+
+#ifdef ND_WITH_HDF5_MPI
+  int initialized = 0;
+  int provided = 0;
+
+  mpiInitLock.lock();
+  MPI_Initialized(&initialized);
+  if (!initialized){
+    if (MPI_Init_thread(NULL, NULL, MPI_THREAD_MULTIPLE, &provided) != MPI_SUCCESS){
+      mpiInitLock.unlock();
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: unable to initialise MPI\n",
+                driverName, functionName);
+      return asynError;
+    }
+    if (provided < MPI_THREAD_MULTIPLE){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s MPI does not support MPI_THREAD_MULTIPLE, only one plugin can use MPI mode\n",
+                driverName, functionName);
+    }
+    epicsAtExit(finalizeMPI, NULL);
+  }
+  mpiInitLock.unlock();
+  MPI_Comm_rank(MPI_COMM_WORLD, &this->mpiRank);
+  MPI_Comm_size(MPI_COMM_WORLD, &this->mpiSize);
+  this->lock();
+  setIntegerParam(NDFileHDF5_mpiRank, this->mpiRank);
+  setIntegerParam(NDFileHDF5_mpiSize, this->mpiSize);
+  callParamCallbacks();
+  this->unlock();
+  return asynSuccess;
+#else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR: the plugin was built without MPI\n",
+            driverName, functionName);
+  return asynError;
+#endif
+}
+
+/** Finds the index in the default dataset of the next frame of this rank in MPI mode.
+ * \param[in] pArray The frame.
+ * \param[out] index The index of the frame in the n'th frame dimension.
+ */
+asynStatus NDFileHDF5::findMPIFrameIndex(NDArray *pArray, hsize_t *index)
+{
+  static const char *functionName = "findMPIFrameIndex";
+
+  if (this->mpiFrameAttribute.empty()){
+    // The ranks take turns
+    *index = this->mpiFrames * this->mpiSize + this->mpiRank;
+    return asynSuccess;
+  }
+  NDAttribute *pAttribute = pArray->pAttributeList->find(this->mpiFrameAttribute.c_str());
+  epicsUInt32 value = 0;
+  if (pAttribute == NULL || pAttribute->getValue(NDAttrUInt32, &value, 0) != ND_SUCCESS){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: the frame has no %s attribute\n",
+              driverName, functionName, this->mpiFrameAttribute.c_str());
     return asynError;
   }
+  *index = value;
   return asynSuccess;
 }
 
@@ -3435,8 +5326,24 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
   hdfdatatype = this->typeNd2Hdf(pArray->dataType);
   this->datatype = H5Tcopy(hdfdatatype);
 
-  /* configure compression if required */
-  this->configureCompression();
+  /* configure compression if required.  The packed data types are stored as UInt16 with the N-bit filter at their
+   * precision, and configureDirectChunk() writes them without unpacking them. */
+  if (this->packedBits){
+    int compressionScheme = HDF5CompressNone;
+    this->lock();
+    getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
+    this->unlock();
+    if (compressionScheme != HDF5CompressNone && compressionScheme != HDF5CompressNumBits){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+        "%s::%s packed arrays are stored with the N-bit filter, compression %d is not used\n",
+        driverName, functionName, compressionScheme);
+    }
+    H5Tset_precision(this->datatype, this->packedBits);
+    H5Tset_offset(this->datatype, 0);
+    H5Pset_nbit(this->cparms);
+  } else {
+    this->configureCompression();
+  }
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
     "%s::%s Setting fillvalue\n", 
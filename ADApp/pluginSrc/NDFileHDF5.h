@@ -8,6 +8,7 @@
 #define NDFileHDF5_H
 
 #include <list>
+#include <vector>
 #include <hdf5.h>
 #include <asynDriver.h>
 #include <NDPluginFile.h>
@@ -16,7 +17,9 @@
 #include "NDFileHDF5Dataset.h"
 #include "NDFileHDF5LayoutXML.h"
 #include "NDFileHDF5AttributeDataset.h"
+#include "NDFileHDF5PackedAttributeDataset.h"
 #include "NDFileHDF5VersionCheck.h"
+#include "NDFileHDF5Reader.h"
 
 #define MAXEXTRADIMS 10
 
@@ -24,8 +27,13 @@
 #define str_NDFileHDF5_nColChunks        "HDF5_nColChunks"
 #define str_NDFileHDF5_nFramesChunks     "HDF5_nFramesChunks"
 #define str_NDFileHDF5_chunkBoundaryAlign "HDF5_chunkBoundaryAlign"
+#define str_NDFileHDF5_chunkAutoTune     "HDF5_chunkAutoTune"
+#define str_NDFileHDF5_chunkTargetBytes  "HDF5_chunkTargetBytes"
+#define str_NDFileHDF5_chunkAchievedSpeed "HDF5_chunkAchievedSpeed"
 #define str_NDFileHDF5_chunkBoundaryThreshold "HDF5_chunkBoundaryThreshold"
 #define str_NDFileHDF5_NDAttributeChunk  "HDF5_NDAttributeChunk"
+#define str_NDFileHDF5_NDAttributeBatch  "HDF5_NDAttributeBatch"
+#define str_NDFileHDF5_NDAttributePacked "HDF5_NDAttributePacked"
 #define str_NDFileHDF5_nExtraDims        "HDF5_nExtraDims"
 #define str_NDFileHDF5_extraDimOffsetX   "HDF5_extraDimOffsetX"
 #define str_NDFileHDF5_extraDimOffsetY   "HDF5_extraDimOffsetY"
@@ -33,7 +41,16 @@
 #define str_NDFileHDF5_storePerformance  "HDF5_storePerformance"
 #define str_NDFileHDF5_totalRuntime      "HDF5_totalRuntime"
 #define str_NDFileHDF5_totalIoSpeed      "HDF5_totalIoSpeed"
+#define str_NDFileHDF5_frameWriteTime    "HDF5_frameWriteTime"
+#define str_NDFileHDF5_extendTime        "HDF5_extendTime"
+#define str_NDFileHDF5_writeTime         "HDF5_writeTime"
+#define str_NDFileHDF5_compressTime      "HDF5_compressTime"
+#define str_NDFileHDF5_attributeTime     "HDF5_attributeTime"
+#define str_NDFileHDF5_flushTime         "HDF5_flushTime"
 #define str_NDFileHDF5_flushNthFrame     "HDF5_flushNthFrame"
+#define str_NDFileHDF5_flushPeriod       "HDF5_flushPeriod"
+#define str_NDFileHDF5_flushMaxPeriod    "HDF5_flushMaxPeriod"
+#define str_NDFileHDF5_preCreateFile     "HDF5_preCreateFile"
 #define str_NDFileHDF5_compressionType   "HDF5_compressionType"
 #define str_NDFileHDF5_nbitsPrecision    "HDF5_nbitsPrecision"
 #define str_NDFileHDF5_nbitsOffset       "HDF5_nbitsOffset"
@@ -42,6 +59,8 @@
 #define str_NDFileHDF5_bloscShuffleType  "HDF5_bloscShuffleType"
 #define str_NDFileHDF5_bloscCompressor   "HDF5_bloscCompressor"
 #define str_NDFileHDF5_bloscCompressLevel "HDF5_bloscCompressLevel"
+#define str_NDFileHDF5_bshufBlockSize    "HDF5_bshufBlockSize"
+#define str_NDFileHDF5_zstdCompressLevel "HDF5_zstdCompressLevel"
 #define str_NDFileHDF5_dimAttDatasets    "HDF5_dimAttDatasets"
 #define str_NDFileHDF5_layoutErrorMsg    "HDF5_layoutErrorMsg"
 #define str_NDFileHDF5_layoutValid       "HDF5_layoutValid"
@@ -58,6 +77,26 @@
 #define str_NDFileHDF5_SWMRSupported     "HDF5_SWMRSupported"
 #define str_NDFileHDF5_SWMRMode          "HDF5_SWMRMode"
 #define str_NDFileHDF5_SWMRRunning       "HDF5_SWMRRunning"
+#define str_NDFileHDF5_directChunk       "HDF5_directChunk"
+#define str_NDFileHDF5_directChunkActive "HDF5_directChunkActive"
+#define str_NDFileHDF5_metaBlockSize     "HDF5_metaBlockSize"
+#define str_NDFileHDF5_sieveBufSize      "HDF5_sieveBufSize"
+#define str_NDFileHDF5_directIO          "HDF5_directIO"
+#define str_NDFileHDF5_directIOSupported "HDF5_directIOSupported"
+#define str_NDFileHDF5_vdsNumWriters     "HDF5_vdsNumWriters"
+#define str_NDFileHDF5_vdsWriterIndex    "HDF5_vdsWriterIndex"
+#define str_NDFileHDF5_vdsFileName       "HDF5_vdsFileName"
+#define str_NDFileHDF5_mpiMode           "HDF5_mpiMode"
+#define str_NDFileHDF5_mpiSupported      "HDF5_mpiSupported"
+#define str_NDFileHDF5_mpiRank           "HDF5_mpiRank"
+#define str_NDFileHDF5_mpiSize           "HDF5_mpiSize"
+#define str_NDFileHDF5_mpiFrameAttribute "HDF5_mpiFrameAttribute"
+#define str_NDFileHDF5_readDataset       "HDF5_readDataset"
+#define str_NDFileHDF5_readAhead         "HDF5_readAhead"
+#define str_NDFileHDF5_readChunks        "HDF5_readChunks"
+#define str_NDFileHDF5_readNumFrames     "HDF5_readNumFrames"
+#define str_NDFileHDF5_readFrame         "HDF5_readFrame"
+#define str_NDFileHDF5_readSpeed         "HDF5_readSpeed"
 
 /** Writes NDArrays in the HDF5 file format; an XML file can control the structure of the HDF5 file.
   */
@@ -82,9 +121,12 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     virtual void report(FILE *fp, int details);
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+    virtual void captureStopped();
 
     asynStatus startSWMR();
     asynStatus flushCallback();
+    void flushTask();
+    void nextFileTask();
     asynStatus createXMLFileLayout();
     asynStatus storeOnOpenAttributes();
     asynStatus storeOnCloseAttributes();
@@ -127,7 +169,12 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_nFramesChunks;
     int NDFileHDF5_chunkBoundaryAlign;
     int NDFileHDF5_chunkBoundaryThreshold;
+    int NDFileHDF5_chunkAutoTune;
+    int NDFileHDF5_chunkTargetBytes;
+    int NDFileHDF5_chunkAchievedSpeed;
     int NDFileHDF5_NDAttributeChunk;
+    int NDFileHDF5_NDAttributeBatch;
+    int NDFileHDF5_NDAttributePacked;
     int NDFileHDF5_nExtraDims;
     int NDFileHDF5_extraDimOffsetX;
     int NDFileHDF5_extraDimOffsetY;
@@ -138,7 +185,16 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_storePerformance;
     int NDFileHDF5_totalRuntime;
     int NDFileHDF5_totalIoSpeed;
+    int NDFileHDF5_frameWriteTime;
+    int NDFileHDF5_extendTime;
+    int NDFileHDF5_writeTime;
+    int NDFileHDF5_compressTime;
+    int NDFileHDF5_attributeTime;
+    int NDFileHDF5_flushTime;
     int NDFileHDF5_flushNthFrame;
+    int NDFileHDF5_flushPeriod;
+    int NDFileHDF5_flushMaxPeriod;
+    int NDFileHDF5_preCreateFile;
     int NDFileHDF5_compressionType;
     int NDFileHDF5_nbitsPrecision;
     int NDFileHDF5_nbitsOffset;
@@ -147,6 +203,8 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_bloscCompressor;
     int NDFileHDF5_bloscCompressLevel;
     int NDFileHDF5_bloscShuffleType;
+    int NDFileHDF5_bshufBlockSize;
+    int NDFileHDF5_zstdCompressLevel;
     int NDFileHDF5_dimAttDatasets;
     int NDFileHDF5_layoutErrorMsg;
     int NDFileHDF5_layoutValid;
@@ -159,6 +217,26 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_SWMRSupported;
     int NDFileHDF5_SWMRMode;
     int NDFileHDF5_SWMRRunning;
+    int NDFileHDF5_directChunk;
+    int NDFileHDF5_directChunkActive;
+    int NDFileHDF5_metaBlockSize;
+    int NDFileHDF5_sieveBufSize;
+    int NDFileHDF5_directIO;
+    int NDFileHDF5_directIOSupported;
+    int NDFileHDF5_vdsNumWriters;
+    int NDFileHDF5_vdsWriterIndex;
+    int NDFileHDF5_vdsFileName;
+    int NDFileHDF5_mpiMode;
+    int NDFileHDF5_mpiSupported;
+    int NDFileHDF5_mpiRank;
+    int NDFileHDF5_mpiSize;
+    int NDFileHDF5_mpiFrameAttribute;
+    int NDFileHDF5_readDataset;
+    int NDFileHDF5_readAhead;
+    int NDFileHDF5_readChunks;
+    int NDFileHDF5_readNumFrames;
+    int NDFileHDF5_readFrame;
+    int NDFileHDF5_readSpeed;
 
 #ifndef _UNITTEST_HDF5_
   private:
@@ -182,6 +260,17 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     asynStatus configureDatasetDims(NDArray *pArray);
     asynStatus configureDims(NDArray *pArray);
     asynStatus configureCompression();
+    bool configureDirectChunk(NDArray *pArray);
+    asynStatus registerVdsWriter(const char *fileName);
+    asynStatus createVdsFile(const std::string& vdsFileName, const std::vector<std::string>& sources);
+    bool codecMatchesDirectChunk(NDArray *pArray);
+    asynStatus compressDirectChunks(NDArray *pArray);
+    asynStatus writeDirectChunks(NDArray *pArray, NDFileHDF5Dataset *pDataset);
+    asynStatus createEventDatasets();
+    asynStatus writeEventDatasets(NDArray *pArray);
+    asynStatus flushEventDatasets();
+    asynStatus writeStackFrames(NDArray *pArray);
+    static void compressChunkTask(void *pArg, int task);
     char* getDimsReport();
     asynStatus writeStringAttribute(hid_t element, const char* attrName, const char* attrStrValue);
     asynStatus calculateAttributeChunking(int *chunking, int *mdim_chunking);
@@ -190,15 +279,26 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     asynStatus configurePerformanceDataset();
     asynStatus createPerformanceDataset();
     asynStatus writePerformanceDataset();
+    double timeToFlush(const epicsTimeStamp *now);
+    asynStatus flushDatasets();
+    hid_t createH5File(const char *fileName, unsigned flags);
+    void prepareNextFile(const char *fileName);
+    void discardNextFile();
+    asynStatus configureMPI(NDFileOpenMode_t openMode);
+    asynStatus startMPI();
+    asynStatus findMPIFrameIndex(NDArray *pArray, hsize_t *index);
     void calcNumFrames();
     unsigned int calcIstorek();
     hsize_t calcChunkCacheBytes();
     hsize_t calcChunkCacheSlots();
+    void tuneChunking(NDArray *pArray);
+    void adaptChunkTarget(double achievedSpeed);
 
     void checkForOpenFile();
     bool checkForSWMRMode();
     bool checkForSWMRSupported();
     void addDefaultAttributes(NDArray *pArray);
+    void addDefaultAttributes(epicsInt32 uniqueId, double timeStamp, const epicsTimeStamp& epicsTS);
     asynStatus writeDefaultDatasetAttributes(NDArray *pArray);
     asynStatus createNewFile(const char *fileName);
     asynStatus createFileLayout(NDArray *pArray);
@@ -230,9 +330,15 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     epicsTimeStamp firstFrame;
     double frameSize;  /** < frame size in megabits. For performance measurement. */
     int bytesPerElement;
+    int packedBits;    /** < NDPackedBits() of the data type of the frames, which are stored with the N-bit filter */
+    double fileWriteMB;       /** < MB of frames written to this file. For the chunk auto-tune */
+    double fileWriteSeconds;  /** < Time spent writing them */
+    double tunePrevSpeed;     /** < MB/s achieved by the previous file of the series, 0 for none */
+    int tuneDirection;        /** < 1 if the target chunk size is doubled for the next file, -1 if it is halved */
     char *hostname;
 
     std::list<NDFileHDF5AttributeDataset*> attrList;
+    NDFileHDF5PackedAttributeDataset *pPackedAttributes;  /** < The numeric per-frame NDAttributes of the default group, NULL unless NDAttributePacked */
 
     /* HDF5 handles and references */
     hid_t file;
@@ -253,6 +359,63 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     char *ptrDimensionNames[ND_ARRAY_MAX_DIMS + MAXEXTRADIMS]; /** Array of strings with human readable names for each dimension */
 
     char *dimsreport;       /** < A string which contain a verbose report of all dimension sizes. The method getDimsReport fill in this */
+
+    /* direct chunk writes */
+    bool directChunk;       /** < The frames are compressed by this plugin and written with H5Dwrite_chunk */
+    int directCompression;  /** < The HDF5Compression_t of the dataset when directChunk is set */
+    int directLevel;        /** < The zlib, blosc or zstd compression level */
+    int directShuffle;      /** < The blosc shuffle type */
+    int directCompressor;   /** < The blosc compressor */
+    int directBlockSize;    /** < The elements in a block of a bitshuffle chunk */
+    int directNumChunks;    /** < The number of chunks in one frame */
+    size_t directFrameBytes;  /** < The size of one frame */
+    size_t directChunkBytes;  /** < The uncompressed size of one chunk */
+    size_t directBoundBytes;  /** < The space for one compressed chunk */
+    std::vector<char> directBuffer;           /** < The compressed chunks, directBoundBytes apart */
+    std::vector<char> directPadBuffer;        /** < The last chunk padded with zeros when it is only partly filled */
+    std::vector<char> directScratch;          /** < One bitshuffle block for each chunk */
+    std::vector<const void *> directChunkData;
+    std::vector<size_t> directChunkSizes;
+    std::vector<unsigned int> directChunkMasks;
+
+    /* time-based SWMR flushing */
+    bool timedFlush;        /** < The flushes are made by the flush thread on the FlushPeriod and FlushMaxPeriod policy */
+    double flushPeriod;     /** < The minimum time between flushes in seconds */
+    double flushMaxPeriod;  /** < The maximum time between flushes while there are frames to be flushed, 0 for none */
+    int flushFrames;        /** < The frames to be written before a flush is made after flushPeriod */
+    int framesUnflushed;    /** < The frames written since the last flush, protected by the file mutex */
+    epicsTimeStamp lastFlush;
+    epicsEventId flushEvent;  /** < Signalled when a flush is due */
+    epicsThreadId flushThreadId;
+
+    /* the next file of a stream, created in advance */
+    hid_t nextFile;               /** < The file created in advance, 0 if there is none */
+    std::string nextFileName;     /** < The name of nextFile */
+    std::string pendingFileName;  /** < The name of the file that the next file thread is to create */
+    epicsEventId nextFileEvent;   /** < Signalled when pendingFileName is set */
+    epicsThreadId nextFileThreadId;
+
+    /* parallel writing of one file by all MPI ranks */
+    bool mpi;               /** < The open file is written with the MPI-IO driver by all of the ranks */
+    int mpiRank;            /** < The MPI rank of this process */
+    int mpiSize;            /** < The number of MPI ranks */
+    hsize_t mpiFrames;      /** < The frames that this rank has written to the open file */
+    std::string mpiFrameAttribute;  /** < The NDAttribute with the index of each frame in the dataset, empty to interleave the ranks */
+
+    /* sparse frames written as events */
+    bool sparse;                /** < The frames are written to the event datasets instead of the detector dataset */
+    hid_t eventIdDataset;       /** < The linear index in the frame of each event */
+    hid_t eventValueDataset;    /** < The value of each event */
+    hid_t eventIndexDataset;    /** < The first event of each frame */
+    hsize_t eventsWritten;      /** < The events written to the open file */
+    hsize_t eventFrames;        /** < The frames written to the open file */
+
+    /* frame stacks written as their frames */
+    int framesPerArray;         /** < The frames of each array the open file is written with, NumCapture counts the arrays */
+
+    /* files read back to process their frames again */
+    NDFileHDF5Reader *pReader;  /** < The reader of the file opened with NDFileModeRead, NULL if there is none */
+    epicsTimeStamp readStart;   /** < The time the file was opened for reading */
 };
 
 #endif
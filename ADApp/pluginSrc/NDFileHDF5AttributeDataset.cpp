@@ -9,6 +9,8 @@
 #include <epicsString.h>
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <epicsMath.h>
 
 #define MAX_ATTRIBUTE_STRING_SIZE 256
@@ -35,7 +37,10 @@ NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::st
   rank_(0),
   nextRecord_(0),
   extraDimensions_(0),
-  whenToSave_(hdf5::OnFrame)
+  whenToSave_(hdf5::OnFrame),
+  batchSize_(1),
+  numBuffered_(0),
+  valueSize_(0)
 {
   //printf("Constructor called for %s\n", name.c_str());
   // Allocate enough memory for the fill value to accept any data type
@@ -64,6 +69,16 @@ void NDFileHDF5AttributeDataset::setParentGroupName(const std::string& group)
   groupName_ = group;
 }
 
+/** Sets the number of values that are buffered in memory before they are written to the file
+  * as one selection.  The buffer is also written when the dataset is flushed and when it is closed.
+  * This must be called before the dataset is created.
+  */
+void NDFileHDF5AttributeDataset::setBatchSize(int batchSize)
+{
+  if (batchSize < 1) batchSize = 1;
+  batchSize_ = batchSize;
+}
+
 asynStatus NDFileHDF5AttributeDataset::createDataset(int user_chunking)
 {
   asynStatus status = asynSuccess;
@@ -120,7 +135,17 @@ asynStatus NDFileHDF5AttributeDataset::createHDF5Dataset()
     H5Gclose(dsetgroup);
   }
 
-  memspace_ = H5Screate_simple(rank_, elementSize_, NULL);
+  // The file space is kept for the life of the dataset and only resized when the dataset grows,
+  // and the memory space holds a whole batch of values
+  hsize_t batch = batchSize_;
+  filespace_ = H5Dget_space(dataset_);
+  memspace_ = H5Screate_simple(1, &batch, NULL);
+  extent_.assign(dims_, dims_ + rank_);
+
+  valueSize_ = H5Tget_size(datatype_);
+  batchValues_.resize(batchSize_ * valueSize_);
+  batchCoords_.resize(batchSize_ * rank_);
+  numBuffered_ = 0;
 
   return status;
 }
@@ -141,24 +166,15 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     if (ret == ND_ERROR) {
       memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
     }
-    // Work with HDF5 library to select a suitable hyperslab (one element) and write the new data to it
-    H5Dset_extent(dataset_, dims_);
-    filespace_ = H5Dget_space(dataset_);
-
-    // Select the hyperslab
-    H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, offset_, NULL, elementSize_, NULL);
-
-    // Write the data to the hyperslab if data is defined
-    if (!isUndefined_) {
-       H5Dwrite(dataset_, datatype_, memspace_, filespace_, H5P_DEFAULT, pDatavalue);
-    }
+    // Buffer the value for the current offset.  Undefined data is buffered as the fill value,
+    // which leaves the element as it would be without a write.
+    status = this->bufferValue(isUndefined_ ? ptrFillValue_ : pDatavalue);
 
     // Check if we are being asked to flush
     if (flush == 1){
-      status = this->flushDataset();
+      if (this->flushDataset() != asynSuccess) status = asynError;
     }
 
-    H5Sclose(filespace_);
     nextRecord_++;
   }
 
@@ -184,23 +200,21 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     if (ret == ND_ERROR) {
       memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
     }
-    // Work with HDF5 library to select a suitable hyperslab (one element) and write the new data to it
-    H5Dset_extent(dataset_, dims_);
-    filespace_ = H5Dget_space(dataset_);
-
-    // Select the hyperslab
-    H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, offset_, NULL, elementSize_, NULL);
-
-    // Write the data to the hyperslab.
-    H5Dwrite(dataset_, datatype_, memspace_, filespace_, H5P_DEFAULT, pDatavalue);
-
+    // A position can be written more than once, so a buffered value for the same position
+    // is written first and the new value replaces it in the file
+    for (int i = 0; i < numBuffered_; i++){
+      if (std::equal(offset_, offset_ + rank_, &batchCoords_[i * rank_])){
+        status = this->writeBuffer();
+        break;
+      }
+    }
+    if (this->bufferValue(pDatavalue) != asynSuccess) status = asynError;
 
     // Check if we are being asked to flush
     if (flush == 1){
-      status = this->flushDataset();
+      if (this->flushDataset() != asynSuccess) status = asynError;
     }
 
-    H5Sclose(filespace_);
     nextRecord_++;
   }
 
@@ -209,14 +223,89 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
 
 asynStatus NDFileHDF5AttributeDataset::closeAttributeDataset()
 {
+  asynStatus status;
   //printf("close called for %s\n", name_.c_str());
+  status = this->writeBuffer();
   H5Dclose(dataset_);
   H5Sclose(memspace_);
+  H5Sclose(filespace_);
   H5Sclose(dataspace_);
   H5Pclose(cparm_);
+  return status;
+}
+
+/** Adds a value for the current offset to the buffer, and writes the buffer when it is full.
+  */
+asynStatus NDFileHDF5AttributeDataset::bufferValue(void *pValue)
+{
+  memcpy(&batchValues_[numBuffered_ * valueSize_], pValue, valueSize_);
+  std::copy(offset_, offset_ + rank_, &batchCoords_[numBuffered_ * rank_]);
+  numBuffered_++;
+  if (numBuffered_ >= batchSize_){
+    return this->writeBuffer();
+  }
   return asynSuccess;
 }
 
+/** Extends the dataset to the current dimensions and writes the buffered values with one H5Dwrite.
+  * Values at consecutive offsets along one dimension, which is the case for consecutive frames,
+  * are written as one hyperslab, otherwise the offsets are selected as a list of points.
+  */
+asynStatus NDFileHDF5AttributeDataset::writeBuffer()
+{
+  asynStatus status = asynSuccess;
+  const hsize_t *first = &batchCoords_[0];
+  hsize_t start = 0;
+  hsize_t count = numBuffered_;
+  int dim = -1;
+  bool contiguous = true;
+  int i, j;
+
+  // The dimensions only ever grow, so the dataset is extended once for the whole buffer
+  if (!std::equal(extent_.begin(), extent_.end(), dims_)){
+    H5Dset_extent(dataset_, dims_);
+    H5Sset_extent_simple(filespace_, rank_, dims_, maxdims_);
+    extent_.assign(dims_, dims_ + rank_);
+  }
+  if (numBuffered_ == 0) return status;
+
+  // Find the dimension that the second value moves along, and check that all of the values follow it
+  if (numBuffered_ > 1){
+    for (j = 0; j < rank_; j++){
+      if (batchCoords_[rank_ + j] != first[j]){
+        dim = j;
+        break;
+      }
+    }
+    contiguous = (dim >= 0);
+  }
+  for (i = 1; i < numBuffered_ && contiguous; i++){
+    const hsize_t *coords = &batchCoords_[i * rank_];
+    for (j = 0; j < rank_; j++){
+      if (coords[j] != first[j] + ((j == dim) ? i : 0)){
+        contiguous = false;
+        break;
+      }
+    }
+  }
+
+  if (contiguous){
+    std::vector<hsize_t> block(elementSize_, elementSize_ + rank_);
+    if (dim >= 0) block[dim] = numBuffered_;
+    H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, first, NULL, &block[0], NULL);
+  } else {
+    H5Sselect_elements(filespace_, H5S_SELECT_SET, numBuffered_, first);
+  }
+  H5Sselect_hyperslab(memspace_, H5S_SELECT_SET, &start, NULL, &count, NULL);
+
+  if (H5Dwrite(dataset_, datatype_, memspace_, filespace_, H5P_DEFAULT, &batchValues_[0]) < 0){
+    status = asynError;
+  }
+  numBuffered_ = 0;
+
+  return status;
+}
+
 asynStatus NDFileHDF5AttributeDataset::configureDims(int user_chunking)
 {
   asynStatus status = asynSuccess;
@@ -450,7 +539,8 @@ hid_t NDFileHDF5AttributeDataset::getHandle()
 
 asynStatus NDFileHDF5AttributeDataset::flushDataset()
 {
-  asynStatus status = asynSuccess;
+  // The buffered values are written first so that they are flushed as well
+  asynStatus status = this->writeBuffer();
 
   // We cannot flush for SWMR if the HDF version doesn't support it
   #if H5_VERSION_GE(1,9,178)
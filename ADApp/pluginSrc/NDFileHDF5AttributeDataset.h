@@ -9,6 +9,7 @@
 #define ADAPP_PLUGINSRC_NDFILEHDF5ATTRIBUTEDATASET_H_
 
 #include <string>
+#include <vector>
 #include <hdf5.h>
 #include <asynDriver.h>
 #include <NDPluginFile.h>
@@ -25,6 +26,7 @@ public:
   void setDsetName(const std::string& dsetName);
   void setWhenToSave(hdf5::When_t whenToSave);
   void setParentGroupName(const std::string& group);
+  void setBatchSize(int batchSize);
   asynStatus createDataset(int user_chunking);
   asynStatus createDataset(bool multiframe, int extradimensions, int *extra_dims, int *user_chunking);
   asynStatus writeAttributeDataset(hdf5::When_t whenToSave, NDAttribute *ndAttr, int flush);
@@ -42,6 +44,8 @@ private:
   void extendDataSet();
   void extendDataSet(hsize_t *offsets);
   void extendIndexDataSet(hsize_t offset);
+  asynStatus bufferValue(void *pValue);
+  asynStatus writeBuffer();
 
   std::string      name_;            // Name of the attribute
   std::string      dsetName_;        // Name of the dataset to store
@@ -66,6 +70,12 @@ private:
   int              nextRecord_;
   int              extraDimensions_;
   hdf5::When_t     whenToSave_;
+  int              batchSize_;       // Number of values to buffer before they are written
+  int              numBuffered_;     // Number of values in the buffer
+  size_t           valueSize_;       // Size of one value in bytes
+  std::vector<char>    batchValues_;  // Buffered values
+  std::vector<hsize_t> batchCoords_;  // Offsets of the buffered values, rank_ per value
+  std::vector<hsize_t> extent_;       // Dimensions of the dataset in the file
 
 };
 
@@ -1,6 +1,8 @@
 #include "NDFileHDF5Dataset.h"
 #include <iostream>
+#include <algorithm>
 #include <stdlib.h>
+#include <epicsTime.h>
 
 static const char *fileName = "NDFileHDF5Dataset";
 
@@ -10,8 +12,13 @@ static const char *fileName = "NDFileHDF5Dataset";
  * \param[in] dataset - HDF5 handle to the dataset.
  */
 NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& name, hid_t dataset) : 
-                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0)
+                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0),
+                                     extraDims_(0), extendBlock_(1), fspace_(-1), extendTime_(0.0),
+                                     xferPlist_(H5P_DEFAULT)
 {
+#ifdef ND_WITH_HDF5_MPI
+  this->comm_        = MPI_COMM_NULL;
+#endif
   this->maxdims_     = NULL;
   this->dims_        = NULL;
   this->offset_      = NULL;
@@ -32,6 +39,7 @@ asynStatus NDFileHDF5Dataset::configureDims(NDArray *pArray, bool multiframe, in
   asynStatus status = asynSuccess;
 
   extradims = extradimensions;
+  this->extraDims_ = extradims;
 
   ndims = pArray->ndims + extradims;
 
@@ -68,9 +76,112 @@ asynStatus NDFileHDF5Dataset::configureDims(NDArray *pArray, bool multiframe, in
     this->dims_[i]       = pArray->dims[j].size;
     this->offset_[i]     = 0;
   }
+
+  // The extent in the file is read again with the first frame
+  if (this->fspace_ >= 0) H5Sclose(this->fspace_);
+  this->fspace_ = -1;
+  this->extent_.clear();
   return status;
 }
 
+/** setExtendBlock.
+ * Set the number of frames that the dataset is extended by when a frame does not fit.
+ * With only the n'th frame dimension the dataset grows in multiples of this number of frames,
+ * and with more extra dimensions they are extended to their full sizes at once.  The dataset
+ * is shrunk to the frames that were written in closeDataset.  The default of 1 extends the dataset
+ * by exactly one frame at a time, which SWMR readers rely on.
+ * \param[in] frames - The number of frames.
+ */
+void NDFileHDF5Dataset::setExtendBlock(hsize_t frames)
+{
+  this->extendBlock_ = (frames < 1) ? 1 : frames;
+}
+
+/** extendToFit.
+ * Extend the dataset in the file if the current frame is outside of it.
+ * The file dataspace is kept open and only resized when the dataset is extended,
+ * so most frames need no changes to the dataset metadata.
+ */
+asynStatus NDFileHDF5Dataset::extendToFit()
+{
+  herr_t hdfstatus;
+  bool grow = false;
+  epicsTimeStamp startts, endts;
+  int i;
+  static const char *functionName = "extendToFit";
+
+  this->extendTime_ = 0.0;
+  if (this->fspace_ < 0){
+    this->fspace_ = H5Dget_space(this->dataset_);
+    if (this->fspace_ < 0){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+                "%s::%s ERROR Unable to get a copy of the dataspace for dataset [%s]\n", 
+                fileName, functionName, this->name_.c_str());
+      return asynError;
+    }
+    this->extent_.resize(this->rank_);
+    this->fileMaxdims_.resize(this->rank_);
+    H5Sget_simple_extent_dims(this->fspace_, &this->extent_[0], &this->fileMaxdims_[0]);
+    // The first block is allocated with the first frame
+    grow = (this->extendBlock_ > 1);
+  }
+
+#ifdef ND_WITH_HDF5_MPI
+  // Extending the dataset is collective, so all of the ranks extend it to the largest size that any of them needs
+  if (this->comm_ != MPI_COMM_NULL){
+    if (MPI_Allreduce(MPI_IN_PLACE, this->dims_, this->rank_, MPI_UINT64_T, MPI_MAX, this->comm_) != MPI_SUCCESS){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+                "%s::%s ERROR Unable to agree the size of dataset [%s] between the MPI ranks\n", 
+                fileName, functionName, this->name_.c_str());
+      return asynError;
+    }
+  }
+#endif
+
+  for (i=0; i<this->rank_; i++){
+    if (this->dims_[i] > this->extent_[i]) grow = true;
+  }
+  if (!grow) return asynSuccess;
+
+  epicsTimeGetCurrent(&startts);
+  for (i=0; i<this->rank_; i++){
+    hsize_t size = this->dims_[i];
+    if (i < this->extraDims_ && this->extendBlock_ > 1){
+      if (this->extraDims_ == 1){
+        size = ((size + this->extendBlock_ - 1) / this->extendBlock_) * this->extendBlock_;
+      } else if (this->virtualdims_[i] > size){
+        size = this->virtualdims_[i];
+      }
+      if (this->fileMaxdims_[i] != H5S_UNLIMITED && size > this->fileMaxdims_[i]) size = this->fileMaxdims_[i];
+      if (size < this->extent_[i]) size = this->extent_[i];
+      if (size < this->dims_[i]) size = this->dims_[i];
+    }
+    this->extent_[i] = size;
+  }
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s: set_extent dims={%d,%d,%d}\n",
+            fileName, functionName, (int)this->extent_[0], (int)this->extent_[1], (int)this->extent_[this->rank_ > 2 ? 2 : 1]);
+
+  hdfstatus = H5Dset_extent(this->dataset_, &this->extent_[0]);
+  if (hdfstatus){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n", 
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  hdfstatus = H5Sset_extent_simple(this->fspace_, this->rank_, &this->extent_[0], &this->fileMaxdims_[0]);
+  if (hdfstatus){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Unable to resize the dataspace for dataset [%s]\n", 
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  epicsTimeGetCurrent(&endts);
+  this->extendTime_ = epicsTimeDiffInSeconds(&endts, &startts);
+  return asynSuccess;
+}
+
 /** extendDataSet.
  * Extend this dataset as necessary.  If no extra dimensions are specified
  * then the dataset is simply increased in the frame number direction.
@@ -149,6 +260,55 @@ asynStatus NDFileHDF5Dataset::extendDataSet(int extradims, hsize_t *offsets)
   return status;
 }
 
+/** placeFrame.
+ * Place the next frame at a given index of the n'th frame dimension, rather than after the
+ * previous frame.  The dataset grows to include the index, and the frames in between are left
+ * to be written by others.  This is only for datasets with no extra dimensions besides the frame number.
+ * \param[in] frame - The index of the frame in the dataset.
+ */
+asynStatus NDFileHDF5Dataset::placeFrame(hsize_t frame)
+{
+  static const char *functionName = "placeFrame";
+
+  if (this->extraDims_ != 1){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR frames can only be placed in datasets with only the frame dimension [%s]\n",
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  if (this->dims_[0] < frame+1) this->dims_[0] = frame+1;
+  this->offset_[0] = frame;
+  return asynSuccess;
+}
+
+#ifdef ND_WITH_HDF5_MPI
+/** setParallel.
+ * Write this dataset together with the other MPI ranks of a communicator, in a file opened with
+ * the MPI-IO driver on the same communicator.  The ranks must write the same number of frames.
+ * The frames are written collectively, and the dataset is extended to the largest size that any
+ * rank needs as each frame is written.
+ * \param[in] comm - The MPI communicator of the ranks that write the file.
+ */
+asynStatus NDFileHDF5Dataset::setParallel(MPI_Comm comm)
+{
+  static const char *functionName = "setParallel";
+
+  if (this->xferPlist_ == H5P_DEFAULT){
+    this->xferPlist_ = H5Pcreate(H5P_DATASET_XFER);
+    if (this->xferPlist_ < 0 || H5Pset_dxpl_mpio(this->xferPlist_, H5FD_MPIO_COLLECTIVE) < 0){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+                "%s::%s ERROR Unable to configure collective writes of dataset [%s]\n", 
+                fileName, functionName, this->name_.c_str());
+      if (this->xferPlist_ >= 0) H5Pclose(this->xferPlist_);
+      this->xferPlist_ = H5P_DEFAULT;
+      return asynError;
+    }
+  }
+  this->comm_ = comm;
+  return asynSuccess;
+}
+#endif
+
 /** writeFile.
  * Write the data using the HDF5 library calls.
  * \param[in] pArray - The NDArray containing the data to write.
@@ -161,35 +321,78 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
   herr_t hdfstatus;
   static const char *functionName = "writeFile";
 
-  // Increase the size of the dataset
-  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
-            "%s::%s: set_extent dims={%d,%d,%d}\n",
-            fileName, functionName, (int)this->dims_[0], (int)this->dims_[1], (int)this->dims_[2]);
+  // Increase the size of the dataset if the frame does not fit
+  if (this->extendToFit() != asynSuccess) return asynError;
 
-  hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
+  // Select a hyperslab.
+  hdfstatus = H5Sselect_hyperslab(this->fspace_, H5S_SELECT_SET, this->offset_, NULL, framesize, NULL);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
-              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n", 
-              fileName, functionName, this->name_.c_str());
+              "%s::%s ERROR Unable to select hyperslab\n", 
+              fileName, functionName);
     return asynError;
   }
-  // Select a hyperslab.
-  hid_t fspace = H5Dget_space(this->dataset_);
-  if (fspace < 0){
+  // Write the data to the hyperslab.
+  hdfstatus = H5Dwrite(this->dataset_, datatype, dataspace, this->fspace_, this->xferPlist_, pArray->pData);
+  if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
-              "%s::%s ERROR Unable to get a copy of the dataspace for dataset [%s]\n", 
+              "%s::%s ERROR Unable to write data to hyperslab\n", 
+              fileName, functionName);
+    return asynError;
+  }
+
+  this->nextRecord_++;
+
+  return asynSuccess;
+}
+
+/** writeFrames.
+ * Write a number of consecutive frames after the last frame with one hyperslab, for the frames of a frame stack.
+ * This is only for datasets with no extra dimensions besides the frame number.
+ * \param[in] pData - The frames, one after the other.
+ * \param[in] datatype - The HDF5 datatype of the data.
+ * \param[in] numFrames - The number of frames to write.
+ * \param[in] framesize - The size of one frame.
+ */
+asynStatus NDFileHDF5Dataset::writeFrames(const void *pData, hid_t datatype, hsize_t numFrames, hsize_t *framesize)
+{
+  herr_t hdfstatus;
+  hid_t memspace;
+  std::vector<hsize_t> count(framesize, framesize + this->rank_);
+  hsize_t first;
+  static const char *functionName = "writeFrames";
+
+  if (this->extraDims_ != 1 || numFrames == 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR frames can only be written together to datasets with only the frame dimension [%s]\n",
               fileName, functionName, this->name_.c_str());
     return asynError;
   }
-  hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, this->offset_, NULL, framesize, NULL);
+  // The first frame has the offset and dimensions that are preconfigured
+  first = (this->nextRecord_ == 0) ? 0 : this->dims_[0];
+  this->dims_[0] = first + numFrames;
+  this->offset_[0] = first;
+
+  // Increase the size of the dataset if the frames do not fit
+  if (this->extendToFit() != asynSuccess) return asynError;
+
+  count[0] = numFrames;
+  hdfstatus = H5Sselect_hyperslab(this->fspace_, H5S_SELECT_SET, this->offset_, NULL, &count[0], NULL);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Unable to select hyperslab\n", 
               fileName, functionName);
     return asynError;
   }
-  // Write the data to the hyperslab.
-  hdfstatus = H5Dwrite(this->dataset_, datatype, dataspace, fspace, H5P_DEFAULT, pArray->pData);
+  memspace = H5Screate_simple(this->rank_, &count[0], NULL);
+  if (memspace < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Unable to create the dataspace of %d frames\n", 
+              fileName, functionName, (int)numFrames);
+    return asynError;
+  }
+  hdfstatus = H5Dwrite(this->dataset_, datatype, memspace, this->fspace_, this->xferPlist_, pData);
+  H5Sclose(memspace);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Unable to write data to hyperslab\n", 
@@ -197,17 +400,62 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     return asynError;
   }
 
-  hdfstatus = H5Sclose(fspace);
-  if (hdfstatus){
-    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
-              "%s::%s ERROR Unable to close the dataspace\n", 
-              fileName, functionName);
+  // The offset is left at the last frame, as for frames written one at a time
+  this->offset_[0] = this->dims_[0] - 1;
+  this->nextRecord_ += (int)numFrames;
+
+  return asynSuccess;
+}
+
+/** writeChunks.
+ * Write the chunks of one frame that are already compressed, bypassing the HDF5 filter pipeline.
+ * The frame must be chunked in only one dimension, so the chunks are at the offset of the frame
+ * except in that dimension.
+ * \param[in] numChunks - The number of chunks in the frame.
+ * \param[in] chunkDim - The HDF5 dimension that the frame is chunked in.
+ * \param[in] chunkSize - The size of a chunk in that dimension.
+ * \param[in] pChunks - The data of each chunk, as the filters would have produced it.
+ * \param[in] pSizes - The size of each chunk in bytes.
+ * \param[in] pFilterMasks - The filters that were skipped for each chunk, 0 if none were.
+ */
+asynStatus NDFileHDF5Dataset::writeChunks(int numChunks, int chunkDim, hsize_t chunkSize, const void *const *pChunks,
+                                          const size_t *pSizes, const unsigned int *pFilterMasks)
+{
+  static const char *functionName = "writeChunks";
+
+#if H5_VERSION_GE(1,10,3)
+  herr_t hdfstatus;
+  hsize_t *offsets = (hsize_t *)calloc(this->rank_, sizeof(hsize_t));
+  int i;
+
+  // Increase the size of the dataset if the frame does not fit
+  if (this->extendToFit() != asynSuccess){
+    free(offsets);
     return asynError;
   }
+  for (i=0; i<this->rank_; i++) offsets[i] = this->offset_[i];
+  for (i=0; i<numChunks; i++){
+    offsets[chunkDim] = i * chunkSize;
+    hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, pFilterMasks[i], offsets, pSizes[i], pChunks[i]);
+    if (hdfstatus){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+                "%s::%s ERROR Unable to write chunk %d to dataset [%s]\n", 
+                fileName, functionName, i, this->name_.c_str());
+      free(offsets);
+      return asynError;
+    }
+  }
+  free(offsets);
 
   this->nextRecord_++;
 
   return asynSuccess;
+#else
+  asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+            "%s::%s ERROR Direct chunk writes need HDF5 1.10.3 or later\n", 
+            fileName, functionName);
+  return asynError;
+#endif
 }
 
 /** getHandle.
@@ -218,6 +466,14 @@ hid_t NDFileHDF5Dataset::getHandle()
   return this->dataset_;
 }
 
+/** getExtendTime.
+ * Returns the time that the last write spent extending the dataset in the file, in seconds.
+ */
+double NDFileHDF5Dataset::getExtendTime()
+{
+  return this->extendTime_;
+}
+
 asynStatus NDFileHDF5Dataset::flushDataset()
 {
   static const char *functionName = "flushDataset";
@@ -246,3 +502,34 @@ asynStatus NDFileHDF5Dataset::flushDataset()
   return asynSuccess;  
 }
 
+/** closeDataset.
+ * Shrink the dataset to the frames that were written, if it was extended ahead of them,
+ * and close the dataset.
+ */
+asynStatus NDFileHDF5Dataset::closeDataset()
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "closeDataset";
+
+  if (this->fspace_ >= 0){
+    if (!std::equal(this->extent_.begin(), this->extent_.end(), this->dims_)){
+      if (H5Dset_extent(this->dataset_, this->dims_)){
+        asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+                  "%s::%s ERROR Shrinking the dataset [%s] failed\n", 
+                  fileName, functionName, this->name_.c_str());
+        status = asynError;
+      }
+    }
+    H5Sclose(this->fspace_);
+    this->fspace_ = -1;
+    this->extent_.clear();
+  }
+  if (this->xferPlist_ != H5P_DEFAULT){
+    H5Pclose(this->xferPlist_);
+    this->xferPlist_ = H5P_DEFAULT;
+  }
+  H5Dclose(this->dataset_);
+
+  return status;
+}
+
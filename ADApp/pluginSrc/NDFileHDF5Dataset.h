@@ -2,7 +2,11 @@
 #define NDFILEHDF5DATASET_H_
 
 #include <string>
+#include <vector>
 #include <hdf5.h>
+#ifdef ND_WITH_HDF5_MPI
+#include <mpi.h>
+#endif
 #include "NDPluginFile.h"
 #include "NDFileHDF5VersionCheck.h"
 
@@ -14,16 +18,28 @@ class NDFileHDF5Dataset
     NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& name, hid_t dataset);
 
     asynStatus configureDims(NDArray *pArray, bool multiframe, int extradimensions, int *extra_dims, int *user_chunking);
+    void setExtendBlock(hsize_t frames);
     asynStatus extendDataSet(int extradims);
     asynStatus extendDataSet(int extradims, hsize_t *offsets);
+    asynStatus placeFrame(hsize_t frame);
+#ifdef ND_WITH_HDF5_MPI
+    asynStatus setParallel(MPI_Comm comm);
+#endif
     asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize);
+    asynStatus writeFrames(const void *pData, hid_t datatype, hsize_t numFrames, hsize_t *framesize);
+    asynStatus writeChunks(int numChunks, int chunkDim, hsize_t chunkSize, const void *const *pChunks,
+                           const size_t *pSizes, const unsigned int *pFilterMasks);
     hid_t getHandle();
+    double getExtendTime();
     asynStatus flushDataset();
+    asynStatus closeDataset();
 
 #ifndef _UNITTEST_HDF5_
   private:
 #endif
 
+    asynStatus extendToFit();
+
     asynUser    *pAsynUser_;   // Pointer to the asynUser structure
     std::string name_;         // Name of this dataset
     hid_t       dataset_;      // Dataset handle
@@ -37,6 +53,16 @@ class NDFileHDF5Dataset
     hsize_t     *virtualdims_; // The desired sizes of the extra (virtual) dimensions: {Y, X, n}
     char        *ptrDimensionNames[ND_ARRAY_MAX_DIMS]; // Array of strings with human readable names for each dimension
     char        *dimsreport_;  // A string which contain a verbose report of all dimension sizes. The method getDimsReport fill in this
+    int         extraDims_;    // Number of extra dimensions, including the n'th frame dimension
+    hsize_t     extendBlock_;  // Number of frames the dataset is extended by at a time
+    hid_t       fspace_;       // File dataspace, kept open between frames
+    std::vector<hsize_t> extent_;      // Current dimension sizes of the dataset in the file, which can be ahead of dims_
+    std::vector<hsize_t> fileMaxdims_; // Maximum dimension sizes of the dataset in the file
+    double      extendTime_;   // Time spent extending the dataset in the file by the last write, in seconds
+    hid_t       xferPlist_;    // Data transfer property list of the frame writes
+#ifdef ND_WITH_HDF5_MPI
+    MPI_Comm    comm_;         // The MPI ranks that write this dataset together, MPI_COMM_NULL if this process writes it alone
+#endif
 };
 
 
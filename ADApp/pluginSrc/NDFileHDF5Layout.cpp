@@ -258,6 +258,13 @@ namespace hdf5
     return 0;
   }
 
+  /** Add an attribute, replacing any existing attribute with the same name */
+  void Element::set_attribute(Attribute& attr)
+  {
+    this->attributes.erase(attr.get_name());
+    this->attributes.insert(std::pair<std::string, Attribute>(attr.get_name(), attr));
+  }
+
   bool Element::has_attribute(const std::string& attr_name)
   {
     return this->attributes.count(attr_name)>0 ? true : false;
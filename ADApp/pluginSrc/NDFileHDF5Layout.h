@@ -122,6 +122,7 @@ namespace hdf5
       virtual std::string get_full_name();
       virtual std::string get_path(bool trailing_slash=false);
       int add_attribute(Attribute& attr);
+      void set_attribute(Attribute& attr);
       bool has_attribute(const std::string& attr_name);
       int tree_level();
       Element *get_parent();
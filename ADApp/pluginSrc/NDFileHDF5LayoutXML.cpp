@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <string>
 #include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <libxml/xmlreader.h>
 #include <epicsExport.h>
@@ -77,7 +79,8 @@ namespace hdf5
     </group>              <!-- end group data --> \
   </group>                <!-- end group entry --> ";
 
-  LayoutXML::LayoutXML() : auto_ndattr_default(true), ptr_tree(NULL), ptr_curr_element(NULL)
+  LayoutXML::LayoutXML() : auto_ndattr_default(true), ptr_tree(NULL), ptr_curr_element(NULL),
+                           loaded_default(false), loaded_mtime(0), loaded_size(0)
   {
     log = log4cxx::Logger::getLogger("LayoutXML");
 
@@ -98,6 +101,14 @@ namespace hdf5
   int LayoutXML::load_xml()
   {
     int ret = 0;
+
+    // Reuse the tree if the default layout is already loaded
+    if (this->ptr_tree != NULL && this->loaded_default){
+      LOG4CXX_DEBUG(log, "Reusing default HDF5 layout tree");
+      return 0;
+    }
+    this->unload_xml();
+
     auto_ndattr_default = true;
     this->xmlreader = xmlReaderForMemory(DEFAULT_LAYOUT.c_str(),
                                          (int)DEFAULT_LAYOUT.size(),
@@ -127,12 +138,27 @@ namespace hdf5
     }
 
     LOG4CXX_DEBUG(log, "XML layout tree shape: " << this->ptr_tree->_str_());
+    if (ret == 0){
+      this->loaded_default = true;
+    }
     return ret;
   }
 
   int LayoutXML::load_xml(const std::string& filename)
   {
     int ret = 0;
+    time_t mtime = 0;
+    long long size = 0;
+
+    // Reuse the tree if it was parsed from this layout and the layout has not changed since
+    bool stamped = this->get_source_stamp(filename, &mtime, &size);
+    if (stamped && this->ptr_tree != NULL && !this->loaded_default && this->loaded_source == filename &&
+        this->loaded_mtime == mtime && this->loaded_size == size){
+      LOG4CXX_DEBUG(log, "Reusing HDF5 layout tree of: " << filename);
+      return 0;
+    }
+    this->unload_xml();
+
     auto_ndattr_default = true;
     // if the file name contains <?xml then load it as an xml string from memory
     if (filename.find("<?xml") != std::string::npos){
@@ -163,6 +189,11 @@ namespace hdf5
     }
 
     LOG4CXX_DEBUG(log, "XML layout tree shape: " << this->ptr_tree->_str_() );
+    if (ret == 0 && stamped){
+      this->loaded_source = filename;
+      this->loaded_mtime = mtime;
+      this->loaded_size = size;
+    }
     return ret;
   }
 
@@ -226,6 +257,12 @@ namespace hdf5
     // Empty the globals store
     this->globals.clear();
 
+    // Forget where the tree was loaded from
+    this->loaded_default = false;
+    this->loaded_source.clear();
+    this->loaded_mtime = 0;
+    this->loaded_size = 0;
+
     // Release the xml reader
     if (this->xmlreader != NULL){
       xmlFreeTextReader(this->xmlreader);
@@ -234,6 +271,26 @@ namespace hdf5
     return 0;
   }
 
+  /** Get the modification time and size of a layout file, used to tell if a loaded tree is
+   * still current. An XML string has no modification time, and its length is used as its size.
+   * Returns false if the layout file cannot be accessed.
+   */
+  bool LayoutXML::get_source_stamp(const std::string& filename, time_t *mtime, long long *size)
+  {
+    if (filename.find("<?xml") != std::string::npos){
+      *mtime = 0;
+      *size = (long long)filename.length();
+      return true;
+    }
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer) != 0){
+      return false;
+    }
+    *mtime = buffer.st_mtime;
+    *size = (long long)buffer.st_size;
+    return true;
+  }
+
   Root* LayoutXML::get_hdftree()
   {
     return this->ptr_tree;
@@ -9,6 +9,7 @@
 #define NDFILEHDF5LAYOUTXML_H_
 
 #include <libxml/xmlreader.h>
+#include <ctime>
 #include <string>
 #include <map>
 #ifdef LOG4CXX
@@ -55,6 +56,10 @@ namespace hdf5
   int main_xml(const char *fname);
 
   /**  Used to define layout of HDF5 file with NDFileHDF5 plugin 
+    *
+    * The parsed tree is kept until unload_xml() is called, and load_xml() reuses it
+    * without parsing again if it is asked to load the same layout file (unchanged
+    * modification time and size), the same XML string or the default layout again.
     */ 
   class epicsShareClass LayoutXML
   {
@@ -108,6 +113,7 @@ namespace hdf5
       int new_attribute();
       int new_global();
       int new_hardlink();
+      bool get_source_stamp(const std::string& filename, time_t *mtime, long long *size);
 
       bool auto_ndattr_default;
       log4cxx::LoggerPtr log;
@@ -115,6 +121,10 @@ namespace hdf5
       Element *ptr_curr_element;
       xmlTextReaderPtr xmlreader;
       std::map<std::string, std::string> globals;
+      bool loaded_default;        // The tree was parsed from the default layout
+      std::string loaded_source;  // Layout file name or XML string the tree was parsed from
+      time_t loaded_mtime;        // Modification time of the layout file when it was parsed
+      long long loaded_size;      // Size of the layout file (or XML string) when it was parsed
   };
 
 } // hdf5
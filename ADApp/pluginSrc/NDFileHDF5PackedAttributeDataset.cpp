@@ -0,0 +1,281 @@
+/*
+ * NDFileHDF5PackedAttributeDataset.cpp
+ *
+ * The numeric NDAttributes of each frame packed into one record of a compound dataset.
+ */
+
+#include "NDFileHDF5PackedAttributeDataset.h"
+#include <string.h>
+#include <algorithm>
+
+NDFileHDF5PackedAttributeDataset::NDFileHDF5PackedAttributeDataset(hid_t file, const std::string& name) :
+  name_(name),
+  file_(file),
+  groupName_(""),
+  dataset_(-1),
+  memType_(-1),
+  fileType_(-1),
+  filespace_(-1),
+  memspace_(-1),
+  recordSize_(0),
+  numRecords_(0),
+  extent_(0),
+  batchSize_(1),
+  numBuffered_(0)
+{
+}
+
+NDFileHDF5PackedAttributeDataset::~NDFileHDF5PackedAttributeDataset()
+{
+}
+
+/** Returns true for an NDAttribute that can be a member of the records, one with a numeric value */
+bool NDFileHDF5PackedAttributeDataset::isPackable(NDAttribute *ndAttr)
+{
+  switch (ndAttr->getDataType())
+  {
+    case NDAttrInt8:
+    case NDAttrUInt8:
+    case NDAttrInt16:
+    case NDAttrUInt16:
+    case NDAttrInt32:
+    case NDAttrUInt32:
+    case NDAttrFloat32:
+    case NDAttrFloat64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void NDFileHDF5PackedAttributeDataset::setParentGroupName(const std::string& group)
+{
+  groupName_ = group;
+}
+
+/** Sets the number of records that are buffered in memory before they are written to the file with one
+  * H5Dwrite.  The buffer is also written when the dataset is flushed and when it is closed.
+  * This must be called before the dataset is created.
+  */
+void NDFileHDF5PackedAttributeDataset::setBatchSize(int batchSize)
+{
+  if (batchSize < 1) batchSize = 1;
+  batchSize_ = batchSize;
+}
+
+/** Adds an NDAttribute to the members of the records.  This must be called before the dataset is created,
+  * and only for an NDAttribute for which isPackable() is true.
+  */
+void NDFileHDF5PackedAttributeDataset::addMember(NDAttribute *ndAttr)
+{
+  member_t member;
+  NDAttrSource_t sourceType;
+  NDAttrDataType_t type;
+  size_t size;
+
+  ndAttr->getValueInfo(&type, &size);
+  member.name = ndAttr->getName();
+  member.description = ndAttr->getDescription();
+  member.sourceType = ndAttr->getSourceInfo(&sourceType);
+  member.source = ndAttr->getSource();
+  member.type = type;
+  member.size = size;
+  // Each value is aligned to its size in memory, the file type has no padding
+  member.offset = (recordSize_ + size - 1) / size * size;
+  recordSize_ = member.offset + size;
+  members_.push_back(member);
+}
+
+int NDFileHDF5PackedAttributeDataset::getNumMembers()
+{
+  return (int)members_.size();
+}
+
+asynStatus NDFileHDF5PackedAttributeDataset::createDataset(int user_chunking)
+{
+  asynStatus status = asynSuccess;
+  std::vector<std::string> names, descriptions, sourceTypes, sources;
+  hsize_t dims = 0, maxdims = H5S_UNLIMITED, chunk, batch;
+  hid_t nativeType, cparm, dataspace, dsetgroup;
+  size_t i;
+
+  if (members_.empty()) return asynError;
+  recordSize_ = (recordSize_ + sizeof(epicsFloat64) - 1) / sizeof(epicsFloat64) * sizeof(epicsFloat64);
+  memType_ = H5Tcreate(H5T_COMPOUND, recordSize_);
+  for (i = 0; i < members_.size(); i++){
+    switch (members_[i].type)
+    {
+      case NDAttrInt8:    nativeType = H5T_NATIVE_INT8;   break;
+      case NDAttrUInt8:   nativeType = H5T_NATIVE_UINT8;  break;
+      case NDAttrInt16:   nativeType = H5T_NATIVE_INT16;  break;
+      case NDAttrUInt16:  nativeType = H5T_NATIVE_UINT16; break;
+      case NDAttrInt32:   nativeType = H5T_NATIVE_INT32;  break;
+      case NDAttrUInt32:  nativeType = H5T_NATIVE_UINT32; break;
+      case NDAttrFloat32: nativeType = H5T_NATIVE_FLOAT;  break;
+      default:            nativeType = H5T_NATIVE_DOUBLE; break;
+    }
+    H5Tinsert(memType_, members_[i].name.c_str(), members_[i].offset, nativeType);
+    names.push_back(members_[i].name);
+    descriptions.push_back(members_[i].description);
+    sourceTypes.push_back(members_[i].sourceType);
+    sources.push_back(members_[i].source);
+  }
+  fileType_ = H5Tcopy(memType_);
+  H5Tpack(fileType_);
+
+  chunk = (user_chunking > 0) ? user_chunking : 1;
+  cparm = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(cparm, 1, &chunk);
+  dataspace = H5Screate_simple(1, &dims, &maxdims);
+  if (groupName_ != ""){
+    dsetgroup = H5Gopen(file_, groupName_.c_str(), H5P_DEFAULT);
+  } else {
+    dsetgroup = file_;
+  }
+  dataset_ = H5Dcreate2(dsetgroup, name_.c_str(), fileType_, dataspace, H5P_DEFAULT, cparm, H5P_DEFAULT);
+  if (groupName_ != ""){
+    H5Gclose(dsetgroup);
+  }
+  H5Sclose(dataspace);
+  H5Pclose(cparm);
+  if (dataset_ < 0) return asynError;
+
+  if (writeStringArrayAttribute("NDAttrNames", names) != asynSuccess) status = asynError;
+  if (writeStringArrayAttribute("NDAttrDescriptions", descriptions) != asynSuccess) status = asynError;
+  if (writeStringArrayAttribute("NDAttrSourceTypes", sourceTypes) != asynSuccess) status = asynError;
+  if (writeStringArrayAttribute("NDAttrSources", sources) != asynSuccess) status = asynError;
+
+  // The file space is kept for the life of the dataset and only resized when the dataset grows,
+  // and the memory space holds a whole batch of records
+  batch = batchSize_;
+  filespace_ = H5Dget_space(dataset_);
+  memspace_ = H5Screate_simple(1, &batch, NULL);
+  batchRecords_.assign(batchSize_ * recordSize_, 0);
+  numRecords_ = 0;
+  extent_ = 0;
+  numBuffered_ = 0;
+
+  return status;
+}
+
+/** Writes a 1-D attribute of fixed length strings to the dataset */
+asynStatus NDFileHDF5PackedAttributeDataset::writeStringArrayAttribute(const char *attrName,
+                                                                     const std::vector<std::string>& values)
+{
+  asynStatus status = asynSuccess;
+  size_t size = 1, i;
+  hsize_t count = values.size();
+
+  for (i = 0; i < values.size(); i++) size = std::max(size, values[i].size() + 1);
+  std::vector<char> strings(count * size, 0);
+  for (i = 0; i < values.size(); i++) memcpy(&strings[i * size], values[i].c_str(), values[i].size());
+
+  hid_t type = H5Tcopy(H5T_C_S1);
+  H5Tset_size(type, size);
+  H5Tset_strpad(type, H5T_STR_NULLTERM);
+  hid_t space = H5Screate_simple(1, &count, NULL);
+  hid_t attr = H5Acreate2(dataset_, attrName, type, space, H5P_DEFAULT, H5P_DEFAULT);
+  if (attr < 0 || H5Awrite(attr, type, &strings[0]) < 0) status = asynError;
+  if (attr >= 0) H5Aclose(attr);
+  H5Sclose(space);
+  H5Tclose(type);
+  return status;
+}
+
+/** Adds the record of a frame to the buffer, and writes the buffer when it is full.
+  * \param[in] pAttributeList The NDAttributes of the frame.  The members that are not in the list are 0 in
+  *            the record, and values of another type are converted to the type of the member.
+  * \param[in] flush 1 to flush the dataset after the record.
+  */
+asynStatus NDFileHDF5PackedAttributeDataset::writeAttributeDataset(NDAttributeList *pAttributeList, int flush)
+{
+  asynStatus status = asynSuccess;
+  char *pRecord = &batchRecords_[numBuffered_ * recordSize_];
+  NDAttribute *ndAttr;
+  size_t i;
+
+  memset(pRecord, 0, recordSize_);
+  for (i = 0; i < members_.size(); i++){
+    ndAttr = pAttributeList->find(members_[i].name.c_str());
+    if (ndAttr == NULL) continue;
+    if (ndAttr->getValue(members_[i].type, pRecord + members_[i].offset, members_[i].size) == ND_ERROR){
+      memset(pRecord + members_[i].offset, 0, members_[i].size);
+    }
+  }
+  numRecords_++;
+  numBuffered_++;
+  if (numBuffered_ >= batchSize_){
+    status = this->writeBuffer();
+  }
+  if (flush == 1){
+    if (this->flushDataset() != asynSuccess) status = asynError;
+  }
+  return status;
+}
+
+/** Extends the dataset to the records written so far and writes the buffered records as one hyperslab */
+asynStatus NDFileHDF5PackedAttributeDataset::writeBuffer()
+{
+  asynStatus status = asynSuccess;
+  hsize_t start = 0;
+  hsize_t count = numBuffered_;
+  hsize_t first = numRecords_ - numBuffered_;
+
+  if (extent_ != numRecords_){
+    H5Dset_extent(dataset_, &numRecords_);
+    H5Sset_extent_simple(filespace_, 1, &numRecords_, NULL);
+    extent_ = numRecords_;
+  }
+  if (numBuffered_ == 0) return status;
+
+  H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, &first, NULL, &count, NULL);
+  H5Sselect_hyperslab(memspace_, H5S_SELECT_SET, &start, NULL, &count, NULL);
+  if (H5Dwrite(dataset_, memType_, memspace_, filespace_, H5P_DEFAULT, &batchRecords_[0]) < 0){
+    status = asynError;
+  }
+  numBuffered_ = 0;
+
+  return status;
+}
+
+asynStatus NDFileHDF5PackedAttributeDataset::closeAttributeDataset()
+{
+  asynStatus status = asynSuccess;
+
+  if (dataset_ >= 0){
+    status = this->writeBuffer();
+    H5Dclose(dataset_);
+    H5Sclose(memspace_);
+    H5Sclose(filespace_);
+    dataset_ = -1;
+  }
+  if (memType_ >= 0) H5Tclose(memType_);
+  if (fileType_ >= 0) H5Tclose(fileType_);
+  memType_ = fileType_ = -1;
+  return status;
+}
+
+asynStatus NDFileHDF5PackedAttributeDataset::flushDataset()
+{
+  // The buffered records are written first so that they are flushed as well
+  asynStatus status = this->writeBuffer();
+
+  // We cannot flush for SWMR if the HDF version doesn't support it
+  #if H5_VERSION_GE(1,9,178)
+  H5Dflush(dataset_);
+  #else
+  status = asynError;
+  #endif
+
+  return status;
+}
+
+std::string NDFileHDF5PackedAttributeDataset::getName()
+{
+  return name_;
+}
+
+hid_t NDFileHDF5PackedAttributeDataset::getHandle()
+{
+  return dataset_;
+}
@@ -0,0 +1,76 @@
+/*
+ * NDFileHDF5PackedAttributeDataset.h
+ *
+ * The numeric NDAttributes of each frame packed into one record of a compound dataset.
+ */
+
+#ifndef ADAPP_PLUGINSRC_NDFILEHDF5PACKEDATTRIBUTEDATASET_H_
+#define ADAPP_PLUGINSRC_NDFILEHDF5PACKEDATTRIBUTEDATASET_H_
+
+#include <string>
+#include <vector>
+#include <hdf5.h>
+#include <asynDriver.h>
+#include <NDPluginFile.h>
+#include <NDArray.h>
+#include "NDFileHDF5VersionCheck.h"
+
+/** Writes the numeric NDAttributes of each frame as one record of a 1-D compound dataset, with one member for
+  * each NDAttribute, instead of one dataset for each NDAttribute.  The members are fixed when the file is
+  * opened.  The records of NDAttributeBatch frames are written with one H5Dwrite, so the attributes of the
+  * frames cost one chunked write rather than one for each NDAttribute.
+  * The names, descriptions, source types and sources of the NDAttributes are stored in the NDAttrNames,
+  * NDAttrDescriptions, NDAttrSourceTypes and NDAttrSources string array attributes of the dataset, in the
+  * order of the members.
+  */
+class NDFileHDF5PackedAttributeDataset
+{
+public:
+  NDFileHDF5PackedAttributeDataset(hid_t file, const std::string& name);
+  virtual ~NDFileHDF5PackedAttributeDataset();
+
+  static bool isPackable(NDAttribute *ndAttr);
+  void setParentGroupName(const std::string& group);
+  void setBatchSize(int batchSize);
+  void addMember(NDAttribute *ndAttr);
+  int getNumMembers();
+  asynStatus createDataset(int user_chunking);
+  asynStatus writeAttributeDataset(NDAttributeList *pAttributeList, int flush);
+  asynStatus closeAttributeDataset();
+  asynStatus flushDataset();
+  std::string getName();
+  hid_t getHandle();
+
+private:
+  /** One NDAttribute of the records */
+  typedef struct {
+    std::string name;
+    std::string description;
+    std::string sourceType;
+    std::string source;
+    NDAttrDataType_t type;
+    size_t offset;                    // Offset of the value in a record
+    size_t size;
+  } member_t;
+
+  asynStatus writeStringArrayAttribute(const char *attrName, const std::vector<std::string>& values);
+  asynStatus writeBuffer();
+
+  std::string      name_;            // Name of the dataset
+  hid_t            file_;            // File handle
+  std::string      groupName_;       // Name of the parent group
+  hid_t            dataset_;         // Dataset handle
+  hid_t            memType_;         // Compound type of a record in memory
+  hid_t            fileType_;        // Compound type of a record in the file, without the padding
+  hid_t            filespace_;
+  hid_t            memspace_;
+  std::vector<member_t> members_;
+  size_t           recordSize_;      // Size of a record in memory
+  hsize_t          numRecords_;      // Records written or buffered
+  hsize_t          extent_;          // Records of the dataset in the file
+  int              batchSize_;       // Number of records to buffer before they are written
+  int              numBuffered_;     // Number of records in the buffer
+  std::vector<char> batchRecords_;   // Buffered records
+};
+
+#endif /* ADAPP_PLUGINSRC_NDFILEHDF5PACKEDATTRIBUTEDATASET_H_ */
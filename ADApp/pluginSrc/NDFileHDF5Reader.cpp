@@ -0,0 +1,722 @@
+/*
+ * NDFileHDF5Reader.cpp
+ *
+ * Reads the frames of a detector dataset written by NDFileHDF5 back into NDArrays.
+ */
+
+#include <string.h>
+#include <epicsThread.h>
+#include "NDFileHDF5Reader.h"
+
+/* Filter IDs officially assigned to blosc and bitshuffle */
+#define READ_FILTER_BLOSC 32001
+#define READ_FILTER_BSHUF 32008
+/* The compression of the bitshuffle filter that follows the bit shuffle */
+#define READ_BSHUF_COMPRESS_LZ4 2
+/* Frames are read in whole chunks of frames of at least this size with one H5Dread */
+#define READ_BLOCK_BYTES (16*1048576)
+
+static const char *driverName = "NDFileHDF5Reader";
+
+static void readTaskC(void *drvPvt)
+{
+  NDFileHDF5Reader *pPvt = (NDFileHDF5Reader *)drvPvt;
+  pPvt->readTask();
+}
+
+/** Returns the NDDataType_t of the elements of an HDF5 type, or -1 if it has no NDDataType_t */
+static int typeHdf2Nd(hid_t type)
+{
+  size_t size = H5Tget_size(type);
+  switch (H5Tget_class(type))
+  {
+    case H5T_INTEGER:
+    {
+      bool isSigned = (H5Tget_sign(type) == H5T_SGN_2);
+      if (size == 1) return isSigned ? NDInt8 : NDUInt8;
+      if (size == 2) return isSigned ? NDInt16 : NDUInt16;
+      if (size == 4) return isSigned ? NDInt32 : NDUInt32;
+      return -1;
+    }
+    case H5T_FLOAT:
+      if (size == 4) return NDFloat32;
+      if (size == 8) return NDFloat64;
+      return -1;
+    default:
+      return -1;
+  }
+}
+
+/** Reads a fixed or variable length string attribute of an HDF5 object; returns an empty string if it has none */
+static std::string readStringAttribute(hid_t object, const char *name)
+{
+  std::string value;
+  if (H5Aexists(object, name) <= 0) return value;
+  hid_t attr = H5Aopen(object, name, H5P_DEFAULT);
+  hid_t type = H5Aget_type(attr);
+  if (H5Tget_class(type) == H5T_STRING){
+    if (H5Tis_variable_str(type) > 0){
+      char *pValue = NULL;
+      if (H5Aread(attr, type, &pValue) >= 0 && pValue){
+        value = pValue;
+        H5free_memory(pValue);
+      }
+    } else {
+      std::vector<char> buffer(H5Tget_size(type) + 1, 0);
+      if (H5Aread(attr, type, &buffer[0]) >= 0) value = &buffer[0];
+    }
+  }
+  H5Tclose(type);
+  H5Aclose(attr);
+  return value;
+}
+
+/** Returns the strings of a 1-D fixed length string attribute, or nothing if there is no such attribute */
+static std::vector<std::string> readStringArrayAttribute(hid_t object, const char *name)
+{
+  std::vector<std::string> values;
+  if (H5Aexists(object, name) <= 0) return values;
+  hid_t attr = H5Aopen(object, name, H5P_DEFAULT);
+  hid_t type = H5Aget_type(attr);
+  hid_t space = H5Aget_space(attr);
+  hssize_t count = H5Sget_simple_extent_npoints(space);
+  if (H5Tget_class(type) == H5T_STRING && H5Tis_variable_str(type) <= 0 && count > 0){
+    size_t size = H5Tget_size(type);
+    std::vector<char> buffer(count * size + 1, 0);
+    if (H5Aread(attr, type, &buffer[0]) >= 0){
+      for (hssize_t i=0; i<count; i++){
+        const char *pValue = &buffer[i * size];
+        values.push_back(std::string(pValue, strnlen(pValue, size)));
+      }
+    }
+  }
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Aclose(attr);
+  return values;
+}
+
+/** Returns the NDAttrSource_t of the NDAttrSourceType string of an attribute dataset */
+static NDAttrSource_t sourceTypeFromString(const std::string& sourceType)
+{
+  if (sourceType == "NDAttrSourceParam") return NDAttrSourceParam;
+  if (sourceType == "NDAttrSourceEPICSPV") return NDAttrSourceEPICSPV;
+  if (sourceType == "NDAttrSourceFunct") return NDAttrSourceFunct;
+  return NDAttrSourceDriver;
+}
+
+NDFileHDF5Reader::NDFileHDF5Reader(asynUser *pAsynUser, NDArrayPool *pNDArrayPool) :
+  pAsynUser_(pAsynUser),
+  pNDArrayPool_(pNDArrayPool),
+  file_(-1),
+  dataset_(-1),
+  memType_(-1),
+  dataType_(NDUInt8),
+  rank_(0),
+  frameRank_(0),
+  frameBytes_(0),
+  numFrames_(0),
+  blockFrames_(1),
+  readChunks_(false),
+  uniqueIdIndex_(-1),
+  timeStampIndex_(-1),
+  epicsTSSecIndex_(-1),
+  epicsTSnSecIndex_(-1),
+  queue_(NULL),
+  doneEvent_(NULL),
+  threadId_(0),
+  stop_(false),
+  finished_(true),
+  failed_(false),
+  mbytesRead_(0.0)
+{
+}
+
+NDFileHDF5Reader::~NDFileHDF5Reader()
+{
+  this->close();
+}
+
+/** Opens a file and its detector dataset and starts the read-ahead thread.
+ * \param[in] fileName The file.
+ * \param[in] datasetName The full name of the detector dataset, e.g. /entry/data/data.
+ * \param[in] readChunks Read the chunks of one frame as they are stored, if their compression is the codec
+ *            of an NDArray.
+ * \param[in] readAhead The most frames that are read ahead of next().
+ */
+asynStatus NDFileHDF5Reader::open(const char *fileName, const std::string& datasetName, bool readChunks, int readAhead)
+{
+  int i;
+  static const char *functionName = "open";
+
+  this->close();
+  this->fileName_ = fileName;
+  this->file_ = H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (this->file_ < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot open file %s\n",
+              driverName, functionName, fileName);
+    this->file_ = -1;
+    return asynError;
+  }
+  this->dataset_ = H5Dopen2(this->file_, datasetName.c_str(), H5P_DEFAULT);
+  if (this->dataset_ < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR file %s has no dataset %s\n",
+              driverName, functionName, fileName, datasetName.c_str());
+    this->dataset_ = -1;
+    this->closeHandles();
+    return asynError;
+  }
+
+  hid_t type = H5Dget_type(this->dataset_);
+  int dataType = typeHdf2Nd(type);
+  this->memType_ = H5Tget_native_type(type, H5T_DIR_ASCEND);
+  H5Tclose(type);
+  hid_t space = H5Dget_space(this->dataset_);
+  this->rank_ = H5Sget_simple_extent_ndims(space);
+  if (this->rank_ > 0){
+    this->dims_.resize(this->rank_);
+    H5Sget_simple_extent_dims(space, &this->dims_[0], NULL);
+  }
+  H5Sclose(space);
+  // The frames have the rank of the NDArrays that were written, the other dimensions number the frames
+  this->frameRank_ = (this->rank_ < 2) ? this->rank_ : 2;
+  if (H5Aexists(this->dataset_, "NDArrayNumDims") > 0){
+    int numDims = 0;
+    hid_t attr = H5Aopen(this->dataset_, "NDArrayNumDims", H5P_DEFAULT);
+    if (H5Aread(attr, H5T_NATIVE_INT, &numDims) >= 0 && numDims >= 1 && numDims <= this->rank_){
+      this->frameRank_ = numDims;
+    }
+    H5Aclose(attr);
+  }
+  if (dataType < 0 || this->frameRank_ < 1 || this->frameRank_ >= ND_ARRAY_MAX_DIMS){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR the data type or rank %d of dataset %s is not supported\n",
+              driverName, functionName, this->rank_, datasetName.c_str());
+    this->closeHandles();
+    return asynError;
+  }
+  this->dataType_ = (NDDataType_t)dataType;
+  this->frameBytes_ = H5Tget_size(this->memType_);
+  for (i=0; i<this->frameRank_; i++){
+    this->frameDims_[i] = (size_t)this->dims_[this->rank_ - 1 - i];
+    this->frameBytes_ *= this->frameDims_[i];
+  }
+  this->numFrames_ = 1;
+  for (i=0; i<this->rank_ - this->frameRank_; i++) this->numFrames_ *= (size_t)this->dims_[i];
+
+  // The frames are read in blocks of whole chunks of the last frame dimension, so no chunk is read twice
+  this->chunk_.assign(this->rank_, 1);
+  hid_t plist = H5Dget_create_plist(this->dataset_);
+  if (H5Pget_layout(plist) == H5D_CHUNKED) H5Pget_chunk(plist, this->rank_, &this->chunk_[0]);
+  this->blockFrames_ = 1;
+  if (this->rank_ > this->frameRank_ && this->frameBytes_ > 0){
+    int inner = this->rank_ - this->frameRank_ - 1;
+    hsize_t chunkFrames = this->chunk_[inner];
+    hsize_t chunks = READ_BLOCK_BYTES / (chunkFrames * this->frameBytes_);
+    this->blockFrames_ = chunkFrames * ((chunks > 1) ? chunks : 1);
+    if (this->blockFrames_ > this->dims_[inner]) this->blockFrames_ = this->dims_[inner];
+    if (this->blockFrames_ < 1) this->blockFrames_ = 1;
+  }
+  this->readChunks_ = readChunks && this->configureReadChunks(plist);
+  H5Pclose(plist);
+
+  if (this->openAttributeDatasets() != asynSuccess){
+    this->closeHandles();
+    return asynError;
+  }
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s file %s dataset %s: %d frames of %d bytes, read %d frames at a time%s, %d attribute datasets\n",
+            driverName, functionName, fileName, datasetName.c_str(), (int)this->numFrames_, (int)this->frameBytes_,
+            (int)this->blockFrames_, this->readChunks_ ? " as compressed chunks" : "", (int)this->attributes_.size());
+
+  this->queue_ = epicsMessageQueueCreate((readAhead > 0) ? readAhead : 1, sizeof(NDArray *));
+  this->doneEvent_ = epicsEventCreate(epicsEventEmpty);
+  this->stop_ = false;
+  this->finished_ = false;
+  this->failed_ = false;
+  this->mbytesRead_ = 0.0;
+  this->threadId_ = epicsThreadCreate("NDFileHDF5Reader",
+                                      epicsThreadPriorityMedium,
+                                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                                      (EPICSTHREADFUNC)readTaskC, this);
+  if (!this->threadId_){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot create the read-ahead thread\n",
+              driverName, functionName);
+    this->finished_ = true;
+    this->close();
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** Returns true if the chunks hold one frame each and are compressed with one filter that is the codec of an
+ * NDArray, and sets codec_ to it */
+bool NDFileHDF5Reader::configureReadChunks(hid_t plist)
+{
+  static const char *functionName = "configureReadChunks";
+#if H5_VERSION_GE(1,10,3)
+  unsigned int flags = 0, config = 0;
+  unsigned int cdValues[16];
+  size_t numValues = 16;
+  char name[64];
+  int i;
+
+  for (i=0; i<this->rank_; i++){
+    hsize_t chunkSize = (i < this->rank_ - this->frameRank_) ? 1 : this->dims_[i];
+    if (this->chunk_[i] != chunkSize) break;
+  }
+  if (i == this->rank_ && H5Pget_nfilters(plist) == 1){
+    H5Z_filter_t filter = H5Pget_filter2(plist, 0, &flags, &numValues, cdValues, sizeof(name), name, &config);
+    this->codec_.clear();
+    if (filter == READ_FILTER_BLOSC){
+      this->codec_.name = NDCodecName[NDCodecBlosc];
+      if (numValues > 4) this->codec_.level = cdValues[4];
+      if (numValues > 5) this->codec_.shuffle = cdValues[5];
+      if (numValues > 6) this->codec_.compressor = cdValues[6];
+      return true;
+    }
+    if (filter == READ_FILTER_BSHUF && numValues > 4 && cdValues[4] == READ_BSHUF_COMPRESS_LZ4){
+      this->codec_.name = NDCodecName[NDCodecBSLZ4];
+      return true;
+    }
+  }
+#endif
+  asynPrint(this->pAsynUser_, ASYN_TRACE_WARNING,
+            "%s::%s the chunks of %s are not blosc or bitshuffle/LZ4 chunks of one frame, reading them decompressed\n",
+            driverName, functionName, this->fileName_.c_str());
+  return false;
+}
+
+/** Finds the datasets of the NDAttributes in the file, which have an NDAttrName attribute, and reads the values
+ * that are not read with each block */
+asynStatus NDFileHDF5Reader::openAttributeDatasets()
+{
+  size_t i;
+  static const char *functionName = "openAttributeDatasets";
+
+  this->attributes_.clear();
+  this->uniqueIdIndex_ = this->timeStampIndex_ = this->epicsTSSecIndex_ = this->epicsTSnSecIndex_ = -1;
+  if (H5Lvisit(this->file_, H5_INDEX_NAME, H5_ITER_NATIVE, visitLink, this) < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot list the datasets of %s\n",
+              driverName, functionName, this->fileName_.c_str());
+    return asynError;
+  }
+  for (i=0; i<this->attributes_.size(); i++){
+    attributeDataset_t& attr = this->attributes_[i];
+    if (attr.name == "NDArrayUniqueId") this->uniqueIdIndex_ = (int)i;
+    if (attr.name == "NDArrayTimeStamp") this->timeStampIndex_ = (int)i;
+    if (attr.name == "NDArrayEpicsTSSec") this->epicsTSSecIndex_ = (int)i;
+    if (attr.name == "NDArrayEpicsTSnSec") this->epicsTSnSecIndex_ = (int)i;
+    if (!attr.loaded) continue;
+    hsize_t numValues = attr.perFrame ? this->numFrames_ : 1;
+    attr.values.resize(numValues * attr.valueSize);
+    if (H5Dread(attr.dataset, attr.memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, &attr.values[0]) < 0){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot read the attribute dataset %s\n",
+                driverName, functionName, attr.name.c_str());
+      return asynError;
+    }
+  }
+  return asynSuccess;
+}
+
+/** H5Lvisit callback that adds the datasets of the file to the attribute datasets */
+herr_t NDFileHDF5Reader::visitLink(hid_t group, const char *name, const H5L_info_t *info, void *pArg)
+{
+  NDFileHDF5Reader *pReader = (NDFileHDF5Reader *)pArg;
+
+  if (info->type != H5L_TYPE_HARD) return 0;
+  hid_t object = H5Oopen(group, name, H5P_DEFAULT);
+  if (object < 0) return 0;
+  if (H5Iget_type(object) == H5I_DATASET){
+    pReader->addAttributeDataset(object);
+  } else {
+    H5Oclose(object);
+  }
+  return 0;
+}
+
+/** Adds a dataset to attributes_ if it is the dataset of an NDAttribute with one value for each frame or for
+ * all of them; otherwise closes it */
+void NDFileHDF5Reader::addAttributeDataset(hid_t dataset)
+{
+  attributeDataset_t attr;
+  size_t i;
+
+  if (H5Aexists(dataset, "NDAttrNames") > 0){
+    this->addPackedAttributeDataset(dataset);
+    return;
+  }
+  attr.name = readStringAttribute(dataset, "NDAttrName");
+  for (i=0; i<this->attributes_.size(); i++){
+    // The hard links of the layout give some datasets more than one name
+    if (this->attributes_[i].name == attr.name) break;
+  }
+  hid_t space = H5Dget_space(dataset);
+  hssize_t numValues = H5Sget_simple_extent_npoints(space);
+  int rank = H5Sget_simple_extent_ndims(space);
+  H5Sclose(space);
+  if (attr.name.empty() || i < this->attributes_.size() ||
+      (numValues != (hssize_t)this->numFrames_ && numValues != 1)){
+    H5Dclose(dataset);
+    return;
+  }
+  attr.description = readStringAttribute(dataset, "NDAttrDescription");
+  attr.source = readStringAttribute(dataset, "NDAttrSource");
+  attr.sourceType = sourceTypeFromString(readStringAttribute(dataset, "NDAttrSourceType"));
+  attr.dataset = dataset;
+  attr.perFrame = (numValues == (hssize_t)this->numFrames_) && (this->numFrames_ > 1);
+  // The values of 1-D datasets are read with each block, the others all at once
+  attr.loaded = !attr.perFrame || (rank != 1);
+
+  hid_t type = H5Dget_type(dataset);
+  H5T_class_t typeClass = H5Tget_class(type);
+  if (attr.name == "NDArrayUniqueId" || attr.name == "NDArrayTimeStamp" ||
+      attr.name == "NDArrayEpicsTSSec" || attr.name == "NDArrayEpicsTSnSec"){
+    // HDF5 converts the identity of the frames to the types of the NDArray fields
+    if (typeClass != H5T_INTEGER && typeClass != H5T_FLOAT) attr.memType = -1;
+    else if (attr.name == "NDArrayUniqueId") attr.memType = H5Tcopy(H5T_NATIVE_INT);
+    else if (attr.name == "NDArrayTimeStamp") attr.memType = H5Tcopy(H5T_NATIVE_DOUBLE);
+    else attr.memType = H5Tcopy(H5T_NATIVE_UINT);
+    attr.dataType = NDAttrUndefined;
+  } else if (typeClass == H5T_STRING && H5Tis_variable_str(type) <= 0){
+    attr.dataType = NDAttrString;
+    attr.memType = H5Tcopy(type);
+  } else if (typeHdf2Nd(type) >= 0){
+    attr.dataType = (NDAttrDataType_t)typeHdf2Nd(type);
+    attr.memType = H5Tget_native_type(type, H5T_DIR_ASCEND);
+  } else {
+    attr.memType = -1;
+  }
+  H5Tclose(type);
+  if (attr.memType < 0){
+    H5Dclose(dataset);
+    return;
+  }
+  attr.valueSize = H5Tget_size(attr.memType);
+  this->attributes_.push_back(attr);
+}
+
+/** Adds the members of a packed NDAttributes dataset to attributes_, each read with a compound type of just
+ * that member, and closes the dataset, which stays open for each member */
+void NDFileHDF5Reader::addPackedAttributeDataset(hid_t dataset)
+{
+  std::vector<std::string> names = readStringArrayAttribute(dataset, "NDAttrNames");
+  std::vector<std::string> descriptions = readStringArrayAttribute(dataset, "NDAttrDescriptions");
+  std::vector<std::string> sourceTypes = readStringArrayAttribute(dataset, "NDAttrSourceTypes");
+  std::vector<std::string> sources = readStringArrayAttribute(dataset, "NDAttrSources");
+  size_t i, j;
+
+  hid_t space = H5Dget_space(dataset);
+  hssize_t numValues = H5Sget_simple_extent_npoints(space);
+  int rank = H5Sget_simple_extent_ndims(space);
+  H5Sclose(space);
+  hid_t type = H5Dget_type(dataset);
+  if (H5Tget_class(type) == H5T_COMPOUND && rank == 1 &&
+      (numValues == (hssize_t)this->numFrames_ || numValues == 1)){
+    for (i=0; i<names.size(); i++){
+      attributeDataset_t attr;
+      attr.name = names[i];
+      for (j=0; j<this->attributes_.size(); j++){
+        if (this->attributes_[j].name == attr.name) break;
+      }
+      int member = H5Tget_member_index(type, attr.name.c_str());
+      if (j < this->attributes_.size() || member < 0) continue;
+      hid_t memberType = H5Tget_member_type(type, member);
+      if (typeHdf2Nd(memberType) < 0){
+        H5Tclose(memberType);
+        continue;
+      }
+      attr.dataType = (NDAttrDataType_t)typeHdf2Nd(memberType);
+      hid_t nativeType = H5Tget_native_type(memberType, H5T_DIR_ASCEND);
+      H5Tclose(memberType);
+      attr.valueSize = H5Tget_size(nativeType);
+      attr.memType = H5Tcreate(H5T_COMPOUND, attr.valueSize);
+      H5Tinsert(attr.memType, attr.name.c_str(), 0, nativeType);
+      H5Tclose(nativeType);
+      if (i < descriptions.size()) attr.description = descriptions[i];
+      if (i < sources.size()) attr.source = sources[i];
+      attr.sourceType = sourceTypeFromString((i < sourceTypes.size()) ? sourceTypes[i] : "");
+      attr.perFrame = (numValues == (hssize_t)this->numFrames_) && (this->numFrames_ > 1);
+      attr.loaded = !attr.perFrame;
+      H5Iinc_ref(dataset);
+      attr.dataset = dataset;
+      this->attributes_.push_back(attr);
+    }
+  }
+  H5Tclose(type);
+  H5Dclose(dataset);
+}
+
+/** Reads the values of the attribute datasets for a block of frames, if they were not all read when the file was opened */
+asynStatus NDFileHDF5Reader::readAttributeValues(size_t frame, hsize_t numFrames)
+{
+  size_t i;
+  static const char *functionName = "readAttributeValues";
+
+  for (i=0; i<this->attributes_.size(); i++){
+    attributeDataset_t& attr = this->attributes_[i];
+    if (attr.loaded) continue;
+    hsize_t start = frame;
+    attr.values.resize(numFrames * attr.valueSize);
+    hid_t fspace = H5Dget_space(attr.dataset);
+    H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &start, NULL, &numFrames, NULL);
+    hid_t mspace = H5Screate_simple(1, &numFrames, NULL);
+    herr_t hdfstatus = H5Dread(attr.dataset, attr.memType, mspace, fspace, H5P_DEFAULT, &attr.values[0]);
+    H5Sclose(mspace);
+    H5Sclose(fspace);
+    if (hdfstatus < 0){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot read the attribute dataset %s\n",
+                driverName, functionName, attr.name.c_str());
+      return asynError;
+    }
+  }
+  return asynSuccess;
+}
+
+/** Sets the uniqueId and time stamps of a frame and adds its NDAttributes.
+ * \param[in] pFrame The frame.
+ * \param[in] frame The index of the frame in the dataset.
+ * \param[in] blockFrame The index of the frame in the block that it was read with.
+ */
+void NDFileHDF5Reader::setFrameAttributes(NDArray *pFrame, size_t frame, hsize_t blockFrame)
+{
+  size_t i;
+
+  pFrame->uniqueId = (int)frame;
+  pFrame->timeStamp = 0.0;
+  pFrame->epicsTS.secPastEpoch = 0;
+  pFrame->epicsTS.nsec = 0;
+  for (i=0; i<this->attributes_.size(); i++){
+    attributeDataset_t& attr = this->attributes_[i];
+    size_t index = 0;
+    if (attr.perFrame) index = attr.loaded ? frame : (size_t)blockFrame;
+    void *pValue = &attr.values[index * attr.valueSize];
+    if ((int)i == this->uniqueIdIndex_) pFrame->uniqueId = *(epicsInt32 *)pValue;
+    else if ((int)i == this->timeStampIndex_) pFrame->timeStamp = *(epicsFloat64 *)pValue;
+    else if ((int)i == this->epicsTSSecIndex_) pFrame->epicsTS.secPastEpoch = *(epicsUInt32 *)pValue;
+    else if ((int)i == this->epicsTSnSecIndex_) pFrame->epicsTS.nsec = *(epicsUInt32 *)pValue;
+    else if (attr.dataType == NDAttrString){
+      std::string value((const char *)pValue, strnlen((const char *)pValue, attr.valueSize));
+      pFrame->pAttributeList->add(new NDAttribute(attr.name.c_str(), attr.description.c_str(), attr.sourceType,
+                                                  attr.source.c_str(), attr.dataType, (void *)value.c_str()));
+    } else {
+      pFrame->pAttributeList->add(new NDAttribute(attr.name.c_str(), attr.description.c_str(), attr.sourceType,
+                                                  attr.source.c_str(), attr.dataType, pValue));
+    }
+  }
+}
+
+/** Sets start to the offset in the dataset of the first element of a frame */
+void NDFileHDF5Reader::frameStart(size_t frame, hsize_t *start)
+{
+  int i;
+  for (i=this->rank_-1; i>=0; i--){
+    if (i >= this->rank_ - this->frameRank_){
+      start[i] = 0;
+    } else {
+      start[i] = frame % this->dims_[i];
+      frame /= (size_t)this->dims_[i];
+    }
+  }
+}
+
+/** Reads frames that follow one another in the last frame dimension with one H5Dread into a frame stack from the
+ * NDArrayPool.
+ * \param[in] start The offset of the first frame in the dataset.
+ * \param[in] numFrames The number of frames.
+ * \return The frame stack, or NULL on error.
+ */
+NDArray *NDFileHDF5Reader::readBlock(hsize_t *start, hsize_t numFrames)
+{
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  hsize_t count[H5S_MAX_RANK];
+  int i;
+  static const char *functionName = "readBlock";
+
+  for (i=0; i<this->frameRank_; i++) dims[i] = this->frameDims_[i];
+  dims[this->frameRank_] = (size_t)numFrames;
+  NDArray *pStack = this->pNDArrayPool_->alloc(this->frameRank_ + 1, dims, this->dataType_, 0, NULL);
+  if (!pStack){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot allocate an array of %d frames\n",
+              driverName, functionName, (int)numFrames);
+    return NULL;
+  }
+  pStack->stackFrames.resize((size_t)numFrames);
+  for (i=0; i<this->rank_; i++) count[i] = (i < this->rank_ - this->frameRank_) ? 1 : this->dims_[i];
+  if (this->rank_ > this->frameRank_) count[this->rank_ - this->frameRank_ - 1] = numFrames;
+  hid_t fspace = H5Dget_space(this->dataset_);
+  H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, NULL, count, NULL);
+  hid_t mspace = H5Screate_simple(this->rank_, count, NULL);
+  herr_t hdfstatus = H5Dread(this->dataset_, this->memType_, mspace, fspace, H5P_DEFAULT, pStack->pData);
+  H5Sclose(mspace);
+  H5Sclose(fspace);
+  if (hdfstatus < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot read %d frames from %s\n",
+              driverName, functionName, (int)numFrames, this->fileName_.c_str());
+    pStack->release();
+    return NULL;
+  }
+  this->mbytesRead_ += (double)(numFrames * this->frameBytes_) / 1048576.0;
+  return pStack;
+}
+
+/** Reads the chunk of one frame as it is stored into a compressed NDArray from the NDArrayPool.
+ * \param[in] start The offset of the frame in the dataset.
+ * \return The frame, or NULL on error.
+ */
+NDArray *NDFileHDF5Reader::readChunk(hsize_t *start)
+{
+  NDArray *pFrame = NULL;
+  static const char *functionName = "readChunk";
+#if H5_VERSION_GE(1,10,3)
+  hsize_t chunkBytes = 0;
+  uint32_t filterMask = 0;
+
+  if (H5Dget_chunk_storage_size(this->dataset_, start, &chunkBytes) >= 0 && chunkBytes > 0){
+    size_t dataSize = ((size_t)chunkBytes > this->frameBytes_) ? (size_t)chunkBytes : this->frameBytes_;
+    pFrame = this->pNDArrayPool_->alloc(this->frameRank_, this->frameDims_, this->dataType_, dataSize, NULL);
+  }
+  if (pFrame && H5Dread_chunk(this->dataset_, H5P_DEFAULT, start, &filterMask, pFrame->pData) >= 0){
+    if (filterMask == 0){
+      pFrame->codec = this->codec_;
+      pFrame->compressedSize = (size_t)chunkBytes;
+    } else if ((size_t)chunkBytes != this->frameBytes_){
+      pFrame->release();
+      pFrame = NULL;
+    }
+    // A chunk that the filter did not compress is stored as it is
+  } else if (pFrame){
+    pFrame->release();
+    pFrame = NULL;
+  }
+  if (pFrame){
+    this->mbytesRead_ += (double)chunkBytes / 1048576.0;
+    return pFrame;
+  }
+#endif
+  asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s ERROR cannot read the chunk of frame at %d from %s\n",
+            driverName, functionName, (int)start[0], this->fileName_.c_str());
+  return NULL;
+}
+
+/** The read-ahead thread; queues the frames of the dataset, followed by NULL */
+void NDFileHDF5Reader::readTask()
+{
+  hsize_t start[H5S_MAX_RANK];
+  size_t frame = 0;
+  hsize_t i, numFrames;
+  NDArray *pFrame;
+  int inner = this->rank_ - this->frameRank_ - 1;
+
+  while (!this->stop_ && frame < this->numFrames_){
+    this->frameStart(frame, start);
+    // A block does not go past the end of the last frame dimension, so its frames are one hyperslab
+    numFrames = 1;
+    if (!this->readChunks_ && inner >= 0){
+      numFrames = this->dims_[inner] - start[inner];
+      if (numFrames > this->blockFrames_) numFrames = this->blockFrames_;
+    }
+    if (this->readAttributeValues(frame, numFrames) != asynSuccess) break;
+    if (this->readChunks_){
+      pFrame = this->readChunk(start);
+      if (!pFrame) break;
+      this->setFrameAttributes(pFrame, frame, 0);
+      epicsMessageQueueSend(this->queue_, &pFrame, sizeof(pFrame));
+    } else {
+      NDArray *pStack = this->readBlock(start, numFrames);
+      if (!pStack) break;
+      for (i=0; i<numFrames && !this->stop_; i++){
+        pFrame = this->pNDArrayPool_->stackFrame(pStack, (size_t)i);
+        if (!pFrame) break;
+        this->setFrameAttributes(pFrame, frame + (size_t)i, i);
+        epicsMessageQueueSend(this->queue_, &pFrame, sizeof(pFrame));
+      }
+      pStack->release();
+      if (i < numFrames) break;
+    }
+    frame += (size_t)numFrames;
+  }
+  if (!this->stop_ && frame < this->numFrames_) this->failed_ = true;
+  pFrame = NULL;
+  epicsMessageQueueSend(this->queue_, &pFrame, sizeof(pFrame));
+  epicsEventSignal(this->doneEvent_);
+}
+
+/** Returns the next frame of the dataset, which the caller must release, or NULL after the last frame or on
+ * an error */
+NDArray *NDFileHDF5Reader::next()
+{
+  NDArray *pFrame = NULL;
+
+  if (this->finished_ || !this->queue_) return NULL;
+  epicsMessageQueueReceive(this->queue_, &pFrame, sizeof(pFrame));
+  if (!pFrame) this->finished_ = true;
+  return pFrame;
+}
+
+/** Stops the read-ahead thread, releases the frames it has read ahead and closes the file */
+asynStatus NDFileHDF5Reader::close()
+{
+  NDArray *pFrame;
+
+  if (this->threadId_){
+    this->stop_ = true;
+    // The thread may be waiting for space in the queue
+    while (epicsEventWaitWithTimeout(this->doneEvent_, 0.01) != epicsEventWaitOK){
+      while (epicsMessageQueueTryReceive(this->queue_, &pFrame, sizeof(pFrame)) >= 0){
+        if (pFrame) pFrame->release();
+      }
+    }
+    this->threadId_ = 0;
+  }
+  if (this->queue_){
+    while (epicsMessageQueueTryReceive(this->queue_, &pFrame, sizeof(pFrame)) >= 0){
+      if (pFrame) pFrame->release();
+    }
+    epicsMessageQueueDestroy(this->queue_);
+    this->queue_ = NULL;
+  }
+  if (this->doneEvent_){
+    epicsEventDestroy(this->doneEvent_);
+    this->doneEvent_ = NULL;
+  }
+  this->finished_ = true;
+  this->closeHandles();
+  return asynSuccess;
+}
+
+void NDFileHDF5Reader::closeHandles()
+{
+  size_t i;
+
+  for (i=0; i<this->attributes_.size(); i++){
+    H5Tclose(this->attributes_[i].memType);
+    H5Dclose(this->attributes_[i].dataset);
+  }
+  this->attributes_.clear();
+  if (this->memType_ >= 0) H5Tclose(this->memType_);
+  if (this->dataset_ >= 0) H5Dclose(this->dataset_);
+  if (this->file_ >= 0) H5Fclose(this->file_);
+  this->memType_ = -1;
+  this->dataset_ = -1;
+  this->file_ = -1;
+  this->numFrames_ = 0;
+}
+
+/** Returns the number of frames of the open dataset */
+size_t NDFileHDF5Reader::getNumFrames()
+{
+  return this->numFrames_;
+}
+
+/** Returns true if the read-ahead thread stopped on an error before the last frame */
+bool NDFileHDF5Reader::failed()
+{
+  return this->failed_;
+}
+
+/** Returns the MB that the read-ahead thread has read from the file */
+double NDFileHDF5Reader::getMBytesRead()
+{
+  return this->mbytesRead_;
+}
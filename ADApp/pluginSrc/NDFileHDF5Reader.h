@@ -0,0 +1,100 @@
+#ifndef NDFILEHDF5READER_H_
+#define NDFILEHDF5READER_H_
+
+#include <string>
+#include <vector>
+#include <hdf5.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+#include <epicsThread.h>
+#include "NDPluginFile.h"
+#include "NDFileHDF5VersionCheck.h"
+
+/** Class used for reading the frames of a detector dataset with the NDFileHDF5 plugin, to process them again
+  * with the plugins.
+  * A read-ahead thread reads the frames in blocks of whole chunks, each with one H5Dread into a frame stack
+  * from the NDArrayPool, so every chunk is read and decompressed once, and queues views of its frames with the
+  * NDAttributes restored from the attribute datasets.  The frames of the NDArrayUniqueId, NDArrayTimeStamp,
+  * NDArrayEpicsTSSec and NDArrayEpicsTSnSec datasets get their uniqueId and time stamps back.
+  * The members of the packed NDAttributes dataset are read as the datasets of their NDAttributes.
+  * Chunks of one frame compressed with the blosc or bitshuffle/LZ4 filter can also be read as they are stored,
+  * with H5Dread_chunk, into compressed NDArrays.
+  */
+class NDFileHDF5Reader
+{
+  public:
+    NDFileHDF5Reader(asynUser *pAsynUser, NDArrayPool *pNDArrayPool);
+    ~NDFileHDF5Reader();
+
+    asynStatus open(const char *fileName, const std::string& datasetName, bool readChunks, int readAhead);
+    NDArray *next();
+    asynStatus close();
+    size_t getNumFrames();
+    bool failed();
+    double getMBytesRead();
+    void readTask();
+
+#ifndef _UNITTEST_HDF5_
+  private:
+#endif
+
+    /** The values of one attribute dataset */
+    typedef struct {
+      std::string name;
+      std::string description;
+      std::string source;
+      NDAttrSource_t sourceType;
+      NDAttrDataType_t dataType;
+      hid_t dataset;
+      hid_t memType;
+      size_t valueSize;
+      bool perFrame;        // One value for each frame, otherwise one value for all of the frames
+      bool loaded;          // All of the values were read when the file was opened, otherwise those of each block
+      std::vector<char> values;
+    } attributeDataset_t;
+
+    asynStatus openAttributeDatasets();
+    static herr_t visitLink(hid_t group, const char *name, const H5L_info_t *info, void *pArg);
+    void addAttributeDataset(hid_t dataset);
+    void addPackedAttributeDataset(hid_t dataset);
+    bool configureReadChunks(hid_t plist);
+    asynStatus readAttributeValues(size_t frame, hsize_t numFrames);
+    void setFrameAttributes(NDArray *pFrame, size_t frame, hsize_t blockFrame);
+    NDArray *readBlock(hsize_t *start, hsize_t numFrames);
+    NDArray *readChunk(hsize_t *start);
+    void frameStart(size_t frame, hsize_t *start);
+    void closeHandles();
+
+    asynUser    *pAsynUser_;
+    NDArrayPool *pNDArrayPool_;
+    std::string fileName_;
+    hid_t       file_;
+    hid_t       dataset_;
+    hid_t       memType_;        // Native type of the elements of the dataset
+    NDDataType_t dataType_;
+    int         rank_;           // Rank of the dataset
+    int         frameRank_;      // Rank of one frame, NDArrayNumDims of the dataset
+    std::vector<hsize_t> dims_;  // Dimensions of the dataset
+    std::vector<hsize_t> chunk_; // Chunk dimensions of the dataset, 1 for the dimensions of a contiguous dataset
+    size_t      frameDims_[ND_ARRAY_MAX_DIMS];
+    size_t      frameBytes_;
+    size_t      numFrames_;
+    hsize_t     blockFrames_;    // Frames read with one H5Dread, a multiple of the frames of a chunk
+    bool        readChunks_;     // The chunks are read compressed with H5Dread_chunk
+    NDCodec_t   codec_;          // The codec of the chunks that are read compressed
+    std::vector<attributeDataset_t> attributes_;
+    int         uniqueIdIndex_;  // Index in attributes_ of NDArrayUniqueId etc., -1 if there is none
+    int         timeStampIndex_;
+    int         epicsTSSecIndex_;
+    int         epicsTSnSecIndex_;
+
+    epicsMessageQueueId queue_;  // Frames read ahead; NULL after the last frame or an error
+    epicsEventId doneEvent_;     // Signalled when the read-ahead thread exits
+    epicsThreadId threadId_;
+    volatile bool stop_;         // Set to stop the read-ahead thread
+    bool        finished_;       // next() has received the end of the frames
+    volatile bool failed_;       // The read-ahead thread stopped on an error
+    double      mbytesRead_;     // MB read by the read-ahead thread
+};
+
+#endif /* NDFILEHDF5READER_H_ */
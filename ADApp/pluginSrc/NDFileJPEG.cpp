@@ -8,6 +8,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef _WIN32
+  #include <io.h>
+  #define fdopen _fdopen
+#else
+  #include <unistd.h>
+#endif
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
@@ -37,6 +43,7 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
     int colorMode = NDColorModeMono;
     NDAttribute *pAttribute;
     int quality;
+    int fd;
 
     /* We don't support reading yet */
     if (openMode & NDFileModeRead) return(asynError);
@@ -91,35 +98,185 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
         return(asynError);
     }
 
-   /* Create the file. */
-    if ((this->outFile = fopen(fileName, "wb")) == NULL ) {
+   /* Create the file. NDPluginFile opens it, and may have created it in advance. */
+    fd = this->openFileHandle(fileName);
+    if ((fd < 0) || ((this->outFile = fdopen(fd, "wb")) == NULL)) {
+        if (fd >= 0) close(fd);
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
         "%s:%s error opening file %s\n",
         driverName, functionName, fileName);
         return(asynError);
     }
     
-    jpeg_set_defaults(&this->jpegInfo);
-
     /* Set the file quality */
     /* Must lock when accessing parameter library */
     this->lock();
     getIntegerParam(NDFileJPEGQuality, &quality);
     this->unlock();
+
+#ifdef ND_WITH_TURBOJPEG
+    /* The image is compressed in one call in writeFile() */
+    if (this->tjHandle) {
+        this->quality = quality;
+        return(asynSuccess);
+    }
+#endif
+    jpeg_set_defaults(&this->jpegInfo);
     jpeg_set_quality(&this->jpegInfo, quality, TRUE);
     
     jpeg_start_compress(&this->jpegInfo, TRUE);
     return(asynSuccess);
 }
 
+#ifdef ND_WITH_TURBOJPEG
+/* The arguments of yuvStripe() */
+typedef struct {
+    const unsigned char *pRed;
+    const unsigned char *pGreen;
+    const unsigned char *pBlue;
+    size_t rowStride;           /* Distance between the rows of each colour */
+    size_t sizeX;
+    size_t sizeY;
+    unsigned char *pY;
+    unsigned char *pCb;
+    unsigned char *pCr;
+} yuvArgs_t;
+
+/* Converts pairs of RGB rows to the Y, Cb and Cr planes of a 4:2:0 image with the JFIF coefficients,
+ * in 16-bit fixed point. Each Cb and Cr sample is the average of 2x2 pixels; the last row and column
+ * are repeated when the image has an odd size. Called by parallelForRows() with a row pair per "row". */
+static void yuvStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    yuvArgs_t *pArgs = (yuvArgs_t *)pArg;
+    size_t sizeX = pArgs->sizeX;
+    size_t chromaX = (sizeX + 1) / 2;
+    size_t pair, i, x0, x1, y, yy[2];
+    int k;
+
+    for (pair=firstRow; pair<firstRow+numRows; pair++) {
+        yy[0] = 2*pair;
+        yy[1] = (yy[0] + 1 < pArgs->sizeY) ? yy[0] + 1 : yy[0];
+        for (k=0; k<2; k++) {
+            y = yy[k];
+            const unsigned char *pR = pArgs->pRed   + y * pArgs->rowStride;
+            const unsigned char *pG = pArgs->pGreen + y * pArgs->rowStride;
+            const unsigned char *pB = pArgs->pBlue  + y * pArgs->rowStride;
+            unsigned char *pY = pArgs->pY + y * sizeX;
+            for (i=0; i<sizeX; i++) {
+                pY[i] = (unsigned char)((19595*pR[i] + 38470*pG[i] + 7471*pB[i] + 32768) >> 16);
+            }
+        }
+        const unsigned char *pR0 = pArgs->pRed   + yy[0] * pArgs->rowStride;
+        const unsigned char *pG0 = pArgs->pGreen + yy[0] * pArgs->rowStride;
+        const unsigned char *pB0 = pArgs->pBlue  + yy[0] * pArgs->rowStride;
+        const unsigned char *pR1 = pArgs->pRed   + yy[1] * pArgs->rowStride;
+        const unsigned char *pG1 = pArgs->pGreen + yy[1] * pArgs->rowStride;
+        const unsigned char *pB1 = pArgs->pBlue  + yy[1] * pArgs->rowStride;
+        unsigned char *pCb = pArgs->pCb + pair * chromaX;
+        unsigned char *pCr = pArgs->pCr + pair * chromaX;
+        for (i=0; i<chromaX; i++) {
+            x0 = 2*i;
+            x1 = (x0 + 1 < sizeX) ? x0 + 1 : x0;
+            int r = pR0[x0] + pR0[x1] + pR1[x0] + pR1[x1];
+            int g = pG0[x0] + pG0[x1] + pG1[x0] + pG1[x1];
+            int b = pB0[x0] + pB0[x1] + pB1[x0] + pB1[x1];
+            int cb = (-11059*r - 21709*g + 32768*b + (128 << 18) + (1 << 17)) >> 18;
+            int cr = ( 32768*r - 27439*g -  5329*b + (128 << 18) + (1 << 17)) >> 18;
+            pCb[i] = (unsigned char)((cb > 255) ? 255 : cb);
+            pCr[i] = (unsigned char)((cr > 255) ? 255 : cr);
+        }
+    }
+}
+
+/** Compresses an NDArray with the TurboJPEG API and writes it to the file.
+  * Mono and RGB1 arrays are compressed directly; RGB2 and RGB3 arrays are first converted to planar YCbCr.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileJPEG::writeTurboJPEG(NDArray *pArray)
+{
+    int sizeX = (int)this->jpegInfo.image_width;
+    int sizeY = (int)this->jpegInfo.image_height;
+    int subsamp = (this->colorMode == NDColorModeMono) ? TJSAMP_GRAY : TJSAMP_420;
+    unsigned long bufSize = tjBufSize(sizeX, sizeY, subsamp);
+    unsigned long jpegSize;
+    int status;
+    static const char *functionName = "writeTurboJPEG";
+
+    /* The output buffer is kept between images and only grows */
+    if (bufSize > this->tjBufferSize) {
+        if (this->tjBuffer) tjFree(this->tjBuffer);
+        this->tjBuffer = tjAlloc((int)bufSize);
+        this->tjBufferSize = this->tjBuffer ? bufSize : 0;
+        if (!this->tjBuffer) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error allocating %lu byte buffer\n",
+                driverName, functionName, bufSize);
+            return(asynError);
+        }
+    }
+    jpegSize = this->tjBufferSize;
+
+    if ((this->colorMode == NDColorModeMono) || (this->colorMode == NDColorModeRGB1)) {
+        status = tjCompress2(this->tjHandle, (unsigned char *)pArray->pData, sizeX, 0, sizeY,
+                             (this->colorMode == NDColorModeMono) ? TJPF_GRAY : TJPF_RGB,
+                             &this->tjBuffer, &jpegSize, subsamp, this->quality, TJFLAG_NOREALLOC);
+    } else {
+        yuvArgs_t yuvArgs;
+        size_t planeSize = (size_t)sizeX * sizeY;
+        size_t chromaX = ((size_t)sizeX + 1) / 2;
+        size_t chromaY = ((size_t)sizeY + 1) / 2;
+        const unsigned char *planes[3];
+        int strides[3];
+
+        this->yuvBuffer.resize(planeSize + 2 * chromaX * chromaY);
+        yuvArgs.pRed = (const unsigned char *)pArray->pData;
+        if (this->colorMode == NDColorModeRGB2) {
+            yuvArgs.pGreen = yuvArgs.pRed + sizeX;
+            yuvArgs.pBlue = yuvArgs.pGreen + sizeX;
+            yuvArgs.rowStride = (size_t)sizeX * 3;
+        } else {
+            yuvArgs.pGreen = yuvArgs.pRed + planeSize;
+            yuvArgs.pBlue = yuvArgs.pGreen + planeSize;
+            yuvArgs.rowStride = sizeX;
+        }
+        yuvArgs.sizeX = sizeX;
+        yuvArgs.sizeY = sizeY;
+        yuvArgs.pY = &this->yuvBuffer[0];
+        yuvArgs.pCb = yuvArgs.pY + planeSize;
+        yuvArgs.pCr = yuvArgs.pCb + chromaX * chromaY;
+        this->parallelForRows(yuvStripe, &yuvArgs, chromaY, this->numStripes(chromaY));
+
+        planes[0] = yuvArgs.pY;
+        planes[1] = yuvArgs.pCb;
+        planes[2] = yuvArgs.pCr;
+        strides[0] = sizeX;
+        strides[1] = strides[2] = (int)chromaX;
+        status = tjCompressFromYUVPlanes(this->tjHandle, planes, sizeX, strides, sizeY, subsamp,
+                                         &this->tjBuffer, &jpegSize, this->quality, TJFLAG_NOREALLOC);
+    }
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error compressing image: %s\n",
+            driverName, functionName, tjGetErrorStr());
+        return(asynError);
+    }
+    if ((fwrite(this->tjBuffer, 1, jpegSize, this->outFile) != jpegSize) || fflush(this->outFile)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing JPEG file\n",
+            driverName, functionName);
+        return(asynError);
+    }
+    return(asynSuccess);
+}
+#endif
+
 /** Writes single NDArray to the JPEG file.
   * \param[in] pArray Pointer to the NDArray to be written
   */
 asynStatus NDFileJPEG::writeFile(NDArray *pArray)
 {
-    JSAMPROW row_pointer[1];
     int nwrite=0;
-    unsigned char *pRed=NULL, *pGreen=NULL, *pBlue=NULL, *pData=NULL, *pOut, *buffer=NULL;
+    unsigned char *pRed=NULL, *pGreen=NULL, *pBlue=NULL, *pData=NULL, *pOut;
     int sizeX = (int)this->jpegInfo.image_width;
     int sizeY = (int)this->jpegInfo.image_height;
     int stepSize=0, i;
@@ -129,20 +286,29 @@ asynStatus NDFileJPEG::writeFile(NDArray *pArray)
               "%s:%s: %lu, %lu\n", 
               driverName, functionName, (unsigned long)pArray->dims[0].size, (unsigned long)pArray->dims[1].size);
 
+#ifdef ND_WITH_TURBOJPEG
+    if (this->tjHandle) return this->writeTurboJPEG(pArray);
+#endif
+
     switch (this->colorMode) {
         case NDColorModeMono:
         case NDColorModeRGB1:
+            /* The rows are already interleaved, so they are all passed to the library at once */
             pData = (unsigned char *)pArray->pData;
+            this->rowPointers.resize(sizeY);
+            for (i=0; i<sizeY; i++) {
+                this->rowPointers[i] = pData + (size_t)i * sizeX * this->jpegInfo.input_components;
+            }
             break;
         case NDColorModeRGB2:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
+            this->rowBuffer.resize((size_t)sizeX * 3);
             stepSize = sizeX * 3;
             pRed = (unsigned char *)pArray->pData;
             pGreen = pRed + sizeX;
             pBlue = pGreen + sizeX;
             break;
         case NDColorModeRGB3:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
+            this->rowBuffer.resize((size_t)sizeX * 3);
             stepSize = sizeX;
             pRed = (unsigned char *)pArray->pData;
             pGreen = pRed + sizeX * sizeY;
@@ -159,14 +325,14 @@ asynStatus NDFileJPEG::writeFile(NDArray *pArray)
         switch (this->colorMode) {
             case NDColorModeMono:
             case NDColorModeRGB1:
-                row_pointer[0] = pData;
-                nwrite = jpeg_write_scanlines(&this->jpegInfo, row_pointer, 1);
-                pData += sizeX * this->jpegInfo.input_components;
+                nwrite = jpeg_write_scanlines(&this->jpegInfo, &this->rowPointers[this->jpegInfo.next_scanline],
+                                              sizeY - this->jpegInfo.next_scanline);
                 break;
             case NDColorModeRGB2:
-            case NDColorModeRGB3:
-                row_pointer[0] = buffer;
-                pOut = buffer;
+            case NDColorModeRGB3: {
+                JSAMPROW row_pointer[1];
+                row_pointer[0] = &this->rowBuffer[0];
+                pOut = row_pointer[0];
                 for (i=0; i<sizeX; i++) {
                     *pOut++ = pRed[i];
                     *pOut++ = pGreen[i];
@@ -177,6 +343,7 @@ asynStatus NDFileJPEG::writeFile(NDArray *pArray)
                 pBlue += stepSize;
                 pGreen += stepSize;
                 break;
+            }
             default:
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s:%s: unknown color mode %d\n",
@@ -184,14 +351,13 @@ asynStatus NDFileJPEG::writeFile(NDArray *pArray)
                 return(asynError);
                 break;
         }
-        if (nwrite != 1) {
+        if (nwrite < 1) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s:%s: error writing data to file\n",
                 driverName, functionName);
             return(asynError);
         }
     }
-    if (buffer) free(buffer);
 
     return(asynSuccess);
 }
@@ -212,6 +378,9 @@ asynStatus NDFileJPEG::closeFile()
 {
     //static const char *functionName = "closeFile";
 
+#ifdef ND_WITH_TURBOJPEG
+    if (!this->tjHandle)
+#endif
     jpeg_finish_compress(&this->jpegInfo);
     fclose(this->outFile);
 
@@ -329,6 +498,20 @@ NDFileJPEG::NDFileJPEG(const char *portName, int queueSize, int blockingCallback
     this->destMgr.pNDFileJPEG = this;
     this->jpegInfo.dest = (jpeg_destination_mgr *) &this->destMgr;
 
+#ifdef ND_WITH_TURBOJPEG
+    /* If TurboJPEG cannot be initialized the libjpeg API is used instead */
+    static const char *functionName = "NDFileJPEG";
+    this->tjBuffer = NULL;
+    this->tjBufferSize = 0;
+    this->quality = 50;
+    this->tjHandle = tjInitCompress();
+    if (!this->tjHandle) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error initializing TurboJPEG, using libjpeg: %s\n",
+            driverName, functionName, tjGetErrorStr());
+    }
+#endif
+
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileJPEG");
     this->supportsMultipleArrays = 0;
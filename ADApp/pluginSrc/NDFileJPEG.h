@@ -8,8 +8,13 @@
 #ifndef DRV_NDFileJPEG_H
 #define DRV_NDFileJPEG_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 #include "jpeglib.h"
+#ifdef ND_WITH_TURBOJPEG
+#include <turbojpeg.h>
+#endif
 
 #define JPEG_BUF_SIZE 4096 /* choose an efficiently fwrite'able size */
 
@@ -23,6 +28,9 @@ typedef struct {
 
 /** Writes NDArrays in the JPEG file format, which is a lossy compression format.
   * This plugin was developed using the libjpeg library to write the file.
+  * When it is built with the TurboJPEG API of libjpeg-turbo (WITH_TURBOJPEG) it compresses each image with
+  * one call into a buffer that is kept between images, and converts RGB2 and RGB3 images to planar YCbCr
+  * in the IntraFrameThreads threads rather than interleaving the pixels.
   */
 class epicsShareClass NDFileJPEG : public NDPluginFile {
 public:
@@ -51,6 +59,16 @@ private:
     FILE *outFile;
     JOCTET jpegBuffer[JPEG_BUF_SIZE];
     jpegDestMgr destMgr;
+    std::vector<unsigned char> rowBuffer;   /* One interleaved row of an RGB2 or RGB3 image */
+    std::vector<JSAMPROW> rowPointers;      /* The rows of a Mono or RGB1 image */
+#ifdef ND_WITH_TURBOJPEG
+    asynStatus writeTurboJPEG(NDArray *pArray);
+    tjhandle tjHandle;
+    unsigned char *tjBuffer;                /* The compressed image, allocated with tjAlloc */
+    unsigned long tjBufferSize;
+    std::vector<unsigned char> yuvBuffer;   /* The Y, Cb and Cr planes of an RGB2 or RGB3 image */
+    int quality;
+#endif
 };
 
 #endif
@@ -24,6 +24,8 @@
 #include "NDFileNetCDF.h"
 
 #define MAX_ATTRIBUTE_STRING_SIZE 256
+/** Records in a chunk of the variables of the uniqueId, time stamps and attributes in netCDF-4 files */
+#define NETCDF_RECORD_CHUNK 1024
 
 static const char *driverName = "NDFileNetCDF";
 
@@ -64,6 +66,12 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     size_t attrSize;
     int numAttributes, attrCount;
     double fileVersion;
+    int format, compressLevel, shuffle, framesPerWrite;
+    int createMode, oldFill;
+    NDArrayInfo_t arrayInfo;
+#ifdef ND_WITH_NETCDF4
+    size_t chunks[ND_ARRAY_MAX_DIMS+1];
+#endif
     static const char *functionName = "openFile";
 
     /* We don't support reading yet */    
@@ -84,10 +92,31 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     
     /* Set the next record in the file to 0 */
     this->nextRecord = 0;
+    this->bufferedFrames = 0;
+
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileNetCDFFormat, &format);
+    getIntegerParam(NDFileNetCDFCompressLevel, &compressLevel);
+    getIntegerParam(NDFileNetCDFShuffle, &shuffle);
+    getIntegerParam(NDFileNetCDFFramesPerWrite, &framesPerWrite);
+    this->unlock();
+    /* A file with a single array has nothing to buffer */
+    if (!(openMode & NDFileModeMultiple) || (framesPerWrite < 1)) framesPerWrite = 1;
 
     /* Create the file. The NC_CLOBBER parameter tells netCDF to
      * overwrite this file, if it already exists.*/
-    if ((retval = nc_create(fileName, NC_CLOBBER, &this->ncId)))
+    createMode = NC_CLOBBER;
+    if (format == NDFileNetCDFFormat64BitOffset) createMode |= NC_64BIT_OFFSET;
+#ifdef ND_WITH_NETCDF4
+    /* The classic model keeps the same data types and structure as the other formats */
+    if (format == NDFileNetCDFFormatNetCDF4) createMode |= NC_NETCDF4 | NC_CLASSIC_MODEL;
+#endif
+    if ((retval = nc_create(fileName, createMode, &this->ncId)))
+        ERR(retval);
+
+    /* Every value of every variable is written, so netCDF need not write fill values first */
+    if ((retval = nc_set_fill(this->ncId, NC_NOFILL, &oldFill)))
         ERR(retval);
 
     /* Create global attribute for the data type because netCDF does not
@@ -205,11 +234,32 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
                  dimIds, &this->arrayDataId)))
         ERR(retval);
 
+#ifdef ND_WITH_NETCDF4
+    if (format == NDFileNetCDFFormatNetCDF4) {
+        /* Each array is one chunk, so a write of whole arrays never reads a chunk back, and each array is
+         * compressed on its own */
+        chunks[0] = 1;
+        for (i=0; i<pArray->ndims; i++) {
+            chunks[i+1] = pArray->dims[pArray->ndims - i - 1].size;
+        }
+        if ((retval = nc_def_var_chunking(this->ncId, this->arrayDataId, NC_CHUNKED, chunks)))
+            ERR(retval);
+        if ((compressLevel > 0) || shuffle) {
+            if ((retval = nc_def_var_deflate(this->ncId, this->arrayDataId, shuffle ? 1 : 0,
+                                             (compressLevel > 0) ? 1 : 0, compressLevel)))
+                ERR(retval);
+        }
+    }
+#endif
+
     /* Create a variable for each attribute in the array */
     free(this->pAttributeId);
     numAttributes = this->pFileAttributes->count();
     attrCount = 0;
     this->pAttributeId = (int *)calloc(numAttributes, sizeof(int));
+    this->attrDataTypes.resize(numAttributes);
+    this->attrSizes.resize(numAttributes);
+    this->attrValues.resize(numAttributes);
     pAttribute = this->pFileAttributes->next(NULL);
     while (pAttribute) {
         const char *attributeName = pAttribute->getName();
@@ -278,26 +328,33 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
             case NDAttrInt8:
             case NDAttrUInt8:
                 ncType = NC_BYTE;
+                attrSize = 1;
                 break;
             case NDAttrInt16:
             case NDAttrUInt16:
                 ncType = NC_SHORT;
+                attrSize = 2;
                 break;
             case NDAttrInt32:
             case NDAttrUInt32:
                 ncType = NC_INT;
+                attrSize = 4;
                 break;
             case NDAttrFloat32:
                 ncType = NC_FLOAT;
+                attrSize = 4;
                 break;
             case NDAttrFloat64:
                 ncType = NC_DOUBLE;
+                attrSize = 8;
                 break;
             case NDAttrString:
                 ncType = NC_CHAR;
+                attrSize = MAX_ATTRIBUTE_STRING_SIZE;
                 break;
             case NDAttrUndefined:
                 ncType = NC_BYTE;
+                attrSize = 1;
                 break;
             default:
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -306,6 +363,10 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
                 return asynError;
                 break;
         }
+        /* The values of the attribute for the arrays that have not been written yet */
+        this->attrDataTypes[attrCount] = attrDataType;
+        this->attrSizes[attrCount] = attrSize;
+        this->attrValues[attrCount].resize(framesPerWrite * attrSize);
         epicsSnprintf(tempString, sizeof(tempString), "Attr_%s", pAttribute->getName());
         if (attrDataType == NDAttrString) {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 2,
@@ -318,156 +379,203 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
         }
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
+    this->numFileAttributes = attrCount;
+
+#ifdef ND_WITH_NETCDF4
+    /* The default chunks of the variables along an unlimited dimension are very small.  The string attributes
+     * have a second dimension, which is the second element of chunks. */
+    if ((format == NDFileNetCDFFormatNetCDF4) && (openMode & NDFileModeMultiple)) {
+        int recordVars[4] = {this->uniqueIdId, this->timeStampId, this->epicsTSSecId, this->epicsTSNsecId};
+        chunks[0] = NETCDF_RECORD_CHUNK;
+        chunks[1] = MAX_ATTRIBUTE_STRING_SIZE;
+        for (i=0; i<4+attrCount; i++) {
+            if ((retval = nc_def_var_chunking(this->ncId, (i < 4) ? recordVars[i] : this->pAttributeId[i-4],
+                                              NC_CHUNKED, chunks)))
+                ERR(retval);
+        }
+    }
+#endif
 
     /* End define mode. This tells netCDF we are done defining
      * metadata. */
     if ((retval = nc_enddef(this->ncId)))
         ERR(retval);
+
+    /* The arrays are buffered until framesPerWrite of them can be written */
+    pArray->getInfo(&arrayInfo);
+    this->framesPerWrite = framesPerWrite;
+    this->dataType = pArray->dataType;
+    this->frameBytes = arrayInfo.totalBytes;
+    this->frameDims = pArray->ndims + 1;
+    for (i=0; i<pArray->ndims; i++) {
+        this->frameCount[i+1] = pArray->dims[pArray->ndims - i - 1].size;
+    }
+    this->dataBuffer.resize((framesPerWrite > 1) ? framesPerWrite * this->frameBytes : 0);
+    this->uniqueIds.resize(framesPerWrite);
+    this->timeStamps.resize(framesPerWrite);
+    this->epicsTSSecs.resize(framesPerWrite);
+    this->epicsTSNsecs.resize(framesPerWrite);
     return(asynSuccess);
 }
 
 
-/** Writes NDArray data to a netCDF file.
-  * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
-  *           times between the call to openFile and closeFile if
-  *           NDFileModeMultiple was set in openMode in the call to NDFileNetCDF::openFile. */ 
-asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
-{       
+/** Writes data with the nc_put_vara function for its type.
+  * \param[in] varId The variable.
+  * \param[in] dataType The NDDataType_t of the data, or the NDAttrDataType_t of a numeric attribute.
+  * \param[in] start The first element to write in each dimension.
+  * \param[in] count The number of elements to write in each dimension.
+  * \param[in] pData The data. */
+asynStatus NDFileNetCDF::putVara(int varId, int dataType, const size_t *start, const size_t *count, const void *pData)
+{
     int retval;
-    size_t stringCount[2];
-    size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
-    int attrId;
-    NDAttrValue attrVal;
-    int i, j;
-    NDAttribute *pAttribute;
-    NDAttrDataType_t attrDataType;
-    size_t attrSize;
-    int attrCount;
-    char attrString[MAX_ATTRIBUTE_STRING_SIZE];
-    static const char *functionName = "writeFile";
+    static const char *functionName = "putVara";
 
-    
-    /* Update attribute list. We use a separate attribute list
-     * from the one in pArray to avoid the need to copy the array. */
-    /* Get the current values of the attributes for this plugin */
-    this->getAttributes(this->pFileAttributes);
-    /* Now append the attributes from the array which are already up to date from
-     * the driver and prior plugins */
-    pArray->pAttributeList->copy(this->pFileAttributes);
-
-    count[0] = 1;
-    start[0] = this->nextRecord;
-    for (i=0; i<pArray->ndims; i++) {
-        j = pArray->ndims - i - 1;
-        count[i+1] = pArray->dims[j].size;
-        start[i+1] = 0;
-    }
- 
-    /* Write the data to the file. */
-    if ((retval = nc_put_vara_int(this->ncId, this->uniqueIdId, start, count, &pArray->uniqueId)))
-                ERR(retval);
-    if ((retval = nc_put_vara_double(this->ncId, this->timeStampId, start, count, &pArray->timeStamp)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSSecId, start, count, (int *)&pArray->epicsTS.secPastEpoch)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSNsecId, start, count, (int *)&pArray->epicsTS.nsec)))
-                ERR(retval);
-
-    switch (pArray->dataType) {
+    switch (dataType) {
         case NDInt8:
-            if ((retval = nc_put_vara_schar(this->ncId, this->arrayDataId, start, count, (signed char*)pArray->pData)))
+            if ((retval = nc_put_vara_schar(this->ncId, varId, start, count, (const signed char*)pData)))
                 ERR(retval);
             break;
         case NDUInt8:
-            if ((retval = nc_put_vara_uchar(this->ncId, this->arrayDataId, start, count, (unsigned char*)pArray->pData)))
+            if ((retval = nc_put_vara_uchar(this->ncId, varId, start, count, (const unsigned char*)pData)))
                 ERR(retval);
             break;
         case NDInt16:
         case NDUInt16:
-            if ((retval = nc_put_vara_short(this->ncId, this->arrayDataId, start, count, (short *)pArray->pData)))
+            if ((retval = nc_put_vara_short(this->ncId, varId, start, count, (const short *)pData)))
                 ERR(retval);
             break;
         case NDInt32:
         case NDUInt32:
-            if ((retval = nc_put_vara_int(this->ncId, this->arrayDataId, start, count, (int *)pArray->pData)))
+            if ((retval = nc_put_vara_int(this->ncId, varId, start, count, (const int *)pData)))
                 ERR(retval);
             break;
         case NDFloat32:
-            if ((retval = nc_put_vara_float(this->ncId, this->arrayDataId, start, count, (float *)pArray->pData)))
+            if ((retval = nc_put_vara_float(this->ncId, varId, start, count, (const float *)pData)))
                 ERR(retval);
             break;
         case NDFloat64:
-            if ((retval = nc_put_vara_double(this->ncId, this->arrayDataId, start, count, (double *)pArray->pData)))
+            if ((retval = nc_put_vara_double(this->ncId, varId, start, count, (const double *)pData)))
                 ERR(retval);
             break;
         default:
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s error, unknown array data type =%d\n",
-                driverName, functionName, pArray->dataType);
+                "%s:%s error, unknown data type =%d\n",
+                driverName, functionName, dataType);
             return asynError;
             break;
     }
-    /* Write the attributes.  Loop through the list of attributes.  These must not have changed since define time! */
-    pAttribute = this->pFileAttributes->next(NULL);
-    attrCount = 0;
-    while (pAttribute) {
-        pAttribute->getValueInfo(&attrDataType, &attrSize);
-        attrId = this->pAttributeId[attrCount++];
-        switch (attrDataType) {
-            case NDAttrInt8:
-            case NDAttrUInt8:
-                pAttribute->getValue(attrDataType, &attrVal.i8);
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
-                break;
-            case NDAttrInt16:
-            case NDAttrUInt16:
-                pAttribute->getValue(attrDataType, &attrVal.i16);
-                if ((retval = nc_put_vara_short(this->ncId, attrId, start, count, (short *)&attrVal.i16)))
-                    ERR(retval);
-                break;
-            case NDAttrInt32:
-            case NDAttrUInt32:
-                pAttribute->getValue(attrDataType, &attrVal.i32);
-                if ((retval = nc_put_vara_int(this->ncId, attrId, start, count, (int *)&attrVal.i32)))
-                    ERR(retval);
-                break;
-            case NDAttrFloat32:
-                pAttribute->getValue(attrDataType, &attrVal.f32);
-                if ((retval = nc_put_vara_float(this->ncId, attrId, start, count, (float *)&attrVal.f32)))
-                    ERR(retval);
-                break;
-            case NDAttrFloat64:
-                pAttribute->getValue(attrDataType, &attrVal.f64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.f64)))
-                    ERR(retval);
-                break;
+    return asynSuccess;
+}
+
+/** Writes the arrays that writeFile() has buffered, with one call for each variable.
+  * \param[in] pData The data of the arrays, contiguous in the order they were received. */
+asynStatus NDFileNetCDF::flushFrames(const void *pData)
+{
+    int retval;
+    size_t start[ND_ARRAY_MAX_DIMS+1], stringCount[2];
+    int numFrames = this->bufferedFrames;
+    int i;
+    static const char *functionName = "flushFrames";
+
+    if (numFrames == 0) return asynSuccess;
+    /* The arrays are not written again if this fails */
+    this->bufferedFrames = 0;
+    for (i=0; i<this->frameDims; i++) start[i] = 0;
+    start[0] = this->nextRecord;
+    this->frameCount[0] = numFrames;
+
+    if ((retval = nc_put_vara_int(this->ncId, this->uniqueIdId, start, this->frameCount, &this->uniqueIds[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara_double(this->ncId, this->timeStampId, start, this->frameCount, &this->timeStamps[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSSecId, start, this->frameCount, &this->epicsTSSecs[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSNsecId, start, this->frameCount, &this->epicsTSNsecs[0])))
+                ERR(retval);
+    if (this->putVara(this->arrayDataId, this->dataType, start, this->frameCount, pData))
+        return asynError;
+
+    for (i=0; i<this->numFileAttributes; i++) {
+        switch (this->attrDataTypes[i]) {
             case NDAttrString:
-                pAttribute->getValue(attrDataType, attrString, sizeof(attrString));
-                stringCount[0] = 1;
-                stringCount[1] = strlen(attrString);
-                if ((retval = nc_put_vara_text(this->ncId, attrId, start, stringCount, attrString)))
+                stringCount[0] = numFrames;
+                stringCount[1] = MAX_ATTRIBUTE_STRING_SIZE;
+                if ((retval = nc_put_vara_text(this->ncId, this->pAttributeId[i], start, stringCount,
+                                               &this->attrValues[i][0])))
                     ERR(retval);
                 break;
             case NDAttrUndefined:
                 /* netCDF does not have a way of storing NaN, etc. We just use 0 byte */
-                attrVal.i8 = 0;
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
+                if (this->putVara(this->pAttributeId[i], NDAttrInt8, start, this->frameCount, &this->attrValues[i][0]))
+                    return asynError;
                 break;
             default:
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s error, unknown attrDataType=%d\n",
-                    driverName, functionName, attrDataType);
-                return asynError;
+                if (this->putVara(this->pAttributeId[i], this->attrDataTypes[i], start, this->frameCount,
+                                  &this->attrValues[i][0]))
+                    return asynError;
                 break;
         }
-        pAttribute = this->pFileAttributes->next(pAttribute);
     }
-    this->nextRecord++;
+    this->nextRecord += numFrames;
     return(asynSuccess);
 }
 
+/** Writes NDArray data to a netCDF file.
+  * The array and its attributes are buffered, and written by flushFrames() when NetCDFFramesPerWrite arrays have
+  * been buffered, or when the file is closed.  With 1 array per write it is written at once, without a copy.
+  * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
+  *           times between the call to openFile and closeFile if
+  *           NDFileModeMultiple was set in openMode in the call to NDFileNetCDF::openFile. */ 
+asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
+{       
+    NDArrayInfo_t arrayInfo;
+    NDAttribute *pAttribute;
+    int attrCount;
+    int frame = this->bufferedFrames;
+    char *pValue;
+    static const char *functionName = "writeFile";
+
+    pArray->getInfo(&arrayInfo);
+    if ((pArray->dataType != this->dataType) || (arrayInfo.totalBytes != this->frameBytes)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, the array data type or size is not the same as that of the file\n",
+            driverName, functionName);
+        return asynError;
+    }
+
+    /* Update attribute list. We use a separate attribute list
+     * from the one in pArray to avoid the need to copy the array. */
+    /* Get the current values of the attributes for this plugin */
+    this->getAttributes(this->pFileAttributes);
+    /* Now append the attributes from the array which are already up to date from
+     * the driver and prior plugins */
+    pArray->pAttributeList->copy(this->pFileAttributes);
+
+    this->uniqueIds[frame]    = pArray->uniqueId;
+    this->timeStamps[frame]   = pArray->timeStamp;
+    this->epicsTSSecs[frame]  = (int)pArray->epicsTS.secPastEpoch;
+    this->epicsTSNsecs[frame] = (int)pArray->epicsTS.nsec;
+
+    /* Buffer the attributes.  Loop through the list of attributes.  These must not have changed since define time!
+     * Each is converted to the data type it had then. */
+    pAttribute = this->pFileAttributes->next(NULL);
+    attrCount = 0;
+    while (pAttribute && (attrCount < this->numFileAttributes)) {
+        pValue = &this->attrValues[attrCount][frame * this->attrSizes[attrCount]];
+        memset(pValue, 0, this->attrSizes[attrCount]);
+        if (this->attrDataTypes[attrCount] != NDAttrUndefined)
+            pAttribute->getValue(this->attrDataTypes[attrCount], pValue, this->attrSizes[attrCount]);
+        attrCount++;
+        pAttribute = this->pFileAttributes->next(pAttribute);
+    }
+
+    if (this->framesPerWrite > 1)
+        memcpy(&this->dataBuffer[frame * this->frameBytes], pArray->pData, this->frameBytes);
+    this->bufferedFrames++;
+    if (this->bufferedFrames < this->framesPerWrite) return asynSuccess;
+    return this->flushFrames((this->framesPerWrite > 1) ? (const void *)&this->dataBuffer[0] : pArray->pData);
+}
+
 /** Read NDArray data from a netCDF file; NOTE: not implemented yet.
   * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */ 
 asynStatus NDFileNetCDF::readFile(NDArray **pArray)
@@ -482,16 +590,63 @@ asynStatus NDFileNetCDF::readFile(NDArray **pArray)
 asynStatus NDFileNetCDF::closeFile()
 {
     int retval;
+    asynStatus status;
     static const char *functionName = "closeFile";
 
     if (this->ncId == 0) return asynSuccess;
-    if ((retval = nc_close(this->ncId)))
+    /* Write the arrays that are still buffered; only possible with more than 1 array per write */
+    status = this->flushFrames(this->dataBuffer.empty() ? NULL : (const void *)&this->dataBuffer[0]);
+    if ((retval = nc_close(this->ncId))) {
+        this->ncId = 0;
         ERR(retval);
+    }
     this->ncId = 0;
-    return asynSuccess;
+    return status;
 }
 
 
+/** Called when asyn clients call pasynInt32->write().
+  * It checks the values of the netCDF parameters, which are used when the next file is opened.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileNetCDF::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_NETCDF_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDFileNetCDFFormat) {
+        if ((value < NDFileNetCDFFormatClassic) || (value > NDFileNetCDFFormatNetCDF4)) status = asynError;
+#ifndef ND_WITH_NETCDF4
+        if (value == NDFileNetCDFFormatNetCDF4) status = asynError;
+#endif
+    } else if (function == NDFileNetCDFCompressLevel) {
+        if ((value < 0) || (value > 9)) status = asynError;
+    } else if (function == NDFileNetCDFFramesPerWrite) {
+        if (value < 1) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+
 /** Constructor for NDFileNetCDF; parameters are identical to those for NDPluginFile::NDPluginFile,
     and are passed directly to that base class constructor.
   * After calling the base class constructor this method sets NDPluginFile::supportsMultipleArrays=1.
@@ -511,13 +666,25 @@ NDFileNetCDF::NDFileNetCDF(const char *portName, int queueSize, int blockingCall
                    (stackSize==0) ? epicsThreadGetStackSize(epicsThreadStackBig) : stackSize, 1)
 {
     //static const char *functionName = "NDFileNetCDF";
+
+    createParam(NDFileNetCDFFormatString,         asynParamInt32, &NDFileNetCDFFormat);
+    createParam(NDFileNetCDFCompressLevelString,  asynParamInt32, &NDFileNetCDFCompressLevel);
+    createParam(NDFileNetCDFShuffleString,        asynParamInt32, &NDFileNetCDFShuffle);
+    createParam(NDFileNetCDFFramesPerWriteString, asynParamInt32, &NDFileNetCDFFramesPerWrite);
     
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileNetCDF");
+    setIntegerParam(NDFileNetCDFFormat, NDFileNetCDFFormatClassic);
+    setIntegerParam(NDFileNetCDFCompressLevel, 0);
+    setIntegerParam(NDFileNetCDFShuffle, 0);
+    setIntegerParam(NDFileNetCDFFramesPerWrite, 1);
     this->supportsMultipleArrays = 1;
     this->pAttributeId = NULL;
     this->ncId = 0;
     this->pFileAttributes = new NDAttributeList;
+    this->framesPerWrite = 1;
+    this->bufferedFrames = 0;
+    this->numFileAttributes = 0;
 }
 
 /** Configuration routine.  Called directly, or from the iocsh function in NDFileEpics */
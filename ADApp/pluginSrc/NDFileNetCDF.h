@@ -8,18 +8,36 @@
 #ifndef DRV_NDFileNetCDF_H
 #define DRV_NDFileNetCDF_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 
 /** This version number is an attribute in the netCDF file to allow readers
  * to handle changes in the file contents */
 #define NDNetCDFFileVersion 3.0
 
+#define NDFileNetCDFFormatString         "NETCDF_FORMAT"           /* (asynInt32, r/w) File format, NDFileNetCDFFormat_t */
+#define NDFileNetCDFCompressLevelString  "NETCDF_COMPRESS_LEVEL"   /* (asynInt32, r/w) Deflate level 0-9 of netCDF-4 files */
+#define NDFileNetCDFShuffleString        "NETCDF_SHUFFLE"          /* (asynInt32, r/w) Shuffle filter in netCDF-4 files */
+#define NDFileNetCDFFramesPerWriteString "NETCDF_FRAMES_PER_WRITE" /* (asynInt32, r/w) Arrays buffered for each write */
+
+/** File formats that NDFileNetCDF writes */
+typedef enum {
+    NDFileNetCDFFormatClassic,      /**< The classic format */
+    NDFileNetCDFFormat64BitOffset,  /**< The 64-bit offset format, for files larger than 2 GB */
+    NDFileNetCDFFormatNetCDF4       /**< netCDF-4 classic model in HDF5, with chunking and compression; needs a
+                                      *  netCDF library built with netCDF-4 and ADCore built with WITH_NETCDF4=YES */
+} NDFileNetCDFFormat_t;
+
 /** Writes NDArrays to files in the netCDF file format.
   * netCDF is an open-source, portable, self-describing binary format supported by Unidata at UCAR
   * (http://www.unidata.ucar.edu/software/netcdf).
   * The netCDF format supports arrays of any dimension and all of the data types supported by NDArray.
   * It can store multiple NDArrays in a single file, so it sets NDPluginFile::supportsMultipleArrays to 1.
   * If also can store all of the attributes associated with an NDArray.
+  * In Capture and Stream mode the arrays and their attributes are buffered, and NetCDFFramesPerWrite of them
+  * are written with one call for each variable.  netCDF-4 files store each array as one chunk, which can be
+  * compressed with the deflate and shuffle filters.
   * This class implements the 4 pure virtual functions from 
   * NDPluginFile: openFile, readFile, writeFile and closeFile. */
 class epicsShareClass NDFileNetCDF : public NDPluginFile {
@@ -33,8 +51,18 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileNetCDFFormat;
+    #define FIRST_NDFILE_NETCDF_PARAM NDFileNetCDFFormat
+    int NDFileNetCDFCompressLevel;
+    int NDFileNetCDFShuffle;
+    int NDFileNetCDFFramesPerWrite;
 
 private:
+    asynStatus putVara(int varId, int dataType, const size_t *start, const size_t *count, const void *pData);
+    asynStatus flushFrames(const void *pData);
     int ncId;
     int arrayDataId;
     int uniqueIdId;
@@ -44,6 +72,22 @@ private:
     int nextRecord;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
+    /* The arrays that have not been written yet, see flushFrames() */
+    int framesPerWrite;
+    int bufferedFrames;
+    NDDataType_t dataType;
+    size_t frameBytes;
+    int frameDims;
+    size_t frameCount[ND_ARRAY_MAX_DIMS+1];
+    std::vector<char> dataBuffer;
+    std::vector<int> uniqueIds;
+    std::vector<double> timeStamps;
+    std::vector<int> epicsTSSecs;
+    std::vector<int> epicsTSNsecs;
+    int numFileAttributes;
+    std::vector<NDAttrDataType_t> attrDataTypes;
+    std::vector<size_t> attrSizes;          /* Bytes of each value of each attribute */
+    std::vector< std::vector<char> > attrValues;
 };
 
 #endif
@@ -43,6 +43,7 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
   char programName[] = "areaDetector NDFileNexus plugin v0.2";
   static const char *functionName = "openFile";
   NXstatus nxstat;
+  int addr = 0;
 
   /* Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -75,7 +76,14 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
   }
   nxstat = NXputattr( this->nxFileHandle, "creator", programName, (int)strlen(programName), NX_CHAR);
 
-  processNode(this->rootNode, pArray);
+  /* Must lock when accessing parameter library, and the template which writeOctet can replace */
+  this->lock();
+  getIntegerParam(addr, NDFileWriteMode, &this->fileWriteMode);
+  getIntegerParam(addr, NDFileNumCapture, &this->numCapture);
+  this->fileSteps = this->templateSteps;
+  this->unlock();
+
+  writeSteps(pArray);
 
   /*Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -97,16 +105,7 @@ asynStatus NDFileNexus::writeFile(NDArray *pArray) {
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "Entering %s:%s\n", driverName, functionName );
 
-
-  /* Update attribute list. We use a separate attribute list
-   * from the one in pArray to avoid the need to copy the array. */
-  /* Get the current values of the attributes for this plugin */
-  this->getAttributes(this->pFileAttributes);
-
-  /* Now append the attributes from the array which are already up to date from
-   * the driver and prior plugins */
-  pArray->pAttributeList->copy(this->pFileAttributes);
-
+  /* The attributes are only written by openFile, so each array only needs its data written */
   processStreamData(pArray);
 
   /* Print trace information if level is set correctly */
@@ -162,52 +161,33 @@ asynStatus NDFileNexus::closeFile() {
   return status;
 }
 
-int NDFileNexus::processNode(xmlNode *curNode, NDArray *pArray) {
-  int status = 0;
-  const char *nodeName;
+/** Compiles a node of the template, and the nodes below it, into steps.
+  * The node types, NeXus types and constant values are resolved here, so that writeSteps does not
+  * need to look at the XML document.
+  * \param[in] curNode The node.
+  * \param[in,out] steps The steps of the node are appended to these. */
+void NDFileNexus::compileNode(xmlNode *curNode, std::vector<NDNexusStep_t>& steps) {
   const char *nodeValue;
-  const char *nodeOuttype;
-  const char *nodeSource;
-  const char *nodeType;
-  //float data;
-  int rank;
-  NDDataType_t type;
-  int ii;
-  int dims[ND_ARRAY_MAX_DIMS];
-  int numCapture;
-  int fileWriteMode;
-  NDAttrDataType_t attrDataType;
-  NDAttribute *pAttr;
-  size_t attrDataSize;
-  size_t nodeTextLen;
-  int wordSize;
-  int dataOutType=NDInt8;
-  size_t numWords;
-  int numItems = 0;
-  int addr =0;
-  void *pValue;
-  char nodeText[256];
-  NXname dataclass;
-  NXname dPath;
-  static const char *functionName = "processNode";
-
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-            "Entering %s:%s\n", driverName, functionName );
-
-  /* Must lock when accessing parameter library */
-  this->lock();
-  getIntegerParam(addr, NDFileWriteMode, &fileWriteMode);
-  getIntegerParam(addr, NDFileNumCapture, &numCapture);
-  this->unlock();
+  char *nodeName;
+  char *nodeSource;
+  char *nodeType;
+  size_t first;
+  NDNexusStep_t step;
+  static const char *functionName = "compileNode";
 
   nodeValue = (const char *)curNode->name;
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
             "%s:%s  Value=%s Type=%d\n", driverName, functionName,
             curNode->content, curNode->type);
-  nodeType = (const char *)xmlGetProp(curNode, (const xmlChar *)"type");
-  NXstatus stat;
+  nodeType = (char *)xmlGetProp(curNode, (const xmlChar *)"type");
+  nodeName = (char *)xmlGetProp(curNode, (const xmlChar *)"name");
+  nodeSource = (char *)xmlGetProp(curNode, (const xmlChar *)"source");
+  step.outType = -1;
+  step.length = 0;
+  step.end = 0;
+
   if (strcmp (nodeValue, "NXroot") == 0) {
-    this->iterateNodes(curNode, pArray);
+    this->compileChildren(curNode, steps);
   }  /*  only include all the NeXus base classes */
   else if ((strcmp (nodeValue, "NXentry") ==0) ||
            (strcmp (nodeValue, "NXinstrument") ==0) ||
@@ -254,67 +234,26 @@ int NDFileNexus::processNode(xmlNode *curNode, NDArray *pArray) {
            (strcmp (nodeValue, "NXsubentry") ==0) ||
            (strcmp (nodeValue, "NXxraylens") ==0) ||
            (nodeType && strcmp (nodeType, "UserGroup") == 0) ) {
-  nodeName = (const char *)xmlGetProp(curNode, (const xmlChar *)"name");
-  if (nodeName == NULL) {
-    nodeName = nodeValue;
-  }
-  stat = NXmakegroup(this->nxFileHandle, (const char *)nodeName, (const char *)nodeValue);
-  stat |= NXopengroup(this->nxFileHandle, (const char *)nodeName, (const char *)nodeValue);
-  if (stat != NX_OK ) {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s Error creating group %s %s\n",
-              driverName, functionName, nodeName, nodeValue);
-  }
-  this->iterateNodes(curNode, pArray);
-  stat = NXclosegroup(this->nxFileHandle);
-  if (stat != NX_OK ) {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s Error closing group %s %s\n",
-              driverName, functionName, nodeName, nodeValue);
-    }
+    step.type = NDNexusOpenGroup;
+    step.name = nodeName ? nodeName : nodeValue;
+    step.nxClass = nodeValue;
+    first = steps.size();
+    steps.push_back(step);
+    this->compileChildren(curNode, steps);
+    step.type = NDNexusCloseGroup;
+    steps.push_back(step);
+    steps[first].end = steps.size();
   }
   else if (strcmp (nodeValue, "Attr") ==0) {
-    nodeName = (const char *)xmlGetProp(curNode, (const xmlChar *)"name");
-    nodeSource = (const char *)xmlGetProp(curNode, (const xmlChar *)"source");
+    step.name = nodeName ? nodeName : "";
     if (nodeType && strcmp(nodeType, "ND_ATTR") == 0 ) {
-      pAttr = this->pFileAttributes->find(nodeSource);
-      if (pAttr != NULL ){
-        pAttr->getValueInfo(&attrDataType, &attrDataSize);
-        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
-
-        if (dataOutType > 0) {
-          pValue = calloc( attrDataSize, wordSize );
-          pAttr->getValue(attrDataType, (char *)pValue, attrDataSize*wordSize);
-
-          NXputattr(this->nxFileHandle, nodeName, pValue, (int)(attrDataSize/wordSize), dataOutType);
-
-          free(pValue);
-        }
-      }
-      else {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                  "%s:%s Could not find attribute named %s\n",
-                  driverName, functionName, nodeSource);
-      }
+      step.type = NDNexusAttrND;
+      step.source = nodeSource ? nodeSource : "";
+      steps.push_back(step);
     }
     else if (nodeType && strcmp(nodeType, "CONST") == 0 ) {
-      this->findConstText( curNode, nodeText);
-      nodeOuttype = (const char *)xmlGetProp(curNode, (const xmlChar *)"outtype");
-      if (nodeOuttype == NULL){
-        nodeOuttype = "NX_CHAR";
-      }
-      dataOutType = this->typeStringToVal((const char *)nodeOuttype);
-      if ( dataOutType == NX_CHAR ) {
-        nodeTextLen = strlen(nodeText);
-      }
-      else {
-        nodeTextLen = 1;
-      }
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
-      NXputattr(this->nxFileHandle, nodeName, pValue, (int)nodeTextLen, dataOutType);
-      free(pValue);
-
+      step.type = NDNexusAttrConst;
+      if (this->compileConst(curNode, step)) steps.push_back(step);
     }
     else if (nodeType) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -322,155 +261,268 @@ int NDFileNexus::processNode(xmlNode *curNode, NDArray *pArray) {
                 driverName, functionName, nodeType, nodeValue);
     }
   }
-
   else {
-    nodeSource = (const char *)xmlGetProp(curNode, (const xmlChar *)"source");
+    step.name = nodeValue;
+    first = steps.size();
     if (nodeType && strcmp(nodeType, "ND_ATTR") == 0 ) {
-      pAttr = this->pFileAttributes->find(nodeSource);
-      if ( pAttr != NULL) {
-        pAttr->getValueInfo(&attrDataType, &attrDataSize);
-        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
-
-        if (dataOutType > 0) {
-          pValue = calloc( attrDataSize, wordSize );
-          pAttr->getValue(attrDataType, (char *)pValue, attrDataSize);
-
-          numWords = attrDataSize/wordSize;
-          NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&(numWords));
-          NXopendata(this->nxFileHandle, nodeValue);
-          NXputdata(this->nxFileHandle, (char *)pValue);
-          free(pValue);
-          this->iterateNodes(curNode, pArray);
-          NXclosedata(this->nxFileHandle);
-        }
-      }
-      else {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                  "%s:%s Could not add node %s could not find an attribute by that name\n",
-                  driverName, functionName, nodeSource);
-      }
+      step.type = NDNexusDataND;
+      step.source = nodeSource ? nodeSource : "";
     }
     else if (nodeType && strcmp(nodeType, "pArray") == 0 ){
-
-      rank = pArray->ndims;
-      type = pArray->dataType;
-      for (ii=0; ii<rank; ii++) {
-        dims[(rank-1) - ii] = (int)pArray->dims[ii].size;
-      }
-
-      switch(type) {
-        case NDInt8:
-          dataOutType = NX_INT8;
-          wordSize = 1;
-          break;
-        case NDUInt8:
-          dataOutType = NX_UINT8;
-          wordSize = 1;
-          break;
-        case NDInt16:
-          dataOutType = NX_INT16;
-          wordSize = 2;
-          break;
-        case NDUInt16:
-          dataOutType = NX_UINT16;
-          wordSize = 2;
-          break;
-        case NDInt32:
-          dataOutType = NX_INT32;
-          wordSize = 4;
-          break;
-        case NDUInt32:
-          dataOutType = NX_UINT32;
-          wordSize = 4;
-          break;
-        case NDFloat32:
-          dataOutType = NX_FLOAT32;
-          wordSize = 4;
-          break;
-        case NDFloat64:
-          dataOutType = NX_FLOAT64;
-          wordSize = 8;
-          break;
-        }
-
-        asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-                  "%s:%s Starting to write data making group\n", driverName, functionName );
-
-      if ( fileWriteMode == NDFileModeSingle ) {
-          NXmakedata( this->nxFileHandle, nodeValue, dataOutType, rank, dims);
-      }
-      else if ((fileWriteMode == NDFileModeCapture) ||
-               (fileWriteMode == NDFileModeStream)) {
-        for (ii = 0; ii < rank; ii++) {
-          dims[(rank) - ii] = dims[(rank-1) - ii];
-        }
-        rank = rank +1;
-        dims[0] = numCapture;
-        NXmakedata( this->nxFileHandle, nodeValue, dataOutType, rank, dims);
-      }
-      dPath[0] = '\0';
-      dataclass[0] = '\0';
-
-      NXopendata(this->nxFileHandle, nodeValue);
-      // If you are having problems with NXgetgroupinfo in Visual Studio,
-      // Checkout this link: http://trac.nexusformat.org/code/ticket/217
-      // Fixed in Nexus 4.2.1
-      //printf("%s:%s: calling NXgetgroupinfo!\n", driverName, functionName);
-      NXgetgroupinfo(this->nxFileHandle, &numItems, dPath, dataclass);
-      //printf("dPath=%s, nodeValue=%s\n", dPath, nodeValue );
-      sprintf(this->dataName, "%s", nodeValue);
-      sprintf(this->dataPath, "%c%s", '/', dPath);
-      this->iterateNodes(curNode, pArray);
-      NXclosedata(this->nxFileHandle);
+      step.type = NDNexusDataArray;
     }
     else if (nodeType && strcmp(nodeType, "CONST") == 0 ){
-      this->findConstText( curNode, nodeText);
-
-      nodeOuttype = (const char *)xmlGetProp(curNode, (const xmlChar *)"outtype");
-      if (nodeOuttype == NULL){
-        nodeOuttype = "NX_CHAR";
-      }
-      dataOutType = this->typeStringToVal(nodeOuttype);
-      if ( dataOutType == NX_CHAR ) {
-        nodeTextLen = strlen(nodeText);
-      }
-      else {
-        nodeTextLen = 1;
-      }
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
-
-      NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&nodeTextLen);
-      NXopendata(this->nxFileHandle, nodeValue);
-      NXputdata(this->nxFileHandle, pValue);
-      free(pValue);
-      this->iterateNodes(curNode, pArray);
-      NXclosedata(this->nxFileHandle);
+      step.type = NDNexusDataConst;
+      if (!this->compileConst(curNode, step)) nodeValue = NULL;
     }
     else if (nodeType) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s:%s Node type %s for node %s is invalid\n",
                 driverName, functionName, nodeType, nodeValue);
+      nodeValue = NULL;
     }
     else {
-      this->findConstText( curNode, nodeText);
+      step.type = NDNexusDataConst;
+      this->compileConst(curNode, step);
+    }
+    /* nodeValue is NULL if the node cannot be written, and then the nodes below it are not either */
+    if (nodeValue) {
+      steps.push_back(step);
+      this->compileChildren(curNode, steps);
+      step.type = NDNexusCloseData;
+      step.value.clear();
+      steps.push_back(step);
+      steps[first].end = steps.size();
+    }
+  }
+  xmlFree(nodeType);
+  xmlFree(nodeName);
+  xmlFree(nodeSource);
+}
 
-      dataOutType = NX_CHAR;
-      nodeTextLen = strlen(nodeText);
+/** Compiles the element nodes below a node of the template, see compileNode */
+void NDFileNexus::compileChildren(xmlNode *curNode, std::vector<NDNexusStep_t>& steps) {
+  xmlNode *childNode;
 
-      if (nodeTextLen == 0) {
-        sprintf(nodeText, "LEFT BLANK");
-        nodeTextLen = strlen(nodeText);
-      }
+  for(childNode = curNode->children; childNode; childNode = childNode->next) {
+    if (childNode->type == XML_ELEMENT_NODE){
+      this->compileNode(childNode, steps);
+    }
+  }
+  return;
+}
+
+/** Converts the text of a CONST node, or of a node without a type, to the value of its step.
+  * A CONST node has the NeXus type of its outtype property, NX_CHAR by default; a node without a type is
+  * always NX_CHAR, and "LEFT BLANK" if it has no text.
+  * \param[in] curNode The node.
+  * \param[in,out] step The step; outType, length and value are set.
+  * \return false if the outtype is not a NeXus type. */
+bool NDFileNexus::compileConst(xmlNode *curNode, NDNexusStep_t& step) {
+  char nodeText[256];
+  char *nodeType;
+  char *nodeOuttype;
+  size_t nodeTextLen;
+  static const char *functionName = "compileConst";
+
+  this->findConstText( curNode, nodeText);
+  nodeType = (char *)xmlGetProp(curNode, (const xmlChar *)"type");
+  if (nodeType == NULL) {
+    step.outType = NX_CHAR;
+    if (strlen(nodeText) == 0) {
+      sprintf(nodeText, "LEFT BLANK");
+    }
+  }
+  else {
+    nodeOuttype = (char *)xmlGetProp(curNode, (const xmlChar *)"outtype");
+    step.outType = this->typeStringToVal(nodeOuttype ? nodeOuttype : "NX_CHAR");
+    if (step.outType < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s Output type %s for node %s is invalid\n",
+                driverName, functionName, nodeOuttype, (const char *)curNode->name);
+    }
+    xmlFree(nodeOuttype);
+    xmlFree(nodeType);
+    if (step.outType < 0) return false;
+  }
+  if ( step.outType == NX_CHAR ) {
+    nodeTextLen = strlen(nodeText);
+  }
+  else {
+    nodeTextLen = 1;
+  }
+  step.length = (int)nodeTextLen;
+  step.value.resize(constValueSize(step.outType, nodeTextLen));
+  constTextToDataType(nodeText, step.outType, &step.value[0]);
+  return true;
+}
+
+/** Writes the groups, data items and attributes of the compiled template to the open file.
+  * The NDAttribute values come from pFileAttributes, and the dimensions of the data item for the NDArrays
+  * from pArray and the file write mode.
+  * \param[in] pArray The array the file is opened with. */
+int NDFileNexus::writeSteps(NDArray *pArray) {
+  int status = 0;
+  int rank;
+  int ii;
+  int dims[ND_ARRAY_MAX_DIMS+1];
+  NDAttrDataType_t attrDataType;
+  NDAttribute *pAttr;
+  size_t attrDataSize;
+  int wordSize;
+  int dataOutType=NDInt8;
+  int numWords;
+  int numItems = 0;
+  void *pValue;
+  NXname dataclass;
+  NXname dPath;
+  NXstatus stat;
+  NDNexusStep_t *pStep;
+  size_t step = 0;
+  static const char *functionName = "writeSteps";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "Entering %s:%s\n", driverName, functionName );
+
+  while (step < this->fileSteps.size()) {
+    pStep = &this->fileSteps[step++];
+    switch (pStep->type) {
+      case NDNexusOpenGroup:
+        stat = NXmakegroup(this->nxFileHandle, pStep->name.c_str(), pStep->nxClass.c_str());
+        stat |= NXopengroup(this->nxFileHandle, pStep->name.c_str(), pStep->nxClass.c_str());
+        if (stat != NX_OK ) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s Error creating group %s %s\n",
+                    driverName, functionName, pStep->name.c_str(), pStep->nxClass.c_str());
+        }
+        break;
+
+      case NDNexusCloseGroup:
+        stat = NXclosegroup(this->nxFileHandle);
+        if (stat != NX_OK ) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s Error closing group %s %s\n",
+                    driverName, functionName, pStep->name.c_str(), pStep->nxClass.c_str());
+        }
+        break;
+
+      case NDNexusAttrConst:
+        NXputattr(this->nxFileHandle, pStep->name.c_str(), &pStep->value[0], pStep->length, pStep->outType);
+        break;
+
+      case NDNexusAttrND:
+        pAttr = this->pFileAttributes->find(pStep->source.c_str());
+        if (pAttr == NULL) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s Could not find attribute named %s\n",
+                    driverName, functionName, pStep->source.c_str());
+          break;
+        }
+        pAttr->getValueInfo(&attrDataType, &attrDataSize);
+        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
+        if (dataOutType > 0) {
+          pValue = calloc( attrDataSize, wordSize );
+          pAttr->getValue(attrDataType, (char *)pValue, attrDataSize*wordSize);
+          NXputattr(this->nxFileHandle, pStep->name.c_str(), pValue, (int)(attrDataSize/wordSize), dataOutType);
+          free(pValue);
+        }
+        break;
+
+      case NDNexusDataConst:
+        NXmakedata( this->nxFileHandle, pStep->name.c_str(), pStep->outType, 1, &pStep->length);
+        NXopendata(this->nxFileHandle, pStep->name.c_str());
+        NXputdata(this->nxFileHandle, &pStep->value[0]);
+        break;
+
+      case NDNexusDataND:
+        pAttr = this->pFileAttributes->find(pStep->source.c_str());
+        if (pAttr == NULL) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s Could not add node %s could not find an attribute by that name\n",
+                    driverName, functionName, pStep->source.c_str());
+          step = pStep->end;
+          break;
+        }
+        pAttr->getValueInfo(&attrDataType, &attrDataSize);
+        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
+        if (dataOutType <= 0) {
+          step = pStep->end;
+          break;
+        }
+        pValue = calloc( attrDataSize, wordSize );
+        pAttr->getValue(attrDataType, (char *)pValue, attrDataSize);
+        numWords = (int)(attrDataSize/wordSize);
+        NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, 1, &numWords);
+        NXopendata(this->nxFileHandle, pStep->name.c_str());
+        NXputdata(this->nxFileHandle, (char *)pValue);
+        free(pValue);
+        break;
+
+      case NDNexusDataArray:
+        rank = pArray->ndims;
+        for (ii=0; ii<rank; ii++) {
+          dims[(rank-1) - ii] = (int)pArray->dims[ii].size;
+        }
 
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
+        switch(pArray->dataType) {
+          case NDInt8:
+            dataOutType = NX_INT8;
+            break;
+          case NDUInt8:
+            dataOutType = NX_UINT8;
+            break;
+          case NDInt16:
+            dataOutType = NX_INT16;
+            break;
+          case NDUInt16:
+            dataOutType = NX_UINT16;
+            break;
+          case NDInt32:
+            dataOutType = NX_INT32;
+            break;
+          case NDUInt32:
+            dataOutType = NX_UINT32;
+            break;
+          case NDFloat32:
+            dataOutType = NX_FLOAT32;
+            break;
+          case NDFloat64:
+            dataOutType = NX_FLOAT64;
+            break;
+          default:
+            break;
+        }
 
-      NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&nodeTextLen);
-      NXopendata(this->nxFileHandle, nodeValue);
-      NXputdata(this->nxFileHandle, pValue);
-      this->iterateNodes(curNode, pArray);
-      NXclosedata(this->nxFileHandle);
+        asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
+                  "%s:%s Starting to write data making group\n", driverName, functionName );
+
+        if ( this->fileWriteMode == NDFileModeSingle ) {
+          NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, rank, dims);
+        }
+        else if ((this->fileWriteMode == NDFileModeCapture) ||
+                 (this->fileWriteMode == NDFileModeStream)) {
+          for (ii = 0; ii < rank; ii++) {
+            dims[(rank) - ii] = dims[(rank-1) - ii];
+          }
+          rank = rank +1;
+          dims[0] = this->numCapture;
+          NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, rank, dims);
+        }
+        dPath[0] = '\0';
+        dataclass[0] = '\0';
+
+        NXopendata(this->nxFileHandle, pStep->name.c_str());
+        // If you are having problems with NXgetgroupinfo in Visual Studio,
+        // Checkout this link: http://trac.nexusformat.org/code/ticket/217
+        // Fixed in Nexus 4.2.1
+        NXgetgroupinfo(this->nxFileHandle, &numItems, dPath, dataclass);
+        sprintf(this->dataName, "%s", pStep->name.c_str());
+        sprintf(this->dataPath, "%c%s", '/', dPath);
+        break;
+
+      case NDNexusCloseData:
+        NXclosedata(this->nxFileHandle);
+        break;
     }
   }
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -479,24 +531,16 @@ int NDFileNexus::processNode(xmlNode *curNode, NDArray *pArray) {
 }
 
 int NDFileNexus::processStreamData(NDArray *pArray) {
-  int fileWriteMode;
-  int numCapture;
-  int slabOffset[ND_ARRAY_MAX_DIMS];
-  int slabSize[ND_ARRAY_MAX_DIMS];
+  int slabOffset[ND_ARRAY_MAX_DIMS+1];
+  int slabSize[ND_ARRAY_MAX_DIMS+1];
   int rank;
   int ii;
-  int addr = 0;
-  //static const char *functionName = "processNode";
 
-  /* Must lock when accessing parameter library */
-  this->lock();
-  getIntegerParam(addr, NDFileWriteMode, &fileWriteMode);
-  getIntegerParam(addr, NDFileNumCapture, &numCapture);
-  this->unlock();
-  
+  /* The file write mode and number to capture were read by openFile, so the parameter library
+   * does not need to be locked for each array */
   rank = pArray->ndims;
   for (ii=0; ii<rank; ii++) {
-    switch(fileWriteMode) {
+    switch(this->fileWriteMode) {
     case NDFileModeSingle:
       slabOffset[(rank-1) - ii] = 0;
       slabSize[(rank-1) -ii] = (int)pArray->dims[ii].size;
@@ -509,12 +553,11 @@ int NDFileNexus::processStreamData(NDArray *pArray) {
     }
   }
 
-  //printf ("%s: dataPath %s\ndataName %s\nimageNumber %d\n", functionName, this->dataPath, this->dataName, this->imageNumber);
   if (this->imageNumber == 0) {
     NXopenpath( this->nxFileHandle, this->dataPath);
     NXopendata( this->nxFileHandle, this->dataName);
   }
-  switch (fileWriteMode) {
+  switch (this->fileWriteMode) {
     case NDFileModeSingle:
       NXputdata(this->nxFileHandle, pArray->pData);
       break;
@@ -527,7 +570,7 @@ int NDFileNexus::processStreamData(NDArray *pArray) {
       NXputslab(this->nxFileHandle, pArray->pData, slabOffset, slabSize);
       break;
   }
-  if (this-> imageNumber == (numCapture-1) ) {
+  if (this-> imageNumber == (this->numCapture-1) ) {
     NXclosedata(this->nxFileHandle);
     NXclosegroup(this->nxFileHandle );
   }
@@ -537,17 +580,6 @@ int NDFileNexus::processStreamData(NDArray *pArray) {
 
 }
 
-void NDFileNexus::iterateNodes(xmlNode *curNode, NDArray *pArray) {
-  xmlNode *childNode;
-
-  for(childNode = curNode->children; childNode; childNode = childNode->next) {
-    if (childNode->type <2 ){
-      this->processNode(childNode, pArray);
-    }
-  }
-  return;
-}
-
 void NDFileNexus::getAttrTypeNSize(NDAttribute *pAttr, int *retType, int *retSize) {
   int dataOutType;
   int wordSize;
@@ -623,41 +655,32 @@ void NDFileNexus::findConstText(xmlNode *curNode, char *outtext) {
   return;
 }
 
-void * NDFileNexus::allocConstValue(int dataType, size_t length ) {
-  void *pValue;
+/** Returns the number of bytes of a constant value of a NeXus type, including the terminating nul of NX_CHAR */
+size_t NDFileNexus::constValueSize(int dataType, size_t length ) {
   switch (dataType) {
     case  NX_INT8:
     case NX_UINT8:
-      pValue = calloc( length, sizeof(char) );
-      break;
+      return length * sizeof(char);
     case NX_INT16:
     case NX_UINT16:
-      pValue = calloc( length, sizeof(short) );
-      break;
+      return length * sizeof(short);
     case NX_INT32:
     case NX_UINT32:
-      pValue = calloc( length, sizeof(int) );
-      break;
+      return length * sizeof(int);
     case NX_FLOAT32:
-      pValue = calloc( length, sizeof(float) );
-      break;
+      return length * sizeof(float);
     case NX_FLOAT64:
-      pValue = calloc( length, sizeof(double) );
-      break;
+      return length * sizeof(double);
     case NX_CHAR:
-      pValue = calloc( length + 1 , sizeof(char) );
-      break;
-    case NDAttrUndefined:
+      return (length + 1) * sizeof(char);
     default:
-      pValue = NULL;
-      break;
+      return 0;
   }
-  return pValue;
 }
 
 void NDFileNexus::constTextToDataType(char *inText, int dataType, void *pValue) {
-  double dval;
-  int ival;
+  double dval = 0.;
+  int ival = 0;
   int ii;
 
   switch (dataType) {
@@ -791,6 +814,8 @@ void NDFileNexus::loadTemplateFile() {
   char fullFilename[2*MAX_FILENAME_LEN] = "";
   char template_path[MAX_FILENAME_LEN] = "";
   char template_file[MAX_FILENAME_LEN] = "";
+  xmlDoc *configDoc;
+  xmlNode *rootNode;
   static const char *functionName = "loadTemplateFile";
 
   /* get the filename to be used for nexus template */
@@ -800,9 +825,9 @@ void NDFileNexus::loadTemplateFile() {
   sprintf(fullFilename, "%s%s", template_path, template_file);
 
   /* Load the Nexus template file */
-  this->configDoc = xmlReadFile(fullFilename, NULL, 0);
+  configDoc = xmlReadFile(fullFilename, NULL, 0);
 
-  if (this->configDoc == NULL){
+  if (configDoc == NULL){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Parameter file %s is invalid\n",
               driverName, functionName, fullFilename);
@@ -818,8 +843,11 @@ void NDFileNexus::loadTemplateFile() {
     callParamCallbacks(addr, addr);
   }
 
-  this->rootNode = xmlDocGetRootElement(this->configDoc);
-
+  /* Compile the template once, so that the files are written without walking the document */
+  this->templateSteps.clear();
+  rootNode = xmlDocGetRootElement(configDoc);
+  if (rootNode) this->compileNode(rootNode, this->templateSteps);
+  xmlFreeDoc(configDoc);
 }
 
 /** Constructor for NDFileNexus; all parameters are simply passed to NDPluginFile::NDPluginFile.
@@ -854,6 +882,8 @@ NDFileNexus::NDFileNexus(const char *portName, int queueSize, int blockingCallba
 
   this->pFileAttributes = new NDAttributeList;
   this->imageNumber = 0;
+  this->fileWriteMode = NDFileModeSingle;
+  this->numCapture = 0;
   setIntegerParam(NDFileNexusTemplateValid, 0);
 
   this->supportsMultipleArrays = 1;
@@ -8,6 +8,9 @@
 #ifndef DRV_NDFileNexus_H
 #define DRV_NDFileNexus_H
 
+#include <string>
+#include <vector>
+
 #include "NDPluginFile.h"
 #include <napi.h>
 #include <libxml/parser.h>
@@ -22,8 +25,35 @@
 #define NDFileNexusTemplateValidString "TEMPLATE_FILE_VALID"
 #define NUM_ND_FILE_NEXUS_PARAMS (sizeof(NDFileNexusParamString)/sizeof(NDFileNexusParamString[0]))
 
+/** The kinds of step in a compiled template */
+typedef enum {
+    NDNexusOpenGroup,   /**< Make and open a group */
+    NDNexusCloseGroup,  /**< Close a group */
+    NDNexusAttrConst,   /**< Write an attribute with a constant value */
+    NDNexusAttrND,      /**< Write an attribute with the value of an NDAttribute */
+    NDNexusDataConst,   /**< Make, open and write a data item with a constant value */
+    NDNexusDataND,      /**< Make, open and write a data item with the value of an NDAttribute */
+    NDNexusDataArray,   /**< Make and open the data item for the NDArrays */
+    NDNexusCloseData    /**< Close a data item */
+} NDNexusStepType_t;
+
+/** One step of a compiled template */
+typedef struct {
+    NDNexusStepType_t type;
+    std::string name;         /**< Name of the group, data item or attribute */
+    std::string nxClass;      /**< NeXus class of a group */
+    std::string source;       /**< Name of the NDAttribute of an NDNexusAttrND or NDNexusDataND step */
+    int outType;              /**< NeXus type of a constant value */
+    int length;               /**< Number of elements of a constant value */
+    std::vector<char> value;  /**< Constant value, converted from the template text when it is loaded */
+    size_t end;               /**< Index after the close step of an open step, where the steps continue if
+                                *  its data item cannot be written */
+} NDNexusStep_t;
+
 /** Writes NDArrays in the NeXus file format.
   * Uses an XML template file to configure the contents of the NeXus file.
+  * The template is compiled when it is loaded into a list of steps, with the node types, NeXus types and constant
+  * values already resolved, and each file is written by running the steps rather than walking the XML document.
   *
   * This version is currently limited to writing a single NDArray to each NeXus file.
   * Future releases will be capable of storing multiple NDArrays in each NeXus file.
@@ -51,19 +81,23 @@ private:
     NXhandle nxFileHandle;
     int bitsPerSample;
     NDColorMode_t colorMode;
-    xmlDoc *configDoc;
-    xmlNodePtr rootNode;
+    std::vector<NDNexusStep_t> templateSteps;  /**< The compiled template, replaced by loadTemplateFile */
+    std::vector<NDNexusStep_t> fileSteps;      /**< The copy of templateSteps the open file is written with */
     NDAttributeList *pFileAttributes;
     NXname dataPath;
     NXname dataName;
     int imageNumber;
+    int fileWriteMode;   /**< NDFileWriteMode when the file was opened */
+    int numCapture;      /**< NDFileNumCapture when the file was opened */
 
-    int processNode(xmlNode *curNode, NDArray *);
+    void compileNode(xmlNode *curNode, std::vector<NDNexusStep_t>& steps);
+    void compileChildren(xmlNode *curNode, std::vector<NDNexusStep_t>& steps);
+    bool compileConst(xmlNode *curNode, NDNexusStep_t& step);
+    int writeSteps(NDArray *pArray);
     int processStreamData(NDArray *);
     void getAttrTypeNSize(NDAttribute *pAttr, int *retType, int *retSize);
-    void iterateNodes(xmlNode *curNode, NDArray *pArray);
     void findConstText(xmlNode *curNode, char *outtext);
-    void * allocConstValue(int dataType, size_t length);
+    size_t constValueSize(int dataType, size_t length);
     void constTextToDataType(char *inText, int dataType, void *pValue);
     int typeStringToVal( const char * typeStr );
     void loadTemplateFile();
@@ -1,6 +1,6 @@
 /* NDFileNull.cpp
  * Dummy file writer, whose main purpose is to allow deleting original driver files without re-writing them in 
- * an actual file plugin.
+ * an actual file plugin.  It also measures the arrays it receives, as the end of a chain of plugins.
  *
  * Mark Rivers
  * November 30, 2011
@@ -22,7 +22,197 @@
 #include <epicsExport.h>
 #include "NDFileNull.h"
 
-//static const char *driverName = "NDFileNull";
+static const char *driverName = "NDFileNull";
+
+/** The largest number of bytes that can be added to the Adler-32 sums before they could overflow 32 bits */
+#define ADLER32_BLOCK 5552
+#define ADLER32_MODULUS 65521
+
+/** Computes the Adler-32 checksum of data, the same as zlib adler32(), so it can be compared with the
+  * checksum of the data where it was produced or of a file that it was written to.
+  * \param[in] pData The data.
+  * \param[in] nBytes The size of the data in bytes. */
+epicsUInt32 NDFileNull::checksum(const void *pData, size_t nBytes)
+{
+    const epicsUInt8 *pIn = (const epicsUInt8 *)pData;
+    epicsUInt32 a = 1, b = 0;
+    size_t n;
+
+    while (nBytes > 0) {
+        n = (nBytes < ADLER32_BLOCK) ? nBytes : ADLER32_BLOCK;
+        nBytes -= n;
+        while (n--) {
+            a += *pIn++;
+            b += a;
+        }
+        a %= ADLER32_MODULUS;
+        b %= ADLER32_MODULUS;
+    }
+    return (b << 16) | a;
+}
+
+/** Resets the measurements of the arrays that have been received. */
+void NDFileNull::resetMeasurements()
+{
+    numArrays_ = 0;
+    bytes_ = 0.;
+    firstBytes_ = 0.;
+    rateArrays_ = 0;
+    rateBytes_ = 0.;
+    latencySum_ = 0.;
+    lastUniqueId_ = 0;
+    missing_ = 0;
+    outOfOrder_ = 0;
+    setIntegerParam(NDFileNullNumArrays, 0);
+    setDoubleParam(NDFileNullMBytes, 0.);
+    setDoubleParam(NDFileNullArrayRate, 0.);
+    setDoubleParam(NDFileNullMBytesRate, 0.);
+    setDoubleParam(NDFileNullMeanArrayRate, 0.);
+    setDoubleParam(NDFileNullMeanMBytesRate, 0.);
+    setDoubleParam(NDFileNullLatency, 0.);
+    setDoubleParam(NDFileNullMeanLatency, 0.);
+    setIntegerParam(NDFileNullLastUniqueId, 0);
+    setIntegerParam(NDFileNullMissing, 0);
+    setIntegerParam(NDFileNullOutOfOrder, 0);
+    setIntegerParam(NDFileNullChecksum, 0);
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * It measures the array, and then calls NDPluginFile::processCallbacks, so the array is still counted
+  * when no file is being "written".  ArrayRate and MBytesRate are measured over the last RatePeriod in
+  * which arrays were received, and the mean rates from the first array after the reset to the last one.
+  * Missing counts the uniqueIds that were skipped when an array was received, and OutOfOrder the arrays
+  * whose uniqueId was not greater than the largest one so far; an array that arrives late is counted in
+  * OutOfOrder, and the gap that it left is still counted in Missing.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDFileNull::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  It unlocks it while it computes the checksum. */
+    NDArrayInfo_t arrayInfo;
+    epicsTimeStamp now;
+    double latency, elapsed, ratePeriod, bytes;
+    int checksumEnable;
+    epicsUInt32 sum;
+
+    epicsTimeGetCurrent(&now);
+    pArray->getInfo(&arrayInfo);
+    bytes = (double)arrayInfo.totalBytes;
+    latency = epicsTimeDiffInSeconds(&now, &pArray->epicsTS);
+    getIntegerParam(NDFileNullChecksumEnable, &checksumEnable);
+    getDoubleParam(NDFileNullRatePeriod, &ratePeriod);
+
+    if (numArrays_ == 0) {
+        firstTime_ = now;
+        rateStart_ = now;
+        firstBytes_ = bytes;
+        lastUniqueId_ = pArray->uniqueId;
+    } else {
+        rateArrays_++;
+        rateBytes_ += bytes;
+        if (pArray->uniqueId > lastUniqueId_) {
+            missing_ += pArray->uniqueId - lastUniqueId_ - 1;
+            lastUniqueId_ = pArray->uniqueId;
+        } else {
+            outOfOrder_++;
+        }
+    }
+    numArrays_++;
+    bytes_ += bytes;
+    latencySum_ += latency;
+
+    elapsed = epicsTimeDiffInSeconds(&now, &rateStart_);
+    if ((elapsed > 0.) && (elapsed >= ratePeriod)) {
+        setDoubleParam(NDFileNullArrayRate, rateArrays_ / elapsed);
+        setDoubleParam(NDFileNullMBytesRate, rateBytes_ / elapsed / 1e6);
+        rateStart_ = now;
+        rateArrays_ = 0;
+        rateBytes_ = 0.;
+    }
+    elapsed = epicsTimeDiffInSeconds(&now, &firstTime_);
+    if (elapsed > 0.) {
+        setDoubleParam(NDFileNullMeanArrayRate, (numArrays_ - 1) / elapsed);
+        setDoubleParam(NDFileNullMeanMBytesRate, (bytes_ - firstBytes_) / elapsed / 1e6);
+    }
+    setIntegerParam(NDFileNullNumArrays, numArrays_);
+    setDoubleParam(NDFileNullMBytes, bytes_ / 1e6);
+    setDoubleParam(NDFileNullLatency, latency * 1e3);
+    setDoubleParam(NDFileNullMeanLatency, latencySum_ / numArrays_ * 1e3);
+    setIntegerParam(NDFileNullLastUniqueId, lastUniqueId_);
+    setIntegerParam(NDFileNullMissing, missing_);
+    setIntegerParam(NDFileNullOutOfOrder, outOfOrder_);
+
+    if (checksumEnable) {
+        this->unlock();
+        sum = checksum(pArray->pData, arrayInfo.totalBytes);
+        this->lock();
+        setIntegerParam(NDFileNullChecksum, (epicsInt32)sum);
+    }
+
+    NDPluginFile::processCallbacks(pArray);
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Writing Reset resets the measurements.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileNull::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_NULL_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    setIntegerParam(function, value);
+    if (function == NDFileNullReset) {
+        if (value) resetMeasurements();
+        setIntegerParam(NDFileNullReset, 0);
+    }
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    asynPrint(pasynUser, ASYN_TRACE_FLOW,
+          "%s:%s: function=%d, value=%d\n",
+          driverName, functionName, function, value);
+    return status;
+}
+
+/** Called when asyn clients call pasynFloat64->write().
+  * It checks that RatePeriod is not negative.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileNull::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    double oldvalue = 0.;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeFloat64";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_NULL_PARAM) return NDPluginFile::writeFloat64(pasynUser, value);
+
+    getDoubleParam(function, &oldvalue);
+    if (function == NDFileNullRatePeriod) {
+        if (value < 0.) status = asynError;
+    }
+    setDoubleParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%f old=%f\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%f\n",
+              driverName, functionName, function, value);
+    return status;
+}
 
 /** Opens a Null file.
   * \param[in] fileName The name of the file to open.
@@ -86,8 +276,28 @@ NDFileNull::NDFileNull(const char *portName, int queueSize, int blockingCallback
 {
     //static const char *functionName = "NDFileNull";
 
+    createParam(NDFileNullResetString,          asynParamInt32,   &NDFileNullReset);
+    createParam(NDFileNullNumArraysString,      asynParamInt32,   &NDFileNullNumArrays);
+    createParam(NDFileNullMBytesString,         asynParamFloat64, &NDFileNullMBytes);
+    createParam(NDFileNullRatePeriodString,     asynParamFloat64, &NDFileNullRatePeriod);
+    createParam(NDFileNullArrayRateString,      asynParamFloat64, &NDFileNullArrayRate);
+    createParam(NDFileNullMBytesRateString,     asynParamFloat64, &NDFileNullMBytesRate);
+    createParam(NDFileNullMeanArrayRateString,  asynParamFloat64, &NDFileNullMeanArrayRate);
+    createParam(NDFileNullMeanMBytesRateString, asynParamFloat64, &NDFileNullMeanMBytesRate);
+    createParam(NDFileNullLatencyString,        asynParamFloat64, &NDFileNullLatency);
+    createParam(NDFileNullMeanLatencyString,    asynParamFloat64, &NDFileNullMeanLatency);
+    createParam(NDFileNullLastUniqueIdString,   asynParamInt32,   &NDFileNullLastUniqueId);
+    createParam(NDFileNullMissingString,        asynParamInt32,   &NDFileNullMissing);
+    createParam(NDFileNullOutOfOrderString,     asynParamInt32,   &NDFileNullOutOfOrder);
+    createParam(NDFileNullChecksumEnableString, asynParamInt32,   &NDFileNullChecksumEnable);
+    createParam(NDFileNullChecksumString,       asynParamInt32,   &NDFileNullChecksum);
+
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileNull");
+    setIntegerParam(NDFileNullReset, 0);
+    setDoubleParam(NDFileNullRatePeriod, 1.0);
+    setIntegerParam(NDFileNullChecksumEnable, 0);
+    resetMeasurements();
     this->supportsMultipleArrays = 0;
 }
 
@@ -1,7 +1,7 @@
 /*
  * NDFileNull.h
  * Dummy file writer, whose main purpose is to allow deleting original driver files without re-writing them in 
- * an actual file plugin.
+ * an actual file plugin.  It also measures the arrays it receives, as the end of a chain of plugins.
  *
  * Mark Rivers
  * November 30, 2011
@@ -10,9 +10,34 @@
 #ifndef DRV_NDFileNULL_H
 #define DRV_NDFileNULL_H
 
+#include <epicsTime.h>
+
 #include "NDPluginFile.h"
 
-/** Writes NDArrays in the Null file format. */
+#define NDFileNullResetString           "NULL_RESET"            /**< (asynInt32,   r/w) Reset the measurements */
+#define NDFileNullNumArraysString       "NULL_NUM_ARRAYS"       /**< (asynInt32,   r/o) Arrays received since the reset */
+#define NDFileNullMBytesString          "NULL_MBYTES"           /**< (asynFloat64, r/o) Data received since the reset (MB) */
+#define NDFileNullRatePeriodString      "NULL_RATE_PERIOD"      /**< (asynFloat64, r/w) Time over which ArrayRate and MBytesRate
+                                                                  *  are measured (s) */
+#define NDFileNullArrayRateString       "NULL_ARRAY_RATE"       /**< (asynFloat64, r/o) Arrays per second over the last RatePeriod */
+#define NDFileNullMBytesRateString      "NULL_MBYTES_RATE"      /**< (asynFloat64, r/o) MB per second over the last RatePeriod */
+#define NDFileNullMeanArrayRateString   "NULL_MEAN_ARRAY_RATE"  /**< (asynFloat64, r/o) Arrays per second since the reset */
+#define NDFileNullMeanMBytesRateString  "NULL_MEAN_MBYTES_RATE" /**< (asynFloat64, r/o) MB per second since the reset */
+#define NDFileNullLatencyString         "NULL_LATENCY"          /**< (asynFloat64, r/o) Time from the epicsTS of the last array
+                                                                  *  to when it was received (ms) */
+#define NDFileNullMeanLatencyString     "NULL_MEAN_LATENCY"     /**< (asynFloat64, r/o) Mean of Latency since the reset (ms) */
+#define NDFileNullLastUniqueIdString    "NULL_LAST_UNIQUE_ID"   /**< (asynInt32,   r/o) Largest uniqueId received */
+#define NDFileNullMissingString         "NULL_MISSING"          /**< (asynInt32,   r/o) uniqueIds skipped since the reset */
+#define NDFileNullOutOfOrderString      "NULL_OUT_OF_ORDER"     /**< (asynInt32,   r/o) Arrays whose uniqueId was not greater
+                                                                  *  than LastUniqueId */
+#define NDFileNullChecksumEnableString  "NULL_CHECKSUM_ENABLE"  /**< (asynInt32,   r/w) Compute the checksum of each array */
+#define NDFileNullChecksumString        "NULL_CHECKSUM"         /**< (asynInt32,   r/o) Adler-32 checksum of the data of the
+                                                                  *  last array */
+
+/** Writes NDArrays in the Null file format.
+  * It does not write any files, but it measures the arrays it receives, so it can be used as the end of a
+  * chain of plugins to measure its throughput: the rate of arrays and data, the latency from the epicsTS of
+  * each array, uniqueIds that were skipped or are out of order, and optionally a checksum of the data. */
 
 class epicsShareClass NDFileNull : public NDPluginFile {
 public:
@@ -21,10 +46,48 @@ public:
                  int priority, int stackSize);
 
     /* The methods that this class implements */
+    virtual void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
     virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+
+    static epicsUInt32 checksum(const void *pData, size_t nBytes);
+
+protected:
+    int NDFileNullReset;
+    #define FIRST_NDFILE_NULL_PARAM NDFileNullReset
+    int NDFileNullNumArrays;
+    int NDFileNullMBytes;
+    int NDFileNullRatePeriod;
+    int NDFileNullArrayRate;
+    int NDFileNullMBytesRate;
+    int NDFileNullMeanArrayRate;
+    int NDFileNullMeanMBytesRate;
+    int NDFileNullLatency;
+    int NDFileNullMeanLatency;
+    int NDFileNullLastUniqueId;
+    int NDFileNullMissing;
+    int NDFileNullOutOfOrder;
+    int NDFileNullChecksumEnable;
+    int NDFileNullChecksum;
+
+private:
+    void resetMeasurements();
+
+    int numArrays_;             /**< Arrays received since the reset */
+    double bytes_;              /**< Data received since the reset */
+    double firstBytes_;         /**< Size of the first array after the reset, which is not in the mean rate */
+    epicsTimeStamp firstTime_;  /**< When the first array after the reset was received */
+    epicsTimeStamp rateStart_;  /**< Start of the current RatePeriod */
+    int rateArrays_;            /**< Arrays received in the current RatePeriod */
+    double rateBytes_;          /**< Data received in the current RatePeriod */
+    double latencySum_;         /**< Sum of the latencies since the reset, in seconds */
+    int lastUniqueId_;
+    int missing_;
+    int outOfOrder_;
 };
 
 #endif
@@ -0,0 +1,249 @@
+/* NDFileRaw.cpp
+ * Writes the data of NDArrays to raw files with asynchronous direct I/O, and their descriptions to a sidecar index,
+ * for capture at rates that structured file formats cannot sustain.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDFileRaw.h"
+
+static const char *driverName = "NDFileRaw";
+
+/** The longest list of IndexAttributes */
+#define ND_RAW_MAX_ATTRIBUTE_LIST 4096
+
+/** Opens a raw data file and its index.
+  * \param[in] fileName The name of the data file; the index is this name with ".idx" appended.
+  * \param[in] openMode Mask defining how the file should be opened; bits are 
+  *            NDFileModeRead, NDFileModeWrite, NDFileModeAppend, NDFileModeMultiple
+  * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  */
+asynStatus NDFileRaw::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
+{
+    std::vector<std::string> attributeNames;
+    std::string names;
+    char attributeList[ND_RAW_MAX_ATTRIBUTE_LIST] = "";
+    size_t start, end;
+    int directIO, inFlight, preallocate, recordAttributes;
+    int status;
+    static const char *functionName = "openFile";
+
+    /* We don't support reading */
+    if (openMode & NDFileModeRead) return asynError;
+
+    /* We don't support opening an existing file for appending */
+    if (openMode & NDFileModeAppend) return asynError;
+
+    this->lock();
+    getIntegerParam(NDFileRawDirectIO, &directIO);
+    getIntegerParam(NDFileRawInFlight, &inFlight);
+    getIntegerParam(NDFileRawPreallocate, &preallocate);
+    getStringParam(NDFileRawIndexAttributes, sizeof(attributeList), attributeList);
+    getIntegerParam(NDFileRawRecordAttributes, &recordAttributes);
+    this->unlock();
+
+    names = attributeList;
+    start = names.find_first_not_of(" ,\t");
+    while (start != std::string::npos) {
+        end = names.find_first_of(" ,\t", start);
+        attributeNames.push_back(names.substr(start, (end == std::string::npos) ? std::string::npos : end - start));
+        start = names.find_first_not_of(" ,\t", end);
+    }
+
+    status = rawFile.open(fileName, attributeNames, inFlight, (size_t)preallocate * 1024 * 1024, directIO != 0,
+                          recordAttributes != 0);
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error opening file %s\n",
+            driverName, functionName, fileName);
+        return asynError;
+    }
+
+    this->lock();
+    setIntegerParam(NDFileRawDirectIOActive, rawFile.directIO() ? 1 : 0);
+    setIntegerParam(NDFileRawNumCopied, 0);
+    callParamCallbacks();
+    this->unlock();
+    return asynSuccess;
+}
+
+/** Starts writing an NDArray to the raw file; the write completes in the background.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileRaw::writeFile(NDArray *pArray)
+{
+    static const char *functionName = "writeFile";
+
+    if (rawFile.write(pArray)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error writing array uniqueId=%d\n",
+            driverName, functionName, pArray->uniqueId);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/** Reads single NDArray from a raw file; NOT CURRENTLY IMPLEMENTED.
+  * \param[in] pArray Pointer to the NDArray to be read
+  */
+asynStatus NDFileRaw::readFile(NDArray **pArray)
+{
+    return asynError;
+}
+
+/** Waits for the writes in progress and closes the raw file and its index. */
+asynStatus NDFileRaw::closeFile()
+{
+    int status;
+    static const char *functionName = "closeFile";
+
+    status = rawFile.close();
+    this->lock();
+    setIntegerParam(NDFileRawNumCopied, rawFile.numCopied());
+    callParamCallbacks();
+    this->unlock();
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error writing or closing the file\n",
+            driverName, functionName);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks that InFlight is at least 1 and Preallocate is not negative.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileRaw::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_RAW_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDFileRawInFlight) {
+        if (value < 1) status = asynError;
+    } else if (function == NDFileRawPreallocate) {
+        if (value < 0) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDFileRaw; all parameters are simply passed to NDPluginFile::NDPluginFile.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when 
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDFileRaw::NDFileRaw(const char *portName, int queueSize, int blockingCallbacks,
+                     const char *NDArrayPort, int NDArrayAddr,
+                     int priority, int stackSize)
+    /* Invoke the base class constructor.
+     * We allocate 2 NDArrays of unlimited size in the NDArray pool.
+     * This driver can block (because writing a file can be slow), and it is not multi-device.  
+     * Set autoconnect to 1.  priority and stacksize can be 0, which will use defaults. */
+    : NDPluginFile(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1,
+                   2, 0, asynGenericPointerMask, asynGenericPointerMask, 
+                   ASYN_CANBLOCK, 1, priority, stackSize, 1)
+{
+    //static const char *functionName = "NDFileRaw";
+
+    createParam(NDFileRawDirectIOString,        asynParamInt32, &NDFileRawDirectIO);
+    createParam(NDFileRawInFlightString,        asynParamInt32, &NDFileRawInFlight);
+    createParam(NDFileRawPreallocateString,     asynParamInt32, &NDFileRawPreallocate);
+    createParam(NDFileRawIndexAttributesString, asynParamOctet, &NDFileRawIndexAttributes);
+    createParam(NDFileRawRecordAttributesString, asynParamInt32, &NDFileRawRecordAttributes);
+    createParam(NDFileRawDirectIOActiveString,  asynParamInt32, &NDFileRawDirectIOActive);
+    createParam(NDFileRawNumCopiedString,       asynParamInt32, &NDFileRawNumCopied);
+
+    /* Set the plugin type string */    
+    setStringParam(NDPluginDriverPluginType, "NDFileRaw");
+    setIntegerParam(NDFileRawDirectIO, 1);
+    setIntegerParam(NDFileRawInFlight, 4);
+    setIntegerParam(NDFileRawPreallocate, 1024);
+    setStringParam(NDFileRawIndexAttributes, "");
+    setIntegerParam(NDFileRawRecordAttributes, 0);
+    setIntegerParam(NDFileRawDirectIOActive, 0);
+    setIntegerParam(NDFileRawNumCopied, 0);
+    this->supportsMultipleArrays = 1;
+}
+
+/* Configuration routine.  Called directly, or from the iocsh  */
+
+extern "C" int NDFileRawConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                  const char *NDArrayPort, int NDArrayAddr,
+                                  int priority, int stackSize)
+{
+    NDFileRaw *pPlugin = new NDFileRaw(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                       priority, stackSize);
+    return pPlugin->start();
+}
+
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArray Port",iocshArgString};
+static const iocshArg initArg4 = { "NDArray Addr",iocshArgInt};
+static const iocshArg initArg5 = { "priority",iocshArgInt};
+static const iocshArg initArg6 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6};
+static const iocshFuncDef initFuncDef = {"NDFileRawConfigure",7,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDFileRawConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].sval, args[4].ival, args[5].ival, args[6].ival);
+}
+
+extern "C" void NDFileRawRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDFileRawRegister);
+}
@@ -0,0 +1,61 @@
+/*
+ * NDFileRaw.h
+ * Writes the data of NDArrays to raw files with asynchronous direct I/O, and their descriptions to a sidecar index.
+ */
+
+#ifndef DRV_NDFileRaw_H
+#define DRV_NDFileRaw_H
+
+#include "NDPluginFile.h"
+#include "NDRawFile.h"
+
+#define NDFileRawDirectIOString        "RAW_DIRECT_IO"         /* (asynInt32, r/w) Open the files with O_DIRECT (1=Yes, 0=No) */
+#define NDFileRawInFlightString        "RAW_IN_FLIGHT"         /* (asynInt32, r/w) Writes in progress at once */
+#define NDFileRawPreallocateString     "RAW_PREALLOCATE"       /* (asynInt32, r/w) MB of the file allocated at a time,
+                                                                * 0 to not preallocate */
+#define NDFileRawIndexAttributesString "RAW_INDEX_ATTRIBUTES"  /* (asynOctet, r/w) Names of the attributes written to
+                                                                * the index, separated by spaces or commas */
+#define NDFileRawRecordAttributesString "RAW_RECORD_ATTRIBUTES" /* (asynInt32, r/w) Write all of the attributes to the
+                                                                * attribute file, for NDRawReplay (1=Yes, 0=No) */
+#define NDFileRawDirectIOActiveString  "RAW_DIRECT_IO_ACTIVE"  /* (asynInt32, r/o) The open file uses O_DIRECT */
+#define NDFileRawNumCopiedString       "RAW_NUM_COPIED"        /* (asynInt32, r/o) Arrays of the last file that were
+                                                                * copied to an aligned buffer */
+
+/** Writes NDArrays to raw files for the highest capture rates, to be converted to other formats later.
+  * In Capture and Stream mode all of the arrays go to one large data file, each at the next 4 kB boundary, and
+  * a record for each array, with its offset, size, uniqueId, time stamps, data type, dimensions and the values
+  * of the IndexAttributes, is written to the index file, which is the data file name with ".idx" appended.
+  * The data is written from the NDArray buffers with POSIX asynchronous I/O, with up to InFlight writes in
+  * progress, and with O_DIRECT if DirectIO is Yes, which needs the driver to allocate 4096 byte aligned
+  * arrays (NDArrayPool::setAlignment) whose size is a multiple of 4096 bytes to avoid a copy.  NDRawToHDF5 converts the files to HDF5.
+  * With RecordAttributes all of the attributes of each array are written to the attribute file, the data file name
+  * with ".attr" appended, so that NDRawReplay can replay the recording with them.
+  */
+class epicsShareClass NDFileRaw : public NDPluginFile {
+public:
+    NDFileRaw(const char *portName, int queueSize, int blockingCallbacks,
+              const char *NDArrayPort, int NDArrayAddr,
+              int priority, int stackSize);
+
+    /* The methods that this class implements */
+    virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
+    virtual asynStatus readFile(NDArray **pArray);
+    virtual asynStatus writeFile(NDArray *pArray);
+    virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileRawDirectIO;
+    #define FIRST_NDFILE_RAW_PARAM NDFileRawDirectIO
+    int NDFileRawInFlight;
+    int NDFileRawPreallocate;
+    int NDFileRawIndexAttributes;
+    int NDFileRawRecordAttributes;
+    int NDFileRawDirectIOActive;
+    int NDFileRawNumCopied;
+
+private:
+    NDRawFile rawFile;
+};
+
+#endif
@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
@@ -37,6 +40,10 @@
 #include "tiffio.h"
 #include "NDFileTIFF.h"
 
+#ifdef ND_WITH_ZLIB
+  #include <zlib.h>
+#endif
+
 #define STRING_BUFFER_SIZE 2048
  
 static const char *driverName = "NDFileTIFF";
@@ -44,7 +51,62 @@ static const char *driverName = "NDFileTIFF";
 const int NDFileTIFF::TIFFTAG_START_ = 65010;
 const int NDFileTIFF::TIFFTAG_END_ = 65500;
 
+/* this is in the unallocated 'reusable' range */
+static const int TIFFTAG_NDTIMESTAMP    = 65000;
+static const int TIFFTAG_UNIQUEID       = 65001;
+static const int TIFFTAG_EPICSTSSEC     = 65002;
+static const int TIFFTAG_EPICSTSNSEC    = 65003;
+static const TIFFFieldInfo NDTimeStampFI = {
+    TIFFTAG_NDTIMESTAMP,1,1,TIFF_DOUBLE,FIELD_CUSTOM,1,0,(char *)"NDTimeStamp"
+};
+static const TIFFFieldInfo NDUniqueIdFI = {
+    TIFFTAG_UNIQUEID,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"NDUniqueId"
+};
+static const TIFFFieldInfo EPICSTSSecFI = {
+    TIFFTAG_EPICSTSSEC,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"EPICSTSSec"
+};
+static const TIFFFieldInfo EPICSTSNsecFI = {
+    TIFFTAG_EPICSTSNSEC,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"EPICSTSNsec"
+};
+
+/** Encodes one row with the PackBits scheme of the TIFF specification.
+  * The encoded row is at most n + (n+127)/128 bytes.
+  * \param[in] pSrc The row.
+  * \param[in] n The size of the row in bytes.
+  * \param[out] pDest The encoded row.
+  * \return The size of the encoded row in bytes.
+  */
+static size_t packBitsRow(const unsigned char *pSrc, size_t n, unsigned char *pDest)
+{
+    unsigned char *pOut = pDest;
+    size_t i = 0, run, start;
+
+    while (i < n) {
+        run = 1;
+        while ((i+run < n) && (run < 128) && (pSrc[i+run] == pSrc[i])) run++;
+        if (run > 1) {
+            /* A replicate run is -(run-1) followed by the byte */
+            *pOut++ = (unsigned char)(257 - run);
+            *pOut++ = pSrc[i];
+            i += run;
+            continue;
+        }
+        /* A literal run stops where a replicate run of at least 3 bytes starts */
+        start = i;
+        while ((i < n) && (i-start < 128)) {
+            if ((i+2 < n) && (pSrc[i] == pSrc[i+1]) && (pSrc[i] == pSrc[i+2])) break;
+            i++;
+        }
+        *pOut++ = (unsigned char)(i - start - 1);
+        memcpy(pOut, pSrc+start, i-start);
+        pOut += i-start;
+    }
+    return pOut - pDest;
+}
+
 /** Opens a TIFF file.
+  * In Capture and Stream mode with MultiPage=Yes (openMode includes NDFileModeMultiple) this opens a BigTIFF file,
+  * which can be larger than 4 GB, and each call to writeFile() adds a page.
   * \param[in] fileName The name of the file to open.
   * \param[in] openMode Mask defining how the file should be opened; bits are 
   *            NDFileModeRead, NDFileModeWrite, NDFileModeAppend, NDFileModeMultiple
@@ -55,12 +117,10 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* When we create TIFF variables and dimensions, we get back an
      * ID for each one. */
     static const char *functionName = "openFile";
-    size_t sizeX, sizeY, rowsPerStrip;
-    int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
     int colorMode=NDColorModeMono;
+    int userRowsPerStrip, numStrips;
+    size_t stripBytes;
     NDAttribute *pAttribute = NULL;
-    char tagString[STRING_BUFFER_SIZE] = {0};
-    char attrString[STRING_BUFFER_SIZE] = {0};
 
     /* We don't support reading yet */
     if (openMode & NDFileModeRead) return(asynError);
@@ -68,8 +128,22 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* We don't support opening an existing file for appending yet */
     if (openMode & NDFileModeAppend) return(asynError);
 
-    /* Create the file. */
-    if ((this->output = TIFFOpen(fileName, "w")) == NULL ) {
+    /* Create the file. A file with many pages may need the 64-bit offsets of BigTIFF.
+     * A single image is written to a file that NDPluginFile opens, and may have created in advance.
+     * TIFFFdOpen takes a Windows handle rather than a descriptor on Windows, so there libtiff opens the file. */
+    this->multiPage = (openMode & NDFileModeMultiple) != 0;
+#ifndef _WIN32
+    if (!this->supportsMultipleArrays) {
+        int fd = this->openFileHandle(fileName);
+        this->output = NULL;
+        if (fd >= 0) {
+            this->output = TIFFFdOpen(fd, fileName, this->multiPage ? "w8" : "w");
+            if (this->output == NULL) close(fd);
+        }
+    } else
+#endif
+    this->output = TIFFOpen(fileName, this->multiPage ? "w8" : "w");
+    if (this->output == NULL) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
         "%s:%s error opening file %s\n",
         driverName, functionName, fileName);
@@ -78,245 +152,169 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
         "%s::%s opened file %s\n", 
         driverName, functionName, fileName);
+    this->numPages = 0;
     
     /* We do some special treatment based on colorMode */
     pAttribute = pArray->pAttributeList->find("ColorMode");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
 
+    this->sampleFormat = SAMPLEFORMAT_INT;
+    this->bitsPerSample = 8;
     switch (pArray->dataType) {
         case NDInt8:
-            sampleFormat = SAMPLEFORMAT_INT;
-            bitsPerSample = 8;
+            this->sampleFormat = SAMPLEFORMAT_INT;
+            this->bitsPerSample = 8;
             break;
         case NDUInt8:
-            sampleFormat = SAMPLEFORMAT_UINT;
-            bitsPerSample = 8;
+            this->sampleFormat = SAMPLEFORMAT_UINT;
+            this->bitsPerSample = 8;
             break;
         case NDInt16:
-            sampleFormat = SAMPLEFORMAT_INT;
-            bitsPerSample = 16;
+            this->sampleFormat = SAMPLEFORMAT_INT;
+            this->bitsPerSample = 16;
             break;
         case NDUInt16:
-            sampleFormat = SAMPLEFORMAT_UINT;
-            bitsPerSample = 16;
+            this->sampleFormat = SAMPLEFORMAT_UINT;
+            this->bitsPerSample = 16;
             break;
         case NDInt32:
-            sampleFormat = SAMPLEFORMAT_INT;
-            bitsPerSample = 32;
+            this->sampleFormat = SAMPLEFORMAT_INT;
+            this->bitsPerSample = 32;
             break;
         case NDUInt32:
-            sampleFormat = SAMPLEFORMAT_UINT;
-            bitsPerSample = 32;
+            this->sampleFormat = SAMPLEFORMAT_UINT;
+            this->bitsPerSample = 32;
             break;
         case NDFloat32:
-            sampleFormat = SAMPLEFORMAT_IEEEFP;
-            bitsPerSample = 32;
+            this->sampleFormat = SAMPLEFORMAT_IEEEFP;
+            this->bitsPerSample = 32;
             break;
         case NDFloat64:
-            sampleFormat = SAMPLEFORMAT_IEEEFP;
-            bitsPerSample = 64;
+            this->sampleFormat = SAMPLEFORMAT_IEEEFP;
+            this->bitsPerSample = 64;
             break;
     }
+    getIntegerParam(NDFileTIFFRowsPerStrip, &userRowsPerStrip);
+    getIntegerParam(NDFileTIFFCompression, &this->compression);
     if (pArray->ndims == 2) {
-        sizeX = pArray->dims[0].size;
-        sizeY = pArray->dims[1].size;
-        rowsPerStrip = sizeY;
-        samplesPerPixel = 1;
-        photoMetric = PHOTOMETRIC_MINISBLACK;
-        planarConfig = PLANARCONFIG_CONTIG;
+        this->sizeX = pArray->dims[0].size;
+        this->sizeY = pArray->dims[1].size;
+        this->samplesPerPixel = 1;
+        this->photoMetric = PHOTOMETRIC_MINISBLACK;
+        this->planarConfig = PLANARCONFIG_CONTIG;
         this->colorMode = NDColorModeMono;
     } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3) && (colorMode == NDColorModeRGB1)) {
-        sizeX = pArray->dims[1].size;
-        sizeY = pArray->dims[2].size;
-        rowsPerStrip = sizeY;
-        samplesPerPixel = 3;
-        photoMetric = PHOTOMETRIC_RGB;
-        planarConfig = PLANARCONFIG_CONTIG;
+        this->sizeX = pArray->dims[1].size;
+        this->sizeY = pArray->dims[2].size;
+        this->samplesPerPixel = 3;
+        this->photoMetric = PHOTOMETRIC_RGB;
+        this->planarConfig = PLANARCONFIG_CONTIG;
         this->colorMode = NDColorModeRGB1;
     } else if ((pArray->ndims == 3) && (pArray->dims[1].size == 3) && (colorMode == NDColorModeRGB2)) {
-        sizeX = pArray->dims[0].size;
-        sizeY = pArray->dims[2].size;
-        rowsPerStrip = 1;
-        samplesPerPixel = 3;
-        photoMetric = PHOTOMETRIC_RGB;
-        planarConfig = PLANARCONFIG_SEPARATE;
+        this->sizeX = pArray->dims[0].size;
+        this->sizeY = pArray->dims[2].size;
+        this->samplesPerPixel = 3;
+        this->photoMetric = PHOTOMETRIC_RGB;
+        this->planarConfig = PLANARCONFIG_SEPARATE;
         this->colorMode = NDColorModeRGB2;
     } else if ((pArray->ndims == 3) && (pArray->dims[2].size == 3) && (colorMode == NDColorModeRGB3)) {
-        sizeX = pArray->dims[0].size;
-        sizeY = pArray->dims[1].size;
-        rowsPerStrip = sizeY;
-        samplesPerPixel = 3;
-        photoMetric = PHOTOMETRIC_RGB;
-        planarConfig = PLANARCONFIG_SEPARATE;
+        this->sizeX = pArray->dims[0].size;
+        this->sizeY = pArray->dims[1].size;
+        this->samplesPerPixel = 3;
+        this->photoMetric = PHOTOMETRIC_RGB;
+        this->planarConfig = PLANARCONFIG_SEPARATE;
         this->colorMode = NDColorModeRGB3;
     } else {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
             "%s:%s: unsupported array structure\n",
             driverName, functionName);
+        TIFFClose(this->output);
+        this->output = NULL;
         return(asynError);
     }
 
-    /* this is in the unallocated 'reusable' range */
-    static const int TIFFTAG_NDTIMESTAMP    = 65000;
-    static const int TIFFTAG_UNIQUEID       = 65001;
-    static const int TIFFTAG_EPICSTSSEC     = 65002;
-    static const int TIFFTAG_EPICSTSNSEC    = 65003;
-    static const TIFFFieldInfo NDTimeStampFI = {
-        TIFFTAG_NDTIMESTAMP,1,1,TIFF_DOUBLE,FIELD_CUSTOM,1,0,(char *)"NDTimeStamp"
-    };
-    static const TIFFFieldInfo NDUniqueIdFI = {
-        TIFFTAG_UNIQUEID,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"NDUniqueId"
-    };
-    static const TIFFFieldInfo EPICSTSSecFI = {
-        TIFFTAG_EPICSTSSEC,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"EPICSTSSec"
-    };
-    static const TIFFFieldInfo EPICSTSNsecFI = {
-        TIFFTAG_EPICSTSNSEC,1,1,TIFF_LONG,FIELD_CUSTOM,1,0,(char *)"EPICSTSNsec"
-    };
-    TIFFMergeFieldInfo(output, &NDTimeStampFI, 1);
-    TIFFMergeFieldInfo(output, &NDUniqueIdFI, 1);
-    TIFFMergeFieldInfo(output, &EPICSTSSecFI, 1);
-    TIFFMergeFieldInfo(output, &EPICSTSNsecFI, 1);
-    TIFFSetField(this->output, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
-    TIFFSetField(this->output, TIFFTAG_UNIQUEID, pArray->uniqueId);
-    TIFFSetField(this->output, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
-    TIFFSetField(this->output, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
-    TIFFSetField(this->output, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
-    TIFFSetField(this->output, TIFFTAG_SAMPLEFORMAT, sampleFormat);
-    TIFFSetField(this->output, TIFFTAG_SAMPLESPERPIXEL, samplesPerPixel);
-    TIFFSetField(this->output, TIFFTAG_PHOTOMETRIC, photoMetric);
-    TIFFSetField(this->output, TIFFTAG_PLANARCONFIG, planarConfig);
-    TIFFSetField(this->output, TIFFTAG_IMAGEWIDTH, (epicsUInt32)sizeX);
-    TIFFSetField(this->output, TIFFTAG_IMAGELENGTH, (epicsUInt32)sizeY);
-    TIFFSetField(this->output, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);   
-    
-    this->pFileAttributes->clear();
-    this->getAttributes(this->pFileAttributes);
-    pArray->pAttributeList->copy(this->pFileAttributes);
- 
-    pAttribute = this->pFileAttributes->find("Model");
-    if (pAttribute) {
-        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
-        TIFFSetField(this->output, TIFFTAG_MODEL, tagString);
+    /* The strips of each plane hold rowsPerStrip rows, the last one may hold fewer.
+     * Without compression one strip holds the whole plane, as it did before strips could be compressed.
+     * With compression there is a strip for the calling thread and each of the IntraFrameThreads threads.
+     * The rows of the colors of RGB2 are interleaved, so each strip of this mode is one row. */
+    this->numPlanes = (this->planarConfig == PLANARCONFIG_SEPARATE) ? 3 : 1;
+    this->rowBytes = this->sizeX * this->bitsPerSample/8 * (this->numPlanes == 1 ? this->samplesPerPixel : 1);
+    if (this->colorMode == NDColorModeRGB2) {
+        this->rowsPerStrip = 1;
+    } else if (userRowsPerStrip > 0) {
+        this->rowsPerStrip = userRowsPerStrip;
+    } else if (this->compression == NDFileTIFFCompressNone) {
+        this->rowsPerStrip = this->sizeY;
     } else {
-        TIFFSetField(this->output, TIFFTAG_MODEL, "Unknown");
+        int nStripes = this->numStripes(this->sizeY);
+        this->rowsPerStrip = (this->sizeY + nStripes - 1) / nStripes;
     }
-    
-    pAttribute = this->pFileAttributes->find("Manufacturer");
-    if (pAttribute) {
-        pAttribute->getValue(NDAttrString, tagString);
-        TIFFSetField(this->output, TIFFTAG_MAKE, tagString, sizeof(tagString)-1);
-    } else {
-        TIFFSetField(this->output, TIFFTAG_MAKE, "Unknown");
+    if (this->rowsPerStrip > this->sizeY) this->rowsPerStrip = this->sizeY;
+    if (this->rowsPerStrip < 1) this->rowsPerStrip = 1;
+    this->stripsPerPlane = (int)((this->sizeY + this->rowsPerStrip - 1) / this->rowsPerStrip);
+    numStrips = this->numPlanes * this->stripsPerPlane;
+    stripBytes = this->rowsPerStrip * this->rowBytes;
+    switch (this->compression) {
+        case NDFileTIFFCompressPackBits:
+            this->stripBoundBytes = this->rowsPerStrip * (this->rowBytes + (this->rowBytes+127)/128);
+            break;
+#ifdef ND_WITH_ZLIB
+        case NDFileTIFFCompressDeflate:
+            this->stripBoundBytes = compressBound((uLong)stripBytes);
+            break;
+#endif
+        default:
+            this->compression = NDFileTIFFCompressNone;
+            this->stripBoundBytes = 0;
+            break;
     }
+    this->stripBuffer.resize(numStrips * this->stripBoundBytes);
+    this->stripData.resize(numStrips);
+    this->stripSizes.resize(numStrips);
 
-    TIFFSetField(this->output, TIFFTAG_SOFTWARE, "EPICS areaDetector");
-
-    // If the attribute TIFFImageDescription exists use it to set the TIFFTAG_IMAGEDESCRIPTION
-    pAttribute = this->pFileAttributes->find("TIFFImageDescription");
-    if (pAttribute) {
-        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
-        TIFFSetField(this->output, TIFFTAG_IMAGEDESCRIPTION, tagString);
-    }
+    /* The custom tags of the attributes are chosen from the attributes of the first array and are the same
+     * for each page.  Their names are copied because the attributes are read again for each page. */
+    this->pFileAttributes->clear();
+    this->getAttributes(this->pFileAttributes);
+    pArray->pAttributeList->copy(this->pFileAttributes);
 
-    int count = 0;
-    int tagId = TIFFTAG_START_;
-   
-    numAttributes_ = this->pFileAttributes->count();
     asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
         "%s:%s this->pFileAttributes->count(): %d\n",
-        driverName, functionName, numAttributes_);
-
-    fieldInfo_ = (TIFFFieldInfo**) malloc(numAttributes_ * sizeof(TIFFFieldInfo *));
-    if (fieldInfo_ == NULL) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error, fieldInfo_ malloc failed. file: %s\n",
-            driverName, functionName, fileName);
-        return asynError;
-    }
-    for (int i=0; i<numAttributes_; ++i) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-            "%s:%s Initializing %d fieldInfo_ entry.\n",
-            driverName, functionName, i);
-        fieldInfo_[i] = NULL;
-    }
-    
-    asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-        "%s:%s Looping over attributes...\n",
-        driverName, functionName);
+        driverName, functionName, this->pFileAttributes->count());
 
+    this->tagNames_.clear();
     pAttribute = this->pFileAttributes->next(NULL);
     while (pAttribute) {
-        const char *attributeName = pAttribute->getName();
-        //const char *attributeDescription = pAttribute->getDescription();
-        const char *attributeSource = pAttribute->getSource();
+        NDAttrDataType_t attrDataType;
+        size_t attrSize;
 
         asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
           "%s:%s : attribute: %s, source: %s\n",
-          driverName, functionName, attributeName, attributeSource);
+          driverName, functionName, pAttribute->getName(), pAttribute->getSource());
 
-        NDAttrDataType_t attrDataType;
-        size_t attrSize;
-        NDAttrValue value;
         pAttribute->getValueInfo(&attrDataType, &attrSize);
-        memset(tagString, 0, sizeof(tagString));
-
-        switch (attrDataType) {
-            case NDAttrInt8:
-            case NDAttrUInt8:
-            case NDAttrInt16:
-            case NDAttrUInt16:
-            case NDAttrInt32:
-            case NDAttrUInt32: {
-                pAttribute->getValue(attrDataType, &value.i32);
-                epicsSnprintf(tagString, sizeof(tagString)-1, "%s:%d", attributeName, value.i32);
-                break;
-            }
-            case NDAttrFloat32: {
-                pAttribute->getValue(attrDataType, &value.f32);
-                epicsSnprintf(tagString, sizeof(tagString)-1, "%s:%f", attributeName, value.f32);
-                break;
-            }
-            case NDAttrFloat64: {
-                pAttribute->getValue(attrDataType, &value.f64);
-                epicsSnprintf(tagString, sizeof(tagString)-1, "%s:%f", attributeName, value.f64);
-                break;
-            }
-            case NDAttrString: {
-                memset(attrString, 0, sizeof(tagString)-1);
-                pAttribute->getValue(attrDataType, attrString, sizeof(attrString)-1);
-                epicsSnprintf(tagString, sizeof(tagString)-1, "%s:%s", attributeName, attrString);
-                break;
-            }
-            case NDAttrUndefined:
-                break;
-            default:
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s:%s error, unknown attrDataType=%d\n",
-                          driverName, functionName, attrDataType);
-                return asynError;
-                break;
-        }
-
         if (attrDataType != NDAttrUndefined) {
-            asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-                "%s:%s : tagId: %d, tagString: %s\n",
-                  driverName, functionName, tagId, tagString);
-            fieldInfo_[count] = (TIFFFieldInfo*) malloc(sizeof(TIFFFieldInfo));
-            populateAsciiFieldInfo(fieldInfo_[count], tagId, attributeName);
-            TIFFMergeFieldInfo(output, fieldInfo_[count], 1);
-            TIFFSetField(this->output, tagId, tagString);
-            ++count;
-            ++tagId;
-            if ((tagId == TIFFTAG_END_) || (count > numAttributes_)) {
+            if (TIFFTAG_START_ + (int)this->tagNames_.size() == TIFFTAG_END_) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s error, Too many tags/attributes for file. tagId: %d, count: %d\n",
-                    driverName, functionName, tagId, count);
+                    "%s:%s error, Too many tags/attributes for file. count: %d\n",
+                    driverName, functionName, (int)this->tagNames_.size());
                 break;
             }
+            this->tagNames_.push_back(pAttribute->getName());
         }
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
+
+    this->fieldInfo_.clear();
+    this->fieldInfo_.push_back(NDTimeStampFI);
+    this->fieldInfo_.push_back(NDUniqueIdFI);
+    this->fieldInfo_.push_back(EPICSTSSecFI);
+    this->fieldInfo_.push_back(EPICSTSNsecFI);
+    for (size_t i=0; i<this->tagNames_.size(); ++i) {
+        TIFFFieldInfo fieldInfo;
+        populateAsciiFieldInfo(&fieldInfo, TIFFTAG_START_ + (int)i, this->tagNames_[i].c_str());
+        this->fieldInfo_.push_back(fieldInfo);
+    }
     
     return(asynSuccess);
 }
@@ -353,16 +351,196 @@ asynStatus NDFileTIFF::populateAsciiFieldInfo(TIFFFieldInfo *fieldInfo, int fiel
 
 }
 
+/**
+ * Formats an attribute as the "name:value" string of its custom ASCII tag.
+ * \param[in] pAttribute The attribute.
+ * \param[out] tagString The string, which is empty for an attribute with an undefined value.
+ * \param[in] tagSize The size of tagString.
+ */
+asynStatus NDFileTIFF::formatAttribute(NDAttribute *pAttribute, char *tagString, size_t tagSize)
+{
+    static const char *functionName = "formatAttribute";
+    const char *attributeName = pAttribute->getName();
+    char attrString[STRING_BUFFER_SIZE] = {0};
+    NDAttrDataType_t attrDataType;
+    size_t attrSize;
+    NDAttrValue value;
+
+    pAttribute->getValueInfo(&attrDataType, &attrSize);
+    memset(tagString, 0, tagSize);
+
+    switch (attrDataType) {
+        case NDAttrInt8:
+        case NDAttrUInt8:
+        case NDAttrInt16:
+        case NDAttrUInt16:
+        case NDAttrInt32:
+        case NDAttrUInt32: {
+            pAttribute->getValue(attrDataType, &value.i32);
+            epicsSnprintf(tagString, tagSize-1, "%s:%d", attributeName, value.i32);
+            break;
+        }
+        case NDAttrFloat32: {
+            pAttribute->getValue(attrDataType, &value.f32);
+            epicsSnprintf(tagString, tagSize-1, "%s:%f", attributeName, value.f32);
+            break;
+        }
+        case NDAttrFloat64: {
+            pAttribute->getValue(attrDataType, &value.f64);
+            epicsSnprintf(tagString, tagSize-1, "%s:%f", attributeName, value.f64);
+            break;
+        }
+        case NDAttrString: {
+            pAttribute->getValue(attrDataType, attrString, sizeof(attrString)-1);
+            epicsSnprintf(tagString, tagSize-1, "%s:%s", attributeName, attrString);
+            break;
+        }
+        case NDAttrUndefined:
+            break;
+        default:
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s error, unknown attrDataType=%d\n",
+                      driverName, functionName, attrDataType);
+            return asynError;
+            break;
+    }
+    return asynSuccess;
+}
+
+/** Sets the tags of the page that the next strips are written to.
+  * libtiff forgets the custom tags when it starts a new page, so they are merged again for each page.
+  * \param[in] pArray The array of the page.
+  */
+asynStatus NDFileTIFF::setPageTags(NDArray *pArray)
+{
+    static const char *functionName = "setPageTags";
+    NDAttribute *pAttribute = NULL;
+    char tagString[STRING_BUFFER_SIZE] = {0};
+    int tagId;
+    static const int compressionTags[] = {COMPRESSION_NONE, COMPRESSION_PACKBITS, COMPRESSION_ADOBE_DEFLATE};
+
+    TIFFMergeFieldInfo(this->output, &this->fieldInfo_[0], (int)this->fieldInfo_.size());
+    TIFFSetField(this->output, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
+    TIFFSetField(this->output, TIFFTAG_UNIQUEID, pArray->uniqueId);
+    TIFFSetField(this->output, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
+    TIFFSetField(this->output, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
+    TIFFSetField(this->output, TIFFTAG_BITSPERSAMPLE, this->bitsPerSample);
+    TIFFSetField(this->output, TIFFTAG_SAMPLEFORMAT, this->sampleFormat);
+    TIFFSetField(this->output, TIFFTAG_SAMPLESPERPIXEL, this->samplesPerPixel);
+    TIFFSetField(this->output, TIFFTAG_PHOTOMETRIC, this->photoMetric);
+    TIFFSetField(this->output, TIFFTAG_PLANARCONFIG, this->planarConfig);
+    TIFFSetField(this->output, TIFFTAG_IMAGEWIDTH, (epicsUInt32)this->sizeX);
+    TIFFSetField(this->output, TIFFTAG_IMAGELENGTH, (epicsUInt32)this->sizeY);
+    TIFFSetField(this->output, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)this->rowsPerStrip);
+    TIFFSetField(this->output, TIFFTAG_COMPRESSION, compressionTags[this->compression]);
+    if (this->multiPage) {
+        /* The number of pages is not known until the file is closed, which the TIFF specification allows as 0 */
+        TIFFSetField(this->output, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+        TIFFSetField(this->output, TIFFTAG_PAGENUMBER, this->numPages, 0);
+    }
+
+    this->pFileAttributes->clear();
+    this->getAttributes(this->pFileAttributes);
+    pArray->pAttributeList->copy(this->pFileAttributes);
+ 
+    pAttribute = this->pFileAttributes->find("Model");
+    if (pAttribute) {
+        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
+        TIFFSetField(this->output, TIFFTAG_MODEL, tagString);
+    } else {
+        TIFFSetField(this->output, TIFFTAG_MODEL, "Unknown");
+    }
+    
+    pAttribute = this->pFileAttributes->find("Manufacturer");
+    if (pAttribute) {
+        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
+        TIFFSetField(this->output, TIFFTAG_MAKE, tagString);
+    } else {
+        TIFFSetField(this->output, TIFFTAG_MAKE, "Unknown");
+    }
+
+    TIFFSetField(this->output, TIFFTAG_SOFTWARE, "EPICS areaDetector");
+
+    // If the attribute TIFFImageDescription exists use it to set the TIFFTAG_IMAGEDESCRIPTION
+    pAttribute = this->pFileAttributes->find("TIFFImageDescription");
+    if (pAttribute) {
+        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
+        TIFFSetField(this->output, TIFFTAG_IMAGEDESCRIPTION, tagString);
+    }
+
+    for (size_t i=0; i<this->tagNames_.size(); ++i) {
+        pAttribute = this->pFileAttributes->find(this->tagNames_[i].c_str());
+        if (!pAttribute) continue;
+        if (formatAttribute(pAttribute, tagString, sizeof(tagString))) continue;
+        if (tagString[0] == 0) continue;
+        tagId = TIFFTAG_START_ + (int)i;
+        asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
+            "%s:%s : tagId: %d, tagString: %s\n",
+              driverName, functionName, tagId, tagString);
+        TIFFSetField(this->output, tagId, tagString);
+    }
+
+    return asynSuccess;
+}
+
+/** Encodes one strip of the page being written; called by parallelForTasks() from writeFile().
+  * The strips of each plane are stripsPerPlane tasks apart.  A strip that can't be compressed gets the size 0.
+  * \param[in] pArg Pointer to the NDFileTIFF object.
+  * \param[in] task The number of the strip in the page.
+  */
+void NDFileTIFF::encodeStripTask(void *pArg, int task)
+{
+    NDFileTIFF *pPlugin = (NDFileTIFF *)pArg;
+    size_t plane = task / pPlugin->stripsPerPlane;
+    size_t firstRow = (task % pPlugin->stripsPerPlane) * pPlugin->rowsPerStrip;
+    size_t numRows = pPlugin->rowsPerStrip;
+    size_t rowBytes = pPlugin->rowBytes;
+    const char *pSrc;
+    char *pDest;
+    size_t row, encodedBytes = 0;
+
+    if (firstRow + numRows > pPlugin->sizeY) numRows = pPlugin->sizeY - firstRow;
+    if (pPlugin->colorMode == NDColorModeRGB2) {
+        /* The red, green and blue rows are interleaved, and each strip is one row */
+        pSrc = pPlugin->pPageData + (3*firstRow + plane) * rowBytes;
+    } else {
+        pSrc = pPlugin->pPageData + (plane * pPlugin->sizeY + firstRow) * rowBytes;
+    }
+    pPlugin->stripData[task] = pSrc;
+    pPlugin->stripSizes[task] = numRows * rowBytes;
+    if (pPlugin->compression == NDFileTIFFCompressNone) return;
+    pDest = &pPlugin->stripBuffer[0] + (size_t)task * pPlugin->stripBoundBytes;
+
+    if (pPlugin->compression == NDFileTIFFCompressPackBits) {
+        /* PackBits encodes each row separately */
+        for (row=0; row<numRows; row++) {
+            encodedBytes += packBitsRow((const unsigned char *)pSrc + row*rowBytes, rowBytes,
+                                        (unsigned char *)pDest + encodedBytes);
+        }
+    }
+#ifdef ND_WITH_ZLIB
+    if (pPlugin->compression == NDFileTIFFCompressDeflate) {
+        uLongf destLen = (uLongf)pPlugin->stripBoundBytes;
+        if (compress2((Bytef *)pDest, &destLen, (const Bytef *)pSrc, (uLong)(numRows * rowBytes),
+                      Z_DEFAULT_COMPRESSION) == Z_OK) {
+            encodedBytes = destLen;
+        }
+    }
+#endif
+    pPlugin->stripData[task] = pDest;
+    pPlugin->stripSizes[task] = encodedBytes;
+}
+
 
 /** Writes single NDArray to the TIFF file.
+  * The strips of the array are encoded in parallel and then written with TIFFWriteRawStrip.
+  * In a multi-page file each array is a page.
   * \param[in] pArray Pointer to the NDArray to be written
   */
 asynStatus NDFileTIFF::writeFile(NDArray *pArray)
 {
-    unsigned long stripSize;
     tsize_t nwrite=0;
-    int strip, sizeY;
-    unsigned char *pRed, *pGreen, *pBlue;
+    int strip, numStrips;
     static const char *functionName = "writeFile";
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -376,36 +554,21 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
         return(asynError);
     }
 
-    stripSize = (unsigned long)TIFFStripSize(this->output);
-    TIFFGetField(this->output, TIFFTAG_IMAGELENGTH, &sizeY);
+    if (setPageTags(pArray)) return(asynError);
 
-    switch (this->colorMode) {
-        case NDColorModeMono:
-        case NDColorModeRGB1:
-            nwrite = TIFFWriteEncodedStrip(this->output, 0, pArray->pData, stripSize); 
-            break;
-        case NDColorModeRGB2:
-            /* TIFF readers don't support row interleave, put all the red strips first, then all the blue, then green. */
-            for (strip=0; strip<sizeY; strip++) {
-                pRed   = (unsigned char *)pArray->pData + 3*strip*stripSize;
-                pGreen = pRed + stripSize;
-                pBlue  = pRed + 2*stripSize;
-                nwrite = TIFFWriteEncodedStrip(this->output, strip, pRed, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->output, sizeY+strip, pBlue, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->output, 2*sizeY+strip, pGreen, stripSize);
-            }
-            break;
-        case NDColorModeRGB3:
-            for (strip=0; strip<3; strip++) {
-                nwrite = TIFFWriteEncodedStrip(this->output, strip, (unsigned char *)pArray->pData+stripSize*strip, stripSize);
-            }
-            break;
-        default:
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s:%s: unknown color mode %d\n",
-                driverName, functionName, this->colorMode);
+    this->pPageData = (const char *)pArray->pData;
+    numStrips = this->numPlanes * this->stripsPerPlane;
+    this->parallelForTasks(encodeStripTask, this, numStrips);
+
+    for (strip=0; strip<numStrips; strip++) {
+        if (this->stripSizes[strip] == 0) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error compressing strip %d\n",
+                driverName, functionName, strip);
             return(asynError);
-            break;
+        }
+        nwrite = TIFFWriteRawStrip(this->output, strip, (void *)this->stripData[strip], this->stripSizes[strip]);
+        if (nwrite <= 0) break;
     }
     if (nwrite <= 0) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -414,6 +577,17 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
         return(asynError);
     }
 
+    /* A single image is written when the file is closed */
+    if (this->multiPage) {
+        if (!TIFFWriteDirectory(this->output)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error writing page %d to file\n",
+                driverName, functionName, this->numPages);
+            return(asynError);
+        }
+        this->numPages++;
+    }
+
     return(asynSuccess);
 }
 
@@ -444,16 +618,57 @@ asynStatus NDFileTIFF::closeFile()
         "%s::%s closing file\n", 
         driverName, functionName);
     TIFFClose(this->output);
-
-    for (int i=0; i<numAttributes_; ++i) {
-      free(fieldInfo_[i]);
-    }
-    free(fieldInfo_);
+    this->output = NULL;
 
     return asynSuccess;
 }
 
-
+/** Called when asyn clients call pasynInt32->write().
+  * This function performs actions for some parameters.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileTIFF::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0, capture = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_TIFF_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    getIntegerParam(NDFileCapture, &capture);
+    if (function == NDFileTIFFCompression) {
+        if ((value < NDFileTIFFCompressNone) || (value > NDFileTIFFCompressDeflate)) status = asynError;
+#ifndef ND_WITH_ZLIB
+        if (value == NDFileTIFFCompressDeflate) status = asynError;
+#endif
+    } else if (function == NDFileTIFFRowsPerStrip) {
+        if (value < 0) status = asynError;
+    } else if (function == NDFileTIFFMultiPage) {
+        /* NDPluginFile decides from this whether it opens a file for each array */
+        if (capture) status = asynError;
+        else this->supportsMultipleArrays = value ? 1 : 0;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+
 /** Constructor for NDFileTIFF; all parameters are simply passed to NDPluginFile::NDPluginFile.
   * \param[in] portName The name of the asyn port driver to be created.
   * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when 
@@ -485,6 +700,16 @@ NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallback
     setStringParam(NDPluginDriverPluginType, "NDFileTIFF");
     this->supportsMultipleArrays = 0;
 
+    createParam(NDFileTIFFCompressionString,  asynParamInt32, &NDFileTIFFCompression);
+    createParam(NDFileTIFFRowsPerStripString, asynParamInt32, &NDFileTIFFRowsPerStrip);
+    createParam(NDFileTIFFMultiPageString,    asynParamInt32, &NDFileTIFFMultiPage);
+    setIntegerParam(NDFileTIFFCompression, NDFileTIFFCompressNone);
+    setIntegerParam(NDFileTIFFRowsPerStrip, 0);
+    setIntegerParam(NDFileTIFFMultiPage, 0);
+
+    this->output = NULL;
+    this->multiPage = false;
+    this->numPages = 0;
     this->pAttributeId = NULL;
     this->pFileAttributes = new NDAttributeList;
 }
@@ -8,6 +8,9 @@
 #ifndef DRV_NDFileTIFF_H
 #define DRV_NDFileTIFF_H
 
+#include <string>
+#include <vector>
+
 #include "NDPluginFile.h"
 #include "tiffio.h"
 
@@ -15,10 +18,24 @@
  * to handle changes in the file contents */
 #define NDTIFFFileVersion 1.0
 
+#define NDFileTIFFCompressionString  "TIFF_COMPRESSION"     /* (asynInt32, r/w) Compression of the strips, see NDFileTIFFCompress_t */
+#define NDFileTIFFRowsPerStripString "TIFF_ROWS_PER_STRIP"  /* (asynInt32, r/w) Rows in each strip, 0 for automatic */
+#define NDFileTIFFMultiPageString    "TIFF_MULTI_PAGE"      /* (asynInt32, r/w) Write the frames of Capture and Stream mode
+                                                             * as the pages of one BigTIFF file (1=Yes, 0=No) */
+
+/** Compression of the strips of the TIFF files */
+typedef enum {
+    NDFileTIFFCompressNone,
+    NDFileTIFFCompressPackBits,
+    NDFileTIFFCompressDeflate
+} NDFileTIFFCompress_t;
+
 /** Writes NDArrays in the TIFF file format.
     Tagged Image File Format is a file format for storing images.  The format was originally created by Aldus corporation and is
     currently developed by Adobe Systems Incorporated.  This plugin was developed using the libtiff library to write the file.
-    The current version is only capable of writing 2-D images with one image per file.
+    It writes 2-D images, with one image per file or, with MultiPage=Yes, all of the images of Capture and Stream
+    mode as the pages of one BigTIFF file.  Each image is split into strips, which are compressed in parallel
+    in the IntraFrameThreads threads of the plugin.
     */
 
 class epicsShareClass NDFileTIFF : public NDPluginFile {
@@ -32,19 +49,47 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileTIFFCompression;
+    #define FIRST_NDFILE_TIFF_PARAM NDFileTIFFCompression
+    int NDFileTIFFRowsPerStrip;
+    int NDFileTIFFMultiPage;
 
 private:
     TIFF *output;
     NDColorMode_t colorMode;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
-    TIFFFieldInfo **fieldInfo_;
-    int numAttributes_;
+    std::vector<TIFFFieldInfo> fieldInfo_;  /* The custom tags of the file, merged again for each page */
+    std::vector<std::string> tagNames_;     /* The names of the attributes that the custom ASCII tags hold */
+
+    /* The layout of the pages of the file, which is the same for every page */
+    size_t sizeX, sizeY;
+    int bitsPerSample, sampleFormat, samplesPerPixel, photoMetric, planarConfig;
+    size_t rowsPerStrip;
+    size_t rowBytes;                        /* The size of one row of one plane */
+    int stripsPerPlane;
+    int numPlanes;
+    int compression;
+    int numPages;
+    bool multiPage;
+
+    /* The strips of the page being written, which encodeStripTask() fills in */
+    std::vector<char> stripBuffer;          /* The encoded strips, stripBoundBytes apart */
+    size_t stripBoundBytes;
+    std::vector<const char *> stripData;
+    std::vector<size_t> stripSizes;
+    const char *pPageData;
 
     static const int TIFFTAG_START_;
     static const int TIFFTAG_END_;
 
     asynStatus populateAsciiFieldInfo(TIFFFieldInfo *fieldInfo, int fieldTag, const char *tagName);
+    asynStatus formatAttribute(NDAttribute *pAttribute, char *tagString, size_t tagSize);
+    asynStatus setPageTags(NDArray *pArray);
+    static void encodeStripTask(void *pArg, int task);
 
 };
 
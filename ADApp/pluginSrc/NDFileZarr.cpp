@@ -0,0 +1,516 @@
+/* NDFileZarr.cpp
+ * Writes NDArrays to Zarr version 3 stores.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDFileZarr.h"
+
+static const char *driverName = "NDFileZarr";
+
+/** Writes a 1-D array of one value for each frame, in one chunk, to a group of the store */
+static int writeValues(const std::string& path, NDDataType_t dataType, const void *pValues, size_t numValues,
+                       const NDZarrCompression_t& compression)
+{
+    NDZarrArray array;
+    std::vector<size_t> shape(1, numValues);
+    std::vector<size_t> chunkIndex(1, 0);
+    std::vector<char> buffer;
+
+    if (array.create(path, dataType, shape, shape, compression, "{}")) return ND_ERROR;
+    return array.writeChunk(chunkIndex, pValues, buffer);
+}
+
+/** Creates a Zarr store and the "data" array for the NDArrays.
+  * \param[in] fileName The directory of the store.
+  * \param[in] openMode Mask defining how the file should be opened; bits are 
+  *            NDFileModeRead, NDFileModeWrite, NDFileModeAppend, NDFileModeMultiple
+  * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  */
+asynStatus NDFileZarr::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
+{
+    std::vector<size_t> shape, chunkShape;
+    std::string attributes = "{";
+    NDAttribute *pAttribute;
+    NDAttrDataType_t attrDataType;
+    size_t attrSize;
+    NDArrayInfo_t info;
+    std::string value;
+    int nRowChunks, nColChunks, nFramesChunks, codec;
+    int fileWriteMode, numCapture;
+    size_t numChunks, size, chunk;
+    int i;
+    static const char *functionName = "openFile";
+
+    /* We don't support reading */
+    if (openMode & NDFileModeRead) return asynError;
+
+    /* We don't support opening an existing store for appending */
+    if (openMode & NDFileModeAppend) return asynError;
+
+    if (!storePath.empty()) closeFile();
+
+    this->lock();
+    getIntegerParam(NDFileZarrNRowChunks, &nRowChunks);
+    getIntegerParam(NDFileZarrNColChunks, &nColChunks);
+    getIntegerParam(NDFileZarrNFramesChunks, &nFramesChunks);
+    getIntegerParam(NDFileZarrCompressor, &codec);
+    getIntegerParam(NDFileZarrCompressLevel, &compression.level);
+    getIntegerParam(NDFileZarrBloscCompressor, &compression.bloscCompressor);
+    getIntegerParam(NDFileZarrBloscShuffle, &compression.bloscShuffle);
+    getIntegerParam(NDFileWriteMode, &fileWriteMode);
+    getIntegerParam(NDFileNumCapture, &numCapture);
+    this->unlock();
+    compression.codec = (NDZarrCodec_t)codec;
+
+    /* A chunk of more frames than the store will hold would only be padding */
+    if (!(openMode & NDFileModeMultiple) || (nFramesChunks < 1)) nFramesChunks = 1;
+    if ((fileWriteMode == NDFileModeCapture) && (numCapture > 0) && (nFramesChunks > numCapture)) {
+        nFramesChunks = numCapture;
+    }
+
+    pArray->getInfo(&info);
+    dataType = pArray->dataType;
+    ndims = pArray->ndims;
+    frameBytes = info.totalBytes;
+    shape.push_back(0);
+    chunkShape.push_back(nFramesChunks);
+    for (i=ndims-1; i>=0; i--) {
+        dims[i] = pArray->dims[i].size;
+        size = dims[i];
+        chunk = size;
+        if ((i == 0) && (nColChunks > 0) && ((size_t)nColChunks < size)) chunk = nColChunks;
+        if ((i == 1) && (nRowChunks > 0) && ((size_t)nRowChunks < size)) chunk = nRowChunks;
+        shape.push_back(size);
+        chunkShape.push_back(chunk);
+    }
+
+    /* The attributes of the first array, and the numeric attributes that are recorded for every array */
+    attributeNames.clear();
+    pAttribute = pArray->pAttributeList->next(NULL);
+    while (pAttribute) {
+        pAttribute->getValueInfo(&attrDataType, &attrSize);
+        if (attrDataType != NDAttrUndefined) {
+            if (attributes.size() > 1) attributes += ", ";
+            NDZarrJsonString(attributes, pAttribute->getName());
+            attributes += ": ";
+            if (attrDataType == NDAttrString) {
+                pAttribute->getValue(value);
+                NDZarrJsonString(attributes, value);
+            } else {
+                epicsFloat64 number;
+                pAttribute->getValue(NDAttrFloat64, &number);
+                NDZarrJsonNumber(attributes, number);
+                attributeNames.push_back(pAttribute->getName());
+            }
+        }
+        pAttribute = pArray->pAttributeList->next(pAttribute);
+    }
+    attributes += "}";
+
+    if (NDZarrWriteGroup(fileName, "{}") ||
+        dataArray.create(std::string(fileName) + "/data", dataType, shape, chunkShape, compression, attributes) ||
+        NDZarrWriteGroup(std::string(fileName) + "/NDAttributes", "{}")) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating store %s\n",
+            driverName, functionName, fileName);
+        return asynError;
+    }
+
+    /* The chunks of one block of nFramesChunks frames */
+    gridShape.assign(1, 1);
+    numChunks = 1;
+    for (i=1; i<(int)shape.size(); i++) {
+        gridShape.push_back((shape[i] + chunkShape[i] - 1) / chunkShape[i]);
+        numChunks *= gridShape[i];
+    }
+    chunkBuffers.resize(numChunks);
+    compressBuffers.resize(numChunks);
+    if (nFramesChunks > 1) blockBuffer.resize(nFramesChunks * frameBytes);
+    pBlock = NULL;
+    numFrames = 0;
+    blockFrames = 0;
+    blockIndex = 0;
+    attributeValues.assign(attributeNames.size(), std::vector<epicsFloat64>());
+    uniqueIds.clear();
+    timeStamps.clear();
+    secPastEpoch.clear();
+    nsec.clear();
+    storePath = fileName;
+    return asynSuccess;
+}
+
+/** Adds an NDArray to the block of frames being filled, and writes the block when it is full.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileZarr::writeFile(NDArray *pArray)
+{
+    NDAttribute *pAttribute;
+    NDAttrDataType_t attrDataType;
+    size_t attrSize;
+    epicsFloat64 value;
+    bool differs;
+    size_t i;
+    static const char *functionName = "writeFile";
+
+    if (storePath.empty()) return asynError;
+    differs = (pArray->dataType != dataType) || (pArray->ndims != ndims);
+    for (i=0; i<(size_t)ndims && !differs; i++) {
+        if (pArray->dims[i].size != dims[i]) differs = true;
+    }
+    if (differs) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s array uniqueId=%d has a different type or dimensions from the first array of the store\n",
+            driverName, functionName, pArray->uniqueId);
+        return asynError;
+    }
+
+    /* A block of one frame is compressed from the array itself */
+    if (blockBuffer.empty()) {
+        pBlock = (const char *)pArray->pData;
+    } else {
+        memcpy(&blockBuffer[blockFrames * frameBytes], pArray->pData, frameBytes);
+        pBlock = &blockBuffer[0];
+    }
+
+    for (i=0; i<attributeNames.size(); i++) {
+        value = NAN;
+        pAttribute = pArray->pAttributeList->find(attributeNames[i].c_str());
+        if (pAttribute) {
+            pAttribute->getValueInfo(&attrDataType, &attrSize);
+            if ((attrDataType != NDAttrString) && (attrDataType != NDAttrUndefined)) {
+                pAttribute->getValue(NDAttrFloat64, &value);
+            }
+        }
+        attributeValues[i].push_back(value);
+    }
+    uniqueIds.push_back(pArray->uniqueId);
+    timeStamps.push_back(pArray->timeStamp);
+    secPastEpoch.push_back(pArray->epicsTS.secPastEpoch);
+    nsec.push_back(pArray->epicsTS.nsec);
+
+    blockFrames++;
+    numFrames++;
+    if (blockFrames == dataArray.chunkShape()[0]) return writeBlock();
+    return asynSuccess;
+}
+
+/** Gathers, compresses and writes one chunk of the block, for parallelForTasks().  Each task writes only its
+  * own chunk, to its own file. */
+void NDFileZarr::writeChunkTask(void *pArg, int task)
+{
+    NDFileZarr *pPlugin = (NDFileZarr *)pArg;
+    NDZarrArray *pArray = &pPlugin->dataArray;
+    const std::vector<size_t>& chunkShape = pArray->chunkShape();
+    const std::vector<size_t>& shape = pArray->shape();
+    size_t rank = chunkShape.size();
+    size_t elementSize = pArray->elementSize();
+    std::vector<size_t> index(rank), start(rank), count(rank), blockShape(rank), position(rank, 0);
+    std::vector<char>& chunk = pPlugin->chunkBuffers[task];
+    const char *pSrc;
+    size_t remainder = task;
+    size_t srcOffset, destOffset, srcStride, destStride;
+    bool whole = true, contiguous = true, covered = false;
+    int d;
+
+    /* The position of the chunk in the block, last dimension fastest */
+    blockShape[0] = chunkShape[0];
+    for (d=1; d<(int)rank; d++) blockShape[d] = shape[d];
+    for (d=(int)rank-1; d>=0; d--) {
+        index[d] = remainder % pPlugin->gridShape[d];
+        remainder /= pPlugin->gridShape[d];
+        start[d] = index[d] * chunkShape[d];
+        count[d] = chunkShape[d];
+        if (start[d] + count[d] > blockShape[d]) {
+            count[d] = blockShape[d] - start[d];
+            whole = false;
+        }
+    }
+    index[0] = pPlugin->blockIndex;
+
+    /* A whole chunk that is 1 element in the slower dimensions, and all of the faster dimensions after the
+     * first that it splits, is a contiguous part of the block that is compressed where it is */
+    for (d=(int)rank-1; d>=0; d--) {
+        if (covered && (count[d] != 1)) contiguous = false;
+        if (count[d] != blockShape[d]) covered = true;
+    }
+    if (whole && contiguous) {
+        srcOffset = 0;
+        srcStride = elementSize;
+        for (d=(int)rank-1; d>=0; d--) {
+            srcOffset += start[d] * srcStride;
+            srcStride *= blockShape[d];
+        }
+        pSrc = pPlugin->pBlock + srcOffset;
+    } else {
+        /* Copy the rows of the chunk, with the parts outside the array 0 */
+        chunk.assign(pArray->chunkBytes(), 0);
+        while (true) {
+            srcOffset = 0;
+            destOffset = 0;
+            srcStride = elementSize;
+            destStride = elementSize;
+            for (d=(int)rank-1; d>=0; d--) {
+                srcOffset += (start[d] + position[d]) * srcStride;
+                destOffset += position[d] * destStride;
+                srcStride *= blockShape[d];
+                destStride *= chunkShape[d];
+            }
+            memcpy(&chunk[destOffset], pPlugin->pBlock + srcOffset, count[rank-1] * elementSize);
+            for (d=(int)rank-2; d>=0; d--) {
+                if (++position[d] < count[d]) break;
+                position[d] = 0;
+            }
+            if (d < 0) break;
+        }
+        pSrc = &chunk[0];
+    }
+    pPlugin->chunkStatus[task] = pArray->writeChunk(index, pSrc, pPlugin->compressBuffers[task]);
+}
+
+/** Writes the chunks of the block of frames being filled; the frames of a partly filled block that have not
+  * been written are 0. */
+asynStatus NDFileZarr::writeBlock()
+{
+    size_t numChunks = chunkBuffers.size();
+    size_t i;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeBlock";
+
+    if (blockFrames == 0) return asynSuccess;
+    if (!blockBuffer.empty() && (blockFrames < dataArray.chunkShape()[0])) {
+        memset(&blockBuffer[blockFrames * frameBytes], 0, blockBuffer.size() - blockFrames * frameBytes);
+    }
+    chunkStatus.assign(numChunks, ND_SUCCESS);
+    this->parallelForTasks(writeChunkTask, this, (int)numChunks);
+    for (i=0; i<numChunks; i++) {
+        if (chunkStatus[i] != ND_SUCCESS) status = asynError;
+    }
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error writing the chunks of frames %lu to %lu\n",
+            driverName, functionName, (unsigned long)(numFrames - blockFrames), (unsigned long)(numFrames - 1));
+    }
+    blockIndex++;
+    blockFrames = 0;
+    return status;
+}
+
+/** Writes the arrays of the uniqueId, time stamps and numeric attributes of the frames to the group
+  * "NDAttributes" */
+asynStatus NDFileZarr::writeAttributeArrays()
+{
+    std::string group = storePath + "/NDAttributes/";
+    int status = ND_SUCCESS;
+    size_t i;
+
+    if (numFrames == 0) return asynSuccess;
+    status |= writeValues(group + "NDArrayUniqueId", NDInt32, &uniqueIds[0], numFrames, compression);
+    status |= writeValues(group + "NDArrayTimeStamp", NDFloat64, &timeStamps[0], numFrames, compression);
+    status |= writeValues(group + "NDArrayEpicsTSSec", NDUInt32, &secPastEpoch[0], numFrames, compression);
+    status |= writeValues(group + "NDArrayEpicsTSnSec", NDUInt32, &nsec[0], numFrames, compression);
+    for (i=0; i<attributeNames.size(); i++) {
+        status |= writeValues(group + NDZarrNodeName(attributeNames[i]), NDFloat64, &attributeValues[i][0],
+                              numFrames, compression);
+    }
+    return status ? asynError : asynSuccess;
+}
+
+/** Reads single NDArray from a Zarr store; NOT CURRENTLY IMPLEMENTED.
+  * \param[in] pArray Pointer to the NDArray to be read
+  */
+asynStatus NDFileZarr::readFile(NDArray **pArray)
+{
+    return asynError;
+}
+
+/** Writes the last block of frames, the shape of the "data" array and the attribute arrays, and closes the
+  * store. */
+asynStatus NDFileZarr::closeFile()
+{
+    std::vector<size_t> shape;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "closeFile";
+
+    if (storePath.empty()) return asynSuccess;
+    if (writeBlock()) status = asynError;
+    shape = dataArray.shape();
+    shape[0] = numFrames;
+    dataArray.setShape(shape);
+    if (dataArray.writeMetadata()) status = asynError;
+    if (writeAttributeArrays()) status = asynError;
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error closing store %s\n",
+            driverName, functionName, storePath.c_str());
+    }
+    storePath.clear();
+    pBlock = NULL;
+    std::vector<char>().swap(blockBuffer);
+    chunkBuffers.clear();
+    compressBuffers.clear();
+    return status;
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks the chunk sizes, and that the compressor is one that this build supports.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileZarr::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDFILE_ZARR_PARAM) return NDPluginFile::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if ((function == NDFileZarrNRowChunks) ||
+        (function == NDFileZarrNColChunks) ||
+        (function == NDFileZarrNFramesChunks)) {
+        if (value < 0) status = asynError;
+    } else if (function == NDFileZarrCompressor) {
+        switch (value) {
+            case NDZarrCodecNone:
+                break;
+#ifdef ND_WITH_BLOSC
+            case NDZarrCodecBlosc:
+                break;
+#endif
+#ifdef ND_WITH_ZSTD
+            case NDZarrCodecZstd:
+                break;
+#endif
+#ifdef ND_WITH_ZLIB
+            case NDZarrCodecGzip:
+                break;
+#endif
+            default:
+                status = asynError;
+        }
+    } else if (function == NDFileZarrBloscCompressor) {
+        if ((value < 0) || (value > 5)) status = asynError;
+    } else if (function == NDFileZarrBloscShuffle) {
+        if ((value < 0) || (value > 2)) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDFileZarr; all parameters are simply passed to NDPluginFile::NDPluginFile.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when 
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDFileZarr::NDFileZarr(const char *portName, int queueSize, int blockingCallbacks,
+                       const char *NDArrayPort, int NDArrayAddr,
+                       int priority, int stackSize)
+    /* Invoke the base class constructor.
+     * We allocate 2 NDArrays of unlimited size in the NDArray pool.
+     * This driver can block (because writing a file can be slow), and it is not multi-device.  
+     * Set autoconnect to 1.  priority and stacksize can be 0, which will use defaults. */
+    : NDPluginFile(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1,
+                   2, 0, asynGenericPointerMask, asynGenericPointerMask, 
+                   ASYN_CANBLOCK, 1, priority, stackSize, 1),
+      dataType(NDUInt8), ndims(0), frameBytes(0), numFrames(0), blockFrames(0), blockIndex(0), pBlock(NULL)
+{
+    //static const char *functionName = "NDFileZarr";
+
+    createParam(NDFileZarrNRowChunksString,      asynParamInt32, &NDFileZarrNRowChunks);
+    createParam(NDFileZarrNColChunksString,      asynParamInt32, &NDFileZarrNColChunks);
+    createParam(NDFileZarrNFramesChunksString,   asynParamInt32, &NDFileZarrNFramesChunks);
+    createParam(NDFileZarrCompressorString,      asynParamInt32, &NDFileZarrCompressor);
+    createParam(NDFileZarrCompressLevelString,   asynParamInt32, &NDFileZarrCompressLevel);
+    createParam(NDFileZarrBloscCompressorString, asynParamInt32, &NDFileZarrBloscCompressor);
+    createParam(NDFileZarrBloscShuffleString,    asynParamInt32, &NDFileZarrBloscShuffle);
+
+    /* Set the plugin type string */    
+    setStringParam(NDPluginDriverPluginType, "NDFileZarr");
+    setIntegerParam(NDFileZarrNRowChunks, 0);
+    setIntegerParam(NDFileZarrNColChunks, 0);
+    setIntegerParam(NDFileZarrNFramesChunks, 1);
+    setIntegerParam(NDFileZarrCompressor, NDZarrCodecNone);
+    setIntegerParam(NDFileZarrCompressLevel, 3);
+    setIntegerParam(NDFileZarrBloscCompressor, 1);
+    setIntegerParam(NDFileZarrBloscShuffle, 1);
+    memset(&compression, 0, sizeof(compression));
+    memset(dims, 0, sizeof(dims));
+    this->supportsMultipleArrays = 1;
+}
+
+/* Configuration routine.  Called directly, or from the iocsh  */
+
+extern "C" int NDFileZarrConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                   const char *NDArrayPort, int NDArrayAddr,
+                                   int priority, int stackSize)
+{
+    NDFileZarr *pPlugin = new NDFileZarr(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                         priority, stackSize);
+    return pPlugin->start();
+}
+
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArray Port",iocshArgString};
+static const iocshArg initArg4 = { "NDArray Addr",iocshArgInt};
+static const iocshArg initArg5 = { "priority",iocshArgInt};
+static const iocshArg initArg6 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6};
+static const iocshFuncDef initFuncDef = {"NDFileZarrConfigure",7,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDFileZarrConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].sval, args[4].ival, args[5].ival, args[6].ival);
+}
+
+extern "C" void NDFileZarrRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDFileZarrRegister);
+}
@@ -0,0 +1,84 @@
+/*
+ * NDFileZarr.h
+ * Writes NDArrays to Zarr version 3 stores, for readers on object stores and parallel file systems.
+ */
+
+#ifndef DRV_NDFileZarr_H
+#define DRV_NDFileZarr_H
+
+#include <vector>
+#include <string>
+
+#include "NDPluginFile.h"
+#include "NDZarrStore.h"
+
+#define NDFileZarrNRowChunksString       "ZARR_N_ROW_CHUNKS"       /* (asynInt32, r/w) Rows of a chunk, 0 for all */
+#define NDFileZarrNColChunksString       "ZARR_N_COL_CHUNKS"       /* (asynInt32, r/w) Columns of a chunk, 0 for all */
+#define NDFileZarrNFramesChunksString    "ZARR_N_FRAMES_CHUNKS"    /* (asynInt32, r/w) Frames of a chunk */
+#define NDFileZarrCompressorString       "ZARR_COMPRESSOR"         /* (asynInt32, r/w) NDZarrCodec_t of the chunks */
+#define NDFileZarrCompressLevelString    "ZARR_COMPRESS_LEVEL"     /* (asynInt32, r/w) Compression level */
+#define NDFileZarrBloscCompressorString  "ZARR_BLOSC_COMPRESSOR"   /* (asynInt32, r/w) Compressor of blosc */
+#define NDFileZarrBloscShuffleString     "ZARR_BLOSC_SHUFFLE"      /* (asynInt32, r/w) Shuffle of blosc */
+
+/** Writes NDArrays to Zarr version 3 stores.
+  * The store is a directory with the file name.  The arrays are in the array "data", with the frame number as
+  * the slowest dimension followed by the NDArray dimensions in reverse order, as in NDFileHDF5.  The chunks
+  * hold NumColChunks of dims[0], NumRowChunks of dims[1], all of the other dimensions, and NumFramesChunks
+  * frames; 0 is the whole dimension.  The attributes of the first array are the attributes of "data", and the
+  * values of the numeric attributes of every array, and its uniqueId and time stamps, are the arrays in the
+  * group "NDAttributes".  The chunks of a block of NumFramesChunks frames are compressed and written at the
+  * same time in the IntraFrameThreads threads, each to its own file.
+  */
+class epicsShareClass NDFileZarr : public NDPluginFile {
+public:
+    NDFileZarr(const char *portName, int queueSize, int blockingCallbacks,
+               const char *NDArrayPort, int NDArrayAddr,
+               int priority, int stackSize);
+
+    /* The methods that this class implements */
+    virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
+    virtual asynStatus readFile(NDArray **pArray);
+    virtual asynStatus writeFile(NDArray *pArray);
+    virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileZarrNRowChunks;
+    #define FIRST_NDFILE_ZARR_PARAM NDFileZarrNRowChunks
+    int NDFileZarrNColChunks;
+    int NDFileZarrNFramesChunks;
+    int NDFileZarrCompressor;
+    int NDFileZarrCompressLevel;
+    int NDFileZarrBloscCompressor;
+    int NDFileZarrBloscShuffle;
+
+private:
+    asynStatus writeBlock();
+    asynStatus writeAttributeArrays();
+    static void writeChunkTask(void *pArg, int task);
+
+    std::string storePath;        /**< The directory of the open store; empty if no store is open */
+    NDZarrArray dataArray;
+    NDZarrCompression_t compression;
+    NDDataType_t dataType;
+    int ndims;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    size_t frameBytes;
+    size_t numFrames;             /**< The frames written to the store */
+    size_t blockFrames;           /**< The frames in the block being filled */
+    size_t blockIndex;            /**< The index of the block being filled in the frame dimension */
+    const char *pBlock;           /**< The data of the block: blockBuffer, or the array when a block is 1 frame */
+    std::vector<char> blockBuffer;
+    std::vector<size_t> gridShape;  /**< The number of chunks in each dimension of a block */
+    std::vector<std::vector<char> > chunkBuffers;     /**< The gathered chunk of each task */
+    std::vector<std::vector<char> > compressBuffers;  /**< The compressed chunk of each task */
+    std::vector<int> chunkStatus;
+    std::vector<std::string> attributeNames;          /**< The numeric attributes of the first array */
+    std::vector<std::vector<epicsFloat64> > attributeValues;
+    std::vector<epicsInt32> uniqueIds;
+    std::vector<epicsFloat64> timeStamps;
+    std::vector<epicsUInt32> secPastEpoch;
+    std::vector<epicsUInt32> nsec;
+};
+
+#endif
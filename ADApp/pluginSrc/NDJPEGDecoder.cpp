@@ -0,0 +1,178 @@
+/** NDJPEGDecoder.cpp
+ *
+ * Decompresses JPEG images in memory into NDArrays, for NDPluginCodec.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "NDJPEGDecoder.h"
+#include "jerror.h"
+
+static const char *driverName = "NDJPEGDecoder";
+
+/** The end of image marker that is returned if the image is truncated, as libjpeg's own sources do */
+static const JOCTET eoiMarker[2] = {0xFF, JPEG_EOI};
+
+static NDJPEGDecoder *decoderOf(j_common_ptr cinfo)
+{
+    return (NDJPEGDecoder *)cinfo->client_data;
+}
+
+static void init_source(j_decompress_ptr cinfo)
+{
+    decoderOf((j_common_ptr)cinfo)->initSource();
+}
+
+static boolean fill_input_buffer(j_decompress_ptr cinfo)
+{
+    return decoderOf((j_common_ptr)cinfo)->fillInputBuffer();
+}
+
+static void skip_input_data(j_decompress_ptr cinfo, long numBytes)
+{
+    decoderOf((j_common_ptr)cinfo)->skipInputData(numBytes);
+}
+
+static void term_source(j_decompress_ptr cinfo)
+{
+}
+
+static void error_exit(j_common_ptr cinfo)
+{
+    decoderOf(cinfo)->errorExit();
+}
+
+NDJPEGDecoder::NDJPEGDecoder()
+  : pJpeg_(NULL), jpegSize_(0)
+{
+    memset(&jpegInfo_, 0, sizeof(jpegInfo_));
+    jpegInfo_.err = jpeg_std_error(&errorMgr_);
+    errorMgr_.error_exit = error_exit;
+    jpegInfo_.client_data = this;
+    jpeg_create_decompress(&jpegInfo_);
+
+    sourceMgr_.init_source = init_source;
+    sourceMgr_.fill_input_buffer = fill_input_buffer;
+    sourceMgr_.skip_input_data = skip_input_data;
+    sourceMgr_.resync_to_restart = jpeg_resync_to_restart;
+    sourceMgr_.term_source = term_source;
+    jpegInfo_.src = &sourceMgr_;
+}
+
+NDJPEGDecoder::~NDJPEGDecoder()
+{
+    jpeg_destroy_decompress(&jpegInfo_);
+}
+
+/** Decompresses a JPEG image into the data of an NDArray.
+  * \param[in] pJpeg The image.
+  * \param[in] jpegSize The size of the image in bytes.
+  * \param[out] pArray The array; 8-bit data, either 2-D for a Mono image or 3-D RGB1 for an RGB image, whose
+  *             dimensions must be those of the image.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDJPEGDecoder::decode(const unsigned char *pJpeg, size_t jpegSize, NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t sizeX, sizeY;
+    int components;
+    static const char *functionName = "decode";
+
+    if ((pArray->dataType != NDInt8) && (pArray->dataType != NDUInt8)) {
+        printf("%s:%s: only 8-bit data is supported\n", driverName, functionName);
+        return ND_ERROR;
+    }
+    if (pArray->ndims == 2) {
+        sizeX = pArray->dims[0].size;
+        sizeY = pArray->dims[1].size;
+        components = 1;
+    } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3)) {
+        sizeX = pArray->dims[1].size;
+        sizeY = pArray->dims[2].size;
+        components = 3;
+    } else {
+        printf("%s:%s: unsupported array structure\n", driverName, functionName);
+        return ND_ERROR;
+    }
+    pArray->getInfo(&arrayInfo);
+    if (pArray->dataSize < arrayInfo.totalBytes) {
+        printf("%s:%s: the array is too small\n", driverName, functionName);
+        return ND_ERROR;
+    }
+    pJpeg_ = pJpeg;
+    jpegSize_ = jpegSize;
+    return decompress((unsigned char *)pArray->pData, sizeX, sizeY, components);
+}
+
+/** Runs libjpeg on the image that decode() has described, checking that it has the size of the array.
+  * A libjpeg error returns here through errorExit(), so this function must not have local objects with
+  * destructors. */
+int NDJPEGDecoder::decompress(unsigned char *pData, size_t sizeX, size_t sizeY, int components)
+{
+    JSAMPROW rowPointer[1];
+    static const char *functionName = "decompress";
+
+    if (setjmp(errorJump_)) {
+        jpeg_abort_decompress(&jpegInfo_);
+        return ND_ERROR;
+    }
+    jpeg_read_header(&jpegInfo_, TRUE);
+    jpegInfo_.out_color_space = (components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&jpegInfo_);
+    if ((jpegInfo_.output_width != sizeX) || (jpegInfo_.output_height != sizeY) ||
+        (jpegInfo_.output_components != components)) {
+        printf("%s:%s: the image is %u x %u x %d, the array is %lu x %lu x %d\n",
+               driverName, functionName, jpegInfo_.output_width, jpegInfo_.output_height,
+               jpegInfo_.output_components, (unsigned long)sizeX, (unsigned long)sizeY, components);
+        jpeg_abort_decompress(&jpegInfo_);
+        return ND_ERROR;
+    }
+    while (jpegInfo_.output_scanline < jpegInfo_.output_height) {
+        rowPointer[0] = (JSAMPROW)(pData + (size_t)jpegInfo_.output_scanline * sizeX * components);
+        jpeg_read_scanlines(&jpegInfo_, rowPointer, 1);
+    }
+    jpeg_finish_decompress(&jpegInfo_);
+    return ND_SUCCESS;
+}
+
+/** Gives libjpeg the whole image; should be private but called from C so must be public */
+void NDJPEGDecoder::initSource()
+{
+    sourceMgr_.next_input_byte = pJpeg_;
+    sourceMgr_.bytes_in_buffer = jpegSize_;
+}
+
+/** Called if libjpeg reads past the end of the image, which is truncated; should be private but called from C
+  * so must be public */
+boolean NDJPEGDecoder::fillInputBuffer()
+{
+    WARNMS(&jpegInfo_, JWRN_JPEG_EOF);
+    sourceMgr_.next_input_byte = eoiMarker;
+    sourceMgr_.bytes_in_buffer = sizeof(eoiMarker);
+    return TRUE;
+}
+
+/** Skips data that libjpeg does not use; should be private but called from C so must be public */
+void NDJPEGDecoder::skipInputData(long numBytes)
+{
+    if (numBytes <= 0) return;
+    if ((size_t)numBytes > sourceMgr_.bytes_in_buffer) {
+        fillInputBuffer();
+        return;
+    }
+    sourceMgr_.next_input_byte += numBytes;
+    sourceMgr_.bytes_in_buffer -= numBytes;
+}
+
+/** Handles a libjpeg error by returning ND_ERROR from decompress(), rather than ending the process as the
+  * default libjpeg handler does; should be private but called from C so must be public */
+void NDJPEGDecoder::errorExit()
+{
+    char message[JMSG_LENGTH_MAX];
+
+    errorMgr_.format_message((j_common_ptr)&jpegInfo_, message);
+    printf("%s::errorExit: %s\n", driverName, message);
+    longjmp(errorJump_, 1);
+}
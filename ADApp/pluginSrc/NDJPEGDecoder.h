@@ -0,0 +1,46 @@
+/** NDJPEGDecoder.h
+ *
+ * Decompresses JPEG images in memory into NDArrays, for NDPluginCodec.  The images are the ones NDJPEGEncoder
+ * writes: 8-bit Mono images decode to 2-D arrays, and RGB images to 3-D RGB1 arrays.
+ *
+ */
+
+#ifndef NDJPEGDecoder_H
+#define NDJPEGDecoder_H
+
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <shareLib.h>
+
+#include "NDArray.h"
+#include "jpeglib.h"
+
+/** Decompresses JPEG images from a buffer into the data of NDArrays.
+  * libjpeg errors are returned as ND_ERROR rather than ending the process.
+  * Each decoder must only be used by one thread at a time.
+  */
+class epicsShareClass NDJPEGDecoder {
+public:
+    NDJPEGDecoder();
+    ~NDJPEGDecoder();
+    int decode(const unsigned char *pJpeg, size_t jpegSize, NDArray *pArray);
+
+    /* These are called from C by libjpeg so must be public */
+    void initSource();
+    boolean fillInputBuffer();
+    void skipInputData(long numBytes);
+    void errorExit();
+
+private:
+    int decompress(unsigned char *pData, size_t sizeX, size_t sizeY, int components);
+
+    struct jpeg_decompress_struct jpegInfo_;  /**< client_data points to this decoder for the libjpeg callbacks */
+    struct jpeg_source_mgr sourceMgr_;
+    struct jpeg_error_mgr errorMgr_;
+    jmp_buf errorJump_;             /**< Where errorExit() returns to in decompress() */
+    const unsigned char *pJpeg_;    /**< The image being decompressed */
+    size_t jpegSize_;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/** NDJPEGEncoder.cpp
+ *
+ * Compresses NDArrays to JPEG images in memory, for plugins that publish the images rather than writing files.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "NDJPEGEncoder.h"
+#include "jerror.h"
+
+static const char *driverName = "NDJPEGEncoder";
+
+/** The size of the buffer when the first image is compressed; it grows as needed */
+#define ND_JPEG_INITIAL_SIZE (64*1024)
+
+static NDJPEGEncoder *encoderOf(j_common_ptr cinfo)
+{
+    return (NDJPEGEncoder *)cinfo->client_data;
+}
+
+static void init_destination(j_compress_ptr cinfo)
+{
+    encoderOf((j_common_ptr)cinfo)->initDestination();
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+    return encoderOf((j_common_ptr)cinfo)->emptyOutputBuffer();
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+    encoderOf((j_common_ptr)cinfo)->termDestination();
+}
+
+static void error_exit(j_common_ptr cinfo)
+{
+    encoderOf(cinfo)->errorExit();
+}
+
+NDJPEGEncoder::NDJPEGEncoder()
+  : colorMode_(NDColorModeMono), pRed_(NULL), pGreen_(NULL), pBlue_(NULL), pJpeg_(NULL), jpegSize_(0)
+{
+    memset(&jpegInfo_, 0, sizeof(jpegInfo_));
+    jpegInfo_.err = jpeg_std_error(&errorMgr_);
+    errorMgr_.error_exit = error_exit;
+    jpegInfo_.client_data = this;
+    jpeg_create_compress(&jpegInfo_);
+
+    destMgr_.init_destination = init_destination;
+    destMgr_.empty_output_buffer = empty_output_buffer;
+    destMgr_.term_destination = term_destination;
+    jpegInfo_.dest = &destMgr_;
+}
+
+NDJPEGEncoder::~NDJPEGEncoder()
+{
+    jpeg_destroy_compress(&jpegInfo_);
+}
+
+/** Compresses an NDArray to a JPEG image.
+  * \param[in] pArray The array; 8-bit data, either 2-D or 3-D with the ColorMode attribute RGB1, RGB2 or RGB3.
+  * \param[in] quality The JPEG quality, 1 to 100.
+  * \param[out] jpeg The image.  The vector is resized to the size of the image; its capacity is kept, so passing
+  *             the same vector again does not allocate memory unless the image is larger.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDJPEGEncoder::encode(NDArray *pArray, int quality, std::vector<unsigned char>& jpeg)
+{
+    NDAttribute *pAttribute;
+    int colorMode = NDColorModeMono;
+    const unsigned char *pData = (const unsigned char *)pArray->pData;
+    size_t rowStride = 0;
+    size_t sizeX, sizeY;
+    int status;
+    static const char *functionName = "encode";
+
+    if ((pArray->dataType != NDInt8) && (pArray->dataType != NDUInt8)) {
+        printf("%s:%s: only 8-bit data is supported\n", driverName, functionName);
+        return ND_ERROR;
+    }
+    pAttribute = pArray->pAttributeList->find("ColorMode");
+    if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
+
+    if (pArray->ndims == 2) {
+        sizeX = pArray->dims[0].size;
+        sizeY = pArray->dims[1].size;
+        jpegInfo_.input_components = 1;
+        jpegInfo_.in_color_space = JCS_GRAYSCALE;
+        colorMode_ = NDColorModeMono;
+        rowStride = sizeX;
+    } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3) && (colorMode == NDColorModeRGB1)) {
+        sizeX = pArray->dims[1].size;
+        sizeY = pArray->dims[2].size;
+        jpegInfo_.input_components = 3;
+        jpegInfo_.in_color_space = JCS_RGB;
+        colorMode_ = NDColorModeRGB1;
+        rowStride = sizeX * 3;
+    } else if ((pArray->ndims == 3) && (pArray->dims[1].size == 3) && (colorMode == NDColorModeRGB2)) {
+        sizeX = pArray->dims[0].size;
+        sizeY = pArray->dims[2].size;
+        jpegInfo_.input_components = 3;
+        jpegInfo_.in_color_space = JCS_RGB;
+        colorMode_ = NDColorModeRGB2;
+        pRed_ = pData;
+        pGreen_ = pRed_ + sizeX;
+        pBlue_ = pGreen_ + sizeX;
+        rowStride = sizeX * 3;
+    } else if ((pArray->ndims == 3) && (pArray->dims[2].size == 3) && (colorMode == NDColorModeRGB3)) {
+        sizeX = pArray->dims[0].size;
+        sizeY = pArray->dims[1].size;
+        jpegInfo_.input_components = 3;
+        jpegInfo_.in_color_space = JCS_RGB;
+        colorMode_ = NDColorModeRGB3;
+        pRed_ = pData;
+        pGreen_ = pRed_ + sizeX * sizeY;
+        pBlue_ = pGreen_ + sizeX * sizeY;
+        rowStride = sizeX;
+    } else {
+        printf("%s:%s: unsupported array structure\n", driverName, functionName);
+        return ND_ERROR;
+    }
+    if ((sizeX == 0) || (sizeY == 0) || (sizeX > JPEG_MAX_DIMENSION) || (sizeY > JPEG_MAX_DIMENSION)) {
+        printf("%s:%s: unsupported image size %lu x %lu\n",
+               driverName, functionName, (unsigned long)sizeX, (unsigned long)sizeY);
+        return ND_ERROR;
+    }
+    jpegInfo_.image_width = (JDIMENSION)sizeX;
+    jpegInfo_.image_height = (JDIMENSION)sizeY;
+    if ((colorMode_ == NDColorModeRGB2) || (colorMode_ == NDColorModeRGB3)) rowBuffer_.resize(sizeX * 3);
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+
+    pJpeg_ = &jpeg;
+    jpegSize_ = 0;
+    status = compress(quality, pData, rowStride);
+    pJpeg_ = NULL;
+    if (status != ND_SUCCESS) {
+        jpeg.clear();
+        return ND_ERROR;
+    }
+    jpeg.resize(jpegSize_);
+    return ND_SUCCESS;
+}
+
+/** Runs libjpeg on the image that encode() has described.  A libjpeg error returns here through errorExit(),
+  * so this function must not have local objects with destructors. */
+int NDJPEGEncoder::compress(int quality, const unsigned char *pData, size_t rowStride)
+{
+    JSAMPROW rowPointer[1];
+    unsigned char *pOut;
+    size_t i, row;
+    size_t sizeX = jpegInfo_.image_width;
+
+    if (setjmp(errorJump_)) {
+        jpeg_abort_compress(&jpegInfo_);
+        return ND_ERROR;
+    }
+    jpeg_set_defaults(&jpegInfo_);
+    jpeg_set_quality(&jpegInfo_, quality, TRUE);
+    jpeg_start_compress(&jpegInfo_, TRUE);
+    while (jpegInfo_.next_scanline < jpegInfo_.image_height) {
+        row = jpegInfo_.next_scanline;
+        if ((colorMode_ == NDColorModeMono) || (colorMode_ == NDColorModeRGB1)) {
+            rowPointer[0] = (JSAMPROW)(pData + row * rowStride);
+        } else {
+            rowPointer[0] = pOut = &rowBuffer_[0];
+            for (i=0; i<sizeX; i++) {
+                *pOut++ = pRed_[row * rowStride + i];
+                *pOut++ = pGreen_[row * rowStride + i];
+                *pOut++ = pBlue_[row * rowStride + i];
+            }
+        }
+        jpeg_write_scanlines(&jpegInfo_, rowPointer, 1);
+    }
+    jpeg_finish_compress(&jpegInfo_);
+    return ND_SUCCESS;
+}
+
+/** Starts the image at the beginning of the buffer; should be private but called from C so must be public */
+void NDJPEGEncoder::initDestination()
+{
+    if (pJpeg_->size() < ND_JPEG_INITIAL_SIZE) pJpeg_->resize(ND_JPEG_INITIAL_SIZE);
+    /* Use all of the memory the vector already has */
+    pJpeg_->resize(pJpeg_->capacity());
+    destMgr_.next_output_byte = &(*pJpeg_)[0];
+    destMgr_.free_in_buffer = pJpeg_->size();
+}
+
+/** Doubles the buffer when it is full; should be private but called from C so must be public */
+boolean NDJPEGEncoder::emptyOutputBuffer()
+{
+    /* libjpeg calls this when free_in_buffer reaches 0, so the whole vector has been used */
+    size_t used = pJpeg_->size();
+    bool allocated = true;
+
+    try {
+        pJpeg_->resize(used * 2);
+    }
+    catch (...) {
+        allocated = false;
+    }
+    /* Report a failure to allocate memory as a libjpeg error, which returns through errorExit() */
+    if (!allocated) ERREXIT(&jpegInfo_, JERR_OUT_OF_MEMORY);
+    destMgr_.next_output_byte = &(*pJpeg_)[used];
+    destMgr_.free_in_buffer = pJpeg_->size() - used;
+    return TRUE;
+}
+
+/** Records the size of the image; should be private but called from C so must be public */
+void NDJPEGEncoder::termDestination()
+{
+    jpegSize_ = pJpeg_->size() - destMgr_.free_in_buffer;
+}
+
+/** Handles a libjpeg error by returning ND_ERROR from compress(), rather than ending the process as the
+  * default libjpeg handler does; should be private but called from C so must be public */
+void NDJPEGEncoder::errorExit()
+{
+    char message[JMSG_LENGTH_MAX];
+
+    errorMgr_.format_message((j_common_ptr)&jpegInfo_, message);
+    printf("%s::errorExit: %s\n", driverName, message);
+    longjmp(errorJump_, 1);
+}
@@ -0,0 +1,53 @@
+/** NDJPEGEncoder.h
+ *
+ * Compresses NDArrays to JPEG images in memory, for plugins that publish the images rather than writing files.
+ * The arrays have the same layouts as for NDFileJPEG: 8-bit Mono, RGB1, RGB2 or RGB3, with the ColorMode attribute
+ * giving the colour mode of 3-D arrays.
+ *
+ */
+
+#ifndef NDJPEGEncoder_H
+#define NDJPEGEncoder_H
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <vector>
+
+#include <shareLib.h>
+
+#include "NDArray.h"
+#include "jpeglib.h"
+
+/** Compresses NDArrays to JPEG images in a buffer that grows as needed and is kept between images.
+  * libjpeg errors are returned as ND_ERROR rather than ending the process.
+  * Each encoder must only be used by one thread at a time.
+  */
+class epicsShareClass NDJPEGEncoder {
+public:
+    NDJPEGEncoder();
+    ~NDJPEGEncoder();
+    int encode(NDArray *pArray, int quality, std::vector<unsigned char>& jpeg);
+
+    /* These are called from C by libjpeg so must be public */
+    void initDestination();
+    boolean emptyOutputBuffer();
+    void termDestination();
+    void errorExit();
+
+private:
+    int compress(int quality, const unsigned char *pData, size_t rowStride);
+
+    struct jpeg_compress_struct jpegInfo_;  /**< client_data points to this encoder for the libjpeg callbacks */
+    struct jpeg_destination_mgr destMgr_;
+    struct jpeg_error_mgr errorMgr_;
+    jmp_buf errorJump_;             /**< Where errorExit() returns to in compress() */
+    NDColorMode_t colorMode_;
+    const unsigned char *pRed_;     /**< The colour planes of an RGB2 or RGB3 image */
+    const unsigned char *pGreen_;
+    const unsigned char *pBlue_;
+    std::vector<unsigned char> *pJpeg_;   /**< The buffer of the image being compressed */
+    size_t jpegSize_;                     /**< The bytes of the image that have been written to *pJpeg_ */
+    std::vector<unsigned char> rowBuffer_;  /**< One interleaved row of an RGB2 or RGB3 image */
+};
+
+#endif
@@ -0,0 +1,103 @@
+/** NDLatencyHistogram.cpp
+ *
+ * Histogram of time intervals with logarithmic bins.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "NDLatencyHistogram.h"
+
+NDLatencyHistogram::NDLatencyHistogram()
+  : window_(0)
+{
+  reset();
+}
+
+/** Returns the bin of a time; bin 0 holds times up to 1 microsecond and the last bin holds the longest times. */
+int NDLatencyHistogram::bin(double seconds)
+{
+  double micro = seconds * 1e6;
+  int b;
+
+  if (!(micro > 1.)) return 0;
+  b = 1 + (int)(log(micro) / log(2.) * ND_LATENCY_BINS_PER_OCTAVE);
+  if (b >= ND_LATENCY_NUM_BINS) b = ND_LATENCY_NUM_BINS - 1;
+  return b;
+}
+
+/** Returns the longest time in a bin in seconds */
+double NDLatencyHistogram::binUpperEdge(int bin)
+{
+  return pow(2., (double)bin / ND_LATENCY_BINS_PER_OCTAVE) * 1e-6;
+}
+
+/** Adds a time interval.
+  * \param[in] seconds The interval in seconds; negative values are counted as 0.
+  */
+void NDLatencyHistogram::add(double seconds)
+{
+  if ((window_ > 0) && (total_[current_] >= window_)) {
+    current_ = 1 - current_;
+    memset(counts_[current_], 0, sizeof(counts_[current_]));
+    total_[current_] = 0;
+    max_[current_] = 0.;
+  }
+  if (seconds < 0.) seconds = 0.;
+  counts_[current_][bin(seconds)]++;
+  total_[current_]++;
+  if (seconds > max_[current_]) max_[current_] = seconds;
+}
+
+/** Removes all of the values */
+void NDLatencyHistogram::reset()
+{
+  memset(counts_, 0, sizeof(counts_));
+  total_[0] = total_[1] = 0;
+  max_[0] = max_[1] = 0.;
+  current_ = 0;
+}
+
+/** Sets the number of values in each of the two histograms; 0 keeps all of the values since the last reset.
+  * This also resets the histogram. */
+void NDLatencyHistogram::setWindow(int window)
+{
+  window_ = (window > 0) ? window : 0;
+  reset();
+}
+
+/** Returns the time in seconds that a fraction of the values are less than or equal to.
+  * This is the upper edge of the bin that contains the percentile, limited to the maximum value.
+  * \param[in] fraction The fraction, e.g. 0.99 for the 99th percentile.
+  * \return The time in seconds, or 0 if there are no values. */
+double NDLatencyHistogram::percentile(double fraction)
+{
+  int n = count();
+  int target, sum = 0;
+  int b;
+  double edge;
+
+  if (n == 0) return 0.;
+  target = (int)ceil(fraction * n);
+  if (target < 1) target = 1;
+  for (b=0; b<ND_LATENCY_NUM_BINS-1; b++) {
+    sum += counts_[0][b] + counts_[1][b];
+    if (sum >= target) break;
+  }
+  edge = binUpperEdge(b);
+  if ((b == ND_LATENCY_NUM_BINS-1) || (edge > maximum())) edge = maximum();
+  return edge;
+}
+
+/** Returns the longest time in seconds */
+double NDLatencyHistogram::maximum()
+{
+  return (max_[0] > max_[1]) ? max_[0] : max_[1];
+}
+
+/** Returns the number of values */
+int NDLatencyHistogram::count()
+{
+  return total_[0] + total_[1];
+}
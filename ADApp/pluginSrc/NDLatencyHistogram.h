@@ -0,0 +1,46 @@
+/** NDLatencyHistogram.h
+ *
+ * Histogram of time intervals with logarithmic bins, used by NDPluginDriver for the queue, processing
+ * and end-to-end latency of each array.
+ *
+ */
+
+#ifndef NDLatencyHistogram_H
+#define NDLatencyHistogram_H
+
+#include <shareLib.h>
+
+/** Number of bins per factor of 2 in time */
+#define ND_LATENCY_BINS_PER_OCTAVE 8
+/** Number of factors of 2 covered, from 1 microsecond to 2^ND_LATENCY_OCTAVES microseconds (over 2 hours) */
+#define ND_LATENCY_OCTAVES 33
+#define ND_LATENCY_NUM_BINS (ND_LATENCY_BINS_PER_OCTAVE*ND_LATENCY_OCTAVES + 1)
+
+/** Histogram of time intervals with logarithmic bins, so percentiles are accurate to about 9% at any latency.
+  * It is rolling: when the current histogram has window values it becomes the previous one and a new one
+  * is started, and the percentiles are computed over both, so they cover between window and 2*window values.
+  * A window of 0 keeps all of the values since the last reset.
+  * The methods are not thread safe; NDPluginDriver calls them with its lock held.
+  */
+class epicsShareClass NDLatencyHistogram {
+public:
+    NDLatencyHistogram();
+    void add(double seconds);
+    void reset();
+    void setWindow(int window);
+    double percentile(double fraction);
+    double maximum();
+    int count();
+
+private:
+    static int bin(double seconds);
+    static double binUpperEdge(int bin);
+
+    int window_;
+    int current_;                               /**< Index of the current histogram in counts_ */
+    int counts_[2][ND_LATENCY_NUM_BINS];
+    int total_[2];
+    double max_[2];
+};
+
+#endif
@@ -0,0 +1,201 @@
+/** NDLockFreeQueue.cpp
+ *
+ * Bounded lock-free multi-producer multi-consumer message queue.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <cantProceed.h>
+
+#include "NDLockFreeQueue.h"
+
+/** Constructor.
+  * \param[in] capacity The maximum number of messages in the queue.
+  * \param[in] msgSize The size of each message in bytes.
+  */
+NDLockFreeQueue::NDLockFreeQueue(int capacity, size_t msgSize)
+  : enqueuePos_(0), dequeuePos_(0), capacity_(capacity), messageSize_(msgSize), numWaiting_(0)
+{
+  size_t numSlots = 1;
+  size_t i;
+
+  if (capacity_ < 1) capacity_ = 1;
+  while (numSlots < (size_t)capacity_) numSlots *= 2;
+  mask_ = numSlots - 1;
+  sequences_ = (size_t *)callocMustSucceed(numSlots, sizeof(size_t), "NDLockFreeQueue");
+  messages_ = (char *)callocMustSucceed(numSlots, messageSize_, "NDLockFreeQueue");
+  for (i=0; i<numSlots; i++) sequences_[i] = i;
+  event_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+NDLockFreeQueue::~NDLockFreeQueue()
+{
+  epicsEventDestroy(event_);
+  free(messages_);
+  free(sequences_);
+}
+
+/** Sends a message if the queue is not full.
+  * \param[in] pMessage Pointer to the message.
+  * \param[in] messageSize Size of the message, which must not be larger than the size passed to the constructor.
+  * \return 0 if the message was sent, -1 if the queue is full or the message is too large.
+  */
+int NDLockFreeQueue::trySend(void *pMessage, size_t messageSize)
+{
+  size_t pos, *pSequence;
+  ptrdiff_t diff;
+
+  if (messageSize > messageSize_) return -1;
+  pos = epicsAtomicGetSizeT(&enqueuePos_);
+  while (1) {
+    /* Enforce the capacity, which may be less than the number of slots */
+    if (pos - epicsAtomicGetSizeT(&dequeuePos_) >= (size_t)capacity_) return -1;
+    pSequence = &sequences_[pos & mask_];
+    diff = (ptrdiff_t)(epicsAtomicGetSizeT(pSequence) - pos);
+    if (diff == 0) {
+      /* The slot is free, try to claim it */
+      size_t oldPos = epicsAtomicCmpAndSwapSizeT(&enqueuePos_, pos, pos + 1);
+      if (oldPos == pos) break;
+      pos = oldPos;
+    } else if (diff < 0) {
+      /* The slot still holds the message of the previous lap, the queue is full */
+      return -1;
+    } else {
+      pos = epicsAtomicGetSizeT(&enqueuePos_);
+    }
+  }
+  memcpy(&messages_[(pos & mask_) * messageSize_], pMessage, messageSize);
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(pSequence, pos + 1);
+  wakeConsumer();
+  return 0;
+}
+
+/** Sends a message, waiting for room in the queue if it is full.
+  * \param[in] pMessage Pointer to the message.
+  * \param[in] messageSize Size of the message.
+  * \return 0 if the message was sent, -1 if the message is too large.
+  */
+int NDLockFreeQueue::send(void *pMessage, size_t messageSize)
+{
+  if (messageSize > messageSize_) return -1;
+  while (trySend(pMessage, messageSize) != 0) {
+    epicsThreadSleep(epicsThreadSleepQuantum());
+  }
+  return 0;
+}
+
+/** Sends a message, waiting up to a timeout for room in the queue if it is full.
+  * \param[in] pMessage Pointer to the message.
+  * \param[in] messageSize Size of the message.
+  * \param[in] timeout The maximum time to wait in seconds.
+  * \return 0 if the message was sent, -1 if the queue was still full after the timeout or the message is too large.
+  */
+int NDLockFreeQueue::send(void *pMessage, size_t messageSize, double timeout)
+{
+  epicsTimeStamp tStart, tNow;
+
+  if (messageSize > messageSize_) return -1;
+  epicsTimeGetCurrent(&tStart);
+  while (trySend(pMessage, messageSize) != 0) {
+    epicsTimeGetCurrent(&tNow);
+    if (epicsTimeDiffInSeconds(&tNow, &tStart) >= timeout) return -1;
+    epicsThreadSleep(epicsThreadSleepQuantum());
+  }
+  return 0;
+}
+
+/** Receives a message if the queue is not empty.
+  * \param[out] pMessage Buffer for the message.
+  * \param[in] size Size of the buffer, which must be at least the message size.
+  * \return The size of the message, or -1 if the queue is empty.
+  */
+int NDLockFreeQueue::tryReceive(void *pMessage, size_t size)
+{
+  size_t pos, *pSequence;
+  ptrdiff_t diff;
+
+  if (size < messageSize_) return -1;
+  pos = epicsAtomicGetSizeT(&dequeuePos_);
+  while (1) {
+    pSequence = &sequences_[pos & mask_];
+    diff = (ptrdiff_t)(epicsAtomicGetSizeT(pSequence) - (pos + 1));
+    if (diff == 0) {
+      size_t oldPos = epicsAtomicCmpAndSwapSizeT(&dequeuePos_, pos, pos + 1);
+      if (oldPos == pos) break;
+      pos = oldPos;
+    } else if (diff < 0) {
+      /* The slot has not been written yet, the queue is empty */
+      return -1;
+    } else {
+      pos = epicsAtomicGetSizeT(&dequeuePos_);
+    }
+  }
+  epicsAtomicReadMemoryBarrier();
+  memcpy(pMessage, &messages_[(pos & mask_) * messageSize_], messageSize_);
+  /* Free the slot for the position one lap later */
+  epicsAtomicSetSizeT(pSequence, pos + mask_ + 1);
+  return (int)messageSize_;
+}
+
+/** Receives a message, waiting for one if the queue is empty.
+  * \param[out] pMessage Buffer for the message.
+  * \param[in] size Size of the buffer, which must be at least the message size.
+  * \return The size of the message, or -1 if the buffer is too small.
+  */
+int NDLockFreeQueue::receive(void *pMessage, size_t size)
+{
+  int i, status;
+
+  if (size < messageSize_) return -1;
+  while (1) {
+    for (i=0; i<ND_LOCK_FREE_QUEUE_SPINS; i++) {
+      status = tryReceive(pMessage, size);
+      if (status >= 0) break;
+    }
+    if (status < 0) {
+      /* Announce that we will block before the last check, so that a producer that sends after the check
+       * sees numWaiting_ and signals the event */
+      epicsAtomicIncrIntT(&numWaiting_);
+      status = tryReceive(pMessage, size);
+      if (status < 0) epicsEventMustWait(event_);
+      epicsAtomicDecrIntT(&numWaiting_);
+    }
+    if (status >= 0) {
+      /* The event does not count signals, so the signals for several messages can wake only one consumer.
+       * Pass the wakeup on if messages remain. */
+      if ((epicsAtomicGetIntT(&numWaiting_) > 0) && (pending() > 0)) epicsEventSignal(event_);
+      return status;
+    }
+  }
+}
+
+/** Signals a blocked consumer, if there is one */
+void NDLockFreeQueue::wakeConsumer()
+{
+  /* The read-modify-write is a full barrier between the sequence store and the read of numWaiting_ */
+  if (epicsAtomicAddIntT(&numWaiting_, 0) > 0) epicsEventSignal(event_);
+}
+
+/** Returns the number of messages in the queue */
+int NDLockFreeQueue::pending()
+{
+  size_t dequeuePos = epicsAtomicGetSizeT(&dequeuePos_);
+  size_t enqueuePos = epicsAtomicGetSizeT(&enqueuePos_);
+
+  /* The positions are read separately, so clamp the result to the valid range */
+  if (enqueuePos < dequeuePos) return 0;
+  if (enqueuePos - dequeuePos > (size_t)capacity_) return capacity_;
+  return (int)(enqueuePos - dequeuePos);
+}
+
+/** Returns the maximum number of messages in the queue */
+int NDLockFreeQueue::capacity()
+{
+  return capacity_;
+}
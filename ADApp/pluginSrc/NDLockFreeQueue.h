@@ -0,0 +1,55 @@
+/** NDLockFreeQueue.h
+ *
+ * Bounded lock-free multi-producer multi-consumer queue of fixed size messages, used by NDPluginDriver
+ * as an alternative to epicsMessageQueue for the input arrays of the plugin threads.
+ *
+ */
+
+#ifndef NDLockFreeQueue_H
+#define NDLockFreeQueue_H
+
+#include <stddef.h>
+
+#include <epicsEvent.h>
+#include <shareLib.h>
+
+/** The number of times that receive() polls an empty queue before it blocks */
+#define ND_LOCK_FREE_QUEUE_SPINS 1000
+
+/** Bounded lock-free queue of fixed size messages.
+  * The methods have the same return values as those of epicsMessageQueue with the same names.
+  * Producers and consumers claim slots with atomic compare-and-swap on the enqueue and dequeue positions, and each
+  * slot has a sequence number that says whether it is free or holds a message, so neither side takes a lock.
+  * A consumer that finds the queue empty polls it ND_LOCK_FREE_QUEUE_SPINS times and then blocks on an event,
+  * which producers signal only when a consumer is blocked.
+  */
+class epicsShareClass NDLockFreeQueue {
+public:
+    NDLockFreeQueue(int capacity, size_t msgSize);
+    ~NDLockFreeQueue();
+    int          trySend(void *pMessage, size_t messageSize);
+    int          send(void *pMessage, size_t messageSize);
+    int          send(void *pMessage, size_t messageSize, double timeout);
+    int          tryReceive(void *pMessage, size_t size);
+    int          receive(void *pMessage, size_t size);
+    int          pending();
+    int          capacity();
+
+private:
+    void         wakeConsumer();
+
+    size_t       enqueuePos_;   /**< Position of the next message to send; only modified with the epicsAtomic functions */
+    char         pad1_[64];     /**< Keeps the producer and consumer positions in separate cache lines */
+    size_t       dequeuePos_;   /**< Position of the next message to receive; only modified with the epicsAtomic functions */
+    char         pad2_[64];
+    size_t       *sequences_;   /**< Sequence number of each slot; slot i is free for position p if sequences_[i]==p,
+                                  *  and holds the message of position p if sequences_[i]==p+1 */
+    char         *messages_;    /**< The message buffer of each slot */
+    size_t       mask_;         /**< Number of slots - 1; the number of slots is a power of 2 >= capacity_ */
+    int          capacity_;     /**< Maximum number of messages in the queue */
+    size_t       messageSize_;  /**< Size of each message in bytes */
+    int          numWaiting_;   /**< Number of consumers blocked in receive(); only modified with the epicsAtomic functions */
+    epicsEventId event_;        /**< Signalled by producers when numWaiting_ > 0 */
+};
+
+#endif
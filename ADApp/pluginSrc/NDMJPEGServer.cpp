@@ -0,0 +1,310 @@
+/** NDMJPEGServer.cpp
+ *
+ * A minimal HTTP server that streams JPEG images to web browsers as MJPEG, a multipart/x-mixed-replace response
+ * with one part per image.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <sys/time.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+#endif
+
+#include <epicsTypes.h>
+#include <epicsStdio.h>
+#include <osiSock.h>
+
+#include "NDArray.h"
+#include "NDMJPEGServer.h"
+
+static const char *driverName = "NDMJPEGServer";
+
+#ifdef MSG_NOSIGNAL
+#define ND_MJPEG_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define ND_MJPEG_SEND_FLAGS 0
+#endif
+
+/** The boundary between the parts of the stream */
+#define ND_MJPEG_BOUNDARY "NDMJPEGFrame"
+/** Longest request that is read */
+#define ND_MJPEG_MAX_REQUEST 8192
+/** Time to wait for the request of a client, and for a client to accept data, in seconds */
+#define ND_MJPEG_CLIENT_TIMEOUT 10
+/** Time between checks that an idle client is still connected, in seconds */
+#define ND_MJPEG_IDLE_CHECK 1.0
+/** Time to wait before accepting again if accepting a client fails, in seconds */
+#define ND_MJPEG_ACCEPT_RETRY 1.0
+
+static const char *streamResponse =
+    "HTTP/1.0 200 OK\r\n"
+    "Connection: close\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Pragma: no-cache\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=" ND_MJPEG_BOUNDARY "\r\n"
+    "\r\n";
+static const char *badRequestResponse =
+    "HTTP/1.0 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+static const char *busyResponse =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static void acceptTaskC(void *pServer)
+{
+  ((NDMJPEGServer *)pServer)->acceptTask();
+}
+
+static void clientTaskC(void *pClient)
+{
+  NDMJPEGClient_t *pC = (NDMJPEGClient_t *)pClient;
+  pC->pServer->clientTask(pC);
+}
+
+/** Sets the time that receives and sends on a socket wait before they fail */
+static void setTimeouts(SOCKET sock, int seconds)
+{
+#ifdef _WIN32
+  DWORD timeout = seconds * 1000;
+#else
+  struct timeval timeout;
+  timeout.tv_sec = seconds;
+  timeout.tv_usec = 0;
+#endif
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+}
+
+NDMJPEGServer::NDMJPEGServer()
+  : listenSock_(INVALID_SOCKET), imageCount_(0)
+{
+  osiSockAttach();
+  mutex_ = epicsMutexCreate();
+}
+
+/** Opens the listening socket and starts the thread that accepts clients.
+  * \param[in] port The TCP port to listen on; 0 for a port chosen by the system, see port().
+  * \param[in] name The name of the thread that accepts clients.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDMJPEGServer::start(int port, const char *name)
+{
+  struct sockaddr_in addr;
+  const char *functionName = "start";
+
+  if (listenSock_ != INVALID_SOCKET) return ND_ERROR;
+  listenSock_ = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+  if (listenSock_ == INVALID_SOCKET) {
+    printf("%s:%s: ERROR, cannot create socket\n", driverName, functionName);
+    return ND_ERROR;
+  }
+  epicsSocketEnableAddressReuseDuringTimeWaitState(listenSock_);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((unsigned short)port);
+  if ((bind(listenSock_, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (listen(listenSock_, ND_MJPEG_MAX_CLIENTS) != 0)) {
+    printf("%s:%s: ERROR, cannot listen on port %d, errno=%d\n",
+           driverName, functionName, port, (int)SOCKERRNO);
+    epicsSocketDestroy(listenSock_);
+    listenSock_ = INVALID_SOCKET;
+    return ND_ERROR;
+  }
+  if (epicsThreadCreate(name, epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)acceptTaskC, this) == NULL) {
+    printf("%s:%s: ERROR, cannot create thread %s\n", driverName, functionName, name);
+    epicsSocketDestroy(listenSock_);
+    listenSock_ = INVALID_SOCKET;
+    return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Returns the TCP port that the server listens on, or -1 if it is not started */
+int NDMJPEGServer::port()
+{
+  struct sockaddr_in addr;
+  osiSocklen_t size = sizeof(addr);
+
+  if (listenSock_ == INVALID_SOCKET) return -1;
+  if (getsockname(listenSock_, (struct sockaddr *)&addr, &size) != 0) return -1;
+  return ntohs(addr.sin_port);
+}
+
+/** Returns the number of clients that are being streamed to */
+int NDMJPEGServer::numClients()
+{
+  int count;
+
+  epicsMutexLock(mutex_);
+  count = (int)clients_.size();
+  epicsMutexUnlock(mutex_);
+  return count;
+}
+
+/** Makes an image the latest image, which each client is sent when it has finished sending the previous one.
+  * The image is copied, so the caller can reuse its buffer.
+  * \param[in] pJpeg The JPEG image.
+  * \param[in] size The size of the image in bytes. */
+void NDMJPEGServer::publish(const unsigned char *pJpeg, size_t size)
+{
+  std::list<NDMJPEGClient_t *>::iterator it;
+
+  epicsMutexLock(mutex_);
+  if (!clients_.empty()) {
+    image_.assign(pJpeg, pJpeg + size);
+    imageCount_++;
+    for (it = clients_.begin(); it != clients_.end(); ++it) {
+      epicsEventSignal((*it)->event);
+    }
+  }
+  epicsMutexUnlock(mutex_);
+}
+
+/** Accepts clients and starts a thread for each one; should be private but called from C so must be public */
+void NDMJPEGServer::acceptTask()
+{
+  NDMJPEGClient_t *pClient;
+  osiSockAddr addr;
+  osiSocklen_t size;
+  SOCKET sock;
+  bool busy;
+  int flag = 1;
+  static const char *functionName = "acceptTask";
+
+  while (1) {
+    size = sizeof(addr);
+    sock = epicsSocketAccept(listenSock_, &addr.sa, &size);
+    if (sock == INVALID_SOCKET) {
+      epicsThreadSleep(ND_MJPEG_ACCEPT_RETRY);
+      continue;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+    setTimeouts(sock, ND_MJPEG_CLIENT_TIMEOUT);
+    epicsMutexLock(mutex_);
+    busy = (clients_.size() >= ND_MJPEG_MAX_CLIENTS);
+    epicsMutexUnlock(mutex_);
+    if (busy) {
+      sendAll(sock, busyResponse, strlen(busyResponse));
+      epicsSocketDestroy(sock);
+      continue;
+    }
+    pClient = new NDMJPEGClient_t;
+    pClient->pServer = this;
+    pClient->sock = sock;
+    pClient->event = epicsEventCreate(epicsEventEmpty);
+    epicsMutexLock(mutex_);
+    clients_.push_back(pClient);
+    epicsMutexUnlock(mutex_);
+    if (epicsThreadCreate("NDMJPEGClient", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)clientTaskC, pClient) == NULL) {
+      printf("%s:%s: ERROR, cannot create client thread\n", driverName, functionName);
+      epicsMutexLock(mutex_);
+      clients_.remove(pClient);
+      epicsMutexUnlock(mutex_);
+      epicsSocketDestroy(sock);
+      epicsEventDestroy(pClient->event);
+      delete pClient;
+    }
+  }
+}
+
+/** Streams the images to one client until it disconnects or stops accepting data; should be private but called
+  * from C so must be public */
+void NDMJPEGServer::clientTask(NDMJPEGClient_t *pClient)
+{
+  std::vector<unsigned char> image;
+  unsigned long sentCount = 0;
+  char header[128];
+  char discard[256];
+  struct timeval tv;
+  fd_set readFds;
+  bool newImage, connected;
+
+  connected = readRequest(pClient->sock);
+  if (!connected) {
+    sendAll(pClient->sock, badRequestResponse, strlen(badRequestResponse));
+  } else {
+    connected = (sendAll(pClient->sock, streamResponse, strlen(streamResponse)) == ND_SUCCESS);
+  }
+  while (connected) {
+    epicsMutexLock(mutex_);
+    newImage = (imageCount_ != sentCount);
+    if (newImage) {
+      image = image_;
+      sentCount = imageCount_;
+    }
+    epicsMutexUnlock(mutex_);
+    if (newImage) {
+      epicsSnprintf(header, sizeof(header),
+                    "--" ND_MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\n\r\n",
+                    (unsigned long)image.size());
+      connected = (sendAll(pClient->sock, header, strlen(header)) == ND_SUCCESS) &&
+                  (sendAll(pClient->sock, &image[0], image.size()) == ND_SUCCESS) &&
+                  (sendAll(pClient->sock, "\r\n", 2) == ND_SUCCESS);
+      continue;
+    }
+    if (epicsEventWaitWithTimeout(pClient->event, ND_MJPEG_IDLE_CHECK) == epicsEventWaitOK) continue;
+    /* No image for a while: see if the client has closed the connection, which makes the socket readable */
+    FD_ZERO(&readFds);
+    FD_SET(pClient->sock, &readFds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    if ((select((int)pClient->sock + 1, &readFds, NULL, NULL, &tv) > 0) &&
+        (recv(pClient->sock, discard, sizeof(discard), 0) <= 0)) {
+      connected = false;
+    }
+  }
+
+  epicsMutexLock(mutex_);
+  clients_.remove(pClient);
+  epicsMutexUnlock(mutex_);
+  epicsSocketDestroy(pClient->sock);
+  epicsEventDestroy(pClient->event);
+  delete pClient;
+}
+
+/** Reads the request of a client up to the blank line that ends its headers.
+  * \return true if it is a GET request. */
+bool NDMJPEGServer::readRequest(SOCKET sock)
+{
+  char request[ND_MJPEG_MAX_REQUEST + 1];
+  size_t size = 0;
+  int received;
+
+  while (size < ND_MJPEG_MAX_REQUEST) {
+    received = recv(sock, request + size, (int)(ND_MJPEG_MAX_REQUEST - size), 0);
+    if (received < 0 && SOCKERRNO == SOCK_EINTR) continue;
+    if (received <= 0) return false;
+    size += received;
+    request[size] = 0;
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+  }
+  return (size >= 4) && (strncmp(request, "GET ", 4) == 0);
+}
+
+/** Sends exactly size bytes to a client. */
+int NDMJPEGServer::sendAll(SOCKET sock, const void *pData, size_t size)
+{
+  const char *pIn = (const char *)pData;
+  int sent;
+
+  while (size > 0) {
+    sent = send(sock, pIn, (int)((size > 0x40000000) ? 0x40000000 : size), ND_MJPEG_SEND_FLAGS);
+    if (sent < 0 && SOCKERRNO == SOCK_EINTR) continue;
+    if (sent <= 0) return ND_ERROR;
+    pIn += sent;
+    size -= sent;
+  }
+  return ND_SUCCESS;
+}
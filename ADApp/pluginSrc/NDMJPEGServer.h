@@ -0,0 +1,60 @@
+/** NDMJPEGServer.h
+ *
+ * A minimal HTTP server that streams JPEG images to web browsers as MJPEG, a multipart/x-mixed-replace response
+ * with one part per image.
+ *
+ */
+
+#ifndef NDMJPEGServer_H
+#define NDMJPEGServer_H
+
+#include <stddef.h>
+#include <list>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <osiSock.h>
+#include <shareLib.h>
+
+/** Most clients that are streamed to at once; further clients are refused */
+#define ND_MJPEG_MAX_CLIENTS 16
+
+class NDMJPEGServer;
+
+/** A client of NDMJPEGServer */
+typedef struct {
+    NDMJPEGServer *pServer;
+    SOCKET         sock;
+    epicsEventId   event;     /**< Signalled when there is a new image */
+} NDMJPEGClient_t;
+
+/** Streams the latest JPEG image to every HTTP client that connects to it.
+  * Each client has a thread that sends it the latest image when it is ready for one, so a slow client skips
+  * images and never delays publish() or the other clients.  Any GET request is answered with the stream.
+  */
+class epicsShareClass NDMJPEGServer {
+public:
+    NDMJPEGServer();
+    int          start(int port, const char *name);
+    int          port();
+    int          numClients();
+    void         publish(const unsigned char *pJpeg, size_t size);
+
+    /* These are called from C by the threads so must be public */
+    void         acceptTask();
+    void         clientTask(NDMJPEGClient_t *pClient);
+
+private:
+    int          sendAll(SOCKET sock, const void *pData, size_t size);
+    bool         readRequest(SOCKET sock);
+
+    SOCKET       listenSock_;    /**< INVALID_SOCKET if the server is not started */
+    epicsMutexId mutex_;         /**< Protects the members below */
+    std::list<NDMJPEGClient_t *> clients_;
+    std::vector<unsigned char> image_;  /**< The latest image */
+    unsigned long imageCount_;   /**< Incremented by each publish() */
+};
+
+#endif
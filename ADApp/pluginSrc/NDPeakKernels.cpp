@@ -0,0 +1,355 @@
+/** NDPeakKernels.cpp
+ *
+ * Peak finding for NDPluginPeakFinder.
+ * NDPeakSummedArea() computes the summed-area tables of the values and of their squares for a stripe of rows, as
+ * if the rows above the stripe were 0, and NDPeakSummedAreaAdd() then adds the last row of the stripe above, so
+ * that the stripes can be summed in parallel.  The tables are in double, which is exact for the sums of the
+ * integer types up to 2^53.
+ *
+ * NDPeakFindSpans() reads the sums of the background around each pixel, a box less an inner box, from the
+ * differences of the rows of the tables, computed once for each row, so each pixel costs four differences and the
+ * threshold test, and stores the runs of pixels above the threshold with the sums of their signal.
+ * NDPeakLabelSpans() joins the runs that touch, also diagonally, in adjacent rows with a union-find over the runs,
+ * which are in row order, and sums them into peaks.
+ *
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include <epicsTypes.h>
+
+#include <NDFloat16.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDPeakKernels.h"
+
+template <typename epicsType>
+static void summedAreaT(const epicsType *pData, size_t sizeX, size_t firstRow, size_t numRows,
+                        double *pSum, double *pSumSquares)
+{
+    size_t width = sizeX + 1;
+    size_t x, y;
+    double rowSum, rowSquares;
+
+    if (firstRow == 0) {
+        for (x=0; x<width; x++) pSum[x] = pSumSquares[x] = 0.;
+    }
+    for (y=firstRow; y<firstRow+numRows; y++) {
+        const epicsType *pRow = pData + y*sizeX;
+        double *pSumPrev = pSum + y*width;
+        double *pSumRow = pSumPrev + width;
+        double *pSquaresPrev = pSumSquares + y*width;
+        double *pSquaresRow = pSquaresPrev + width;
+        rowSum = rowSquares = 0.;
+        pSumRow[0] = pSquaresRow[0] = 0.;
+        for (x=0; x<sizeX; x++) {
+            double value = (double)pRow[x];
+            rowSum += value;
+            rowSquares += value * value;
+            /* The row above the stripe is counted as 0 here, NDPeakSummedAreaAdd() adds it */
+            pSumRow[x+1] = ((y == firstRow) ? 0. : pSumPrev[x+1]) + rowSum;
+            pSquaresRow[x+1] = ((y == firstRow) ? 0. : pSquaresPrev[x+1]) + rowSquares;
+        }
+    }
+}
+
+/** Computes rows firstRow+1 to firstRow+numRows of the summed-area tables of a 2-D array, taking row firstRow of
+  * the tables as 0.  Element (x+1, y+1) of a table is the sum of the elements, or of their squares, with columns
+  * up to x and rows up to y; the tables have sizeX+1 columns, and their first row and column are 0.
+  * For a stripe with firstRow > 0 the tables are complete once NDPeakSummedAreaAdd() has added row firstRow.
+  * \param[in] dataType The data type of the array.
+  * \param[in] pData The elements of the contiguous array.
+  * \param[in] sizeX The number of columns of the array.
+  * \param[in] firstRow The first array row of the stripe.
+  * \param[in] numRows The number of rows of the stripe.
+  * \param[out] pSum The table of the sums.
+  * \param[out] pSumSquares The table of the sums of squares.
+  * \return ND_SUCCESS, or ND_ERROR for an unsupported data type. */
+int NDPeakSummedArea(NDDataType_t dataType, const void *pData, size_t sizeX,
+                     size_t firstRow, size_t numRows, double *pSum, double *pSumSquares)
+{
+    switch (dataType) {
+        case NDInt8:
+            summedAreaT((const epicsInt8 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDUInt8:
+            summedAreaT((const epicsUInt8 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDInt16:
+            summedAreaT((const epicsInt16 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDUInt16:
+            summedAreaT((const epicsUInt16 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDInt32:
+            summedAreaT((const epicsInt32 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDUInt32:
+            summedAreaT((const epicsUInt32 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDFloat32:
+            summedAreaT((const epicsFloat32 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDFloat64:
+            summedAreaT((const epicsFloat64 *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        case NDFloat16:
+            summedAreaT((const NDFloat16_t *)pData, sizeX, firstRow, numRows, pSum, pSumSquares);
+            break;
+        default:
+            return ND_ERROR;
+    }
+    return ND_SUCCESS;
+}
+
+/** Adds row fromRow of the summed-area tables to rows firstRow to firstRow+numRows-1.
+  * \param[in,out] pSum The table of the sums.
+  * \param[in,out] pSumSquares The table of the sums of squares.
+  * \param[in] sizeX The number of columns of the array; the tables have sizeX+1.
+  * \param[in] fromRow The table row that is added.
+  * \param[in] firstRow The first table row it is added to.
+  * \param[in] numRows The number of table rows it is added to. */
+void NDPeakSummedAreaAdd(double *pSum, double *pSumSquares, size_t sizeX, size_t fromRow,
+                         size_t firstRow, size_t numRows)
+{
+    size_t width = sizeX + 1;
+    const double *pSumFrom = pSum + fromRow*width;
+    const double *pSquaresFrom = pSumSquares + fromRow*width;
+    size_t x, y;
+
+    for (y=firstRow; y<firstRow+numRows; y++) {
+        double *pSumRow = pSum + y*width;
+        double *pSquaresRow = pSumSquares + y*width;
+        for (x=0; x<width; x++) {
+            pSumRow[x] += pSumFrom[x];
+            pSquaresRow[x] += pSquaresFrom[x];
+        }
+    }
+}
+
+template <typename epicsType>
+static int findSpansT(const epicsType *pData, size_t sizeX, size_t sizeY, const double *pSum,
+                      const double *pSumSquares, const NDPeakThreshold_t *pThreshold, size_t firstRow,
+                      size_t numRows, size_t maxSpans, std::vector<NDPeakSpan_t> &spans)
+{
+    size_t width = sizeX + 1;
+    size_t radius = (pThreshold->backgroundRadius > 0) ? pThreshold->backgroundRadius : 0;
+    size_t inner = (pThreshold->innerRadius > 0) ? pThreshold->innerRadius : 0;
+    double minSignal = (pThreshold->minSignal > 0.) ? pThreshold->minSignal : 0.;
+    double snr2 = pThreshold->snr * pThreshold->snr;
+    std::vector<size_t> boxStart(sizeX), boxEnd(sizeX), innerStart(sizeX), innerEnd(sizeX);
+    std::vector<double> boxColumns(sizeX), innerColumns(sizeX), signal(sizeX);
+    std::vector<double> boxSums(width), boxSquares(width), innerSums(width), innerSquares(width);
+    NDPeakSpan_t span;
+    size_t x, y, y0, y1, iy0, iy1;
+
+    /* The columns of the boxes of each pixel, which are the same for every row */
+    for (x=0; x<sizeX; x++) {
+        boxStart[x] = (x > radius) ? x - radius : 0;
+        boxEnd[x] = (x + radius + 1 < sizeX) ? x + radius + 1 : sizeX;
+        boxColumns[x] = (double)(boxEnd[x] - boxStart[x]);
+        innerStart[x] = (x > inner) ? x - inner : 0;
+        innerEnd[x] = (x + inner + 1 < sizeX) ? x + inner + 1 : sizeX;
+        innerColumns[x] = (double)(innerEnd[x] - innerStart[x]);
+    }
+    for (y=firstRow; y<firstRow+numRows; y++) {
+        const epicsType *pRow = pData + y*sizeX;
+        y0 = (y > radius) ? y - radius : 0;
+        y1 = (y + radius + 1 < sizeY) ? y + radius + 1 : sizeY;
+        iy0 = (y > inner) ? y - inner : 0;
+        iy1 = (y + inner + 1 < sizeY) ? y + inner + 1 : sizeY;
+        const double *pSum0 = pSum + y0*width, *pSum1 = pSum + y1*width;
+        const double *pSquares0 = pSumSquares + y0*width, *pSquares1 = pSumSquares + y1*width;
+        const double *pInnerSum0 = pSum + iy0*width, *pInnerSum1 = pSum + iy1*width;
+        const double *pInnerSquares0 = pSumSquares + iy0*width, *pInnerSquares1 = pSumSquares + iy1*width;
+        double boxRows = (double)(y1 - y0), innerRows = (double)(iy1 - iy0);
+
+        /* The sums of the rows of the boxes of each column up to x */
+        for (x=0; x<width; x++) {
+            boxSums[x] = pSum1[x] - pSum0[x];
+            boxSquares[x] = pSquares1[x] - pSquares0[x];
+            innerSums[x] = pInnerSum1[x] - pInnerSum0[x];
+            innerSquares[x] = pInnerSquares1[x] - pInnerSquares0[x];
+        }
+        for (x=0; x<sizeX; x++) {
+            double count = boxRows * boxColumns[x] - innerRows * innerColumns[x];
+            double sum = (boxSums[boxEnd[x]] - boxSums[boxStart[x]]) -
+                         (innerSums[innerEnd[x]] - innerSums[innerStart[x]]);
+            double squares = (boxSquares[boxEnd[x]] - boxSquares[boxStart[x]]) -
+                             (innerSquares[innerEnd[x]] - innerSquares[innerStart[x]]);
+            /* A pixel without background, at the edges if radius is not more than inner, is not above */
+            double mean = (count > 0.) ? sum / count : 0.;
+            double variance = (count > 0.) ? squares / count - mean*mean : 0.;
+            double delta = (double)pRow[x] - mean;
+            signal[x] = ((count > 0.) && (delta > minSignal) && (delta*delta > snr2*variance)) ? delta : 0.;
+        }
+        for (x=0; x<sizeX; x++) {
+            if (signal[x] == 0.) continue;
+            if (spans.size() >= maxSpans) return ND_ERROR;
+            span.y = (epicsInt32)y;
+            span.x0 = (epicsInt32)x;
+            span.signal = span.sumX = span.sumY = span.sumXX = span.sumYY = 0.;
+            span.max = (double)pRow[x];
+            for (; (x < sizeX) && (signal[x] != 0.); x++) {
+                double value = (double)pRow[x];
+                span.signal += signal[x];
+                span.sumX += signal[x] * x;
+                span.sumXX += signal[x] * x * x;
+                if (value > span.max) span.max = value;
+            }
+            span.x1 = (epicsInt32)(x - 1);
+            span.sumY = span.signal * y;
+            span.sumYY = span.signal * y * y;
+            spans.push_back(span);
+        }
+    }
+    return ND_SUCCESS;
+}
+
+/** Appends the runs of pixels above the threshold in a stripe of rows of a 2-D array to a list of runs.
+  * The box around each pixel is read from the summed-area tables of NDPeakSummedArea(), which must be complete
+  * for the rows of the boxes, radius rows above and below the stripe.
+  * \param[in] dataType The data type of the array.
+  * \param[in] pData The elements of the contiguous array.
+  * \param[in] sizeX The number of columns of the array.
+  * \param[in] sizeY The number of rows of the array.
+  * \param[in] pSum The table of the sums.
+  * \param[in] pSumSquares The table of the sums of squares.
+  * \param[in] pThreshold The threshold.
+  * \param[in] firstRow The first row of the stripe.
+  * \param[in] numRows The number of rows of the stripe.
+  * \param[in] maxSpans The largest number of runs in the list; the runs after that are not added.
+  * \param[in,out] spans The list of runs, in the order of their rows and columns.
+  * \return ND_SUCCESS, or ND_ERROR for an unsupported data type or if the list reached maxSpans. */
+int NDPeakFindSpans(NDDataType_t dataType, const void *pData, size_t sizeX, size_t sizeY,
+                    const double *pSum, const double *pSumSquares,
+                    const NDPeakThreshold_t *pThreshold, size_t firstRow, size_t numRows,
+                    size_t maxSpans, std::vector<NDPeakSpan_t> &spans)
+{
+    switch (dataType) {
+        case NDInt8:
+            return findSpansT((const epicsInt8 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDUInt8:
+            return findSpansT((const epicsUInt8 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDInt16:
+            return findSpansT((const epicsInt16 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDUInt16:
+            return findSpansT((const epicsUInt16 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDInt32:
+            return findSpansT((const epicsInt32 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDUInt32:
+            return findSpansT((const epicsUInt32 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDFloat32:
+            return findSpansT((const epicsFloat32 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDFloat64:
+            return findSpansT((const epicsFloat64 *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        case NDFloat16:
+            return findSpansT((const NDFloat16_t *)pData, sizeX, sizeY, pSum, pSumSquares, pThreshold,
+                              firstRow, numRows, maxSpans, spans);
+        default:
+            return ND_ERROR;
+    }
+}
+
+/* Returns the root of the set of a run, halving the path to it */
+static size_t findRoot(std::vector<size_t> &parent, size_t i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static bool brighter(const NDPeak_t &a, const NDPeak_t &b)
+{
+    return a.intensity > b.intensity;
+}
+
+/** Joins the runs that touch in adjacent rows, also diagonally, into peaks, and returns the peaks with at least
+  * minPixels and at most maxPixels pixels, the brightest first.
+  * \param[in] spans The runs of NDPeakFindSpans(), in the order of their rows and columns.
+  * \param[in] minPixels The smallest number of pixels of a peak.
+  * \param[in] maxPixels The largest number of pixels of a peak, 0 for no limit.
+  * \param[out] peaks The peaks. */
+void NDPeakLabelSpans(const std::vector<NDPeakSpan_t> &spans, int minPixels, int maxPixels,
+                      std::vector<NDPeak_t> &peaks)
+{
+    size_t numSpans = spans.size();
+    std::vector<size_t> parent(numSpans);
+    std::vector<NDPeakSpan_t> sums;
+    std::vector<size_t> sumIndex(numSpans);
+    size_t prevStart = 0, prevEnd = 0, start, end, i, j, root;
+    NDPeak_t peak;
+
+    peaks.clear();
+    for (i=0; i<numSpans; i++) parent[i] = i;
+
+    /* Each row is merged with the runs of the row above it, if that is the previous row that has runs */
+    for (start=0; start<numSpans; start=end) {
+        for (end=start; (end < numSpans) && (spans[end].y == spans[start].y); end++);
+        if ((prevEnd > prevStart) && (spans[prevStart].y + 1 == spans[start].y)) {
+            i = prevStart;
+            j = start;
+            while ((i < prevEnd) && (j < end)) {
+                if (spans[i].x1 + 1 < spans[j].x0) {
+                    i++;
+                } else if (spans[j].x1 + 1 < spans[i].x0) {
+                    j++;
+                } else {
+                    size_t rootI = findRoot(parent, i), rootJ = findRoot(parent, j);
+                    if (rootI != rootJ) parent[std::max(rootI, rootJ)] = std::min(rootI, rootJ);
+                    if (spans[i].x1 < spans[j].x1) i++;
+                    else j++;
+                }
+            }
+        }
+        prevStart = start;
+        prevEnd = end;
+    }
+
+    /* Sum the runs of each set into the sums of its root */
+    for (i=0; i<numSpans; i++) {
+        const NDPeakSpan_t &span = spans[i];
+        root = findRoot(parent, i);
+        if (root == i) {
+            sumIndex[i] = sums.size();
+            sums.push_back(span);
+            /* The pixels of the peak are counted in x1 */
+            sums.back().x1 = span.x1 - span.x0 + 1;
+            continue;
+        }
+        NDPeakSpan_t &sum = sums[sumIndex[root]];
+        sum.signal += span.signal;
+        sum.sumX += span.sumX;
+        sum.sumY += span.sumY;
+        sum.sumXX += span.sumXX;
+        sum.sumYY += span.sumYY;
+        sum.x1 += span.x1 - span.x0 + 1;
+        if (span.max > sum.max) sum.max = span.max;
+    }
+
+    for (i=0; i<sums.size(); i++) {
+        const NDPeakSpan_t &sum = sums[i];
+        if ((sum.x1 < minPixels) || ((maxPixels > 0) && (sum.x1 > maxPixels))) continue;
+        peak.centroidX = sum.sumX / sum.signal;
+        peak.centroidY = sum.sumY / sum.signal;
+        peak.intensity = sum.signal;
+        peak.pixels = sum.x1;
+        peak.max = sum.max;
+        peak.sigmaX = sqrt(std::max(0., sum.sumXX / sum.signal - peak.centroidX*peak.centroidX));
+        peak.sigmaY = sqrt(std::max(0., sum.sumYY / sum.signal - peak.centroidY*peak.centroidY));
+        peaks.push_back(peak);
+    }
+    std::stable_sort(peaks.begin(), peaks.end(), brighter);
+}
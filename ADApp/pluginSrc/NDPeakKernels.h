@@ -0,0 +1,72 @@
+/** NDPeakKernels.h
+ *
+ * Peak finding for NDPluginPeakFinder: a summed-area table of the values and their squares, thresholding of each
+ * pixel against the mean and standard deviation of the background around it, read from the table, and connected
+ * components of the runs of pixels above the threshold in each row, with the centroid, intensity and size of
+ * each component.
+ * The table and the runs are computed for stripes of rows, so that the stripes can be processed in parallel,
+ * and the components are found from the runs of all the stripes.
+ *
+ */
+
+#ifndef NDPeakKernels_H
+#define NDPeakKernels_H
+
+#include <stddef.h>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The threshold of NDPeakFindSpans().  A pixel is above it if its value minus the mean of the background around
+  * it is greater than minSignal and than snr times the standard deviation of the background.  The background is
+  * the box around the pixel less the inner box, so that the peak the pixel is part of is not in its background. */
+typedef struct {
+    int backgroundRadius;   /**< The box is 2*backgroundRadius+1 pixels square, cut at the edges of the array */
+    int innerRadius;        /**< The inner box is 2*innerRadius+1 pixels square, less than the box */
+    double snr;             /**< Signal to noise ratio of a pixel above the threshold */
+    double minSignal;       /**< Smallest value above the background of a pixel above the threshold, at least 0 */
+} NDPeakThreshold_t;
+
+/** A run of adjacent pixels of one row that are above the threshold, with the sums of their signal, which is
+  * their value minus the mean of the background around each pixel */
+typedef struct {
+    epicsInt32 y;       /**< Row */
+    epicsInt32 x0;      /**< First column */
+    epicsInt32 x1;      /**< Last column */
+    double signal;      /**< Sum of the signal */
+    double sumX;        /**< Sum of the signal times the column */
+    double sumY;        /**< Sum of the signal times the row */
+    double sumXX;       /**< Sum of the signal times the square of the column */
+    double sumYY;       /**< Sum of the signal times the square of the row */
+    double max;         /**< Largest value */
+} NDPeakSpan_t;
+
+/** The columns of a peak in the peak table of NDPluginPeakFinder, all in double */
+typedef struct {
+    double centroidX;   /**< Centroid of the signal in X */
+    double centroidY;   /**< Centroid of the signal in Y */
+    double intensity;   /**< Sum of the signal */
+    double pixels;      /**< Number of pixels */
+    double max;         /**< Largest value */
+    double sigmaX;      /**< Standard deviation of the signal in X */
+    double sigmaY;      /**< Standard deviation of the signal in Y */
+} NDPeak_t;
+
+/** The number of columns of NDPeak_t */
+#define ND_PEAK_COLUMNS 7
+
+epicsShareFunc int NDPeakSummedArea(NDDataType_t dataType, const void *pData, size_t sizeX,
+                                    size_t firstRow, size_t numRows, double *pSum, double *pSumSquares);
+epicsShareFunc void NDPeakSummedAreaAdd(double *pSum, double *pSumSquares, size_t sizeX, size_t fromRow,
+                                        size_t firstRow, size_t numRows);
+epicsShareFunc int NDPeakFindSpans(NDDataType_t dataType, const void *pData, size_t sizeX, size_t sizeY,
+                                   const double *pSum, const double *pSumSquares,
+                                   const NDPeakThreshold_t *pThreshold, size_t firstRow, size_t numRows,
+                                   size_t maxSpans, std::vector<NDPeakSpan_t> &spans);
+epicsShareFunc void NDPeakLabelSpans(const std::vector<NDPeakSpan_t> &spans, int minPixels, int maxPixels,
+                                     std::vector<NDPeak_t> &peaks);
+
+#endif
@@ -0,0 +1,154 @@
+/** NDPerfCounters.cpp
+ *
+ * Optional counting of the CPU cycles, instructions, last level cache misses and branch misses of the
+ * calling thread with the Linux hardware performance counters.
+ *
+ * Each thread opens its own group of counters the first time it reads them, so the counters only count
+ * that thread, and reading them takes no lock.  The counters exclude the kernel, so they can be opened by
+ * unprivileged processes with the default perf_event_paranoid of 2.  Other systems have no counters.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <cantProceed.h>
+
+#if defined(__linux__)
+  #include <unistd.h>
+  #include <sys/syscall.h>
+  #include <linux/perf_event.h>
+#endif
+
+#include "NDPerfCounters.h"
+
+#define NUM_PERF_EVENTS 4
+
+typedef struct {
+  int fds[NUM_PERF_EVENTS];   /**< fds[0] is the group leader; -1 for the events the CPU does not count */
+  int numOpen;                /**< Number of events in the group, which are read in the order they were opened */
+} perfCounters_t;
+
+#if defined(__linux__)
+
+static epicsThreadOnceId perfOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId perfCountersId;
+
+/** The counters of threads that could not open them, so they do not try again for every array */
+static perfCounters_t noCounters;
+
+static void perfInit(void *)
+{
+  perfCountersId = epicsThreadPrivateCreate();
+}
+
+static const unsigned long long perfEvents[NUM_PERF_EVENTS] = {
+  PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/** Opens a counter of the calling thread on any CPU.
+  * \param[in] config The PERF_COUNT_HW_ event.
+  * \param[in] groupFd The group leader, or -1 to open the leader.
+  * \return The file descriptor, or -1 on error. */
+static int openCounter(unsigned long long config, int groupFd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/** Returns the counters of the calling thread, opening them if needed */
+static perfCounters_t *threadCounters(void)
+{
+  perfCounters_t *pCounters;
+  int i;
+
+  epicsThreadOnce(&perfOnce, perfInit, 0);
+  pCounters = (perfCounters_t *)epicsThreadPrivateGet(perfCountersId);
+  if (pCounters) return pCounters;
+  pCounters = (perfCounters_t *)callocMustSucceed(1, sizeof(perfCounters_t), "NDPerfCountersRead");
+  pCounters->fds[0] = openCounter(perfEvents[0], -1);
+  if (pCounters->fds[0] < 0) {
+    free(pCounters);
+    epicsThreadPrivateSet(perfCountersId, &noCounters);
+    return &noCounters;
+  }
+  pCounters->numOpen = 1;
+  for (i=1; i<NUM_PERF_EVENTS; i++) {
+    pCounters->fds[i] = openCounter(perfEvents[i], pCounters->fds[0]);
+    if (pCounters->fds[i] >= 0) pCounters->numOpen++;
+  }
+  epicsThreadPrivateSet(perfCountersId, pCounters);
+  return pCounters;
+}
+
+/** Reads the counts of the calling thread, opening its counters the first time.
+  * \param[out] pCounts The counts since the counters were opened; the difference of two reads is the
+  *             counts of the code between them.
+  * \return 0 on success, -1 if the counters could not be opened, in which case the thread does not
+  *         try to open them again until NDPerfCountersClose() is called.
+  */
+int NDPerfCountersRead(NDPerfCounts_t *pCounts)
+{
+  perfCounters_t *pCounters = threadCounters();
+  /* nr, time_enabled, time_running, and the values in the order the events were opened */
+  unsigned long long values[3 + NUM_PERF_EVENTS];
+  double counts[NUM_PERF_EVENTS];
+  double scale = 1.;
+  int i, j;
+
+  memset(pCounts, 0, sizeof(*pCounts));
+  if (pCounters->numOpen == 0) return -1;
+  if (read(pCounters->fds[0], values, sizeof(values)) < (ssize_t)((3 + pCounters->numOpen) * sizeof(values[0]))) {
+    return -1;
+  }
+  if ((values[2] > 0) && (values[2] < values[1])) scale = (double)values[1] / values[2];
+  for (i=0, j=3; i<NUM_PERF_EVENTS; i++) {
+    counts[i] = (pCounters->fds[i] >= 0) ? values[j++] * scale : 0.;
+  }
+  pCounts->cycles       = counts[0];
+  pCounts->instructions = counts[1];
+  pCounts->cacheMisses  = counts[2];
+  pCounts->branchMisses = counts[3];
+  return 0;
+}
+
+/** Closes the counters of the calling thread.  Threads that read the counters should call this before
+  * they exit, and the counters are opened again by the next NDPerfCountersRead(). */
+void NDPerfCountersClose(void)
+{
+  perfCounters_t *pCounters;
+  int i;
+
+  epicsThreadOnce(&perfOnce, perfInit, 0);
+  pCounters = (perfCounters_t *)epicsThreadPrivateGet(perfCountersId);
+  if (!pCounters) return;
+  epicsThreadPrivateSet(perfCountersId, 0);
+  if (pCounters == &noCounters) return;
+  for (i=0; i<NUM_PERF_EVENTS; i++) {
+    if (pCounters->fds[i] >= 0) close(pCounters->fds[i]);
+  }
+  free(pCounters);
+}
+
+#else
+
+int NDPerfCountersRead(NDPerfCounts_t *pCounts)
+{
+  memset(pCounts, 0, sizeof(*pCounts));
+  return -1;
+}
+
+void NDPerfCountersClose(void)
+{
+}
+
+#endif
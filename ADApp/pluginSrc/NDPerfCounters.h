@@ -0,0 +1,33 @@
+/** NDPerfCounters.h
+ *
+ * Optional counting of the CPU cycles, instructions, last level cache misses and branch misses of the
+ * calling thread with the Linux hardware performance counters, see perf_event_open(2).
+ *
+ */
+
+#ifndef NDPerfCounters_H
+#define NDPerfCounters_H
+
+#include <shareLib.h>
+
+/** The counts of the calling thread since its counters were opened.  The counts are scaled up when the kernel
+  * multiplexes the counters with other users of them, and are 0 for the events the CPU does not count. */
+typedef struct {
+    double cycles;
+    double instructions;
+    double cacheMisses;     /**< Last level cache misses */
+    double branchMisses;
+} NDPerfCounts_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDPerfCountersRead(NDPerfCounts_t *pCounts);
+epicsShareFunc void NDPerfCountersClose(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
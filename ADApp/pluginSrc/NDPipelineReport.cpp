@@ -0,0 +1,302 @@
+/** NDPipelineReport.cpp
+ *
+ * Report of the NDArray plugin graph of the IOC.
+ *
+ * The graph is found from the NDArrayPort and NDArrayAddr of each plugin.  The ports that plugins get their
+ * arrays from and that are not plugins are the drivers at the roots of the graph.  The counters of each node are
+ * read twice, period seconds apart, to get the rates.  The bottleneck is the enabled plugin with the highest
+ * load, which is the larger of the fraction of time its threads are busy and the fraction of its queue in use,
+ * plus the fraction of its input arrays that it dropped.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <asynPortDriver.h>
+
+#include "NDPluginDriver.h"
+#include "NDPipelineReport.h"
+
+/** A node with its rates over the period */
+typedef struct {
+    NDPipelineNode_t status;
+    double inputRate;           /**< Arrays per second received by a plugin, including those it dropped */
+    double outputRate;          /**< Arrays per second processed by a plugin, or produced by a driver */
+    double dropRate;            /**< Arrays per second dropped by a plugin, because the queue was full or for MaxAge */
+    double busy;                /**< Fraction of the time the threads of a plugin were processing arrays */
+    double queueUse;            /**< Fraction of the queue of a plugin in use at the end of the period */
+    double load;
+} pipelineNode_t;
+
+/** Returns the status of a port that plugins get their arrays from and that is not a plugin.
+  * The status of ports that are not NDArray drivers only has the name. */
+static NDPipelineNode_t driverNode(const std::string &portName)
+{
+    NDPipelineNode_t node;
+    asynNDArrayDriver *pDriver = dynamic_cast<asynNDArrayDriver *>(findAsynPortDriver(portName.c_str()));
+    NDArrayPool *pPool;
+    int index;
+
+    node.portName = portName;
+    node.arrayAddr = 0;
+    node.isPlugin = false;
+    node.enableCallbacks = true;
+    node.blockingCallbacks = false;
+    node.arrayCounter = 0;
+    node.droppedArrays = 0;
+    node.expiredArrays = 0;
+    node.poolHeld = 0;
+    node.queueSize = 0;
+    node.queueFree = 0;
+    node.numThreads = 0;
+    node.processTime = 0.;
+    node.poolBuffers = 0;
+    node.poolFreeBuffers = 0;
+    node.poolMemory = 0.;
+    node.poolMaxMemory = 0.;
+    if (!pDriver) return node;
+    pDriver->lock();
+    if (pDriver->findParam(NDArrayCounterString, &index) == asynSuccess) {
+        pDriver->getIntegerParam(index, &node.arrayCounter);
+    }
+    pPool = pDriver->getNDArrayPool();
+    if (pPool) {
+        node.poolBuffers = pPool->numBuffers();
+        node.poolFreeBuffers = pPool->numFree();
+        node.poolMemory = (double)pPool->memorySize();
+        node.poolMaxMemory = (double)pPool->maxMemory();
+    }
+    pDriver->unlock();
+    return node;
+}
+
+/** Reads the status of all of the plugins and of the drivers they get their arrays from.
+  * \param[in] plugins The plugins.
+  * \param[in] drivers The drivers found the first time; the drivers that are found are added to it. */
+static std::vector<NDPipelineNode_t> readNodes(const std::vector<NDPluginDriver*> &plugins,
+                                               std::vector<std::string> &drivers)
+{
+    std::vector<NDPipelineNode_t> nodes(plugins.size());
+    size_t i, j;
+
+    for (i=0; i<plugins.size(); i++) {
+        plugins[i]->getPipelineNode(&nodes[i]);
+    }
+    for (i=0; i<plugins.size(); i++) {
+        const std::string &arrayPort = nodes[i].arrayPort;
+        if (arrayPort.empty()) continue;
+        for (j=0; j<plugins.size(); j++) {
+            if (nodes[j].portName == arrayPort) break;
+        }
+        if (j < plugins.size()) continue;
+        for (j=0; j<drivers.size(); j++) {
+            if (drivers[j] == arrayPort) break;
+        }
+        if (j == drivers.size()) drivers.push_back(arrayPort);
+    }
+    for (i=0; i<drivers.size(); i++) {
+        nodes.push_back(driverNode(drivers[i]));
+    }
+    return nodes;
+}
+
+/** Returns the increase of a counter, which is 0 if the counter was reset during the period */
+static double counterDelta(int first, int last)
+{
+    return (last > first) ? (double)(last - first) : 0.;
+}
+
+/** Computes the rates and the load of the nodes from their status at the start and at the end of the period */
+static std::vector<pipelineNode_t> computeRates(const std::vector<NDPipelineNode_t> &first,
+                                                const std::vector<NDPipelineNode_t> &last, double period)
+{
+    std::vector<pipelineNode_t> nodes(last.size());
+    double processed, dropped;
+    size_t i, j;
+
+    for (i=0; i<last.size(); i++) {
+        pipelineNode_t *pNode = &nodes[i];
+        const NDPipelineNode_t *pFirst = 0;
+        pNode->status = last[i];
+        for (j=0; j<first.size(); j++) {
+            if (first[j].portName == last[i].portName) pFirst = &first[j];
+        }
+        processed = pFirst ? counterDelta(pFirst->arrayCounter, last[i].arrayCounter) : 0.;
+        dropped = pFirst ? counterDelta(pFirst->droppedArrays, last[i].droppedArrays) +
+                           counterDelta(pFirst->expiredArrays, last[i].expiredArrays) : 0.;
+        pNode->outputRate = processed / period;
+        pNode->dropRate = dropped / period;
+        pNode->inputRate = pNode->outputRate + pNode->dropRate;
+        pNode->busy = pNode->outputRate * last[i].processTime /
+                      ((last[i].numThreads > 0) ? last[i].numThreads : 1);
+        pNode->queueUse = (last[i].queueSize > 0) ?
+                          (double)(last[i].queueSize - last[i].queueFree) / last[i].queueSize : 0.;
+        pNode->load = (pNode->busy > pNode->queueUse) ? pNode->busy : pNode->queueUse;
+        if (pNode->inputRate > 0.) pNode->load += pNode->dropRate / pNode->inputRate;
+    }
+    return nodes;
+}
+
+/** Prints a node and the plugins that get their arrays from it, indented by their depth in the graph */
+static void printNode(FILE *fp, const std::vector<pipelineNode_t> &nodes, size_t index, int depth,
+                      int bottleneck, std::vector<bool> &printed)
+{
+    const pipelineNode_t *pNode = &nodes[index];
+    const NDPipelineNode_t *pStatus = &pNode->status;
+    char name[128];
+    size_t i;
+
+    printed[index] = true;
+    if (pStatus->isPlugin) {
+        epicsSnprintf(name, sizeof(name), "%*s%s[%d]", 2*depth, "", pStatus->portName.c_str(), pStatus->arrayAddr);
+        fprintf(fp, "%-28s %-22s in %8.1f/s out %8.1f/s drops %7.1f/s queue %4d/%-4d threads %2d busy %5.1f%%",
+                name, pStatus->pluginType.c_str(), pNode->inputRate, pNode->outputRate, pNode->dropRate,
+                pStatus->queueSize - pStatus->queueFree, pStatus->queueSize, pStatus->numThreads,
+                pNode->busy * 100.);
+        if (pStatus->poolHeld > 0) fprintf(fp, " holds %d", pStatus->poolHeld);
+    } else {
+        epicsSnprintf(name, sizeof(name), "%*s%s", 2*depth, "", pStatus->portName.c_str());
+        fprintf(fp, "%-28s %-22s                out %8.1f/s", name, "(driver)", pNode->outputRate);
+    }
+    fprintf(fp, " pool %d/%d buffers %.1f MB", pStatus->poolBuffers - pStatus->poolFreeBuffers,
+            pStatus->poolBuffers, pStatus->poolMemory / 1048576.);
+    if (pStatus->isPlugin && !pStatus->enableCallbacks) fprintf(fp, " disabled");
+    if (!pStatus->fusedTo.empty()) fprintf(fp, " fused");
+    else if (pStatus->blockingCallbacks) fprintf(fp, " blocking");
+    if ((int)index == bottleneck) fprintf(fp, " <- bottleneck");
+    fprintf(fp, "\n");
+    for (i=0; i<nodes.size(); i++) {
+        if (!printed[i] && nodes[i].status.isPlugin && (nodes[i].status.arrayPort == pStatus->portName)) {
+            printNode(fp, nodes, i, depth+1, bottleneck, printed);
+        }
+    }
+}
+
+/** Writes a string as a JSON string */
+static void writeJSONString(FILE *fp, const std::string &value)
+{
+    size_t i;
+
+    fputc('"', fp);
+    for (i=0; i<value.size(); i++) {
+        if ((value[i] == '"') || (value[i] == '\\')) fputc('\\', fp);
+        if ((unsigned char)value[i] >= ' ') fputc(value[i], fp);
+    }
+    fputc('"', fp);
+}
+
+/** Writes the nodes as JSON, with the upstream port of each plugin, so that a display can draw the graph */
+static void writeJSON(FILE *fp, const std::vector<pipelineNode_t> &nodes, int bottleneck, double period)
+{
+    epicsTimeStamp now;
+    char timeString[64];
+    size_t i;
+
+    epicsTimeGetCurrent(&now);
+    epicsTimeToStrftime(timeString, sizeof(timeString), "%Y-%m-%dT%H:%M:%S.%03f", &now);
+    fprintf(fp, "{\n  \"time\": \"%s\",\n  \"period\": %g,\n  \"bottleneck\": ", timeString, period);
+    if (bottleneck >= 0) writeJSONString(fp, nodes[bottleneck].status.portName);
+    else fprintf(fp, "null");
+    fprintf(fp, ",\n  \"nodes\": [");
+    for (i=0; i<nodes.size(); i++) {
+        const pipelineNode_t *pNode = &nodes[i];
+        const NDPipelineNode_t *pStatus = &pNode->status;
+        fprintf(fp, "%s\n    {\"port\": ", i ? "," : "");
+        writeJSONString(fp, pStatus->portName);
+        fprintf(fp, ", \"plugin\": %s", pStatus->isPlugin ? "true" : "false");
+        if (pStatus->isPlugin) {
+            fprintf(fp, ", \"type\": ");
+            writeJSONString(fp, pStatus->pluginType);
+            fprintf(fp, ", \"upstream\": ");
+            writeJSONString(fp, pStatus->arrayPort);
+            fprintf(fp, ", \"upstreamAddr\": %d, \"fusedTo\": ", pStatus->arrayAddr);
+            writeJSONString(fp, pStatus->fusedTo);
+            fprintf(fp, ", \"enabled\": %s, \"blocking\": %s",
+                    pStatus->enableCallbacks ? "true" : "false", pStatus->blockingCallbacks ? "true" : "false");
+            fprintf(fp, ", \"inputRate\": %.3f, \"dropRate\": %.3f", pNode->inputRate, pNode->dropRate);
+            fprintf(fp, ", \"droppedArrays\": %d, \"expiredArrays\": %d", pStatus->droppedArrays, pStatus->expiredArrays);
+            fprintf(fp, ", \"poolHeld\": %d", pStatus->poolHeld);
+            fprintf(fp, ", \"queueSize\": %d, \"queueUsed\": %d, \"threads\": %d",
+                    pStatus->queueSize, pStatus->queueSize - pStatus->queueFree, pStatus->numThreads);
+            fprintf(fp, ", \"processTimeMs\": %.3f, \"busy\": %.4f, \"load\": %.4f",
+                    pStatus->processTime * 1e3, pNode->busy, pNode->load);
+        }
+        fprintf(fp, ", \"outputRate\": %.3f, \"arrayCounter\": %d", pNode->outputRate, pStatus->arrayCounter);
+        fprintf(fp, ", \"poolBuffers\": %d, \"poolFreeBuffers\": %d, \"poolMemoryMB\": %.3f, \"poolMaxMemoryMB\": %.3f}",
+                pStatus->poolBuffers, pStatus->poolFreeBuffers,
+                pStatus->poolMemory / 1048576., pStatus->poolMaxMemory / 1048576.);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+/** Prints the graph of the plugins of the IOC, with the input and output rates, drops, queue use, threads, busy
+  * fraction and pool use of each plugin, and shows the bottleneck.  The rates are measured over period seconds.
+  * \param[in] fileName If not empty, the report is also written to this file as JSON, for displays that poll it.
+  *            It is written to fileName.tmp and renamed, so readers never see a partial file.
+  * \param[in] period The time in seconds over which the rates are measured; 0 uses 1 second.
+  * \return 0 on success, -1 if the file could not be written.
+  */
+int NDPipelineReport(const char *fileName, double period)
+{
+    std::vector<NDPluginDriver*> plugins;
+    std::vector<NDPipelineNode_t> first, last;
+    std::vector<pipelineNode_t> nodes;
+    std::vector<std::string> drivers;
+    std::vector<bool> printed;
+    std::string tempName;
+    int bottleneck = -1;
+    FILE *fp;
+    size_t i;
+
+    if (period <= 0.) period = 1.;
+    NDPluginDriver::getPlugins(plugins);
+    first = readNodes(plugins, drivers);
+    epicsThreadSleep(period);
+    last = readNodes(plugins, drivers);
+    nodes = computeRates(first, last, period);
+
+    for (i=0; i<nodes.size(); i++) {
+        if (!nodes[i].status.isPlugin || !nodes[i].status.enableCallbacks || (nodes[i].load <= 0.)) continue;
+        if ((bottleneck < 0) || (nodes[i].load > nodes[bottleneck].load)) bottleneck = (int)i;
+    }
+
+    printf("NDArray pipeline over %g s, %d plugins\n", period, (int)plugins.size());
+    printed.assign(nodes.size(), false);
+    /* The drivers first, then the plugins whose upstream port is not known */
+    for (i=plugins.size(); i<nodes.size(); i++) {
+        printNode(stdout, nodes, i, 0, bottleneck, printed);
+    }
+    for (i=0; i<nodes.size(); i++) {
+        if (!printed[i]) printNode(stdout, nodes, i, 0, bottleneck, printed);
+    }
+    if (bottleneck >= 0) {
+        const pipelineNode_t *pNode = &nodes[bottleneck];
+        printf("Bottleneck: %s, busy %.1f%%, queue %.1f%% used, %.1f arrays/s dropped of %.1f/s\n",
+               pNode->status.portName.c_str(), pNode->busy * 100., pNode->queueUse * 100.,
+               pNode->dropRate, pNode->inputRate);
+    } else {
+        printf("Bottleneck: none, no plugin processed or dropped arrays\n");
+    }
+
+    if (!fileName || !fileName[0]) return 0;
+    tempName = std::string(fileName) + ".tmp";
+    fp = fopen(tempName.c_str(), "w");
+    if (!fp) {
+        printf("NDPipelineReport: cannot open file %s\n", tempName.c_str());
+        return -1;
+    }
+    writeJSON(fp, nodes, bottleneck, period);
+    if (fclose(fp) || rename(tempName.c_str(), fileName)) {
+        printf("NDPipelineReport: cannot write file %s\n", fileName);
+        remove(tempName.c_str());
+        return -1;
+    }
+    return 0;
+}
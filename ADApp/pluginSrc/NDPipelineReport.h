@@ -0,0 +1,50 @@
+/** NDPipelineReport.h
+ *
+ * Report of the NDArray plugin graph of the IOC, with the rates, queues, drops, threads and pools of each node
+ * and the node that limits the rate of the pipeline.
+ *
+ */
+
+#ifndef NDPipelineReport_H
+#define NDPipelineReport_H
+
+#include <string>
+
+#include <shareLib.h>
+
+/** The status of a driver or plugin of the pipeline.  NDPluginDriver::getPipelineNode() fills in a plugin,
+  * and NDPipelineReport() the drivers that plugins get their arrays from. */
+typedef struct {
+    std::string portName;
+    std::string pluginType;     /**< PluginType of a plugin; empty for a driver */
+    std::string arrayPort;      /**< NDArrayPort of a plugin; empty for a driver */
+    int arrayAddr;
+    std::string fusedTo;        /**< The upstream plugin this plugin is fused to, if any */
+    bool isPlugin;
+    bool enableCallbacks;
+    bool blockingCallbacks;
+    int arrayCounter;           /**< ArrayCounter, the arrays that were processed */
+    int droppedArrays;          /**< Arrays dropped because the queue was full */
+    int expiredArrays;          /**< Arrays dropped for MaxAge */
+    int poolHeld;               /**< Arrays of the upstream pools that the queue holds, see PoolQuota */
+    int queueSize;
+    int queueFree;
+    int numThreads;             /**< Threads that process the arrays; 0 with blocking callbacks */
+    double processTime;         /**< Median processing time of an array (s) */
+    int poolBuffers;            /**< Buffers allocated by the NDArrayPool of the port */
+    int poolFreeBuffers;
+    double poolMemory;          /**< Memory allocated by the NDArrayPool of the port (bytes) */
+    double poolMaxMemory;       /**< Maximum memory of the NDArrayPool, 0 if unlimited (bytes) */
+} NDPipelineNode_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDPipelineReport(const char *fileName, double period);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
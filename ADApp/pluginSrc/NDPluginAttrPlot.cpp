@@ -10,6 +10,7 @@
 
 #include <epicsExport.h>
 #include "NDPluginAttrPlot.h"
+#include "NDDecimationKernels.h"
 #include "CircularBuffer.h"
 
 ExposeDataTask::ExposeDataTask(NDPluginAttrPlot& plugin)
@@ -64,6 +65,8 @@ NDPluginAttrPlot::NDPluginAttrPlot(const char * port, int n_attributes,
       state_(NDAttrPlot_InitState),
       data_(),
       uids_(cache_size),
+      n_pushed_(0),
+      n_exposed_(0),
       n_attributes_(n_attributes),
       attributes_(),
       n_data_blocks_(n_data_blocks),
@@ -84,6 +87,15 @@ NDPluginAttrPlot::NDPluginAttrPlot(const char * port, int n_attributes,
             &NDAttrPlotAttribute);
     createParam(NDAttrPlotResetString, asynParamInt32, &NDAttrPlotReset);
     createParam(NDAttrPlotNPtsString, asynParamInt32, &NDAttrPlotNPts);
+    createParam(NDAttrPlotDataNewString, asynParamFloat64Array,
+            &NDAttrPlotDataNew);
+    createParam(NDAttrPlotDecimationString, asynParamInt32,
+            &NDAttrPlotDecimation);
+    createParam(NDAttrPlotDisplayPointsString, asynParamInt32,
+            &NDAttrPlotDisplayPoints);
+
+    setIntegerParam(NDAttrPlotDecimation, NDAttrPlot_DecimateNone);
+    setIntegerParam(NDAttrPlotDisplayPoints, ND_ATTRPLOT_DISPLAY_POINTS);
 
     setStringParam(NDPluginDriverPluginType, "NDAttrPlot");
 
@@ -94,41 +106,113 @@ void NDPluginAttrPlot::start_expose() {
     expose_task_.start();
 }
 
+size_t NDPluginAttrPlot::copy_block(size_t block, double * buffer) const {
+    int selected = data_selections_[block];
+    if (selected == ND_ATTRPLOT_UID_INDEX) {
+        return uids_.copy_to_array(buffer, uids_.size());
+    } else if (selected >= 0 &&
+            static_cast<unsigned>(selected) < data_.size()) {
+        return data_[selected].copy_to_array(buffer, uids_.size());
+    }
+    return 0;
+}
+
 void NDPluginAttrPlot::callback_data() {
 
     size_t size = uids_.size();
     size_t cache_size = uids_.max_size();
     double * const tmp_arr = new double[cache_size];
+    int decimation, display_points;
+
+    getIntegerParam(NDAttrPlotDecimation, &decimation);
+    getIntegerParam(NDAttrPlotDisplayPoints, &display_points);
+    size_t n_display = display_points > 0 ? display_points : 0;
+    bool decimate = decimation != NDAttrPlot_DecimateNone &&
+            n_display >= 2 && size > n_display;
+
+    // LTTB selects the points from the first selected attribute, or from
+    // the UIDs if only they are selected, against the UIDs
+    std::vector<double> decimated(decimate ? n_display : 0);
+    std::vector<size_t> indices;
+    size_t n_indices = 0;
+    if (decimate && decimation == NDAttrPlot_DecimateLTTB) {
+        std::vector<double> uids(size);
+        uids_.copy_to_array(&uids[0], size);
+        indices.resize(n_display);
+        size_t ref = 0;
+        while (ref < n_data_blocks_ && (data_selections_[ref] < 0 ||
+                static_cast<unsigned>(data_selections_[ref]) >= data_.size())) {
+            ++ref;
+        }
+        if (ref < n_data_blocks_ && copy_block(ref, tmp_arr) == size) {
+            n_indices = NDDecimateLTTB(&uids[0], tmp_arr, size, n_display,
+                    &indices[0]);
+        } else {
+            n_indices = NDDecimateLTTB(NULL, &uids[0], size, n_display,
+                    &indices[0]);
+        }
+    }
 
     size_t n_copied;
     for (size_t i = 0; i < n_data_blocks_; ++i) {
         int selected = data_selections_[i];
-        if (selected == ND_ATTRPLOT_UID_INDEX) {
-            n_copied = uids_.copy_to_array(tmp_arr, size);
-        } else if (selected >= 0 &&
-                static_cast<unsigned>(selected) < data_.size()) {
-            n_copied = data_[selected].copy_to_array(tmp_arr,
-                    size);
+        bool has_data = selected == ND_ATTRPLOT_UID_INDEX || (selected >= 0 &&
+                static_cast<unsigned>(selected) < data_.size());
+        if (has_data) {
+            n_copied = copy_block(i, tmp_arr);
         } else {
             std::fill(tmp_arr, tmp_arr + size, epicsNAN);
             n_copied = size;
         }
+        if (decimate) {
+            size_t n_out = 0;
+            if (has_data && decimation == NDAttrPlot_DecimateMinMax) {
+                n_out = NDDecimateMinMax(tmp_arr, n_copied, n_display / 2,
+                        &decimated[0]);
+            } else if (has_data) {
+                for (n_out = 0; n_out < n_indices; ++n_out) {
+                    decimated[n_out] = indices[n_out] < n_copied ?
+                            tmp_arr[indices[n_out]] : epicsNAN;
+                }
+            }
+            std::fill(decimated.begin() + n_out, decimated.end(),
+                    n_out > 0 ? decimated[n_out - 1] : epicsNAN);
+            doCallbacksFloat64Array(&decimated[0], n_display, NDAttrPlotData,
+                    (int)i);
+            continue;
+        }
         // To remove visual artifacts on EDM plots fill
         // the remaining arrays with the last point
         std::fill(tmp_arr + n_copied,
                 tmp_arr + cache_size,
-                *(tmp_arr + n_copied - 1));
+                n_copied > 0 ? *(tmp_arr + n_copied - 1) : epicsNAN);
         doCallbacksFloat64Array(tmp_arr, cache_size, NDAttrPlotData, (int)i);
     }
 
+    // The points appended since the last exposure
+    size_t n_new = std::min(n_pushed_ - n_exposed_, size);
+    for (size_t i = 0; i < n_data_blocks_ && n_new > 0; ++i) {
+        int selected = data_selections_[i];
+        if (selected == ND_ATTRPLOT_UID_INDEX) {
+            n_copied = uids_.copy_last_to_array(tmp_arr, n_new);
+        } else if (selected >= 0 &&
+                static_cast<unsigned>(selected) < data_.size()) {
+            n_copied = data_[selected].copy_last_to_array(tmp_arr, n_new);
+        } else {
+            continue;
+        }
+        doCallbacksFloat64Array(tmp_arr, n_copied, NDAttrPlotDataNew, (int)i);
+    }
+    n_exposed_ = n_pushed_;
+
     delete[] tmp_arr;
 }
 
 void NDPluginAttrPlot::processCallbacks(NDArray *pArray) {
-    NDAttributeList attr_list;
+    // The attributes are only read, so the list of the array is used directly
+    NDAttributeList& attr_list = *pArray->pAttributeList;
 
     NDPluginDriver::beginProcessCallbacks(pArray);
-    pArray->pAttributeList->copy(&attr_list);
 
     epicsInt32 uid;
     getIntegerParam(NDUniqueId, &uid);
@@ -204,6 +288,8 @@ void NDPluginAttrPlot::rebuild_attributes(NDAttributeList& attr_list) {
 void NDPluginAttrPlot::reset_data() {
     state_ = NDAttrPlot_InitState;
     uids_.clear();
+    n_pushed_ = 0;
+    n_exposed_ = 0;
     for (std::vector<CB>::iterator it = data_.begin();
             it != data_.end(); ++it) {
         it->clear();
@@ -244,25 +330,23 @@ asynStatus NDPluginAttrPlot::push_data(epicsInt32 uid, NDAttributeList& list) {
     double *new_values = new double[length];
     std::fill(new_values, new_values + length, epicsNAN);
 
-    // Populate the new values with values from the attribute list
-    for (NDAttribute * attr = list.next(NULL);
-            attr != NULL; attr = list.next(attr)) {
-        std::string name(attr->getName());
-        std::vector<std::string>::const_iterator it = std::find(
-                attributes_.begin(), attributes_.end(), name);
-        if (it != attributes_.end()) {
-            ptrdiff_t index = it - attributes_.begin();
-            attr->getValue(NDAttrFloat64, &new_values[index], 1);
+    // Populate the new values with values from the attribute list, looking
+    // up each cached attribute in the hash index of the list
+    for (size_t i = 0; i < length; ++i) {
+        NDAttribute * attr = list.find(attributes_[i].c_str());
+        if (attr != NULL) {
+            attr->getValue(NDAttrFloat64, &new_values[i], 1);
         }
     }
 
     // Push the new values to the data block
     uids_.push_back(uid);
+    n_pushed_++;
     for (size_t i = 0; i < length; ++i) {
         data_[i].push_back(new_values[i]);
     }
 
-    delete new_values;
+    delete[] new_values;
     return asynSuccess;
 }
 
@@ -289,6 +373,16 @@ asynStatus NDPluginAttrPlot::writeInt32(asynUser * pasynUser, epicsInt32 value)
     } else if (reason == NDAttrPlotReset) {
         reset_data();
         return asynSuccess;
+    } else if (reason == NDAttrPlotDecimation ||
+            reason == NDAttrPlotDisplayPoints) {
+        if (value < 0 || (reason == NDAttrPlotDecimation &&
+                value > NDAttrPlot_DecimateLTTB)) {
+            return asynError;
+        }
+        setIntegerParam(reason, value);
+        callParamCallbacks();
+        callback_data();
+        return asynSuccess;
     }
 
     return NDPluginDriver::writeInt32(pasynUser, value);
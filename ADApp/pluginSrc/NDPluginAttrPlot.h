@@ -29,6 +29,9 @@
 #define NDAttrPlotAttributeString   "AP_Attribute"
 #define NDAttrPlotResetString       "AP_Reset"
 #define NDAttrPlotNPtsString        "AP_NPts"
+#define NDAttrPlotDataNewString     "AP_DataNew"
+#define NDAttrPlotDecimationString  "AP_Decimation"
+#define NDAttrPlotDisplayPointsString "AP_DisplayPoints"
 
 #define ND_ATTRPLOT_UID_INDEX        -1
 #define ND_ATTRPLOT_UID_LABEL        "UID"
@@ -36,6 +39,16 @@
 #define ND_ATTRPLOT_NONE_LABEL       "None"
 
 #define ND_ATTRPLOT_DATA_EXPOSURE_PERIOD 1. // Data callback period in seconds
+#define ND_ATTRPLOT_DISPLAY_POINTS 2000     // Default number of decimated points
+
+/**
+ * Decimation of the data exposed in AP_Data.
+ */
+enum NDAttrPlotDecimation {
+    NDAttrPlot_DecimateNone,   /**< All the cached points */
+    NDAttrPlot_DecimateMinMax, /**< Minimum and maximum of each of AP_DisplayPoints/2 buckets */
+    NDAttrPlot_DecimateLTTB    /**< AP_DisplayPoints points selected by Largest-Triangle-Three-Buckets */
+};
 
 class NDPluginAttrPlot;
 
@@ -89,6 +102,13 @@ private:
  * The attributes are read from the NDArray on the first frame of acquisition
  * and populated in first come first served fashion (unpredictable order).
  * On reset or reacquistion the cache is cleared and all data is discarded.
+ *
+ * Long caches can be decimated to AP_DisplayPoints points for display, with
+ * a min/max envelope or with LTTB.  LTTB selects the points from the first
+ * selected attribute, against the UIDs, and exposes the same points of every
+ * selected block so that blocks used as X and Y stay paired.  AP_DataNew
+ * exposes only the points appended since the previous exposure, so that
+ * clients can append them to their own copy instead of reading the cache.
  */
 class NDPluginAttrPlot : public NDPluginDriver
 {
@@ -147,7 +167,10 @@ protected:
     int NDAttrPlotAttribute;
     int NDAttrPlotReset;
     int NDAttrPlotNPts;
-#define NDATTRPLOT_LAST_PARAM NDAttrPlotNPts
+    int NDAttrPlotDataNew;
+    int NDAttrPlotDecimation;
+    int NDAttrPlotDisplayPoints;
+#define NDATTRPLOT_LAST_PARAM NDAttrPlotDisplayPoints
 #define NUM_NDATTRPLOT_PARAMS (&NDATTRPLOT_LAST_PARAM - \
                                &NDATTRPLOT_FIRST_PARAM + 1)
 
@@ -188,9 +211,21 @@ private:
 
     /**
      * \brief Exposes the selected data fields to EPICS layer.
+     *
+     * AP_Data is decimated as selected by AP_Decimation, and AP_DataNew
+     * receives the points appended since the last call.
      */
     void callback_data();
 
+    /**
+     * \brief Copies the cache of a data block to an array.
+     *
+     * \param block Index of the data block.
+     * \param buffer Array of at least the cache size.
+     * \return The number of points copied, or 0 if nothing is selected.
+     */
+    size_t copy_block(size_t block, double * buffer) const;
+
     /**
      * \brief Exposes the attribute names to the EPICS layer.
      */
@@ -211,6 +246,12 @@ private:
     /** Container for uids */
     CB uids_;
 
+    /** Number of points cached since the reset */
+    size_t n_pushed_;
+
+    /** Value of n_pushed_ at the last data exposure */
+    size_t n_exposed_;
+
     /** Maximum number of saved attributes */
     const size_t n_attributes_;
 
@@ -31,6 +31,16 @@ const char*      NDPluginAttribute::TIMESTAMP_NAME_     = "NDArrayTimeStamp";
 const char*      NDPluginAttribute::EPICS_TS_SEC_NAME_  = "NDArrayEpicsTSSec";
 const char*      NDPluginAttribute::EPICS_TS_NSEC_NAME_ = "NDArrayEpicsTSnSec";
 
+/* Where the value of an address comes from */
+typedef enum {
+  AttrSourceNone,
+  AttrSourceAttribute,
+  AttrSourceUniqueId,
+  AttrSourceTimeStamp,
+  AttrSourceEpicsTSSec,
+  AttrSourceEpicsTSNsec
+} NDAttributeSource_t;
+
 typedef enum {
   TSEraseStart,
   TSStart,
@@ -56,7 +66,7 @@ void NDPluginAttribute::processCallbacks(NDArray *pArray)
   int TSAcquiring;
   double valueSum;
   int i;
-  char attrName[MAX_ATTR_NAME_] = {0};
+  const char *attrName;
   NDAttribute *pAttribute = NULL;
   NDAttributeList *pAttrList = NULL;
   epicsFloat64 attrValue = 0.0;
@@ -73,18 +83,20 @@ void NDPluginAttribute::processCallbacks(NDArray *pArray)
   getIntegerParam(NDPluginAttributeTSNumPoints,    &numTSPoints);
   getIntegerParam(NDPluginAttributeTSAcquiring,    &TSAcquiring);
 
+  /* The names were resolved by writeOctet(), so only the attributes are looked up */
   for (i=0; i<maxAttributes_; i++) {
-    getStringParam(i, NDPluginAttributeAttrName, MAX_ATTR_NAME_, attrName);
+    if (attrSources_[i] == AttrSourceNone) continue;
+    attrName = attrNames_[i].c_str();
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "Finding the attribute %s\n", attrName);
 
-    if (strcmp(attrName, UNIQUE_ID_NAME_) == 0) {
+    if (attrSources_[i] == AttrSourceUniqueId) {
       attrValue = (epicsFloat64) pArray->uniqueId;
-    } else if (strcmp(attrName, TIMESTAMP_NAME_) == 0) {
+    } else if (attrSources_[i] == AttrSourceTimeStamp) {
       attrValue = pArray->timeStamp;
-    } else if (strcmp(attrName, EPICS_TS_SEC_NAME_) == 0) {
+    } else if (attrSources_[i] == AttrSourceEpicsTSSec) {
       attrValue = (epicsFloat64)pArray->epicsTS.secPastEpoch;
-    } else if (strcmp(attrName, EPICS_TS_NSEC_NAME_) == 0) {
+    } else if (attrSources_[i] == AttrSourceEpicsTSNsec) {
       attrValue = (epicsFloat64)pArray->epicsTS.nsec;
     } else {
       pAttribute = pAttrList->find(attrName);
@@ -119,6 +131,30 @@ void NDPluginAttribute::processCallbacks(NDArray *pArray)
   }
 }
 
+/** Resolves the attribute name of an address to the source of its value.
+  * \param[in] index The address.
+  */
+void NDPluginAttribute::resolveAttrName(int index)
+{
+  char attrName[MAX_ATTR_NAME_] = {0};
+
+  getStringParam(index, NDPluginAttributeAttrName, MAX_ATTR_NAME_, attrName);
+  attrNames_[index] = attrName;
+  if (attrName[0] == 0) {
+    attrSources_[index] = AttrSourceNone;
+  } else if (strcmp(attrName, UNIQUE_ID_NAME_) == 0) {
+    attrSources_[index] = AttrSourceUniqueId;
+  } else if (strcmp(attrName, TIMESTAMP_NAME_) == 0) {
+    attrSources_[index] = AttrSourceTimeStamp;
+  } else if (strcmp(attrName, EPICS_TS_SEC_NAME_) == 0) {
+    attrSources_[index] = AttrSourceEpicsTSSec;
+  } else if (strcmp(attrName, EPICS_TS_NSEC_NAME_) == 0) {
+    attrSources_[index] = AttrSourceEpicsTSNsec;
+  } else {
+    attrSources_[index] = AttrSourceAttribute;
+  }
+}
+
 void NDPluginAttribute::doTimeSeriesCallbacks()
 {
   int currentTSPoint;
@@ -208,6 +244,28 @@ asynStatus NDPluginAttribute::writeInt32(asynUser *pasynUser, epicsInt32 value)
 }
 
 
+/** Called when asyn clients call pasynOctet->write().
+  * Resolves the attribute names when they change, and passes the other parameters to NDPluginDriver::writeOctet.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written.
+  */
+asynStatus NDPluginAttribute::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+  int function = pasynUser->reason;
+  int addr;
+  asynStatus status;
+
+  status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+  if ((status == asynSuccess) && (function == NDPluginAttributeAttrName)) {
+    status = getAddress(pasynUser, &addr);
+    if ((status == asynSuccess) && (addr >= 0) && (addr < maxAttributes_)) resolveAttrName(addr);
+  }
+  return status;
+}
+
+
 /** Constructor for NDPluginAttribute; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   *
   * \param[in] portName The name of the asyn port driver to be created.
@@ -243,6 +301,8 @@ NDPluginAttribute::NDPluginAttribute(const char *portName, int queueSize, int bl
 
   maxAttributes_ = maxAttributes;
   if (maxAttributes_ < 1) maxAttributes_ = 1;
+  attrNames_.resize(maxAttributes_);
+  attrSources_.resize(maxAttributes_, AttrSourceNone);
   /* parameters */
   createParam(NDPluginAttributeAttrNameString,       asynParamOctet,        &NDPluginAttributeAttrName);
   createParam(NDPluginAttributeResetString,          asynParamInt32,        &NDPluginAttributeReset);
@@ -2,6 +2,9 @@
 #ifndef NDPluginAttribute_H
 #define NDPluginAttribute_H
 
+#include <string>
+#include <vector>
+
 #include <epicsTypes.h>
 
 #include "NDPluginDriver.h"
@@ -27,6 +30,7 @@ public:
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
 
 protected:
     int NDPluginAttributeAttrName;
@@ -43,6 +47,7 @@ protected:
 private:
 
     void doTimeSeriesCallbacks();
+    void resolveAttrName(int index);
     static const epicsInt32 MAX_ATTR_NAME_;
     static const char*      UNIQUE_ID_NAME_;
     static const char*      TIMESTAMP_NAME_;
@@ -51,6 +56,8 @@ private:
 
     int maxAttributes_;
     epicsFloat64 **pTSArray_;
+    std::vector<std::string> attrNames_;  /* The attribute name of each address */
+    std::vector<int> attrSources_;        /* Where the value of each address comes from, resolved from its name */
 
 };
     
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <algorithm>
+
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
@@ -25,12 +27,40 @@
 
 #include <epicsExport.h>
 #include "NDArray.h"
+#include "NDCompressKernels.h"
 #include "NDPluginCircularBuff.h"
 
 static const char *driverName="NDPluginCircularBuff";
 
 #define DEFAULT_TRIGGER_CALC "0"
 
+/* The arrays that can wait for the thread of the spill file, beyond the MemoryDepth arrays kept in memory */
+#define SPILL_MAX_PENDING 4
+
+/* How often the drain thread offers an array again to a downstream plugin whose queue is full, and for how long */
+#define DRAIN_RETRY_DELAY 0.001
+#define DRAIN_TIMEOUT 1.0
+
+/* The blocks of the data of one array, for compressTask() and decompressTask() */
+typedef struct {
+    NDShuffle_t shuffle;
+    size_t elementSize;
+    char *pData;            /* The data of the array */
+    size_t dataSize;
+    char *pScratch;         /* ND_COMPRESS_BLOCK_SIZE bytes for each block */
+    char *pBlocks;          /* The compressed blocks, NDCompressBound(ND_COMPRESS_BLOCK_SIZE) bytes apart, when compressing */
+    size_t *pSizes;         /* The size of each compressed block, when compressing */
+    const char *pCompressed;  /* The compressed blocks, when decompressing */
+    const size_t *pEnds;    /* The end of each compressed block, when decompressing */
+    int *pStatus;           /* The status of each block */
+} circBuffTaskArgs_t;
+
+static void drainTaskC(void *drvPvt)
+{
+    NDPluginCircularBuff *pPvt = (NDPluginCircularBuff *)drvPvt;
+    pPvt->drainTask();
+}
+
 asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 {
     NDAttribute *trigger;
@@ -102,10 +132,11 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
      * structures don't need to be protected.
      */
     int scopeControl, preCount, postCount, currentImage, currentPostCount, softTrigger;
-    int presetTriggerCount, actualTriggerCount;
-    NDArray *pArrayCpy = NULL;
+    int presetTriggerCount, actualTriggerCount, copyMode, ringSize;
+    NDArray *pArrayCpy = NULL, *pRingArray;
     NDArrayInfo arrayInfo;
     int triggered = 0;
+    bool stored;
 
     //const char* functionName = "processCallbacks";
 
@@ -124,6 +155,7 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
     getIntegerParam(NDCircBuffPresetTriggerCount, &presetTriggerCount);
     getIntegerParam(NDCircBuffPresetTriggerCount, &presetTriggerCount);
     getIntegerParam(NDCircBuffActualTriggerCount, &actualTriggerCount);
+    getIntegerParam(NDCircBuffCopyMode,           &copyMode);
 
     // Are we running?
     if (scopeControl) {
@@ -141,23 +173,45 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         }
       }
 
-      // First copy the buffer into our buffer pool so we can release the resource on the driver
-      pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      if (useEntryRing_ && !triggered) {
+        // The entry ring keeps its own copy of the data, the input array is not held
+        stored = (storeArray(pArray) == asynSuccess);
+      } else {
+        // Hold a reference to the array if its pool can spare it, otherwise copy the buffer into our buffer pool
+        // so we can release the resource on the driver.  After the trigger the arrays are only held for the callbacks.
+        if ((copyMode == NDCircBuffHold) && pArray->pNDArrayPool && (triggered || canHoldArray(pArray))) {
+          pArray->reserve();
+          pArrayCpy = pArray;
+          if (!triggered && (pArray->pNDArrayPool != this->pNDArrayPool)) {
+            heldArrays_++;
+            heldMemory_ += pArray->dataSize;
+          }
+        } else {
+          pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+        }
+        stored = (pArrayCpy != NULL);
+      }
 
-      if (pArrayCpy){
+      if (stored){
 
         // Have we detected a trigger event yet?
         if (!triggered){
-          // No trigger so add the NDArray to the pre-trigger ring
-          pOldArray_ = preBuffer_->addToEnd(pArrayCpy);
-          // If we overwrote an existing array in the ring, release it here
-          if (pOldArray_){
-            pOldArray_->release();
-            pOldArray_ = NULL;
+          if (useEntryRing_) {
+            ringSize = entryCount_;
+          } else {
+            // No trigger so add the NDArray to the pre-trigger ring
+            pOldArray_ = preBuffer_->addToEnd(pArrayCpy);
+            // If we overwrote an existing array in the ring, release it here
+            if (pOldArray_){
+              releaseRingArray(pOldArray_);
+              pOldArray_ = NULL;
+            }
+            ringSize = preBuffer_->size();
+            setIntegerParam(NDCircBuffHeldArrays, heldArrays_);
           }
           // Set the size
-          setIntegerParam(NDCircBuffCurrentImage,  preBuffer_->size());
-          if (preBuffer_->size() == preCount){
+          setIntegerParam(NDCircBuffCurrentImage, ringSize);
+          if (ringSize == preCount){
             setStringParam(NDCircBuffStatus, "Buffer Wrapping");
           }
         } else {
@@ -170,7 +224,19 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
             previousTrigger_ = 1;
             // Yes, so flush the ring first
 
-            if (preBuffer_->size() > 0){
+            if (useEntryRing_) {
+              flushEntryRing();
+            } else if (asyncFlush_ && (preBuffer_->size() > 0)) {
+              // The drain thread passes the ring on, the ring keeps its references
+              pRingArray = preBuffer_->readFromStart();
+              pRingArray->reserve();
+              queueDrain(pRingArray);
+              while (preBuffer_->hasNext()) {
+                pRingArray = preBuffer_->readNext();
+                pRingArray->reserve();
+                queueDrain(pRingArray);
+              }
+            } else if (preBuffer_->size() > 0){
               doCallbacksGenericPointer(preBuffer_->readFromStart(), NDArrayData, 0);
               while (preBuffer_->hasNext()) {
                 doCallbacksGenericPointer(preBuffer_->readNext(), NDArrayData, 0);
@@ -181,9 +247,14 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
           currentPostCount++;
           setIntegerParam(NDCircBuffPostCount,  currentPostCount);
 
-          doCallbacksGenericPointer(pArrayCpy, NDArrayData, 0);
-          if (pArrayCpy){
-            pArrayCpy->release();
+          if (asyncFlush_ && drainBusy()) {
+            // Queue the array behind the flush so the arrays stay in order
+            queueDrain(pArrayCpy);
+          } else {
+            doCallbacksGenericPointer(pArrayCpy, NDArrayData, 0);
+            if (pArrayCpy){
+              pArrayCpy->release();
+            }
           }
         }
 
@@ -217,6 +288,496 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
     callParamCallbacks();
 }
 
+/** Returns true if the pre-trigger ring can hold a reference to an input array rather than a copy.
+  * The arrays of the pool of the plugin can always be held.  The arrays held from another pool, normally that of
+  * the driver, must leave at least half of the maximum buffers and memory of that pool to its other clients.
+  * \param[in] pArray The input array. */
+bool NDPluginCircularBuff::canHoldArray(NDArray *pArray)
+{
+    NDArrayPool *pPool = pArray->pNDArrayPool;
+    int maxBuffers;
+    size_t maxMemory;
+
+    if (pPool == this->pNDArrayPool) return true;
+    maxBuffers = pPool->maxBuffers();
+    maxMemory = pPool->maxMemory();
+    if ((maxBuffers > 0) && (2*(heldArrays_ + 1) > maxBuffers)) return false;
+    if ((maxMemory > 0) && (2*(heldMemory_ + pArray->dataSize) > maxMemory)) return false;
+    return true;
+}
+
+/** Releases an array that was removed from the pre-trigger ring, updating the count of the held arrays. */
+void NDPluginCircularBuff::releaseRingArray(NDArray *pArray)
+{
+    if (pArray->pNDArrayPool != this->pNDArrayPool) {
+        heldArrays_--;
+        heldMemory_ -= pArray->dataSize;
+    }
+    pArray->release();
+}
+
+/**
+ * Compresses one block of an array, for parallelForTasks().  Each task writes only its own block.
+ * \param[in] pArg The circBuffTaskArgs_t
+ * \param[in] task The index of the block
+ */
+void NDPluginCircularBuff::compressTask(void *pArg, int task)
+{
+    circBuffTaskArgs_t *pArgs = (circBuffTaskArgs_t *)pArg;
+    size_t offset = (size_t)task * ND_COMPRESS_BLOCK_SIZE;
+    size_t nBytes = std::min(pArgs->dataSize - offset, (size_t)ND_COMPRESS_BLOCK_SIZE);
+    size_t bound = NDCompressBound(ND_COMPRESS_BLOCK_SIZE);
+
+    pArgs->pStatus[task] = NDCompressBlock(pArgs->shuffle, pArgs->elementSize, pArgs->pData + offset, nBytes,
+                                           pArgs->pScratch + offset, pArgs->pBlocks + task*bound, bound,
+                                           &pArgs->pSizes[task]);
+}
+
+/**
+ * Decompresses one block of an array, for parallelForTasks().  Each task writes only its own block.
+ * \param[in] pArg The circBuffTaskArgs_t
+ * \param[in] task The index of the block
+ */
+void NDPluginCircularBuff::decompressTask(void *pArg, int task)
+{
+    circBuffTaskArgs_t *pArgs = (circBuffTaskArgs_t *)pArg;
+    size_t offset = (size_t)task * ND_COMPRESS_BLOCK_SIZE;
+    size_t nBytes = std::min(pArgs->dataSize - offset, (size_t)ND_COMPRESS_BLOCK_SIZE);
+    size_t start = task ? pArgs->pEnds[task - 1] : 0;
+
+    pArgs->pStatus[task] = NDDecompressBlock(pArgs->elementSize, pArgs->pCompressed + start, pArgs->pEnds[task] - start,
+                                             pArgs->pScratch + offset, pArgs->pData + offset, nBytes);
+}
+
+/** Stores an array in the entry ring, overwriting the oldest array when the ring is full.
+  * The blocks of the array are compressed in the IntraFrameThreads threads if the ring is compressed; an array
+  * that is already compressed, by NDPluginCodec, is stored as it is.
+  * The array that leaves the last MemoryDepth arrays is then spilled if the ring has a spill file.
+  * \param[in] pArray The input array. */
+asynStatus NDPluginCircularBuff::storeArray(NDArray *pArray)
+{
+    NDArrayInfo arrayInfo;
+    NDCircBuffEntry_t *pEntry;
+    circBuffTaskArgs_t args;
+    size_t bound = NDCompressBound(ND_COMPRESS_BLOCK_SIZE), total = 0;
+    int numBlocks = 0, block, ringSize = (int)entryRing_.size();
+    static const char *functionName = "storeArray";
+
+    if (entryRing_.empty()) return asynSuccess;
+    pArray->getInfo(&arrayInfo);
+    if (!pArray->codec.empty()) {
+        // An array that was compressed upstream is stored as it is
+        total = pArray->compressedSize;
+    } else if (compressRing_ == NDCircBuffCompressNone) {
+        total = arrayInfo.totalBytes;
+    } else {
+        numBlocks = (int)((arrayInfo.totalBytes + ND_COMPRESS_BLOCK_SIZE - 1) / ND_COMPRESS_BLOCK_SIZE);
+        if (compressScratch_.size() < (size_t)numBlocks * ND_COMPRESS_BLOCK_SIZE) {
+            compressScratch_.resize((size_t)numBlocks * ND_COMPRESS_BLOCK_SIZE);
+            compressBlocks_.resize((size_t)numBlocks * bound);
+        }
+        compressSizes_.resize(numBlocks);
+        compressStatus_.assign(numBlocks, ND_SUCCESS);
+        if (numBlocks > 0) {
+            args.shuffle = (compressRing_ == NDCircBuffCompressBitLZ4) ? NDShuffleBit : NDShuffleByte;
+            args.elementSize = arrayInfo.bytesPerElement;
+            args.pData = (char *)pArray->pData;
+            args.dataSize = arrayInfo.totalBytes;
+            args.pScratch = &compressScratch_[0];
+            args.pBlocks = &compressBlocks_[0];
+            args.pSizes = &compressSizes_[0];
+            args.pCompressed = NULL;
+            args.pEnds = NULL;
+            args.pStatus = &compressStatus_[0];
+            parallelForTasks(compressTask, &args, numBlocks);
+        }
+        for (block=0; block<numBlocks; block++) {
+            if (compressStatus_[block] != ND_SUCCESS) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s error compressing array %d\n",
+                    driverName, functionName, pArray->uniqueId);
+                return asynError;
+            }
+            total += compressSizes_[block];
+        }
+    }
+
+    pEntry = entryRing_[entryNext_];
+    if (pEntry) {
+        compressedBytes_ -= pEntry->storedBytes;
+        uncompressedBytes_ -= pEntry->dataSize;
+        if (pEntry->spilled) spilledArrays_--;
+    } else {
+        pEntry = new NDCircBuffEntry_t;
+        pEntry->pAttributeList = new NDAttributeList(true);
+        entryRing_[entryNext_] = pEntry;
+        entryCount_++;
+    }
+    pEntry->ndims = pArray->ndims;
+    memcpy(pEntry->dims, pArray->dims, sizeof(pEntry->dims));
+    pEntry->dataType = pArray->dataType;
+    pEntry->uniqueId = pArray->uniqueId;
+    pEntry->timeStamp = pArray->timeStamp;
+    pEntry->epicsTS = pArray->epicsTS;
+    pEntry->pAttributeList->clear();
+    pArray->pAttributeList->copy(pEntry->pAttributeList);
+    pEntry->dataSize = arrayInfo.totalBytes;
+    pEntry->codec = pArray->codec;
+    // Allocate exactly the stored size, a vector that was resized would keep the capacity of a larger array
+    std::vector<char>(total).swap(pEntry->data);
+    pEntry->blockEnds.resize(numBlocks);
+    if (numBlocks == 0) {
+        if (total > 0) memcpy(&pEntry->data[0], pArray->pData, total);
+    } else {
+        total = 0;
+        for (block=0; block<numBlocks; block++) {
+            memcpy(&pEntry->data[total], &compressBlocks_[block*bound], compressSizes_[block]);
+            total += compressSizes_[block];
+            pEntry->blockEnds[block] = total;
+        }
+    }
+    pEntry->storedBytes = total;
+    pEntry->spilled = false;
+    compressedBytes_ += total;
+    uncompressedBytes_ += pEntry->dataSize;
+    if (!spillPath_.empty() && (memoryDepth_ < ringSize)) {
+        spillEntry((entryNext_ - memoryDepth_ + ringSize) % ringSize);
+    }
+    entryNext_ = (entryNext_ + 1) % ringSize;
+    setDoubleParam(NDCircBuffCompressionRatio, (compressedBytes_ > 0) ? uncompressedBytes_/compressedBytes_ : 0.0);
+    setIntegerParam(NDCircBuffSpilledArrays, spilledArrays_);
+    return asynSuccess;
+}
+
+/** Moves the data of an entry of the entry ring to the spill file, which writes it behind.
+  * The file is created for the first array spilled, with a slot for each entry of the size of that array;
+  * a larger array stays in memory.
+  * \param[in] index The index of the entry. */
+void NDPluginCircularBuff::spillEntry(int index)
+{
+    NDCircBuffEntry_t *pEntry = entryRing_[index];
+    size_t slotSize, numBlocks;
+    static const char *functionName = "spillEntry";
+
+    if (!pEntry || pEntry->spilled) return;
+    // The drain thread still reads the arrays of the last flush from the file, this array stays in memory
+    if (drainSpilled_ > 0) return;
+    if (!spillFile_.isOpen()) {
+        slotSize = pEntry->dataSize;
+        if (compressRing_ != NDCircBuffCompressNone) {
+            numBlocks = (pEntry->dataSize + ND_COMPRESS_BLOCK_SIZE - 1) / ND_COMPRESS_BLOCK_SIZE;
+            slotSize = numBlocks * NDCompressBound(ND_COMPRESS_BLOCK_SIZE);
+        }
+        if ((slotSize == 0) ||
+            (spillFile_.open(spillPath_.c_str(), (int)entryRing_.size(), slotSize, SPILL_MAX_PENDING) != ND_SUCCESS)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s cannot create spill file %s, the ring stays in memory\n",
+                driverName, functionName, spillPath_.c_str());
+            // Do not try again for every array
+            spillPath_.clear();
+            return;
+        }
+    }
+    if (pEntry->storedBytes > spillFile_.slotSize()) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s array %d is larger than the slots of the spill file, it stays in memory\n",
+            driverName, functionName, pEntry->uniqueId);
+        return;
+    }
+    if (spillFile_.write(index, pEntry->data) != ND_SUCCESS) return;
+    pEntry->spilled = true;
+    spilledArrays_++;
+}
+
+/** Copies an entry of the entry ring into a new array of the pool of the plugin, decompressing it if it is
+  * compressed.  This does not access the parameter library, so the drain thread calls it without the lock.
+  * \param[in] pEntry The entry.
+  * \param[in] pStored The data of the entry, in memory or in the spill file.
+  * \param[in,out] scratch The shuffled blocks of the caller.
+  * \param[in,out] status The status of each block, for the caller.
+  * \return The array, or NULL if it cannot be allocated or restored. */
+NDArray* NDPluginCircularBuff::restoreEntry(NDCircBuffEntry_t *pEntry, const char *pStored,
+                                            std::vector<char>& scratch, std::vector<int>& status)
+{
+    int d, numBlocks, block;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pOut;
+    NDArrayInfo arrayInfo;
+    circBuffTaskArgs_t args;
+    bool ok;
+    static const char *functionName = "restoreEntry";
+
+    for (d=0; d<pEntry->ndims; d++) dims[d] = pEntry->dims[d].size;
+    // A compressed array can be larger than its uncompressed data
+    pOut = this->pNDArrayPool->alloc(pEntry->ndims, dims, pEntry->dataType,
+                                     pEntry->codec.empty() ? 0 : std::max(pEntry->storedBytes, pEntry->dataSize), NULL);
+    if (!pOut) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot allocate array %d\n",
+            driverName, functionName, pEntry->uniqueId);
+        return NULL;
+    }
+    memcpy(pOut->dims, pEntry->dims, sizeof(pEntry->dims));
+    pOut->uniqueId = pEntry->uniqueId;
+    pOut->timeStamp = pEntry->timeStamp;
+    pOut->epicsTS = pEntry->epicsTS;
+    pOut->pAttributeList->clear();
+    pEntry->pAttributeList->copy(pOut->pAttributeList);
+    pOut->getInfo(&arrayInfo);
+    numBlocks = (int)pEntry->blockEnds.size();
+    ok = (arrayInfo.totalBytes == pEntry->dataSize) && (pStored || (pEntry->storedBytes == 0));
+    if (ok && !pEntry->codec.empty()) {
+        if (pEntry->storedBytes > 0) memcpy(pOut->pData, pStored, pEntry->storedBytes);
+        pOut->codec = pEntry->codec;
+        pOut->compressedSize = pEntry->storedBytes;
+    } else if (ok && (numBlocks == 0)) {
+        if (pEntry->dataSize > 0) memcpy(pOut->pData, pStored, pEntry->dataSize);
+    } else if (ok) {
+        if (scratch.size() < (size_t)numBlocks * ND_COMPRESS_BLOCK_SIZE)
+            scratch.resize((size_t)numBlocks * ND_COMPRESS_BLOCK_SIZE);
+        status.assign(numBlocks, ND_SUCCESS);
+        args.shuffle = NDShuffleNone;
+        args.elementSize = arrayInfo.bytesPerElement;
+        args.pData = (char *)pOut->pData;
+        args.dataSize = pEntry->dataSize;
+        args.pScratch = &scratch[0];
+        args.pBlocks = NULL;
+        args.pSizes = NULL;
+        args.pCompressed = pStored;
+        args.pEnds = &pEntry->blockEnds[0];
+        args.pStatus = &status[0];
+        parallelForTasks(decompressTask, &args, numBlocks);
+        for (block=0; block<numBlocks; block++) {
+            if (status[block] != ND_SUCCESS) ok = false;
+        }
+    }
+    if (!ok) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error restoring array %d\n",
+            driverName, functionName, pEntry->uniqueId);
+        pOut->release();
+        return NULL;
+    }
+    return pOut;
+}
+
+/** Passes the arrays of the entry ring on, oldest first, decompressing them or reading them back from the
+  * spill file.  With AsyncFlush the entries are queued for the drain thread, which restores them, otherwise
+  * they are restored and the callbacks are done here.  The ring is then empty. */
+void NDPluginCircularBuff::flushEntryRing()
+{
+    int ringSize = (int)entryRing_.size(), i, index;
+    NDCircBuffEntry_t *pEntry;
+    NDCircBuffDrainItem_t item;
+    NDArray *pOut;
+    const char *pStored;
+
+    // The spilled arrays can be read once the file has written them
+    if (spillFile_.isOpen()) spillFile_.waitWrites();
+    // The oldest array is the next one to be overwritten, the entries after it are empty until the ring wraps
+    for (i=0; i<ringSize; i++) {
+        index = (entryNext_ + i) % ringSize;
+        pEntry = entryRing_[index];
+        if (!pEntry) continue;
+        if (asyncFlush_) {
+            // The drain thread owns the entry now
+            item.pArray = NULL;
+            item.pEntry = pEntry;
+            item.spillSlot = pEntry->spilled ? index : -1;
+            if (pEntry->spilled) drainSpilled_++;
+            drainQueue_.push_back(item);
+            entryRing_[index] = NULL;
+            continue;
+        }
+        if (pEntry->spilled) {
+            pStored = (const char *)spillFile_.data(index);
+        } else {
+            pStored = pEntry->data.empty() ? NULL : &pEntry->data[0];
+        }
+        pOut = restoreEntry(pEntry, pStored, compressScratch_, compressStatus_);
+        if (pOut) {
+            doCallbacksGenericPointer(pOut, NDArrayData, 0);
+            pOut->release();
+        }
+    }
+    if (asyncFlush_) queueDrain(NULL);
+    clearEntryRing();
+}
+
+/** Queues an array for the drain thread and wakes it.
+  * \param[in] pArray The array, which the drain thread releases once it has passed it on; NULL only wakes
+  *            the thread for the items already queued. */
+void NDPluginCircularBuff::queueDrain(NDArray *pArray)
+{
+    NDCircBuffDrainItem_t item;
+
+    if (pArray) {
+        item.pArray = pArray;
+        item.pEntry = NULL;
+        item.spillSlot = -1;
+        drainQueue_.push_back(item);
+    }
+    setIntegerParam(NDCircBuffFlushQueued, (int)drainQueue_.size());
+    epicsEventSignal(drainEvent_);
+}
+
+/** Returns true while the drain thread has arrays to pass on, so the next array must be queued behind them. */
+bool NDPluginCircularBuff::drainBusy()
+{
+    return draining_ || !drainQueue_.empty();
+}
+
+/** Starts the drain thread if it is not running. */
+asynStatus NDPluginCircularBuff::startDrainThread()
+{
+    char taskName[256];
+    static const char *functionName = "startDrainThread";
+
+    if (drainThreadId_ != 0) return asynSuccess;
+    epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_Drain", portName);
+    drainThreadId_ = epicsThreadCreate(taskName,
+                                       epicsThreadPriorityMedium,
+                                       epicsThreadGetStackSize(epicsThreadStackMedium),
+                                       (EPICSTHREADFUNC)drainTaskC, this);
+    if (drainThreadId_ == 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating drainTask thread\n",
+            driverName, functionName);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/** Does the NDArray callbacks of the drain thread, without the lock.
+  * Each downstream plugin is offered the array without dropping it while its queue is full, and is offered it
+  * again every DRAIN_RETRY_DELAY until it has room, so the flush goes at the pace of the downstream queues.
+  * After DRAIN_TIMEOUT the plugin is passed the array normally, which drops it if its queue is still full.
+  * A plugin that skips the array, for MinCallbackTime, Decimate or VetoExpression, is not offered it again, and
+  * clients that are not plugins have no queue and are passed the array once.
+  * \param[in] pArray The array. */
+void NDPluginCircularBuff::drainCallbacks(NDArray *pArray)
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    int addr;
+    double waited;
+
+    pasynManager->interruptStart(this->asynStdInterfaces.genericPointerInterruptPvt, &pclientList);
+    for (pnode = (interruptNode *)ellFirst(pclientList); pnode; pnode = (interruptNode *)ellNext(&pnode->node)) {
+        asynGenericPointerInterrupt *pInterrupt = (asynGenericPointerInterrupt *)pnode->drvPvt;
+        pasynManager->getAddr(pInterrupt->pasynUser, &addr);
+        /* If this is not a multi-device then address is -1, change to 0 */
+        if (addr == -1) addr = 0;
+        if ((pInterrupt->pasynUser->reason != NDArrayData) || (addr != 0)) continue;
+        if (!NDPluginDriver::fromArrayInterrupt(pInterrupt)) {
+            pInterrupt->pasynUser->auxStatus = asynSuccess;
+            pInterrupt->callback(pInterrupt->userPvt, pInterrupt->pasynUser, pArray);
+            continue;
+        }
+        for (waited = 0.; ; waited += DRAIN_RETRY_DELAY) {
+            /* asynOverflow asks the plugin to return without dropping the array if its queue is full,
+             * it leaves auxStatus at asynOverflow only if its queue was full */
+            pInterrupt->pasynUser->auxStatus = (waited < DRAIN_TIMEOUT) ? asynOverflow : asynSuccess;
+            pInterrupt->callback(pInterrupt->userPvt, pInterrupt->pasynUser, pArray);
+            if ((pInterrupt->pasynUser->auxStatus == asynSuccess) || (waited >= DRAIN_TIMEOUT)) break;
+            epicsThreadSleep(DRAIN_RETRY_DELAY);
+        }
+    }
+    pasynManager->interruptEnd(this->asynStdInterfaces.genericPointerInterruptPvt);
+}
+
+/** The loop of the drain thread, which passes on the queued arrays in order, restoring the entries of the
+  * entry ring.  It takes the lock only to take the next item off drainQueue_, so processCallbacks() keeps
+  * accepting arrays while it waits for the downstream plugins.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDPluginCircularBuff::drainTask()
+{
+    NDCircBuffDrainItem_t item;
+    NDArray *pOut;
+    const char *pStored;
+
+    this->lock();
+    while (!drainExiting_) {
+        if (drainQueue_.empty()) {
+            this->unlock();
+            epicsEventWait(drainEvent_);
+            this->lock();
+            continue;
+        }
+        item = drainQueue_.front();
+        drainQueue_.pop_front();
+        draining_ = true;
+        setIntegerParam(NDCircBuffFlushQueued, (int)drainQueue_.size());
+        callParamCallbacks();
+        this->unlock();
+
+        pOut = item.pArray;
+        if (item.pEntry) {
+            // The spill file is not closed or written while drainSpilled_ counts this entry
+            if (item.spillSlot >= 0) {
+                pStored = (const char *)spillFile_.data(item.spillSlot);
+            } else {
+                pStored = item.pEntry->data.empty() ? NULL : &item.pEntry->data[0];
+            }
+            pOut = restoreEntry(item.pEntry, pStored, drainScratch_, drainStatus_);
+            delete item.pEntry->pAttributeList;
+            delete item.pEntry;
+        }
+        if (pOut) {
+            drainCallbacks(pOut);
+            pOut->release();
+        }
+
+        this->lock();
+        if (item.spillSlot >= 0) drainSpilled_--;
+        draining_ = false;
+        epicsEventSignal(drainDoneEvent_);
+    }
+    // The plugin is being deleted, discard the arrays that are left
+    while (!drainQueue_.empty()) {
+        item = drainQueue_.front();
+        drainQueue_.pop_front();
+        if (item.pArray) item.pArray->release();
+        if (item.pEntry) {
+            delete item.pEntry->pAttributeList;
+            delete item.pEntry;
+        }
+    }
+    drainSpilled_ = 0;
+    this->unlock();
+    epicsEventSignal(drainExitEvent_);
+}
+
+/** Waits until the drain thread no longer reads the spill file.  This must be called with the lock held,
+  * which it releases while it waits. */
+void NDPluginCircularBuff::waitDrainSpilled()
+{
+    while (drainSpilled_ > 0) {
+        this->unlock();
+        epicsEventWait(drainDoneEvent_);
+        this->lock();
+    }
+}
+
+/** Frees the arrays of the entry ring. */
+void NDPluginCircularBuff::clearEntryRing()
+{
+    for (size_t i=0; i<entryRing_.size(); i++) {
+        if (entryRing_[i]) {
+            delete entryRing_[i]->pAttributeList;
+            delete entryRing_[i];
+            entryRing_[i] = NULL;
+        }
+    }
+    entryNext_ = 0;
+    entryCount_ = 0;
+    spilledArrays_ = 0;
+    compressedBytes_ = 0;
+    uncompressedBytes_ = 0;
+    setDoubleParam(NDCircBuffCompressionRatio, 0.0);
+    setIntegerParam(NDCircBuffSpilledArrays, 0);
+}
+
 /** Called when asyn clients call pasynInt32->write().
   * This function performs actions for some parameters.
   * For all parameters it sets the value in the parameter library and calls any registered callbacks..
@@ -226,7 +787,8 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
 {
     int function = pasynUser->reason;
     asynStatus status = asynSuccess;
-    int preCount;
+    int preCount, compress;
+    char spillFile[MAX_FILENAME_LEN];
     static const char *functionName = "writeInt32";
 
     if (function == NDCircBuffControl){
@@ -241,6 +803,23 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
             pOldArray_->release();
           }
           pOldArray_ = NULL;
+          // Deleting the ring released the arrays it held
+          heldArrays_ = 0;
+          heldMemory_ = 0;
+          setIntegerParam(NDCircBuffHeldArrays, 0);
+          // The compression and the spill file are chosen when the ring is created
+          getIntegerParam(NDCircBuffCompress, &compressRing_);
+          getIntegerParam(NDCircBuffMemoryDepth, &memoryDepth_);
+          getStringParam(NDCircBuffSpillFile, sizeof(spillFile), spillFile);
+          getIntegerParam(NDCircBuffAsyncFlush, &asyncFlush_);
+          if (asyncFlush_ && (startDrainThread() != asynSuccess)) asyncFlush_ = 0;
+          clearEntryRing();
+          waitDrainSpilled();
+          spillFile_.close();
+          spillPath_ = spillFile;
+          if (memoryDepth_ < 0) memoryDepth_ = 0;
+          useEntryRing_ = (compressRing_ != NDCircBuffCompressNone) || (!spillPath_.empty() && (memoryDepth_ < preCount));
+          entryRing_.assign(useEntryRing_ ? preCount : 0, (NDCircBuffEntry_t *)NULL);
  
           previousTrigger_ = 0;
 
@@ -270,8 +849,10 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
         setIntegerParam(NDCircBuffTriggered, 1);
 
     }  else if (function == NDCircBuffPreTrigger){
-        // Check the value of pretrigger does not exceed max buffers
-        if (value > (maxBuffers_ - 1)){
+        // Check the value of pretrigger does not exceed max buffers, the compressed or spilled ring does not use them
+        getIntegerParam(NDCircBuffCompress, &compress);
+        getStringParam(NDCircBuffSpillFile, sizeof(spillFile), spillFile);
+        if ((compress == NDCircBuffCompressNone) && (spillFile[0] == 0) && (value > (maxBuffers_ - 1))){
           setStringParam(NDCircBuffStatus, "Pre-count too high");
         } else {
           // Set the parameter in the parameter library.
@@ -387,12 +968,21 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
                    NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   0, 1, priority, stackSize, 1), pOldArray_(NULL)
+                   0, 1, priority, stackSize, 1), pOldArray_(NULL), heldArrays_(0), heldMemory_(0),
+      compressRing_(NDCircBuffCompressNone), useEntryRing_(false), memoryDepth_(0), entryNext_(0), entryCount_(0),
+      spilledArrays_(0), compressedBytes_(0), uncompressedBytes_(0),
+      asyncFlush_(0), drainThreadId_(0), draining_(false), drainExiting_(false), drainSpilled_(0)
 {
     //const char *functionName = "NDPluginCircularBuff";
     preBuffer_ = NULL;
 
     maxBuffers_ = maxBuffers;
+    // The arrays of NDPluginCodec are held and passed on as they are
+    supportsCompressedArrays_ = true;
+
+    drainEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    drainDoneEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    drainExitEvent_ = epicsEventMustCreate(epicsEventEmpty);
 
     // Scope
     createParam(NDCircBuffControlString,            asynParamInt32,      &NDCircBuffControl);
@@ -411,6 +1001,15 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     createParam(NDCircBuffPostCountString,          asynParamInt32,      &NDCircBuffPostCount);
     createParam(NDCircBuffSoftTriggerString,        asynParamInt32,      &NDCircBuffSoftTrigger);
     createParam(NDCircBuffTriggeredString,          asynParamInt32,      &NDCircBuffTriggered);
+    createParam(NDCircBuffCopyModeString,           asynParamInt32,      &NDCircBuffCopyMode);
+    createParam(NDCircBuffHeldArraysString,         asynParamInt32,      &NDCircBuffHeldArrays);
+    createParam(NDCircBuffCompressString,           asynParamInt32,      &NDCircBuffCompress);
+    createParam(NDCircBuffCompressionRatioString,   asynParamFloat64,    &NDCircBuffCompressionRatio);
+    createParam(NDCircBuffSpillFileString,          asynParamOctet,      &NDCircBuffSpillFile);
+    createParam(NDCircBuffMemoryDepthString,        asynParamInt32,      &NDCircBuffMemoryDepth);
+    createParam(NDCircBuffSpilledArraysString,      asynParamInt32,      &NDCircBuffSpilledArrays);
+    createParam(NDCircBuffAsyncFlushString,         asynParamInt32,      &NDCircBuffAsyncFlush);
+    createParam(NDCircBuffFlushQueuedString,        asynParamInt32,      &NDCircBuffFlushQueued);
 
     // Set the plugin type string
     setStringParam(NDPluginDriverPluginType, "NDPluginCircularBuff");
@@ -429,6 +1028,23 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     setIntegerParam(NDCircBuffPreTrigger, 100);
     setIntegerParam(NDCircBuffPostTrigger, 100);
     
+    // Hold the input arrays rather than copying them
+    setIntegerParam(NDCircBuffCopyMode, NDCircBuffHold);
+    setIntegerParam(NDCircBuffHeldArrays, 0);
+
+    // Keep the pre-trigger ring uncompressed
+    setIntegerParam(NDCircBuffCompress, NDCircBuffCompressNone);
+    setDoubleParam(NDCircBuffCompressionRatio, 0.0);
+
+    // Keep the whole ring in memory until a spill file is set
+    setStringParam(NDCircBuffSpillFile, "");
+    setIntegerParam(NDCircBuffMemoryDepth, 10);
+    setIntegerParam(NDCircBuffSpilledArrays, 0);
+
+    // Flush the ring in the thread of the plugin
+    setIntegerParam(NDCircBuffAsyncFlush, 0);
+    setIntegerParam(NDCircBuffFlushQueued, 0);
+
     // Init the preset trigger count to 1
     setIntegerParam(NDCircBuffPresetTriggerCount, 1);
     setIntegerParam(NDCircBuffActualTriggerCount, 0);
@@ -441,6 +1057,21 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     connectToArrayPort();
 }
 
+/** Destructor for NDPluginCircularBuff; stops the drain thread, discarding the arrays it has not passed on. */
+NDPluginCircularBuff::~NDPluginCircularBuff()
+{
+    if (drainThreadId_ != 0) {
+        this->lock();
+        drainExiting_ = true;
+        this->unlock();
+        epicsEventSignal(drainEvent_);
+        epicsEventWait(drainExitEvent_);
+    }
+    epicsEventDestroy(drainExitEvent_);
+    epicsEventDestroy(drainDoneEvent_);
+    epicsEventDestroy(drainEvent_);
+}
+
 /** Configuration command */
 extern "C" int NDCircularBuffConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                 const char *NDArrayPort, int NDArrayAddr,
@@ -1,11 +1,17 @@
 #ifndef NDPluginCircularBuff_H
 #define NDPluginCircularBuff_H
 
+#include <deque>
+#include <vector>
+
 #include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
 #include <postfix.h>
 
 #include "NDPluginDriver.h"
 #include "NDArrayRing.h"
+#include "NDSpillFile.h"
 
 /* Param definitions */
 #define NDCircBuffControlString             "CIRC_BUFF_CONTROL"               /* (asynInt32,        r/w) Run scope? */
@@ -24,6 +30,53 @@
 #define NDCircBuffPostCountString           "CIRC_BUFF_POST_COUNT"            /* (asynInt32,        r/o) Number of the current post count image */
 #define NDCircBuffSoftTriggerString         "CIRC_BUFF_SOFT_TRIGGER"          /* (asynInt32,        r/w) Force a soft trigger */
 #define NDCircBuffTriggeredString           "CIRC_BUFF_TRIGGERED"             /* (asynInt32,        r/o) Have we had a trigger event */
+#define NDCircBuffCopyModeString            "CIRC_BUFF_COPY_MODE"             /* (asynInt32,        r/w) Hold or copy the input arrays */
+#define NDCircBuffHeldArraysString          "CIRC_BUFF_HELD_ARRAYS"           /* (asynInt32,        r/o) Input arrays held in the pre-trigger ring */
+#define NDCircBuffCompressString            "CIRC_BUFF_COMPRESS"              /* (asynInt32,        r/w) Compression of the pre-trigger ring */
+#define NDCircBuffCompressionRatioString    "CIRC_BUFF_COMPRESSION_RATIO"     /* (asynFloat64,      r/o) Compression ratio of the pre-trigger ring */
+#define NDCircBuffSpillFileString           "CIRC_BUFF_SPILL_FILE"            /* (asynOctetWrite,   r/w) File the older pre-trigger images spill to */
+#define NDCircBuffMemoryDepthString         "CIRC_BUFF_MEMORY_DEPTH"          /* (asynInt32,        r/w) Pre-trigger images kept in memory with a spill file */
+#define NDCircBuffSpilledArraysString       "CIRC_BUFF_SPILLED_ARRAYS"        /* (asynInt32,        r/o) Pre-trigger images in the spill file */
+#define NDCircBuffAsyncFlushString          "CIRC_BUFF_ASYNC_FLUSH"           /* (asynInt32,        r/w) Flush the ring in a drain thread */
+#define NDCircBuffFlushQueuedString         "CIRC_BUFF_FLUSH_QUEUED"          /* (asynInt32,        r/o) Images waiting for the drain thread */
+
+/** How the pre-trigger ring keeps the input arrays */
+typedef enum {
+    NDCircBuffHold,     /**< Reserve the input arrays, copying them only when their pool cannot spare them */
+    NDCircBuffCopy      /**< Copy the input arrays into the pool of the plugin, releasing those of the driver */
+} NDCircBuffCopyMode_t;
+
+/** How the pre-trigger ring compresses the input arrays */
+typedef enum {
+    NDCircBuffCompressNone,       /**< Keep the arrays as they are */
+    NDCircBuffCompressLZ4,        /**< Byte shuffle and LZ4 */
+    NDCircBuffCompressBitLZ4      /**< Bit shuffle and LZ4, best for the noise of dark images */
+} NDCircBuffCompress_t;
+
+/** An array of the entry ring, which NDPluginCircularBuff uses instead of the NDArrayRing when it compresses or spills
+  * the pre-trigger arrays: the NDArray without its data, and the data, compressed in blocks or not */
+typedef struct {
+    int ndims;
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDDataType_t dataType;
+    int uniqueId;
+    double timeStamp;
+    epicsTimeStamp epicsTS;
+    NDAttributeList *pAttributeList;
+    size_t dataSize;                /**< The size of the data in bytes */
+    NDCodec_t codec;                /**< The codec of an array that was already compressed, which is stored as it is */
+    std::vector<size_t> blockEnds;  /**< The end of each compressed block in data; empty if the data is not compressed */
+    std::vector<char> data;         /**< The compressed blocks, or the data; empty once it is spilled */
+    size_t storedBytes;             /**< The size of data, in memory or in the spill file */
+    bool spilled;                   /**< The data is in the slot of the spill file of the entry */
+} NDCircBuffEntry_t;
+
+/** An array queued for the drain thread of NDPluginCircularBuff, which passes the flushed arrays on */
+typedef struct {
+    NDArray *pArray;                /**< An array to pass on and release, or NULL */
+    NDCircBuffEntry_t *pEntry;      /**< An entry of the entry ring to restore, pass on and delete, or NULL */
+    int spillSlot;                  /**< The slot of the spill file that holds the data of pEntry, or -1 */
+} NDCircBuffDrainItem_t;
 
 
 /** Performs a scope like capture.  Records a quantity
@@ -35,10 +88,12 @@ public:
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginCircularBuff();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+    void drainTask();
     
     //template <typename epicsType> asynStatus doProcessCircularBuffT(NDArray *pArray);
     //asynStatus doProcessCircularBuff(NDArray *pArray);
@@ -62,14 +117,66 @@ protected:
     int NDCircBuffPostCount;
     int NDCircBuffSoftTrigger;
     int NDCircBuffTriggered;
+    int NDCircBuffCopyMode;
+    int NDCircBuffHeldArrays;
+    int NDCircBuffCompress;
+    int NDCircBuffCompressionRatio;
+    int NDCircBuffSpillFile;
+    int NDCircBuffMemoryDepth;
+    int NDCircBuffSpilledArrays;
+    int NDCircBuffAsyncFlush;
+    int NDCircBuffFlushQueued;
 
 private:
 
     asynStatus calculateTrigger(NDArray *pArray, int *trig);
+    bool canHoldArray(NDArray *pArray);
+    void releaseRingArray(NDArray *pArray);
+    asynStatus storeArray(NDArray *pArray);
+    void spillEntry(int index);
+    NDArray* restoreEntry(NDCircBuffEntry_t *pEntry, const char *pStored,
+                          std::vector<char>& scratch, std::vector<int>& status);
+    void flushEntryRing();
+    void queueDrain(NDArray *pArray);
+    bool drainBusy();
+    asynStatus startDrainThread();
+    void drainCallbacks(NDArray *pArray);
+    void waitDrainSpilled();
+    void clearEntryRing();
+    static void compressTask(void *pArg, int task);
+    static void decompressTask(void *pArg, int task);
     NDArrayRing *preBuffer_;
     NDArray *pOldArray_;
     int previousTrigger_;
     int maxBuffers_;
+    int heldArrays_;      /**< Arrays of other pools held by reference in preBuffer_ */
+    size_t heldMemory_;   /**< Memory of the arrays counted in heldArrays_ */
+    int compressRing_;    /**< The NDCircBuffCompress_t of the ring, read when the ring is created */
+    bool useEntryRing_;   /**< entryRing_ is used instead of preBuffer_ */
+    int memoryDepth_;     /**< The newest arrays of entryRing_ that are not spilled */
+    std::string spillPath_;       /**< The spill file; empty if the arrays are not spilled */
+    NDSpillFile spillFile_;
+    std::vector<NDCircBuffEntry_t *> entryRing_;  /**< The ring of compressed or spilled arrays */
+    int entryNext_;               /**< The entry of entryRing_ the next array is written to */
+    int entryCount_;              /**< The entries of entryRing_ that hold an array */
+    int spilledArrays_;           /**< The entries of entryRing_ in the spill file */
+    double compressedBytes_;      /**< The stored size of the arrays in entryRing_ */
+    double uncompressedBytes_;    /**< The size of the arrays in entryRing_ */
+    std::vector<char> compressScratch_;    /**< Shuffled blocks */
+    std::vector<char> compressBlocks_;     /**< Compressed blocks, NDCompressBound() bytes for each */
+    std::vector<size_t> compressSizes_;    /**< The size of each compressed block */
+    std::vector<int> compressStatus_;      /**< The status of each block */
+    int asyncFlush_;      /**< The flush is passed on by the drain thread, read when the ring is created */
+    epicsThreadId drainThreadId_;
+    std::deque<NDCircBuffDrainItem_t> drainQueue_;  /**< The arrays for the drain thread, oldest first */
+    bool draining_;       /**< The drain thread is passing on an array it took off drainQueue_ */
+    bool drainExiting_;
+    int drainSpilled_;    /**< The items for the drain thread whose data is in the spill file */
+    epicsEventId drainEvent_;      /**< Signalled when an array is queued or the drain thread must exit */
+    epicsEventId drainDoneEvent_;  /**< Signalled when the drain thread has passed on an array */
+    epicsEventId drainExitEvent_;  /**< Signalled by the drain thread when it exits */
+    std::vector<char> drainScratch_;       /**< Shuffled blocks of the drain thread */
+    std::vector<int> drainStatus_;         /**< The status of each block of the drain thread */
     char triggerCalcInfix_[MAX_INFIX_SIZE];
     char triggerCalcPostfix_[MAX_POSTFIX_SIZE];
     double triggerCalcArgs_[CALCPERFORM_NARGS];
@@ -0,0 +1,265 @@
+/*
+ * NDPluginCodec.cpp
+ *
+ * Plugin that compresses NDArrays, and decompresses them, keeping the codec with the array.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <epicsTypes.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginCodec.h"
+
+static const char *driverName="NDPluginCodec";
+
+/** Returns true if this plugin was built with the compressor.
+  * \param[in] compressor The NDCodecCompressor_t. */
+bool NDPluginCodec::compressorSupported(int compressor)
+{
+    return NDArrayCodec::compressorSupported(compressor);
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * It compresses or decompresses the array and outputs the result.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginCodec::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  It unlocks it while it compresses the array. */
+    NDArray *pArrayOut = NULL;
+    NDArrayInfo_t arrayInfo;
+    NDCodec_t codec;
+    int mode, compressor, bloscThreads;
+    const char *error = "";
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getIntegerParam(NDCodecMode, &mode);
+    getIntegerParam(NDCodecCompressor, &compressor);
+    getIntegerParam(NDCodecBloscNumThreads, &bloscThreads);
+    codec.name = NDCodecName[compressor];
+    if (compressor == NDCodecJPEG) {
+        getIntegerParam(NDCodecJPEGQuality, &codec.level);
+    } else if (compressor == NDCodecBlosc) {
+        getIntegerParam(NDCodecBloscCLevel, &codec.level);
+        getIntegerParam(NDCodecBloscShuffle, &codec.shuffle);
+        getIntegerParam(NDCodecBloscCompressor, &codec.compressor);
+    }
+    pArray->getInfo(&arrayInfo);
+
+    if (((mode == NDCodecModeCompress) && ((compressor == NDCodecNone) || !pArray->codec.empty())) ||
+        ((mode == NDCodecModeDecompress) && pArray->codec.empty())) {
+        /* There is nothing to do, so the array is passed on */
+        if ((mode == NDCodecModeCompress) && (compressor != NDCodecNone)) {
+            setIntegerParam(NDCodecStatus, NDCodecStatusWarning);
+            setStringParam(NDCodecError, "the array is already compressed");
+        } else {
+            setIntegerParam(NDCodecStatus, NDCodecStatusSuccess);
+            setStringParam(NDCodecError, "");
+        }
+        setDoubleParam(NDCodecCompFactor, pArray->codec.empty() || (pArray->compressedSize == 0) ? 1.0 :
+                       (double)arrayInfo.totalBytes / pArray->compressedSize);
+        NDPluginDriver::endProcessCallbacks(pArray, true, true);
+        callParamCallbacks();
+        return;
+    }
+
+    this->unlock();
+    if (mode == NDCodecModeCompress) {
+        pArrayOut = codec_.compress(pArray, codec, bloscThreads, this->pNDArrayPool, &error);
+    } else {
+        pArrayOut = codec_.decompress(pArray, bloscThreads, this->pNDArrayPool, &error);
+    }
+    this->lock();
+
+    if (!pArrayOut) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot %s array uniqueId=%d: %s\n",
+            driverName, functionName, (mode == NDCodecModeCompress) ? "compress" : "decompress",
+            pArray->uniqueId, error);
+        setIntegerParam(NDCodecStatus, NDCodecStatusError);
+        setStringParam(NDCodecError, error);
+        callParamCallbacks();
+        return;
+    }
+    if (mode == NDCodecModeCompress) {
+        setDoubleParam(NDCodecCompFactor, (double)arrayInfo.totalBytes / pArrayOut->compressedSize);
+    } else if (pArray->compressedSize > 0) {
+        setDoubleParam(NDCodecCompFactor, (double)arrayInfo.totalBytes / pArray->compressedSize);
+    }
+    setIntegerParam(NDCodecStatus, NDCodecStatusSuccess);
+    setStringParam(NDCodecError, "");
+    NDPluginDriver::endProcessCallbacks(pArrayOut, false, true);
+    callParamCallbacks();
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks the ranges of the parameters, and that the plugin was built with the Compressor.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDCODEC_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDCodecMode) {
+        if ((value < NDCodecModeCompress) || (value > NDCodecModeDecompress)) status = asynError;
+    } else if (function == NDCodecCompressor) {
+        if (!compressorSupported(value)) status = asynError;
+    } else if (function == NDCodecJPEGQuality) {
+        if ((value < 1) || (value > 100)) status = asynError;
+    } else if (function == NDCodecBloscCompressor) {
+        if ((value < 0) || (value > 5)) status = asynError;
+    } else if (function == NDCodecBloscCLevel) {
+        if ((value < 0) || (value > 9)) status = asynError;
+    } else if (function == NDCodecBloscShuffle) {
+        if ((value < 0) || (value > 2)) status = asynError;
+    } else if (function == NDCodecBloscNumThreads) {
+        if (value < 1) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDPluginCodec; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The maximum number of threads that compress arrays. If 0 then 1 will be used.
+  */
+NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCallbacks,
+                             const char *NDArrayPort, int NDArrayAddr,
+                             int maxBuffers, size_t maxMemory,
+                             int priority, int stackSize, int maxThreads)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, maxThreads)
+{
+    //static const char *functionName = "NDPluginCodec";
+
+    createParam(NDCodecModeString,            asynParamInt32,   &NDCodecMode);
+    createParam(NDCodecCompressorString,      asynParamInt32,   &NDCodecCompressor);
+    createParam(NDCodecCompFactorString,      asynParamFloat64, &NDCodecCompFactor);
+    createParam(NDCodecStatusString,          asynParamInt32,   &NDCodecStatus);
+    createParam(NDCodecErrorString,           asynParamOctet,   &NDCodecError);
+    createParam(NDCodecJPEGQualityString,     asynParamInt32,   &NDCodecJPEGQuality);
+    createParam(NDCodecBloscCompressorString, asynParamInt32,   &NDCodecBloscCompressor);
+    createParam(NDCodecBloscCLevelString,     asynParamInt32,   &NDCodecBloscCLevel);
+    createParam(NDCodecBloscShuffleString,    asynParamInt32,   &NDCodecBloscShuffle);
+    createParam(NDCodecBloscNumThreadsString, asynParamInt32,   &NDCodecBloscNumThreads);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginCodec");
+    setIntegerParam(NDCodecMode, NDCodecModeCompress);
+    setIntegerParam(NDCodecCompressor, NDCodecNone);
+    setDoubleParam(NDCodecCompFactor, 1.0);
+    setIntegerParam(NDCodecStatus, NDCodecStatusSuccess);
+    setStringParam(NDCodecError, "");
+    setIntegerParam(NDCodecJPEGQuality, 85);
+    setIntegerParam(NDCodecBloscCompressor, 0);
+    setIntegerParam(NDCodecBloscCLevel, 5);
+    setIntegerParam(NDCodecBloscShuffle, 1);
+    setIntegerParam(NDCodecBloscNumThreads, 1);
+
+    /* The arrays it decompresses are compressed */
+    supportsCompressedArrays_ = true;
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+NDPluginCodec::~NDPluginCodec()
+{
+}
+
+/** Configuration command */
+extern "C" int NDCodecConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                const char *NDArrayPort, int NDArrayAddr,
+                                int maxBuffers, size_t maxMemory,
+                                int priority, int stackSize, int maxThreads)
+{
+    NDPluginCodec *pPlugin = new NDPluginCodec(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                               maxBuffers, maxMemory, priority, stackSize, maxThreads);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg initArg9 = { "# threads",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDCodecConfigure",10,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDCodecConfigure(args[0].sval, args[1].ival, args[2].ival,
+                     args[3].sval, args[4].ival, args[5].ival,
+                     args[6].ival, args[7].ival, args[8].ival,
+                     args[9].ival);
+}
+
+extern "C" void NDCodecRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDCodecRegister);
+}
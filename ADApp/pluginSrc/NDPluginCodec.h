@@ -0,0 +1,74 @@
+#ifndef NDPluginCodec_H
+#define NDPluginCodec_H
+
+#include <epicsTypes.h>
+
+#include "NDPluginDriver.h"
+#include "NDArrayCodec.h"
+
+#define NDCodecModeString            "CODEC_MODE"             /* (asynInt32,   r/w) NDCodecMode_t */
+#define NDCodecCompressorString      "CODEC_COMPRESSOR"       /* (asynInt32,   r/w) NDCodecCompressor_t of Compress */
+#define NDCodecCompFactorString      "CODEC_COMP_FACTOR"      /* (asynFloat64, r/o) Uncompressed over compressed
+                                                               *  size of the last array */
+#define NDCodecStatusString          "CODEC_STATUS"           /* (asynInt32,   r/o) NDCodecStatus_t of the last array */
+#define NDCodecErrorString           "CODEC_ERROR"            /* (asynOctet,   r/o) Why the last array failed */
+#define NDCodecJPEGQualityString     "CODEC_JPEG_QUALITY"     /* (asynInt32,   r/w) JPEG quality, 1 to 100 */
+#define NDCodecBloscCompressorString "CODEC_BLOSC_COMPRESSOR" /* (asynInt32,   r/w) Compressor of blosc */
+#define NDCodecBloscCLevelString     "CODEC_BLOSC_CLEVEL"     /* (asynInt32,   r/w) Level of blosc, 0 to 9 */
+#define NDCodecBloscShuffleString    "CODEC_BLOSC_SHUFFLE"    /* (asynInt32,   r/w) Shuffle of blosc, 0 to 2 */
+#define NDCodecBloscNumThreadsString "CODEC_BLOSC_NUMTHREADS" /* (asynInt32,   r/w) Threads of blosc for each array */
+
+/** The modes of NDPluginCodec */
+typedef enum {
+    NDCodecModeCompress,    /**< Compresses the arrays with the Compressor */
+    NDCodecModeDecompress   /**< Decompresses the arrays with their codec */
+} NDCodecMode_t;
+
+/** The status of the last array NDPluginCodec processed */
+typedef enum {
+    NDCodecStatusSuccess,
+    NDCodecStatusWarning,   /**< The array was passed on unchanged */
+    NDCodecStatusError      /**< The array was dropped, see Error */
+} NDCodecStatus_t;
+
+/** Compresses NDArrays early in the plugin chain, so that the arrays queued for the plugins and file writers after
+  * it take less memory and memory bandwidth, and decompresses them for the plugins that need the pixels.
+  * The output arrays keep the dims and dataType of the input, and hold NDArray::compressedSize bytes of compressed
+  * data along with their NDArray::codec.  The compressors are jpeg (lossy, 8-bit Mono and RGB1 arrays), blosc with
+  * WITH_BLOSC, lz4, and bslz4; the blosc and bslz4 codecs are the chunk formats of their HDF5 filters, so NDFileHDF5
+  * writes these arrays as direct chunks.  Each array is compressed by one of the plugin threads, so NumThreads
+  * arrays are compressed at once; blosc can also share one array among BloscNumThreads threads.  Arrays that are
+  * already compressed are passed on unchanged in Compress mode, as are uncompressed arrays in Decompress mode.
+  */
+class epicsShareClass NDPluginCodec : public NDPluginDriver {
+public:
+    NDPluginCodec(const char *portName, int queueSize, int blockingCallbacks,
+                  const char *NDArrayPort, int NDArrayAddr,
+                  int maxBuffers, size_t maxMemory,
+                  int priority, int stackSize, int maxThreads);
+    ~NDPluginCodec();
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+    static bool compressorSupported(int compressor);
+
+protected:
+    int NDCodecMode;
+    #define FIRST_NDCODEC_PARAM NDCodecMode
+    int NDCodecCompressor;
+    int NDCodecCompFactor;
+    int NDCodecStatus;
+    int NDCodecError;
+    int NDCodecJPEGQuality;
+    int NDCodecBloscCompressor;
+    int NDCodecBloscCLevel;
+    int NDCodecBloscShuffle;
+    int NDCodecBloscNumThreads;
+
+private:
+    NDArrayCodec codec_;    /**< Compresses and decompresses the arrays of all of the plugin threads */
+};
+
+#endif
@@ -25,43 +25,227 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "colorMaps.h"
-#ifdef HAVE_PVAPI
-  #include "PvApi.h"
-#endif
+#include "NDBayerKernels.h"
+#include "NDColorKernels.h"
 #include "NDPluginColorConvert.h"
 
 static const char *driverName="NDPluginColorConvert";
 
+struct NDFalseColorTable {
+    int falseColor;             /* The color map */
+    int isSigned;               /* The table is for Int16 data */
+    double minValue;
+    double maxValue;
+    int refs;                   /* The arrays using the table, and 1 while it is the current table */
+    epicsUInt32 table[ND_FALSE_COLOR_TABLE_SIZE];
+};
+
+/* Sets the dimensions of an RGB array of a color mode and returns the index of the color dimension,
+ * or -1 if the mode is not RGB */
+static int rgbDims(NDColorMode_t colorMode, size_t rowSize, size_t numRows, size_t *dims)
+{
+    switch (colorMode) {
+        case NDColorModeRGB1:
+            dims[0] = 3;
+            dims[1] = rowSize;
+            dims[2] = numRows;
+            return 0;
+        case NDColorModeRGB2:
+            dims[0] = rowSize;
+            dims[1] = 3;
+            dims[2] = numRows;
+            return 1;
+        case NDColorModeRGB3:
+            dims[0] = rowSize;
+            dims[1] = numRows;
+            dims[2] = 3;
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+/* The arguments of bayerStripe() */
+typedef struct {
+    NDDataType_t dataType;
+    int bayerPattern;
+    NDBayerMethod_t method;
+    const void *pIn;
+    size_t sizeX;
+    size_t sizeY;
+    void *pRed;
+    void *pGreen;
+    void *pBlue;
+    size_t pixelStride;
+    size_t rowStride;
+    int status;                 /* Set to ND_ERROR by any stripe that fails */
+} bayerArgs_t;
+
+/* Demosaics the rows of one stripe; called by parallelForRows() */
+static void bayerStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    bayerArgs_t *pArgs = (bayerArgs_t *)pArg;
+
+    if (NDBayerDemosaic(pArgs->dataType, pArgs->bayerPattern, pArgs->method, pArgs->pIn, pArgs->sizeX,
+                        pArgs->sizeY, pArgs->pRed, pArgs->pGreen, pArgs->pBlue, pArgs->pixelStride,
+                        pArgs->rowStride, firstRow, numRows) != ND_SUCCESS) {
+        pArgs->status = ND_ERROR;
+    }
+}
+
+/* The conversions of colorStripe() */
+typedef enum {
+    colorOpNone,                /* No conversion */
+    colorOpCopy,                /* Copy each input plane to the output plane, the mono plane for all three */
+    colorOpFalse8,              /* Map 8-bit mono values to RGB with colorMapR, colorMapG and colorMapB */
+    colorOpFalse16,             /* Map 16-bit mono values to 8-bit RGB with the false color table */
+    colorOpMono,                /* Average the three input planes */
+    colorOpYUV                  /* Convert YUV bytes to RGB */
+} colorOp_t;
+
+/* The elements of one color of an image, in units of elements */
+typedef struct {
+    void *pPlane[3];            /* The first red, green and blue elements */
+    size_t pixelStride;         /* The distance between the elements of adjacent pixels */
+    size_t rowStride;           /* The distance between the rows of a color */
+} colorPlanes_t;
+
+/* The arguments of colorStripe() */
+typedef struct {
+    colorOp_t op;
+    NDColorMode_t yuvMode;
+    colorPlanes_t in;
+    colorPlanes_t out;
+    size_t rowSize;
+    const unsigned char *colorMap[3];
+    const epicsUInt32 *pFalseColorTable;
+    int status;                 /* Set to ND_ERROR by any stripe that fails */
+} colorArgs_t;
+
+/* Sets the planes of an RGB layout, with colorIndex the color dimension returned by rgbDims() */
+static void rgbPlanes(int colorIndex, void *pData, size_t elementSize, size_t rowSize, size_t numRows,
+                      colorPlanes_t *pPlanes)
+{
+    char *pBytes = (char *)pData;
+    size_t planeStride = (colorIndex == 0) ? 1 : (colorIndex == 1) ? rowSize : rowSize*numRows;
+    int color;
+
+    for (color=0; color<3; color++) pPlanes->pPlane[color] = pBytes + color*planeStride*elementSize;
+    pPlanes->pixelStride = (colorIndex == 0) ? 3 : 1;
+    pPlanes->rowStride = (colorIndex == 2) ? rowSize : 3*rowSize;
+}
+
+/* Sets the planes of a mono image, which is all three colors */
+static void monoPlanes(void *pData, size_t rowSize, colorPlanes_t *pPlanes)
+{
+    pPlanes->pPlane[0] = pPlanes->pPlane[1] = pPlanes->pPlane[2] = pData;
+    pPlanes->pixelStride = 1;
+    pPlanes->rowStride = rowSize;
+}
+
+/* Converts the rows of one stripe; called by parallelForRows().  Each row only depends on the same input row. */
+template <typename epicsType>
+static void colorStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    colorArgs_t *pArgs = (colorArgs_t *)pArg;
+    const colorPlanes_t *pIn = &pArgs->in, *pOut = &pArgs->out;
+    size_t inOffset = firstRow * pIn->rowStride, outOffset = firstRow * pOut->rowStride;
+    const epicsType *pRedIn   = (const epicsType *)pIn->pPlane[0] + inOffset;
+    const epicsType *pGreenIn = (const epicsType *)pIn->pPlane[1] + inOffset;
+    const epicsType *pBlueIn  = (const epicsType *)pIn->pPlane[2] + inOffset;
+    epicsType *pRedOut   = (epicsType *)pOut->pPlane[0] + outOffset;
+    epicsType *pGreenOut = (epicsType *)pOut->pPlane[1] + outOffset;
+    epicsType *pBlueOut  = (epicsType *)pOut->pPlane[2] + outOffset;
+    size_t rowSize = pArgs->rowSize;
+    size_t i, j, in, out;
+    int status = ND_SUCCESS;
+
+    switch (pArgs->op) {
+        case colorOpCopy:
+            if ((pIn->pixelStride == 1) && (pOut->pixelStride == 3)) {
+                status = NDColorInterleave(sizeof(epicsType), pRedIn, pGreenIn, pBlueIn, pIn->rowStride,
+                                           pRedOut, pOut->rowStride, rowSize, numRows);
+            } else if ((pIn->pixelStride == 3) && (pOut->pixelStride == 1)) {
+                status = NDColorDeinterleave(sizeof(epicsType), pRedIn, pIn->rowStride, pRedOut, pGreenOut,
+                                             pBlueOut, pOut->rowStride, rowSize, numRows);
+            } else {
+                for (i=0; i<numRows; i++) {
+                    for (j=0; j<rowSize; j++) {
+                        in = i*pIn->rowStride + j*pIn->pixelStride;
+                        out = i*pOut->rowStride + j*pOut->pixelStride;
+                        pRedOut[out]   = pRedIn[in];
+                        pGreenOut[out] = pGreenIn[in];
+                        pBlueOut[out]  = pBlueIn[in];
+                    }
+                }
+            }
+            break;
+        case colorOpFalse8:
+            for (i=0; i<numRows; i++) {
+                for (j=0; j<rowSize; j++) {
+                    unsigned char value = (unsigned char)pRedIn[i*pIn->rowStride + j];
+                    out = i*pOut->rowStride + j*pOut->pixelStride;
+                    pRedOut[out]   = (epicsType)pArgs->colorMap[0][value];
+                    pGreenOut[out] = (epicsType)pArgs->colorMap[1][value];
+                    pBlueOut[out]  = (epicsType)pArgs->colorMap[2][value];
+                }
+            }
+            break;
+        case colorOpFalse16:
+            /* The output is 8-bit, so the output pointers are those of epicsUInt8 elements */
+            for (i=0; (i<numRows) && (status == ND_SUCCESS); i++) {
+                out = (firstRow + i)*pOut->rowStride;
+                status = NDColorFalseColor16(pArgs->pFalseColorTable, pRedIn + i*pIn->rowStride,
+                                             (epicsUInt8 *)pOut->pPlane[0] + out, (epicsUInt8 *)pOut->pPlane[1] + out,
+                                             (epicsUInt8 *)pOut->pPlane[2] + out, pOut->pixelStride, rowSize);
+            }
+            break;
+        case colorOpMono:
+            for (i=0; i<numRows; i++) {
+                for (j=0; j<rowSize; j++) {
+                    in = i*pIn->rowStride + j*pIn->pixelStride;
+                    pRedOut[i*pOut->rowStride + j] = (epicsType)((pRedIn[in] + pGreenIn[in] + pBlueIn[in])/3.);
+                }
+            }
+            break;
+        case colorOpYUV:
+            status = NDColorYUVToRGB(pArgs->yuvMode, pRedIn, pIn->rowStride, pRedOut, pGreenOut, pBlueOut,
+                                     pOut->pixelStride, pOut->rowStride, rowSize, numRows);
+            break;
+        default:
+            break;
+    }
+    if (status != ND_SUCCESS) pArgs->status = ND_ERROR;
+}
+
 /* This function returns 1 if it did a conversion, 0 if it did not */
 template <typename epicsType>
 void NDPluginColorConvert::convertColor(NDArray *pArray)
 {
     NDColorMode_t colorModeOut;
     static const char* functionName = "convertColor";
-    size_t i, j;
-    epicsType *pIn, *pRedIn, *pGreenIn, *pBlueIn;
-    epicsType *pOut, *pRedOut, *pGreenOut, *pBlueOut;
     epicsType *pDataIn  = (epicsType *)pArray->pData;
     epicsType *pDataOut;
     NDArray *pArrayOut=NULL;
-    size_t imageSize, rowSize, numRows;
+    size_t imageSize, rowSize=0, numRows=0;
     size_t dims[3];
-    NDDimension_t tmpDim;
-    #ifdef HAVE_PVAPI
-    tPvFrame PvFrame, *pFrame=&PvFrame;
-    int ndims;
-    #endif
-    double value;
+    NDDimension_t tmpDim, xDim;
+    bayerArgs_t bayerArgs;
+    colorArgs_t colorArgs;
+    int bayerMethod=NDBayerBilinear;
+    size_t yuvPixels, yuvBytes;
+    int colorIndex;
+    NDFalseColorTable *pFalseColorTable=NULL;
     int colorMode=NDColorModeMono, bayerPattern=NDBayerRGGB;
     int falseColor=0;
     int changedColorMode=0;
     const unsigned char *colorMapR=NULL;
     const unsigned char *colorMapG=NULL;
     const unsigned char *colorMapB=NULL;        
-    const unsigned char *colorMapRGB=NULL;     
     NDAttribute *pAttribute;
      
     getIntegerParam(NDPluginColorConvertColorModeOut, (int *)&colorModeOut);
+    getIntegerParam(NDPluginColorConvertBayerMethod, &bayerMethod);
     pAttribute = pArray->pAttributeList->find("ColorMode");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
     pAttribute = pArray->pAttributeList->find("BayerPattern");
@@ -75,28 +259,66 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
             colorMapR = RainbowColorR;
             colorMapG = RainbowColorG;
             colorMapB = RainbowColorB;
-            colorMapRGB = RainbowColorRGB;      
             break;
         case 2:
             colorMapR = IronColorR;
             colorMapG = IronColorG;
             colorMapB = IronColorB;
-            colorMapRGB = IronColorRGB;                        
             break;
         default:
             falseColor = 0;
         }
     }     
+    /* 16-bit mono data are converted to 8-bit RGB with a false color table of the window */
+    if ((pArray->dataType == NDInt16 || pArray->dataType == NDUInt16) && (colorMode == NDColorModeMono)) {
+        getIntegerParam(NDPluginColorConvertFalseColor, &falseColor);
+        switch (falseColor) {
+        case 1:
+            pFalseColorTable = acquireFalseColorTable(falseColor, RainbowColorRGB, pArray->dataType == NDInt16);
+            break;
+        case 2:
+            pFalseColorTable = acquireFalseColorTable(falseColor, IronColorRGB, pArray->dataType == NDInt16);
+            break;
+        default:
+            break;
+        }
+        falseColor = 0;
+    }
     /* This function is called with the lock taken, and it must be set when we exit.
      * The following code can be exected without the mutex because we are not accessing elements of
      * pPvt that other threads can access. */
     this->unlock();
+    /* The conversions other than Bayer set up colorArgs, and the rows are converted in stripes below */
+    colorArgs.op = colorOpNone;
+    colorArgs.colorMap[0] = colorMapR;
+    colorArgs.colorMap[1] = colorMapG;
+    colorArgs.colorMap[2] = colorMapB;
+    colorArgs.pFalseColorTable = pFalseColorTable ? pFalseColorTable->table : NULL;
     switch (colorMode) {
         case NDColorModeMono:
             if (pArray->ndims != 2) break;
             rowSize   = pArray->dims[0].size;
             numRows   = pArray->dims[1].size;
-            imageSize = rowSize * numRows;
+            if (pFalseColorTable) {
+                colorIndex = rgbDims(colorModeOut, rowSize, numRows, dims);
+                if (colorIndex < 0) break;
+                pArrayOut = this->pNDArrayPool->alloc(3, dims, NDUInt8, 0, NULL);
+                if (!pArrayOut) break;
+                tmpDim = pArrayOut->dims[colorIndex];
+                /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
+                this->pNDArrayPool->copy(pArray, pArrayOut, 0);
+                /* That replaced the dimensions and the data type in the output array, need to fix. */
+                pArrayOut->ndims = 3;
+                pArrayOut->dataType = NDUInt8;
+                pArrayOut->dims[colorIndex] = tmpDim;
+                pArrayOut->dims[(colorIndex == 0) ? 1 : 0] = pArray->dims[0];
+                pArrayOut->dims[(colorIndex == 2) ? 1 : 2] = pArray->dims[1];
+                monoPlanes(pDataIn, rowSize, &colorArgs.in);
+                rgbPlanes(colorIndex, pArrayOut->pData, sizeof(epicsUInt8), rowSize, numRows, &colorArgs.out);
+                colorArgs.op = colorOpFalse16;
+                changedColorMode = 1;
+                break;
+            }
             switch (colorModeOut) {
                 case NDColorModeRGB1:
                     dims[0] = 3;
@@ -111,21 +333,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     pArrayOut->dims[2] = pArrayOut->dims[1];
                     pArrayOut->dims[1] = pArrayOut->dims[0];
                     pArrayOut->dims[0] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pIn  = pDataIn;
-                    if (falseColor) {
-                        for (i=0; i<imageSize; i++) {
-                            memcpy(pOut, colorMapRGB + 3 * ((unsigned char)*pIn++), 3);
-                            pOut+=3;
-                        }                                       
-                    } else {
-                        for (i=0; i<imageSize; i++) {
-                            *pOut++ = *pIn;
-                            *pOut++ = *pIn;
-                            *pOut++ = *pIn++;
-                        }
-                    }
+                    monoPlanes(pDataIn, rowSize, &colorArgs.in);
+                    rgbPlanes(0, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = falseColor ? colorOpFalse8 : colorOpCopy;
                     changedColorMode = 1;
                     break;
                 case NDColorModeRGB2:
@@ -141,31 +351,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     pArrayOut->ndims = 3;
                     pArrayOut->dims[2] = pArrayOut->dims[1];
                     pArrayOut->dims[1] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn  = pDataIn;
-                    if (falseColor) {
-                        for (i=0; i<numRows; i++) {
-                            pRedOut   = pDataOut + 3*i*rowSize;
-                            pGreenOut = pRedOut + rowSize;
-                            pBlueOut  = pRedOut + 2*rowSize;
-                            for (j=0; j<rowSize; j++) {
-                                *pRedOut++   = colorMapR[(unsigned char)*pIn];
-                                *pGreenOut++ = colorMapG[(unsigned char)*pIn];
-                                *pBlueOut++  = colorMapB[(unsigned char)*pIn++];
-                            }
-                        }                                
-                    } else {
-                        for (i=0; i<numRows; i++) {
-                            pRedOut   = pDataOut + 3*i*rowSize;
-                            pGreenOut = pRedOut + rowSize;
-                            pBlueOut  = pRedOut + 2*rowSize;
-                            for (j=0; j<rowSize; j++) {
-                                *pRedOut++   = *pIn;
-                                *pGreenOut++ = *pIn;
-                                *pBlueOut++  = *pIn++;
-                            }
-                        }
-                    }                    
+                    monoPlanes(pDataIn, rowSize, &colorArgs.in);
+                    rgbPlanes(1, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = falseColor ? colorOpFalse8 : colorOpCopy;
                     changedColorMode = 1;
                     break;
                 case NDColorModeRGB3:
@@ -180,117 +368,101 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     /* That replaced the dimensions in the output array, need to fix. */
                     pArrayOut->ndims = 3;
                     pArrayOut->dims[2] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    pIn  = pDataIn;
-                    if (falseColor) {  
-                        for (i=0; i<imageSize; i++) {                    
-                            *pRedOut++   = colorMapR[(unsigned char)*pIn];
-                            *pGreenOut++ = colorMapG[(unsigned char)*pIn];
-                            *pBlueOut++  = colorMapB[(unsigned char)*pIn++];
-                        }                                                   
-                    } else {                                      
-                        for (i=0; i<imageSize; i++) {
-                            *pRedOut++   = *pIn;
-                            *pGreenOut++ = *pIn;
-                            *pBlueOut++  = *pIn++;
-                        }
-                    }                        
+                    monoPlanes(pDataIn, rowSize, &colorArgs.in);
+                    rgbPlanes(2, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = falseColor ? colorOpFalse8 : colorOpCopy;
                     changedColorMode = 1;
                     break;
                 default:
                     break;
             }
             break;
-        #ifdef HAVE_PVAPI
         case NDColorModeBayer:
             if (pArray->ndims != 2) break;
-            switch (colorModeOut) {
-                case NDColorModeRGB1:
-                case NDColorModeRGB2:
-                case NDColorModeRGB3:
-                    rowSize   = pArray->dims[0].size;
-                    numRows   = pArray->dims[1].size;
-                    imageSize = rowSize * numRows;
-                    ndims = 3;
-                    dims[0] = 3;
-                    dims[1] = rowSize;
-                    dims[2] = numRows;
-                    /* There is a problem: the uniqueId and timeStamp are not preserved! */
-                    pArrayOut = this->pNDArrayPool->alloc(ndims, dims, pArray->dataType, 0, NULL);
-                    pArrayOut->uniqueId = pArray->uniqueId;
-                    pArrayOut->epicsTS = pArray->epicsTS;
-                    pArrayOut->timeStamp = pArray->timeStamp;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    /* For now we use the Prosilica library functions to convert Bayer to RGB */
-                    /* This requires creating their tPvFrame data structure */
-                    memset(pFrame, 0, sizeof(tPvFrame));
-                    pFrame->Width = (unsigned long)pArray->dims[0].size;
-                    pFrame->Height = (unsigned long)pArray->dims[1].size;
-                    pFrame->RegionX = (unsigned long)pArray->dims[0].offset;
-                    pFrame->RegionY = (unsigned long)pArray->dims[1].offset;
-                    pFrame->ImageBuffer = pArray->pData;
-                    pFrame->ImageBufferSize = (unsigned long)pArray->dataSize;
-                    pFrame->ImageSize = pFrame->ImageBufferSize;
-                    pFrame->BayerPattern = (tPvBayerPattern)bayerPattern;
-                    switch(pArray->dataType) {
-                        case NDInt8:
-                        case NDUInt8:
-                            pFrame->Format = ePvFmtBayer8;
-                            pFrame->BitDepth = 8;
-                            break;
-                        case NDInt16:
-                        case NDUInt16:
-                            pFrame->Format = ePvFmtBayer16;
-                            pFrame->BitDepth = 16;
-                            break;
-                        default:
-                            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                                "%s:%s: error unsupported data type=%d\n",
-                                driverName, functionName, pArray->dataType);
-                            break;
-                    }
-                    break;
-                default: 
-                    break;
+            if ((colorModeOut != NDColorModeRGB1) && (colorModeOut != NDColorModeRGB2) &&
+                (colorModeOut != NDColorModeRGB3)) break;
+            if ((pArray->dataType != NDInt8) && (pArray->dataType != NDUInt8) &&
+                (pArray->dataType != NDInt16) && (pArray->dataType != NDUInt16)) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error unsupported data type=%d\n",
+                    driverName, functionName, pArray->dataType);
+                break;
             }
+            rowSize   = pArray->dims[0].size;
+            numRows   = pArray->dims[1].size;
+            imageSize = rowSize * numRows;
+            dims[0] = 3;
+            dims[1] = rowSize;
+            dims[2] = numRows;
+            pArrayOut = this->pNDArrayPool->alloc(3, dims, pArray->dataType, 0, NULL);
+            if (!pArrayOut) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error allocating output array\n",
+                    driverName, functionName);
+                break;
+            }
+            pArrayOut->uniqueId = pArray->uniqueId;
+            pArrayOut->epicsTS = pArray->epicsTS;
+            pArrayOut->timeStamp = pArray->timeStamp;
+            pDataOut = (epicsType *)pArrayOut->pData;
+            /* The pattern is that of the first pixel of the detector, so it changes with odd offsets */
+            if (pArray->dims[0].offset & 1) bayerPattern ^= 2;
+            if (pArray->dims[1].offset & 1) bayerPattern ^= 1;
+            bayerArgs.dataType = pArray->dataType;
+            bayerArgs.bayerPattern = bayerPattern;
+            bayerArgs.method = (bayerMethod == NDBayerEdgeAware) ? NDBayerEdgeAware : NDBayerBilinear;
+            bayerArgs.pIn = pDataIn;
+            bayerArgs.sizeX = rowSize;
+            bayerArgs.sizeY = numRows;
             switch (colorModeOut) {
                 case NDColorModeRGB1:
-                    PvUtilityColorInterpolate(pFrame, pDataOut, pDataOut+1, pDataOut+2, 2, 0);
+                    bayerArgs.pRed = pDataOut;
+                    bayerArgs.pGreen = pDataOut + 1;
+                    bayerArgs.pBlue = pDataOut + 2;
+                    bayerArgs.pixelStride = 3;
+                    bayerArgs.rowStride = 3*rowSize;
                     pArrayOut->dims[0].size = 3;
                     memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
                     break;
-                
                 case NDColorModeRGB2:
-                    PvUtilityColorInterpolate(pFrame, pDataOut,  pDataOut+rowSize, pDataOut+2*rowSize, 
-                                              0, (unsigned long)(2*rowSize));
+                    bayerArgs.pRed = pDataOut;
+                    bayerArgs.pGreen = pDataOut + rowSize;
+                    bayerArgs.pBlue = pDataOut + 2*rowSize;
+                    bayerArgs.pixelStride = 1;
+                    bayerArgs.rowStride = 3*rowSize;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
                     pArrayOut->dims[1].size = 3;
                     memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
                     break;
-
-                case NDColorModeRGB3:
-                    PvUtilityColorInterpolate(pFrame, pDataOut,  pDataOut+imageSize, pDataOut+2*imageSize, 0, 0);
+                default:
+                    bayerArgs.pRed = pDataOut;
+                    bayerArgs.pGreen = pDataOut + imageSize;
+                    bayerArgs.pBlue = pDataOut + 2*imageSize;
+                    bayerArgs.pixelStride = 1;
+                    bayerArgs.rowStride = rowSize;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[1], sizeof(NDDimension_t));
                     pArrayOut->dims[2].size = 3;
-                    changedColorMode = 1;
-                    break;
-                default:
                     break;
             }
+            /* The rows are computed in stripes by the intra-frame threads */
+            bayerArgs.status = ND_SUCCESS;
+            parallelForRows(bayerStripe, &bayerArgs, numRows, numStripes(numRows));
+            if (bayerArgs.status != ND_SUCCESS) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error converting %dx%d Bayer array\n",
+                    driverName, functionName, (int)rowSize, (int)numRows);
+                pArrayOut->release();
+                pArrayOut = NULL;
+                break;
+            }
+            changedColorMode = 1;
             break;
-        #endif
         case NDColorModeRGB1:
             if (pArray->ndims != 3) break;
             rowSize   = pArray->dims[1].size;
             numRows   = pArray->dims[2].size;
-            imageSize = rowSize * numRows;
             switch (colorModeOut) {
                 case NDColorModeMono:
                     /* Make a new 2-D array */
@@ -303,30 +475,16 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     pArrayOut->ndims = 2;
                     pArrayOut->dims[0] = pArrayOut->dims[1];
                     pArrayOut->dims[1] = pArrayOut->dims[2];
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pIn = pDataIn;
-                    for (i=0; i<imageSize; i++) {
-                        value  = (*pIn + *(pIn+1) + *(pIn+2))/3.;
-                        *pOut++ = (epicsType)value;
-                        pIn += 3;
-                    }
+                    rgbPlanes(0, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    monoPlanes(pArrayOut->pData, rowSize, &colorArgs.out);
+                    colorArgs.op = colorOpMono;
                     changedColorMode = 1;
                     break;
                 case NDColorModeRGB2:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn = pDataIn;
-                    for (i=0; i<numRows; i++) {
-                        pRedOut   = pDataOut + 3*i*rowSize;
-                        pGreenOut = pRedOut + rowSize;
-                        pBlueOut  = pRedOut + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pIn++;
-                            *pGreenOut++ = *pIn++;
-                            *pBlueOut++  = *pIn++;
-                        }
-                    }
+                    rgbPlanes(0, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(1, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[2], sizeof(NDDimension_t));
@@ -334,16 +492,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     break;
                 case NDColorModeRGB3:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn = pDataIn;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    for (i=0; i<imageSize; i++) {
-                        *pRedOut++   = *pIn++;
-                        *pGreenOut++ = *pIn++;
-                        *pBlueOut++  = *pIn++;
-                    }
+                    rgbPlanes(0, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(2, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[0], sizeof(NDDimension_t));
@@ -357,7 +508,6 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
             if (pArray->ndims != 3) break;
             rowSize   = pArray->dims[0].size;
             numRows   = pArray->dims[2].size;
-            imageSize = rowSize * numRows;
             switch (colorModeOut) {
                 case NDColorModeMono:
                     /* Make a new 2-D array */
@@ -369,33 +519,16 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     /* That replaced the dimensions in the output array, need to fix. */
                     pArrayOut->ndims = 2;
                     pArrayOut->dims[1] = pArrayOut->dims[2];
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            value = (*pRedIn++ + *pGreenIn++ + *pBlueIn++)/3.;
-                            *pOut++ = (epicsType)value;
-                        }
-                    }
+                    rgbPlanes(1, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    monoPlanes(pArrayOut->pData, rowSize, &colorArgs.out);
+                    colorArgs.op = colorOpMono;
                     changedColorMode = 1;
                     break;
                 case NDColorModeRGB1:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pOut++  = *pRedIn++;
-                            *pOut++  = *pGreenIn++;
-                            *pOut++  = *pBlueIn++;
-                        }
-                    }
+                    rgbPlanes(1, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(0, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[2], sizeof(NDDimension_t));
@@ -403,20 +536,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     break;
                 case NDColorModeRGB3:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pRedIn++;
-                            *pGreenOut++ = *pGreenIn++;
-                            *pBlueOut++  = *pBlueIn++;
-                        }
-                    }
+                    rgbPlanes(1, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(2, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
@@ -430,7 +552,6 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
             if (pArray->ndims != 3) break;
             rowSize   = pArray->dims[0].size;
             numRows   = pArray->dims[1].size;
-            imageSize = rowSize * numRows;
             switch (colorModeOut) {
                 case NDColorModeMono:
                     /* Make a new 2-D array */
@@ -441,29 +562,16 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     this->pNDArrayPool->copy(pArray, pArrayOut, 0);
                     /* That replaced the dimensions in the output array, need to fix. */
                     pArrayOut->ndims = 2;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    for (i=0; i<imageSize; i++) {
-                        value = (*pRedIn++ + *pGreenIn++ + *pBlueIn++)/3.;
-                        *pOut++ = (epicsType)value;
-                    }
+                    rgbPlanes(2, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    monoPlanes(pArrayOut->pData, rowSize, &colorArgs.out);
+                    colorArgs.op = colorOpMono;
                     changedColorMode = 1;
                     break;
                 case NDColorModeRGB1:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    pOut = pDataOut;
-                    for (i=0; i<imageSize; i++) {
-                        *pOut++ = *pRedIn++;
-                        *pOut++ = *pGreenIn++;
-                        *pOut++ = *pBlueIn++;
-                    }
+                    rgbPlanes(2, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(0, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[2], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
@@ -471,20 +579,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     break;
                 case NDColorModeRGB2:
                     pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    for (i=0; i<numRows; i++) {
-                        pRedOut   = pDataOut + 3*i*rowSize;
-                        pGreenOut = pRedOut + rowSize;
-                        pBlueOut  = pRedOut + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pRedIn++;
-                            *pGreenOut++ = *pGreenIn++;
-                            *pBlueOut++  = *pBlueIn++;
-                        }
-                    }
+                    rgbPlanes(2, pDataIn, sizeof(epicsType), rowSize, numRows, &colorArgs.in);
+                    rgbPlanes(1, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+                    colorArgs.op = colorOpCopy;
                     memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
                     memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
@@ -494,12 +591,60 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
                     break;
             }
             break;
+        case NDColorModeYUV444:
+        case NDColorModeYUV422:
+        case NDColorModeYUV411:
+            /* The YUV modes are 8-bit, with dims[0] the number of bytes of a row */
+            if (pArray->ndims != 2) break;
+            if ((pArray->dataType != NDInt8) && (pArray->dataType != NDUInt8)) break;
+            yuvPixels = (colorMode == NDColorModeYUV444) ? 1 : (colorMode == NDColorModeYUV422) ? 2 : 4;
+            yuvBytes  = (colorMode == NDColorModeYUV444) ? 3 : (colorMode == NDColorModeYUV422) ? 4 : 6;
+            if (pArray->dims[0].size % yuvBytes) break;
+            rowSize   = pArray->dims[0].size / yuvBytes * yuvPixels;
+            numRows   = pArray->dims[1].size;
+            colorIndex = rgbDims(colorModeOut, rowSize, numRows, dims);
+            if (colorIndex < 0) break;
+            pArrayOut = this->pNDArrayPool->alloc(3, dims, pArray->dataType, 0, NULL);
+            if (!pArrayOut) break;
+            tmpDim = pArrayOut->dims[colorIndex];
+            /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
+            this->pNDArrayPool->copy(pArray, pArrayOut, 0);
+            /* That replaced the dimensions in the output array, need to fix. */
+            pArrayOut->ndims = 3;
+            xDim = pArray->dims[0];
+            xDim.size = rowSize;
+            xDim.offset = xDim.offset / yuvBytes * yuvPixels;
+            pArrayOut->dims[colorIndex] = tmpDim;
+            pArrayOut->dims[(colorIndex == 0) ? 1 : 0] = xDim;
+            pArrayOut->dims[(colorIndex == 2) ? 1 : 2] = pArray->dims[1];
+            /* The input rows are bytes, so the row stride of the input plane is dims[0] */
+            monoPlanes(pDataIn, pArray->dims[0].size, &colorArgs.in);
+            rgbPlanes(colorIndex, pArrayOut->pData, sizeof(epicsType), rowSize, numRows, &colorArgs.out);
+            colorArgs.op = colorOpYUV;
+            colorArgs.yuvMode = (NDColorMode_t)colorMode;
+            changedColorMode = 1;
+            break;
         default:
             break;
     }
+    /* The rows are converted in stripes by the intra-frame threads */
+    if (pArrayOut && (colorArgs.op != colorOpNone)) {
+        colorArgs.rowSize = rowSize;
+        colorArgs.status = ND_SUCCESS;
+        parallelForRows(colorStripe<epicsType>, &colorArgs, numRows, numStripes(numRows));
+        if (colorArgs.status != ND_SUCCESS) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error converting %dx%d array from color mode %d to %d\n",
+                driverName, functionName, (int)rowSize, (int)numRows, colorMode, colorModeOut);
+            pArrayOut->release();
+            pArrayOut = NULL;
+            changedColorMode = 0;
+        }
+    }
     /* If the output array pointer is null then no conversion was done, copy the input to the output */
     if (!pArrayOut) pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
     this->lock();
+    if (pFalseColorTable) releaseFalseColorTable(pFalseColorTable);
     /* Get the attributes for this plugin */
     this->getAttributes(pArrayOut->pAttributeList);
     /* If we changed the color mode then set the attribute */
@@ -512,6 +657,45 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
               driverName, functionName, colorMode, colorModeOut, pArrayOut);
 }
 
+/** Returns the false color table of a color map and of the current window, computing it if the map, the window
+  * or the data type changed.  Called with the lock taken; the table stays valid until releaseFalseColorTable(),
+  * even if another array replaces the current table.
+  * \param[in] falseColor The FalseColor choice of the map.
+  * \param[in] pColorMapRGB The map.
+  * \param[in] isSigned The table is for Int16 data, else for UInt16 data.
+  * \return The table. */
+NDFalseColorTable* NDPluginColorConvert::acquireFalseColorTable(int falseColor, const unsigned char *pColorMapRGB,
+                                                                 int isSigned)
+{
+    NDFalseColorTable *pTable = pFalseColorTable_;
+    double minValue, maxValue;
+
+    getDoubleParam(NDPluginColorConvertFalseColorMin, &minValue);
+    getDoubleParam(NDPluginColorConvertFalseColorMax, &maxValue);
+    if (!pTable || (pTable->falseColor != falseColor) || (pTable->isSigned != isSigned) ||
+        (pTable->minValue != minValue) || (pTable->maxValue != maxValue)) {
+        pTable = new NDFalseColorTable;
+        pTable->falseColor = falseColor;
+        pTable->isSigned = isSigned;
+        pTable->minValue = minValue;
+        pTable->maxValue = maxValue;
+        pTable->refs = 1;
+        NDColorFalseColorTable(pColorMapRGB, isSigned, minValue, maxValue, pTable->table);
+        /* The old table is freed now if no array is using it, else by the last releaseFalseColorTable() */
+        if (pFalseColorTable_) releaseFalseColorTable(pFalseColorTable_);
+        pFalseColorTable_ = pTable;
+    }
+    pTable->refs++;
+    return pTable;
+}
+
+/** Releases a table from acquireFalseColorTable(), and frees it if it is no longer the current table.
+  * Called with the lock taken. */
+void NDPluginColorConvert::releaseFalseColorTable(NDFalseColorTable *pTable)
+{
+    if (--pTable->refs == 0) delete pTable;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Looks for the NDArray attribute called "ColorMode" to determine the color
   * mode of the input array.  Uses the parameter NDPluginColorConvertColorModeOut
@@ -570,7 +754,7 @@ void NDPluginColorConvert::processCallbacks(NDArray *pArray)
             break;
     }
    
-    callParamCallbacks();
+    callStatusCallbacks();
 }
 
 
@@ -609,11 +793,18 @@ NDPluginColorConvert::NDPluginColorConvert(const char *portName, int queueSize,
 
     createParam(NDPluginColorConvertColorModeOutString, asynParamInt32, &NDPluginColorConvertColorModeOut);
     createParam(NDPluginColorConvertFalseColorString,   asynParamInt32, &NDPluginColorConvertFalseColor);    
+    createParam(NDPluginColorConvertBayerMethodString,  asynParamInt32, &NDPluginColorConvertBayerMethod);
+    createParam(NDPluginColorConvertFalseColorMinString, asynParamFloat64, &NDPluginColorConvertFalseColorMin);
+    createParam(NDPluginColorConvertFalseColorMaxString, asynParamFloat64, &NDPluginColorConvertFalseColorMax);
+    pFalseColorTable_ = NULL;
 
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDPluginColorConvert");
     
     setIntegerParam(NDPluginColorConvertColorModeOut, NDColorModeMono);
+    setIntegerParam(NDPluginColorConvertBayerMethod, NDBayerBilinear);
+    setDoubleParam(NDPluginColorConvertFalseColorMin, 0.);
+    setDoubleParam(NDPluginColorConvertFalseColorMax, 65535.);
 
     // Enable ArrayCallbacks.  
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
@@ -7,6 +7,14 @@
 
 #define NDPluginColorConvertColorModeOutString  "COLOR_MODE_OUT" /* (NDColorMode_t r/w) Output color mode */
 #define NDPluginColorConvertFalseColorString    "FALSE_COLOR"    /* (NDColorMode_t r/w) Output color mode */
+#define NDPluginColorConvertBayerMethodString   "BAYER_METHOD"   /* (NDBayerMethod_t r/w) Bayer demosaic method */
+#define NDPluginColorConvertFalseColorMinString "FALSE_COLOR_MIN" /* (asynFloat64 r/w) 16-bit value of the first
+                                                                   *  false color */
+#define NDPluginColorConvertFalseColorMaxString "FALSE_COLOR_MAX" /* (asynFloat64 r/w) 16-bit value of the last
+                                                                   *  false color */
+
+/** A false color table for 16-bit data and the arrays that are using it */
+struct NDFalseColorTable;
 
 /** Convert NDArrays from one NDColorMode to another.
   * This plugin is as source of NDArray callbacks, passing the (possibly converted) NDArray
@@ -15,12 +23,15 @@
   * <ul>
   *  <li> Mono to RGB1, RGB2 or RGB3 </li>
   *  <li> RGB1, RGB2 or RGB3 to mono</li>
-  *  <li> Bayer color to RGB1, RGB2 or RGB3 (Windows and Linux only)</li>
+  *  <li> Bayer color to RGB1, RGB2 or RGB3, with a bilinear or an edge-aware demosaic of 8 and 16 bit data</li>
   *  <li> RGB1 to RGB2 or RGB3 </li> 
   *  <li> RGB2 to RGB1 or RGB3 </li> 
   *  <li> RGB3 to RGB1 or RGB2 </li> 
+  *  <li> 8 bit YUV444, YUV422 or YUV411 to RGB1, RGB2 or RGB3</li>
   * </ul> 
-  * It also applies a false color map if requested for 8 bit data  
+  * It also applies a false color map if requested for 8 bit data, and for 16 bit data, which is converted to 8
+  * bit RGB with the window from FalseColorMin to FalseColorMax.
+  * The rows of each conversion are split into stripes that are converted by the IntraFrameThreads threads.
   * If the conversion required by the input color mode and output color mode are not
   * in this supported list then the NDArray is passed on without conversion. */
 class epicsShareClass NDPluginColorConvert : public NDPluginDriver {
@@ -37,10 +48,18 @@ protected:
     int NDPluginColorConvertColorModeOut;
     #define FIRST_NDPLUGIN_COLOR_CONVERT_PARAM NDPluginColorConvertColorModeOut
     int NDPluginColorConvertFalseColor;    
+    int NDPluginColorConvertBayerMethod;
+    int NDPluginColorConvertFalseColorMin;
+    int NDPluginColorConvertFalseColorMax;
 
 private:
     /* These methods are just for this class */
     template <typename epicsType> void convertColor(NDArray *pArray);
+    NDFalseColorTable* acquireFalseColorTable(int falseColor, const unsigned char *pColorMapRGB, int isSigned);
+    void releaseFalseColorTable(NDFalseColorTable *pTable);
+
+    NDFalseColorTable *pFalseColorTable_;   /**< The table of the current map and window, NULL before the first
+                                              *  16-bit false color array */
 };
  
 #endif
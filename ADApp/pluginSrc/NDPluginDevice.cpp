@@ -0,0 +1,255 @@
+/*
+ * NDPluginDevice.cpp
+ *
+ * Base class of the plugins that process arrays in the memory of a device, which keeps the arrays on the device
+ * between the plugins of a chain.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginDevice.h"
+#ifdef ND_WITH_CUDA
+#include "NDCudaKernels.h"
+#endif
+
+static const char *driverName = "NDPluginDevice";
+
+/** Constructor for NDPluginDevice; the arguments are those of NDPluginDriver, and
+  * \param[in] pDevice The memory of the device; the pool of the device arrays of the plugin has the same maxBuffers
+  *            and maxMemory as the pool of its host arrays.
+  */
+NDPluginDevice::NDPluginDevice(const char *portName, int queueSize, int blockingCallbacks,
+                               const char *NDArrayPort, int NDArrayAddr, int maxAddr,
+                               NDDeviceMemory *pDevice, int maxBuffers, size_t maxMemory,
+                               int interfaceMask, int interruptMask,
+                               int asynFlags, int autoConnect, int priority, int stackSize, int maxThreads)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                     NDArrayPort, NDArrayAddr, maxAddr, maxBuffers, maxMemory,
+                     interfaceMask, interruptMask, asynFlags, autoConnect, priority, stackSize, maxThreads),
+      pDevice_(pDevice)
+{
+    pDevicePool_ = new NDArrayPool(maxBuffers, maxMemory, pDevice);
+    streamId_ = epicsThreadPrivateCreate();
+    streamLock_ = epicsMutexMustCreate();
+
+    createParam(NDPluginDeviceNameString,    asynParamOctet,   &NDPluginDeviceName);
+    createParam(NDPluginDeviceMemoryString,  asynParamFloat64, &NDPluginDeviceMemory);
+    createParam(NDPluginDeviceUploadsString, asynParamInt32,   &NDPluginDeviceUploads);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginDevice");
+    setStringParam(NDPluginDeviceName, pDevice->name());
+    setDoubleParam(NDPluginDeviceMemory, 0.);
+    setIntegerParam(NDPluginDeviceUploads, 0);
+
+    /* The device arrays of the upstream plugins are processed on the device */
+    supportsDeviceArrays_ = true;
+}
+
+NDPluginDevice::~NDPluginDevice()
+{
+    for (size_t i=0; i<streams_.size(); i++) pDevice_->destroyStream(streams_[i]);
+    epicsMutexDestroy(streamLock_);
+    epicsThreadPrivateDelete(streamId_);
+    delete pDevicePool_;
+}
+
+/** Returns the stream of the calling thread, which is created the first time, or NULL if it cannot be created */
+void* NDPluginDevice::threadStream()
+{
+    void *stream = epicsThreadPrivateGet(streamId_);
+
+    if (!stream) {
+        stream = pDevice_->createStream();
+        if (!stream) return NULL;
+        epicsThreadPrivateSet(streamId_, stream);
+        epicsMutexLock(streamLock_);
+        streams_.push_back(stream);
+        epicsMutexUnlock(streamLock_);
+    }
+    return stream;
+}
+
+/** Returns an array of the device pool with the data of an array in host memory, whose copy is queued on a stream,
+  * or NULL if there is no memory or the copy cannot be queued.  This is called without the lock.
+  * The host array must not change until the stream is synchronized. */
+NDArray* NDPluginDevice::copyToDevice(NDArray *pArray, void *stream)
+{
+    NDArray *pOut;
+    NDArrayInfo_t arrayInfo;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    int i;
+
+    for (i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+    pOut = pDevicePool_->alloc(pArray->ndims, dims, pArray->dataType, 0, NULL);
+    if (!pOut) return NULL;
+    /* The dimensions, time stamps and attributes are copied on the host, the data on the device */
+    pDevicePool_->copy(pArray, pOut, 0);
+    pArray->getInfo(&arrayInfo);
+    if (pDevice_->toDevice(pOut->pData, pArray->pData, arrayInfo.totalBytes, stream) != ND_SUCCESS) {
+        pOut->release();
+        return NULL;
+    }
+    return pOut;
+}
+
+/** Queues the processing of an array on the device, and returns the output array.
+  * This is called without the lock.  The work that reads pArray must be queued on stream, after which it waits
+  * for the work that writes pArray.  The output is normally allocated from pDevicePool_, and the work that writes
+  * it is queued on stream too, so the downstream plugins wait for it on the device.  An output in host memory,
+  * such as a table of results, must be complete when this returns, so the work must be synchronized first.
+  * This implementation outputs the input, so the plugin copies the arrays to the device.
+  * \param[in] pArray The array, in the memory of pDevice_.
+  * \param[in] stream The stream of the calling thread.
+  * \return The output array, which the caller releases, or NULL for none.
+  */
+NDArray* NDPluginDevice::processDevice(NDArray *pArray, void *stream)
+{
+    pArray->reserve();
+    return pArray;
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * Copies the array to the device if it is in host memory, and calls processDevice() without the lock.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginDevice::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the lock taken, and it must be set when we exit.
+     * The lock is released while the work is queued on the device and while it is waited for. */
+    NDArray *pInput=NULL, *pOutput=NULL;
+    bool uploaded = false;
+    int uploads;
+    void *stream;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    stream = threadStream();
+    if (!stream) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot create a stream on %s\n",
+            driverName, functionName, pDevice_->name());
+        return;
+    }
+    if (pArray->pDevice && (pArray->pDevice != pDevice_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s array uniqueId=%d is in the memory of %s, not %s\n",
+            driverName, functionName, pArray->uniqueId, pArray->pDevice->name(), pDevice_->name());
+        return;
+    }
+
+    this->unlock();
+    if (pArray->pDevice) {
+        if (pDevice_->waitStream(stream, pArray->deviceStream) == ND_SUCCESS) {
+            pInput = pArray;
+            pInput->reserve();
+        }
+    } else {
+        pInput = copyToDevice(pArray, stream);
+        uploaded = (pInput != NULL);
+    }
+    if (pInput) pOutput = processDevice(pInput, stream);
+    this->lock();
+
+    if (!pInput) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot queue array uniqueId=%d on %s\n",
+            driverName, functionName, pArray->uniqueId, pDevice_->name());
+    }
+    if (uploaded) {
+        getIntegerParam(NDPluginDeviceUploads, &uploads);
+        setIntegerParam(NDPluginDeviceUploads, uploads+1);
+    }
+    if (pOutput) {
+        /* The output of an upstream plugin that is passed on is written on the stream of that plugin */
+        if (pOutput->pDevice && (pOutput != pArray)) pOutput->deviceStream = stream;
+        NDPluginDriver::endProcessCallbacks(pOutput, false, true);
+    }
+
+    /* The input is released once the work that reads it is done, so its buffer is not reused before */
+    this->unlock();
+    if (pDevice_->synchronize(stream) != ND_SUCCESS) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s the work on array uniqueId=%d failed on %s\n",
+            driverName, functionName, pArray->uniqueId, pDevice_->name());
+    }
+    this->lock();
+    if (pInput) pInput->release();
+    setDoubleParam(NDPluginDeviceMemory, pDevicePool_->memorySize() / 1048576.);
+    callStatusCallbacks();
+}
+
+#ifdef ND_WITH_CUDA
+/** Configuration command for a plugin that copies the arrays to a CUDA device */
+extern "C" int NDDeviceConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                 const char *NDArrayPort, int NDArrayAddr, int device,
+                                 int maxBuffers, size_t maxMemory,
+                                 int priority, int stackSize, int maxThreads)
+{
+    NDDeviceMemory *pDevice = NDCudaDeviceMemory(device);
+    NDPluginDevice *pPlugin;
+
+    if (!pDevice) {
+        printf("NDDeviceConfigure: cannot use CUDA device %d\n", device);
+        return asynError;
+    }
+    pPlugin = new NDPluginDevice(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr, 1,
+                                 pDevice, maxBuffers, maxMemory,
+                                 asynGenericPointerMask, asynGenericPointerMask,
+                                 0, 1, priority, stackSize, maxThreads);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "device",iocshArgInt};
+static const iocshArg initArg6 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg7 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg8 = { "priority",iocshArgInt};
+static const iocshArg initArg9 = { "stackSize",iocshArgInt};
+static const iocshArg initArg10 = { "# threads",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9,
+                                            &initArg10};
+static const iocshFuncDef initFuncDef = {"NDDeviceConfigure",11,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDDeviceConfigure(args[0].sval, args[1].ival, args[2].ival,
+                      args[3].sval, args[4].ival, args[5].ival,
+                      args[6].ival, args[7].ival, args[8].ival,
+                      args[9].ival, args[10].ival);
+}
+
+extern "C" void NDDeviceRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDDeviceRegister);
+}
+#endif
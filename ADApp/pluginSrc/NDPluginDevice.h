@@ -0,0 +1,57 @@
+#ifndef NDPluginDevice_H
+#define NDPluginDevice_H
+
+#include <vector>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+
+#include "NDPluginDriver.h"
+
+#define NDPluginDeviceNameString    "DEVICE_NAME"    /* (asynOctet,   r/o) Name of the device memory */
+#define NDPluginDeviceMemoryString  "DEVICE_MEMORY"  /* (asynFloat64, r/o) Memory of the device pool in MB */
+#define NDPluginDeviceUploadsString "DEVICE_UPLOADS" /* (asynInt32,   r/w) Number of arrays copied from host memory
+                                                      *  to the device */
+
+/** Base class of the plugins that process arrays in the memory of a device, such as a GPU.
+  * The input arrays in host memory are copied to the device, and those already in its memory, from an upstream
+  * device plugin, are processed where they are, so a chain of device plugins copies each frame to the device
+  * once, and the host plugins after it are given copies in host memory by NDPluginDriver.
+  * Each thread of the plugin queues its work on a stream of its own, which waits for the stream the input is
+  * written on without waiting in the host, and the output is passed on as soon as the work is queued, with its
+  * NDArray::deviceStream set, so the work of the plugins of the chain is done on the device one after the other.
+  * The thread then waits for its stream before it releases the input, so its buffer is not reused while it is read.
+  * Derived classes override processDevice(); this class by itself outputs the arrays copied to the device.
+  */
+class epicsShareClass NDPluginDevice : public NDPluginDriver {
+public:
+    NDPluginDevice(const char *portName, int queueSize, int blockingCallbacks,
+                   const char *NDArrayPort, int NDArrayAddr, int maxAddr,
+                   NDDeviceMemory *pDevice, int maxBuffers, size_t maxMemory,
+                   int interfaceMask, int interruptMask,
+                   int asynFlags, int autoConnect, int priority, int stackSize, int maxThreads);
+    ~NDPluginDevice();
+    /* These methods override the virtual methods in the base class */
+    virtual void processCallbacks(NDArray *pArray);
+
+protected:
+    virtual NDArray* processDevice(NDArray *pArray, void *stream);
+
+    NDDeviceMemory *pDevice_;   /**< The device the plugin works on */
+    NDArrayPool *pDevicePool_;  /**< The pool of the arrays in the memory of the device */
+
+    int NDPluginDeviceName;
+    #define FIRST_NDPLUGIN_DEVICE_PARAM NDPluginDeviceName
+    int NDPluginDeviceMemory;
+    int NDPluginDeviceUploads;
+
+private:
+    void* threadStream();
+    NDArray* copyToDevice(NDArray *pArray, void *stream);
+
+    epicsThreadPrivateId streamId_;     /**< The stream of each thread */
+    epicsMutexId streamLock_;           /**< Protects streams_ */
+    std::vector<void*> streams_;        /**< The streams of all the threads, destroyed with the plugin */
+};
+
+#endif
@@ -12,18 +12,29 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <algorithm>
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsEvent.h>
+#include <epicsMutex.h>
 #include <epicsTime.h>
+#include <epicsTimer.h>
 #include <cantProceed.h>
+#include <epicsAtomic.h>
+#include <iocsh.h>
 
 #include <asynDriver.h>
 
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
+#include "NDPluginExecutor.h"
+#include "NDPluginTrace.h"
+
+#if defined(_WIN32)
+  #define strtok_r(a,b,c) strtok(a,b)
+#endif
 
 typedef enum {
     ToThreadMessageData,
@@ -33,6 +44,7 @@ typedef enum {
 typedef struct {
     ToThreadMessageType_t messageType;
     NDArray *pArray;    
+    epicsTimeStamp enqueueTime;
 } ToThreadMessage_t;
 
 typedef enum {
@@ -47,9 +59,76 @@ typedef struct {
 
 static const char *driverName="NDPluginDriver";
 
+/** All of the plugins of the IOC, for NDPipelineReport() */
+static epicsThreadOnceId pluginListOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId pluginListLock;
+static std::vector<NDPluginDriver*> pluginList;
+
+static void pluginListInit(void *)
+{
+    pluginListLock = epicsMutexMustCreate();
+}
+
 sortedListElement::sortedListElement(NDArray *pArray, epicsTimeStamp time)
     : pArray_(pArray), insertionTime_(time) {}
 
+/** Returns the value of an asynInt32 parameter, or 0 if the snapshot does not contain it. */
+epicsInt32 NDPluginParamSnapshot::getInteger(int index) const
+{
+    if ((index < 0) || (index >= (int)types_.size()) || (types_[index] != paramInteger)) return 0;
+    return integers_[index];
+}
+
+/** Returns the value of an asynFloat64 parameter, or 0 if the snapshot does not contain it. */
+double NDPluginParamSnapshot::getDouble(int index) const
+{
+    if ((index < 0) || (index >= (int)types_.size()) || (types_[index] != paramDouble)) return 0.;
+    return doubles_[index];
+}
+
+/** Sets the value of an asynInt32 parameter, adding it to the snapshot if needed. */
+void NDPluginParamSnapshot::setInteger(int index, epicsInt32 value)
+{
+    if (index < 0) return;
+    setType(index, paramInteger);
+    integers_[index] = value;
+}
+
+/** Sets the value of an asynFloat64 parameter, adding it to the snapshot if needed. */
+void NDPluginParamSnapshot::setDouble(int index, double value)
+{
+    if (index < 0) return;
+    setType(index, paramDouble);
+    doubles_[index] = value;
+}
+
+void NDPluginParamSnapshot::setType(int index, char type)
+{
+    if (index >= (int)types_.size()) {
+        types_.resize(index+1, paramNone);
+        integers_.resize(index+1, 0);
+        doubles_.resize(index+1, 0.);
+    }
+    types_[index] = type;
+}
+
+/** The maximum number of batches of arrays that an executor job processes for one plugin before it lets
+  * the jobs of other plugins run */
+#define MAX_EXECUTOR_BATCHES 16
+
+/** Weight of the last array in recentProcessTime_, the moving average of the processing time */
+static const double recentProcessWeight = 0.2;
+
+/** AutoScale parks a thread only if the others would then be busy for less than this fraction of the time */
+static const double autoScaleMaxUtilization = 0.75;
+
+static void executorJobC(void *drvPvt)
+{
+    NDPluginDriver *pPvt = (NDPluginDriver *)drvPvt;
+
+    pPvt->executorTask();
+}
+
 static void sortingTaskC(void *drvPvt)
 {
     NDPluginDriver *pPvt = (NDPluginDriver *)drvPvt;
@@ -57,6 +136,13 @@ static void sortingTaskC(void *drvPvt)
     pPvt->sortingTask();
 }
 
+static void statusTimerCallbackC(void *drvPvt)
+{
+    NDPluginDriver *pPvt = (NDPluginDriver *)drvPvt;
+
+    pPvt->statusTimerCallback();
+}
+
 /** Constructor for NDPluginDriver; most parameters are simply passed to asynNDArrayDriver::asynNDArrayDriver.
   * After calling the base class constructor this method creates a thread to execute the NDArray callbacks, 
   * and sets reasonable default values for all of the parameters defined in NDPluginDriver.h.
@@ -94,12 +180,38 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
           interruptMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask,
           asynFlags, autoConnect, priority, stackSize),
     pPrevInputArray_(0),
+    supportsStridedViews_(false),
+    supportsCompressedArrays_(false),
+    supportsPackedArrays_(false),
+    supportsSparseArrays_(false),
+    supportsDeviceArrays_(false),
+    passArraysByReference_(false),
+    reportsOwnDimensions_(false),
     pluginStarted_(false),
     firstOutputArray_(true),
+    fused_(false),
     pToThreadMsgQ_(NULL),
+    pToThreadLockFreeQ_(NULL),
+    useExecutor_(false),
+    executorActive_(0),
+    numBlockedSenders_(0),
+    directQueue_(0),
+    directSenders_(0),
+    decimate_(0),
+    vetoEnabled_(false),
+    scratchBytes_(0),
+    poolConsumer_(portName),
     pFromThreadMsgQ_(NULL),
+    pStripeWorkers_(NULL),
+    intraFrameThreads_(0),
+    numSorted_(0),
     prevUniqueId_(-1000),
-    sortingThreadId_(0)  
+    sortingThreadId_(0),
+    numaNode_(-1),
+    threadConfigId_(0),
+    affinitySet_(false),
+    schedulerSet_(false),
+    recentProcessTime_(0.)
 {
     asynUser *pasynUser;
     //static const char *functionName = "NDPluginDriver";
@@ -108,6 +220,14 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     
     /* Initialize some members to 0 */
     memset(&this->lastProcessTime_, 0, sizeof(this->lastProcessTime_));
+    memset(&this->lastStatusTime_, 0, sizeof(this->lastStatusTime_));
+    this->statusPending_ = false;
+    this->statusTimerActive_ = false;
+    this->autoScale_ = false;
+    this->activeThreads_ = 0;
+    this->busyTime_ = 0.;
+    this->maxPending_ = 0;
+    memset(&this->lastScaleTime_, 0, sizeof(this->lastScaleTime_));
     memset(&this->dimsPrev_, 0, sizeof(this->dimsPrev_));
     this->pasynGenericPointer_ = NULL;
     this->asynGenericPointerPvt_ = NULL;
@@ -121,15 +241,49 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     pasynUser->userPvt = this;
     this->pasynUserGenericPointer_ = pasynUser;
     this->pasynUserGenericPointer_->reason = NDArrayData;
+    executorLock_ = epicsMutexMustCreate();
+    sortEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    stripeLock_ = epicsMutexMustCreate();
+    scratchArenaId_ = epicsThreadPrivateCreate();
+    scratchLock_ = epicsMutexMustCreate();
+    statusTimerQueue_ = epicsTimerQueueAllocate(1, epicsThreadPriorityScanLow);
+    statusTimer_ = epicsTimerQueueCreateTimer(statusTimerQueue_, statusTimerCallbackC, this);
+    epicsThreadOnce(&pluginListOnce, pluginListInit, 0);
+    epicsMutexLock(pluginListLock);
+    pluginList.push_back(this);
+    epicsMutexUnlock(pluginListLock);
 
     createParam(NDPluginDriverArrayPortString,         asynParamOctet, &NDPluginDriverArrayPort);
     createParam(NDPluginDriverArrayAddrString,         asynParamInt32, &NDPluginDriverArrayAddr);
     createParam(NDPluginDriverPluginTypeString,        asynParamOctet, &NDPluginDriverPluginType);
     createParam(NDPluginDriverDroppedArraysString,     asynParamInt32, &NDPluginDriverDroppedArrays);
+    createParam(NDPluginDriverMaxAgeString,            asynParamFloat64, &NDPluginDriverMaxAge);
+    createParam(NDPluginDriverMaxAgeSourceString,      asynParamInt32, &NDPluginDriverMaxAgeSource);
+    createParam(NDPluginDriverExpiredArraysString,     asynParamInt32, &NDPluginDriverExpiredArrays);
+    createParam(NDPluginDriverPoolQuotaString,         asynParamInt32, &NDPluginDriverPoolQuota);
+    createParam(NDPluginDriverPoolHeldString,          asynParamInt32, &NDPluginDriverPoolHeld);
+    createParam(NDPluginDriverPoolQuotaDropsString,    asynParamInt32, &NDPluginDriverPoolQuotaDrops);
     createParam(NDPluginDriverQueueSizeString,         asynParamInt32, &NDPluginDriverQueueSize);
     createParam(NDPluginDriverQueueFreeString,         asynParamInt32, &NDPluginDriverQueueFree);
     createParam(NDPluginDriverMaxThreadsString,        asynParamInt32, &NDPluginDriverMaxThreads);
     createParam(NDPluginDriverNumThreadsString,        asynParamInt32, &NDPluginDriverNumThreads);
+    createParam(NDPluginDriverLockFreeQueueString,     asynParamInt32, &NDPluginDriverLockFreeQueue);
+    createParam(NDPluginDriverBatchSizeString,         asynParamInt32, &NDPluginDriverBatchSize);
+    createParam(NDPluginDriverUseExecutorString,       asynParamInt32, &NDPluginDriverUseExecutor);
+    createParam(NDPluginDriverAutoScaleString,         asynParamInt32, &NDPluginDriverAutoScale);
+    createParam(NDPluginDriverAutoScaleMinString,      asynParamInt32, &NDPluginDriverAutoScaleMin);
+    createParam(NDPluginDriverAutoScaleMaxString,      asynParamInt32, &NDPluginDriverAutoScaleMax);
+    createParam(NDPluginDriverAutoScaleHighString,     asynParamInt32, &NDPluginDriverAutoScaleHigh);
+    createParam(NDPluginDriverAutoScaleLowString,      asynParamInt32, &NDPluginDriverAutoScaleLow);
+    createParam(NDPluginDriverAutoScalePeriodString,   asynParamFloat64, &NDPluginDriverAutoScalePeriod);
+    createParam(NDPluginDriverActiveThreadsString,     asynParamInt32, &NDPluginDriverActiveThreads);
+    createParam(NDPluginDriverIntraFrameThreadsString, asynParamInt32, &NDPluginDriverIntraFrameThreads);
+    createParam(NDPluginDriverCpuAffinityString,       asynParamOctet, &NDPluginDriverCpuAffinity);
+    createParam(NDPluginDriverSchedPolicyString,       asynParamInt32, &NDPluginDriverSchedPolicy);
+    createParam(NDPluginDriverSchedPriorityString,     asynParamInt32, &NDPluginDriverSchedPriority);
+    createParam(NDPluginDriverOverflowPolicyString,    asynParamInt32, &NDPluginDriverOverflowPolicy);
+    createParam(NDPluginDriverOverflowTimeoutString,   asynParamFloat64, &NDPluginDriverOverflowTimeout);
+    createParam(NDPluginDriverBlockedTimeString,       asynParamFloat64, &NDPluginDriverBlockedTime);
     createParam(NDPluginDriverSortModeString,          asynParamInt32, &NDPluginDriverSortMode);
     createParam(NDPluginDriverSortTimeString,          asynParamFloat64, &NDPluginDriverSortTime);
     createParam(NDPluginDriverSortSizeString,          asynParamInt32, &NDPluginDriverSortSize);
@@ -138,9 +292,33 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     createParam(NDPluginDriverDroppedOutputArraysString,  asynParamInt32, &NDPluginDriverDroppedOutputArrays);
     createParam(NDPluginDriverEnableCallbacksString,   asynParamInt32, &NDPluginDriverEnableCallbacks);
     createParam(NDPluginDriverBlockingCallbacksString, asynParamInt32, &NDPluginDriverBlockingCallbacks);
+    createParam(NDPluginDriverFusedToString,           asynParamOctet, &NDPluginDriverFusedTo);
     createParam(NDPluginDriverProcessPluginString,     asynParamInt32, &NDPluginDriverProcessPlugin);
     createParam(NDPluginDriverExecutionTimeString,     asynParamFloat64, &NDPluginDriverExecutionTime);
     createParam(NDPluginDriverMinCallbackTimeString,   asynParamFloat64, &NDPluginDriverMinCallbackTime);
+    createParam(NDPluginDriverDecimateString,          asynParamInt32, &NDPluginDriverDecimate);
+    createParam(NDPluginDriverDecimateAttributeString, asynParamOctet, &NDPluginDriverDecimateAttribute);
+    createParam(NDPluginDriverVetoExpressionString,    asynParamOctet, &NDPluginDriverVetoExpression);
+    createParam(NDPluginDriverVetoErrorString,         asynParamOctet, &NDPluginDriverVetoError);
+    createParam(NDPluginDriverVetoedArraysString,      asynParamInt32, &NDPluginDriverVetoedArrays);
+    createParam(NDPluginDriverScratchMemoryString,     asynParamFloat64, &NDPluginDriverScratchMemory);
+    createParam(NDPluginDriverStatusUpdatePeriodString, asynParamFloat64, &NDPluginDriverStatusUpdatePeriod);
+    createParam(NDPluginDriverQueueTimeP50String,      asynParamFloat64, &NDPluginDriverQueueTimeP50);
+    createParam(NDPluginDriverQueueTimeP99String,      asynParamFloat64, &NDPluginDriverQueueTimeP99);
+    createParam(NDPluginDriverQueueTimeMaxString,      asynParamFloat64, &NDPluginDriverQueueTimeMax);
+    createParam(NDPluginDriverProcessTimeP50String,    asynParamFloat64, &NDPluginDriverProcessTimeP50);
+    createParam(NDPluginDriverProcessTimeP99String,    asynParamFloat64, &NDPluginDriverProcessTimeP99);
+    createParam(NDPluginDriverProcessTimeMaxString,    asynParamFloat64, &NDPluginDriverProcessTimeMax);
+    createParam(NDPluginDriverLatencyP50String,        asynParamFloat64, &NDPluginDriverLatencyP50);
+    createParam(NDPluginDriverLatencyP99String,        asynParamFloat64, &NDPluginDriverLatencyP99);
+    createParam(NDPluginDriverLatencyMaxString,        asynParamFloat64, &NDPluginDriverLatencyMax);
+    createParam(NDPluginDriverLatencyWindowString,     asynParamInt32, &NDPluginDriverLatencyWindow);
+    createParam(NDPluginDriverLatencyResetString,      asynParamInt32, &NDPluginDriverLatencyReset);
+    createParam(NDPluginDriverPerfCountersString,      asynParamInt32, &NDPluginDriverPerfCounters);
+    createParam(NDPluginDriverPerfCyclesString,        asynParamFloat64, &NDPluginDriverPerfCycles);
+    createParam(NDPluginDriverPerfIPCString,           asynParamFloat64, &NDPluginDriverPerfIPC);
+    createParam(NDPluginDriverPerfCacheMissesString,   asynParamFloat64, &NDPluginDriverPerfCacheMisses);
+    createParam(NDPluginDriverPerfBranchMissesString,  asynParamFloat64, &NDPluginDriverPerfBranchMisses);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -151,12 +329,60 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     setStringParam (NDPluginDriverArrayPort, NDArrayPort);
     setIntegerParam(NDPluginDriverArrayAddr, NDArrayAddr);
     setIntegerParam(NDPluginDriverDroppedArrays, 0);
+    setDoubleParam (NDPluginDriverMaxAge, 0.);
+    setIntegerParam(NDPluginDriverMaxAgeSource, 0);
+    setIntegerParam(NDPluginDriverExpiredArrays, 0);
+    setIntegerParam(NDPluginDriverPoolQuota, 0);
+    setIntegerParam(NDPluginDriverPoolHeld, 0);
+    setIntegerParam(NDPluginDriverPoolQuotaDrops, 0);
     setIntegerParam(NDPluginDriverDroppedOutputArrays, 0);
     setIntegerParam(NDPluginDriverQueueSize, queueSize);
     setIntegerParam(NDPluginDriverQueueFree, queueSize);
     setIntegerParam(NDPluginDriverMaxThreads, maxThreads);
     setIntegerParam(NDPluginDriverNumThreads, 1);
+    setIntegerParam(NDPluginDriverLockFreeQueue, 0);
+    setIntegerParam(NDPluginDriverBatchSize, 1);
+    setIntegerParam(NDPluginDriverUseExecutor, 0);
+    setIntegerParam(NDPluginDriverAutoScale, 0);
+    setIntegerParam(NDPluginDriverAutoScaleMin, 1);
+    setIntegerParam(NDPluginDriverAutoScaleMax, maxThreads);
+    setIntegerParam(NDPluginDriverAutoScaleHigh, 50);
+    setIntegerParam(NDPluginDriverAutoScaleLow, 10);
+    setDoubleParam (NDPluginDriverAutoScalePeriod, 1.0);
+    setIntegerParam(NDPluginDriverActiveThreads, 0);
+    setIntegerParam(NDPluginDriverIntraFrameThreads, 0);
+    setStringParam (NDPluginDriverCpuAffinity, "");
+    setIntegerParam(NDPluginDriverSchedPolicy, NDSchedDefault);
+    setIntegerParam(NDPluginDriverSchedPriority, 0);
+    setIntegerParam(NDPluginDriverOverflowPolicy, NDPluginOverflowDropNewest);
+    setDoubleParam (NDPluginDriverOverflowTimeout, 1.0);
+    setDoubleParam (NDPluginDriverBlockedTime, 0.);
+    setDoubleParam (NDPluginDriverStatusUpdatePeriod, 0.);
+    setIntegerParam(NDPluginDriverDecimate, 0);
+    setStringParam (NDPluginDriverDecimateAttribute, "");
+    setStringParam (NDPluginDriverVetoExpression, "");
+    setStringParam (NDPluginDriverVetoError, "");
+    setIntegerParam(NDPluginDriverVetoedArrays, 0);
+    setDoubleParam (NDPluginDriverScratchMemory, 0.);
+    setIntegerParam(NDPluginDriverLatencyWindow, 1000);
+    queueTimeHist_.setWindow(1000);
+    processTimeHist_.setWindow(1000);
+    latencyHist_.setWindow(1000);
+    setLatencyParams();
+    setIntegerParam(NDPluginDriverPerfCounters, 0);
+    setDoubleParam (NDPluginDriverPerfCycles, 0.);
+    setDoubleParam (NDPluginDriverPerfIPC, 0.);
+    setDoubleParam (NDPluginDriverPerfCacheMisses, 0.);
+    setDoubleParam (NDPluginDriverPerfBranchMisses, 0.);
     setIntegerParam(NDPluginDriverBlockingCallbacks, blockingCallbacks);
+    setStringParam (NDPluginDriverFusedTo, "");
+
+    /* The parameters that beginProcessCallbacks() sets are always in the snapshot */
+    snapshotParams_.setInteger(NDNDimensions, 0);
+    snapshotParams_.setInteger(NDDataType, 0);
+    snapshotParams_.setInteger(NDColorMode, 0);
+    snapshotParams_.setInteger(NDBayerPattern, 0);
+    snapshotParams_.setInteger(NDUniqueId, 0);
     
     /* Create the callback threads, unless blocking callbacks are disabled with
      * the blockingCallbacks argument here. Even then, if they are enabled
@@ -175,9 +401,21 @@ NDPluginDriver::~NDPluginDriver()
   // We lock the mutex because deleteCallbackThreads expects it to be held, but then
   // unlocked it because the mutex is deleted in the asynPortDriver destructor and the
   // mutex must be unlocked before deleting it.
+  epicsMutexLock(pluginListLock);
+  pluginList.erase(std::find(pluginList.begin(), pluginList.end(), this));
+  epicsMutexUnlock(pluginListLock);
   this->lock();
   deleteCallbackThreads();
   this->unlock();
+  // This waits for a timer callback that is running, so it must be done without the lock
+  epicsTimerQueueDestroyTimer(statusTimerQueue_, statusTimer_);
+  epicsTimerQueueRelease(statusTimerQueue_);
+  epicsMutexDestroy(executorLock_);
+  delete pStripeWorkers_;
+  epicsMutexDestroy(stripeLock_);
+  for (size_t i=0; i<scratchArenas_.size(); i++) delete scratchArenas_[i];
+  epicsMutexDestroy(scratchLock_);
+  epicsThreadPrivateDelete(scratchArenaId_);
 }
 
 /** Method that is normally called at the beginning of the processCallbacks
@@ -190,8 +428,6 @@ NDPluginDriver::~NDPluginDriver()
     void NDPluginDriver::beginProcessCallbacks(NDArray *pArray)
 {
     int arrayCounter;
-    int i, dimsChanged;
-    int size;
     NDAttribute *pAttribute;
     int colorMode=NDColorModeMono, bayerPattern=NDBayerRGGB;
     //static const char *functionName="beginProcessCallbacks";
@@ -204,7 +440,6 @@ NDPluginDriver::~NDPluginDriver()
     getIntegerParam(NDArrayCounter, &arrayCounter);
     arrayCounter++;
     setIntegerParam(NDArrayCounter, arrayCounter);
-    setIntegerParam(NDNDimensions, pArray->ndims);
     setIntegerParam(NDDataType, pArray->dataType);
     setIntegerParam(NDColorMode, colorMode);
     setIntegerParam(NDBayerPattern, bayerPattern);
@@ -213,7 +448,23 @@ NDPluginDriver::~NDPluginDriver()
     setDoubleParam(NDTimeStamp, pArray->timeStamp);
     setIntegerParam(NDEpicsTSSec, pArray->epicsTS.secPastEpoch);
     setIntegerParam(NDEpicsTSNsec, pArray->epicsTS.nsec);
-    /* See if the array dimensions have changed.  If so then do callbacks on them. */
+    if (!reportsOwnDimensions_) setArrayDimensions(pArray);
+    // Save a pointer to the input array for use by ProcessPlugin
+    if (pPrevInputArray_) pPrevInputArray_->release();
+    pArray->reserve();
+    pPrevInputArray_ = pArray;
+}
+
+/** Sets the dimensions parameter to those of an array, doing asynInt32Array callbacks if they have changed.
+  * beginProcessCallbacks() calls this for the input array unless the derived class sets reportsOwnDimensions_,
+  * because the arrays that it publishes have other dimensions.  Must be called with the lock held.
+  * \param[in] pArray The array whose dimensions are reported. */
+void NDPluginDriver::setArrayDimensions(NDArray *pArray)
+{
+    int i, dimsChanged;
+    int size;
+
+    setIntegerParam(NDNDimensions, pArray->ndims);
     for (i=0, dimsChanged=0; i<ND_ARRAY_MAX_DIMS; i++) {
         size = (int)pArray->dims[i].size;
         if (i >= pArray->ndims) size = 0;
@@ -225,10 +476,6 @@ NDPluginDriver::~NDPluginDriver()
     if (dimsChanged) {
         doCallbacksInt32Array(this->dimsPrev_, ND_ARRAY_MAX_DIMS, NDDimensions, 0);
     }
-    // Save a pointer to the input array for use by ProcessPlugin
-    if (pPrevInputArray_) pPrevInputArray_->release();
-    pArray->reserve();
-    pPrevInputArray_ = pArray;
 }
 
 /** Method that is normally called at the end of the processCallbacks())
@@ -239,7 +486,9 @@ NDPluginDriver::~NDPluginDriver()
   * \param[in] readAttributes This flag must be true if the derived class has not yet called readAttributes() for pArray.
   *
   * This method does NDArray callbacks to downstream plugins if NDArrayCallbacks is true and SortMode is Unsorted.
-  * If SortMode is sorted it inserts the NDArray into the std::multilist for callbacks in SortThread(). 
+  * If SortMode is sorted it does them once the arrays before this one have been output, see sortArray(). 
+  * If copyArray is true the array is not copied when there are no downstream plugins, and is output as a view
+  * that shares the data when the derived class sets passArraysByReference_.
   * It keeps track of DisorderedArrays and DroppedOutputArrays. 
   * It caches the most recent NDArray in pArrays[0]. */ 
 asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray, bool readAttributes)
@@ -250,7 +499,7 @@ asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray,
     static const char *functionName = "endProcessCallbacks";
 
     getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-    if (arrayCallbacks == 0) {
+    if ((arrayCallbacks == 0) || (copyArray && !hasArrayClients())) {
         // We don't do array callbacks but still want to cache the last array in pArrays[0]
         // If this array has not been copied then we need to increase the reference count
         if (copyArray) pArray->reserve();
@@ -260,7 +509,10 @@ asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray,
     }
 
     getIntegerParam(NDPluginDriverSortMode, &callbacksSorted);
-    if (copyArray) {
+    if (copyArray && passArraysByReference_ && pArray->pNDArrayPool) {
+        pArrayOut = referenceArray(pArray, readAttributes);
+        readAttributes = false;
+    } else if (copyArray) {
         pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
     }
     if (NULL != pArrayOut) {
@@ -277,44 +529,364 @@ asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray,
         return asynError;
     }
     if (callbacksSorted) {
-        int sortSize;
-        int listSize = (int)sortedNDArrayList_.size();
-        getIntegerParam(NDPluginDriverSortSize, &sortSize);
-        setIntegerParam(NDPluginDriverSortFree, sortSize-listSize);
-        if (listSize >= sortSize) {
+        sortArray(pArrayOut);
+    } else {
+        doOutputCallbacks(pArrayOut);
+    }
+    return asynSuccess;
+}
+
+/** Returns a reference to an array that a plugin passes on without modifying it, instead of a copy.
+  * If the plugin adds no attributes this is the array itself, reserved again.  Otherwise it is a view of the
+  * whole array, which shares the data and has its own attribute list, so getAttributes() does not change pArray.
+  * Sparse arrays have no views, so they are copied, which only copies their events.
+  * The caller must release the returned array.
+  * \param[in] pArray The array.
+  * \param[in] readAttributes Add the attributes of the plugin to the returned array. */
+NDArray* NDPluginDriver::referenceArray(NDArray *pArray, bool readAttributes)
+{
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pArrayOut;
+    int i;
+
+    if (!readAttributes || (this->pAttributeList->count() == 0)) {
+        pArray->reserve();
+        return pArray;
+    }
+    for (i=0; i<pArray->ndims; i++) {
+        pArray->initDimension(&dims[i], pArray->dims[i].size);
+    }
+    if (pArray->sparse) pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
+    else pArrayOut = this->pNDArrayPool->createView(pArray, dims);
+    if (pArrayOut) this->getAttributes(pArrayOut->pAttributeList);
+    return pArrayOut;
+}
+
+/** Returns true if any downstream plugin is registered for the NDArray callbacks of this plugin. */
+bool NDPluginDriver::hasArrayClients()
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    bool found = false;
+
+    pasynManager->interruptStart(this->asynStdInterfaces.genericPointerInterruptPvt, &pclientList);
+    for (pnode = (interruptNode *)ellFirst(pclientList); pnode && !found;
+         pnode = (interruptNode *)ellNext(&pnode->node)) {
+        asynGenericPointerInterrupt *pInterrupt = (asynGenericPointerInterrupt *)pnode->drvPvt;
+        if (pInterrupt->pasynUser->reason == NDArrayData) found = true;
+    }
+    pasynManager->interruptEnd(this->asynStdInterfaces.genericPointerInterruptPvt);
+    return found;
+}
+
+/** Returns the number of arrays in the input queue.  This can be called without the lock. */
+int NDPluginDriver::queuePending()
+{
+    if (!pToThreadLockFreeQ_ && !pToThreadMsgQ_) return 0;
+    return toThreadPending();
+}
+
+/** Returns an estimate of the time a new array would wait until it has been processed: the arrays in the input
+  * queue and the new one, times the moving average of the processing time, over the number of active threads.
+  * This takes the lock, so it must not be called with the lock of this plugin held. */
+double NDPluginDriver::expectedWait()
+{
+    double wait;
+    int threads;
+
+    this->lock();
+    threads = (activeThreads_ > 0) ? activeThreads_ : 1;
+    wait = (queuePending() + 1) * recentProcessTime_ / threads;
+    this->unlock();
+    return wait;
+}
+
+/** Returns the status of this plugin for NDPipelineReport().
+  * This takes the lock, so it must not be called with the lock of this plugin held.
+  * \param[out] pNode The status. */
+void NDPluginDriver::getPipelineNode(NDPipelineNode_t *pNode)
+{
+    char value[MAX_FILENAME_LEN];
+    int enableCallbacks, blockingCallbacks;
+
+    this->lock();
+    pNode->portName = portName;
+    getStringParam(NDPluginDriverPluginType, sizeof(value), value);
+    pNode->pluginType = value;
+    getStringParam(NDPluginDriverArrayPort, sizeof(value), value);
+    pNode->arrayPort = value;
+    getIntegerParam(NDPluginDriverArrayAddr, &pNode->arrayAddr);
+    getStringParam(NDPluginDriverFusedTo, sizeof(value), value);
+    pNode->fusedTo = value;
+    pNode->isPlugin = true;
+    getIntegerParam(NDPluginDriverEnableCallbacks, &enableCallbacks);
+    pNode->enableCallbacks = (enableCallbacks != 0);
+    getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
+    pNode->blockingCallbacks = (blockingCallbacks != 0);
+    getIntegerParam(NDArrayCounter, &pNode->arrayCounter);
+    getIntegerParam(NDPluginDriverDroppedArrays, &pNode->droppedArrays);
+    getIntegerParam(NDPluginDriverExpiredArrays, &pNode->expiredArrays);
+    getIntegerParam(NDPluginDriverPoolHeld, &pNode->poolHeld);
+    getIntegerParam(NDPluginDriverQueueSize, &pNode->queueSize);
+    pNode->queueFree = pNode->queueSize - queuePending();
+    if (pNode->blockingCallbacks) pNode->numThreads = 0;
+    else pNode->numThreads = useExecutor_ ? numThreads_ : activeThreads_;
+    pNode->processTime = processTimeHist_.percentile(0.50);
+    pNode->poolBuffers = pNDArrayPool->numBuffers();
+    pNode->poolFreeBuffers = pNDArrayPool->numFree();
+    pNode->poolMemory = (double)pNDArrayPool->memorySize();
+    pNode->poolMaxMemory = (double)pNDArrayPool->maxMemory();
+    this->unlock();
+}
+
+/** Returns all of the plugins of the IOC, in the order they were created.
+  * \param[out] plugins The plugins. */
+void NDPluginDriver::getPlugins(std::vector<NDPluginDriver*> &plugins)
+{
+    epicsThreadOnce(&pluginListOnce, pluginListInit, 0);
+    epicsMutexLock(pluginListLock);
+    plugins = pluginList;
+    epicsMutexUnlock(pluginListLock);
+}
+
+/** Default processCallbacks() for plugins that do their work in processCallbacksUnlocked().
+  * It calls beginProcessCallbacks(), copies the parameters added with addSnapshotParam() with the lock held,
+  * and calls processCallbacksUnlocked() with the lock released, so that the threads of a plugin with
+  * NumThreads > 1 do not contend for the lock while they process arrays.  It then sets the parameters
+  * in the results and calls endProcessCallbacks() with the array that processCallbacksUnlocked() returned.
+  * Plugins that override this method instead are not affected.
+  * \param[in] pArray  The NDArray from the callback. */
+void NDPluginDriver::processCallbacks(NDArray *pArray)
+{
+    NDPluginParamSnapshot params, results;
+    NDArray *pArrayOut;
+
+    beginProcessCallbacks(pArray);
+    takeParamSnapshot(params);
+    this->unlock();
+    pArrayOut = processCallbacksUnlocked(pArray, params, results);
+    this->lock();
+    applyParamSnapshot(results);
+    if (pArrayOut) endProcessCallbacks(pArrayOut, pArrayOut == pArray, true);
+    callStatusCallbacks();
+}
+
+/** Processes an array without the lock; called by the default processCallbacks().
+  * Implementations must not access the parameter library or any other class data that is not
+  * protected by its own lock.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] params The values of the parameters added with addSnapshotParam(), and of the parameters
+  *            set by beginProcessCallbacks(), taken when processing of this array began.
+  * \param[out] results Parameter values to set with the lock held when this method returns.
+  * \return The output array to pass to endProcessCallbacks(): pArray itself to pass on the input array,
+  *         a new array that the caller then owns, or NULL for no output array. */
+NDArray* NDPluginDriver::processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                                  NDPluginParamSnapshot &results)
+{
+    static const char *functionName = "processCallbacksUnlocked";
+
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s plugin overrides neither processCallbacks nor processCallbacksUnlocked\n",
+        driverName, functionName);
+    return NULL;
+}
+
+/** Adds a parameter to the snapshot that the default processCallbacks() passes to processCallbacksUnlocked().
+  * This is normally called in the constructor of the derived class after createParam().
+  * The parameters that beginProcessCallbacks() sets from the array need not be added.
+  * \param[in] index The parameter index, which must be an asynInt32 or asynFloat64 parameter. */
+asynStatus NDPluginDriver::addSnapshotParam(int index)
+{
+    epicsInt32 ival;
+    double dval;
+    static const char *functionName = "addSnapshotParam";
+
+    if (getIntegerParam(index, &ival) != asynParamWrongType) {
+        snapshotParams_.setInteger(index, 0);
+    } else if (getDoubleParam(index, &dval) != asynParamWrongType) {
+        snapshotParams_.setDouble(index, 0.);
+    } else {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s parameter %d is not asynInt32 or asynFloat64\n",
+            driverName, functionName, index);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/** Copies the current values of the snapshot parameters.  This must be called with the lock held.
+  * \param[out] params The snapshot. */
+void NDPluginDriver::takeParamSnapshot(NDPluginParamSnapshot &params)
+{
+    int i;
+
+    params = snapshotParams_;
+    for (i=0; i<(int)params.types_.size(); i++) {
+        switch (params.types_[i]) {
+            case NDPluginParamSnapshot::paramInteger:
+                getIntegerParam(i, &params.integers_[i]);
+                break;
+            case NDPluginParamSnapshot::paramDouble:
+                getDoubleParam(i, &params.doubles_[i]);
+                break;
+        }
+    }
+}
+
+/** Sets the parameters in a snapshot.  This must be called with the lock held.
+  * \param[in] results The parameter values to set. */
+void NDPluginDriver::applyParamSnapshot(const NDPluginParamSnapshot &results)
+{
+    int i;
+
+    for (i=0; i<(int)results.types_.size(); i++) {
+        switch (results.types_[i]) {
+            case NDPluginParamSnapshot::paramInteger:
+                setIntegerParam(i, results.integers_[i]);
+                break;
+            case NDPluginParamSnapshot::paramDouble:
+                setDoubleParam(i, results.doubles_[i]);
+                break;
+        }
+    }
+}
+/** Does the NDArray callbacks for an output array and keeps track of DisorderedArrays.
+  * This must be called with the lock held.
+  * \param[in] pArray The output array. */
+void NDPluginDriver::doOutputCallbacks(NDArray *pArray)
+{
+    static const char *functionName = "doOutputCallbacks";
+
+    NDTraceRecord(portName, NDTraceOutput, pArray->uniqueId);
+    doArrayCallbacks(pArray);
+    bool orderOK = (pArray->uniqueId == prevUniqueId_)   ||
+                   (pArray->uniqueId == prevUniqueId_+1);
+    if (!firstOutputArray_ && !orderOK) {
+        int disorderedArrays;
+        getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
+        disorderedArrays++;
+        setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
+            "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
+            driverName, functionName, pArray->uniqueId, prevUniqueId_, orderOK, disorderedArrays);
+    }
+    firstOutputArray_ = false;
+    prevUniqueId_ = pArray->uniqueId;
+}
+
+/** Passes an output array to the NDArray clients of address 0, like doCallbacksGenericPointer(), but queues it to
+  * the downstream plugins that can take it with tryQueueArray() first, without their locks.  The other clients,
+  * which are the plugins with BlockingCallbacks=1, those whose queue is full and clients that are not plugins,
+  * are called after that, so a slow client does not delay the arrays of the plugins with their own threads.
+  * The clients are called between interruptStart() and interruptEnd() as in doCallbacksGenericPointer(), so the
+  * list of clients does not change while they are called.
+  * This must be called with the lock held.
+  * \param[in] pArray The output array. */
+void NDPluginDriver::doArrayCallbacks(NDArray *pArray)
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    int addr;
+    size_t i;
+
+    deferredClients_.clear();
+    pasynManager->interruptStart(this->asynStdInterfaces.genericPointerInterruptPvt, &pclientList);
+    for (pnode = (interruptNode *)ellFirst(pclientList); pnode;
+         pnode = (interruptNode *)ellNext(&pnode->node)) {
+        asynGenericPointerInterrupt *pInterrupt = (asynGenericPointerInterrupt *)pnode->drvPvt;
+        pasynManager->getAddr(pInterrupt->pasynUser, &addr);
+        /* If this is not a multi-device then address is -1, change to 0 */
+        if (addr == -1) addr = 0;
+        if ((pInterrupt->pasynUser->reason != NDArrayData) || (addr != 0)) continue;
+        NDPluginDriver *pPlugin = fromArrayInterrupt(pInterrupt);
+        if (pPlugin && pPlugin->tryQueueArray(pInterrupt->pasynUser, pArray)) continue;
+        deferredClients_.push_back(pInterrupt);
+    }
+    for (i=0; i<deferredClients_.size(); i++) {
+        asynGenericPointerInterrupt *pInterrupt = deferredClients_[i];
+        pInterrupt->callback(pInterrupt->userPvt, pInterrupt->pasynUser, pArray);
+    }
+    pasynManager->interruptEnd(this->asynStdInterfaces.genericPointerInterruptPvt);
+    deferredClients_.clear();
+}
+
+/** Outputs an array in uniqueId order when SortMode=Sorted.
+  * An array that follows the previous output array, or that is older than it, is output at once, followed by
+  * any arrays in the reorder ring that follow it.  Other arrays wait in the ring until the arrays before
+  * them arrive, or for at most SortTime, after which sortingTask() outputs them in order with the gaps counted
+  * in DisorderedArrays.  An array is dropped and counted in DroppedOutputArrays if its slot in the ring is
+  * taken, which happens when more than SortSize arrays are waiting.
+  * This must be called with the lock held.
+  * \param[in] pArray The output array. */
+void NDPluginDriver::sortArray(NDArray *pArray)
+{
+    int sortSize;
+    int uniqueId = pArray->uniqueId;
+    sortedListElement *pSlot;
+    static const char *functionName = "sortArray";
+
+    getIntegerParam(NDPluginDriverSortSize, &sortSize);
+    if (sortSize < 1) sortSize = 1;
+    if ((int)sortRing_.size() != sortSize) {
+        epicsTimeStamp zero = {0, 0};
+        emitSortedArrays(true);
+        sortRing_.assign(sortSize, sortedListElement(NULL, zero));
+    }
+    if (!firstOutputArray_ && (uniqueId <= prevUniqueId_+1)) {
+        doOutputCallbacks(pArray);
+        emitSortedArrays(false);
+    } else {
+        pSlot = &sortRing_[(unsigned int)uniqueId % sortRing_.size()];
+        if (pSlot->pArray_) {
             int droppedOutputArrays;
             getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
             asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                "%s::%s std::multilist size exceeded, dropped array uniqueId=%d\n",
-                driverName, functionName, pArrayOut->uniqueId);
+                "%s::%s reorder ring slot in use by uniqueId=%d, dropped array uniqueId=%d\n",
+                driverName, functionName, pSlot->pArray_->uniqueId, uniqueId);
             droppedOutputArrays++;
             setIntegerParam(NDPluginDriverDroppedOutputArrays, droppedOutputArrays);
         } else {
-            epicsTimeStamp now;
-            epicsTimeGetCurrent(&now);
-            pArrayOut->reserve();
-            sortedListElement *pListElement = new sortedListElement(pArrayOut, now);
-            sortedNDArrayList_.insert(*pListElement);
-        }
-    } else {
-        doCallbacksGenericPointer(pArrayOut, NDArrayData, 0);
-        bool orderOK = (pArrayOut->uniqueId == prevUniqueId_)   ||
-                       (pArrayOut->uniqueId == prevUniqueId_+1);
-        if (!firstOutputArray_ && !orderOK) {
-            int disorderedArrays;
-            getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
-            disorderedArrays++;
-            setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
-                driverName, functionName, pArrayOut->uniqueId, prevUniqueId_, orderOK, disorderedArrays);
+            pArray->reserve();
+            pSlot->pArray_ = pArray;
+            epicsTimeGetCurrent(&pSlot->insertionTime_);
+            numSorted_++;
+            epicsEventSignal(sortEvent_);
         }
-        firstOutputArray_ = false;
-        prevUniqueId_ = pArrayOut->uniqueId;
     }
-    return asynSuccess;
+    setIntegerParam(NDPluginDriverSortFree, (int)sortRing_.size() - numSorted_);
 }
 
+/** Outputs the arrays in the reorder ring that follow the previous output array.
+  * This must be called with the lock held.
+  * \param[in] all If true the arrays after a gap are also output, in uniqueId order, until the ring is empty;
+  *            if false the first gap stops the output. */
+void NDPluginDriver::emitSortedArrays(bool all)
+{
+    sortedListElement *pSlot, *pLowest;
+    NDArray *pArray;
+    size_t i;
+
+    while (numSorted_ > 0) {
+        pSlot = &sortRing_[(unsigned int)(prevUniqueId_+1) % sortRing_.size()];
+        if (firstOutputArray_ || !pSlot->pArray_ || (pSlot->pArray_->uniqueId != prevUniqueId_+1)) {
+            if (!all) break;
+            /* Output the array with the lowest uniqueId */
+            pLowest = NULL;
+            for (i=0; i<sortRing_.size(); i++) {
+                if (sortRing_[i].pArray_ &&
+                    (!pLowest || (sortRing_[i].pArray_->uniqueId < pLowest->pArray_->uniqueId))) {
+                    pLowest = &sortRing_[i];
+                }
+            }
+            pSlot = pLowest;
+        }
+        pArray = pSlot->pArray_;
+        pSlot->pArray_ = NULL;
+        numSorted_--;
+        doOutputCallbacks(pArray);
+        pArray->release();
+    }
+}
 
 extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *genericPointer)
 {
@@ -322,12 +894,23 @@ extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *
     pNDPluginDriver->driverCallback(pasynUser, genericPointer);
 }}
 
+/** Returns the plugin whose driverCallback() an NDArray interrupt client calls, or NULL if the client is not a plugin.
+  * Plugins that dispatch arrays to selected clients, such as NDPluginScatter, use it to look at the load of the clients.
+  * \param[in] pInterrupt The interrupt client. */
+NDPluginDriver* NDPluginDriver::fromArrayInterrupt(asynGenericPointerInterrupt *pInterrupt)
+{
+    if (pInterrupt->callback != ::driverCallback) return NULL;
+    return (NDPluginDriver *)pInterrupt->userPvt;
+}
+
 /** Method that is called from the driver with a new NDArray.
   * It calls the processCallbacks function, which typically is implemented in the
   * derived class.
   * It can either do the callbacks directly (if NDPluginDriverBlockingCallbacks=1) or by queueing
   * the arrays to be processed by a background task (if NDPluginDriverBlockingCallbacks=0).
-  * In the latter case arrays can be dropped if the queue is full.  This method should really
+  * In the latter case OverflowPolicy says what happens when the queue is full, see queueFullSend().  A caller that
+  * sets pasynUser->auxStatus to asynOverflow is not dropped an array for a full queue: auxStatus is then left at
+  * asynOverflow, and it is set to asynSuccess when the array is taken or skipped.  This method should really
   * be private, but it must be called from a C-linkage callback function, so it must be public.
   * \param[in] pasynUser  The pasynUser from the asyn client.
   * \param[in] genericPointer The pointer to the NDArray */ 
@@ -344,6 +927,7 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
     static const char *functionName = "driverCallback";
 
     this->lock();
+    NDTraceRecord(portName, NDTraceDriverCallback, pArray->uniqueId);
 
     status |= getDoubleParam(NDPluginDriverMinCallbackTime, &minCallbackTime);
     status |= getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
@@ -352,7 +936,24 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
     epicsTimeGetCurrent(&tNow);
     deltaTime = epicsTimeDiffInSeconds(&tNow, &this->lastProcessTime_);
 
-    if ((minCallbackTime == 0.) || (deltaTime > minCallbackTime)) {
+    /* A vetoed array is dropped here, before it is reserved for the queue */
+    if ((pasynUser != pasynUserSelf) && vetoes(pArray)) {
+        int vetoedArrays;
+        getIntegerParam(NDPluginDriverVetoedArrays, &vetoedArrays);
+        setIntegerParam(NDPluginDriverVetoedArrays, vetoedArrays+1);
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s::%s vetoed array uniqueId=%d\n",
+            driverName, functionName, pArray->uniqueId);
+        NDTraceRecord(portName, NDTraceDrop, pArray->uniqueId);
+        /* The array was not refused for a full queue */
+        pasynUser->auxStatus = asynSuccess;
+    }
+    /* Decimate selects the same arrays in all the plugins that have the same Decimate, and ProcessPlugin
+     * always processes the cached array.  A skipped array was not refused for a full queue. */
+    else if ((pasynUser != pasynUserSelf) && !decimateSelects(pArray)) {
+        pasynUser->auxStatus = asynSuccess;
+    }
+    else if ((minCallbackTime == 0.) || (deltaTime > minCallbackTime)) {
         if (pasynUser->auxStatus == asynOverflow) ignoreQueueFull = true;
         pasynUser->auxStatus = asynSuccess;
         
@@ -367,19 +968,41 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
         epicsTimeGetCurrent(&tNow);
         memcpy(&this->lastProcessTime_, &tNow, sizeof(tNow));
         if (blockingCallbacks) {
-            processCallbacks(pArray);
+            NDPerfCounts_t perfStart;
+            bool countPerf = beginPerfCounters(&perfStart);
+            NDTraceRecord(portName, NDTraceProcessBegin, pArray->uniqueId);
+            callProcessCallbacks(pArray);
+            NDTraceRecord(portName, NDTraceProcessEnd, pArray->uniqueId);
+            if (countPerf) endPerfCounters(&perfStart, &pArray, 1);
             epicsTimeGetCurrent(&tEnd);
             setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tNow)*1e3);
+            recordLatency(pArray, NULL, &tNow, epicsTimeDiffInSeconds(&tEnd, &tNow), &tEnd);
+            setLatencyParams();
+        } else if (reserveQueued(pArray) != ND_SUCCESS) {
+            /* The queue holds PoolQuota arrays of the pool of the driver; drop this one rather than take
+             * more of the buffers that the driver and the other plugins need */
+            int quotaDrops;
+            getIntegerParam(NDPluginDriverPoolQuotaDrops, &quotaDrops);
+            setIntegerParam(NDPluginDriverPoolQuotaDrops, quotaDrops+1);
+            getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
+            setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays+1);
+            asynPrint(pasynUser, ASYN_TRACE_FLOW,
+                "%s::%s pool quota reached, dropped array uniqueId=%d\n",
+                driverName, functionName, pArray->uniqueId);
+            NDTraceRecord(portName, NDTraceDrop, pArray->uniqueId);
         } else {
-            /* Increase the reference count again on this array
+            /* reserveQueued() increased the reference count again on this array.
              * It will be released in the background task when processing is done */
-            pArray->reserve();
             /* Try to put this array on the message queue.  If there is no room then return
-             * immediately. */
-            ToThreadMessage_t msg = {ToThreadMessageData, pArray};
-            status = pToThreadMsgQ_->trySend(&msg, sizeof(msg));
-            queueFree = queueSize - pToThreadMsgQ_->pending();
+             * immediately, unless OverflowPolicy says to make room or wait for it. */
+            ToThreadMessage_t msg = {ToThreadMessageData, pArray, tNow};
+            status = toThreadTrySend(&msg, sizeof(msg));
+            if (status && !ignoreQueueFull) status = queueFullSend(&msg, sizeof(msg), pasynUser);
+            if (!status) NDTraceRecord(portName, NDTraceEnqueue, pArray->uniqueId);
+            if (!status && useExecutor_) executorSchedule();
+            queueFree = queueSize - toThreadPending();
             setIntegerParam(NDPluginDriverQueueFree, queueFree);
+            if (queueSize - queueFree > maxPending_) maxPending_ = queueSize - queueFree;
             if (status) {
                 pasynUser->auxStatus = asynOverflow;
                 if (!ignoreQueueFull) {
@@ -389,16 +1012,151 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
                         driverName, functionName, pArray->uniqueId);
                     droppedArrays++;
                     status |= setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+                    NDTraceRecord(portName, NDTraceDrop, pArray->uniqueId);
                 }
                 /* This buffer needs to be released */
-                pArray->release();
+                releaseQueued(pArray);
             }
         }
+    } else {
+        /* MinCallbackTime holds the array back, which is not a full queue */
+        pasynUser->auxStatus = asynSuccess;
     }
-    callParamCallbacks();
+    callStatusCallbacks();
     this->unlock();
 }
 
+/** Queues an array from doArrayCallbacks() of an upstream plugin without taking the lock of this plugin.
+  * This is only done when driverCallback() would put the array straight on the input queue, which is when
+  * BlockingCallbacks=0, MinCallbackTime=0, LockFreeQueue=1 and AutoScale=0, see updateDirectQueue().
+  * It returns false without queueing the array if that is not the case, if the queue is full or if PoolQuota
+  * is reached, and the caller then calls driverCallback(), which handles these cases with the lock held.
+  * The QueueFree and PoolHeld parameters are updated when the plugin threads take the array.
+  * An array that Decimate does not select is skipped here, as driverCallback() would skip it.
+  * \param[in] pasynUser The pasynUser of the interrupt client.
+  * \param[in] pArray The array.
+  * \return true if the array was queued or skipped. */
+bool NDPluginDriver::tryQueueArray(asynUser *pasynUser, NDArray *pArray)
+{
+    ToThreadMessage_t msg = {ToThreadMessageData, pArray};
+    int decimate;
+    bool queued = false;
+
+    /* deleteCallbackThreads() clears directQueue_ and then waits for directSenders_ to be 0 before it deletes
+     * the queue */
+    epicsAtomicIncrIntT(&directSenders_);
+    decimate = epicsAtomicGetIntT(&decimate_);
+    if (epicsAtomicGetIntT(&directQueue_) && (decimate > 1) && (pArray->uniqueId % decimate != 0)) {
+        pasynUser->auxStatus = asynSuccess;
+        queued = true;
+    } else if (epicsAtomicGetIntT(&directQueue_) && (pasynUser->auxStatus == asynSuccess) &&
+        ((poolConsumer_.quota <= 0) || (epicsAtomicGetIntT(&poolConsumer_.held) < poolConsumer_.quota)) &&
+        (pArray->reserve(&poolConsumer_) == ND_SUCCESS)) {
+        epicsTimeGetCurrent(&msg.enqueueTime);
+        if (pToThreadLockFreeQ_->trySend(&msg, sizeof(msg)) == 0) {
+            NDTraceRecord(portName, NDTraceDriverCallback, pArray->uniqueId);
+            NDTraceRecord(portName, NDTraceEnqueue, pArray->uniqueId);
+            if (useExecutor_) executorSchedule();
+            queued = true;
+        } else {
+            pArray->release(&poolConsumer_);
+        }
+    }
+    epicsAtomicDecrIntT(&directSenders_);
+    return queued;
+}
+
+/** Decides whether upstream plugins can queue arrays with tryQueueArray(), and copies PoolQuota and Decimate to
+  * poolConsumer_ and decimate_ for it.  The arrays are not queued directly when DecimateAttribute or
+  * VetoExpression is set, because the selection then depends on the attributes.
+  * This is called when the parameters that it depends on have changed, with the lock held. */
+void NDPluginDriver::updateDirectQueue()
+{
+    int blockingCallbacks = 1;
+    int decimate = 0;
+    double minCallbackTime = 0.;
+    char decimateAttribute[256] = "";
+
+    getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
+    getDoubleParam(NDPluginDriverMinCallbackTime, &minCallbackTime);
+    getIntegerParam(NDPluginDriverDecimate, &decimate);
+    getStringParam(NDPluginDriverDecimateAttribute, sizeof(decimateAttribute), decimateAttribute);
+    getIntegerParam(NDPluginDriverPoolQuota, &poolConsumer_.quota);
+    epicsAtomicSetIntT(&decimate_, decimate);
+    epicsAtomicSetIntT(&directQueue_, (pToThreadLockFreeQ_ && !blockingCallbacks && !fused_ &&
+                                       (minCallbackTime == 0.) && !autoScale_ && !decimateAttribute[0] &&
+                                       !vetoEnabled_) ? 1 : 0);
+}
+
+/** Returns true if Decimate selects an array for processing, which is when its index is a multiple of Decimate.
+  * The index is the uniqueId, or the value of the DecimateAttribute NDAttribute when that is set; an array without
+  * that attribute is not selected.  Because the index comes from the array, all the plugins with the same Decimate
+  * process the same arrays, unlike MinCallbackTime, so they use the same buffers while they are still in the cache.
+  * This must be called with the lock held.
+  * \param[in] pArray The array. */
+bool NDPluginDriver::decimateSelects(NDArray *pArray)
+{
+    int decimate = 0;
+    char decimateAttribute[256] = "";
+    NDAttribute *pAttribute;
+    epicsFloat64 value;
+    int index = pArray->uniqueId;
+
+    getIntegerParam(NDPluginDriverDecimate, &decimate);
+    getStringParam(NDPluginDriverDecimateAttribute, sizeof(decimateAttribute), decimateAttribute);
+    if (decimateAttribute[0]) {
+        pAttribute = pArray->pAttributeList->find(decimateAttribute);
+        if (!pAttribute || (pAttribute->getValue(NDAttrFloat64, &value) != ND_SUCCESS)) return false;
+        index = (int)value;
+    }
+    if (decimate <= 1) return true;
+    return (index % decimate) == 0;
+}
+
+/** Returns true if VetoExpression vetoes an array, which is when its value for the NDAttributes of the array is not
+  * 0.  An array without one of the attributes of the expression is vetoed.  In the expression i is the uniqueId of
+  * the array, x and b are 0 and f is 1.
+  * This must be called with the lock held.
+  * \param[in] pArray The array. */
+bool NDPluginDriver::vetoes(NDArray *pArray)
+{
+    double values[ND_EXPRESSION_MAX_NAMES];
+    double zero = 0., result = 0.;
+    NDAttribute *pAttribute;
+    int i;
+
+    if (!vetoEnabled_) return false;
+    for (i=0; i<vetoExpression_.nNames; i++) {
+        pAttribute = pArray->pAttributeList->find(vetoExpression_.names[i]);
+        if (!pAttribute || (pAttribute->getValue(NDAttrFloat64, &values[i]) != ND_SUCCESS)) return true;
+    }
+    if (NDProcessExpressionEvaluate(&vetoExpression_, &zero, NULL, NULL, (size_t)pArray->uniqueId, values,
+                                    &result, 1) != ND_SUCCESS) return false;
+    return result != 0.;
+}
+
+/** Reserves an array for the input queue on behalf of poolConsumer_, so its NDArrayPool counts the arrays of the
+  * pool that the queue holds against PoolQuota.  This must be called with the lock held.
+  * \param[in] pArray The array.
+  * \return ND_SUCCESS, or ND_ERROR if the queue already holds PoolQuota arrays of the pool of pArray. */
+int NDPluginDriver::reserveQueued(NDArray *pArray)
+{
+    int status;
+
+    getIntegerParam(NDPluginDriverPoolQuota, &poolConsumer_.quota);
+    status = pArray->reserve(&poolConsumer_);
+    setIntegerParam(NDPluginDriverPoolHeld, epicsAtomicGetIntT(&poolConsumer_.held));
+    return status;
+}
+
+/** Releases an array that reserveQueued() reserved.  This must be called with the lock held.
+  * \param[in] pArray The array. */
+void NDPluginDriver::releaseQueued(NDArray *pArray)
+{
+    pArray->release(&poolConsumer_);
+    setIntegerParam(NDPluginDriverPoolHeld, epicsAtomicGetIntT(&poolConsumer_.held));
+}
+
 /** Method runs as a separate thread, waiting for NDArrays to arrive in a message queue
   * and processing them.
   * This thread is used when NDPluginDriverBlockingCallbacks=0.
@@ -407,13 +1165,16 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 void NDPluginDriver::processTask()
 {
     /* This thread processes a new array when it arrives */
-    int queueSize, queueFree;
-    epicsTimeStamp tStart, tEnd;
     int numBytes;
     int status;
-    NDArray *pArray=0;
+    int batchSize, numArrays;
+    bool exitAfterBatch;
+    std::vector<NDArray*> batch;
+    std::vector<epicsTimeStamp> enqueueTimes;
     ToThreadMessage_t toMsg;
     FromThreadMessage_t fromMsg = {FromThreadMessageEnter, epicsThreadGetIdSelf()};
+    int threadConfigId = 0;
+    int threadIndex = 0;
     static const char *functionName = "processTask";
 
     // Send event indicating that the thread has started. Must do this before taking lock.
@@ -424,12 +1185,29 @@ void NDPluginDriver::processTask()
             driverName, functionName, epicsThreadGetNameSelf());
     }
     this->lock();
+    for (threadIndex=0; threadIndex<(int)pThreads_.size(); threadIndex++) {
+        if (pThreads_[threadIndex]->getId() == fromMsg.threadId) break;
+    }
+    if (threadIndex == (int)pThreads_.size()) threadIndex = 0;
     /* Loop forever */
     while (1) {
 
+        /* With AutoScale=1 the threads from activeThreads_ on wait until they are needed */
+        while (threadIndex >= activeThreads_) {
+            this->unlock();
+            epicsEventWait(parkEvents_[threadIndex]);
+            this->lock();
+        }
+        getIntegerParam(NDPluginDriverBatchSize, &batchSize);
+        if (batchSize < 1) batchSize = 1;
+        batch.resize(batchSize);
+        enqueueTimes.resize(batchSize);
+        numArrays = 0;
+        exitAfterBatch = false;
+
         /* Wait for an array to arrive from the queue. Release the lock while  waiting. */
         this->unlock();   
-        numBytes = pToThreadMsgQ_->receive(&toMsg, sizeof(toMsg));
+        numBytes = toThreadReceive(&toMsg, sizeof(toMsg));
         if (numBytes != sizeof(toMsg)) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s::%s error reading message queue, expected size=%d, actual=%d\n",
@@ -440,36 +1218,553 @@ void NDPluginDriver::processTask()
                 asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                     "%s::%s received exit message, thread=%s\n", 
                     driverName, functionName, epicsThreadGetNameSelf());
+                NDPerfCountersClose();
+                freeScratchArena();
                 fromMsg.messageType = FromThreadMessageExit;
                 pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
                 return; // shutdown thread if special message
                 break;
             case ToThreadMessageData:
-                pArray = toMsg.pArray;
+                enqueueTimes[numArrays] = toMsg.enqueueTime;
+                batch[numArrays++] = toMsg.pArray;
                 break;
             default:
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s::%s unknown message type = %d\n",
                     driverName, functionName, toMsg.messageType);
         }
+        /* If BatchSize > 1 also take the arrays that are already queued, without waiting.
+         * An exit message ends the batch, and the thread exits after processing it. */
+        while ((numArrays > 0) && (numArrays < batchSize) &&
+               (toThreadTryReceive(&toMsg, sizeof(toMsg)) == sizeof(toMsg))) {
+            if (toMsg.messageType == ToThreadMessageExit) {
+                exitAfterBatch = true;
+                break;
+            }
+            enqueueTimes[numArrays] = toMsg.enqueueTime;
+            batch[numArrays++] = toMsg.pArray;
+        }
         
         // Note: the lock must not be taken until after the thread exit logic above    
         this->lock();
-        epicsTimeGetCurrent(&tStart);
-        getIntegerParam(NDPluginDriverQueueSize, &queueSize);
-        queueFree = queueSize - pToThreadMsgQ_->pending();
-        setIntegerParam(NDPluginDriverQueueFree, queueFree);
-
-        /* Call the function that does the business of this callback.
-         * This function should release the lock during time-consuming operations,
-         * but of course it must not access any class data when the lock is released. */
-        processCallbacks(pArray); 
-        
-        /* We are done with this array buffer */
-        pArray->release();
-        epicsTimeGetCurrent(&tEnd);
-        setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tStart)*1e3);
-        callParamCallbacks();
+        applyThreadConfig(&threadConfigId);
+        processQueuedArrays(&batch[0], &enqueueTimes[0], numArrays);
+        if (exitAfterBatch) {
+            this->unlock();
+            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+                "%s::%s received exit message, thread=%s\n", 
+                driverName, functionName, epicsThreadGetNameSelf());
+            NDPerfCountersClose();
+            freeScratchArena();
+            fromMsg.messageType = FromThreadMessageExit;
+            pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
+            return;
+        }
+    }
+}
+
+/** Processes arrays taken from the input queue by processTask() or executorTask() and releases them.
+  * This must be called with the lock held.
+  * \param[in] ppArrays The arrays, in the order they were queued.
+  * \param[in] pEnqueueTimes The times that the arrays were queued.
+  * \param[in] numArrays The number of arrays. */
+void NDPluginDriver::processQueuedArrays(NDArray **ppArrays, epicsTimeStamp *pEnqueueTimes, int numArrays)
+{
+    int queueSize, queueFree;
+    epicsTimeStamp tStart, tEnd;
+    NDPerfCounts_t perfStart;
+    bool countPerf;
+    int i;
+
+    if (numArrays < 1) return;
+    epicsTimeGetCurrent(&tStart);
+    getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    queueFree = queueSize - toThreadPending();
+    setIntegerParam(NDPluginDriverQueueFree, queueFree);
+
+    for (i=0; i<numArrays; i++) {
+        NDTraceRecord(portName, NDTraceDequeue, ppArrays[i]->uniqueId);
+    }
+    numArrays = dropExpiredArrays(ppArrays, pEnqueueTimes, numArrays, &tStart);
+    if (numArrays < 1) {
+        callStatusCallbacks();
+        return;
+    }
+
+    /* Call the function that does the business of this callback.
+     * This function should release the lock during time-consuming operations,
+     * but of course it must not access any class data when the lock is released. */
+    countPerf = beginPerfCounters(&perfStart);
+    NDTraceRecord(portName, NDTraceProcessBegin, ppArrays[0]->uniqueId);
+    if (numArrays == 1) {
+        callProcessCallbacks(ppArrays[0]);
+    } else {
+        callProcessCallbacksBatch(ppArrays, numArrays);
+    }
+    NDTraceRecord(portName, NDTraceProcessEnd, ppArrays[0]->uniqueId);
+    if (countPerf) endPerfCounters(&perfStart, ppArrays, numArrays);
+
+    /* The processing time of each array of a batch is the mean */
+    epicsTimeGetCurrent(&tEnd);
+    for (i=0; i<numArrays; i++) {
+        recordLatency(ppArrays[i], &pEnqueueTimes[i], &tStart,
+                      epicsTimeDiffInSeconds(&tEnd, &tStart) / numArrays, &tEnd);
+    }
+    setLatencyParams();
+
+    /* We are done with these array buffers */
+    for (i=0; i<numArrays; i++) {
+        releaseQueued(ppArrays[i]);
+    }
+    setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tStart)*1e3);
+    if (autoScale_) {
+        busyTime_ += epicsTimeDiffInSeconds(&tEnd, &tStart);
+        autoScale(&tEnd);
+    }
+    callStatusCallbacks();
+}
+
+/** Drops the arrays that are older than MaxAge, so that an overloaded plugin processes the newest arrays
+  * instead of falling further behind.  The age is from the time the array was queued, or from its epicsTS
+  * if MaxAgeSource=1.  The dropped arrays are released and counted in ExpiredArrays.
+  * This must be called with the lock held.
+  * \param[in,out] ppArrays The arrays; the arrays that are kept are moved to the start.
+  * \param[in,out] pEnqueueTimes The times that the arrays were queued, moved with the arrays.
+  * \param[in] numArrays The number of arrays.
+  * \param[in] pNow The current time.
+  * \return The number of arrays that are kept. */
+int NDPluginDriver::dropExpiredArrays(NDArray **ppArrays, epicsTimeStamp *pEnqueueTimes, int numArrays,
+                                      const epicsTimeStamp *pNow)
+{
+    double maxAge, age;
+    int ageSource, expiredArrays;
+    int i, numKept = 0;
+    static const char *functionName = "dropExpiredArrays";
+
+    getDoubleParam(NDPluginDriverMaxAge, &maxAge);
+    if (maxAge <= 0.) return numArrays;
+    getIntegerParam(NDPluginDriverMaxAgeSource, &ageSource);
+    getIntegerParam(NDPluginDriverExpiredArrays, &expiredArrays);
+    for (i=0; i<numArrays; i++) {
+        if (ageSource) {
+            age = epicsTimeDiffInSeconds(pNow, &ppArrays[i]->epicsTS);
+        } else {
+            age = epicsTimeDiffInSeconds(pNow, &pEnqueueTimes[i]);
+        }
+        if (age*1e3 > maxAge) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s dropped array uniqueId=%d, age=%f ms\n",
+                driverName, functionName, ppArrays[i]->uniqueId, age*1e3);
+            NDTraceRecord(portName, NDTraceDrop, ppArrays[i]->uniqueId);
+            releaseQueued(ppArrays[i]);
+            expiredArrays++;
+            continue;
+        }
+        ppArrays[numKept] = ppArrays[i];
+        pEnqueueTimes[numKept] = pEnqueueTimes[i];
+        numKept++;
+    }
+    setIntegerParam(NDPluginDriverExpiredArrays, expiredArrays);
+    return numKept;
+}
+
+/** Starts a thread when the queue has filled above AutoScaleHigh since the last change, and parks one
+  * when it stayed below AutoScaleLow and the other threads could process the arrays at less than
+  * autoScaleMaxUtilization of their time.  Does nothing until AutoScalePeriod has passed since the
+  * last change, which keeps the number of threads from oscillating.
+  * This must be called with the lock held.
+  * \param[in] pNow The current time. */
+void NDPluginDriver::autoScale(const epicsTimeStamp *pNow)
+{
+    int queueSize, high, low;
+    double period, elapsed, fill, busy;
+
+    getDoubleParam(NDPluginDriverAutoScalePeriod, &period);
+    elapsed = epicsTimeDiffInSeconds(pNow, &lastScaleTime_);
+    if ((elapsed < period) || (elapsed <= 0.)) return;
+    getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    getIntegerParam(NDPluginDriverAutoScaleHigh, &high);
+    getIntegerParam(NDPluginDriverAutoScaleLow, &low);
+    fill = 100. * maxPending_ / queueSize;
+    /* The number of threads that were busy on average */
+    busy = busyTime_ / elapsed;
+    if (fill >= high) {
+        setActiveThreads(activeThreads_ + 1);
+    } else if ((fill <= low) && (activeThreads_ > 1) &&
+               (busy < autoScaleMaxUtilization * (activeThreads_ - 1))) {
+        setActiveThreads(activeThreads_ - 1);
+    }
+    lastScaleTime_ = *pNow;
+    busyTime_ = 0.;
+    maxPending_ = toThreadPending();
+}
+
+/** Sets the number of active threads, within AutoScaleMin and AutoScaleMax, and starts the threads
+  * that were parked.  The threads that are no longer active park when they finish their current arrays.
+  * This must be called with the lock held.
+  * \param[in] numThreads The number of threads. */
+void NDPluginDriver::setActiveThreads(int numThreads)
+{
+    int minThreads, maxThreads;
+    int i;
+
+    getIntegerParam(NDPluginDriverAutoScaleMin, &minThreads);
+    getIntegerParam(NDPluginDriverAutoScaleMax, &maxThreads);
+    if (numThreads > maxThreads) numThreads = maxThreads;
+    if (numThreads < minThreads) numThreads = minThreads;
+    if (numThreads > (int)pThreads_.size()) numThreads = (int)pThreads_.size();
+    if (numThreads < 1) numThreads = 1;
+    for (i=activeThreads_; i<numThreads; i++) {
+        epicsEventSignal(parkEvents_[i]);
+    }
+    if (numThreads != activeThreads_) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::setActiveThreads %d active threads\n", driverName, numThreads);
+    }
+    activeThreads_ = numThreads;
+    setIntegerParam(NDPluginDriverActiveThreads, activeThreads_);
+}
+
+/** Does the parameter callbacks for the parameters that change with each array, at most once every
+  * StatusUpdatePeriod.  Within the period the callbacks are deferred, and a timer does them at the end
+  * of the period, so the values for the last array are posted when the arrays stop.
+  * Derived classes call this instead of callParamCallbacks() at the end of processCallbacks().
+  * This must be called with the lock held. */
+void NDPluginDriver::callStatusCallbacks()
+{
+    double period, elapsed;
+    epicsTimeStamp now;
+
+    getDoubleParam(NDPluginDriverStatusUpdatePeriod, &period);
+    period /= 1000.;
+    if (period <= 0.) {
+        doStatusCallbacks();
+        return;
+    }
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &lastStatusTime_);
+    if ((elapsed >= period) && !statusTimerActive_) {
+        lastStatusTime_ = now;
+        statusPending_ = false;
+        doStatusCallbacks();
+        return;
+    }
+    statusPending_ = true;
+    if (!statusTimerActive_) {
+        statusTimerActive_ = true;
+        epicsTimerStartDelay(statusTimer_, period - elapsed);
+    }
+}
+
+/** Does the parameter callbacks that callStatusCallbacks() deferred.
+  * This method should really be private, but it must be called from a 
+  * C-linkage callback function, so it must be public. */
+void NDPluginDriver::statusTimerCallback()
+{
+    this->lock();
+    statusTimerActive_ = false;
+    if (statusPending_) {
+        statusPending_ = false;
+        epicsTimeGetCurrent(&lastStatusTime_);
+        doStatusCallbacks();
+    }
+    this->unlock();
+}
+
+/** Does the parameter callbacks of callStatusCallbacks(), on address 0.
+  * Derived classes that set the parameters of other addresses for each array override this
+  * to do their callbacks too.  This is called with the lock held. */
+void NDPluginDriver::doStatusCallbacks()
+{
+    callParamCallbacks();
+}
+
+/** Submits a job to the shared executor for the array that driverCallback() has just queued,
+  * unless NumThreads jobs are already running or queued for this plugin.
+  * The running jobs take every queued array before they finish, so none is left behind. */
+void NDPluginDriver::executorSchedule()
+{
+    bool submit = false;
+
+    epicsMutexLock(executorLock_);
+    if (executorActive_ < numThreads_) {
+        executorActive_++;
+        submit = true;
+    }
+    epicsMutexUnlock(executorLock_);
+    if (submit) NDPluginExecutor::instance()->submit(executorJobC, this);
+}
+
+/** The job that runs in the shared executor threads when UseExecutor=1.
+  * It processes the queued arrays in batches of up to BatchSize, like processTask(), and finishes when the queue
+  * is empty.  After MAX_EXECUTOR_BATCHES batches it submits itself again so that other plugins get a turn.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDPluginDriver::executorTask()
+{
+    ToThreadMessage_t toMsg;
+    std::vector<NDArray*> batch;
+    std::vector<epicsTimeStamp> enqueueTimes;
+    int batchSize, numArrays, numBatches;
+
+    this->lock();
+    getIntegerParam(NDPluginDriverBatchSize, &batchSize);
+    this->unlock();
+    if (batchSize < 1) batchSize = 1;
+    batch.resize(batchSize);
+    enqueueTimes.resize(batchSize);
+
+    for (numBatches=0; numBatches<MAX_EXECUTOR_BATCHES; ) {
+        numArrays = 0;
+        while ((numArrays < batchSize) && (toThreadTryReceive(&toMsg, sizeof(toMsg)) == sizeof(toMsg))) {
+            if (toMsg.messageType == ToThreadMessageData) {
+                enqueueTimes[numArrays] = toMsg.enqueueTime;
+                batch[numArrays++] = toMsg.pArray;
+            }
+        }
+        if (numArrays == 0) {
+            /* An array queued before driverCallback() took executorLock_ is seen here, one queued after
+             * it is seen by driverCallback() as a free job slot */
+            epicsMutexLock(executorLock_);
+            if (toThreadPending() > 0) {
+                epicsMutexUnlock(executorLock_);
+                continue;
+            }
+            executorActive_--;
+            epicsMutexUnlock(executorLock_);
+            return;
+        }
+        this->lock();
+        processQueuedArrays(&batch[0], &enqueueTimes[0], numArrays);
+        this->unlock();
+        numBatches++;
+    }
+    /* The job is still counted in executorActive_ while it waits to run again */
+    NDPluginExecutor::instance()->submit(executorJobC, this);
+}
+
+/** Adds the times of an array to the latency histograms.
+  * This must be called with the lock held.
+  * \param[in] pArray The array.
+  * \param[in] pEnqueueTime The time the array was queued; NULL if it was not queued.
+  * \param[in] pStart The time the processing started, which is when a thread took the array from the queue.
+  * \param[in] processTime The processing time in seconds.
+  * \param[in] pEnd The time the processing finished. */
+void NDPluginDriver::recordLatency(NDArray *pArray, const epicsTimeStamp *pEnqueueTime, const epicsTimeStamp *pStart,
+                                   double processTime, const epicsTimeStamp *pEnd)
+{
+    if (pEnqueueTime) queueTimeHist_.add(epicsTimeDiffInSeconds(pStart, pEnqueueTime));
+    processTimeHist_.add(processTime);
+    recentProcessTime_ += recentProcessWeight * (processTime - recentProcessTime_);
+    /* Drivers that do not set epicsTS leave it 0 */
+    if ((pArray->epicsTS.secPastEpoch != 0) || (pArray->epicsTS.nsec != 0)) {
+        latencyHist_.add(epicsTimeDiffInSeconds(pEnd, &pArray->epicsTS));
+    }
+}
+
+/** Sets the percentile parameters from the latency histograms.
+  * This must be called with the lock held. */
+void NDPluginDriver::setLatencyParams()
+{
+    setDoubleParam(NDPluginDriverQueueTimeP50,   queueTimeHist_.percentile(0.50)*1e3);
+    setDoubleParam(NDPluginDriverQueueTimeP99,   queueTimeHist_.percentile(0.99)*1e3);
+    setDoubleParam(NDPluginDriverQueueTimeMax,   queueTimeHist_.maximum()*1e3);
+    setDoubleParam(NDPluginDriverProcessTimeP50, processTimeHist_.percentile(0.50)*1e3);
+    setDoubleParam(NDPluginDriverProcessTimeP99, processTimeHist_.percentile(0.99)*1e3);
+    setDoubleParam(NDPluginDriverProcessTimeMax, processTimeHist_.maximum()*1e3);
+    setDoubleParam(NDPluginDriverLatencyP50,     latencyHist_.percentile(0.50)*1e3);
+    setDoubleParam(NDPluginDriverLatencyP99,     latencyHist_.percentile(0.99)*1e3);
+    setDoubleParam(NDPluginDriverLatencyMax,     latencyHist_.maximum()*1e3);
+}
+
+/** Reads the performance counters of the calling thread before processing arrays, if PerfCounters=1.
+  * The counters count the calling thread, so they include the downstream plugins that are fused to this one,
+  * and the plugins that run in this thread with blocking callbacks, as ExecutionTime does.
+  * If the counters cannot be opened, e.g. on other systems or in virtual machines without them,
+  * PerfCounters is set to 0.  This must be called with the lock held.
+  * \param[out] pStart The counts before processing.
+  * \return true if the counts were read. */
+bool NDPluginDriver::beginPerfCounters(NDPerfCounts_t *pStart)
+{
+    int perfCounters;
+    static const char *functionName = "beginPerfCounters";
+
+    getIntegerParam(NDPluginDriverPerfCounters, &perfCounters);
+    if (!perfCounters) return false;
+    if (NDPerfCountersRead(pStart) == 0) return true;
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+        "%s::%s cannot open the performance counters of thread %s, setting PerfCounters=0\n",
+        driverName, functionName, epicsThreadGetNameSelf());
+    setIntegerParam(NDPluginDriverPerfCounters, 0);
+    return false;
+}
+
+/** Sets the performance counter parameters from the counts of processing arrays.
+  * The counts of each array of a batch are the mean.  This must be called with the lock held.
+  * \param[in] pStart The counts that beginPerfCounters() read.
+  * \param[in] ppArrays The arrays that were processed.
+  * \param[in] numArrays The number of arrays. */
+void NDPluginDriver::endPerfCounters(const NDPerfCounts_t *pStart, NDArray **ppArrays, int numArrays)
+{
+    NDPerfCounts_t perfEnd;
+    NDArrayInfo_t arrayInfo;
+    double cycles, elements = 0.;
+    int i;
+
+    if (NDPerfCountersRead(&perfEnd) != 0) return;
+    for (i=0; i<numArrays; i++) {
+        ppArrays[i]->getInfo(&arrayInfo);
+        elements += arrayInfo.nElements;
+    }
+    cycles = perfEnd.cycles - pStart->cycles;
+    setDoubleParam(NDPluginDriverPerfCycles, cycles / numArrays);
+    setDoubleParam(NDPluginDriverPerfIPC, (cycles > 0.) ? (perfEnd.instructions - pStart->instructions) / cycles : 0.);
+    if (elements > 0.) {
+        setDoubleParam(NDPluginDriverPerfCacheMisses, (perfEnd.cacheMisses - pStart->cacheMisses) / elements);
+        setDoubleParam(NDPluginDriverPerfBranchMisses, (perfEnd.branchMisses - pStart->branchMisses) / elements);
+    }
+}
+
+/** Returns false, and counts the array as dropped, if its data is compressed and the plugin does not set
+  * supportsCompressedArrays_.  An NDPluginCodec in Decompress mode must then be placed before the plugin.
+  * \param[in] pArray The array from the driver or the upstream plugin. */
+bool NDPluginDriver::acceptArray(NDArray *pArray)
+{
+    int droppedArrays;
+    static const char *functionName = "acceptArray";
+
+    if (supportsCompressedArrays_ || pArray->codec.empty()) return true;
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s array uniqueId=%d is compressed with codec %s, which this plugin does not support\n",
+        driverName, functionName, pArray->uniqueId, pArray->codec.name.c_str());
+    getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
+    setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays+1);
+    return false;
+}
+
+/** Returns the array that processCallbacks() is given for an input array: the array itself, a copy unpacked to
+  * UInt16 if its data type is packed and the plugin does not set supportsPackedArrays_, a dense copy if it is sparse
+  * and the plugin does not set supportsSparseArrays_, or a contiguous copy if it is a strided view and the plugin
+  * does not set supportsStridedViews_.  Arrays in the memory of a device are copied to host memory unless the
+  * plugin sets supportsDeviceArrays_, so the data only leaves the device at the end of a chain of device plugins.
+  * The steps are done one after the other, so the host copy of a packed device array is unpacked too, and each
+  * intermediate copy is released when it is replaced.  The caller releases the array if it is a copy.
+  * \param[in] pArray The array from the driver or the upstream plugin.
+  * \param[out] ppOut The array to process, or NULL if the copy could not be made. */
+int NDPluginDriver::prepareArray(NDArray *pArray, NDArray **ppOut)
+{
+    NDArray *pPrepared = pArray;
+    NDArray *pNext = NULL;
+    const char *failure = NULL;
+    static const char *functionName = "prepareArray";
+
+    if (!supportsDeviceArrays_ && pPrepared->pDevice) {
+        pNext = this->pNDArrayPool->copy(pPrepared, NULL, 1);
+        if (!pNext) {
+            failure = "cannot copy device array to host memory";
+        } else {
+            pPrepared = pNext;
+        }
+    }
+
+    if (!failure && !supportsPackedArrays_ && NDPackedBits(pPrepared->dataType)) {
+        if (this->pNDArrayPool->convert(pPrepared, &pNext, NDUInt16) != ND_SUCCESS) {
+            failure = "cannot unpack array";
+        } else {
+            if (pPrepared != pArray) pPrepared->release();
+            pPrepared = pNext;
+        }
+    }
+    if (!failure && !supportsSparseArrays_ && pPrepared->sparse) {
+        if (this->pNDArrayPool->makeDense(pPrepared, &pNext) != ND_SUCCESS) {
+            failure = "cannot densify array";
+        } else {
+            if (pPrepared != pArray) pPrepared->release();
+            pPrepared = pNext;
+        }
+    }
+    if (!failure && !supportsStridedViews_ && !pPrepared->isContiguous()) {
+        pNext = this->pNDArrayPool->copy(pPrepared, NULL, 1);
+        if (!pNext) {
+            failure = "cannot make contiguous copy of array";
+        } else {
+            if (pPrepared != pArray) pPrepared->release();
+            pPrepared = pNext;
+        }
+    }
+
+    if (failure) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %s, uniqueId=%d\n",
+            driverName, functionName, failure, pArray->uniqueId);
+        if (pPrepared != pArray) pPrepared->release();
+        *ppOut = NULL;
+        return ND_ERROR;
+    }
+    *ppOut = pPrepared;
+    return ND_SUCCESS;
+}
+
+/** Calls processCallbacks() with the array that prepareArray() returns.  Compressed arrays are dropped,
+  * see acceptArray().
+  * \param[in] pArray The array from the driver or the upstream plugin. */
+void NDPluginDriver::callProcessCallbacks(NDArray *pArray)
+{
+    NDArray *pPrepared;
+
+    if (!acceptArray(pArray)) return;
+    if (prepareArray(pArray, &pPrepared) != ND_SUCCESS) return;
+    processCallbacks(pPrepared);
+    if (pPrepared != pArray) pPrepared->release();
+    resetScratchArena();
+}
+
+/** Calls processCallbacksBatch() with the arrays that prepareArray() returns.
+  * \param[in] ppArrays The arrays from the driver or the upstream plugin, in the order they were queued.
+  * \param[in] numArrays The number of arrays. */
+void NDPluginDriver::callProcessCallbacksBatch(NDArray **ppArrays, int numArrays)
+{
+    std::vector<NDArray*> prepared;
+    std::vector<bool> copied;
+    NDArray *pPrepared;
+    int i;
+
+    for (i=0; i<numArrays; i++) {
+        if (!supportsStridedViews_ && !ppArrays[i]->isContiguous()) break;
+        if (!supportsCompressedArrays_ && !ppArrays[i]->codec.empty()) break;
+        if (!supportsPackedArrays_ && NDPackedBits(ppArrays[i]->dataType)) break;
+        if (!supportsSparseArrays_ && ppArrays[i]->sparse) break;
+        if (!supportsDeviceArrays_ && ppArrays[i]->pDevice) break;
+    }
+    if (i == numArrays) {
+        processCallbacksBatch(ppArrays, numArrays);
+        resetScratchArena();
+        return;
+    }
+    for (i=0; i<numArrays; i++) {
+        if (!acceptArray(ppArrays[i])) continue;
+        if (prepareArray(ppArrays[i], &pPrepared) != ND_SUCCESS) continue;
+        prepared.push_back(pPrepared);
+        copied.push_back(pPrepared != ppArrays[i]);
+    }
+    if (!prepared.empty()) processCallbacksBatch(&prepared[0], (int)prepared.size());
+    for (i=0; i<(int)prepared.size(); i++) {
+        if (copied[i]) prepared[i]->release();
+    }
+    resetScratchArena();
+}
+
+/** Processes several queued arrays at once.  This is called with the lock held by the plugin threads
+  * when BatchSize > 1 and more than one array was waiting in the queue.
+  * Plugins can override it to do their setup and parameter callbacks once for the whole batch;
+  * the default implementation calls processCallbacks() for each array.
+  * \param[in] ppArrays The arrays, in the order they were queued.  The caller releases them.
+  * \param[in] numArrays The number of arrays. */
+void NDPluginDriver::processCallbacksBatch(NDArray **ppArrays, int numArrays)
+{
+    int i;
+
+    for (i=0; i<numArrays; i++) {
+        processCallbacks(ppArrays[i]);
     }
 }
 
@@ -559,7 +1854,9 @@ asynStatus NDPluginDriver::connectToArrayPort(void)
     return(status);
 }   
 
-/** Method runs as a separate thread, periodically doing NDArray callbacks to downstream plugins.
+/** Method runs as a separate thread, doing the NDArray callbacks for arrays that have waited in the
+  * reorder ring for SortTime.  It sleeps until an array is put in the ring and then until the oldest
+  * array in the ring has waited for SortTime, so arrays that arrive in order are not delayed.
   * This thread is used when SortMode=1.
   * This method should really be private, but it must be called from a 
   * C-linkage callback function, so it must be public. */ 
@@ -567,51 +1864,50 @@ void NDPluginDriver::sortingTask()
 {
     double sortTime;
     epicsTimeStamp now;
-    int sortSize;
-    double deltaTime;
-    int listSize;
-    std::multiset<sortedListElement>::iterator pListElement;
+    double deltaTime, maxDeltaTime;
+    sortedListElement *pSlot, *pLowest;
+    NDArray *pArray;
+    size_t i;
+    int threadConfigId = 0;
     static const char *functionName = "sortingTask";
 
     lock();
     while (1) {
+        applyThreadConfig(&threadConfigId);
+        if (numSorted_ == 0) {
+            unlock();
+            epicsEventWait(sortEvent_);
+            lock();
+            continue;
+        }
         getDoubleParam(NDPluginDriverSortTime, &sortTime);
-        unlock();
-        epicsThreadSleep(sortTime);
-        lock();
         epicsTimeGetCurrent(&now);
-        getIntegerParam(NDPluginDriverSortSize, &sortSize);
-        while ((listSize=(int)sortedNDArrayList_.size()) > 0) {
-            bool orderOK;
-            pListElement = sortedNDArrayList_.begin();
-            deltaTime = epicsTimeDiffInSeconds(&now, &pListElement->insertionTime_);
-            asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, 
-                "%s::%s, deltaTime=%f, list size=%d, uniqueId=%d\n", 
-                driverName, functionName, deltaTime, listSize, pListElement->pArray_->uniqueId);            
-            orderOK = (pListElement->pArray_->uniqueId == prevUniqueId_)   ||
-                      (pListElement->pArray_->uniqueId == prevUniqueId_+1);
-            if ((!firstOutputArray_ && orderOK) || (deltaTime > sortTime)) {
-                doCallbacksGenericPointer(pListElement->pArray_, NDArrayData, 0);
-                if (!firstOutputArray_ && !orderOK) {
-                    int disorderedArrays;
-                    getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
-                    disorderedArrays++;
-                    setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
-                    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                        "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
-                        driverName, functionName, pListElement->pArray_->uniqueId, prevUniqueId_, 
-                        orderOK, disorderedArrays);
-                }
-                prevUniqueId_ = pListElement->pArray_->uniqueId;
-                pListElement->pArray_->release();
-                sortedNDArrayList_.erase(pListElement);
-                firstOutputArray_ = false;
-            } else  {
-                break;
-            }
+        maxDeltaTime = 0.;
+        pLowest = NULL;
+        for (i=0; i<sortRing_.size(); i++) {
+            pSlot = &sortRing_[i];
+            if (!pSlot->pArray_) continue;
+            deltaTime = epicsTimeDiffInSeconds(&now, &pSlot->insertionTime_);
+            if (deltaTime > maxDeltaTime) maxDeltaTime = deltaTime;
+            if (!pLowest || (pSlot->pArray_->uniqueId < pLowest->pArray_->uniqueId)) pLowest = pSlot;
+        }
+        if (maxDeltaTime < sortTime) {
+            /* Wait for the gap to be filled, or until the oldest array has waited for SortTime */
+            unlock();
+            epicsEventWaitWithTimeout(sortEvent_, sortTime - maxDeltaTime);
+            lock();
+            continue;
         }
-        listSize=(int)sortedNDArrayList_.size();
-        setIntegerParam(NDPluginDriverSortFree, sortSize-listSize);
+        asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, 
+            "%s::%s, deltaTime=%f, ring count=%d, uniqueId=%d\n", 
+            driverName, functionName, maxDeltaTime, numSorted_, pLowest->pArray_->uniqueId);
+        pArray = pLowest->pArray_;
+        pLowest->pArray_ = NULL;
+        numSorted_--;
+        doOutputCallbacks(pArray);
+        pArray->release();
+        emitSortedArrays(false);
+        setIntegerParam(NDPluginDriverSortFree, (int)sortRing_.size() - numSorted_);
         callParamCallbacks();
     }    
 }
@@ -637,13 +1933,21 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
     status = getAddress(pasynUser, &addr); 
     if (status != asynSuccess) goto done;
 
+    /* A fused plugin must run in the thread of the upstream plugin, e.g. when autosave restores BlockingCallbacks */
+    if ((function == NDPluginDriverBlockingCallbacks) && fused_ && !value) {
+        asynPrint(pasynUser, ASYN_TRACE_WARNING, 
+            "%s::%s plugin is fused, BlockingCallbacks stays Yes\n", 
+            driverName, functionName);
+        value = 1;
+    }
+
     /* Set the parameter in the parameter library. */
     status = (asynStatus) setIntegerParam(addr, function, value);
     if (status != asynSuccess) goto done;
 
     /* If blocking callbacks are being disabled but the callback threads have
      * not been created yet, create them here. */
-    if (function == NDPluginDriverBlockingCallbacks && !value && pThreads_.size() == 0) {
+    if (function == NDPluginDriverBlockingCallbacks && !value && !pToThreadMsgQ_ && !pToThreadLockFreeQ_) {
          createCallbackThreads();
      }
     
@@ -674,10 +1978,39 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
         if (status != asynSuccess) goto done;
 
     } else if ((function == NDPluginDriverQueueSize) ||
-               (function == NDPluginDriverNumThreads)) {
+               (function == NDPluginDriverNumThreads) ||
+               (function == NDPluginDriverLockFreeQueue) ||
+               (function == NDPluginDriverUseExecutor) ||
+               (function == NDPluginDriverAutoScale)) {
         if ((status = deleteCallbackThreads())) goto done;
         if ((status = createCallbackThreads())) goto done;
 
+    } else if ((function == NDPluginDriverAutoScaleMin) ||
+               (function == NDPluginDriverAutoScaleMax)) {
+        if (autoScale_) setActiveThreads(activeThreads_);
+
+    } else if (function == NDPluginDriverLatencyWindow) {
+        queueTimeHist_.setWindow(value);
+        processTimeHist_.setWindow(value);
+        latencyHist_.setWindow(value);
+        setLatencyParams();
+
+    } else if (function == NDPluginDriverLatencyReset) {
+        queueTimeHist_.reset();
+        processTimeHist_.reset();
+        latencyHist_.reset();
+        setLatencyParams();
+
+    } else if (function == NDPluginDriverIntraFrameThreads) {
+        status = setIntraFrameThreads(value);
+
+    } else if ((function == NDPluginDriverSchedPolicy) ||
+               (function == NDPluginDriverSchedPriority)) {
+        int policy;
+        getIntegerParam(NDPluginDriverSchedPolicy, &policy);
+        if (policy != NDSchedDefault) schedulerSet_ = true;
+        threadConfigChanged();
+
     } else if ((function == NDPluginDriverSortMode) && 
                (value == 1)) {
         status = createSortingThread();
@@ -695,6 +2028,7 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
     
     done:
+    updateDirectQueue();
     /* Do callbacks so higher layers see any changes */
     callParamCallbacks(addr);
     
@@ -710,6 +2044,20 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 }
 
 
+/** Called when asyn clients call pasynFloat64->write().
+  * MinCallbackTime decides whether upstream plugins can queue arrays without the lock, see tryQueueArray().
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginDriver::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status;
+
+    status = asynNDArrayDriver::writeFloat64(pasynUser, value);
+    if (function == NDPluginDriverMinCallbackTime) updateDirectQueue();
+    return status;
+}
+
 /** Called when asyn clients call pasynOctet->write().
   * This function performs actions for some parameters, including NDPluginDriverArrayPort.
   * For all parameters it sets the value in the parameter library and calls any registered callbacks..
@@ -730,9 +2078,31 @@ asynStatus NDPluginDriver::writeOctet(asynUser *pasynUser, const char *value,
     status = (asynStatus)setStringParam(addr, function, (char *)value);
 
     if (function == NDPluginDriverArrayPort) {
+        /* The plugin is no longer part of the fused chain */
+        fused_ = false;
+        setStringParam(NDPluginDriverFusedTo, "");
         this->unlock();
         connectToArrayPort();
         this->lock();
+    } else if (function == NDPluginDriverCpuAffinity) {
+        if (value[0]) affinitySet_ = true;
+        threadConfigChanged();
+    } else if (function == NDPluginDriverDecimateAttribute) {
+        updateDirectQueue();
+    } else if (function == NDPluginDriverVetoExpression) {
+        /* driverCallback() evaluates the expression with the lock held, so it can be replaced here */
+        char error[256] = "";
+        vetoEnabled_ = false;
+        if (value[0]) {
+            vetoEnabled_ = (NDProcessExpressionCompile(value, &vetoExpression_, error, sizeof(error)) == ND_SUCCESS);
+            if (!vetoEnabled_) {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                    "%s::%s error compiling VetoExpression=%s, %s\n",
+                    driverName, functionName, value, error);
+            }
+        }
+        setStringParam(NDPluginDriverVetoError, error);
+        updateDirectQueue();
     } else {
         /* If this parameter belongs to a base class call its method */
         if (function < FIRST_NDPLUGIN_PARAM) 
@@ -814,7 +2184,7 @@ asynStatus NDPluginDriver::startCallbackThreads(void)
     FromThreadMessage_t fromMsg;
     static const char *functionName = "startCallbackThreads";
 
-    for (i=0; i<numThreads_; i++) {
+    for (i=0; i<(int)pThreads_.size(); i++) {
         pThreads_[i]->start();
   
         // Wait for the thread to say its running
@@ -847,17 +2217,22 @@ void NDPluginDriver::run()
 }
 
 /** Creates the plugin threads.  
-  * This method is called when BlockingCallbacks is 0, and whenever QueueSize or NumThreads is changed. */ 
+  * This method is called when BlockingCallbacks is 0, and whenever QueueSize, NumThreads, LockFreeQueue
+  * or UseExecutor is changed. */ 
 asynStatus NDPluginDriver::createCallbackThreads()
 {
     assert(this->pThreads_.size() == 0);
     assert(this->pToThreadMsgQ_ == 0);
+    assert(this->pToThreadLockFreeQ_ == 0);
     assert(this->pFromThreadMsgQ_ == 0);
     
     int queueSize;
     int numThreads;
     int maxThreads;
     int enableCallbacks;
+    int lockFreeQueue;
+    int useExecutor;
+    int autoScale;
     int i;
     int status = asynSuccess;
     static const char *functionName = "createCallbackThreads";
@@ -865,6 +2240,9 @@ asynStatus NDPluginDriver::createCallbackThreads()
     getIntegerParam(NDPluginDriverMaxThreads, &maxThreads);
     getIntegerParam(NDPluginDriverNumThreads, &numThreads);
     getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    getIntegerParam(NDPluginDriverLockFreeQueue, &lockFreeQueue);
+    getIntegerParam(NDPluginDriverUseExecutor, &useExecutor);
+    getIntegerParam(NDPluginDriverAutoScale, &autoScale);
     if (numThreads > maxThreads) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
             "%s::%s error, numThreads=%d must be <= maxThreads=%d, setting to %d\n",
@@ -890,21 +2268,46 @@ asynStatus NDPluginDriver::createCallbackThreads()
         setIntegerParam(NDPluginDriverQueueSize, queueSize);
     }
   
-    pThreads_.resize(numThreads);
+    /* With the shared executor NumThreads limits the number of executor threads that process arrays
+     * for this plugin at the same time, and the plugin has no threads of its own */
+    useExecutor_ = (useExecutor != 0);
+    pThreads_.resize(useExecutor_ ? 0 : numThreads);
+
+    /* With AutoScale all MaxThreads threads are created, and those that are not needed are parked.
+     * NumThreads is the number of threads that are active at first. */
+    autoScale_ = (autoScale != 0) && !useExecutor_;
+    if (autoScale_) pThreads_.resize(maxThreads);
+    parkEvents_.resize(pThreads_.size());
+    for (i=0; i<(int)parkEvents_.size(); i++) {
+        parkEvents_[i] = epicsEventMustCreate(epicsEventEmpty);
+    }
+    activeThreads_ = (int)pThreads_.size();
+    if (autoScale_) {
+        activeThreads_ = 0;
+        setActiveThreads(numThreads);
+    }
+    setIntegerParam(NDPluginDriverActiveThreads, activeThreads_);
+    busyTime_ = 0.;
+    maxPending_ = 0;
+    epicsTimeGetCurrent(&lastScaleTime_);
 
     /* Create the message queue for the input arrays */
-    pToThreadMsgQ_ = new epicsMessageQueue(queueSize, sizeof(ToThreadMessage_t));
-    if (!pToThreadMsgQ_) {
-        /* We don't handle memory errors above, so no point in handling this. */
-        cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
+    if (lockFreeQueue) {
+        pToThreadLockFreeQ_ = new NDLockFreeQueue(queueSize, sizeof(ToThreadMessage_t));
+    } else {
+        pToThreadMsgQ_ = new epicsMessageQueue(queueSize, sizeof(ToThreadMessage_t));
+        if (!pToThreadMsgQ_) {
+            /* We don't handle memory errors above, so no point in handling this. */
+            cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
+        }
     }
-    pFromThreadMsgQ_ = new epicsMessageQueue(numThreads, sizeof(FromThreadMessage_t));
+    pFromThreadMsgQ_ = new epicsMessageQueue(pThreads_.size() > 0 ? (int)pThreads_.size() : 1, sizeof(FromThreadMessage_t));
     if (!pFromThreadMsgQ_) {
         /* We don't handle memory errors above, so no point in handling this. */
         cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
     }
 
-    for (i=0; i<numThreads; i++) {
+    for (i=0; i<(int)pThreads_.size(); i++) {
         /* Create the thread (but not start). */
         char taskName[256];
         epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_%d", portName, i+1);
@@ -912,17 +2315,19 @@ asynStatus NDPluginDriver::createCallbackThreads()
     }
 
     /* If start() was already run, we also need to start the threads. */
-    if (this->pluginStarted_) {
+    if (this->pluginStarted_ && !useExecutor_) {
         status |= startCallbackThreads();
     }
     getIntegerParam(NDPluginDriverEnableCallbacks, &enableCallbacks);
     setIntegerParam(NDPluginDriverQueueFree, queueSize);
+    updateDirectQueue();
     if (enableCallbacks) this->setArrayInterrupt(1);
     return (asynStatus) status;
 }
 
 /** Deletes the plugin threads.  
-  * This method is called from the destructor and whenever QueueSize or NumThreads is changed. */ 
+  * This method is called from the destructor and whenever QueueSize, NumThreads, LockFreeQueue
+  * or UseExecutor is changed. */ 
 asynStatus NDPluginDriver::deleteCallbackThreads()
 {
     ToThreadMessage_t toMsg = {ToThreadMessageExit, 0};
@@ -934,19 +2339,45 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
     static const char *functionName = "deleteCallbackThreads";
     
     //  Disable callbacks from driver so the threads will empty the message queue
-    if (pToThreadMsgQ_ != 0) {
+    if ((pToThreadMsgQ_ != 0) || (pToThreadLockFreeQ_ != 0)) {
+        epicsAtomicSetIntT(&directQueue_, 0);
         this->unlock();
         this->setArrayInterrupt(0);
-        while ((pending=pToThreadMsgQ_->pending()) > 0) {
+        // Wait for callbacks that are waiting for room in the queue, or queueing without the lock,
+        // to queue their arrays
+        while (1) {
+            this->lock();
+            pending = numBlockedSenders_ + epicsAtomicGetIntT(&directSenders_);
+            this->unlock();
+            if (pending == 0) break;
+            epicsThreadSleep(0.01);
+        }
+        while ((pending=toThreadPending()) > 0) {
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s::%s waiting for queue to empty, pending=%d\n", 
                 driverName, functionName, pending);
             epicsThreadSleep(0.05);
         }
+        // Wait for the executor jobs of this plugin to finish
+        while (useExecutor_) {
+            epicsMutexLock(executorLock_);
+            pending = executorActive_;
+            epicsMutexUnlock(executorLock_);
+            if (pending == 0) break;
+            epicsThreadSleep(0.01);
+        }
+        // Start the parked threads so that they receive the kill messages
+        this->lock();
+        autoScale_ = false;
+        for (i=activeThreads_; i<(int)pThreads_.size(); i++) {
+            epicsEventSignal(parkEvents_[i]);
+        }
+        activeThreads_ = (int)pThreads_.size();
+        this->unlock();
         // Send a kill message to the threads and wait for reply.
         // Must do this with lock released else the threads may not be able to receive the message
-        for (i=0; i<numThreads_; i++) {
-            if (pToThreadMsgQ_->send(&toMsg, sizeof(toMsg)) != 0) {
+        for (i=0; i<(int)pThreads_.size(); i++) {
+            if (toThreadSend(&toMsg, sizeof(toMsg)) != 0) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                     "%s::%s error sending plugin thread %d exit message\n",
                     driverName, functionName, i);
@@ -970,21 +2401,131 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
         }
         this->lock();
         // All threads have now been stopped.  Delete them.
-        for (i=0; i<numThreads_; i++) {
+        for (i=0; i<(int)pThreads_.size(); i++) {
             delete pThreads_[i]; // The epicsThread destructor waits for the thread to return
         }
         pThreads_.resize(0);
         delete pToThreadMsgQ_;
         pToThreadMsgQ_ = 0;
+        delete pToThreadLockFreeQ_;
+        pToThreadLockFreeQ_ = 0;
     }
     if (pFromThreadMsgQ_) {
         delete pFromThreadMsgQ_;
         pFromThreadMsgQ_ = 0;
     }
+    for (i=0; i<(int)parkEvents_.size(); i++) {
+        epicsEventDestroy(parkEvents_[i]);
+    }
+    parkEvents_.resize(0);
+    autoScale_ = false;
     
     return status;
 }
 
+/* The input queue of the plugin threads is either an epicsMessageQueue or, when LockFreeQueue=1, an NDLockFreeQueue.
+ * These methods forward to whichever one exists; callers must only use them while the threads exist. */
+int NDPluginDriver::toThreadTrySend(void *pMessage, size_t size)
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->trySend(pMessage, size);
+    return pToThreadMsgQ_->trySend(pMessage, size);
+}
+
+int NDPluginDriver::toThreadSend(void *pMessage, size_t size)
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->send(pMessage, size);
+    return pToThreadMsgQ_->send(pMessage, size);
+}
+
+int NDPluginDriver::toThreadSend(void *pMessage, size_t size, double timeout)
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->send(pMessage, size, timeout);
+    return pToThreadMsgQ_->send(pMessage, size, timeout);
+}
+
+/** Called by driverCallback() when the queue is full, to handle the array according to OverflowPolicy.
+  * DropNewest returns an error at once.  DropOldest drops the array at the head of the queue and counts it in
+  * DroppedArrays.  Block and Backpressure wait for room in the queue, with the lock released so that the plugin
+  * threads can finish the arrays they are processing; the time waited is added to BlockedTime.
+  * This must be called with the lock held.
+  * \param[in] pMessage The message for the new array.
+  * \param[in] size The size of the message.
+  * \param[in] pasynUser The pasynUser of the callback.
+  * \return 0 if the message was queued, -1 if the new array is to be dropped. */
+int NDPluginDriver::queueFullSend(void *pMessage, size_t size, asynUser *pasynUser)
+{
+    int overflowPolicy;
+    int droppedArrays;
+    double timeout = 0., blockedTime;
+    epicsTimeStamp tStart, tEnd;
+    ToThreadMessage_t oldMsg;
+    int status = -1;
+    static const char *functionName = "queueFullSend";
+
+    getIntegerParam(NDPluginDriverOverflowPolicy, &overflowPolicy);
+    switch (overflowPolicy) {
+        case NDPluginOverflowDropOldest:
+            if (toThreadTryReceive(&oldMsg, sizeof(oldMsg)) != sizeof(oldMsg)) {
+                /* A plugin thread took an array in the meantime */
+                status = toThreadTrySend(pMessage, size);
+            } else if (oldMsg.messageType != ToThreadMessageData) {
+                /* Never drop the exit messages of deleteCallbackThreads(); drop the new array instead */
+                toThreadTrySend(&oldMsg, sizeof(oldMsg));
+            } else {
+                getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
+                asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+                    "%s::%s message queue full, dropped oldest array uniqueId=%d\n",
+                    driverName, functionName, oldMsg.pArray->uniqueId);
+                droppedArrays++;
+                setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+                NDTraceRecord(portName, NDTraceDrop, oldMsg.pArray->uniqueId);
+                releaseQueued(oldMsg.pArray);
+                status = toThreadTrySend(pMessage, size);
+            }
+            break;
+        case NDPluginOverflowBlock:
+        case NDPluginOverflowBackpressure:
+            getDoubleParam(NDPluginDriverOverflowTimeout, &timeout);
+            /* deleteCallbackThreads() waits for numBlockedSenders_ to be 0 before it deletes the queue */
+            numBlockedSenders_++;
+            epicsTimeGetCurrent(&tStart);
+            this->unlock();
+            if (overflowPolicy == NDPluginOverflowBlock) {
+                status = toThreadSend(pMessage, size, timeout);
+            } else {
+                status = toThreadSend(pMessage, size);
+            }
+            this->lock();
+            epicsTimeGetCurrent(&tEnd);
+            numBlockedSenders_--;
+            getDoubleParam(NDPluginDriverBlockedTime, &blockedTime);
+            blockedTime += epicsTimeDiffInSeconds(&tEnd, &tStart);
+            setDoubleParam(NDPluginDriverBlockedTime, blockedTime);
+            break;
+        default:
+            break;
+    }
+    return status;
+}
+
+int NDPluginDriver::toThreadReceive(void *pMessage, size_t size)
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->receive(pMessage, size);
+    return pToThreadMsgQ_->receive(pMessage, size);
+}
+
+int NDPluginDriver::toThreadTryReceive(void *pMessage, size_t size)
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->tryReceive(pMessage, size);
+    return pToThreadMsgQ_->tryReceive(pMessage, size);
+}
+
+int NDPluginDriver::toThreadPending()
+{
+    if (pToThreadLockFreeQ_) return pToThreadLockFreeQ_->pending();
+    return pToThreadMsgQ_->pending();
+}
+
 /** Creates the sorting thread.  
   * This method is called when SortMode is set to Sorted. */ 
 asynStatus NDPluginDriver::createSortingThread()
@@ -1010,4 +2551,495 @@ asynStatus NDPluginDriver::createSortingThread()
     return asynSuccess;
 }
 
+/** Replaces the threads that parallelForRows() uses.
+  * This waits for a parallelForRows() call that is using the old threads to finish.
+  * \param[in] numThreads The number of threads in addition to the calling thread; 0 processes the stripes in the calling thread. */
+asynStatus NDPluginDriver::setIntraFrameThreads(int numThreads)
+{
+    NDWorkerPool *pOldWorkers;
+    char poolName[32];
+    static const char *functionName = "setIntraFrameThreads";
+
+    if (numThreads < 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s invalid number of threads=%d\n", 
+            driverName, functionName, numThreads);
+        return asynError;
+    }
+    epicsSnprintf(poolName, sizeof(poolName), "%s_Stripe", portName);
+    epicsMutexLock(stripeLock_);
+    pOldWorkers = pStripeWorkers_;
+    pStripeWorkers_ = (numThreads > 0) ? new NDWorkerPool(poolName, numThreads) : NULL;
+    intraFrameThreads_ = numThreads;
+    epicsMutexUnlock(stripeLock_);
+    delete pOldWorkers;
+    return asynSuccess;
+}
+
+/** Returns the number of row stripes that parallelForRows() should split an array into.
+  * This is IntraFrameThreads+1, since the calling thread processes a stripe, but not more than numRows.
+  * Plugins that reduce per-stripe results allocate them for this number of stripes.
+  * \param[in] numRows The number of rows of the array. */
+int NDPluginDriver::numStripes(size_t numRows)
+{
+    int numStripes = intraFrameThreads_ + 1;
+
+    if ((size_t)numStripes > numRows) numStripes = (int)numRows;
+    if (numStripes < 1) numStripes = 1;
+    return numStripes;
+}
+
+/** Processes the rows of an array in stripes, in the IntraFrameThreads threads and the calling thread.
+  * It returns when all of the stripes are done.  Derived classes call this from processCallbacks() or
+  * processCallbacksUnlocked() for loops whose rows are independent; func stores the results of each stripe
+  * at its stripe index and the caller combines them afterwards.
+  * If another thread of this plugin is already using the threads, or IntraFrameThreads=0, the stripes are
+  * processed one after the other in the calling thread, so the results are the same.
+  * func must not take the asynPortDriver lock, which the caller may hold, or call parallelForRows().
+  * \param[in] func The function that processes one stripe.
+  * \param[in] pArg The argument passed to func.
+  * \param[in] numRows The number of rows.
+  * \param[in] numStripes The number of stripes, normally the value returned by numStripes(numRows).
+  */
+void NDPluginDriver::parallelForRows(NDStripeTask func, void *pArg, size_t numRows, int numStripes)
+{
+    int stripe;
+
+    if ((size_t)numStripes > numRows) numStripes = (int)numRows;
+    if ((numStripes > 1) && (epicsMutexTryLock(stripeLock_) == epicsMutexLockOK)) {
+        if (pStripeWorkers_) {
+            pStripeWorkers_->runStripes(func, pArg, numRows, numStripes);
+            epicsMutexUnlock(stripeLock_);
+            return;
+        }
+        epicsMutexUnlock(stripeLock_);
+    }
+    for (stripe=0; stripe<numStripes; stripe++) {
+        size_t firstRow = numRows * stripe / numStripes;
+        func(pArg, firstRow, numRows * (stripe + 1) / numStripes - firstRow, stripe);
+    }
+}
+
+/** Runs independent tasks in the IntraFrameThreads threads and the calling thread, for work that does not
+  * split into rows, such as the regions of NDPluginROIStat.  The threads take the tasks in order as they
+  * become free, so putting the largest tasks first balances the load.
+  * If another thread of this plugin is already using the threads, or IntraFrameThreads=0, the tasks are
+  * run one after the other in the calling thread.
+  * func must not take the asynPortDriver lock, which the caller may hold, or call parallelForTasks().
+  * \param[in] func The function that executes one task.
+  * \param[in] pArg The argument passed to func.
+  * \param[in] numTasks The number of tasks.
+  */
+void NDPluginDriver::parallelForTasks(NDWorkerTask func, void *pArg, int numTasks)
+{
+    int task;
+
+    if ((numTasks > 1) && (epicsMutexTryLock(stripeLock_) == epicsMutexLockOK)) {
+        if (pStripeWorkers_) {
+            pStripeWorkers_->run(func, pArg, numTasks);
+            epicsMutexUnlock(stripeLock_);
+            return;
+        }
+        epicsMutexUnlock(stripeLock_);
+    }
+    for (task=0; task<numTasks; task++) func(pArg, task);
+}
+
+/** Returns a buffer for the intermediate results of processing an array, from the scratch arena of the
+  * calling thread.  The buffer is valid until processCallbacks() or processCallbacksBatch() returns, and
+  * the memory is reused for the next arrays, so when they are the same size there are no allocations.
+  * The ScratchMemory parameter is the memory of the arenas of all of the threads.
+  * This can be called without the lock, from processCallbacksUnlocked(), but only by the thread that called
+  * processCallbacks(), not by the functions run by parallelForRows() and parallelForTasks(); give those
+  * slices of a buffer instead.
+  * \param[in] bytes The size of the buffer.
+  * \return The buffer, aligned to ND_SCRATCH_ALIGNMENT and not initialized, or NULL if there is not enough memory.
+  */
+void* NDPluginDriver::scratchBuffer(size_t bytes)
+{
+    NDScratchArena *pArena = (NDScratchArena *)epicsThreadPrivateGet(scratchArenaId_);
+    size_t capacity;
+    void *pBuffer;
+
+    if (!pArena) {
+        pArena = new NDScratchArena();
+        epicsThreadPrivateSet(scratchArenaId_, pArena);
+        epicsMutexLock(scratchLock_);
+        scratchArenas_.push_back(pArena);
+        epicsMutexUnlock(scratchLock_);
+    }
+    capacity = pArena->capacity();
+    pBuffer = pArena->alloc(bytes);
+    epicsAtomicAddSizeT(&scratchBytes_, pArena->capacity() - capacity);
+    return pBuffer;
+}
+
+/** Frees the buffers that scratchBuffer() returned to the calling thread, keeping the memory for the next array.
+  * This is called with the lock held after processCallbacks() and processCallbacksBatch(). */
+void NDPluginDriver::resetScratchArena()
+{
+    NDScratchArena *pArena = (NDScratchArena *)epicsThreadPrivateGet(scratchArenaId_);
+    size_t capacity;
+
+    if (!pArena) return;
+    capacity = pArena->capacity();
+    pArena->reset();
+    if (pArena->capacity() >= capacity) {
+        epicsAtomicAddSizeT(&scratchBytes_, pArena->capacity() - capacity);
+    } else {
+        epicsAtomicSubSizeT(&scratchBytes_, capacity - pArena->capacity());
+    }
+    setDoubleParam(NDPluginDriverScratchMemory, epicsAtomicGetSizeT(&scratchBytes_) / 1048576.);
+}
+
+/** Frees the scratch arena of the calling thread; called by the plugin threads when they exit */
+void NDPluginDriver::freeScratchArena()
+{
+    NDScratchArena *pArena = (NDScratchArena *)epicsThreadPrivateGet(scratchArenaId_);
+
+    if (!pArena) return;
+    epicsThreadPrivateSet(scratchArenaId_, NULL);
+    epicsMutexLock(scratchLock_);
+    scratchArenas_.erase(std::find(scratchArenas_.begin(), scratchArenas_.end(), pArena));
+    epicsMutexUnlock(scratchLock_);
+    epicsAtomicSubSizeT(&scratchBytes_, pArena->capacity());
+    delete pArena;
+}
+
 
+
+/** Sets the CPU affinity of the callback threads to the CPUs of a NUMA node.
+  * This should be the node that the NDArrayPool of the driver binds its buffers to,
+  * see NDArrayPool::setNumaPolicy(). The threads change their affinity before processing the next NDArray.
+  * \param[in] node The NUMA node; -1 allows the threads to run on all CPUs.
+  */
+asynStatus NDPluginDriver::setNumaNode(int node)
+{
+    static const char *functionName = "setNumaNode";
+
+    if ((node < -1) || (node >= NDNumaNumNodes())) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s invalid NUMA node=%d, number of nodes=%d\n",
+            driverName, functionName, node, NDNumaNumNodes());
+        return asynError;
+    }
+    this->lock();
+    numaNode_ = node;
+    if (node >= 0) affinitySet_ = true;
+    threadConfigChanged();
+    this->unlock();
+    return asynSuccess;
+}
+
+/** Sets the CPUs that the callback threads and the sorting thread run on.
+  * The threads change their affinity before processing the next NDArray.
+  * \param[in] cpuList The CPUs, in the form "2,4-7"; an empty string allows the threads to run on all CPUs,
+  *            or on the CPUs of the NUMA node set with setNumaNode().
+  */
+asynStatus NDPluginDriver::setThreadAffinity(const char *cpuList)
+{
+    this->lock();
+    setStringParam(NDPluginDriverCpuAffinity, cpuList);
+    if (cpuList[0]) affinitySet_ = true;
+    threadConfigChanged();
+    callParamCallbacks();
+    this->unlock();
+    return asynSuccess;
+}
+
+/** Sets the scheduling policy and priority of the callback threads and the sorting thread.
+  * The threads change their scheduling before processing the next NDArray.
+  * \param[in] policy One of the NDSchedPolicy_t values.
+  * \param[in] priority The real-time priority, 1-99, for NDSchedFIFO and NDSchedRR.
+  */
+asynStatus NDPluginDriver::setScheduler(int policy, int priority)
+{
+    static const char *functionName = "setScheduler";
+
+    if ((policy < NDSchedDefault) || (policy > NDSchedRR)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s invalid scheduling policy=%d\n",
+            driverName, functionName, policy);
+        return asynError;
+    }
+    this->lock();
+    setIntegerParam(NDPluginDriverSchedPolicy, policy);
+    setIntegerParam(NDPluginDriverSchedPriority, priority);
+    if (policy != NDSchedDefault) schedulerSet_ = true;
+    threadConfigChanged();
+    callParamCallbacks();
+    this->unlock();
+    return asynSuccess;
+}
+
+/** Makes this plugin run in the thread of its upstream plugin, as part of a fused chain.
+  * This sets BlockingCallbacks=1, which then cannot be changed, and deletes the input queue and the threads
+  * of this plugin, so each array is passed directly from the upstream plugin without a queue or a thread
+  * switch.  The parameters and interfaces of the plugin are unchanged.  Changing NDArrayPort ends the fusion.
+  * \param[in] upstreamPort The port of the upstream plugin, which must be the NDArrayPort of this plugin.
+  */
+asynStatus NDPluginDriver::fuseTo(const char *upstreamPort)
+{
+    char arrayPort[256];
+    int enableCallbacks;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "fuseTo";
+
+    this->lock();
+    getStringParam(NDPluginDriverArrayPort, sizeof(arrayPort), arrayPort);
+    if (strcmp(arrayPort, upstreamPort) != 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s port %s gets its arrays from %s, not %s\n",
+            driverName, functionName, portName, arrayPort, upstreamPort);
+        this->unlock();
+        return asynError;
+    }
+    fused_ = true;
+    setStringParam(NDPluginDriverFusedTo, upstreamPort);
+    setIntegerParam(NDPluginDriverBlockingCallbacks, 1);
+    status = deleteCallbackThreads();
+    /* deleteCallbackThreads() stops the callbacks from the upstream plugin */
+    getIntegerParam(NDPluginDriverEnableCallbacks, &enableCallbacks);
+    if (enableCallbacks) setArrayInterrupt(1);
+    callParamCallbacks();
+    this->unlock();
+    return status;
+}
+
+/** Tells the plugin threads to apply the CPU affinity and scheduling parameters again.
+  * This must be called with the lock held. */
+void NDPluginDriver::threadConfigChanged()
+{
+    threadConfigId_++;
+    /* Wake the sorting thread so it applies them without waiting for an array */
+    epicsEventSignal(sortEvent_);
+}
+
+/** Applies the CPU affinity and scheduling parameters to the calling thread if they have changed.
+  * The defaults are only applied once other values have been set, so threads keep the affinity
+  * and scheduling that they inherit until the plugin is configured.
+  * This must be called with the lock held.
+  * \param[in,out] pConfigId The value of threadConfigId_ that the thread last applied. */
+void NDPluginDriver::applyThreadConfig(int *pConfigId)
+{
+    char cpuList[256];
+    int policy, priority;
+    static const char *functionName = "applyThreadConfig";
+
+    if (*pConfigId == threadConfigId_) return;
+    *pConfigId = threadConfigId_;
+    if (affinitySet_) {
+        getStringParam(NDPluginDriverCpuAffinity, sizeof(cpuList), cpuList);
+        if (cpuList[0]) {
+            if (NDNumaPinThreadToCpus(cpuList) != ND_SUCCESS) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s::%s error setting CPU affinity of thread %s to CPUs %s\n",
+                    driverName, functionName, epicsThreadGetNameSelf(), cpuList);
+            }
+        } else if (NDNumaPinThread(numaNode_) != ND_SUCCESS) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s error setting CPU affinity of thread %s to NUMA node %d\n",
+                driverName, functionName, epicsThreadGetNameSelf(), numaNode_);
+        }
+    }
+    if (schedulerSet_) {
+        getIntegerParam(NDPluginDriverSchedPolicy, &policy);
+        getIntegerParam(NDPluginDriverSchedPriority, &priority);
+        if (NDNumaSetScheduler(policy, priority) != ND_SUCCESS) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s error setting scheduling policy=%d priority=%d of thread %s\n",
+                driverName, functionName, policy, priority, epicsThreadGetNameSelf());
+        }
+    }
+}
+
+/** Sets the NUMA node of the callback threads of a plugin.
+  * \param[in] portName The name of the plugin port.
+  * \param[in] node The NUMA node; -1 allows the threads to run on all CPUs.
+  */
+extern "C" int NDPluginSetNumaNode(const char *portName, int node)
+{
+    NDPluginDriver *pPlugin = (NDPluginDriver *)findAsynPortDriver(portName);
+
+    if (!pPlugin) {
+        printf("NDPluginSetNumaNode: cannot find port %s\n", portName);
+        return asynError;
+    }
+    return pPlugin->setNumaNode(node);
+}
+
+/** Sets the CPUs that the callback threads of a plugin run on.
+  * \param[in] portName The name of the plugin port.
+  * \param[in] cpuList The CPUs, in the form "2,4-7"; an empty string allows the threads to run on all CPUs.
+  */
+extern "C" int NDPluginSetThreadAffinity(const char *portName, const char *cpuList)
+{
+    NDPluginDriver *pPlugin = (NDPluginDriver *)findAsynPortDriver(portName);
+
+    if (!pPlugin) {
+        printf("NDPluginSetThreadAffinity: cannot find port %s\n", portName);
+        return asynError;
+    }
+    return pPlugin->setThreadAffinity(cpuList ? cpuList : "");
+}
+
+/** Sets the scheduling policy of the callback threads of a plugin.
+  * \param[in] portName The name of the plugin port.
+  * \param[in] policy 0=default time-sharing, 1=SCHED_FIFO, 2=SCHED_RR.
+  * \param[in] priority The real-time priority, 1-99, for policies 1 and 2.
+  */
+extern "C" int NDPluginSetScheduler(const char *portName, int policy, int priority)
+{
+    NDPluginDriver *pPlugin = (NDPluginDriver *)findAsynPortDriver(portName);
+
+    if (!pPlugin) {
+        printf("NDPluginSetScheduler: cannot find port %s\n", portName);
+        return asynError;
+    }
+    return pPlugin->setScheduler(policy, priority);
+}
+
+/** Fuses a chain of plugins, so that each array is processed by all of them in the thread of the first one.
+  * Each plugin after the first must get its arrays from the one before it.
+  * \param[in] portNames The ports of the plugins in the order of the chain, separated by spaces or commas.
+  */
+extern "C" int NDPluginFuseChain(const char *portNames)
+{
+    char list[1024];
+    char *pToken, *pSave;
+    std::vector<NDPluginDriver*> plugins;
+    std::vector<const char*> names;
+    int status = asynSuccess;
+    size_t i;
+
+    if (!portNames) {
+        printf("Usage: NDPluginFuseChain \"port1 port2 ...\"\n");
+        return asynError;
+    }
+    strncpy(list, portNames, sizeof(list)-1);
+    list[sizeof(list)-1] = 0;
+    for (pToken = strtok_r(list, ", ", &pSave); pToken; pToken = strtok_r(NULL, ", ", &pSave)) {
+        NDPluginDriver *pPlugin = (NDPluginDriver *)findAsynPortDriver(pToken);
+        if (!pPlugin) {
+            printf("NDPluginFuseChain: cannot find port %s\n", pToken);
+            return asynError;
+        }
+        plugins.push_back(pPlugin);
+        names.push_back(pToken);
+    }
+    for (i=1; i<plugins.size(); i++) {
+        if (plugins[i]->fuseTo(names[i-1]) != asynSuccess) {
+            printf("NDPluginFuseChain: cannot fuse %s to %s\n", names[i], names[i-1]);
+            status = asynError;
+        }
+    }
+    return status;
+}
+
+/** Creates the executor threads that plugins with UseExecutor=1 share.
+  * This must be called before iocInit; otherwise the executor is created with one thread per CPU
+  * the first time a plugin uses it.
+  * \param[in] numThreads The number of threads; 0 uses one thread per CPU.
+  */
+extern "C" int NDPluginExecutorConfigure(int numThreads)
+{
+    return NDPluginExecutor::configure(numThreads);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg fuseChainArg0 = {"portNames", iocshArgString};
+static const iocshArg * const fuseChainArgs[] = {&fuseChainArg0};
+static const iocshFuncDef fuseChainFuncDef = {"NDPluginFuseChain", 1, fuseChainArgs};
+static void fuseChainCallFunc(const iocshArgBuf *args)
+{
+    NDPluginFuseChain(args[0].sval);
+}
+
+static const iocshArg traceEnableArg0 = {"enable", iocshArgInt};
+static const iocshArg traceEnableArg1 = {"eventsPerThread", iocshArgInt};
+static const iocshArg * const traceEnableArgs[] = {&traceEnableArg0,
+                                                   &traceEnableArg1};
+static const iocshFuncDef traceEnableFuncDef = {"NDTraceEnable", 2, traceEnableArgs};
+static void traceEnableCallFunc(const iocshArgBuf *args)
+{
+    NDTraceEnable(args[0].ival, args[1].ival);
+}
+
+static const iocshArg traceDumpArg0 = {"fileName", iocshArgString};
+static const iocshArg * const traceDumpArgs[] = {&traceDumpArg0};
+static const iocshFuncDef traceDumpFuncDef = {"NDTraceDump", 1, traceDumpArgs};
+static void traceDumpCallFunc(const iocshArgBuf *args)
+{
+    if (!args[0].sval) {
+        printf("Usage: NDTraceDump fileName\n");
+        return;
+    }
+    NDTraceDump(args[0].sval);
+}
+
+
+static const iocshArg pipelineReportArg0 = {"fileName", iocshArgString};
+static const iocshArg pipelineReportArg1 = {"period", iocshArgDouble};
+static const iocshArg * const pipelineReportArgs[] = {&pipelineReportArg0,
+                                                      &pipelineReportArg1};
+static const iocshFuncDef pipelineReportFuncDef = {"NDPipelineReport", 2, pipelineReportArgs};
+static void pipelineReportCallFunc(const iocshArgBuf *args)
+{
+    NDPipelineReport(args[0].sval, args[1].dval);
+}
+
+static const iocshArg setNumaNodeArg0 = {"portName", iocshArgString};
+static const iocshArg setNumaNodeArg1 = {"node", iocshArgInt};
+static const iocshArg * const setNumaNodeArgs[] = {&setNumaNodeArg0,
+                                                   &setNumaNodeArg1};
+static const iocshFuncDef setNumaNodeFuncDef = {"NDPluginSetNumaNode", 2, setNumaNodeArgs};
+static void setNumaNodeCallFunc(const iocshArgBuf *args)
+{
+    NDPluginSetNumaNode(args[0].sval, args[1].ival);
+}
+
+static const iocshArg setThreadAffinityArg0 = {"portName", iocshArgString};
+static const iocshArg setThreadAffinityArg1 = {"cpuList", iocshArgString};
+static const iocshArg * const setThreadAffinityArgs[] = {&setThreadAffinityArg0,
+                                                         &setThreadAffinityArg1};
+static const iocshFuncDef setThreadAffinityFuncDef = {"NDPluginSetThreadAffinity", 2, setThreadAffinityArgs};
+static void setThreadAffinityCallFunc(const iocshArgBuf *args)
+{
+    NDPluginSetThreadAffinity(args[0].sval, args[1].sval);
+}
+
+static const iocshArg setSchedulerArg0 = {"portName", iocshArgString};
+static const iocshArg setSchedulerArg1 = {"policy", iocshArgInt};
+static const iocshArg setSchedulerArg2 = {"priority", iocshArgInt};
+static const iocshArg * const setSchedulerArgs[] = {&setSchedulerArg0,
+                                                    &setSchedulerArg1,
+                                                    &setSchedulerArg2};
+static const iocshFuncDef setSchedulerFuncDef = {"NDPluginSetScheduler", 3, setSchedulerArgs};
+static void setSchedulerCallFunc(const iocshArgBuf *args)
+{
+    NDPluginSetScheduler(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg executorConfigureArg0 = {"numThreads", iocshArgInt};
+static const iocshArg * const executorConfigureArgs[] = {&executorConfigureArg0};
+static const iocshFuncDef executorConfigureFuncDef = {"NDPluginExecutorConfigure", 1, executorConfigureArgs};
+static void executorConfigureCallFunc(const iocshArgBuf *args)
+{
+    NDPluginExecutorConfigure(args[0].ival);
+}
+
+extern "C" void NDPluginDriverRegister(void)
+{
+    iocshRegister(&setNumaNodeFuncDef, setNumaNodeCallFunc);
+    iocshRegister(&setThreadAffinityFuncDef, setThreadAffinityCallFunc);
+    iocshRegister(&setSchedulerFuncDef, setSchedulerCallFunc);
+    iocshRegister(&executorConfigureFuncDef, executorConfigureCallFunc);
+    iocshRegister(&fuseChainFuncDef, fuseChainCallFunc);
+    iocshRegister(&traceEnableFuncDef, traceEnableCallFunc);
+    iocshRegister(&traceDumpFuncDef, traceDumpCallFunc);
+    iocshRegister(&pipelineReportFuncDef, pipelineReportCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDPluginDriverRegister);
+}
@@ -1,17 +1,26 @@
 #ifndef NDPluginDriver_H
 #define NDPluginDriver_H
 
-#include <set>
+#include <vector>
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
+#include <epicsEvent.h>
 #include <epicsTime.h>
+#include <epicsTimer.h>
 
 #include "asynNDArrayDriver.h"
+#include "NDLockFreeQueue.h"
+#include "NDWorkerPool.h"
+#include "NDLatencyHistogram.h"
+#include "NDPerfCounters.h"
+#include "NDPipelineReport.h"
+#include "NDProcessExpression.h"
+#include "NDScratchArena.h"
 
 
-// This class defines the object that is contained in the std::multilist for sorting output NDArrays
-// It contains a pointer to the NDArray and the time that the object was added to the list
+// This class defines the slots of the reorder ring for sorting output NDArrays
+// It contains a pointer to the NDArray and the time that the array was put in the ring
 // It defines the < operator to use the NDArray::uniqueId field as the sort key
 
 // We would like to hide this class definition in NDPluginDriver.cpp and just forward reference it here.
@@ -29,26 +38,123 @@ class sortedListElement {
         epicsTimeStamp insertionTime_;
 };
 
+/** What driverCallback() does with an array when the input queue is full */
+typedef enum {
+    NDPluginOverflowDropNewest,     /**< Drop the new array */
+    NDPluginOverflowDropOldest,     /**< Drop the oldest queued array to make room for the new one */
+    NDPluginOverflowBlock,          /**< Wait up to OverflowTimeout for room, then drop the new array */
+    NDPluginOverflowBackpressure    /**< Wait for room however long it takes, slowing the upstream driver or plugin */
+} NDPluginOverflowPolicy_t;
+
+/** Copy of the values of asynInt32 and asynFloat64 parameters of a plugin, indexed by parameter index.
+  * NDPluginDriver::processCallbacks() takes one with the lock held for each array and passes it to
+  * processCallbacksUnlocked(), which reads it without the lock.  A second one carries the values that
+  * processCallbacksUnlocked() sets back to the parameter library. */
+class epicsShareClass NDPluginParamSnapshot {
+public:
+    epicsInt32 getInteger(int index) const;
+    double getDouble(int index) const;
+    void setInteger(int index, epicsInt32 value);
+    void setDouble(int index, double value);
+
+private:
+    friend class NDPluginDriver;
+    enum { paramNone, paramInteger, paramDouble };
+    void setType(int index, char type);
+    std::vector<char> types_;
+    std::vector<epicsInt32> integers_;
+    std::vector<double> doubles_;
+};
+
 #define NDPluginDriverArrayPortString           "NDARRAY_PORT"          /**< (asynOctet,    r/w) The port for the NDArray interface */
 #define NDPluginDriverArrayAddrString           "NDARRAY_ADDR"          /**< (asynInt32,    r/w) The address on the port */
 #define NDPluginDriverPluginTypeString          "PLUGIN_TYPE"           /**< (asynOctet,    r/o) The type of plugin */
 #define NDPluginDriverDroppedArraysString       "DROPPED_ARRAYS"        /**< (asynInt32,    r/w) Number of dropped input arrays */
+#define NDPluginDriverMaxAgeString              "MAX_AGE"               /**< (asynFloat64,  r/w) Arrays older than this when they are taken
+                                                                         *  from the queue are dropped (ms, 0=no limit) */
+#define NDPluginDriverMaxAgeSourceString        "MAX_AGE_SOURCE"        /**< (asynInt32,    r/w) Age of an array from 0=the time it was queued,
+                                                                         *  1=its epicsTS */
+#define NDPluginDriverExpiredArraysString       "EXPIRED_ARRAYS"        /**< (asynInt32,    r/w) Number of input arrays dropped for MaxAge */
+#define NDPluginDriverPoolQuotaString           "POOL_QUOTA"            /**< (asynInt32,    r/w) Most arrays of the pool of each upstream port
+                                                                         *  that the queue may hold (0=no limit) */
+#define NDPluginDriverPoolHeldString            "POOL_HELD"             /**< (asynInt32,    r/o) Number of upstream arrays the queue holds */
+#define NDPluginDriverPoolQuotaDropsString      "POOL_QUOTA_DROPS"      /**< (asynInt32,    r/w) Number of input arrays dropped for PoolQuota */
 #define NDPluginDriverQueueSizeString           "QUEUE_SIZE"            /**< (asynInt32,    r/w) Total queue elements */ 
 #define NDPluginDriverQueueFreeString           "QUEUE_FREE"            /**< (asynInt32,    r/w) Free queue elements */
 #define NDPluginDriverMaxThreadsString          "MAX_THREADS"           /**< (asynInt32,    r/w) Maximum number of threads */ 
 #define NDPluginDriverNumThreadsString          "NUM_THREADS"           /**< (asynInt32,    r/w) Number of threads */
+#define NDPluginDriverLockFreeQueueString       "LOCK_FREE_QUEUE"       /**< (asynInt32,    r/w) Use a lock-free input queue (1=Yes, 0=No) */
+#define NDPluginDriverBatchSizeString           "BATCH_SIZE"            /**< (asynInt32,    r/w) Maximum number of queued arrays passed to
+                                                                         *  processCallbacksBatch (1=no batching) */
+#define NDPluginDriverUseExecutorString         "USE_EXECUTOR"          /**< (asynInt32,    r/w) Process arrays in the shared executor threads
+                                                                         *  instead of threads of this plugin (1=Yes, 0=No) */
+#define NDPluginDriverAutoScaleString           "AUTO_SCALE"            /**< (asynInt32,    r/w) Start and park threads with the queue occupancy
+                                                                         *  (1=Yes, 0=No) */
+#define NDPluginDriverAutoScaleMinString        "AUTO_SCALE_MIN"        /**< (asynInt32,    r/w) Minimum number of active threads for AutoScale */
+#define NDPluginDriverAutoScaleMaxString        "AUTO_SCALE_MAX"        /**< (asynInt32,    r/w) Maximum number of active threads for AutoScale */
+#define NDPluginDriverAutoScaleHighString       "AUTO_SCALE_HIGH"       /**< (asynInt32,    r/w) Queue fill (%) at which a thread is started */
+#define NDPluginDriverAutoScaleLowString        "AUTO_SCALE_LOW"        /**< (asynInt32,    r/w) Queue fill (%) below which a thread may be parked */
+#define NDPluginDriverAutoScalePeriodString     "AUTO_SCALE_PERIOD"     /**< (asynFloat64,  r/w) Minimum time between changes of the number
+                                                                         *  of active threads (s) */
+#define NDPluginDriverActiveThreadsString       "ACTIVE_THREADS"        /**< (asynInt32,    r/o) Number of threads that are not parked */
+#define NDPluginDriverIntraFrameThreadsString   "INTRA_FRAME_THREADS"   /**< (asynInt32,    r/w) Number of extra threads that process the row
+                                                                         *  stripes or tasks of one array, for plugins that use parallelForRows or parallelForTasks */
+#define NDPluginDriverCpuAffinityString        "CPU_AFFINITY"          /**< (asynOctet,    r/w) CPUs the plugin threads run on, e.g. "2,4-7";
+                                                                         *  empty for all CPUs or the NUMA node set with NDPluginSetNumaNode */
+#define NDPluginDriverSchedPolicyString         "SCHED_POLICY"          /**< (asynInt32,    r/w) Scheduling policy of the plugin threads,
+                                                                         *  see NDSchedPolicy_t */
+#define NDPluginDriverSchedPriorityString       "SCHED_PRIORITY"        /**< (asynInt32,    r/w) Real-time priority for SchedPolicy FIFO or RR */
+#define NDPluginDriverOverflowPolicyString      "OVERFLOW_POLICY"       /**< (asynInt32,    r/w) What to do when the queue is full,
+                                                                         *  see NDPluginOverflowPolicy_t */
+#define NDPluginDriverOverflowTimeoutString     "OVERFLOW_TIMEOUT"      /**< (asynFloat64,  r/w) Maximum time to wait for room in the queue
+                                                                         *  for OverflowPolicy=Block */
+#define NDPluginDriverBlockedTimeString         "BLOCKED_TIME"          /**< (asynFloat64,  r/w) Total time in seconds that callbacks have
+                                                                         *  waited for room in the queue */
 #define NDPluginDriverSortModeString            "SORT_MODE"             /**< (asynInt32,    r/w) sorted callback mode */
 #define NDPluginDriverSortTimeString            "SORT_TIME"             /**< (asynFloat64,  r/w) sorted callback time */
-#define NDPluginDriverSortSizeString            "SORT_SIZE"             /**< (asynInt32,    r/o) std::multiset maximum # elements */
-#define NDPluginDriverSortFreeString            "SORT_FREE"             /**< (asynInt32,    r/o) std::multiset free elements */
+#define NDPluginDriverSortSizeString            "SORT_SIZE"             /**< (asynInt32,    r/w) reorder ring maximum # elements */
+#define NDPluginDriverSortFreeString            "SORT_FREE"             /**< (asynInt32,    r/o) reorder ring free elements */
 #define NDPluginDriverDisorderedArraysString    "DISORDERED_ARRAYS"     /**< (asynInt32,    r/o) Number of out of order output arrays */
 #define NDPluginDriverDroppedOutputArraysString "DROPPED_OUTPUT_ARRAYS" /**< (asynInt32,    r/o) Number of dropped output arrays */
 #define NDPluginDriverEnableCallbacksString     "ENABLE_CALLBACKS"      /**< (asynInt32,    r/w) Enable callbacks from driver (1=Yes, 0=No) */
 #define NDPluginDriverBlockingCallbacksString   "BLOCKING_CALLBACKS"    /**< (asynInt32,    r/w) Callbacks block (1=Yes, 0=No) */
+#define NDPluginDriverFusedToString             "FUSED_TO"              /**< (asynOctet,    r/o) Upstream plugin that this plugin is fused to
+                                                                         *  with NDPluginFuseChain, empty if none */
 #define NDPluginDriverProcessPluginString       "PROCESS_PLUGIN"        /**< (asynInt32,    r/w) Process plugin with last callback array */
 #define NDPluginDriverExecutionTimeString       "EXECUTION_TIME"        /**< (asynFloat64,  r/o) The last execution time (milliseconds) */
+#define NDPluginDriverQueueTimeP50String        "QUEUE_TIME_P50"        /**< (asynFloat64,  r/o) Median time arrays wait in the queue (ms) */
+#define NDPluginDriverQueueTimeP99String        "QUEUE_TIME_P99"        /**< (asynFloat64,  r/o) 99th percentile of the queue time (ms) */
+#define NDPluginDriverQueueTimeMaxString        "QUEUE_TIME_MAX"        /**< (asynFloat64,  r/o) Maximum queue time (ms) */
+#define NDPluginDriverProcessTimeP50String      "PROCESS_TIME_P50"      /**< (asynFloat64,  r/o) Median processing time of an array (ms) */
+#define NDPluginDriverProcessTimeP99String      "PROCESS_TIME_P99"      /**< (asynFloat64,  r/o) 99th percentile of the processing time (ms) */
+#define NDPluginDriverProcessTimeMaxString      "PROCESS_TIME_MAX"      /**< (asynFloat64,  r/o) Maximum processing time (ms) */
+#define NDPluginDriverLatencyP50String          "LATENCY_P50"           /**< (asynFloat64,  r/o) Median time from the array epicsTS to the end
+                                                                         *  of processing (ms) */
+#define NDPluginDriverLatencyP99String          "LATENCY_P99"           /**< (asynFloat64,  r/o) 99th percentile of the latency (ms) */
+#define NDPluginDriverLatencyMaxString          "LATENCY_MAX"           /**< (asynFloat64,  r/o) Maximum latency (ms) */
+#define NDPluginDriverLatencyWindowString       "LATENCY_WINDOW"        /**< (asynInt32,    r/w) Number of arrays in each half of the rolling
+                                                                         *  latency histograms (0=all arrays since reset) */
+#define NDPluginDriverLatencyResetString        "LATENCY_RESET"         /**< (asynInt32,    r/w) Reset the latency histograms */
+#define NDPluginDriverPerfCountersString        "PERF_COUNTERS"         /**< (asynInt32,    r/w) Count the CPU events of processCallbacks with the
+                                                                         *  hardware performance counters (1=Yes, 0=No) */
+#define NDPluginDriverPerfCyclesString          "PERF_CYCLES"           /**< (asynFloat64,  r/o) CPU cycles processing the last array */
+#define NDPluginDriverPerfIPCString             "PERF_IPC"              /**< (asynFloat64,  r/o) Instructions per cycle of the last array */
+#define NDPluginDriverPerfCacheMissesString     "PERF_CACHE_MISSES"     /**< (asynFloat64,  r/o) Last level cache misses per element of
+                                                                         *  the last array */
+#define NDPluginDriverPerfBranchMissesString    "PERF_BRANCH_MISSES"    /**< (asynFloat64,  r/o) Branch misses per element of the last array */
 #define NDPluginDriverMinCallbackTimeString     "MIN_CALLBACK_TIME"     /**< (asynFloat64,  r/w) Minimum time between calling processCallbacks 
                                                                          *  to execute plugin code */
+#define NDPluginDriverDecimateString            "DECIMATE"              /**< (asynInt32,    r/w) Only process the arrays whose index is a multiple
+                                                                         *  of this (0 or 1=all arrays) */
+#define NDPluginDriverDecimateAttributeString   "DECIMATE_ATTRIBUTE"    /**< (asynOctet,    r/w) NDAttribute whose value is the index of an array
+                                                                         *  for Decimate; empty for the uniqueId */
+#define NDPluginDriverVetoExpressionString      "VETO_EXPRESSION"       /**< (asynOctet,    r/w) Expression of the NDAttributes of an array; the
+                                                                         *  arrays for which it is not 0 are vetoed, empty for none */
+#define NDPluginDriverVetoErrorString           "VETO_ERROR"            /**< (asynOctet,    r/o) Error compiling VetoExpression */
+#define NDPluginDriverVetoedArraysString        "VETOED_ARRAYS"         /**< (asynInt32,    r/w) Number of arrays vetoed */
+#define NDPluginDriverScratchMemoryString       "SCRATCH_MEMORY"        /**< (asynFloat64,  r/o) Memory of the scratch arenas of the threads (MB) */
+#define NDPluginDriverStatusUpdatePeriodString  "STATUS_UPDATE_PERIOD"  /**< (asynFloat64,  r/w) Minimum time between the parameter callbacks
+                                                                         *  done for each array (ms, 0=every array) */
 /** Class from which actual plugin drivers are derived; derived from asynNDArrayDriver */
 class epicsShareClass NDPluginDriver : public asynNDArrayDriver, public epicsThreadRunable {
 public:
@@ -60,6 +166,7 @@ public:
 
     /* These are the methods that we override from asynNDArrayDriver */
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
     virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars,
                           size_t *nActual);
     virtual asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *value,
@@ -70,13 +177,40 @@ public:
     virtual void run(void);
     virtual asynStatus start(void);
     void sortingTask();
+    void executorTask();
+    void statusTimerCallback();
+    asynStatus setNumaNode(int node);
+    asynStatus setThreadAffinity(const char *cpuList);
+    asynStatus setScheduler(int policy, int priority);
+    asynStatus fuseTo(const char *upstreamPort);
+    int queuePending();
+    double expectedWait();
+    void getPipelineNode(NDPipelineNode_t *pNode);
+
+    static NDPluginDriver* fromArrayInterrupt(asynGenericPointerInterrupt *pInterrupt);
+    static void getPlugins(std::vector<NDPluginDriver*> &plugins);
 
 protected:
-    virtual void processCallbacks(NDArray *pArray) = 0;
+    virtual void processCallbacks(NDArray *pArray);
+    virtual void processCallbacksBatch(NDArray **ppArrays, int numArrays);
+    virtual NDArray* processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                              NDPluginParamSnapshot &results);
     virtual void beginProcessCallbacks(NDArray *pArray);
+    void setArrayDimensions(NDArray *pArray);
     virtual asynStatus endProcessCallbacks(NDArray *pArray, bool copyArray=false, bool readAttributes=true);
     virtual asynStatus connectToArrayPort(void);    
     virtual asynStatus setArrayInterrupt(int connect);
+    asynStatus addSnapshotParam(int index);
+    void takeParamSnapshot(NDPluginParamSnapshot &params);
+    void applyParamSnapshot(const NDPluginParamSnapshot &results);
+    int numStripes(size_t numRows);
+    void callStatusCallbacks();
+    virtual void doStatusCallbacks();
+    bool hasArrayClients();
+    NDArray* referenceArray(NDArray *pArray, bool readAttributes);
+    void parallelForRows(NDStripeTask func, void *pArg, size_t numRows, int numStripes);
+    void parallelForTasks(NDWorkerTask func, void *pArg, int numTasks);
+    void* scratchBuffer(size_t bytes);
 
 protected:
     int NDPluginDriverArrayPort;
@@ -84,10 +218,33 @@ protected:
     int NDPluginDriverArrayAddr;
     int NDPluginDriverPluginType;
     int NDPluginDriverDroppedArrays;
+    int NDPluginDriverMaxAge;
+    int NDPluginDriverMaxAgeSource;
+    int NDPluginDriverExpiredArrays;
+    int NDPluginDriverPoolQuota;
+    int NDPluginDriverPoolHeld;
+    int NDPluginDriverPoolQuotaDrops;
     int NDPluginDriverQueueSize;
     int NDPluginDriverQueueFree;
     int NDPluginDriverMaxThreads;
     int NDPluginDriverNumThreads;
+    int NDPluginDriverLockFreeQueue;
+    int NDPluginDriverBatchSize;
+    int NDPluginDriverUseExecutor;
+    int NDPluginDriverAutoScale;
+    int NDPluginDriverAutoScaleMin;
+    int NDPluginDriverAutoScaleMax;
+    int NDPluginDriverAutoScaleHigh;
+    int NDPluginDriverAutoScaleLow;
+    int NDPluginDriverAutoScalePeriod;
+    int NDPluginDriverActiveThreads;
+    int NDPluginDriverIntraFrameThreads;
+    int NDPluginDriverCpuAffinity;
+    int NDPluginDriverSchedPolicy;
+    int NDPluginDriverSchedPriority;
+    int NDPluginDriverOverflowPolicy;
+    int NDPluginDriverOverflowTimeout;
+    int NDPluginDriverBlockedTime;
     int NDPluginDriverSortMode;
     int NDPluginDriverSortTime;
     int NDPluginDriverSortSize;
@@ -96,18 +253,91 @@ protected:
     int NDPluginDriverDroppedOutputArrays;
     int NDPluginDriverEnableCallbacks;
     int NDPluginDriverBlockingCallbacks;
+    int NDPluginDriverFusedTo;
     int NDPluginDriverProcessPlugin;
     int NDPluginDriverExecutionTime;
     int NDPluginDriverMinCallbackTime;
+    int NDPluginDriverDecimate;
+    int NDPluginDriverDecimateAttribute;
+    int NDPluginDriverVetoExpression;
+    int NDPluginDriverVetoError;
+    int NDPluginDriverVetoedArrays;
+    int NDPluginDriverScratchMemory;
+    int NDPluginDriverStatusUpdatePeriod;
+    int NDPluginDriverQueueTimeP50;
+    int NDPluginDriverQueueTimeP99;
+    int NDPluginDriverQueueTimeMax;
+    int NDPluginDriverProcessTimeP50;
+    int NDPluginDriverProcessTimeP99;
+    int NDPluginDriverProcessTimeMax;
+    int NDPluginDriverLatencyP50;
+    int NDPluginDriverLatencyP99;
+    int NDPluginDriverLatencyMax;
+    int NDPluginDriverLatencyWindow;
+    int NDPluginDriverLatencyReset;
+    int NDPluginDriverPerfCounters;
+    int NDPluginDriverPerfCycles;
+    int NDPluginDriverPerfIPC;
+    int NDPluginDriverPerfCacheMisses;
+    int NDPluginDriverPerfBranchMisses;
 
     NDArray *pPrevInputArray_;
+    bool supportsStridedViews_;   /**< Derived classes set this if processCallbacks() handles non-contiguous views */
+    bool supportsCompressedArrays_; /**< Derived classes set this if processCallbacks() handles arrays whose
+                                      *  data is compressed, see NDArray::codec; other plugins drop them */
+    bool supportsPackedArrays_;   /**< Derived classes set this if processCallbacks() handles the packed data types;
+                                    *  other plugins are given the arrays unpacked to UInt16 */
+    bool supportsSparseArrays_;   /**< Derived classes set this if processCallbacks() handles sparse arrays, see
+                                    *  NDArray::sparse; other plugins are given the arrays densified */
+    bool supportsDeviceArrays_;   /**< Derived classes set this if processCallbacks() handles arrays in the memory of
+                                    *  a device, see NDArray::pDevice; other plugins are given copies in host memory */
+    bool passArraysByReference_;  /**< Derived classes set this if they do not modify the arrays that they pass to
+                                    *  endProcessCallbacks() with copyArray=true, which then outputs views of them */
+    bool reportsOwnDimensions_;   /**< Derived classes set this if they report the dimensions of the arrays they
+                                    *  publish with setArrayDimensions(), so beginProcessCallbacks() does not */
 
 private:
     void processTask();
+    void callProcessCallbacks(NDArray *pArray);
+    void callProcessCallbacksBatch(NDArray **ppArrays, int numArrays);
+    bool acceptArray(NDArray *pArray);
+    int prepareArray(NDArray *pArray, NDArray **ppOut);
+    void processQueuedArrays(NDArray **ppArrays, epicsTimeStamp *pEnqueueTimes, int numArrays);
+    int dropExpiredArrays(NDArray **ppArrays, epicsTimeStamp *pEnqueueTimes, int numArrays, const epicsTimeStamp *pNow);
+    int reserveQueued(NDArray *pArray);
+    void releaseQueued(NDArray *pArray);
+    void recordLatency(NDArray *pArray, const epicsTimeStamp *pEnqueueTime, const epicsTimeStamp *pStart,
+                       double processTime, const epicsTimeStamp *pEnd);
+    void setLatencyParams();
+    bool beginPerfCounters(NDPerfCounts_t *pStart);
+    void endPerfCounters(const NDPerfCounts_t *pStart, NDArray **ppArrays, int numArrays);
+    void doOutputCallbacks(NDArray *pArray);
+    void doArrayCallbacks(NDArray *pArray);
+    bool tryQueueArray(asynUser *pasynUser, NDArray *pArray);
+    bool decimateSelects(NDArray *pArray);
+    bool vetoes(NDArray *pArray);
+    void resetScratchArena();
+    void freeScratchArena();
+    void updateDirectQueue();
+    void sortArray(NDArray *pArray);
+    void emitSortedArrays(bool all);
+    void executorSchedule();
+    void autoScale(const epicsTimeStamp *pNow);
+    void setActiveThreads(int numThreads);
     asynStatus createCallbackThreads();
     asynStatus startCallbackThreads();
     asynStatus deleteCallbackThreads();
     asynStatus createSortingThread();
+    asynStatus setIntraFrameThreads(int numThreads);
+    void threadConfigChanged();
+    void applyThreadConfig(int *pConfigId);
+    int toThreadTrySend(void *pMessage, size_t size);
+    int toThreadSend(void *pMessage, size_t size);
+    int toThreadSend(void *pMessage, size_t size, double timeout);
+    int queueFullSend(void *pMessage, size_t size, asynUser *pasynUser);
+    int toThreadReceive(void *pMessage, size_t size);
+    int toThreadTryReceive(void *pMessage, size_t size);
+    int toThreadPending();
      
     /* The asyn interfaces we access as a client */
     void *asynGenericPointerInterruptPvt_;
@@ -116,18 +346,60 @@ private:
     int numThreads_;
     bool pluginStarted_;
     bool firstOutputArray_;
+    bool fused_;                                 /**< Runs in the thread of the upstream plugin, see fuseTo() */
     asynUser *pasynUserGenericPointer_;          /**< asynUser for connecting to NDArray driver */
     void *asynGenericPointerPvt_;                /**< Handle for connecting to NDArray driver */
     asynGenericPointer *pasynGenericPointer_;    /**< asyn interface for connecting to NDArray driver */
     bool connectedToArrayPort_;
     std::vector<epicsThread*>pThreads_;
     epicsMessageQueue *pToThreadMsgQ_;
+    NDLockFreeQueue *pToThreadLockFreeQ_;        /**< Used instead of pToThreadMsgQ_ when LockFreeQueue=1 */
+    bool useExecutor_;                           /**< The arrays are processed by NDPluginExecutor jobs */
+    epicsMutexId executorLock_;                  /**< Protects executorActive_ */
+    int executorActive_;                         /**< Number of executor jobs running or queued for this plugin */
+    int numBlockedSenders_;                      /**< Number of driverCallback() calls waiting for room in the queue */
+    int directQueue_;                            /**< 1 if upstream plugins can queue arrays with tryQueueArray(); only accessed with the epicsAtomic functions */
+    int directSenders_;                          /**< Number of tryQueueArray() calls in progress; only accessed with the epicsAtomic functions */
+    int decimate_;                               /**< Decimate for tryQueueArray(); only accessed with the epicsAtomic functions */
+    bool vetoEnabled_;                           /**< vetoExpression_ holds the compiled VetoExpression */
+    NDProcessExpression_t vetoExpression_;       /**< VetoExpression, compiled by writeOctet() */
+    epicsThreadPrivateId scratchArenaId_;        /**< The NDScratchArena of each thread that processes arrays */
+    epicsMutexId scratchLock_;                   /**< Protects scratchArenas_ */
+    std::vector<NDScratchArena*> scratchArenas_; /**< The arenas of all of the threads, freed by the destructor */
+    size_t scratchBytes_;                        /**< Total capacity of the arenas; only accessed with the epicsAtomic functions */
+    std::vector<asynGenericPointerInterrupt*> deferredClients_; /**< The clients that doArrayCallbacks() calls after queueing to the others */
+    NDPoolConsumer poolConsumer_;                /**< The consumer that the queued arrays are reserved for, with PoolQuota */
+    bool autoScale_;                             /**< AutoScale=1, pThreads_ has MaxThreads threads */
+    int activeThreads_;                          /**< The threads of pThreads_ from this index on are parked */
+    std::vector<epicsEventId> parkEvents_;       /**< Signalled to start each parked thread */
+    double busyTime_;                            /**< Time the threads processed arrays since the last autoScale() change */
+    int maxPending_;                             /**< Maximum number of queued arrays since the last autoScale() change */
+    epicsTimeStamp lastScaleTime_;
     epicsMessageQueue *pFromThreadMsgQ_;
-    std::multiset<sortedListElement> sortedNDArrayList_;
+    NDWorkerPool *pStripeWorkers_;               /**< Threads for parallelForRows and parallelForTasks when IntraFrameThreads > 0 */
+    epicsMutexId stripeLock_;                    /**< Held while pStripeWorkers_ is in use or being replaced */
+    int intraFrameThreads_;
+    std::vector<sortedListElement> sortRing_;    /**< Reorder ring of SortSize slots; array uniqueId goes in slot uniqueId % SortSize */
+    int numSorted_;                              /**< Number of arrays in sortRing_ */
+    epicsEventId sortEvent_;                     /**< Signalled when an array is put in sortRing_ */
     int prevUniqueId_;
     epicsThreadId sortingThreadId_;
     epicsTimeStamp lastProcessTime_;
+    epicsTimeStamp lastStatusTime_;              /**< Time of the last parameter callbacks done by callStatusCallbacks() */
+    bool statusPending_;                         /**< callStatusCallbacks() has deferred parameter callbacks */
+    bool statusTimerActive_;
+    epicsTimerQueueId statusTimerQueue_;
+    epicsTimerId statusTimer_;                   /**< Does the deferred parameter callbacks at the end of the period */
     int dimsPrev_[ND_ARRAY_MAX_DIMS];
+    int numaNode_;
+    int threadConfigId_;                         /**< Incremented when the CPU affinity or scheduling of the threads changes */
+    bool affinitySet_;                           /**< The CPU affinity has been changed from the default */
+    bool schedulerSet_;                          /**< The scheduling policy has been changed from the default */
+    NDLatencyHistogram queueTimeHist_;          /**< Time from driverCallback() queueing an array to a thread taking it */
+    NDLatencyHistogram processTimeHist_;        /**< Time processing an array */
+    NDLatencyHistogram latencyHist_;            /**< Time from the epicsTS of an array to the end of processing */
+    double recentProcessTime_;                   /**< Moving average of the processing time of an array (s) */
+    NDPluginParamSnapshot snapshotParams_;       /**< The parameters added with addSnapshotParam(); only the types are used */
 };
 
     
@@ -0,0 +1,273 @@
+/** NDPluginExecutor.cpp
+ *
+ * A group of worker threads shared by the plugins of an IOC.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+
+#include "NDPluginExecutor.h"
+
+static epicsThreadOnceId executorOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId executorLock;
+static NDPluginExecutor *pExecutor = 0;
+
+static void executorInit(void *)
+{
+  executorLock = epicsMutexMustCreate();
+}
+
+static void workerTaskC(void *drvPvt)
+{
+  NDPluginExecutor *pPvt = (NDPluginExecutor *)drvPvt;
+  pPvt->workerTask();
+}
+
+/** Constructor for the NDPluginExecutor class; starts the worker threads.
+  * \param[in] name The prefix of the names of the threads.
+  * \param[in] numThreads The number of worker threads; values < 1 are set to 1.
+  */
+NDPluginExecutor::NDPluginExecutor(const char *name, int numThreads)
+  : numThreads_(numThreads > 0 ? numThreads : 1), nextWorker_(0), numStarted_(0), numRunning_(0), exiting_(false)
+{
+  char threadName[48];
+  int i;
+
+  strncpy(name_, name, sizeof(name_)-1);
+  name_[sizeof(name_)-1] = 0;
+  idleLock_ = epicsMutexMustCreate();
+  exitEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  /* Create all of the workers before the threads look them up */
+  for (i=0; i<numThreads_; i++) {
+    executorWorker_t *pWorker = new executorWorker_t;
+    pWorker->lock = epicsMutexMustCreate();
+    pWorker->wakeEvent = epicsEventMustCreate(epicsEventEmpty);
+    pWorker->threadId = 0;
+    pWorker->numRun = 0;
+    pWorker->numStolen = 0;
+    workers_.push_back(pWorker);
+  }
+  numRunning_ = numThreads_;
+  for (i=0; i<numThreads_; i++) {
+    epicsSnprintf(threadName, sizeof(threadName), "%s_%d", name_, i);
+    epicsThreadMustCreate(threadName, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          workerTaskC, this);
+  }
+}
+
+/** Destructor for the NDPluginExecutor class; runs the jobs that are still queued and waits for the threads to exit. */
+NDPluginExecutor::~NDPluginExecutor()
+{
+  size_t i;
+
+  epicsMutexLock(idleLock_);
+  exiting_ = true;
+  epicsMutexUnlock(idleLock_);
+  for (i=0; i<workers_.size(); i++) epicsEventSignal(workers_[i]->wakeEvent);
+  epicsEventWait(exitEvent_);
+  for (i=0; i<workers_.size(); i++) {
+    epicsEventDestroy(workers_[i]->wakeEvent);
+    epicsMutexDestroy(workers_[i]->lock);
+    delete workers_[i];
+  }
+  epicsEventDestroy(exitEvent_);
+  epicsMutexDestroy(idleLock_);
+}
+
+/** Returns the IOC-wide executor, creating it with one thread per CPU if NDPluginExecutorConfigure was not called. */
+NDPluginExecutor* NDPluginExecutor::instance()
+{
+  NDPluginExecutor *pInstance;
+
+  epicsThreadOnce(&executorOnce, executorInit, 0);
+  epicsMutexLock(executorLock);
+  if (!pExecutor) pExecutor = new NDPluginExecutor("NDPluginExecutor", epicsThreadGetCPUs());
+  pInstance = pExecutor;
+  epicsMutexUnlock(executorLock);
+  return pInstance;
+}
+
+/** Creates the IOC-wide executor.  This must be called before any plugin uses it.
+  * \param[in] numThreads The number of worker threads; 0 uses one thread per CPU.
+  */
+int NDPluginExecutor::configure(int numThreads)
+{
+  int status = 0;
+
+  epicsThreadOnce(&executorOnce, executorInit, 0);
+  epicsMutexLock(executorLock);
+  if (pExecutor) {
+    printf("NDPluginExecutorConfigure: the executor already exists with %d threads\n", pExecutor->numThreads());
+    status = -1;
+  } else {
+    if (numThreads <= 0) numThreads = epicsThreadGetCPUs();
+    pExecutor = new NDPluginExecutor("NDPluginExecutor", numThreads);
+  }
+  epicsMutexUnlock(executorLock);
+  return status;
+}
+
+/** Returns the number of worker threads. */
+int NDPluginExecutor::numThreads()
+{
+  return numThreads_;
+}
+
+/** Returns the index of the worker that is the calling thread, or -1. Must be called with idleLock_ held. */
+int NDPluginExecutor::currentWorker()
+{
+  epicsThreadId self = epicsThreadGetIdSelf();
+  int i;
+
+  for (i=0; i<numStarted_; i++) {
+    if (workers_[i]->threadId == self) return i;
+  }
+  return -1;
+}
+
+/** Queues a job.  It runs once in one of the worker threads.
+  * \param[in] job The function that executes the job.
+  * \param[in] pArg The argument passed to job.
+  */
+void NDPluginExecutor::submit(NDExecutorJob job, void *pArg)
+{
+  executorJob_t newJob = {job, pArg};
+  executorWorker_t *pWorker;
+  int worker, wake = -1;
+  size_t i;
+
+  epicsMutexLock(idleLock_);
+  worker = currentWorker();
+  if (worker < 0) {
+    worker = nextWorker_;
+    nextWorker_ = (nextWorker_ + 1) % numThreads_;
+  }
+  epicsMutexUnlock(idleLock_);
+
+  pWorker = workers_[worker];
+  epicsMutexLock(pWorker->lock);
+  pWorker->jobs.push_back(newJob);
+  epicsMutexUnlock(pWorker->lock);
+
+  /* Wake the owner of the queue if it is idle, otherwise any idle worker, which will take the job */
+  epicsMutexLock(idleLock_);
+  for (i=0; i<idle_.size(); i++) {
+    if (idle_[i] == worker) break;
+  }
+  if (i == idle_.size()) i = idle_.size() - 1;
+  if (!idle_.empty()) {
+    wake = idle_[i];
+    idle_.erase(idle_.begin() + i);
+  }
+  epicsMutexUnlock(idleLock_);
+  if (wake >= 0) epicsEventSignal(workers_[wake]->wakeEvent);
+}
+
+/** Takes the oldest job from the queue of a worker, or the newest job from another queue. */
+bool NDPluginExecutor::takeJob(int worker, executorJob_t *pJob)
+{
+  executorWorker_t *pWorker = workers_[worker];
+  executorWorker_t *pOther;
+  bool found = false;
+  int i;
+
+  epicsMutexLock(pWorker->lock);
+  if (!pWorker->jobs.empty()) {
+    *pJob = pWorker->jobs.front();
+    pWorker->jobs.pop_front();
+    found = true;
+  }
+  epicsMutexUnlock(pWorker->lock);
+  if (found) return true;
+
+  for (i=1; i<numThreads_ && !found; i++) {
+    pOther = workers_[(worker + i) % numThreads_];
+    epicsMutexLock(pOther->lock);
+    if (!pOther->jobs.empty()) {
+      *pJob = pOther->jobs.back();
+      pOther->jobs.pop_back();
+      found = true;
+    }
+    epicsMutexUnlock(pOther->lock);
+  }
+  if (found) pWorker->numStolen++;
+  return found;
+}
+
+/** The loop of each worker thread.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDPluginExecutor::workerTask()
+{
+  executorWorker_t *pWorker;
+  executorJob_t job;
+  int worker;
+  size_t i;
+  bool last;
+
+  /* Each thread takes the next worker in the order it was created */
+  epicsMutexLock(idleLock_);
+  worker = numStarted_;
+  pWorker = workers_[worker];
+  pWorker->threadId = epicsThreadGetIdSelf();
+  numStarted_++;
+  epicsMutexUnlock(idleLock_);
+
+  while (1) {
+    if (takeJob(worker, &job)) {
+      job.job(job.pArg);
+      pWorker->numRun++;
+      continue;
+    }
+    /* Register as idle before looking again, so that a job submitted after the last look wakes this worker */
+    epicsMutexLock(idleLock_);
+    if (exiting_) {
+      epicsMutexUnlock(idleLock_);
+      break;
+    }
+    idle_.push_back(worker);
+    epicsMutexUnlock(idleLock_);
+    if (!takeJob(worker, &job)) {
+      epicsEventWait(pWorker->wakeEvent);
+      job.job = 0;
+    }
+    epicsMutexLock(idleLock_);
+    for (i=0; i<idle_.size(); i++) {
+      if (idle_[i] == worker) {
+        idle_.erase(idle_.begin() + i);
+        break;
+      }
+    }
+    epicsMutexUnlock(idleLock_);
+    if (job.job) {
+      job.job(job.pArg);
+      pWorker->numRun++;
+    }
+  }
+  /* The last thread to exit tells the destructor, after it has finished with the mutex */
+  epicsMutexLock(idleLock_);
+  last = (--numRunning_ == 0);
+  epicsMutexUnlock(idleLock_);
+  if (last) epicsEventSignal(exitEvent_);
+}
+
+/** Reports the number of jobs each worker has run.
+  * \param[in] fp File pointer for the report output.
+  * \param[in] details The level of detail of the report; 0 prints only the number of threads.
+  */
+void NDPluginExecutor::report(FILE *fp, int details)
+{
+  size_t i;
+
+  fprintf(fp, "NDPluginExecutor %s: %d threads\n", name_, numThreads_);
+  if (details < 1) return;
+  for (i=0; i<workers_.size(); i++) {
+    epicsMutexLock(workers_[i]->lock);
+    fprintf(fp, "  worker %d: queued=%d run=%lu stolen=%lu\n", (int)i, (int)workers_[i]->jobs.size(),
+            (unsigned long)workers_[i]->numRun, (unsigned long)workers_[i]->numStolen);
+    epicsMutexUnlock(workers_[i]->lock);
+  }
+}
@@ -0,0 +1,73 @@
+/** NDPluginExecutor.h
+ *
+ * A group of worker threads shared by the plugins of an IOC, used instead of private plugin threads.
+ *
+ */
+
+#ifndef NDPluginExecutor_H
+#define NDPluginExecutor_H
+
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <shareLib.h>
+
+/** Function that executes one job submitted to NDPluginExecutor::submit()
+  * \param[in] pArg The argument passed to NDPluginExecutor::submit(). */
+typedef void (*NDExecutorJob)(void *pArg);
+
+/** A group of worker threads that run jobs for many plugins.
+  * Each worker has its own queue of jobs.  Jobs submitted by a worker go on its own queue, other jobs are
+  * spread over the queues in turn, and a worker whose queue is empty takes jobs from the other queues, so
+  * the threads go to whichever plugins have work queued.
+  * The IOC-wide executor is created with NDPluginExecutorConfigure, or with one thread per CPU the first time
+  * it is needed.
+  */
+class epicsShareClass NDPluginExecutor {
+public:
+    NDPluginExecutor(const char *name, int numThreads);
+    ~NDPluginExecutor();
+    void submit(NDExecutorJob job, void *pArg);
+    int numThreads();
+    void report(FILE *fp, int details);
+    void workerTask();
+
+    static NDPluginExecutor* instance();
+    static int configure(int numThreads);
+
+private:
+    typedef struct {
+        NDExecutorJob job;
+        void *pArg;
+    } executorJob_t;
+
+    typedef struct {
+        epicsMutexId lock;              /**< Protects jobs */
+        std::deque<executorJob_t> jobs;
+        epicsEventId wakeEvent;         /**< Signalled when the worker is idle and there is a job */
+        epicsThreadId threadId;
+        size_t numRun;                  /**< Number of jobs run by this worker */
+        size_t numStolen;               /**< Number of those jobs that were taken from other queues */
+    } executorWorker_t;
+
+    bool takeJob(int worker, executorJob_t *pJob);
+    int currentWorker();
+
+    char name_[32];
+    int numThreads_;
+    std::vector<executorWorker_t*> workers_;
+    epicsMutexId idleLock_;             /**< Protects idle_, nextWorker_, numRunning_ and exiting_ */
+    std::vector<int> idle_;             /**< Workers that are waiting for a job */
+    int nextWorker_;                    /**< Queue for the next job submitted by a thread that is not a worker */
+    int numStarted_;
+    int numRunning_;
+    bool exiting_;
+    epicsEventId exitEvent_;            /**< Signalled by the last worker to exit */
+};
+
+#endif
@@ -26,7 +26,6 @@
 #include <epicsExport.h>
 
 #include "NDPluginFFT.h"
-#include "fft.h"
 
 #define MIN(A,B) ((A <= B) ? A : B)
 
@@ -60,7 +59,8 @@ NDPluginFFT::NDPluginFFT(const char *portName, int queueSize, int blockingCallba
              asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
              asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
              0, 1, priority, stackSize, maxThreads),
-    uniqueId_(0), FFTAbsValue_(0), timePerPoint_(0), timeAxis_(0), freqAxis_(0)
+    uniqueId_(0), padding_(-1), FFTAbsValue_(0), timePerPoint_(0), timeAxis_(0), freqAxis_(0), pWelch_(0),
+    welchLength_(0), welchOverlap_(0), welchWindow_(0)
 {
   //const char *functionName = "NDPluginFFT::NDPluginFFT";
 
@@ -69,6 +69,7 @@ NDPluginFFT::NDPluginFFT(const char *portName, int queueSize, int blockingCallba
   createParam(FFTTimePerPointString,          asynParamFloat64, &P_FFTTimePerPoint);
   createParam(FFTDirectionString,               asynParamInt32, &P_FFTDirection);
   createParam(FFTSuppressDCString,              asynParamInt32, &P_FFTSuppressDC);
+  createParam(FFTPaddingString,                 asynParamInt32, &P_FFTPadding);
   createParam(FFTNumAverageString,              asynParamInt32, &P_FFTNumAverage);
   createParam(FFTNumAveragedString,             asynParamInt32, &P_FFTNumAveraged);
   createParam(FFTResetAverageString,            asynParamInt32, &P_FFTResetAverage);
@@ -77,7 +78,24 @@ NDPluginFFT::NDPluginFFT(const char *portName, int queueSize, int blockingCallba
   createParam(FFTRealString,             asynParamFloat64Array, &P_FFTReal);
   createParam(FFTImaginaryString,        asynParamFloat64Array, &P_FFTImaginary);
   createParam(FFTAbsValueString,         asynParamFloat64Array, &P_FFTAbsValue);
+  createParam(FFTModeString,                    asynParamInt32, &P_FFTMode);
+  createParam(FFTWindowString,                  asynParamInt32, &P_FFTWindow);
+  createParam(FFTSegmentLengthString,           asynParamInt32, &P_FFTSegmentLength);
+  createParam(FFTOverlapString,               asynParamFloat64, &P_FFTOverlap);
+  createParam(FFTNumSegmentsString,             asynParamInt32, &P_FFTNumSegments);
+  createParam(FFTNumSegmentsAvgString,          asynParamInt32, &P_FFTNumSegmentsAvg);
+  createParam(FFTPSDString,              asynParamFloat64Array, &P_FFTPSD);
+  createParam(FFTPSDFreqAxisString,      asynParamFloat64Array, &P_FFTPSDFreqAxis);
  
+  /* No padding by default, the FFT engine handles any size */
+  setIntegerParam(P_FFTPadding, 0);
+  setIntegerParam(P_FFTMode, FFTModeArrays);
+  setIntegerParam(P_FFTWindow, NDFFTWindowHann);
+  setIntegerParam(P_FFTSegmentLength, 1024);
+  setDoubleParam(P_FFTOverlap, 50.);
+  setIntegerParam(P_FFTNumSegments, 8);
+  setIntegerParam(P_FFTNumSegmentsAvg, 0);
+
   /* Set the plugin type string */
   setStringParam(NDPluginDriverPluginType, "NDPluginFFT");
   
@@ -102,9 +120,17 @@ int NDPluginFFT::nextPow2(int v)
 
 void NDPluginFFT::allocateArrays(fftPvt_t *pPvt, bool sizeChanged)
 {
-  // Round dimensions up to next power of 2
-  pPvt->nTimeX = nextPow2(pPvt->nTimeXIn);
-  pPvt->nTimeY = nextPow2(pPvt->nTimeYIn);
+  static const char *functionName = "NDPluginFFT::allocateArrays";
+  size_t dims[2];
+
+  if (pPvt->timeSeries) {
+    // A workspace of a finished array of the same size; the padding of timeSeries is still zero
+    if (sizeChanged) createFreqArrays(pPvt);
+    return;
+  }
+  // The FFT engine handles any size, so rounding the dimensions up to the next power of 2 is optional
+  pPvt->nTimeX = pPvt->padding ? nextPow2(pPvt->nTimeXIn) : pPvt->nTimeXIn;
+  pPvt->nTimeY = pPvt->padding ? nextPow2(pPvt->nTimeYIn) : pPvt->nTimeYIn;
 
   pPvt->nFreqX = pPvt->nTimeX / 2;
   pPvt->nFreqY = pPvt->nTimeY / 2;
@@ -112,31 +138,89 @@ void NDPluginFFT::allocateArrays(fftPvt_t *pPvt, bool sizeChanged)
 
   size_t timeSize = pPvt->nTimeX * pPvt->nTimeY;
   size_t freqSize = pPvt->nFreqX * pPvt->nFreqY;
+  // Only the padding of timeSeries needs to be zero, the other arrays are overwritten for each array
   pPvt->timeSeries   = (double *)calloc(timeSize, sizeof(double));
-  pPvt->FFTComplex   = (double *)calloc(timeSize, sizeof(double) * 2); // Complex data
-  pPvt->FFTReal      = (double *)calloc(freqSize, sizeof(double));
-  pPvt->FFTImaginary = (double *)calloc(freqSize, sizeof(double));
-  pPvt->FFTAbsValue  = (double *)calloc(freqSize, sizeof(double));
-  if (sizeChanged) {
-    if (FFTAbsValue_) {
-      free(FFTAbsValue_);
-    }
-    FFTAbsValue_ = (double *)calloc(freqSize, sizeof(double));
-    nFreqX_ = pPvt->nFreqX;
-    nFreqY_ = pPvt->nFreqY;
-    createAxisArrays(pPvt);
+  // The half spectrum of the real time series, nTimeX/2+1 complex values per row
+  pPvt->FFTComplex   = (double *)malloc((pPvt->nTimeX/2 + 1) * pPvt->nTimeY * sizeof(double) * 2);
+  pPvt->FFTReal      = (double *)malloc(freqSize * sizeof(double));
+  pPvt->FFTImaginary = (double *)malloc(freqSize * sizeof(double));
+  pPvt->FFTAbsValue  = (double *)malloc(freqSize * sizeof(double));
+  // The plan comes from the cache of the FFT engine unless the size is new
+  dims[0] = pPvt->nTimeX;
+  dims[1] = pPvt->nTimeY;
+  pPvt->pPlan = NDFFTPlanAcquireReal(pPvt->rank, dims);
+  if (!pPvt->pPlan) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s: error, cannot create %s FFT plan for %dx%d array\n",
+      functionName, NDFFTBackend(), pPvt->nTimeX, pPvt->nTimeY);
   }
+  if (sizeChanged) createFreqArrays(pPvt);
+}
+
+void NDPluginFFT::createFreqArrays(fftPvt_t *pPvt)
+{
+  if (FFTAbsValue_) {
+    free(FFTAbsValue_);
+  }
+  FFTAbsValue_ = (double *)calloc(pPvt->nFreqX * pPvt->nFreqY, sizeof(double));
+  nFreqX_ = pPvt->nFreqX;
+  nFreqY_ = pPvt->nFreqY;
+  createAxisArrays(pPvt);
+}
+
+/** Returns a workspace for an array, with the buffers of a finished array of the same size if there is one.
+  * Workspaces of other sizes are freed, so the plugin keeps at most one per thread.
+  * Called with the lock held. */
+fftPvt_t* NDPluginFFT::getWorkspace(int rank, int nTimeXIn, int nTimeYIn, int padding)
+{
+  fftPvt_t *pPvt;
+
+  while (!freeWorkspaces_.empty()) {
+    pPvt = freeWorkspaces_.back();
+    freeWorkspaces_.pop_back();
+    if ((pPvt->rank == rank) && (pPvt->nTimeXIn == nTimeXIn) && (pPvt->nTimeYIn == nTimeYIn) &&
+        (pPvt->padding == padding)) return pPvt;
+    freeWorkspace(pPvt);
+  }
+  pPvt = (fftPvt_t *)calloc(1, sizeof(fftPvt_t));
+  pPvt->rank = rank;
+  pPvt->nTimeXIn = nTimeXIn;
+  pPvt->nTimeYIn = nTimeYIn;
+  pPvt->padding = padding;
+  return pPvt;
+}
+
+void NDPluginFFT::freeWorkspace(fftPvt_t *pPvt)
+{
+  free(pPvt->timeSeries);
+  free(pPvt->FFTComplex);
+  free(pPvt->FFTReal);
+  free(pPvt->FFTImaginary);
+  free(pPvt->FFTAbsValue);
+  if (pPvt->pPlan) NDFFTPlanRelease(pPvt->pPlan);
+  free(pPvt);
+}
+
+/** The lines of one pass of a 2-D FFT for parallelForRows */
+typedef struct {
+  const NDFFTPlan_t *pPlan;
+  int pass;
+  const double *pIn;
+  double *pOut;
+} fftPassArgs_t;
+
+static void fftPassStripe(void *pArg, size_t firstLine, size_t numLines, int stripe)
+{
+  fftPassArgs_t *pArgs = (fftPassArgs_t *)pArg;
+
+  NDFFTExecutePass(pArgs->pPlan, pArgs->pass, pArgs->pIn, pArgs->pOut, 1, firstLine, numLines);
 }
 
 void NDPluginFFT::computeFFT_1D(fftPvt_t *pPvt)
 {
   int j;
 
-  for (j=0; j<pPvt->nTimeX; j++) {
-    pPvt->FFTComplex[2*j] = pPvt->timeSeries[j];
-    pPvt->FFTComplex[2*j+1] = 0.;
-  }
-  fft_1D(pPvt->FFTComplex, pPvt->nTimeX, 1);
+  if (pPvt->pPlan) NDFFTExecuteReal(pPvt->pPlan, pPvt->timeSeries, pPvt->FFTComplex, 1);
   for (j=0; j<pPvt->nFreqX; j++) {
     pPvt->FFTReal     [j] = pPvt->FFTComplex[2*j]; 
     pPvt->FFTImaginary[j] = pPvt->FFTComplex[2*j+1]; 
@@ -154,18 +238,22 @@ void NDPluginFFT::computeFFT_2D(fftPvt_t *pPvt)
 {
   int i,j, k;
   double *pIn;
-  unsigned long dims[2];
+  fftPassArgs_t args;
  
-  for (j=0; j<pPvt->nTimeX*pPvt->nTimeY; j++) {
-    pPvt->FFTComplex[2*j] = pPvt->timeSeries[j];
-    pPvt->FFTComplex[2*j+1] = 0.;
+  // The plan transforms the rows of nTimeX points, then the columns of the nTimeX/2+1 values of the rows.
+  // The lines of each pass are independent, so they are split between the IntraFrameThreads.
+  if (pPvt->pPlan) {
+    args.pPlan = pPvt->pPlan;
+    args.pIn = pPvt->timeSeries;
+    args.pOut = pPvt->FFTComplex;
+    for (args.pass=0; args.pass<NDFFTPasses(pPvt->pPlan); args.pass++) {
+      size_t numLines = NDFFTPassLines(pPvt->pPlan, args.pass);
+      parallelForRows(fftPassStripe, &args, numLines, numStripes(numLines));
+    }
   }
-  dims[0] = pPvt->nTimeX;
-  dims[1] = pPvt->nTimeY;
-  fft_ND(pPvt->FFTComplex, dims, 2, 1);
   for (i=0, k=0, pIn=pPvt->FFTComplex; 
        i<pPvt->nFreqY; 
-       i++, pIn+=pPvt->nTimeX*2) {
+       i++, pIn+=(pPvt->nTimeX/2 + 1)*2) {
     for (j=0; j<pPvt->nFreqX; j++, k++) {
       pPvt->FFTReal     [k] = pIn[j*2]; 
       pPvt->FFTImaginary[k] = pIn[j*2+1]; 
@@ -234,11 +322,6 @@ void NDPluginFFT::doArrayCallbacks(fftPvt_t *pPvt)
   doCallbacksFloat64Array(pPvt->FFTReal,      pPvt->nFreqX, P_FFTReal,       0);
   doCallbacksFloat64Array(pPvt->FFTImaginary, pPvt->nFreqX, P_FFTImaginary,  0);
   doCallbacksFloat64Array(FFTAbsValue_,       MIN(pPvt->nFreqX, nFreqX_), P_FFTAbsValue,   0);
-  free(pPvt->timeSeries);
-  free(pPvt->FFTComplex);
-  free(pPvt->FFTReal);
-  free(pPvt->FFTImaginary);
-  free(pPvt->FFTAbsValue);
 }
 
 void NDPluginFFT::createAxisArrays(fftPvt_t *pPvt)
@@ -283,6 +366,125 @@ void NDPluginFFT::convertToDoubleT(NDArray *pArray, fftPvt_t *pPvt)
   }
 }
 
+/**
+ * Templated function to copy the elements of an NDArray into a stream of doubles.
+ */
+template <typename epicsType>
+static void convertStreamT(const NDArray *pArray, size_t nElements, double *pOut)
+{
+  const epicsType *pIn = (const epicsType *)pArray->pData;
+  size_t i;
+
+  for (i=0; i<nElements; i++) pOut[i] = (double)pIn[i];
+}
+
+/**
+ * Adds the elements of an array to the Welch estimator, and does the callbacks of the PSD each time it has
+ * NumSegments segments.  The elements of each array continue the stream of the previous arrays, whatever their
+ * dimensions, so this is called with the lock held to add the arrays in order.
+ * \param[in] pArray The NDArray from the callback.
+ */
+void NDPluginFFT::processWelch(NDArray *pArray)
+{
+  int segmentLength, window, numSegments, resetAverage, arrayCallbacks, overlap;
+  double overlapPercent, timePerPoint, sampleRate;
+  size_t nElements, used = 0, k;
+  NDArrayInfo_t arrayInfo;
+  static const char *functionName = "NDPluginFFT::processWelch";
+
+  getIntegerParam(P_FFTSegmentLength, &segmentLength);
+  getDoubleParam(P_FFTOverlap, &overlapPercent);
+  getIntegerParam(P_FFTWindow, &window);
+  getIntegerParam(P_FFTNumSegments, &numSegments);
+  getIntegerParam(P_FFTResetAverage, &resetAverage);
+  getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+  getDoubleParam(P_FFTTimePerPoint, &timePerPoint);
+  if (segmentLength < 1) segmentLength = 1;
+  if (numSegments < 1) numSegments = 1;
+  overlap = (int)(segmentLength * overlapPercent / 100. + 0.5);
+  if (overlap < 0) overlap = 0;
+  if (overlap >= segmentLength) overlap = segmentLength - 1;
+  sampleRate = (timePerPoint > 0.) ? 1. / timePerPoint : 1.;
+
+  if (!pWelch_ || (segmentLength != welchLength_) || (overlap != welchOverlap_) || (window != welchWindow_)) {
+    if (pWelch_) NDFFTWelchDestroy(pWelch_);
+    pWelch_ = NDFFTWelchCreate(segmentLength, overlap, (NDFFTWindow_t)window);
+    if (!pWelch_) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s: error, cannot create Welch estimator with %d points, overlap %d and window %d\n",
+        functionName, segmentLength, overlap, window);
+      return;
+    }
+    welchLength_ = segmentLength;
+    welchOverlap_ = overlap;
+    welchWindow_ = window;
+    welchPSD_.resize(segmentLength/2 + 1);
+  } else if (resetAverage) {
+    NDFFTWelchReset(pWelch_);
+  }
+  if (resetAverage) setIntegerParam(P_FFTResetAverage, 0);
+  // The frequency axis follows the sample rate as well as the segment length
+  welchFreqAxis_.resize(segmentLength/2 + 1);
+  for (k=0; k<welchFreqAxis_.size(); k++) welchFreqAxis_[k] = k * sampleRate / segmentLength;
+
+  pArray->getInfo(&arrayInfo);
+  nElements = arrayInfo.nElements;
+  welchStream_.resize(nElements);
+  switch(pArray->dataType) {
+  case NDInt8:
+    convertStreamT<epicsInt8>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDUInt8:
+    convertStreamT<epicsUInt8>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDInt16:
+    convertStreamT<epicsInt16>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDUInt16:
+    convertStreamT<epicsUInt16>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDInt32:
+    convertStreamT<epicsInt32>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDUInt32:
+    convertStreamT<epicsUInt32>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDFloat32:
+    convertStreamT<epicsFloat32>(pArray, nElements, &welchStream_[0]);
+    break;
+  case NDFloat64:
+    convertStreamT<epicsFloat64>(pArray, nElements, &welchStream_[0]);
+    break;
+  default:
+    return;
+  }
+
+  // Each spectrum averages numSegments segments, so an array can complete several spectra or none
+  while (used < nElements) {
+    used += NDFFTWelchAdd(pWelch_, &welchStream_[used], nElements - used, numSegments);
+    if (NDFFTWelchSegments(pWelch_) < (size_t)numSegments) continue;
+    NDFFTWelchPSD(pWelch_, sampleRate, &welchPSD_[0]);
+    if (arrayCallbacks) {
+      size_t dims[1];
+      epicsTimeStamp now;
+      dims[0] = welchPSD_.size();
+      NDArray *pArrayOut = pNDArrayPool->alloc(1, dims, NDFloat64, 0, 0);
+      if (pArrayOut) {
+        memcpy(pArrayOut->pData, &welchPSD_[0], welchPSD_.size() * sizeof(double));
+        this->getAttributes(pArrayOut->pAttributeList);
+        getTimeStamp(&pArrayOut->epicsTS);
+        epicsTimeGetCurrent(&now);
+        pArrayOut->timeStamp = now.secPastEpoch + now.nsec / 1.e9;
+        pArrayOut->uniqueId = uniqueId_++;
+        NDPluginDriver::endProcessCallbacks(pArrayOut, false, false);
+      }
+    }
+    doCallbacksFloat64Array(&welchPSD_[0], welchPSD_.size(), P_FFTPSD, 0);
+    doCallbacksFloat64Array(&welchFreqAxis_[0], welchFreqAxis_.size(), P_FFTPSDFreqAxis, 0);
+  }
+  setIntegerParam(P_FFTNumSegmentsAvg, (int)NDFFTWelchSegments(pWelch_));
+}
+
      
 /** 
  * Callback function that is called by the NDArray driver with new NDArray data.
@@ -295,24 +497,32 @@ void NDPluginFFT::processCallbacks(NDArray *pArray)
   //It unlocks it during long calculations when private structures don't need to be protected.
 
   double timePerPoint;
-  fftPvt_t *pPvt = new fftPvt_t;
+  fftPvt_t *pPvt;
+  int rank, nTimeXIn, nTimeYIn, padding, mode;
   bool sizeChanged = false;  
   const char* functionName = "NDPluginFFT::processCallbacks";
 
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
+  getIntegerParam(P_FFTMode, &mode);
+  if (mode == FFTModeWelch) {
+    processWelch(pArray);
+    callStatusCallbacks();
+    return;
+  }
+
   // This plugin only works with 1-D or 2-D arrays
   switch (pArray->ndims) {
     case 1:
-      pPvt->rank = 1;
-      pPvt->nTimeXIn = (int)pArray->dims[0].size;
-      pPvt->nTimeYIn = 1;
+      rank = 1;
+      nTimeXIn = (int)pArray->dims[0].size;
+      nTimeYIn = 1;
       break;
     case 2:
-      pPvt->rank = 2;
-      pPvt->nTimeXIn = (int)pArray->dims[0].size;
-      pPvt->nTimeYIn = (int)pArray->dims[1].size;
+      rank = 2;
+      nTimeXIn = (int)pArray->dims[0].size;
+      nTimeYIn = (int)pArray->dims[1].size;
       break;
     default:
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -322,12 +532,16 @@ void NDPluginFFT::processCallbacks(NDArray *pArray)
       break;
   }
 
-  if ((pPvt->nTimeXIn != nTimeXIn_) ||
-      (pPvt->nTimeYIn != nTimeYIn_)) {
+  getIntegerParam(P_FFTPadding, &padding);
+  if ((nTimeXIn != nTimeXIn_) ||
+      (nTimeYIn != nTimeYIn_) ||
+      (padding != padding_)) {
     sizeChanged = true;
-    nTimeXIn_ = pPvt->nTimeXIn;
-    nTimeYIn_ = pPvt->nTimeYIn;
+    nTimeXIn_ = nTimeXIn;
+    nTimeYIn_ = nTimeYIn;
+    padding_ = padding;
   }
+  pPvt = getWorkspace(rank, nTimeXIn, nTimeYIn, padding);
 
   getIntegerParam(P_FFTSuppressDC, &pPvt->suppressDC);
 
@@ -374,8 +588,8 @@ void NDPluginFFT::processCallbacks(NDArray *pArray)
   // Take the lock again
   this->lock();
   doArrayCallbacks(pPvt);
-  delete pPvt;
-  callParamCallbacks();
+  freeWorkspaces_.push_back(pPvt);
+  callStatusCallbacks();
 }
 
 /** Configuration command */
@@ -10,16 +10,20 @@
 #ifndef NDPluginFFT_H
 #define NDPluginFFT_H
 
+#include <vector>
+
 #include <epicsTypes.h>
 #include <epicsTime.h>
 
 #include "NDPluginDriver.h"
+#include "NDFFTEngine.h"
 
 #define FFTTimeAxisString        "FFT_TIME_AXIS"        /* (asynFloat64Array, r/o) Time axis array */
 #define FFTFreqAxisString        "FFT_FREQ_AXIS"        /* (asynFloat64Array, r/o) Frequency axis array */
 #define FFTTimePerPointString    "FFT_TIME_PER_POINT"   /* (asynFloat64,      r/o) Time per time point from driver */
 #define FFTDirectionString       "FFT_DIRECTION"        /* (asynInt32,        r/w) FFT direction */
 #define FFTSuppressDCString      "FFT_SUPPRESS_DC"      /* (asynInt32,        r/w) FFT DC offset suppression */
+#define FFTPaddingString         "FFT_PADDING"          /* (asynInt32,        r/w) Pad the arrays to powers of 2 */
 #define FFTNumAverageString      "FFT_NUM_AVERAGE"      /* (asynInt32,        r/w) # of FFTs to average */
 #define FFTNumAveragedString     "FFT_NUM_AVERAGED"     /* (asynInt32,        r/o) # of FFTs averaged */
 #define FFTResetAverageString    "FFT_RESET_AVERAGE"    /* (asynInt32,        r/w) Reset FFT average */
@@ -27,6 +31,20 @@
 #define FFTRealString            "FFT_REAL"             /* (asynFloat64Array, r/o) Real part of FFT */
 #define FFTImaginaryString       "FFT_IMAGINARY"        /* (asynFloat64Array, r/o) Imaginary part of FFT */
 #define FFTAbsValueString        "FFT_ABS_VALUE"        /* (asynFloat64Array, r/o) Absolute value of FFT */
+#define FFTModeString            "FFT_MODE"             /* (asynInt32,        r/w) FFT of each array or Welch PSD of the stream */
+#define FFTWindowString          "FFT_WINDOW"           /* (asynInt32,        r/w) Window of the Welch segments */
+#define FFTSegmentLengthString   "FFT_SEGMENT_LENGTH"   /* (asynInt32,        r/w) Points of the Welch segments */
+#define FFTOverlapString         "FFT_OVERLAP"          /* (asynFloat64,      r/w) Overlap of the Welch segments in % */
+#define FFTNumSegmentsString     "FFT_NUM_SEGMENTS"     /* (asynInt32,        r/w) # of segments per Welch PSD */
+#define FFTNumSegmentsAvgString  "FFT_NUM_SEGMENTS_AVG" /* (asynInt32,        r/o) # of segments in the next PSD */
+#define FFTPSDString             "FFT_PSD"              /* (asynFloat64Array, r/o) Welch power spectral density */
+#define FFTPSDFreqAxisString     "FFT_PSD_FREQ_AXIS"    /* (asynFloat64Array, r/o) Frequency axis of the PSD */
+
+/** The modes of NDPluginFFT */
+typedef enum {
+  FFTModeArrays,    /**< The FFT of each array, averaged over NumAverage arrays */
+  FFTModeWelch      /**< The Welch PSD of the stream of the elements of the arrays */
+} FFTMode_t;
 
 typedef struct {
   int rank;
@@ -37,12 +55,14 @@ typedef struct {
   int nFreqX;
   int nFreqY;
   int suppressDC;
+  int padding;
   int numAverage;
   double *timeSeries;
   double *FFTComplex;
   double *FFTReal;
   double *FFTImaginary;
   double *FFTAbsValue;
+  NDFFTPlan_t *pPlan;
 } fftPvt_t;
 
 /** Compute FFTs on signals */
@@ -64,6 +84,7 @@ protected:
   int P_FFTTimePerPoint;
   int P_FFTDirection;
   int P_FFTSuppressDC;
+  int P_FFTPadding;
   int P_FFTNumAverage;
   int P_FFTNumAveraged;
   int P_FFTResetAverage;
@@ -72,20 +93,33 @@ protected:
   int P_FFTReal;
   int P_FFTImaginary;
   int P_FFTAbsValue;
+  int P_FFTMode;
+  int P_FFTWindow;
+  int P_FFTSegmentLength;
+  int P_FFTOverlap;
+  int P_FFTNumSegments;
+  int P_FFTNumSegmentsAvg;
+  int P_FFTPSD;
+  int P_FFTPSDFreqAxis;
                                 
 private:
   template <typename epicsType> void convertToDoubleT(NDArray *pArray, fftPvt_t *pPvt);
+  fftPvt_t* getWorkspace(int rank, int nTimeXIn, int nTimeYIn, int padding);
+  void freeWorkspace(fftPvt_t *pPvt);
   void allocateArrays(fftPvt_t *pPvt, bool sizeChanged);
+  void createFreqArrays(fftPvt_t *pPvt);
   void createAxisArrays(fftPvt_t *pPvt);
   void computeFFT_1D(fftPvt_t *pPvt);
   void computeFFT_2D(fftPvt_t *pPvt);
   void doArrayCallbacks(fftPvt_t *pPvt);
+  void processWelch(NDArray *pArray);
   int nextPow2(int v);
 
   int numAverage_;
   int uniqueId_;
   int nTimeXIn_;
   int nTimeYIn_;
+  int padding_;
   // Note FFTAbsValue_ is guaranteed to be size nFreqX_ * nFreqY_
   // These could change between when a thread began computing the FFT and when it does the callbacks
   int nFreqX_;
@@ -94,6 +128,14 @@ private:
   double timePerPoint_; /* Actual time between points in input arrays */
   double *timeAxis_;
   double *freqAxis_;
+  std::vector<fftPvt_t*> freeWorkspaces_;   /* The workspaces of the finished arrays, for the next arrays */
+  NDFFTWelch_t *pWelch_;
+  int welchLength_;
+  int welchOverlap_;
+  int welchWindow_;
+  std::vector<double> welchStream_;         /* The elements of an array as doubles */
+  std::vector<double> welchPSD_;
+  std::vector<double> welchFreqAxis_;
 };
     
 #endif //NDPluginFFT_H
@@ -12,6 +12,26 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
+#ifdef _WIN32
+  #include <malloc.h>
+  #include <io.h>
+  #define fsync _commit
+#else
+  #include <unistd.h>
+#endif
+#ifndef O_BINARY
+  #define O_BINARY 0
+#endif
+#ifdef vxWorks
+  #include <memLib.h>
+#endif
+#ifdef __linux__
+  #include <sys/mman.h>
+  #include <sys/statvfs.h>
+#endif
+#include <sys/stat.h>
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
@@ -29,6 +49,28 @@
 
 static const char *driverName="NDPluginFile";
 
+/** Time between checks of the writer queue by a thread that waits for the writer thread, in seconds */
+#define WRITE_QUEUE_POLL_DELAY 0.1
+
+/** Alignment of the slots in the capture buffer, so each array starts on a cache line */
+#define CAPTURE_SLOT_ALIGNMENT ((size_t)64)
+/** The size of a huge page, used to align and round up a capture buffer allocated with huge pages */
+#define CAPTURE_HUGE_PAGE_SIZE ((size_t)2*1024*1024)
+/** The stride for touching the pages of a new capture buffer */
+#define CAPTURE_PAGE_SIZE ((size_t)4096)
+
+static void writeTaskC(void *drvPvt)
+{
+    NDPluginFile *pPvt = (NDPluginFile *)drvPvt;
+    pPvt->writeTask();
+}
+
+static void fileStageTaskC(void *drvPvt)
+{
+    NDPluginFile *pPvt = (NDPluginFile *)drvPvt;
+    pPvt->fileStageTask();
+}
+
 
 
 /** Base method for opening a file
@@ -41,8 +83,18 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     char fullFileName[MAX_FILENAME_LEN];
     char tempSuffix[MAX_FILENAME_LEN];
     char errorMessage[256];
+    char filePath[MAX_FILENAME_LEN];
+    char fileName[MAX_FILENAME_LEN];
+    char fileTemplate[MAX_FILENAME_LEN];
+    char nextFileName[MAX_FILENAME_LEN];
+    int createAhead, syncOnClose, fileWriteMode, autoIncrement, fileNumber, i;
+    bool stageClose;
+    std::vector<std::string> nextFiles;
     static const char* functionName = "openFileBase";
 
+    /* The arrays for the previous file must be written first */
+    this->flushWriteQueue();
+
     if (this->useAttrFilePrefix)
         this->attrFileNameSet();
 
@@ -65,10 +117,31 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
         strcat( fullFileName, tempSuffix );
     }
 
+    /* With CreateAhead the file stage closes the files of single-image writers, and in Capture and Stream mode
+     * it creates the files with the next file numbers while this one is written */
+    getIntegerParam(NDFileCreateAhead, &createAhead);
+    getIntegerParam(NDFileSyncOnClose, &syncOnClose);
+    getIntegerParam(NDFileWriteMode, &fileWriteMode);
+    getIntegerParam(NDAutoIncrement, &autoIncrement);
+    stageClose = (createAhead > 0) && !this->supportsMultipleArrays;
+    if (stageClose && autoIncrement && !this->useAttrFilePrefix && (fileWriteMode != NDFileModeSingle)) {
+        getStringParam(NDFileName, sizeof(fileName), fileName);
+        getStringParam(NDFileTemplate, sizeof(fileTemplate), fileTemplate);
+        getIntegerParam(NDFileNumber, &fileNumber);
+        for (i=0; i<createAhead; i++) {
+            this->stripeFilePath(i, sizeof(filePath), filePath);
+            if (epicsSnprintf(nextFileName, sizeof(nextFileName), fileTemplate, filePath, fileName, fileNumber+i) < 0) break;
+            if ((strlen(nextFileName) + strlen(tempSuffix)) < sizeof(nextFileName)) strcat(nextFileName, tempSuffix);
+            nextFiles.push_back(nextFileName);
+        }
+    }
+
     /* Call the openFile method in the derived class */
     /* Do this with the main lock released since it is slow */
     this->unlock();
     epicsMutexLock(this->fileMutexId);
+    this->stageClose_ = stageClose;
+    this->stageSync_ = (syncOnClose != 0);
     this->registerInitFrameInfo(pArray);
     status = this->openFile(fullFileName, openMode, pArray);
     if (status) {
@@ -79,9 +152,14 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
               driverName, functionName, errorMessage);
         setIntegerParam(NDFileWriteStatus, NDFileWriteError);
         setStringParam(NDFileWriteMessage, errorMessage);
+        this->releaseFileHandle();
     }
+    /* The plan is changed after openFile, which takes this file if it was created in advance */
+    this->planFiles(nextFiles);
     epicsMutexUnlock(this->fileMutexId);
     this->lock();
+    /* The directory may have gone away since it was checked */
+    if (status) this->checkedPath_.clear();
     
     return(status);
 }
@@ -98,6 +176,9 @@ asynStatus NDPluginFile::closeFileBase()
     char errorMessage[256];
     static const char* functionName = "closeFileBase";
 
+    /* All of the arrays must be written before the file is closed */
+    this->flushWriteQueue();
+
     setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
     setStringParam(NDFileWriteMessage, "");
 
@@ -125,6 +206,9 @@ asynStatus NDPluginFile::closeFileBase()
         }
     }
 
+    /* The descriptor that a single-image writer got from openFileHandle() is closed last */
+    this->releaseFileHandle();
+
     epicsMutexUnlock(this->fileMutexId);
     this->lock();
     if (status) {
@@ -138,18 +222,390 @@ asynStatus NDPluginFile::closeFileBase()
     return(status);
 }
 
+/** Opens a file for a single-image writer, which writes it through the returned descriptor.
+  * The file may have been created in advance by the file stage, see NDFileCreateAhead.
+  * The derived class owns the returned descriptor and closes it in closeFile(), for example with fclose() or
+  * TIFFClose().  NDPluginFile keeps another descriptor for the file, which it flushes and closes after closeFile(),
+  * in the file stage thread with CreateAhead.  This is called from openFile(), with the file mutex.
+  * \param[in] fileName The name of the file, which is created or truncated.
+  * \return The descriptor, or -1 if the file could not be opened. */
+int NDPluginFile::openFileHandle(const char *fileName)
+{
+    int fd = -1, writerFd;
+    std::deque<std::pair<std::string, int> >::iterator it;
+    static const char* functionName = "openFileHandle";
+
+    epicsMutexLock(stageMutexId_);
+    /* Wait if the stage thread is creating this file right now */
+    while (creatingFile_ == fileName) {
+        epicsMutexUnlock(stageMutexId_);
+        epicsEventWait(createdEvent_);
+        epicsMutexLock(stageMutexId_);
+    }
+    for (it=createdFiles_.begin(); it!=createdFiles_.end(); ++it) {
+        if (it->first == fileName) break;
+    }
+    if (it != createdFiles_.end()) {
+        fd = it->second;
+        /* The files created for the file numbers before this one will not be used */
+        discardFiles_.insert(discardFiles_.end(), createdFiles_.begin(), it);
+        createdFiles_.erase(createdFiles_.begin(), it+1);
+    }
+    epicsMutexUnlock(stageMutexId_);
+
+    if (fd < 0) fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd < 0) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error opening file %s, %s\n",
+            driverName, functionName, fileName, strerror(errno));
+        return -1;
+    }
+    this->releaseFileHandle();
+    writerFd = dup(fd);
+    if (writerFd < 0) {
+        close(fd);
+        return -1;
+    }
+    this->fileHandle_ = fd;
+    return writerFd;
+}
+
+/** Closes the descriptor that NDPluginFile kept for the file of openFileHandle(), if there is one.
+  * With CreateAhead the file stage thread closes it, together with the other files written since it last ran,
+  * since closing a file can be as slow as creating it on a parallel file system.  Called with the file mutex. */
+void NDPluginFile::releaseFileHandle()
+{
+    if (this->fileHandle_ < 0) return;
+    if (this->stageClose_ && this->startFileStage()) {
+        epicsMutexLock(stageMutexId_);
+        closeHandles_.push_back(std::make_pair(this->fileHandle_, this->stageSync_));
+        epicsMutexUnlock(stageMutexId_);
+        epicsEventSignal(stageEvent_);
+    } else {
+        if (this->stageSync_) fsync(this->fileHandle_);
+        close(this->fileHandle_);
+    }
+    this->fileHandle_ = -1;
+}
+
+/** Sets the files that the file stage creates next, in the order they will be opened.
+  * Files that were created for an earlier plan and are not in this one are removed.
+  * An empty list discards all of the files created in advance, which is done when Capture or Stream mode ends.
+  * \param[in] fileNames The names of the files. */
+void NDPluginFile::planFiles(const std::vector<std::string> &fileNames)
+{
+    std::deque<std::pair<std::string, int> >::iterator it;
+    std::vector<std::string>::iterator tried;
+    bool work;
+
+    epicsMutexLock(stageMutexId_);
+    plannedFiles_ = fileNames;
+    for (it=createdFiles_.begin(); it!=createdFiles_.end(); ) {
+        if (std::find(fileNames.begin(), fileNames.end(), it->first) == fileNames.end()) {
+            discardFiles_.push_back(*it);
+            it = createdFiles_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (tried=triedFiles_.begin(); tried!=triedFiles_.end(); ) {
+        if (std::find(fileNames.begin(), fileNames.end(), *tried) == fileNames.end())
+            tried = triedFiles_.erase(tried);
+        else
+            ++tried;
+    }
+    work = !plannedFiles_.empty() || !discardFiles_.empty();
+    epicsMutexUnlock(stageMutexId_);
+    if (work && this->startFileStage()) epicsEventSignal(stageEvent_);
+}
+
+/** Starts the file stage thread if it is not running.
+  * \return true if the thread is running. */
+bool NDPluginFile::startFileStage()
+{
+    char taskName[256];
+    static const char* functionName = "startFileStage";
+
+    if (stageThreadId_ == 0) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_FileStage", portName);
+        stageThreadId_ = epicsThreadCreate(taskName,
+                                           epicsThreadPriorityMedium,
+                                           epicsThreadGetStackSize(epicsThreadStackMedium),
+                                           (EPICSTHREADFUNC)fileStageTaskC, this);
+        if (stageThreadId_ == 0) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error creating fileStageTask thread\n",
+                driverName, functionName);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** File stage thread; closes the written files, removes the files that will not be used, and creates the
+  * planned files.  A planned file that already exists is left alone, so only files that it created itself are
+  * ever removed; the writer opens an existing file itself when it gets to it. */
+void NDPluginFile::fileStageTask()
+{
+    std::vector<std::pair<int, bool> > handles;
+    std::vector<std::pair<std::string, int> > discards;
+    std::vector<std::string>::iterator planned;
+    std::string fileName;
+    size_t i;
+    int fd;
+
+    while (1) {
+        epicsEventWait(stageEvent_);
+        epicsMutexLock(stageMutexId_);
+        handles.swap(closeHandles_);
+        discards.swap(discardFiles_);
+        epicsMutexUnlock(stageMutexId_);
+
+        for (i=0; i<handles.size(); i++) {
+            if (handles[i].second) fsync(handles[i].first);
+            close(handles[i].first);
+        }
+        for (i=0; i<discards.size(); i++) {
+            close(discards[i].second);
+            remove(discards[i].first.c_str());
+        }
+        handles.clear();
+        discards.clear();
+
+        while (1) {
+            epicsMutexLock(stageMutexId_);
+            fileName.clear();
+            for (planned=plannedFiles_.begin(); planned!=plannedFiles_.end(); ++planned) {
+                if (std::find(triedFiles_.begin(), triedFiles_.end(), *planned) == triedFiles_.end()) {
+                    fileName = *planned;
+                    triedFiles_.push_back(fileName);
+                    break;
+                }
+            }
+            creatingFile_ = fileName;
+            epicsMutexUnlock(stageMutexId_);
+            if (fileName.empty()) break;
+
+            /* openFileHandle() waits for this file while it is created, without the lock */
+            fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+
+            epicsMutexLock(stageMutexId_);
+            if (fd >= 0) {
+                /* The plan may have changed while the file was created */
+                if (std::find(plannedFiles_.begin(), plannedFiles_.end(), fileName) != plannedFiles_.end()) {
+                    createdFiles_.push_back(std::make_pair(fileName, fd));
+                } else {
+                    discardFiles_.push_back(std::make_pair(fileName, fd));
+                    epicsEventSignal(stageEvent_);
+                }
+            }
+            creatingFile_.clear();
+            epicsMutexUnlock(stageMutexId_);
+            epicsEventSignal(createdEvent_);
+        }
+    }
+}
+
+/** Checks whether the directory in NDFilePath exists, see asynNDArrayDriver::checkPath().
+  * A file plugin checks the directory for every file it creates, so a directory that was found is remembered
+  * and not checked again until NDFilePath is written or a file can't be opened. */
+asynStatus NDPluginFile::checkPath()
+{
+    char filePath[MAX_FILENAME_LEN];
+    asynStatus status;
+
+    getStringParam(NDFilePath, sizeof(filePath), filePath);
+    if (!this->checkedPath_.empty() && (this->checkedPath_ == filePath)) return asynSuccess;
+    this->checkedPath_.clear();
+    status = asynNDArrayDriver::checkPath();
+    if (status == asynSuccess) {
+        /* checkPath() adds the trailing delimiter */
+        getStringParam(NDFilePath, sizeof(filePath), filePath);
+        this->checkedPath_ = filePath;
+    }
+    return status;
+}
+
+/** Called when asyn clients call pasynOctet->write().
+  * Writing NDFilePath always checks the directory again, even if the path has not changed, because the
+  * directory may have been created or removed since the last check.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPluginFile::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    asynStatus status;
+
+    if (pasynUser->reason == NDFilePath) this->checkedPath_.clear();
+    status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+    if (pasynUser->reason == NDFileStripePaths) {
+        if (this->setStripePaths(value) != asynSuccess) status = asynError;
+        callParamCallbacks();
+    }
+    return status;
+}
+
+/** Returns the free space of the file system of a directory in bytes, or -1 if it is not known */
+static double directoryFreeSpace(const char *path)
+{
+#ifdef __linux__
+    struct statvfs info;
+
+    if (statvfs(path, &info) != 0) return -1.;
+    return (double)info.f_bavail * (double)info.f_frsize;
+#else
+    return -1.;
+#endif
+}
+
+/** Sets the directories that the files are distributed across from StripePaths.
+  * The directories are separated by ';' or new lines.  A directory that does not exist is created, as for
+  * NDFilePath, if CreateDirectory is not 0.  A directory that still does not exist is kept in the list, since
+  * it may be mounted later, but it is reported and the status is asynError.
+  * \param[in] value The StripePaths string. */
+asynStatus NDPluginFile::setStripePaths(const char *value)
+{
+    std::string path, directory;
+    const char *pStart, *pEnd;
+    struct stat info;
+    int pathDepth;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "setStripePaths";
+
+    this->stripePaths_.clear();
+    this->stripeNext_ = 0;
+    getIntegerParam(NDFileCreateDir, &pathDepth);
+    pStart = value;
+    while (*pStart) {
+        pEnd = pStart + strcspn(pStart, ";\r\n");
+        path.assign(pStart, pEnd - pStart);
+        pStart = *pEnd ? pEnd + 1 : pEnd;
+        path.erase(0, path.find_first_not_of(" \t"));
+        path.erase(path.find_last_not_of(" \t") + 1);
+        if (path.empty()) continue;
+        if ((path[path.size()-1] != '/') && (path[path.size()-1] != '\\')) path += "/";
+        /* Windows does not find a directory with a trailing delimiter */
+        directory = path.substr(0, (path.size() > 1) ? path.size()-1 : 1);
+        if (stat(directory.c_str(), &info) != 0) createFilePath(path.c_str(), pathDepth);
+        if ((stat(directory.c_str(), &info) != 0) || !(info.st_mode & S_IFDIR)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s directory %s does not exist\n",
+                driverName, functionName, path.c_str());
+            status = asynError;
+        }
+        this->stripePaths_.push_back(path);
+    }
+    setIntegerParam(NDFileStripeNumPaths, (int)this->stripePaths_.size());
+    return status;
+}
+
+/** Returns the directory of a file that will be created, from StripePaths, or NDFilePath if it is empty.
+  * In RoundRobin mode each file is in the directory after the one of the previous file.  In FreeSpace mode
+  * each file is in the directory with the most free space, which is only known on Linux; directories with
+  * the same free space, or whose free space is not known, are taken in round robin order.
+  * \param[in] offset The files after the next file, for writers that create files in advance.
+  *            In FreeSpace mode the directory of a later file is the one with the most free space now.
+  * \param[in] maxChars The size of filePath.
+  * \param[out] filePath The directory, with a trailing delimiter.
+  * \return The index of the directory in StripePaths, or -1 for NDFilePath. */
+int NDPluginFile::stripeFilePath(int offset, int maxChars, char *filePath)
+{
+    size_t numPaths = this->stripePaths_.size();
+    size_t index, i, j;
+    double freeSpace, mostFreeSpace = -2.;
+    int stripeMode;
+
+    if (numPaths == 0) {
+        getStringParam(NDFilePath, maxChars, filePath);
+        return -1;
+    }
+    getIntegerParam(NDFileStripeMode, &stripeMode);
+    index = (this->stripeNext_ + offset) % numPaths;
+    if (stripeMode == NDFileStripeFreeSpace) {
+        for (i=0, j=index; i<numPaths; i++, j=(j+1)%numPaths) {
+            freeSpace = directoryFreeSpace(this->stripePaths_[j].c_str());
+            if (freeSpace > mostFreeSpace) {
+                mostFreeSpace = freeSpace;
+                index = j;
+            }
+        }
+    }
+    epicsSnprintf(filePath, maxChars, "%s", this->stripePaths_[index].c_str());
+    return (int)index;
+}
+
+/** Builds the full file name as asynNDArrayDriver::createFileName does, but with the directory from
+  * stripeFilePath() if StripePaths is not empty, so the template is resolved in each directory of the list.
+  * Sets StripeIndex to the directory it used.
+  * \param[in] maxChars  The size of the fullFileName string.
+  * \param[out] fullFileName The constructed file name including the file path. */
+asynStatus NDPluginFile::createFileName(int maxChars, char *fullFileName)
+{
+    char filePath[MAX_FILENAME_LEN];
+    char fileName[MAX_FILENAME_LEN];
+    char fileTemplate[MAX_FILENAME_LEN];
+    int fileNumber, autoIncrement, index;
+    int status = asynSuccess;
+
+    setIntegerParam(NDFileStripeIndex, -1);
+    if (this->stripePaths_.empty()) return NDPluginDriver::createFileName(maxChars, fullFileName);
+    status |= getStringParam(NDFileName, sizeof(fileName), fileName);
+    status |= getStringParam(NDFileTemplate, sizeof(fileTemplate), fileTemplate);
+    status |= getIntegerParam(NDFileNumber, &fileNumber);
+    status |= getIntegerParam(NDAutoIncrement, &autoIncrement);
+    if (status) return (asynStatus)status;
+    index = stripeFilePath(0, sizeof(filePath), filePath);
+    if (epicsSnprintf(fullFileName, maxChars, fileTemplate, filePath, fileName, fileNumber) < 0) return asynError;
+    if (autoIncrement) setIntegerParam(NDFileNumber, fileNumber+1);
+    this->stripeNext_ = (index + 1) % this->stripePaths_.size();
+    setIntegerParam(NDFileStripeIndex, index);
+    return asynSuccess;
+}
+
+/** Builds the file path and file name as asynNDArrayDriver::createFileName does, but with the directory from
+  * stripeFilePath() if StripePaths is not empty.  Sets StripeIndex to the directory it used.
+  * \param[in] maxChars  The size of the filePath and fileName strings.
+  * \param[out] filePath The file path.
+  * \param[out] fileName The constructed file name without file file path. */
+asynStatus NDPluginFile::createFileName(int maxChars, char *filePath, char *fileName)
+{
+    char name[MAX_FILENAME_LEN];
+    char fileTemplate[MAX_FILENAME_LEN];
+    int fileNumber, autoIncrement, index;
+    int status = asynSuccess;
+
+    setIntegerParam(NDFileStripeIndex, -1);
+    if (this->stripePaths_.empty()) return NDPluginDriver::createFileName(maxChars, filePath, fileName);
+    status |= getStringParam(NDFileName, sizeof(name), name);
+    status |= getStringParam(NDFileTemplate, sizeof(fileTemplate), fileTemplate);
+    status |= getIntegerParam(NDFileNumber, &fileNumber);
+    status |= getIntegerParam(NDAutoIncrement, &autoIncrement);
+    if (status) return (asynStatus)status;
+    index = stripeFilePath(0, maxChars, filePath);
+    if (epicsSnprintf(fileName, maxChars, fileTemplate, name, fileNumber) < 0) return asynError;
+    if (autoIncrement) setIntegerParam(NDFileNumber, fileNumber+1);
+    this->stripeNext_ = (index + 1) % this->stripePaths_.size();
+    setIntegerParam(NDFileStripeIndex, index);
+    return asynSuccess;
+}
+
 /** Base method for reading a file
   * Creates the file name with NDPluginBase::createFileName, then calls the pure virtual functions openFile,
   * readFile and closeFile in the derived class.  Does callbacks with the NDArray that was read in. */
 asynStatus NDPluginFile::readFileBase(void)
 {
     asynStatus status = asynSuccess;
+    asynStatus closeStatus;
     char fullFileName[MAX_FILENAME_LEN];
     int dataType=0;
     NDArray *pArray=NULL;
     static const char* functionName = "readFileBase";
 
-    status = (asynStatus)createFileName(MAX_FILENAME_LEN, fullFileName);
+    this->flushWriteQueue();
+
+    /* Files are read from NDFilePath, not from StripePaths */
+    status = (asynStatus)NDPluginDriver::createFileName(MAX_FILENAME_LEN, fullFileName);
     if (status) { 
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
               "%s::%s error creating full file name, fullFileName=%s, status=%d\n", 
@@ -162,15 +618,20 @@ asynStatus NDPluginFile::readFileBase(void)
     this->unlock();
     epicsMutexLock(this->fileMutexId);
     status = this->openFile(fullFileName, NDFileModeRead, pArray);
-    status = this->readFile(&pArray);
-    status = this->closeFile();
+    if (status == asynSuccess) status = this->readFile(&pArray);
+    closeStatus = this->closeFile();
+    if (status == asynSuccess) status = closeStatus;
     epicsMutexUnlock(this->fileMutexId);
     this->lock();
     
     /* If we got an error then return */
-    if (status) return(status);
+    if (status || !pArray) {
+        if (pArray) pArray->release();
+        return status ? status : asynError;
+    }
     
     /* Update the new values of dimensions and the array data */
+    dataType = pArray->dataType;
     setIntegerParam(NDDataType, dataType);
     
     /* Call any registered clients */
@@ -190,9 +651,9 @@ asynStatus NDPluginFile::writeFileBase()
     int i;
     bool doLazyOpen;
     int deleteDriverFile;
+    int writeBehind;
+    bool queued = false;
     NDArray *pArray;
-    NDAttribute *pAttribute;
-    char driverFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
     static const char* functionName = "writeFileBase";
 
@@ -266,7 +727,7 @@ asynStatus NDPluginFile::writeFileBase()
                 status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, pArrayOut);
             if (status == asynSuccess) {
                 for (i=0; i<numCaptured; i++) {
-                    pArray = this->pCapture[i];
+                    pArray = &this->pCapture[i];
                     if (!this->supportsMultipleArrays)
                         status = this->openFileBase(NDFileModeWrite, pArray);
                     else
@@ -293,9 +754,10 @@ asynStatus NDPluginFile::writeFileBase()
                     }
                 }
             }
-            freeCaptureBuffer(numCapture);
+            releaseCaptureBuffer();
             if ((status == asynSuccess) && this->supportsMultipleArrays) 
                 status = this->closeFileBase();
+            this->planFiles(std::vector<std::string>());
             this->registerInitFrameInfo(NULL);
             setIntegerParam(NDFileNumCaptured, 0);
             setIntegerParam(NDWriteFile, 0);
@@ -313,11 +775,20 @@ asynStatus NDPluginFile::writeFileBase()
                 status = asynError;
             }
             if (status == asynSuccess) {
-                this->unlock();
-                epicsMutexLock(this->fileMutexId);
-                status = this->writeFile(pArrayOut);
-                epicsMutexUnlock(this->fileMutexId);
-                this->lock();
+                getIntegerParam(NDFileWriteBehind, &writeBehind);
+                queued = writeBehind && this->supportsMultipleArrays;
+                if (queued) {
+                    /* The writer thread writes the array, so this thread can take the next one */
+                    status = this->queueWrite(pArrayOut);
+                } else {
+                    /* Write behind may just have been turned off */
+                    this->flushWriteQueue();
+                    this->unlock();
+                    epicsMutexLock(this->fileMutexId);
+                    status = this->writeFile(pArrayOut);
+                    epicsMutexUnlock(this->fileMutexId);
+                    this->lock();
+                }
                 NDPluginDriver::endProcessCallbacks(pArrayOut, true, true);
                 if (status) {
                     epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
@@ -346,21 +817,11 @@ asynStatus NDPluginFile::writeFileBase()
      *  - DeleteOriginalFile is true
      *  - There were no errors above
      *  - The NDFullFileName attribute is present and contains a non-blank string
+     * The writer thread does this for the arrays that it writes.
      */
     getIntegerParam(NDFileDeleteDriverFile, &deleteDriverFile);
-    if ((status == asynSuccess) && deleteDriverFile) {
-        pAttribute = pArrayOut->pAttributeList->find("DriverFileName");
-        if (pAttribute) {
-            status = pAttribute->getValue(NDAttrString, driverFileName, sizeof(driverFileName));
-            if ((status == asynSuccess) && (strlen(driverFileName) > 0)) {
-                status = remove(driverFileName);
-                if (status != 0) {
-                    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                              "%s::%s: error deleting file %s, error=%s\n",
-                              driverName, functionName, driverFileName, strerror(errno));
-                }
-            }
-        }
+    if ((status == asynSuccess) && deleteDriverFile && !queued) {
+        status = this->removeDriverFile(pArrayOut);
     }
 
     // Decrease reference count
@@ -369,20 +830,265 @@ asynStatus NDPluginFile::writeFileBase()
     return (asynStatus) status;
 }
 
-void NDPluginFile::freeCaptureBuffer(int numCapture)
+/** Deletes the file named in the DriverFileName attribute of an array, if there is one.
+  * \param[in] pArray The array that was written.
+  * \return 0, or the error status of the attribute or of remove(). */
+int NDPluginFile::removeDriverFile(NDArray *pArray)
+{
+    int status = asynSuccess;
+    NDAttribute *pAttribute;
+    char driverFileName[MAX_FILENAME_LEN];
+    static const char* functionName = "removeDriverFile";
+
+    pAttribute = pArray->pAttributeList->find("DriverFileName");
+    if (pAttribute) {
+        status = pAttribute->getValue(NDAttrString, driverFileName, sizeof(driverFileName));
+        if ((status == asynSuccess) && (strlen(driverFileName) > 0)) {
+            status = remove(driverFileName);
+            if (status != 0) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                          "%s::%s: error deleting file %s, error=%s\n",
+                          driverName, functionName, driverFileName, strerror(errno));
+            }
+        }
+    }
+    return status;
+}
+
+/** Puts an array on the writer queue for the writer thread, starting the thread if it is not running.
+  * This waits, without the lock, until the queue has room for the array within NDFileWriteQueueSize and
+  * NDFileWriteQueueMaxMB, so a slow file system holds back the input queue of the plugin rather than using
+  * unlimited memory.  The queue always takes an array when it is empty, however large the array is.
+  * Must be called with the lock.
+  * \param[in] pArray The array to write; the queue reserves it.
+  * \return asynSuccess, or asynError if the thread could not be started or capture was stopped while waiting. */
+asynStatus NDPluginFile::queueWrite(NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    int queueSize, capture;
+    double maxMB;
+    size_t depth;
+    bool waited = false;
+    char taskName[256];
+    static const char* functionName = "queueWrite";
+
+    if (writeThreadId_ == 0) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_Writer", portName);
+        writeThreadId_ = epicsThreadCreate(taskName,
+                                           epicsThreadPriorityMedium,
+                                           epicsThreadGetStackSize(epicsThreadStackBig),
+                                           (EPICSTHREADFUNC)writeTaskC, this);
+        if (writeThreadId_ == 0) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error creating writeTask thread\n",
+                driverName, functionName);
+            return asynError;
+        }
+    }
+
+    pArray->getInfo(&arrayInfo);
+    while (1) {
+        getIntegerParam(NDFileWriteQueueSize, &queueSize);
+        getDoubleParam(NDFileWriteQueueMaxMB, &maxMB);
+        depth = writeQueue_.size() + (writing_ ? 1 : 0);
+        if ((depth == 0) ||
+            (((int)depth < queueSize) && ((writeQueueBytes_ + arrayInfo.totalBytes) <= maxMB*1e6))) break;
+        this->unlock();
+        epicsEventWaitWithTimeout(writeDoneEvent_, WRITE_QUEUE_POLL_DELAY);
+        this->lock();
+        waited = true;
+    }
+    /* Streaming may have been stopped, and the file closed, while this thread waited */
+    getIntegerParam(NDFileCapture, &capture);
+    if (waited && !capture) return asynError;
+
+    pArray->reserve();
+    writeQueue_.push_back(pArray);
+    writeQueueBytes_ += arrayInfo.totalBytes;
+    updateWriteQueue();
+    epicsEventSignal(writeEvent_);
+    return asynSuccess;
+}
+
+/** Waits, without the lock, until the writer thread has written all of the arrays on the writer queue.
+  * Must be called with the lock. */
+void NDPluginFile::flushWriteQueue()
+{
+    while (writing_ || !writeQueue_.empty()) {
+        this->unlock();
+        epicsEventWaitWithTimeout(writeDoneEvent_, WRITE_QUEUE_POLL_DELAY);
+        this->lock();
+    }
+}
+
+/** Sets the parameters for the state of the writer queue.  Must be called with the lock. */
+void NDPluginFile::updateWriteQueue()
+{
+    setIntegerParam(NDFileWriteQueueDepth, (int)writeQueue_.size() + (writing_ ? 1 : 0));
+    setDoubleParam(NDFileWriteQueueMBytes, writeQueueBytes_/1e6);
+}
+
+/** Writer thread; writes the arrays on the writer queue, in order, with writeFile. */
+void NDPluginFile::writeTask()
 {
-    int i;
     NDArray *pArray;
-    
-    if (!this->pCapture) return;
-    /* Free the capture buffer */
+    NDArrayInfo_t arrayInfo;
+    int status;
+    int deleteDriverFile;
+    char errorMessage[256];
+    static const char* functionName = "writeTask";
+
+    this->lock();
+    while (1) {
+        while (writeQueue_.empty()) {
+            this->unlock();
+            epicsEventWait(writeEvent_);
+            this->lock();
+        }
+        pArray = writeQueue_.front();
+        writeQueue_.pop_front();
+        writing_ = true;
+        this->unlock();
+        epicsMutexLock(this->fileMutexId);
+        status = this->writeFile(pArray);
+        epicsMutexUnlock(this->fileMutexId);
+        this->lock();
+        writing_ = false;
+        if (status) {
+            epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                    "Error writing file, status=%d", status);
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s %s\n",
+                    driverName, functionName, errorMessage);
+            setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+            setStringParam(NDFileWriteMessage, errorMessage);
+        } else {
+            getIntegerParam(NDFileDeleteDriverFile, &deleteDriverFile);
+            if (deleteDriverFile) this->removeDriverFile(pArray);
+        }
+        pArray->getInfo(&arrayInfo);
+        writeQueueBytes_ -= arrayInfo.totalBytes;
+        pArray->release();
+        updateWriteQueue();
+        callParamCallbacks();
+        epicsEventSignal(writeDoneEvent_);
+    }
+}
+
+/** Prepares the capture buffer for numCapture arrays of totalBytes each.
+  * The arrays are stored in slots of one contiguous buffer, which is kept after the capture is written and reused
+  * by the next capture of the same array size, so starting a capture does not allocate numCapture buffers.
+  * A new buffer uses huge pages if the NDArrayPool of the plugin does (see NDArrayPoolSetHugePages), and all of
+  * its pages are touched here so the first captured arrays do not take page faults.
+  * \param[in] numCapture The number of arrays to capture.
+  * \param[in] pArray An array with the dimensions and data type of the arrays that will be captured.
+  * \return asynSuccess, or asynError if the buffer could not be allocated. */
+asynStatus NDPluginFile::allocCaptureBuffer(int numCapture, NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t slotBytes, arenaBytes, offset;
+    size_t alignment = CAPTURE_SLOT_ALIGNMENT;
+    bool hugePages;
+    void *pData = NULL;
+    int i;
+    static const char* functionName = "allocCaptureBuffer";
+
+    pArray->getInfo(&arrayInfo);
+    slotBytes = (arrayInfo.totalBytes + CAPTURE_SLOT_ALIGNMENT - 1) / CAPTURE_SLOT_ALIGNMENT * CAPTURE_SLOT_ALIGNMENT;
+    if ((numCapture > captureNumSlots_) || (slotBytes != captureSlotBytes_)) {
+        freeCaptureArena();
+        arenaBytes = slotBytes * numCapture;
+        hugePages = (this->pNDArrayPool->hugePages() != NDHugePagesNone) && (arenaBytes >= CAPTURE_HUGE_PAGE_SIZE);
+        #ifdef __linux__
+        if (hugePages && (this->pNDArrayPool->hugePages() == NDHugePagesExplicit)) {
+            arenaBytes = (arenaBytes + CAPTURE_HUGE_PAGE_SIZE - 1) / CAPTURE_HUGE_PAGE_SIZE * CAPTURE_HUGE_PAGE_SIZE;
+            pData = mmap(NULL, arenaBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (pData == MAP_FAILED) {
+                /* The explicit huge page pool is empty or not configured, use transparent huge pages */
+                pData = NULL;
+            } else {
+                captureArenaMmap_ = true;
+            }
+        }
+        if (hugePages) alignment = CAPTURE_HUGE_PAGE_SIZE;
+        #else
+        hugePages = false;
+        #endif
+        if (!pData) {
+            #if defined(_WIN32)
+              pData = _aligned_malloc(arenaBytes, alignment);
+            #elif defined(vxWorks)
+              pData = memalign(alignment, arenaBytes);
+            #else
+              if (posix_memalign(&pData, alignment, arenaBytes) != 0) pData = NULL;
+            #endif
+            #ifdef __linux__
+            if (pData && hugePages) madvise(pData, arenaBytes, MADV_HUGEPAGE);
+            #endif
+        }
+        if (!pData) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: cannot allocate capture buffer of %lu bytes\n",
+                driverName, functionName, (unsigned long)arenaBytes);
+            captureArenaMmap_ = false;
+            return asynError;
+        }
+        /* Touch every page so the memory is mapped before the capture starts */
+        for (offset=0; offset<arenaBytes; offset+=CAPTURE_PAGE_SIZE) ((char *)pData)[offset] = 0;
+        captureArena_ = (char *)pData;
+        captureArenaBytes_ = arenaBytes;
+        captureSlots_ = new NDArray[numCapture];
+        captureNumSlots_ = numCapture;
+        captureSlotBytes_ = slotBytes;
+    }
     for (i=0; i<numCapture; i++) {
-        pArray = this->pCapture[i];
-        if (!pArray) break;
-        delete pArray;
+        captureSlots_[i].pData = captureArena_ + i*slotBytes;
+        captureSlots_[i].dataSize = arrayInfo.totalBytes;
+        captureSlots_[i].ndims = pArray->ndims;
     }
-    free(this->pCapture);
+    this->pCapture = captureSlots_;
+    return asynSuccess;
+}
+
+/** Marks the capture buffer as empty, keeping its memory for the next capture. */
+void NDPluginFile::releaseCaptureBuffer()
+{
+    int i;
+
+    if (!this->pCapture) return;
+    /* The attributes are copies, free them now rather than at the next capture */
+    for (i=0; i<captureNumSlots_; i++) captureSlots_[i].pAttributeList->clear();
+    this->pCapture = NULL;
+}
+
+/** Frees the memory of the capture buffer */
+void NDPluginFile::freeCaptureArena()
+{
+    int i;
+
     this->pCapture = NULL;
+    if (captureSlots_) {
+        /* The slots point into the arena, which is freed below */
+        for (i=0; i<captureNumSlots_; i++) captureSlots_[i].pData = NULL;
+        delete [] captureSlots_;
+        captureSlots_ = NULL;
+    }
+    if (captureArena_) {
+        #ifdef __linux__
+        if (captureArenaMmap_) munmap(captureArena_, captureArenaBytes_);
+        else
+        #endif
+        #ifdef _WIN32
+        _aligned_free(captureArena_);
+        #else
+        free(captureArena_);
+        #endif
+        captureArena_ = NULL;
+    }
+    captureArenaMmap_ = false;
+    captureArenaBytes_ = 0;
+    captureNumSlots_ = 0;
+    captureSlotBytes_ = 0;
 }
 
 /** Handles the logic for when NDFileCapture changes state, starting or stopping capturing or streaming NDArrays
@@ -394,8 +1100,6 @@ asynStatus NDPluginFile::doCapture(int capture)
     asynStatus status = asynSuccess;
     int fileWriteMode;
     NDArray *pArray = this->pArrays[0];
-    NDArrayInfo_t arrayInfo;
-    int i;
     int numCapture;
     static const char* functionName = "doCapture";
 
@@ -436,38 +1140,11 @@ asynStatus NDPluginFile::doCapture(int capture)
                         driverName, functionName);
                     return(asynError);
                 }
-                pArray->getInfo(&arrayInfo);
                 this->registerInitFrameInfo(pArray);
-                this->pCapture = (NDArray **)calloc(numCapture, sizeof(NDArray *));
-                if (!this->pCapture) {
-                    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                        "%s::%s ERROR: cannot allocate capture buffer\n",
-                        driverName, functionName);
+                if (this->allocCaptureBuffer(numCapture, pArray) != asynSuccess) {
                     setIntegerParam(NDFileCapture, 0);
                     return(asynError);
                 }
-                for (i=0; i<numCapture; i++) {
-                    pCapture[i] = new NDArray;
-                    if (!this->pCapture[i]) {
-                        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                            "%s::%s ERROR: cannot allocate capture buffer %d\n",
-                            driverName, functionName, i);
-                        setIntegerParam(NDFileCapture, 0);
-                        freeCaptureBuffer(numCapture);
-                        return(asynError);
-                    }
-                    this->pCapture[i]->dataSize = arrayInfo.totalBytes;
-                    this->pCapture[i]->pData = malloc(arrayInfo.totalBytes);
-                    this->pCapture[i]->ndims = pArray->ndims;
-                    if (!this->pCapture[i]->pData) {
-                        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                            "%s::%s ERROR: cannot allocate capture array for buffer %d\n",
-                            driverName, functionName, i);
-                        setIntegerParam(NDFileCapture, 0);
-                        freeCaptureBuffer(numCapture);
-                        return(asynError);
-                    }
-                }
             } else {
                 /* Stop capturing, nothing to do, setting the parameter is all that is needed */
             }
@@ -483,13 +1160,23 @@ asynStatus NDPluginFile::doCapture(int capture)
                 /* Streaming was just stopped */
                 if (this->supportsMultipleArrays)
                     status = this->closeFileBase();
+                /* Remove the files that were created in advance for arrays that did not come */
+                this->planFiles(std::vector<std::string>());
                 setIntegerParam(NDFileCapture, 0);
                 setIntegerParam(NDWriteFile, 0);
+                this->captureStopped();
             }
     }
     return(status);
 }
 
+/** Called when streaming has stopped, after the last file has been closed.
+  * Derived classes can release anything that they prepared for a following file, such as a file
+  * created in advance.  This is called with the lock taken. */
+void NDPluginFile::captureStopped()
+{
+}
+
 /** Check whether an attribute asking the file to be closed has been set.
  *  if the value of FILEPLUGIN_CLOSE attribute is set to 1 then close the file.
  */
@@ -510,6 +1197,7 @@ asynStatus NDPluginFile::attrFileCloseCheck()
                 this->closeFileBase();
                 // We must also set the parameter to notify we have stopped capturing
                 setIntegerParam(NDFileCapture, 0);
+                this->captureStopped();
             }
         } else {
             status = asynError;
@@ -754,7 +1442,7 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
         case NDFileModeCapture:
             if (capture) {
                 if (numCaptured < numCapture && this->isFrameValid(pArray)) {
-                    this->pNDArrayPool->copy(pArray, this->pCapture[numCaptured++], 1);
+                    this->pNDArrayPool->copy(pArray, &this->pCapture[numCaptured++], 1);
                     arrayCounter++;
                     setIntegerParam(NDFileNumCaptured, numCaptured);
                 } 
@@ -852,6 +1540,9 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
         } else {
             setIntegerParam(NDFileCapture, 0);
         }
+    } else if (function == NDFileWriteMode) {
+        /* The capture buffer is kept for the next capture, free it when capture mode is left */
+        if ((value != NDFileModeCapture) && !this->pCapture) freeCaptureArena();
     } else {
         /* This was not a parameter that this driver understands, try the base class */
         status = NDPluginDriver::writeInt32(pasynUser, value);
@@ -925,15 +1616,50 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
                      NDArrayPort, NDArrayAddr, maxAddr, maxBuffers, maxMemory, 
                      asynGenericPointerMask, asynGenericPointerMask,
                      asynFlags, autoConnect, priority, stackSize, maxThreads),
-    pCapture(NULL), captureBufferSize(0)
+    pCapture(NULL), captureBufferSize(0),
+    captureSlots_(NULL), captureNumSlots_(0), captureSlotBytes_(0),
+    captureArena_(NULL), captureArenaBytes_(0), captureArenaMmap_(false),
+    writeQueueBytes_(0), writing_(false), writeThreadId_(0), stripeNext_(0),
+    fileHandle_(-1), stageClose_(false), stageSync_(false), stageThreadId_(0)
 {
     //static const char *functionName = "NDPluginFile";
 
+    createParam(NDFileWriteBehindString,      asynParamInt32,   &NDFileWriteBehind);
+    createParam(NDFileWriteQueueSizeString,   asynParamInt32,   &NDFileWriteQueueSize);
+    createParam(NDFileWriteQueueMaxMBString,  asynParamFloat64, &NDFileWriteQueueMaxMB);
+    createParam(NDFileWriteQueueDepthString,  asynParamInt32,   &NDFileWriteQueueDepth);
+    createParam(NDFileWriteQueueMBytesString, asynParamFloat64, &NDFileWriteQueueMBytes);
+    createParam(NDFileCreateAheadString,      asynParamInt32,   &NDFileCreateAhead);
+    createParam(NDFileSyncOnCloseString,      asynParamInt32,   &NDFileSyncOnClose);
+    createParam(NDFileStripePathsString,      asynParamOctet,   &NDFileStripePaths);
+    createParam(NDFileStripeModeString,       asynParamInt32,   &NDFileStripeMode);
+    createParam(NDFileStripeNumPathsString,   asynParamInt32,   &NDFileStripeNumPaths);
+    createParam(NDFileStripeIndexString,      asynParamInt32,   &NDFileStripeIndex);
+
+    setIntegerParam(NDFileWriteBehind, 0);
+    setIntegerParam(NDFileWriteQueueSize, 16);
+    setDoubleParam(NDFileWriteQueueMaxMB, 256.);
+    setIntegerParam(NDFileWriteQueueDepth, 0);
+    setDoubleParam(NDFileWriteQueueMBytes, 0.);
+    setIntegerParam(NDFileCreateAhead, 0);
+    setIntegerParam(NDFileSyncOnClose, 0);
+    setStringParam(NDFileStripePaths, "");
+    setIntegerParam(NDFileStripeMode, NDFileStripeRoundRobin);
+    setIntegerParam(NDFileStripeNumPaths, 0);
+    setIntegerParam(NDFileStripeIndex, -1);
+    this->writeEvent_ = epicsEventCreate(epicsEventEmpty);
+    this->writeDoneEvent_ = epicsEventCreate(epicsEventEmpty);
+    this->stageMutexId_ = epicsMutexCreate();
+    this->stageEvent_ = epicsEventCreate(epicsEventEmpty);
+    this->createdEvent_ = epicsEventCreate(epicsEventEmpty);
+
     this->ndArrayInfoInit = NULL;
     this->lazyOpen = false;
 
     this->useAttrFilePrefix = false;
     this->fileMutexId = epicsMutexCreate();
+    /* The file writers do not modify the arrays, so they are passed on without copying the data */
+    passArraysByReference_ = true;
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDPluginFile");
 
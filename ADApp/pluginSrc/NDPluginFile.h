@@ -1,8 +1,15 @@
 #ifndef NDPluginFile_H
 #define NDPluginFile_H
 
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+
 #include <epicsTypes.h>
 #include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
 
 #include "NDPluginDriver.h"
 
@@ -21,6 +28,31 @@ typedef int NDFileOpenMode_t;
 #define FILEPLUGIN_DESTINATION "FilePluginDestination"
 #define FILEPLUGIN_CLOSE       "FilePluginClose"
 
+#define NDFileWriteBehindString       "WRITE_BEHIND"        /* (asynInt32,   r/w) Write arrays in stream mode on a
+                                                             *  separate writer thread */
+#define NDFileWriteQueueSizeString    "WRITE_QUEUE_SIZE"    /* (asynInt32,   r/w) Maximum arrays in the writer queue */
+#define NDFileWriteQueueMaxMBString   "WRITE_QUEUE_MAX_MB"  /* (asynFloat64, r/w) Maximum data in the writer queue in MB */
+#define NDFileWriteQueueDepthString   "WRITE_QUEUE_DEPTH"   /* (asynInt32,   r/o) Arrays in the writer queue */
+#define NDFileWriteQueueMBytesString  "WRITE_QUEUE_MBYTES"  /* (asynFloat64, r/o) Data in the writer queue in MB */
+#define NDFileCreateAheadString       "CREATE_AHEAD"        /* (asynInt32,   r/w) Files that single-image writers create
+                                                             *  in advance in Capture and Stream mode, and close on a
+                                                             *  separate thread; 0 to create and close them in line */
+#define NDFileSyncOnCloseString       "SYNC_ON_CLOSE"       /* (asynInt32,   r/w) Flush the files of single-image writers
+                                                             *  to disk before they are closed */
+#define NDFileStripePathsString       "STRIPE_PATHS"        /* (asynOctet,   r/w) Directories, separated by ';', that the
+                                                             *  files are distributed across instead of NDFilePath */
+#define NDFileStripeModeString        "STRIPE_MODE"         /* (asynInt32,   r/w) How the directory of each file is chosen,
+                                                             *  NDFileStripeMode_t */
+#define NDFileStripeNumPathsString    "STRIPE_NUM_PATHS"    /* (asynInt32,   r/o) Number of directories in StripePaths */
+#define NDFileStripeIndexString       "STRIPE_INDEX"        /* (asynInt32,   r/o) The StripePaths directory of the last file,
+                                                             *  -1 if it was in NDFilePath */
+
+/** How the directory of each file is chosen from StripePaths */
+typedef enum {
+    NDFileStripeRoundRobin,     /**< Each file is in the next directory of the list */
+    NDFileStripeFreeSpace       /**< Each file is in the directory with the most free space */
+} NDFileStripeMode_t;
+
 /** Base class for NDArray file writing plugins; actual file writing plugins inherit from this class.
   * This class handles the logic of single file per image, capture into buffer or streaming multiple images
   * to a single file.  
@@ -35,7 +67,11 @@ public:
     /* These methods override those in the base class */
     virtual void processCallbacks(NDArray *pArray);
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
     virtual asynStatus writeNDArray(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus checkPath();
+    virtual asynStatus createFileName(int maxChars, char *fullFileName);
+    virtual asynStatus createFileName(int maxChars, char *filePath, char *fileName);
 
     /** Open a file; pure virtual function that must be implemented by derived classes.
       * \param[in] fileName  Absolute path name of the file to open.
@@ -65,27 +101,89 @@ public:
     int supportsMultipleArrays; /**< Derived classes must set this flag to 0/1 if they cannot/can write 
                                   * multiple NDArrays to a single file. Used in capture and stream modes. */
 
+    /* These should be private but are called from C so must be public */
+    void writeTask();
+    void fileStageTask();
+
+protected:
+    int NDFileWriteBehind;
+    #define FIRST_NDPLUGIN_FILE_PARAM NDFileWriteBehind
+    int NDFileWriteQueueSize;
+    int NDFileWriteQueueMaxMB;
+    int NDFileWriteQueueDepth;
+    int NDFileWriteQueueMBytes;
+    int NDFileCreateAhead;
+    int NDFileSyncOnClose;
+    int NDFileStripePaths;
+    int NDFileStripeMode;
+    int NDFileStripeNumPaths;
+    int NDFileStripeIndex;
+    epicsMutexId fileMutexId;       /**< Held while the file is opened, written or closed */
+    virtual void captureStopped();
+    int openFileHandle(const char *fileName);
+    int stripeFilePath(int offset, int maxChars, char *filePath);
+
 private:
     asynStatus openFileBase(NDFileOpenMode_t openMode, NDArray *pArray);
     asynStatus readFileBase();
     asynStatus writeFileBase();
     asynStatus closeFileBase();
+    asynStatus queueWrite(NDArray *pArray);
+    void       flushWriteQueue();
+    void       updateWriteQueue();
+    int        removeDriverFile(NDArray *pArray);
     asynStatus doCapture(int capture);
-    void       freeCaptureBuffer(int numCapture);
+    asynStatus allocCaptureBuffer(int numCapture, NDArray *pArray);
+    void       releaseCaptureBuffer();
+    void       freeCaptureArena();
     asynStatus attrFileCloseCheck();
     asynStatus attrFileNameCheck();
     asynStatus attrFileNameSet();
     bool attrIsProcessingRequired(NDAttributeList* pAttrList);
     void registerInitFrameInfo(NDArray *pArray); /**< Grab a copy of the NDArrayInfo_t structure for future reference */
     bool isFrameValid(NDArray *pArray); /**< Compare pArray dimensions and datatype against latched NDArrayInfo_t structure */
+    bool startFileStage();
+    void planFiles(const std::vector<std::string> &fileNames);
+    void releaseFileHandle();
+    asynStatus setStripePaths(const char *value);
 
-    NDArray **pCapture;
+    NDArray *pCapture;              /**< The capture slots while a capture is in progress or waiting to be written */
     int captureBufferSize;
-    epicsMutexId fileMutexId;
+    NDArray *captureSlots_;         /**< The arrays for the slots of the capture buffer */
+    int captureNumSlots_;           /**< The number of slots in the capture buffer */
+    size_t captureSlotBytes_;       /**< The size of each slot in bytes */
+    char *captureArena_;            /**< The memory of the capture buffer, which the slots point into */
+    size_t captureArenaBytes_;      /**< The size of captureArena_ in bytes */
+    bool captureArenaMmap_;         /**< captureArena_ was mapped from the explicit huge page pool */
     bool useAttrFilePrefix;
     bool lazyOpen;
     NDArrayInfo_t *ndArrayInfoInit; /**< The NDArray information at file open time.
                                       *  Used to check against changes in incoming frames dimensions or datatype */
+    std::deque<NDArray *> writeQueue_; /**< Arrays waiting for the writer thread, protected by the asyn lock */
+    size_t writeQueueBytes_;        /**< Data in writeQueue_ and in writeFile() on the writer thread */
+    bool writing_;                  /**< The writer thread is in writeFile() */
+    epicsEventId writeEvent_;       /**< Signalled when an array is queued */
+    epicsEventId writeDoneEvent_;   /**< Signalled when the writer thread has written an array */
+    epicsThreadId writeThreadId_;
+    std::string checkedPath_;       /**< The NDFilePath that checkPath() last found, empty if it must check again */
+    std::vector<std::string> stripePaths_; /**< The directories of StripePaths, each with a trailing delimiter */
+    size_t stripeNext_;             /**< The StripePaths directory of the next file in round robin order */
+    int fileHandle_;                /**< The descriptor of the open file that openFileHandle() returned a duplicate of,
+                                      *  -1 if there is none */
+    bool stageClose_;               /**< The file stage thread closes fileHandle_ */
+    bool stageSync_;                /**< fileHandle_ is flushed to disk before it is closed */
+    /* The file stage, which creates the next files of single-image writers and closes the written ones.
+     * These are protected by stageMutexId_ */
+    std::vector<std::string> plannedFiles_;  /**< The files to create, in the order they will be opened */
+    std::vector<std::string> triedFiles_;    /**< Planned files that already existed, which are left alone */
+    std::deque<std::pair<std::string, int> > createdFiles_; /**< The files that have been created, with their descriptors */
+    std::vector<std::pair<std::string, int> > discardFiles_; /**< Created files that will not be used, to close and remove */
+    std::vector<std::pair<int, bool> > closeHandles_; /**< Descriptors of written files to close, and whether to flush them */
+    std::string creatingFile_;      /**< The file that the stage thread is creating */
+    epicsMutexId stageMutexId_;
+    epicsEventId stageEvent_;       /**< Signalled when there is work for the stage thread */
+    epicsEventId createdEvent_;     /**< Signalled when the stage thread has created a file */
+    epicsThreadId stageThreadId_;
 };
 
 #endif
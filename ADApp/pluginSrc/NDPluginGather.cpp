@@ -9,7 +9,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <epicsStdio.h>
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
@@ -51,14 +53,31 @@ NDPluginGather::NDPluginGather(const char *portName, int queueSize, int blocking
                    asynInt32Mask | asynFloat64Mask | asynGenericPointerMask,
                    asynInt32Mask | asynFloat64Mask | asynGenericPointerMask,
                    ASYN_MULTIDEVICE, 1, priority, stackSize, 1),
-    maxPorts_(maxPorts)
+    maxPorts_(maxPorts), orderStarted_(false), nextUniqueId_(0)
 {
     int i;
     NDGatherNDArraySource_t *pArraySrc;
     //static const char *functionName = "NDPluginGather";
 
+    createParam(NDPluginGatherModeString,           asynParamInt32,        &NDPluginGatherMode);
+    createParam(NDPluginGatherWindowString,         asynParamInt32,        &NDPluginGatherWindow);
+    createParam(NDPluginGatherPendingString,        asynParamInt32,        &NDPluginGatherPending);
+    createParam(NDPluginGatherSkippedString,        asynParamInt32,        &NDPluginGatherSkipped);
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginGather");
+
+    /* Output the arrays in the order they arrive */
+    setIntegerParam(NDPluginGatherMode, NDGatherArrival);
+    setIntegerParam(NDPluginGatherWindow, 100);
+    setIntegerParam(NDPluginGatherPending, 0);
+    setIntegerParam(NDPluginGatherSkipped, 0);
+
+    /* The arrays are passed on unmodified, packed, sparse and device arrays too */
+    passArraysByReference_ = true;
+    supportsPackedArrays_ = true;
+    supportsSparseArrays_ = true;
+    supportsDeviceArrays_ = true;
     
     if (maxPorts_ < 1) maxPorts_ = 1;
     NDArraySrc_ = (NDGatherNDArraySource_t *)calloc(sizeof(NDGatherNDArraySource_t), maxPorts_);
@@ -95,6 +114,157 @@ void NDPluginGather::processCallbacks(NDArray *pArray)
     NDPluginDriver::endProcessCallbacks(pArray, true, true);
 }
 
+/** Called by the input ports with each array.
+  * With GatherMode=Arrival the array goes to the input queue, as in NDPluginDriver::driverCallback().
+  * With GatherMode=Ordered it goes to the reorder window in the thread of the input port, and the arrays that
+  * are then in uniqueId order are output at once, so they do not wait for SortTime.
+  * \param[in] pasynUser  The pasynUser from the asyn client.
+  * \param[in] genericPointer The pointer to the NDArray */
+void NDPluginGather::driverCallback(asynUser *pasynUser, void *genericPointer)
+{
+    NDArray *pArray = (NDArray *)genericPointer;
+    const char *portName, *srcPortName;
+    int mode, addr, srcAddr, source;
+
+    this->lock();
+    getIntegerParam(NDPluginGatherMode, &mode);
+    if (mode != NDGatherOrdered) {
+        this->unlock();
+        NDPluginDriver::driverCallback(pasynUser, genericPointer);
+        return;
+    }
+    /* The interrupt passes a copy of the asynUser of the source, which is connected to the same port and address */
+    pasynManager->getPortName(pasynUser, &portName);
+    pasynManager->getAddr(pasynUser, &addr);
+    for (source=0; source<maxPorts_; source++) {
+        if (!NDArraySrc_[source].connectedToArrayPort) continue;
+        if ((pasynManager->getPortName(NDArraySrc_[source].pasynUserGenericPointer, &srcPortName) == asynSuccess) &&
+            (pasynManager->getAddr(NDArraySrc_[source].pasynUserGenericPointer, &srcAddr) == asynSuccess) &&
+            (strcmp(portName, srcPortName) == 0) && (addr == srcAddr)) break;
+    }
+    if (source == maxPorts_) source = -1;
+    /* The array is never dropped for a full queue */
+    pasynUser->auxStatus = asynSuccess;
+    NDPluginDriver::beginProcessCallbacks(pArray);
+    orderArray(source, pArray);
+    callStatusCallbacks();
+    this->unlock();
+}
+
+/** Puts an array in the reorder window and outputs the arrays that are then in order.
+  * This must be called with the lock held.
+  * An array whose uniqueId is before the next one to output is output at once.  An array that is more than
+  * GatherWindow before it means the uniqueIds have restarted, and the window is output first.
+  * \param[in] source The input port that delivered the array; -1 if it is not known.
+  * \param[in] pArray The array. */
+void NDPluginGather::orderArray(int source, NDArray *pArray)
+{
+    int windowSize;
+    int uniqueId = pArray->uniqueId;
+    NDGatherNDArraySource_t *pArraySrc;
+
+    getIntegerParam(NDPluginGatherWindow, &windowSize);
+    if (windowSize < 1) windowSize = 1;
+    if (orderStarted_ && (uniqueId + windowSize < nextUniqueId_)) {
+        emitOrderedArrays(true);
+        resetOrder();
+    }
+    if (!orderStarted_) {
+        orderStarted_ = true;
+        nextUniqueId_ = uniqueId;
+    }
+    if ((source >= 0) && (source < maxPorts_)) {
+        pArraySrc = &NDArraySrc_[source];
+        if (!pArraySrc->delivered || (uniqueId > pArraySrc->lastUniqueId)) pArraySrc->lastUniqueId = uniqueId;
+        pArraySrc->delivered = true;
+    }
+    if ((uniqueId < nextUniqueId_) || (window_.count(uniqueId) > 0)) {
+        /* Too late for its place in the order, or a duplicate */
+        endProcessCallbacks(pArray, true, true);
+    } else {
+        pArray->reserve();
+        window_[uniqueId] = pArray;
+    }
+    emitOrderedArrays(false);
+}
+
+/** Outputs the arrays of the reorder window that are in order.
+  * This must be called with the lock held.
+  * The missing uniqueIds before the first array of the window are given up, and counted in GatherSkipped, when
+  * every connected input port has delivered an array with that uniqueId or a later one, since each port delivers
+  * its arrays in uniqueId order, or when the window holds more than GatherWindow arrays.
+  * \param[in] all If true all of the arrays are output, giving up on every gap. */
+void NDPluginGather::emitOrderedArrays(bool all)
+{
+    std::map<int, NDArray *>::iterator it;
+    NDArray *pArray;
+    bool lost;
+    int windowSize, skipped, i;
+
+    getIntegerParam(NDPluginGatherWindow, &windowSize);
+    getIntegerParam(NDPluginGatherSkipped, &skipped);
+    while (!window_.empty()) {
+        it = window_.begin();
+        if (it->first != nextUniqueId_) {
+            lost = all || ((int)window_.size() > windowSize);
+            for (i=0; (i<maxPorts_) && !lost; i++) {
+                if (!NDArraySrc_[i].asynGenericPointerInterruptPvt) continue;
+                if (!NDArraySrc_[i].delivered || (NDArraySrc_[i].lastUniqueId < nextUniqueId_)) break;
+            }
+            if (i == maxPorts_) lost = true;
+            if (!lost) break;
+            skipped += it->first - nextUniqueId_;
+            nextUniqueId_ = it->first;
+        }
+        pArray = it->second;
+        window_.erase(it);
+        nextUniqueId_++;
+        endProcessCallbacks(pArray, true, true);
+        pArray->release();
+    }
+    setIntegerParam(NDPluginGatherPending, (int)window_.size());
+    setIntegerParam(NDPluginGatherSkipped, skipped);
+}
+
+/** Forgets the uniqueIds seen so far, so the next array starts the order.  The window must be empty. */
+void NDPluginGather::resetOrder()
+{
+    int i;
+
+    orderStarted_ = false;
+    for (i=0; i<maxPorts_; i++) NDArraySrc_[i].delivered = false;
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Changing GatherMode outputs the arrays of the reorder window and restarts the order.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginGather::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_GATHER_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    status = (asynStatus) setIntegerParam(function, value);
+    if (function == NDPluginGatherMode) {
+        emitOrderedArrays(true);
+        resetOrder();
+    }
+    callParamCallbacks();
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
 /** Register or unregister to receive asynGenericPointer (NDArray) callbacks from the driver.
   * Note: this function must be called with the lock released, otherwise a deadlock can occur
   * in the call to cancelInterruptUser.
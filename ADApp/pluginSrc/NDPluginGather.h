@@ -2,15 +2,30 @@
 #define NDPluginGather_H
 
 #include <set>
+#include <map>
 
 #include "NDPluginDriver.h"
 
+/* Param definitions */
+#define NDPluginGatherModeString        "GATHER_MODE"       /* (asynInt32,        r/w) Output order, NDGatherMode_t */
+#define NDPluginGatherWindowString      "GATHER_WINDOW"     /* (asynInt32,        r/w) Arrays held for a lower uniqueId */
+#define NDPluginGatherPendingString     "GATHER_PENDING"    /* (asynInt32,        r/o) Arrays in the reorder window */
+#define NDPluginGatherSkippedString     "GATHER_SKIPPED"    /* (asynInt32,        r/w) uniqueIds given up as lost */
+
+/** The order in which NDPluginGather outputs the arrays */
+typedef enum {
+    NDGatherArrival,            /**< In the order they arrive, through the input queue */
+    NDGatherOrdered             /**< In uniqueId order, through a reorder window, in the thread of the input port */
+} NDGatherMode_t;
+
 typedef struct {
     void *asynGenericPointerInterruptPvt;        /**< InterruptPvt for connecting to NDArray driver interupts */
     asynUser *pasynUserGenericPointer;           /**< asynUser for connecting to NDArray driver */
     void *asynGenericPointerPvt;                 /**< Handle for connecting to NDArray driver */
     asynGenericPointer *pasynGenericPointer;     /**< asyn interface for connecting to NDArray driver */
     bool connectedToArrayPort;
+    bool delivered;                              /**< The port has delivered an array since the order was reset */
+    int lastUniqueId;                            /**< The highest uniqueId the port has delivered */
 } NDGatherNDArraySource_t;
 
 /** A plugin that subscribes to callbacks from multiple ports, not just a single port  */
@@ -20,6 +35,8 @@ public:
                    int maxPorts, 
                    int maxBuffers, size_t maxMemory,
                    int priority, int stackSize);
+    virtual void driverCallback(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
 protected:
     /* These methods override the virtual methods in the base class */
@@ -27,10 +44,22 @@ protected:
     virtual asynStatus connectToArrayPort(void);    
     virtual asynStatus setArrayInterrupt(int connect);
 
+    int NDPluginGatherMode;
+    #define FIRST_NDPLUGIN_GATHER_PARAM NDPluginGatherMode
+    int NDPluginGatherWindow;
+    int NDPluginGatherPending;
+    int NDPluginGatherSkipped;
+
+    void orderArray(int source, NDArray *pArray);
                                 
 private:
+    void emitOrderedArrays(bool all);
+    void resetOrder();
     int maxPorts_;
     NDGatherNDArraySource_t *NDArraySrc_;
+    std::map<int, NDArray *> window_;            /**< The reorder window, keyed on uniqueId */
+    bool orderStarted_;                          /**< nextUniqueId_ has been set by the first array */
+    int nextUniqueId_;                           /**< The uniqueId of the next array to output in uniqueId order */
 };
     
 #endif
@@ -0,0 +1,265 @@
+/*
+ * NDPluginMJPEG.cpp
+ *
+ * Plugin that compresses NDArrays to JPEG images in memory, and outputs them as NDArrays and as an MJPEG stream.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginMJPEG.h"
+
+static const char *driverName="NDPluginMJPEG";
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * It compresses the array if there is a consumer for the image, either ArrayCallbacks or a client of the
+  * MJPEG stream, and the last image was compressed at least 1/MaxRate seconds ago.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginMJPEG::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  It unlocks it while it compresses the array. */
+    NDArray *pArrayOut;
+    epicsTimeStamp now;
+    size_t dims[1];
+    double maxRate;
+    int quality, arrayCallbacks, numClients, count;
+    int status;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getIntegerParam(NDPluginMJPEGQuality, &quality);
+    getDoubleParam(NDPluginMJPEGMaxRate, &maxRate);
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    numClients = server_.numClients();
+    setIntegerParam(NDPluginMJPEGNumClients, numClients);
+
+    epicsTimeGetCurrent(&now);
+    if ((!arrayCallbacks && (numClients == 0)) ||
+        ((maxRate > 0.) && (epicsTimeDiffInSeconds(&now, &lastImage_) < 1./maxRate))) {
+        getIntegerParam(NDPluginMJPEGNumSkipped, &count);
+        setIntegerParam(NDPluginMJPEGNumSkipped, count+1);
+        callParamCallbacks();
+        return;
+    }
+    lastImage_ = now;
+
+    this->unlock();
+    status = encoder_.encode(pArray, quality, jpeg_);
+    if (status == ND_SUCCESS) server_.publish(&jpeg_[0], jpeg_.size());
+    this->lock();
+
+    if (status != ND_SUCCESS) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot compress array uniqueId=%d\n",
+            driverName, functionName, pArray->uniqueId);
+        callParamCallbacks();
+        return;
+    }
+    setIntegerParam(NDPluginMJPEGImageSize, (int)jpeg_.size());
+
+    if (arrayCallbacks) {
+        dims[0] = jpeg_.size();
+        pArrayOut = this->pNDArrayPool->alloc(1, dims, NDUInt8, 0, NULL);
+        if (pArrayOut) {
+            memcpy(pArrayOut->pData, &jpeg_[0], jpeg_.size());
+            pArrayOut->uniqueId = pArray->uniqueId;
+            pArrayOut->timeStamp = pArray->timeStamp;
+            pArrayOut->epicsTS = pArray->epicsTS;
+            pArray->pAttributeList->copy(pArrayOut->pAttributeList);
+            pArrayOut->pAttributeList->add("Codec", "Compression of the array data", NDAttrString, (void *)"jpeg");
+            NDPluginDriver::endProcessCallbacks(pArrayOut, false, true);
+        } else {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s cannot allocate output array\n",
+                driverName, functionName);
+        }
+    }
+    callParamCallbacks();
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks that MJPEGQuality is 1 to 100.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginMJPEG::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_MJPEG_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDPluginMJPEGQuality) {
+        if ((value < 1) || (value > 100)) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Called when asyn clients call pasynFloat64->write().
+  * It checks that MJPEGMaxRate is not negative.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginMJPEG::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    double oldvalue = 0.;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeFloat64";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_MJPEG_PARAM) return NDPluginDriver::writeFloat64(pasynUser, value);
+
+    getDoubleParam(function, &oldvalue);
+    if (function == NDPluginMJPEGMaxRate) {
+        if (value < 0.) status = asynError;
+    }
+    setDoubleParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%f old=%f\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%f\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDPluginMJPEG; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] httpPort The TCP port of the MJPEG stream; 0 for no stream.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginMJPEG::NDPluginMJPEG(const char *portName, int queueSize, int blockingCallbacks,
+                             const char *NDArrayPort, int NDArrayAddr, int httpPort,
+                             int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, 1)
+{
+    char threadName[64];
+    //static const char *functionName = "NDPluginMJPEG";
+
+    createParam(NDPluginMJPEGQualityString,    asynParamInt32,   &NDPluginMJPEGQuality);
+    createParam(NDPluginMJPEGMaxRateString,    asynParamFloat64, &NDPluginMJPEGMaxRate);
+    createParam(NDPluginMJPEGHttpPortString,   asynParamInt32,   &NDPluginMJPEGHttpPort);
+    createParam(NDPluginMJPEGNumClientsString, asynParamInt32,   &NDPluginMJPEGNumClients);
+    createParam(NDPluginMJPEGImageSizeString,  asynParamInt32,   &NDPluginMJPEGImageSize);
+    createParam(NDPluginMJPEGNumSkippedString, asynParamInt32,   &NDPluginMJPEGNumSkipped);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginMJPEG");
+    setIntegerParam(NDPluginMJPEGQuality, 50);
+    setDoubleParam(NDPluginMJPEGMaxRate, 10.);
+    setIntegerParam(NDPluginMJPEGNumClients, 0);
+    setIntegerParam(NDPluginMJPEGImageSize, 0);
+    setIntegerParam(NDPluginMJPEGNumSkipped, 0);
+    lastImage_.secPastEpoch = 0;
+    lastImage_.nsec = 0;
+
+    if (httpPort > 0) {
+        epicsSnprintf(threadName, sizeof(threadName), "%s_http", portName);
+        server_.start(httpPort, threadName);
+    }
+    setIntegerParam(NDPluginMJPEGHttpPort, server_.port());
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/** Configuration command */
+extern "C" int NDMJPEGConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                const char *NDArrayPort, int NDArrayAddr, int httpPort,
+                                int maxBuffers, size_t maxMemory, int priority, int stackSize)
+{
+    NDPluginMJPEG *pPlugin = new NDPluginMJPEG(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                               httpPort, maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "httpPort",iocshArgInt};
+static const iocshArg initArg6 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg7 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg8 = { "priority",iocshArgInt};
+static const iocshArg initArg9 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDMJPEGConfigure",10,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDMJPEGConfigure(args[0].sval, args[1].ival, args[2].ival,
+                     args[3].sval, args[4].ival, args[5].ival,
+                     args[6].ival, args[7].ival, args[8].ival,
+                     args[9].ival);
+}
+
+extern "C" void NDMJPEGRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDMJPEGRegister);
+}
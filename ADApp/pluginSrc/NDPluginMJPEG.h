@@ -0,0 +1,54 @@
+#ifndef NDPluginMJPEG_H
+#define NDPluginMJPEG_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "NDPluginDriver.h"
+#include "NDJPEGEncoder.h"
+#include "NDMJPEGServer.h"
+
+#define NDPluginMJPEGQualityString     "MJPEG_QUALITY"      /* (asynInt32,   r/w) JPEG quality, 1 to 100 */
+#define NDPluginMJPEGMaxRateString     "MJPEG_MAX_RATE"     /* (asynFloat64, r/w) Most images compressed per second,
+                                                             *  0 for no limit */
+#define NDPluginMJPEGHttpPortString    "MJPEG_HTTP_PORT"    /* (asynInt32,   r/o) TCP port of the MJPEG stream,
+                                                             *  -1 if there is none */
+#define NDPluginMJPEGNumClientsString  "MJPEG_NUM_CLIENTS"  /* (asynInt32,   r/o) Clients of the MJPEG stream */
+#define NDPluginMJPEGImageSizeString   "MJPEG_IMAGE_SIZE"   /* (asynInt32,   r/o) Bytes of the last JPEG image */
+#define NDPluginMJPEGNumSkippedString  "MJPEG_NUM_SKIPPED"  /* (asynInt32,   r/w) Arrays that were not compressed */
+
+/** Compresses NDArrays to JPEG images in memory, for previews in web viewers, without writing files.
+  * Each image is output as a 1-D NDUInt8 array with the Codec attribute "jpeg", and is streamed as MJPEG to the
+  * HTTP clients on the port given to NDMJPEGConfigure.  An array is only compressed if it is at least 1/MaxRate
+  * seconds after the last compressed one and there is a consumer for the image, so the CPU time a preview takes
+  * is bounded; the other arrays are counted in NumSkipped. */
+class epicsShareClass NDPluginMJPEG : public NDPluginDriver {
+public:
+    NDPluginMJPEG(const char *portName, int queueSize, int blockingCallbacks,
+                  const char *NDArrayPort, int NDArrayAddr, int httpPort,
+                  int maxBuffers, size_t maxMemory, int priority, int stackSize);
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+
+protected:
+    int NDPluginMJPEGQuality;
+    #define FIRST_NDPLUGIN_MJPEG_PARAM NDPluginMJPEGQuality
+    int NDPluginMJPEGMaxRate;
+    int NDPluginMJPEGHttpPort;
+    int NDPluginMJPEGNumClients;
+    int NDPluginMJPEGImageSize;
+    int NDPluginMJPEGNumSkipped;
+
+private:
+    NDJPEGEncoder encoder_;        /**< Only used by the plugin thread, the plugin has 1 thread */
+    NDMJPEGServer server_;
+    std::vector<unsigned char> jpeg_;  /**< The last image */
+    epicsTimeStamp lastImage_;     /**< When the last image was compressed */
+};
+
+#endif
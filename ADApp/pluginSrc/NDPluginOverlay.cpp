@@ -37,6 +37,41 @@
 
 static const char *driverName="NDPluginOverlay";
 
+/* The characters that the fonts have glyphs for */
+#define FIRST_GLYPH 32
+#define NUM_GLYPHS  96
+
+/** Finds the pixels that are set in the bitmap of each character of each font, so that text overlays
+  * are rasterized from these lists rather than testing every bit of the bitmaps for each array. */
+void NDPluginOverlay::buildGlyphs()
+{
+  NDPluginOverlayTextFontBitmapType *bmp;
+  const unsigned char *pRow;
+  NDOverlayGlyph_t *pGlyph;
+  int font, ic, iy, ib, bpc, mask;
+
+  glyphs_.resize(NDPluginOverlayTextFontBitmapTypeN);
+  for (font=0; font<NDPluginOverlayTextFontBitmapTypeN; font++) {
+    bmp = &NDPluginOverlayTextFontBitmaps[font];
+    bpc = bmp->width / 8 + 1;
+    glyphs_[font].resize(NUM_GLYPHS);
+    for (ic=0; ic<NUM_GLYPHS; ic++) {
+      pGlyph = &glyphs_[font][ic];
+      for (iy=0; iy<bmp->height; iy++) {
+        pRow = &bmp->bitmap[(bmp->height*ic + iy)*bpc];
+        for (ib=0, mask=0x80; ib<bmp->width; ib++) {
+          if (pRow[ib/8] & mask) {
+            pGlyph->x.push_back(ib);
+            pGlyph->y.push_back(iy);
+          }
+          mask >>= 1;
+          if (!mask) mask = 0x80;
+        }
+      }
+    }
+  }
+}
+
 void NDPluginOverlay::addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInfo_t *pArrayInfo)
 {
   if ((ix >= 0) && (ix < (int)pArrayInfo->xSize) &&
@@ -44,53 +79,72 @@ void NDPluginOverlay::addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInf
     pOverlay->pvt.addressOffset.push_back(iy*pArrayInfo->yStride + ix*pArrayInfo->xStride);
 }
 
+/** Sets the pixels of an overlay in an array from the address offsets that doOverlayT() rasterized.
+  * The color mode and draw mode are tested once for the overlay, not for each pixel. */
 template <typename epicsType>
-void NDPluginOverlay::setPixel(epicsType *pValue, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
+void NDPluginOverlay::setPixels(epicsType *pData, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
 {
+  int nPixels = (int)pOverlay->pvt.addressOffset.size();
+  const int *pOffset;
+  size_t colorStride = pArrayInfo->colorStride;
+  epicsType *pValue;
+  int i;
+
+  if (nPixels == 0) return;
+  pOffset = &pOverlay->pvt.addressOffset[0];
   if ((pArrayInfo->colorMode == NDColorModeRGB1) ||
       (pArrayInfo->colorMode == NDColorModeRGB2) ||
       (pArrayInfo->colorMode == NDColorModeRGB3)) {
     if (pOverlay->drawMode == NDOverlaySet) {
-      *pValue = (epicsType)pOverlay->red;
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)pOverlay->green;
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)pOverlay->blue;
+      epicsType red = (epicsType)pOverlay->red;
+      epicsType green = (epicsType)pOverlay->green;
+      epicsType blue = (epicsType)pOverlay->blue;
+      for (i=0; i<nPixels; i++) {
+        pValue = pData + pOffset[i];
+        pValue[0] = red;
+        pValue[colorStride] = green;
+        pValue[2*colorStride] = blue;
+      }
     } else if (pOverlay->drawMode == NDOverlayXOR) {
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->red);
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->blue);
+      for (i=0; i<nPixels; i++) {
+        pValue = pData + pOffset[i];
+        pValue[0] = (epicsType)((int)pValue[0] ^ (int)pOverlay->red);
+        pValue[colorStride] = (epicsType)((int)pValue[colorStride] ^ (int)pOverlay->green);
+        pValue[2*colorStride] = (epicsType)((int)pValue[2*colorStride] ^ (int)pOverlay->blue);
+      }
     }
   }
   else {
-    if (pOverlay->drawMode == NDOverlaySet)
-      *pValue = (epicsType)pOverlay->green;
-    else if (pOverlay->drawMode == NDOverlayXOR)
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
+    if (pOverlay->drawMode == NDOverlaySet) {
+      epicsType green = (epicsType)pOverlay->green;
+      for (i=0; i<nPixels; i++)
+        pData[pOffset[i]] = green;
+    } else if (pOverlay->drawMode == NDOverlayXOR) {
+      for (i=0; i<nPixels; i++) {
+        pValue = pData + pOffset[i];
+        *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
+      }
+    }
   }
 }
 
 
-
+
 template <typename epicsType>
 void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
 {
-  int xmin, xmax, ymin, ymax, xcent, ycent, xsize, ysize, ix, iy, ii, jj, ib;
+  int xmin, xmax, ymin, ymax, xcent, ycent, xsize, ysize, ix, iy, ii, jj;
   int xwide, ywide, xwidemax_line, xwidemin_line;
   std::vector<int>::iterator it;
   int nSteps;
   double theta, thetaStep;
   epicsType *pData=(epicsType *)pArray->pData;
   char textOutStr[512];                    // our string, maybe with a time stamp, to place into the image array
-  char *cp;                                // character pointer to current character being rendered
-  int bmc;                                 // current byte in the font bitmap
-  int mask;                                // selects the bit in bmc to look at
   char tstr[64];                           // Used to build the time string
   NDPluginOverlayTextFontBitmapType *bmp;  // pointer to our font information (bitmap pointer, perhaps misnamed)
-  int bpc;                                 // bytes per char, ie, 1 for 6x13 font, 2 for 9x15 font
-  int sbc;                                 // "sub" byte counter to keep track of which byte we are looking at for multi byte fonts
+  NDOverlayGlyph_t *pGlyph;                // the pixels of the current character
+  int nChars;                              // the length of textOutStr
+  int ch;                                  // the current character
   //static const char *functionName = "doOverlayT";
 
   asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
@@ -190,14 +244,11 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
         break;
 
       case NDOverlayText:
-        if ((pOverlay->Font >= 0) && (pOverlay->Font < NDPluginOverlayTextFontBitmapTypeN)) {
-          bmp = &NDPluginOverlayTextFontBitmaps[pOverlay->Font];
-        } else {
+        if ((pOverlay->Font < 0) || (pOverlay->Font >= NDPluginOverlayTextFontBitmapTypeN)) {
           // Really, no reason to go on if the font is ill defined
           return;
         }
-
-        bpc = bmp->width / 8 + 1;
+        bmp = &NDPluginOverlayTextFontBitmaps[pOverlay->Font];
 
         if (strlen(pOverlay->TimeStampFormat) > 0) {
           epicsTimeToStrftime(tstr, sizeof(tstr)-1, pOverlay->TimeStampFormat, &pArray->epicsTS);
@@ -207,52 +258,47 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
         }
         textOutStr[sizeof(textOutStr)-1] = 0;
 
-        cp   = textOutStr;
         xmin = pOverlay->PositionX;
         xmax = pOverlay->PositionX + pOverlay->SizeX;
         ymin = pOverlay->PositionY;
         ymax = pOverlay->PositionY + pOverlay->SizeY;
         ymax = MIN(ymax, pOverlay->PositionY + bmp->height);
-
-        // Loop over vertical lines
-        for (jj=0, iy=ymin; iy<ymax; jj++, iy++) {
-
-          // Loop over characters
-          for (ii=0; cp[ii]!=0; ii++) {
-            if( cp[ii] < 32)
-              continue;
-
-            if (xmin+ii * bmp->width >= xmax)
-              // None of this character can be written
-              break;
-
-            sbc = 0;
-            bmc = bmp->bitmap[(bmp->height*(cp[ii] - 32) + jj)*bpc];
-            mask = 0x80;
-            for (ib=0; ib<bmp->width; ib++) {
-              ix = xmin + ii * bmp->width + ib;
-              if (ix >= xmax)
-                break;
-              if (mask & bmc) {
-                addPixel(pOverlay, ix, iy, pArrayInfo);
-              }
-              mask >>= 1;
-              if (!mask) {
-                mask = 0x80;
-                sbc++;
-                bmc = bmp->bitmap[(bmp->height*(cp[ii] - 32) + jj)*bpc + sbc];
-              }
-            }
+        xmax = MIN(xmax, (int)pArrayInfo->xSize);
+        ymax = MIN(ymax, (int)pArrayInfo->ySize);
+
+        // When only the time stamp has changed just the characters that differ from the last text are
+        // rasterized again, usually the last digits
+        if (pOverlay->pvt.layoutChanged) pOverlay->pvt.text.clear();
+        nChars = (int)strlen(textOutStr);
+        pOverlay->pvt.charOffsets.resize(nChars);
+        for (ii=0; ii<nChars; ii++) {
+          if ((ii < (int)pOverlay->pvt.text.size()) && (pOverlay->pvt.text[ii] == textOutStr[ii]))
+            continue;
+          std::vector<int> &charOffset = pOverlay->pvt.charOffsets[ii];
+          charOffset.clear();
+          ch = (unsigned char)textOutStr[ii];
+          if ((ch < FIRST_GLYPH) || (ch >= FIRST_GLYPH + NUM_GLYPHS))
+            continue;
+          pGlyph = &glyphs_[pOverlay->Font][ch - FIRST_GLYPH];
+          for (jj=0; jj<(int)pGlyph->x.size(); jj++) {
+            ix = xmin + ii * bmp->width + pGlyph->x[jj];
+            iy = ymin + pGlyph->y[jj];
+            if ((ix >= 0) && (ix < xmax) && (iy >= 0) && (iy < ymax))
+              charOffset.push_back(iy*pArrayInfo->yStride + ix*pArrayInfo->xStride);
           }
         }
+        pOverlay->pvt.text = textOutStr;
+        for (ii=0; ii<nChars; ii++) {
+          pOverlay->pvt.addressOffset.insert(pOverlay->pvt.addressOffset.end(),
+                                             pOverlay->pvt.charOffsets[ii].begin(),
+                                             pOverlay->pvt.charOffsets[ii].end());
+        }
         break;
     } // switch(pOverlay->shape)
   } // if (pOverlay->pvt.changed)
 
   // Set the pixels in the image from the addressOffset vector list
-  for (ii=0; ii<(int)pOverlay->pvt.addressOffset.size(); ii++) {
-    setPixel(pData + pOverlay->pvt.addressOffset[ii], pOverlay, pArrayInfo);
-  }
+  setPixels(pData, pOverlay, pArrayInfo);
 }
 
 int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
@@ -291,7 +337,9 @@ int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayIn
 
 
 /** Callback function that is called by the NDArray driver with new NDArray data.
-  * Draws overlays on top of the array.
+  * Draws overlays on top of the array.  The overlays are drawn into the input array itself when this plugin holds
+  * all of its references, because the upstream driver or plugin has released it by the time it is dequeued.
+  * Otherwise they are drawn into a copy.  If no overlay is in use the input array is passed on by reference.
   * \param[in] pArray  The NDArray from the callback.
   */
 void NDPluginOverlay::processCallbacks(NDArray *pArray)
@@ -303,6 +351,8 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
 
   int overlay;
   int itemp;
+  int numUsed=0;
+  int blockingCallbacks;
   NDArray *pOutput;
   NDArrayInfo arrayInfo;
   std::vector<NDOverlay_t>pOverlays;
@@ -314,11 +364,8 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
-  /* Copy the input array so we can modify it. */
-  pOutput = this->pNDArrayPool->copy(pArray, NULL, 1);
-  
   /* Get information about the array needed later */
-  pOutput->getInfo(&arrayInfo);
+  pArray->getInfo(&arrayInfo);
   arrayInfoChanged = (memcmp(&arrayInfo, &this->prevArrayInfo_, sizeof(arrayInfo)) != 0);
   this->prevArrayInfo_ = arrayInfo;
   setIntegerParam(NDPluginOverlayMaxSizeX, (int)arrayInfo.xSize);
@@ -332,6 +379,7 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
     pOverlay = &pOverlays[overlay];
     getIntegerParam(overlay, NDPluginOverlayUse, &pOverlay->use);
     if (!pOverlay->use) continue;
+    numUsed++;
      /* Need to fetch all of these parameters while we still have the mutex */
     getIntegerParam(overlay, NDPluginOverlayPositionX,  &pOverlay->PositionX);
     getIntegerParam(overlay, NDPluginOverlayPositionY,  &pOverlay->PositionY);
@@ -353,11 +401,39 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
     // Compare to see if any fields in the overlay have changed
     pOverlay->pvt.changed = (memcmp(&this->prevOverlays_[overlay], pOverlay, overlayUserLen) != 0);
     if (arrayInfoChanged) pOverlay->pvt.changed = true;
+    pOverlay->pvt.layoutChanged = pOverlay->pvt.changed;
     /* If this is a text overlay with a non-blank time stamp format then it always needs to be updated */
     if ((pOverlay->shape == NDOverlayText) && (strlen(pOverlay->TimeStampFormat) > 0)) {
         pOverlay->pvt.changed = true;
     }
   }
+  if (numUsed == 0) {
+    this->prevOverlays_ = pOverlays;
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    callStatusCallbacks();
+    return;
+  }
+
+  /* With non-blocking callbacks the only references to an array that owns its data may be the one the queue took
+   * for this call and pPrevInputArray_.  The overlays are then drawn into it, and the reference of
+   * pPrevInputArray_ is passed on with it, since it is no longer the unmodified input that ProcessPlugin needs.
+   * Otherwise copy the input array so we can modify it. */
+  getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
+  if (!blockingCallbacks && (pArray == this->pPrevInputArray_) && pArray->ownsData() &&
+      (pArray->getReferenceCount() == 2)) {
+    this->pPrevInputArray_ = NULL;
+    pOutput = pArray;
+  } else {
+    pOutput = this->pNDArrayPool->copy(pArray, NULL, 1);
+    if (!pOutput) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s cannot allocate output array\n", driverName, functionName);
+      this->prevOverlays_ = pOverlays;
+      callStatusCallbacks();
+      return;
+    }
+  }
+
   /* This function is called with the lock taken, and it must be set when we exit.
    * The following code can be exected without the mutex because we are not accessing memory
    * that other threads can access. */
@@ -373,7 +449,7 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
   this->lock();
   this->prevOverlays_ = pOverlays;
   NDPluginDriver::endProcessCallbacks(pOutput, false, true);
-  callParamCallbacks();
+  callStatusCallbacks();
 }
 
 
@@ -415,6 +491,9 @@ NDPluginOverlay::NDPluginOverlay(const char *portName, int queueSize, int blocki
 
   this->maxOverlays_ = maxOverlays;
   this->prevOverlays_.resize(maxOverlays_);
+  buildGlyphs();
+  /* The input array is passed on by reference when no overlay is in use */
+  passArraysByReference_ = true;
 
   createParam(NDPluginOverlayMaxSizeXString,        asynParamInt32, &NDPluginOverlayMaxSizeX);
   createParam(NDPluginOverlayMaxSizeYString,        asynParamInt32, &NDPluginOverlayMaxSizeY);
@@ -2,6 +2,7 @@
 #define NDPluginOverlay_H
 
 #include <vector>
+#include <string>
 #include <algorithm>
 #include "NDPluginDriver.h"
 
@@ -20,10 +21,19 @@ typedef enum {
 typedef struct {
     std::vector<int> addressOffset;
     bool changed;
+    bool layoutChanged;                         /* changed, other than by the time stamp of a text overlay */
     bool freezePositionX;
     bool freezePositionY;
+    std::string text;                           /* The text that addressOffset holds for a text overlay */
+    std::vector<std::vector<int> > charOffsets; /* The address offsets of each character of text */
 } NDOverlayPvt_t;
 
+/** The pixels of a font character that are set, relative to the upper left corner of the character */
+typedef struct {
+    std::vector<int> x;
+    std::vector<int> y;
+} NDOverlayGlyph_t;
+
 /** Structure defining an overlay */
 typedef struct NDOverlay {
     int use;
@@ -104,10 +114,12 @@ private:
     int maxOverlays_;
     NDArrayInfo prevArrayInfo_;
     std::vector<NDOverlay_t> prevOverlays_;    /* Vector of NDOverlay structures */
+    std::vector<std::vector<NDOverlayGlyph_t> > glyphs_; /* The glyphs of the characters of each font */
+    void buildGlyphs();
     inline void addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInfo_t *pArrayInfo);
     template <typename epicsType> void doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
     int doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
-    template <typename epicsType> void setPixel(epicsType *pValue, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
+    template <typename epicsType> void setPixels(epicsType *pData, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
 };
     
 #endif
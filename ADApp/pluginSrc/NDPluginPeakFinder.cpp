@@ -0,0 +1,384 @@
+/*
+ * NDPluginPeakFinder.cpp
+ *
+ * Peak finding plugin: thresholds each pixel against the background of the ring of pixels around it,
+ * joins the pixels above the threshold into peaks, and outputs a peak table or the hit frames.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsAtomic.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginPeakFinder.h"
+
+static const char *driverName = "NDPluginPeakFinder";
+
+/* The arguments of the stripe functions */
+typedef struct {
+    NDDataType_t dataType;
+    const void *pData;
+    size_t sizeX;
+    size_t sizeY;
+    double *pSum;
+    double *pSumSquares;
+    const NDPeakThreshold_t *pThreshold;
+    size_t maxSpans;                                /* The largest number of runs of a stripe */
+    std::vector<std::vector<NDPeakSpan_t> > spans;  /* The runs of each stripe */
+    std::vector<int> status;                        /* The status of each stripe */
+} peakArgs_t;
+
+/* Computes the summed-area tables of one stripe; called by parallelForRows() */
+static void summedAreaStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    peakArgs_t *pArgs = (peakArgs_t *)pArg;
+
+    pArgs->status[stripe] = NDPeakSummedArea(pArgs->dataType, pArgs->pData, pArgs->sizeX, firstRow, numRows,
+                                             pArgs->pSum, pArgs->pSumSquares);
+}
+
+/* Adds the row above a stripe to the rows of the stripe, except its last row, which is already complete;
+ * called by parallelForRows() */
+static void summedAreaAddStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    peakArgs_t *pArgs = (peakArgs_t *)pArg;
+
+    if ((firstRow > 0) && (numRows > 1)) {
+        NDPeakSummedAreaAdd(pArgs->pSum, pArgs->pSumSquares, pArgs->sizeX, firstRow, firstRow+1, numRows-1);
+    }
+}
+
+/* Finds the runs of pixels above the threshold of one stripe; called by parallelForRows() */
+static void findSpansStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    peakArgs_t *pArgs = (peakArgs_t *)pArg;
+
+    pArgs->status[stripe] = NDPeakFindSpans(pArgs->dataType, pArgs->pData, pArgs->sizeX, pArgs->sizeY,
+                                            pArgs->pSum, pArgs->pSumSquares, pArgs->pThreshold,
+                                            firstRow, numRows, pArgs->maxSpans, pArgs->spans[stripe]);
+}
+
+/** Finds the runs of pixels above the threshold of a 2-D array, in parallel over stripes of rows.
+  * \param[in] pArray The contiguous 2-D array.
+  * \param[in] threshold The threshold.
+  * \param[in] maxSpans The largest number of runs of a stripe.
+  * \param[out] spans The runs, in the order of their rows and columns.
+  * \return ND_SUCCESS, or ND_ERROR if the tables cannot be allocated or a stripe had more than maxSpans runs,
+  *      in which case spans has the runs that were found. */
+int NDPluginPeakFinder::findPeaks(NDArray *pArray, const NDPeakThreshold_t &threshold, size_t maxSpans,
+                                  std::vector<NDPeakSpan_t> &spans)
+{
+    size_t tableBytes;
+    peakArgs_t args;
+    int stripes, stripe;
+    size_t firstRow, numRows;
+    int status = ND_SUCCESS;
+    static const char *functionName = "findPeaks";
+
+    args.dataType = pArray->dataType;
+    args.pData = pArray->pData;
+    args.sizeX = pArray->dims[0].size;
+    args.sizeY = pArray->dims[1].size;
+    /* The tables are the same size for every array, so they come from the scratch arena */
+    tableBytes = (args.sizeX + 1) * (args.sizeY + 1) * sizeof(double);
+    args.pSum = (double *)scratchBuffer(tableBytes);
+    args.pSumSquares = (double *)scratchBuffer(tableBytes);
+    if (!args.pSum || !args.pSumSquares) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot allocate the summed-area tables\n",
+            driverName, functionName);
+        return ND_ERROR;
+    }
+    args.pThreshold = &threshold;
+    args.maxSpans = maxSpans;
+    stripes = numStripes(args.sizeY);
+    args.spans.resize(stripes);
+    args.status.assign(stripes, ND_SUCCESS);
+
+    /* Each stripe sums its rows as if the rows above it were 0.  The last row of each stripe is then completed in
+     * order, which only adds one row per stripe, and the other rows in parallel.  The stripes of parallelForRows()
+     * are the same for the same number of rows and stripes. */
+    parallelForRows(summedAreaStripe, &args, args.sizeY, stripes);
+    if (args.status[0] != ND_SUCCESS) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s unsupported data type %d\n",
+            driverName, functionName, pArray->dataType);
+        return ND_ERROR;
+    }
+    for (stripe=1; stripe<stripes; stripe++) {
+        firstRow = args.sizeY * stripe / stripes;
+        numRows = args.sizeY * (stripe + 1) / stripes - firstRow;
+        NDPeakSummedAreaAdd(args.pSum, args.pSumSquares, args.sizeX, firstRow, firstRow + numRows, 1);
+    }
+    parallelForRows(summedAreaAddStripe, &args, args.sizeY, stripes);
+
+    parallelForRows(findSpansStripe, &args, args.sizeY, stripes);
+    spans.clear();
+    for (stripe=0; stripe<stripes; stripe++) {
+        if (args.status[stripe] != ND_SUCCESS) status = ND_ERROR;
+        spans.insert(spans.end(), args.spans[stripe].begin(), args.spans[stripe].end());
+    }
+
+    return status;
+}
+
+/** Called by the default NDPluginDriver::processCallbacks() with the lock released.
+  * Finds the peaks of the array and outputs the peak table, or the array if it is a hit or if all the arrays
+  * are output.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] params The parameter values when processing of this array began.
+  * \param[out] results The number of peaks, and the counts of arrays and hits.
+  */
+NDArray* NDPluginPeakFinder::processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                                      NDPluginParamSnapshot &results)
+{
+    NDArray *pOutput = NULL;
+    NDPeakThreshold_t threshold;
+    std::vector<NDPeakSpan_t> spans;
+    std::vector<NDPeak_t> peaks;
+    NDDimension_t dims[2];
+    size_t tableDims[2];
+    int maxPeaks, minPeaks, output;
+    int numPeaks, peakCount, hit, numFrames, numHits;
+    static const char *functionName = "processCallbacksUnlocked";
+
+    if ((pArray->ndims != 2) || (pArray->dims[0].size == 0) || (pArray->dims[1].size == 0)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s arrays must have 2 dimensions, this one has %d\n",
+            driverName, functionName, pArray->ndims);
+        return NULL;
+    }
+
+    threshold.backgroundRadius = params.getInteger(NDPluginPeakFinderBackgroundRadius);
+    threshold.innerRadius = params.getInteger(NDPluginPeakFinderInnerRadius);
+    threshold.snr = params.getDouble(NDPluginPeakFinderSNR);
+    threshold.minSignal = params.getDouble(NDPluginPeakFinderMinSignal);
+    maxPeaks = params.getInteger(NDPluginPeakFinderMaxPeaks);
+    if (maxPeaks < 1) maxPeaks = 1;
+    minPeaks = params.getInteger(NDPluginPeakFinderMinPeaks);
+    output = params.getInteger(NDPluginPeakFinderOutput);
+
+    /* A stripe may have two runs per row and more for the peaks; a noisy array with far more is cut off */
+    if (findPeaks(pArray, threshold, 16*(size_t)maxPeaks + 2*pArray->dims[1].size, spans) != ND_SUCCESS) {
+        if (spans.empty()) return NULL;
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s too many pixels above the threshold, some peaks of array %d were not found\n",
+            driverName, functionName, pArray->uniqueId);
+    }
+    NDPeakLabelSpans(spans, params.getInteger(NDPluginPeakFinderMinPixels),
+                     params.getInteger(NDPluginPeakFinderMaxPixels), peaks);
+
+    numPeaks = (int)peaks.size();
+    peakCount = (numPeaks < maxPeaks) ? numPeaks : maxPeaks;
+    hit = (numPeaks >= minPeaks) ? 1 : 0;
+    numFrames = epicsAtomicIncrIntT(&numFrames_);
+    numHits = hit ? epicsAtomicIncrIntT(&numHits_) : epicsAtomicGetIntT(&numHits_);
+    results.setInteger(NDPluginPeakFinderNumPeaks, numPeaks);
+    results.setInteger(NDPluginPeakFinderHit, hit);
+    results.setInteger(NDPluginPeakFinderNumFrames, numFrames);
+    results.setInteger(NDPluginPeakFinderNumHits, numHits);
+    results.setDouble(NDPluginPeakFinderHitRate, (numFrames > 0) ? 100. * numHits / numFrames : 0.);
+
+    switch (output) {
+        case NDPeakFinderOutputTable:
+            tableDims[0] = ND_PEAK_COLUMNS;
+            tableDims[1] = maxPeaks;
+            pOutput = this->pNDArrayPool->alloc(2, tableDims, NDFloat64, 0, NULL);
+            if (!pOutput) break;
+            /* The rows after the peaks are 0 */
+            memset(pOutput->pData, 0, ND_PEAK_COLUMNS * maxPeaks * sizeof(epicsFloat64));
+            if (peakCount > 0) memcpy(pOutput->pData, &peaks[0], peakCount * sizeof(NDPeak_t));
+            pOutput->uniqueId = pArray->uniqueId;
+            pOutput->timeStamp = pArray->timeStamp;
+            pOutput->epicsTS = pArray->epicsTS;
+            pArray->pAttributeList->copy(pOutput->pAttributeList);
+            break;
+        case NDPeakFinderOutputHits:
+            if (!hit) return NULL;
+            /* Fall through */
+        case NDPeakFinderOutputAll:
+            pArray->initDimension(&dims[0], pArray->dims[0].size);
+            pArray->initDimension(&dims[1], pArray->dims[1].size);
+            pOutput = this->pNDArrayPool->createView(pArray, dims);
+            break;
+        default:
+            return NULL;
+    }
+    if (!pOutput) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot allocate the output array\n",
+            driverName, functionName);
+        return NULL;
+    }
+    pOutput->pAttributeList->add("PeakCount", "Number of rows of the peak table", NDAttrInt32, &peakCount);
+    pOutput->pAttributeList->add("PeakHit", "1 if the array has enough peaks", NDAttrInt32, &hit);
+
+    return pOutput;
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Resets the counts of arrays and hits for PEAK_RESET; other parameters go to NDPluginDriver::writeInt32.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginPeakFinder::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    if (function == NDPluginPeakFinderReset) {
+        epicsAtomicSetIntT(&numFrames_, 0);
+        epicsAtomicSetIntT(&numHits_, 0);
+        setIntegerParam(NDPluginPeakFinderNumFrames, 0);
+        setIntegerParam(NDPluginPeakFinderNumHits, 0);
+        setDoubleParam(NDPluginPeakFinderHitRate, 0.);
+    } else {
+        status = NDPluginDriver::writeInt32(pasynUser, value);
+    }
+    callParamCallbacks();
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s::%s error, status=%d function=%d, value=%d\n",
+              driverName, functionName, status, function, value);
+    return status;
+}
+
+
+/** Constructor for NDPluginPeakFinder; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method sets reasonable default values for all of the
+  * parameters.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *      NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *      at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *      0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *      of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The maximum number of threads this driver is allowed to use. If 0 then 1 will be used.
+  */
+NDPluginPeakFinder::NDPluginPeakFinder(const char *portName, int queueSize, int blockingCallbacks,
+                                       const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
+                                       int priority, int stackSize, int maxThreads)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                     NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                     asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                     asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                     ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads),
+      numFrames_(0), numHits_(0)
+{
+    createParam(NDPluginPeakFinderBackgroundRadiusString, asynParamInt32,   &NDPluginPeakFinderBackgroundRadius);
+    createParam(NDPluginPeakFinderInnerRadiusString,      asynParamInt32,   &NDPluginPeakFinderInnerRadius);
+    createParam(NDPluginPeakFinderSNRString,              asynParamFloat64, &NDPluginPeakFinderSNR);
+    createParam(NDPluginPeakFinderMinSignalString,        asynParamFloat64, &NDPluginPeakFinderMinSignal);
+    createParam(NDPluginPeakFinderMinPixelsString,        asynParamInt32,   &NDPluginPeakFinderMinPixels);
+    createParam(NDPluginPeakFinderMaxPixelsString,        asynParamInt32,   &NDPluginPeakFinderMaxPixels);
+    createParam(NDPluginPeakFinderMaxPeaksString,         asynParamInt32,   &NDPluginPeakFinderMaxPeaks);
+    createParam(NDPluginPeakFinderMinPeaksString,         asynParamInt32,   &NDPluginPeakFinderMinPeaks);
+    createParam(NDPluginPeakFinderOutputString,           asynParamInt32,   &NDPluginPeakFinderOutput);
+    createParam(NDPluginPeakFinderNumPeaksString,         asynParamInt32,   &NDPluginPeakFinderNumPeaks);
+    createParam(NDPluginPeakFinderHitString,              asynParamInt32,   &NDPluginPeakFinderHit);
+    createParam(NDPluginPeakFinderNumFramesString,        asynParamInt32,   &NDPluginPeakFinderNumFrames);
+    createParam(NDPluginPeakFinderNumHitsString,          asynParamInt32,   &NDPluginPeakFinderNumHits);
+    createParam(NDPluginPeakFinderHitRateString,          asynParamFloat64, &NDPluginPeakFinderHitRate);
+    createParam(NDPluginPeakFinderResetString,            asynParamInt32,   &NDPluginPeakFinderReset);
+    addSnapshotParam(NDPluginPeakFinderBackgroundRadius);
+    addSnapshotParam(NDPluginPeakFinderInnerRadius);
+    addSnapshotParam(NDPluginPeakFinderSNR);
+    addSnapshotParam(NDPluginPeakFinderMinSignal);
+    addSnapshotParam(NDPluginPeakFinderMinPixels);
+    addSnapshotParam(NDPluginPeakFinderMaxPixels);
+    addSnapshotParam(NDPluginPeakFinderMaxPeaks);
+    addSnapshotParam(NDPluginPeakFinderMinPeaks);
+    addSnapshotParam(NDPluginPeakFinderOutput);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginPeakFinder");
+    setIntegerParam(NDPluginPeakFinderBackgroundRadius, 5);
+    setIntegerParam(NDPluginPeakFinderInnerRadius, 2);
+    setDoubleParam(NDPluginPeakFinderSNR, 5.);
+    setDoubleParam(NDPluginPeakFinderMinSignal, 0.);
+    setIntegerParam(NDPluginPeakFinderMinPixels, 2);
+    setIntegerParam(NDPluginPeakFinderMaxPixels, 0);
+    setIntegerParam(NDPluginPeakFinderMaxPeaks, 1000);
+    setIntegerParam(NDPluginPeakFinderMinPeaks, 10);
+    setIntegerParam(NDPluginPeakFinderOutput, NDPeakFinderOutputTable);
+    setIntegerParam(NDPluginPeakFinderNumPeaks, 0);
+    setIntegerParam(NDPluginPeakFinderHit, 0);
+    setIntegerParam(NDPluginPeakFinderNumFrames, 0);
+    setIntegerParam(NDPluginPeakFinderNumHits, 0);
+    setDoubleParam(NDPluginPeakFinderHitRate, 0.);
+
+    // Enable ArrayCallbacks.
+    // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
+    setIntegerParam(NDArrayCallbacks, 1);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/** Configuration command */
+extern "C" int NDPeakFinderConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                     const char *NDArrayPort, int NDArrayAddr,
+                                     int maxBuffers, size_t maxMemory,
+                                     int priority, int stackSize, int maxThreads)
+{
+    NDPluginPeakFinder *pPlugin = new NDPluginPeakFinder(portName, queueSize, blockingCallbacks, NDArrayPort,
+                                                         NDArrayAddr, maxBuffers, maxMemory, priority, stackSize,
+                                                         maxThreads);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg initArg9 = { "# threads",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDPeakFinderConfigure",10,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDPeakFinderConfigure(args[0].sval, args[1].ival, args[2].ival,
+                          args[3].sval, args[4].ival, args[5].ival,
+                          args[6].ival, args[7].ival, args[8].ival,
+                          args[9].ival);
+}
+
+extern "C" void NDPeakFinderRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDPeakFinderRegister);
+}
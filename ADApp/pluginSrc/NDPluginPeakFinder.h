@@ -0,0 +1,80 @@
+#ifndef NDPluginPeakFinder_H
+#define NDPluginPeakFinder_H
+
+#include <epicsTypes.h>
+
+#include "NDPluginDriver.h"
+#include "NDPeakKernels.h"
+
+#define NDPluginPeakFinderBackgroundRadiusString "PEAK_BACKGROUND_RADIUS" /* (asynInt32, r/w) Half width of the
+                                                                          *  background box */
+#define NDPluginPeakFinderInnerRadiusString "PEAK_INNER_RADIUS" /* (asynInt32, r/w) Half width of the inner box,
+                                                                 *  which is not part of the background */
+#define NDPluginPeakFinderSNRString         "PEAK_SNR"          /* (asynFloat64, r/w) Signal to noise threshold */
+#define NDPluginPeakFinderMinSignalString   "PEAK_MIN_SIGNAL"   /* (asynFloat64, r/w) Smallest signal above the
+                                                                 *  background of a peak pixel */
+#define NDPluginPeakFinderMinPixelsString   "PEAK_MIN_PIXELS"   /* (asynInt32, r/w) Smallest number of pixels of a peak */
+#define NDPluginPeakFinderMaxPixelsString   "PEAK_MAX_PIXELS"   /* (asynInt32, r/w) Largest number of pixels of a peak,
+                                                                 *  0 for no limit */
+#define NDPluginPeakFinderMaxPeaksString    "PEAK_MAX_PEAKS"    /* (asynInt32, r/w) Number of rows of the peak table */
+#define NDPluginPeakFinderMinPeaksString    "PEAK_MIN_PEAKS"    /* (asynInt32, r/w) Smallest number of peaks of a hit */
+#define NDPluginPeakFinderOutputString      "PEAK_OUTPUT"       /* (asynInt32, r/w) Output arrays, NDPeakFinderOutput_t */
+#define NDPluginPeakFinderNumPeaksString    "PEAK_NUM_PEAKS"    /* (asynInt32, r/o) Number of peaks of the last array */
+#define NDPluginPeakFinderHitString         "PEAK_HIT"          /* (asynInt32, r/o) The last array was a hit */
+#define NDPluginPeakFinderNumFramesString   "PEAK_NUM_FRAMES"   /* (asynInt32, r/o) Number of arrays since the reset */
+#define NDPluginPeakFinderNumHitsString     "PEAK_NUM_HITS"     /* (asynInt32, r/o) Number of hits since the reset */
+#define NDPluginPeakFinderHitRateString     "PEAK_HIT_RATE"     /* (asynFloat64, r/o) Percentage of hits since the reset */
+#define NDPluginPeakFinderResetString       "PEAK_RESET"        /* (asynInt32, r/w) Resets the counts of arrays and hits */
+
+/** The arrays that NDPluginPeakFinder outputs */
+typedef enum {
+    NDPeakFinderOutputTable,    /**< The peak table of each array */
+    NDPeakFinderOutputHits,     /**< The arrays that are hits */
+    NDPeakFinderOutputAll       /**< All the arrays */
+} NDPeakFinderOutput_t;
+
+/** Finds the peaks of 2-D arrays, such as the Bragg peaks of serial crystallography frames, and outputs a table of
+  * their centroids, intensities and sizes, or only the arrays with enough peaks.
+  * A pixel is part of a peak if it is above the mean of the background around it by SNR times the standard
+  * deviation of the background, a box less an inner box that holds the peak, read from summed-area tables, and
+  * the pixels above the threshold that touch are joined into peaks.
+  * The output arrays have the attributes PeakCount, the number of rows of the table, and PeakHit, 1 for a hit,
+  * for the file plugins to filter on. */
+class epicsShareClass NDPluginPeakFinder : public NDPluginDriver {
+public:
+    NDPluginPeakFinder(const char *portName, int queueSize, int blockingCallbacks,
+                       const char *NDArrayPort, int NDArrayAddr,
+                       int maxBuffers, size_t maxMemory,
+                       int priority, int stackSize, int maxThreads=1);
+    /* These methods override the virtual methods in the base class */
+    NDArray* processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                      NDPluginParamSnapshot &results);
+    asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDPluginPeakFinderBackgroundRadius;
+    #define FIRST_NDPLUGIN_PEAK_FINDER_PARAM NDPluginPeakFinderBackgroundRadius
+    int NDPluginPeakFinderInnerRadius;
+    int NDPluginPeakFinderSNR;
+    int NDPluginPeakFinderMinSignal;
+    int NDPluginPeakFinderMinPixels;
+    int NDPluginPeakFinderMaxPixels;
+    int NDPluginPeakFinderMaxPeaks;
+    int NDPluginPeakFinderMinPeaks;
+    int NDPluginPeakFinderOutput;
+    int NDPluginPeakFinderNumPeaks;
+    int NDPluginPeakFinderHit;
+    int NDPluginPeakFinderNumFrames;
+    int NDPluginPeakFinderNumHits;
+    int NDPluginPeakFinderHitRate;
+    int NDPluginPeakFinderReset;
+
+private:
+    int findPeaks(NDArray *pArray, const NDPeakThreshold_t &threshold, size_t maxSpans,
+                  std::vector<NDPeakSpan_t> &spans);
+
+    int numFrames_;     /**< Arrays since the reset, updated atomically by the processing threads */
+    int numHits_;       /**< Hits since the reset, updated atomically by the processing threads */
+};
+
+#endif
@@ -21,15 +21,415 @@
 
 #include <asynDriver.h>
 
+#include <NDConvertKernels.h>
+
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "NDPluginProcess.h"
+#include "NDProcessKernels.h"
+#ifdef ND_WITH_CUDA
+#include "NDCudaKernels.h"
+#endif
 
 static const char *driverName="NDPluginProcess";
 
 
+/* The number of elements each stripe processes at a time, small enough for the block to stay in the L1 cache */
+#define PROCESS_BLOCK 1024
+
+/* The range of the input elements of one stripe */
+typedef struct {
+    double minValue;
+    double maxValue;
+} processStripe_t;
+
+/* The arguments of processStripe().  The background, flat field and filter arrays are in the arithmetic type. */
+typedef struct {
+    NDDataType_t inType;
+    NDDataType_t outType;
+    NDDataType_t calcType;
+    size_t inBytes;             /* Bytes per element of the input */
+    size_t outBytes;            /* Bytes per element of the output */
+    size_t rowSize;             /* Elements per row */
+    const void *pIn;
+    void   *pOut;               /* NULL when no output array is made for this input array */
+    const void *pBackground;    /* NULL when the background is not subtracted */
+    const void *pGain;          /* Gain and bias maps of the flat field; NULL when the flat field is not applied */
+    const void *pBias;
+    void   *pFilter;            /* NULL when the filter is not enabled */
+    NDProcessCorrection_t correction;
+    int    initFilter;          /* Set the filter to the processed input before it is reset */
+    int    resetFilter;
+    double rOffset, rc1, rc2;
+    double oOffset, O1, O2;
+    double fOffset, F1, F2;
+    processStripe_t *pStripes;  /* The range of the input of each stripe; NULL unless autoOffsetScale is set */
+    void   *pAccumulator;       /* The frame accumulator; NULL when frames are not accumulated */
+    NDProcessAccType_t accType;
+    NDProcessAccOp_t accOp;     /* Set the accumulator to the first frame, or add the frame */
+    int    rawAccumulate;       /* Accumulate the input elements rather than the corrected ones */
+    const void *pOldest;        /* The frame that leaves the running window, in the accumulated type, or NULL */
+    void   *pHistory;           /* Where the corrected elements are kept for the running window, or NULL */
+    double divisor;             /* The accumulator is divided by this for the output */
+    NDProcessTemporalOp_t temporalOp;
+    int    nTemporal;           /* The number of frames of the temporal filter, 0 when it is off */
+    const void *pTemporal[ND_PROCESS_MAX_TEMPORAL];
+    int    useExpression;       /* The expression replaces the background and flat field corrections */
+    const void *pFlatField;     /* The flat field of the expression, or NULL */
+    NDProcessExpression_t expression;
+    double nameValues[ND_EXPRESSION_MAX_NAMES];     /* The values of the attributes of the expression */
+} processArgs_t;
+
+template <typename epicsTypeIn, typename epicsTypeOut>
+static void castBlockT(const void *pIn, void *pOut, size_t n)
+{
+    const epicsTypeIn *pInT = (const epicsTypeIn *)pIn;
+    epicsTypeOut *pOutT = (epicsTypeOut *)pOut;
+    size_t i;
+
+    for (i=0; i<n; i++) pOutT[i] = (epicsTypeOut)pInT[i];
+}
+
+template <typename epicsTypeIn>
+static void castBlockOut(NDDataType_t outType, const void *pIn, void *pOut, size_t n)
+{
+    switch (outType) {
+        case NDInt8:
+            castBlockT<epicsTypeIn, epicsInt8>(pIn, pOut, n);
+            break;
+        case NDUInt8:
+            castBlockT<epicsTypeIn, epicsUInt8>(pIn, pOut, n);
+            break;
+        case NDInt16:
+            castBlockT<epicsTypeIn, epicsInt16>(pIn, pOut, n);
+            break;
+        case NDUInt16:
+            castBlockT<epicsTypeIn, epicsUInt16>(pIn, pOut, n);
+            break;
+        case NDInt32:
+            castBlockT<epicsTypeIn, epicsInt32>(pIn, pOut, n);
+            break;
+        case NDUInt32:
+            castBlockT<epicsTypeIn, epicsUInt32>(pIn, pOut, n);
+            break;
+        case NDFloat32:
+            castBlockT<epicsTypeIn, epicsFloat32>(pIn, pOut, n);
+            break;
+        case NDFloat64:
+            castBlockT<epicsTypeIn, epicsFloat64>(pIn, pOut, n);
+            break;
+        case NDFloat16:
+            castBlockT<epicsTypeIn, NDFloat16_t>(pIn, pOut, n);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Converts a block of elements with the vectorized kernels if there is one for the pair of types, as
+ * NDArrayPool::convert() does */
+static void convertBlock(NDDataType_t inType, const void *pIn, NDDataType_t outType, void *pOut, size_t n)
+{
+    if (NDConvertContiguous(inType, pIn, outType, pOut, n) == ND_SUCCESS) return;
+    switch (inType) {
+        case NDInt8:
+            castBlockOut<epicsInt8>(outType, pIn, pOut, n);
+            break;
+        case NDUInt8:
+            castBlockOut<epicsUInt8>(outType, pIn, pOut, n);
+            break;
+        case NDInt16:
+            castBlockOut<epicsInt16>(outType, pIn, pOut, n);
+            break;
+        case NDUInt16:
+            castBlockOut<epicsUInt16>(outType, pIn, pOut, n);
+            break;
+        case NDInt32:
+            castBlockOut<epicsInt32>(outType, pIn, pOut, n);
+            break;
+        case NDUInt32:
+            castBlockOut<epicsUInt32>(outType, pIn, pOut, n);
+            break;
+        case NDFloat32:
+            castBlockOut<epicsFloat32>(outType, pIn, pOut, n);
+            break;
+        case NDFloat64:
+            castBlockOut<epicsFloat64>(outType, pIn, pOut, n);
+            break;
+        case NDFloat16:
+            castBlockOut<NDFloat16_t>(outType, pIn, pOut, n);
+            break;
+        default:
+            break;
+    }
+}
+
+template <typename epicsType>
+static void rangeBlockT(const void *pData, size_t n, processStripe_t *pStripe)
+{
+    const epicsType *pIn = (const epicsType *)pData;
+    epicsType minValue = (epicsType)pStripe->minValue, maxValue = (epicsType)pStripe->maxValue;
+    size_t i;
+
+    for (i=0; i<n; i++) {
+        if (pIn[i] < minValue) minValue = pIn[i];
+        if (pIn[i] > maxValue) maxValue = pIn[i];
+    }
+    pStripe->minValue = (double)minValue;
+    pStripe->maxValue = (double)maxValue;
+}
+
+/* Widens the range of a stripe to include a block of input elements */
+static void rangeBlock(NDDataType_t dataType, const void *pData, size_t n, processStripe_t *pStripe)
+{
+    switch (dataType) {
+        case NDInt8:
+            rangeBlockT<epicsInt8>(pData, n, pStripe);
+            break;
+        case NDUInt8:
+            rangeBlockT<epicsUInt8>(pData, n, pStripe);
+            break;
+        case NDInt16:
+            rangeBlockT<epicsInt16>(pData, n, pStripe);
+            break;
+        case NDUInt16:
+            rangeBlockT<epicsUInt16>(pData, n, pStripe);
+            break;
+        case NDInt32:
+            rangeBlockT<epicsInt32>(pData, n, pStripe);
+            break;
+        case NDUInt32:
+            rangeBlockT<epicsUInt32>(pData, n, pStripe);
+            break;
+        case NDFloat32:
+            rangeBlockT<epicsFloat32>(pData, n, pStripe);
+            break;
+        case NDFloat64:
+            rangeBlockT<epicsFloat64>(pData, n, pStripe);
+            break;
+        case NDFloat16:
+            rangeBlockT<NDFloat16_t>(pData, n, pStripe);
+            break;
+        default:
+            break;
+    }
+}
+
+template <typename accType, typename epicsTypeOut>
+static void accumulatorOutT(const accType *pAcc, epicsTypeOut *pOut, size_t n, double divisor)
+{
+    double scale = 1. / divisor;
+    size_t i;
+
+    if (divisor == 1.) {
+        for (i=0; i<n; i++) pOut[i] = (epicsTypeOut)pAcc[i];
+    } else {
+        for (i=0; i<n; i++) pOut[i] = (epicsTypeOut)(pAcc[i] * scale);
+    }
+}
+
+template <typename accType>
+static void accumulatorOutSwitch(const accType *pAcc, NDDataType_t outType, void *pOut, size_t n, double divisor)
+{
+    switch (outType) {
+        case NDInt8:
+            accumulatorOutT(pAcc, (epicsInt8 *)pOut, n, divisor);
+            break;
+        case NDUInt8:
+            accumulatorOutT(pAcc, (epicsUInt8 *)pOut, n, divisor);
+            break;
+        case NDInt16:
+            accumulatorOutT(pAcc, (epicsInt16 *)pOut, n, divisor);
+            break;
+        case NDUInt16:
+            accumulatorOutT(pAcc, (epicsUInt16 *)pOut, n, divisor);
+            break;
+        case NDInt32:
+            accumulatorOutT(pAcc, (epicsInt32 *)pOut, n, divisor);
+            break;
+        case NDUInt32:
+            accumulatorOutT(pAcc, (epicsUInt32 *)pOut, n, divisor);
+            break;
+        case NDFloat32:
+            accumulatorOutT(pAcc, (epicsFloat32 *)pOut, n, divisor);
+            break;
+        case NDFloat64:
+            accumulatorOutT(pAcc, (epicsFloat64 *)pOut, n, divisor);
+            break;
+        case NDFloat16:
+            accumulatorOutT(pAcc, (NDFloat16_t *)pOut, n, divisor);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Adds a block of elements to the accumulator, subtracts the matching block of the frame that leaves the running
+ * window, and converts the block of the accumulator to the output type if there is an output array */
+static void accumulateBlock(const processArgs_t *pArgs, NDDataType_t dataType, const void *pData,
+                            size_t elementBytes, size_t block, size_t n)
+{
+    size_t accBytes = (pArgs->accType == NDProcessAccInt32) ? sizeof(epicsInt32) : sizeof(epicsInt64);
+    char *pAcc = (char *)pArgs->pAccumulator + block*accBytes;
+    void *pOut;
+
+    NDProcessAccumulate(dataType, pData, pArgs->accType, pAcc, pArgs->accOp, n);
+    if (pArgs->pOldest)
+        NDProcessAccumulate(dataType, (const char *)pArgs->pOldest + block*elementBytes, pArgs->accType, pAcc,
+                            NDProcessAccSubtract, n);
+    if (!pArgs->pOut) return;
+    pOut = (char *)pArgs->pOut + block*pArgs->outBytes;
+    switch (pArgs->accType) {
+        case NDProcessAccInt32:
+            accumulatorOutSwitch((const epicsInt32 *)pAcc, pArgs->outType, pOut, n, pArgs->divisor);
+            break;
+        case NDProcessAccInt64:
+            accumulatorOutSwitch((const epicsInt64 *)pAcc, pArgs->outType, pOut, n, pArgs->divisor);
+            break;
+        case NDProcessAccFloat64:
+            accumulatorOutSwitch((const epicsFloat64 *)pAcc, pArgs->outType, pOut, n, pArgs->divisor);
+            break;
+    }
+}
+
+/* Applies the recursive filter to a block of corrected elements */
+template <typename calcType>
+static void filterBlockT(const processArgs_t *pArgs, calcType *pValues, calcType *pFilter, size_t n)
+{
+    calcType rOffset = (calcType)pArgs->rOffset, rc1 = (calcType)pArgs->rc1, rc2 = (calcType)pArgs->rc2;
+    calcType oOffset = (calcType)pArgs->oOffset, O1 = (calcType)pArgs->O1, O2 = (calcType)pArgs->O2;
+    calcType fOffset = (calcType)pArgs->fOffset, F1 = (calcType)pArgs->F1, F2 = (calcType)pArgs->F2;
+    calcType value, newData, newFilter;
+    size_t i;
+
+    for (i=0; i<n; i++) {
+        value = pValues[i];
+        if (pArgs->initFilter) pFilter[i] = value;
+        if (pArgs->resetFilter) {
+            newFilter = rOffset;
+            if (rc1) newFilter += rc1*pFilter[i];
+            if (rc2) newFilter += rc2*value;
+            pFilter[i] = newFilter;
+        }
+        newData   = oOffset;
+        if (O1) newData += O1 * pFilter[i];
+        if (O2) newData += O2 * value;
+        newFilter = fOffset;
+        if (F1) newFilter += F1 * pFilter[i];
+        if (F2) newFilter += F2 * value;
+        pValues[i] = newData;
+        pFilter[i] = newFilter;
+    }
+}
+
+/* Processes the elements start to end-1 block by block: converts them to calcType, applies the corrections with
+ * NDProcessCorrect(), filters or accumulates them and converts them to the output type.
+ * Input elements that need no corrections are accumulated without the conversion to calcType. */
+template <typename calcType>
+static void processStripeT(processArgs_t *pArgs, size_t start, size_t end, int stripe)
+{
+    calcType values[PROCESS_BLOCK];
+    epicsFloat64 temporal[PROCESS_BLOCK];
+    const char *pIn;
+    size_t block, n;
+
+    for (block=start; block<end; block+=n) {
+        n = (end - block > PROCESS_BLOCK) ? PROCESS_BLOCK : end - block;
+        pIn = (const char *)pArgs->pIn + block*pArgs->inBytes;
+        /* The temporal filter replaces the input elements, in the input type */
+        if (pArgs->nTemporal > 0) {
+            NDProcessTemporal(pArgs->inType, pArgs->temporalOp, pArgs->pTemporal, pArgs->nTemporal, block,
+                              temporal, n);
+            pIn = (const char *)temporal;
+        }
+        if (pArgs->pStripes) rangeBlock(pArgs->inType, pIn, n, &pArgs->pStripes[stripe]);
+        if (pArgs->rawAccumulate) {
+            accumulateBlock(pArgs, pArgs->inType, pIn, pArgs->inBytes, block, n);
+            continue;
+        }
+        if (pArgs->useExpression) {
+            double x[PROCESS_BLOCK], background[PROCESS_BLOCK], flatField[PROCESS_BLOCK];
+            convertBlock(pArgs->inType, pIn, NDFloat64, x, n);
+            if (pArgs->pBackground) convertBlock(pArgs->calcType, (const calcType *)pArgs->pBackground + block,
+                                                 NDFloat64, background, n);
+            if (pArgs->pFlatField) convertBlock(pArgs->calcType, (const calcType *)pArgs->pFlatField + block,
+                                                NDFloat64, flatField, n);
+            NDProcessExpressionEvaluate(&pArgs->expression, x, pArgs->pBackground ? background : NULL,
+                                        pArgs->pFlatField ? flatField : NULL, block, pArgs->nameValues, x, n);
+            convertBlock(NDFloat64, x, pArgs->calcType, values, n);
+        } else {
+            convertBlock(pArgs->inType, pIn, pArgs->calcType, values, n);
+        }
+        NDProcessCorrect(pArgs->calcType, &pArgs->correction, values,
+                         pArgs->pBackground ? (const calcType *)pArgs->pBackground + block : NULL,
+                         pArgs->pGain ? (const calcType *)pArgs->pGain + block : NULL,
+                         pArgs->pBias ? (const calcType *)pArgs->pBias + block : NULL, n);
+        if (pArgs->pAccumulator) {
+            if (pArgs->pHistory) memcpy((calcType *)pArgs->pHistory + block, values, n*sizeof(calcType));
+            accumulateBlock(pArgs, pArgs->calcType, values, sizeof(calcType), block, n);
+            continue;
+        }
+        if (pArgs->pFilter) filterBlockT(pArgs, values, (calcType *)pArgs->pFilter + block, n);
+        if (pArgs->pOut) convertBlock(pArgs->calcType, values, pArgs->outType,
+                                      (char *)pArgs->pOut + block*pArgs->outBytes, n);
+    }
+}
+
+/* Processes the rows of one stripe; called by parallelForRows() */
+static void processStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    processArgs_t *pArgs = (processArgs_t *)pArg;
+    size_t start = firstRow * pArgs->rowSize;
+    size_t end = start + numRows * pArgs->rowSize;
+
+    if (pArgs->pStripes) {
+        /* The range starts at the first element of the stripe */
+        convertBlock(pArgs->inType, (const char *)pArgs->pIn + start*pArgs->inBytes,
+                     NDFloat64, &pArgs->pStripes[stripe].minValue, 1);
+        pArgs->pStripes[stripe].maxValue = pArgs->pStripes[stripe].minValue;
+    }
+    if (pArgs->calcType == NDFloat32)
+        processStripeT<epicsFloat32>(pArgs, start, end, stripe);
+    else
+        processStripeT<epicsFloat64>(pArgs, start, end, stripe);
+}
+
+/** Returns the type the arithmetic is done in for a precision setting and an input data type.
+  * The automatic precision uses Float32 for the input types that it represents exactly, 8-bit and 16-bit
+  * integers, Float16 and Float32, and Float64 for the others. */
+static NDDataType_t processCalcType(int precision, NDDataType_t dataType)
+{
+    if (precision == NDProcessPrecisionFloat32) return NDFloat32;
+    if (precision == NDProcessPrecisionFloat64) return NDFloat64;
+    switch (dataType) {
+        case NDInt8:
+        case NDUInt8:
+        case NDInt16:
+        case NDUInt16:
+        case NDFloat16:
+        case NDFloat32:
+            return NDFloat32;
+        default:
+            return NDFloat64;
+    }
+}
+
+/** Converts a stored background, flat field or filter array to the arithmetic type if it is in another type */
+static void convertStoredArray(NDArrayPool *pPool, NDArray **ppArray, NDDataType_t calcType)
+{
+    NDArray *pConverted = NULL;
+
+    if (!*ppArray || ((*ppArray)->dataType == calcType)) return;
+    pPool->convert(*ppArray, &pConverted, calcType);
+    (*ppArray)->release();
+    *ppArray = pConverted;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Does image processing.
+  * The input elements are read in their own type, processed in Float32 or Float64 depending on Precision,
+  * and written in the output type in one pass.  The rows are split into stripes that are processed by the
+  * IntraFrameThreads threads, and the corrections use the vectorized kernels of NDProcessKernels.
   * \param[in] pArray  The NDArray from the callback.
   */
 void NDPluginProcess::processCallbacks(NDArray *pArray)
@@ -38,38 +438,54 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
      * It is called with the mutex already locked.  It unlocks it during long calculations when private
      * structures don't need to be protected.
      */
-    size_t i;
-    NDArray *pScratch=NULL;
-    double  *data, newData, newFilter;
     NDArrayInfo arrayInfo;
-    double  *background=NULL, *flatField=NULL, *filter=NULL;
-    double  value;
-    size_t  nElements;
+    NDArray *pBackgroundUsed=NULL, *pGainUsed=NULL, *pBiasUsed=NULL, *pFlatFieldUsed=NULL;
+    NDAttribute *pAttribute;
+    processArgs_t args;
+    size_t  nElements, numRows;
+    int     stripe, nStripes;
     int     saveBackground, enableBackground, validBackground;
     int     saveFlatField,  enableFlatField,  validFlatField;
+    int     useBackground, useFlatField;
+    int     enableExpression, useExpression;
     double  scaleFlatField;
     int     enableOffsetScale, autoOffsetScale;
-    double  offset, scale, minValue, maxValue;
+    double  offset=0, scale=1, minValue, maxValue;
     double  lowClip=0, highClip=0;
     int     enableLowClip, enableHighClip;
     int     resetFilter, autoResetFilter, filterCallbacks, doCallbacks=1;
     int     enableFilter, numFilter;
-    int     dataType;
+    int     accumulateMode, accumulateWindow, accumulateNum, resetAccumulate, rawAccumulate=0;
+    int     temporalFilter, temporalNum, resetTemporal;
+    int     enableGPU, gpuActive=0;
+#ifdef ND_WITH_CUDA
+    int     useGPU, mapGeneration;
+    NDCudaProcessArgs_t gpuArgs;
+#endif
+    NDArray *pSavedBackground;
+    NDProcessAccType_t accType = NDProcessAccFloat64;
+    NDArray *pOldest=NULL, *pNewest=NULL, *pTemporalNewest;
+    int     dataType, precision;
     int     anyProcess;
     double  oOffset, fOffset, rOffset, oScale, fScale;
     double  oc1, oc2, oc3, oc4;
     double  fc1, fc2, fc3, fc4;
     double  rc1, rc2;
-    double  F1, F2, O1, O2;
+    size_t  dims[ND_ARRAY_MAX_DIMS];
+    int     i;
+    NDDataType_t calcType;
 
     NDArray *pArrayOut = NULL;
     static const char* functionName = "processCallbacks";
 
+    memset(&args, 0, sizeof(args));
+
     /* Call the base class method */
     NDPluginDriver::beginProcessCallbacks(pArray);
 
     /* Need to fetch all of these parameters while we still have the mutex */
     getIntegerParam(NDPluginProcessDataType,            &dataType);
+    getIntegerParam(NDPluginProcessPrecision,           &precision);
     getIntegerParam(NDPluginProcessSaveBackground,      &saveBackground);
     getIntegerParam(NDPluginProcessEnableBackground,    &enableBackground);
     getIntegerParam(NDPluginProcessSaveFlatField,       &saveFlatField);
@@ -83,6 +499,15 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
     getIntegerParam(NDPluginProcessResetFilter,         &resetFilter);
     getIntegerParam(NDPluginProcessAutoResetFilter,     &autoResetFilter);
     getIntegerParam(NDPluginProcessFilterCallbacks,     &filterCallbacks);
+    getIntegerParam(NDPluginProcessAccumulateMode,      &accumulateMode);
+    getIntegerParam(NDPluginProcessAccumulateWindow,    &accumulateWindow);
+    getIntegerParam(NDPluginProcessAccumulateNum,       &accumulateNum);
+    getIntegerParam(NDPluginProcessResetAccumulate,     &resetAccumulate);
+    getIntegerParam(NDPluginProcessEnableExpression,    &enableExpression);
+    getIntegerParam(NDPluginProcessTemporalFilter,      &temporalFilter);
+    getIntegerParam(NDPluginProcessTemporalNum,         &temporalNum);
+    getIntegerParam(NDPluginProcessResetTemporal,       &resetTemporal);
+    getIntegerParam(NDPluginProcessEnableGPU,           &enableGPU);
 
     if (enableOffsetScale) {
         getDoubleParam (NDPluginProcessScale,           &scale);
@@ -94,6 +519,20 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         getDoubleParam (NDPluginProcessHighClip,        &highClip);
     if (resetFilter) 
         setIntegerParam(NDPluginProcessResetFilter, 0);
+    if (resetAccumulate) 
+        setIntegerParam(NDPluginProcessResetAccumulate, 0);
+    if (accumulateNum < 1) accumulateMode = NDProcessAccumulateOff;
+    /* Accumulation takes the place of the recursive filter */
+    if (accumulateMode != NDProcessAccumulateOff) enableFilter = 0;
+    /* The accumulator is released when it is reset or accumulation is turned off */
+    if (resetAccumulate || (accumulateMode == NDProcessAccumulateOff)) resetAccumulator();
+    if (resetTemporal) 
+        setIntegerParam(NDPluginProcessResetTemporal, 0);
+    /* The expression is copied, because writeOctet() can compile another one while the lock is released */
+    useExpression = enableExpression && this->validExpression;
+    if (useExpression) args.expression = this->expression;
+    if ((temporalNum < 1) || (temporalNum > ND_PROCESS_MAX_TEMPORAL)) temporalFilter = NDProcessTemporalOff;
+    if (resetTemporal || (temporalFilter == NDProcessTemporalOff)) resetTemporalFilter();
     if (enableFilter) {
         getIntegerParam(NDPluginProcessNumFilter,       &numFilter);
         getDoubleParam (NDPluginProcessOOffset,         &oOffset);
@@ -113,14 +552,17 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         getDoubleParam (NDPluginProcessRC2,             &rc2);
     }
 
-    /* Release the lock now that we are only doing things that don't involve memory other thread
-     * cannot access */
-    /* Special case for automatic data type */
-    if (dataType == -1) dataType = (int)pArray->dataType;
-    
     pArray->getInfo(&arrayInfo);
     nElements = arrayInfo.nElements;
+    calcType = processCalcType(precision, pArray->dataType);
+    for (i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
 
+    /* The stored arrays are kept in the arithmetic type, so they are converted if the precision or the type of
+     * the input arrays has changed since they were saved */
+    pSavedBackground = this->pBackground;
+    convertStoredArray(this->pNDArrayPool, &this->pBackground, calcType);
+    convertStoredArray(this->pNDArrayPool, &this->pFlatField, calcType);
+    if (this->pBackground != pSavedBackground) this->mapGeneration++;
     validBackground = 0;
     if (this->pBackground && (nElements == this->nBackgroundElements)) validBackground = 1;
     setIntegerParam(NDPluginProcessValidBackground, validBackground);
@@ -128,18 +570,87 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
     if (this->pFlatField && (nElements == this->nFlatFieldElements)) validFlatField = 1;
     setIntegerParam(NDPluginProcessValidFlatField, validFlatField);
 
-    if (validBackground && enableBackground)
-        background = (double *)this->pBackground->pData;
-    if (validFlatField && enableFlatField)
-        flatField = (double *)this->pFlatField->pData;
+    useBackground = validBackground && enableBackground;
+    useFlatField = validFlatField && enableFlatField;
+    /* An expression replaces the background and flat field corrections, and uses the saved arrays itself */
+    if (useExpression) {
+        useBackground = 0;
+        useFlatField = 0;
+        if (validBackground) {
+            pBackgroundUsed = this->pBackground;
+            pBackgroundUsed->reserve();
+        }
+        if (validFlatField) {
+            pFlatFieldUsed = this->pFlatField;
+            pFlatFieldUsed->reserve();
+        }
+    }
+    if (useFlatField && (updateGainMap(calcType, scaleFlatField, useBackground) != asynSuccess)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s:%s cannot allocate the gain map, the flat field is not applied.\n", 
+            driverName, functionName);
+        useFlatField = 0;
+    }
 
-    anyProcess = ((enableBackground && validBackground) ||
-                  (enableFlatField && validFlatField)   ||
+    /* The arrays in use are reserved, because writeInt32() can replace them while the lock is released.
+     * The background is folded into the bias map when the flat field is applied. */
+    if (useFlatField) {
+        pGainUsed = this->pGain;
+        pGainUsed->reserve();
+        pBiasUsed = this->pBias;
+        pBiasUsed->reserve();
+    } else if (useBackground) {
+        pBackgroundUsed = this->pBackground;
+        pBackgroundUsed->reserve();
+    }
+
+    /* Integer input elements that need no corrections are accumulated exactly in an integer accumulator.
+     * Int32 holds the sum of up to 32768 frames of 16-bit elements. */
+    if (accumulateMode != NDProcessAccumulateOff) {
+        rawAccumulate = !useBackground && !useFlatField && !enableOffsetScale && !autoOffsetScale &&
+                        !enableHighClip && !enableLowClip && (temporalFilter == NDProcessTemporalOff) &&
+                        !useExpression &&
+                        (pArray->dataType != NDFloat32) && (pArray->dataType != NDFloat64) &&
+                        (pArray->dataType != NDFloat16);
+        if (!rawAccumulate)
+            accType = NDProcessAccFloat64;
+        else if ((arrayInfo.bytesPerElement <= 2) && (accumulateNum <= 32768))
+            accType = NDProcessAccInt32;
+        else
+            accType = NDProcessAccInt64;
+    }
+
+    /* Special case for automatic data type.  Sums would overflow the input type, so they are Int32 for the
+     * integer accumulators and Float64 otherwise. */
+    if (dataType == -1) {
+        if (accumulateMode == NDProcessAccumulateSum)
+            dataType = rawAccumulate ? NDInt32 : NDFloat64;
+        else
+            dataType = (int)pArray->dataType;
+    }
+
+    anyProcess = ( useBackground                        ||
+                   useFlatField                         ||
+                   (accumulateMode != NDProcessAccumulateOff) ||
+                   (temporalFilter != NDProcessTemporalOff)   ||
+                   useExpression                        ||
                    enableOffsetScale                    ||
                    autoOffsetScale                      ||
                    enableHighClip                       || 
                    enableLowClip                        ||
                    enableFilter);
+
+#ifdef ND_WITH_CUDA
+    /* The GPU does the corrections and the filter in Float32; the other processing, and Float16 arrays,
+     * are only done on the CPU */
+    useGPU = enableGPU && (this->pCuda != NULL) && (calcType == NDFloat32) && !autoOffsetScale &&
+             (accumulateMode == NDProcessAccumulateOff) && (temporalFilter == NDProcessTemporalOff) &&
+             !useExpression && (pArray->dataType != NDFloat16) && (dataType != NDFloat16);
+    mapGeneration = this->mapGeneration;
+#endif
+
+    /* Release the lock now that we are only doing things that don't involve memory other thread
+     * cannot access */
     this->unlock();
     /* If no processing is to be done just convert the input array and do callbacks */
     if (!anyProcess) {
@@ -147,44 +658,69 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         this->pNDArrayPool->convert(pArray, &pArrayOut, (NDDataType_t)dataType);
         goto doCallbacks;
     }
-    
-    /* Make a copy of the array converted to double, because we cannot modify the input array */
-    this->pNDArrayPool->convert(pArray, &pScratch, NDFloat64);
-    if (NULL == pScratch) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-            "%s:%s Processing aborted; cannot allocate an NDArray for storage of temporary data.\n", 
-            driverName, functionName);
-        goto doCallbacks;
-    }
-    data = (double *)pScratch->pData;
 
-    if (nElements > 0) {
-        minValue = data[0];
-        maxValue = data[0];
-    } else {
-        minValue = 0;
-        maxValue = 1;
+    args.inType            = pArray->dataType;
+    args.outType           = (NDDataType_t)dataType;
+    args.calcType          = calcType;
+    args.pIn               = pArray->pData;
+    args.inBytes           = arrayInfo.bytesPerElement;
+    args.rowSize           = (pArray->ndims > 0) ? pArray->dims[0].size : 1;
+    args.pBackground       = pBackgroundUsed ? pBackgroundUsed->pData : NULL;
+    args.pGain             = pGainUsed ? pGainUsed->pData : NULL;
+    args.pBias             = pBiasUsed ? pBiasUsed->pData : NULL;
+    args.correction.enableBackground  = (pBackgroundUsed != NULL) && !useExpression;
+    args.correction.enableGain        = (pGainUsed != NULL);
+    args.correction.enableOffsetScale = enableOffsetScale;
+    args.correction.offset            = offset;
+    args.correction.scale             = scale;
+    args.correction.enableHighClip    = enableHighClip;
+    args.correction.highClip          = highClip;
+    args.correction.enableLowClip     = enableLowClip;
+    args.correction.lowClip           = lowClip;
+    args.useExpression     = useExpression;
+    args.pFlatField        = pFlatFieldUsed ? pFlatFieldUsed->pData : NULL;
+    /* The attributes of the expression are constant for the frame; those the frame does not have are 0 */
+    for (i=0; useExpression && (i<args.expression.nNames); i++) {
+        pAttribute = pArray->pAttributeList->find(args.expression.names[i]);
+        if (pAttribute) pAttribute->getValue(NDAttrFloat64, &args.nameValues[i]);
     }
-    for (i=0; i<nElements; i++) {
-        value = data[i];
-        if (autoOffsetScale) {
-            if (data[i] < minValue) minValue = data[i];
-            if (data[i] > maxValue) maxValue = data[i];
+    
+    if (temporalFilter != NDProcessTemporalOff) {
+        /* The temporal filter keeps copies of the last N input frames in their own type, and is made again when
+         * the type, the size or N changes.  It is only used by this thread. */
+        if (this->pTemporal && ((this->temporalType != pArray->dataType) ||
+                                (this->nTemporalElements != nElements) ||
+                                (this->temporalNum != temporalNum))) {
+            resetTemporalFilter();
         }
-        if (background) value -= background[i];
-        if (flatField) {
-            if (flatField[i] != 0.) 
-                value *= scaleFlatField / flatField[i];
-            else
-                value = scaleFlatField;
+        if (!this->pTemporal) {
+            this->pTemporal = (NDArray **)calloc(temporalNum, sizeof(NDArray *));
+            this->temporalType = pArray->dataType;
+            this->nTemporalElements = nElements;
+            this->temporalNum = temporalNum;
+        }
+        pTemporalNewest = this->pTemporal ? this->pNDArrayPool->copy(pArray, NULL, 1) : NULL;
+        if (NULL == pTemporalNewest) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s Processing aborted; cannot allocate an NDArray for the temporal filter.\n", 
+                driverName, functionName);
+            doCallbacks = 0;
+            goto doCallbacks;
         }
-        if (enableOffsetScale) value = (value + offset)*scale;
-        if (enableHighClip && (value > highClip)) value = highClip;
-        if (enableLowClip  && (value < lowClip))  value = lowClip;
-        data[i] = value;
+        /* The newest frame takes the place of the oldest */
+        if (this->pTemporal[this->temporalNext]) this->pTemporal[this->temporalNext]->release();
+        this->pTemporal[this->temporalNext] = pTemporalNewest;
+        this->temporalNext = (this->temporalNext + 1) % temporalNum;
+        if (this->numTemporal < temporalNum) this->numTemporal++;
+        for (i=0; i<this->numTemporal; i++) args.pTemporal[i] = this->pTemporal[i]->pData;
+        args.nTemporal = this->numTemporal;
+        args.temporalOp = (temporalFilter == NDProcessTemporalFilterMedian) ? NDProcessTemporalMedian :
+                          (temporalFilter == NDProcessTemporalFilterMin)    ? NDProcessTemporalMin :
+                                                                              NDProcessTemporalMax;
     }
-    
+
     if (enableFilter) {
+        /* The filter is only used by this thread, so it can be changed without the lock */
         if (this->pFilter) {
             this->pFilter->getInfo(&arrayInfo);
             if (nElements != arrayInfo.nElements) {
@@ -192,58 +728,191 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
                 this->pFilter = NULL;
             }
         }
+        if (!this->pFilter) this->filterOnDevice = 0;
+#ifdef ND_WITH_CUDA
+        /* The filter is copied back from the GPU before the CPU uses or converts it */
+        if (this->filterOnDevice && (!useGPU || (this->pFilter->dataType != calcType))) {
+            if (NDCudaProcessGetFilter(this->pCuda, (float *)this->pFilter->pData, nElements) != ND_SUCCESS) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s:%s cannot copy the filter from the GPU; %s\n", 
+                    driverName, functionName, NDCudaError(this->pCuda));
+            }
+            this->filterOnDevice = 0;
+        }
+#endif
+        convertStoredArray(this->pNDArrayPool, &this->pFilter, calcType);
         if (!this->pFilter) {
-            /* There is not a current filter array */
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(pScratch, &this->pFilter, NDFloat64);
+            /* There is not a current filter array, it is set to the processed input and then reset */
+            this->pFilter = this->pNDArrayPool->alloc(pArray->ndims, dims, calcType, 0, NULL);
             if (NULL == this->pFilter) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s:%s Processing aborted; cannot allocate an NDArray to store the filter.\n", 
                     driverName,functionName);
                 goto doCallbacks;
             }
+            args.initFilter = 1;
             resetFilter = 1;
         }
         if ((this->numFiltered >= numFilter) && autoResetFilter)
           resetFilter = 1;
         if (resetFilter) {
-            filter = (double *)this->pFilter->pData;
-            for (i=0; i<nElements; i++) {
-                newFilter = rOffset;
-                if (rc1) newFilter += rc1*filter[i];
-                if (rc2) newFilter += rc2*data[i];
-                filter[i] = newFilter;
-            }           
+            args.resetFilter = 1;
+            args.rOffset = rOffset;
+            args.rc1 = rc1;
+            args.rc2 = rc2;
             this->numFiltered = 0;
         }
-        /* Do the filtering */
         if (this->numFiltered < numFilter) this->numFiltered++;
-        filter = (double *)this->pFilter->pData;
-        O1 = oScale * (oc1 + oc2/this->numFiltered);
-        O2 = oScale * (oc3 + oc4/this->numFiltered);
-        F1 = fScale * (fc1 + fc2/this->numFiltered);
-        F2 = fScale * (fc3 + fc4/this->numFiltered);
-        for (i=0; i<nElements; i++) {
-            newData   = oOffset;
-            if (O1) newData += O1 * filter[i];
-            if (O2) newData += O2 * data[i];
-            newFilter = fOffset;
-            if (F1) newFilter += F1 * filter[i];
-            if (F2) newFilter += F2 * data[i];
-            data[i] = newData;
-            filter[i] = newFilter;
-        }
+        args.pFilter = this->pFilter->pData;
+        args.oOffset = oOffset;
+        args.O1 = oScale * (oc1 + oc2/this->numFiltered);
+        args.O2 = oScale * (oc3 + oc4/this->numFiltered);
+        args.fOffset = fOffset;
+        args.F1 = fScale * (fc1 + fc2/this->numFiltered);
+        args.F2 = fScale * (fc3 + fc4/this->numFiltered);
         if ((this->numFiltered != numFilter) && filterCallbacks)
           doCallbacks = 0;
     }
 
+    if (accumulateMode != NDProcessAccumulateOff) {
+        /* The accumulator is only used by this thread, so it can be changed without the lock.
+         * It is made again when the type of the frames or of the sums, the size, the window or N changes. */
+        NDDataType_t accumulatedType = rawAccumulate ? pArray->dataType : calcType;
+        if (this->pAccumulator && ((this->accumulatorType != accType) ||
+                                   (this->accumulatedType != accumulatedType) ||
+                                   (this->nAccumulatorElements != nElements) ||
+                                   (this->accumulatorWindow != accumulateWindow) ||
+                                   (this->accumulatorNum != accumulateNum))) {
+            resetAccumulator();
+        }
+        if (!this->pAccumulator) {
+            this->pAccumulator = malloc(nElements * ((accType == NDProcessAccInt32) ? sizeof(epicsInt32) :
+                                                                                      sizeof(epicsInt64)));
+            if (accumulateWindow == NDProcessWindowRunning)
+                this->pHistory = (NDArray **)calloc(accumulateNum, sizeof(NDArray *));
+            if (!this->pAccumulator || ((accumulateWindow == NDProcessWindowRunning) && !this->pHistory)) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s:%s Processing aborted; cannot allocate the accumulator.\n", 
+                    driverName, functionName);
+                resetAccumulator();
+                doCallbacks = 0;
+                goto doCallbacks;
+            }
+            this->accumulatorType = accType;
+            this->accumulatedType = accumulatedType;
+            this->nAccumulatorElements = nElements;
+            this->accumulatorWindow = accumulateWindow;
+            this->accumulatorNum = accumulateNum;
+        }
+        /* A block of N frames that has been output starts again */
+        if ((accumulateWindow == NDProcessWindowBlock) && (this->numAccumulated >= accumulateNum))
+            this->numAccumulated = 0;
+        if (accumulateWindow == NDProcessWindowRunning) {
+            /* The window keeps a copy of each of the last N frames, so that the oldest can be subtracted */
+            if (rawAccumulate)
+                pNewest = this->pNDArrayPool->copy(pArray, NULL, 1);
+            else
+                pNewest = this->pNDArrayPool->alloc(pArray->ndims, dims, calcType, 0, NULL);
+            if (NULL == pNewest) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s:%s Processing aborted; cannot allocate an NDArray for the running window.\n", 
+                    driverName, functionName);
+                doCallbacks = 0;
+                goto doCallbacks;
+            }
+            if (this->numAccumulated == accumulateNum) {
+                pOldest = this->pHistory[this->historyNext];
+                args.pOldest = pOldest->pData;
+            }
+            if (!rawAccumulate) args.pHistory = pNewest->pData;
+            this->pHistory[this->historyNext] = pNewest;
+            this->historyNext = (this->historyNext + 1) % accumulateNum;
+        }
+        args.pAccumulator = this->pAccumulator;
+        args.accType = accType;
+        args.accOp = (this->numAccumulated == 0) ? NDProcessAccSet : NDProcessAccAdd;
+        args.rawAccumulate = rawAccumulate;
+        if (this->numAccumulated < accumulateNum) this->numAccumulated++;
+        args.divisor = (accumulateMode == NDProcessAccumulateAverage) ? this->numAccumulated : 1.;
+        /* A block is output when it has N frames, a running window after each frame */
+        doCallbacks = (accumulateWindow == NDProcessWindowRunning) || (this->numAccumulated == accumulateNum);
+    }
+
     if (doCallbacks) {
-      /* Convert the array to the desired output data type */
-      this->pNDArrayPool->convert(pScratch, &pArrayOut, (NDDataType_t)dataType);
+        pArrayOut = this->pNDArrayPool->alloc(pArray->ndims, dims, (NDDataType_t)dataType, 0, NULL);
+        if (NULL == pArrayOut) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s Processing aborted; cannot allocate the output NDArray.\n", 
+                driverName, functionName);
+            goto doCallbacks;
+        }
+        pArrayOut->timeStamp = pArray->timeStamp;
+        pArrayOut->epicsTS = pArray->epicsTS;
+        pArrayOut->uniqueId = pArray->uniqueId;
+        memcpy(pArrayOut->dims, pArray->dims, pArray->ndims*sizeof(NDDimension_t));
+        if (this->pNDArrayPool->shareAttributes())
+            pArray->pAttributeList->share(pArrayOut->pAttributeList);
+        else
+            pArray->pAttributeList->copy(pArrayOut->pAttributeList);
+        pArrayOut->getInfo(&arrayInfo);
+        args.outBytes = arrayInfo.bytesPerElement;
+        args.pOut = pArrayOut->pData;
     }
 
+#ifdef ND_WITH_CUDA
+    if (useGPU) {
+        /* The maps and the filter stay on the GPU, so they are only copied when they change on the host */
+        gpuArgs.correction   = args.correction;
+        gpuArgs.enableFilter = (args.pFilter != NULL);
+        gpuArgs.initFilter   = args.initFilter;
+        gpuArgs.resetFilter  = args.resetFilter;
+        gpuArgs.rOffset = args.rOffset;
+        gpuArgs.rc1     = args.rc1;
+        gpuArgs.rc2     = args.rc2;
+        gpuArgs.oOffset = args.oOffset;
+        gpuArgs.O1      = args.O1;
+        gpuArgs.O2      = args.O2;
+        gpuArgs.fOffset = args.fOffset;
+        gpuArgs.F1      = args.F1;
+        gpuArgs.F2      = args.F2;
+        gpuActive = (NDCudaProcessMaps(this->pCuda, mapGeneration, (const float *)args.pBackground,
+                                       (const float *)args.pGain, (const float *)args.pBias,
+                                       nElements) == ND_SUCCESS);
+        if (gpuActive && args.pFilter && !args.initFilter && !this->filterOnDevice)
+            gpuActive = (NDCudaProcessSetFilter(this->pCuda, (const float *)args.pFilter, nElements) == ND_SUCCESS);
+        if (gpuActive)
+            gpuActive = (NDCudaProcess(this->pCuda, &gpuArgs, args.inType, args.pIn, args.outType, args.pOut,
+                                       nElements) == ND_SUCCESS);
+        if (gpuActive) {
+            if (args.pFilter) this->filterOnDevice = 1;
+        } else {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s GPU processing failed, the frame is processed on the CPU; %s\n", 
+                driverName, functionName, NDCudaError(this->pCuda));
+            /* The CPU continues from the filter on the GPU if it can be copied back */
+            if (this->filterOnDevice) NDCudaProcessGetFilter(this->pCuda, (float *)args.pFilter, nElements);
+            this->filterOnDevice = 0;
+        }
+    }
+#endif
+
+    /* The rows are processed in stripes by the IntraFrameThreads threads, unless the GPU has processed them */
+    numRows = (args.rowSize > 0) ? nElements / args.rowSize : 0;
+    nStripes = numStripes(numRows);
+    if (autoOffsetScale) args.pStripes = (processStripe_t *)calloc(nStripes, sizeof(processStripe_t));
+    if ((numRows > 0) && !gpuActive) parallelForRows(processStripe, &args, numRows, nStripes);
+
     if (autoOffsetScale && (NULL != pArrayOut)) {
-        pArrayOut->getInfo(&arrayInfo);
+        minValue = 0;
+        maxValue = 1;
+        if (numRows > 0) {
+            minValue = args.pStripes[0].minValue;
+            maxValue = args.pStripes[0].maxValue;
+        }
+        for (stripe=1; stripe<nStripes; stripe++) {
+            if (args.pStripes[stripe].minValue < minValue) minValue = args.pStripes[stripe].minValue;
+            if (args.pStripes[stripe].maxValue > maxValue) maxValue = args.pStripes[stripe].maxValue;
+        }
         double maxScale = pow(2., arrayInfo.bytesPerElement*8) - 1;
         scale = maxScale /(maxValue-minValue);
         offset = -minValue;
@@ -257,6 +926,9 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
     }
 
     doCallbacks:    
+    free(args.pStripes);
+    /* The frame that left the running window is no longer needed */
+    if (NULL != pOldest) pOldest->release();
     /* We must exit with the mutex locked */
     this->lock();
 
@@ -264,13 +936,93 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         NDPluginDriver::endProcessCallbacks(pArrayOut, false, true);
     }
 
-    if (NULL != pScratch) pScratch->release();
+    if (NULL != pBackgroundUsed) pBackgroundUsed->release();
+    if (NULL != pGainUsed) pGainUsed->release();
+    if (NULL != pBiasUsed) pBiasUsed->release();
+    if (NULL != pFlatFieldUsed) pFlatFieldUsed->release();
 
     setIntegerParam(NDPluginProcessNumFiltered, this->numFiltered);
+    setIntegerParam(NDPluginProcessAccumulated, this->numAccumulated);
+    setIntegerParam(NDPluginProcessTemporalFrames, this->numTemporal);
+    setIntegerParam(NDPluginProcessGPUActive, gpuActive);
     if (autoOffsetScale && this->pArrays[0] != NULL) {
         setIntegerParam(NDPluginProcessAutoOffsetScale, 0);
     }
-    callParamCallbacks();
+    callStatusCallbacks();
+}
+
+/** Releases the frame accumulator and the frames of the running window, so that accumulation starts again with
+  * the next frame */
+void NDPluginProcess::resetAccumulator()
+{
+    int i;
+
+    free(this->pAccumulator);
+    this->pAccumulator = NULL;
+    if (this->pHistory) {
+        for (i=0; i<this->accumulatorNum; i++) {
+            if (this->pHistory[i]) this->pHistory[i]->release();
+        }
+        free(this->pHistory);
+        this->pHistory = NULL;
+    }
+    this->historyNext = 0;
+    this->numAccumulated = 0;
+}
+
+/** Releases the frames of the temporal filter, so that it starts again with the next frame */
+void NDPluginProcess::resetTemporalFilter()
+{
+    int i;
+
+    if (this->pTemporal) {
+        for (i=0; i<this->temporalNum; i++) {
+            if (this->pTemporal[i]) this->pTemporal[i]->release();
+        }
+        free(this->pTemporal);
+        this->pTemporal = NULL;
+    }
+    this->temporalNext = 0;
+    this->numTemporal = 0;
+}
+
+/** Releases the gain and bias maps of the flat field, so that they are computed again when they are next used */
+void NDPluginProcess::releaseGainMap()
+{
+    if (this->pGain) this->pGain->release();
+    this->pGain = NULL;
+    if (this->pBias) this->pBias->release();
+    this->pBias = NULL;
+    this->mapGeneration++;
+}
+
+/** Computes the gain and bias maps of the flat field with NDProcessGainMap() unless they are already up to date.
+  * They are computed again when the flat field or the background is saved, and when the arithmetic type,
+  * the flat field scale or the use of the background changes.
+  * It is called with the mutex locked, and the flat field must be valid.
+  * \param[in] calcType The type of the arithmetic, which the flat field has already been converted to.
+  * \param[in] scaleFlatField The scale factor after dividing by the flat field.
+  * \param[in] foldBackground Fold the background subtraction into the bias map. */
+asynStatus NDPluginProcess::updateGainMap(NDDataType_t calcType, double scaleFlatField, int foldBackground)
+{
+    size_t dims[1];
+
+    if (this->pGain && (this->pGain->dataType == calcType) &&
+        (this->gainScale == scaleFlatField) && (this->gainBackground == foldBackground)) return asynSuccess;
+
+    releaseGainMap();
+    dims[0] = this->nFlatFieldElements;
+    this->pGain = this->pNDArrayPool->alloc(1, dims, calcType, 0, NULL);
+    this->pBias = this->pNDArrayPool->alloc(1, dims, calcType, 0, NULL);
+    if (!this->pGain || !this->pBias) {
+        releaseGainMap();
+        return asynError;
+    }
+    NDProcessGainMap(calcType, this->pFlatField->pData, foldBackground ? this->pBackground->pData : NULL,
+                     scaleFlatField, this->pGain->pData, this->pBias->pData, this->nFlatFieldElements);
+    this->gainScale = scaleFlatField;
+    this->gainBackground = foldBackground;
+    return asynSuccess;
 }
 
 /** Called when asyn clients call pasynInt32->write().
@@ -282,6 +1034,7 @@ asynStatus NDPluginProcess::writeInt32(asynUser *pasynUser, epicsInt32 value)
 {
     int function = pasynUser->reason;
     int addr=0;
+    int precision;
     NDArrayInfo arrayInfo;
     asynStatus status = asynSuccess;
     static const char *functionName = "writeInt32";
@@ -293,24 +1046,31 @@ asynStatus NDPluginProcess::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
     if (function == NDPluginProcessSaveBackground) {
         setIntegerParam(NDPluginProcessSaveBackground, 0);
+        /* The background may be folded into the bias map */
+        releaseGainMap();
         if (this->pBackground) this->pBackground->release();
         this->pBackground = NULL;
         setIntegerParam(NDPluginProcessValidBackground, 0);
         if (this->pArrays[0]) {
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(this->pArrays[0], &this->pBackground, NDFloat64);
+            /* Make a copy of the current array, converted to the type of the arithmetic */
+            getIntegerParam(NDPluginProcessPrecision, &precision);
+            this->pNDArrayPool->convert(this->pArrays[0], &this->pBackground,
+                                        processCalcType(precision, this->pArrays[0]->dataType));
             this->pBackground->getInfo(&arrayInfo);
             this->nBackgroundElements = arrayInfo.nElements;
             setIntegerParam(NDPluginProcessValidBackground, 1);
         }
     } else if (function == NDPluginProcessSaveFlatField) {
         setIntegerParam(NDPluginProcessSaveFlatField, 0);
+        releaseGainMap();
         if (this->pFlatField) this->pFlatField->release();
         this->pFlatField = NULL;
         setIntegerParam(NDPluginProcessValidFlatField, 0);
         if (this->pArrays[0]) {
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(this->pArrays[0], &this->pFlatField, NDFloat64);
+            /* Make a copy of the current array, converted to the type of the arithmetic */
+            getIntegerParam(NDPluginProcessPrecision, &precision);
+            this->pNDArrayPool->convert(this->pArrays[0], &this->pFlatField,
+                                        processCalcType(precision, this->pArrays[0]->dataType));
             this->pFlatField->getInfo(&arrayInfo);
             this->nFlatFieldElements = arrayInfo.nElements;
             setIntegerParam(NDPluginProcessValidFlatField, 1);
@@ -337,6 +1097,62 @@ asynStatus NDPluginProcess::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
 
 
+/** Called when asyn clients call pasynOctet->write().
+  * This function compiles the expression when it is written, and sets ValidExpression and ExpressionError.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPluginProcess::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    int addr=0;
+    char error[256];
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeOctet";
+
+    status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
+
+    /* Set the parameter in the parameter library. */
+    status = (asynStatus) setStringParam(addr, function, (char *)value);
+
+    if (function == NDPluginProcessExpression) {
+        /* processCallbacks() copies the expression while it holds the lock, so it can be replaced here.
+         * An empty expression is not valid, but is not an error. */
+        this->validExpression = 0;
+        error[0] = '\0';
+        if (value && (value[0] != '\0'))
+            this->validExpression = (NDProcessExpressionCompile(value, &this->expression, error, sizeof(error)) 
+                                     == ND_SUCCESS);
+        setIntegerParam(NDPluginProcessValidExpression, this->validExpression);
+        setStringParam(NDPluginProcessExpressionError, error);
+        if (error[0] != '\0') 
+            asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+                "%s:%s: error compiling expression=%s, %s\n", 
+                driverName, functionName, value, error);
+    } else {
+        /* If this parameter belongs to a base class call its method */
+        if (function < FIRST_NDPLUGIN_PROCESS_PARAM) 
+            status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+    }
+    
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks(addr);
+    
+    if (status) 
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
+                  "%s:%s: status=%d, function=%d, value=%s", 
+                  driverName, functionName, status, function, value);
+    else        
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+              "%s:%s: function=%d, value=%s\n", 
+              driverName, functionName, function, value);
+    *nActual = nChars;
+    return status;
+}
+
+
 /** Constructor for NDPluginProcess; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   * After calling the base class constructor this method sets reasonable default values for all of the
   * parameters.
@@ -414,16 +1230,88 @@ NDPluginProcess::NDPluginProcess(const char *portName, int queueSize, int blocki
     createParam(NDPluginProcessROffsetString,           asynParamFloat64,   &NDPluginProcessROffset);   
     createParam(NDPluginProcessRC1String,               asynParamFloat64,   &NDPluginProcessRC1);   
     createParam(NDPluginProcessRC2String,               asynParamFloat64,   &NDPluginProcessRC2);   
+
+    /* Frame accumulation */
+    createParam(NDPluginProcessAccumulateModeString,    asynParamInt32,     &NDPluginProcessAccumulateMode);
+    createParam(NDPluginProcessAccumulateWindowString,  asynParamInt32,     &NDPluginProcessAccumulateWindow);
+    createParam(NDPluginProcessAccumulateNumString,     asynParamInt32,     &NDPluginProcessAccumulateNum);
+    createParam(NDPluginProcessAccumulatedString,       asynParamInt32,     &NDPluginProcessAccumulated);
+    createParam(NDPluginProcessResetAccumulateString,   asynParamInt32,     &NDPluginProcessResetAccumulate);
+
+    /* Per-element expression */
+    createParam(NDPluginProcessEnableExpressionString,  asynParamInt32,     &NDPluginProcessEnableExpression);
+    createParam(NDPluginProcessExpressionString,        asynParamOctet,     &NDPluginProcessExpression);
+    createParam(NDPluginProcessValidExpressionString,   asynParamInt32,     &NDPluginProcessValidExpression);
+    createParam(NDPluginProcessExpressionErrorString,   asynParamOctet,     &NDPluginProcessExpressionError);
+
+    /* Temporal filters */
+    createParam(NDPluginProcessTemporalFilterString,    asynParamInt32,     &NDPluginProcessTemporalFilter);
+    createParam(NDPluginProcessTemporalNumString,       asynParamInt32,     &NDPluginProcessTemporalNum);
+    createParam(NDPluginProcessTemporalFramesString,    asynParamInt32,     &NDPluginProcessTemporalFrames);
+    createParam(NDPluginProcessResetTemporalString,     asynParamInt32,     &NDPluginProcessResetTemporal);
+
+    /* GPU offload */
+    createParam(NDPluginProcessEnableGPUString,         asynParamInt32,     &NDPluginProcessEnableGPU);
+    createParam(NDPluginProcessGPUActiveString,         asynParamInt32,     &NDPluginProcessGPUActive);
     
     /* Output data type */
     createParam(NDPluginProcessDataTypeString,          asynParamInt32,     &NDPluginProcessDataType);   
 
+    /* Arithmetic precision */
+    createParam(NDPluginProcessPrecisionString,         asynParamInt32,     &NDPluginProcessPrecision);
+
     this->pBackground = NULL;
     this->pFlatField  = NULL;
+    this->pGain       = NULL;
+    this->pBias       = NULL;
+    this->gainScale   = 0.;
+    this->gainBackground = 0;
+    this->pAccumulator = NULL;
+    this->pHistory    = NULL;
+    this->accumulatorNum = 0;
+    this->historyNext = 0;
+    this->numAccumulated = 0;
+    this->pTemporal   = NULL;
+    this->temporalNum = 0;
+    this->temporalNext = 0;
+    this->numTemporal = 0;
+    this->validExpression = 0;
+    memset(&this->expression, 0, sizeof(this->expression));
     this->pFilter     = NULL;
     setIntegerParam(NDPluginProcessValidBackground, 0);
     setIntegerParam(NDPluginProcessValidFlatField, 0);
     setIntegerParam(NDPluginProcessAutoOffsetScale, 0);
+    setIntegerParam(NDPluginProcessPrecision, NDProcessPrecisionAutomatic);
+    setIntegerParam(NDPluginProcessAccumulateMode, NDProcessAccumulateOff);
+    setIntegerParam(NDPluginProcessAccumulateWindow, NDProcessWindowBlock);
+    setIntegerParam(NDPluginProcessAccumulateNum, 1);
+    setIntegerParam(NDPluginProcessAccumulated, 0);
+    setIntegerParam(NDPluginProcessResetAccumulate, 0);
+    setIntegerParam(NDPluginProcessEnableExpression, 0);
+    setStringParam (NDPluginProcessExpression, "");
+    setIntegerParam(NDPluginProcessValidExpression, 0);
+    setStringParam (NDPluginProcessExpressionError, "");
+    setIntegerParam(NDPluginProcessTemporalFilter, NDProcessTemporalOff);
+    setIntegerParam(NDPluginProcessTemporalNum, 3);
+    setIntegerParam(NDPluginProcessTemporalFrames, 0);
+    setIntegerParam(NDPluginProcessResetTemporal, 0);
+    setIntegerParam(NDPluginProcessEnableGPU, 0);
+    setIntegerParam(NDPluginProcessGPUActive, 0);
+
+    this->pCuda = NULL;
+    this->mapGeneration = 0;
+    this->filterOnDevice = 0;
+#ifdef ND_WITH_CUDA
+    {
+        char error[256];
+        /* The arrays of the plugin are pinned, so they are copied to and from the GPU without staging */
+        this->pCuda = NDCudaCreate(0, error, sizeof(error));
+        if (this->pCuda && !this->pNDArrayPool->memoryProvider())
+            this->pNDArrayPool->setMemoryProvider(NDCudaPinnedMemory());
+        if (!this->pCuda)
+            printf("%s: GPU offload is not available; %s\n", driverName, error);
+    }
+#endif
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginProcess");
@@ -3,6 +3,10 @@
 
 #include <epicsTypes.h>
 #include "NDPluginDriver.h"
+#include "NDProcessKernels.h"
+#include "NDProcessExpression.h"
+
+struct NDCudaContext;
 
 /* Background array subtraction */
 #define NDPluginProcessSaveBackgroundString     "SAVE_BACKGROUND"   /* (asynInt32,   r/w) Save the current frame as background */
@@ -50,8 +54,62 @@
 #define NDPluginProcessRC1String                "FILTER_RC1"        /* (asynFloat64, r/w) Reset coefficient 1 */
 #define NDPluginProcessRC2String                "FILTER_RC2"        /* (asynFloat64, r/w) Reset coefficient 2 */
 
+/* Frame accumulation */
+#define NDPluginProcessAccumulateModeString     "ACCUMULATE_MODE"   /* (asynInt32,   r/w) Off, sum or average of N frames */
+#define NDPluginProcessAccumulateWindowString   "ACCUMULATE_WINDOW" /* (asynInt32,   r/w) Blocks of N frames or a running window */
+#define NDPluginProcessAccumulateNumString      "ACCUMULATE_NUM"    /* (asynInt32,   r/w) Number of frames to accumulate */
+#define NDPluginProcessAccumulatedString        "ACCUMULATED"       /* (asynInt32,   r/o) Number of frames accumulated */
+#define NDPluginProcessResetAccumulateString    "RESET_ACCUMULATE"  /* (asynInt32,   r/w) Reset the accumulator when 1 */
+
+/** The frame accumulation modes */
+typedef enum {
+    NDProcessAccumulateOff,         /**< Frames are not accumulated */
+    NDProcessAccumulateSum,         /**< Output the sum of the frames */
+    NDProcessAccumulateAverage      /**< Output the average of the frames */
+} NDProcessAccumulateMode_t;
+
+/** The frame accumulation windows */
+typedef enum {
+    NDProcessWindowBlock,           /**< Output once for each block of N frames */
+    NDProcessWindowRunning          /**< Output the last N frames after each frame */
+} NDProcessAccumulateWindow_t;
+
+/* Temporal filters */
+#define NDPluginProcessTemporalFilterString     "TEMPORAL_FILTER"   /* (asynInt32,   r/w) Off, median, minimum or maximum */
+#define NDPluginProcessTemporalNumString        "TEMPORAL_NUM"      /* (asynInt32,   r/w) Number of frames of the filter */
+#define NDPluginProcessTemporalFramesString     "TEMPORAL_FRAMES"   /* (asynInt32,   r/o) Number of frames in the filter */
+#define NDPluginProcessResetTemporalString      "RESET_TEMPORAL"    /* (asynInt32,   r/w) Reset the temporal filter when 1 */
+
+/** The temporal filters, which are applied to the input frames before the corrections */
+typedef enum {
+    NDProcessTemporalOff,           /**< No temporal filter */
+    NDProcessTemporalFilterMedian,  /**< The median of each element over the last N frames */
+    NDProcessTemporalFilterMin,     /**< The minimum of each element over the last N frames */
+    NDProcessTemporalFilterMax      /**< The maximum of each element over the last N frames */
+} NDProcessTemporalFilter_t;
+
+/* Per-element expression */
+#define NDPluginProcessEnableExpressionString   "ENABLE_EXPRESSION" /* (asynInt32,   r/w) Enable the expression */
+#define NDPluginProcessExpressionString         "EXPRESSION"        /* (asynOctet,   r/w) Expression of x, b, f, i and attributes */
+#define NDPluginProcessValidExpressionString    "VALID_EXPRESSION"  /* (asynInt32,   r/o) The expression compiled */
+#define NDPluginProcessExpressionErrorString    "EXPRESSION_ERROR"  /* (asynOctet,   r/o) Why the expression did not compile */
+
+/* GPU offload */
+#define NDPluginProcessEnableGPUString          "ENABLE_GPU"        /* (asynInt32,   r/w) Process on the GPU when it can */
+#define NDPluginProcessGPUActiveString          "GPU_ACTIVE"        /* (asynInt32,   r/o) The last frame was processed on the GPU */
+
 /* Output data type */
 #define NDPluginProcessDataTypeString           "PROCESS_DATA_TYPE" /* (asynInt32,   r/w) Output type.  -1 means automatic. */
+
+/* Arithmetic precision */
+#define NDPluginProcessPrecisionString          "PROCESS_PRECISION" /* (asynInt32,   r/w) Type the processing is done in */
+
+/** The types the processing can be done in */
+typedef enum {
+    NDProcessPrecisionAutomatic,    /**< Float32 for 8-bit and 16-bit integer and Float32 input, otherwise Float64 */
+    NDProcessPrecisionFloat32,      /**< Float32 */
+    NDProcessPrecisionFloat64       /**< Float64 */
+} NDProcessPrecision_t;
    
 
 /** Does image processing operations.  These include
@@ -69,6 +127,7 @@ public:
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
     
 protected:
     /* Background array subtraction */
@@ -117,17 +176,71 @@ protected:
     int NDPluginProcessROffset;
     int NDPluginProcessRC1;
     int NDPluginProcessRC2;
+
+    /* Frame accumulation */
+    int NDPluginProcessAccumulateMode;
+    int NDPluginProcessAccumulateWindow;
+    int NDPluginProcessAccumulateNum;
+    int NDPluginProcessAccumulated;
+    int NDPluginProcessResetAccumulate;
+
+    /* Per-element expression */
+    int NDPluginProcessEnableExpression;
+    int NDPluginProcessExpression;
+    int NDPluginProcessValidExpression;
+    int NDPluginProcessExpressionError;
+
+    /* Temporal filters */
+    int NDPluginProcessTemporalFilter;
+    int NDPluginProcessTemporalNum;
+    int NDPluginProcessTemporalFrames;
+    int NDPluginProcessResetTemporal;
+
+    /* GPU offload */
+    int NDPluginProcessEnableGPU;
+    int NDPluginProcessGPUActive;
     
     /* Output data type */
     int NDPluginProcessDataType;
 
+    /* Arithmetic precision */
+    int NDPluginProcessPrecision;
+
 private:
+    void releaseGainMap();
+    void resetAccumulator();
+    void resetTemporalFilter();
+    asynStatus updateGainMap(NDDataType_t calcType, double scaleFlatField, int foldBackground);
     NDArray *pBackground;
     size_t  nBackgroundElements;
     NDArray *pFlatField;
     size_t  nFlatFieldElements;
+    NDArray *pGain;         /* scaleFlatField/flatField, 0 where the flat field is 0 */
+    NDArray *pBias;         /* -background*gain, or 0; scaleFlatField where the flat field is 0 */
+    double  gainScale;      /* The scaleFlatField the maps were computed with */
+    int     gainBackground; /* The maps include the background */
     NDArray *pFilter;
     int  numFiltered;
+    void    *pAccumulator;          /* The sums of the frames, NULL when frames are not accumulated */
+    NDProcessAccType_t accumulatorType;
+    NDDataType_t accumulatedType;   /* The type of the frames that are added to the accumulator */
+    size_t  nAccumulatorElements;
+    int     accumulatorWindow;      /* The window and N the accumulator was made for */
+    int     accumulatorNum;
+    NDArray **pHistory;             /* The last N frames for the running window, the oldest at historyNext */
+    int     historyNext;
+    int     numAccumulated;
+    NDArray **pTemporal;            /* The last N input frames of the temporal filter, the oldest at temporalNext */
+    NDDataType_t temporalType;
+    size_t  nTemporalElements;
+    int     temporalNum;
+    int     temporalNext;
+    int     numTemporal;
+    NDProcessExpression_t expression;
+    int     validExpression;
+    struct NDCudaContext *pCuda;    /* The GPU context, NULL when the plugin is built without CUDA or has no GPU */
+    int     mapGeneration;          /* Changed whenever the background, gain or bias map changes */
+    int     filterOnDevice;         /* The GPU has the current filter, the copy in pFilter is out of date */
 };
     
 #endif
@@ -3,6 +3,7 @@
 #include <pv/channelProviderLocal.h>
 
 #include <epicsThread.h>
+#include <epicsGuard.h>
 #include <epicsExport.h>
 #include <iocsh.h>
 
@@ -17,6 +18,8 @@
 #include "NDPluginDriver.h"
 #include "NDPluginPva.h"
 
+static const char *driverName = "NDPluginPva";
+
 using namespace epics;
 using namespace epics::pvData;
 using namespace epics::pvAccess;
@@ -93,18 +96,123 @@ void NTNDArrayRecord::update(NDArray *pArray)
 }
 
 /** Callback function that is called by the NDArray driver with new NDArray
-  * data.
+  * data.  It compresses the array with the Compressor, unless it is already
+  * compressed, and publishes it.  Float16 arrays are published as Float32.
   * \param[in] pArray  The NDArray from the callback.
   */
 void NDPluginPva::processCallbacks(NDArray *pArray)
 {
+    NDArray *pPublish = pArray;
+    NDArray *pFloat32 = NULL;
+    NDArrayInfo_t arrayInfo;
+    NDCodec_t codec;
+    int compressor, dropped;
+    epicsUInt32 sequence;
+    bool stale = false;
+    const char *error = NULL;
+    static const char *functionName = "processCallbacks";
+
     NDPluginDriver::beginProcessCallbacks(pArray);   // Base class method
 
+    getIntegerParam(NDPluginPvaCompressor, &compressor);
+    codec.name = NDCodecName[compressor];
+    if (compressor == NDCodecJPEG) {
+        getIntegerParam(NDPluginPvaJPEGQuality, &codec.level);
+    } else if (compressor == NDCodecBlosc) {
+        getIntegerParam(NDPluginPvaBloscCLevel, &codec.level);
+        getIntegerParam(NDPluginPvaBloscShuffle, &codec.shuffle);
+        getIntegerParam(NDPluginPvaBloscCompressor, &codec.compressor);
+    }
+    sequence = m_nextSequence++;
+
     this->unlock();             // Function called with the lock taken
-    m_record->update(pArray);
+    // pvData has no half precision type, so Float16 arrays are decompressed and published as Float32
+    if (pArray->dataType == NDFloat16) {
+        NDArray *pDecompressed = pArray->codec.empty() ? pArray :
+                                 m_codec.decompress(pArray, 1, this->pNDArrayPool, &error);
+        if (pDecompressed) {
+            this->pNDArrayPool->convert(pDecompressed, &pFloat32, NDFloat32);
+            if (pDecompressed != pArray) pDecompressed->release();
+        }
+        if (pFloat32) pPublish = pFloat32;
+    }
+    if ((compressor != NDCodecNone) && pPublish->codec.empty()) {
+        NDArray *pCompressed = m_codec.compress(pPublish, codec, 1, this->pNDArrayPool, &error);
+        // An array that cannot be compressed is published as it is
+        if (pCompressed) pPublish = pCompressed;
+    }
+    {
+        epicsGuard<epicsMutex> guard(m_publishMutex);
+        // Another thread has published a later array
+        if (m_published && ((epicsInt32)(sequence - m_publishedSequence) < 0)) {
+            stale = true;
+        } else {
+            m_record->update(pPublish);
+            m_publishedSequence = sequence;
+            m_published = true;
+        }
+    }
     this->lock();               // Must return locked
 
+    if (error) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot compress or convert array uniqueId=%d, published it as it was: %s\n",
+            driverName, functionName, pArray->uniqueId, error);
+    }
+    if (stale) {
+        getIntegerParam(NDPluginDriverDroppedOutputArrays, &dropped);
+        setIntegerParam(NDPluginDriverDroppedOutputArrays, dropped+1);
+    } else {
+        (pFloat32 ? pFloat32 : pArray)->getInfo(&arrayInfo);
+        setDoubleParam(NDPluginPvaCompFactor, (pPublish->codec.empty() || (pPublish->compressedSize == 0)) ? 1.0 :
+                       (double)arrayInfo.totalBytes / pPublish->compressedSize);
+    }
+    if (pPublish != pArray) pPublish->release();
+    if (pFloat32 && (pFloat32 != pPublish)) pFloat32->release();
+
+    callStatusCallbacks();
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks the ranges of the parameters, and that ADCore was built with the Compressor.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginPva::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_PVA_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDPluginPvaCompressor) {
+        if (!NDArrayCodec::compressorSupported(value)) status = asynError;
+    } else if (function == NDPluginPvaJPEGQuality) {
+        if ((value < 1) || (value > 100)) status = asynError;
+    } else if (function == NDPluginPvaBloscCompressor) {
+        if ((value < 0) || (value > 5)) status = asynError;
+    } else if (function == NDPluginPvaBloscCLevel) {
+        if ((value < 0) || (value > 9)) status = asynError;
+    } else if (function == NDPluginPvaBloscShuffle) {
+        if ((value < 0) || (value > 2)) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
     callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
 }
 
 /** Constructor for NDPluginPva
@@ -132,17 +240,35 @@ void NDPluginPva::processCallbacks(NDArray *pArray)
   *            This value should also be used for any other threads this object creates.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   *            This value should also be used for any other threads this object creates.
+  * \param[in] maxThreads The maximum number of threads that compress and publish arrays. If 0 then 1 will
+  *            be used.
   */
 NDPluginPva::NDPluginPva(const char *portName, int queueSize,
         int blockingCallbacks, const char *NDArrayPort, int NDArrayAddr,
-        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
+        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize,
+        int maxThreads)
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
             NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory, 0, 0,
-            0, 1, priority, stackSize, 1),
-            m_record(NTNDArrayRecord::create(pvName))
+            0, 1, priority, stackSize, maxThreads),
+            m_record(NTNDArrayRecord::create(pvName)),
+            m_nextSequence(0), m_publishedSequence(0), m_published(false)
 {
-    createParam(NDPluginPvaPvNameString, asynParamOctet, &NDPluginPvaPvName);
+    createParam(NDPluginPvaPvNameString,          asynParamOctet,   &NDPluginPvaPvName);
+    createParam(NDPluginPvaCompressorString,      asynParamInt32,   &NDPluginPvaCompressor);
+    createParam(NDPluginPvaCompFactorString,      asynParamFloat64, &NDPluginPvaCompFactor);
+    createParam(NDPluginPvaJPEGQualityString,     asynParamInt32,   &NDPluginPvaJPEGQuality);
+    createParam(NDPluginPvaBloscCompressorString, asynParamInt32,   &NDPluginPvaBloscCompressor);
+    createParam(NDPluginPvaBloscCLevelString,     asynParamInt32,   &NDPluginPvaBloscCLevel);
+    createParam(NDPluginPvaBloscShuffleString,    asynParamInt32,   &NDPluginPvaBloscShuffle);
+    setIntegerParam(NDPluginPvaCompressor, NDCodecNone);
+    setDoubleParam(NDPluginPvaCompFactor, 1.0);
+    setIntegerParam(NDPluginPvaJPEGQuality, 85);
+    setIntegerParam(NDPluginPvaBloscCompressor, 0);
+    setIntegerParam(NDPluginPvaBloscCLevel, 5);
+    setIntegerParam(NDPluginPvaBloscShuffle, 1);
+    // Compressed arrays are published with their codec, for the clients to decompress
+    supportsCompressedArrays_ = true;
 
     if(!m_record.get())
         throw runtime_error("failed to create NTNDArrayRecord");
@@ -166,10 +292,12 @@ NDPluginPva::NDPluginPva(const char *portName, int queueSize,
 /* Configuration routine.  Called directly, or from the iocsh function */
 extern "C" int NDPvaConfigure(const char *portName, int queueSize,
         int blockingCallbacks, const char *NDArrayPort, int NDArrayAddr,
-        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
+        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize,
+        int maxThreads)
 {
     NDPluginPva *pPlugin = new NDPluginPva(portName, queueSize, blockingCallbacks, NDArrayPort,
-                                           NDArrayAddr, pvName, maxBuffers, maxMemory, priority, stackSize);
+                                           NDArrayAddr, pvName, maxBuffers, maxMemory, priority, stackSize,
+                                           maxThreads);
     return pPlugin->start();
 }
 
@@ -184,6 +312,7 @@ static const iocshArg initArg6 = { "maxBuffers",iocshArgInt};
 static const iocshArg initArg7 = { "maxMemory",iocshArgInt};
 static const iocshArg initArg8 = { "priority",iocshArgInt};
 static const iocshArg initArg9 = { "stack size",iocshArgInt};
+static const iocshArg initArg10 = { "# threads",iocshArgInt};
 static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg1,
                                             &initArg2,
@@ -193,14 +322,15 @@ static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg6,
                                             &initArg7,
                                             &initArg8,
-                                            &initArg9,};
-static const iocshFuncDef initFuncDef = {"NDPvaConfigure",10,initArgs};
+                                            &initArg9,
+                                            &initArg10,};
+static const iocshFuncDef initFuncDef = {"NDPvaConfigure",11,initArgs};
 static void initCallFunc(const iocshArgBuf *args)
 {
     NDPvaConfigure(args[0].sval, args[1].ival, args[2].ival, 
                    args[3].sval, args[4].ival, args[5].sval, 
                    args[6].ival, args[7].ival, args[8].ival,
-                   args[9].ival);
+                   args[9].ival, args[10].ival);
 }
 
 extern "C" void NDPvaRegister(void)
@@ -5,6 +5,7 @@
 #include <epicsMutex.h>
 
 #include "NDPluginDriver.h"
+#include "NDArrayCodec.h"
 
 #include <pv/serverContext.h>
 #include <pv/lock.h>
@@ -12,12 +13,23 @@
 #include <vector>
 
 #define NDPluginPvaPvNameString "PV_NAME"
+#define NDPluginPvaCompressorString      "PVA_COMPRESSOR"       /* (asynInt32,   r/w) NDCodecCompressor_t of the
+                                                                 *  published arrays */
+#define NDPluginPvaCompFactorString      "PVA_COMP_FACTOR"      /* (asynFloat64, r/o) Uncompressed over published
+                                                                 *  size of the last array */
+#define NDPluginPvaJPEGQualityString     "PVA_JPEG_QUALITY"     /* (asynInt32,   r/w) JPEG quality, 1 to 100 */
+#define NDPluginPvaBloscCompressorString "PVA_BLOSC_COMPRESSOR" /* (asynInt32,   r/w) Compressor of blosc */
+#define NDPluginPvaBloscCLevelString     "PVA_BLOSC_CLEVEL"     /* (asynInt32,   r/w) Level of blosc, 0 to 9 */
+#define NDPluginPvaBloscShuffleString    "PVA_BLOSC_SHUFFLE"    /* (asynInt32,   r/w) Shuffle of blosc, 0 to 2 */
 
 class NTNDArrayRecord;
 typedef std::tr1::shared_ptr<NTNDArrayRecord> NTNDArrayRecordPtr;
 
 /** Converts NDArray callback data into EPICS V4 NTNDArray data and exposes it
-  * as an EPICS V4 PV  */
+  * as an EPICS V4 PV.  With a Compressor the arrays are compressed before they are published, by
+  * NumThreads plugin threads at once, and the codec field of the NTNDArray names the codec.  An array
+  * that is compressed after a later array has been published is dropped, as a DroppedOutputArray,
+  * so the clients never see the arrays go backwards.  */
 class NDPluginPva : public NDPluginDriver,
                      public std::tr1::enable_shared_from_this<NDPluginPva>
 {
@@ -25,16 +37,31 @@ public:
     POINTER_DEFINITIONS(NDPluginPva);
     NDPluginPva(const char *portName, int queueSize, int blockingCallbacks,
                  const char *NDArrayPort, int NDArrayAddr, const char *pvName,
-                 int maxBuffers, size_t maxMemory, int priority, int stackSize);
+                 int maxBuffers, size_t maxMemory, int priority, int stackSize,
+                 int maxThreads=1);
 
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
 protected:
     int NDPluginPvaPvName;
+    #define FIRST_NDPLUGIN_PVA_PARAM NDPluginPvaPvName
+    int NDPluginPvaCompressor;
+    int NDPluginPvaCompFactor;
+    int NDPluginPvaJPEGQuality;
+    int NDPluginPvaBloscCompressor;
+    int NDPluginPvaBloscCLevel;
+    int NDPluginPvaBloscShuffle;
 
 private:
     NTNDArrayRecordPtr m_record;
+    NDArrayCodec m_codec;
+    epicsMutex m_publishMutex;          /**< Orders the publication of the arrays of the plugin threads */
+    epicsUInt32 m_nextSequence;         /**< The sequence number of the next array; protected by the lock */
+    epicsUInt32 m_publishedSequence;    /**< The sequence number of the last array published; protected by
+                                          *  m_publishMutex */
+    bool m_published;                   /**< An array has been published */
 };
 
 #endif
@@ -33,56 +33,40 @@
 static const char *driverName="NDPluginROI";
 
 
-/** Callback function that is called by the NDArray driver with new NDArray data.
-  * Extracts the NthrDArray data into each of the ROIs that are being used.
-  * Computes statistics on the ROI if NDPluginROIComputeStatistics is 1.
-  * Computes the histogram of ROI values if NDPluginROIComputeHistogram is 1.
-  * \param[in] pArray  The NDArray from the callback.
-  */
-void NDPluginROI::processCallbacks(NDArray *pArray)
+/** Reads the settings of one ROI, makes the dimensions valid for the input array, and updates the parameters
+  * that may have changed.  This must be called with the lock held.
+  * \param[in] pArray The input array.
+  * \param[in] roi The address of the ROI.
+  * \param[out] pROI The settings of the ROI. */
+void NDPluginROI::getROISettings(NDArray *pArray, int roi, NDROISettings_t *pROI)
 {
-    /* This function computes the ROIs.
-     * It is called with the mutex already locked.  It unlocks it during long calculations when private
-     * structures don't need to be protected.
-     */
-
-    int dataType;
     int dim;
-    NDDimension_t dims[ND_ARRAY_MAX_DIMS], tempDim, *pDim;
+    NDDimension_t *dims = pROI->dims, tempDim, *pDim;
     size_t userDims[ND_ARRAY_MAX_DIMS];
-    NDArrayInfo arrayInfo, scratchInfo;
-    NDArray *pScratch, *pOutput;
-    NDColorMode_t colorMode;
-    double *pData;
-    int enableScale, enableDim[3], autoSize[3];
-    size_t i;
-    double scale;
-    int collapseDims;
-    //static const char* functionName = "processCallbacks";
-    
-    memset(dims, 0, sizeof(NDDimension_t) * ND_ARRAY_MAX_DIMS);
+    NDArrayInfo arrayInfo;
+    int enableDim[3], autoSize[3];
 
-    /* Get all parameters while we have the mutex */
-    getIntegerParam(NDPluginROIDim0Bin,      &dims[0].binning);
-    getIntegerParam(NDPluginROIDim1Bin,      &dims[1].binning);
-    getIntegerParam(NDPluginROIDim2Bin,      &dims[2].binning);
-    getIntegerParam(NDPluginROIDim0Reverse,  &dims[0].reverse);
-    getIntegerParam(NDPluginROIDim1Reverse,  &dims[1].reverse);
-    getIntegerParam(NDPluginROIDim2Reverse,  &dims[2].reverse);
-    getIntegerParam(NDPluginROIDim0Enable,   &enableDim[0]);
-    getIntegerParam(NDPluginROIDim1Enable,   &enableDim[1]);
-    getIntegerParam(NDPluginROIDim2Enable,   &enableDim[2]);
-    getIntegerParam(NDPluginROIDim0AutoSize, &autoSize[0]);
-    getIntegerParam(NDPluginROIDim1AutoSize, &autoSize[1]);
-    getIntegerParam(NDPluginROIDim2AutoSize, &autoSize[2]);
-    getIntegerParam(NDPluginROIDataType,     &dataType);
-    getIntegerParam(NDPluginROIEnableScale,  &enableScale);
-    getDoubleParam(NDPluginROIScale, &scale);
-    getIntegerParam(NDPluginROICollapseDims, &collapseDims);
+    memset(dims, 0, sizeof(NDDimension_t) * ND_ARRAY_MAX_DIMS);
+    pROI->pOutput = NULL;
+
+    getIntegerParam(roi, NDPluginROIDim0Bin,      &dims[0].binning);
+    getIntegerParam(roi, NDPluginROIDim1Bin,      &dims[1].binning);
+    getIntegerParam(roi, NDPluginROIDim2Bin,      &dims[2].binning);
+    getIntegerParam(roi, NDPluginROIDim0Reverse,  &dims[0].reverse);
+    getIntegerParam(roi, NDPluginROIDim1Reverse,  &dims[1].reverse);
+    getIntegerParam(roi, NDPluginROIDim2Reverse,  &dims[2].reverse);
+    getIntegerParam(roi, NDPluginROIDim0Enable,   &enableDim[0]);
+    getIntegerParam(roi, NDPluginROIDim1Enable,   &enableDim[1]);
+    getIntegerParam(roi, NDPluginROIDim2Enable,   &enableDim[2]);
+    getIntegerParam(roi, NDPluginROIDim0AutoSize, &autoSize[0]);
+    getIntegerParam(roi, NDPluginROIDim1AutoSize, &autoSize[1]);
+    getIntegerParam(roi, NDPluginROIDim2AutoSize, &autoSize[2]);
+    getIntegerParam(roi, NDPluginROIDataType,     &pROI->dataType);
+    getIntegerParam(roi, NDPluginROIEnableScale,  &pROI->enableScale);
+    getDoubleParam (roi, NDPluginROIScale,        &pROI->scale);
+    getIntegerParam(roi, NDPluginROICollapseDims, &pROI->collapseDims);
+    getIntegerParam(roi, NDPluginROIEnableViews,  &pROI->enableViews);
 
-    /* Call the base class method */
-    NDPluginDriver::beginProcessCallbacks(pArray);
-    
     /* Get information about the array */
     pArray->getInfo(&arrayInfo);
     
@@ -95,8 +79,8 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
         pDim = &dims[dim];
         if (enableDim[dim]) {
             size_t newDimSize = pArray->dims[userDims[dim]].size;
-            pDim->offset  = requestedOffset_[dim];
-            pDim->size    = requestedSize_[dim];
+            pDim->offset  = requestedOffset_[roi][dim];
+            pDim->size    = requestedSize_[roi][dim];
             pDim->offset  = MAX(pDim->offset,  0);
             pDim->offset  = MIN(pDim->offset,  newDimSize-1);
             if (autoSize[dim]) pDim->size = newDimSize;
@@ -112,45 +96,38 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     }
 
     /* Update the parameters that may have changed */
-    setIntegerParam(NDPluginROIDim0MaxSize, 0);
-    setIntegerParam(NDPluginROIDim1MaxSize, 0);
-    setIntegerParam(NDPluginROIDim2MaxSize, 0);
+    setIntegerParam(roi, NDPluginROIDim0MaxSize, 0);
+    setIntegerParam(roi, NDPluginROIDim1MaxSize, 0);
+    setIntegerParam(roi, NDPluginROIDim2MaxSize, 0);
     if (pArray->ndims > 0) {
         pDim = &dims[0];
-        setIntegerParam(NDPluginROIDim0MaxSize, (int)pArray->dims[userDims[0]].size);
+        setIntegerParam(roi, NDPluginROIDim0MaxSize, (int)pArray->dims[userDims[0]].size);
         if (enableDim[0]) {
-            setIntegerParam(NDPluginROIDim0Min,  (int)pDim->offset);
-            setIntegerParam(NDPluginROIDim0Size, (int)pDim->size);
-            setIntegerParam(NDPluginROIDim0Bin,  pDim->binning);
+            setIntegerParam(roi, NDPluginROIDim0Min,  (int)pDim->offset);
+            setIntegerParam(roi, NDPluginROIDim0Size, (int)pDim->size);
+            setIntegerParam(roi, NDPluginROIDim0Bin,  pDim->binning);
         }
     }
     if (pArray->ndims > 1) {
         pDim = &dims[1];
-        setIntegerParam(NDPluginROIDim1MaxSize, (int)pArray->dims[userDims[1]].size);
+        setIntegerParam(roi, NDPluginROIDim1MaxSize, (int)pArray->dims[userDims[1]].size);
         if (enableDim[1]) {
-            setIntegerParam(NDPluginROIDim1Min,  (int)pDim->offset);
-            setIntegerParam(NDPluginROIDim1Size, (int)pDim->size);
-            setIntegerParam(NDPluginROIDim1Bin,  pDim->binning);
+            setIntegerParam(roi, NDPluginROIDim1Min,  (int)pDim->offset);
+            setIntegerParam(roi, NDPluginROIDim1Size, (int)pDim->size);
+            setIntegerParam(roi, NDPluginROIDim1Bin,  pDim->binning);
         }
     }
     if (pArray->ndims > 2) {
         pDim = &dims[2];
-        setIntegerParam(NDPluginROIDim2MaxSize, (int)pArray->dims[userDims[2]].size);
+        setIntegerParam(roi, NDPluginROIDim2MaxSize, (int)pArray->dims[userDims[2]].size);
         if (enableDim[2]) {
-            setIntegerParam(NDPluginROIDim2Min,  (int)pDim->offset);
-            setIntegerParam(NDPluginROIDim2Size, (int)pDim->size);
-            setIntegerParam(NDPluginROIDim2Bin,  pDim->binning);
+            setIntegerParam(roi, NDPluginROIDim2Min,  (int)pDim->offset);
+            setIntegerParam(roi, NDPluginROIDim2Size, (int)pDim->size);
+            setIntegerParam(roi, NDPluginROIDim2Bin,  pDim->binning);
         }
     }
 
-    /* This function is called with the lock taken, and it must be set when we exit.
-     * The following code can be exected without the mutex because we are not accessing memory
-     * that other threads can access. */
-    this->unlock();
-
-    /* Extract this ROI from the input array.  The convert() function allocates
-     * a new array and it is reserved (reference count = 1) */
-    if (dataType == -1) dataType = (int)pArray->dataType;
+    if (pROI->dataType == -1) pROI->dataType = (int)pArray->dataType;
     /* We treat the case of RGB1 data specially, so that NX and NY are the X and Y dimensions of the
      * image, not the first 2 dimensions.  This makes it much easier to switch back and forth between
      * RGB1 and mono mode when using an ROI. */
@@ -166,22 +143,52 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
         dims[2] = tempDim;
     }
     
-    if (enableScale && (scale != 0) && (scale != 1)) {
+    /* A pure crop does not need to copy the data, the output can be a view of the input array.
+     * Downstream plugins that need contiguous data get a copy from NDPluginDriver.
+     * Sparse arrays have no views; convert() maps their events into a sparse output. */
+    if (pROI->enableViews && !pArray->sparse && (pROI->dataType == (int)pArray->dataType) &&
+        !(pROI->enableScale && (pROI->scale != 0) && (pROI->scale != 1))) {
+        for (dim=0; dim<pArray->ndims; dim++) {
+            if ((dims[dim].binning != 1) || dims[dim].reverse) pROI->enableViews = 0;
+        }
+    } else {
+        pROI->enableViews = 0;
+    }
+}
+
+/** Extracts one ROI from the input array.  This is called without the lock, so it only uses the settings
+  * in pROI.
+  * \param[in] pArray The input array.
+  * \param[in] pROI The settings of the ROI from getROISettings().
+  * \return The output array, which the caller owns, or NULL if it could not be allocated. */
+NDArray* NDPluginROI::extractROI(NDArray *pArray, NDROISettings_t *pROI)
+{
+    NDArrayInfo arrayInfo;
+    NDArray *pOutput=NULL;
+    NDColorMode_t colorMode;
+    int collapseDims = pROI->collapseDims;
+
+    pArray->getInfo(&arrayInfo);
+
+    /* Extract this ROI from the input array.  The convert() function allocates
+     * a new array and it is reserved (reference count = 1).
+     * A band of whole rows is a contiguous range of the input, which convert() copies in one memcpy,
+     * or which is output as a view when views are enabled. */
+    if (pROI->enableViews) {
+        pOutput = this->pNDArrayPool->createView(pArray, pROI->dims);
+    }
+    else if (pROI->enableScale && (pROI->scale != 0) && (pROI->scale != 1)) {
         /* This is tricky.  We want to do the operation to avoid errors due to integer truncation.
          * For example, if an image with all pixels=1 is binned 3x3 with scale=9 (divide by 9), then
          * the output should also have all pixels=1. 
-         * We do this by extracting the ROI and converting to double, do the scaling, then convert
-         * to the desired data type. */
-        this->pNDArrayPool->convert(pArray, &pScratch, NDFloat64, dims);
-        pScratch->getInfo(&scratchInfo);
-        pData = (double *)pScratch->pData;
-        for (i=0; i<scratchInfo.nElements; i++) pData[i] = pData[i]/scale;
-        this->pNDArrayPool->convert(pScratch, &pOutput, (NDDataType_t)dataType);
-        pScratch->release();
+         * convert() sums the bins in a wider type and divides them before converting to the desired
+         * data type, in one pass. */
+        this->pNDArrayPool->convert(pArray, &pOutput, (NDDataType_t)pROI->dataType, pROI->dims, pROI->scale);
     } 
     else {        
-        this->pNDArrayPool->convert(pArray, &pOutput, (NDDataType_t)dataType, dims);
+        this->pNDArrayPool->convert(pArray, &pOutput, (NDDataType_t)pROI->dataType, pROI->dims);
     }
+    if (!pOutput) return NULL;
 
     /* If we selected just one color from the array, then we need to collapse the
      * dimensions and set the color mode to mono */
@@ -215,6 +222,7 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
             if (pOutput->dims[i].size == 1) {
                 for (j=i+1; j<pOutput->ndims; j++) {
                     pOutput->dims[j-1] = pOutput->dims[j];
+                    pOutput->strides[j-1] = pOutput->strides[j];
                 }
                 if (pOutput->ndims > 1) pOutput->ndims--;
             } else {
@@ -222,20 +230,104 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
             }
         }
     }
-    this->lock();
+    return pOutput;
+}
+
+/** Publishes the output array of one ROI on its address and sets its array size parameters.
+  * The ROI at address 0 is output with endProcessCallbacks(), so it is sorted and counted like the output
+  * of other plugins; the others are passed directly to the plugins registered on their address.
+  * The parameter callbacks of all the addresses are done by doStatusCallbacks(), at most once every
+  * StatusUpdatePeriod.
+  * This must be called with the lock held, and takes over the reference to pOutput.
+  * \param[in] pArray The input array.
+  * \param[in] roi The address of the ROI.
+  * \param[in] pOutput The output array from extractROI(). */
+void NDPluginROI::outputROI(NDArray *pArray, int roi, NDArray *pOutput)
+{
+    NDArrayInfo arrayInfo;
+    size_t userDims[3];
+    int arrayCallbacks;
+
+    pArray->getInfo(&arrayInfo);
+    userDims[0] = arrayInfo.xDim;
+    userDims[1] = arrayInfo.yDim;
+    userDims[2] = arrayInfo.colorDim;
 
     /* Set the image size of the ROI image data */
-    setIntegerParam(NDArraySizeX, 0);
-    setIntegerParam(NDArraySizeY, 0);
-    setIntegerParam(NDArraySizeZ, 0);
-    if (pOutput->ndims > 0) setIntegerParam(NDArraySizeX, (int)pOutput->dims[userDims[0]].size);
-    if (pOutput->ndims > 1) setIntegerParam(NDArraySizeY, (int)pOutput->dims[userDims[1]].size);
-    if (pOutput->ndims > 2) setIntegerParam(NDArraySizeZ, (int)pOutput->dims[userDims[2]].size);
+    setIntegerParam(roi, NDArraySizeX, 0);
+    setIntegerParam(roi, NDArraySizeY, 0);
+    setIntegerParam(roi, NDArraySizeZ, 0);
+    if (pOutput->ndims > 0) setIntegerParam(roi, NDArraySizeX, (int)pOutput->dims[userDims[0]].size);
+    if (pOutput->ndims > 1) setIntegerParam(roi, NDArraySizeY, (int)pOutput->dims[userDims[1]].size);
+    if (pOutput->ndims > 2) setIntegerParam(roi, NDArraySizeZ, (int)pOutput->dims[userDims[2]].size);
+
+    if (roi == 0) {
+        NDPluginDriver::endProcessCallbacks(pOutput, false, true);
+        return;
+    }
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (arrayCallbacks) {
+        this->getAttributes(pOutput->pAttributeList);
+        doCallbacksGenericPointer(pOutput, NDArrayData, roi);
+    }
+    if (this->pArrays[roi]) this->pArrays[roi]->release();
+    this->pArrays[roi] = pOutput;
+}
 
-    NDPluginDriver::endProcessCallbacks(pOutput, false, true);
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * Extracts the NDArray data into each of the ROIs that are being used.
+  * The settings of all the ROIs are read first, then all the ROIs are extracted without the lock, then
+  * their output arrays are published, so an input array is handled in one callback for any number of ROIs.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginROI::processCallbacks(NDArray *pArray)
+{
+    /* This function computes the ROIs.
+     * It is called with the mutex already locked.  It unlocks it during long calculations when private
+     * structures don't need to be protected.
+     */
 
-    callParamCallbacks();
+    NDROISettings_t *pROIs = new NDROISettings_t[maxROIs_];
+    int *use = new int[maxROIs_];
+    int roi;
+    //static const char* functionName = "processCallbacks";
+    
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
 
+    /* Get all parameters while we have the mutex */
+    for (roi=0; roi<maxROIs_; roi++) {
+        getIntegerParam(roi, NDPluginROIUse, &use[roi]);
+        pROIs[roi].pOutput = NULL;
+        if (use[roi]) getROISettings(pArray, roi, &pROIs[roi]);
+    }
+
+    /* This function is called with the lock taken, and it must be set when we exit.
+     * The following code can be exected without the mutex because we are not accessing memory
+     * that other threads can access. */
+    this->unlock();
+    for (roi=0; roi<maxROIs_; roi++) {
+        if (use[roi]) pROIs[roi].pOutput = extractROI(pArray, &pROIs[roi]);
+    }
+    this->lock();
+
+    for (roi=0; roi<maxROIs_; roi++) {
+        if (pROIs[roi].pOutput) outputROI(pArray, roi, pROIs[roi].pOutput);
+    }
+    delete [] pROIs;
+    delete [] use;
+
+    callStatusCallbacks();
+
+}
+
+/** Does the parameter callbacks of callStatusCallbacks() on the address of each ROI.
+  * This is called with the lock held. */
+void NDPluginROI::doStatusCallbacks()
+{
+    int roi;
+
+    for (roi=0; roi<maxROIs_; roi++) callParamCallbacks(roi);
 }
 
 /** Called when asyn clients call pasynInt32->write().
@@ -247,24 +339,28 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
 asynStatus NDPluginROI::writeInt32(asynUser *pasynUser, epicsInt32 value)
 {
     int function = pasynUser->reason;
+    int roi;
     asynStatus status = asynSuccess;
     static const char* functionName = "writeInt32";
 
+    status = getAddress(pasynUser, &roi);
+    if (status != asynSuccess) return status;
+
     /* Set the parameter in the parameter library. */
-    status = (asynStatus) setIntegerParam(function, value);
+    status = (asynStatus) setIntegerParam(roi, function, value);
 
     if        (function == NDPluginROIDim0Min) {
-        requestedOffset_[0] = value;
+        requestedOffset_[roi][0] = value;
     } else if (function == NDPluginROIDim1Min) {
-        requestedOffset_[1] = value;
+        requestedOffset_[roi][1] = value;
     } else if (function == NDPluginROIDim2Min) {
-        requestedOffset_[2] = value;
+        requestedOffset_[roi][2] = value;
     } else if (function == NDPluginROIDim0Size) {
-        requestedSize_[0] = value;
+        requestedSize_[roi][0] = value;
     } else if (function == NDPluginROIDim1Size) {
-        requestedSize_[1] = value;
+        requestedSize_[roi][1] = value;
     } else if (function == NDPluginROIDim2Size) {
-        requestedSize_[2] = value;
+        requestedSize_[roi][2] = value;
     } else {
         /* If this parameter belongs to a base class call its method */
         if (function < FIRST_NDPLUGIN_ROI_PARAM) 
@@ -272,7 +368,7 @@ asynStatus NDPluginROI::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
     
     /* Do callbacks so higher layers see any changes */
-    callParamCallbacks();
+    callParamCallbacks(roi);
     
     if (status) 
         asynPrint(pasynUser, ASYN_TRACE_ERROR, 
@@ -305,22 +401,32 @@ asynStatus NDPluginROI::writeInt32(asynUser *pasynUser, epicsInt32 value)
   * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   * \param[in] maxThreads The maximum number of threads this driver is allowed to use. If 0 then 1 will be used.
+  * \param[in] maxROIs The number of ROIs, selected by the asyn address.  The output arrays of each ROI are
+  *            published on its address.  If less than 1 then 1 will be used.
   */
 NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallbacks,
                          const char *NDArrayPort, int NDArrayAddr,
                          int maxBuffers, size_t maxMemory,
-                         int priority, int stackSize, int maxThreads)
+                         int priority, int stackSize, int maxThreads, int maxROIs)
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
-                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   NDArrayPort, NDArrayAddr, (maxROIs < 1) ? 1 : maxROIs, maxBuffers, maxMemory,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads)
 {
     //static const char *functionName = "NDPluginROI";
+    int roi;
+
+    maxROIs_ = (maxROIs < 1) ? 1 : maxROIs;
+    requestedSize_   = new int[maxROIs_][3];
+    requestedOffset_ = new int[maxROIs_][3];
+    memset(requestedSize_,   0, maxROIs_ * sizeof(*requestedSize_));
+    memset(requestedOffset_, 0, maxROIs_ * sizeof(*requestedOffset_));
 
     /* ROI general parameters */
     createParam(NDPluginROINameString,              asynParamOctet, &NDPluginROIName);
+    createParam(NDPluginROIUseString,               asynParamInt32, &NDPluginROIUse);
 
      /* ROI definition */
     createParam(NDPluginROIDim0MinString,           asynParamInt32, &NDPluginROIDim0Min);
@@ -348,6 +454,16 @@ NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallba
     createParam(NDPluginROIEnableScaleString,       asynParamInt32, &NDPluginROIEnableScale);
     createParam(NDPluginROIScaleString,             asynParamFloat64, &NDPluginROIScale);
     createParam(NDPluginROICollapseDimsString,      asynParamInt32, &NDPluginROICollapseDims);
+    createParam(NDPluginROIEnableViewsString,       asynParamInt32, &NDPluginROIEnableViews);
+
+    /* The first ROI is used unless it is disabled, the others only when they are enabled */
+    for (roi=0; roi<maxROIs_; roi++) {
+        setIntegerParam(roi, NDPluginROIUse, (roi == 0) ? 1 : 0);
+    }
+
+    /* convert() and createView() accept strided views as input, and convert() sparse arrays */
+    supportsStridedViews_ = true;
+    supportsSparseArrays_ = true;
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginROI");
@@ -360,10 +476,10 @@ NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallba
 extern "C" int NDROIConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr,
                                  int maxBuffers, size_t maxMemory,
-                                 int priority, int stackSize, int maxThreads)
+                                 int priority, int stackSize, int maxThreads, int maxROIs)
 {
     NDPluginROI *pPlugin = new NDPluginROI(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
-                                           maxBuffers, maxMemory, priority, stackSize, maxThreads);
+                                           maxBuffers, maxMemory, priority, stackSize, maxThreads, maxROIs);
     return pPlugin->start();
 }
 
@@ -378,6 +494,7 @@ static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
 static const iocshArg initArg7 = { "priority",iocshArgInt};
 static const iocshArg initArg8 = { "stackSize",iocshArgInt};
 static const iocshArg initArg9 = { "maxThreads",iocshArgInt};
+static const iocshArg initArg10 = { "maxROIs",iocshArgInt};
 static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg1,
                                             &initArg2,
@@ -387,14 +504,15 @@ static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg6,
                                             &initArg7,
                                             &initArg8,
-                                            &initArg9};
-static const iocshFuncDef initFuncDef = {"NDROIConfigure",10,initArgs};
+                                            &initArg9,
+                                            &initArg10};
+static const iocshFuncDef initFuncDef = {"NDROIConfigure",11,initArgs};
 static void initCallFunc(const iocshArgBuf *args)
 {
     NDROIConfigure(args[0].sval, args[1].ival, args[2].ival,
                    args[3].sval, args[4].ival, args[5].ival,
                    args[6].ival, args[7].ival, args[8].ival,
-                   args[9].ival);
+                   args[9].ival, args[10].ival);
 }
 
 extern "C" void NDROIRegister(void)
@@ -5,6 +5,7 @@
 
 /* ROI general parameters */
 #define NDPluginROINameString               "NAME"                /* (asynOctet,   r/w) Name of this ROI */
+#define NDPluginROIUseString                "ROI_USE"             /* (asynInt32,   r/w) Extract this ROI? */
 
 /* ROI definition */
 #define NDPluginROIDim0MinString            "DIM0_MIN"          /* (asynInt32,   r/w) Starting element of ROI in each dimension */
@@ -32,24 +33,40 @@
 #define NDPluginROIEnableScaleString        "ENABLE_SCALE"      /* (asynInt32,   r/w) Disable/Enable scaling */
 #define NDPluginROIScaleString              "SCALE_VALUE"       /* (asynFloat64, r/w) Scaling value, used as divisor */
 #define NDPluginROICollapseDimsString       "COLLAPSE_DIMS"     /* (asynInt32,   r/w) Collapse dimensions of size 1 */
+#define NDPluginROIEnableViewsString        "ENABLE_VIEWS"      /* (asynInt32,   r/w) Output views of the input array instead of copies */
+
+/** The settings of one ROI, read with the lock held and used to extract the ROI without it */
+typedef struct {
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    int dataType;
+    int enableScale;
+    double scale;
+    int collapseDims;
+    int enableViews;
+    NDArray *pOutput;
+} NDROISettings_t;
 
 /** Extract Regions-Of-Interest (ROI) from NDArray data; the plugin can be a source of NDArray callbacks for
   * other plugins, passing these sub-arrays. 
-  * The plugin also optionally computes a statistics on the ROI. */
+  * A plugin can hold more than one ROI, selected by the asyn address.  All of them are extracted from each
+  * input array in one callback, and the output arrays of each ROI are published on its address. */
 class epicsShareClass NDPluginROI : public NDPluginDriver {
 public:
     NDPluginROI(const char *portName, int queueSize, int blockingCallbacks, 
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
-                 int priority, int stackSize, int maxThreads);
+                 int priority, int stackSize, int maxThreads, int maxROIs=1);
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
 protected:
+    void doStatusCallbacks();
+
     /* ROI general parameters */
     int NDPluginROIName;
     #define FIRST_NDPLUGIN_ROI_PARAM NDPluginROIName
+    int NDPluginROIUse;
 
     /* ROI definition */
     int NDPluginROIDim0Min;
@@ -77,10 +94,17 @@ protected:
     int NDPluginROIEnableScale;
     int NDPluginROIScale;
     int NDPluginROICollapseDims;
+    int NDPluginROIEnableViews;
 
 private:
-    int requestedSize_[3];
-    int requestedOffset_[3];
+    void getROISettings(NDArray *pArray, int roi, NDROISettings_t *pROI);
+    NDArray* extractROI(NDArray *pArray, NDROISettings_t *pROI);
+    void outputROI(NDArray *pArray, int roi, NDArray *pOutput);
+
+    int maxROIs_;
+    /* The size and offset in each dimension that were last written for each ROI */
+    int (*requestedSize_)[3];
+    int (*requestedOffset_)[3];
 };
     
 #endif
@@ -14,6 +14,10 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include <cantProceed.h>
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
@@ -27,6 +31,7 @@
 #include <epicsExport.h>
 
 #include "NDArray.h"
+#include "NDStatsKernels.h"
 #include "NDPluginROIStat.h"
 
 #define MAX(A,B) (A)>(B)?(A):(B)
@@ -34,6 +39,437 @@
 
 #define DEFAULT_NUM_TSPOINTS 2048
 
+/**
+ * Adds the minimum, maximum and sum of one row of an ROI to the ROI.
+ * The row sums are exact for integer types, see NDStatsRow().
+ * \param[in] pArray The pointer to the NDArray object
+ * \param[in] pRow The first element of the row
+ * \param[in] n The number of elements in the row, at least 1
+ * \param[in] step Use every step'th element of the row
+ * \param[in] NDROI The pointer to the NDROI object
+ * \param[in,out] pInitial True until the first row has been added
+ * \return The number of elements used
+ */
+template <typename epicsType>
+static size_t addROIRow(NDArray *pArray, const epicsType *pRow, size_t n, size_t step, NDROI *pROI, bool *pInitial)
+{
+  typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
+  NDStatsSums_t sums;
+  sumType sum = 0;
+  size_t x, nUsed = n;
+
+  if (step > 1) {
+    sums.min = sums.max = (double)pRow[0];
+    for (x=0; x<n; x+=step) {
+      if (pRow[x] < sums.min) sums.min = (double)pRow[x];
+      if (pRow[x] > sums.max) sums.max = (double)pRow[x];
+      sum += (sumType)pRow[x];
+    }
+    sums.total = (double)sum;
+    nUsed = (n + step - 1) / step;
+  } else if (NDStatsContiguous(pArray->dataType, pRow, n, &sums) != ND_SUCCESS) {
+    NDStatsRow(pRow, n, 0., &sums);
+  }
+  if (*pInitial) {
+    pROI->min = sums.min;
+    pROI->max = sums.max;
+    *pInitial = false;
+  }
+  if (sums.min < pROI->min) pROI->min = sums.min;
+  if (sums.max > pROI->max) pROI->max = sums.max;
+  pROI->total += sums.total;
+  return nUsed;
+}
+
+/**
+ * Returns the sum of a rectangle of the array from its summed-area table.
+ * \param[in] pTable The summed-area table
+ * \param[in] width The width of the table, which is one more than the array width
+ * \param[in] x The first column of the rectangle
+ * \param[in] y The first row of the rectangle
+ * \param[in] nx The number of columns of the rectangle
+ * \param[in] ny The number of rows of the rectangle
+ */
+template <typename sumType>
+static sumType rectSum(const sumType *pTable, size_t width, size_t x, size_t y, size_t nx, size_t ny)
+{
+  return pTable[(y+ny)*width + x+nx] - pTable[y*width + x+nx] - pTable[(y+ny)*width + x] + pTable[y*width + x];
+}
+
+/**
+ * Returns the sum of a rectangle of a sparse array, whose elements are zero except for its events.
+ * The events of each row of the rectangle are a range of the ascending event indices, found by binary search,
+ * so the cost grows with the events in the rectangle and the number of rows, not with its area.
+ * \param[in] pArray The sparse array
+ * \param[in] width The width of the array
+ * \param[in] x The first column of the rectangle
+ * \param[in] y The first row of the rectangle
+ * \param[in] nx The number of columns of the rectangle
+ * \param[in] ny The number of rows of the rectangle
+ * \param[out] pROI If not NULL, the minimum and maximum of the rectangle are set in it, with the zeros
+ */
+template <typename epicsType>
+static typename NDStatsAccumulator<epicsType>::sumType sparseRectSum(NDArray *pArray, size_t width, size_t x,
+                                                                     size_t y, size_t nx, size_t ny, NDROI *pROI)
+{
+  typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
+  const epicsUInt32 *pIndices = pArray->eventIndices();
+  const epicsUInt32 *pEnd = pIndices + pArray->numEvents;
+  const epicsUInt32 *pFirst = pIndices, *pLast;
+  const epicsType *pValues = (const epicsType *)pArray->eventValues();
+  sumType sum = 0;
+  size_t row, nEvents = 0;
+  double value;
+
+  if (pROI) {
+    pROI->min = 0;
+    pROI->max = 0;
+  }
+  for (row=y; row<y+ny; row++) {
+    pFirst = std::lower_bound(pFirst, pEnd, (epicsUInt32)(row*width + x));
+    pLast = std::lower_bound(pFirst, pEnd, (epicsUInt32)(row*width + x + nx));
+    for (; pFirst<pLast; pFirst++) {
+      sum += (sumType)pValues[pFirst - pIndices];
+      if (!pROI) continue;
+      value = (double)pValues[pFirst - pIndices];
+      if ((nEvents == 0) || (value < pROI->min)) pROI->min = value;
+      if ((nEvents == 0) || (value > pROI->max)) pROI->max = value;
+      nEvents++;
+    }
+  }
+  if (pROI && (nEvents < nx*ny)) {
+    if (pROI->min > 0) pROI->min = 0;
+    if (pROI->max < 0) pROI->max = 0;
+  }
+  return sum;
+}
+
+/**
+ * Returns the sum of a rectangle of the array, from its summed-area table or, if it is sparse, from its events.
+ * \param[in] pArray The array
+ * \param[in] pTable The summed-area table, not used for a sparse array
+ * \param[in] width The width of the table, which is one more than the array width
+ * \param[in] x The first column of the rectangle
+ * \param[in] y The first row of the rectangle
+ * \param[in] nx The number of columns of the rectangle
+ * \param[in] ny The number of rows of the rectangle
+ */
+template <typename epicsType, typename sumType>
+static sumType areaSum(NDArray *pArray, const sumType *pTable, size_t width, size_t x, size_t y, size_t nx, size_t ny)
+{
+  if (pArray->sparse) return sparseRectSum<epicsType>(pArray, width-1, x, y, nx, ny, NULL);
+  return rectSum(pTable, width, x, y, nx, ny);
+}
+
+/**
+ * Sets lo and hi to the first and last column x with (x-c)^2 < w2.
+ * \return false if there is no such column
+ */
+static bool rowRange(double c, double w2, long *pLo, long *pHi)
+{
+  long lo, hi;
+  double w;
+
+  if (w2 <= 0) return false;
+  w = sqrt(w2);
+  lo = (long)floor(c - w);
+  hi = (long)ceil(c + w);
+  /* The square root can be a little off, so the ends are checked against w2 itself */
+  while ((lo <= hi) && ((lo - c)*(lo - c) >= w2)) lo++;
+  while ((hi >= lo) && ((hi - c)*(hi - c) >= w2)) hi--;
+  if (lo > hi) return false;
+  *pLo = lo;
+  *pHi = hi;
+  return true;
+}
+
+/**
+ * Adds the span of the columns lo to hi of a row to the spans of an ROI, clipped to the columns first to last.
+ */
+static void addSpan(NDROISpans_t *pSpans, long lo, long hi, size_t y, size_t first, size_t last)
+{
+  NDROISpan_t span;
+
+  if (lo < (long)first) lo = (long)first;
+  if (hi > (long)last) hi = (long)last;
+  if (lo > hi) return;
+  span.x = (size_t)lo;
+  span.y = y;
+  span.n = (size_t)(hi - lo + 1);
+  pSpans->spans.push_back(span);
+  pSpans->numElements += span.n;
+}
+
+/**
+ * Returns true if the mask of an ROI selects column x of the mask row that starts at element row of the mask.
+ */
+static bool maskSelects(const NDROIShape_t *pShape, size_t row, size_t x)
+{
+  size_t index;
+
+  if ((x < pShape->maskOffset[0]) || (x - pShape->maskOffset[0] >= pShape->maskSize[0])) return false;
+  index = row + x - pShape->maskOffset[0];
+  return (index < pShape->mask.size()) && pShape->mask[index];
+}
+
+/**
+ * Compiles an ROI shape into the runs of elements it covers in each row, so the statistics of every array
+ * scan only those elements, a contiguous run at a time.
+ * An element of an annulus is in it if its distance from the center is at least RadiusMin and less than
+ * RadiusMax, so the rings of an azimuthal integration do not share elements.
+ * \param[in] pShape The shape; the ellipse and mask are within its rectangle, the annulus within the array.
+ *            The mask is laid over the rectangle that was requested, so a clipped ROI keeps the mask elements
+ *            that are in the array where they were.
+ * \param[out] pSpans The spans, row by row
+ */
+static void compileSpans(const NDROIShape_t *pShape, NDROISpans_t *pSpans)
+{
+  size_t firstX = pShape->offset[0], lastX = pShape->offset[0] + pShape->size[0] - 1;
+  size_t firstY = pShape->offset[1], lastY = pShape->offset[1] + pShape->size[1] - 1;
+  size_t x, y, row;
+  long lo, hi, innerLo, innerHi;
+  double cx, cy, a, b, dy, dy2;
+
+  pSpans->spans.clear();
+  pSpans->numElements = 0;
+  switch (pShape->shape) {
+  case ROIShapeEllipse:
+    a = pShape->size[0] / 2.;
+    b = pShape->size[1] / 2.;
+    cx = firstX + (pShape->size[0] - 1) / 2.;
+    cy = firstY + (pShape->size[1] - 1) / 2.;
+    for (y=firstY; y<=lastY; y++) {
+      dy = (y - cy) / b;
+      if (rowRange(cx, a*a*(1. - dy*dy), &lo, &hi)) addSpan(pSpans, lo, hi, y, firstX, lastX);
+    }
+    break;
+  case ROIShapeAnnulus:
+    cx = pShape->center[0];
+    cy = pShape->center[1];
+    for (y=0; y<pShape->arraySize[1]; y++) {
+      dy2 = (y - cy)*(y - cy);
+      if (!rowRange(cx, pShape->radius[1]*pShape->radius[1] - dy2, &lo, &hi)) continue;
+      if (rowRange(cx, pShape->radius[0]*pShape->radius[0] - dy2, &innerLo, &innerHi)) {
+        addSpan(pSpans, lo, innerLo - 1, y, 0, pShape->arraySize[0] - 1);
+        addSpan(pSpans, innerHi + 1, hi, y, 0, pShape->arraySize[0] - 1);
+      } else {
+        addSpan(pSpans, lo, hi, y, 0, pShape->arraySize[0] - 1);
+      }
+    }
+    break;
+  case ROIShapeMask:
+    /* The mask is row by row over the requested rectangle, so the rows and columns clipped off the array are
+     * skipped; the elements it does not reach are outside */
+    for (y=firstY; y<=lastY; y++) {
+      if ((y < pShape->maskOffset[1]) || (y - pShape->maskOffset[1] >= pShape->maskSize[1])) continue;
+      row = (y - pShape->maskOffset[1]) * pShape->maskSize[0];
+      for (x=firstX; x<=lastX; x++) {
+        if (!maskSelects(pShape, row, x)) continue;
+        lo = (long)x;
+        while ((x < lastX) && maskSelects(pShape, row, x+1)) x++;
+        addSpan(pSpans, lo, (long)x, y, firstX, lastX);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * Returns the spans of an ROI that is not a rectangle, compiling them again if its shape, rectangle or the
+ * array size changed.  Must be called with the lock taken; the caller releases the spans with releaseSpans().
+ * \param[in] roi The ROI
+ * \param[in] pROI The ROI rectangle, already clipped to the array
+ * \param[in] ndims The number of dimensions of the array
+ * \return The spans, or NULL for a rectangle
+ */
+NDROISpans_t* NDPluginROIStat::getSpans(int roi, NDROI_t *pROI, int ndims)
+{
+  NDROIShape_t *pShape = &shapes_[roi];
+  NDROIShape_t key;
+  int dim;
+
+  getIntegerParam(roi, NDPluginROIStatShape,     &key.shape);
+  getDoubleParam (roi, NDPluginROIStatCenterX,   &key.center[0]);
+  getDoubleParam (roi, NDPluginROIStatCenterY,   &key.center[1]);
+  getDoubleParam (roi, NDPluginROIStatRadiusMin, &key.radius[0]);
+  getDoubleParam (roi, NDPluginROIStatRadiusMax, &key.radius[1]);
+  for (dim=0; dim<2; dim++) {
+    key.offset[dim] = (dim < ndims) ? pROI->offset[dim] : 0;
+    key.size[dim] = (dim < ndims) ? pROI->size[dim] : 1;
+    key.arraySize[dim] = (dim < ndims) ? pROI->arraySize[dim] : 1;
+    key.maskOffset[dim] = (dim < ndims) ? MAX(pShape->requestedOffset[dim], 0) : 0;
+    key.maskSize[dim] = (dim < ndims) ? MAX(pShape->requestedSize[dim], 1) : 1;
+  }
+  if ((key.shape <= ROIShapeRectangle) || (key.shape > ROIShapeMask)) return NULL;
+
+  if (!pShape->pSpans || pShape->maskChanged || (key.shape != pShape->shape) ||
+      (key.center[0] != pShape->center[0]) || (key.center[1] != pShape->center[1]) ||
+      (key.radius[0] != pShape->radius[0]) || (key.radius[1] != pShape->radius[1]) ||
+      (memcmp(key.offset, pShape->offset, sizeof(key.offset)) != 0) ||
+      (memcmp(key.size, pShape->size, sizeof(key.size)) != 0) ||
+      (memcmp(key.arraySize, pShape->arraySize, sizeof(key.arraySize)) != 0) ||
+      (memcmp(key.maskOffset, pShape->maskOffset, sizeof(key.maskOffset)) != 0) ||
+      (memcmp(key.maskSize, pShape->maskSize, sizeof(key.maskSize)) != 0)) {
+    pShape->shape = key.shape;
+    for (dim=0; dim<2; dim++) {
+      pShape->center[dim] = key.center[dim];
+      pShape->radius[dim] = key.radius[dim];
+      pShape->offset[dim] = key.offset[dim];
+      pShape->size[dim] = key.size[dim];
+      pShape->arraySize[dim] = key.arraySize[dim];
+      pShape->maskOffset[dim] = key.maskOffset[dim];
+      pShape->maskSize[dim] = key.maskSize[dim];
+    }
+    /* The arrays being processed keep the old spans until they release them */
+    if (pShape->pSpans) releaseSpans(pShape->pSpans);
+    pShape->pSpans = new NDROISpans_t;
+    pShape->pSpans->refCount = 1;
+    compileSpans(pShape, pShape->pSpans);
+    pShape->maskChanged = false;
+  }
+  pShape->pSpans->refCount++;
+  return pShape->pSpans;
+}
+
+/**
+ * Releases spans returned by getSpans(), deleting them when they are no longer used.  Must be called with the
+ * lock taken.
+ */
+void NDPluginROIStat::releaseSpans(NDROISpans_t *pSpans)
+{
+  if (--pSpans->refCount == 0) delete pSpans;
+}
+
+/**
+ * Computes the statistics of an ROI from its spans.  There is no background, so the net is the total.
+ * With the summed-area table or a sparse array the sums of the spans are read from the table or the events;
+ * otherwise each span is summed as one contiguous row.
+ * \param[in] NDArray The pointer to the NDArray object
+ * \param[in] NDROI The pointer to the NDROI object
+ */
+template <typename epicsType>
+static void computeSpanStatistics(NDArray *pArray, NDROI *pROI)
+{
+  typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
+  const epicsType *pData = (const epicsType *)pArray->pData;
+  const sumType *pTable = (const sumType *)pROI->pSummedArea;
+  const std::vector<NDROISpan_t>& spans = pROI->pSpans->spans;
+  size_t tableWidth = pROI->arraySize[0] + 1;
+  size_t nElements = pROI->pSpans->numElements;
+  size_t i, nUsed = 0;
+  sumType sum = 0;
+  bool initial = true;
+  NDROI spanROI;
+
+  for (i=0; i<spans.size(); i++) {
+    const NDROISpan_t& span = spans[i];
+    if (pArray->sparse) {
+      sum += sparseRectSum<epicsType>(pArray, pROI->arraySize[0], span.x, span.y, span.n, 1, &spanROI);
+      if (initial || (spanROI.min < pROI->min)) pROI->min = spanROI.min;
+      if (initial || (spanROI.max > pROI->max)) pROI->max = spanROI.max;
+      initial = false;
+      continue;
+    }
+    if (span.y % pROI->sample[1] != 0) continue;
+    nUsed += addROIRow(pArray, pData + span.y*pROI->arraySize[0] + span.x, span.n, pROI->sample[0], pROI, &initial);
+    if (pTable) sum += rectSum(pTable, tableWidth, span.x, span.y, span.n, 1);
+  }
+  if (pTable || pArray->sparse) {
+    pROI->total = (double)sum;
+    nUsed = nElements;
+  }
+  /* When sampling, the total of the elements used is scaled to an estimate for the whole ROI */
+  if ((nUsed > 0) && (nUsed < nElements)) {
+    pROI->total = pROI->total * nElements / nUsed;
+  }
+  pROI->net = pROI->total;
+  if (nElements > 0) {
+    pROI->mean = pROI->total / nElements;
+  }
+}
+
+/**
+ * Builds the summed-area table of an array.  Element (x+1, y+1) of the table is the sum of the elements
+ * of the array with columns up to x and rows up to y; the first row and column of the table are 0.
+ * The table uses the accumulator type of the data type, so it is exact for integer types.
+ * \param[in] NDArray The pointer to the NDArray object
+ * \param[out] pTable The table, with (sizeX+1)*(sizeY+1) elements
+ */
+template <typename epicsType>
+static void buildSummedAreaT(NDArray *pArray, void *pTable)
+{
+  typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
+  epicsType *pData = (epicsType *)pArray->pData;
+  sumType *pSum = (sumType *)pTable;
+  size_t sizeX = pArray->dims[0].size;
+  size_t sizeY = (pArray->ndims > 1) ? pArray->dims[1].size : 1;
+  size_t width = sizeX + 1;
+  size_t x, y;
+  sumType rowSum;
+
+  for (x=0; x<width; x++) pSum[x] = 0;
+  for (y=0; y<sizeY; y++, pData+=sizeX) {
+    sumType *pPrev = pSum + y*width;
+    sumType *pRow = pPrev + width;
+    rowSum = 0;
+    pRow[0] = 0;
+    for (x=0; x<sizeX; x++) {
+      rowSum += (sumType)pData[x];
+      pRow[x+1] = pPrev[x+1] + rowSum;
+    }
+  }
+}
+
+/**
+ * Builds the summed-area table of an array.
+ * The table is a scratch buffer, valid until processCallbacks() returns; its elements are 8 bytes, the size
+ * of all the accumulator types.
+ * \param[in] NDArray The pointer to the NDArray object
+ * \return The table, or NULL if it cannot be allocated
+ */
+const void* NDPluginROIStat::buildSummedArea(NDArray *pArray)
+{
+  size_t sizeY = (pArray->ndims > 1) ? pArray->dims[1].size : 1;
+  void *pTable;
+
+  pTable = scratchBuffer((pArray->dims[0].size + 1) * (sizeY + 1) * sizeof(epicsFloat64));
+  if (!pTable) return NULL;
+  switch(pArray->dataType) {
+  case NDInt8:
+    buildSummedAreaT<epicsInt8>(pArray, pTable);
+    break;
+  case NDUInt8:
+    buildSummedAreaT<epicsUInt8>(pArray, pTable);
+    break;
+  case NDInt16:
+    buildSummedAreaT<epicsInt16>(pArray, pTable);
+    break;
+  case NDUInt16:
+    buildSummedAreaT<epicsUInt16>(pArray, pTable);
+    break;
+  case NDInt32:
+    buildSummedAreaT<epicsInt32>(pArray, pTable);
+    break;
+  case NDUInt32:
+    buildSummedAreaT<epicsUInt32>(pArray, pTable);
+    break;
+  case NDFloat32:
+    buildSummedAreaT<epicsFloat32>(pArray, pTable);
+    break;
+  case NDFloat64:
+    buildSummedAreaT<epicsFloat64>(pArray, pTable);
+    break;
+  case NDFloat16:
+    buildSummedAreaT<NDFloat16_t>(pArray, pTable);
+    break;
+  default:
+    return NULL;
+  }
+  return pTable;
+}
+
 /**
  * Templated function to calculate statistics on different NDArray data types.
  * \param[in] NDArray The pointer to the NDArray object
@@ -43,8 +479,15 @@
 template <typename epicsType>
 asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
 {
+  /* The background is summed in the same type as the rows, so it is exact for integer types */
+  typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
   epicsType *pData = (epicsType *)pArray->pData;
-  double value = 0;
+  /* With the summed-area table the sums are read from the table, and only the minimum and maximum
+   * are computed from the ROI elements */
+  const sumType *pTable = (const sumType *)pROI->pSummedArea;
+  size_t tableWidth = pROI->arraySize[0] + 1;
+  size_t nMiddle;
+  sumType bgdSum = 0;
   double bgd = 0;
   size_t sizeX = pROI->size[0];
   size_t sizeY = pROI->size[1];
@@ -58,6 +501,10 @@ asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
   size_t bgdWidthY = MIN(pROI->bgdWidth, sizeY);
   bool initial = true;
   size_t yOffset = 0;
+  size_t nUsed = 0;
+  /* The rows of a sparse array are not read; its sums come from its events, as they would from the table,
+   * and all of its elements are used */
+  bool sparse = (pArray->sparse != 0);
 
   pROI->min = 0;
   pROI->max = 0;
@@ -65,52 +512,39 @@ asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
   pROI->mean = 0;
   pROI->net = 0;
 
+  if (pROI->pSpans) {
+    computeSpanStatistics<epicsType>(pArray, pROI);
+    return asynSuccess;
+  }
+
   if (pArray->ndims == 1) {
     nElements = sizeX;
-    for (x=offsetX; x<offsetX+sizeX; ++x) {
-      value = (double)pData[x];
-      if (initial) {
-        pROI->min = value;
-        pROI->max = value;
-        initial = false;
-      }  
-      if (value < pROI->min) pROI->min = value;
-      if (value > pROI->max) pROI->max = value;
-      pROI->total += value;
-    }
-    if (pROI->bgdWidth > 0) {
+    if ((sizeX > 0) && !sparse) nUsed = addROIRow(pArray, pData + offsetX, sizeX, pROI->sample[0], pROI, &initial);
+    if ((pROI->bgdWidth > 0) && !pTable && !sparse) {
       for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
         nBgd++;
-        bgd += (double)pData[x];
+        bgdSum += (sumType)pData[x];
       }
       for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
         nBgd++;
-        bgd += (double)pData[x];
+        bgdSum += (sumType)pData[x];
       }
     }    
   } else if (pArray->ndims == 2) {
     nElements = sizeX * sizeY;
-    for (y=offsetY; y<offsetY+sizeY; ++y) {
-      yOffset = y*pROI->arraySize[0];
-      for (x=offsetX; x<offsetX+sizeX; ++x) {
-        value = (double)pData[x+yOffset];
-        if (initial) {
-          pROI->min = value;
-          pROI->max = value;
-          initial = false;
-        } 
-        if (value < pROI->min) pROI->min = value;
-        if (value > pROI->max) pROI->max = value;
-        pROI->total += value;
+    if ((sizeX > 0) && !sparse) {
+      for (y=offsetY; y<offsetY+sizeY; y+=pROI->sample[1]) {
+        yOffset = y*pROI->arraySize[0];
+        nUsed += addROIRow(pArray, pData + offsetX + yOffset, sizeX, pROI->sample[0], pROI, &initial);
       }
     }
-    if (pROI->bgdWidth > 0) {
+    if ((pROI->bgdWidth > 0) && !pTable && !sparse) {
       // Compute total counts in the bgdWidthY rows at the top
       for (y=offsetY; y<offsetY+bgdWidthY; ++y) {
         yOffset = y*pROI->arraySize[0];
         for (x=offsetX; x<offsetX+sizeX; ++x) {
           nBgd++;
-          bgd += (double)pData[x+yOffset];
+          bgdSum += (sumType)pData[x+yOffset];
         }
       }
       // Compute total counts in the bgdWidthY rows at the bottom
@@ -118,7 +552,7 @@ asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
         yOffset = y*pROI->arraySize[0];
         for (x=offsetX; x<offsetX+sizeX; ++x) {
           nBgd++;
-          bgd += (double)pData[x+yOffset];
+          bgdSum += (sumType)pData[x+yOffset];
         }
       }
       // Compute total counts in the bgdWidthX columns left and right
@@ -126,15 +560,48 @@ asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
         yOffset = y*pROI->arraySize[0];
         for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
           nBgd++;
-          bgd += (double)pData[x+yOffset];
+          bgdSum += (sumType)pData[x+yOffset];
         }
         for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
           nBgd++;
-          bgd += (double)pData[x+yOffset];
+          bgdSum += (sumType)pData[x+yOffset];
         }
       }
     }
   }
+  if ((pTable || sparse) && (nElements > 0)) {
+    if (pArray->ndims == 1) {
+      sizeY = 1;
+      offsetY = 0;
+      bgdWidthY = 0;
+    }
+    if (sparse) {
+      pROI->total = (double)sparseRectSum<epicsType>(pArray, pROI->arraySize[0], offsetX, offsetY, sizeX, sizeY,
+                                                     pROI);
+    } else {
+      pROI->total = (double)rectSum(pTable, tableWidth, offsetX, offsetY, sizeX, sizeY);
+    }
+    nUsed = nElements;
+    if (pROI->bgdWidth > 0) {
+      if (pArray->ndims == 2) {
+        // The bgdWidthY rows at the top and bottom
+        bgdSum += areaSum<epicsType>(pArray, pTable, tableWidth, offsetX, offsetY, sizeX, bgdWidthY);
+        bgdSum += areaSum<epicsType>(pArray, pTable, tableWidth, offsetX, offsetY+sizeY-bgdWidthY, sizeX, bgdWidthY);
+        nBgd += 2 * sizeX * bgdWidthY;
+      }
+      // The bgdWidthX columns left and right of the rows in between, as in the loops above
+      nMiddle = (sizeY > 2*bgdWidthY) ? sizeY - 2*bgdWidthY : 0;
+      bgdSum += areaSum<epicsType>(pArray, pTable, tableWidth, offsetX, offsetY+bgdWidthY, bgdWidthX, nMiddle);
+      bgdSum += areaSum<epicsType>(pArray, pTable, tableWidth, offsetX+sizeX-bgdWidthX, offsetY+bgdWidthY,
+                                   bgdWidthX, nMiddle);
+      nBgd += 2 * bgdWidthX * nMiddle;
+    }
+  }
+  bgd = (double)bgdSum;
+  /* When sampling, the total of the elements used is scaled to an estimate for the whole ROI */
+  if ((nUsed > 0) && (nUsed < nElements)) {
+    pROI->total = pROI->total * nElements / nUsed;
+  }
 
   if (nBgd > 0) {
     bgd = bgd/nBgd * nElements;
@@ -185,6 +652,9 @@ asynStatus NDPluginROIStat::doComputeStatistics(NDArray *pArray, NDROI *pROI)
   case NDFloat64:
     status = doComputeStatisticsT<epicsFloat64>(pArray, pROI);
     break;
+  case NDFloat16:
+    status = doComputeStatisticsT<NDFloat16_t>(pArray, pROI);
+    break;
   default:
     return asynError;
     break;
@@ -193,6 +663,27 @@ asynStatus NDPluginROIStat::doComputeStatistics(NDArray *pArray, NDROI *pROI)
 }
 
 
+/* The argument of computeROITask() */
+typedef struct {
+  NDPluginROIStat *pPlugin;
+  NDArray *pArray;
+  NDROI *pROIs;
+  const std::pair<size_t, int> *pOrder;   /* The area and index of the ROIs, largest first */
+  asynStatus *pStatus;                    /* The status of each task */
+} roiTaskArgs_t;
+
+/**
+ * Computes the statistics of one ROI, for parallelForTasks().  Each task writes only its own NDROI.
+ * \param[in] pArg The roiTaskArgs_t
+ * \param[in] task The index of the ROI in the order of the tasks
+ */
+void NDPluginROIStat::computeROITask(void *pArg, int task)
+{
+  roiTaskArgs_t *pArgs = (roiTaskArgs_t *)pArg;
+
+  pArgs->pStatus[task] = pArgs->pPlugin->doComputeStatistics(pArgs->pArray, &pArgs->pROIs[pArgs->pOrder[task].second]);
+}
+
 /** 
  * Callback function that is called by the NDArray driver with new NDArray data.
  * Computes statistics on the ROIs if NDPluginROIStatUse is 1.
@@ -210,6 +701,13 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
   asynStatus status = asynSuccess;
   NDROI *pROI;
   int TSAcquiring;
+  int sampleFrames = 1;
+  size_t sampleX = 1, sampleY = 1;
+  int useSummedArea = 0;
+  const void *pSummedArea = NULL;
+  std::vector<std::pair<size_t, int> > order;
+  std::vector<asynStatus> taskStatus;
+  roiTaskArgs_t taskArgs;
   const char* functionName = "NDPluginROIStat::processCallbacks";
   NDROI_t *pROIs = new NDROI[maxROIs_];
   if(!pROIs) {cantProceed(functionName);}
@@ -217,6 +715,23 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
+  getIntegerParam(NDPluginROIStatSampleX,      &itemp); sampleX = MAX(itemp, 1);
+  getIntegerParam(NDPluginROIStatSampleY,      &itemp); sampleY = MAX(itemp, 1);
+  getIntegerParam(NDPluginROIStatSummedArea,   &useSummedArea);
+  getIntegerParam(NDPluginROIStatSampleFrames, &sampleFrames);
+  sampleFrames = MAX(sampleFrames, 1);
+  setIntegerParam(NDPluginROIStatSampled, (sampleX > 1) || (sampleY > 1) || (sampleFrames > 1));
+
+  /* When sampling frames the statistics are only computed for every sampleFrames'th array;
+   * the other arrays are passed on, and the results of the last computed array are kept */
+  if (sampleFrameCount_ >= sampleFrames) sampleFrameCount_ = 0;
+  if (sampleFrameCount_++ != 0) {
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    callParamCallbacks();
+    delete[] pROIs;
+    return;
+  }
+
   // This plugin only works with 1-D or 2-D arrays
   if ((pArray->ndims < 1) || (pArray->ndims > 2)) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -242,6 +757,10 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
     getIntegerParam(roi, NDPluginROIStatDim0Size,     &itemp); pROI->size[0] = itemp;
     getIntegerParam(roi, NDPluginROIStatDim1Size,     &itemp); pROI->size[1] = itemp;
     getIntegerParam(roi, NDPluginROIStatBgdWidth,     &itemp); pROI->bgdWidth = itemp;
+    pROI->sample[0] = sampleX;
+    pROI->sample[1] = sampleY;
+    pROI->pSummedArea = NULL;
+    pROI->pSpans = NULL;
     
     for (dim=0; dim<pArray->ndims; dim++) {
       pROI->offset[dim]  = MAX(pROI->offset[dim], 0);
@@ -264,23 +783,56 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
       setIntegerParam(roi, NDPluginROIStatDim1Min,  (int)pROI->offset[1]);
       setIntegerParam(roi, NDPluginROIStatDim1Size, (int)pROI->size[1]);
     }
+
+    /* The other shapes are compiled into spans when they change, and the arrays only scan the spans */
+    if ((pArray->ndims >= 1) && (pArray->ndims <= 2)) pROI->pSpans = getSpans(roi, pROI, pArray->ndims);
+    setIntegerParam(roi, NDPluginROIStatMaskElements, pROI->pSpans ? (int)pROI->pSpans->numElements :
+                    (int)(pROI->size[0] * ((pArray->ndims > 1) ? pROI->size[1] : 1)));
   }
         
   /* This function is called with the lock taken, and it must be set when we exit.
    * The following code can be exected without the mutex because we are not accessing elements of
    * pPvt that other threads can access. */
   this->unlock();
+
+  /* One summed-area table gives the sums of all the ROIs, so its cost does not grow with their number or area.
+   * The sums of a sparse array are read from its events instead. */
+  if (useSummedArea && !pArray->sparse && (pArray->ndims >= 1) && (pArray->ndims <= 2)) {
+    pSummedArea = buildSummedArea(pArray);
+    if (!pSummedArea) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s: error allocating summed-area table, summing the ROIs directly\n",
+        functionName);
+    }
+  }
     
+  /* The ROIs are independent, so they are computed in the IntraFrameThreads threads.
+   * The threads take the largest ROIs first, which balances the load. */
   for (int roi=0; roi<maxROIs_; ++roi) {
     pROI = &pROIs[roi];
     if (!pROI->use) {
       continue;
     }
-    status = doComputeStatistics(pArray, pROI);
+    pROI->pSummedArea = pSummedArea;
+    order.push_back(std::make_pair(pROI->pSpans ? pROI->pSpans->numElements :
+                                   pROI->size[0] * ((pArray->ndims > 1) ? pROI->size[1] : 1), roi));
+  }
+  std::sort(order.rbegin(), order.rend());
+  taskStatus.resize(order.size(), asynSuccess);
+  if (!order.empty()) {
+    taskArgs.pPlugin = this;
+    taskArgs.pArray = pArray;
+    taskArgs.pROIs = pROIs;
+    taskArgs.pOrder = &order[0];
+    taskArgs.pStatus = &taskStatus[0];
+    parallelForTasks(computeROITask, &taskArgs, (int)order.size());
+  }
+  for (size_t task=0; task<order.size(); ++task) {
+    status = taskStatus[task];
     if (status != asynSuccess) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-        "%s: doComputeStatistics failed. status=%d\n", 
-        functionName, status);
+        "%s: doComputeStatistics failed for ROI %d. status=%d\n", 
+        functionName, order[task].second, status);
     }
   }
 
@@ -294,6 +846,7 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
     if (!pROI->use) {
       continue;
     }
+    if (pROI->pSpans) releaseSpans(pROI->pSpans);
     if (TSAcquiring) {
       double *pData = timeSeries_ + (roi * MAX_TIME_SERIES_TYPES * numTSPoints_);
       pData[TSMinValue*numTSPoints_ + currentTSPoint_]  = pROI->min;
@@ -384,6 +937,14 @@ asynStatus NDPluginROIStat::writeInt32(asynUser *pasynUser, epicsInt32 value)
             doTimeSeriesCallbacks();
             break;
         }
+    } else if (function == NDPluginROIStatDim0Min) {
+      shapes_[roi].requestedOffset[0] = value;
+    } else if (function == NDPluginROIStatDim1Min) {
+      shapes_[roi].requestedOffset[1] = value;
+    } else if (function == NDPluginROIStatDim0Size) {
+      shapes_[roi].requestedSize[0] = value;
+    } else if (function == NDPluginROIStatDim1Size) {
+      shapes_[roi].requestedSize[1] = value;
     } else if (function < FIRST_NDPLUGIN_ROISTAT_PARAM) {
       stat = (NDPluginDriver::writeInt32(pasynUser, value) == asynSuccess) && stat;
     }
@@ -406,6 +967,35 @@ asynStatus NDPluginROIStat::writeInt32(asynUser *pasynUser, epicsInt32 value)
     return status;
 }
 
+/** Called when asyn clients call pasynInt8Array->write().
+  * The mask of an ROI is stored, and compiled into spans with the next array.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value The mask, row by row over the ROI rectangle.
+  * \param[in] nElements The number of elements of the mask.
+  * \return asynStatus
+  */
+asynStatus NDPluginROIStat::writeInt8Array(asynUser *pasynUser, epicsInt8 *value, size_t nElements)
+{
+    int function = pasynUser->reason;
+    int roi = 0;
+    asynStatus status = asynSuccess;
+    const char* functionName = "NDPluginROIStat::writeInt8Array";
+
+    status = getAddress(pasynUser, &roi);
+    if (status != asynSuccess) {
+      return status;
+    }
+    if (function != NDPluginROIStatMask) {
+      return NDPluginDriver::writeInt8Array(pasynUser, value, nElements);
+    }
+    shapes_[roi].mask.assign(value, value + nElements);
+    shapes_[roi].maskChanged = true;
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+      "%s: roi=%d, mask of %d elements\n",
+      functionName, roi, (int)nElements);
+    return status;
+}
+
 /**
  * Reset the data for an ROI.
  * \param[in] roi number
@@ -483,8 +1073,8 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
              NDArrayPort, NDArrayAddr, maxROIs, maxBuffers, maxMemory,
-             asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
-             asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
+             asynInt8ArrayMask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
+             asynInt8ArrayMask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
              ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads)
 {
 //  const char *functionName = "NDPluginROIStat::NDPluginROIStat";
@@ -532,6 +1122,22 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
   createParam(NDPluginROIStatTSNetString,        asynParamFloat64Array, &NDPluginROIStatTSNet);
   createParam(NDPluginROIStatTSTimestampString,  asynParamFloat64Array, &NDPluginROIStatTSTimestamp);
 
+  /* Sampling */
+  createParam(NDPluginROIStatSampleXString,           asynParamInt32, &NDPluginROIStatSampleX);
+  createParam(NDPluginROIStatSampleYString,           asynParamInt32, &NDPluginROIStatSampleY);
+  createParam(NDPluginROIStatSampleFramesString,      asynParamInt32, &NDPluginROIStatSampleFrames);
+  createParam(NDPluginROIStatSampledString,           asynParamInt32, &NDPluginROIStatSampled);
+  createParam(NDPluginROIStatSummedAreaString,        asynParamInt32, &NDPluginROIStatSummedArea);
+
+  /* Shapes */
+  createParam(NDPluginROIStatShapeString,             asynParamInt32,     &NDPluginROIStatShape);
+  createParam(NDPluginROIStatCenterXString,           asynParamFloat64,   &NDPluginROIStatCenterX);
+  createParam(NDPluginROIStatCenterYString,           asynParamFloat64,   &NDPluginROIStatCenterY);
+  createParam(NDPluginROIStatRadiusMinString,         asynParamFloat64,   &NDPluginROIStatRadiusMin);
+  createParam(NDPluginROIStatRadiusMaxString,         asynParamFloat64,   &NDPluginROIStatRadiusMax);
+  createParam(NDPluginROIStatMaskString,              asynParamInt8Array, &NDPluginROIStatMask);
+  createParam(NDPluginROIStatMaskElementsString,      asynParamInt32,     &NDPluginROIStatMaskElements);
+
   createParam(NDPluginROIStatLastString,              asynParamInt32, &NDPluginROIStatLast);
   
   //Note: params set to a default value here will overwrite a default database value
@@ -562,12 +1168,39 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
     setDoubleParam (roi , NDPluginROIStatMeanValue,         0.0);
     setDoubleParam (roi , NDPluginROIStatTotal,             0.0);
     setDoubleParam (roi , NDPluginROIStatNet,               0.0);
+
+    setIntegerParam(roi , NDPluginROIStatShape,             ROIShapeRectangle);
+    setDoubleParam (roi , NDPluginROIStatCenterX,           0.0);
+    setDoubleParam (roi , NDPluginROIStatCenterY,           0.0);
+    setDoubleParam (roi , NDPluginROIStatRadiusMin,         0.0);
+    setDoubleParam (roi , NDPluginROIStatRadiusMax,         0.0);
+    setIntegerParam(roi , NDPluginROIStatMaskElements,      0);
     callParamCallbacks(roi);
   }
 
+  shapes_.resize(maxROIs_);
+  for (int roi=0; roi<maxROIs_; ++roi) {
+    shapes_[roi].shape = ROIShapeRectangle;
+    shapes_[roi].maskChanged = false;
+    shapes_[roi].pSpans = NULL;
+    for (int dim=0; dim<2; ++dim) {
+      shapes_[roi].requestedOffset[dim] = 0;
+      shapes_[roi].requestedSize[dim] = 0;
+    }
+  }
+
   numTSPoints_ = DEFAULT_NUM_TSPOINTS;
   setIntegerParam(NDPluginROIStatTSNumPoints, numTSPoints_);
+  setIntegerParam(NDPluginROIStatSampleX, 1);
+  setIntegerParam(NDPluginROIStatSampleY, 1);
+  setIntegerParam(NDPluginROIStatSampleFrames, 1);
+  setIntegerParam(NDPluginROIStatSampled, 0);
+  setIntegerParam(NDPluginROIStatSummedArea, 0);
+  sampleFrameCount_ = 0;
   timeSeries_ = (double *)calloc(MAX_TIME_SERIES_TYPES*maxROIs_*numTSPoints_, sizeof(double));
+
+  /* The ROIs of sparse arrays are summed from their events */
+  supportsSparseArrays_ = true;
   
   /* Try to connect to the array port */
   connectToArrayPort();
@@ -5,6 +5,8 @@
 #ifndef NDPluginROIStat_H
 #define NDPluginROIStat_H
 
+#include <vector>
+
 #include <epicsTypes.h>
 
 #include "NDPluginDriver.h"
@@ -48,6 +50,24 @@
 #define NDPluginROIStatTSNetString              "ROISTAT_TS_NET"            /* (asynFloat64Array, r/o) Series of net */
 #define NDPluginROIStatTSTimestampString        "ROISTAT_TS_TIMESTAMP"      /* (asynFloat64Array, r/o) Series of timestamps */
 
+/* Sampling for preview statistics */
+#define NDPluginROIStatSampleXString            "ROISTAT_SAMPLE_X"          /* (asynInt32, r/w) Use every Nth element in X */
+#define NDPluginROIStatSampleYString            "ROISTAT_SAMPLE_Y"          /* (asynInt32, r/w) Use every Nth element in Y */
+#define NDPluginROIStatSampleFramesString       "ROISTAT_SAMPLE_FRAMES"     /* (asynInt32, r/w) Use every Nth array */
+#define NDPluginROIStatSampledString            "ROISTAT_SAMPLED"           /* (asynInt32, r/o) Results are approximate, from sampled data */
+
+/* Summed-area table for many ROIs */
+#define NDPluginROIStatSummedAreaString         "ROISTAT_SUMMED_AREA"       /* (asynInt32, r/w) Sum the ROIs with a summed-area table */
+
+/* ROIs of other shapes */
+#define NDPluginROIStatShapeString              "ROISTAT_SHAPE"             /* (asynInt32,     r/w) Rectangle, ellipse, annulus or mask */
+#define NDPluginROIStatCenterXString            "ROISTAT_CENTER_X"          /* (asynFloat64,   r/w) X center of the annulus */
+#define NDPluginROIStatCenterYString            "ROISTAT_CENTER_Y"          /* (asynFloat64,   r/w) Y center of the annulus */
+#define NDPluginROIStatRadiusMinString          "ROISTAT_RADIUS_MIN"        /* (asynFloat64,   r/w) Inner radius of the annulus */
+#define NDPluginROIStatRadiusMaxString          "ROISTAT_RADIUS_MAX"        /* (asynFloat64,   r/w) Outer radius of the annulus */
+#define NDPluginROIStatMaskString               "ROISTAT_MASK"              /* (asynInt8Array, w)   Mask of the ROI rectangle, non-zero inside */
+#define NDPluginROIStatMaskElementsString       "ROISTAT_MASK_ELEMENTS"     /* (asynInt32,     r/o) Number of elements in the ROI */
+
 typedef enum {
     TSMinValue,
     TSMaxValue,
@@ -58,6 +78,13 @@ typedef enum {
     MAX_TIME_SERIES_TYPES
 } NDPluginROIStatTSType;
 
+typedef enum {
+    ROIShapeRectangle,          /* The rectangle of Dim0Min, Dim0Size, Dim1Min and Dim1Size */
+    ROIShapeEllipse,            /* The ellipse inscribed in the rectangle */
+    ROIShapeAnnulus,            /* The elements from RadiusMin up to RadiusMax from the center */
+    ROIShapeMask                /* The non-zero elements of the mask of the rectangle */
+} NDPluginROIStatShape_t;
+
 typedef enum {
     TSEraseStart,
     TSStart,
@@ -65,6 +92,38 @@ typedef enum {
     TSRead
 } NDPluginROIStatsTSControl_t;
 
+/** A run of elements of one row of an ROI that is not a rectangle */
+typedef struct {
+    size_t x;                   /* The first column */
+    size_t y;                   /* The row */
+    size_t n;                   /* The number of elements */
+} NDROISpan_t;
+
+/** The spans of an ROI shape, compiled once and shared by the arrays that are processed with it.
+  * The reference count is protected by the plugin lock. */
+typedef struct {
+    std::vector<NDROISpan_t> spans;
+    size_t numElements;
+    int refCount;
+} NDROISpans_t;
+
+/** The shape of an ROI, and the spans compiled from it */
+typedef struct {
+    int shape;
+    size_t offset[2];
+    size_t size[2];
+    size_t arraySize[2];
+    double center[2];
+    double radius[2];
+    std::vector<epicsInt8> mask;
+    size_t maskOffset[2];       /* The rectangle the mask is over, as requested before it is clipped to the array */
+    size_t maskSize[2];
+    int requestedOffset[2];     /* The rectangle last written to Dim0Min, Dim1Min, Dim0Size and Dim1Size */
+    int requestedSize[2];
+    bool maskChanged;           /* A mask was written since the spans were compiled */
+    NDROISpans_t *pSpans;       /* NULL when the spans have not been compiled */
+} NDROIShape_t;
+
 /** Structure defining a Region-Of-Interest and Stats */
 typedef struct NDROI {
     int use;
@@ -77,6 +136,9 @@ typedef struct NDROI {
     double max;
     double net;
     size_t arraySize[2];
+    size_t sample[2];           /* Use every sample[0]'th element of every sample[1]'th row */
+    const void *pSummedArea;    /* Summed-area table of the array, or NULL to sum the elements */
+    NDROISpans_t *pSpans;       /* The spans of an ROI that is not a rectangle, or NULL */
 } NDROI_t;
 
 
@@ -91,6 +153,7 @@ public:
     //These methods override the virtual methods in the base class
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeInt8Array(asynUser *pasynUser, epicsInt8 *value, size_t nElements);
 
 protected:
 
@@ -132,6 +195,22 @@ protected:
     int NDPluginROIStatTSTotal;
     int NDPluginROIStatTSNet;
     int NDPluginROIStatTSTimestamp;
+
+    /* Sampling */
+    int NDPluginROIStatSampleX;
+    int NDPluginROIStatSampleY;
+    int NDPluginROIStatSampleFrames;
+    int NDPluginROIStatSampled;
+    int NDPluginROIStatSummedArea;
+
+    /* Shapes */
+    int NDPluginROIStatShape;
+    int NDPluginROIStatCenterX;
+    int NDPluginROIStatCenterY;
+    int NDPluginROIStatRadiusMin;
+    int NDPluginROIStatRadiusMax;
+    int NDPluginROIStatMask;
+    int NDPluginROIStatMaskElements;
     
     int NDPluginROIStatLast;
                                 
@@ -139,6 +218,10 @@ private:
 
     template <typename epicsType> asynStatus doComputeStatisticsT(NDArray *pArray, NDROI_t *pROI);
     asynStatus doComputeStatistics(NDArray *pArray, NDROI_t *pStats);
+    const void *buildSummedArea(NDArray *pArray);
+    NDROISpans_t *getSpans(int roi, NDROI_t *pROI, int ndims);
+    void releaseSpans(NDROISpans_t *pSpans);
+    static void computeROITask(void *pArg, int task);
     asynStatus clear(epicsUInt32 roi);
     void doTimeSeriesCallbacks();
 
@@ -146,6 +229,8 @@ private:
     int numTSPoints_;
     int currentTSPoint_;
     double  *timeSeries_;
+    int sampleFrameCount_;
+    std::vector<NDROIShape_t> shapes_;
 };
 
 #endif //NDPluginROIStat_H
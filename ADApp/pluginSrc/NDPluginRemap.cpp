@@ -0,0 +1,311 @@
+/*
+ * NDPluginRemap.cpp
+ *
+ * Geometric remap plugin: rotation by any angle, scaling, shifts and radial distortion correction
+ * with bilinear interpolation from a cached table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginRemap.h"
+
+static const char *driverName = "NDPluginRemap";
+
+/** A remap table, the geometry it was computed for, and the number of arrays using it */
+struct NDRemapCacheEntry {
+    NDRemapTable_t table;
+    NDRemapGeometry_t geometry;
+    int refs;   /**< Arrays that are being remapped with the table, plus 1 while it is the current table */
+};
+
+/* The arguments of remapStripe() */
+typedef struct {
+    const NDRemapTable_t *pTable;
+    NDDataType_t dataType;
+    const char *pIn;
+    char *pOut;
+    int numColors;              /* The number of planes, each remapped with the same table */
+    size_t colorStrideBytes;    /* The offset between the planes in bytes */
+    size_t xStride;
+    size_t yStride;
+    double fill;
+} remapArgs_t;
+
+/* Remaps the rows of one stripe in every plane; called by parallelForRows() */
+static void remapStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    remapArgs_t *pArgs = (remapArgs_t *)pArg;
+    int color;
+
+    for (color=0; color<pArgs->numColors; color++) {
+        NDRemapApply(pArgs->dataType, pArgs->pTable, pArgs->pIn + color*pArgs->colorStrideBytes,
+                     pArgs->pOut + color*pArgs->colorStrideBytes, pArgs->xStride, pArgs->yStride,
+                     firstRow, numRows, pArgs->fill);
+    }
+}
+
+static bool sameGeometry(const NDRemapGeometry_t &a, const NDRemapGeometry_t &b)
+{
+    return (a.angle == b.angle) && (a.scaleX == b.scaleX) && (a.scaleY == b.scaleY) &&
+           (a.shiftX == b.shiftX) && (a.shiftY == b.shiftY) &&
+           (a.centerX == b.centerX) && (a.centerY == b.centerY) && (a.distortion == b.distortion);
+}
+
+/** Returns the table for a geometry and array layout, computing it if the current table is for another one.
+  * The table stays valid until releaseTable(), even if another thread replaces the current table.
+  * \param[in] geometry The geometry.
+  * \param[in] arrayInfo The layout of the input array.
+  * \param[out] results The build count and time when a table is computed.
+  * \return The table, or NULL if it cannot be computed. */
+NDRemapCacheEntry* NDPluginRemap::acquireTable(const NDRemapGeometry_t &geometry, const NDArrayInfo_t &arrayInfo,
+                                               NDPluginParamSnapshot &results)
+{
+    NDRemapCacheEntry *pEntry, *pFree = NULL;
+    epicsTimeStamp start, end;
+    static const char *functionName = "acquireTable";
+
+    epicsMutexLock(tableLock_);
+    pEntry = pTable_;
+    if (!pEntry || !sameGeometry(pEntry->geometry, geometry) ||
+        (pEntry->table.inSizeX != arrayInfo.xSize) || (pEntry->table.inSizeY != arrayInfo.ySize) ||
+        (pEntry->table.inXStride != arrayInfo.xStride) || (pEntry->table.inYStride != arrayInfo.yStride)) {
+        epicsTimeGetCurrent(&start);
+        pEntry = new NDRemapCacheEntry;
+        pEntry->geometry = geometry;
+        pEntry->refs = 1;
+        if (NDRemapCreateTable(&geometry, arrayInfo.xSize, arrayInfo.ySize, arrayInfo.xStride, arrayInfo.yStride,
+                               arrayInfo.xSize, arrayInfo.ySize, &pEntry->table) != ND_SUCCESS) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s cannot compute the table for a %dx%d array\n",
+                driverName, functionName, (int)arrayInfo.xSize, (int)arrayInfo.ySize);
+            delete pEntry;
+            epicsMutexUnlock(tableLock_);
+            return NULL;
+        }
+        /* The old table is freed now if no array is using it, else by the last releaseTable() */
+        if (pTable_ && (--pTable_->refs == 0)) pFree = pTable_;
+        pTable_ = pEntry;
+        tableBuilds_++;
+        epicsTimeGetCurrent(&end);
+        results.setInteger(NDPluginRemapTableBuilds, tableBuilds_);
+        results.setDouble(NDPluginRemapBuildTime, epicsTimeDiffInSeconds(&end, &start) * 1000.);
+    }
+    pEntry->refs++;
+    epicsMutexUnlock(tableLock_);
+    if (pFree) {
+        NDRemapFreeTable(&pFree->table);
+        delete pFree;
+    }
+    return pEntry;
+}
+
+/** Releases a table from acquireTable(), and frees it if it is no longer the current table. */
+void NDPluginRemap::releaseTable(NDRemapCacheEntry *pEntry)
+{
+    int refs;
+
+    epicsMutexLock(tableLock_);
+    refs = --pEntry->refs;
+    epicsMutexUnlock(tableLock_);
+    if (refs == 0) {
+        NDRemapFreeTable(&pEntry->table);
+        delete pEntry;
+    }
+}
+
+/** Called by the default NDPluginDriver::processCallbacks() with the lock released.
+  * Remaps each color plane of the array with the table of the current geometry.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] params The parameter values when processing of this array began.
+  * \param[out] results The table build count and time when the table was computed for this array.
+  */
+NDArray* NDPluginRemap::processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                                 NDPluginParamSnapshot &results)
+{
+    NDArray *pOutput;
+    NDArrayInfo_t arrayInfo;
+    NDRemapGeometry_t geometry;
+    NDRemapCacheEntry *pEntry;
+    remapArgs_t args;
+    static const char *functionName = "processCallbacksUnlocked";
+
+    pArray->getInfo(&arrayInfo);
+    if ((pArray->ndims < 2) || (pArray->ndims > 3)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s arrays must have 2 or 3 dimensions, this one has %d\n",
+            driverName, functionName, pArray->ndims);
+        return NULL;
+    }
+
+    geometry.angle      = params.getDouble(NDPluginRemapAngle);
+    geometry.scaleX     = params.getDouble(NDPluginRemapScaleX);
+    geometry.scaleY     = params.getDouble(NDPluginRemapScaleY);
+    geometry.shiftX     = params.getDouble(NDPluginRemapShiftX);
+    geometry.shiftY     = params.getDouble(NDPluginRemapShiftY);
+    geometry.centerX    = params.getDouble(NDPluginRemapCenterX);
+    geometry.centerY    = params.getDouble(NDPluginRemapCenterY);
+    geometry.distortion = params.getDouble(NDPluginRemapDistortion);
+    pEntry = acquireTable(geometry, arrayInfo, results);
+    if (!pEntry) return NULL;
+
+    /* Every pixel of the output is written, so the data are not copied */
+    pOutput = this->pNDArrayPool->copy(pArray, NULL, 0);
+    if (!pOutput) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot allocate the output array\n",
+            driverName, functionName);
+        releaseTable(pEntry);
+        return NULL;
+    }
+
+    args.pTable = &pEntry->table;
+    args.dataType = pArray->dataType;
+    args.pIn = (const char *)pArray->pData;
+    args.pOut = (char *)pOutput->pData;
+    args.numColors = (pArray->ndims == 3) ? (int)arrayInfo.colorSize : 1;
+    args.colorStrideBytes = arrayInfo.colorStride * arrayInfo.bytesPerElement;
+    args.xStride = arrayInfo.xStride;
+    args.yStride = arrayInfo.yStride;
+    args.fill = params.getDouble(NDPluginRemapFill);
+    parallelForRows(remapStripe, &args, arrayInfo.ySize, numStripes(arrayInfo.ySize));
+    releaseTable(pEntry);
+
+    return pOutput;
+}
+
+
+/** Constructor for NDPluginRemap; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method sets reasonable default values for all of the
+  * parameters.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *      NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *      at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *      0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *      of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The maximum number of threads this driver is allowed to use. If 0 then 1 will be used.
+  */
+NDPluginRemap::NDPluginRemap(const char *portName, int queueSize, int blockingCallbacks,
+                             const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
+                             int priority, int stackSize, int maxThreads)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                     NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                     asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                     asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                     ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads),
+      pTable_(NULL), tableBuilds_(0)
+{
+    tableLock_ = epicsMutexMustCreate();
+
+    createParam(NDPluginRemapAngleString,       asynParamFloat64, &NDPluginRemapAngle);
+    createParam(NDPluginRemapScaleXString,      asynParamFloat64, &NDPluginRemapScaleX);
+    createParam(NDPluginRemapScaleYString,      asynParamFloat64, &NDPluginRemapScaleY);
+    createParam(NDPluginRemapShiftXString,      asynParamFloat64, &NDPluginRemapShiftX);
+    createParam(NDPluginRemapShiftYString,      asynParamFloat64, &NDPluginRemapShiftY);
+    createParam(NDPluginRemapCenterXString,     asynParamFloat64, &NDPluginRemapCenterX);
+    createParam(NDPluginRemapCenterYString,     asynParamFloat64, &NDPluginRemapCenterY);
+    createParam(NDPluginRemapDistortionString,  asynParamFloat64, &NDPluginRemapDistortion);
+    createParam(NDPluginRemapFillString,        asynParamFloat64, &NDPluginRemapFill);
+    createParam(NDPluginRemapTableBuildsString, asynParamInt32,   &NDPluginRemapTableBuilds);
+    createParam(NDPluginRemapBuildTimeString,   asynParamFloat64, &NDPluginRemapBuildTime);
+    addSnapshotParam(NDPluginRemapAngle);
+    addSnapshotParam(NDPluginRemapScaleX);
+    addSnapshotParam(NDPluginRemapScaleY);
+    addSnapshotParam(NDPluginRemapShiftX);
+    addSnapshotParam(NDPluginRemapShiftY);
+    addSnapshotParam(NDPluginRemapCenterX);
+    addSnapshotParam(NDPluginRemapCenterY);
+    addSnapshotParam(NDPluginRemapDistortion);
+    addSnapshotParam(NDPluginRemapFill);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginRemap");
+    setDoubleParam(NDPluginRemapAngle, 0.);
+    setDoubleParam(NDPluginRemapScaleX, 1.);
+    setDoubleParam(NDPluginRemapScaleY, 1.);
+    setDoubleParam(NDPluginRemapShiftX, 0.);
+    setDoubleParam(NDPluginRemapShiftY, 0.);
+    setDoubleParam(NDPluginRemapCenterX, 0.);
+    setDoubleParam(NDPluginRemapCenterY, 0.);
+    setDoubleParam(NDPluginRemapDistortion, 0.);
+    setDoubleParam(NDPluginRemapFill, 0.);
+    setIntegerParam(NDPluginRemapTableBuilds, 0);
+    setDoubleParam(NDPluginRemapBuildTime, 0.);
+
+    // Enable ArrayCallbacks.
+    // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
+    setIntegerParam(NDArrayCallbacks, 1);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/** Configuration command */
+extern "C" int NDRemapConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                const char *NDArrayPort, int NDArrayAddr,
+                                int maxBuffers, size_t maxMemory,
+                                int priority, int stackSize, int maxThreads)
+{
+    NDPluginRemap *pPlugin = new NDPluginRemap(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                               maxBuffers, maxMemory, priority, stackSize, maxThreads);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg initArg9 = { "# threads",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDRemapConfigure",10,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDRemapConfigure(args[0].sval, args[1].ival, args[2].ival,
+                     args[3].sval, args[4].ival, args[5].ival,
+                     args[6].ival, args[7].ival, args[8].ival,
+                     args[9].ival);
+}
+
+extern "C" void NDRemapRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDRemapRegister);
+}
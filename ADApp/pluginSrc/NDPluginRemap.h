@@ -0,0 +1,64 @@
+#ifndef NDPluginRemap_H
+#define NDPluginRemap_H
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+#include "NDPluginDriver.h"
+#include "NDRemapKernels.h"
+
+#define NDPluginRemapAngleString       "REMAP_ANGLE"        /* (asynFloat64, r/w) Rotation in degrees */
+#define NDPluginRemapScaleXString      "REMAP_SCALE_X"      /* (asynFloat64, r/w) Magnification in X */
+#define NDPluginRemapScaleYString      "REMAP_SCALE_Y"      /* (asynFloat64, r/w) Magnification in Y */
+#define NDPluginRemapShiftXString      "REMAP_SHIFT_X"      /* (asynFloat64, r/w) Shift of the output in X */
+#define NDPluginRemapShiftYString      "REMAP_SHIFT_Y"      /* (asynFloat64, r/w) Shift of the output in Y */
+#define NDPluginRemapCenterXString     "REMAP_CENTER_X"     /* (asynFloat64, r/w) Center offset from the image
+                                                             *  center in X */
+#define NDPluginRemapCenterYString     "REMAP_CENTER_Y"     /* (asynFloat64, r/w) Center offset from the image
+                                                             *  center in Y */
+#define NDPluginRemapDistortionString  "REMAP_DISTORTION"   /* (asynFloat64, r/w) Radial distortion coefficient */
+#define NDPluginRemapFillString        "REMAP_FILL"         /* (asynFloat64, r/w) Value of the pixels outside the input */
+#define NDPluginRemapTableBuildsString "REMAP_TABLE_BUILDS" /* (asynInt32, r/o) Number of times the table was computed */
+#define NDPluginRemapBuildTimeString   "REMAP_BUILD_TIME"   /* (asynFloat64, r/o) Time to compute the table in ms */
+
+/** A remap table and the arrays that are using it */
+struct NDRemapCacheEntry;
+
+/** Rotates NDArrays by any angle, scales and shifts them and corrects radial distortion, with bilinear
+  * interpolation.  The geometry is computed once into a table of input offsets and weights, which is kept
+  * until the geometry or the size or layout of the arrays change, so each array only needs the interpolation. */
+class epicsShareClass NDPluginRemap : public NDPluginDriver {
+public:
+    NDPluginRemap(const char *portName, int queueSize, int blockingCallbacks,
+                  const char *NDArrayPort, int NDArrayAddr,
+                  int maxBuffers, size_t maxMemory,
+                  int priority, int stackSize, int maxThreads=1);
+    /* These methods override the virtual methods in the base class */
+    NDArray* processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                      NDPluginParamSnapshot &results);
+
+protected:
+    int NDPluginRemapAngle;
+    #define FIRST_NDPLUGIN_REMAP_PARAM NDPluginRemapAngle
+    int NDPluginRemapScaleX;
+    int NDPluginRemapScaleY;
+    int NDPluginRemapShiftX;
+    int NDPluginRemapShiftY;
+    int NDPluginRemapCenterX;
+    int NDPluginRemapCenterY;
+    int NDPluginRemapDistortion;
+    int NDPluginRemapFill;
+    int NDPluginRemapTableBuilds;
+    int NDPluginRemapBuildTime;
+
+private:
+    NDRemapCacheEntry* acquireTable(const NDRemapGeometry_t &geometry, const NDArrayInfo_t &arrayInfo,
+                                    NDPluginParamSnapshot &results);
+    void releaseTable(NDRemapCacheEntry *pEntry);
+
+    epicsMutexId tableLock_;        /**< Protects pTable_ and the reference counts of the entries */
+    NDRemapCacheEntry *pTable_;     /**< The table of the current geometry, NULL before the first array */
+    int tableBuilds_;               /**< The number of tables computed */
+};
+
+#endif
@@ -32,7 +32,7 @@ void NDPluginScatter::processCallbacks(NDArray *pArray)
      * This function is called with the mutex already locked.  It unlocks it during long calculations when private
      * structures don't need to be protected.
      */
-    int arrayCallbacks;
+    int arrayCallbacks, method;
 
     static const char *functionName = "NDPluginScatter::processCallbacks";
 
@@ -40,12 +40,17 @@ void NDPluginScatter::processCallbacks(NDArray *pArray)
     NDPluginDriver::beginProcessCallbacks(pArray);
 
     getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    getIntegerParam(NDPluginScatterMethod, &method);
     if (arrayCallbacks == 1) {
-        NDArray *pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
+        /* The array is passed on unmodified, so the client gets a reference to it rather than a copy */
+        NDArray *pArrayOut = referenceArray(pArray, true);
         if (NULL != pArrayOut) {
-            this->getAttributes(pArrayOut->pAttributeList);
             this->unlock();
-            doNDArrayCallbacks(pArrayOut, NDArrayData, 0);
+            if (method == NDScatterRoundRobin) {
+                doNDArrayCallbacks(pArrayOut, NDArrayData, 0);
+            } else {
+                doLoadCallbacks(pArrayOut, NDArrayData, 0, method);
+            }
             this->lock();
             if (this->pArrays[0]) this->pArrays[0]->release();
             this->pArrays[0] = pArrayOut;
@@ -95,6 +100,61 @@ asynStatus NDPluginScatter::doNDArrayCallbacks(NDArray *pArray, int reason, int
     return asynSuccess;
 }
 
+/** Called by driver to do the callbacks to the least loaded registered client on the asynGenericPointer interface.
+  * The clients are tried in the order of their load, clients with the same load in round-robin order.  As in
+  * doNDArrayCallbacks() a client whose queue is full is skipped, unless it is the last one.
+  * Clients that are not plugins are taken to have no load.
+  * \param[in] pArray Pointer to the NDArray 
+  * \param[in] reason A client will be called if reason matches pasynUser->reason registered for that client.
+  * \param[in] address A client will be called if address matches the address registered for that client.
+  * \param[in] method NDScatterLeastQueued for the load to be the arrays in the queue of the client,
+  *            NDScatterLeastBusy for it to be the time the client would take to process them. */
+asynStatus NDPluginScatter::doLoadCallbacks(NDArray *pArray, int reason, int address, int method)
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    NDPluginDriver *pClient;
+    double load;
+    int addr;
+    int numNodes, numCandidates;
+    int i, j;
+    //static const char *functionName = "doLoadCallbacks";
+
+    pasynManager->interruptStart(this->asynStdInterfaces.genericPointerInterruptPvt, &pclientList);
+    numNodes = ellCount(pclientList);
+    candidates_.clear();
+    loads_.clear();
+    if (nextClient_ > numNodes) nextClient_ = 1;
+    for (i=0; i<numNodes; i++) {
+        pnode = (interruptNode *)ellNth(pclientList, (nextClient_ - 1 + i) % numNodes + 1);
+        asynGenericPointerInterrupt *pInterrupt = (asynGenericPointerInterrupt *)pnode->drvPvt;
+        pasynManager->getAddr(pInterrupt->pasynUser, &addr);
+        /* If this is not a multi-device then address is -1, change to 0 */
+        if (addr == -1) addr = 0;
+        if ((pInterrupt->pasynUser->reason != reason) || (address != addr)) continue;
+        load = 0.;
+        pClient = NDPluginDriver::fromArrayInterrupt(pInterrupt);
+        if (pClient) load = (method == NDScatterLeastBusy) ? pClient->expectedWait() : pClient->queuePending();
+        /* Insert the client after the clients with the same or a lower load */
+        for (j=(int)loads_.size(); (j > 0) && (loads_[j-1] > load); j--) {}
+        candidates_.insert(candidates_.begin() + j, pnode);
+        loads_.insert(loads_.begin() + j, load);
+    }
+    /* The clients with the same load start one further on for the next array */
+    nextClient_++;
+    numCandidates = (int)candidates_.size();
+    for (i=0; i<numCandidates; i++) {
+        asynGenericPointerInterrupt *pInterrupt = (asynGenericPointerInterrupt *)candidates_[i]->drvPvt;
+        /* As in doNDArrayCallbacks(), asynOverflow lets a client with a full queue return without dropping the array */
+        pInterrupt->pasynUser->auxStatus = asynOverflow;
+        if (i == numCandidates-1) pInterrupt->pasynUser->auxStatus = asynSuccess;
+        pInterrupt->callback(pInterrupt->userPvt, pInterrupt->pasynUser, pArray);
+        if (pInterrupt->pasynUser->auxStatus == asynSuccess) break;
+    }
+    pasynManager->interruptEnd(this->asynStdInterfaces.genericPointerInterruptPvt);
+    return asynSuccess;
+}
+
 /** Constructor for NDPluginScatter; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   *
   * \param[in] portName The name of the asyn port driver to be created.
@@ -128,6 +188,12 @@ NDPluginScatter::NDPluginScatter(const char *portName, int queueSize, int blocki
     //static const char *functionName = "NDPluginScatter::NDPluginScatter";
 
     createParam(NDPluginScatterMethodString,         asynParamInt32,        &NDPluginScatterMethod);
+    setIntegerParam(NDPluginScatterMethod, NDScatterRoundRobin);
+
+    /* The arrays are passed on unmodified, so packed, sparse and device arrays stay packed, sparse and on the device */
+    supportsPackedArrays_ = true;
+    supportsSparseArrays_ = true;
+    supportsDeviceArrays_ = true;
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginScatter");
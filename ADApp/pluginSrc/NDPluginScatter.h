@@ -1,11 +1,20 @@
 #ifndef NDPluginScatter_H
 #define NDPluginScatter_H
 
+#include <vector>
+
 #include "NDPluginDriver.h"
 
 /* General parameters */
 #define NDPluginScatterMethodString          "SCATTER_METHOD"            /* (asynInt32,        r/w) Algorithm for scatter */
 
+/** How NDPluginScatter chooses the client for each array */
+typedef enum {
+    NDScatterRoundRobin,        /**< The clients in turn */
+    NDScatterLeastQueued,       /**< The client with the fewest arrays in its input queue */
+    NDScatterLeastBusy          /**< The client with the shortest queue, weighted by its recent processing time */
+} NDScatterMethod_t;
+
 /** A plugin that does callbacks in round-robin fashion rather than passing every NDArray to every callback client  */
 class epicsShareClass NDPluginScatter : public NDPluginDriver {
 public:
@@ -19,10 +28,14 @@ public:
 protected:
     int NDPluginScatterMethod;
     #define FIRST_NDPLUGIN_SCATTER_PARAM NDPluginScatterMethod
+
+    asynStatus doNDArrayCallbacks(NDArray *pArray, int reason, int addr);
+    asynStatus doLoadCallbacks(NDArray *pArray, int reason, int addr, int method);
                                 
 private:
     int nextClient_;
-    asynStatus doNDArrayCallbacks(NDArray *pArray, int reason, int addr);
+    std::vector<interruptNode *> candidates_;  /**< The clients in the order doLoadCallbacks() tries them; the plugin has 1 thread */
+    std::vector<double> loads_;                /**< The load of each client of candidates_ */
 };
     
 #endif
@@ -0,0 +1,251 @@
+/*
+ * NDPluginShm.cpp
+ *
+ * Plugin that publishes NDArrays to other processes through POSIX shared memory.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginShm.h"
+
+static const char *driverName="NDPluginShm";
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * It publishes the array in the shared memory segment, copying it there first if its data is not already in it.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginShm::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  It unlocks it while it copies the array. */
+    NDArray *pShmArray, *pOldArray;
+    int count;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    if (pSegment_) {
+        if (pSegment_->contains(pArray->pData) && pArray->isContiguous()) {
+            /* The driver allocated the array in the segment, so it is published as it is */
+            pArray->reserve();
+            pShmArray = pArray;
+            getIntegerParam(NDPluginShmNumZeroCopy, &count);
+            setIntegerParam(NDPluginShmNumZeroCopy, count+1);
+        } else {
+            /* The pool of this plugin allocates from the segment */
+            this->unlock();
+            pShmArray = this->pNDArrayPool->copy(pArray, NULL, 1);
+            this->lock();
+        }
+        if (!pShmArray) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s cannot allocate array uniqueId=%d in the shared memory segment\n",
+                driverName, functionName, pArray->uniqueId);
+            getIntegerParam(NDPluginShmNumNoMemory, &count);
+            setIntegerParam(NDPluginShmNumNoMemory, count+1);
+        } else if (pSegment_->publish(pShmArray, &pOldArray) != ND_SUCCESS) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s descriptor in use by a reader, dropped array uniqueId=%d\n",
+                driverName, functionName, pArray->uniqueId);
+            pShmArray->release();
+            getIntegerParam(NDPluginShmNumBusy, &count);
+            setIntegerParam(NDPluginShmNumBusy, count+1);
+        } else {
+            if (pOldArray) pOldArray->release();
+            getIntegerParam(NDPluginShmNumPublished, &count);
+            setIntegerParam(NDPluginShmNumPublished, count+1);
+        }
+        setDoubleParam(NDPluginShmDataFree, pSegment_->dataFree()/1e6);
+    }
+
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    callStatusCallbacks();
+}
+
+/** Returns the shared memory segment of the plugin, or NULL if it could not be created */
+NDShmSegment* NDPluginShm::segment()
+{
+    return pSegment_;
+}
+
+/** Report status of the plugin.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then driver details are printed.
+  */
+void NDPluginShm::report(FILE *fp, int details)
+{
+    if (pSegment_) pSegment_->report(fp, details);
+    NDPluginDriver::report(fp, details);
+}
+
+/** Constructor for NDPluginShm; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method creates the shared memory segment and sets
+  * it as the memory provider of the NDArrayPool of this plugin.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] shmName The name of the shared memory segment, e.g. "/13SIM1".
+  * \param[in] numSlots The number of arrays that are published at once.  The plugin keeps a reference to each
+  *            published array, so the driver needs this many more buffers for zero-copy publishing.
+  * \param[in] dataSize The size of the data area of the segment in bytes.
+  * \param[in] maxAttributeBytes The space for the attributes of each array in bytes.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginShm::NDPluginShm(const char *portName, int queueSize, int blockingCallbacks,
+                         const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                         int numSlots, size_t dataSize, int maxAttributeBytes,
+                         int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, 1),
+      pSegment_(NULL)
+{
+    static const char *functionName = "NDPluginShm";
+
+    createParam(NDPluginShmNameString,         asynParamOctet,   &NDPluginShmName);
+    createParam(NDPluginShmNumPublishedString, asynParamInt32,   &NDPluginShmNumPublished);
+    createParam(NDPluginShmNumZeroCopyString,  asynParamInt32,   &NDPluginShmNumZeroCopy);
+    createParam(NDPluginShmNumBusyString,      asynParamInt32,   &NDPluginShmNumBusy);
+    createParam(NDPluginShmNumNoMemoryString,  asynParamInt32,   &NDPluginShmNumNoMemory);
+    createParam(NDPluginShmDataFreeString,     asynParamFloat64, &NDPluginShmDataFree);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginShm");
+    setStringParam(NDPluginShmName, shmName);
+    setIntegerParam(NDPluginShmNumPublished, 0);
+    setIntegerParam(NDPluginShmNumZeroCopy, 0);
+    setIntegerParam(NDPluginShmNumBusy, 0);
+    setIntegerParam(NDPluginShmNumNoMemory, 0);
+
+    pSegment_ = new NDShmSegment;
+    if (pSegment_->create(shmName, numSlots, dataSize, maxAttributeBytes) != ND_SUCCESS) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot create shared memory segment %s, arrays will not be published\n",
+            driverName, functionName, shmName);
+        delete pSegment_;
+        pSegment_ = NULL;
+    } else {
+        this->pNDArrayPool->setMemoryProvider(pSegment_);
+        setDoubleParam(NDPluginShmDataFree, pSegment_->dataFree()/1e6);
+    }
+
+    // This plugin publishes arrays through shared memory, not with callbacks, so disable ArrayCallbacks by default
+    setIntegerParam(NDArrayCallbacks, 0);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/** Configuration command */
+extern "C" int NDShmConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                              const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                              int numSlots, int dataSize, int maxAttributeBytes,
+                              int maxBuffers, size_t maxMemory, int priority, int stackSize)
+{
+    NDPluginShm *pPlugin = new NDPluginShm(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                           shmName, numSlots, dataSize, maxAttributeBytes,
+                                           maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/** Makes the NDArrayPool of a driver or plugin allocate its buffers in the shared memory segment of an NDPluginShm
+  * plugin, so that the plugin publishes its arrays without copying them.
+  * This must be called before the driver allocates any arrays, and the data area of the segment must be large
+  * enough for all of the buffers of the driver.
+  * \param[in] shmPortName The name of the NDPluginShm port.
+  * \param[in] portName The name of the asynNDArrayDriver port whose pool allocates from the segment.
+  */
+extern "C" int NDShmUseForPool(const char *shmPortName, const char *portName)
+{
+    NDPluginShm *pPlugin = (NDPluginShm *)findAsynPortDriver(shmPortName);
+    asynNDArrayDriver *pDriver = (asynNDArrayDriver *)findAsynPortDriver(portName);
+
+    if (!pPlugin || !pDriver) {
+        printf("NDShmUseForPool: cannot find port %s\n", pPlugin ? portName : shmPortName);
+        return ND_ERROR;
+    }
+    if (!pPlugin->segment()) {
+        printf("NDShmUseForPool: port %s has no shared memory segment\n", shmPortName);
+        return ND_ERROR;
+    }
+    return pDriver->getNDArrayPool()->setMemoryProvider(pPlugin->segment());
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "shmName",iocshArgString};
+static const iocshArg initArg6 = { "numSlots",iocshArgInt};
+static const iocshArg initArg7 = { "dataSize",iocshArgInt};
+static const iocshArg initArg8 = { "maxAttributeBytes",iocshArgInt};
+static const iocshArg initArg9 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg10 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg11 = { "priority",iocshArgInt};
+static const iocshArg initArg12 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9,
+                                            &initArg10,
+                                            &initArg11,
+                                            &initArg12};
+static const iocshFuncDef initFuncDef = {"NDShmConfigure",13,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDShmConfigure(args[0].sval, args[1].ival, args[2].ival,
+                   args[3].sval, args[4].ival, args[5].sval,
+                   args[6].ival, args[7].ival, args[8].ival,
+                   args[9].ival, args[10].ival, args[11].ival,
+                   args[12].ival);
+}
+
+static const iocshArg useForPoolArg0 = { "shmPortName",iocshArgString};
+static const iocshArg useForPoolArg1 = { "portName",iocshArgString};
+static const iocshArg * const useForPoolArgs[] = {&useForPoolArg0,
+                                                  &useForPoolArg1};
+static const iocshFuncDef useForPoolFuncDef = {"NDShmUseForPool",2,useForPoolArgs};
+static void useForPoolCallFunc(const iocshArgBuf *args)
+{
+    NDShmUseForPool(args[0].sval, args[1].sval);
+}
+
+extern "C" void NDShmRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+    iocshRegister(&useForPoolFuncDef,useForPoolCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDShmRegister);
+}
@@ -0,0 +1,49 @@
+#ifndef NDPluginShm_H
+#define NDPluginShm_H
+
+#include <epicsTypes.h>
+
+#include "NDPluginDriver.h"
+#include "NDShmSegment.h"
+
+#define NDPluginShmNameString          "SHM_NAME"           /* (asynOctet, r/o) Name of the shared memory segment */
+#define NDPluginShmNumPublishedString  "SHM_NUM_PUBLISHED"  /* (asynInt32, r/w) Number of arrays published */
+#define NDPluginShmNumZeroCopyString   "SHM_NUM_ZERO_COPY"  /* (asynInt32, r/w) Number of arrays published without copying */
+#define NDPluginShmNumBusyString       "SHM_NUM_BUSY"       /* (asynInt32, r/w) Number of arrays dropped because a reader
+                                                             *  held the descriptor */
+#define NDPluginShmNumNoMemoryString   "SHM_NUM_NO_MEMORY"  /* (asynInt32, r/w) Number of arrays dropped because the
+                                                             *  data area was full */
+#define NDPluginShmDataFreeString      "SHM_DATA_FREE"      /* (asynFloat64, r/o) Free memory in the data area in MB */
+
+/** Publishes NDArrays to other processes on the same host through a POSIX shared memory segment.
+  * Arrays whose data is already in the segment, because the driver's NDArrayPool allocates from it
+  * (see NDShmUseForPool), are published without copying; other arrays are copied into the segment once.
+  * Readers attach to the segment with NDShmSegment::open() and read the descriptors and data in place. */
+class epicsShareClass NDPluginShm : public NDPluginDriver {
+public:
+    NDPluginShm(const char *portName, int queueSize, int blockingCallbacks,
+                const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                int numSlots, size_t dataSize, int maxAttributeBytes,
+                int maxBuffers, size_t maxMemory, int priority, int stackSize);
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    void report(FILE *fp, int details);
+
+    NDShmSegment* segment();
+
+protected:
+    int NDPluginShmName;
+    #define FIRST_NDPLUGIN_SHM_PARAM NDPluginShmName
+    int NDPluginShmNumPublished;
+    int NDPluginShmNumZeroCopy;
+    int NDPluginShmNumBusy;
+    int NDPluginShmNumNoMemory;
+    int NDPluginShmDataFree;
+
+private:
+    NDShmSegment *pSegment_;  /**< The segment; NULL if it could not be created.  It is never deleted, because it
+                               *  provides the memory of NDArrayPools that may outlive the plugin */
+};
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * NDPluginStack.cpp
+ *
+ * Stack consecutive arrays into frame stacks, so that the plugins after this one are called once for N frames
+ *
+ * The frame stacks are described in NDArray::stackFrames.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTypes.h>
+#include <epicsMessageQueue.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginStack.h"
+
+static const char *driverName="NDPluginStack";
+
+/** Copies the array into the stack being filled, and outputs the stack once it holds StackSize frames.
+  * A new stack is started with the first frame, and whenever a frame does not fit the stack being filled,
+  * which is then output with the frames it holds.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginStack::processCallbacks(NDArray *pArray)
+{
+    /*
+     * This function is called with the mutex already locked.  The frames are copied with the mutex held, as
+     * the plugin has 1 thread, and writeInt32() can output the stack.
+     */
+    NDArrayInfo_t arrayInfo;
+    NDStackFrame_t stackFrame;
+    int stackSize;
+    size_t frame;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getIntegerParam(NDPluginStackSize, &stackSize);
+    if ((stackSize <= 1) || !pArray->stackFrames.empty() || (pArray->ndims >= ND_ARRAY_MAX_DIMS)) {
+        outputStack();
+        setArrayDimensions(pArray);
+        NDPluginDriver::endProcessCallbacks(pArray, true, true);
+        callParamCallbacks();
+        return;
+    }
+
+    if (!fitsStack(pArray)) {
+        outputStack();
+        pStack_ = allocStack(pArray, stackSize);
+        if (!pStack_) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s: Couldn't allocate stack of %d frames for uniqueId=%d\n",
+                driverName, functionName, stackSize, pArray->uniqueId);
+            callParamCallbacks();
+            return;
+        }
+    }
+    pArray->getInfo(&arrayInfo);
+    frame = pStack_->stackFrames.size();
+    memcpy((char *)pStack_->pData + frame * arrayInfo.totalBytes, pArray->pData, arrayInfo.totalBytes);
+    stackFrame.uniqueId = pArray->uniqueId;
+    stackFrame.timeStamp = pArray->timeStamp;
+    stackFrame.epicsTS = pArray->epicsTS;
+    pStack_->stackFrames.push_back(stackFrame);
+    setIntegerParam(NDPluginStackFrames, (int)pStack_->stackFrames.size());
+    if (pStack_->stackFrames.size() >= pStack_->dims[pStack_->ndims-1].size) outputStack();
+    callParamCallbacks();
+}
+
+/** Allocates a stack for the frames that are like a frame.
+  * It has the dimensions and the data type of the frame and a slowest dimension of numFrames, and the uniqueId,
+  * time stamps and attributes of the frame.
+  * \param[in] pFrame The first frame of the stack.
+  * \param[in] numFrames The number of frames the stack holds. */
+NDArray* NDPluginStack::allocStack(NDArray *pFrame, int numFrames)
+{
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pStack;
+    int i;
+
+    for (i=0; i<pFrame->ndims; i++) dims[i] = pFrame->dims[i].size;
+    dims[pFrame->ndims] = numFrames;
+    pStack = this->pNDArrayPool->alloc(pFrame->ndims+1, dims, pFrame->dataType, 0, NULL);
+    if (!pStack) return NULL;
+    for (i=0; i<pFrame->ndims; i++) pStack->dims[i] = pFrame->dims[i];
+    pStack->uniqueId = pFrame->uniqueId;
+    pStack->timeStamp = pFrame->timeStamp;
+    pStack->epicsTS = pFrame->epicsTS;
+    pStack->pAttributeList->clear();
+    pFrame->pAttributeList->copy(pStack->pAttributeList);
+    pStack->stackFrames.reserve(numFrames);
+    return pStack;
+}
+
+/** Returns true if there is a stack being filled with frames of the data type and dimensions of a frame.
+  * \param[in] pFrame The frame. */
+bool NDPluginStack::fitsStack(NDArray *pFrame)
+{
+    int i;
+
+    if (!pStack_ || (pStack_->ndims != pFrame->ndims+1) || (pStack_->dataType != pFrame->dataType)) return false;
+    for (i=0; i<pFrame->ndims; i++) {
+        if (pStack_->dims[i].size != pFrame->dims[i].size) return false;
+    }
+    return true;
+}
+
+/** Outputs the stack being filled, whose slowest dimension is reduced to the frames it holds, if there is one. */
+void NDPluginStack::outputStack()
+{
+    NDArray *pStack = pStack_;
+
+    if (!pStack) return;
+    pStack_ = NULL;
+    pStack->dims[pStack->ndims-1].size = pStack->stackFrames.size();
+    setArrayDimensions(pStack);
+    setIntegerParam(NDPluginStackFrames, 0);
+    NDPluginDriver::endProcessCallbacks(pStack, false, true);
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Flush outputs the stack being filled, as does changing StackSize.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginStack::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_STACK_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    if (function == NDPluginStackFlush) {
+        outputStack();
+    } else if (function == NDPluginStackSize) {
+        status = (asynStatus) setIntegerParam(function, value);
+        outputStack();
+    } else {
+        status = (asynStatus) setIntegerParam(function, value);
+    }
+    callParamCallbacks();
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDPluginStack; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method sets reasonable default values for all of the
+  * parameters.  The plugin has 1 thread, which fills one stack at a time.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginStack::NDPluginStack(const char *portName, int queueSize, int blockingCallbacks,
+                             const char *NDArrayPort, int NDArrayAddr,
+                             int maxBuffers, size_t maxMemory,
+                             int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, 1),
+      pStack_(NULL)
+{
+    //static const char *functionName = "NDPluginStack::NDPluginStack";
+
+    createParam(NDPluginStackSizeString,             asynParamInt32,        &NDPluginStackSize);
+    createParam(NDPluginStackFramesString,           asynParamInt32,        &NDPluginStackFrames);
+    createParam(NDPluginStackFlushString,            asynParamInt32,        &NDPluginStackFlush);
+    setIntegerParam(NDPluginStackSize, 10);
+    setIntegerParam(NDPluginStackFrames, 0);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginStack");
+
+    /* The arrays that are not stacked are passed on unchanged, and the stacks have their own dimensions */
+    passArraysByReference_ = true;
+    reportsOwnDimensions_ = true;
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+NDPluginStack::~NDPluginStack()
+{
+    if (pStack_) pStack_->release();
+}
+
+/** Configuration command */
+extern "C" int NDStackConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                const char *NDArrayPort, int NDArrayAddr,
+                                int maxBuffers, size_t maxMemory,
+                                int priority, int stackSize)
+{
+    NDPluginStack *pPlugin = new NDPluginStack(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                               maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8};
+static const iocshFuncDef initFuncDef = {"NDStackConfigure",9,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDStackConfigure(args[0].sval, args[1].ival, args[2].ival,
+                   args[3].sval, args[4].ival, args[5].ival,
+                   args[6].ival, args[7].ival, args[8].ival);
+}
+
+extern "C" void NDStackRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDStackRegister);
+}
@@ -0,0 +1,41 @@
+#ifndef NDPluginStack_H
+#define NDPluginStack_H
+
+#include "NDPluginDriver.h"
+
+/* Param definitions */
+#define NDPluginStackSizeString              "STACK_SIZE"                /* (asynInt32,        r/w) Frames in each stack */
+#define NDPluginStackFramesString            "STACK_FRAMES"              /* (asynInt32,        r/o) Frames in the stack being filled */
+#define NDPluginStackFlushString             "STACK_FLUSH"               /* (asynInt32,        r/w) Output the stack being filled */
+
+/** A plugin that stacks StackSize consecutive arrays into one frame stack, see NDArray::stackFrames, so that the
+  * plugins after it are called once for every StackSize frames rather than for every frame.  A stack has the
+  * dimensions of its frames and a slowest dimension of StackSize, and the uniqueId, time stamps and attributes
+  * of its first frame; NDArray::stackFrames holds the uniqueId and time stamps of each frame.  A stack is output
+  * early when a frame of another data type or size arrives, or on Flush.  Arrays are passed on unchanged if
+  * StackSize is 1 or less, and if they already are stacks. */
+class epicsShareClass NDPluginStack : public NDPluginDriver {
+public:
+    NDPluginStack(const char *portName, int queueSize, int blockingCallbacks,
+                  const char *NDArrayPort, int NDArrayAddr,
+                  int maxBuffers, size_t maxMemory,
+                  int priority, int stackSize);
+    ~NDPluginStack();
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDPluginStackSize;
+    #define FIRST_NDPLUGIN_STACK_PARAM NDPluginStackSize
+    int NDPluginStackFrames;
+    int NDPluginStackFlush;
+
+private:
+    NDArray *allocStack(NDArray *pFrame, int numFrames);
+    bool fitsStack(NDArray *pFrame);
+    void outputStack();
+    NDArray *pStack_;                          /**< The stack being filled; the plugin has 1 thread */
+};
+
+#endif
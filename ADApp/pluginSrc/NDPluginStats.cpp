@@ -24,6 +24,10 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "NDPluginStats.h"
+#include "NDStatsKernels.h"
+#ifdef ND_WITH_CUDA
+#include "NDCudaKernels.h"
+#endif
 
 #define MAX(A,B) (A)>(B)?(A):(B)
 #define MIN(A,B) (A)<(B)?(A):(B)
@@ -40,10 +44,11 @@ asynStatus NDPluginStats::doComputeHistogramT(NDArray *pArray, NDStats_t *pStats
 {
     epicsType *pData = (epicsType *)pArray->pData;
     size_t i;
-    double scale, entropy;
+    double scale;
     int bin;
-    size_t nElements;
-    double value, counts;
+    size_t nElements, tableSize;
+    double value;
+    epicsUInt32 *pCounts;
     NDArrayInfo arrayInfo;
 
     pArray->getInfo(&arrayInfo);
@@ -52,29 +57,223 @@ asynStatus NDPluginStats::doComputeHistogramT(NDArray *pArray, NDStats_t *pStats
 
     pStats->histBelow = 0;
     pStats->histAbove = 0;
-    for (i=0; i<nElements; i++) {
-        value = (double)pData[i];
-        bin = (int)(((value - pStats->histMin) * scale) + 0.5);
-        if ((bin < 0) || (value < pStats->histMin))
-            pStats->histBelow++;
-        else if ((bin > (int)pStats->histSize-1) || (value > pStats->histMax))
-            pStats->histAbove++;
-        else 
-            pStats->histogram[bin]++;
+    if (pArray->sparse) {
+        /* The elements that are not events are binned together as the value 0 */
+        pData = (epicsType *)pArray->eventValues();
+        for (i=0; i<=pArray->numEvents; i++) {
+            double counts = (i < pArray->numEvents) ? 1. : (double)(nElements - pArray->numEvents);
+            value = (i < pArray->numEvents) ? (double)pData[i] : 0.;
+            if (counts == 0.) continue;
+            bin = (int)(((value - pStats->histMin) * scale) + 0.5);
+            if ((bin < 0) || (value < pStats->histMin))
+                pStats->histBelow += (epicsInt32)counts;
+            else if ((bin > (int)pStats->histSize-1) || (value > pStats->histMax))
+                pStats->histAbove += (epicsInt32)counts;
+            else
+                pStats->histogram[bin] += counts;
+        }
+        finishHistogram(pStats, nElements);
+        return(asynSuccess);
+    }
+    tableSize = countTableSize(pArray->dataType, nElements);
+    if (tableSize > 0) {
+        /* Count each value, then bin the values rather than the elements */
+        pCounts = (epicsUInt32 *)calloc(tableSize, sizeof(epicsUInt32));
+        NDStatsCountValues(pArray->dataType, pData, nElements, pCounts);
+        foldHistogram(pStats, pArray->dataType, pCounts);
+        free(pCounts);
+    } else {
+        for (i=0; i<nElements; i++) {
+            value = (double)pData[i];
+            bin = (int)(((value - pStats->histMin) * scale) + 0.5);
+            if ((bin < 0) || (value < pStats->histMin))
+                pStats->histBelow++;
+            else if ((bin > (int)pStats->histSize-1) || (value > pStats->histMax))
+                pStats->histAbove++;
+            else 
+                pStats->histogram[bin]++;
+        }
     }
 
-    entropy = 0;
-    for (i=0; (int)i<pStats->histSize; i++) {
+    finishHistogram(pStats, nElements);
+    return(asynSuccess);
+}
+
+/** Computes the entropy of the histogram in pStats. */
+void NDPluginStats::finishHistogram(NDStats_t *pStats, size_t nElements)
+{
+    int i;
+    double counts, entropy = 0;
+
+    for (i=0; i<pStats->histSize; i++) {
         counts = pStats->histogram[i];
         if (counts <= 0) counts = 1;
         entropy += counts * log(counts);
     }
     entropy = -entropy / nElements;
     pStats->histEntropy = entropy;
-    
+}
+
+/** The number of bins of the histogram that the quantiles of 32-bit and floating point types are found in */
+#define QUANTILE_BINS 65536
+
+/** Computes the median and the low and high quantiles.
+  * 8-bit and 16-bit types are counted in a table of all their values, so the quantiles are exact.
+  * Other types are binned into QUANTILE_BINS bins between the minimum and maximum, so the quantiles are
+  * within (max-min)/QUANTILE_BINS of the exact values.  Neither needs the array to be sorted. */
+template <typename epicsType>
+asynStatus NDPluginStats::doComputeQuantilesT(NDArray *pArray, NDStats_t *pStats)
+{
+    epicsType *pData = (epicsType *)pArray->pData;
+    NDArrayInfo arrayInfo;
+    NDStatsSums_t sums;
+    epicsUInt32 *pCounts;
+    double fractions[3], values[3];
+    double firstValue, binWidth, scale, value;
+    size_t i, nValues, nElements, nData, nZeros;
+    int interpolate, status;
+
+    pArray->getInfo(&arrayInfo);
+    nElements = arrayInfo.nElements;
+    if ((nElements == 0) || (nElements > 0xFFFFFFFFu)) return(asynError);
+    fractions[0] = 0.5;
+    fractions[1] = pStats->quantileLowPercent / 100.;
+    fractions[2] = pStats->quantileHighPercent / 100.;
+
+    /* Of a sparse array only the events are read, and the other elements are counted as the value 0 */
+    nData = nElements;
+    nZeros = 0;
+    if (pArray->sparse) {
+        pData = (epicsType *)pArray->eventValues();
+        nData = pArray->numEvents;
+        nZeros = nElements - nData;
+    }
+
+    nValues = NDStatsValueRange(pArray->dataType, &firstValue);
+    if (nValues > 0) {
+        pCounts = (epicsUInt32 *)calloc(ND_STATS_SUB_HISTOGRAMS * nValues, sizeof(epicsUInt32));
+        if (!pCounts) return(asynError);
+        if (nData > 0) NDStatsCountValues(pArray->dataType, pData, nData, pCounts);
+        NDStatsMergeCounts(pArray->dataType, pCounts);
+        pCounts[(size_t)(0. - firstValue)] += (epicsUInt32)nZeros;
+        binWidth = 1.;
+        interpolate = 0;
+    } else {
+        if (nData == 0) {
+            sums.min = 0.;
+            sums.max = 0.;
+        } else if (NDStatsContiguous(pArray->dataType, pData, nData, &sums) != ND_SUCCESS) {
+            NDStatsRow(pData, nData, 0., &sums);
+        }
+        if (nZeros > 0) {
+            sums.min = MIN(sums.min, 0.);
+            sums.max = MAX(sums.max, 0.);
+        }
+        nValues = QUANTILE_BINS;
+        pCounts = (epicsUInt32 *)calloc(nValues, sizeof(epicsUInt32));
+        if (!pCounts) return(asynError);
+        firstValue = sums.min;
+        binWidth = (sums.max - sums.min) / nValues;
+        scale = (binWidth > 0.) ? 1. / binWidth : 0.;
+        for (i=0; i<nData; i++) {
+            value = (double)pData[i];
+            /* This also skips NaN */
+            if (!((value >= sums.min) && (value <= sums.max))) continue;
+            size_t bin = (size_t)((value - sums.min) * scale);
+            if (bin > nValues-1) bin = nValues-1;
+            pCounts[bin]++;
+        }
+        if (nZeros > 0) {
+            size_t bin = (size_t)((0. - sums.min) * scale);
+            if (bin > nValues-1) bin = nValues-1;
+            pCounts[bin] += (epicsUInt32)nZeros;
+        }
+        interpolate = (binWidth > 0.);
+    }
+    status = NDStatsQuantiles(pCounts, nValues, firstValue, binWidth, interpolate, fractions, 3, values);
+    free(pCounts);
+    if (status != ND_SUCCESS) return(asynError);
+    pStats->median       = values[0];
+    pStats->quantileLow  = values[1];
+    pStats->quantileHigh = values[2];
     return(asynSuccess);
 }
 
+asynStatus NDPluginStats::doComputeQuantiles(NDArray *pArray, NDStats_t *pStats)
+{
+    asynStatus status;
+    
+    switch(pArray->dataType) {
+        case NDInt8:
+            status = doComputeQuantilesT<epicsInt8>(pArray, pStats);
+            break;
+        case NDUInt8:
+            status = doComputeQuantilesT<epicsUInt8>(pArray, pStats);
+            break;
+        case NDInt16:
+            status = doComputeQuantilesT<epicsInt16>(pArray, pStats);
+            break;
+        case NDUInt16:
+            status = doComputeQuantilesT<epicsUInt16>(pArray, pStats);
+            break;
+        case NDInt32:
+            status = doComputeQuantilesT<epicsInt32>(pArray, pStats);
+            break;
+        case NDUInt32:
+            status = doComputeQuantilesT<epicsUInt32>(pArray, pStats);
+            break;
+        case NDFloat32:
+            status = doComputeQuantilesT<epicsFloat32>(pArray, pStats);
+            break;
+        case NDFloat64:
+            status = doComputeQuantilesT<epicsFloat64>(pArray, pStats);
+            break;
+        case NDFloat16:
+            status = doComputeQuantilesT<NDFloat16_t>(pArray, pStats);
+            break;
+        default:
+            status = asynError;
+        break;
+    }
+    return(status);
+}
+
+/** Returns the number of entries of the count table for the histogram of nElements elements of an array,
+  * or 0 if the elements should be binned directly.  The table is only used for 8-bit and 16-bit types, and
+  * only when there are more elements than entries to clear and fold. */
+size_t NDPluginStats::countTableSize(NDDataType_t dataType, size_t nElements)
+{
+    double firstValue;
+    size_t tableSize = ND_STATS_SUB_HISTOGRAMS * NDStatsValueRange(dataType, &firstValue);
+
+    /* The counts are 32-bit */
+    if (nElements > 0xFFFFFFFFu) return 0;
+    return (nElements >= tableSize) ? tableSize : 0;
+}
+
+/** Merges a count table filled by NDStatsCountValues() and adds it to the histogram in pStats.
+  * Each value is binned as the elements are in doComputeHistogramT(), so the histogram is the same. */
+void NDPluginStats::foldHistogram(NDStats_t *pStats, NDDataType_t dataType, epicsUInt32 *pCounts)
+{
+    double firstValue, value;
+    double scale = pStats->histSize / (pStats->histMax - pStats->histMin);
+    size_t i, nValues = NDStatsValueRange(dataType, &firstValue);
+    int bin;
+
+    NDStatsMergeCounts(dataType, pCounts);
+    for (i=0; i<nValues; i++) {
+        if (pCounts[i] == 0) continue;
+        value = firstValue + i;
+        bin = (int)(((value - pStats->histMin) * scale) + 0.5);
+        if ((bin < 0) || (value < pStats->histMin))
+            pStats->histBelow += pCounts[i];
+        else if ((bin > (int)pStats->histSize-1) || (value > pStats->histMax))
+            pStats->histAbove += pCounts[i];
+        else 
+            pStats->histogram[bin] += pCounts[i];
+    }
+}
+
 asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray, NDStats_t *pStats)
 {
     asynStatus status;
@@ -104,6 +303,9 @@ asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray, NDStats_t *pStats)
         case NDFloat64:
             status = doComputeHistogramT<epicsFloat64>(pArray, pStats);
             break;
+        case NDFloat16:
+            status = doComputeHistogramT<NDFloat16_t>(pArray, pStats);
+            break;
         default:
             status = asynError;
         break;
@@ -111,42 +313,77 @@ asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray, NDStats_t *pStats)
     return(status);
 }
 
+/* Computes the sums of a sparse array for doComputeStatisticsT().  The sums are about 0, so the elements that
+ * are not events add nothing to them; they are zeros, which are the minimum or maximum if no event is below or
+ * above 0.  The first of them is the first index that is not an event. */
+template <typename epicsType>
+static void sparseStatistics(NDArray *pArray, size_t nElements, NDStatsSums_t *pSums)
+{
+    const epicsUInt32 *pIndices = pArray->eventIndices();
+    const epicsType *pValues = (const epicsType *)pArray->eventValues();
+    size_t numEvents = pArray->numEvents;
+    size_t firstZero = 0;
+
+    if (numEvents == 0) {
+        memset(pSums, 0, sizeof(*pSums));
+        return;
+    }
+    if (NDStatsContiguous(pArray->dataType, pValues, numEvents, pSums) != ND_SUCCESS) {
+        NDStatsRow(pValues, numEvents, 0., pSums);
+    }
+    pSums->minIndex = pIndices[pSums->minIndex];
+    pSums->maxIndex = pIndices[pSums->maxIndex];
+    if (numEvents == nElements) return;
+    while ((firstZero < numEvents) && (pIndices[firstZero] == firstZero)) firstZero++;
+    if ((pSums->min > 0.) || ((pSums->min == 0.) && (firstZero < pSums->minIndex))) {
+        pSums->min = 0.;
+        pSums->minIndex = firstZero;
+    }
+    if ((pSums->max < 0.) || ((pSums->max == 0.) && (firstZero < pSums->maxIndex))) {
+        pSums->max = 0.;
+        pSums->maxIndex = firstZero;
+    }
+}
+
 template <typename epicsType>
 void NDPluginStats::doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats)
 {
-    size_t i, imin, imax;
     epicsType *pData = (epicsType *)pArray->pData;
     NDArrayInfo arrayInfo;
-    double value;
+    NDStatsSums_t sums;
 
     pArray->getInfo(&arrayInfo);
     pStats->nElements = arrayInfo.nElements;
-    pStats->min = (double) pData[0];
-    imin = 0;
-    pStats->max = (double) pData[0];
-    imax = 0;
-    pStats->total = 0.;
-    pStats->sigma = 0.;
-    for (i=0; i<pStats->nElements; i++) {
-        value = (double)pData[i];
-        if (value < pStats->min) {
-            pStats->min = value;
-            imin = i;
-        }
-        if (value > pStats->max) {
-            pStats->max = value;
-            imax = i; 
-        }
-        pStats->total += value;
-        pStats->sigma += value * value;
-    }
-    pStats->minX = imin % arrayInfo.xSize;
-    pStats->minY = imin / arrayInfo.xSize;
-    pStats->maxX = imax % arrayInfo.xSize;
-    pStats->maxY = imax / arrayInfo.xSize;
+    if (pArray->sparse) {
+        sparseStatistics<epicsType>(pArray, pStats->nElements, &sums);
+    } else if (NDStatsContiguous(pArray->dataType, pData, pStats->nElements, &sums) != ND_SUCCESS) {
+        /* There is no vectorized kernel for this data type */
+        NDStatsRow(pData, pStats->nElements, NDStatsShift(pData), &sums);
+    }
+    pStats->min = sums.min;
+    pStats->max = sums.max;
+    pStats->total = sums.total;
+    pStats->sigma = sums.sumSquares;
+    finishStatistics(pStats, sums.minIndex, sums.maxIndex, arrayInfo.xSize, sums.shift);
+}
+
+/** Computes the positions of the minimum and maximum, the total, mean and sigma from the sums in pStats.
+  * pStats->total and pStats->sigma hold the sum and the sum of squares of the values minus shift;
+  * the variance is computed from these, so it is not lost to cancellation when the mean is large. */
+void NDPluginStats::finishStatistics(NDStats_t *pStats, size_t imin, size_t imax, size_t xSize, double shift)
+{
+    double mean = pStats->total / pStats->nElements;
+    double variance = (pStats->sigma / pStats->nElements) - (mean * mean);
+
+    pStats->minX = imin % xSize;
+    pStats->minY = imin / xSize;
+    pStats->maxX = imax % xSize;
+    pStats->maxY = imax / xSize;
+    pStats->total += shift * pStats->nElements;
     pStats->net = pStats->total;
-    pStats->mean = pStats->total / pStats->nElements;
-    pStats->sigma = sqrt((pStats->sigma / pStats->nElements) - (pStats->mean * pStats->mean));
+    pStats->mean = shift + mean;
+    /* Rounding can make the variance of a constant array slightly negative */
+    pStats->sigma = (variance > 0.) ? sqrt(variance) : 0.;
 }
 
 int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
@@ -177,6 +414,9 @@ int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
         case NDFloat64:
             doComputeStatisticsT<epicsFloat64>(pArray, pStats);
             break;
+        case NDFloat16:
+            doComputeStatisticsT<NDFloat16_t>(pArray, pStats);
+            break;
         default:
             return(ND_ERROR);
         break;
@@ -188,19 +428,33 @@ template <typename epicsType>
 asynStatus NDPluginStats::doComputeCentroidT(NDArray *pArray, NDStats_t *pStats)
 {
     epicsType *pData = (epicsType *)pArray->pData;
-    double value, *pValue, *pThresh, varX, varY, varXY;
+    double value;
     size_t ix, iy;
-    /*Raw moments */
-    double M00 = 0.0;
-    double M10 = 0.0, M01 = 0.0;
-    double M20 = 0.0, M02 = 0.0, M11 = 0.0;
-    double M30 = 0.0, M03 = 0.0;
-    double M40 = 0.0, M04 = 0.0;
-    /*Central moments */
-    double mu20, mu02, mu11, mu30, mu03, mu40, mu04;
+    double M11 = 0.0;
 
     if (pArray->ndims > 2) return(asynError);
-    
+
+    if (pArray->sparse) {
+        /* Only the events add to the profiles and moments, since the other elements are zeros */
+        const epicsUInt32 *pIndices = pArray->eventIndices();
+        size_t n;
+        pData = (epicsType *)pArray->eventValues();
+        for (n=0; n<pArray->numEvents; n++) {
+            value = (double)pData[n];
+            ix = pIndices[n] % pStats->profileSizeX;
+            iy = pIndices[n] / pStats->profileSizeX;
+            pStats->profileX[profAverage][ix] += value;
+            pStats->profileY[profAverage][iy] += value;
+            if (value >= pStats->centroidThreshold) {
+                pStats->profileX[profThreshold][ix] += value;
+                pStats->profileY[profThreshold][iy] += value;
+                M11 += value * ix * iy;
+            }
+        }
+        finishCentroid(pStats, M11);
+        return(asynSuccess);
+    }
+
     for (iy=0; iy<pStats->profileSizeY; iy++) {
         for (ix=0; ix<pStats->profileSizeX; ix++) {
             value = (double)*pData++;
@@ -213,6 +467,26 @@ asynStatus NDPluginStats::doComputeCentroidT(NDArray *pArray, NDStats_t *pStats)
             }
         }
     }
+    finishCentroid(pStats, M11);
+    return(asynSuccess);
+}
+
+/** Computes the centroid and the moments from the average and threshold profiles in pStats,
+  * and normalizes the profiles.
+  * \param[in] pStats The statistics, with the sums of each row and column in the profiles.
+  * \param[in] M11 The sum of value * x * y of the elements above the threshold, which the profiles do not give. */
+void NDPluginStats::finishCentroid(NDStats_t *pStats, double M11)
+{
+    double *pValue, *pThresh, varX, varY, varXY;
+    size_t ix, iy;
+    /*Raw moments */
+    double M00 = 0.0;
+    double M10 = 0.0, M01 = 0.0;
+    double M20 = 0.0, M02 = 0.0;
+    double M30 = 0.0, M03 = 0.0;
+    double M40 = 0.0, M04 = 0.0;
+    /*Central moments */
+    double mu20, mu02, mu11, mu30, mu03, mu40, mu04;
 
     /* Normalize the average profiles and compute the centroid from them */
     pValue  = pStats->profileX[profAverage];
@@ -280,7 +554,6 @@ asynStatus NDPluginStats::doComputeCentroidT(NDArray *pArray, NDStats_t *pStats)
                                  ((mu20 + mu02) * (mu20 + mu02));
         }
     }
-    return(asynSuccess);
 }
 
 asynStatus NDPluginStats::doComputeCentroid(NDArray *pArray, NDStats_t *pStats)
@@ -312,6 +585,9 @@ asynStatus NDPluginStats::doComputeCentroid(NDArray *pArray, NDStats_t *pStats)
         case NDFloat64:
             status = doComputeCentroidT<epicsFloat64>(pArray, pStats);
             break;
+        case NDFloat16:
+            status = doComputeCentroidT<NDFloat16_t>(pArray, pStats);
+            break;
         default:
             status = asynError;
         break;
@@ -319,74 +595,389 @@ asynStatus NDPluginStats::doComputeCentroid(NDArray *pArray, NDStats_t *pStats)
     return(status);
 }
 
+/* Copies every step'th element of a row into a profile */
+template <typename epicsType>
+static void copyRowProfile(const epicsType *pRow, size_t nElements, size_t step, double *pProfile)
+{
+    size_t i;
+
+    if (step == 1) {
+        for (i=0; i<nElements; i++) pProfile[i] = pRow[i];
+    } else {
+        for (i=0; i<nElements; i++) pProfile[i] = pRow[i*step];
+    }
+}
+
+/* Copies two columns into profiles in one pass down the rows, so that each row is visited once */
+template <typename epicsType>
+static void copyColumnProfiles(const epicsType *pColumn1, const epicsType *pColumn2, size_t nElements,
+                               size_t stride, double *pProfile1, double *pProfile2)
+{
+    size_t i;
+
+    for (i=0; i<nElements; i++) {
+        pProfile1[i] = *pColumn1;
+        pProfile2[i] = *pColumn2;
+        pColumn1 += stride;
+        pColumn2 += stride;
+    }
+}
+
+/* Positions of the profiles of doComputeProfilesT() */
+static void profilePositions(NDStats_t *pStats, size_t *pixCentroid, size_t *piyCentroid,
+                             size_t *pixCursor, size_t *piyCursor)
+{
+    *piyCentroid = (size_t) (pStats->centroidY + 0.5);
+    *piyCentroid = MIN(*piyCentroid, pStats->profileSizeY-1);
+    *piyCursor = MIN(pStats->cursorY, pStats->profileSizeY-1);
+    *pixCentroid = (size_t) (pStats->centroidX + 0.5);
+    *pixCentroid = MIN(*pixCentroid, pStats->profileSizeX-1);
+    *pixCursor = MIN(pStats->cursorX, pStats->profileSizeX-1);
+}
+
+/* Fills the profiles of doComputeProfilesT() from the events of a sparse array, in one pass over the events;
+ * the profiles are already zero, which the other elements are */
+template <typename epicsType>
+static void sparseProfiles(NDArray *pArray, NDStats_t *pStats, size_t stepX, size_t stepY)
+{
+    const epicsUInt32 *pIndices = pArray->eventIndices();
+    const epicsType *pValues = (const epicsType *)pArray->eventValues();
+    size_t sizeX = pArray->dims[0].size;
+    size_t ixCentroid, iyCentroid, ixCursor, iyCursor;
+    size_t n, x, y;
+
+    profilePositions(pStats, &ixCentroid, &iyCentroid, &ixCursor, &iyCursor);
+    for (n=0; n<pArray->numEvents; n++) {
+        x = pIndices[n] % sizeX;
+        y = pIndices[n] / sizeX;
+        if ((x % stepX) || (y % stepY)) continue;
+        x /= stepX;
+        y /= stepY;
+        if (x >= pStats->profileSizeX || y >= pStats->profileSizeY) continue;
+        if (y == iyCentroid) pStats->profileX[profCentroid][x] = pValues[n];
+        if (y == iyCursor)   pStats->profileX[profCursor][x]   = pValues[n];
+        if (x == ixCentroid) pStats->profileY[profCentroid][y] = pValues[n];
+        if (x == ixCursor)   pStats->profileY[profCursor][y]   = pValues[n];
+    }
+}
+
+/** Computes the X and Y profiles at the centroid and cursor positions.
+  * Only the two rows and two columns are read, so the cost is proportional to the width plus the height
+  * of the array, not to the number of elements.  The profiles are those of every stepX'th element of
+  * every stepY'th row, which lets the profiles of a sampled array be read without a sampled copy;
+  * the positions and the profile sizes are those of the sampled array. */
 template <typename epicsType>
-asynStatus NDPluginStats::doComputeProfilesT(NDArray *pArray, NDStats_t *pStats)
+asynStatus NDPluginStats::doComputeProfilesT(NDArray *pArray, NDStats_t *pStats, size_t stepX, size_t stepY)
 {
     epicsType *pData = (epicsType *)pArray->pData;
-    epicsType *pCentroid, *pCursor;
-    size_t ix, iy;
+    size_t rowStride, ixCentroid, iyCentroid, ixCursor, iyCursor;
 
     if (pArray->ndims > 2) return(asynError);
+    rowStride = pArray->dims[0].size * stepY;
 
-    /* Compute the X and Y profiles at the centroid and cursor positions */
-    iy = (size_t) (pStats->centroidY + 0.5);
-    iy = MAX(iy, 0);
-    iy = MIN(iy, pStats->profileSizeY-1);
-    pCentroid = pData + iy*pStats->profileSizeX;
-    iy = pStats->cursorY;
-    iy = MAX(iy, 0);
-    iy = MIN(iy, pStats->profileSizeY-1);
-    pCursor = pData + iy*pStats->profileSizeX;
-    for (ix=0; ix<pStats->profileSizeX; ix++) {
-        pStats->profileX[profCentroid][ix] = *pCentroid++;
-        pStats->profileX[profCursor][ix]   = *pCursor++;
-    }
-    ix = (size_t) (pStats->centroidX + 0.5);
-    ix = MAX(ix, 0);
-    ix = MIN(ix, pStats->profileSizeX-1);
-    pCentroid = pData + ix;
-    ix = pStats->cursorX;
-    ix = MAX(ix, 0);
-    ix = MIN(ix, pStats->profileSizeX-1);
-    pCursor = pData + ix;
-    for (iy=0; iy<pStats->profileSizeY; iy++) {
-        pStats->profileY[profCentroid][iy] = *pCentroid;
-        pStats->profileY[profCursor][iy]   = *pCursor;
-        pCentroid += pStats->profileSizeX;
-        pCursor   += pStats->profileSizeX;
+    if (pArray->sparse) {
+        sparseProfiles<epicsType>(pArray, pStats, stepX, stepY);
+        return(asynSuccess);
     }
+
+    profilePositions(pStats, &ixCentroid, &iyCentroid, &ixCursor, &iyCursor);
+
+    copyRowProfile(pData + iyCentroid*rowStride, pStats->profileSizeX, stepX, pStats->profileX[profCentroid]);
+    copyRowProfile(pData + iyCursor*rowStride,   pStats->profileSizeX, stepX, pStats->profileX[profCursor]);
+    copyColumnProfiles(pData + ixCentroid*stepX, pData + ixCursor*stepX, pStats->profileSizeY, rowStride,
+                       pStats->profileY[profCentroid], pStats->profileY[profCursor]);
     
     return(asynSuccess);
 }
 
-asynStatus NDPluginStats::doComputeProfiles(NDArray *pArray, NDStats_t *pStats)
+asynStatus NDPluginStats::doComputeProfiles(NDArray *pArray, NDStats_t *pStats, size_t stepX, size_t stepY)
+{
+    asynStatus status;
+
+    switch(pArray->dataType) {
+        case NDInt8:
+            status = doComputeProfilesT<epicsInt8>(pArray, pStats, stepX, stepY);
+            break;
+        case NDUInt8:
+            status = doComputeProfilesT<epicsUInt8>(pArray, pStats, stepX, stepY);
+            break;
+        case NDInt16:
+            status = doComputeProfilesT<epicsInt16>(pArray, pStats, stepX, stepY);
+            break;
+        case NDUInt16:
+            status = doComputeProfilesT<epicsUInt16>(pArray, pStats, stepX, stepY);
+            break;
+        case NDInt32:
+            status = doComputeProfilesT<epicsInt32>(pArray, pStats, stepX, stepY);
+            break;
+        case NDUInt32:
+            status = doComputeProfilesT<epicsUInt32>(pArray, pStats, stepX, stepY);
+            break;
+        case NDFloat32:
+            status = doComputeProfilesT<epicsFloat32>(pArray, pStats, stepX, stepY);
+            break;
+        case NDFloat64:
+            status = doComputeProfilesT<epicsFloat64>(pArray, pStats, stepX, stepY);
+            break;
+        case NDFloat16:
+            status = doComputeProfilesT<NDFloat16_t>(pArray, pStats, stepX, stepY);
+            break;
+        default:
+            status = asynError;
+        break;
+    }
+    return(status);
+}
+
+/* The results of one stripe of rows in doComputeFusedT() */
+typedef struct {
+    double min;
+    size_t minIndex;
+    double max;
+    size_t maxIndex;
+    double total;
+    double sumSquares;
+    double M11;
+    double *profileX;       /* Column sums; stripe 0 uses the profiles in NDStats_t */
+    double *threshX;        /* Column sums above the centroid threshold */
+    double *histogram;      /* Bin counts; stripe 0 uses the histogram in NDStats_t */
+    epicsUInt32 *pCounts;   /* Count table, when the histogram uses one */
+    epicsInt32 histBelow;
+    epicsInt32 histAbove;
+} statsStripe_t;
+
+/* The argument of the stripe tasks of doComputeFusedT() */
+typedef struct {
+    NDArray *pArray;
+    NDStats_t *pStats;
+    int computeStatistics;
+    int computeCentroid;
+    int computeHistogram;
+    size_t sizeX;
+    double scale;
+    double shift;           /* The shift of the sums of all the rows, from NDStatsShift() */
+    size_t tableSize;       /* The size of the count tables, or 0 to bin the elements directly */
+    statsStripe_t *pStripes;
+} statsFusedArgs_t;
+
+/* Computes the enabled quantities for one stripe of rows.  Each row is read once: the statistics kernel runs
+ * on the row, then the centroid and histogram loops run on it while it is still in the cache. */
+template <typename epicsType>
+static void computeStatsStripeT(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+    statsFusedArgs_t *pArgs = (statsFusedArgs_t *)pArg;
+    statsStripe_t *pStripe = &pArgs->pStripes[stripe];
+    NDStats_t *pStats = pArgs->pStats;
+    size_t sizeX = pArgs->sizeX;
+    epicsType *pRow;
+    NDStatsSums_t rowSums;
+    size_t ix, iy;
+    double value, rowSum, rowThresh;
+    int bin;
+
+    pRow = (epicsType *)pArgs->pArray->pData + firstRow*sizeX;
+    pStripe->min = pStripe->max = (double)pRow[0];
+    pStripe->minIndex = pStripe->maxIndex = firstRow*sizeX;
+    pStripe->total = pStripe->sumSquares = 0.;
+    pStripe->M11 = 0.;
+    pStripe->histBelow = pStripe->histAbove = 0;
+
+    for (iy=firstRow; iy<firstRow+numRows; iy++, pRow+=sizeX) {
+        if (pArgs->computeStatistics) {
+            /* The vectorized kernels do not shift, so they are only used when the shift is 0 */
+            if ((pArgs->shift != 0.) ||
+                (NDStatsContiguous(pArgs->pArray->dataType, pRow, sizeX, &rowSums) != ND_SUCCESS)) {
+                NDStatsRow(pRow, sizeX, pArgs->shift, &rowSums);
+            }
+            /* Strict comparisons keep the first occurrence, as in doComputeStatisticsT() */
+            if (rowSums.min < pStripe->min) {
+                pStripe->min = rowSums.min;
+                pStripe->minIndex = iy*sizeX + rowSums.minIndex;
+            }
+            if (rowSums.max > pStripe->max) {
+                pStripe->max = rowSums.max;
+                pStripe->maxIndex = iy*sizeX + rowSums.maxIndex;
+            }
+            pStripe->total += rowSums.total;
+            pStripe->sumSquares += rowSums.sumSquares;
+        }
+        if (pArgs->computeCentroid) {
+            rowSum = 0.;
+            rowThresh = 0.;
+            for (ix=0; ix<sizeX; ix++) {
+                value = (double)pRow[ix];
+                pStripe->profileX[ix] += value;
+                rowSum += value;
+                if (value >= pStats->centroidThreshold) {
+                    pStripe->threshX[ix] += value;
+                    rowThresh += value;
+                    pStripe->M11 += value * ix * iy;
+                }
+            }
+            /* The stripes have different rows, so they write different elements of the Y profiles */
+            pStats->profileY[profAverage][iy] += rowSum;
+            pStats->profileY[profThreshold][iy] += rowThresh;
+        }
+        if (pArgs->computeHistogram && pStripe->pCounts) {
+            NDStatsCountValues(pArgs->pArray->dataType, pRow, sizeX, pStripe->pCounts);
+        } else if (pArgs->computeHistogram) {
+            for (ix=0; ix<sizeX; ix++) {
+                value = (double)pRow[ix];
+                bin = (int)(((value - pStats->histMin) * pArgs->scale) + 0.5);
+                if ((bin < 0) || (value < pStats->histMin))
+                    pStripe->histBelow++;
+                else if ((bin > (int)pStats->histSize-1) || (value > pStats->histMax))
+                    pStripe->histAbove++;
+                else 
+                    pStripe->histogram[bin]++;
+            }
+        }
+    }
+}
+
+/** Computes the statistics, centroid and histogram that are enabled in one pass over the array.
+  * The rows are split into stripes that are processed by the IntraFrameThreads threads with parallelForRows().
+  * The results of the stripes are combined in the order of the stripes, so they do not depend on which thread
+  * finishes first, and they are the same as those of doComputeStatisticsT(), doComputeCentroidT() and
+  * doComputeHistogramT() except for the rounding of sums of non-integer values.
+  * The profiles must have been allocated for the centroid, as they must for doComputeCentroidT().
+  * \param[in] pArray The array, which must have 1 or 2 dimensions.
+  * \param[in,out] pStats The statistics.
+  * \param[in] computeStatistics Compute the statistics.
+  * \param[in] computeCentroid Compute the centroid.
+  * \param[in] computeHistogram Compute the histogram. */
+template <typename epicsType>
+asynStatus NDPluginStats::doComputeFusedT(NDArray *pArray, NDStats_t *pStats,
+                                          int computeStatistics, int computeCentroid, int computeHistogram)
+{
+    NDArrayInfo arrayInfo;
+    statsFusedArgs_t args;
+    statsStripe_t *pStripe;
+    size_t ix, sizeY, imin, imax;
+    double M11;
+    int i, stripe, nStripes;
+
+    if ((pArray->ndims < 1) || (pArray->ndims > 2)) return(asynError);
+    pArray->getInfo(&arrayInfo);
+    args.pArray = pArray;
+    args.pStats = pStats;
+    args.computeStatistics = computeStatistics;
+    args.computeCentroid = computeCentroid;
+    args.computeHistogram = computeHistogram;
+    args.sizeX = pArray->dims[0].size;
+    args.scale = computeHistogram ? pStats->histSize / (pStats->histMax - pStats->histMin) : 0.;
+    sizeY = (pArray->ndims > 1) ? pArray->dims[1].size : 1;
+    if ((args.sizeX == 0) || (sizeY == 0)) return(asynError);
+    args.shift = NDStatsShift((epicsType *)pArray->pData);
+
+    /* Stripe 0 accumulates into pStats, the others into their own arrays */
+    nStripes = numStripes(sizeY);
+    args.tableSize = computeHistogram ? countTableSize(pArray->dataType, arrayInfo.nElements / nStripes) : 0;
+    args.pStripes = (statsStripe_t *)calloc(nStripes, sizeof(statsStripe_t));
+    for (stripe=0; stripe<nStripes; stripe++) {
+        pStripe = &args.pStripes[stripe];
+        if (computeCentroid) {
+            pStripe->profileX = stripe ? (double *)calloc(args.sizeX, sizeof(double)) : pStats->profileX[profAverage];
+            pStripe->threshX  = stripe ? (double *)calloc(args.sizeX, sizeof(double)) : pStats->profileX[profThreshold];
+        }
+        if (computeHistogram) {
+            pStripe->histogram = stripe ? (double *)calloc(pStats->histSize, sizeof(double)) : pStats->histogram;
+            if (args.tableSize) pStripe->pCounts = (epicsUInt32 *)calloc(args.tableSize, sizeof(epicsUInt32));
+        }
+    }
+
+    parallelForRows(computeStatsStripeT<epicsType>, &args, sizeY, nStripes);
+
+    pStripe = &args.pStripes[0];
+    if (computeStatistics) {
+        pStats->nElements = arrayInfo.nElements;
+        pStats->min = pStripe->min;
+        pStats->max = pStripe->max;
+        pStats->total = pStripe->total;
+        pStats->sigma = pStripe->sumSquares;
+    }
+    pStats->histBelow = pStripe->histBelow;
+    pStats->histAbove = pStripe->histAbove;
+    M11 = pStripe->M11;
+    imin = pStripe->minIndex;
+    imax = pStripe->maxIndex;
+    for (stripe=1; stripe<nStripes; stripe++) {
+        pStripe = &args.pStripes[stripe];
+        if (computeStatistics) {
+            /* The stripes are in row order, so strict comparisons keep the first occurrence */
+            if (pStripe->min < pStats->min) {
+                pStats->min = pStripe->min;
+                imin = pStripe->minIndex;
+            }
+            if (pStripe->max > pStats->max) {
+                pStats->max = pStripe->max;
+                imax = pStripe->maxIndex;
+            }
+            pStats->total += pStripe->total;
+            pStats->sigma += pStripe->sumSquares;
+        }
+        if (computeCentroid) {
+            M11 += pStripe->M11;
+            for (ix=0; ix<args.sizeX; ix++) {
+                pStats->profileX[profAverage][ix]   += pStripe->profileX[ix];
+                pStats->profileX[profThreshold][ix] += pStripe->threshX[ix];
+            }
+            free(pStripe->profileX);
+            free(pStripe->threshX);
+        }
+        if (computeHistogram) {
+            pStats->histBelow += pStripe->histBelow;
+            pStats->histAbove += pStripe->histAbove;
+            for (i=0; i<pStats->histSize; i++) pStats->histogram[i] += pStripe->histogram[i];
+            for (ix=0; ix<args.tableSize; ix++) args.pStripes[0].pCounts[ix] += pStripe->pCounts[ix];
+            free(pStripe->histogram);
+            free(pStripe->pCounts);
+        }
+    }
+    if (args.tableSize) {
+        foldHistogram(pStats, pArray->dataType, args.pStripes[0].pCounts);
+        free(args.pStripes[0].pCounts);
+    }
+    free(args.pStripes);
+
+    if (computeStatistics) finishStatistics(pStats, imin, imax, arrayInfo.xSize, args.shift);
+    if (computeCentroid)   finishCentroid(pStats, M11);
+    if (computeHistogram)  finishHistogram(pStats, arrayInfo.nElements);
+    return(asynSuccess);
+}
+
+asynStatus NDPluginStats::doComputeFused(NDArray *pArray, NDStats_t *pStats,
+                                         int computeStatistics, int computeCentroid, int computeHistogram)
 {
     asynStatus status;
 
     switch(pArray->dataType) {
         case NDInt8:
-            status = doComputeProfilesT<epicsInt8>(pArray, pStats);
+            status = doComputeFusedT<epicsInt8>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDUInt8:
-            status = doComputeProfilesT<epicsUInt8>(pArray, pStats);
+            status = doComputeFusedT<epicsUInt8>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDInt16:
-            status = doComputeProfilesT<epicsInt16>(pArray, pStats);
+            status = doComputeFusedT<epicsInt16>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDUInt16:
-            status = doComputeProfilesT<epicsUInt16>(pArray, pStats);
+            status = doComputeFusedT<epicsUInt16>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDInt32:
-            status = doComputeProfilesT<epicsInt32>(pArray, pStats);
+            status = doComputeFusedT<epicsInt32>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDUInt32:
-            status = doComputeProfilesT<epicsUInt32>(pArray, pStats);
+            status = doComputeFusedT<epicsUInt32>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDFloat32:
-            status = doComputeProfilesT<epicsFloat32>(pArray, pStats);
+            status = doComputeFusedT<epicsFloat32>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         case NDFloat64:
-            status = doComputeProfilesT<epicsFloat64>(pArray, pStats);
+            status = doComputeFusedT<epicsFloat64>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
+            break;
+        case NDFloat16:
+            status = doComputeFusedT<NDFloat16_t>(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
             break;
         default:
             status = asynError;
@@ -395,43 +986,260 @@ asynStatus NDPluginStats::doComputeProfiles(NDArray *pArray, NDStats_t *pStats)
     return(status);
 }
 
+#ifdef ND_WITH_CUDA
+/* Returns the shift of the sums of an array, from NDStatsShift() as in doComputeFusedT() */
+static double arrayShift(NDArray *pArray)
+{
+    switch(pArray->dataType) {
+        case NDInt8:    return NDStatsShift((epicsInt8 *)pArray->pData);
+        case NDUInt8:   return NDStatsShift((epicsUInt8 *)pArray->pData);
+        case NDInt16:   return NDStatsShift((epicsInt16 *)pArray->pData);
+        case NDUInt16:  return NDStatsShift((epicsUInt16 *)pArray->pData);
+        case NDInt32:   return NDStatsShift((epicsInt32 *)pArray->pData);
+        case NDUInt32:  return NDStatsShift((epicsUInt32 *)pArray->pData);
+        case NDFloat32: return NDStatsShift((epicsFloat32 *)pArray->pData);
+        case NDFloat64: return NDStatsShift((epicsFloat64 *)pArray->pData);
+        default:        return 0.;
+    }
+}
+#endif
+
+/** Computes the statistics, centroid and histogram that are enabled on the GPU with NDCudaStats(), with the
+  * same results as doComputeFused() except for the rounding of sums of non-integer values.
+  * It fails when the plugin is built without CUDA, when there is no GPU and when the GPU fails, and the caller
+  * then computes them on the CPU.
+  * \param[in] pArray The array, which must have 1 or 2 dimensions.
+  * \param[in,out] pStats The statistics.
+  * \param[in] computeStatistics Compute the statistics.
+  * \param[in] computeCentroid Compute the centroid.
+  * \param[in] computeHistogram Compute the histogram. */
+asynStatus NDPluginStats::doComputeGPU(NDArray *pArray, NDStats_t *pStats,
+                                       int computeStatistics, int computeCentroid, int computeHistogram)
+{
+#ifdef ND_WITH_CUDA
+    NDArrayInfo arrayInfo;
+    NDCudaStatsArgs_t args;
+    NDCudaStatsResult_t result;
+    size_t sizeX, sizeY;
+    static const char *functionName = "doComputeGPU";
+
+    if (!this->pCuda || (pArray->ndims < 1) || (pArray->ndims > 2)) return(asynError);
+    pArray->getInfo(&arrayInfo);
+    sizeX = pArray->dims[0].size;
+    sizeY = (pArray->ndims > 1) ? pArray->dims[1].size : 1;
+    args.computeStatistics = computeStatistics;
+    args.computeCentroid = computeCentroid;
+    args.computeHistogram = computeHistogram;
+    args.shift = arrayShift(pArray);
+    args.centroidThreshold = pStats->centroidThreshold;
+    args.histMin = pStats->histMin;
+    args.histMax = pStats->histMax;
+    args.histSize = pStats->histSize;
+    memset(&result, 0, sizeof(result));
+    if (computeCentroid) {
+        result.profileX = pStats->profileX[profAverage];
+        result.threshX  = pStats->profileX[profThreshold];
+        result.profileY = pStats->profileY[profAverage];
+        result.threshY  = pStats->profileY[profThreshold];
+    }
+    result.histogram = pStats->histogram;
+    if (NDCudaStats(this->pCuda, &args, pArray->dataType, pArray->pData, sizeX, sizeY, &result) != ND_SUCCESS) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s GPU statistics failed, they are computed on the CPU; %s\n",
+            driverName, functionName, NDCudaError(this->pCuda));
+        return(asynError);
+    }
+    if (computeStatistics) {
+        pStats->nElements = arrayInfo.nElements;
+        pStats->min = result.min;
+        pStats->max = result.max;
+        pStats->total = result.total;
+        pStats->sigma = result.sumSquares;
+        finishStatistics(pStats, result.minIndex, result.maxIndex, sizeX, args.shift);
+    }
+    if (computeCentroid) finishCentroid(pStats, result.M11);
+    if (computeHistogram) {
+        pStats->histBelow = result.histBelow;
+        pStats->histAbove = result.histAbove;
+        finishHistogram(pStats, arrayInfo.nElements);
+    }
+    return(asynSuccess);
+#else
+    return(asynError);
+#endif
+}
+
+/** Reduces a series to an envelope of the minimum and maximum of each of nOut/2 equal groups of points,
+  * in the order they occur, so that a plot of the envelope shows the same range as a plot of the series. */
+static size_t envelopeSeries(const double *pIn, size_t nIn, double *pOut, size_t nOut)
+{
+    size_t group, nGroups = nOut / 2, i, first, last, iMin, iMax;
+
+    for (group=0; group<nGroups; group++) {
+        first = nIn * group / nGroups;
+        last  = nIn * (group + 1) / nGroups;
+        iMin = iMax = first;
+        for (i=first+1; i<last; i++) {
+            if (pIn[i] < pIn[iMin]) iMin = i;
+            if (pIn[i] > pIn[iMax]) iMax = i;
+        }
+        pOut[2*group]   = pIn[MIN(iMin, iMax)];
+        pOut[2*group+1] = pIn[MAX(iMin, iMax)];
+    }
+    return 2 * nGroups;
+}
+
+/** Publishes the time series.
+  * In circular mode the points are published oldest first.  When TSDisplayPoints is set and there are
+  * more points than that, a min/max envelope of TSDisplayPoints points is published instead of the points. */
 void NDPluginStats::doTimeSeriesCallbacks()
 {
-    int currentPoint;
+    const int tsParams[MAX_TIME_SERIES_TYPES] = {
+        NDPluginStatsTSMinValue, NDPluginStatsTSMinX, NDPluginStatsTSMinY,
+        NDPluginStatsTSMaxValue, NDPluginStatsTSMaxX, NDPluginStatsTSMaxY,
+        NDPluginStatsTSMeanValue, NDPluginStatsTSSigmaValue, NDPluginStatsTSTotal, NDPluginStatsTSNet,
+        NDPluginStatsTSCentroidTotal, NDPluginStatsTSCentroidX, NDPluginStatsTSCentroidY,
+        NDPluginStatsTSSigmaX, NDPluginStatsTSSigmaY, NDPluginStatsTSSigmaXY,
+        NDPluginStatsTSSkewX, NDPluginStatsTSSkewY, NDPluginStatsTSKurtosisX, NDPluginStatsTSKurtosisY,
+        NDPluginStatsTSEccentricity, NDPluginStatsTSOrientation, NDPluginStatsTSTimestamp
+    };
+    int currentPoint, head, displayPoints;
+    size_t nPoints, nOut;
+    double *pOrdered = NULL, *pEnvelope = NULL, *pSeries;
+    int i;
     
     getIntegerParam(NDPluginStatsTSCurrentPoint, &currentPoint);
+    getIntegerParam(NDPluginStatsTSHead, &head);
+    getIntegerParam(NDPluginStatsTSDisplayPoints, &displayPoints);
+    nPoints = currentPoint;
+    /* The buffer has wrapped if the next point is not after the last one */
+    if ((head > 0) && (head < currentPoint)) {
+        pOrdered = (double *)malloc(nPoints * sizeof(double));
+    }
+    if ((displayPoints > 1) && (nPoints > (size_t)displayPoints)) {
+        pEnvelope = (double *)malloc(displayPoints * sizeof(double));
+    }
 
-    doCallbacksFloat64Array(this->timeSeries[TSMinValue],   currentPoint, NDPluginStatsTSMinValue, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSMinX],       currentPoint, NDPluginStatsTSMinX,     0);
-    doCallbacksFloat64Array(this->timeSeries[TSMinY],       currentPoint, NDPluginStatsTSMinY,     0);            
-    doCallbacksFloat64Array(this->timeSeries[TSMaxValue],   currentPoint, NDPluginStatsTSMaxValue, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSMaxX],       currentPoint, NDPluginStatsTSMaxX,     0);
-    doCallbacksFloat64Array(this->timeSeries[TSMaxY],       currentPoint, NDPluginStatsTSMaxY,     0);                
-    doCallbacksFloat64Array(this->timeSeries[TSMeanValue],  currentPoint, NDPluginStatsTSMeanValue, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSigmaValue], currentPoint, NDPluginStatsTSSigmaValue, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSTotal],      currentPoint, NDPluginStatsTSTotal, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSNet],        currentPoint, NDPluginStatsTSNet, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSCentroidTotal],  currentPoint, NDPluginStatsTSCentroidTotal, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSCentroidX],      currentPoint, NDPluginStatsTSCentroidX, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSCentroidY],      currentPoint, NDPluginStatsTSCentroidY, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSigmaX],         currentPoint, NDPluginStatsTSSigmaX, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSigmaY],         currentPoint, NDPluginStatsTSSigmaY, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSigmaXY],        currentPoint, NDPluginStatsTSSigmaXY, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSkewX],          currentPoint, NDPluginStatsTSSkewX, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSSkewY],          currentPoint, NDPluginStatsTSSkewY, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSKurtosisX],      currentPoint, NDPluginStatsTSKurtosisX, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSKurtosisY],      currentPoint, NDPluginStatsTSKurtosisY, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSEccentricity],   currentPoint, NDPluginStatsTSEccentricity, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSOrientation],    currentPoint, NDPluginStatsTSOrientation, 0);
-    doCallbacksFloat64Array(this->timeSeries[TSTimestamp],      currentPoint, NDPluginStatsTSTimestamp, 0);
+    for (i=0; i<MAX_TIME_SERIES_TYPES; i++) {
+        pSeries = this->timeSeries[i];
+        nOut = nPoints;
+        if (pOrdered) {
+            memcpy(pOrdered, pSeries + head, (nPoints - head) * sizeof(double));
+            memcpy(pOrdered + nPoints - head, pSeries, head * sizeof(double));
+            pSeries = pOrdered;
+        }
+        if (pEnvelope) {
+            nOut = envelopeSeries(pSeries, nPoints, pEnvelope, displayPoints);
+            pSeries = pEnvelope;
+        }
+        doCallbacksFloat64Array(pSeries, nOut, tsParams[i], 0);
+    }
+    free(pOrdered);
+    free(pEnvelope);
+    epicsTimeGetCurrent(&lastTSCallbackTime);
 }
 
 
+/* Copies every sampleX'th element of every sampleY'th row of a 1-D or 2-D array */
+template <typename epicsType>
+static void sampleArrayT(NDArray *pIn, NDArray *pOut, size_t sampleX, size_t sampleY)
+{
+    epicsType *pInData = (epicsType *)pIn->pData;
+    epicsType *pOutData = (epicsType *)pOut->pData;
+    size_t inSizeX = pIn->dims[0].size;
+    size_t inSizeY = (pIn->ndims > 1) ? pIn->dims[1].size : 1;
+    size_t ix, iy;
+
+    for (iy=0; iy<inSizeY; iy+=sampleY) {
+        for (ix=0; ix<inSizeX; ix+=sampleX) {
+            *pOutData++ = pInData[iy*inSizeX + ix];
+        }
+    }
+}
+
+/** Returns a new array with every sampleX'th element of every sampleY'th row of a 1-D or 2-D array,
+  * or NULL if it cannot be allocated.  The elements are copied by size, so any data type is handled. */
+NDArray* NDPluginStats::sampleArray(NDArray *pArray, size_t sampleX, size_t sampleY)
+{
+    size_t dims[2];
+    NDArray *pSampled;
+    NDArrayInfo arrayInfo;
+
+    pArray->getInfo(&arrayInfo);
+    dims[0] = (pArray->dims[0].size + sampleX - 1) / sampleX;
+    if (pArray->ndims > 1) dims[1] = (pArray->dims[1].size + sampleY - 1) / sampleY;
+    pSampled = this->pNDArrayPool->alloc(pArray->ndims, dims, pArray->dataType, 0, NULL);
+    if (!pSampled) return NULL;
+    switch (arrayInfo.bytesPerElement) {
+        case 1:
+            sampleArrayT<epicsUInt8>(pArray, pSampled, sampleX, sampleY);
+            break;
+        case 2:
+            sampleArrayT<epicsUInt16>(pArray, pSampled, sampleX, sampleY);
+            break;
+        case 4:
+            sampleArrayT<epicsUInt32>(pArray, pSampled, sampleX, sampleY);
+            break;
+        default:
+            sampleArrayT<epicsFloat64>(pArray, pSampled, sampleX, sampleY);
+            break;
+    }
+    return pSampled;
+}
+
+/** Scales the positions and sums computed from a sampled array to estimates for the full array.
+  * The min, max, mean, sigma and the normalized centroid moments need no scaling.  The profiles and the
+  * histogram are those of the sampled elements. */
+void NDPluginStats::scaleSampledStats(NDStats_t *pStats, size_t sampleX, size_t sampleY)
+{
+    double scale = (double)(sampleX * sampleY);
+
+    pStats->minX *= sampleX;
+    pStats->minY *= sampleY;
+    pStats->maxX *= sampleX;
+    pStats->maxY *= sampleY;
+    pStats->total *= scale;
+    pStats->net *= scale;
+    pStats->centroidTotal *= scale;
+    pStats->centroidX *= sampleX;
+    pStats->centroidY *= sampleY;
+    pStats->sigmaX *= sampleX;
+    pStats->sigmaY *= sampleY;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
-  * Does image statistics.
+  * Does image statistics.  The statistics of a frame stack, see NDArray::stackFrames, are computed for each
+  * of its frames in turn, so each frame is a point of the time series.
   * \param[in] pArray  The NDArray from the callback.
   */
 void NDPluginStats::processCallbacks(NDArray *pArray)
+{
+    NDArray *pFrame = NULL;
+    size_t frame;
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    if (!pArray->stackFrames.empty() && !pArray->sparse) pFrame = this->pNDArrayPool->stackFrame(pArray, 0);
+    if (!pFrame) {
+        processFrame(pArray);
+    } else {
+        for (frame=1; pFrame; frame++) {
+            processFrame(pFrame);
+            pFrame->release();
+            pFrame = (frame < pArray->stackFrames.size()) ? this->pNDArrayPool->stackFrame(pArray, frame) : NULL;
+        }
+    }
+
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+
+    callStatusCallbacks();
+}
+
+/** Does the statistics of an array, or of one frame of a frame stack.
+  * \param[in] pArray  The array or the frame.
+  */
+void NDPluginStats::processFrame(NDArray *pArray)
 {
     /* This function does array statistics.
      * It is called with the mutex already locked.  It unlocks it during long calculations when private
@@ -443,23 +1251,29 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     int dim;
     NDStats_t stats, *pStats=&stats, statsTemp, *pStatsTemp=&statsTemp;
     double bgdCounts, avgBgd;
-    NDArray *pBgdArray=NULL;
-    int computeStatistics, computeCentroid, computeProfiles, computeHistogram;
+    NDArray *pBgdArray=NULL, *pSampled=NULL, *pOrigArray=pArray;
+    int computeStatistics, computeCentroid, computeProfiles, computeHistogram, computeQuantiles;
+    int sampleX, sampleY, sampleFrames;
+    bool fused, sampled, wholeArray;
+    int enableGPU, gpuActive=0;
+    size_t profileStepX = 1, profileStepY = 1;
     size_t sizeX=0, sizeY=0;
     int i;
-    int numTSPoints, currentTSPoint, TSAcquiring;
+    int numTSPoints, currentTSPoint, TSAcquiring, TSHead, TSCircular;
+    double TSUpdatePeriod;
+    epicsTimeStamp now;
     int itemp;
     NDArrayInfo arrayInfo;
-    static const char* functionName = "processCallbacks";
+    static const char* functionName = "processFrame";
 
-    /* Call the base class method */
-    NDPluginDriver::beginProcessCallbacks(pArray);
-    
     pArray->getInfo(&arrayInfo);
     getIntegerParam(NDPluginStatsComputeStatistics,  &computeStatistics);
     getIntegerParam(NDPluginStatsComputeCentroid,    &computeCentroid);
     getIntegerParam(NDPluginStatsComputeProfiles,    &computeProfiles);
     getIntegerParam(NDPluginStatsComputeHistogram,   &computeHistogram);
+    getIntegerParam(NDPluginStatsComputeQuantiles,   &computeQuantiles);
+    getDoubleParam (NDPluginStatsQuantileLowPercent,  &pStats->quantileLowPercent);
+    getDoubleParam (NDPluginStatsQuantileHighPercent, &pStats->quantileHighPercent);
     getIntegerParam(NDPluginStatsBgdWidth, &bgdWidth);
     getIntegerParam(NDPluginStatsCursorX, &itemp); pStats->cursorX = itemp;
     getIntegerParam(NDPluginStatsCursorY, &itemp); pStats->cursorY = itemp;
@@ -467,11 +1281,36 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     getDoubleParam (NDPluginStatsHistMin,  &pStats->histMin);
     getDoubleParam (NDPluginStatsHistMax,  &pStats->histMax);
     getDoubleParam (NDPluginStatsCentroidThreshold,  &pStats->centroidThreshold);
+    getIntegerParam(NDPluginStatsSampleX,      &sampleX);
+    getIntegerParam(NDPluginStatsSampleY,      &sampleY);
+    getIntegerParam(NDPluginStatsSampleFrames, &sampleFrames);
+    getIntegerParam(NDPluginStatsEnableGPU,    &enableGPU);
+    if (sampleX < 1) sampleX = 1;
+    if (sampleY < 1) sampleY = 1;
+    if (sampleFrames < 1) sampleFrames = 1;
+    setIntegerParam(NDPluginStatsSampled, (sampleX > 1) || (sampleY > 1) || (sampleFrames > 1));
+
+    /* When sampling frames the statistics are only computed for every sampleFrames'th frame;
+     * the other frames are passed on, and the results of the last computed frame are kept */
+    if (sampleFrameCount >= sampleFrames) sampleFrameCount = 0;
+    if (sampleFrameCount++ != 0) return;
   
     if (pArray->ndims > 0) sizeX = pArray->dims[0].size;
     if (pArray->ndims == 1) sizeY = 1;
     if (pArray->ndims > 1)  sizeY = pArray->dims[1].size;
 
+    /* When sampling elements the statistics are computed on a copy of every sampleX'th element of every
+     * sampleY'th row, and the positions and sums are scaled back to the full array.  Sparse arrays are read
+     * event by event, so they are not sampled, nor computed in the fused pass or on the GPU. */
+    sampled = ((sampleX > 1) || (sampleY > 1)) && (pArray->ndims >= 1) && (pArray->ndims <= 2) && !pArray->sparse;
+    if (sampled) {
+        if (pArray->ndims == 1) sampleY = 1;
+        sizeX = (sizeX + sampleX - 1) / sampleX;
+        sizeY = (sizeY + sampleY - 1) / sampleY;
+        pStats->cursorX /= sampleX;
+        pStats->cursorY /= sampleY;
+    }
+
     
     if (computeCentroid || computeProfiles) {
         pStats->profileSizeX = sizeX;
@@ -490,11 +1329,44 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
         pStats->histogram = (double *)calloc(pStats->histSize, sizeof(double));
     }
 
+    /* When more than one of the quantities that read the whole array is enabled they are computed in one pass,
+     * which is also the code that splits the array into stripes for IntraFrameThreads */
+    i = (computeStatistics ? 1 : 0) + (computeCentroid ? 1 : 0) + (computeHistogram ? 1 : 0);
+    fused = ((i > 1) || ((i == 1) && (numStripes(sizeY) > 1))) &&
+            (pArray->ndims >= 1) && (pArray->ndims <= 2) && !pArray->sparse;
+
     // Release the lock.  While it is released we cannot access the parameter library or class member data.
     this->unlock();
+
+    /* The profiles read only a few rows and columns, so when nothing else reads the whole array they are
+     * read from the original array with the sampling steps rather than from a sampled copy */
+    wholeArray = computeStatistics || computeCentroid || computeHistogram || computeQuantiles;
+    if (sampled && !wholeArray) {
+        profileStepX = sampleX;
+        profileStepY = sampleY;
+    } else if (sampled) {
+        pSampled = sampleArray(pArray, sampleX, sampleY);
+        if (pSampled) {
+            pArray = pSampled;
+        } else {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s, error allocating sampled array, using all elements\n",
+                driverName, functionName);
+            sampled = false;
+        }
+    }
  
+    /* The GPU computes what the fused pass would, and the CPU does if it cannot */
+    if (enableGPU && !pArray->sparse && (computeStatistics || computeCentroid || computeHistogram))
+        gpuActive = (doComputeGPU(pArray, pStats, computeStatistics, computeCentroid, computeHistogram) == asynSuccess);
+    if (gpuActive) {
+        fused = true;
+    } else if (fused) {
+        doComputeFused(pArray, pStats, computeStatistics, computeCentroid, computeHistogram);
+    }
+
     if (computeStatistics) {
-        doComputeStatistics(pArray, pStats);
+        if (!fused) doComputeStatistics(pArray, pStats);
         /* If there is a non-zero background width then compute the background counts */
         // Note that the following algorithm is general in N-dimensions but does have a slight inaccuracy.
         // It computes the background region such that the pixels at the corners are counted twice.
@@ -545,53 +1417,79 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
         }
     }
 
-    if (computeCentroid) {
+    if (computeCentroid && !fused) {
          doComputeCentroid(pArray, pStats);
     }
          
     if (computeProfiles) {
-        doComputeProfiles(pArray, pStats);
+        doComputeProfiles(pArray, pStats, profileStepX, profileStepY);
     }
     
-    if (computeHistogram) {
+    if (computeHistogram && !fused) {
         doComputeHistogram(pArray, pStats);
     }
+
+    if (computeQuantiles) {
+        computeQuantiles = (doComputeQuantiles(pArray, pStats) == asynSuccess);
+    }
     
+    if (sampled) {
+        scaleSampledStats(pStats, sampleX, sampleY);
+        /* The original array is passed on to the downstream plugins */
+        pArray = pOrigArray;
+    }
+
     // Take the lock again.  The time-series data need to be protected.
     this->lock();
+    setIntegerParam(NDPluginStatsGPUActive, gpuActive);
 
     getIntegerParam(NDPluginStatsTSCurrentPoint,     &currentTSPoint);
     getIntegerParam(NDPluginStatsTSNumPoints,        &numTSPoints);
     getIntegerParam(NDPluginStatsTSAcquiring,        &TSAcquiring);
+    getIntegerParam(NDPluginStatsTSHead,             &TSHead);
+    getIntegerParam(NDPluginStatsTSCircular,         &TSCircular);
+    getDoubleParam (NDPluginStatsTSUpdatePeriod,     &TSUpdatePeriod);
+    if (TSHead >= numTSPoints) TSHead = 0;
     if (TSAcquiring) {
-        timeSeries[TSMinValue][currentTSPoint]    = pStats->min;
-        timeSeries[TSMinX][currentTSPoint]        = (double)pStats->minX;
-        timeSeries[TSMinY][currentTSPoint]        = (double)pStats->minY;                        
-        timeSeries[TSMaxValue][currentTSPoint]    = pStats->max;
-        timeSeries[TSMaxX][currentTSPoint]        = (double)pStats->maxX;
-        timeSeries[TSMaxY][currentTSPoint]        = (double)pStats->maxY;                                
-        timeSeries[TSMeanValue][currentTSPoint]   = pStats->mean;
-        timeSeries[TSSigmaValue][currentTSPoint]  = pStats->sigma;
-        timeSeries[TSTotal][currentTSPoint]       = pStats->total;
-        timeSeries[TSNet][currentTSPoint]         = pStats->net;
-        timeSeries[TSCentroidTotal][currentTSPoint]   = pStats->centroidTotal;
-        timeSeries[TSCentroidX][currentTSPoint]       = pStats->centroidX;
-        timeSeries[TSCentroidY][currentTSPoint]       = pStats->centroidY;
-        timeSeries[TSSigmaX][currentTSPoint]          = pStats->sigmaX;
-        timeSeries[TSSigmaY][currentTSPoint]          = pStats->sigmaY;
-        timeSeries[TSSigmaXY][currentTSPoint]         = pStats->sigmaXY;
-        timeSeries[TSSkewX][currentTSPoint]           = pStats->skewX;
-        timeSeries[TSSkewY][currentTSPoint]           = pStats->skewY;
-        timeSeries[TSKurtosisX][currentTSPoint]       = pStats->kurtosisX;
-        timeSeries[TSKurtosisY][currentTSPoint]       = pStats->kurtosisY;
-        timeSeries[TSEccentricity][currentTSPoint]    = pStats->eccentricity;
-        timeSeries[TSOrientation][currentTSPoint]     = pStats->orientation;
-        timeSeries[TSTimestamp][currentTSPoint]       = pArray->timeStamp;
-        currentTSPoint++;
+        timeSeries[TSMinValue][TSHead]    = pStats->min;
+        timeSeries[TSMinX][TSHead]        = (double)pStats->minX;
+        timeSeries[TSMinY][TSHead]        = (double)pStats->minY;                        
+        timeSeries[TSMaxValue][TSHead]    = pStats->max;
+        timeSeries[TSMaxX][TSHead]        = (double)pStats->maxX;
+        timeSeries[TSMaxY][TSHead]        = (double)pStats->maxY;                                
+        timeSeries[TSMeanValue][TSHead]   = pStats->mean;
+        timeSeries[TSSigmaValue][TSHead]  = pStats->sigma;
+        timeSeries[TSTotal][TSHead]       = pStats->total;
+        timeSeries[TSNet][TSHead]         = pStats->net;
+        timeSeries[TSCentroidTotal][TSHead]   = pStats->centroidTotal;
+        timeSeries[TSCentroidX][TSHead]       = pStats->centroidX;
+        timeSeries[TSCentroidY][TSHead]       = pStats->centroidY;
+        timeSeries[TSSigmaX][TSHead]          = pStats->sigmaX;
+        timeSeries[TSSigmaY][TSHead]          = pStats->sigmaY;
+        timeSeries[TSSigmaXY][TSHead]         = pStats->sigmaXY;
+        timeSeries[TSSkewX][TSHead]           = pStats->skewX;
+        timeSeries[TSSkewY][TSHead]           = pStats->skewY;
+        timeSeries[TSKurtosisX][TSHead]       = pStats->kurtosisX;
+        timeSeries[TSKurtosisY][TSHead]       = pStats->kurtosisY;
+        timeSeries[TSEccentricity][TSHead]    = pStats->eccentricity;
+        timeSeries[TSOrientation][TSHead]     = pStats->orientation;
+        timeSeries[TSTimestamp][TSHead]       = pArray->timeStamp;
+        /* TSHead is the index of the next point and TSCurrentPoint the number of points;
+         * in circular mode the head wraps and the oldest points are overwritten */
+        TSHead++;
+        if (currentTSPoint < numTSPoints) currentTSPoint++;
+        if (TSCircular && (TSHead >= numTSPoints)) TSHead = 0;
         setIntegerParam(NDPluginStatsTSCurrentPoint, currentTSPoint);
-        if (currentTSPoint >= numTSPoints) {
+        setIntegerParam(NDPluginStatsTSHead, TSHead);
+        if (!TSCircular && (currentTSPoint >= numTSPoints)) {
             setIntegerParam(NDPluginStatsTSAcquiring, 0);
             doTimeSeriesCallbacks();
+        } else if (TSUpdatePeriod > 0.) {
+            /* Publish while acquiring, at most once per TSUpdatePeriod whatever the frame rate */
+            epicsTimeGetCurrent(&now);
+            if (epicsTimeDiffInSeconds(&now, &lastTSCallbackTime) >= TSUpdatePeriod) {
+                doTimeSeriesCallbacks();
+            }
         }
     }
 
@@ -637,6 +1535,12 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
         doCallbacksFloat64Array(pStats->profileY[profCursor],    pStats->profileSizeY, NDPluginStatsProfileCursorY, 0);
     }
 
+    if (computeQuantiles) {
+        setDoubleParam(NDPluginStatsMedianValue,       pStats->median);
+        setDoubleParam(NDPluginStatsQuantileLowValue,  pStats->quantileLow);
+        setDoubleParam(NDPluginStatsQuantileHighValue, pStats->quantileHigh);
+    }
+
     if (computeHistogram) {
         setDoubleParam(NDPluginStatsHistEntropy, pStats->histEntropy);
         setIntegerParam(NDPluginStatsHistBelow, pStats->histBelow);
@@ -655,9 +1559,7 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
         free(pStats->histogram);
     }
 
-    NDPluginDriver::endProcessCallbacks(pArray, true, true);
-    
-    callParamCallbacks();
+    if (pSampled) pSampled->release();
 }
 
 asynStatus NDPluginStats::computeHistX()
@@ -690,7 +1592,7 @@ asynStatus NDPluginStats::writeInt32(asynUser *pasynUser, epicsInt32 value)
     int function = pasynUser->reason;
     asynStatus status = asynSuccess;
     int i;
-    int numPoints, currentPoint;
+    int numPoints, currentPoint, circular;
     static const char *functionName = "writeInt32";
 
 
@@ -710,12 +1612,16 @@ asynStatus NDPluginStats::writeInt32(asynUser *pasynUser, epicsInt32 value)
             free(this->timeSeries[i]);
             timeSeries[i] = (double *)calloc(value, sizeof(double));
         }
+        /* The new arrays are empty */
+        setIntegerParam(NDPluginStatsTSCurrentPoint, 0);
+        setIntegerParam(NDPluginStatsTSHead, 0);
     } else if (function == NDPluginStatsHistSize) {
           status = computeHistX();
     } else if (function == NDPluginStatsTSControl) {
         switch (value) {
             case TSEraseStart:
                 setIntegerParam(NDPluginStatsTSCurrentPoint, 0);
+                setIntegerParam(NDPluginStatsTSHead, 0);
                 setIntegerParam(NDPluginStatsTSAcquiring, 1);
                 getIntegerParam(NDPluginStatsTSNumPoints, &numPoints);
                 for (i=0; i<MAX_TIME_SERIES_TYPES; i++) {
@@ -725,7 +1631,8 @@ asynStatus NDPluginStats::writeInt32(asynUser *pasynUser, epicsInt32 value)
             case TSStart:
                 getIntegerParam(NDPluginStatsTSNumPoints, &numPoints);
                 getIntegerParam(NDPluginStatsTSCurrentPoint, &currentPoint);
-                if (currentPoint < numPoints) {
+                getIntegerParam(NDPluginStatsTSCircular, &circular);
+                if (circular || (currentPoint < numPoints)) {
                     setIntegerParam(NDPluginStatsTSAcquiring, 1);
                 }
                 break;
@@ -894,6 +1801,10 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     createParam(NDPluginStatsTSEccentricityString,    asynParamFloat64Array, &NDPluginStatsTSEccentricity);
     createParam(NDPluginStatsTSOrientationString,     asynParamFloat64Array, &NDPluginStatsTSOrientation);
     createParam(NDPluginStatsTSTimestampString,       asynParamFloat64Array, &NDPluginStatsTSTimestamp);
+    createParam(NDPluginStatsTSCircularString,        asynParamInt32,        &NDPluginStatsTSCircular);
+    createParam(NDPluginStatsTSHeadString,            asynParamInt32,        &NDPluginStatsTSHead);
+    createParam(NDPluginStatsTSDisplayPointsString,   asynParamInt32,        &NDPluginStatsTSDisplayPoints);
+    createParam(NDPluginStatsTSUpdatePeriodString,    asynParamFloat64,      &NDPluginStatsTSUpdatePeriod);
 
     /* Profiles */
     createParam(NDPluginStatsComputeProfilesString,   asynParamInt32,         &NDPluginStatsComputeProfiles);
@@ -921,14 +1832,62 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     createParam(NDPluginStatsHistArrayString,         asynParamFloat64Array,  &NDPluginStatsHistArray);
     createParam(NDPluginStatsHistXArrayString,        asynParamFloat64Array,  &NDPluginStatsHistXArray);
 
+    /* Quantiles */
+    createParam(NDPluginStatsComputeQuantilesString,    asynParamInt32,       &NDPluginStatsComputeQuantiles);
+    createParam(NDPluginStatsQuantileLowPercentString,  asynParamFloat64,     &NDPluginStatsQuantileLowPercent);
+    createParam(NDPluginStatsQuantileHighPercentString, asynParamFloat64,     &NDPluginStatsQuantileHighPercent);
+    createParam(NDPluginStatsMedianValueString,         asynParamFloat64,     &NDPluginStatsMedianValue);
+    createParam(NDPluginStatsQuantileLowValueString,    asynParamFloat64,     &NDPluginStatsQuantileLowValue);
+    createParam(NDPluginStatsQuantileHighValueString,   asynParamFloat64,     &NDPluginStatsQuantileHighValue);
+
+    /* Sampling */
+    createParam(NDPluginStatsSampleXString,           asynParamInt32,         &NDPluginStatsSampleX);
+    createParam(NDPluginStatsSampleYString,           asynParamInt32,         &NDPluginStatsSampleY);
+    createParam(NDPluginStatsSampleFramesString,      asynParamInt32,         &NDPluginStatsSampleFrames);
+    createParam(NDPluginStatsSampledString,           asynParamInt32,         &NDPluginStatsSampled);
+
+    /* GPU offload */
+    createParam(NDPluginStatsEnableGPUString,         asynParamInt32,         &NDPluginStatsEnableGPU);
+    createParam(NDPluginStatsGPUActiveString,         asynParamInt32,         &NDPluginStatsGPUActive);
+
     // If we uncomment the following line then we can't set numTSPoints from database at initialisation
     //setIntegerParam(NDPluginStatsTSNumPoints, numTSPoints);
     setIntegerParam(NDPluginStatsTSAcquiring, 0);
     setIntegerParam(NDPluginStatsTSCurrentPoint, 0);
+    setIntegerParam(NDPluginStatsTSCircular, 0);
+    setIntegerParam(NDPluginStatsTSHead, 0);
+    setIntegerParam(NDPluginStatsTSDisplayPoints, 0);
+    setDoubleParam (NDPluginStatsTSUpdatePeriod, 0.);
+    epicsTimeGetCurrent(&lastTSCallbackTime);
+    setIntegerParam(NDPluginStatsComputeQuantiles, 0);
+    setDoubleParam (NDPluginStatsQuantileLowPercent, 1.);
+    setDoubleParam (NDPluginStatsQuantileHighPercent, 99.);
+    setIntegerParam(NDPluginStatsSampleX, 1);
+    setIntegerParam(NDPluginStatsSampleY, 1);
+    setIntegerParam(NDPluginStatsSampleFrames, 1);
+    setIntegerParam(NDPluginStatsSampled, 0);
+    sampleFrameCount = 0;
+    setIntegerParam(NDPluginStatsEnableGPU, 0);
+    setIntegerParam(NDPluginStatsGPUActive, 0);
+    this->pCuda = NULL;
+#ifdef ND_WITH_CUDA
+    {
+        char error[256];
+        /* The arrays of the plugin, such as sampled copies, are pinned so they are copied without staging */
+        this->pCuda = NDCudaCreate(0, error, sizeof(error));
+        if (this->pCuda && !this->pNDArrayPool->memoryProvider())
+            this->pNDArrayPool->setMemoryProvider(NDCudaPinnedMemory());
+        if (!this->pCuda)
+            printf("%s: GPU offload is not available; %s\n", driverName, error);
+    }
+#endif
     for (i=0; i<MAX_TIME_SERIES_TYPES; i++) {
         timeSeries[i] = (double *)calloc(numTSPoints, sizeof(double));
     }
 
+    /* The statistics, centroid, profiles, histogram and quantiles read the events of sparse arrays */
+    supportsSparseArrays_ = true;
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginStats");
 
@@ -5,6 +5,8 @@
 
 #include "NDPluginDriver.h"
 
+struct NDCudaContext;
+
 typedef enum {
     profAverage,
     profThreshold,
@@ -87,6 +89,11 @@ typedef struct NDStats {
     epicsInt32 histBelow;
     epicsInt32 histAbove;
     double histEntropy;
+    double quantileLowPercent;
+    double quantileHighPercent;
+    double median;
+    double quantileLow;
+    double quantileHigh;
 } NDStats_t;
 
 /* Statistics */
@@ -148,6 +155,10 @@ typedef struct NDStats {
 #define NDPluginStatsTSEccentricityString     "TS_ECCENTRICITY_VALUE"/* (asynFloat64Array, r/o) Series of eccentricity */
 #define NDPluginStatsTSOrientationString      "TS_ORIENTATION_VALUE"     /* (asynFloat64Array, r/o) Series of orientation */
 #define NDPluginStatsTSTimestampString        "TS_TIMESTAMP_VALUE"  /* (asynFloat64Array, r/o) Series of timestamps */
+#define NDPluginStatsTSCircularString         "TS_CIRCULAR"         /* (asynInt32,        r/w) Keep acquiring and overwrite the oldest points */
+#define NDPluginStatsTSHeadString             "TS_HEAD"             /* (asynInt32,        r/o) Index of the next point to be written */
+#define NDPluginStatsTSDisplayPointsString    "TS_DISPLAY_POINTS"   /* (asynInt32,        r/w) Publish a min/max envelope of this many points, 0=all */
+#define NDPluginStatsTSUpdatePeriodString     "TS_UPDATE_PERIOD"    /* (asynFloat64,      r/w) Minimum time between time series callbacks while acquiring, 0=none */
 
 /* Profiles*/   
 #define NDPluginStatsComputeProfilesString    "COMPUTE_PROFILES"    /* (asynInt32,        r/w) Compute profiles? */
@@ -176,6 +187,24 @@ typedef struct NDStats {
 #define NDPluginStatsHistXArrayString         "HIST_X_ARRAY"        /* (asynFloat64Array, r/o) Histogram X axis array */
 
 
+/* Quantiles */
+#define NDPluginStatsComputeQuantilesString   "COMPUTE_QUANTILES"   /* (asynInt32,        r/w) Compute quantiles? */
+#define NDPluginStatsQuantileLowPercentString "QUANTILE_LOW_PERCENT"  /* (asynFloat64,    r/w) Percentile of the low quantile */
+#define NDPluginStatsQuantileHighPercentString "QUANTILE_HIGH_PERCENT" /* (asynFloat64,   r/w) Percentile of the high quantile */
+#define NDPluginStatsMedianValueString        "MEDIAN_VALUE"        /* (asynFloat64,      r/o) Median of all elements */
+#define NDPluginStatsQuantileLowValueString   "QUANTILE_LOW_VALUE"  /* (asynFloat64,      r/o) Low quantile of all elements */
+#define NDPluginStatsQuantileHighValueString  "QUANTILE_HIGH_VALUE" /* (asynFloat64,      r/o) High quantile of all elements */
+
+/* Sampling for preview statistics */
+#define NDPluginStatsSampleXString            "SAMPLE_X"            /* (asynInt32,        r/w) Use every Nth element in X */
+#define NDPluginStatsSampleYString            "SAMPLE_Y"            /* (asynInt32,        r/w) Use every Nth element in Y */
+#define NDPluginStatsSampleFramesString       "SAMPLE_FRAMES"       /* (asynInt32,        r/w) Use every Nth array */
+#define NDPluginStatsSampledString            "SAMPLED"             /* (asynInt32,        r/o) Results are approximate, from sampled data */
+
+/* GPU offload */
+#define NDPluginStatsEnableGPUString          "ENABLE_GPU"          /* (asynInt32,        r/w) Compute on the GPU when it can */
+#define NDPluginStatsGPUActiveString          "GPU_ACTIVE"          /* (asynInt32,        r/o) The last array was computed on the GPU */
+
 /* Arrays of total and net counts for MCA or waveform record */   
 #define NDPluginStatsCallbackPeriodString     "CALLBACK_PERIOD"     /* (asynFloat64,      r/w) Callback period */
 
@@ -194,15 +223,26 @@ public:
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    void processFrame(NDArray *pArray);
     
     template <typename epicsType> void doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats);
     int doComputeStatistics(NDArray *pArray, NDStats_t *pStats);
     template <typename epicsType> asynStatus doComputeCentroidT(NDArray *pArray, NDStats_t *pStats);
     asynStatus doComputeCentroid(NDArray *pArray, NDStats_t *pStats);
-    template <typename epicsType> asynStatus doComputeProfilesT(NDArray *pArray, NDStats_t *pStats);
-    asynStatus doComputeProfiles(NDArray *pArray, NDStats_t *pStats);
+    template <typename epicsType> asynStatus doComputeProfilesT(NDArray *pArray, NDStats_t *pStats,
+                                                                size_t stepX, size_t stepY);
+    asynStatus doComputeProfiles(NDArray *pArray, NDStats_t *pStats, size_t stepX, size_t stepY);
     template <typename epicsType> asynStatus doComputeHistogramT(NDArray *pArray, NDStats_t *pStats);
     asynStatus doComputeHistogram(NDArray *pArray, NDStats_t *pStats);
+    template <typename epicsType> asynStatus doComputeQuantilesT(NDArray *pArray, NDStats_t *pStats);
+    asynStatus doComputeQuantiles(NDArray *pArray, NDStats_t *pStats);
+    template <typename epicsType> asynStatus doComputeFusedT(NDArray *pArray, NDStats_t *pStats,
+                                                             int computeStatistics, int computeCentroid,
+                                                             int computeHistogram);
+    asynStatus doComputeFused(NDArray *pArray, NDStats_t *pStats,
+                              int computeStatistics, int computeCentroid, int computeHistogram);
+    asynStatus doComputeGPU(NDArray *pArray, NDStats_t *pStats,
+                            int computeStatistics, int computeCentroid, int computeHistogram);
    
 protected:
     int NDPluginStatsComputeStatistics;
@@ -264,6 +304,10 @@ protected:
     int NDPluginStatsTSEccentricity;
     int NDPluginStatsTSOrientation;
     int NDPluginStatsTSTimestamp;
+    int NDPluginStatsTSCircular;
+    int NDPluginStatsTSHead;
+    int NDPluginStatsTSDisplayPoints;
+    int NDPluginStatsTSUpdatePeriod;
     
     /* Profiles */
     int NDPluginStatsComputeProfiles;
@@ -291,10 +335,38 @@ protected:
     int NDPluginStatsHistArray;
     int NDPluginStatsHistXArray;
 
+    /* Quantiles */
+    int NDPluginStatsComputeQuantiles;
+    int NDPluginStatsQuantileLowPercent;
+    int NDPluginStatsQuantileHighPercent;
+    int NDPluginStatsMedianValue;
+    int NDPluginStatsQuantileLowValue;
+    int NDPluginStatsQuantileHighValue;
+
+    /* Sampling */
+    int NDPluginStatsSampleX;
+    int NDPluginStatsSampleY;
+    int NDPluginStatsSampleFrames;
+    int NDPluginStatsSampled;
+
+    /* GPU offload */
+    int NDPluginStatsEnableGPU;
+    int NDPluginStatsGPUActive;
+
 private:
     double  *timeSeries[MAX_TIME_SERIES_TYPES];
+    epicsTimeStamp lastTSCallbackTime;
+    int sampleFrameCount;
+    struct NDCudaContext *pCuda;    /* The GPU context, NULL when the plugin is built without CUDA or has no GPU */
     void doTimeSeriesCallbacks();
     asynStatus computeHistX();
+    void finishStatistics(NDStats_t *pStats, size_t imin, size_t imax, size_t xSize, double shift);
+    void finishCentroid(NDStats_t *pStats, double M11);
+    void finishHistogram(NDStats_t *pStats, size_t nElements);
+    size_t countTableSize(NDDataType_t dataType, size_t nElements);
+    void foldHistogram(NDStats_t *pStats, NDDataType_t dataType, epicsUInt32 *pCounts);
+    NDArray *sampleArray(NDArray *pArray, size_t sampleX, size_t sampleY);
+    void scaleSampledStats(NDStats_t *pStats, size_t sampleX, size_t sampleY);
 };
 
 #endif
@@ -28,43 +28,103 @@
 
 static const char *driverName="NDPluginStdArrays";
 
+/** Returns an array converted to a data type, converting it only if it is not yet in pConverted.
+  * An array that already has the data type is reserved rather than copied.
+  * \param[in] pArray The array to convert.
+  * \param[in] dataType The data type of the output.
+  * \param[in,out] pConverted The arrays converted so far, indexed by data type; the output is added to it.
+  * \return The status of NDArrayPool::convert(). */
+int NDPluginStdArrays::convertArray(NDArray *pArray, NDDataType_t dataType, NDArray **pConverted)
+{
+    int status = ND_SUCCESS;
+
+    if (!pConverted[dataType]) {
+        if ((pArray->dataType == dataType) && pArray->isContiguous()) {
+            pArray->reserve();
+            pConverted[dataType] = pArray;
+        } else {
+            status = this->pNDArrayPool->convert(pArray, &pConverted[dataType], dataType);
+        }
+    }
+    return status;
+}
+
+/** Averages bins of binning x binning pixels of the image in an array, keeping its data type.
+  * The color dimension of RGB arrays is not binned, nor is a dimension smaller than the bin.
+  * \param[in] pArray The input array.
+  * \param[in] binning The size of a bin in each dimension of the image.
+  * \param[out] ppOut The binned array.
+  * \return The status of NDArrayPool::convert(). */
+int NDPluginStdArrays::downsampleArray(NDArray *pArray, int binning, NDArray **ppOut)
+{
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDAttribute *pAttribute;
+    int colorMode = NDColorModeMono;
+    int xDim = 0, yDim = 1;
+    double scale = 1.;
+    int i;
+
+    pAttribute = pArray->pAttributeList->find("ColorMode");
+    if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
+    if (pArray->ndims == 3) {
+        if (colorMode == NDColorModeRGB1) {
+            xDim = 1;
+            yDim = 2;
+        } else if (colorMode == NDColorModeRGB2) {
+            yDim = 2;
+        }
+    }
+    for (i=0; i<pArray->ndims; i++) {
+        pArray->initDimension(&dims[i], pArray->dims[i].size);
+        if (((i == xDim) || (i == yDim)) && (dims[i].size >= (size_t)binning)) {
+            dims[i].binning = binning;
+            scale *= binning;
+        }
+    }
+    return this->pNDArrayPool->convert(pArray, ppOut, pArray->dataType, dims, scale);
+}
+
+/** Releases the arrays in pConverted and clears it. */
+void NDPluginStdArrays::releaseConverted(NDArray **pConverted)
+{
+    int i;
+
+    for (i=0; i<=NDFloat64; i++) {
+        if (pConverted[i]) pConverted[i]->release();
+        pConverted[i] = NULL;
+    }
+}
+
 template <typename epicsType, typename interruptType>
-void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool, 
-                            void *interruptPvt, int *initialized, NDDataType_t signedType)
+void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArray **pConverted,
+                            void *interruptPvt, NDDataType_t signedType)
 {
     ELLLIST *pclientList;
     interruptNode *pnode;
     int status;
-    epicsType *pData=NULL;
-    NDArray *pOutput=NULL;
     NDArrayInfo_t arrayInfo;
 
+    pArray->getInfo(&arrayInfo);
     pasynManager->interruptStart(interruptPvt, &pclientList);
     pnode = (interruptNode *)ellFirst(pclientList);
     while (pnode) {
         interruptType *pInterrupt = (interruptType *)pnode->drvPvt;
         if (pInterrupt->pasynUser->reason == NDPluginStdArraysData) {
-            if (!*initialized) {
-                *initialized = 1;
-                pArray->getInfo(&arrayInfo);
-                status = pNDArrayPool->convert(pArray, &pOutput, signedType);
-                if (status) {
-                    asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
-                              "%s::arrayInterruptCallback: error allocating array in convert()\n",
-                               driverName);
-                    break;
-                }
-                pData = (epicsType *)pOutput->pData;
+            status = convertArray(pArray, signedType, pConverted);
+            if (status) {
+                asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
+                          "%s::arrayInterruptCallback: error allocating array in convert()\n",
+                           driverName);
+                break;
             }
             pInterrupt->pasynUser->timestamp = pArray->epicsTS;
             pInterrupt->callback(pInterrupt->userPvt,
                                  pInterrupt->pasynUser,
-                                 pData, arrayInfo.nElements);
+                                 (epicsType *)pConverted[signedType]->pData, arrayInfo.nElements);
         }
         pnode = (interruptNode *)ellNext(&pnode->node);
     }
     pasynManager->interruptEnd(interruptPvt);
-    if (pOutput) pOutput->release();
 }
 
 template <typename epicsType> 
@@ -72,7 +132,7 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
 {
     int command = pasynUser->reason;
     asynStatus status = asynSuccess;
-    NDArray *pOutput, *myArray;
+    NDArray *myArray;
     NDArrayInfo_t arrayInfo;
 
     myArray = this->pArrays[0];
@@ -89,7 +149,8 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
              * Just pass the first nElements. */
              arrayInfo.nElements = nElements;
         }
-        status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType);
+        /* The converted array is kept for the next reads of this array */
+        status = (asynStatus)convertArray(myArray, outputType, this->pConverted_);
         if (status) {
             asynPrint(pasynUser, ASYN_TRACE_ERROR,
                       "%s::readArray: error allocating array in convert()\n",
@@ -98,8 +159,7 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
         }
         /* Copy the data */
         *nIn = arrayInfo.nElements;
-        memcpy(value, pOutput->pData, *nIn*sizeof(epicsType));
-        pOutput->release();
+        memcpy(value, this->pConverted_[outputType]->pData, *nIn*sizeof(epicsType));
         /* Set the timestamp */
         pasynUser->timestamp = myArray->epicsTS;
     } else {
@@ -117,7 +177,7 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * It does callbacks with the array data to any registered asyn clients on any
   * of the asynXXXArray interfaces.  It converts the array data to the type required for that
-  * interface.
+  * interface, once for all of the clients of each interface, and keeps the converted arrays for read().
   * \param[in] pArray  The NDArray from the callback.
   */ 
 void NDPluginStdArrays::processCallbacks(NDArray *pArray)
@@ -127,62 +187,99 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
      * It is called with the mutex already locked.
      */
      
-    int int8Initialized=0;
-    int int16Initialized=0;
-    int int32Initialized=0;
-    int float32Initialized=0;
-    int float64Initialized=0;
-    NDArrayInfo_t arrayInfo;
+    NDArray *pConverted[NDFloat64+1] = {0};
+    NDArray *pOutput = pArray;
+    int downsample;
     asynStandardInterfaces *pInterfaces = this->getAsynStdInterfaces();
-    /* static const char* functionName = "processCallbacks"; */
+    static const char* functionName = "processCallbacks";
 
     /* Call the base class method */
     NDPluginDriver::beginProcessCallbacks(pArray);
-    
-    pArray->getInfo(&arrayInfo);
+    getIntegerParam(NDPluginStdArraysDownsample, &downsample);
  
     /* This function is called with the lock taken, and it must be set when we exit.
      * The following code can be exected without the mutex because we are not accessing pPvt */
     this->unlock();
 
+    if ((downsample <= 1) || downsampleArray(pArray, downsample, &pOutput)) {
+        if (downsample > 1) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s: error downsampling array, passing it on unbinned\n",
+                      driverName, functionName);
+        }
+        pOutput = pArray;
+        pOutput->reserve();
+    }
+
     /* Pass interrupts for int8Array data*/
-    arrayInterruptCallback<epicsInt8, asynInt8ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int8ArrayInterruptPvt,
-                             &int8Initialized, NDInt8);
+    arrayInterruptCallback<epicsInt8, asynInt8ArrayInterrupt>(pOutput, pConverted,
+                             pInterfaces->int8ArrayInterruptPvt, NDInt8);
     
     /* Pass interrupts for int16Array data*/
-    arrayInterruptCallback<epicsInt16,  asynInt16ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int16ArrayInterruptPvt,
-                             &int16Initialized, NDInt16);
+    arrayInterruptCallback<epicsInt16,  asynInt16ArrayInterrupt>(pOutput, pConverted,
+                             pInterfaces->int16ArrayInterruptPvt, NDInt16);
     
     /* Pass interrupts for int32Array data*/
-    arrayInterruptCallback<epicsInt32, asynInt32ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int32ArrayInterruptPvt,
-                             &int32Initialized, NDInt32);
+    arrayInterruptCallback<epicsInt32, asynInt32ArrayInterrupt>(pOutput, pConverted,
+                             pInterfaces->int32ArrayInterruptPvt, NDInt32);
     
     /* Pass interrupts for float32Array data*/
-    arrayInterruptCallback<epicsFloat32, asynFloat32ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->float32ArrayInterruptPvt,
-                             &float32Initialized, NDFloat32);
+    arrayInterruptCallback<epicsFloat32, asynFloat32ArrayInterrupt>(pOutput, pConverted,
+                             pInterfaces->float32ArrayInterruptPvt, NDFloat32);
     
     /* Pass interrupts for float64Array data*/
-    arrayInterruptCallback<epicsFloat64, asynFloat64ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->float64ArrayInterruptPvt,
-                             &float64Initialized, NDFloat64);
+    arrayInterruptCallback<epicsFloat64, asynFloat64ArrayInterrupt>(pOutput, pConverted,
+                             pInterfaces->float64ArrayInterruptPvt, NDFloat64);
 
     /* We must exit with the mutex locked */
     this->lock();
-    /* We always keep the last array so read() can use it.  
-     * Release previous one, reserve new one */
+    /* We always keep the last array, and its conversions, so read() can use them.  
+     * Release the previous ones, our reference to pOutput passes to pArrays[0] */
     if (this->pArrays[0]) this->pArrays[0]->release();
-    pArray->reserve();
-    this->pArrays[0] = pArray;
+    this->pArrays[0] = pOutput;
+    releaseConverted(this->pConverted_);
+    memcpy(this->pConverted_, pConverted, sizeof(pConverted));
+    setArrayDimensions(pOutput);
     /* Update the parameters.  The counter should be updated after data are posted
      * because clients might use that to detect new data */
+    callStatusCallbacks();
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * It checks that Downsample is 1, 2 or 4.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginStdArrays::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int oldvalue = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_STDARRAYS_PARAM) return NDPluginDriver::writeInt32(pasynUser, value);
+
+    getIntegerParam(function, &oldvalue);
+    if (function == NDPluginStdArraysDownsample) {
+        if ((value != 1) && (value != 2) && (value != 4)) status = asynError;
+    }
+    setIntegerParam(function, status ? oldvalue : value);
+
+    /* Do callbacks so higher layers see any changes */
     callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: ERROR status=%d, function=%d, value=%d old=%d\n",
+              driverName, functionName, status, function, value, oldvalue);
+    else
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
 }
 
-
+
 /** Called when asyn clients call pasynInt8Array->read().
   * Converts the last NDArray callback data to epicsInt8 (if necessary) and returns it.  
   * \param[in] pasynUser pasynUser structure that encodes the reason and address.
@@ -284,6 +381,11 @@ NDPluginStdArrays::NDPluginStdArrays(const char *portName, int queueSize, int bl
     //static const char *functionName = "NDPluginStdArrays";
     
     createParam(NDPluginStdArraysDataString, asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysDownsampleString, asynParamInt32, &NDPluginStdArraysDownsample);
+    setIntegerParam(NDPluginStdArraysDownsample, 1);
+    memset(this->pConverted_, 0, sizeof(this->pConverted_));
+    /* The dimensions are those of the downsampled arrays */
+    reportsOwnDimensions_ = true;
 
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDPluginStdArrays");
@@ -296,6 +398,11 @@ NDPluginStdArrays::NDPluginStdArrays(const char *portName, int queueSize, int bl
     connectToArrayPort();
 }
 
+NDPluginStdArrays::~NDPluginStdArrays()
+{
+    releaseConverted(this->pConverted_);
+}
+
 /* Configuration routine.  Called directly, or from the iocsh function */
 extern "C" int NDStdArraysConfigure(const char *portName, int queueSize, int blockingCallbacks, 
                                     const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
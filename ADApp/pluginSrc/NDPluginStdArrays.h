@@ -5,20 +5,27 @@
 
 #include "NDPluginDriver.h"
 
-#define NDPluginStdArraysDataString "STD_ARRAY_DATA"           /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysDataString       "STD_ARRAY_DATA"        /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysDownsampleString "STD_ARRAY_DOWNSAMPLE"  /* (asynInt32,    r/w) Binning of the image, 1, 2 or 4 */
 
 /** Converts NDArray callback data into standard asyn arrays (asynInt8Array, asynInt16Array, asynInt32Array,
   * asynFloat32Array or asynFloat64Array); normally used for putting NDArray data in EPICS waveform records.
   * It handles the data type conversion if the NDArray data type differs from the data type of the asyn interface.
-  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays. */
+  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays.
+  * Each array is converted at most once to each data type, for the callbacks and for all of the reads until the
+  * next array; an array that already has the data type is not copied.  Downsample averages 2x2 or 4x4 bins of the
+  * image for displays, and the dimensions of the plugin are those of the binned image.  The update rate of the
+  * waveforms is limited with MinCallbackTime, which drops the arrays before they are queued. */
 class epicsShareClass NDPluginStdArrays : public NDPluginDriver {
 public:
     NDPluginStdArrays(const char *portName, int queueSize, int blockingCallbacks, 
                       const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
                       int priority, int stackSize, int maxThreads=1);
+    ~NDPluginStdArrays();
 
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus readInt8Array(asynUser *pasynUser, epicsInt8 *value,
                                         size_t nElements, size_t *nIn);
     virtual asynStatus readInt16Array(asynUser *pasynUser, epicsInt16 *value,
@@ -32,14 +39,19 @@ public:
 protected:
     int NDPluginStdArraysData;
     #define FIRST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysData
+    int NDPluginStdArraysDownsample;
 private:
     /* These methods are just for this class */
     template <typename epicsType> asynStatus readArray(asynUser *pasynUser, epicsType *value, 
                                         size_t nElements, size_t *nIn, NDDataType_t outputType);
     template <typename epicsType, typename interruptType> void arrayInterruptCallback(NDArray *pArray, 
-                            NDArrayPool *pNDArrayPool, 
-                            void *interruptPvt, int *initialized, NDDataType_t signedType);
-                                        
+                            NDArray **pConverted,
+                            void *interruptPvt, NDDataType_t signedType);
+    int convertArray(NDArray *pArray, NDDataType_t dataType, NDArray **pConverted);
+    int downsampleArray(NDArray *pArray, int binning, NDArray **ppOut);
+    void releaseConverted(NDArray **pConverted);
+
+    NDArray *pConverted_[NDFloat64+1]; /**< pArrays[0] converted to each data type that has been read */
 };
 
 #endif
@@ -0,0 +1,223 @@
+/*
+ * NDPluginTcpSend.cpp
+ *
+ * Plugin that sends NDArrays to an NDTcpReceiver in another IOC over TCP.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginTcpSend.h"
+
+static const char *driverName="NDPluginTcpSend";
+
+/** Time between attempts to connect to the receiver in seconds */
+#define TCP_SEND_CONNECT_RETRY 1.0
+
+/** Connects to the receiver if the plugin is not connected, at most once every TCP_SEND_CONNECT_RETRY seconds.
+  * This is called without the lock.
+  * \param[in] server The address of the receiver, host:port.
+  * \return true if the plugin is connected. */
+bool NDPluginTcpSend::connectToServer(const char *server)
+{
+    epicsTimeStamp now;
+
+    if (stream_.connected()) return true;
+    epicsTimeGetCurrent(&now);
+    if ((strlen(server) == 0) || (epicsTimeDiffInSeconds(&now, &lastConnect_) < TCP_SEND_CONNECT_RETRY)) return false;
+    lastConnect_ = now;
+    credits_ = 0;
+    return stream_.connect(server) == ND_SUCCESS;
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * It sends the array to the receiver if the receiver has a credit for it, waiting up to TcpSendTimeout for one.
+  * Otherwise the array is dropped and counted in TcpSendNumDropped.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginTcpSend::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  It unlocks it while it sends the array. */
+    char server[256];
+    double timeout;
+    size_t bytes = 0;
+    bool reconnect, connected, sent = false;
+    int credits, count;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getStringParam(NDPluginTcpSendServer, sizeof(server), server);
+    getDoubleParam(NDPluginTcpSendTimeout, &timeout);
+    reconnect = reconnect_;
+    reconnect_ = false;
+    if (reconnect) {
+        /* Connect to the new receiver at once */
+        lastConnect_.secPastEpoch = 0;
+        lastConnect_.nsec = 0;
+    }
+
+    this->unlock();
+    if (reconnect) stream_.close();
+    connected = connectToServer(server);
+    if (connected) {
+        /* Wait for a credit only if there is none left */
+        credits = stream_.receiveCredits((credits_ > 0) ? 0. : timeout);
+        if (credits >= 0) credits_ += credits;
+        if (credits_ > 0) {
+            sent = (stream_.sendArray(pArray, &bytes) == ND_SUCCESS);
+            if (sent) credits_--;
+        }
+        connected = stream_.connected();
+    }
+    this->lock();
+
+    if (sent) {
+        bytesSent_ += bytes;
+        getIntegerParam(NDPluginTcpSendNumSent, &count);
+        setIntegerParam(NDPluginTcpSendNumSent, count+1);
+        setDoubleParam(NDPluginTcpSendMBytes, bytesSent_/1e6);
+    } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s %s, dropped array uniqueId=%d\n",
+            driverName, functionName, connected ? "no credit from the receiver" : "not connected",
+            pArray->uniqueId);
+        getIntegerParam(NDPluginTcpSendNumDropped, &count);
+        setIntegerParam(NDPluginTcpSendNumDropped, count+1);
+    }
+    setIntegerParam(NDPluginTcpSendConnected, connected ? 1 : 0);
+    setIntegerParam(NDPluginTcpSendCredits, connected ? credits_ : 0);
+
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    callParamCallbacks();
+}
+
+/** Called when asyn clients call pasynOctet->write().
+  * Changing TcpSendServer makes the plugin connect to the new receiver with the next array.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPluginTcpSend::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+
+    if (function == NDPluginTcpSendServer) reconnect_ = true;
+    return NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+}
+
+/** Constructor for NDPluginTcpSend; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] server The address of the NDTcpReceiver, host:port.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginTcpSend::NDPluginTcpSend(const char *portName, int queueSize, int blockingCallbacks,
+                                 const char *NDArrayPort, int NDArrayAddr, const char *server,
+                                 int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, 1),
+      credits_(0), reconnect_(false), bytesSent_(0.)
+{
+    //static const char *functionName = "NDPluginTcpSend";
+
+    createParam(NDPluginTcpSendServerString,     asynParamOctet,   &NDPluginTcpSendServer);
+    createParam(NDPluginTcpSendConnectedString,  asynParamInt32,   &NDPluginTcpSendConnected);
+    createParam(NDPluginTcpSendCreditsString,    asynParamInt32,   &NDPluginTcpSendCredits);
+    createParam(NDPluginTcpSendTimeoutString,    asynParamFloat64, &NDPluginTcpSendTimeout);
+    createParam(NDPluginTcpSendNumSentString,    asynParamInt32,   &NDPluginTcpSendNumSent);
+    createParam(NDPluginTcpSendNumDroppedString, asynParamInt32,   &NDPluginTcpSendNumDropped);
+    createParam(NDPluginTcpSendMBytesString,     asynParamFloat64, &NDPluginTcpSendMBytes);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginTcpSend");
+    setStringParam(NDPluginTcpSendServer, server ? server : "");
+    setIntegerParam(NDPluginTcpSendConnected, 0);
+    setIntegerParam(NDPluginTcpSendCredits, 0);
+    setDoubleParam(NDPluginTcpSendTimeout, 1.0);
+    setIntegerParam(NDPluginTcpSendNumSent, 0);
+    setIntegerParam(NDPluginTcpSendNumDropped, 0);
+    setDoubleParam(NDPluginTcpSendMBytes, 0.);
+    lastConnect_.secPastEpoch = 0;
+    lastConnect_.nsec = 0;
+
+    // This plugin sends arrays over TCP, not with callbacks, so disable ArrayCallbacks by default
+    setIntegerParam(NDArrayCallbacks, 0);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/** Configuration command */
+extern "C" int NDTcpSendConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                  const char *NDArrayPort, int NDArrayAddr, const char *server,
+                                  int maxBuffers, size_t maxMemory, int priority, int stackSize)
+{
+    NDPluginTcpSend *pPlugin = new NDPluginTcpSend(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                                   server, maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "server",iocshArgString};
+static const iocshArg initArg6 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg7 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg8 = { "priority",iocshArgInt};
+static const iocshArg initArg9 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDTcpSendConfigure",10,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDTcpSendConfigure(args[0].sval, args[1].ival, args[2].ival,
+                       args[3].sval, args[4].ival, args[5].sval,
+                       args[6].ival, args[7].ival, args[8].ival,
+                       args[9].ival);
+}
+
+extern "C" void NDTcpSendRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDTcpSendRegister);
+}
@@ -0,0 +1,52 @@
+#ifndef NDPluginTcpSend_H
+#define NDPluginTcpSend_H
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "NDPluginDriver.h"
+#include "NDTcpStream.h"
+
+#define NDPluginTcpSendServerString     "TCP_SEND_SERVER"     /* (asynOctet,   r/w) Address of the receiver, host:port */
+#define NDPluginTcpSendConnectedString  "TCP_SEND_CONNECTED"  /* (asynInt32,   r/o) Connected to the receiver */
+#define NDPluginTcpSendCreditsString    "TCP_SEND_CREDITS"    /* (asynInt32,   r/o) Arrays the receiver can accept */
+#define NDPluginTcpSendTimeoutString    "TCP_SEND_TIMEOUT"    /* (asynFloat64, r/w) Time to wait for a credit in seconds */
+#define NDPluginTcpSendNumSentString    "TCP_SEND_NUM_SENT"   /* (asynInt32,   r/w) Number of arrays sent */
+#define NDPluginTcpSendNumDroppedString "TCP_SEND_NUM_DROPPED" /* (asynInt32,  r/w) Number of arrays dropped for lack of
+                                                              *  a credit or a connection */
+#define NDPluginTcpSendMBytesString     "TCP_SEND_MBYTES"     /* (asynFloat64, r/o) Total data sent in MB */
+
+/** Sends NDArrays to an NDTcpReceiver driver in another IOC over TCP.
+  * The header, the attributes and the data of each array are sent with one gathering system call, without copying
+  * the data.  The plugin only sends an array when the receiver has given it a credit, and otherwise waits up to
+  * TcpSendTimeout, so a slow receiver makes the input queue of this plugin fill rather than the network buffers. */
+class epicsShareClass NDPluginTcpSend : public NDPluginDriver {
+public:
+    NDPluginTcpSend(const char *portName, int queueSize, int blockingCallbacks,
+                    const char *NDArrayPort, int NDArrayAddr, const char *server,
+                    int maxBuffers, size_t maxMemory, int priority, int stackSize);
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
+
+protected:
+    int NDPluginTcpSendServer;
+    #define FIRST_NDPLUGIN_TCP_SEND_PARAM NDPluginTcpSendServer
+    int NDPluginTcpSendConnected;
+    int NDPluginTcpSendCredits;
+    int NDPluginTcpSendTimeout;
+    int NDPluginTcpSendNumSent;
+    int NDPluginTcpSendNumDropped;
+    int NDPluginTcpSendMBytes;
+
+private:
+    bool connectToServer(const char *server);
+    NDTcpStream stream_;          /**< The connection; only used by the plugin thread, the plugin has 1 thread */
+    int credits_;                 /**< Arrays the receiver can accept */
+    bool reconnect_;              /**< The server changed, so the connection must be made again */
+    epicsTimeStamp lastConnect_;  /**< The last attempt to connect */
+    double bytesSent_;            /**< Total bytes sent */
+};
+
+#endif
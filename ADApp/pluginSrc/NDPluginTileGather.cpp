@@ -0,0 +1,371 @@
+/*
+ * NDPluginTileGather.cpp
+ *
+ * A plugin that reassembles the tiles cut by NDPluginTileSplit, after they have been processed by other plugins,
+ * into the full arrays
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTypes.h>
+#include <epicsMessageQueue.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginTileSplit.h"
+#include "NDPluginTileGather.h"
+
+static const char *driverName="NDPluginTileGather";
+
+/* The NDTile attributes, which are removed from the reassembled frame */
+static const char *tileAttributes[] = {NDTileIndexAttrName, NDTileCountAttrName,
+                                       NDTileOffsetXAttrName, NDTileOffsetYAttrName,
+                                       NDTileFrameSizeXAttrName, NDTileFrameSizeYAttrName};
+#define NUM_TILE_ATTRIBUTES (int)(sizeof(tileAttributes)/sizeof(tileAttributes[0]))
+
+/** Reads the NDTile attributes of an array.
+  * \param[in] pArray The array.
+  * \param[out] pValues The values, in the order of tileAttributes.
+  * \return ND_SUCCESS if the array has all of the attributes, i.e. it is a tile. */
+static int getTileAttributes(NDArray *pArray, epicsInt32 *pValues)
+{
+    NDAttribute *pAttribute;
+    int i;
+
+    for (i=0; i<NUM_TILE_ATTRIBUTES; i++) {
+        pAttribute = pArray->pAttributeList->find(tileAttributes[i]);
+        if (!pAttribute || (pAttribute->getValue(NDAttrInt32, &pValues[i]) != ND_SUCCESS)) return ND_ERROR;
+    }
+    return ND_SUCCESS;
+}
+
+/** Copies a tile into its region of the frame.  The tile and the frame can be strided views.
+  * \param[in] pTile The tile.
+  * \param[in] pFrame The frame, with the same ndims and dataType as the tile.
+  * \param[in] offsets The offset of the tile in each dimension of the frame. */
+static void copyTile(NDArray *pTile, NDArray *pFrame, const size_t *offsets)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t tileStrides[ND_ARRAY_MAX_DIMS], frameStrides[ND_ARRAY_MAX_DIMS];
+    size_t index[ND_ARRAY_MAX_DIMS];
+    size_t rowSize = pTile->dims[0].size;
+    size_t src, dst, i;
+    const char *pSrc = (const char *)pTile->pData;
+    char *pDst = (char *)pFrame->pData;
+    int bytes;
+    int dim;
+
+    pTile->getInfo(&arrayInfo);
+    bytes = arrayInfo.bytesPerElement;
+    pTile->getStrides(tileStrides);
+    pFrame->getStrides(frameStrides);
+    memset(index, 0, sizeof(index));
+    /* Copy the tile one row of the first dimension at a time */
+    while (1) {
+        src = 0;
+        dst = offsets[0] * frameStrides[0];
+        for (dim=1; dim<pTile->ndims; dim++) {
+            src += index[dim] * tileStrides[dim];
+            dst += (offsets[dim] + index[dim]) * frameStrides[dim];
+        }
+        if ((tileStrides[0] == 1) && (frameStrides[0] == 1)) {
+            memcpy(pDst + dst*bytes, pSrc + src*bytes, rowSize*bytes);
+        } else {
+            for (i=0; i<rowSize; i++) {
+                memcpy(pDst + (dst + i*frameStrides[0])*bytes, pSrc + (src + i*tileStrides[0])*bytes, bytes);
+            }
+        }
+        for (dim=1; dim<pTile->ndims; dim++) {
+            if (++index[dim] < pTile->dims[dim].size) break;
+            index[dim] = 0;
+        }
+        if (dim >= pTile->ndims) break;
+    }
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * The tiles of each frame are copied into a frame of the size given by their NDTile attributes, at their
+  * offsets.  The frame is output when all TileCount tiles have arrived, in the order of GatherMode.
+  * Each tile must still have the size and the data type that NDPluginTileSplit gave it, so this is for plugins
+  * that work on each pixel, or on a neighbourhood within the tile, rather than plugins that move the pixels.
+  * Arrays that are not tiles are passed on unchanged.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginTileGather::processCallbacks(NDArray *pArray)
+{
+    /* This function is called with the mutex already locked.  The tiles are copied with the lock held, because
+     * the plugin has 1 thread, and writeInt32() can drop the frames.
+     */
+    epicsInt32 tile[NUM_TILE_ATTRIBUTES];
+    std::map<int, NDTileGatherFrame_t>::iterator it;
+    NDTileGatherFrame_t *pEntry = NULL;
+    NDArrayInfo_t tileInfo;
+    NDArray *pFrame = NULL;
+    size_t offsets[ND_ARRAY_MAX_DIMS];
+    int maxFrames, badTiles;
+    int tileIndex, tileCount;
+    int dim;
+    bool valid;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    if (getTileAttributes(pArray, tile) != ND_SUCCESS) {
+        outputFrame(pArray);
+        return;
+    }
+    tileIndex = tile[0];
+    tileCount = tile[1];
+    pArray->getInfo(&tileInfo);
+
+    it = frames_.find(pArray->uniqueId);
+    if ((it == frames_.end()) && (tileCount > 0) && (tile[4] > 0) && (tile[5] > 0)) {
+        pFrame = allocFrame(pArray, tile[4], tile[5]);
+        if (!pFrame) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s: Couldn't allocate frame for uniqueId=%d\n",
+                driverName, functionName, pArray->uniqueId);
+            return;
+        }
+        it = frames_.insert(std::make_pair(pArray->uniqueId, NDTileGatherFrame_t())).first;
+        it->second.pFrame = pFrame;
+        it->second.received.assign(tileCount, false);
+        it->second.numReceived = 0;
+        getIntegerParam(NDPluginTileGatherMaxFrames, &maxFrames);
+        if (maxFrames < 1) maxFrames = 1;
+        dropFrames(maxFrames);
+        it = frames_.find(pArray->uniqueId);
+    }
+
+    /* The tile must fit its frame, and not have been copied already */
+    valid = (it != frames_.end());
+    if (valid) {
+        pEntry = &it->second;
+        pFrame = pEntry->pFrame;
+        valid = (tileCount == (int)pEntry->received.size()) && (tileIndex >= 0) && (tileIndex < tileCount) &&
+                !pEntry->received[tileIndex] &&
+                (pArray->ndims == pFrame->ndims) && (pArray->dataType == pFrame->dataType);
+        for (dim=0; valid && (dim<pArray->ndims); dim++) {
+            offsets[dim] = 0;
+            if (dim == tileInfo.xDim) offsets[dim] = tile[2];
+            else if ((dim == tileInfo.yDim) && (pArray->ndims > 1)) offsets[dim] = tile[3];
+            if (offsets[dim] + pArray->dims[dim].size > pFrame->dims[dim].size) valid = false;
+        }
+    }
+    if (!valid) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s: Tile %d of %d of uniqueId=%d does not fit the frame\n",
+            driverName, functionName, tileIndex, tileCount, pArray->uniqueId);
+        getIntegerParam(NDPluginTileGatherBadTiles, &badTiles);
+        setIntegerParam(NDPluginTileGatherBadTiles, badTiles+1);
+        callParamCallbacks();
+        return;
+    }
+
+    copyTile(pArray, pFrame, offsets);
+    pEntry->received[tileIndex] = true;
+    if (++pEntry->numReceived == tileCount) {
+        frames_.erase(it);
+        outputFrame(pFrame);
+        pFrame->release();
+    }
+    setIntegerParam(NDPluginTileGatherFrames, (int)frames_.size());
+    callParamCallbacks();
+}
+
+/** Allocates the frame that the tiles of an array are copied into.
+  * It has the dimensions and the data type of the tile except for the X and Y sizes, and the uniqueId, time stamps
+  * and attributes of the tile apart from the NDTile attributes.
+  * \param[in] pTile The first tile of the frame that has arrived.
+  * \param[in] frameSizeX The X size of the frame.
+  * \param[in] frameSizeY The Y size of the frame. */
+NDArray* NDPluginTileGather::allocFrame(NDArray *pTile, size_t frameSizeX, size_t frameSizeY)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pFrame = NULL;
+    int i;
+
+    pTile->getInfo(&arrayInfo);
+    for (i=0; i<pTile->ndims; i++) dims[i] = pTile->dims[i].size;
+    dims[arrayInfo.xDim] = frameSizeX;
+    if (pTile->ndims > 1) dims[arrayInfo.yDim] = frameSizeY;
+    pFrame = this->pNDArrayPool->alloc(pTile->ndims, dims, pTile->dataType, 0, NULL);
+    if (!pFrame) return NULL;
+    pFrame->uniqueId = pTile->uniqueId;
+    pFrame->timeStamp = pTile->timeStamp;
+    pFrame->epicsTS = pTile->epicsTS;
+    pFrame->pAttributeList->clear();
+    pTile->pAttributeList->copy(pFrame->pAttributeList);
+    for (i=0; i<NUM_TILE_ATTRIBUTES; i++) pFrame->pAttributeList->remove(tileAttributes[i]);
+    return pFrame;
+}
+
+/** Outputs a frame, or an array that is not a tile, in the order of GatherMode.
+  * \param[in] pFrame The frame; the caller keeps its reference. */
+void NDPluginTileGather::outputFrame(NDArray *pFrame)
+{
+    int mode;
+
+    getIntegerParam(NDPluginGatherMode, &mode);
+    if (mode == NDGatherOrdered) {
+        orderArray(-1, pFrame);
+    } else {
+        NDPluginDriver::endProcessCallbacks(pFrame, true, true);
+    }
+}
+
+/** Drops the frames with the lowest uniqueIds, which have not received all of their tiles, until there are
+  * no more than maxFrames.  These are counted in TileGatherIncomplete.
+  * \param[in] maxFrames The number of frames to keep. */
+void NDPluginTileGather::dropFrames(size_t maxFrames)
+{
+    int incomplete;
+
+    getIntegerParam(NDPluginTileGatherIncomplete, &incomplete);
+    while (frames_.size() > maxFrames) {
+        frames_.begin()->second.pFrame->release();
+        frames_.erase(frames_.begin());
+        incomplete++;
+    }
+    setIntegerParam(NDPluginTileGatherIncomplete, incomplete);
+    setIntegerParam(NDPluginTileGatherFrames, (int)frames_.size());
+}
+
+/** Called by the input ports with each array.
+  * The tiles always go through the input queue, GatherMode orders the frames that are reassembled from them.
+  * \param[in] pasynUser  The pasynUser from the asyn client.
+  * \param[in] genericPointer The pointer to the NDArray */
+void NDPluginTileGather::driverCallback(asynUser *pasynUser, void *genericPointer)
+{
+    NDPluginDriver::driverCallback(pasynUser, genericPointer);
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Lowering TileGatherMaxFrames drops the oldest frames.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginTileGather::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDPLUGIN_TILE_GATHER_PARAM) return NDPluginGather::writeInt32(pasynUser, value);
+
+    if (function == NDPluginTileGatherMaxFrames) {
+        if (value < 1) value = 1;
+        status = (asynStatus) setIntegerParam(function, value);
+        dropFrames(value);
+    } else {
+        status = (asynStatus) setIntegerParam(function, value);
+    }
+    callParamCallbacks();
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDPluginTileGather; most parameters are simply passed to NDPluginGather::NDPluginGather.
+  *
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.  Each frame is TilesX*TilesY tiles, so this should be larger
+  *            than for NDPluginGather.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] maxPorts  Maximum number of ports that this plugin can connected to for callbacks
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginTileGather::NDPluginTileGather(const char *portName, int queueSize, int blockingCallbacks,
+                                       int maxPorts,
+                                       int maxBuffers, size_t maxMemory,
+                                       int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginGather(portName, queueSize, blockingCallbacks, maxPorts,
+                     maxBuffers, maxMemory, priority, stackSize)
+{
+    //static const char *functionName = "NDPluginTileGather";
+
+    createParam(NDPluginTileGatherMaxFramesString,   asynParamInt32,        &NDPluginTileGatherMaxFrames);
+    createParam(NDPluginTileGatherFramesString,      asynParamInt32,        &NDPluginTileGatherFrames);
+    createParam(NDPluginTileGatherIncompleteString,  asynParamInt32,        &NDPluginTileGatherIncomplete);
+    createParam(NDPluginTileGatherBadTilesString,    asynParamInt32,        &NDPluginTileGatherBadTiles);
+    setIntegerParam(NDPluginTileGatherMaxFrames, 4);
+    setIntegerParam(NDPluginTileGatherFrames, 0);
+    setIntegerParam(NDPluginTileGatherIncomplete, 0);
+    setIntegerParam(NDPluginTileGatherBadTiles, 0);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginTileGather");
+
+    /* copyTile() copies from strided views */
+    supportsStridedViews_ = true;
+}
+
+/** Configuration command */
+extern "C" int NDTileGatherConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                     int maxPorts,
+                                     int maxBuffers, size_t maxMemory,
+                                     int priority, int stackSize)
+{
+    NDPluginTileGather *pPlugin = new NDPluginTileGather(portName, queueSize, blockingCallbacks, maxPorts,
+                                                         maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "maxPorts",iocshArgInt};
+static const iocshArg initArg4 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg5 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg6 = { "priority",iocshArgInt};
+static const iocshArg initArg7 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7};
+static const iocshFuncDef initFuncDef = {"NDTileGatherConfigure",8,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDTileGatherConfigure(args[0].sval, args[1].ival, args[2].ival,
+                        args[3].ival, args[4].ival, args[5].ival,
+                        args[6].ival, args[7].ival);
+}
+
+extern "C" void NDTileGatherRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDTileGatherRegister);
+}
@@ -0,0 +1,50 @@
+#ifndef NDPluginTileGather_H
+#define NDPluginTileGather_H
+
+#include <map>
+#include <vector>
+
+#include "NDPluginGather.h"
+
+/* Param definitions */
+#define NDPluginTileGatherMaxFramesString    "TILE_GATHER_MAX_FRAMES"    /* (asynInt32,        r/w) Frames being reassembled at once */
+#define NDPluginTileGatherFramesString       "TILE_GATHER_FRAMES"        /* (asynInt32,        r/o) Frames being reassembled */
+#define NDPluginTileGatherIncompleteString   "TILE_GATHER_INCOMPLETE"    /* (asynInt32,        r/w) Frames dropped before all tiles arrived */
+#define NDPluginTileGatherBadTilesString     "TILE_GATHER_BAD_TILES"     /* (asynInt32,        r/w) Tiles that do not fit their frame */
+
+/** A frame that NDPluginTileGather is reassembling */
+typedef struct {
+    NDArray *pFrame;                             /**< The frame the tiles are copied into */
+    std::vector<bool> received;                  /**< The tiles that have been copied, by TileIndex */
+    int numReceived;                             /**< The number of tiles that have been copied */
+} NDTileGatherFrame_t;
+
+/** A plugin that gathers the tiles that NDPluginTileSplit cut from each array, after other plugins have processed
+  * them, and reassembles them into the full array.  Arrays that are not tiles are passed on as by NDPluginGather. */
+class epicsShareClass NDPluginTileGather : public NDPluginGather {
+public:
+    NDPluginTileGather(const char *portName, int queueSize, int blockingCallbacks,
+                       int maxPorts,
+                       int maxBuffers, size_t maxMemory,
+                       int priority, int stackSize);
+    virtual void driverCallback(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    /* These methods override the virtual methods in the base class */
+    virtual void processCallbacks(NDArray *pArray);
+
+    int NDPluginTileGatherMaxFrames;
+    #define FIRST_NDPLUGIN_TILE_GATHER_PARAM NDPluginTileGatherMaxFrames
+    int NDPluginTileGatherFrames;
+    int NDPluginTileGatherIncomplete;
+    int NDPluginTileGatherBadTiles;
+
+private:
+    NDArray *allocFrame(NDArray *pTile, size_t frameSizeX, size_t frameSizeY);
+    void outputFrame(NDArray *pFrame);
+    void dropFrames(size_t maxFrames);
+    std::map<int, NDTileGatherFrame_t> frames_;  /**< The frames being reassembled, keyed on uniqueId */
+};
+
+#endif
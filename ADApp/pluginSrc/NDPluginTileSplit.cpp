@@ -0,0 +1,216 @@
+/*
+ * NDPluginTileSplit.cpp
+ *
+ * Cut each array into tiles and do the callback for each tile only to one registered client
+ *
+ * The tiles are reassembled into the full array by NDPluginTileGather.
+ */
+
+#include <stdlib.h>
+
+#include <epicsTypes.h>
+#include <epicsMessageQueue.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginTileSplit.h"
+
+static const char *driverName="NDPluginTileSplit";
+
+/** Cuts the array into TilesX by TilesY tiles and passes each tile to one client, chosen with ScatterMethod.
+  * Each tile is a view of the region of the array in X and Y; it has all of the other dimensions, e.g. the colors.
+  * The tiles are in row order, and carry the NDTile attributes that NDPluginTileGather needs to reassemble them.
+  * The tiles along X are only contiguous if TilesX=1; clients that do not handle strided views make a contiguous
+  * copy of each tile.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginTileSplit::processCallbacks(NDArray *pArray)
+{
+    /*
+     * This function is called with the mutex already locked.  It unlocks it during long calculations when private
+     * structures don't need to be protected.
+     */
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDArrayInfo_t arrayInfo;
+    NDArray *pTile;
+    int arrayCallbacks, method;
+    int tilesX, tilesY;
+    int ix, iy, i;
+    epicsInt32 tileIndex, tileCount, offsetX, offsetY, frameSizeX, frameSizeY;
+
+    static const char *functionName = "NDPluginTileSplit::processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    getIntegerParam(NDPluginScatterMethod, &method);
+    getIntegerParam(NDPluginTileSplitTilesX, &tilesX);
+    getIntegerParam(NDPluginTileSplitTilesY, &tilesY);
+    if (arrayCallbacks != 1) return;
+
+    pArray->getInfo(&arrayInfo);
+    /* A 1-D array only has an X dimension */
+    if (pArray->ndims < 2) tilesY = 1;
+    if (tilesX < 1) tilesX = 1;
+    if (tilesY < 1) tilesY = 1;
+    if (tilesX > (int)arrayInfo.xSize) tilesX = (int)arrayInfo.xSize;
+    if (tilesY > (int)arrayInfo.ySize) tilesY = (int)arrayInfo.ySize;
+    tileCount  = tilesX * tilesY;
+    frameSizeX = (epicsInt32)arrayInfo.xSize;
+    frameSizeY = (epicsInt32)arrayInfo.ySize;
+
+    for (i=0; i<pArray->ndims; i++) {
+        pArray->initDimension(&dims[i], pArray->dims[i].size);
+    }
+    tiles_.clear();
+    for (iy=0; iy<tilesY; iy++) {
+        for (ix=0; ix<tilesX; ix++) {
+            /* The remainder is spread over the tiles, so their sizes differ by at most 1 */
+            offsetX = (epicsInt32)(ix * arrayInfo.xSize / tilesX);
+            dims[arrayInfo.xDim].offset = offsetX;
+            dims[arrayInfo.xDim].size = (ix+1) * arrayInfo.xSize / tilesX - offsetX;
+            offsetY = 0;
+            if (pArray->ndims > 1) {
+                offsetY = (epicsInt32)(iy * arrayInfo.ySize / tilesY);
+                dims[arrayInfo.yDim].offset = offsetY;
+                dims[arrayInfo.yDim].size = (iy+1) * arrayInfo.ySize / tilesY - offsetY;
+            }
+            if ((ix == 0) && (iy == 0)) {
+                setIntegerParam(NDPluginTileSplitSizeX, (int)dims[arrayInfo.xDim].size);
+                setIntegerParam(NDPluginTileSplitSizeY, (pArray->ndims > 1) ? (int)dims[arrayInfo.yDim].size : 1);
+            }
+            pTile = this->pNDArrayPool->createView(pArray, dims);
+            if (NULL == pTile) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s: Couldn't create tile %d of array uniqueId=%d. Further processing terminated.\n",
+                    driverName, functionName, (int)tiles_.size(), pArray->uniqueId);
+                for (i=0; i<(int)tiles_.size(); i++) tiles_[i]->release();
+                tiles_.clear();
+                return;
+            }
+            this->getAttributes(pTile->pAttributeList);
+            tileIndex = (epicsInt32)tiles_.size();
+            pTile->pAttributeList->add(NDTileIndexAttrName,      "Tile index",      NDAttrInt32, &tileIndex);
+            pTile->pAttributeList->add(NDTileCountAttrName,      "Tile count",      NDAttrInt32, &tileCount);
+            pTile->pAttributeList->add(NDTileOffsetXAttrName,    "Tile X offset",   NDAttrInt32, &offsetX);
+            pTile->pAttributeList->add(NDTileOffsetYAttrName,    "Tile Y offset",   NDAttrInt32, &offsetY);
+            pTile->pAttributeList->add(NDTileFrameSizeXAttrName, "Frame X size",    NDAttrInt32, &frameSizeX);
+            pTile->pAttributeList->add(NDTileFrameSizeYAttrName, "Frame Y size",    NDAttrInt32, &frameSizeY);
+            tiles_.push_back(pTile);
+        }
+    }
+
+    this->unlock();
+    for (i=0; i<tileCount; i++) {
+        if (method == NDScatterRoundRobin) {
+            doNDArrayCallbacks(tiles_[i], NDArrayData, 0);
+        } else {
+            doLoadCallbacks(tiles_[i], NDArrayData, 0, method);
+        }
+    }
+    this->lock();
+    /* Keep the last tile in pArrays[0], as NDPluginScatter keeps the last array */
+    for (i=0; i<tileCount-1; i++) tiles_[i]->release();
+    if (this->pArrays[0]) this->pArrays[0]->release();
+    this->pArrays[0] = tiles_[tileCount-1];
+    tiles_.clear();
+    callParamCallbacks();
+}
+
+/** Constructor for NDPluginTileSplit; all parameters are simply passed to NDPluginScatter::NDPluginScatter.
+  *
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginTileSplit::NDPluginTileSplit(const char *portName, int queueSize, int blockingCallbacks,
+                                     const char *NDArrayPort, int NDArrayAddr,
+                                     int maxBuffers, size_t maxMemory,
+                                     int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginScatter(portName, queueSize, blockingCallbacks,
+                      NDArrayPort, NDArrayAddr, maxBuffers, maxMemory,
+                      priority, stackSize)
+{
+    //static const char *functionName = "NDPluginTileSplit::NDPluginTileSplit";
+
+    createParam(NDPluginTileSplitTilesXString,       asynParamInt32,        &NDPluginTileSplitTilesX);
+    createParam(NDPluginTileSplitTilesYString,       asynParamInt32,        &NDPluginTileSplitTilesY);
+    createParam(NDPluginTileSplitSizeXString,        asynParamInt32,        &NDPluginTileSplitSizeX);
+    createParam(NDPluginTileSplitSizeYString,        asynParamInt32,        &NDPluginTileSplitSizeY);
+    setIntegerParam(NDPluginTileSplitTilesX, 1);
+    setIntegerParam(NDPluginTileSplitTilesY, 1);
+    setIntegerParam(NDPluginTileSplitSizeX, 0);
+    setIntegerParam(NDPluginTileSplitSizeY, 0);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginTileSplit");
+
+    /* createView() also cuts tiles from a view */
+    supportsStridedViews_ = true;
+}
+
+/** Configuration command */
+extern "C" int NDTileSplitConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                    const char *NDArrayPort, int NDArrayAddr,
+                                    int maxBuffers, size_t maxMemory,
+                                    int priority, int stackSize)
+{
+    NDPluginTileSplit *pPlugin = new NDPluginTileSplit(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                                       maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8};
+static const iocshFuncDef initFuncDef = {"NDTileSplitConfigure",9,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDTileSplitConfigure(args[0].sval, args[1].ival, args[2].ival,
+                       args[3].sval, args[4].ival, args[5].ival,
+                       args[6].ival, args[7].ival, args[8].ival);
+}
+
+extern "C" void NDTileSplitRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDTileSplitRegister);
+}
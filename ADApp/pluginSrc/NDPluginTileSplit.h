@@ -0,0 +1,42 @@
+#ifndef NDPluginTileSplit_H
+#define NDPluginTileSplit_H
+
+#include "NDPluginScatter.h"
+
+/* General parameters */
+#define NDPluginTileSplitTilesXString        "TILE_SPLIT_TILES_X"        /* (asynInt32,        r/w) Number of tiles in X */
+#define NDPluginTileSplitTilesYString        "TILE_SPLIT_TILES_Y"        /* (asynInt32,        r/w) Number of tiles in Y */
+#define NDPluginTileSplitSizeXString         "TILE_SPLIT_SIZE_X"         /* (asynInt32,        r/o) X size of the first tile */
+#define NDPluginTileSplitSizeYString         "TILE_SPLIT_SIZE_Y"         /* (asynInt32,        r/o) Y size of the first tile */
+
+/* The attributes that NDPluginTileSplit adds to each tile, and that NDPluginTileGather uses to reassemble the frame */
+#define NDTileIndexAttrName                  "TileIndex"                 /* Index of the tile in the frame, 0 to TileCount-1 */
+#define NDTileCountAttrName                  "TileCount"                 /* Number of tiles in the frame */
+#define NDTileOffsetXAttrName                "TileOffsetX"               /* X offset of the tile in the frame */
+#define NDTileOffsetYAttrName                "TileOffsetY"               /* Y offset of the tile in the frame */
+#define NDTileFrameSizeXAttrName             "TileFrameSizeX"            /* X size of the frame */
+#define NDTileFrameSizeYAttrName             "TileFrameSizeY"            /* Y size of the frame */
+
+/** A plugin that cuts each NDArray into tiles and passes each tile to one downstream plugin, as NDPluginScatter does
+  * with whole arrays.  The tiles are views that share the data of the array. */
+class epicsShareClass NDPluginTileSplit : public NDPluginScatter {
+public:
+    NDPluginTileSplit(const char *portName, int queueSize, int blockingCallbacks,
+                      const char *NDArrayPort, int NDArrayAddr,
+                      int maxBuffers, size_t maxMemory,
+                      int priority, int stackSize);
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+
+protected:
+    int NDPluginTileSplitTilesX;
+    #define FIRST_NDPLUGIN_TILE_SPLIT_PARAM NDPluginTileSplitTilesX
+    int NDPluginTileSplitTilesY;
+    int NDPluginTileSplitSizeX;
+    int NDPluginTileSplitSizeY;
+
+private:
+    std::vector<NDArray *> tiles_;             /**< The tiles of the current array; the plugin has 1 thread */
+};
+
+#endif
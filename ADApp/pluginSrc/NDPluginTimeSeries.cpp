@@ -26,6 +26,7 @@
 #include <epicsExport.h>
 
 #include "NDPluginTimeSeries.h"
+#include "NDTimeSeriesKernels.h"
 
 #define DEFAULT_NUM_TSPOINTS 2048
 
@@ -137,7 +138,8 @@ void NDPluginTimeSeries::allocateArrays()
   timeStamp_  = (double *)calloc(numSignals_*numTimePoints_, sizeof(double));
   signalData_ = (double *)calloc(numSignals_*numTimePoints_, sizeof(double));
   nDims = 2;
-  dims[0] = numTimePoints_;
+  // Each signal is stored twice in a row, see doAddToTimeSeriesT()
+  dims[0] = 2*numTimePoints_;
   dims[1] = numSignals_;
   pTimeCircular_ = pNDArrayPool->alloc(nDims, dims, dataType_, 0, 0);
   createAxisArray();
@@ -148,7 +150,8 @@ void NDPluginTimeSeries::acquireReset()
 {
   memset(signalData_,           0, numTimePoints_ * numSignals_ * sizeof(double));
   memset(timeStamp_,            0, numTimePoints_ * sizeof(double));
-  memset(pTimeCircular_->pData, 0, numTimePoints_ * numSignals_ * dataSize_);
+  unshareTimeCircular(false);
+  memset(pTimeCircular_->pData, 0, 2 * numTimePoints_ * numSignals_ * dataSize_);
   currentTimePoint_ = 0;
   setIntegerParam(P_TSCurrentPoint, currentTimePoint_);
   epicsTimeGetCurrent(&startTime_);
@@ -170,6 +173,51 @@ void NDPluginTimeSeries::createAxisArray()
   doCallbacksFloat64Array(timeAxis_, numTimePoints_, P_TSTimeAxis, 0);
 }
 
+/** Makes sure that no published array uses the circular buffer before it is modified.
+  * The arrays that doTimeSeriesCallbacks() publishes are views of the buffer, so while downstream plugins
+  * hold any of them the buffer is replaced by a new one.  The last array, which is only kept in pArrays[0],
+  * is released instead.
+  * \param[in] copyData true to copy the time series to the new buffer.
+  * 
+eturn asynError if the new buffer cannot be allocated.
+  */
+asynStatus NDPluginTimeSeries::unshareTimeCircular(bool copyData)
+{
+  NDArray *pArray = this->pArrays[0];
+  char *pStart = (char *)pTimeCircular_->pData;
+  static const char *functionName = "NDPluginTimeSeries::unshareTimeCircular";
+
+  if (pTimeCircular_->getReferenceCount() == 1) return asynSuccess;
+  if (pArray && (pArray->getReferenceCount() == 1) && (pTimeCircular_->getReferenceCount() == 2) &&
+      ((char *)pArray->pData >= pStart) && ((char *)pArray->pData < pStart + pTimeCircular_->dataSize)) {
+    pArray->release();
+    this->pArrays[0] = NULL;
+    return asynSuccess;
+  }
+  pArray = pNDArrayPool->copy(pTimeCircular_, NULL, copyData);
+  if (!pArray) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s: error allocating the circular buffer\n",
+      functionName);
+    return asynError;
+  }
+  pTimeCircular_->release();
+  pTimeCircular_ = pArray;
+  return asynSuccess;
+}
+
+/**
+ * Returns the time stamp of a time of an array.  The times of a frame stack, see NDArray::stackFrames, are its
+ * frames, which each have their own time stamp; the other arrays have one time stamp for all of their times.
+ * \param[in] pArray The pointer to the NDArray object
+ * \param[in] row The row of the time in the array
+ */
+static double rowTimeStamp(NDArray *pArray, int row)
+{
+  if ((row >= 0) && ((size_t)row < pArray->stackFrames.size())) return pArray->stackFrames[row].timeStamp;
+  return pArray->timeStamp;
+}
+
 /**
  * Templated function to append to time series on different NDArray data types.
  * \param[in] NDArray The pointer to the NDArray object
@@ -179,31 +227,61 @@ template <typename epicsType>
 asynStatus NDPluginTimeSeries::doAddToTimeSeriesT(NDArray *pArray)
 {
   epicsType *pData         = (epicsType *)pArray->pData;
-  epicsType *pIn; 
   epicsType *pTimeCircular = (epicsType *)pTimeCircular_->pData;
   int signal;
   int i;
   int numTimes = 1;
+  int row = 0;
+  int numRows, numPoints;
+  int lastRow, rowStep;
+  size_t rowStride = 2*numTimePoints_;
   epicsTimeStamp timeNow;
   double elapsedTime;
   
   if (pArray->ndims == 2) numTimes = (int)pArray->dims[1].size;
   
-  for (i=0; i<numTimes; i++) {
-    pIn = pData + i*numSignalsIn_;
-    for (signal=0; signal<numSignals_; signal++) {
-      averageStore_[signal] += (epicsFloat64)*pIn++;
-    }
-    numAveraged_++;
-    if (numAveraged_ < numAverage_) continue;
-    /* We have now collected the desired number of points to average */
-    for (signal=0; signal<numSignals_; signal++) {
-      pTimeCircular[signal * numTimePoints_ + currentTimePoint_] = (epicsType)averageStore_[signal]/numAveraged_;
-      averageStore_[signal] = 0;
+  /* Whole groups of numAverage_ time points are averaged and transposed into the circular buffer in tiles,
+   * up to its end.  A group that the array does not complete is summed in averageStore_ and is completed
+   * by the next arrays.
+   * Each signal row holds the numTimePoints_ points twice, so the numTimePoints_ points that start at
+   * currentTimePoint_ are the time series in time order, which doTimeSeriesCallbacks() publishes without
+   * copying it. */
+  while (row < numTimes) {
+    if ((numAveraged_ > 0) || (numTimes - row < numAverage_)) {
+      numRows = numAverage_ - numAveraged_;
+      if (numRows < 1) numRows = 1;
+      if (numRows > numTimes - row) numRows = numTimes - row;
+      NDTimeSeriesAccumulate(pArray->dataType, pData + row*numSignalsIn_, numSignalsIn_, numSignals_,
+                             numRows, averageStore_);
+      numAveraged_ += numRows;
+      row += numRows;
+      if (numAveraged_ < numAverage_) break;
+      /* We have now collected the desired number of points to average */
+      for (signal=0; signal<numSignals_; signal++) {
+        epicsType *pRow = pTimeCircular + signal*rowStride;
+        pRow[currentTimePoint_] = (epicsType)(averageStore_[signal]/numAveraged_);
+        pRow[numTimePoints_ + currentTimePoint_] = pRow[currentTimePoint_];
+        averageStore_[signal] = 0;
+      }
+      numAveraged_ = 0;
+      numPoints = 1;
+      lastRow = row - 1;
+      rowStep = 0;
+    } else {
+      numPoints = (numTimes - row) / numAverage_;
+      if (numPoints > numTimePoints_ - currentTimePoint_) numPoints = numTimePoints_ - currentTimePoint_;
+      NDTimeSeriesAverage(pArray->dataType, pData + row*numSignalsIn_, numSignalsIn_, numSignals_, numAverage_,
+                          numPoints, pTimeCircular + currentTimePoint_, rowStride);
+      for (signal=0; signal<numSignals_; signal++) {
+        epicsType *pRow = pTimeCircular + signal*rowStride + currentTimePoint_;
+        memcpy(pRow + numTimePoints_, pRow, numPoints*sizeof(epicsType));
+      }
+      lastRow = row + numAverage_ - 1;
+      rowStep = numAverage_;
+      row += numPoints*numAverage_;
     }
-    numAveraged_ = 0;
-    timeStamp_[currentTimePoint_] = pArray->timeStamp;
-    currentTimePoint_++;
+    /* Each point has the time stamp of the last time that it averages */
+    for (i=0; i<numPoints; i++) timeStamp_[currentTimePoint_++] = rowTimeStamp(pArray, lastRow + i*rowStep);
     if (currentTimePoint_ >= numTimePoints_) {
       if (acquireMode_ == TSAcquireModeFixed) {
         setIntegerParam(P_TSAcquire, 0);
@@ -214,7 +292,7 @@ asynStatus NDPluginTimeSeries::doAddToTimeSeriesT(NDArray *pArray)
           currentTimePoint_ = 0;
       }
     }
-  }  // for (i=0; ...)
+  }  // while (row < numTimes)
   setIntegerParam(P_TSCurrentPoint, currentTimePoint_);     
   epicsTimeGetCurrent(&timeNow);
   elapsedTime = epicsTimeDiffInSeconds(&timeNow, &startTime_);
@@ -232,6 +310,8 @@ asynStatus NDPluginTimeSeries::addToTimeSeries(NDArray *pArray)
 {
   asynStatus status = asynSuccess;
   
+  status = unshareTimeCircular(true);
+  if (status != asynSuccess) return status;
   switch(pArray->dataType) {
   case NDInt8:
     status = doAddToTimeSeriesT<epicsInt8>(pArray);
@@ -269,27 +349,24 @@ void NDPluginTimeSeries::doTimeSeriesCallbacksT()
 {
   int signal;
   int timeOut;
-  int timeIn=0;
+  int numOut = currentTimePoint_;
   epicsType *timeCircular = (epicsType *)pTimeCircular_->pData;
+  epicsType *pIn;
 
-
+  // In circular mode the oldest point is at currentTimePoint_, see doAddToTimeSeriesT()
   if (acquireMode_ == TSAcquireModeFixed) {
-    for (signal=0; signal<numSignals_; signal++) {
-      for (timeOut=0; timeOut<currentTimePoint_; timeOut++) {
-        signalData_[timeOut] = timeCircular[signal*numTimePoints_ + timeOut];
-      }
-      doCallbacksFloat64Array(signalData_, currentTimePoint_, P_TSTimeSeries, signal);
-    }
+    pIn = timeCircular;
   }
   else {
-    timeIn = currentTimePoint_;
-    for (signal=0; signal<numSignals_; signal++) {
-      for (timeOut=0; timeOut<numTimePoints_; timeOut++) {
-        signalData_[timeOut] = timeCircular[signal*numTimePoints_ + timeIn];
-        if (++timeIn >= numTimePoints_) timeIn = 0;
-      }
-      doCallbacksFloat64Array(signalData_, numTimePoints_, P_TSTimeSeries, signal);
+    pIn = timeCircular + currentTimePoint_;
+    numOut = numTimePoints_;
+  }
+  for (signal=0; signal<numSignals_; signal++) {
+    for (timeOut=0; timeOut<numOut; timeOut++) {
+      signalData_[timeOut] = pIn[timeOut];
     }
+    doCallbacksFloat64Array(signalData_, numOut, P_TSTimeSeries, signal);
+    pIn += 2*numTimePoints_;
   }
 }
 
@@ -302,10 +379,9 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
   int arrayCallbacks;
   epicsTimeStamp now;
   asynStatus status = asynSuccess;
-  char *src, *dst;
   int signal;
-  size_t dims[1]; 
-  int numCopy;
+  NDDimension_t dims[2];
+  static const char *functionName = "NDPluginTimeSeries::doTimeSeriesCallbacks";
   
   switch(dataType_) {
   case NDInt8:
@@ -341,23 +417,20 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
   if (arrayCallbacks) {
     NDArray *pArrayOut = this->pArrays[0];
     if (pArrayOut) pArrayOut->release();
-    if (acquireMode_ == TSAcquireModeFixed) {
-      pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 1);    
-    }
-    else {
-      // Shift the data so the oldest time point is the first point in the array
-      pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 0);
-      for (signal=0; signal<numSignals_; signal++) {
-        numCopy = numTimePoints_ - currentTimePoint_;
-        src = (char *)pTimeCircular_->pData + ((signal * numTimePoints_) + currentTimePoint_)*dataSize_;
-        dst = (char *)pArrayOut->pData      +  (signal * numTimePoints_)*dataSize_;
-        memcpy(dst, src, numCopy*dataSize_);
-        numCopy = currentTimePoint_;
-        src = (char *)pTimeCircular_->pData +  (signal * numTimePoints_)*dataSize_;
-        dst = (char *)pArrayOut->pData      + ((signal * numTimePoints_) + numTimePoints_ - currentTimePoint_)*dataSize_;
-        memcpy(dst, src, numCopy*dataSize_);
-      }
+    this->pArrays[0] = NULL;
+    // The output is a view of the circular buffer that starts with the oldest time point, so it is not copied;
+    // addToTimeSeries() replaces the buffer if the view is still in use when new points arrive
+    pTimeCircular_->initDimension(&dims[0], numTimePoints_);
+    pTimeCircular_->initDimension(&dims[1], numSignals_);
+    if (acquireMode_ == TSAcquireModeCircular) dims[0].offset = currentTimePoint_;
+    pArrayOut = pNDArrayPool->createView(pTimeCircular_, dims);
+    if (!pArrayOut) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s: error creating the output array\n",
+        functionName);
+      return asynError;
     }
+    pArrayOut->dims[0].offset = 0;
     this->getAttributes(pArrayOut->pAttributeList);
     getTimeStamp(&pArrayOut->epicsTS);
     epicsTimeGetCurrent(&now);
@@ -365,14 +438,14 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
     pArrayOut->uniqueId = uniqueId_++;
     doCallbacksGenericPointer(pArrayOut, NDArrayData, numSignals_);
     this->pArrays[0] = pArrayOut;
-    // Now do NDArray callbacks on 1-D arrays for each signal
-    numCopy = (int)pArrayOut->dims[0].size;
-    dims[0] = numCopy;
+    // Now do NDArray callbacks on 1-D arrays for each signal, which are views of its row
+    pArrayOut->initDimension(&dims[0], numTimePoints_);
+    pArrayOut->initDimension(&dims[1], 1);
     for (signal=0; signal<numSignals_; signal++) {
-      NDArray *pArray = pNDArrayPool->alloc(1, dims, pArrayOut->dataType, 0, 0);
-      src = (char *)pArrayOut->pData + (signal * numTimePoints_)*dataSize_;
-      dst = (char *)pArray->pData;
-      memcpy(dst, src, numCopy*dataSize_); 
+      dims[1].offset = signal;
+      NDArray *pArray = pNDArrayPool->createView(pArrayOut, dims);
+      if (!pArray) break;
+      pArray->ndims = 1;
       this->getAttributes(pArray->pAttributeList);
       pArray->epicsTS   = pArrayOut->epicsTS;
       pArray->timeStamp = pArrayOut->timeStamp;
@@ -399,7 +472,7 @@ void NDPluginTimeSeries::processCallbacks(NDArray *pArray)
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
-  // This plugin only works with 1-D or 2-D arrays
+  // This plugin only works with 1-D or 2-D arrays; a stack of 1-D frames is a 2-D array of the signals at each time
   if ((pArray->ndims < 1) || (pArray->ndims > 2)) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
       "%s: error, number of array dimensions must be 1 or 2\n",
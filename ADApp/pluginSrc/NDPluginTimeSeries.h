@@ -75,6 +75,7 @@ private:
   void acquireReset();
   void createAxisArray();
   void computeNumAverage();
+  asynStatus unshareTimeCircular(bool copyData);
 
   int maxSignals_;
   int numSignals_;
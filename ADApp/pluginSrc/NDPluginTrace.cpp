@@ -0,0 +1,188 @@
+/** NDPluginTrace.cpp
+ *
+ * Optional tracing of the path of each NDArray through the plugins, written as a Chrome trace file.
+ *
+ * Each thread records its events in its own ring buffer, so recording takes no lock.  The buffers are
+ * created the first time a thread records an event while tracing is enabled, and are never freed,
+ * because NDTraceDump() may read them after the thread has exited.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsAtomic.h>
+#include <cantProceed.h>
+
+#include "NDPluginTrace.h"
+
+typedef struct {
+  epicsTimeStamp time;
+  const char *portName;       /**< The port names of plugins exist for the life of the IOC */
+  int event;
+  int uniqueId;
+} traceEvent_t;
+
+typedef struct traceBuffer {
+  struct traceBuffer *pNext;
+  char threadName[32];
+  int numEvents;
+  size_t nextEvent;           /**< Only written by the owning thread; events nextEvent-numEvents to nextEvent-1 are valid */
+  traceEvent_t *pEvents;
+} traceBuffer_t;
+
+static epicsThreadOnceId traceOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId traceLock;             /**< Protects traceBuffers and the creation of buffers */
+static epicsThreadPrivateId traceBufferId;
+static traceBuffer_t *traceBuffers = 0;
+static int traceEnabled = 0;               /**< Only modified with the epicsAtomic functions */
+static int traceEventsPerThread = ND_TRACE_DEFAULT_EVENTS;
+
+static const char *eventNames[] = {
+  "driverCallback", "enqueue", "dequeue", "process", "process", "output", "drop"
+};
+
+static void traceInit(void *)
+{
+  traceLock = epicsMutexMustCreate();
+  traceBufferId = epicsThreadPrivateCreate();
+}
+
+/** Returns the buffer of the calling thread, creating it if needed */
+static traceBuffer_t *threadBuffer(void)
+{
+  traceBuffer_t *pBuffer = (traceBuffer_t *)epicsThreadPrivateGet(traceBufferId);
+
+  if (pBuffer) return pBuffer;
+  pBuffer = (traceBuffer_t *)callocMustSucceed(1, sizeof(traceBuffer_t), "NDTraceRecord");
+  strncpy(pBuffer->threadName, epicsThreadGetNameSelf(), sizeof(pBuffer->threadName)-1);
+  epicsMutexLock(traceLock);
+  pBuffer->numEvents = traceEventsPerThread;
+  pBuffer->pEvents = (traceEvent_t *)callocMustSucceed(pBuffer->numEvents, sizeof(traceEvent_t), "NDTraceRecord");
+  pBuffer->pNext = traceBuffers;
+  traceBuffers = pBuffer;
+  epicsMutexUnlock(traceLock);
+  epicsThreadPrivateSet(traceBufferId, pBuffer);
+  return pBuffer;
+}
+
+/** Records an event for an array, if tracing is enabled.  This is cheap when tracing is disabled.
+  * \param[in] portName The port name of the plugin.
+  * \param[in] event The event.
+  * \param[in] uniqueId The uniqueId of the array.
+  */
+void NDTraceRecord(const char *portName, NDTraceEvent_t event, int uniqueId)
+{
+  traceBuffer_t *pBuffer;
+  traceEvent_t *pEvent;
+
+  if (!epicsAtomicGetIntT(&traceEnabled)) return;
+  pBuffer = threadBuffer();
+  pEvent = &pBuffer->pEvents[pBuffer->nextEvent % pBuffer->numEvents];
+  epicsTimeGetCurrent(&pEvent->time);
+  pEvent->portName = portName;
+  pEvent->event = event;
+  pEvent->uniqueId = uniqueId;
+  epicsAtomicSetSizeT(&pBuffer->nextEvent, pBuffer->nextEvent + 1);
+}
+
+/** Enables or disables tracing.  Enabling it discards the events that were recorded before.
+  * \param[in] enable 1 to enable tracing, 0 to disable it.
+  * \param[in] eventsPerThread The number of events kept for each thread; 0 uses ND_TRACE_DEFAULT_EVENTS.
+  *            This only applies to the buffers of threads that have not traced yet.
+  * \return 0 on success.
+  */
+int NDTraceEnable(int enable, int eventsPerThread)
+{
+  traceBuffer_t *pBuffer;
+
+  epicsThreadOnce(&traceOnce, traceInit, 0);
+  epicsMutexLock(traceLock);
+  if (eventsPerThread > 0) traceEventsPerThread = eventsPerThread;
+  if (enable) {
+    /* The threads may still be writing the event they started before tracing was disabled */
+    for (pBuffer=traceBuffers; pBuffer; pBuffer=pBuffer->pNext) {
+      epicsAtomicSetSizeT(&pBuffer->nextEvent, 0);
+    }
+  }
+  epicsAtomicSetIntT(&traceEnabled, enable ? 1 : 0);
+  epicsMutexUnlock(traceLock);
+  return 0;
+}
+
+/** Writes the recorded events to a file in the Chrome trace event format.
+  * Each plugin thread is a row; processCallbacks() is a slice named after the plugin port, and the other
+  * events are instants.  All events carry the uniqueId of the array.  For consistent results disable tracing
+  * before dumping; otherwise the newest events of busy threads may be missing.
+  * \param[in] fileName The name of the file.
+  * \return 0 on success, -1 if the file cannot be written.
+  */
+int NDTraceDump(const char *fileName)
+{
+  traceBuffer_t *pBuffer;
+  traceEvent_t *pEvent;
+  epicsTimeStamp tOrigin;
+  FILE *fp;
+  size_t nextEvent, first, i;
+  int tid = 0;
+  int depth;
+  int numEvents = 0;
+  bool originSet = false;
+  const char *separator = "";
+
+  epicsThreadOnce(&traceOnce, traceInit, 0);
+  fp = fopen(fileName, "w");
+  if (!fp) {
+    printf("NDTraceDump: cannot open file %s\n", fileName);
+    return -1;
+  }
+  epicsMutexLock(traceLock);
+  /* Times are written relative to the oldest event */
+  for (pBuffer=traceBuffers; pBuffer; pBuffer=pBuffer->pNext) {
+    nextEvent = epicsAtomicGetSizeT(&pBuffer->nextEvent);
+    first = (nextEvent > (size_t)pBuffer->numEvents) ? nextEvent - pBuffer->numEvents : 0;
+    if (first == nextEvent) continue;
+    pEvent = &pBuffer->pEvents[first % pBuffer->numEvents];
+    if (!originSet || (epicsTimeDiffInSeconds(&pEvent->time, &tOrigin) < 0.)) tOrigin = pEvent->time;
+    originSet = true;
+  }
+  fprintf(fp, "{\"traceEvents\":[");
+  for (pBuffer=traceBuffers; pBuffer; pBuffer=pBuffer->pNext) {
+    tid++;
+    fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            separator, tid, pBuffer->threadName);
+    separator = ",";
+    nextEvent = epicsAtomicGetSizeT(&pBuffer->nextEvent);
+    first = (nextEvent > (size_t)pBuffer->numEvents) ? nextEvent - pBuffer->numEvents : 0;
+    depth = 0;
+    for (i=first; i<nextEvent; i++) {
+      const char *phase;
+      pEvent = &pBuffer->pEvents[i % pBuffer->numEvents];
+      switch (pEvent->event) {
+        case NDTraceProcessBegin: phase = "B"; depth++; break;
+        case NDTraceProcessEnd:   phase = "E"; break;
+        default:                  phase = "i"; break;
+      }
+      /* Skip the ends of slices whose beginnings were overwritten */
+      if (*phase == 'E') {
+        if (depth == 0) continue;
+        depth--;
+      }
+      fprintf(fp, ",\n{\"name\":\"%s%s%s\",\"cat\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                  "\"args\":{\"uniqueId\":%d}}",
+              (*phase == 'i') ? eventNames[pEvent->event] : "", (*phase == 'i') ? " " : "", pEvent->portName,
+              pEvent->portName, phase, (*phase == 'i') ? "\"s\":\"t\"," : "",
+              epicsTimeDiffInSeconds(&pEvent->time, &tOrigin)*1e6, tid, pEvent->uniqueId);
+      numEvents++;
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  epicsMutexUnlock(traceLock);
+  fclose(fp);
+  printf("NDTraceDump: wrote %d events of %d threads to %s\n", numEvents, tid, fileName);
+  return 0;
+}
@@ -0,0 +1,39 @@
+/** NDPluginTrace.h
+ *
+ * Optional tracing of the path of each NDArray through the plugins, written as a Chrome trace file
+ * that chrome://tracing and Perfetto (ui.perfetto.dev) display.
+ *
+ */
+
+#ifndef NDPluginTrace_H
+#define NDPluginTrace_H
+
+#include <shareLib.h>
+
+/** The events that are traced for each array */
+typedef enum {
+    NDTraceDriverCallback,  /**< driverCallback() received the array from upstream */
+    NDTraceEnqueue,         /**< The array was put on the input queue */
+    NDTraceDequeue,         /**< A plugin thread took the array from the queue */
+    NDTraceProcessBegin,    /**< processCallbacks() started */
+    NDTraceProcessEnd,      /**< processCallbacks() finished */
+    NDTraceOutput,          /**< The output array was passed to the downstream plugins */
+    NDTraceDrop             /**< The array was dropped because the queue was full */
+} NDTraceEvent_t;
+
+/** Default number of events kept for each thread; older events are overwritten */
+#define ND_TRACE_DEFAULT_EVENTS 65536
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc void NDTraceRecord(const char *portName, NDTraceEvent_t event, int uniqueId);
+epicsShareFunc int NDTraceEnable(int enable, int eventsPerThread);
+epicsShareFunc int NDTraceDump(const char *fileName);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
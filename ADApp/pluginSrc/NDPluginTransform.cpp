@@ -28,6 +28,7 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "NDPluginTransform.h"
+#include "NDTransformKernels.h"
 
 /* Enums to describe the types of transformations */
 typedef enum {
@@ -51,6 +52,7 @@ void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, in
   int xSize, ySize, colorSize;
   int xStride, yStride, colorStride;
   int elementSize;
+  int reverseX, reverseY;
 
   xSize = (int)arrayInfo->xSize;
   ySize = (int)arrayInfo->ySize;
@@ -73,37 +75,36 @@ void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, in
   {
     case (TransformNone):
 
-      // Nothing to do, since the input array has already been copied to the output array
+      // Nothing to do, since processCallbacksUnlocked() passes on the input array
       break;
 
     case (TransformRotate90):
+    case (TransformRotate270):
+    case (TransformRotate90Mirror):
+    case (TransformRotate270Mirror):
 
       outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
       outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
 
+      /** Output row x, column y is input pixel (x, y), with x reversed for the 270 degree rotations and y
+        reversed for Rotate90 and Rotate270Mirror.  The tiled transposes keep the strided accesses in the cache.
+      */
+      reverseX = (transformType == TransformRotate270) || (transformType == TransformRotate270Mirror);
+      reverseY = (transformType == TransformRotate90) || (transformType == TransformRotate270Mirror);
+
       if (colorMode == NDColorModeMono)
-      {      
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            outData[(((ySize-1) - y) * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }          
+      {
+        NDTransformTranspose(elementSize, 1, inData, yStride, outData, ySize, xSize, ySize, reverseX, reverseY);
       }
 
       if (colorMode == NDColorModeRGB3)
-      {      
-        for (x = 0; x < xSize; x++)
+      {
+        /** Each color plane keeps its offset, since the planes have the same size after the rotation. */
+        for (color = 0; color < 3; color++)
         {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize-1) - y) * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize-1) - y) * xStride) + (x * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize-1) - y) * xStride) + (x * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }          
+          NDTransformTranspose(elementSize, 1, inData + (color * colorStride), yStride,
+                               outData + (color * colorStride), ySize, xSize, ySize, reverseX, reverseY);
+        }
       }
 
       if (colorMode == NDColorModeRGB2)
@@ -114,37 +115,19 @@ void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, in
         int newColorStride = ySize;
         int newYStride = newColorStride * colorSize;
 
-        for (y = (ySize - 1); y >= 0; y--)
+        for (color = 0; color < 3; color++)
         {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
+          NDTransformTranspose(elementSize, 1, inData + (color * colorStride), yStride,
+                               outData + (color * newColorStride), newYStride, xSize, ySize, reverseX, reverseY);
         }
       }
 
       if (colorMode == NDColorModeRGB1)
       {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
+        /** Calculate a new value for the Y stride.  The three values of a pixel are moved together. */
         int newStride = colorSize * ySize;
 
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (((ySize - 1) - y) * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
+        NDTransformTranspose(elementSize, 3, inData, yStride, outData, newStride, xSize, ySize, reverseX, reverseY);
       }
 
       break;
@@ -176,225 +159,6 @@ void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, in
       }  
       break;
 
-    case (TransformRotate270):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize)]           = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize) + colorStride]     = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride)]            = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride) + newColorStride]     = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (y * xStride) + (((xSize-1) - x) * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformRotate90Mirror):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            outData[(y * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (x * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (x * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = 0; x < xSize; x++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (x * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (x * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (x * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (y * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformRotate270Mirror):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride);
-            target_offset = (y * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
     case (TransformMirror):
 
       if (colorMode == NDColorModeMono)
@@ -482,61 +246,60 @@ void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, in
   return;
 }
 
-/** Callback function that is called by the NDArray driver with new NDArray data.
+/** Called by the default NDPluginDriver::processCallbacks() with the lock released.
   * Grabs the current NDArray and applies the selected transforms to the data.  Apply the transforms in order.
   * \param[in] pArray  The NDArray from the callback.
+  * \param[in] params The parameter values when processing of this array began.
+  * \param[out] results The array size parameters of the transformed array.
   */
-void NDPluginTransform::processCallbacks(NDArray *pArray){
+NDArray* NDPluginTransform::processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                                     NDPluginParamSnapshot &results)
+{
   NDArray *transformedArray;
   NDArrayInfo_t arrayInfo;
-  static const char* functionName = "processCallbacks";
-
-  /* Call the base class method */
-  NDPluginDriver::beginProcessCallbacks(pArray);
+  int transformType = params.getInteger(NDPluginTransformType_);
+  static const char* functionName = "processCallbacksUnlocked";
 
   /** Create a pointer to a structure of type NDArrayInfo_t and use it to get information about
     the input array.
   */
   pArray->getInfo(&arrayInfo);
 
-  this->userDims_[0] = arrayInfo.xDim;
-  this->userDims_[1] = arrayInfo.yDim;
-  this->userDims_[2] = arrayInfo.colorDim;
-
-  /* Copy the information from the current array */
-  transformedArray = this->pNDArrayPool->copy(pArray, NULL, 1);
-
-  /* Release the lock; this is computationally intensive and does not access any shared data */
-  this->unlock();
-  if ( pArray->ndims <=3 )
-    this->transformImage(pArray, transformedArray, &arrayInfo);
-  else {
+  if ( pArray->ndims > 3 ) {
     asynPrint( this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s, this method is meant to transform 2Dimages when the number of dimensions is <= 3\n",
           pluginName, functionName);
   }
-  this->lock();
+
+  /* The input array is passed on by reference when there is nothing to transform */
+  if ((transformType == TransformNone) || (pArray->ndims > 3)) {
+    transformedArray = pArray;
+  } else {
+    /* Copy the information from the current array.  Every pixel is written by the transform,
+       so the data are not copied. */
+    transformedArray = this->pNDArrayPool->copy(pArray, NULL, 0);
+    if (!transformedArray) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s, cannot allocate transformed array\n",
+            pluginName, functionName);
+      return NULL;
+    }
+    this->transformImage(pArray, transformedArray, &arrayInfo, transformType, params.getInteger(NDColorMode));
+  }
 
   // Set NDArraySizeX and NDArraySizeY appropriately
-  setIntegerParam(NDArraySizeX, (int)transformedArray->dims[arrayInfo.xDim].size);
-  setIntegerParam(NDArraySizeY, (int)transformedArray->dims[arrayInfo.yDim].size);
-  if (transformedArray->ndims < 3) setIntegerParam(NDArraySizeZ, 0);
-  else setIntegerParam(NDArraySizeZ, 3);
+  results.setInteger(NDArraySizeX, (int)transformedArray->dims[arrayInfo.xDim].size);
+  results.setInteger(NDArraySizeY, (int)transformedArray->dims[arrayInfo.yDim].size);
+  if (transformedArray->ndims < 3) results.setInteger(NDArraySizeZ, 0);
+  else results.setInteger(NDArraySizeZ, 3);
 
-  NDPluginDriver::endProcessCallbacks(transformedArray, false, true);
-  callParamCallbacks();
+  return transformedArray;
 }
 
-
+
 /** Transform the image according to the selected choice.*/  
-void NDPluginTransform::transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo)
+void NDPluginTransform::transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo,
+                                       int transformType, int colorMode)
 {
   //static const char *functionName = "transformNDArray";
-  int colorMode;
-  int transformType;
-
-  colorMode = NDColorModeMono;
-  getIntegerParam(NDColorMode, &colorMode);
-  getIntegerParam(NDPluginTransformType_, &transformType);
 
   switch (inArray->dataType) {
     case NDInt8:
@@ -600,14 +363,10 @@ NDPluginTransform::NDPluginTransform(const char *portName, int queueSize, int bl
                    ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads)
 {
   //static const char *functionName = "NDPluginTransform";
-  int i;
 
   createParam(NDPluginTransformTypeString, asynParamInt32, &NDPluginTransformType_);
+  addSnapshotParam(NDPluginTransformType_);
 
-  for (i = 0; i < ND_ARRAY_MAX_DIMS; i++) {
-    this->userDims_[i] = i;
-  }
-  
   /* Set the plugin type string */
   setStringParam(NDPluginDriverPluginType, "NDPluginTransform");
   setIntegerParam(NDPluginTransformType_, TransformNone);
@@ -616,6 +375,9 @@ NDPluginTransform::NDPluginTransform(const char *portName, int queueSize, int bl
   // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
   setIntegerParam(NDArrayCallbacks, 1);
 
+  /* The input array is passed on unchanged with TransformNone, so it is output as a view without copying the data */
+  passArraysByReference_ = true;
+
   /* Try to connect to the array port */
   connectToArrayPort();
 }
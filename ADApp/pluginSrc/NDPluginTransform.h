@@ -20,15 +20,16 @@ public:
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize, int maxThreads=1);
     /* These methods override the virtual methods in the base class */
-    void processCallbacks(NDArray *pArray);
+    NDArray* processCallbacksUnlocked(NDArray *pArray, const NDPluginParamSnapshot &params,
+                                      NDPluginParamSnapshot &results);
 
 protected:
     int NDPluginTransformType_;
     #define FIRST_TRANSFORM_PARAM NDPluginTransformType_
 
 private:
-    size_t userDims_[ND_ARRAY_MAX_DIMS];
-    void transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo);
+    void transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo,
+                        int transformType, int colorMode);
 };
 
 #endif
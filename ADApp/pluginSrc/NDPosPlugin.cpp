@@ -10,12 +10,12 @@
 #include <iocsh.h>
 #include <sys/stat.h>
 #include <string>
-#include <list>
 #include <map>
 #include <vector>
 
 #include <epicsTypes.h>
 #include <epicsThread.h>
+#include <epicsMath.h>
 
 #include <asynDriver.h>
 
@@ -27,6 +27,75 @@
 
 static const char *driverName = "NDPosPlugin";
 
+// The number of positions that are read from a file before they are appended to the store
+static const size_t loadChunkSize = 10000;
+
+/** Returns the number of positions in the store */
+size_t NDPosPlugin::positionCount()
+{
+  if (positions_.empty()) return 0;
+  return positions_.begin()->second.size() - firstPosition_;
+}
+
+/** Appends positions to the end of the store.  Dimensions that the store does not have yet are added,
+  * with no value for the positions already in it, and the new positions have no value for the dimensions
+  * of the store that they do not have.
+  * \param[in] names The names of the dimensions of the positions.
+  * \param[in] values The values of the positions, one vector for each of names. */
+void NDPosPlugin::appendPositions(const std::vector<std::string>& names, const std::vector<std::vector<double> >& values)
+{
+  std::map<std::string, std::vector<double> >::iterator iter;
+  size_t stored, added;
+
+  if (names.empty() || values[0].empty()) return;
+  // Remove the positions that were discarded if they are half of the store, before the columns grow
+  discardPositions(0);
+  // The values in the columns, including those that were discarded
+  stored = positions_.empty() ? 0 : positions_.begin()->second.size();
+  added = values[0].size();
+  for (size_t i = 0; i < names.size(); i++){
+    iter = positions_.find(names[i]);
+    if (iter == positions_.end()){
+      iter = positions_.insert(std::make_pair(names[i], std::vector<double>(stored, epicsNAN))).first;
+    } else if (iter->second.size() > stored){
+      // The name appears twice in the dimensions, only the first is used
+      continue;
+    }
+    iter->second.insert(iter->second.end(), values[i].begin(), values[i].end());
+  }
+  for (iter = positions_.begin(); iter != positions_.end(); iter++){
+    iter->second.resize(stored + added, epicsNAN);
+  }
+}
+
+/** Discards positions from the front of the store.  This only advances firstPosition_, the discarded
+  * values are removed once they are at least half of the store, so discarding takes constant time on average.
+  * \param[in] count The number of positions to discard. */
+void NDPosPlugin::discardPositions(size_t count)
+{
+  std::map<std::string, std::vector<double> >::iterator iter;
+  size_t stored;
+
+  if (positions_.empty()) return;
+  firstPosition_ += count;
+  stored = positions_.begin()->second.size();
+  if (firstPosition_ >= stored){
+    clearPositions();
+  } else if ((firstPosition_ > 0) && (firstPosition_ >= stored / 2)){
+    for (iter = positions_.begin(); iter != positions_.end(); iter++){
+      iter->second.erase(iter->second.begin(), iter->second.begin() + firstPosition_);
+    }
+    firstPosition_ = 0;
+  }
+}
+
+/** Removes all of the positions and dimensions from the store */
+void NDPosPlugin::clearPositions()
+{
+  positions_.clear();
+  firstPosition_ = 0;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * If the plugin is running then it attaches position data to the NDArray as NDAttributes
   * and then passes the array on.  If the plugin is not running then NDArrays are not
@@ -52,10 +121,7 @@ void NDPosPlugin::processCallbacks(NDArray *pArray)
   // Call the base class method
   NDPluginDriver::beginProcessCallbacks(pArray);
   getIntegerParam(NDPos_Running, &running);
-  // We must maintain the size of the list ourselves, as calling
-  // size() on the list has a complexity of O(n) which causes a problem
-  // once we get into tens of thousands of items.
-  getIntegerParam(NDPos_CurrentQty, &size);
+  size = (int)positionCount();
   // Only attach the position data to the array if we are running
   if (running == NDPOS_RUNNING){
     getIntegerParam(NDPos_CurrentIndex, &index);
@@ -104,7 +170,7 @@ void NDPosPlugin::processCallbacks(NDArray *pArray)
           if (mode == MODE_DISCARD){
             while ((expectedID < IDValue) && (size > 0)){
               // The index will stay the same, and we need to pop the value out of the position array
-              positionArray.erase(positionArray.begin());
+              discardPositions(1);
               size--;
               expectedID += IDDifference;
               dropped++;
@@ -148,23 +214,23 @@ void NDPosPlugin::processCallbacks(NDArray *pArray)
         pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
         this->getAttributes(pArrayOut->pAttributeList);
         if (pArrayOut){
-          std::list<std::map<std::string, double> >::iterator it = positionArray.begin();
-          std::advance(it, index);
-          //std::map<std::string, double> pos = positionArray[index];
-          std::map<std::string, double> pos = *it;
+          size_t position = firstPosition_ + index;
           std::stringstream sspos;
           sspos << "[";
           bool firstTime = true;
-          std::map<std::string, double>::iterator iter;
-          for (iter = pos.begin(); iter != pos.end(); iter++){
+          std::map<std::string, std::vector<double> >::iterator iter;
+          for (iter = positions_.begin(); iter != positions_.end(); iter++){
+            double value = iter->second[position];
+            // Skip the dimensions that this position does not have
+            if (isnan(value)) continue;
             if (firstTime){
               firstTime = false;
             } else {
               sspos << ",";
             }
-            sspos << iter->first << "=" << iter->second;
+            sspos << iter->first << "=" << value;
             // Create the NDAttribute with the position data
-            NDAttribute *pAtt = new NDAttribute(iter->first.c_str(), "Position of NDArray", NDAttrSourceDriver, driverName, NDAttrFloat64, &(iter->second));
+            NDAttribute *pAtt = new NDAttribute(iter->first.c_str(), "Position of NDArray", NDAttrSourceDriver, driverName, NDAttrFloat64, &value);
             // Add the NDAttribute to the NDArray
             pArrayOut->pAttributeList->add(pAtt);
           }
@@ -188,7 +254,7 @@ void NDPosPlugin::processCallbacks(NDArray *pArray)
         getIntegerParam(NDPos_Mode, &mode);
         if (mode == MODE_DISCARD){
           // The index will stay the same, and we need to pop the value out of the position array
-          positionArray.erase(positionArray.begin());
+          discardPositions(1);
           size--;
           setIntegerParam(NDPos_CurrentQty, size);
         } else if (mode == MODE_KEEP){
@@ -252,8 +318,8 @@ asynStatus NDPosPlugin::writeInt32(asynUser *pasynUser, epicsInt32 value)
       // Reset the last sent position
       setStringParam(NDPos_CurrentPos, "");
       // Clear out the position array
-      positionArray.clear();
-      setIntegerParam(NDPos_CurrentQty, (int)positionArray.size());
+      clearPositions();
+      setIntegerParam(NDPos_CurrentQty, (int)positionCount());
     } else {
       // If this parameter belongs to a base class call its method
       if (function < FIRST_NDPOS_PARAM){
@@ -302,19 +368,33 @@ asynStatus NDPosPlugin::writeOctet(asynUser *pasynUser, const char *value, size_
     // Read the filename parameter
     std::string xml;
     getStringParam(NDPos_Filename, xml);
-    // Now validate the XML
     NDPosPluginFileReader fr;
-    if (fr.validateXML(xml) == asynSuccess){
-      setIntegerParam(NDPos_FileValid, 1);
-      NDPosPluginFileReader fr;
-       /* Read the filename and valid parameters
-       * then the positions are loaded and appended to the position set.
+    if (loading_){
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: cannot load %s, positions are still being loaded\n",
+                driverName, functionName, xml.c_str());
+      status = asynError;
+    } else if (fr.openFile(xml) == asynSuccess){
+      /* The positions are appended to the position set in chunks, and the lock is released while
+       * each chunk is read, so that arrays get positions before a large file has been loaded.
        */
-      fr.loadXML(xml);
-      std::vector<std::map<std::string, double> > positions = fr.readPositions();
-      positionArray.insert(positionArray.end(), positions.begin(), positions.end());
-      setIntegerParam(NDPos_CurrentQty, (int)positionArray.size());
-      callParamCallbacks();
+      bool done = false;
+      loading_ = true;
+      while (!done){
+        this->unlock();
+        status = fr.readChunk(loadChunkSize, done);
+        this->lock();
+        appendPositions(fr.readDimensions(), fr.readPositions());
+        setIntegerParam(NDPos_CurrentQty, (int)positionCount());
+        callParamCallbacks();
+      }
+      loading_ = false;
+      setIntegerParam(NDPos_FileValid, (status == asynSuccess) ? 1 : 0);
+      if (status != asynSuccess){
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s:%s: error loading %s: %s\n",
+                  driverName, functionName, xml.c_str(), fr.getErrorMsg().c_str());
+      }
     } else {
       setIntegerParam(NDPos_FileValid, 0);
       status = asynError;
@@ -381,7 +461,9 @@ NDPosPlugin::NDPosPlugin(const char *portName,
                    1,
                    priority,
                    stackSize,
-                   1)
+                   1),
+    firstPosition_(0),
+    loading_(false)
 {
   //static const char *functionName = "NDPluginAttribute::NDPluginAttribute";
 
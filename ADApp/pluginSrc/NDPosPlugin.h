@@ -10,7 +10,8 @@
  *
  *  The following parameters are used to interact with this plugin:
  *
- *  NDPos_Filename           - Filename to load positional data from
+ *  NDPos_Filename           - Filename to load positional data from, an XML file, an XML string
+ *                             or a CSV file ending in .csv
  *  NDPos_FileValid          - Is the currently selected filename a valid location
  *  NDPos_Load               - Load the filename specified above
  *  NDPos_Clear              - Clear the current positional data store
@@ -32,7 +33,7 @@
 
 #include <epicsTypes.h>
 #include <string>
-#include <list>
+#include <vector>
 #include <map>
 
 #include "NDPluginDriver.h"
@@ -102,8 +103,16 @@ protected:
   int NDPos_IDStart;
 
 private:
+  size_t positionCount();
+  void appendPositions(const std::vector<std::string>& names, const std::vector<std::vector<double> >& values);
+  void discardPositions(size_t count);
+  void clearPositions();
+
   // Plugin member variables
-  std::list<std::map<std::string, double> > positionArray;
+  std::map<std::string, std::vector<double> > positions_; // The values of each dimension, indexed by its name.
+                                                           // A value is NaN if the position has no such dimension
+  size_t firstPosition_;                                   // The number of values that have been discarded
+  bool loading_;                                           // A file is being loaded
 };
 
 #endif /* NDPosPluginAPP_SRC_NDPOSPLUGIN_H_ */
@@ -6,7 +6,8 @@
  */
 
 #include "NDPosPluginFileReader.h"
-#include <sstream>
+#include <stdlib.h>
+#include <epicsMath.h>
 
 const std::string NDPosPluginFileReader::ELEMENT_NAME       = "name";
 const std::string NDPosPluginFileReader::ELEMENT_DIMENSIONS = "dimensions";
@@ -16,6 +17,8 @@ const std::string NDPosPluginFileReader::ELEMENT_POSITION   = "position";
 
 const std::string NDPosPluginFileReader::DIMENSION_NAME     = "name";
 
+const std::string NDPosPluginFileReader::CSV_EXTENSION      = ".csv";
+
 NDPosPluginFileReader::NDPosPluginFileReader()
   : xmlreader(NULL)
 {
@@ -23,6 +26,7 @@ NDPosPluginFileReader::NDPosPluginFileReader()
 
 NDPosPluginFileReader::~NDPosPluginFileReader()
 {
+  closeFile();
 }
 
 asynStatus NDPosPluginFileReader::validateXML(const std::string& filename)
@@ -59,41 +63,149 @@ asynStatus NDPosPluginFileReader::validateXML(const std::string& filename)
 
 asynStatus NDPosPluginFileReader::loadXML(const std::string& filename)
 {
-  asynStatus status = asynSuccess;
-  int ret = 0;
-  // if the file name contains <pos_layout> then load it as an xml string from memory
+  asynStatus status;
+  bool done = false;
+
+  status = openFile(filename);
+  if (status == asynSuccess){
+    status = readChunk(0, done);
+    closeFile();
+  }
+  return status;
+}
+
+/** Opens positions to read with readChunk().
+  * \param[in] filename An XML string containing <pos_layout>, the name of an XML file, or the name of a CSV
+  *            file ending in .csv.  An XML string is read in place, so it must exist until closeFile(). */
+asynStatus NDPosPluginFileReader::openFile(const std::string& filename)
+{
+  closeFile();
+  clearPositions();
   if (filename.find("<pos_layout>") != std::string::npos){
     xmlreader = xmlReaderForMemory(filename.c_str(), (int)filename.length(), NULL, NULL, 0);
+  } else if ((filename.size() > CSV_EXTENSION.size()) &&
+             (filename.compare(filename.size() - CSV_EXTENSION.size(), CSV_EXTENSION.size(), CSV_EXTENSION) == 0)){
+    csvfile.open(filename.c_str());
+    if (!csvfile.is_open()){
+      setErrorMsg("Error opening CSV file, check file");
+      return asynError;
+    }
+    return asynSuccess;
   } else {
     xmlreader = xmlReaderForFile(filename.c_str(), NULL, 0);
   }
-
   if (xmlreader == NULL){
     setErrorMsg("Error creating XML parser, check file");
-    status = asynError;
+    return asynError;
   }
+  return asynSuccess;
+}
 
-  if (status == asynSuccess){
-    while ((ret = xmlTextReaderRead(xmlreader)) == 1){
+/** Reads the next positions of the file that openFile() opened.  The positions that readPositions() returns
+  * are replaced by these, so that a large file is loaded in chunks; the dimensions are kept.
+  * \param[in] maxPositions The most positions to read, or 0 to read the rest of the file.
+  * \param[out] done Set to true once the end of the file has been reached or an error occurred. */
+asynStatus NDPosPluginFileReader::readChunk(size_t maxPositions, bool& done)
+{
+  asynStatus status = asynSuccess;
+  int ret = 1;
+
+  for (size_t i = 0; i < positions.size(); i++){
+    positions[i].clear();
+  }
+  if (csvfile.is_open()){
+    status = readCSV(maxPositions, done);
+  } else if (xmlreader != NULL){
+    while (((maxPositions == 0) || positions.empty() || (positions[0].size() < maxPositions)) &&
+           ((ret = xmlTextReaderRead(xmlreader)) == 1)){
       this->processNode();
     }
-    xmlFreeTextReader(xmlreader);
-    xmlreader = NULL;
-    if (ret != 0){
-      setErrorMsg("XML parsing failed, check file format");
-      status = asynError;
+    if (ret != 1){
+      done = true;
+      if (ret != 0){
+        setErrorMsg("XML parsing failed, check file format");
+        status = asynError;
+      }
     }
+  } else {
+    done = true;
+    status = asynError;
   }
-
   return status;
 }
 
-std::vector<std::string> NDPosPluginFileReader::readDimensions()
+/** Reads positions from a CSV file.  Its first line holds the names of the dimensions separated by commas, and
+  * each following line the values of one position.  Empty lines and lines starting with # are ignored. */
+asynStatus NDPosPluginFileReader::readCSV(size_t maxPositions, bool& done)
+{
+  std::string line;
+  const char *pStart;
+  char *pEnd;
+  size_t i, start, end;
+  double value;
+
+  while ((maxPositions == 0) || positions.empty() || (positions[0].size() < maxPositions)){
+    if (!std::getline(csvfile, line)){
+      done = true;
+      if (dimensions.empty()){
+        setErrorMsg("CSV file has no dimensions, check file format");
+        return asynError;
+      }
+      return asynSuccess;
+    }
+    if ((line.find_first_not_of(" \t\r") == std::string::npos) || (line[0] == '#')) continue;
+    if (dimensions.empty()){
+      for (start = 0; start <= line.size(); start = end + 1){
+        end = line.find(',', start);
+        if (end == std::string::npos) end = line.size();
+        size_t first = line.find_first_not_of(" \t\r", start);
+        size_t last = line.find_last_not_of(" \t\r", end - 1);
+        if ((first == std::string::npos) || (first >= end)){
+          done = true;
+          setErrorMsg("CSV file has an empty dimension name, check file format");
+          return asynError;
+        }
+        dimensions.push_back(line.substr(first, last - first + 1));
+        positions.push_back(std::vector<double>());
+      }
+      continue;
+    }
+    pStart = line.c_str();
+    for (i = 0; i < dimensions.size(); i++){
+      value = strtod(pStart, &pEnd);
+      if (pEnd == pStart){
+        done = true;
+        setErrorMsg("CSV position has too few values, check file format");
+        return asynError;
+      }
+      positions[i].push_back(value);
+      while ((*pEnd == ' ') || (*pEnd == '\t')) pEnd++;
+      pStart = (*pEnd == ',') ? pEnd + 1 : pEnd;
+    }
+  }
+  return asynSuccess;
+}
+
+/** Closes the file that openFile() opened */
+void NDPosPluginFileReader::closeFile()
+{
+  if (xmlreader != NULL){
+    xmlFreeTextReader(xmlreader);
+    xmlreader = NULL;
+  }
+  if (csvfile.is_open()){
+    csvfile.close();
+  }
+}
+
+const std::vector<std::string>& NDPosPluginFileReader::readDimensions()
 {
   return dimensions;
 }
 
-std::vector<std::map<std::string, double> > NDPosPluginFileReader::readPositions()
+/** Returns the positions that were loaded, as one vector of values for each of the dimensions
+  * returned by readDimensions(), in the same order. */
+const std::vector<std::vector<double> >& NDPosPluginFileReader::readPositions()
 {
   return positions;
 }
@@ -166,6 +278,11 @@ asynStatus NDPosPluginFileReader::addDimension()
     //printf("Adding dimension: %s\n", str_dim_name.c_str());
     // Add the dimension to the vector of dimension names
     dimensions.push_back(str_dim_name);
+    // Any positions before the dimension have no value for it
+    positions.push_back(std::vector<double>(positions.empty() ? 0 : positions[0].size(), epicsNAN));
+  }
+  if (dim_name != NULL){
+    xmlFree(dim_name);
   }
   return status;
 }
@@ -175,7 +292,7 @@ asynStatus NDPosPluginFileReader::addPosition()
   asynStatus status = asynSuccess;
   xmlChar *pos_val = NULL;
   std::string pos_str;
-  std::map<std::string, double> pos;
+  std::vector<double> pos;
 
   // First check the basics
   if (!xmlTextReaderHasAttributes(this->xmlreader)){
@@ -193,13 +310,15 @@ asynStatus NDPosPluginFileReader::addPosition()
         status = asynError;
       } else {
         // Convert the string value into an integer index
-        std::stringstream sindex((char *)pos_val);
-        sindex >> index;
-        if (!sindex){
+        char *pEnd;
+        index = strtod((char *)pos_val, &pEnd);
+        bool valid = (pEnd != (char *)pos_val);
+        xmlFree(pos_val);
+        if (!valid){
           status = asynError;
         } else {
-          // Insert the dimension index into the position map
-          pos[*iter] = index;
+          // Add the dimension index to the position
+          pos.push_back(index);
         }
       }
     }
@@ -207,7 +326,9 @@ asynStatus NDPosPluginFileReader::addPosition()
 
   if (status == asynSuccess){
     //printf("Adding position: %s\n", pos_str.c_str());
-    positions.push_back(pos);
+    for (size_t i = 0; i < pos.size(); i++){
+      positions[i].push_back(pos[i]);
+    }
   }
   return status;
 }
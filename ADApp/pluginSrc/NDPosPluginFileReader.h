@@ -12,7 +12,7 @@
 #include <libxml/xmlreader.h>
 #include <string>
 #include <vector>
-#include <map>
+#include <fstream>
 
 class NDPosPluginFileReader
 {
@@ -24,13 +24,17 @@ public:
   static const std::string ELEMENT_POSITION;
 
   static const std::string DIMENSION_NAME;
+  static const std::string CSV_EXTENSION;
 
   NDPosPluginFileReader();
   virtual ~NDPosPluginFileReader();
   asynStatus validateXML(const std::string& filename);
   asynStatus loadXML(const std::string& filename);
-  std::vector<std::string> readDimensions();
-  std::vector<std::map<std::string, double> > readPositions();
+  asynStatus openFile(const std::string& filename);
+  asynStatus readChunk(size_t maxPositions, bool& done);
+  void closeFile();
+  const std::vector<std::string>& readDimensions();
+  const std::vector<std::vector<double> >& readPositions();
   asynStatus clearPositions();
   asynStatus processNode();
   asynStatus addDimension();
@@ -39,11 +43,13 @@ public:
 
 protected:
   void setErrorMsg(const std::string& msg);
+  asynStatus readCSV(size_t maxPositions, bool& done);
 
 private:
   xmlTextReaderPtr xmlreader;
+  std::ifstream csvfile;
   std::vector<std::string> dimensions;
-  std::vector<std::map<std::string, double> > positions;
+  std::vector<std::vector<double> > positions; // The values of each position, one vector for each of dimensions
   std::string errorMessage;
 };
 
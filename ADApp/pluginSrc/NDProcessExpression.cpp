@@ -0,0 +1,487 @@
+/** NDProcessExpression.cpp
+ *
+ * Compiler and block interpreter for the per-element expressions of NDPluginProcess.
+ *
+ * The expressions use the operators and precedence of C: ?:, ||, &&, == !=, < <= > >=, + -, * /, unary - + !,
+ * and ^ for the power, which binds tighter than the unary operators and to the right.  The operands are numbers,
+ * the variables x (the input element), b (the background), f (the flat field) and i (the index of the element),
+ * the functions abs, sqrt, exp, log, floor, min, max and pow, and the names of frame attributes, which are constant
+ * for each frame.  All arithmetic is in double; comparisons and logical operators give 1 or 0.
+ *
+ * The parser is recursive descent and emits the program in postfix order.  The interpreter keeps one block of
+ * ND_EXPRESSION_BLOCK elements for each entry of the stack, and ?: evaluates both alternatives and selects
+ * between them element by element, so none of the loops have branches.
+ *
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDProcessExpression.h"
+
+/* The instructions.  The push instructions add an entry to the stack, the others replace their operands with
+ * the result. */
+typedef enum {
+  EXPR_CONSTANT,
+  EXPR_X,
+  EXPR_BACKGROUND,
+  EXPR_FLAT_FIELD,
+  EXPR_INDEX,
+  EXPR_NAME,
+  EXPR_NEGATE,
+  EXPR_NOT,
+  EXPR_ADD,
+  EXPR_SUBTRACT,
+  EXPR_MULTIPLY,
+  EXPR_DIVIDE,
+  EXPR_POWER,
+  EXPR_LESS,
+  EXPR_LESS_EQUAL,
+  EXPR_GREATER,
+  EXPR_GREATER_EQUAL,
+  EXPR_EQUAL,
+  EXPR_NOT_EQUAL,
+  EXPR_AND,
+  EXPR_OR,
+  EXPR_SELECT,
+  EXPR_ABS,
+  EXPR_SQRT,
+  EXPR_EXP,
+  EXPR_LOG,
+  EXPR_FLOOR,
+  EXPR_MIN,
+  EXPR_MAX
+} exprOp_t;
+
+typedef struct {
+  const char *name;
+  exprOp_t op;
+  int nArgs;
+} exprFunction_t;
+
+static const exprFunction_t exprFunctions[] = {
+  {"abs",   EXPR_ABS,   1},
+  {"sqrt",  EXPR_SQRT,  1},
+  {"exp",   EXPR_EXP,   1},
+  {"log",   EXPR_LOG,   1},
+  {"floor", EXPR_FLOOR, 1},
+  {"min",   EXPR_MIN,   2},
+  {"max",   EXPR_MAX,   2},
+  {"pow",   EXPR_POWER, 2}
+};
+
+/* The state of the parser */
+typedef struct {
+  const char *pText;
+  const char *pPos;
+  NDProcessExpression_t *pExpression;
+  int depth;                  /* The depth of the stack after the instructions emitted so far */
+  int nesting;                /* The depth of recursion of the parser */
+  char *pError;
+  size_t errorSize;
+  int failed;
+} exprParser_t;
+
+static void parseError(exprParser_t *pParser, const char *message)
+{
+  if (pParser->failed) return;
+  pParser->failed = 1;
+  if (pParser->pError && (pParser->errorSize > 0))
+    epicsSnprintf(pParser->pError, pParser->errorSize, "%s at character %d", message,
+                  (int)(pParser->pPos - pParser->pText) + 1);
+}
+
+/* Adds an instruction that changes the depth of the stack by change */
+static void emit(exprParser_t *pParser, exprOp_t op, double operand, int change)
+{
+  NDProcessExpression_t *pExpression = pParser->pExpression;
+
+  if (pParser->failed) return;
+  if (pExpression->nOps >= ND_EXPRESSION_MAX_OPS) {
+    parseError(pParser, "expression too long");
+    return;
+  }
+  pParser->depth += change;
+  if (pParser->depth > ND_EXPRESSION_MAX_STACK) {
+    parseError(pParser, "expression nested too deeply");
+    return;
+  }
+  pExpression->ops[pExpression->nOps] = (unsigned char)op;
+  pExpression->operands[pExpression->nOps] = operand;
+  pExpression->nOps++;
+}
+
+static void skipSpace(exprParser_t *pParser)
+{
+  while (isspace((unsigned char)*pParser->pPos)) pParser->pPos++;
+}
+
+/* Consumes the token if it is next */
+static int accept(exprParser_t *pParser, const char *token)
+{
+  size_t len = strlen(token);
+
+  skipSpace(pParser);
+  if (strncmp(pParser->pPos, token, len) != 0) return 0;
+  /* < and > are not the start of <= and >=, nor = and ! of == and != */
+  if ((len == 1) && strchr("<>!", token[0]) && (pParser->pPos[1] == '=')) return 0;
+  pParser->pPos += len;
+  return 1;
+}
+
+static void expect(exprParser_t *pParser, const char *token, const char *message)
+{
+  if (!accept(pParser, token)) parseError(pParser, message);
+}
+
+static void parseTernary(exprParser_t *pParser);
+static void parseUnary(exprParser_t *pParser);
+
+static void parseName(exprParser_t *pParser)
+{
+  NDProcessExpression_t *pExpression = pParser->pExpression;
+  char name[ND_EXPRESSION_NAME_LEN];
+  const char *pStart = pParser->pPos;
+  size_t len, f;
+  int i, nArgs;
+
+  while (isalnum((unsigned char)*pParser->pPos) || (*pParser->pPos == '_')) pParser->pPos++;
+  len = pParser->pPos - pStart;
+  if (len >= sizeof(name)) {
+    pParser->pPos = pStart;
+    parseError(pParser, "name too long");
+    return;
+  }
+  memcpy(name, pStart, len);
+  name[len] = '\0';
+
+  if (accept(pParser, "(")) {
+    for (f=0; f<sizeof(exprFunctions)/sizeof(exprFunctions[0]); f++) {
+      if (strcmp(name, exprFunctions[f].name) == 0) break;
+    }
+    if (f == sizeof(exprFunctions)/sizeof(exprFunctions[0])) {
+      pParser->pPos = pStart;
+      parseError(pParser, "unknown function");
+      return;
+    }
+    nArgs = exprFunctions[f].nArgs;
+    for (i=0; i<nArgs; i++) {
+      if (i > 0) expect(pParser, ",", "expected ,");
+      parseTernary(pParser);
+    }
+    expect(pParser, ")", "expected )");
+    emit(pParser, exprFunctions[f].op, 0., 1 - nArgs);
+    return;
+  }
+  if      (strcmp(name, "x") == 0) emit(pParser, EXPR_X, 0., 1);
+  else if (strcmp(name, "b") == 0) emit(pParser, EXPR_BACKGROUND, 0., 1);
+  else if (strcmp(name, "f") == 0) emit(pParser, EXPR_FLAT_FIELD, 0., 1);
+  else if (strcmp(name, "i") == 0) emit(pParser, EXPR_INDEX, 0., 1);
+  else {
+    /* Any other name is a frame attribute */
+    for (i=0; i<pExpression->nNames; i++) {
+      if (strcmp(name, pExpression->names[i]) == 0) break;
+    }
+    if (i == pExpression->nNames) {
+      if (pExpression->nNames >= ND_EXPRESSION_MAX_NAMES) {
+        pParser->pPos = pStart;
+        parseError(pParser, "too many attributes");
+        return;
+      }
+      strcpy(pExpression->names[pExpression->nNames++], name);
+    }
+    emit(pParser, EXPR_NAME, (double)i, 1);
+  }
+}
+
+static void parsePrimary(exprParser_t *pParser)
+{
+  char *pEnd;
+  double value;
+
+  skipSpace(pParser);
+  if (accept(pParser, "(")) {
+    parseTernary(pParser);
+    expect(pParser, ")", "expected )");
+  } else if (isalpha((unsigned char)*pParser->pPos) || (*pParser->pPos == '_')) {
+    parseName(pParser);
+  } else if (isdigit((unsigned char)*pParser->pPos) || (*pParser->pPos == '.')) {
+    value = strtod(pParser->pPos, &pEnd);
+    if (pEnd == pParser->pPos) {
+      parseError(pParser, "invalid number");
+      return;
+    }
+    pParser->pPos = pEnd;
+    emit(pParser, EXPR_CONSTANT, value, 1);
+  } else {
+    parseError(pParser, (*pParser->pPos == '\0') ? "unexpected end of expression" : "unexpected character");
+  }
+}
+
+static void parsePower(exprParser_t *pParser)
+{
+  parsePrimary(pParser);
+  if (accept(pParser, "^")) {
+    parseUnary(pParser);
+    emit(pParser, EXPR_POWER, 0., -1);
+  }
+}
+
+static void parseUnary(exprParser_t *pParser)
+{
+  /* Limits the recursion of the parser; expressions nested this deeply do not fit in a program anyway */
+  if (pParser->failed || (++pParser->nesting > ND_EXPRESSION_MAX_OPS)) {
+    parseError(pParser, "expression nested too deeply");
+    return;
+  }
+  if (accept(pParser, "-")) {
+    parseUnary(pParser);
+    emit(pParser, EXPR_NEGATE, 0., 0);
+  } else if (accept(pParser, "!")) {
+    parseUnary(pParser);
+    emit(pParser, EXPR_NOT, 0., 0);
+  } else if (accept(pParser, "+")) {
+    parseUnary(pParser);
+  } else {
+    parsePower(pParser);
+  }
+  pParser->nesting--;
+}
+
+/* The binary operators of one level of precedence, all left associative */
+typedef struct {
+  const char *token;
+  exprOp_t op;
+} exprBinary_t;
+
+static const exprBinary_t exprMultiplicative[] = {{"*", EXPR_MULTIPLY}, {"/", EXPR_DIVIDE}, {0, EXPR_ADD}};
+static const exprBinary_t exprAdditive[] = {{"+", EXPR_ADD}, {"-", EXPR_SUBTRACT}, {0, EXPR_ADD}};
+static const exprBinary_t exprRelational[] = {{"<=", EXPR_LESS_EQUAL}, {">=", EXPR_GREATER_EQUAL},
+                                              {"<", EXPR_LESS}, {">", EXPR_GREATER}, {0, EXPR_ADD}};
+static const exprBinary_t exprEquality[] = {{"==", EXPR_EQUAL}, {"!=", EXPR_NOT_EQUAL}, {0, EXPR_ADD}};
+static const exprBinary_t exprAnd[] = {{"&&", EXPR_AND}, {0, EXPR_ADD}};
+static const exprBinary_t exprOr[] = {{"||", EXPR_OR}, {0, EXPR_ADD}};
+
+static const exprBinary_t *exprLevels[] = {exprOr, exprAnd, exprEquality, exprRelational, exprAdditive,
+                                           exprMultiplicative};
+#define EXPR_LEVELS (int)(sizeof(exprLevels)/sizeof(exprLevels[0]))
+
+static void parseBinary(exprParser_t *pParser, int level)
+{
+  const exprBinary_t *pOp;
+
+  if (level == EXPR_LEVELS) {
+    parseUnary(pParser);
+    return;
+  }
+  parseBinary(pParser, level+1);
+  while (!pParser->failed) {
+    for (pOp=exprLevels[level]; pOp->token; pOp++) {
+      if (accept(pParser, pOp->token)) break;
+    }
+    if (!pOp->token) break;
+    parseBinary(pParser, level+1);
+    emit(pParser, pOp->op, 0., -1);
+  }
+}
+
+static void parseTernary(exprParser_t *pParser)
+{
+  parseBinary(pParser, 0);
+  if (accept(pParser, "?")) {
+    parseTernary(pParser);
+    expect(pParser, ":", "expected :");
+    parseTernary(pParser);
+    emit(pParser, EXPR_SELECT, 0., -2);
+  }
+}
+
+/** Compiles an expression.
+  * \param[in] pText The expression.
+  * \param[out] pExpression The compiled expression.
+  * \param[out] pError A message that describes the error, if there is one; may be NULL.
+  * \param[in] errorSize The size of pError.
+  * \return ND_SUCCESS, or ND_ERROR if the expression is not valid.
+  */
+int NDProcessExpressionCompile(const char *pText, NDProcessExpression_t *pExpression, char *pError,
+                               size_t errorSize)
+{
+  exprParser_t parser;
+
+  memset(pExpression, 0, sizeof(*pExpression));
+  parser.pText = pText;
+  parser.pPos = pText;
+  parser.pExpression = pExpression;
+  parser.depth = 0;
+  parser.nesting = 0;
+  parser.pError = pError;
+  parser.errorSize = errorSize;
+  parser.failed = 0;
+  if (pError && (errorSize > 0)) pError[0] = '\0';
+
+  parseTernary(&parser);
+  skipSpace(&parser);
+  if (*parser.pPos != '\0') parseError(&parser, "unexpected character");
+  if (parser.failed) {
+    pExpression->nOps = 0;
+    return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Evaluates a compiled expression for each element.
+  * \param[in] pExpression The compiled expression.
+  * \param[in] pX The input elements.
+  * \param[in] pBackground The background elements; if NULL the background is 0.
+  * \param[in] pFlatField The flat field elements; if NULL the flat field is 1.
+  * \param[in] firstIndex The index i of the first element.
+  * \param[in] pNameValues The values of the frame attributes, in the order of pExpression->names.
+  * \param[out] pOut The nElements results.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS, or ND_ERROR if the expression has not been compiled.
+  */
+int NDProcessExpressionEvaluate(const NDProcessExpression_t *pExpression, const double *pX,
+                                const double *pBackground, const double *pFlatField, size_t firstIndex,
+                                const double *pNameValues, double *pOut, size_t nElements)
+{
+  double stack[ND_EXPRESSION_MAX_STACK][ND_EXPRESSION_BLOCK];
+  double *a, *b, *c;
+  size_t start, n, i;
+  int pc, sp;
+
+  if (pExpression->nOps == 0) return ND_ERROR;
+  for (start=0; start<nElements; start+=n) {
+    n = (nElements - start > ND_EXPRESSION_BLOCK) ? ND_EXPRESSION_BLOCK : nElements - start;
+    sp = 0;
+    for (pc=0; pc<pExpression->nOps; pc++) {
+      double operand = pExpression->operands[pc];
+      /* The top three entries of the stack, c being the top */
+      c = (sp > 0) ? stack[sp-1] : stack[0];
+      b = (sp > 1) ? stack[sp-2] : stack[0];
+      a = (sp > 2) ? stack[sp-3] : stack[0];
+      switch (pExpression->ops[pc]) {
+        case EXPR_CONSTANT:
+          for (i=0; i<n; i++) stack[sp][i] = operand;
+          sp++;
+          break;
+        case EXPR_X:
+          memcpy(stack[sp], pX + start, n*sizeof(double));
+          sp++;
+          break;
+        case EXPR_BACKGROUND:
+          if (pBackground) memcpy(stack[sp], pBackground + start, n*sizeof(double));
+          else for (i=0; i<n; i++) stack[sp][i] = 0.;
+          sp++;
+          break;
+        case EXPR_FLAT_FIELD:
+          if (pFlatField) memcpy(stack[sp], pFlatField + start, n*sizeof(double));
+          else for (i=0; i<n; i++) stack[sp][i] = 1.;
+          sp++;
+          break;
+        case EXPR_INDEX:
+          for (i=0; i<n; i++) stack[sp][i] = (double)(firstIndex + start + i);
+          sp++;
+          break;
+        case EXPR_NAME:
+          for (i=0; i<n; i++) stack[sp][i] = pNameValues[(int)operand];
+          sp++;
+          break;
+        case EXPR_NEGATE:
+          for (i=0; i<n; i++) c[i] = -c[i];
+          break;
+        case EXPR_NOT:
+          for (i=0; i<n; i++) c[i] = (c[i] == 0.) ? 1. : 0.;
+          break;
+        case EXPR_ADD:
+          for (i=0; i<n; i++) b[i] = b[i] + c[i];
+          sp--;
+          break;
+        case EXPR_SUBTRACT:
+          for (i=0; i<n; i++) b[i] = b[i] - c[i];
+          sp--;
+          break;
+        case EXPR_MULTIPLY:
+          for (i=0; i<n; i++) b[i] = b[i] * c[i];
+          sp--;
+          break;
+        case EXPR_DIVIDE:
+          for (i=0; i<n; i++) b[i] = b[i] / c[i];
+          sp--;
+          break;
+        case EXPR_POWER:
+          for (i=0; i<n; i++) b[i] = pow(b[i], c[i]);
+          sp--;
+          break;
+        case EXPR_LESS:
+          for (i=0; i<n; i++) b[i] = (b[i] < c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_LESS_EQUAL:
+          for (i=0; i<n; i++) b[i] = (b[i] <= c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_GREATER:
+          for (i=0; i<n; i++) b[i] = (b[i] > c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_GREATER_EQUAL:
+          for (i=0; i<n; i++) b[i] = (b[i] >= c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_EQUAL:
+          for (i=0; i<n; i++) b[i] = (b[i] == c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_NOT_EQUAL:
+          for (i=0; i<n; i++) b[i] = (b[i] != c[i]) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_AND:
+          for (i=0; i<n; i++) b[i] = ((b[i] != 0.) && (c[i] != 0.)) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_OR:
+          for (i=0; i<n; i++) b[i] = ((b[i] != 0.) || (c[i] != 0.)) ? 1. : 0.;
+          sp--;
+          break;
+        case EXPR_SELECT:
+          for (i=0; i<n; i++) a[i] = (a[i] != 0.) ? b[i] : c[i];
+          sp -= 2;
+          break;
+        case EXPR_ABS:
+          for (i=0; i<n; i++) c[i] = fabs(c[i]);
+          break;
+        case EXPR_SQRT:
+          for (i=0; i<n; i++) c[i] = sqrt(c[i]);
+          break;
+        case EXPR_EXP:
+          for (i=0; i<n; i++) c[i] = exp(c[i]);
+          break;
+        case EXPR_LOG:
+          for (i=0; i<n; i++) c[i] = log(c[i]);
+          break;
+        case EXPR_FLOOR:
+          for (i=0; i<n; i++) c[i] = floor(c[i]);
+          break;
+        case EXPR_MIN:
+          for (i=0; i<n; i++) b[i] = (c[i] < b[i]) ? c[i] : b[i];
+          sp--;
+          break;
+        case EXPR_MAX:
+          for (i=0; i<n; i++) b[i] = (c[i] > b[i]) ? c[i] : b[i];
+          sp--;
+          break;
+        default:
+          return ND_ERROR;
+      }
+    }
+    memcpy(pOut + start, stack[0], n*sizeof(double));
+  }
+  return ND_SUCCESS;
+}
@@ -0,0 +1,49 @@
+/** NDProcessExpression.h
+ *
+ * Per-element expressions for NDPluginProcess, such as "x - b > 10 ? (x - b) * f : 0".
+ * An expression is compiled once into a program for a stack machine whose operands are blocks of elements, so each
+ * instruction is a loop over a block that the compiler vectorizes, and the cost of interpreting the program is
+ * shared by all the elements of the block.
+ *
+ */
+
+#ifndef NDProcessExpression_H
+#define NDProcessExpression_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+#define ND_EXPRESSION_MAX_OPS     128   /**< Maximum number of instructions of a program */
+#define ND_EXPRESSION_MAX_STACK    16   /**< Maximum depth of the stack of a program */
+#define ND_EXPRESSION_MAX_NAMES     8   /**< Maximum number of frame attributes of an expression */
+#define ND_EXPRESSION_NAME_LEN     40   /**< Maximum length of an attribute name, including the terminator */
+#define ND_EXPRESSION_BLOCK       128   /**< Number of elements evaluated at a time */
+
+/** A compiled expression */
+typedef struct {
+    int nOps;                       /**< Number of instructions */
+    unsigned char ops[ND_EXPRESSION_MAX_OPS];
+    double operands[ND_EXPRESSION_MAX_OPS];     /**< The value of constants, the index of attributes */
+    int nNames;                     /**< Number of frame attributes */
+    char names[ND_EXPRESSION_MAX_NAMES][ND_EXPRESSION_NAME_LEN];    /**< Names of the frame attributes */
+} NDProcessExpression_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDProcessExpressionCompile(const char *pText, NDProcessExpression_t *pExpression,
+                                              char *pError, size_t errorSize);
+epicsShareFunc int NDProcessExpressionEvaluate(const NDProcessExpression_t *pExpression, const double *pX,
+                                               const double *pBackground, const double *pFlatField,
+                                               size_t firstIndex, const double *pNameValues, double *pOut,
+                                               size_t nElements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,710 @@
+/** NDProcessKernels.cpp
+ *
+ * Vectorized kernels for the background, flat field, offset and scale, and clipping corrections of NDPluginProcess.
+ * The kernels for each instruction set are compiled with function target attributes, as in NDConvertKernels.cpp,
+ * and the instruction set is the one NDSimdLevel() returns.
+ *
+ * There is one kernel for each combination of enabled corrections, selected once per call, so the loops have
+ * no branches.  The flat field is applied as a multiply and an add with gain and bias maps that are computed
+ * once for each flat field, so there is no division and elements where the flat field is 0 need no test.
+ * The vector kernels do the same operations in the same order as the scalar ones, without fused multiply-adds,
+ * so their results are identical.
+ *
+ * The accumulator kernels add frames to, or subtract them from, integer or Float64 sums; UInt16 frames summed
+ * in Int32, the common case for detectors, have vectorized kernels.
+ *
+ * The temporal filters compute the median, minimum or maximum of each element over the last frames.  The median
+ * is selected with a sorting network, a fixed sequence of compare-exchanges that is applied to vectors of
+ * elements, so each element needs no sort of its own.  The comparators that do not lead to the median are
+ * removed from the network.
+ *
+ */
+
+#include <epicsTypes.h>
+
+#include <NDConvertKernels.h>
+#include <NDFloat16.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDProcessKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+/* The bits of the kernel index, one for each correction */
+#define CORRECT_BACKGROUND  1
+#define CORRECT_GAIN        2
+#define CORRECT_OFFSET      4
+#define CORRECT_HIGH_CLIP   8
+#define CORRECT_LOW_CLIP   16
+#define CORRECT_KERNELS    32
+
+/* The constants of the corrections in the type of the elements */
+template <typename epicsType>
+struct correctConsts {
+  epicsType offset;
+  epicsType scale;
+  epicsType highClip;
+  epicsType lowClip;
+};
+
+/* One entry for each combination of corrections */
+#define CORRECT_4(kernel, base) kernel<(base)>, kernel<(base)+1>, kernel<(base)+2>, kernel<(base)+3>
+#define CORRECT_TABLE(kernel) { \
+  CORRECT_4(kernel, 0),  CORRECT_4(kernel, 4),  CORRECT_4(kernel, 8),  CORRECT_4(kernel, 12), \
+  CORRECT_4(kernel, 16), CORRECT_4(kernel, 20), CORRECT_4(kernel, 24), CORRECT_4(kernel, 28) }
+
+/* Scalar kernels, which also handle the elements left over by the vector loops.
+ * They process the elements start to n-1 and return n. */
+
+template <typename epicsType, int features>
+static size_t correctScalarT(const correctConsts<epicsType> *pC, epicsType *pValues, const epicsType *pBackground,
+                             const epicsType *pGain, const epicsType *pBias, size_t start, size_t n)
+{
+  size_t i;
+  for (i=start; i<n; i++) {
+    epicsType value = pValues[i];
+    if (features & CORRECT_BACKGROUND) value -= pBackground[i];
+    if (features & CORRECT_GAIN) value = value * pGain[i] + pBias[i];
+    if (features & CORRECT_OFFSET) value = (value + pC->offset) * pC->scale;
+    if (features & CORRECT_HIGH_CLIP) value = (value > pC->highClip) ? pC->highClip : value;
+    if (features & CORRECT_LOW_CLIP) value = (value < pC->lowClip) ? pC->lowClip : value;
+    pValues[i] = value;
+  }
+  return n;
+}
+
+template <int features>
+static size_t correctFloat32Scalar(const correctConsts<epicsFloat32> *pC, epicsFloat32 *pValues,
+                                   const epicsFloat32 *pBackground, const epicsFloat32 *pGain,
+                                   const epicsFloat32 *pBias, size_t start, size_t n)
+{
+  return correctScalarT<epicsFloat32, features>(pC, pValues, pBackground, pGain, pBias, start, n);
+}
+
+template <int features>
+static size_t correctFloat64Scalar(const correctConsts<epicsFloat64> *pC, epicsFloat64 *pValues,
+                                   const epicsFloat64 *pBackground, const epicsFloat64 *pGain,
+                                   const epicsFloat64 *pBias, size_t start, size_t n)
+{
+  return correctScalarT<epicsFloat64, features>(pC, pValues, pBackground, pGain, pBias, start, n);
+}
+
+/* Vector kernels.  They process whole vectors from start and return the index of the first element they did not
+ * process.  min(high, v) and max(low, v) return v when it is NaN, as the comparisons of the scalar kernels do. */
+
+#if defined(ND_SIMD_X86)
+
+template <int features>
+ND_TARGET("sse2")
+static size_t correctFloat32SSE2(const correctConsts<epicsFloat32> *pC, epicsFloat32 *pValues,
+                                 const epicsFloat32 *pBackground, const epicsFloat32 *pGain,
+                                 const epicsFloat32 *pBias, size_t start, size_t n)
+{
+  __m128 offset = _mm_set1_ps(pC->offset), scale = _mm_set1_ps(pC->scale);
+  __m128 highClip = _mm_set1_ps(pC->highClip), lowClip = _mm_set1_ps(pC->lowClip);
+  size_t i;
+
+  for (i=start; i+4<=n; i+=4) {
+    __m128 v = _mm_loadu_ps(pValues + i);
+    if (features & CORRECT_BACKGROUND) v = _mm_sub_ps(v, _mm_loadu_ps(pBackground + i));
+    if (features & CORRECT_GAIN)
+      v = _mm_add_ps(_mm_mul_ps(v, _mm_loadu_ps(pGain + i)), _mm_loadu_ps(pBias + i));
+    if (features & CORRECT_OFFSET) v = _mm_mul_ps(_mm_add_ps(v, offset), scale);
+    if (features & CORRECT_HIGH_CLIP) v = _mm_min_ps(highClip, v);
+    if (features & CORRECT_LOW_CLIP) v = _mm_max_ps(lowClip, v);
+    _mm_storeu_ps(pValues + i, v);
+  }
+  return i;
+}
+
+template <int features>
+ND_TARGET("avx2")
+static size_t correctFloat32AVX2(const correctConsts<epicsFloat32> *pC, epicsFloat32 *pValues,
+                                 const epicsFloat32 *pBackground, const epicsFloat32 *pGain,
+                                 const epicsFloat32 *pBias, size_t start, size_t n)
+{
+  __m256 offset = _mm256_set1_ps(pC->offset), scale = _mm256_set1_ps(pC->scale);
+  __m256 highClip = _mm256_set1_ps(pC->highClip), lowClip = _mm256_set1_ps(pC->lowClip);
+  size_t i;
+
+  for (i=start; i+8<=n; i+=8) {
+    __m256 v = _mm256_loadu_ps(pValues + i);
+    if (features & CORRECT_BACKGROUND) v = _mm256_sub_ps(v, _mm256_loadu_ps(pBackground + i));
+    if (features & CORRECT_GAIN)
+      v = _mm256_add_ps(_mm256_mul_ps(v, _mm256_loadu_ps(pGain + i)), _mm256_loadu_ps(pBias + i));
+    if (features & CORRECT_OFFSET) v = _mm256_mul_ps(_mm256_add_ps(v, offset), scale);
+    if (features & CORRECT_HIGH_CLIP) v = _mm256_min_ps(highClip, v);
+    if (features & CORRECT_LOW_CLIP) v = _mm256_max_ps(lowClip, v);
+    _mm256_storeu_ps(pValues + i, v);
+  }
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+template <int features>
+static size_t correctFloat32NEON(const correctConsts<epicsFloat32> *pC, epicsFloat32 *pValues,
+                                 const epicsFloat32 *pBackground, const epicsFloat32 *pGain,
+                                 const epicsFloat32 *pBias, size_t start, size_t n)
+{
+  float32x4_t offset = vdupq_n_f32(pC->offset), scale = vdupq_n_f32(pC->scale);
+  float32x4_t highClip = vdupq_n_f32(pC->highClip), lowClip = vdupq_n_f32(pC->lowClip);
+  size_t i;
+
+  for (i=start; i+4<=n; i+=4) {
+    float32x4_t v = vld1q_f32(pValues + i);
+    if (features & CORRECT_BACKGROUND) v = vsubq_f32(v, vld1q_f32(pBackground + i));
+    /* vmlaq_f32 may be fused on AArch64, so the multiply and the add are separate */
+    if (features & CORRECT_GAIN) v = vaddq_f32(vmulq_f32(v, vld1q_f32(pGain + i)), vld1q_f32(pBias + i));
+    if (features & CORRECT_OFFSET) v = vmulq_f32(vaddq_f32(v, offset), scale);
+    /* vminq_f32 and vmaxq_f32 return NaN if either input is NaN, so the clips use comparisons */
+    if (features & CORRECT_HIGH_CLIP) v = vbslq_f32(vcgtq_f32(v, highClip), highClip, v);
+    if (features & CORRECT_LOW_CLIP) v = vbslq_f32(vcltq_f32(v, lowClip), lowClip, v);
+    vst1q_f32(pValues + i, v);
+  }
+  return i;
+}
+
+#endif
+
+template <typename epicsType>
+static void correctConstants(const NDProcessCorrection_t *pCorrection, correctConsts<epicsType> *pC)
+{
+  pC->offset = (epicsType)pCorrection->offset;
+  pC->scale = (epicsType)pCorrection->scale;
+  pC->highClip = (epicsType)pCorrection->highClip;
+  pC->lowClip = (epicsType)pCorrection->lowClip;
+}
+
+template <typename epicsType>
+static void gainMapT(const epicsType *pFlatField, const epicsType *pBackground, double scaleFlatField,
+                     epicsType *pGain, epicsType *pBias, size_t n)
+{
+  epicsType scale = (epicsType)scaleFlatField;
+  size_t i;
+
+  for (i=0; i<n; i++) {
+    if (pFlatField[i] != 0) {
+      pGain[i] = scale / pFlatField[i];
+      pBias[i] = pBackground ? -pBackground[i] * pGain[i] : 0;
+    } else {
+      pGain[i] = 0;
+      pBias[i] = scale;
+    }
+  }
+}
+
+/** Computes the gain and bias maps that NDProcessCorrect() applies as value*gain+bias for the flat field
+  * normalization, optionally with the background subtraction folded in.
+  * Where the flat field is not 0 the gain is scaleFlatField/flatField and the bias is -background*gain, or 0;
+  * where it is 0 the gain is 0 and the bias is scaleFlatField, so those elements become scaleFlatField.
+  * The arithmetic is done in the data type of the elements.
+  * \param[in] dataType The data type of all of the arrays, NDFloat32 or NDFloat64.
+  * \param[in] pFlatField The flat field.
+  * \param[in] pBackground The background to fold into the bias, or NULL.
+  * \param[in] scaleFlatField The scale factor after dividing by the flat field.
+  * \param[out] pGain The gain map.
+  * \param[out] pBias The bias map.
+  * \param[in] nElements The number of elements of each array.
+  * \return ND_SUCCESS if the maps were computed, ND_ERROR if the data type is not a floating point type.
+  */
+int NDProcessGainMap(NDDataType_t dataType, const void *pFlatField, const void *pBackground,
+                     double scaleFlatField, void *pGain, void *pBias, size_t nElements)
+{
+  if (dataType == NDFloat32) {
+    gainMapT((const epicsFloat32 *)pFlatField, (const epicsFloat32 *)pBackground, scaleFlatField,
+             (epicsFloat32 *)pGain, (epicsFloat32 *)pBias, nElements);
+    return ND_SUCCESS;
+  }
+  if (dataType == NDFloat64) {
+    gainMapT((const epicsFloat64 *)pFlatField, (const epicsFloat64 *)pBackground, scaleFlatField,
+             (epicsFloat64 *)pGain, (epicsFloat64 *)pBias, nElements);
+    return ND_SUCCESS;
+  }
+  return ND_ERROR;
+}
+
+/** Applies the enabled corrections of NDPluginProcess to a contiguous block of elements in place, with the kernel
+  * for that combination of corrections and the fastest instruction set the CPU supports.
+  * They are applied in the order of NDProcessCorrection_t: value-background, value*gain+bias,
+  * (value+offset)*scale, then the high and the low clip.
+  * The arithmetic is done in the data type of the elements, and Float32 has vectorized kernels.
+  * \param[in] dataType The data type of the elements and of the maps, NDFloat32 or NDFloat64.
+  * \param[in] pCorrection The corrections and their constants.
+  * \param[in,out] pValues The elements.
+  * \param[in] pBackground The background, with nElements elements; not used if enableBackground is 0.
+  * \param[in] pGain The gain map from NDProcessGainMap(); not used if enableGain is 0.
+  * \param[in] pBias The bias map from NDProcessGainMap(); not used if enableGain is 0.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS if the corrections were applied, ND_ERROR if the data type is not a floating point type.
+  */
+int NDProcessCorrect(NDDataType_t dataType, const NDProcessCorrection_t *pCorrection,
+                     void *pValues, const void *pBackground, const void *pGain, const void *pBias,
+                     size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  int features = 0;
+  size_t done = 0;
+
+  if (pCorrection->enableBackground)  features |= CORRECT_BACKGROUND;
+  if (pCorrection->enableGain)        features |= CORRECT_GAIN;
+  if (pCorrection->enableOffsetScale) features |= CORRECT_OFFSET;
+  if (pCorrection->enableHighClip)    features |= CORRECT_HIGH_CLIP;
+  if (pCorrection->enableLowClip)     features |= CORRECT_LOW_CLIP;
+
+  if (dataType == NDFloat32) {
+    typedef size_t (*kernel_t)(const correctConsts<epicsFloat32> *, epicsFloat32 *, const epicsFloat32 *,
+                               const epicsFloat32 *, const epicsFloat32 *, size_t, size_t);
+    static const kernel_t scalarKernels[CORRECT_KERNELS] = CORRECT_TABLE(correctFloat32Scalar);
+    kernel_t kernel = 0;
+    correctConsts<epicsFloat32> c;
+#if defined(ND_SIMD_X86)
+    static const kernel_t sse2Kernels[CORRECT_KERNELS] = CORRECT_TABLE(correctFloat32SSE2);
+    static const kernel_t avx2Kernels[CORRECT_KERNELS] = CORRECT_TABLE(correctFloat32AVX2);
+    if (level >= NDSimdAVX2)      kernel = avx2Kernels[features];
+    else if (level >= NDSimdSSE2) kernel = sse2Kernels[features];
+#elif defined(ND_SIMD_NEON)
+    static const kernel_t neonKernels[CORRECT_KERNELS] = CORRECT_TABLE(correctFloat32NEON);
+    if (level == NDSimdNEON) kernel = neonKernels[features];
+#endif
+    if (features == 0) return ND_SUCCESS;
+    correctConstants(pCorrection, &c);
+    if (kernel) done = kernel(&c, (epicsFloat32 *)pValues, (const epicsFloat32 *)pBackground,
+                              (const epicsFloat32 *)pGain, (const epicsFloat32 *)pBias, 0, nElements);
+    scalarKernels[features](&c, (epicsFloat32 *)pValues, (const epicsFloat32 *)pBackground,
+                            (const epicsFloat32 *)pGain, (const epicsFloat32 *)pBias, done, nElements);
+    return ND_SUCCESS;
+  }
+
+  if (dataType == NDFloat64) {
+    typedef size_t (*kernel_t)(const correctConsts<epicsFloat64> *, epicsFloat64 *, const epicsFloat64 *,
+                               const epicsFloat64 *, const epicsFloat64 *, size_t, size_t);
+    static const kernel_t scalarKernels[CORRECT_KERNELS] = CORRECT_TABLE(correctFloat64Scalar);
+    correctConsts<epicsFloat64> c;
+    if (features == 0) return ND_SUCCESS;
+    correctConstants(pCorrection, &c);
+    scalarKernels[features](&c, (epicsFloat64 *)pValues, (const epicsFloat64 *)pBackground,
+                            (const epicsFloat64 *)pGain, (const epicsFloat64 *)pBias, 0, nElements);
+    return ND_SUCCESS;
+  }
+
+  (void)level;
+  return ND_ERROR;
+}
+
+/* Accumulator kernels.  The scalar kernels process the elements start to n-1 and the vector kernels process whole
+ * vectors from start and return the index of the first element they did not process. */
+
+template <typename epicsType, typename accType>
+static void accumulateScalarT(const epicsType *pData, accType *pAcc, NDProcessAccOp_t operation,
+                              size_t start, size_t n)
+{
+  size_t i;
+  switch (operation) {
+    case NDProcessAccSet:
+      for (i=start; i<n; i++) pAcc[i] = (accType)pData[i];
+      break;
+    case NDProcessAccAdd:
+      for (i=start; i<n; i++) pAcc[i] += (accType)pData[i];
+      break;
+    case NDProcessAccSubtract:
+      for (i=start; i<n; i++) pAcc[i] -= (accType)pData[i];
+      break;
+  }
+}
+
+template <typename epicsType>
+static int accumulateScalar(const epicsType *pData, NDProcessAccType_t accType, void *pAcc,
+                            NDProcessAccOp_t operation, size_t start, size_t n)
+{
+  switch (accType) {
+    case NDProcessAccInt32:
+      accumulateScalarT(pData, (epicsInt32 *)pAcc, operation, start, n);
+      break;
+    case NDProcessAccInt64:
+      accumulateScalarT(pData, (epicsInt64 *)pAcc, operation, start, n);
+      break;
+    case NDProcessAccFloat64:
+      accumulateScalarT(pData, (epicsFloat64 *)pAcc, operation, start, n);
+      break;
+    default:
+      return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+#if defined(ND_SIMD_X86)
+
+template <int operation>
+ND_TARGET("sse2")
+static size_t accumulateUInt16Int32SSE2(const epicsUInt16 *pData, epicsInt32 *pAcc, size_t n)
+{
+  __m128i zero = _mm_setzero_si128();
+  size_t i;
+
+  for (i=0; i+8<=n; i+=8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pData + i));
+    __m128i lo = _mm_unpacklo_epi16(v, zero);
+    __m128i hi = _mm_unpackhi_epi16(v, zero);
+    if (operation == NDProcessAccAdd) {
+      lo = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(pAcc + i)), lo);
+      hi = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(pAcc + i + 4)), hi);
+    } else if (operation == NDProcessAccSubtract) {
+      lo = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(pAcc + i)), lo);
+      hi = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(pAcc + i + 4)), hi);
+    }
+    _mm_storeu_si128((__m128i *)(pAcc + i), lo);
+    _mm_storeu_si128((__m128i *)(pAcc + i + 4), hi);
+  }
+  return i;
+}
+
+template <int operation>
+ND_TARGET("avx2")
+static size_t accumulateUInt16Int32AVX2(const epicsUInt16 *pData, epicsInt32 *pAcc, size_t n)
+{
+  size_t i;
+
+  for (i=0; i+8<=n; i+=8) {
+    __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pData + i)));
+    if (operation == NDProcessAccAdd)
+      v = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(pAcc + i)), v);
+    else if (operation == NDProcessAccSubtract)
+      v = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(pAcc + i)), v);
+    _mm256_storeu_si256((__m256i *)(pAcc + i), v);
+  }
+  return i;
+}
+
+#elif defined(ND_SIMD_NEON)
+
+template <int operation>
+static size_t accumulateUInt16Int32NEON(const epicsUInt16 *pData, epicsInt32 *pAcc, size_t n)
+{
+  size_t i;
+
+  for (i=0; i+8<=n; i+=8) {
+    uint16x8_t v = vld1q_u16(pData + i);
+    int32x4_t lo = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(v)));
+    int32x4_t hi = vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(v)));
+    if (operation == NDProcessAccAdd) {
+      lo = vaddq_s32(vld1q_s32(pAcc + i), lo);
+      hi = vaddq_s32(vld1q_s32(pAcc + i + 4), hi);
+    } else if (operation == NDProcessAccSubtract) {
+      lo = vsubq_s32(vld1q_s32(pAcc + i), lo);
+      hi = vsubq_s32(vld1q_s32(pAcc + i + 4), hi);
+    }
+    vst1q_s32(pAcc + i, lo);
+    vst1q_s32(pAcc + i + 4, hi);
+  }
+  return i;
+}
+
+#endif
+
+/** Sets, adds a frame to, or subtracts a frame from an accumulator, element by element.
+  * The integer accumulators wrap around if they overflow, so the caller chooses a type that is wide enough
+  * for the number of frames.
+  * \param[in] dataType The data type of the frame.
+  * \param[in] pData The elements of the frame.
+  * \param[in] accType The type of the accumulator.
+  * \param[in,out] pAcc The accumulator, with nElements elements.
+  * \param[in] operation Set the accumulator to the frame, add the frame or subtract it.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS, or ND_ERROR if the data type or the accumulator type is not valid.
+  */
+int NDProcessAccumulate(NDDataType_t dataType, const void *pData, NDProcessAccType_t accType,
+                        void *pAcc, NDProcessAccOp_t operation, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t done = 0;
+
+  if ((dataType == NDUInt16) && (accType == NDProcessAccInt32)) {
+    typedef size_t (*kernel_t)(const epicsUInt16 *, epicsInt32 *, size_t);
+    kernel_t kernel = 0;
+#if defined(ND_SIMD_X86)
+    static const kernel_t sse2Kernels[3] = {accumulateUInt16Int32SSE2<NDProcessAccSet>,
+      accumulateUInt16Int32SSE2<NDProcessAccAdd>, accumulateUInt16Int32SSE2<NDProcessAccSubtract>};
+    static const kernel_t avx2Kernels[3] = {accumulateUInt16Int32AVX2<NDProcessAccSet>,
+      accumulateUInt16Int32AVX2<NDProcessAccAdd>, accumulateUInt16Int32AVX2<NDProcessAccSubtract>};
+    if ((operation >= NDProcessAccSet) && (operation <= NDProcessAccSubtract)) {
+      if (level >= NDSimdAVX2)      kernel = avx2Kernels[operation];
+      else if (level >= NDSimdSSE2) kernel = sse2Kernels[operation];
+    }
+#elif defined(ND_SIMD_NEON)
+    static const kernel_t neonKernels[3] = {accumulateUInt16Int32NEON<NDProcessAccSet>,
+      accumulateUInt16Int32NEON<NDProcessAccAdd>, accumulateUInt16Int32NEON<NDProcessAccSubtract>};
+    if ((level == NDSimdNEON) && (operation >= NDProcessAccSet) && (operation <= NDProcessAccSubtract))
+      kernel = neonKernels[operation];
+#endif
+    if (kernel) done = kernel((const epicsUInt16 *)pData, (epicsInt32 *)pAcc, nElements);
+  }
+  (void)level;
+
+  switch (dataType) {
+    case NDInt8:
+      return accumulateScalar((const epicsInt8 *)pData, accType, pAcc, operation, done, nElements);
+    case NDUInt8:
+      return accumulateScalar((const epicsUInt8 *)pData, accType, pAcc, operation, done, nElements);
+    case NDInt16:
+      return accumulateScalar((const epicsInt16 *)pData, accType, pAcc, operation, done, nElements);
+    case NDUInt16:
+      return accumulateScalar((const epicsUInt16 *)pData, accType, pAcc, operation, done, nElements);
+    case NDInt32:
+      return accumulateScalar((const epicsInt32 *)pData, accType, pAcc, operation, done, nElements);
+    case NDUInt32:
+      return accumulateScalar((const epicsUInt32 *)pData, accType, pAcc, operation, done, nElements);
+    case NDFloat32:
+      return accumulateScalar((const epicsFloat32 *)pData, accType, pAcc, operation, done, nElements);
+    case NDFloat64:
+      return accumulateScalar((const epicsFloat64 *)pData, accType, pAcc, operation, done, nElements);
+    default:
+      return ND_ERROR;
+  }
+}
+
+/* Temporal filters.  The median is the element (nFrames-1)/2 of a Batcher odd-even merge sorting network for
+ * nFrames wires.  The compare-exchanges are written as vector min and max, lo = (a < b) ? a : b and
+ * hi = (a > b) ? a : b, so the scalar and vector kernels select the same elements. */
+
+#define TEMPORAL_MAX_PAIRS 256
+
+typedef struct {
+  int nPairs;
+  int median;
+  unsigned char pairs[TEMPORAL_MAX_PAIRS][2];
+} temporalNetwork_t;
+
+static void temporalNetwork(int nFrames, temporalNetwork_t *pNet)
+{
+  unsigned char pairs[TEMPORAL_MAX_PAIRS][2];
+  int needed[ND_PROCESS_MAX_TEMPORAL] = {0};
+  int nPairs = 0, nWires, p, k, i, j;
+
+  for (nWires=1; nWires<nFrames; nWires*=2) ;
+  for (p=1; p<nWires; p*=2) {
+    for (k=p; k>=1; k/=2) {
+      for (j=k%p; j+k<nWires; j+=2*k) {
+        for (i=0; i<k; i++) {
+          /* Comparators with a wire past the last frame are removed, as if those wires held +infinity */
+          if (((i+j)/(2*p) == (i+j+k)/(2*p)) && (i+j+k < nFrames)) {
+            pairs[nPairs][0] = (unsigned char)(i+j);
+            pairs[nPairs][1] = (unsigned char)(i+j+k);
+            nPairs++;
+          }
+        }
+      }
+    }
+  }
+  /* Only the comparators that the median depends on are kept, found from the last one backwards */
+  pNet->median = (nFrames-1)/2;
+  needed[pNet->median] = 1;
+  pNet->nPairs = 0;
+  for (p=nPairs-1; p>=0; p--) {
+    if (needed[pairs[p][0]] || needed[pairs[p][1]]) {
+      needed[pairs[p][0]] = needed[pairs[p][1]] = 1;
+      pNet->nPairs++;
+    } else {
+      pairs[p][0] = pairs[p][1] = 0;
+    }
+  }
+  for (p=0, k=0; p<nPairs; p++) {
+    if (pairs[p][0] == pairs[p][1]) continue;
+    pNet->pairs[k][0] = pairs[p][0];
+    pNet->pairs[k][1] = pairs[p][1];
+    k++;
+  }
+}
+
+template <typename epicsType>
+static void temporalScalarT(const temporalNetwork_t *pNet, NDProcessTemporalOp_t operation,
+                            const epicsType *const *pFrames, int nFrames, size_t offset, epicsType *pOut,
+                            size_t start, size_t n)
+{
+  epicsType v[ND_PROCESS_MAX_TEMPORAL];
+  size_t i;
+  int k, p;
+
+  for (i=start; i<n; i++) {
+    if (operation == NDProcessTemporalMedian) {
+      for (k=0; k<nFrames; k++) v[k] = pFrames[k][offset + i];
+      for (p=0; p<pNet->nPairs; p++) {
+        epicsType a = v[pNet->pairs[p][0]], b = v[pNet->pairs[p][1]];
+        v[pNet->pairs[p][0]] = (a < b) ? a : b;
+        v[pNet->pairs[p][1]] = (a > b) ? a : b;
+      }
+      pOut[i] = v[pNet->median];
+    } else {
+      epicsType m = pFrames[0][offset + i];
+      for (k=1; k<nFrames; k++) {
+        epicsType value = pFrames[k][offset + i];
+        if (operation == NDProcessTemporalMin) m = (m < value) ? m : value;
+        else                                   m = (m > value) ? m : value;
+      }
+      pOut[i] = m;
+    }
+  }
+}
+
+template <typename epicsType>
+static void temporalScalar(const temporalNetwork_t *pNet, NDProcessTemporalOp_t operation,
+                           const void *const *pFrames, int nFrames, size_t offset, void *pOut,
+                           size_t start, size_t n)
+{
+  temporalScalarT(pNet, operation, (const epicsType *const *)pFrames, nFrames, offset, (epicsType *)pOut,
+                  start, n);
+}
+
+/* The vector kernels are one loop over vectors of elements, with the loads, stores, min and max of each
+ * instruction set and element type.  They return the index of the first element they did not process. */
+#define TEMPORAL_KERNEL(name, epicsType, vector_t, width, load, store, vmin, vmax)                        \
+static size_t name(const temporalNetwork_t *pNet, NDProcessTemporalOp_t operation,                       \
+                   const epicsType *const *pFrames, int nFrames, size_t offset, epicsType *pOut, size_t n) \
+{                                                                                                         \
+  vector_t v[ND_PROCESS_MAX_TEMPORAL];                                                                    \
+  size_t i;                                                                                               \
+  int k, p;                                                                                               \
+                                                                                                          \
+  for (i=0; i+(width)<=n; i+=(width)) {                                                                   \
+    if (operation == NDProcessTemporalMedian) {                                                           \
+      for (k=0; k<nFrames; k++) v[k] = load(pFrames[k] + offset + i);                                     \
+      for (p=0; p<pNet->nPairs; p++) {                                                                    \
+        vector_t a = v[pNet->pairs[p][0]], b = v[pNet->pairs[p][1]];                                      \
+        v[pNet->pairs[p][0]] = vmin(a, b);                                                                \
+        v[pNet->pairs[p][1]] = vmax(a, b);                                                                \
+      }                                                                                                   \
+      store(pOut + i, v[pNet->median]);                                                                   \
+    } else {                                                                                              \
+      vector_t m = load(pFrames[0] + offset + i);                                                         \
+      for (k=1; k<nFrames; k++) {                                                                         \
+        if (operation == NDProcessTemporalMin) m = vmin(m, load(pFrames[k] + offset + i));                \
+        else                                   m = vmax(m, load(pFrames[k] + offset + i));                \
+      }                                                                                                   \
+      store(pOut + i, m);                                                                                 \
+    }                                                                                                     \
+  }                                                                                                       \
+  return i;                                                                                               \
+}
+
+#if defined(ND_SIMD_X86)
+
+/* SSE2 has no unsigned 16-bit min and max, so the elements are offset by 0x8000 and compared as signed */
+ND_TARGET("sse2") static inline __m128i loadUInt16SSE2(const epicsUInt16 *p)
+{ return _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi16((short)0x8000)); }
+ND_TARGET("sse2") static inline void storeUInt16SSE2(epicsUInt16 *p, __m128i v)
+{ _mm_storeu_si128((__m128i *)p, _mm_xor_si128(v, _mm_set1_epi16((short)0x8000))); }
+ND_TARGET("avx2") static inline __m256i loadUInt16AVX2(const epicsUInt16 *p)
+{ return _mm256_loadu_si256((const __m256i *)p); }
+ND_TARGET("avx2") static inline void storeUInt16AVX2(epicsUInt16 *p, __m256i v)
+{ _mm256_storeu_si256((__m256i *)p, v); }
+
+ND_TARGET("sse2") TEMPORAL_KERNEL(temporalUInt16SSE2, epicsUInt16, __m128i, 8, loadUInt16SSE2, storeUInt16SSE2,
+                                  _mm_min_epi16, _mm_max_epi16)
+ND_TARGET("avx2") TEMPORAL_KERNEL(temporalUInt16AVX2, epicsUInt16, __m256i, 16, loadUInt16AVX2, storeUInt16AVX2,
+                                  _mm256_min_epu16, _mm256_max_epu16)
+ND_TARGET("sse2") TEMPORAL_KERNEL(temporalFloat32SSE2, epicsFloat32, __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+                                  _mm_min_ps, _mm_max_ps)
+ND_TARGET("avx2") TEMPORAL_KERNEL(temporalFloat32AVX2, epicsFloat32, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+                                  _mm256_min_ps, _mm256_max_ps)
+
+#elif defined(ND_SIMD_NEON)
+
+TEMPORAL_KERNEL(temporalUInt16NEON, epicsUInt16, uint16x8_t, 8, vld1q_u16, vst1q_u16, vminq_u16, vmaxq_u16)
+TEMPORAL_KERNEL(temporalFloat32NEON, epicsFloat32, float32x4_t, 4, vld1q_f32, vst1q_f32, vminq_f32, vmaxq_f32)
+
+#endif
+
+/** Computes the median, minimum or maximum of each element over a number of frames.
+  * Elements that are NaN in any frame give undefined results.
+  * \param[in] dataType The data type of the frames and of the output.
+  * \param[in] operation The median, the minimum or the maximum.
+  * \param[in] pFrames The frames, in any order.
+  * \param[in] nFrames The number of frames, 1 to ND_PROCESS_MAX_TEMPORAL.
+  * \param[in] offset The index in the frames of the first element.
+  * \param[out] pOut The nElements results.
+  * \param[in] nElements The number of elements.
+  * \return ND_SUCCESS, or ND_ERROR if the data type or the number of frames is not valid.
+  */
+int NDProcessTemporal(NDDataType_t dataType, NDProcessTemporalOp_t operation, const void *const *pFrames,
+                      int nFrames, size_t offset, void *pOut, size_t nElements)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  temporalNetwork_t net;
+  size_t done = 0;
+
+  if ((nFrames < 1) || (nFrames > ND_PROCESS_MAX_TEMPORAL)) return ND_ERROR;
+  if ((operation != NDProcessTemporalMedian) && (operation != NDProcessTemporalMin) &&
+      (operation != NDProcessTemporalMax)) return ND_ERROR;
+  net.nPairs = 0;
+  net.median = 0;
+  if (operation == NDProcessTemporalMedian) temporalNetwork(nFrames, &net);
+
+  if (dataType == NDUInt16) {
+    typedef size_t (*kernel_t)(const temporalNetwork_t *, NDProcessTemporalOp_t, const epicsUInt16 *const *,
+                               int, size_t, epicsUInt16 *, size_t);
+    kernel_t kernel = 0;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      kernel = temporalUInt16AVX2;
+    else if (level >= NDSimdSSE2) kernel = temporalUInt16SSE2;
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) kernel = temporalUInt16NEON;
+#endif
+    if (kernel) done = kernel(&net, operation, (const epicsUInt16 *const *)pFrames, nFrames, offset,
+                              (epicsUInt16 *)pOut, nElements);
+  } else if (dataType == NDFloat32) {
+    typedef size_t (*kernel_t)(const temporalNetwork_t *, NDProcessTemporalOp_t, const epicsFloat32 *const *,
+                               int, size_t, epicsFloat32 *, size_t);
+    kernel_t kernel = 0;
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdAVX2)      kernel = temporalFloat32AVX2;
+    else if (level >= NDSimdSSE2) kernel = temporalFloat32SSE2;
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) kernel = temporalFloat32NEON;
+#endif
+    if (kernel) done = kernel(&net, operation, (const epicsFloat32 *const *)pFrames, nFrames, offset,
+                              (epicsFloat32 *)pOut, nElements);
+  }
+  (void)level;
+
+  switch (dataType) {
+    case NDInt8:
+      temporalScalar<epicsInt8>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDUInt8:
+      temporalScalar<epicsUInt8>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDInt16:
+      temporalScalar<epicsInt16>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDUInt16:
+      temporalScalar<epicsUInt16>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDInt32:
+      temporalScalar<epicsInt32>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDUInt32:
+      temporalScalar<epicsUInt32>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDFloat32:
+      temporalScalar<epicsFloat32>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDFloat64:
+      temporalScalar<epicsFloat64>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    case NDFloat16:
+      temporalScalar<NDFloat16_t>(&net, operation, pFrames, nFrames, offset, pOut, done, nElements);
+      break;
+    default:
+      return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
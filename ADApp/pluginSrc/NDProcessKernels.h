@@ -0,0 +1,75 @@
+/** NDProcessKernels.h
+ *
+ * Vectorized kernels for the per-element corrections of NDPluginProcess: background subtraction, flat field
+ * normalization with a precomputed gain map, offset and scale, and high and low clipping, for its frame
+ * accumulator, and for its temporal median, minimum and maximum filters.
+ * The instruction set is selected at run time from the features of the CPU, as for the conversion kernels.
+ *
+ */
+
+#ifndef NDProcessKernels_H
+#define NDProcessKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The corrections applied by NDProcessCorrect(), in this order */
+typedef struct {
+    int    enableBackground;    /**< Subtract the background */
+    int    enableGain;          /**< Multiply by the gain map and add the bias map, see NDProcessGainMap() */
+    int    enableOffsetScale;   /**< Add offset, then multiply by scale */
+    double offset;              /**< Offset */
+    double scale;               /**< Scale */
+    int    enableHighClip;      /**< Clip values above highClip */
+    double highClip;            /**< High clip value */
+    int    enableLowClip;       /**< Clip values below lowClip */
+    double lowClip;             /**< Low clip value */
+} NDProcessCorrection_t;
+
+/** The types of the accumulators of NDProcessAccumulate() */
+typedef enum {
+    NDProcessAccInt32,      /**< 32-bit integer */
+    NDProcessAccInt64,      /**< 64-bit integer */
+    NDProcessAccFloat64     /**< 64-bit float */
+} NDProcessAccType_t;
+
+/** The operations of NDProcessAccumulate() */
+typedef enum {
+    NDProcessAccSet,        /**< accumulator = value */
+    NDProcessAccAdd,        /**< accumulator += value */
+    NDProcessAccSubtract    /**< accumulator -= value */
+} NDProcessAccOp_t;
+
+/** The maximum number of frames of NDProcessTemporal() */
+#define ND_PROCESS_MAX_TEMPORAL 32
+
+/** The order statistics of NDProcessTemporal() */
+typedef enum {
+    NDProcessTemporalMedian,    /**< The median; the lower of the two middle values for an even number of frames */
+    NDProcessTemporalMin,       /**< The minimum */
+    NDProcessTemporalMax        /**< The maximum */
+} NDProcessTemporalOp_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDProcessGainMap(NDDataType_t dataType, const void *pFlatField, const void *pBackground,
+                                    double scaleFlatField, void *pGain, void *pBias, size_t nElements);
+epicsShareFunc int NDProcessCorrect(NDDataType_t dataType, const NDProcessCorrection_t *pCorrection,
+                                    void *pValues, const void *pBackground, const void *pGain,
+                                    const void *pBias, size_t nElements);
+epicsShareFunc int NDProcessAccumulate(NDDataType_t dataType, const void *pData, NDProcessAccType_t accType,
+                                       void *pAcc, NDProcessAccOp_t operation, size_t nElements);
+epicsShareFunc int NDProcessTemporal(NDDataType_t dataType, NDProcessTemporalOp_t operation,
+                                     const void *const *pFrames, int nFrames, size_t offset, void *pOut,
+                                     size_t nElements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
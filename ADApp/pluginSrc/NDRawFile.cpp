@@ -0,0 +1,408 @@
+/** NDRawFile.cpp
+ *
+ * Raw array files written with asynchronous direct I/O, and their sidecar index.
+ *
+ */
+
+#ifdef __linux__
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <errno.h>
+  #include <aio.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "NDRawFile.h"
+
+static const char *driverName = "NDRawFile";
+
+/** Rounds a size up to a multiple of 8, the padding of the attribute values */
+static size_t roundUp8(size_t size)
+{
+  return (size + 7) / 8 * 8;
+}
+
+/** Rounds a size up to a multiple of ND_RAW_ALIGNMENT */
+static epicsUInt64 alignUp(epicsUInt64 size)
+{
+  return (size + ND_RAW_ALIGNMENT - 1) / ND_RAW_ALIGNMENT * ND_RAW_ALIGNMENT;
+}
+
+NDRawFile::NDRawFile()
+  : fd_(-1), indexFile_(NULL), attributeFile_(NULL), directIO_(false), preallocate_(0), offset_(0), dataEnd_(0),
+    allocated_(0), nextWrite_(0), numCopied_(0), numErrors_(0)
+{
+}
+
+NDRawFile::~NDRawFile()
+{
+  close();
+}
+
+/** Creates the data file and its index, replacing any files with the same paths.
+  * \param[in] path The path of the data file; the index is the same path with ND_RAW_INDEX_SUFFIX appended.
+  * \param[in] attributeNames The attributes whose values are written to the index for each array.
+  * \param[in] maxInFlight The number of writes that can be in progress at once.
+  * \param[in] preallocate The bytes of the data file that are allocated at a time; 0 to not preallocate.
+  * \param[in] directIO Open the data file with O_DIRECT.  If the file system does not support it the file is
+  *            opened without it, see directIO().
+  * \param[in] recordAttributes Write all of the attributes of each array to the attribute file, the path with
+  *            ND_RAW_ATTRIBUTES_SUFFIX appended, so that the arrays can be replayed with them.
+  * \return ND_SUCCESS or ND_ERROR.
+  */
+int NDRawFile::open(const char *path, const std::vector<std::string>& attributeNames,
+                    int maxInFlight, size_t preallocate, bool directIO, bool recordAttributes)
+{
+  static const char *functionName = "open";
+
+  if (isOpen()) close();
+  if (maxInFlight < 1) {
+    printf("%s:%s: ERROR, invalid maxInFlight=%d\n", driverName, functionName, maxInFlight);
+    return ND_ERROR;
+  }
+#ifdef __linux__
+  {
+    NDRawIndexHeader_t header;
+    std::string indexPath = std::string(path) + ND_RAW_INDEX_SUFFIX;
+    std::string attributesPath = std::string(path) + ND_RAW_ATTRIBUTES_SUFFIX;
+    char name[ND_RAW_ATTRIBUTE_NAME_SIZE];
+    size_t i;
+    int flags = O_CREAT | O_TRUNC | O_WRONLY;
+
+    fd_ = -1;
+    directIO_ = false;
+    if (directIO) {
+      fd_ = ::open(path, flags | O_DIRECT, 0664);
+      /* tmpfs and some network file systems do not support O_DIRECT */
+      if (fd_ >= 0) directIO_ = true;
+      else if (errno != EINVAL) {
+        printf("%s:%s: ERROR, cannot create file %s\n", driverName, functionName, path);
+        perror(functionName);
+        return ND_ERROR;
+      }
+    }
+    if (fd_ < 0) fd_ = ::open(path, flags, 0664);
+    if (fd_ < 0) {
+      printf("%s:%s: ERROR, cannot create file %s\n", driverName, functionName, path);
+      perror(functionName);
+      return ND_ERROR;
+    }
+    indexFile_ = fopen(indexPath.c_str(), "wb");
+    if (indexFile_ == NULL) {
+      printf("%s:%s: ERROR, cannot create index file %s\n", driverName, functionName, indexPath.c_str());
+      ::close(fd_);
+      fd_ = -1;
+      return ND_ERROR;
+    }
+    /* An attribute file of an earlier recording with the same path would not match the new index */
+    if (!recordAttributes) {
+      unlink(attributesPath.c_str());
+    } else {
+      NDRawAttributesHeader_t attributesHeader;
+      attributeFile_ = fopen(attributesPath.c_str(), "wb");
+      if (attributeFile_ == NULL) {
+        printf("%s:%s: ERROR, cannot create attribute file %s\n", driverName, functionName, attributesPath.c_str());
+        fclose(indexFile_);
+        indexFile_ = NULL;
+        ::close(fd_);
+        fd_ = -1;
+        return ND_ERROR;
+      }
+      memset(&attributesHeader, 0, sizeof(attributesHeader));
+      memcpy(attributesHeader.magic, ND_RAW_ATTRIBUTES_MAGIC, sizeof(attributesHeader.magic));
+      attributesHeader.version = ND_RAW_ATTRIBUTES_VERSION;
+      fwrite(&attributesHeader, sizeof(attributesHeader), 1, attributeFile_);
+    }
+
+    attributeNames_ = attributeNames;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ND_RAW_INDEX_MAGIC, sizeof(header.magic));
+    header.version = ND_RAW_INDEX_VERSION;
+    header.alignment = ND_RAW_ALIGNMENT;
+    header.numAttributes = (epicsUInt32)attributeNames_.size();
+    header.recordSize = (epicsUInt32)(sizeof(NDRawIndexRecord_t) + attributeNames_.size() * sizeof(epicsFloat64));
+    fwrite(&header, sizeof(header), 1, indexFile_);
+    for (i=0; i<attributeNames_.size(); i++) {
+      memset(name, 0, sizeof(name));
+      strncpy(name, attributeNames_[i].c_str(), sizeof(name) - 1);
+      fwrite(name, sizeof(name), 1, indexFile_);
+    }
+    record_.resize(header.recordSize);
+
+    writes_.resize(maxInFlight);
+    for (i=0; i<writes_.size(); i++) {
+      memset(&writes_[i], 0, sizeof(writes_[i]));
+      writes_[i].pControl = calloc(1, sizeof(struct aiocb));
+    }
+    preallocate_ = preallocate;
+    offset_ = 0;
+    dataEnd_ = 0;
+    allocated_ = 0;
+    nextWrite_ = 0;
+    numCopied_ = 0;
+    numErrors_ = 0;
+    return ND_SUCCESS;
+  }
+#else
+  printf("%s:%s: ERROR, raw files are only supported on Linux\n", driverName, functionName);
+  return ND_ERROR;
+#endif
+}
+
+/** Starts writing the data of an array, and writes its index record.
+  * If all of the writes are in progress this waits for the oldest one.
+  * \param[in] pArray The array.  If its data is written directly it is reserved until the write completes.
+  * \return ND_SUCCESS, or ND_ERROR if the write cannot be started or the previous write of the same buffer failed.
+  */
+int NDRawFile::write(NDArray *pArray)
+{
+  static const char *functionName = "write";
+
+  if (!isOpen()) return ND_ERROR;
+#ifdef __linux__
+  {
+    NDArrayInfo_t arrayInfo;
+    NDRawIndexRecord_t *pRecord = (NDRawIndexRecord_t *)&record_[0];
+    epicsFloat64 *pValues = (epicsFloat64 *)(&record_[0] + sizeof(NDRawIndexRecord_t));
+    rawWrite_t *pWrite = &writes_[nextWrite_];
+    struct aiocb *pControl = (struct aiocb *)pWrite->pControl;
+    NDAttribute *pAttribute;
+    NDAttrDataType_t attrDataType;
+    size_t attrSize;
+    epicsUInt64 padded;
+    const char *pData;
+    ssize_t written;
+    int status = ND_SUCCESS;
+    int i;
+
+    nextWrite_ = (nextWrite_ + 1) % writes_.size();
+    if (pWrite->busy && (complete(pWrite) != ND_SUCCESS)) status = ND_ERROR;
+
+    pArray->getInfo(&arrayInfo);
+    padded = alignUp(arrayInfo.totalBytes);
+    pWrite->bytes = directIO_ ? (size_t)padded : arrayInfo.totalBytes;
+    pWrite->pArray = NULL;
+    pData = (const char *)pArray->pData;
+    /* Direct I/O cannot write from a buffer that is not aligned or does not extend to the padded size, and an
+     * array that is not from a pool cannot be reserved until the write completes: copy those to the aligned
+     * buffer of the write */
+    if ((directIO_ && ((((size_t)pData % ND_RAW_ALIGNMENT) != 0) || (pArray->dataSize < padded))) ||
+        !pArray->pNDArrayPool || (pArray->reserve() != ND_SUCCESS)) {
+      if (pWrite->bufferSize < padded) {
+        free(pWrite->pBuffer);
+        pWrite->bufferSize = 0;
+        if (posix_memalign((void **)&pWrite->pBuffer, ND_RAW_ALIGNMENT, (size_t)padded) != 0) {
+          printf("%s:%s: ERROR, cannot allocate %lu bytes\n", driverName, functionName, (unsigned long)padded);
+          pWrite->pBuffer = NULL;
+          return ND_ERROR;
+        }
+        pWrite->bufferSize = (size_t)padded;
+      }
+      memcpy(pWrite->pBuffer, pData, arrayInfo.totalBytes);
+      memset(pWrite->pBuffer + arrayInfo.totalBytes, 0, (size_t)(padded - arrayInfo.totalBytes));
+      pData = pWrite->pBuffer;
+      numCopied_++;
+    } else {
+      pWrite->pArray = pArray;
+    }
+
+    if (preallocate_ > 0) allocate(offset_ + padded);
+    memset(pControl, 0, sizeof(*pControl));
+    pControl->aio_fildes = fd_;
+    pControl->aio_buf = (void *)pData;
+    pControl->aio_nbytes = pWrite->bytes;
+    pControl->aio_offset = (off_t)offset_;
+    pControl->aio_sigevent.sigev_notify = SIGEV_NONE;
+    if (aio_write(pControl) == 0) {
+      pWrite->busy = true;
+    } else {
+      /* The asynchronous I/O queue is full, or not available: write synchronously */
+      written = pwrite(fd_, pData, pWrite->bytes, (off_t)offset_);
+      if (pWrite->pArray) pWrite->pArray->release();
+      pWrite->pArray = NULL;
+      if (written != (ssize_t)pWrite->bytes) {
+        printf("%s:%s: ERROR, cannot write %lu bytes at offset %llu\n", driverName, functionName,
+               (unsigned long)pWrite->bytes, (unsigned long long)offset_);
+        numErrors_++;
+        status = ND_ERROR;
+      }
+    }
+
+    memset(pRecord, 0, sizeof(*pRecord));
+    pRecord->offset = offset_;
+    pRecord->bytes = arrayInfo.totalBytes;
+    pRecord->uniqueId = pArray->uniqueId;
+    pRecord->dataType = pArray->dataType;
+    pRecord->ndims = pArray->ndims;
+    pRecord->timeStamp = pArray->timeStamp;
+    pRecord->secPastEpoch = pArray->epicsTS.secPastEpoch;
+    pRecord->nsec = pArray->epicsTS.nsec;
+    for (i=0; i<pArray->ndims; i++) pRecord->dims[i] = pArray->dims[i].size;
+    for (i=0; i<(int)attributeNames_.size(); i++) {
+      pValues[i] = NAN;
+      pAttribute = pArray->pAttributeList->find(attributeNames_[i].c_str());
+      if (pAttribute == NULL) continue;
+      pAttribute->getValueInfo(&attrDataType, &attrSize);
+      if ((attrDataType == NDAttrString) || (attrDataType == NDAttrUndefined)) continue;
+      pAttribute->getValue(NDAttrFloat64, &pValues[i]);
+    }
+    if (fwrite(&record_[0], record_.size(), 1, indexFile_) != 1) {
+      printf("%s:%s: ERROR, cannot write index record\n", driverName, functionName);
+      status = ND_ERROR;
+    }
+    if (attributeFile_ && (writeAttributes(pArray) != ND_SUCCESS)) {
+      printf("%s:%s: ERROR, cannot write the attributes\n", driverName, functionName);
+      status = ND_ERROR;
+    }
+
+    offset_ += padded;
+    dataEnd_ = pRecord->offset + arrayInfo.totalBytes;
+    return status;
+  }
+#else
+  return ND_ERROR;
+#endif
+}
+
+/** Waits for all of the writes, truncates the data file to the end of the data of the last array and closes
+  * the files.
+  * \return ND_SUCCESS, or ND_ERROR if any write since the file was opened failed. */
+int NDRawFile::close()
+{
+  static const char *functionName = "close";
+  int status = ND_SUCCESS;
+
+  if (!isOpen()) return ND_SUCCESS;
+#ifdef __linux__
+  {
+    size_t i;
+
+    for (i=0; i<writes_.size(); i++) {
+      if (writes_[i].busy) complete(&writes_[i]);
+      free(writes_[i].pControl);
+      free(writes_[i].pBuffer);
+    }
+    writes_.clear();
+    /* Remove the preallocated space after the data, and the padding of the last array */
+    if (ftruncate(fd_, (off_t)dataEnd_) != 0) {
+      printf("%s:%s: ERROR, cannot truncate the data file\n", driverName, functionName);
+      status = ND_ERROR;
+    }
+    if (::close(fd_) != 0) status = ND_ERROR;
+    if (fclose(indexFile_) != 0) status = ND_ERROR;
+    if (attributeFile_ && (fclose(attributeFile_) != 0)) status = ND_ERROR;
+  }
+#endif
+  fd_ = -1;
+  indexFile_ = NULL;
+  attributeFile_ = NULL;
+  if (numErrors_ > 0) status = ND_ERROR;
+  return status;
+}
+
+/** Returns true if the file is open */
+bool NDRawFile::isOpen()
+{
+  return (fd_ >= 0);
+}
+
+/** Returns true if the open file is written with direct I/O */
+bool NDRawFile::directIO()
+{
+  return directIO_;
+}
+
+/** Returns the number of arrays that were copied to an aligned buffer since the file was opened */
+int NDRawFile::numCopied()
+{
+  return numCopied_;
+}
+
+/** Returns the size of the data file up to the end of the data of the last array */
+epicsUInt64 NDRawFile::bytesWritten()
+{
+  return dataEnd_;
+}
+
+/** Waits for a write to complete, and releases its array */
+int NDRawFile::complete(rawWrite_t *pWrite)
+{
+  int status = ND_SUCCESS;
+#ifdef __linux__
+  struct aiocb *pControl = (struct aiocb *)pWrite->pControl;
+  const struct aiocb *list[1];
+  static const char *functionName = "complete";
+
+  list[0] = pControl;
+  while (aio_error(pControl) == EINPROGRESS) {
+    aio_suspend(list, 1, NULL);
+  }
+  if (aio_return(pControl) != (ssize_t)pWrite->bytes) {
+    printf("%s:%s: ERROR, cannot write %lu bytes at offset %llu\n", driverName, functionName,
+           (unsigned long)pWrite->bytes, (unsigned long long)pControl->aio_offset);
+    numErrors_++;
+    status = ND_ERROR;
+  }
+#endif
+  if (pWrite->pArray) pWrite->pArray->release();
+  pWrite->pArray = NULL;
+  pWrite->busy = false;
+  return status;
+}
+
+/** Writes the block of the attributes of an array to the attribute file.
+  * The attributes with no value, and those whose names are too long, are not written. */
+int NDRawFile::writeAttributes(NDArray *pArray)
+{
+  NDAttribute *pAttribute = NULL;
+  NDRawAttributeBlock_t *pBlock;
+  NDRawAttribute_t *pRecord;
+  NDAttrDataType_t dataType;
+  size_t valueSize, offset = sizeof(NDRawAttributeBlock_t);
+  int numAttributes = 0;
+
+  attributes_.assign(offset, 0);
+  while ((pAttribute = pArray->pAttributeList->next(pAttribute)) != NULL) {
+    pAttribute->getValueInfo(&dataType, &valueSize);
+    if ((dataType == NDAttrUndefined) || (strlen(pAttribute->getName()) >= ND_RAW_ATTRIBUTE_NAME_SIZE)) continue;
+    attributes_.resize(offset + sizeof(NDRawAttribute_t) + roundUp8(valueSize), 0);
+    pRecord = (NDRawAttribute_t *)&attributes_[offset];
+    strcpy(pRecord->name, pAttribute->getName());
+    pRecord->dataType = dataType;
+    pRecord->valueSize = (epicsInt32)valueSize;
+    pAttribute->getValue(dataType, pRecord + 1, valueSize);
+    offset = attributes_.size();
+    numAttributes++;
+  }
+  pBlock = (NDRawAttributeBlock_t *)&attributes_[0];
+  pBlock->uniqueId = pArray->uniqueId;
+  pBlock->numAttributes = numAttributes;
+  pBlock->bytes = attributes_.size() - sizeof(NDRawAttributeBlock_t);
+  if (fwrite(&attributes_[0], attributes_.size(), 1, attributeFile_) != 1) return ND_ERROR;
+  return ND_SUCCESS;
+}
+
+/** Allocates the data file in steps of preallocate bytes until it extends to end, so the file system can
+  * keep the file contiguous and the writes do not allocate blocks */
+int NDRawFile::allocate(epicsUInt64 end)
+{
+#ifdef __linux__
+  epicsUInt64 size;
+
+  if (end <= allocated_) return ND_SUCCESS;
+  size = alignUp((end - allocated_ > preallocate_) ? end - allocated_ : preallocate_);
+  /* File systems that do not support fallocate are written without preallocation */
+  if (posix_fallocate(fd_, (off_t)allocated_, (off_t)size) != 0) {
+    preallocate_ = 0;
+    return ND_ERROR;
+  }
+  allocated_ += size;
+#endif
+  return ND_SUCCESS;
+}
@@ -0,0 +1,159 @@
+/** NDRawFile.h
+ *
+ * Raw array files for high rate capture: the data of the arrays in one large file, written with asynchronous
+ * direct I/O, and a sidecar index that describes each array.
+ *
+ */
+
+#ifndef NDRawFile_H
+#define NDRawFile_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+/** The magic number at the start of an index file */
+#define ND_RAW_INDEX_MAGIC "NDRAWIDX"
+/** The version of the index file format */
+#define ND_RAW_INDEX_VERSION 1
+/** The alignment of the arrays in the data file, and of the buffers of direct I/O */
+#define ND_RAW_ALIGNMENT 4096
+/** The size of each attribute name in an index file, including the terminating nul */
+#define ND_RAW_ATTRIBUTE_NAME_SIZE 64
+/** The suffix of the index file, after the name of the data file */
+#define ND_RAW_INDEX_SUFFIX ".idx"
+/** The magic number at the start of an attribute file */
+#define ND_RAW_ATTRIBUTES_MAGIC "NDRAWATR"
+/** The version of the attribute file format */
+#define ND_RAW_ATTRIBUTES_VERSION 1
+/** The suffix of the attribute file, after the name of the data file */
+#define ND_RAW_ATTRIBUTES_SUFFIX ".attr"
+/** The largest block of attributes of one array that NDRawIndex::readAttributes() accepts */
+#define ND_RAW_MAX_ATTRIBUTE_BYTES (16*1024*1024)
+
+/** The header of an index file.
+  * It is followed by numAttributes names of ND_RAW_ATTRIBUTE_NAME_SIZE bytes, and then by one record of recordSize
+  * bytes for each array: an NDRawIndexRecord_t and then the numAttributes values, as epicsFloat64, of the
+  * attributes of the array with those names.  An attribute that the array does not have, or that is a string,
+  * has the value NaN.  All values are in the byte order of the IOC that wrote the file. */
+typedef struct {
+    char        magic[8];       /**< ND_RAW_INDEX_MAGIC, without a terminating nul */
+    epicsUInt32 version;        /**< ND_RAW_INDEX_VERSION */
+    epicsUInt32 alignment;      /**< The alignment of the offsets of the arrays in the data file */
+    epicsUInt32 numAttributes;  /**< The number of attribute values in each record */
+    epicsUInt32 recordSize;     /**< The size of each record in bytes */
+} NDRawIndexHeader_t;
+
+/** The description of one array in an index file */
+typedef struct {
+    epicsUInt64  offset;        /**< The offset of the data of the array in the data file */
+    epicsUInt64  bytes;         /**< The size of the data of the array in bytes */
+    epicsInt32   uniqueId;
+    epicsInt32   dataType;      /**< NDDataType_t */
+    epicsInt32   ndims;
+    epicsInt32   reserved;
+    epicsFloat64 timeStamp;
+    epicsUInt32  secPastEpoch;  /**< epicsTS */
+    epicsUInt32  nsec;          /**< epicsTS */
+    epicsUInt64  dims[ND_ARRAY_MAX_DIMS];  /**< The sizes of the first ndims dimensions */
+} NDRawIndexRecord_t;
+
+/** The header of an attribute file, which holds all of the attributes of each array.
+  * It is followed by one NDRawAttributeBlock_t for each array, in the order of the records of the index. */
+typedef struct {
+    char        magic[8];       /**< ND_RAW_ATTRIBUTES_MAGIC, without a terminating nul */
+    epicsUInt32 version;        /**< ND_RAW_ATTRIBUTES_VERSION */
+    epicsUInt32 reserved;
+} NDRawAttributesHeader_t;
+
+/** The attributes of one array in an attribute file.
+  * It is followed by numAttributes NDRawAttribute_t records of bytes in total. */
+typedef struct {
+    epicsInt32  uniqueId;       /**< The uniqueId of the array */
+    epicsInt32  numAttributes;
+    epicsUInt64 bytes;          /**< The size of the attribute records that follow */
+} NDRawAttributeBlock_t;
+
+/** One attribute in an attribute file; the value follows the record and is padded to a multiple of 8 bytes */
+typedef struct {
+    char        name[ND_RAW_ATTRIBUTE_NAME_SIZE];
+    epicsInt32  dataType;       /**< NDAttrDataType_t of the value */
+    epicsInt32  valueSize;      /**< The size of the value in bytes; for NDAttrString this includes the nul */
+} NDRawAttribute_t;
+
+/** Writes a raw array file and its index.
+  * The data of each array is written at the next multiple of ND_RAW_ALIGNMENT in the data file, with POSIX
+  * asynchronous I/O, so up to maxInFlight writes proceed while the caller prepares the next array.  An array
+  * whose data is written directly is reserved until its write completes.  With direct I/O (O_DIRECT) the
+  * data must be in a buffer aligned to ND_RAW_ALIGNMENT, which NDArrayPool::setAlignment(4096) gives, that
+  * extends to the next multiple of ND_RAW_ALIGNMENT, which it does for most image sizes; the data of other
+  * arrays is copied to an aligned buffer of the write.  The data file is allocated in steps of preallocate bytes, and is truncated to the data when it is
+  * closed.  The index records are written with buffered stdio, as are all of the attributes of each array
+  * when they are recorded in the attribute file, the data file name with ND_RAW_ATTRIBUTES_SUFFIX appended.
+  * It is only supported on Linux.
+  */
+class epicsShareClass NDRawFile {
+public:
+    NDRawFile();
+    ~NDRawFile();
+    int          open(const char *path, const std::vector<std::string>& attributeNames,
+                      int maxInFlight, size_t preallocate, bool directIO, bool recordAttributes=false);
+    int          write(NDArray *pArray);
+    int          close();
+    bool         isOpen();
+    bool         directIO();
+    int          numCopied();
+    epicsUInt64  bytesWritten();
+
+private:
+    typedef struct {
+        void     *pControl;     /**< The struct aiocb of the write; NULL if the write has not been started */
+        NDArray  *pArray;       /**< The array whose data is written; NULL if the data was copied */
+        char     *pBuffer;      /**< The aligned buffer that data is copied to */
+        size_t   bufferSize;
+        size_t   bytes;         /**< The bytes being written */
+        bool     busy;
+    } rawWrite_t;
+
+    int          complete(rawWrite_t *pWrite);
+    int          allocate(epicsUInt64 end);
+    int          writeAttributes(NDArray *pArray);
+
+    int          fd_;           /**< The data file; -1 if it is not open */
+    FILE         *indexFile_;
+    FILE         *attributeFile_;  /**< NULL if the attributes are not recorded */
+    bool         directIO_;
+    size_t       preallocate_;
+    epicsUInt64  offset_;       /**< The offset of the next array */
+    epicsUInt64  dataEnd_;      /**< The end of the data of the last array */
+    epicsUInt64  allocated_;    /**< The bytes of the data file allocated so far */
+    std::vector<std::string> attributeNames_;
+    std::vector<char> record_;  /**< The index record being built */
+    std::vector<char> attributes_;  /**< The attribute block being built */
+    std::vector<rawWrite_t> writes_;
+    size_t       nextWrite_;    /**< The write used for the next array */
+    int          numCopied_;
+    int          numErrors_;    /**< Writes that have failed since the file was opened */
+};
+
+/** Reads the index of a raw array file, and its attribute file, for converters, replay and tests. */
+class epicsShareClass NDRawIndex {
+public:
+    int          read(const char *path);
+    int          readAttributes(const char *path);
+
+    NDRawIndexHeader_t header;
+    std::vector<std::string> attributeNames;
+    std::vector<NDRawIndexRecord_t> records;
+    std::vector<epicsFloat64> attributeValues;  /**< header.numAttributes values for each record */
+    std::vector<char> attributeBlocks;          /**< The NDRawAttributeBlock_t of the arrays, from readAttributes() */
+    std::vector<size_t> attributeOffsets;       /**< The offset in attributeBlocks of the block of each array */
+};
+
+#endif
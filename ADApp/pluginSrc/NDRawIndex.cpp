@@ -0,0 +1,116 @@
+/** NDRawIndex.cpp
+ *
+ * Reads the sidecar index of the raw array files of NDRawFile.  This does not need the rest of ADCore, so
+ * converters can be built with it alone.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "NDRawFile.h"
+
+static const char *driverName = "NDRawIndex";
+
+/** Reads an index file.
+  * \param[in] path The path of the index file.
+  * \return ND_SUCCESS, or ND_ERROR if the file cannot be read or is not an index file.
+  */
+int NDRawIndex::read(const char *path)
+{
+  static const char *functionName = "read";
+  std::vector<char> record;
+  char name[ND_RAW_ATTRIBUTE_NAME_SIZE];
+  NDRawIndexRecord_t indexRecord;
+  epicsUInt32 i;
+  FILE *file;
+
+  attributeNames.clear();
+  records.clear();
+  attributeValues.clear();
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("%s:%s: ERROR, cannot open %s\n", driverName, functionName, path);
+    return ND_ERROR;
+  }
+  if ((fread(&header, sizeof(header), 1, file) != 1) ||
+      (memcmp(header.magic, ND_RAW_INDEX_MAGIC, sizeof(header.magic)) != 0) ||
+      (header.version != ND_RAW_INDEX_VERSION) ||
+      (header.recordSize != sizeof(NDRawIndexRecord_t) + header.numAttributes * sizeof(epicsFloat64))) {
+    printf("%s:%s: ERROR, %s is not a version %d index file\n", driverName, functionName, path,
+           ND_RAW_INDEX_VERSION);
+    fclose(file);
+    return ND_ERROR;
+  }
+  for (i=0; i<header.numAttributes; i++) {
+    if (fread(name, sizeof(name), 1, file) != 1) {
+      printf("%s:%s: ERROR, %s is truncated\n", driverName, functionName, path);
+      fclose(file);
+      return ND_ERROR;
+    }
+    name[sizeof(name) - 1] = 0;
+    attributeNames.push_back(name);
+  }
+  record.resize(header.recordSize);
+  /* A partial record at the end, from an IOC that stopped while writing, is ignored */
+  while (fread(&record[0], record.size(), 1, file) == 1) {
+    memcpy(&indexRecord, &record[0], sizeof(indexRecord));
+    records.push_back(indexRecord);
+    for (i=0; i<header.numAttributes; i++) {
+      epicsFloat64 value;
+      memcpy(&value, &record[sizeof(NDRawIndexRecord_t) + i * sizeof(epicsFloat64)], sizeof(value));
+      attributeValues.push_back(value);
+    }
+  }
+  fclose(file);
+  return ND_SUCCESS;
+}
+
+/** Reads an attribute file, after the index it belongs to.
+  * The attribute blocks are kept as they are in the file; there is one for each record of the index, and the
+  * records after the last complete block have no attributes.
+  * \param[in] path The path of the attribute file.
+  * \return ND_SUCCESS, or ND_ERROR if the file cannot be read or is not an attribute file.
+  */
+int NDRawIndex::readAttributes(const char *path)
+{
+  static const char *functionName = "readAttributes";
+  NDRawAttributesHeader_t attributesHeader;
+  NDRawAttributeBlock_t block;
+  size_t offset;
+  FILE *file;
+
+  attributeBlocks.clear();
+  attributeOffsets.clear();
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("%s:%s: ERROR, cannot open %s\n", driverName, functionName, path);
+    return ND_ERROR;
+  }
+  if ((fread(&attributesHeader, sizeof(attributesHeader), 1, file) != 1) ||
+      (memcmp(attributesHeader.magic, ND_RAW_ATTRIBUTES_MAGIC, sizeof(attributesHeader.magic)) != 0) ||
+      (attributesHeader.version != ND_RAW_ATTRIBUTES_VERSION)) {
+    printf("%s:%s: ERROR, %s is not a version %d attribute file\n", driverName, functionName, path,
+           ND_RAW_ATTRIBUTES_VERSION);
+    fclose(file);
+    return ND_ERROR;
+  }
+  /* As for the index, a partial block at the end is ignored */
+  while ((attributeOffsets.size() < records.size()) && (fread(&block, sizeof(block), 1, file) == 1)) {
+    if (block.bytes > ND_RAW_MAX_ATTRIBUTE_BYTES) {
+      printf("%s:%s: ERROR, %s has a block of %llu bytes\n", driverName, functionName, path,
+             (unsigned long long)block.bytes);
+      break;
+    }
+    offset = attributeBlocks.size();
+    attributeBlocks.resize(offset + sizeof(block) + (size_t)block.bytes);
+    memcpy(&attributeBlocks[offset], &block, sizeof(block));
+    if ((block.bytes > 0) && (fread(&attributeBlocks[offset + sizeof(block)], (size_t)block.bytes, 1, file) != 1)) {
+      attributeBlocks.resize(offset);
+      break;
+    }
+    attributeOffsets.push_back(offset);
+  }
+  fclose(file);
+  return ND_SUCCESS;
+}
@@ -0,0 +1,492 @@
+/*
+ * NDRawReplay.cpp
+ *
+ * Driver that replays the NDArrays recorded by NDFileRaw at their recorded rate, a multiple of it,
+ * or as fast as possible.
+ *
+ */
+
+#ifdef __linux__
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDRawReplay.h"
+
+static const char *driverName="NDRawReplay";
+
+/** The longest file name of a recording */
+#define RAW_REPLAY_MAX_FILENAME 1024
+
+static void replayTaskC(void *drvPvt)
+{
+    NDRawReplay *pPvt = (NDRawReplay *)drvPvt;
+    pPvt->replayTask();
+}
+
+/** Returns the time of a record of the recording in seconds: its epicsTS, or its timeStamp if the driver that
+  * recorded it did not set the epicsTS. */
+double NDRawReplay::recordTime(size_t record)
+{
+    NDRawIndexRecord_t *pRecord = &index_.records[record];
+
+    if ((pRecord->secPastEpoch == 0) && (pRecord->nsec == 0)) return pRecord->timeStamp;
+    return pRecord->secPastEpoch + pRecord->nsec / 1.e9;
+}
+
+/** Maps the data file of FileName and reads its index, and its attribute file if there is one.
+  * This is called with the lock. */
+asynStatus NDRawReplay::loadRecording()
+{
+    char fileName[RAW_REPLAY_MAX_FILENAME] = "";
+    double duration, recordedRate = 0.;
+    size_t numRecords;
+    int dim;
+    static const char *functionName = "loadRecording";
+
+    unloadRecording();
+    getStringParam(NDRawReplayFileName, sizeof(fileName), fileName);
+#ifdef __linux__
+    {
+        std::string attributesPath = std::string(fileName) + ND_RAW_ATTRIBUTES_SUFFIX;
+        struct stat fileStat;
+        void *pMap;
+        int fd;
+
+        if (index_.read((std::string(fileName) + ND_RAW_INDEX_SUFFIX).c_str()) != ND_SUCCESS) return asynError;
+        fd = open(fileName, O_RDONLY);
+        if ((fd < 0) || (fstat(fd, &fileStat) != 0)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s cannot open data file %s\n",
+                driverName, functionName, fileName);
+            if (fd >= 0) close(fd);
+            return asynError;
+        }
+        mapSize_ = (size_t)fileStat.st_size;
+        pMap = (mapSize_ > 0) ? mmap(NULL, mapSize_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (pMap == MAP_FAILED) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s cannot map data file %s\n",
+                driverName, functionName, fileName);
+            mapSize_ = 0;
+            return asynError;
+        }
+        /* The arrays are read in order, and reading ahead keeps the disk out of the measurement */
+        madvise(pMap, mapSize_, MADV_SEQUENTIAL);
+        madvise(pMap, mapSize_, MADV_WILLNEED);
+        pMap_ = (char *)pMap;
+        if (stat(attributesPath.c_str(), &fileStat) == 0) index_.readAttributes(attributesPath.c_str());
+    }
+#else
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s replay is only supported on Linux\n",
+        driverName, functionName);
+    return asynError;
+#endif
+
+    /* The records of arrays that are not in the data file, e.g. when the IOC stopped before the data was
+     * written, and records that are not valid, end the recording */
+    for (numRecords=0; numRecords<index_.records.size(); numRecords++) {
+        NDRawIndexRecord_t *pRecord = &index_.records[numRecords];
+        if ((pRecord->offset > mapSize_) || (pRecord->bytes > mapSize_ - pRecord->offset) ||
+            (pRecord->ndims < 1) || (pRecord->ndims > ND_ARRAY_MAX_DIMS) ||
+            (pRecord->dataType < NDInt8) || (pRecord->dataType > NDUInt12Packed)) break;
+        for (dim=0; (dim<pRecord->ndims) && (pRecord->dims[dim] > 0); dim++);
+        if (dim < pRecord->ndims) break;
+    }
+    if (numRecords < index_.records.size()) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s only the first %lu of the %lu arrays of %s are complete\n",
+            driverName, functionName, (unsigned long)numRecords, (unsigned long)index_.records.size(), fileName);
+        index_.records.resize(numRecords);
+    }
+    if (numRecords > 1) {
+        duration = recordTime(numRecords - 1) - recordTime(0);
+        if (duration > 0.) recordedRate = (numRecords - 1) / duration;
+    }
+    if (index_.attributeOffsets.size() > numRecords) index_.attributeOffsets.resize(numRecords);
+
+    setIntegerParam(NDRawReplayLoaded, 1);
+    setIntegerParam(NDRawReplayNumArrays, (int)numRecords);
+    setIntegerParam(NDRawReplayHasAttributes, index_.attributeOffsets.empty() ? 0 : 1);
+    setDoubleParam(NDRawReplayRecordedRate, recordedRate);
+    setIntegerParam(NDRawReplayIndex, 0);
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s loaded %lu arrays from %s\n",
+        driverName, functionName, (unsigned long)numRecords, fileName);
+    return asynSuccess;
+}
+
+/** Unmaps the recording, if one is loaded.  This is called with the lock, and not while replaying. */
+void NDRawReplay::unloadRecording()
+{
+#ifdef __linux__
+    if (pMap_) munmap(pMap_, mapSize_);
+#endif
+    pMap_ = NULL;
+    mapSize_ = 0;
+    index_.records.clear();
+    index_.attributeBlocks.clear();
+    index_.attributeOffsets.clear();
+    setIntegerParam(NDRawReplayLoaded, 0);
+    setIntegerParam(NDRawReplayNumArrays, 0);
+    setIntegerParam(NDRawReplayHasAttributes, 0);
+    setDoubleParam(NDRawReplayRecordedRate, 0.);
+}
+
+/** Adds the recorded attributes of an array to an attribute list.
+  * \param[in] record The index of the array in the recording.
+  * \param[in] pAttributeList The attribute list.
+  * \return ND_SUCCESS, or ND_ERROR if the block of the array is not valid. */
+int NDRawReplay::decodeAttributes(size_t record, NDAttributeList *pAttributeList)
+{
+    NDRawAttributeBlock_t *pBlock;
+    NDRawAttribute_t *pAttribute;
+    size_t offset, end, valueBytes;
+    char *pValue;
+    int i;
+
+    if (record >= index_.attributeOffsets.size()) return ND_SUCCESS;
+    offset = index_.attributeOffsets[record];
+    pBlock = (NDRawAttributeBlock_t *)&index_.attributeBlocks[offset];
+    end = offset + sizeof(NDRawAttributeBlock_t) + (size_t)pBlock->bytes;
+    offset += sizeof(NDRawAttributeBlock_t);
+    for (i=0; i<pBlock->numAttributes; i++) {
+        if (offset + sizeof(NDRawAttribute_t) > end) return ND_ERROR;
+        pAttribute = (NDRawAttribute_t *)&index_.attributeBlocks[offset];
+        pValue = (char *)(pAttribute + 1);
+        valueBytes = ((size_t)pAttribute->valueSize + 7) / 8 * 8;
+        if ((pAttribute->valueSize < 0) || (memchr(pAttribute->name, 0, ND_RAW_ATTRIBUTE_NAME_SIZE) == NULL) ||
+            (pAttribute->dataType < NDAttrInt8) || (pAttribute->dataType > NDAttrString) ||
+            (offset + sizeof(NDRawAttribute_t) + valueBytes > end)) return ND_ERROR;
+        if ((pAttribute->dataType == NDAttrString) &&
+            ((pAttribute->valueSize == 0) || (pValue[pAttribute->valueSize-1] != 0))) return ND_ERROR;
+        pAttributeList->add(pAttribute->name, "", (NDAttrDataType_t)pAttribute->dataType, pValue);
+        offset += sizeof(NDRawAttribute_t) + valueBytes;
+    }
+    return ND_SUCCESS;
+}
+
+/** Allocates an array from the NDArrayPool and copies an array of the recording into it, with its attributes.
+  * This is called without the lock.
+  * \param[in] record The index of the array in the recording.
+  * \return The array, or NULL if the pool is full or the array does not match its record. */
+NDArray* NDRawReplay::readArray(size_t record)
+{
+    NDRawIndexRecord_t *pRecord = &index_.records[record];
+    NDArrayInfo_t arrayInfo;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pArray;
+    int i;
+    static const char *functionName = "readArray";
+
+    for (i=0; i<pRecord->ndims; i++) dims[i] = (size_t)pRecord->dims[i];
+    pArray = this->pNDArrayPool->alloc(pRecord->ndims, dims, (NDDataType_t)pRecord->dataType, 0, NULL);
+    if (!pArray) return NULL;
+    pArray->getInfo(&arrayInfo);
+    if (arrayInfo.totalBytes != pRecord->bytes) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s array %lu has %llu bytes, its dimensions need %lu\n",
+            driverName, functionName, (unsigned long)record, (unsigned long long)pRecord->bytes,
+            (unsigned long)arrayInfo.totalBytes);
+        pArray->release();
+        return NULL;
+    }
+    memcpy(pArray->pData, pMap_ + pRecord->offset, arrayInfo.totalBytes);
+    if (decodeAttributes(record, pArray->pAttributeList) != ND_SUCCESS) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s the attributes of array %lu are not valid\n",
+            driverName, functionName, (unsigned long)record);
+    }
+    return pArray;
+}
+
+/** Sets the array parameters from a replayed array and does the NDArray callbacks with it.
+  * This is called with the lock, which it releases during the callbacks.
+  * \param[in] pArray The array, which this driver now owns.
+  * \param[in] record The index of the array in the recording. */
+void NDRawReplay::publishArray(NDArray *pArray, size_t record)
+{
+    NDArrayInfo_t arrayInfo;
+    int count, arrayCallbacks;
+
+    pArray->getInfo(&arrayInfo);
+    getIntegerParam(NDArrayCounter, &count);
+    count++;
+    setIntegerParam(NDArrayCounter, count);
+    pArray->uniqueId = count;
+    updateTimeStamp(&pArray->epicsTS);
+    pArray->timeStamp = pArray->epicsTS.secPastEpoch + pArray->epicsTS.nsec / 1.e9;
+    getIntegerParam(NDRawReplayNumReplayed, &count);
+    setIntegerParam(NDRawReplayNumReplayed, count+1);
+    setIntegerParam(NDRawReplayIndex, (int)record);
+    setIntegerParam(NDArraySize, (int)arrayInfo.totalBytes);
+    setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+    setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+    setIntegerParam(NDArraySizeZ, (int)arrayInfo.colorSize);
+    setIntegerParam(NDNDimensions, pArray->ndims);
+    setIntegerParam(NDDataType, pArray->dataType);
+    setIntegerParam(NDColorMode, arrayInfo.colorMode);
+    setIntegerParam(NDUniqueId, pArray->uniqueId);
+    setDoubleParam(NDTimeStamp, pArray->timeStamp);
+    setIntegerParam(NDEpicsTSSec, pArray->epicsTS.secPastEpoch);
+    setIntegerParam(NDEpicsTSNsec, pArray->epicsTS.nsec);
+
+    /* Add the attributes of this driver; the recorded attributes are kept */
+    this->getAttributes(pArray->pAttributeList);
+
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (arrayCallbacks) {
+        /* Call the NDArray callback without the lock, as the other drivers do */
+        this->unlock();
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        this->lock();
+    }
+    if (this->pArrays[0]) this->pArrays[0]->release();
+    this->pArrays[0] = pArray;
+}
+
+/** Task that replays the recording when Start is set to 1, Loops times, and then sets Start to 0.
+  * Each array is due RateScale times faster than the interval since the previous array of the recording, after
+  * the previous array was due, so the replay keeps the recorded rate on average when the plugins briefly hold it
+  * up.  Each loop starts again from the first array without a pause. */
+void NDRawReplay::replayTask()
+{
+    epicsTimeStamp startTime, loopStart, now;
+    NDArray *pArray;
+    double rateScale, due, gap, delay, elapsed;
+    size_t record, numRecords;
+    int loops, loop, count, replayed;
+    static const char *functionName = "replayTask";
+
+    this->lock();
+    while (1) {
+        this->unlock();
+        epicsEventWait(startEvent_);
+        this->lock();
+        if (!replaying_) continue;
+        getIntegerParam(NDRawReplayLoops, &loops);
+        numRecords = index_.records.size();
+        replayed = 0;
+        epicsTimeGetCurrent(&startTime);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s replaying %lu arrays %d times\n",
+            driverName, functionName, (unsigned long)numRecords, loops);
+        for (loop=0; replaying_ && ((loops <= 0) || (loop < loops)); loop++) {
+            epicsTimeGetCurrent(&loopStart);
+            due = 0.;
+            for (record=0; replaying_ && (record<numRecords); record++) {
+                getDoubleParam(NDRawReplayRateScale, &rateScale);
+                if ((rateScale > 0.) && (record > 0)) {
+                    gap = recordTime(record) - recordTime(record - 1);
+                    if (gap > 0.) due += gap / rateScale;
+                    epicsTimeGetCurrent(&now);
+                    delay = due - epicsTimeDiffInSeconds(&now, &loopStart);
+                    if (delay > 0.) {
+                        this->unlock();
+                        epicsEventWaitWithTimeout(stopEvent_, delay);
+                        this->lock();
+                        if (!replaying_) break;
+                    }
+                }
+                this->unlock();
+                pArray = readArray(record);
+                this->lock();
+                if (pArray) {
+                    publishArray(pArray, record);
+                    replayed++;
+                } else {
+                    getIntegerParam(NDRawReplayNumDropped, &count);
+                    setIntegerParam(NDRawReplayNumDropped, count+1);
+                }
+                epicsTimeGetCurrent(&now);
+                elapsed = epicsTimeDiffInSeconds(&now, &startTime);
+                if (elapsed > 0.) setDoubleParam(NDRawReplayRate, replayed / elapsed);
+                callParamCallbacks();
+            }
+        }
+        replaying_ = false;
+        setIntegerParam(NDRawReplayStart, 0);
+        callParamCallbacks();
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s replayed %d arrays\n",
+            driverName, functionName, replayed);
+    }
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Load maps the recording of FileName, Start starts or stops the replay, and NumReplayed and NumDropped reset
+  * the counters.  A recording cannot be loaded during a replay.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDRawReplay::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    /* If this parameter belongs to a base class call its method */
+    if (function < FIRST_NDRAW_REPLAY_PARAM) return asynNDArrayDriver::writeInt32(pasynUser, value);
+
+    if (function == NDRawReplayLoad) {
+        int start;
+        /* The replay thread may still be copying an array after a stop, until it sets Start to 0 */
+        getIntegerParam(NDRawReplayStart, &start);
+        if (start) status = asynError;
+        else status = loadRecording();
+        setIntegerParam(NDRawReplayLoad, 0);
+    } else if (function == NDRawReplayStart) {
+        int start;
+        getIntegerParam(NDRawReplayStart, &start);
+        if (value && !start) {
+            if (!pMap_ || index_.records.empty()) {
+                status = asynError;
+            } else {
+                replaying_ = true;
+                setIntegerParam(NDRawReplayNumReplayed, 0);
+                setIntegerParam(NDRawReplayNumDropped, 0);
+                setDoubleParam(NDRawReplayRate, 0.);
+                setIntegerParam(function, 1);
+                /* Clear a stop that the replay thread did not wait for */
+                epicsEventTryWait(stopEvent_);
+                epicsEventSignal(startEvent_);
+            }
+        } else if (!value && replaying_) {
+            /* The replay thread sets Start to 0 when it has stopped */
+            replaying_ = false;
+            epicsEventSignal(stopEvent_);
+        }
+    } else {
+        status = (asynStatus) setIntegerParam(function, value);
+    }
+    callParamCallbacks();
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Constructor for NDRawReplay.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDRawReplay::NDRawReplay(const char *portName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : asynNDArrayDriver(portName, 1, maxBuffers, maxMemory,
+                        0, 0, 0, 1, priority, stackSize),
+      pMap_(NULL), mapSize_(0), replaying_(false), replayThreadId_(0)
+{
+    char taskName[256];
+    static const char *functionName = "NDRawReplay";
+
+    createParam(NDRawReplayFileNameString,      asynParamOctet,   &NDRawReplayFileName);
+    createParam(NDRawReplayLoadString,          asynParamInt32,   &NDRawReplayLoad);
+    createParam(NDRawReplayLoadedString,        asynParamInt32,   &NDRawReplayLoaded);
+    createParam(NDRawReplayNumArraysString,     asynParamInt32,   &NDRawReplayNumArrays);
+    createParam(NDRawReplayHasAttributesString, asynParamInt32,   &NDRawReplayHasAttributes);
+    createParam(NDRawReplayRecordedRateString,  asynParamFloat64, &NDRawReplayRecordedRate);
+    createParam(NDRawReplayRateScaleString,     asynParamFloat64, &NDRawReplayRateScale);
+    createParam(NDRawReplayLoopsString,         asynParamInt32,   &NDRawReplayLoops);
+    createParam(NDRawReplayStartString,         asynParamInt32,   &NDRawReplayStart);
+    createParam(NDRawReplayIndexString,         asynParamInt32,   &NDRawReplayIndex);
+    createParam(NDRawReplayNumReplayedString,   asynParamInt32,   &NDRawReplayNumReplayed);
+    createParam(NDRawReplayNumDroppedString,    asynParamInt32,   &NDRawReplayNumDropped);
+    createParam(NDRawReplayRateString,          asynParamFloat64, &NDRawReplayRate);
+
+    setStringParam(NDRawReplayFileName, "");
+    setIntegerParam(NDRawReplayLoaded, 0);
+    setIntegerParam(NDRawReplayNumArrays, 0);
+    setIntegerParam(NDRawReplayHasAttributes, 0);
+    setDoubleParam(NDRawReplayRecordedRate, 0.);
+    setDoubleParam(NDRawReplayRateScale, 1.);
+    setIntegerParam(NDRawReplayLoops, 1);
+    setIntegerParam(NDRawReplayStart, 0);
+    setIntegerParam(NDRawReplayIndex, 0);
+    setIntegerParam(NDRawReplayNumReplayed, 0);
+    setIntegerParam(NDRawReplayNumDropped, 0);
+    setDoubleParam(NDRawReplayRate, 0.);
+    setIntegerParam(NDArrayCallbacks, 1);
+    callParamCallbacks();
+
+    startEvent_ = epicsEventCreate(epicsEventEmpty);
+    stopEvent_ = epicsEventCreate(epicsEventEmpty);
+    epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Replay", portName);
+    replayThreadId_ = epicsThreadCreate(taskName,
+                                        epicsThreadPriorityMedium,
+                                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                                        (EPICSTHREADFUNC)replayTaskC, this);
+    if (replayThreadId_ == 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating replayTask thread\n",
+            driverName, functionName);
+    }
+}
+
+NDRawReplay::~NDRawReplay()
+{
+    this->lock();
+    unloadRecording();
+    this->unlock();
+}
+
+/** Configuration command */
+extern "C" int NDRawReplayConfigure(const char *portName, int maxBuffers, size_t maxMemory,
+                                    int priority, int stackSize)
+{
+    new NDRawReplay(portName, maxBuffers, maxMemory, priority, stackSize);
+    return(asynSuccess);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg2 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg3 = { "priority",iocshArgInt};
+static const iocshArg initArg4 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4};
+static const iocshFuncDef initFuncDef = {"NDRawReplayConfigure",5,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDRawReplayConfigure(args[0].sval, args[1].ival, args[2].ival,
+                         args[3].ival, args[4].ival);
+}
+
+extern "C" void NDRawReplayRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDRawReplayRegister);
+}
@@ -0,0 +1,76 @@
+#ifndef NDRawReplay_H
+#define NDRawReplay_H
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include "asynNDArrayDriver.h"
+#include "NDRawFile.h"
+
+#define NDRawReplayFileNameString      "RAW_REPLAY_FILE_NAME"      /* (asynOctet,   r/w) Data file of the recording */
+#define NDRawReplayLoadString          "RAW_REPLAY_LOAD"           /* (asynInt32,   r/w) Map the recording */
+#define NDRawReplayLoadedString        "RAW_REPLAY_LOADED"         /* (asynInt32,   r/o) A recording is mapped */
+#define NDRawReplayNumArraysString     "RAW_REPLAY_NUM_ARRAYS"     /* (asynInt32,   r/o) Arrays in the recording */
+#define NDRawReplayHasAttributesString "RAW_REPLAY_HAS_ATTRIBUTES" /* (asynInt32,   r/o) The recording has an
+                                                                    *  attribute file */
+#define NDRawReplayRecordedRateString  "RAW_REPLAY_RECORDED_RATE"  /* (asynFloat64, r/o) Arrays/s of the recording */
+#define NDRawReplayRateScaleString     "RAW_REPLAY_RATE_SCALE"     /* (asynFloat64, r/w) Replay rate / recorded rate,
+                                                                    *  0 for as fast as possible */
+#define NDRawReplayLoopsString         "RAW_REPLAY_LOOPS"          /* (asynInt32,   r/w) Times to replay, 0 forever */
+#define NDRawReplayStartString         "RAW_REPLAY_START"          /* (asynInt32,   r/w) Start (1) or stop (0) */
+#define NDRawReplayIndexString         "RAW_REPLAY_INDEX"          /* (asynInt32,   r/o) Index of the last array */
+#define NDRawReplayNumReplayedString   "RAW_REPLAY_NUM_REPLAYED"   /* (asynInt32,   r/w) Number of arrays replayed */
+#define NDRawReplayNumDroppedString    "RAW_REPLAY_NUM_DROPPED"    /* (asynInt32,   r/w) Number of arrays dropped
+                                                                    *  because the NDArrayPool was full */
+#define NDRawReplayRateString          "RAW_REPLAY_RATE"           /* (asynFloat64, r/o) Arrays/s since Start */
+
+/** Driver that replays a recording of NDFileRaw, and does callbacks with its arrays to the plugins of this IOC as
+  * if they came from the detector, to benchmark chains of plugins with real data without the detector.
+  * The data file is memory mapped, and each array is copied from it into a buffer from the NDArrayPool of this
+  * driver.  The arrays have their recorded data type, dimensions and data, and the attributes of the attribute
+  * file if NDFileRaw wrote one with RecordAttributes; they get a new uniqueId and the current time stamps.
+  * With RateScale=1 the arrays are replayed at the intervals of their recorded epicsTS, with RateScale=2 twice
+  * as fast, and with RateScale=0 as fast as possible.  It is only supported on Linux. */
+class epicsShareClass NDRawReplay : public asynNDArrayDriver {
+public:
+    NDRawReplay(const char *portName, int maxBuffers, size_t maxMemory, int priority, int stackSize);
+    ~NDRawReplay();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+    /* These should be private but are called from C so must be public */
+    void replayTask();
+
+protected:
+    int NDRawReplayFileName;
+    #define FIRST_NDRAW_REPLAY_PARAM NDRawReplayFileName
+    int NDRawReplayLoad;
+    int NDRawReplayLoaded;
+    int NDRawReplayNumArrays;
+    int NDRawReplayHasAttributes;
+    int NDRawReplayRecordedRate;
+    int NDRawReplayRateScale;
+    int NDRawReplayLoops;
+    int NDRawReplayStart;
+    int NDRawReplayIndex;
+    int NDRawReplayNumReplayed;
+    int NDRawReplayNumDropped;
+    int NDRawReplayRate;
+
+private:
+    asynStatus loadRecording();
+    void unloadRecording();
+    NDArray *readArray(size_t record);
+    int decodeAttributes(size_t record, NDAttributeList *pAttributeList);
+    void publishArray(NDArray *pArray, size_t record);
+    double recordTime(size_t record);
+    NDRawIndex index_;            /**< The index and attributes of the recording */
+    char *pMap_;                  /**< The mapped data file; NULL if no recording is loaded */
+    size_t mapSize_;
+    bool replaying_;              /**< Set by Start, cleared by the replay thread when it is done */
+    epicsEventId startEvent_;
+    epicsEventId stopEvent_;
+    epicsThreadId replayThreadId_;
+};
+
+#endif
@@ -0,0 +1,212 @@
+/** NDRawToHDF5.cpp
+ *
+ * Converts a raw array file of NDFileRaw, and its index, to an HDF5 file with the layout of the default
+ * NDFileHDF5 layout: the arrays in /entry/instrument/detector/data, and the time stamps and index attributes
+ * in /entry/instrument/NDAttributes.
+ *
+ * Usage: NDRawToHDF5 dataFile hdf5File
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <hdf5.h>
+
+#include "NDRawFile.h"
+
+static const char *driverName = "NDRawToHDF5";
+
+/** Returns the HDF5 type of an NDArray data type, or -1 if it is not valid */
+static hid_t hdf5Type(int dataType)
+{
+  switch (dataType) {
+    case NDInt8:    return H5T_NATIVE_INT8;
+    case NDUInt8:   return H5T_NATIVE_UINT8;
+    case NDInt16:   return H5T_NATIVE_INT16;
+    case NDUInt16:  return H5T_NATIVE_UINT16;
+    case NDInt32:   return H5T_NATIVE_INT32;
+    case NDUInt32:  return H5T_NATIVE_UINT32;
+    case NDFloat32: return H5T_NATIVE_FLOAT;
+    case NDFloat64: return H5T_NATIVE_DOUBLE;
+    default:        return -1;
+  }
+}
+
+/** Writes a string attribute */
+static void writeStringAttribute(hid_t object, const char *name, const char *value)
+{
+  hid_t type = H5Tcopy(H5T_C_S1);
+  hid_t space = H5Screate(H5S_SCALAR);
+  hid_t attribute;
+
+  H5Tset_size(type, strlen(value));
+  attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, type, value);
+  H5Aclose(attribute);
+  H5Sclose(space);
+  H5Tclose(type);
+}
+
+/** Creates a group with an NX_class attribute */
+static hid_t createGroup(hid_t parent, const char *name, const char *nxClass)
+{
+  hid_t group = H5Gcreate2(parent, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  writeStringAttribute(group, "NX_class", nxClass);
+  return group;
+}
+
+/** Writes a 1-D dataset with one value for each array */
+static void writeValues(hid_t group, const char *name, hid_t type, const void *pValues, hsize_t numValues)
+{
+  hid_t space = H5Screate_simple(1, &numValues, NULL);
+  hid_t dataset = H5Dcreate2(group, name, type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  if (numValues > 0) H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, pValues);
+  H5Dclose(dataset);
+  H5Sclose(space);
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *functionName = "main";
+  NDRawIndex index;
+  std::string indexPath;
+  std::vector<char> buffer;
+  std::vector<epicsInt32> uniqueIds;
+  std::vector<epicsFloat64> timeStamps, values;
+  std::vector<epicsUInt32> secPastEpoch, nsec;
+  hsize_t dims[ND_ARRAY_MAX_DIMS+1], chunk[ND_ARRAY_MAX_DIMS+1], start[ND_ARRAY_MAX_DIMS+1];
+  hsize_t count[ND_ARRAY_MAX_DIMS+1];
+  hid_t file, entry, instrument, detector, attributes, data, space, memSpace, plist, dataset, type;
+  NDRawIndexRecord_t *pFirst;
+  size_t numArrays, i, j;
+  FILE *dataFile;
+  int ndims, status = 0;
+
+  if (argc != 3) {
+    printf("Usage: %s dataFile hdf5File\n", driverName);
+    return 1;
+  }
+  indexPath = std::string(argv[1]) + ND_RAW_INDEX_SUFFIX;
+  if (index.read(indexPath.c_str()) != ND_SUCCESS) return 1;
+  numArrays = index.records.size();
+  if (numArrays == 0) {
+    printf("%s:%s: ERROR, %s has no arrays\n", driverName, functionName, indexPath.c_str());
+    return 1;
+  }
+
+  /* HDF5 datasets have one type and shape, so all of the arrays must be the same as the first */
+  pFirst = &index.records[0];
+  ndims = pFirst->ndims;
+  type = hdf5Type(pFirst->dataType);
+  if ((type < 0) || (ndims < 1) || (ndims > ND_ARRAY_MAX_DIMS)) {
+    printf("%s:%s: ERROR, invalid array dataType=%d ndims=%d\n", driverName, functionName,
+           pFirst->dataType, ndims);
+    return 1;
+  }
+  for (i=1; i<numArrays; i++) {
+    NDRawIndexRecord_t *pRecord = &index.records[i];
+    if ((pRecord->dataType != pFirst->dataType) || (pRecord->ndims != ndims) ||
+        (memcmp(pRecord->dims, pFirst->dims, ndims * sizeof(pFirst->dims[0])) != 0)) {
+      printf("%s:%s: ERROR, array %lu (uniqueId=%d) has a different type or dimensions from the first\n",
+             driverName, functionName, (unsigned long)i, pRecord->uniqueId);
+      return 1;
+    }
+  }
+
+  dataFile = fopen(argv[1], "rb");
+  if (dataFile == NULL) {
+    printf("%s:%s: ERROR, cannot open %s\n", driverName, functionName, argv[1]);
+    return 1;
+  }
+  file = H5Fcreate(argv[2], H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (file < 0) {
+    printf("%s:%s: ERROR, cannot create %s\n", driverName, functionName, argv[2]);
+    fclose(dataFile);
+    return 1;
+  }
+
+  /* The slowest HDF5 dimension is the array number, followed by the NDArray dimensions in reverse order */
+  dims[0] = numArrays;
+  chunk[0] = 1;
+  for (i=0; i<(size_t)ndims; i++) {
+    dims[ndims - i] = pFirst->dims[i];
+    chunk[ndims - i] = pFirst->dims[i];
+  }
+  entry = createGroup(file, "entry", "NXentry");
+  instrument = createGroup(entry, "instrument", "NXinstrument");
+  detector = createGroup(instrument, "detector", "NXdetector");
+  space = H5Screate_simple(ndims + 1, dims, NULL);
+  plist = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(plist, ndims + 1, chunk);
+  dataset = H5Dcreate2(detector, "data", type, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+  writeStringAttribute(dataset, "NX_class", "SDS");
+  {
+    int signal = 1;
+    hid_t scalar = H5Screate(H5S_SCALAR);
+    hid_t attribute = H5Acreate2(dataset, "signal", H5T_NATIVE_INT, scalar, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attribute, H5T_NATIVE_INT, &signal);
+    H5Aclose(attribute);
+    H5Sclose(scalar);
+  }
+
+  /* Copy the arrays one at a time */
+  memSpace = H5Screate_simple(ndims, &dims[1], NULL);
+  buffer.resize((size_t)pFirst->bytes);
+  for (i=0; i<numArrays && status==0; i++) {
+    NDRawIndexRecord_t *pRecord = &index.records[i];
+    if ((fseeko(dataFile, (off_t)pRecord->offset, SEEK_SET) != 0) ||
+        (fread(&buffer[0], 1, buffer.size(), dataFile) != buffer.size())) {
+      printf("%s:%s: ERROR, cannot read array %lu (uniqueId=%d), the data file is truncated\n",
+             driverName, functionName, (unsigned long)i, pRecord->uniqueId);
+      status = 1;
+      break;
+    }
+    start[0] = i;
+    count[0] = 1;
+    for (j=1; j<=(size_t)ndims; j++) {
+      start[j] = 0;
+      count[j] = dims[j];
+    }
+    H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+    if (H5Dwrite(dataset, type, memSpace, space, H5P_DEFAULT, &buffer[0]) < 0) status = 1;
+  }
+  H5Sclose(memSpace);
+  H5Dclose(dataset);
+  H5Pclose(plist);
+  H5Sclose(space);
+  H5Gclose(detector);
+
+  /* The time stamps, and the index attributes */
+  attributes = createGroup(instrument, "NDAttributes", "NXcollection");
+  for (i=0; i<numArrays; i++) {
+    uniqueIds.push_back(index.records[i].uniqueId);
+    timeStamps.push_back(index.records[i].timeStamp);
+    secPastEpoch.push_back(index.records[i].secPastEpoch);
+    nsec.push_back(index.records[i].nsec);
+  }
+  writeValues(attributes, "NDArrayUniqueId", H5T_NATIVE_INT32, &uniqueIds[0], numArrays);
+  writeValues(attributes, "NDArrayTimeStamp", H5T_NATIVE_DOUBLE, &timeStamps[0], numArrays);
+  writeValues(attributes, "NDArrayEpicsTSSec", H5T_NATIVE_UINT32, &secPastEpoch[0], numArrays);
+  writeValues(attributes, "NDArrayEpicsTSnSec", H5T_NATIVE_UINT32, &nsec[0], numArrays);
+  for (j=0; j<index.attributeNames.size(); j++) {
+    values.clear();
+    for (i=0; i<numArrays; i++) values.push_back(index.attributeValues[i * index.attributeNames.size() + j]);
+    writeValues(attributes, index.attributeNames[j].c_str(), H5T_NATIVE_DOUBLE, &values[0], numArrays);
+  }
+  H5Gclose(attributes);
+  H5Gclose(instrument);
+
+  data = createGroup(entry, "data", "NXdata");
+  H5Lcreate_hard(file, "/entry/instrument/detector/data", data, "data", H5P_DEFAULT, H5P_DEFAULT);
+  H5Gclose(data);
+  H5Gclose(entry);
+  if (H5Fclose(file) < 0) status = 1;
+  fclose(dataFile);
+  if (status == 0) printf("%s: wrote %lu arrays to %s\n", driverName, (unsigned long)numArrays, argv[2]);
+  return status;
+}
@@ -0,0 +1,355 @@
+/** NDRemapKernels.cpp
+ *
+ * Table-driven bilinear remapping for NDPluginRemap.
+ * NDRemapCreateTable() computes, in double, the input position of each output pixel, and stores the offset of the
+ * top left of the 4 input pixels around it and the fractional parts of the position as the interpolation weights.
+ * Positions on the last row or column use the pixels before them with a weight of 1, so every table entry reads
+ * 4 pixels inside the input.
+ *
+ * NDRemapApply() interpolates in float for the 8-bit, 16-bit and Float32 types and in double for the 32-bit
+ * integers and Float64, and rounds to the nearest integer for the integer types.  The AVX2 kernels gather the
+ * 4 pixels of 8 output pixels with gather instructions; for UInt16 a 32-bit gather at the top left pixel returns
+ * the pixel to its right in the upper half, so 2 gathers fetch all 4 pixels.  They do the same operations in the
+ * same order as the scalar kernels, so their results are identical.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <epicsTypes.h>
+
+#include <NDConvertKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDRemapKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#ifndef M_PI
+  #define M_PI 3.14159265358979323846
+#endif
+
+/* Positions this close outside the input are moved onto its edge, so that rotations by multiples of 90 degrees,
+ * whose sines and cosines are not exact, keep the edge pixels */
+#define REMAP_EDGE_TOLERANCE 1e-6
+
+/** Computes the table of a remap.
+  * \param[in] pGeometry The geometry.
+  * \param[in] inSizeX The number of input pixels in X, at least 2.
+  * \param[in] inSizeY The number of input pixels in Y, at least 2.
+  * \param[in] inXStride The number of elements between input pixels in X.
+  * \param[in] inYStride The number of elements between input rows.
+  * \param[in] outSizeX The number of output pixels in X.
+  * \param[in] outSizeY The number of output pixels in Y.
+  * \param[out] pTable The table, which is freed with NDRemapFreeTable().
+  * \return ND_SUCCESS, or ND_ERROR if the input is too small, the offsets do not fit in 32 bits, a scale is 0,
+  *         or there is no memory.
+  */
+int NDRemapCreateTable(const NDRemapGeometry_t *pGeometry, size_t inSizeX, size_t inSizeY,
+                       size_t inXStride, size_t inYStride, size_t outSizeX, size_t outSizeY,
+                       NDRemapTable_t *pTable)
+{
+  size_t n = outSizeX * outSizeY, u, v;
+  double angle = pGeometry->angle * M_PI / 180.;
+  double cosAngle = cos(angle), sinAngle = sin(angle);
+  double inCenterX = (inSizeX - 1) / 2. + pGeometry->centerX, inCenterY = (inSizeY - 1) / 2. + pGeometry->centerY;
+  double outCenterX = (outSizeX - 1) / 2. + pGeometry->centerX + pGeometry->shiftX;
+  double outCenterY = (outSizeY - 1) / 2. + pGeometry->centerY + pGeometry->shiftY;
+  double maxX = (double)(inSizeX - 1), maxY = (double)(inSizeY - 1);
+  double radius2 = (inSizeX*inSizeX + inSizeY*inSizeY) / 4.;
+
+  pTable->pOffset = 0;
+  pTable->pWeightX = pTable->pWeightY = 0;
+  if ((inSizeX < 2) || (inSizeY < 2) || (n == 0) || (pGeometry->scaleX == 0.) || (pGeometry->scaleY == 0.) ||
+      ((inSizeY - 1) * inYStride + (inSizeX - 1) * inXStride > 0x7fffffff)) return ND_ERROR;
+  pTable->inSizeX = inSizeX;
+  pTable->inSizeY = inSizeY;
+  pTable->inXStride = inXStride;
+  pTable->inYStride = inYStride;
+  pTable->outSizeX = outSizeX;
+  pTable->outSizeY = outSizeY;
+  pTable->pOffset = (epicsInt32 *)malloc(n * sizeof(epicsInt32));
+  pTable->pWeightX = (float *)malloc(n * sizeof(float));
+  pTable->pWeightY = (float *)malloc(n * sizeof(float));
+  if (!pTable->pOffset || !pTable->pWeightX || !pTable->pWeightY) {
+    NDRemapFreeTable(pTable);
+    return ND_ERROR;
+  }
+
+  for (v=0; v<outSizeY; v++) {
+    for (u=0; u<outSizeX; u++) {
+      size_t i = v*outSizeX + u, x0, y0;
+      double dx = u - outCenterX, dy = v - outCenterY;
+      double x = (cosAngle*dx + sinAngle*dy) / pGeometry->scaleX;
+      double y = (cosAngle*dy - sinAngle*dx) / pGeometry->scaleY;
+
+      if (pGeometry->distortion != 0.) {
+        double factor = 1. + pGeometry->distortion * (x*x + y*y) / radius2;
+        x *= factor;
+        y *= factor;
+      }
+      x += inCenterX;
+      y += inCenterY;
+      if ((x < 0.) && (x > -REMAP_EDGE_TOLERANCE)) x = 0.;
+      if ((y < 0.) && (y > -REMAP_EDGE_TOLERANCE)) y = 0.;
+      if ((x > maxX) && (x < maxX + REMAP_EDGE_TOLERANCE)) x = maxX;
+      if ((y > maxY) && (y < maxY + REMAP_EDGE_TOLERANCE)) y = maxY;
+      /* The negated test also rejects NaN */
+      if (!((x >= 0.) && (x <= maxX) && (y >= 0.) && (y <= maxY))) {
+        pTable->pOffset[i] = -1;
+        pTable->pWeightX[i] = pTable->pWeightY[i] = 0.f;
+        continue;
+      }
+      x0 = (size_t)x;
+      y0 = (size_t)y;
+      if (x0 == inSizeX - 1) x0--;
+      if (y0 == inSizeY - 1) y0--;
+      pTable->pOffset[i] = (epicsInt32)(y0*inYStride + x0*inXStride);
+      pTable->pWeightX[i] = (float)(x - x0);
+      pTable->pWeightY[i] = (float)(y - y0);
+    }
+  }
+  return ND_SUCCESS;
+}
+
+/** Frees the arrays of a table from NDRemapCreateTable().
+  * \param[in,out] pTable The table.
+  */
+void NDRemapFreeTable(NDRemapTable_t *pTable)
+{
+  free(pTable->pOffset);
+  free(pTable->pWeightX);
+  free(pTable->pWeightY);
+  pTable->pOffset = 0;
+  pTable->pWeightX = pTable->pWeightY = 0;
+}
+
+/* The type the elements of each type are interpolated in */
+template <typename epicsType> struct remapCalc { typedef float type; };
+template <> struct remapCalc<epicsInt32> { typedef double type; };
+template <> struct remapCalc<epicsUInt32> { typedef double type; };
+template <> struct remapCalc<epicsFloat64> { typedef double type; };
+
+/* Rounds to the nearest integer for the integer types */
+template <typename epicsType, typename calcType>
+static inline epicsType remapRound(calcType value)
+{
+  return (epicsType)floor(value + (calcType)0.5);
+}
+template <> inline epicsFloat32 remapRound<epicsFloat32, float>(float value) { return value; }
+template <> inline epicsFloat64 remapRound<epicsFloat64, double>(double value) { return value; }
+
+/* The fill value in the calculation type, limited to the range of the data type */
+template <typename epicsType, typename calcType>
+static calcType remapFill(double fill, double low, double high)
+{
+  if (fill < low) fill = low;
+  if (fill > high) fill = high;
+  return (calcType)fill;
+}
+
+/* Interpolates the output pixels start to end-1 of one output row; i is the table index of the first pixel
+ * of the row */
+template <typename epicsType>
+static void remapScalarT(const NDRemapTable_t *pT, const epicsType *pIn, epicsType *pOut, size_t outXStride,
+                         size_t i, size_t start, size_t end, typename remapCalc<epicsType>::type fill)
+{
+  typedef typename remapCalc<epicsType>::type calcType;
+  size_t xs = pT->inXStride, ys = pT->inYStride, u;
+
+  for (u=start; u<end; u++) {
+    epicsInt32 offset = pT->pOffset[i + u];
+    calcType value = fill;
+    if (offset >= 0) {
+      const epicsType *p = pIn + offset;
+      calcType wx = (calcType)pT->pWeightX[i + u], wy = (calcType)pT->pWeightY[i + u];
+      calcType p00 = (calcType)p[0], p01 = (calcType)p[xs];
+      calcType p10 = (calcType)p[ys], p11 = (calcType)p[ys + xs];
+      calcType top = p00 + wx*(p01 - p00);
+      calcType bottom = p10 + wx*(p11 - p10);
+      value = top + wy*(bottom - top);
+    }
+    pOut[u*outXStride] = remapRound<epicsType, calcType>(value);
+  }
+}
+
+/* Vector kernels for contiguous output rows.  They process whole vectors of n pixels from the table index i and
+ * return the number of pixels they processed. */
+typedef size_t (*remapKernelUInt16)(const NDRemapTable_t *pT, const epicsUInt16 *pIn, epicsUInt16 *pOut,
+                                    size_t i, size_t n, float fill);
+typedef size_t (*remapKernelFloat32)(const NDRemapTable_t *pT, const epicsFloat32 *pIn, epicsFloat32 *pOut,
+                                     size_t i, size_t n, float fill);
+
+#if defined(ND_SIMD_X86)
+
+/* Loads 8 table entries; offsets outside the input become 0, so the gathers stay in the image */
+ND_TARGET("avx2")
+static inline void remapLoadAVX2(const NDRemapTable_t *pT, size_t i, __m256i *pOffset, __m256 *pValid,
+                                 __m256 *pWx, __m256 *pWy)
+{
+  __m256i offset = _mm256_loadu_si256((const __m256i *)(pT->pOffset + i));
+  __m256i valid = _mm256_cmpgt_epi32(offset, _mm256_set1_epi32(-1));
+  *pOffset = _mm256_and_si256(offset, valid);
+  *pValid = _mm256_castsi256_ps(valid);
+  *pWx = _mm256_loadu_ps(pT->pWeightX + i);
+  *pWy = _mm256_loadu_ps(pT->pWeightY + i);
+}
+
+ND_TARGET("avx2")
+static inline __m256 remapInterpolateAVX2(__m256 p00, __m256 p01, __m256 p10, __m256 p11, __m256 wx, __m256 wy)
+{
+  __m256 top = _mm256_add_ps(p00, _mm256_mul_ps(wx, _mm256_sub_ps(p01, p00)));
+  __m256 bottom = _mm256_add_ps(p10, _mm256_mul_ps(wx, _mm256_sub_ps(p11, p10)));
+  return _mm256_add_ps(top, _mm256_mul_ps(wy, _mm256_sub_ps(bottom, top)));
+}
+
+/* Needs inXStride == 1, so that the pixel to the right is in the upper half of the 32-bit gather */
+ND_TARGET("avx2")
+static size_t remapUInt16AVX2(const NDRemapTable_t *pT, const epicsUInt16 *pIn, epicsUInt16 *pOut,
+                              size_t i, size_t n, float fill)
+{
+  __m256i rowBelow = _mm256_set1_epi32((int)pT->inYStride), low16 = _mm256_set1_epi32(0xffff);
+  __m256 fillValue = _mm256_set1_ps(fill), half = _mm256_set1_ps(0.5f);
+  size_t u;
+
+  for (u=0; u+8<=n; u+=8) {
+    __m256i offset;
+    __m256 valid, wx, wy;
+    remapLoadAVX2(pT, i + u, &offset, &valid, &wx, &wy);
+    __m256i top = _mm256_i32gather_epi32((const int *)pIn, offset, 2);
+    __m256i bottom = _mm256_i32gather_epi32((const int *)pIn, _mm256_add_epi32(offset, rowBelow), 2);
+    __m256 value = remapInterpolateAVX2(_mm256_cvtepi32_ps(_mm256_and_si256(top, low16)),
+                                        _mm256_cvtepi32_ps(_mm256_srli_epi32(top, 16)),
+                                        _mm256_cvtepi32_ps(_mm256_and_si256(bottom, low16)),
+                                        _mm256_cvtepi32_ps(_mm256_srli_epi32(bottom, 16)), wx, wy);
+    value = _mm256_blendv_ps(fillValue, value, valid);
+    /* The values are at least 0, so truncation after adding 0.5 is the floor of the scalar kernel */
+    __m256i result = _mm256_cvttps_epi32(_mm256_add_ps(value, half));
+    result = _mm256_permute4x64_epi64(_mm256_packus_epi32(result, result), 0xd8);
+    _mm_storeu_si128((__m128i *)(pOut + u), _mm256_castsi256_si128(result));
+  }
+  return u;
+}
+
+ND_TARGET("avx2")
+static size_t remapFloat32AVX2(const NDRemapTable_t *pT, const epicsFloat32 *pIn, epicsFloat32 *pOut,
+                               size_t i, size_t n, float fill)
+{
+  __m256i right = _mm256_set1_epi32((int)pT->inXStride), below = _mm256_set1_epi32((int)pT->inYStride);
+  __m256 fillValue = _mm256_set1_ps(fill);
+  size_t u;
+
+  for (u=0; u+8<=n; u+=8) {
+    __m256i offset;
+    __m256 valid, wx, wy;
+    remapLoadAVX2(pT, i + u, &offset, &valid, &wx, &wy);
+    __m256i offsetBelow = _mm256_add_epi32(offset, below);
+    __m256 value = remapInterpolateAVX2(_mm256_i32gather_ps(pIn, offset, 4),
+                                        _mm256_i32gather_ps(pIn, _mm256_add_epi32(offset, right), 4),
+                                        _mm256_i32gather_ps(pIn, offsetBelow, 4),
+                                        _mm256_i32gather_ps(pIn, _mm256_add_epi32(offsetBelow, right), 4),
+                                        wx, wy);
+    _mm256_storeu_ps(pOut + u, _mm256_blendv_ps(fillValue, value, valid));
+  }
+  return u;
+}
+
+#endif
+
+/* The vector kernel of each type, NULL for the types that have none */
+template <typename epicsType> struct remapVector {
+  typedef size_t (*kernel)(const NDRemapTable_t *, const epicsType *, epicsType *, size_t, size_t,
+                           typename remapCalc<epicsType>::type);
+  static kernel select(const NDRemapTable_t *) { return 0; }
+};
+template <> remapKernelUInt16 remapVector<epicsUInt16>::select(const NDRemapTable_t *pT)
+{
+#if defined(ND_SIMD_X86)
+  if ((NDSimdLevel() >= NDSimdAVX2) && (pT->inXStride == 1)) return remapUInt16AVX2;
+#endif
+  (void)pT;
+  return 0;
+}
+template <> remapKernelFloat32 remapVector<epicsFloat32>::select(const NDRemapTable_t *pT)
+{
+#if defined(ND_SIMD_X86)
+  if (NDSimdLevel() >= NDSimdAVX2) return remapFloat32AVX2;
+#endif
+  (void)pT;
+  return 0;
+}
+
+template <typename epicsType>
+static void remapT(const NDRemapTable_t *pT, const void *pInVoid, void *pOutVoid, size_t outXStride,
+                   size_t outYStride, size_t firstRow, size_t numRows, double fill, double low, double high)
+{
+  typedef typename remapCalc<epicsType>::type calcType;
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  epicsType *pOut = (epicsType *)pOutVoid;
+  typename remapVector<epicsType>::kernel vector = (outXStride == 1) ? remapVector<epicsType>::select(pT) : 0;
+  calcType fillValue = remapFill<epicsType, calcType>(fill, low, high);
+  size_t v;
+
+  for (v=firstRow; v<firstRow+numRows; v++) {
+    size_t i = v * pT->outSizeX, start = 0;
+    epicsType *pRow = pOut + v*outYStride;
+    if (vector) start = vector(pT, pIn, pRow, i, pT->outSizeX, fillValue);
+    remapScalarT<epicsType>(pT, pIn, pRow, outXStride, i, start, pT->outSizeX, fillValue);
+  }
+}
+
+/** Remaps output rows of one image plane.
+  * \param[in] dataType The data type of the input and the output.
+  * \param[in] pTable The table of the remap.
+  * \param[in] pIn The first element of the input plane, whose strides are those of the table.
+  * \param[out] pOut The first element of the output plane.
+  * \param[in] outXStride The number of elements between output pixels in X.
+  * \param[in] outYStride The number of elements between output rows.
+  * \param[in] firstRow The first output row to compute.
+  * \param[in] numRows The number of output rows to compute.
+  * \param[in] fill The value of the output pixels outside the input, limited to the range of the data type.
+  * \return ND_SUCCESS, or ND_ERROR if the data type is not supported.
+  */
+int NDRemapApply(NDDataType_t dataType, const NDRemapTable_t *pTable, const void *pIn,
+                 void *pOut, size_t outXStride, size_t outYStride, size_t firstRow, size_t numRows,
+                 double fill)
+{
+  switch (dataType) {
+    case NDInt8:
+      remapT<epicsInt8>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, -128., 127.);
+      break;
+    case NDUInt8:
+      remapT<epicsUInt8>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, 0., 255.);
+      break;
+    case NDInt16:
+      remapT<epicsInt16>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, -32768., 32767.);
+      break;
+    case NDUInt16:
+      remapT<epicsUInt16>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, 0., 65535.);
+      break;
+    case NDInt32:
+      remapT<epicsInt32>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill,
+                         -2147483648., 2147483647.);
+      break;
+    case NDUInt32:
+      remapT<epicsUInt32>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, 0., 4294967295.);
+      break;
+    case NDFloat32:
+      remapT<epicsFloat32>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill,
+                           -3.402823466e38, 3.402823466e38);
+      break;
+    case NDFloat64:
+      remapT<epicsFloat64>(pTable, pIn, pOut, outXStride, outYStride, firstRow, numRows, fill, -HUGE_VAL, HUGE_VAL);
+      break;
+    default:
+      return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
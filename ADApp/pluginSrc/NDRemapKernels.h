@@ -0,0 +1,65 @@
+/** NDRemapKernels.h
+ *
+ * Geometric remapping of images for NDPluginRemap: rotation by any angle, scaling, shifts and radial distortion,
+ * with bilinear interpolation.  The geometry is turned once into a table with the input offset and the two
+ * interpolation weights of each output pixel, so each frame is a gather of 4 input pixels and 3 interpolations
+ * per output pixel.  The gathers use AVX2 where the CPU has it, as selected by NDSimdLevel().
+ *
+ */
+
+#ifndef NDRemapKernels_H
+#define NDRemapKernels_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The geometry of a remap.  Output pixel (u, v) is the input at the position found by subtracting the output
+  * center, the center offset and the shift, rotating by -angle, dividing by the scales, applying the radial
+  * distortion and adding the input center and the center offset.  The centers of the images are at
+  * ((sizeX-1)/2, (sizeY-1)/2), so the default geometry is the identity. */
+typedef struct {
+    double angle;       /**< Rotation in degrees, from the X axis towards the Y axis */
+    double scaleX;      /**< Magnification in X */
+    double scaleY;      /**< Magnification in Y */
+    double shiftX;      /**< Shift of the output in X, in pixels */
+    double shiftY;      /**< Shift of the output in Y, in pixels */
+    double centerX;     /**< Offset of the center of rotation, scaling and distortion from the image center in X */
+    double centerY;     /**< Offset of the center of rotation, scaling and distortion from the image center in Y */
+    double distortion;  /**< Radial distortion k: a radius r is read at r*(1 + k*r*r), with r in units of half
+                          *  the diagonal of the input */
+} NDRemapGeometry_t;
+
+/** The table of a remap, from NDRemapCreateTable() */
+typedef struct {
+    size_t inSizeX;         /**< Input pixels in X, at least 2 */
+    size_t inSizeY;         /**< Input pixels in Y, at least 2 */
+    size_t inXStride;       /**< Elements between input pixels in X */
+    size_t inYStride;       /**< Elements between input rows */
+    size_t outSizeX;        /**< Output pixels in X */
+    size_t outSizeY;        /**< Output pixels in Y */
+    epicsInt32 *pOffset;    /**< Element offset of the top left input pixel of each output pixel; -1 outside the input */
+    float *pWeightX;        /**< Weight of the pixels to the right */
+    float *pWeightY;        /**< Weight of the pixels below */
+} NDRemapTable_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDRemapCreateTable(const NDRemapGeometry_t *pGeometry, size_t inSizeX, size_t inSizeY,
+                                      size_t inXStride, size_t inYStride, size_t outSizeX, size_t outSizeY,
+                                      NDRemapTable_t *pTable);
+epicsShareFunc void NDRemapFreeTable(NDRemapTable_t *pTable);
+epicsShareFunc int NDRemapApply(NDDataType_t dataType, const NDRemapTable_t *pTable, const void *pIn,
+                                void *pOut, size_t outXStride, size_t outYStride, size_t firstRow, size_t numRows,
+                                double fill);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
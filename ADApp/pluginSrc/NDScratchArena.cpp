@@ -0,0 +1,107 @@
+/** NDScratchArena.cpp
+ *
+ * Bump allocator of aligned scratch buffers.
+ *
+ */
+
+#include <stdlib.h>
+#ifdef _WIN32
+  #include <malloc.h>
+#endif
+#ifdef vxWorks
+  #include <memLib.h>
+#endif
+
+#include "NDScratchArena.h"
+
+NDScratchArena::NDScratchArena()
+  : pBlock_(NULL), blockSize_(0), offset_(0), used_(0), overflowBytes_(0)
+{
+}
+
+NDScratchArena::~NDScratchArena()
+{
+  size_t i;
+
+  for (i=0; i<overflow_.size(); i++) freeBlock(overflow_[i]);
+  freeBlock(pBlock_);
+}
+
+/** Allocates memory aligned to ND_SCRATCH_ALIGNMENT, or returns NULL */
+void *NDScratchArena::allocBlock(size_t bytes)
+{
+  void *pBlock;
+
+  #if defined(_WIN32)
+    pBlock = _aligned_malloc(bytes, ND_SCRATCH_ALIGNMENT);
+  #elif defined(vxWorks)
+    pBlock = memalign(ND_SCRATCH_ALIGNMENT, bytes);
+  #else
+    if (posix_memalign(&pBlock, ND_SCRATCH_ALIGNMENT, bytes) != 0) pBlock = NULL;
+  #endif
+  return pBlock;
+}
+
+void NDScratchArena::freeBlock(void *pBlock)
+{
+  if (!pBlock) return;
+  #if defined(_WIN32)
+    _aligned_free(pBlock);
+  #else
+    free(pBlock);
+  #endif
+}
+
+/** Returns a buffer that is valid until the next reset().
+  * \param[in] bytes The size of the buffer; it is rounded up to a multiple of ND_SCRATCH_ALIGNMENT.
+  * \return The buffer, aligned to ND_SCRATCH_ALIGNMENT and not initialized, or NULL if there is not enough memory.
+  */
+void *NDScratchArena::alloc(size_t bytes)
+{
+  size_t size = (bytes + ND_SCRATCH_ALIGNMENT - 1) / ND_SCRATCH_ALIGNMENT * ND_SCRATCH_ALIGNMENT;
+  void *pBuffer;
+
+  if (size == 0) size = ND_SCRATCH_ALIGNMENT;
+  if (size < bytes) return NULL;
+  if (blockSize_ - offset_ >= size) {
+    pBuffer = pBlock_ + offset_;
+    offset_ += size;
+  } else {
+    pBuffer = allocBlock(size);
+    if (!pBuffer) return NULL;
+    overflow_.push_back(pBuffer);
+    overflowBytes_ += size;
+  }
+  used_ += size;
+  return pBuffer;
+}
+
+/** Frees all of the buffers.  If they did not fit in the block it is grown to the size that they used,
+  * so the same buffers fit after this. */
+void NDScratchArena::reset()
+{
+  size_t i;
+
+  if (!overflow_.empty()) {
+    for (i=0; i<overflow_.size(); i++) freeBlock(overflow_[i]);
+    overflow_.clear();
+    overflowBytes_ = 0;
+    freeBlock(pBlock_);
+    pBlock_ = (char *)allocBlock(used_);
+    blockSize_ = pBlock_ ? used_ : 0;
+  }
+  offset_ = 0;
+  used_ = 0;
+}
+
+/** Returns the number of bytes that the arena holds */
+size_t NDScratchArena::capacity() const
+{
+  return blockSize_ + overflowBytes_;
+}
+
+/** Returns the number of bytes allocated since the last reset() */
+size_t NDScratchArena::used() const
+{
+  return used_;
+}
@@ -0,0 +1,48 @@
+/** NDScratchArena.h
+ *
+ * Reusable scratch memory for the intermediate buffers of a plugin, used by NDPluginDriver to give each
+ * processing thread buffers that are not allocated again for every array.
+ *
+ */
+
+#ifndef NDScratchArena_H
+#define NDScratchArena_H
+
+#include <stddef.h>
+#include <vector>
+
+#include <shareLib.h>
+
+/** Alignment of the buffers, a cache line, which is enough for any SIMD load */
+#define ND_SCRATCH_ALIGNMENT 64
+
+/** Bump allocator of aligned buffers that are all freed at once by reset().
+  * The buffers come from one block; when a frame needs more than it holds the extra buffers are allocated
+  * separately, and the next reset() frees them and grows the block to the total the frame used, so when
+  * the frames are the same size there are no allocations after the first one.
+  * The methods are not thread safe; NDPluginDriver gives each thread its own arena.
+  */
+class epicsShareClass NDScratchArena {
+public:
+    NDScratchArena();
+    ~NDScratchArena();
+    void *alloc(size_t bytes);
+    void reset();
+    size_t capacity() const;
+    size_t used() const;
+
+private:
+    NDScratchArena(const NDScratchArena&);
+    NDScratchArena& operator=(const NDScratchArena&);
+    static void *allocBlock(size_t bytes);
+    static void freeBlock(void *pBlock);
+
+    char *pBlock_;
+    size_t blockSize_;
+    size_t offset_;                     /**< Bytes of pBlock_ in use */
+    size_t used_;                       /**< Bytes allocated since the last reset(), in pBlock_ and overflow_ */
+    size_t overflowBytes_;
+    std::vector<void*> overflow_;       /**< Buffers that did not fit in pBlock_, freed by reset() */
+};
+
+#endif
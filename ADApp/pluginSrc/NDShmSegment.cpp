@@ -0,0 +1,458 @@
+/** NDShmSegment.cpp
+ *
+ * POSIX shared memory segment for NDArray buffers and descriptors.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#include <epicsAtomic.h>
+
+#include "NDShmSegment.h"
+
+static const char *driverName = "NDShmSegment";
+
+/** Alignment of the buffers in the data area, which suits SIMD loads and O_DIRECT-style consumers */
+#define ND_SHM_ALIGNMENT ((size_t)64)
+/** Alignment of the data area itself */
+#define ND_SHM_PAGE_SIZE ((size_t)4096)
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+NDShmSegment::NDShmSegment()
+  : pBase_(NULL), pHeader_(NULL), mapSize_(0), owner_(false), maxAttributeBytes_(0),
+    pSlotArrays_(NULL), freeBytes_(0)
+{
+  lock_ = epicsMutexMustCreate();
+}
+
+NDShmSegment::~NDShmSegment()
+{
+  close();
+  epicsMutexDestroy(lock_);
+}
+
+/** Creates a new shared memory segment and maps it into this process.
+  * Any existing segment with the same name is removed first; readers that are still attached to it must open
+  * the new segment.
+  * \param[in] name The name of the segment, which should start with "/", e.g. "/13SIM1".
+  * \param[in] numSlots The number of descriptors in the ring, i.e. the number of arrays that are published at once.
+  * \param[in] dataSize The size of the data area for the NDArray buffers in bytes.
+  * \param[in] maxAttributeBytes The space for the attributes of each array in bytes; attributes that do not fit are
+  *            not published.
+  */
+int NDShmSegment::create(const char *name, int numSlots, size_t dataSize, int maxAttributeBytes)
+{
+  static const char *functionName = "create";
+
+  if (pBase_) close();
+  if ((numSlots < 1) || (maxAttributeBytes < 0)) {
+    printf("%s:%s: ERROR, invalid numSlots=%d or maxAttributeBytes=%d\n",
+           driverName, functionName, numSlots, maxAttributeBytes);
+    return ND_ERROR;
+  }
+#ifdef __linux__
+  {
+    int slotSize = (int)roundUp(sizeof(NDShmSlot_t) + maxAttributeBytes, ND_SHM_ALIGNMENT);
+    size_t slotsOffset = roundUp(sizeof(NDShmHeader_t), ND_SHM_ALIGNMENT);
+    size_t dataOffset = roundUp(slotsOffset + (size_t)numSlots*slotSize, ND_SHM_PAGE_SIZE);
+    size_t segmentSize = dataOffset + roundUp(dataSize, ND_SHM_PAGE_SIZE);
+    void *pBase;
+    int fd, i;
+
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+      printf("%s:%s: ERROR, cannot create shared memory segment %s\n", driverName, functionName, name);
+      perror(functionName);
+      return ND_ERROR;
+    }
+    if (ftruncate(fd, segmentSize) != 0) {
+      printf("%s:%s: ERROR, cannot set the size of segment %s to %lu bytes\n",
+             driverName, functionName, name, (unsigned long)segmentSize);
+      ::close(fd);
+      shm_unlink(name);
+      return ND_ERROR;
+    }
+    pBase = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (pBase == MAP_FAILED) {
+      printf("%s:%s: ERROR, cannot map segment %s\n", driverName, functionName, name);
+      shm_unlink(name);
+      return ND_ERROR;
+    }
+    pBase_ = (char *)pBase;
+    mapSize_ = segmentSize;
+    owner_ = true;
+    name_ = name;
+    maxAttributeBytes_ = maxAttributeBytes;
+    pHeader_ = (NDShmHeader_t *)pBase_;
+    pHeader_->numSlots = numSlots;
+    pHeader_->slotSize = slotSize;
+    pHeader_->slotsOffset = slotsOffset;
+    pHeader_->dataOffset = dataOffset;
+    pHeader_->segmentSize = segmentSize;
+    pHeader_->numPublished = 0;
+    for (i=0; i<numSlots; i++) slot(i)->number = -1;
+    pSlotArrays_ = (NDArray **)calloc(numSlots, sizeof(NDArray *));
+    epicsMutexLock(lock_);
+    freeBlocks_.clear();
+    freeBlocks_[dataOffset] = segmentSize - dataOffset;
+    freeBytes_ = segmentSize - dataOffset;
+    epicsMutexUnlock(lock_);
+    /* Readers check the magic number last, so it is only valid once the header is complete */
+    pHeader_->version = ND_SHM_VERSION;
+    epicsAtomicWriteMemoryBarrier();
+    pHeader_->magic = ND_SHM_MAGIC;
+    return ND_SUCCESS;
+  }
+#else
+  printf("%s:%s: ERROR, shared memory segments are not supported on this platform\n", driverName, functionName);
+  return ND_ERROR;
+#endif
+}
+
+/** Attaches to a segment that another process created, to read the arrays it publishes.
+  * \param[in] name The name of the segment.
+  */
+int NDShmSegment::open(const char *name)
+{
+  static const char *functionName = "open";
+
+  if (pBase_) close();
+#ifdef __linux__
+  {
+    struct stat st;
+    void *pBase;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+      printf("%s:%s: ERROR, cannot open shared memory segment %s\n", driverName, functionName, name);
+      return ND_ERROR;
+    }
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(NDShmHeader_t))) {
+      printf("%s:%s: ERROR, segment %s is too small\n", driverName, functionName, name);
+      ::close(fd);
+      return ND_ERROR;
+    }
+    pBase = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (pBase == MAP_FAILED) {
+      printf("%s:%s: ERROR, cannot map segment %s\n", driverName, functionName, name);
+      return ND_ERROR;
+    }
+    pBase_ = (char *)pBase;
+    mapSize_ = st.st_size;
+    pHeader_ = (NDShmHeader_t *)pBase_;
+    epicsAtomicReadMemoryBarrier();
+    if ((pHeader_->magic != ND_SHM_MAGIC) || (pHeader_->version != ND_SHM_VERSION) ||
+        (pHeader_->segmentSize > mapSize_)) {
+      printf("%s:%s: ERROR, segment %s is not an NDShmSegment of version %d\n",
+             driverName, functionName, name, ND_SHM_VERSION);
+      close();
+      return ND_ERROR;
+    }
+    owner_ = false;
+    name_ = name;
+    return ND_SUCCESS;
+  }
+#else
+  printf("%s:%s: ERROR, shared memory segments are not supported on this platform\n", driverName, functionName);
+  return ND_ERROR;
+#endif
+}
+
+/** Detaches from the segment.  If this object created the segment, it releases the published arrays and removes
+  * the segment; readers that are still attached keep their mapping until they close it. */
+void NDShmSegment::close()
+{
+  int i;
+
+  if (!pBase_) return;
+  if (pSlotArrays_) {
+    for (i=0; i<pHeader_->numSlots; i++) {
+      if (pSlotArrays_[i]) pSlotArrays_[i]->release();
+    }
+    ::free(pSlotArrays_);
+    pSlotArrays_ = NULL;
+  }
+#ifdef __linux__
+  munmap(pBase_, mapSize_);
+  if (owner_) shm_unlink(name_.c_str());
+#endif
+  pBase_ = NULL;
+  pHeader_ = NULL;
+  mapSize_ = 0;
+  owner_ = false;
+}
+
+NDShmSlot_t* NDShmSegment::slot(int index)
+{
+  return (NDShmSlot_t *)(pBase_ + pHeader_->slotsOffset + (size_t)index*pHeader_->slotSize);
+}
+
+/** Returns true if pData is in the data area of the segment */
+bool NDShmSegment::contains(const void *pData)
+{
+  const char *p = (const char *)pData;
+
+  if (!pBase_) return false;
+  return (p >= pBase_ + pHeader_->dataOffset) && (p < pBase_ + pHeader_->segmentSize);
+}
+
+/** Allocates a buffer in the data area; this is the NDMemoryProvider interface.
+  * \param[in] size The number of bytes required.
+  * \return Pointer to the buffer, or NULL if there is no free block that is large enough. */
+void* NDShmSegment::allocate(size_t size)
+{
+  std::map<size_t, size_t>::iterator it;
+  void *pData = NULL;
+
+  if (!pBase_ || !owner_) return NULL;
+  size = roundUp(size ? size : 1, ND_SHM_ALIGNMENT);
+  epicsMutexLock(lock_);
+  /* First fit, which keeps the blocks at the start of the data area in use */
+  for (it = freeBlocks_.begin(); it != freeBlocks_.end(); ++it) {
+    if (it->second >= size) break;
+  }
+  if (it != freeBlocks_.end()) {
+    size_t offset = it->first;
+    size_t remaining = it->second - size;
+    freeBlocks_.erase(it);
+    if (remaining > 0) freeBlocks_[offset + size] = remaining;
+    freeBytes_ -= size;
+    pData = pBase_ + offset;
+  }
+  epicsMutexUnlock(lock_);
+  return pData;
+}
+
+/** Frees a buffer that allocate() returned, merging it with the adjacent free blocks.
+  * \param[in] pData Pointer to the buffer.
+  * \param[in] size The size that was passed to allocate(). */
+void NDShmSegment::free(void *pData, size_t size)
+{
+  std::map<size_t, size_t>::iterator next, prev;
+  size_t offset;
+
+  if (!pData || !contains(pData)) return;
+  offset = (char *)pData - pBase_;
+  size = roundUp(size ? size : 1, ND_SHM_ALIGNMENT);
+  epicsMutexLock(lock_);
+  freeBytes_ += size;
+  next = freeBlocks_.lower_bound(offset);
+  if ((next != freeBlocks_.end()) && (offset + size == next->first)) {
+    size += next->second;
+    freeBlocks_.erase(next++);
+  }
+  if (next != freeBlocks_.begin()) {
+    prev = next;
+    --prev;
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      epicsMutexUnlock(lock_);
+      return;
+    }
+  }
+  freeBlocks_[offset] = size;
+  epicsMutexUnlock(lock_);
+}
+
+/** Returns the name of the memory provider, which NDArrayPool::report() prints */
+const char* NDShmSegment::name()
+{
+  return name_.c_str();
+}
+
+/** Returns the size of the data area in bytes */
+size_t NDShmSegment::dataSize()
+{
+  return pBase_ ? pHeader_->segmentSize - pHeader_->dataOffset : 0;
+}
+
+/** Returns the number of free bytes in the data area */
+size_t NDShmSegment::dataFree()
+{
+  size_t freeBytes;
+
+  epicsMutexLock(lock_);
+  freeBytes = freeBytes_;
+  epicsMutexUnlock(lock_);
+  return freeBytes;
+}
+
+/** Writes the attributes of an array into a descriptor, skipping those that do not fit. */
+int NDShmSegment::writeAttributes(NDShmSlot_t *pSlot, NDAttributeList *pAttributeList)
+{
+  char *pOut = (char *)(pSlot + 1);
+  char *pEnd = pOut + maxAttributeBytes_;
+  NDAttribute *pAttribute = NULL;
+  NDShmAttribute_t *pRecord;
+  NDAttrDataType_t dataType;
+  size_t valueSize;
+  int numSkipped = 0;
+
+  pSlot->numAttributes = 0;
+  while ((pAttribute = pAttributeList->next(pAttribute)) != NULL) {
+    pAttribute->getValueInfo(&dataType, &valueSize);
+    if ((dataType == NDAttrUndefined) || (strlen(pAttribute->getName()) >= ND_SHM_ATTR_NAME_LEN) ||
+        (pOut + sizeof(NDShmAttribute_t) + roundUp(valueSize, 8) > pEnd)) {
+      numSkipped++;
+      continue;
+    }
+    pRecord = (NDShmAttribute_t *)pOut;
+    strcpy(pRecord->name, pAttribute->getName());
+    pRecord->dataType = dataType;
+    pRecord->valueSize = (int)valueSize;
+    pAttribute->getValue(dataType, pRecord + 1, valueSize);
+    pOut += sizeof(NDShmAttribute_t) + roundUp(valueSize, 8);
+    pSlot->numAttributes++;
+  }
+  pSlot->attributeBytes = (int)(pOut - (char *)(pSlot + 1));
+  return numSkipped;
+}
+
+/** Publishes an array to the readers of the segment.
+  * The data of the array must be contiguous and in the data area of the segment.  On success the segment keeps the
+  * reference to the array that the caller passed, until the descriptor is reused; the array it held before is
+  * returned in *ppOldArray, and the caller must release it.
+  * This must not be called concurrently from more than one thread.
+  * \param[in] pArray The array to publish.
+  * \param[out] ppOldArray The array that the descriptor held before, or NULL.
+  * \return ND_SUCCESS, or ND_ERROR if the descriptor is still in use by a reader, in which case the array is not
+  *         published and the caller keeps its reference.
+  */
+int NDShmSegment::publish(NDArray *pArray, NDArray **ppOldArray)
+{
+  NDShmSlot_t *pSlot;
+  NDArrayInfo_t arrayInfo;
+  int number, index, oldNumber;
+
+  *ppOldArray = NULL;
+  if (!pBase_ || !owner_ || !contains(pArray->pData)) return ND_ERROR;
+  number = pHeader_->numPublished;
+  index = number % pHeader_->numSlots;
+  pSlot = slot(index);
+  /* Marking the descriptor busy before checking readers, while readers increment readers before checking number,
+   * means that either the writer sees the reader or the reader sees that the descriptor changed */
+  oldNumber = pSlot->number;
+  epicsAtomicCmpAndSwapIntT(&pSlot->number, oldNumber, -1);
+  if (epicsAtomicGetIntT(&pSlot->readers) > 0) {
+    epicsAtomicCmpAndSwapIntT(&pSlot->number, -1, oldNumber);
+    return ND_ERROR;
+  }
+  pArray->getInfo(&arrayInfo);
+  pSlot->uniqueId = pArray->uniqueId;
+  pSlot->timeStamp = pArray->timeStamp;
+  pSlot->secPastEpoch = pArray->epicsTS.secPastEpoch;
+  pSlot->nsec = pArray->epicsTS.nsec;
+  pSlot->ndims = pArray->ndims;
+  memcpy(pSlot->dims, pArray->dims, sizeof(pSlot->dims));
+  pSlot->dataType = pArray->dataType;
+  pSlot->dataOffset = (char *)pArray->pData - pBase_;
+  pSlot->dataBytes = arrayInfo.totalBytes;
+  writeAttributes(pSlot, pArray->pAttributeList);
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicCmpAndSwapIntT(&pSlot->number, -1, number);
+  epicsAtomicSetIntT(&pHeader_->numPublished, number + 1);
+  *ppOldArray = pSlotArrays_[index];
+  pSlotArrays_[index] = pArray;
+  return ND_SUCCESS;
+}
+
+/** Returns the number of arrays that have been published; the latest one is numPublished()-1 */
+int NDShmSegment::numPublished()
+{
+  return pBase_ ? epicsAtomicGetIntT(&pHeader_->numPublished) : 0;
+}
+
+/** Acquires the descriptor of a published array, which stays valid until it is released with release().
+  * Readers should release descriptors promptly, because the writer drops new arrays while a reader holds
+  * the descriptor they would replace.
+  * \param[in] number The number of the array, from 0 to numPublished()-1.
+  * \return The descriptor, or NULL if the array has not been published or has been overwritten. */
+NDShmSlot_t* NDShmSegment::acquire(int number)
+{
+  NDShmSlot_t *pSlot;
+
+  if (!pBase_ || (number < 0)) return NULL;
+  pSlot = slot(number % pHeader_->numSlots);
+  epicsAtomicIncrIntT(&pSlot->readers);
+  if (epicsAtomicGetIntT(&pSlot->number) != number) {
+    epicsAtomicDecrIntT(&pSlot->readers);
+    return NULL;
+  }
+  epicsAtomicReadMemoryBarrier();
+  return pSlot;
+}
+
+/** Releases a descriptor that acquire() returned */
+void NDShmSegment::release(NDShmSlot_t *pSlot)
+{
+  epicsAtomicDecrIntT(&pSlot->readers);
+}
+
+/** Returns the address of the array data of a descriptor in this process */
+void* NDShmSegment::data(NDShmSlot_t *pSlot)
+{
+  return pBase_ + pSlot->dataOffset;
+}
+
+/** Iterates over the attributes of a descriptor.
+  * \param[in] pSlot The descriptor.
+  * \param[in] pAttribute The previous attribute, or NULL for the first one.
+  * \return The next attribute, or NULL if there are no more. */
+NDShmAttribute_t* NDShmSegment::nextAttribute(NDShmSlot_t *pSlot, NDShmAttribute_t *pAttribute)
+{
+  char *pStart = (char *)(pSlot + 1);
+  char *pNext;
+
+  if (!pAttribute) pNext = pStart;
+  else pNext = (char *)pAttribute + sizeof(NDShmAttribute_t) + roundUp(pAttribute->valueSize, 8);
+  if (pNext >= pStart + pSlot->attributeBytes) return NULL;
+  return (NDShmAttribute_t *)pNext;
+}
+
+/** Returns the address of the value of an attribute record */
+void* NDShmSegment::attributeValue(NDShmAttribute_t *pAttribute)
+{
+  return pAttribute + 1;
+}
+
+/** Reports on the segment.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then the free blocks of the data area are also reported. */
+int NDShmSegment::report(FILE *fp, int details)
+{
+  std::map<size_t, size_t>::iterator it;
+
+  if (!pBase_) {
+    fprintf(fp, "NDShmSegment: not attached\n");
+    return ND_SUCCESS;
+  }
+  fprintf(fp, "NDShmSegment: name=%s, owner=%s, numSlots=%d, slotSize=%d, segmentSize=%lu\n",
+          name_.c_str(), owner_ ? "Yes" : "No", pHeader_->numSlots, pHeader_->slotSize,
+          (unsigned long)pHeader_->segmentSize);
+  fprintf(fp, "  numPublished=%d, dataSize=%lu, dataFree=%lu\n",
+          numPublished(), (unsigned long)dataSize(), (unsigned long)dataFree());
+  if (details > 0) {
+    epicsMutexLock(lock_);
+    for (it = freeBlocks_.begin(); it != freeBlocks_.end(); ++it) {
+      fprintf(fp, "  free block offset=%lu, size=%lu\n", (unsigned long)it->first, (unsigned long)it->second);
+    }
+    epicsMutexUnlock(lock_);
+  }
+  return ND_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/** NDShmSegment.h
+ *
+ * A POSIX shared memory segment that holds NDArray buffers and a ring of array descriptors,
+ * so that processes on the same host can read NDArrays without copying them.
+ *
+ */
+
+#ifndef NDShmSegment_H
+#define NDShmSegment_H
+
+#include <stddef.h>
+#include <map>
+#include <string>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+/** Magic number at the start of every segment, "NDSM" */
+#define ND_SHM_MAGIC   0x4E44534D
+/** Version of the segment layout; readers must check it */
+#define ND_SHM_VERSION 1
+/** Maximum length of an attribute name in a descriptor, including the terminating NUL */
+#define ND_SHM_ATTR_NAME_LEN 64
+
+/* The structures below define the layout of the segment.  They use the native types and alignment of the IOC host,
+ * so readers must be built for the same ABI.
+ * The segment contains an NDShmHeader_t, followed by numSlots descriptors of slotSize bytes each,
+ * followed by the data area that the NDArray buffers are allocated from.  All offsets are from the start of the segment.
+ *
+ * The writer publishes array number n (0, 1, 2, ...) in slot n % numSlots and then sets numPublished to n+1.
+ * A reader acquires array n by atomically incrementing readers of the slot and then checking that number equals n;
+ * if it does not the array has been overwritten, and the reader decrements readers again.
+ * The writer does not reuse a slot while readers is non-zero, so the descriptor and the data it points to
+ * stay valid until the reader decrements readers.  NDShmSegment::acquire() and release() implement this protocol.
+ */
+
+/** Header at the start of the segment */
+typedef struct {
+    epicsUInt32 magic;          /**< ND_SHM_MAGIC */
+    epicsUInt32 version;        /**< ND_SHM_VERSION */
+    int         numSlots;       /**< Number of descriptors in the ring */
+    int         slotSize;       /**< Size of each descriptor in bytes, including its attributes */
+    size_t      slotsOffset;    /**< Offset of the first descriptor */
+    size_t      dataOffset;     /**< Offset of the data area */
+    size_t      segmentSize;    /**< Total size of the segment in bytes */
+    int         numPublished;   /**< Number of arrays published; the latest is numPublished-1.  Updated atomically. */
+} NDShmHeader_t;
+
+/** Descriptor of a published NDArray */
+typedef struct {
+    int           number;       /**< Number of the array this descriptor holds; -1 while it is written.  Updated atomically. */
+    int           readers;      /**< Number of readers of this descriptor, over all processes.  Updated atomically. */
+    int           uniqueId;     /**< NDArray::uniqueId */
+    double        timeStamp;    /**< NDArray::timeStamp */
+    epicsUInt32   secPastEpoch; /**< NDArray::epicsTS.secPastEpoch */
+    epicsUInt32   nsec;         /**< NDArray::epicsTS.nsec */
+    int           ndims;        /**< NDArray::ndims */
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS]; /**< NDArray::dims */
+    int           dataType;     /**< NDArray::dataType, an NDDataType_t */
+    size_t        dataOffset;   /**< Offset of the array data, which is contiguous */
+    size_t        dataBytes;    /**< Size of the array data in bytes */
+    int           numAttributes;  /**< Number of NDShmAttribute_t records that follow the descriptor */
+    int           attributeBytes; /**< Total size of the attribute records in bytes */
+} NDShmSlot_t;
+
+/** Attribute record; the value follows the record and is padded to a multiple of 8 bytes */
+typedef struct {
+    char          name[ND_SHM_ATTR_NAME_LEN]; /**< Name of the attribute */
+    int           dataType;     /**< NDAttrDataType_t of the value */
+    int           valueSize;    /**< Size of the value in bytes; for NDAttrString this includes the terminating NUL */
+} NDShmAttribute_t;
+
+/** A shared memory segment for NDArrays, which is also the NDMemoryProvider for pools that allocate
+  * their buffers in it.
+  * The IOC creates the segment with create() and publishes arrays with publish(); other processes attach
+  * to it with open() and read arrays with acquire() and release().
+  * The segment uses the epicsAtomic functions on shared memory, which requires a platform on which they are lock-free.
+  */
+class epicsShareClass NDShmSegment : public NDMemoryProvider {
+public:
+    NDShmSegment();
+    ~NDShmSegment();
+    int          create(const char *name, int numSlots, size_t dataSize, int maxAttributeBytes);
+    int          open(const char *name);
+    void         close();
+
+    /* Methods for the writer */
+    int          publish(NDArray *pArray, NDArray **ppOldArray);
+    bool         contains(const void *pData);
+    void*        allocate(size_t size);
+    void         free(void *pData, size_t size);
+    const char*  name();
+
+    /* Methods for readers */
+    int          numPublished();
+    NDShmSlot_t* acquire(int number);
+    void         release(NDShmSlot_t *pSlot);
+    void*        data(NDShmSlot_t *pSlot);
+    NDShmAttribute_t* nextAttribute(NDShmSlot_t *pSlot, NDShmAttribute_t *pAttribute);
+    void*        attributeValue(NDShmAttribute_t *pAttribute);
+
+    size_t       dataSize();
+    size_t       dataFree();
+    int          report(FILE *fp, int details);
+
+private:
+    NDShmSlot_t* slot(int index);
+    int          writeAttributes(NDShmSlot_t *pSlot, NDAttributeList *pAttributeList);
+
+    char         *pBase_;       /**< Address of the segment in this process; NULL if not attached */
+    NDShmHeader_t *pHeader_;    /**< The header at the start of the segment */
+    size_t       mapSize_;      /**< Size of the mapping */
+    bool         owner_;        /**< The segment was created by this object and is removed when it is closed */
+    int          maxAttributeBytes_; /**< Space for attribute records in each descriptor */
+    std::string  name_;         /**< Name of the segment, e.g. "/13SIM1" */
+    NDArray      **pSlotArrays_; /**< The arrays that the descriptors refer to, reserved by publish() */
+    std::map<size_t, size_t> freeBlocks_; /**< Free blocks of the data area, offset to size */
+    size_t       freeBytes_;    /**< Sum of the sizes of the free blocks */
+    epicsMutexId lock_;         /**< Protects freeBlocks_ */
+};
+
+#endif
@@ -0,0 +1,255 @@
+/** NDSpillFile.cpp
+ *
+ * Memory-mapped file of fixed-size slots with write-behind.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#include <epicsThread.h>
+
+#include "NDSpillFile.h"
+
+static const char *driverName = "NDSpillFile";
+
+static void writerTaskC(void *drvPvt)
+{
+  NDSpillFile *pPvt = (NDSpillFile *)drvPvt;
+  pPvt->writerTask();
+}
+
+NDSpillFile::NDSpillFile()
+  : pBase_(NULL), mapSize_(0), numSlots_(0), slotSize_(0), maxPending_(0), exiting_(false), numWrites_(0)
+{
+  lock_ = epicsMutexMustCreate();
+  wakeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  doneEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  exitEvent_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+NDSpillFile::~NDSpillFile()
+{
+  close();
+  epicsEventDestroy(exitEvent_);
+  epicsEventDestroy(doneEvent_);
+  epicsEventDestroy(wakeEvent_);
+  epicsMutexDestroy(lock_);
+}
+
+/** Creates the file, replacing any file with the same path, maps it and starts the thread that writes it.
+  * \param[in] path The path of the file, normally on a fast local disk.
+  * \param[in] numSlots The number of slots.
+  * \param[in] slotSize The size of each slot in bytes.
+  * \param[in] maxPending The number of writes that can be queued before write() waits.
+  */
+int NDSpillFile::open(const char *path, int numSlots, size_t slotSize, int maxPending)
+{
+  static const char *functionName = "open";
+
+  if (pBase_) close();
+  if ((numSlots < 1) || (slotSize == 0) || (maxPending < 1)) {
+    printf("%s:%s: ERROR, invalid numSlots=%d, slotSize=%lu or maxPending=%d\n",
+           driverName, functionName, numSlots, (unsigned long)slotSize, maxPending);
+    return ND_ERROR;
+  }
+#ifdef __linux__
+  {
+    size_t fileSize = (size_t)numSlots * slotSize;
+    void *pBase;
+    int fd;
+
+    fd = ::open(path, O_CREAT | O_TRUNC | O_RDWR, 0660);
+    if (fd < 0) {
+      printf("%s:%s: ERROR, cannot create file %s\n", driverName, functionName, path);
+      perror(functionName);
+      return ND_ERROR;
+    }
+    if (ftruncate(fd, fileSize) != 0) {
+      printf("%s:%s: ERROR, cannot set the size of file %s to %lu bytes\n",
+             driverName, functionName, path, (unsigned long)fileSize);
+      ::close(fd);
+      unlink(path);
+      return ND_ERROR;
+    }
+    pBase = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (pBase == MAP_FAILED) {
+      printf("%s:%s: ERROR, cannot map file %s\n", driverName, functionName, path);
+      unlink(path);
+      return ND_ERROR;
+    }
+    pBase_ = (char *)pBase;
+    mapSize_ = fileSize;
+    numSlots_ = numSlots;
+    slotSize_ = slotSize;
+    maxPending_ = maxPending;
+    path_ = path;
+    dataBytes_.assign(numSlots, 0);
+    exiting_ = false;
+    epicsThreadMustCreate("NDSpillFile", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          writerTaskC, this);
+    return ND_SUCCESS;
+  }
+#else
+  printf("%s:%s: ERROR, spill files are not supported on this platform\n", driverName, functionName);
+  return ND_ERROR;
+#endif
+}
+
+/** Stops the thread, discarding the writes that are still queued, then unmaps and deletes the file. */
+void NDSpillFile::close()
+{
+  if (!pBase_) return;
+  epicsMutexLock(lock_);
+  exiting_ = true;
+  epicsMutexUnlock(lock_);
+  epicsEventSignal(wakeEvent_);
+  epicsEventWait(exitEvent_);
+  while (!pending_.empty()) {
+    delete pending_.front();
+    pending_.pop_front();
+  }
+#ifdef __linux__
+  munmap(pBase_, mapSize_);
+  unlink(path_.c_str());
+#endif
+  pBase_ = NULL;
+  mapSize_ = 0;
+  numSlots_ = 0;
+  slotSize_ = 0;
+  dataBytes_.clear();
+}
+
+/** Returns true if the file is open. */
+bool NDSpillFile::isOpen()
+{
+  return pBase_ != NULL;
+}
+
+/** Returns the number of slots of the file. */
+int NDSpillFile::numSlots()
+{
+  return numSlots_;
+}
+
+/** Returns the size of a slot in bytes. */
+size_t NDSpillFile::slotSize()
+{
+  return slotSize_;
+}
+
+/** Queues the data of a slot for the thread to write.
+  * If maxPending writes are already queued this waits until the thread has written one.
+  * \param[in] slot The slot.
+  * \param[in,out] data The data, at most slotSize() bytes; the file takes the buffer, so data is empty on return.
+  */
+int NDSpillFile::write(int slot, std::vector<char>& data)
+{
+  spillWrite_t *pWrite;
+
+  if (!pBase_ || (slot < 0) || (slot >= numSlots_) || (data.size() > slotSize_)) return ND_ERROR;
+  pWrite = new spillWrite_t;
+  pWrite->slot = slot;
+  pWrite->data.swap(data);
+  dataBytes_[slot] = pWrite->data.size();
+  epicsMutexLock(lock_);
+  while ((int)pending_.size() >= maxPending_) {
+    epicsMutexUnlock(lock_);
+    epicsEventWait(doneEvent_);
+    epicsMutexLock(lock_);
+  }
+  pending_.push_back(pWrite);
+  epicsMutexUnlock(lock_);
+  epicsEventSignal(wakeEvent_);
+  return ND_SUCCESS;
+}
+
+/** Waits until the thread has written all of the queued writes. */
+void NDSpillFile::waitWrites()
+{
+  epicsMutexLock(lock_);
+  while (!pending_.empty()) {
+    epicsMutexUnlock(lock_);
+    epicsEventWait(doneEvent_);
+    epicsMutexLock(lock_);
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/** Returns the address of a slot in the mapping; the data of the last write() of the slot is there once
+  * waitWrites() has returned.
+  * \param[in] slot The slot. */
+const void* NDSpillFile::data(int slot)
+{
+  if (!pBase_ || (slot < 0) || (slot >= numSlots_)) return NULL;
+  return pBase_ + (size_t)slot * slotSize_;
+}
+
+/** Returns the size of the data of the last write() of a slot.
+  * \param[in] slot The slot. */
+size_t NDSpillFile::dataBytes(int slot)
+{
+  if (!pBase_ || (slot < 0) || (slot >= numSlots_)) return 0;
+  return dataBytes_[slot];
+}
+
+/** Reports the file and its queued writes.
+  * \param[in] fp File pointer for the report output.
+  * \param[in] details The level of detail of the report.
+  */
+int NDSpillFile::report(FILE *fp, int details)
+{
+  size_t numPending, numWrites;
+
+  epicsMutexLock(lock_);
+  numPending = pending_.size();
+  numWrites = numWrites_;
+  epicsMutexUnlock(lock_);
+  if (!pBase_) {
+    fprintf(fp, "  Spill file: not open\n");
+    return ND_SUCCESS;
+  }
+  fprintf(fp, "  Spill file %s: %d slots of %lu bytes, %lu writes queued, %lu written\n",
+          path_.c_str(), numSlots_, (unsigned long)slotSize_, (unsigned long)numPending, (unsigned long)numWrites);
+  return ND_SUCCESS;
+}
+
+/** The loop of the thread that copies the queued writes into the mapping.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDSpillFile::writerTask()
+{
+  spillWrite_t *pWrite;
+
+  epicsMutexLock(lock_);
+  while (!exiting_) {
+    if (pending_.empty()) {
+      epicsMutexUnlock(lock_);
+      epicsEventWait(wakeEvent_);
+      epicsMutexLock(lock_);
+      continue;
+    }
+    /* The write stays queued while it is copied, so waitWrites() returns only once it is in the mapping */
+    pWrite = pending_.front();
+    epicsMutexUnlock(lock_);
+    if (!pWrite->data.empty())
+      memcpy(pBase_ + (size_t)pWrite->slot * slotSize_, &pWrite->data[0], pWrite->data.size());
+    epicsMutexLock(lock_);
+    pending_.pop_front();
+    numWrites_++;
+    epicsMutexUnlock(lock_);
+    delete pWrite;
+    epicsEventSignal(doneEvent_);
+    epicsMutexLock(lock_);
+  }
+  epicsMutexUnlock(lock_);
+  epicsEventSignal(exitEvent_);
+}
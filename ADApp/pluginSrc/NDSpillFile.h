@@ -0,0 +1,70 @@
+/** NDSpillFile.h
+ *
+ * A memory-mapped file of fixed-size slots that keeps data which does not fit in memory, such as the older
+ * arrays of the pre-trigger ring of NDPluginCircularBuff.
+ *
+ */
+
+#ifndef NDSpillFile_H
+#define NDSpillFile_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+/** A file of numSlots slots of slotSize bytes, mapped into memory.
+  * write() queues the data of a slot and returns at once; a thread of the file copies the queued data into the
+  * mapping, from which the operating system writes it to the disk, and frees it.  At most maxPending writes are
+  * queued, after which write() waits for the thread, so the memory used by the writes stays bounded.
+  * data() reads a slot in the mapping once waitWrites() has returned.
+  * The file is created by open() and deleted by close(); it is only supported on Linux.
+  */
+class epicsShareClass NDSpillFile {
+public:
+    NDSpillFile();
+    ~NDSpillFile();
+    int          open(const char *path, int numSlots, size_t slotSize, int maxPending);
+    void         close();
+    bool         isOpen();
+    int          numSlots();
+    size_t       slotSize();
+
+    int          write(int slot, std::vector<char>& data);
+    void         waitWrites();
+    const void*  data(int slot);
+    size_t       dataBytes(int slot);
+    int          report(FILE *fp, int details);
+
+    void         writerTask();
+
+private:
+    typedef struct {
+        int slot;
+        std::vector<char> data;
+    } spillWrite_t;
+
+    char         *pBase_;       /**< Address of the mapping; NULL if the file is not open */
+    size_t       mapSize_;      /**< Size of the mapping */
+    int          numSlots_;
+    size_t       slotSize_;
+    int          maxPending_;
+    std::string  path_;         /**< Path of the file, which close() deletes */
+    std::vector<size_t> dataBytes_;   /**< The bytes written to each slot */
+    std::deque<spillWrite_t *> pending_;  /**< The queued writes, oldest first */
+    bool         exiting_;
+    size_t       numWrites_;    /**< The writes copied into the mapping */
+    epicsMutexId lock_;         /**< Protects pending_, exiting_ and numWrites_ */
+    epicsEventId wakeEvent_;    /**< Signalled when a write is queued or the thread must exit */
+    epicsEventId doneEvent_;    /**< Signalled when the thread has copied a write */
+    epicsEventId exitEvent_;    /**< Signalled by the thread when it exits */
+};
+
+#endif
@@ -0,0 +1,178 @@
+/** NDStatsKernels.cpp
+ *
+ * Kernels for the minimum, maximum, sum and sum of squares of contiguous arrays, which use the vectorized
+ * primitives of NDSimdKernels.h, count tables for the histograms and quantiles.
+ *
+ */
+
+#include <math.h>
+
+#include <epicsTypes.h>
+
+#include <NDSimdKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDStatsKernels.h"
+
+/** Computes the minimum and maximum and their positions, the sum and the sum of squares of a contiguous array
+  * with the fastest kernel the CPU supports, NDSimdStats().
+  * Only UInt8 and UInt16 have kernels; their sums are computed exactly with integers.
+  * \param[in] dataType The data type of the array.
+  * \param[in] pData The elements.
+  * \param[in] nElements The number of elements.
+  * \param[out] pSums The statistics.
+  * \return ND_SUCCESS if the statistics were computed, ND_ERROR if there is no kernel for this data type
+  * or the array is empty, and the caller must compute them.
+  */
+int NDStatsContiguous(NDDataType_t dataType, const void *pData, size_t nElements, NDStatsSums_t *pSums)
+{
+  NDSimdStats_t stats;
+
+  if (NDSimdStats(dataType, pData, nElements, &stats) != ND_SUCCESS) return ND_ERROR;
+  pSums->min = stats.min;
+  pSums->minIndex = stats.minIndex;
+  pSums->max = stats.max;
+  pSums->maxIndex = stats.maxIndex;
+  pSums->shift = 0.;
+  pSums->total = (double)stats.sum;
+  pSums->sumSquares = (double)stats.sumSquares;
+  return ND_SUCCESS;
+}
+
+/* The index of a value in the count table; signed values are offset so that the smallest is at index 0 */
+static inline size_t countIndex(epicsInt8 value)   { return (epicsUInt8)value ^ 0x80; }
+static inline size_t countIndex(epicsUInt8 value)  { return value; }
+static inline size_t countIndex(epicsInt16 value)  { return (epicsUInt16)value ^ 0x8000; }
+static inline size_t countIndex(epicsUInt16 value) { return value; }
+
+/* Counts the values into 4 (ND_STATS_SUB_HISTOGRAMS) interleaved tables, so that runs of equal values, which are
+ * common in images, increment different counters and do not wait for each other's stores */
+template <typename epicsType>
+static void countValuesT(const epicsType *pData, size_t nElements, size_t nValues, epicsUInt32 *pCounts)
+{
+  epicsUInt32 *pCounts0 = pCounts;
+  epicsUInt32 *pCounts1 = pCounts + nValues;
+  epicsUInt32 *pCounts2 = pCounts + 2*nValues;
+  epicsUInt32 *pCounts3 = pCounts + 3*nValues;
+  size_t i;
+
+  for (i=0; i+4<=nElements; i+=4) {
+    pCounts0[countIndex(pData[i])]++;
+    pCounts1[countIndex(pData[i+1])]++;
+    pCounts2[countIndex(pData[i+2])]++;
+    pCounts3[countIndex(pData[i+3])]++;
+  }
+  for (; i<nElements; i++) pCounts0[countIndex(pData[i])]++;
+}
+
+/** Returns the number of distinct values of the data types that can be counted with NDStatsCountValues().
+  * \param[in] dataType The data type.
+  * \param[out] pFirstValue The value counted at index 0 of the table.
+  * \return 256 for 8-bit types, 65536 for 16-bit types, 0 for the others.
+  */
+size_t NDStatsValueRange(NDDataType_t dataType, double *pFirstValue)
+{
+  *pFirstValue = 0.;
+  switch (dataType) {
+    case NDInt8:
+      *pFirstValue = -128.;
+      return 256;
+    case NDUInt8:
+      return 256;
+    case NDInt16:
+      *pFirstValue = -32768.;
+      return 65536;
+    case NDUInt16:
+      return 65536;
+    default:
+      return 0;
+  }
+}
+
+/** Adds the number of times each value occurs in a contiguous array to a count table.
+  * The table has ND_STATS_SUB_HISTOGRAMS sub-tables of NDStatsValueRange() entries each, which must be zeroed
+  * before the first call and added with NDStatsMergeCounts() after the last.
+  * \param[in] dataType The data type of the array.
+  * \param[in] pData The elements.
+  * \param[in] nElements The number of elements.
+  * \param[in,out] pCounts The count table.
+  * \return ND_SUCCESS, or ND_ERROR if the data type has no count table.
+  */
+int NDStatsCountValues(NDDataType_t dataType, const void *pData, size_t nElements, epicsUInt32 *pCounts)
+{
+  double firstValue;
+  size_t nValues = NDStatsValueRange(dataType, &firstValue);
+
+  switch (dataType) {
+    case NDInt8:
+      countValuesT((const epicsInt8 *)pData, nElements, nValues, pCounts);
+      break;
+    case NDUInt8:
+      countValuesT((const epicsUInt8 *)pData, nElements, nValues, pCounts);
+      break;
+    case NDInt16:
+      countValuesT((const epicsInt16 *)pData, nElements, nValues, pCounts);
+      break;
+    case NDUInt16:
+      countValuesT((const epicsUInt16 *)pData, nElements, nValues, pCounts);
+      break;
+    default:
+      return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Adds the sub-tables of a count table filled by NDStatsCountValues() into the first.
+  * \param[in] dataType The data type of the array.
+  * \param[in,out] pCounts The count table.
+  */
+void NDStatsMergeCounts(NDDataType_t dataType, epicsUInt32 *pCounts)
+{
+  double firstValue;
+  size_t nValues = NDStatsValueRange(dataType, &firstValue);
+  size_t i;
+  int sub;
+
+  for (sub=1; sub<ND_STATS_SUB_HISTOGRAMS; sub++) {
+    for (i=0; i<nValues; i++) pCounts[i] += pCounts[sub*nValues + i];
+  }
+}
+
+/** Computes quantiles from the counts of a histogram, with the nearest-rank definition: the quantile for
+  * fraction f is the value of the element at rank ceil(f*N), 1-based, in the sorted array of N elements.
+  * \param[in] pCounts The counts of the bins.
+  * \param[in] nBins The number of bins.
+  * \param[in] firstValue The lower edge of the first bin, or its value if the bins are exact values.
+  * \param[in] binWidth The width of the bins.
+  * \param[in] interpolate 0 if each bin holds one exact value, 1 to interpolate linearly within the bin.
+  * \param[in] pFractions The fractions, each in the range 0 to 1.
+  * \param[in] nFractions The number of fractions.
+  * \param[out] pValues The quantiles.
+  * \return ND_SUCCESS, or ND_ERROR if the histogram is empty.
+  */
+int NDStatsQuantiles(const epicsUInt32 *pCounts, size_t nBins, double firstValue, double binWidth,
+                     int interpolate, const double *pFractions, int nFractions, double *pValues)
+{
+  double nElements = 0., rank, cumulative;
+  size_t bin;
+  int i;
+
+  for (bin=0; bin<nBins; bin++) nElements += pCounts[bin];
+  if (nElements == 0.) return ND_ERROR;
+
+  for (i=0; i<nFractions; i++) {
+    rank = ceil(pFractions[i] * nElements);
+    if (rank < 1.) rank = 1.;
+    if (rank > nElements) rank = nElements;
+    cumulative = 0.;
+    for (bin=0; (bin<nBins-1) && (cumulative + pCounts[bin] < rank); bin++) cumulative += pCounts[bin];
+    if (interpolate && (pCounts[bin] > 0)) {
+      /* The elements of the bin are taken to be spread evenly over it */
+      pValues[i] = firstValue + binWidth * (bin + (rank - cumulative - 0.5) / pCounts[bin]);
+    } else {
+      pValues[i] = firstValue + binWidth * bin;
+    }
+  }
+  return ND_SUCCESS;
+}
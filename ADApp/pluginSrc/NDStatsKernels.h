@@ -0,0 +1,150 @@
+/** NDStatsKernels.h
+ *
+ * Vectorized kernels for the basic statistics of contiguous arrays, count tables for the histograms
+ * of 8-bit and 16-bit arrays, and quantiles from histograms.
+ * The instruction set is selected at run time from the features of the CPU, as for the conversion kernels.
+ *
+ */
+
+#ifndef NDStatsKernels_H
+#define NDStatsKernels_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The statistics computed by NDStatsContiguous() */
+typedef struct {
+    double min;         /**< Minimum value */
+    size_t minIndex;    /**< Index of the first element with the minimum value */
+    double max;         /**< Maximum value */
+    size_t maxIndex;    /**< Index of the first element with the maximum value */
+    double shift;       /**< Value subtracted from each element before the sums are computed */
+    double total;       /**< Sum of the values minus shift */
+    double sumSquares;  /**< Sum of the squares of the values minus shift */
+} NDStatsSums_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+epicsShareFunc int NDStatsContiguous(NDDataType_t dataType, const void *pData, size_t nElements,
+                                     NDStatsSums_t *pSums);
+
+/** The number of interleaved sub-tables in the count tables of NDStatsCountValues() */
+#define ND_STATS_SUB_HISTOGRAMS 4
+
+epicsShareFunc size_t NDStatsValueRange(NDDataType_t dataType, double *pFirstValue);
+epicsShareFunc int NDStatsCountValues(NDDataType_t dataType, const void *pData, size_t nElements,
+                                      epicsUInt32 *pCounts);
+epicsShareFunc void NDStatsMergeCounts(NDDataType_t dataType, epicsUInt32 *pCounts);
+epicsShareFunc int NDStatsQuantiles(const epicsUInt32 *pCounts, size_t nBins, double firstValue, double binWidth,
+                                    int interpolate, const double *pFractions, int nFractions, double *pValues);
+
+#ifdef __cplusplus
+}
+
+/** The types NDStatsRow() accumulates the sums of each data type in.
+  * Integers of up to 16 bits are summed exactly in 64-bit integers.  32-bit integers are summed exactly, but
+  * their squares are summed in double about a shift.  Floating point values are summed in double about a shift,
+  * in blocks, so that a bright background does not cancel the variance and the rounding errors stay small. */
+template <typename epicsType> struct NDStatsAccumulator {
+    typedef double sumType;
+    typedef double squareType;
+    enum {shifted = 1};
+};
+template <> struct NDStatsAccumulator<epicsInt8> {
+    typedef epicsInt64 sumType;
+    typedef epicsInt64 squareType;
+    enum {shifted = 0};
+};
+template <> struct NDStatsAccumulator<epicsUInt8> {
+    typedef epicsInt64 sumType;
+    typedef epicsInt64 squareType;
+    enum {shifted = 0};
+};
+template <> struct NDStatsAccumulator<epicsInt16> {
+    typedef epicsInt64 sumType;
+    typedef epicsInt64 squareType;
+    enum {shifted = 0};
+};
+template <> struct NDStatsAccumulator<epicsUInt16> {
+    typedef epicsInt64 sumType;
+    typedef epicsInt64 squareType;
+    enum {shifted = 0};
+};
+template <> struct NDStatsAccumulator<epicsInt32> {
+    typedef epicsInt64 sumType;
+    typedef double squareType;
+    enum {shifted = 1};
+};
+template <> struct NDStatsAccumulator<epicsUInt32> {
+    typedef epicsInt64 sumType;
+    typedef double squareType;
+    enum {shifted = 1};
+};
+
+/** The number of elements NDStatsRow() sums before it adds the sums to the totals in double */
+#define ND_STATS_BLOCK 4096
+
+/** Returns the shift that NDStatsRow() should use for an array: its first element for the types that are
+  * summed about a shift, otherwise 0.  All the rows of an array must use the same shift so that their sums
+  * can be added. */
+template <typename epicsType>
+double NDStatsShift(const epicsType *pData)
+{
+    return NDStatsAccumulator<epicsType>::shifted ? (double)pData[0] : 0.;
+}
+
+/** Computes the minimum and maximum and their positions, the sum and the sum of squares of a contiguous row
+  * with the accumulator types for the data type.  This is the scalar code for the data types that
+  * NDStatsContiguous() has no kernel for.
+  * \param[in] pData The elements.
+  * \param[in] nElements The number of elements, which must be at least 1.
+  * \param[in] shift The value subtracted from each element before the sums, normally NDStatsShift() of the array.
+  * \param[out] pSums The statistics. */
+template <typename epicsType>
+void NDStatsRow(const epicsType *pData, size_t nElements, double shift, NDStatsSums_t *pSums)
+{
+    typedef typename NDStatsAccumulator<epicsType>::sumType sumType;
+    typedef typename NDStatsAccumulator<epicsType>::squareType squareType;
+    epicsType min = pData[0], max = pData[0];
+    size_t imin = 0, imax = 0, i, start, end;
+    sumType offset = (sumType)shift;
+    double total = 0., sumSquares = 0.;
+
+    for (start=0; start<nElements; start+=ND_STATS_BLOCK) {
+        sumType sum = 0;
+        squareType squares = 0;
+        end = (nElements - start > ND_STATS_BLOCK) ? start + ND_STATS_BLOCK : nElements;
+        for (i=start; i<end; i++) {
+            epicsType value = pData[i];
+            sumType delta = (sumType)value - offset;
+            if (value < min) {
+                min = value;
+                imin = i;
+            }
+            if (value > max) {
+                max = value;
+                imax = i;
+            }
+            sum += delta;
+            squares += (squareType)delta * (squareType)delta;
+        }
+        total += (double)sum;
+        sumSquares += (double)squares;
+    }
+    pSums->min = (double)min;
+    pSums->minIndex = imin;
+    pSums->max = (double)max;
+    pSums->maxIndex = imax;
+    pSums->shift = shift;
+    pSums->total = total;
+    pSums->sumSquares = sumSquares;
+}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * NDTcpReceiver.cpp
+ *
+ * Driver that receives NDArrays from an NDPluginTcpSend plugin in another IOC over TCP.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsStdio.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDTcpReceiver.h"
+
+static const char *driverName="NDTcpReceiver";
+
+/** Time to wait before listening again if accepting a connection fails, in seconds */
+#define TCP_RECV_ACCEPT_RETRY 1.0
+
+static void receiveTaskC(void *drvPvt)
+{
+    NDTcpReceiver *pPvt = (NDTcpReceiver *)drvPvt;
+    pPvt->receiveTask();
+}
+
+/** Sets the array parameters from a received array and does the NDArray callbacks with it.
+  * This is called with the lock, which it releases during the callbacks.
+  * \param[in] pArray The array, which this driver now owns. */
+void NDTcpReceiver::publishArray(NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    int count, arrayCallbacks;
+
+    pArray->getInfo(&arrayInfo);
+    getIntegerParam(NDArrayCounter, &count);
+    setIntegerParam(NDArrayCounter, count+1);
+    getIntegerParam(NDTcpReceiverNumReceived, &count);
+    setIntegerParam(NDTcpReceiverNumReceived, count+1);
+    setIntegerParam(NDArraySize, (int)arrayInfo.totalBytes);
+    setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+    setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+    setIntegerParam(NDArraySizeZ, (int)arrayInfo.colorSize);
+    setIntegerParam(NDNDimensions, pArray->ndims);
+    setIntegerParam(NDDataType, pArray->dataType);
+    setIntegerParam(NDColorMode, arrayInfo.colorMode);
+    setIntegerParam(NDUniqueId, pArray->uniqueId);
+    setDoubleParam(NDTimeStamp, pArray->timeStamp);
+    setIntegerParam(NDEpicsTSSec, pArray->epicsTS.secPastEpoch);
+    setIntegerParam(NDEpicsTSNsec, pArray->epicsTS.nsec);
+
+    /* Add the attributes of this driver; the attributes from the sender are kept */
+    this->getAttributes(pArray->pAttributeList);
+
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (arrayCallbacks) {
+        /* Call the NDArray callback without the lock, as the other drivers do */
+        this->unlock();
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        this->lock();
+    }
+    if (this->pArrays[0]) this->pArrays[0]->release();
+    this->pArrays[0] = pArray;
+}
+
+/** Task that accepts a connection from a sender and receives its arrays, until the connection fails.
+  * It then waits for the next sender. */
+void NDTcpReceiver::receiveTask()
+{
+    char peer[256];
+    NDArray *pArray;
+    size_t bytes;
+    int count;
+    static const char *functionName = "receiveTask";
+
+    while (1) {
+        if (stream_.accept(peer, sizeof(peer)) != ND_SUCCESS) {
+            epicsThreadSleep(TCP_RECV_ACCEPT_RETRY);
+            continue;
+        }
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s connection from %s\n",
+            driverName, functionName, peer);
+        this->lock();
+        setIntegerParam(NDTcpReceiverConnected, 1);
+        setStringParam(NDTcpReceiverPeer, peer);
+        callParamCallbacks();
+        this->unlock();
+
+        /* Grant the sender the arrays it may have in flight */
+        stream_.sendCredits(maxCredits_);
+        while (stream_.connected()) {
+            bytes = 0;
+            if (stream_.receiveArray(this->pNDArrayPool, &pArray, &bytes) != ND_SUCCESS) break;
+            this->lock();
+            bytesReceived_ += bytes;
+            setDoubleParam(NDTcpReceiverMBytes, bytesReceived_/1e6);
+            if (pArray) {
+                publishArray(pArray);
+            } else {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                    "%s::%s NDArrayPool is full, dropped array\n",
+                    driverName, functionName);
+                getIntegerParam(NDTcpReceiverNumDropped, &count);
+                setIntegerParam(NDTcpReceiverNumDropped, count+1);
+            }
+            callParamCallbacks();
+            this->unlock();
+            /* The callbacks are done with the array, so the sender may send another */
+            stream_.sendCredits(1);
+        }
+
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s connection from %s closed\n",
+            driverName, functionName, peer);
+        stream_.close();
+        this->lock();
+        setIntegerParam(NDTcpReceiverConnected, 0);
+        callParamCallbacks();
+        this->unlock();
+    }
+}
+
+/** Constructor for NDTcpReceiver.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] listenPort The TCP port to listen on for the sender.
+  * \param[in] maxCredits The number of arrays the sender may have in flight; 0 for the default of 2.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDTcpReceiver::NDTcpReceiver(const char *portName, int listenPort, int maxCredits,
+                             int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : asynNDArrayDriver(portName, 1, maxBuffers, maxMemory,
+                        0, 0, 0, 1, priority, stackSize),
+      maxCredits_(maxCredits > 0 ? maxCredits : 2), bytesReceived_(0.), receiveThreadId_(0)
+{
+    char taskName[256];
+    static const char *functionName = "NDTcpReceiver";
+
+    createParam(NDTcpReceiverPortString,        asynParamInt32,   &NDTcpReceiverPort);
+    createParam(NDTcpReceiverConnectedString,   asynParamInt32,   &NDTcpReceiverConnected);
+    createParam(NDTcpReceiverPeerString,        asynParamOctet,   &NDTcpReceiverPeer);
+    createParam(NDTcpReceiverCreditsString,     asynParamInt32,   &NDTcpReceiverCredits);
+    createParam(NDTcpReceiverNumReceivedString, asynParamInt32,   &NDTcpReceiverNumReceived);
+    createParam(NDTcpReceiverNumDroppedString,  asynParamInt32,   &NDTcpReceiverNumDropped);
+    createParam(NDTcpReceiverMBytesString,      asynParamFloat64, &NDTcpReceiverMBytes);
+
+    setIntegerParam(NDTcpReceiverConnected, 0);
+    setStringParam(NDTcpReceiverPeer, "");
+    setIntegerParam(NDTcpReceiverCredits, maxCredits_);
+    setIntegerParam(NDTcpReceiverNumReceived, 0);
+    setIntegerParam(NDTcpReceiverNumDropped, 0);
+    setDoubleParam(NDTcpReceiverMBytes, 0.);
+    setIntegerParam(NDArrayCallbacks, 1);
+
+    if (stream_.listen(listenPort) != ND_SUCCESS) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error listening on port %d\n",
+            driverName, functionName, listenPort);
+        return;
+    }
+    setIntegerParam(NDTcpReceiverPort, stream_.listenPort());
+    callParamCallbacks();
+
+    epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Receive", portName);
+    receiveThreadId_ = epicsThreadCreate(taskName,
+                                         epicsThreadPriorityMedium,
+                                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                                         (EPICSTHREADFUNC)receiveTaskC, this);
+    if (receiveThreadId_ == 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating receiveTask thread\n",
+            driverName, functionName);
+    }
+}
+
+/** Configuration command */
+extern "C" int NDTcpReceiverConfigure(const char *portName, int listenPort, int maxCredits,
+                                      int maxBuffers, size_t maxMemory, int priority, int stackSize)
+{
+    new NDTcpReceiver(portName, listenPort, maxCredits, maxBuffers, maxMemory, priority, stackSize);
+    return(asynSuccess);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "listenPort",iocshArgInt};
+static const iocshArg initArg2 = { "maxCredits",iocshArgInt};
+static const iocshArg initArg3 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg4 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg5 = { "priority",iocshArgInt};
+static const iocshArg initArg6 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6};
+static const iocshFuncDef initFuncDef = {"NDTcpReceiverConfigure",7,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDTcpReceiverConfigure(args[0].sval, args[1].ival, args[2].ival,
+                           args[3].ival, args[4].ival, args[5].ival,
+                           args[6].ival);
+}
+
+extern "C" void NDTcpReceiverRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDTcpReceiverRegister);
+}
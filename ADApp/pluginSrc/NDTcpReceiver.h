@@ -0,0 +1,50 @@
+#ifndef NDTcpReceiver_H
+#define NDTcpReceiver_H
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+
+#include "asynNDArrayDriver.h"
+#include "NDTcpStream.h"
+
+#define NDTcpReceiverPortString        "TCP_RECV_PORT"         /* (asynInt32,   r/o) TCP port that the driver listens on */
+#define NDTcpReceiverConnectedString   "TCP_RECV_CONNECTED"    /* (asynInt32,   r/o) A sender is connected */
+#define NDTcpReceiverPeerString        "TCP_RECV_PEER"         /* (asynOctet,   r/o) Address of the sender */
+#define NDTcpReceiverCreditsString     "TCP_RECV_CREDITS"      /* (asynInt32,   r/o) Arrays the sender may have in flight */
+#define NDTcpReceiverNumReceivedString "TCP_RECV_NUM_RECEIVED" /* (asynInt32,   r/w) Number of arrays received */
+#define NDTcpReceiverNumDroppedString  "TCP_RECV_NUM_DROPPED"  /* (asynInt32,   r/w) Number of arrays dropped because
+                                                                *  the NDArrayPool was full */
+#define NDTcpReceiverMBytesString      "TCP_RECV_MBYTES"       /* (asynFloat64, r/o) Total data received in MB */
+
+/** Driver that receives NDArrays from an NDPluginTcpSend plugin in another IOC over TCP, and does callbacks
+  * with them to the plugins of this IOC as if they came from a detector.
+  * The arrays are received directly into buffers from the NDArrayPool of this driver.  The driver grants the sender
+  * maxCredits arrays when it connects, and returns a credit for each array once the callbacks are done with it, so
+  * at most maxCredits arrays are ever in flight. */
+class epicsShareClass NDTcpReceiver : public asynNDArrayDriver {
+public:
+    NDTcpReceiver(const char *portName, int listenPort, int maxCredits,
+                  int maxBuffers, size_t maxMemory, int priority, int stackSize);
+
+    /* These should be private but are called from C so must be public */
+    void receiveTask();
+
+protected:
+    int NDTcpReceiverPort;
+    #define FIRST_NDTCP_RECEIVER_PARAM NDTcpReceiverPort
+    int NDTcpReceiverConnected;
+    int NDTcpReceiverPeer;
+    int NDTcpReceiverCredits;
+    int NDTcpReceiverNumReceived;
+    int NDTcpReceiverNumDropped;
+    int NDTcpReceiverMBytes;
+
+private:
+    void publishArray(NDArray *pArray);
+    NDTcpStream stream_;          /**< The connection; only used by the receive thread */
+    int maxCredits_;              /**< Arrays the sender may have in flight */
+    double bytesReceived_;        /**< Total bytes received */
+    epicsThreadId receiveThreadId_;
+};
+
+#endif
@@ -0,0 +1,462 @@
+/** NDTcpStream.cpp
+ *
+ * A TCP connection that carries NDArrays between IOCs, with credit-based flow control.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+#endif
+
+#include <epicsTypes.h>
+#include <osiSock.h>
+
+#include "NDTcpStream.h"
+
+static const char *driverName = "NDTcpStream";
+
+#ifdef MSG_NOSIGNAL
+#define ND_TCP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define ND_TCP_SEND_FLAGS 0
+#endif
+
+/** Most buffers that sendArray() sends with one call: the header, the attributes and the data */
+#define ND_TCP_MAX_BUFFERS 3
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+NDTcpStream::NDTcpStream()
+  : sock_(INVALID_SOCKET), listenSock_(INVALID_SOCKET)
+{
+  osiSockAttach();
+}
+
+NDTcpStream::~NDTcpStream()
+{
+  close();
+  closeListener();
+  osiSockRelease();
+}
+
+/** Opens the listening socket of the receiver.
+  * \param[in] port The TCP port to listen on; 0 for a port chosen by the system, see listenPort().
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDTcpStream::listen(int port)
+{
+  struct sockaddr_in addr;
+  const char *functionName = "listen";
+
+  closeListener();
+  listenSock_ = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+  if (listenSock_ == INVALID_SOCKET) {
+    printf("%s:%s: ERROR, cannot create socket\n", driverName, functionName);
+    return ND_ERROR;
+  }
+  epicsSocketEnableAddressReuseDuringTimeWaitState(listenSock_);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((unsigned short)port);
+  if ((bind(listenSock_, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (::listen(listenSock_, 1) != 0)) {
+    printf("%s:%s: ERROR, cannot listen on port %d, errno=%d\n",
+           driverName, functionName, port, (int)SOCKERRNO);
+    closeListener();
+    return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Returns the TCP port that the receiver listens on, or -1 if it is not listening */
+int NDTcpStream::listenPort()
+{
+  struct sockaddr_in addr;
+  osiSocklen_t size = sizeof(addr);
+
+  if (listenSock_ == INVALID_SOCKET) return -1;
+  if (getsockname(listenSock_, (struct sockaddr *)&addr, &size) != 0) return -1;
+  return ntohs(addr.sin_port);
+}
+
+/** Waits for a sender to connect to the listening socket, closing any previous connection first.
+  * \param[out] peerName The address of the sender, "host:port".
+  * \param[in] maxChars The size of peerName.
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDTcpStream::accept(char *peerName, size_t maxChars)
+{
+  osiSockAddr addr;
+  osiSocklen_t size = sizeof(addr);
+  int flag = 1;
+
+  close();
+  if (listenSock_ == INVALID_SOCKET) return ND_ERROR;
+  sock_ = epicsSocketAccept(listenSock_, &addr.sa, &size);
+  if (sock_ == INVALID_SOCKET) return ND_ERROR;
+  setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+  if (peerName && maxChars) sockAddrToDottedIP(&addr.sa, peerName, (unsigned)maxChars);
+  return ND_SUCCESS;
+}
+
+/** Connects the sender to a receiver, closing any previous connection first.
+  * \param[in] server The address of the receiver, "host:port".
+  * \return ND_SUCCESS or ND_ERROR. */
+int NDTcpStream::connect(const char *server)
+{
+  struct sockaddr_in addr;
+  int flag = 1;
+  const char *functionName = "connect";
+
+  close();
+  if (aToIPAddr(server, 0, &addr) != 0) {
+    printf("%s:%s: ERROR, invalid address %s\n", driverName, functionName, server);
+    return ND_ERROR;
+  }
+  sock_ = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+  if (sock_ == INVALID_SOCKET) return ND_ERROR;
+  if (::connect(sock_, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close();
+    return ND_ERROR;
+  }
+  setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+  return ND_SUCCESS;
+}
+
+/** Closes the connection */
+void NDTcpStream::close()
+{
+  if (sock_ == INVALID_SOCKET) return;
+  epicsSocketDestroy(sock_);
+  sock_ = INVALID_SOCKET;
+}
+
+/** Closes the listening socket */
+void NDTcpStream::closeListener()
+{
+  if (listenSock_ == INVALID_SOCKET) return;
+  epicsSocketDestroy(listenSock_);
+  listenSock_ = INVALID_SOCKET;
+}
+
+/** Returns true if the connection is open */
+bool NDTcpStream::connected()
+{
+  return sock_ != INVALID_SOCKET;
+}
+
+/** Sends buffers in order, with a single gathering system call where the platform allows it.
+  * The connection is closed if the send fails. */
+int NDTcpStream::sendBuffers(const void **ppData, size_t *pSizes, int numBuffers)
+{
+  int i = 0;
+#ifdef _WIN32
+  int sent;
+
+  for (i=0; i<numBuffers; i++) {
+    const char *pData = (const char *)ppData[i];
+    size_t size = pSizes[i];
+    while (size > 0) {
+      sent = send(sock_, pData, (int)((size > 0x40000000) ? 0x40000000 : size), 0);
+      if (sent <= 0) {
+        close();
+        return ND_ERROR;
+      }
+      pData += sent;
+      size -= sent;
+    }
+  }
+#else
+  struct iovec iov[ND_TCP_MAX_BUFFERS];
+  struct msghdr msg;
+  ssize_t sent;
+  int first = 0;
+
+  for (i=0; i<numBuffers; i++) {
+    iov[i].iov_base = (void *)ppData[i];
+    iov[i].iov_len = pSizes[i];
+  }
+  while (first < numBuffers) {
+    if (iov[first].iov_len == 0) {
+      first++;
+      continue;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov[first];
+    msg.msg_iovlen = numBuffers - first;
+    sent = sendmsg(sock_, &msg, ND_TCP_SEND_FLAGS);
+    if (sent < 0) {
+      if (SOCKERRNO == SOCK_EINTR) continue;
+      close();
+      return ND_ERROR;
+    }
+    /* Skip the buffers that were sent completely, and the part of the next one that was sent */
+    while ((first < numBuffers) && ((size_t)sent >= iov[first].iov_len)) {
+      sent -= iov[first].iov_len;
+      first++;
+    }
+    if (first < numBuffers) {
+      iov[first].iov_base = (char *)iov[first].iov_base + sent;
+      iov[first].iov_len -= sent;
+    }
+  }
+#endif
+  return ND_SUCCESS;
+}
+
+/** Receives exactly size bytes.  The connection is closed if the receive fails or the peer closes it. */
+int NDTcpStream::receiveAll(void *pData, size_t size)
+{
+  char *pOut = (char *)pData;
+  int received;
+
+  while (size > 0) {
+    received = recv(sock_, pOut, (int)((size > 0x40000000) ? 0x40000000 : size), 0);
+    if (received < 0 && SOCKERRNO == SOCK_EINTR) continue;
+    if (received <= 0) {
+      close();
+      return ND_ERROR;
+    }
+    pOut += received;
+    size -= received;
+  }
+  return ND_SUCCESS;
+}
+
+/** Receives and discards size bytes */
+int NDTcpStream::discard(size_t size)
+{
+  char buffer[16384];
+  size_t chunk;
+
+  while (size > 0) {
+    chunk = (size > sizeof(buffer)) ? sizeof(buffer) : size;
+    if (receiveAll(buffer, chunk) != ND_SUCCESS) return ND_ERROR;
+    size -= chunk;
+  }
+  return ND_SUCCESS;
+}
+
+/** Writes the attribute records of an array into attributes_.
+  * Attributes with undefined values or names that are too long are skipped.
+  * \return The number of attributes written. */
+int NDTcpStream::encodeAttributes(NDAttributeList *pAttributeList)
+{
+  NDAttribute *pAttribute = NULL;
+  NDTcpAttribute_t *pRecord;
+  NDAttrDataType_t dataType;
+  size_t valueSize, offset = 0;
+  int numAttributes = 0;
+
+  attributes_.clear();
+  while ((pAttribute = pAttributeList->next(pAttribute)) != NULL) {
+    pAttribute->getValueInfo(&dataType, &valueSize);
+    if ((dataType == NDAttrUndefined) || (strlen(pAttribute->getName()) >= ND_TCP_ATTR_NAME_LEN)) continue;
+    attributes_.resize(offset + sizeof(NDTcpAttribute_t) + roundUp(valueSize, 8), 0);
+    pRecord = (NDTcpAttribute_t *)&attributes_[offset];
+    memset(pRecord->name, 0, sizeof(pRecord->name));
+    strcpy(pRecord->name, pAttribute->getName());
+    pRecord->dataType = dataType;
+    pRecord->valueSize = (epicsInt32)valueSize;
+    pAttribute->getValue(dataType, pRecord + 1, valueSize);
+    offset = attributes_.size();
+    numAttributes++;
+  }
+  return numAttributes;
+}
+
+/** Adds the attributes in the records in attributes_ to an attribute list.
+  * \return ND_SUCCESS, or ND_ERROR if the records are invalid. */
+int NDTcpStream::decodeAttributes(int numAttributes, NDAttributeList *pAttributeList)
+{
+  NDTcpAttribute_t *pRecord;
+  size_t offset = 0, size = attributes_.size();
+  char *pValue;
+  int i;
+
+  for (i=0; i<numAttributes; i++) {
+    if (offset + sizeof(NDTcpAttribute_t) > size) return ND_ERROR;
+    pRecord = (NDTcpAttribute_t *)&attributes_[offset];
+    pValue = (char *)(pRecord + 1);
+    if ((pRecord->valueSize < 0) || (memchr(pRecord->name, 0, ND_TCP_ATTR_NAME_LEN) == NULL) ||
+        (pRecord->dataType < NDAttrInt8) || (pRecord->dataType > NDAttrString) ||
+        (offset + sizeof(NDTcpAttribute_t) + roundUp(pRecord->valueSize, 8) > size)) return ND_ERROR;
+    if ((pRecord->dataType == NDAttrString) &&
+        ((pRecord->valueSize == 0) || (pValue[pRecord->valueSize-1] != 0))) return ND_ERROR;
+    pAttributeList->add(pRecord->name, "", (NDAttrDataType_t)pRecord->dataType, pValue);
+    offset += sizeof(NDTcpAttribute_t) + roundUp(pRecord->valueSize, 8);
+  }
+  return ND_SUCCESS;
+}
+
+/** Sends an array: its header, its attributes and its data, without copying the data.
+  * \param[in] pArray The array; its data must be contiguous.
+  * \param[out] pBytes The number of bytes sent, if not NULL.
+  * \return ND_SUCCESS, or ND_ERROR if the array is not contiguous or the send failed, in which case the
+  *         connection is closed. */
+int NDTcpStream::sendArray(NDArray *pArray, size_t *pBytes)
+{
+  NDTcpArrayHeader_t header;
+  NDArrayInfo_t arrayInfo;
+  const void *pData[ND_TCP_MAX_BUFFERS];
+  size_t sizes[ND_TCP_MAX_BUFFERS];
+  int i;
+
+  if (!connected() || !pArray->isContiguous()) return ND_ERROR;
+  pArray->getInfo(&arrayInfo);
+  memset(&header, 0, sizeof(header));
+  header.magic = ND_TCP_ARRAY_MAGIC;
+  header.version = ND_TCP_VERSION;
+  header.uniqueId = pArray->uniqueId;
+  header.ndims = pArray->ndims;
+  header.dataType = pArray->dataType;
+  header.numAttributes = encodeAttributes(pArray->pAttributeList);
+  header.attributeBytes = (epicsInt32)attributes_.size();
+  header.secPastEpoch = pArray->epicsTS.secPastEpoch;
+  header.nsec = pArray->epicsTS.nsec;
+  header.timeStamp = pArray->timeStamp;
+  header.dataBytes = arrayInfo.totalBytes;
+  for (i=0; i<pArray->ndims; i++) {
+    header.dims[i].size = pArray->dims[i].size;
+    header.dims[i].offset = pArray->dims[i].offset;
+    header.dims[i].binning = pArray->dims[i].binning;
+    header.dims[i].reverse = pArray->dims[i].reverse;
+  }
+  pData[0] = &header;
+  sizes[0] = sizeof(header);
+  pData[1] = attributes_.empty() ? NULL : &attributes_[0];
+  sizes[1] = attributes_.size();
+  pData[2] = pArray->pData;
+  sizes[2] = arrayInfo.totalBytes;
+  if (sendBuffers(pData, sizes, ND_TCP_MAX_BUFFERS) != ND_SUCCESS) return ND_ERROR;
+  if (pBytes) *pBytes = sizes[0] + sizes[1] + sizes[2];
+  return ND_SUCCESS;
+}
+
+/** Receives the credits that the receiver has sent.
+  * \param[in] timeout The time to wait for a credit message in seconds; 0 to only read the messages that have
+  *            already arrived.
+  * \return The number of credits received, 0 if none arrived within the timeout, or -1 if the connection failed,
+  *         in which case it is closed. */
+int NDTcpStream::receiveCredits(double timeout)
+{
+  NDTcpCredit_t credit;
+  struct timeval tv;
+  fd_set readFds;
+  int credits = 0;
+  int status;
+
+  if (!connected()) return -1;
+  while (1) {
+    FD_ZERO(&readFds);
+    FD_SET(sock_, &readFds);
+    tv.tv_sec = (long)timeout;
+    tv.tv_usec = (long)((timeout - tv.tv_sec) * 1e6);
+    status = select((int)sock_ + 1, &readFds, NULL, NULL, &tv);
+    if (status < 0 && SOCKERRNO == SOCK_EINTR) continue;
+    if (status < 0) {
+      close();
+      return -1;
+    }
+    if (status == 0) return credits;
+    if (receiveAll(&credit, sizeof(credit)) != ND_SUCCESS) return -1;
+    if (credit.magic != ND_TCP_CREDIT_MAGIC) {
+      close();
+      return -1;
+    }
+    credits += credit.credits;
+    /* Only wait for the first message */
+    timeout = 0.;
+  }
+}
+
+/** Receives an array and allocates it in an NDArrayPool.  The data is received directly into the array.
+  * \param[in] pPool The pool to allocate the array from.
+  * \param[out] ppArray The array, which the caller must release; NULL if the pool could not allocate it, in which
+  *             case the message is read and discarded.
+  * \param[out] pBytes The number of bytes received, if not NULL.
+  * \return ND_SUCCESS, or ND_ERROR if the connection failed or the message is invalid, in which case the
+  *         connection is closed. */
+int NDTcpStream::receiveArray(NDArrayPool *pPool, NDArray **ppArray, size_t *pBytes)
+{
+  NDTcpArrayHeader_t header;
+  NDArray *pArray;
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  int i;
+  const char *functionName = "receiveArray";
+
+  *ppArray = NULL;
+  if (!connected()) return ND_ERROR;
+  if (receiveAll(&header, sizeof(header)) != ND_SUCCESS) return ND_ERROR;
+  if ((header.magic != ND_TCP_ARRAY_MAGIC) || (header.version != ND_TCP_VERSION) ||
+      (header.ndims < 1) || (header.ndims > ND_ARRAY_MAX_DIMS) ||
+      (header.dataType < NDInt8) || (header.dataType > NDFloat16) ||
+      (header.numAttributes < 0) || (header.attributeBytes < 0) ||
+      (header.attributeBytes > ND_TCP_MAX_ATTRIBUTE_BYTES)) {
+    printf("%s:%s: ERROR, invalid array header, magic=0x%x, version=%u\n",
+           driverName, functionName, header.magic, header.version);
+    close();
+    return ND_ERROR;
+  }
+  for (i=0; i<header.ndims; i++) dims[i] = (size_t)header.dims[i].size;
+  if (header.dataBytes != NDArrayPool::requiredBytes(header.ndims, dims, (NDDataType_t)header.dataType)) {
+    printf("%s:%s: ERROR, dataBytes=%llu does not match the dimensions\n",
+           driverName, functionName, (unsigned long long)header.dataBytes);
+    close();
+    return ND_ERROR;
+  }
+  attributes_.resize(header.attributeBytes);
+  if ((header.attributeBytes > 0) && (receiveAll(&attributes_[0], header.attributeBytes) != ND_SUCCESS)) {
+    return ND_ERROR;
+  }
+  if (pBytes) *pBytes = sizeof(header) + header.attributeBytes + (size_t)header.dataBytes;
+
+  pArray = pPool->alloc(header.ndims, dims, (NDDataType_t)header.dataType, 0, NULL);
+  if (!pArray) return discard((size_t)header.dataBytes);
+  if (receiveAll(pArray->pData, (size_t)header.dataBytes) != ND_SUCCESS) {
+    pArray->release();
+    return ND_ERROR;
+  }
+  pArray->uniqueId = header.uniqueId;
+  pArray->timeStamp = header.timeStamp;
+  pArray->epicsTS.secPastEpoch = header.secPastEpoch;
+  pArray->epicsTS.nsec = header.nsec;
+  for (i=0; i<header.ndims; i++) {
+    pArray->dims[i].offset = (size_t)header.dims[i].offset;
+    pArray->dims[i].binning = header.dims[i].binning;
+    pArray->dims[i].reverse = header.dims[i].reverse;
+  }
+  pArray->pAttributeList->clear();
+  if (decodeAttributes(header.numAttributes, pArray->pAttributeList) != ND_SUCCESS) {
+    printf("%s:%s: ERROR, invalid attributes in array uniqueId=%d\n",
+           driverName, functionName, header.uniqueId);
+    pArray->release();
+    close();
+    return ND_ERROR;
+  }
+  *ppArray = pArray;
+  return ND_SUCCESS;
+}
+
+/** Sends credits to the sender.
+  * \param[in] credits The number of further arrays the receiver can accept.
+  * \return ND_SUCCESS, or ND_ERROR if the send failed, in which case the connection is closed. */
+int NDTcpStream::sendCredits(int credits)
+{
+  NDTcpCredit_t credit;
+  const void *pData = &credit;
+  size_t size = sizeof(credit);
+
+  if (!connected()) return ND_ERROR;
+  credit.magic = ND_TCP_CREDIT_MAGIC;
+  credit.credits = credits;
+  return sendBuffers(&pData, &size, 1);
+}
@@ -0,0 +1,116 @@
+/** NDTcpStream.h
+ *
+ * A TCP connection that carries NDArrays between IOCs, with credit-based flow control.
+ *
+ */
+
+#ifndef NDTcpStream_H
+#define NDTcpStream_H
+
+#include <stddef.h>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <osiSock.h>
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+/** Magic number at the start of each array message, "NDTA" */
+#define ND_TCP_ARRAY_MAGIC  0x4E445441
+/** Magic number at the start of each credit message, "NDTC" */
+#define ND_TCP_CREDIT_MAGIC 0x4E445443
+/** Version of the protocol; the receiver rejects other versions */
+#define ND_TCP_VERSION 1
+/** Maximum length of an attribute name in a message, including the terminating NUL */
+#define ND_TCP_ATTR_NAME_LEN 64
+/** Maximum size of the attribute records of one array, which the receiver accepts */
+#define ND_TCP_MAX_ATTRIBUTE_BYTES (16*1024*1024)
+
+/* The structures below define the messages.  They use fixed size types, laid out without padding, in the byte
+ * order of the sender; a receiver of the other byte order sees the magic number reversed and closes the connection.
+ *
+ * The sender sends an NDTcpArrayHeader_t for each array, followed by numAttributes NDTcpAttribute_t records of
+ * attributeBytes in total, followed by dataBytes of contiguous array data.
+ * The receiver sends an NDTcpCredit_t with the number of arrays it can accept when the connection is made, and a
+ * credit of 1 for each array it has passed on.  The sender only sends an array when it has a credit, so the
+ * arrays in flight never exceed the credits of the receiver.
+ */
+
+/** Dimension of an array in a message, see NDDimension_t */
+typedef struct {
+    epicsUInt64   size;
+    epicsUInt64   offset;
+    epicsInt32    binning;
+    epicsInt32    reverse;
+} NDTcpDimension_t;
+
+/** Header of an array message */
+typedef struct {
+    epicsUInt32   magic;        /**< ND_TCP_ARRAY_MAGIC */
+    epicsUInt32   version;      /**< ND_TCP_VERSION */
+    epicsInt32    uniqueId;     /**< NDArray::uniqueId */
+    epicsInt32    ndims;        /**< NDArray::ndims */
+    epicsInt32    dataType;     /**< NDArray::dataType, an NDDataType_t */
+    epicsInt32    numAttributes;  /**< Number of NDTcpAttribute_t records that follow the header */
+    epicsInt32    attributeBytes; /**< Total size of the attribute records in bytes */
+    epicsUInt32   secPastEpoch; /**< NDArray::epicsTS.secPastEpoch */
+    epicsUInt32   nsec;         /**< NDArray::epicsTS.nsec */
+    epicsUInt32   spare;        /**< 0; aligns the following fields */
+    epicsFloat64  timeStamp;    /**< NDArray::timeStamp */
+    epicsUInt64   dataBytes;    /**< Size of the array data in bytes */
+    NDTcpDimension_t dims[ND_ARRAY_MAX_DIMS]; /**< NDArray::dims */
+} NDTcpArrayHeader_t;
+
+/** Attribute record; the value follows the record and is padded to a multiple of 8 bytes */
+typedef struct {
+    char          name[ND_TCP_ATTR_NAME_LEN]; /**< Name of the attribute */
+    epicsInt32    dataType;     /**< NDAttrDataType_t of the value */
+    epicsInt32    valueSize;    /**< Size of the value in bytes; for NDAttrString this includes the terminating NUL */
+} NDTcpAttribute_t;
+
+/** Credit message */
+typedef struct {
+    epicsUInt32   magic;        /**< ND_TCP_CREDIT_MAGIC */
+    epicsInt32    credits;      /**< Number of further arrays the receiver can accept */
+} NDTcpCredit_t;
+
+/** One end of a TCP connection for NDArrays.
+  * The receiver calls listen() and then accept(), the sender calls connect().  The sender sends arrays with
+  * sendArray() while it has credits from receiveCredits(); the receiver reads them with receiveArray() and returns
+  * credits with sendCredits().
+  * Each end must only be used by one thread at a time.
+  */
+class epicsShareClass NDTcpStream {
+public:
+    NDTcpStream();
+    ~NDTcpStream();
+    int          listen(int port);
+    int          listenPort();
+    int          accept(char *peerName, size_t maxChars);
+    int          connect(const char *server);
+    void         close();
+    void         closeListener();
+    bool         connected();
+
+    /* Methods for the sender */
+    int          sendArray(NDArray *pArray, size_t *pBytes);
+    int          receiveCredits(double timeout);
+
+    /* Methods for the receiver */
+    int          receiveArray(NDArrayPool *pPool, NDArray **ppArray, size_t *pBytes);
+    int          sendCredits(int credits);
+
+private:
+    int          sendBuffers(const void **ppData, size_t *pSizes, int numBuffers);
+    int          receiveAll(void *pData, size_t size);
+    int          discard(size_t size);
+    int          encodeAttributes(NDAttributeList *pAttributeList);
+    int          decodeAttributes(int numAttributes, NDAttributeList *pAttributeList);
+
+    SOCKET       sock_;         /**< The connection; INVALID_SOCKET if not connected */
+    SOCKET       listenSock_;   /**< The listening socket of the receiver; INVALID_SOCKET if not listening */
+    std::vector<char> attributes_; /**< The attribute records of the array being sent or received */
+};
+
+#endif
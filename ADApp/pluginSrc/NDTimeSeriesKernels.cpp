@@ -0,0 +1,208 @@
+/** NDTimeSeriesKernels.cpp
+ *
+ * Averaging transposes for NDPluginTimeSeries.  The inputs of a tile of ND_TIME_SERIES_TILE time points are summed
+ * row by row into a tile of sums, in which the signals of a point are contiguous, and the averages are then written
+ * signal by signal, so both the input and the output are accessed in contiguous runs.  The sums of a row are added
+ * 4 at a time with AVX2, in the same order as the scalar loop, so the result does not depend on the instruction set.
+ * Without averaging the input is only copied, and NDTransformTranspose() does it.
+ *
+ */
+
+#include <string.h>
+
+#include <epicsTypes.h>
+
+#include <NDConvertKernels.h>
+#include <NDTransformKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDTimeSeriesKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Adds a row of n elements to n sums */
+typedef void (*addRowFunc)(const void *pIn, double *pSums, size_t n);
+
+template <typename epicsType>
+static void addRowScalar(const void *pInVoid, double *pSums, size_t n)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  size_t i;
+
+  for (i=0; i<n; i++) pSums[i] += (double)pIn[i];
+}
+
+#if defined(ND_SIMD_X86)
+
+/* Loads 4 elements as doubles */
+ND_TARGET("avx2") static inline __m256d load4(const epicsInt8 *p)
+{
+  int bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(bytes)));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsUInt8 *p)
+{
+  int bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsInt16 *p)
+{
+  return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsUInt16 *p)
+{
+  return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsInt32 *p)
+{
+  return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)p));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsFloat32 *p)
+{
+  return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+ND_TARGET("avx2") static inline __m256d load4(const epicsFloat64 *p)
+{
+  return _mm256_loadu_pd(p);
+}
+
+template <typename epicsType>
+ND_TARGET("avx2") static void addRowAVX2(const void *pInVoid, double *pSums, size_t n)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  size_t i;
+
+  for (i=0; i+4<=n; i+=4) {
+    _mm256_storeu_pd(pSums + i, _mm256_add_pd(_mm256_loadu_pd(pSums + i), load4(pIn + i)));
+  }
+  for (; i<n; i++) pSums[i] += (double)pIn[i];
+}
+
+#endif
+
+/* UInt32 has no conversion to double in AVX2, so it is always summed by the scalar loop */
+template <typename epicsType>
+static addRowFunc selectAddRow(epicsType *)
+{
+#if defined(ND_SIMD_X86)
+  if (NDSimdLevel() >= NDSimdAVX2) return addRowAVX2<epicsType>;
+#endif
+  return addRowScalar<epicsType>;
+}
+
+static addRowFunc selectAddRow(epicsUInt32 *)
+{
+  return addRowScalar<epicsUInt32>;
+}
+
+template <typename epicsType>
+static int accumulateT(const void *pInVoid, size_t inRowStride, size_t numSignals, size_t numRows, double *pSums)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  addRowFunc addRow = selectAddRow((epicsType *)0);
+  size_t row;
+
+  for (row=0; row<numRows; row++) addRow(pIn + row*inRowStride, pSums, numSignals);
+  return ND_SUCCESS;
+}
+
+template <typename epicsType>
+static int averageT(const void *pInVoid, size_t inRowStride, size_t numSignals, size_t numAverage,
+                    size_t numPoints, void *pOutVoid, size_t outRowStride)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  epicsType *pOut = (epicsType *)pOutVoid;
+  addRowFunc addRow = selectAddRow((epicsType *)0);
+  double sums[ND_TIME_SERIES_TILE*ND_TIME_SERIES_TILE];
+  size_t S0, P0, s, p, row;
+
+  for (S0=0; S0<numSignals; S0+=ND_TIME_SERIES_TILE) {
+    size_t nS = (numSignals - S0 > ND_TIME_SERIES_TILE) ? ND_TIME_SERIES_TILE : numSignals - S0;
+    for (P0=0; P0<numPoints; P0+=ND_TIME_SERIES_TILE) {
+      size_t nP = (numPoints - P0 > ND_TIME_SERIES_TILE) ? ND_TIME_SERIES_TILE : numPoints - P0;
+      for (p=0; p<nP; p++) {
+        const epicsType *pRow = pIn + (P0 + p)*numAverage*inRowStride + S0;
+        double *pSums = sums + p*ND_TIME_SERIES_TILE;
+        for (s=0; s<nS; s++) pSums[s] = 0.;
+        for (row=0; row<numAverage; row++) addRow(pRow + row*inRowStride, pSums, nS);
+      }
+      for (s=0; s<nS; s++) {
+        epicsType *pSignal = pOut + (S0 + s)*outRowStride + P0;
+        for (p=0; p<nP; p++) pSignal[p] = (epicsType)(sums[p*ND_TIME_SERIES_TILE + s] / numAverage);
+      }
+    }
+  }
+  return ND_SUCCESS;
+}
+
+int NDTimeSeriesAccumulate(NDDataType_t dataType, const void *pIn, size_t inRowStride,
+                           size_t numSignals, size_t numRows, double *pSums)
+{
+  switch (dataType) {
+    case NDInt8:    return accumulateT<epicsInt8>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDUInt8:   return accumulateT<epicsUInt8>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDInt16:   return accumulateT<epicsInt16>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDUInt16:  return accumulateT<epicsUInt16>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDInt32:   return accumulateT<epicsInt32>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDUInt32:  return accumulateT<epicsUInt32>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDFloat32: return accumulateT<epicsFloat32>(pIn, inRowStride, numSignals, numRows, pSums);
+    case NDFloat64: return accumulateT<epicsFloat64>(pIn, inRowStride, numSignals, numRows, pSums);
+    default: return ND_ERROR;
+  }
+}
+
+int NDTimeSeriesAverage(NDDataType_t dataType, const void *pIn, size_t inRowStride,
+                        size_t numSignals, size_t numAverage, size_t numPoints,
+                        void *pOut, size_t outRowStride)
+{
+  size_t elementSize;
+
+  if (numAverage < 1) return ND_ERROR;
+  switch (dataType) {
+    case NDInt8:
+    case NDUInt8:   elementSize = 1; break;
+    case NDInt16:
+    case NDUInt16:  elementSize = 2; break;
+    case NDInt32:
+    case NDUInt32:
+    case NDFloat32: elementSize = 4; break;
+    case NDFloat64: elementSize = 8; break;
+    default: return ND_ERROR;
+  }
+  if (numAverage == 1) {
+    return NDTransformTranspose(elementSize, 1, pIn, inRowStride, pOut, outRowStride, numSignals, numPoints, 0, 0);
+  }
+  switch (dataType) {
+    case NDInt8:    return averageT<epicsInt8>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                               pOut, outRowStride);
+    case NDUInt8:   return averageT<epicsUInt8>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                pOut, outRowStride);
+    case NDInt16:   return averageT<epicsInt16>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                pOut, outRowStride);
+    case NDUInt16:  return averageT<epicsUInt16>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                 pOut, outRowStride);
+    case NDInt32:   return averageT<epicsInt32>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                pOut, outRowStride);
+    case NDUInt32:  return averageT<epicsUInt32>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                 pOut, outRowStride);
+    case NDFloat32: return averageT<epicsFloat32>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                  pOut, outRowStride);
+    case NDFloat64: return averageT<epicsFloat64>(pIn, inRowStride, numSignals, numAverage, numPoints,
+                                                  pOut, outRowStride);
+    default: return ND_ERROR;
+  }
+}
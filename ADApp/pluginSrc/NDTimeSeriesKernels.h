@@ -0,0 +1,39 @@
+/** NDTimeSeriesKernels.h
+ *
+ * Kernels for NDPluginTimeSeries, which receives arrays with one row of signals per time point and stores one row
+ * of time points per signal.  NDTimeSeriesAverage() averages groups of input rows into time points and writes the
+ * time points in tiles of ND_TIME_SERIES_TILE signals by ND_TIME_SERIES_TILE points, so each signal row is written
+ * in contiguous runs instead of one element per input row; without averaging it is the cache-blocked transpose of
+ * NDTransformTranspose().  The rows are summed in double, with the instruction set NDSimdLevel() returns.
+ *
+ */
+
+#ifndef NDTimeSeriesKernels_H
+#define NDTimeSeriesKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+#define ND_TIME_SERIES_TILE 64  /**< The signals and the time points of a tile */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Adds numRows input rows of numSignals elements to the sums of the signals. */
+epicsShareFunc int NDTimeSeriesAccumulate(NDDataType_t dataType, const void *pIn, size_t inRowStride,
+                                          size_t numSignals, size_t numRows, double *pSums);
+/** Writes output row s, column p with the average of column s of input rows p*numAverage to
+  * (p+1)*numAverage-1, converted to the data type.  The row strides are in elements. */
+epicsShareFunc int NDTimeSeriesAverage(NDDataType_t dataType, const void *pIn, size_t inRowStride,
+                                       size_t numSignals, size_t numAverage, size_t numPoints,
+                                       void *pOut, size_t outRowStride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+/** NDTransformKernels.cpp
+ *
+ * Cache-blocked transposes for the Rotate90, Rotate270 and mirrored transposes of NDPluginTransform.
+ * The output is written one tile of ND_TRANSPOSE_TILE x ND_TRANSPOSE_TILE pixels at a time: the tile reads
+ * ND_TRANSPOSE_TILE input rows and writes ND_TRANSPOSE_TILE output rows, which all stay in the L1 cache, so the
+ * strided accesses of the transpose hit the cache instead of each touching a new line.
+ *
+ * In a tile of 16-bit elements, full 8x8 blocks are loaded as 8 vectors, transposed with unpack (SSE2) or
+ * transpose (NEON) instructions and stored as 8 vectors; the reversed axes only change which rows are loaded
+ * and stored.  The rest of the tile, and the other element sizes and the RGB1 pixels, are copied by the scalar
+ * loop.  Both copy the same elements, so the result does not depend on the instruction set.
+ *
+ */
+
+#include <epicsTypes.h>
+
+#include <NDConvertKernels.h>
+
+#define epicsExportSharedSymbols
+#include <shareLib.h>
+#include "NDTransformKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__))
+  #define ND_SIMD_X86
+  #include <immintrin.h>
+  #define ND_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define ND_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+/* The geometry of one transpose */
+typedef struct {
+  size_t inRowStride;
+  size_t outRowStride;
+  size_t xSize;
+  size_t ySize;
+  int reverseX;
+  int reverseY;
+} transposeArgs;
+
+/* Transposes a full 8x8 block of 16-bit elements whose first output row is X0 and first output column is Y0 */
+typedef void (*transposeBlock8)(const transposeArgs *pA, const epicsUInt16 *pIn, epicsUInt16 *pOut,
+                                size_t X0, size_t Y0);
+
+/* Copies output rows X0 to X1-1, columns Y0 to Y1-1 */
+template <typename epicsType, int pixelElements>
+static void transposeScalarT(const transposeArgs *pA, const epicsType *pIn, epicsType *pOut,
+                             size_t X0, size_t X1, size_t Y0, size_t Y1)
+{
+  size_t X, Y;
+  int k;
+
+  for (X=X0; X<X1; X++) {
+    size_t x = pA->reverseX ? pA->xSize - 1 - X : X;
+    const epicsType *pColumn = pIn + x*pixelElements;
+    epicsType *pRow = pOut + X*pA->outRowStride;
+    for (Y=Y0; Y<Y1; Y++) {
+      size_t y = pA->reverseY ? pA->ySize - 1 - Y : Y;
+      for (k=0; k<pixelElements; k++) pRow[Y*pixelElements + k] = pColumn[y*pA->inRowStride + k];
+    }
+  }
+}
+
+#if defined(ND_SIMD_X86)
+
+ND_TARGET("sse2")
+static void transposeUInt16SSE2(const transposeArgs *pA, const epicsUInt16 *pIn, epicsUInt16 *pOut,
+                                size_t X0, size_t Y0)
+{
+  // The 8 input columns, in increasing x, that become output rows X0 to X0+7
+  size_t x0 = pA->reverseX ? pA->xSize - X0 - 8 : X0;
+  __m128i r[8], a[8], b[8], o[8];
+  int i;
+
+  // Vector i holds the input row of output column Y0+i
+  for (i=0; i<8; i++) {
+    size_t y = pA->reverseY ? pA->ySize - 1 - (Y0 + i) : Y0 + i;
+    r[i] = _mm_loadu_si128((const __m128i *)(pIn + y*pA->inRowStride + x0));
+  }
+  for (i=0; i<4; i++) {
+    a[2*i]   = _mm_unpacklo_epi16(r[2*i], r[2*i+1]);
+    a[2*i+1] = _mm_unpackhi_epi16(r[2*i], r[2*i+1]);
+  }
+  b[0] = _mm_unpacklo_epi32(a[0], a[2]);
+  b[1] = _mm_unpackhi_epi32(a[0], a[2]);
+  b[2] = _mm_unpacklo_epi32(a[1], a[3]);
+  b[3] = _mm_unpackhi_epi32(a[1], a[3]);
+  b[4] = _mm_unpacklo_epi32(a[4], a[6]);
+  b[5] = _mm_unpackhi_epi32(a[4], a[6]);
+  b[6] = _mm_unpacklo_epi32(a[5], a[7]);
+  b[7] = _mm_unpackhi_epi32(a[5], a[7]);
+  for (i=0; i<4; i++) {
+    o[2*i]   = _mm_unpacklo_epi64(b[i], b[i+4]);
+    o[2*i+1] = _mm_unpackhi_epi64(b[i], b[i+4]);
+  }
+  // Vector i now holds input column x0+i
+  for (i=0; i<8; i++) {
+    size_t X = pA->reverseX ? X0 + 7 - i : X0 + i;
+    _mm_storeu_si128((__m128i *)(pOut + X*pA->outRowStride + Y0), o[i]);
+  }
+}
+
+#elif defined(ND_SIMD_NEON)
+
+static void transposeUInt16NEON(const transposeArgs *pA, const epicsUInt16 *pIn, epicsUInt16 *pOut,
+                                size_t X0, size_t Y0)
+{
+  size_t x0 = pA->reverseX ? pA->xSize - X0 - 8 : X0;
+  uint16x8_t r[8], o[8];
+  uint16x8x2_t a[4];
+  uint32x4x2_t b[4];
+  int i;
+
+  for (i=0; i<8; i++) {
+    size_t y = pA->reverseY ? pA->ySize - 1 - (Y0 + i) : Y0 + i;
+    r[i] = vld1q_u16(pIn + y*pA->inRowStride + x0);
+  }
+  for (i=0; i<4; i++) a[i] = vtrnq_u16(r[2*i], r[2*i+1]);
+  for (i=0; i<2; i++) {
+    b[2*i]   = vtrnq_u32(vreinterpretq_u32_u16(a[2*i].val[0]), vreinterpretq_u32_u16(a[2*i+1].val[0]));
+    b[2*i+1] = vtrnq_u32(vreinterpretq_u32_u16(a[2*i].val[1]), vreinterpretq_u32_u16(a[2*i+1].val[1]));
+  }
+  // b[0] holds columns 0 and 4, then 2 and 6, of rows 0-3, b[1] columns 1 and 5, then 3 and 7; b[2] and b[3]
+  // hold those of rows 4-7
+  for (i=0; i<2; i++) {
+    uint16x8_t first  = vreinterpretq_u16_u32(b[i].val[0]), firstHigh  = vreinterpretq_u16_u32(b[i+2].val[0]);
+    uint16x8_t second = vreinterpretq_u16_u32(b[i].val[1]), secondHigh = vreinterpretq_u16_u32(b[i+2].val[1]);
+    o[i]   = vcombine_u16(vget_low_u16(first), vget_low_u16(firstHigh));
+    o[i+4] = vcombine_u16(vget_high_u16(first), vget_high_u16(firstHigh));
+    o[i+2] = vcombine_u16(vget_low_u16(second), vget_low_u16(secondHigh));
+    o[i+6] = vcombine_u16(vget_high_u16(second), vget_high_u16(secondHigh));
+  }
+  for (i=0; i<8; i++) {
+    size_t X = pA->reverseX ? X0 + 7 - i : X0 + i;
+    vst1q_u16(pOut + X*pA->outRowStride + Y0, o[i]);
+  }
+}
+
+#endif
+
+template <typename epicsType, int pixelElements>
+static void transposeT(const transposeArgs *pA, const void *pInVoid, void *pOutVoid, transposeBlock8 block)
+{
+  const epicsType *pIn = (const epicsType *)pInVoid;
+  epicsType *pOut = (epicsType *)pOutVoid;
+  size_t XT, YT, X0, Y0;
+
+  for (XT=0; XT<pA->xSize; XT+=ND_TRANSPOSE_TILE) {
+    size_t X1 = (XT + ND_TRANSPOSE_TILE < pA->xSize) ? XT + ND_TRANSPOSE_TILE : pA->xSize;
+    for (YT=0; YT<pA->ySize; YT+=ND_TRANSPOSE_TILE) {
+      size_t Y1 = (YT + ND_TRANSPOSE_TILE < pA->ySize) ? YT + ND_TRANSPOSE_TILE : pA->ySize;
+      if (!block) {
+        transposeScalarT<epicsType, pixelElements>(pA, pIn, pOut, XT, X1, YT, Y1);
+        continue;
+      }
+      // The full 8x8 blocks, then the columns and rows of the tile they leave
+      size_t X8 = XT + (X1 - XT)/8*8, Y8 = YT + (Y1 - YT)/8*8;
+      for (X0=XT; X0<X8; X0+=8)
+        for (Y0=YT; Y0<Y8; Y0+=8)
+          block(pA, (const epicsUInt16 *)pIn, (epicsUInt16 *)pOut, X0, Y0);
+      transposeScalarT<epicsType, pixelElements>(pA, pIn, pOut, XT, X8, Y8, Y1);
+      transposeScalarT<epicsType, pixelElements>(pA, pIn, pOut, X8, X1, YT, Y1);
+    }
+  }
+}
+
+int NDTransformTranspose(size_t elementSize, int pixelElements, const void *pIn, size_t inRowStride,
+                         void *pOut, size_t outRowStride, size_t xSize, size_t ySize,
+                         int reverseX, int reverseY)
+{
+  transposeArgs args;
+  transposeBlock8 block = 0;
+  NDSimdLevel_t level = NDSimdLevel();
+
+  args.inRowStride = inRowStride;
+  args.outRowStride = outRowStride;
+  args.xSize = xSize;
+  args.ySize = ySize;
+  args.reverseX = reverseX;
+  args.reverseY = reverseY;
+
+  if ((elementSize == 2) && (pixelElements == 1)) {
+#if defined(ND_SIMD_X86)
+    if (level >= NDSimdSSE2) block = transposeUInt16SSE2;
+#elif defined(ND_SIMD_NEON)
+    if (level == NDSimdNEON) block = transposeUInt16NEON;
+#endif
+  }
+  (void)level;
+
+  if (pixelElements == 1) {
+    switch (elementSize) {
+      case 1: transposeT<epicsUInt8, 1>(&args, pIn, pOut, 0); break;
+      case 2: transposeT<epicsUInt16, 1>(&args, pIn, pOut, block); break;
+      case 4: transposeT<epicsUInt32, 1>(&args, pIn, pOut, 0); break;
+      case 8: transposeT<epicsUInt64, 1>(&args, pIn, pOut, 0); break;
+      default: return ND_ERROR;
+    }
+  } else if (pixelElements == 3) {
+    switch (elementSize) {
+      case 1: transposeT<epicsUInt8, 3>(&args, pIn, pOut, 0); break;
+      case 2: transposeT<epicsUInt16, 3>(&args, pIn, pOut, 0); break;
+      case 4: transposeT<epicsUInt32, 3>(&args, pIn, pOut, 0); break;
+      case 8: transposeT<epicsUInt64, 3>(&args, pIn, pOut, 0); break;
+      default: return ND_ERROR;
+    }
+  } else {
+    return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
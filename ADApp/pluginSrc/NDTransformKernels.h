@@ -0,0 +1,36 @@
+/** NDTransformKernels.h
+ *
+ * Cache-blocked transposes for the rotations of NDPluginTransform that exchange the X and Y axes.
+ * The image is copied in square tiles whose input and output rows both stay in the L1 cache, so every cache line
+ * that is read or written is used completely instead of once per row of a 2-D loop.  Full 8x8 blocks of 16-bit
+ * elements are transposed in registers with the instruction set NDSimdLevel() returns.
+ *
+ */
+
+#ifndef NDTransformKernels_H
+#define NDTransformKernels_H
+
+#include <stddef.h>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+#define ND_TRANSPOSE_TILE 64    /**< The width and height of a tile, in pixels */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Writes output row X, column Y from input row y, column x, where x is X, or xSize-1-X if reverseX is set,
+  * and y is Y, or ySize-1-Y if reverseY is set.  A pixel is pixelElements contiguous elements of elementSize
+  * bytes, 1 for a plane of an image and 3 for RGB1; the row strides are in elements. */
+epicsShareFunc int NDTransformTranspose(size_t elementSize, int pixelElements, const void *pIn, size_t inRowStride,
+                                        void *pOut, size_t outRowStride, size_t xSize, size_t ySize,
+                                        int reverseX, int reverseY);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,431 @@
+/** NDZarrStore.cpp
+ *
+ * Zarr version 3 stores on a file system.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if defined(_WIN32)
+  #include <direct.h>
+  #define MKDIR(a,b) _mkdir(a)
+#else
+  #include <sys/stat.h>
+  #include <sys/types.h>
+  #define MKDIR(a,b) mkdir(a,b)
+#endif
+
+#include <epicsStdio.h>
+
+#include "NDZarrStore.h"
+
+#ifdef ND_WITH_ZLIB
+  #include <zlib.h>
+#endif
+#ifdef ND_WITH_BLOSC
+  #include <blosc.h>
+#endif
+#ifdef ND_WITH_ZSTD
+  #include <zstd.h>
+#endif
+
+static const char *driverName = "NDZarrStore";
+
+/** The Zarr data types of the NDArray data types */
+static const char *zarrDataTypes[] = {"int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64",
+                                     "float16"};
+
+/** The sizes of the elements of the NDArray data types */
+static const size_t elementSizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 2};
+
+/** The names of the blosc compressors in the blosc codec */
+static const char *bloscCompressors[] = {"blosclz", "lz4", "lz4hc", "snappy", "zlib", "zstd"};
+
+/** The names of the blosc shuffles in the blosc codec */
+static const char *bloscShuffles[] = {"noshuffle", "shuffle", "bitshuffle"};
+
+/** Creates a directory and the directories above it that do not exist */
+static int makeDirectories(const std::string& path)
+{
+  size_t pos = 0;
+  std::string directory;
+
+  while (pos != std::string::npos) {
+    pos = path.find('/', pos + 1);
+    directory = path.substr(0, pos);
+    if (directory.empty()) continue;
+    if ((MKDIR(directory.c_str(), 0777) != 0) && (errno != EEXIST)) return ND_ERROR;
+  }
+  return ND_SUCCESS;
+}
+
+/** Writes a file, creating the directories above it if they do not exist */
+static int writeWholeFile(const std::string& path, const void *pData, size_t nBytes)
+{
+  static const char *functionName = "writeWholeFile";
+  FILE *file;
+  size_t pos;
+  int status = ND_SUCCESS;
+
+  file = fopen(path.c_str(), "wb");
+  if ((file == NULL) && (errno == ENOENT)) {
+    pos = path.rfind('/');
+    if ((pos != std::string::npos) && (pos > 0)) makeDirectories(path.substr(0, pos));
+    file = fopen(path.c_str(), "wb");
+  }
+  if (file == NULL) {
+    printf("%s:%s: ERROR, cannot create %s\n", driverName, functionName, path.c_str());
+    return ND_ERROR;
+  }
+  if ((nBytes > 0) && (fwrite(pData, 1, nBytes, file) != nBytes)) status = ND_ERROR;
+  if (fclose(file) != 0) status = ND_ERROR;
+  if (status) printf("%s:%s: ERROR, cannot write %s\n", driverName, functionName, path.c_str());
+  return status;
+}
+
+/** Appends a list of sizes to JSON text */
+static void jsonSizes(std::string& json, const std::vector<size_t>& sizes)
+{
+  char buffer[32];
+  size_t i;
+
+  json += "[";
+  for (i=0; i<sizes.size(); i++) {
+    epicsSnprintf(buffer, sizeof(buffer), "%s%lu", (i > 0) ? ", " : "", (unsigned long)sizes[i]);
+    json += buffer;
+  }
+  json += "]";
+}
+
+/** Writes the zarr.json metadata of a group.
+  * \param[in] path The directory of the group, which is created if it does not exist.
+  * \param[in] attributes The JSON object of the attributes of the group, "{}" for none.
+  * \return ND_SUCCESS or ND_ERROR.
+  */
+int NDZarrWriteGroup(const std::string& path, const std::string& attributes)
+{
+  std::string json = "{\n  \"zarr_format\": 3,\n  \"node_type\": \"group\",\n  \"attributes\": ";
+
+  json += attributes;
+  json += "\n}\n";
+  return writeWholeFile(path + "/zarr.json", json.c_str(), json.size());
+}
+
+/** Appends a string to JSON text, quoted and escaped */
+void NDZarrJsonString(std::string& json, const std::string& value)
+{
+  char buffer[8];
+  size_t i;
+
+  json += "\"";
+  for (i=0; i<value.size(); i++) {
+    unsigned char c = (unsigned char)value[i];
+    if ((c == '"') || (c == '\\')) {
+      json += '\\';
+      json += (char)c;
+    } else if (c < 0x20) {
+      epicsSnprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      json += buffer;
+    } else {
+      json += (char)c;
+    }
+  }
+  json += "\"";
+}
+
+/** Appends a number to JSON text; NaN and the infinities, which JSON does not have, are null */
+void NDZarrJsonNumber(std::string& json, double value)
+{
+  char buffer[32];
+
+  if (isnan(value) || isinf(value)) {
+    json += "null";
+    return;
+  }
+  epicsSnprintf(buffer, sizeof(buffer), "%.17g", value);
+  json += buffer;
+}
+
+/** Returns a name that can be the name of a node in a store: path separators are replaced with '_', and so is
+  * a leading '.', which would make the node hidden, or a reference to a parent directory */
+std::string NDZarrNodeName(const std::string& name)
+{
+  std::string nodeName = name;
+  size_t i;
+
+  for (i=0; i<nodeName.size(); i++) {
+    if ((nodeName[i] == '/') || (nodeName[i] == '\\')) nodeName[i] = '_';
+  }
+  if (nodeName.empty()) nodeName = "_";
+  if (nodeName[0] == '.') nodeName[0] = '_';
+  return nodeName;
+}
+
+NDZarrArray::NDZarrArray()
+  : dataType_(NDUInt8), elementSize_(1)
+{
+  memset(&compression_, 0, sizeof(compression_));
+}
+
+/** Creates an array and writes its metadata.  The chunks of an existing array in the same directory are not
+  * removed, but those outside the new shape are not part of the new array.
+  * \param[in] path The directory of the array, which is created if it does not exist.
+  * \param[in] dataType The data type of the elements.
+  * \param[in] shape The shape of the array, slowest dimension first.
+  * \param[in] chunkShape The shape of the chunks, with the same number of dimensions as shape.
+  * \param[in] compression The compression of the chunks.
+  * \param[in] attributes The JSON object of the attributes of the array, "{}" for none.
+  * \return ND_SUCCESS, or ND_ERROR if the arguments are not valid, the codec was not built, or the metadata
+  *         cannot be written.
+  */
+int NDZarrArray::create(const std::string& path, NDDataType_t dataType, const std::vector<size_t>& shape,
+                        const std::vector<size_t>& chunkShape, const NDZarrCompression_t& compression,
+                        const std::string& attributes)
+{
+  static const char *functionName = "create";
+  size_t i;
+
+  if ((dataType < NDInt8) || (dataType > NDFloat16) || shape.empty() || (chunkShape.size() != shape.size())) {
+    printf("%s:%s: ERROR, invalid data type or shape for %s\n", driverName, functionName, path.c_str());
+    return ND_ERROR;
+  }
+  for (i=0; i<chunkShape.size(); i++) {
+    if (chunkShape[i] == 0) {
+      printf("%s:%s: ERROR, invalid chunk shape for %s\n", driverName, functionName, path.c_str());
+      return ND_ERROR;
+    }
+  }
+  switch (compression.codec) {
+    case NDZarrCodecNone:
+      break;
+#ifdef ND_WITH_BLOSC
+    case NDZarrCodecBlosc:
+      if ((compression.bloscCompressor < 0) || (compression.bloscCompressor > 5) ||
+          (compression.bloscShuffle < 0) || (compression.bloscShuffle > 2)) {
+        printf("%s:%s: ERROR, invalid blosc compressor or shuffle\n", driverName, functionName);
+        return ND_ERROR;
+      }
+      break;
+#endif
+#ifdef ND_WITH_ZSTD
+    case NDZarrCodecZstd:
+      break;
+#endif
+#ifdef ND_WITH_ZLIB
+    case NDZarrCodecGzip:
+      break;
+#endif
+    default:
+      printf("%s:%s: ERROR, codec %d is not supported by this build\n", driverName, functionName,
+             compression.codec);
+      return ND_ERROR;
+  }
+
+  path_ = path;
+  dataType_ = dataType;
+  elementSize_ = elementSizes[dataType];
+  shape_ = shape;
+  chunkShape_ = chunkShape;
+  compression_ = compression;
+  attributes_ = attributes;
+  return writeMetadata();
+}
+
+/** Sets the shape of the array, for example to the frames that have been written; call writeMetadata() to
+  * write it to the store.  It must have the same number of dimensions as the shape the array was created with.
+  */
+int NDZarrArray::setShape(const std::vector<size_t>& shape)
+{
+  if (shape.size() != shape_.size()) return ND_ERROR;
+  shape_ = shape;
+  return ND_SUCCESS;
+}
+
+/** Writes the zarr.json metadata of the array */
+int NDZarrArray::writeMetadata()
+{
+  std::string json;
+  char buffer[128];
+  const char *endian;
+  epicsUInt16 test = 1;
+
+  endian = (*(epicsUInt8 *)&test == 1) ? "little" : "big";
+  json = "{\n  \"zarr_format\": 3,\n  \"node_type\": \"array\",\n  \"shape\": ";
+  jsonSizes(json, shape_);
+  json += ",\n  \"data_type\": \"";
+  json += zarrDataTypes[dataType_];
+  json += "\",\n  \"chunk_grid\": {\"name\": \"regular\", \"configuration\": {\"chunk_shape\": ";
+  jsonSizes(json, chunkShape_);
+  json += "}},\n  \"chunk_key_encoding\": {\"name\": \"default\", \"configuration\": {\"separator\": \"/\"}},\n";
+  json += "  \"fill_value\": 0,\n  \"codecs\": [\n    {\"name\": \"bytes\", \"configuration\": {\"endian\": \"";
+  json += endian;
+  json += "\"}}";
+  switch (compression_.codec) {
+    case NDZarrCodecBlosc:
+      epicsSnprintf(buffer, sizeof(buffer),
+                    ",\n    {\"name\": \"blosc\", \"configuration\": {\"cname\": \"%s\", \"clevel\": %d, "
+                    "\"shuffle\": \"%s\", ", bloscCompressors[compression_.bloscCompressor], compression_.level,
+                    bloscShuffles[compression_.bloscShuffle]);
+      json += buffer;
+      epicsSnprintf(buffer, sizeof(buffer), "\"typesize\": %d, \"blocksize\": 0}}", (int)elementSize_);
+      json += buffer;
+      break;
+    case NDZarrCodecZstd:
+      epicsSnprintf(buffer, sizeof(buffer),
+                    ",\n    {\"name\": \"zstd\", \"configuration\": {\"level\": %d, \"checksum\": false}}",
+                    compression_.level);
+      json += buffer;
+      break;
+    case NDZarrCodecGzip:
+      epicsSnprintf(buffer, sizeof(buffer), ",\n    {\"name\": \"gzip\", \"configuration\": {\"level\": %d}}",
+                    compression_.level);
+      json += buffer;
+      break;
+    default:
+      break;
+  }
+  json += "\n  ],\n  \"attributes\": ";
+  json += attributes_;
+  json += "\n}\n";
+  return writeWholeFile(path_ + "/zarr.json", json.c_str(), json.size());
+}
+
+/** Returns the uncompressed size of a chunk in bytes */
+size_t NDZarrArray::chunkBytes()
+{
+  size_t bytes = elementSize_;
+  size_t i;
+
+  for (i=0; i<chunkShape_.size(); i++) bytes *= chunkShape_[i];
+  return bytes;
+}
+
+/** Returns the size of an element in bytes */
+size_t NDZarrArray::elementSize()
+{
+  return elementSize_;
+}
+
+/** Returns the largest size of a compressed chunk, which is the size of the buffer of writeChunk() */
+size_t NDZarrArray::compressBound()
+{
+  size_t bytes = chunkBytes();
+
+  switch (compression_.codec) {
+#ifdef ND_WITH_BLOSC
+    case NDZarrCodecBlosc:
+      return bytes + BLOSC_MAX_OVERHEAD;
+#endif
+#ifdef ND_WITH_ZSTD
+    case NDZarrCodecZstd:
+      return ZSTD_compressBound(bytes);
+#endif
+#ifdef ND_WITH_ZLIB
+    case NDZarrCodecGzip:
+      /* The gzip header and trailer are 12 bytes longer than those of the zlib format */
+      return ::compressBound((uLong)bytes) + 32;
+#endif
+    default:
+      return bytes;
+  }
+}
+
+/** Returns the shape of the array */
+const std::vector<size_t>& NDZarrArray::shape()
+{
+  return shape_;
+}
+
+/** Returns the shape of the chunks */
+const std::vector<size_t>& NDZarrArray::chunkShape()
+{
+  return chunkShape_;
+}
+
+/** Compresses a chunk into buffer with the codec of the array */
+int NDZarrArray::compress(const void *pData, std::vector<char>& buffer, size_t *pBytes)
+{
+  size_t bytes = chunkBytes();
+
+  if (buffer.size() < compressBound()) buffer.resize(compressBound());
+  *pBytes = 0;
+  switch (compression_.codec) {
+#ifdef ND_WITH_BLOSC
+    case NDZarrCodecBlosc: {
+      int typesize = (int)elementSize_;
+      int nBytes;
+      if (typesize > BLOSC_MAX_TYPESIZE) typesize = 1;
+      nBytes = blosc_compress_ctx(compression_.level, compression_.bloscShuffle, typesize, bytes, pData,
+                                  &buffer[0], buffer.size(), bloscCompressors[compression_.bloscCompressor], 0, 1);
+      if (nBytes <= 0) return ND_ERROR;
+      *pBytes = nBytes;
+      return ND_SUCCESS;
+    }
+#endif
+#ifdef ND_WITH_ZSTD
+    case NDZarrCodecZstd: {
+      size_t nBytes = ZSTD_compress(&buffer[0], buffer.size(), pData, bytes, compression_.level);
+      if (ZSTD_isError(nBytes)) return ND_ERROR;
+      *pBytes = nBytes;
+      return ND_SUCCESS;
+    }
+#endif
+#ifdef ND_WITH_ZLIB
+    case NDZarrCodecGzip: {
+      z_stream stream;
+      int status;
+      memset(&stream, 0, sizeof(stream));
+      /* 16 more window bits selects the gzip format rather than the zlib format */
+      if (deflateInit2(&stream, compression_.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return ND_ERROR;
+      }
+      stream.next_in = (Bytef *)pData;
+      stream.avail_in = (uInt)bytes;
+      stream.next_out = (Bytef *)&buffer[0];
+      stream.avail_out = (uInt)buffer.size();
+      status = deflate(&stream, Z_FINISH);
+      *pBytes = stream.total_out;
+      deflateEnd(&stream);
+      return (status == Z_STREAM_END) ? ND_SUCCESS : ND_ERROR;
+    }
+#endif
+    default:
+      memcpy(&buffer[0], pData, bytes);
+      *pBytes = bytes;
+      return ND_SUCCESS;
+  }
+}
+
+/** Compresses a chunk and writes it to its file.  Different chunks can be written from different threads at
+  * the same time.
+  * \param[in] chunkIndex The index of the chunk in the chunk grid, slowest dimension first.
+  * \param[in] pData The chunkBytes() of the chunk, in C order.  The parts of edge chunks that are outside the
+  *            array are written too, and should be 0.
+  * \param[in,out] buffer The buffer that the chunk is compressed into, which is enlarged if it is smaller than
+  *            compressBound().  Each thread needs its own buffer.
+  * \return ND_SUCCESS or ND_ERROR.
+  */
+int NDZarrArray::writeChunk(const std::vector<size_t>& chunkIndex, const void *pData, std::vector<char>& buffer)
+{
+  static const char *functionName = "writeChunk";
+  std::string chunkPath = path_ + "/c";
+  char index[32];
+  size_t nBytes = 0;
+  size_t i;
+
+  if (chunkIndex.size() != chunkShape_.size()) return ND_ERROR;
+  for (i=0; i<chunkIndex.size(); i++) {
+    epicsSnprintf(index, sizeof(index), "/%lu", (unsigned long)chunkIndex[i]);
+    chunkPath += index;
+  }
+  if (compression_.codec == NDZarrCodecNone) return writeWholeFile(chunkPath, pData, chunkBytes());
+  if (compress(pData, buffer, &nBytes) != ND_SUCCESS) {
+    printf("%s:%s: ERROR, cannot compress chunk %s\n", driverName, functionName, chunkPath.c_str());
+    return ND_ERROR;
+  }
+  return writeWholeFile(chunkPath, &buffer[0], nBytes);
+}
@@ -0,0 +1,72 @@
+/** NDZarrStore.h
+ *
+ * Zarr version 3 stores on a file system: the zarr.json metadata of groups and arrays, and the chunk files of
+ * arrays, encoded with the bytes codec and compressed with the blosc, zstd or gzip codec.
+ *
+ */
+
+#ifndef NDZarrStore_H
+#define NDZarrStore_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include <shareLib.h>
+
+#include "NDAttribute.h"
+
+/** The compression codecs of the chunks */
+typedef enum {
+  NDZarrCodecNone,   /**< The chunks are stored as they are */
+  NDZarrCodecBlosc,  /**< blosc, when ADCore is built with WITH_BLOSC */
+  NDZarrCodecZstd,   /**< zstd, when ADCore is built with WITH_ZSTD */
+  NDZarrCodecGzip    /**< gzip, when ADCore is built with WITH_ZLIB */
+} NDZarrCodec_t;
+
+/** The compression of the chunks of an array */
+typedef struct {
+  NDZarrCodec_t codec;
+  int level;              /**< The compression level of the codec */
+  int bloscCompressor;    /**< The blosc compressor: 0=blosclz, 1=lz4, 2=lz4hc, 3=snappy, 4=zlib, 5=zstd */
+  int bloscShuffle;       /**< The blosc shuffle: 0=none, 1=byte, 2=bit */
+} NDZarrCompression_t;
+
+epicsShareFunc int NDZarrWriteGroup(const std::string& path, const std::string& attributes);
+epicsShareFunc void NDZarrJsonString(std::string& json, const std::string& value);
+epicsShareFunc void NDZarrJsonNumber(std::string& json, double value);
+epicsShareFunc std::string NDZarrNodeName(const std::string& name);
+
+/** An array in a Zarr store.
+  * The shape and chunk shape are in C order, slowest dimension first, and the chunks use the default chunk key
+  * encoding with "/" separators, so chunk (i, j, k) of the array in directory "a" is the file a/c/i/j/k.
+  * writeChunk() can be called from many threads at once for different chunks.
+  */
+class epicsShareClass NDZarrArray {
+public:
+  NDZarrArray();
+  int          create(const std::string& path, NDDataType_t dataType, const std::vector<size_t>& shape,
+                      const std::vector<size_t>& chunkShape, const NDZarrCompression_t& compression,
+                      const std::string& attributes);
+  int          setShape(const std::vector<size_t>& shape);
+  int          writeMetadata();
+  int          writeChunk(const std::vector<size_t>& chunkIndex, const void *pData, std::vector<char>& buffer);
+  size_t       chunkBytes();
+  size_t       elementSize();
+  size_t       compressBound();
+  const std::vector<size_t>& shape();
+  const std::vector<size_t>& chunkShape();
+
+private:
+  int          compress(const void *pData, std::vector<char>& buffer, size_t *pBytes);
+
+  std::string  path_;
+  NDDataType_t dataType_;
+  size_t       elementSize_;
+  std::vector<size_t> shape_;
+  std::vector<size_t> chunkShape_;
+  NDZarrCompression_t compression_;
+  std::string  attributes_;
+};
+
+#endif
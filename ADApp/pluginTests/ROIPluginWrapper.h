@@ -23,7 +23,8 @@ public:
                    size_t maxMemory,
                    int priority,
                    int stackSize,
-                   int maxThreads);
+                   int maxThreads,
+                   int maxROIs=1);
   virtual ~ROIPluginWrapper ();
 };
 
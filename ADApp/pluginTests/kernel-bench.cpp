@@ -0,0 +1,526 @@
+/** kernel-bench.cpp
+ *
+ *  Microbenchmarks of the kernels that dominate the time spent on each array.
+ *
+ *  Each kernel is run on synthetic frames of each size and data type until the minimum time has passed, and
+ *  the time per iteration is printed as one JSON object per line, so that runs can be compared across releases
+ *  and before and after changes to the kernels.
+ *
+ *  The kernels of NDArrayPool and NDAttributeList, and the statistics and centroid kernels of NDPluginStats,
+ *  are called directly.  The transform, color conversion and FFT kernels are private to their plugins, so they
+ *  are measured through processCallbacks() of a plugin that has array callbacks disabled; this includes the
+ *  small cost of beginProcessCallbacks() and endProcessCallbacks().
+ *
+ *  Usage: kernel-bench [-s sizes] [-t dataTypes] [-k kernels] [-m minTime]
+ *  sizes is a comma separated list of frame sizes N, each measured on N x N frames, default 1024,2048,4096.
+ *  dataTypes is a comma separated list of Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64,
+ *  default all.
+ *  kernels is a comma separated list of poolAlloc, convert, attributeCopy, attributeFind, statistics,
+ *  centroid, transform, colorConvert, fft1D and fft2D, default all.
+ *  minTime is the minimum time in seconds that each measurement runs, default 0.2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTime.h>
+
+#include <asynNDArrayDriver.h>
+#include <NDPluginDriver.h>
+#include <NDPluginStats.h>
+#include <NDPluginTransform.h>
+#include <NDPluginColorConvert.h>
+#include <NDPluginFFT.h>
+
+#include "testingutilities.h"
+#include "AsynPortClientContainer.h"
+
+#define NUM_DATA_TYPES 8
+static const char *dataTypeNames[NUM_DATA_TYPES] = {"Int8", "UInt8", "Int16", "UInt16",
+                                                    "Int32", "UInt32", "Float32", "Float64"};
+static const char *transformNames[] = {"None", "Rot90", "Rot180", "Rot270",
+                                       "Mirror", "Rot90Mirror", "Rot180Mirror", "Rot270Mirror"};
+
+#define NUM_ATTRIBUTES 100
+#define POOL_CALLS 100
+
+/** One kernel; run() is called once per iteration */
+class BenchKernel {
+public:
+  virtual ~BenchKernel() {}
+  virtual void run() = 0;
+};
+
+static double minTime = 0.2;
+
+/** Runs a kernel until minTime has passed and prints the result.
+  * bytes is the amount of input data that one iteration processes, for the throughput. */
+static void measure(BenchKernel& kernel, const char *name, const std::string& variant,
+                    size_t sizeX, size_t sizeY, NDDataType_t dataType, double bytes)
+{
+  epicsTimeStamp tStart, t0, t1;
+  double elapsed = 0., best = 0., dt;
+  int iterations = 0;
+
+  // One untimed iteration, so that buffers and free lists have been allocated
+  kernel.run();
+  epicsTimeGetCurrent(&tStart);
+  do {
+    epicsTimeGetCurrent(&t0);
+    kernel.run();
+    epicsTimeGetCurrent(&t1);
+    dt = epicsTimeDiffInSeconds(&t1, &t0);
+    if ((iterations == 0) || (dt < best)) best = dt;
+    iterations++;
+    elapsed = epicsTimeDiffInSeconds(&t1, &tStart);
+  } while (elapsed < minTime);
+
+  printf("{\"kernel\": \"%s\", \"variant\": \"%s\", \"dataType\": \"%s\", \"sizeX\": %d, \"sizeY\": %d, "
+         "\"iterations\": %d, \"meanSeconds\": %.9f, \"minSeconds\": %.9f, \"megabytesPerSecond\": %.3f}\n",
+         name, variant.c_str(), dataTypeNames[dataType], (int)sizeX, (int)sizeY, iterations,
+         elapsed / iterations, best, (best > 0.) ? bytes / best / 1e6 : 0.);
+  fflush(stdout);
+}
+
+/** Fills an array with a pattern that is not constant, so that the kernels cannot take shortcuts */
+template <typename epicsType>
+static void fillPatternT(NDArray *pArray)
+{
+  NDArrayInfo_t arrayInfo;
+  epicsType *pData = (epicsType *)pArray->pData;
+  size_t i;
+
+  pArray->getInfo(&arrayInfo);
+  for (i=0; i<arrayInfo.nElements; i++) {
+    pData[i] = (epicsType)((i * 7 + i / 1024) % 100);
+  }
+}
+
+static NDArray *allocPattern(NDArrayPool *pPool, int ndims, size_t *dims, NDDataType_t dataType)
+{
+  NDArray *pArray = pPool->alloc(ndims, dims, dataType, 0, NULL);
+
+  if (!pArray) {
+    fprintf(stderr, "kernel-bench: cannot allocate array\n");
+    exit(1);
+  }
+  switch (dataType) {
+    case NDInt8:    fillPatternT<epicsInt8>(pArray);    break;
+    case NDUInt8:   fillPatternT<epicsUInt8>(pArray);   break;
+    case NDInt16:   fillPatternT<epicsInt16>(pArray);   break;
+    case NDUInt16:  fillPatternT<epicsUInt16>(pArray);  break;
+    case NDInt32:   fillPatternT<epicsInt32>(pArray);   break;
+    case NDUInt32:  fillPatternT<epicsUInt32>(pArray);  break;
+    case NDFloat32: fillPatternT<epicsFloat32>(pArray); break;
+    case NDFloat64: fillPatternT<epicsFloat64>(pArray); break;
+    default: break;
+  }
+  return pArray;
+}
+
+static double arrayBytes(NDArray *pArray)
+{
+  NDArrayInfo_t arrayInfo;
+
+  pArray->getInfo(&arrayInfo);
+  return (double)arrayInfo.totalBytes;
+}
+
+/** Allocates and releases an array whose buffer is on the free list of the pool */
+class PoolAllocKernel : public BenchKernel {
+public:
+  PoolAllocKernel(NDArrayPool *pPool, size_t *dims, NDDataType_t dataType)
+    : pPool_(pPool), dims_(dims), dataType_(dataType) {}
+  void run()
+  {
+    for (int i=0; i<POOL_CALLS; i++) {
+      NDArray *pArray = pPool_->alloc(2, dims_, dataType_, 0, NULL);
+      if (pArray) pArray->release();
+    }
+  }
+private:
+  NDArrayPool *pPool_;
+  size_t *dims_;
+  NDDataType_t dataType_;
+};
+
+class ConvertKernel : public BenchKernel {
+public:
+  ConvertKernel(NDArrayPool *pPool, NDArray *pIn, NDDataType_t dataTypeOut, int binning)
+    : pPool_(pPool), pIn_(pIn), dataTypeOut_(dataTypeOut)
+  {
+    for (int i=0; i<pIn->ndims; i++) {
+      pIn->initDimension(&outDims_[i], pIn->dims[i].size);
+      outDims_[i].binning = binning;
+    }
+  }
+  void run()
+  {
+    NDArray *pOut = NULL;
+    pPool_->convert(pIn_, &pOut, dataTypeOut_, outDims_);
+    if (pOut) pOut->release();
+  }
+private:
+  NDArrayPool *pPool_;
+  NDArray *pIn_;
+  NDDataType_t dataTypeOut_;
+  NDDimension_t outDims_[ND_ARRAY_MAX_DIMS];
+};
+
+class AttributeCopyKernel : public BenchKernel {
+public:
+  AttributeCopyKernel(NDAttributeList *pList) : pList_(pList) {}
+  void run()
+  {
+    pList_->copy(&copy_);
+  }
+private:
+  NDAttributeList *pList_;
+  NDAttributeList copy_;
+};
+
+class AttributeFindKernel : public BenchKernel {
+public:
+  AttributeFindKernel(NDAttributeList *pList, const std::vector<std::string>& names)
+    : pList_(pList), names_(names), found_(0) {}
+  void run()
+  {
+    for (size_t i=0; i<names_.size(); i++) {
+      if (pList_->find(names_[i].c_str())) found_++;
+    }
+  }
+private:
+  NDAttributeList *pList_;
+  const std::vector<std::string>& names_;
+  size_t found_;
+};
+
+/** Calls doComputeStatisticsT() or doComputeCentroidT() of NDPluginStats directly */
+template <typename epicsType>
+class StatsKernel : public BenchKernel {
+public:
+  StatsKernel(NDPluginStats *pStats, NDArray *pArray, bool centroid)
+    : pPlugin_(pStats), pArray_(pArray), centroid_(centroid)
+  {
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.profileSizeX = pArray->dims[0].size;
+    stats_.profileSizeY = pArray->dims[1].size;
+    stats_.centroidThreshold = 1.;
+    for (int i=0; i<MAX_PROFILE_TYPES; i++) {
+      stats_.profileX[i] = (double *)calloc(stats_.profileSizeX, sizeof(double));
+      stats_.profileY[i] = (double *)calloc(stats_.profileSizeY, sizeof(double));
+    }
+  }
+  ~StatsKernel()
+  {
+    for (int i=0; i<MAX_PROFILE_TYPES; i++) {
+      free(stats_.profileX[i]);
+      free(stats_.profileY[i]);
+    }
+  }
+  void run()
+  {
+    if (centroid_) {
+      // The centroid accumulates into the profiles, as NDPluginStats::doComputeProfiles() does
+      for (int i=0; i<MAX_PROFILE_TYPES; i++) {
+        memset(stats_.profileX[i], 0, stats_.profileSizeX * sizeof(double));
+        memset(stats_.profileY[i], 0, stats_.profileSizeY * sizeof(double));
+      }
+      pPlugin_->doComputeCentroidT<epicsType>(pArray_, &stats_);
+    } else {
+      pPlugin_->doComputeStatisticsT<epicsType>(pArray_, &stats_);
+    }
+  }
+private:
+  NDPluginStats *pPlugin_;
+  NDArray *pArray_;
+  bool centroid_;
+  NDStats_t stats_;
+};
+
+static BenchKernel *createStatsKernel(NDPluginStats *pStats, NDArray *pArray, bool centroid)
+{
+  switch (pArray->dataType) {
+    case NDInt8:    return new StatsKernel<epicsInt8>(pStats, pArray, centroid);
+    case NDUInt8:   return new StatsKernel<epicsUInt8>(pStats, pArray, centroid);
+    case NDInt16:   return new StatsKernel<epicsInt16>(pStats, pArray, centroid);
+    case NDUInt16:  return new StatsKernel<epicsUInt16>(pStats, pArray, centroid);
+    case NDInt32:   return new StatsKernel<epicsInt32>(pStats, pArray, centroid);
+    case NDUInt32:  return new StatsKernel<epicsUInt32>(pStats, pArray, centroid);
+    case NDFloat32: return new StatsKernel<epicsFloat32>(pStats, pArray, centroid);
+    case NDFloat64: return new StatsKernel<epicsFloat64>(pStats, pArray, centroid);
+    default: return NULL;
+  }
+}
+
+/** A plugin with one input queue entry, blocking callbacks and one thread, whose processCallbacks()
+  * can be called from the benchmark; it is protected in plugins that do not override it */
+template <class PluginType>
+class BenchPlugin : public PluginType {
+public:
+  BenchPlugin(const char *portName, const char *NDArrayPort)
+    : PluginType(portName, 1, 1, NDArrayPort, 0, 0, 0, 0, 0, 1) {}
+  void process(NDArray *pArray)
+  {
+    // The lock is held as it is when NDPluginDriver calls processCallbacks()
+    this->lock();
+    this->processCallbacks(pArray);
+    this->unlock();
+  }
+};
+
+template <class PluginType>
+class PluginKernel : public BenchKernel {
+public:
+  PluginKernel(BenchPlugin<PluginType> *pPlugin, NDArray *pArray) : pPlugin_(pPlugin), pArray_(pArray) {}
+  void run()
+  {
+    pPlugin_->process(pArray_);
+  }
+private:
+  BenchPlugin<PluginType> *pPlugin_;
+  NDArray *pArray_;
+};
+
+static void splitList(const std::string& list, std::vector<std::string>& items)
+{
+  size_t start = 0;
+
+  items.clear();
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) end = list.size();
+    if (end > start) items.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+static bool contains(const std::vector<std::string>& items, const char *item)
+{
+  for (size_t i=0; i<items.size(); i++) {
+    if (items[i] == item) return true;
+  }
+  return false;
+}
+
+static void usage()
+{
+  printf("Usage: kernel-bench [-s sizes] [-t dataTypes] [-k kernels] [-m minTime]\n"
+         "  sizes: comma separated frame sizes N for N x N frames, default 1024,2048,4096\n"
+         "  dataTypes: comma separated list of Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64\n"
+         "  kernels: comma separated list of poolAlloc, convert, attributeCopy, attributeFind, statistics,\n"
+         "           centroid, transform, colorConvert, fft1D, fft2D\n"
+         "  minTime: minimum time of each measurement in seconds, default 0.2\n");
+}
+
+static AsynPortClientContainer *createClient(NDPluginDriver *pPlugin, const std::string& port)
+{
+  AsynPortClientContainer *pClient;
+
+  pPlugin->start();
+  pClient = new AsynPortClientContainer(port);
+  // The output arrays are released by endProcessCallbacks() rather than passed on
+  pClient->write(NDArrayCallbacksString, 0);
+  pClient->write(NDPluginDriverBlockingCallbacksString, 1);
+  pClient->write(NDPluginDriverEnableCallbacksString, 1);
+  return pClient;
+}
+
+int main(int argc, char **argv)
+{
+  std::string sizeList = "1024,2048,4096", typeList, kernelList;
+  std::vector<std::string> items, kernels;
+  std::vector<size_t> sizes;
+  std::vector<NDDataType_t> dataTypes;
+  int i, j;
+
+  for (i=1; i<argc; i++) {
+    std::string opt = argv[i];
+    if ((opt == "-h") || (i+1 >= argc)) {
+      usage();
+      return (opt == "-h") ? 0 : 1;
+    }
+    const char *val = argv[++i];
+    if      (opt == "-s") sizeList = val;
+    else if (opt == "-t") typeList = val;
+    else if (opt == "-k") kernelList = val;
+    else if (opt == "-m") minTime = atof(val);
+    else {
+      usage();
+      return 1;
+    }
+  }
+  splitList(sizeList, items);
+  for (i=0; i<(int)items.size(); i++) {
+    if (atoi(items[i].c_str()) > 0) sizes.push_back(atoi(items[i].c_str()));
+  }
+  splitList(typeList, items);
+  for (i=0; i<NUM_DATA_TYPES; i++) {
+    if (items.empty() || contains(items, dataTypeNames[i])) dataTypes.push_back((NDDataType_t)i);
+  }
+  for (i=0; i<(int)items.size(); i++) {
+    for (j=0; j<NUM_DATA_TYPES; j++) {
+      if (items[i] == dataTypeNames[j]) break;
+    }
+    if (j == NUM_DATA_TYPES) {
+      fprintf(stderr, "kernel-bench: unknown data type %s\n", items[i].c_str());
+      return 1;
+    }
+  }
+  splitList(kernelList, kernels);
+#define RUN_KERNEL(name) (kernels.empty() || contains(kernels, name))
+
+  // The plugins need an upstream port to connect to, but the arrays are passed to them directly
+  std::string sourcePort = "kernelBenchSource";
+  uniqueAsynPortName(sourcePort);
+  new asynNDArrayDriver(sourcePort.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 1, 0, 0);
+  const char *source = sourcePort.c_str();
+
+  std::string statsPort = "kernelBenchStats";
+  uniqueAsynPortName(statsPort);
+  NDPluginStats *pStats = new NDPluginStats(statsPort.c_str(), 1, 1, source, 0, 0, 0, 0, 0, 1);
+
+  std::string transformPort = "kernelBenchTransform";
+  uniqueAsynPortName(transformPort);
+  BenchPlugin<NDPluginTransform> *pTransform = new BenchPlugin<NDPluginTransform>(transformPort.c_str(), source);
+  AsynPortClientContainer *pTransformClient = createClient(pTransform, transformPort);
+
+  std::string colorPort = "kernelBenchColor";
+  uniqueAsynPortName(colorPort);
+  BenchPlugin<NDPluginColorConvert> *pColor = new BenchPlugin<NDPluginColorConvert>(colorPort.c_str(), source);
+  AsynPortClientContainer *pColorClient = createClient(pColor, colorPort);
+
+  std::string fftPort = "kernelBenchFFT";
+  uniqueAsynPortName(fftPort);
+  BenchPlugin<NDPluginFFT> *pFFT = new BenchPlugin<NDPluginFFT>(fftPort.c_str(), source);
+  AsynPortClientContainer *pFFTClient = createClient(pFFT, fftPort);
+  pFFTClient->write(FFTDirectionString, 0);
+  pFFTClient->write(FFTNumAverageString, 1);
+
+  NDArrayPool *pPool = new NDArrayPool(0, 0);
+
+  // Attribute lists do not depend on the frame size
+  NDAttributeList attributes;
+  std::vector<std::string> attributeNames;
+  for (i=0; i<NUM_ATTRIBUTES; i++) {
+    char name[32];
+    epicsInt32 intValue = i;
+    double doubleValue = i * 0.5;
+    sprintf(name, "Attribute%d", i);
+    attributeNames.push_back(name);
+    switch (i % 3) {
+      case 0: attributes.add(name, "Integer attribute", NDAttrInt32, &intValue); break;
+      case 1: attributes.add(name, "Double attribute", NDAttrFloat64, &doubleValue); break;
+      default: attributes.add(name, "String attribute", NDAttrString, (void *)"A string value"); break;
+    }
+  }
+  if (RUN_KERNEL("attributeCopy")) {
+    AttributeCopyKernel kernel(&attributes);
+    measure(kernel, "attributeCopy", "100", 0, 0, NDInt8, 0.);
+  }
+  if (RUN_KERNEL("attributeFind")) {
+    AttributeFindKernel kernel(&attributes, attributeNames);
+    measure(kernel, "attributeFind", "100", 0, 0, NDInt8, 0.);
+  }
+
+  for (size_t s=0; s<sizes.size(); s++) {
+    size_t sizeX = sizes[s], sizeY = sizes[s];
+    size_t dims[3];
+
+    for (size_t t=0; t<dataTypes.size(); t++) {
+      NDDataType_t dataType = dataTypes[t];
+      dims[0] = sizeX;
+      dims[1] = sizeY;
+      NDArray *pArray = allocPattern(pPool, 2, dims, dataType);
+      double bytes = arrayBytes(pArray);
+
+      if (RUN_KERNEL("poolAlloc")) {
+        PoolAllocKernel kernel(pPool, dims, dataType);
+        measure(kernel, "poolAlloc", "100 calls", sizeX, sizeY, dataType, 0.);
+      }
+
+      if (RUN_KERNEL("convert")) {
+        for (int binning=1; binning<=2; binning++) {
+          for (i=0; i<NUM_DATA_TYPES; i++) {
+            char variant[32];
+            ConvertKernel kernel(pPool, pArray, (NDDataType_t)i, binning);
+            sprintf(variant, "%s,bin%d", dataTypeNames[i], binning);
+            measure(kernel, "convert", variant, sizeX, sizeY, dataType, bytes);
+          }
+        }
+      }
+
+      if (RUN_KERNEL("statistics")) {
+        BenchKernel *pKernel = createStatsKernel(pStats, pArray, false);
+        measure(*pKernel, "statistics", "", sizeX, sizeY, dataType, bytes);
+        delete pKernel;
+      }
+      if (RUN_KERNEL("centroid")) {
+        BenchKernel *pKernel = createStatsKernel(pStats, pArray, true);
+        measure(*pKernel, "centroid", "", sizeX, sizeY, dataType, bytes);
+        delete pKernel;
+      }
+
+      if (RUN_KERNEL("transform")) {
+        // Type 0 is no transform, which passes the input array on
+        for (i=1; i<(int)(sizeof(transformNames)/sizeof(transformNames[0])); i++) {
+          pTransformClient->write(NDPluginTransformTypeString, i);
+          PluginKernel<NDPluginTransform> kernel(pTransform, pArray);
+          measure(kernel, "transform", transformNames[i], sizeX, sizeY, dataType, bytes);
+        }
+      }
+
+      if (RUN_KERNEL("colorConvert")) {
+        int colorMode = NDColorModeMono;
+        pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        pColorClient->write(NDPluginColorConvertColorModeOutString, NDColorModeRGB1);
+        PluginKernel<NDPluginColorConvert> monoKernel(pColor, pArray);
+        measure(monoKernel, "colorConvert", "Mono-RGB1", sizeX, sizeY, dataType, bytes);
+        colorMode = NDColorModeBayer;
+        pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        PluginKernel<NDPluginColorConvert> bayerKernel(pColor, pArray);
+        measure(bayerKernel, "colorConvert", "Bayer-RGB1", sizeX, sizeY, dataType, bytes);
+        pArray->pAttributeList->remove("ColorMode");
+
+        // RGB1 input has the color as the first dimension
+        dims[0] = 3;
+        dims[1] = sizeX;
+        dims[2] = sizeY;
+        NDArray *pRGB = allocPattern(pPool, 3, dims, dataType);
+        colorMode = NDColorModeRGB1;
+        pRGB->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        pColorClient->write(NDPluginColorConvertColorModeOutString, NDColorModeRGB3);
+        PluginKernel<NDPluginColorConvert> rgbKernel(pColor, pRGB);
+        measure(rgbKernel, "colorConvert", "RGB1-RGB3", sizeX, sizeY, dataType, arrayBytes(pRGB));
+        pRGB->release();
+        dims[0] = sizeX;
+        dims[1] = sizeY;
+      }
+
+      if (RUN_KERNEL("fft1D")) {
+        // A 1-D signal with as many points as the frame
+        size_t nPoints = sizeX * sizeY;
+        NDArray *pSignal = allocPattern(pPool, 1, &nPoints, dataType);
+        PluginKernel<NDPluginFFT> kernel(pFFT, pSignal);
+        measure(kernel, "fft1D", "", sizeX, sizeY, dataType, arrayBytes(pSignal));
+        pSignal->release();
+      }
+      if (RUN_KERNEL("fft2D")) {
+        PluginKernel<NDPluginFFT> kernel(pFFT, pArray);
+        measure(kernel, "fft2D", "", sizeX, sizeY, dataType, bytes);
+      }
+
+      pArray->release();
+    }
+  }
+
+  // The plugins are not deleted; the asyn ports they created cannot be removed
+  delete pTransformClient;
+  delete pColorClient;
+  delete pFFTClient;
+  return 0;
+}
@@ -0,0 +1,308 @@
+/** plugin-bench.cpp
+ *
+ *  Throughput and latency benchmark for chains of plugins.
+ *
+ *  A source driver sends synthetic NDArrays through a chain of plugins, each connected to the one
+ *  before it, at a fixed rate or as fast as possible.  A sink connected to the last plugin counts the
+ *  arrays and measures the time from when each was sent.  The results are printed as one JSON object,
+ *  so that runs can be compared across releases.
+ *
+ *  Usage: plugin-bench [-n numArrays] [-x sizeX] [-y sizeY] [-t dataType] [-r rate]
+ *                      [-c chain] [-b blocking] [-q queueSize] [-j numThreads] [-w timeout] [-s sink]
+ *  chain is a comma separated list of ROI, Stats, Process and Transform, e.g. "ROI,Stats".
+ *  sink is Client, an asyn client of the last plugin, or Null, an NDFileNull plugin, which also
+ *  reports the uniqueIds that were missing or out of order.
+ *  dataType is one of Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64.
+ *  rate is in arrays per second, 0 sends as fast as possible.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+
+#include <asynNDArrayDriver.h>
+#include <NDPluginDriver.h>
+#include <NDPluginROI.h>
+#include <NDPluginStats.h>
+#include <NDPluginProcess.h>
+#include <NDPluginTransform.h>
+#include <NDFileNull.h>
+#include <NDLatencyHistogram.h>
+
+#include "testingutilities.h"
+#include "AsynPortClientContainer.h"
+
+static const char *dataTypeNames[] = {"Int8", "UInt8", "Int16", "UInt16", "Int32", "UInt32", "Float32", "Float64"};
+
+// The driver at the start of the chain; send() does the NDArray callbacks like a detector driver.
+class BenchSource : public asynNDArrayDriver {
+public:
+  BenchSource(const char *portName)
+    : asynNDArrayDriver(portName, 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 1, 0, 0) {}
+  void send(NDArray *pArray)
+  {
+    lock();
+    doCallbacksGenericPointer(pArray, NDArrayData, 0);
+    unlock();
+  }
+};
+
+// Counts the arrays from the last plugin and the time from when the source sent them.
+class BenchSink : public asynGenericPointerClient {
+public:
+  BenchSink(const char *portName)
+    : asynGenericPointerClient(portName, 0, NDArrayDataString), numReceived(0)
+  {
+    mutex = epicsMutexMustCreate();
+    latency.setWindow(0);
+    registerInterruptUser(callbackC);
+  }
+  ~BenchSink()
+  {
+    epicsMutexDestroy(mutex);
+  }
+  int received()
+  {
+    int n;
+    epicsMutexLock(mutex);
+    n = numReceived;
+    epicsMutexUnlock(mutex);
+    return n;
+  }
+  epicsMutexId mutex;
+  int numReceived;
+  NDLatencyHistogram latency;
+
+private:
+  static void callbackC(void *drvPvt, asynUser *pasynUser, void *ptr)
+  {
+    BenchSink *pSink = (BenchSink *)drvPvt;
+    NDArray *pArray = (NDArray *)ptr;
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    epicsMutexLock(pSink->mutex);
+    pSink->latency.add(epicsTimeDiffInSeconds(&now, &pArray->epicsTS));
+    pSink->numReceived++;
+    epicsMutexUnlock(pSink->mutex);
+  }
+};
+
+static void usage()
+{
+  printf("Usage: plugin-bench [-n numArrays] [-x sizeX] [-y sizeY] [-t dataType] [-r rate]\n"
+         "                    [-c chain] [-b blocking] [-q queueSize] [-j numThreads] [-w timeout] [-s sink]\n"
+         "  chain: comma separated list of ROI, Stats, Process, Transform\n"
+         "  sink: Client or Null\n"
+         "  dataType: Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64\n"
+         "  rate: arrays per second, 0=as fast as possible\n");
+}
+
+static NDPluginDriver *createPlugin(const std::string& type, const std::string& port, const std::string& upstream,
+                                    int queueSize, int blocking, int numThreads)
+{
+  const char *p = port.c_str();
+  const char *u = upstream.c_str();
+
+  if (type == "ROI")       return new NDPluginROI(p, queueSize, blocking, u, 0, 0, 0, 0, 0, numThreads);
+  if (type == "Stats")     return new NDPluginStats(p, queueSize, blocking, u, 0, 0, 0, 0, 0, numThreads);
+  if (type == "Process")   return new NDPluginProcess(p, queueSize, blocking, u, 0, 0, 0, 0, 0);
+  if (type == "Transform") return new NDPluginTransform(p, queueSize, blocking, u, 0, 0, 0, 0, 0, numThreads);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int numArrays = 1000;
+  size_t sizeX = 1024, sizeY = 1024;
+  std::string typeName = "UInt16";
+  double rate = 0.;
+  std::string chainSpec = "Stats";
+  int blocking = 0;
+  int queueSize = 20;
+  int numThreads = 1;
+  double timeout = 10.;
+  std::string sinkType = "Client";
+  NDDataType_t dataType = NDUInt16;
+  std::vector<std::string> types, ports;
+  std::vector<NDPluginDriver*> plugins;
+  std::vector<AsynPortClientContainer*> clients;
+  int i;
+
+  for (i=1; i<argc; i++) {
+    std::string opt = argv[i];
+    if ((opt == "-h") || (i+1 >= argc)) {
+      usage();
+      return (opt == "-h") ? 0 : 1;
+    }
+    const char *val = argv[++i];
+    if      (opt == "-n") numArrays = atoi(val);
+    else if (opt == "-x") sizeX = atoi(val);
+    else if (opt == "-y") sizeY = atoi(val);
+    else if (opt == "-t") typeName = val;
+    else if (opt == "-r") rate = atof(val);
+    else if (opt == "-c") chainSpec = val;
+    else if (opt == "-b") blocking = atoi(val);
+    else if (opt == "-q") queueSize = atoi(val);
+    else if (opt == "-j") numThreads = atoi(val);
+    else if (opt == "-w") timeout = atof(val);
+    else if (opt == "-s") sinkType = val;
+    else {
+      usage();
+      return 1;
+    }
+  }
+  for (i=0; i<(int)(sizeof(dataTypeNames)/sizeof(dataTypeNames[0])); i++) {
+    if (typeName == dataTypeNames[i]) break;
+  }
+  if (i == (int)(sizeof(dataTypeNames)/sizeof(dataTypeNames[0]))) {
+    fprintf(stderr, "plugin-bench: unknown data type %s\n", typeName.c_str());
+    return 1;
+  }
+  dataType = (NDDataType_t)i;
+
+  // Build the chain
+  std::string sourcePort = "benchSource";
+  uniqueAsynPortName(sourcePort);
+  BenchSource *pSource = new BenchSource(sourcePort.c_str());
+  std::string upstream = sourcePort;
+  size_t start = 0;
+  while (start <= chainSpec.size()) {
+    size_t end = chainSpec.find(',', start);
+    if (end == std::string::npos) end = chainSpec.size();
+    std::string type = chainSpec.substr(start, end - start);
+    start = end + 1;
+    if (type.empty()) continue;
+    std::string port = "bench" + type;
+    uniqueAsynPortName(port);
+    NDPluginDriver *pPlugin = createPlugin(type, port, upstream, queueSize, blocking, numThreads);
+    if (!pPlugin) {
+      fprintf(stderr, "plugin-bench: unknown plugin %s\n", type.c_str());
+      return 1;
+    }
+    pPlugin->start();
+    AsynPortClientContainer *pClient = new AsynPortClientContainer(port);
+    pClient->write(NDArrayCallbacksString, 1);
+    if (type == "ROI") {
+      pClient->write(NDPluginROIDim0AutoSizeString, 1);
+      pClient->write(NDPluginROIDim1AutoSizeString, 1);
+    } else if (type == "Stats") {
+      pClient->write(NDPluginStatsComputeStatisticsString, 1);
+    } else if (type == "Transform") {
+      pClient->write(NDPluginTransformTypeString, 1);
+    }
+    pClient->write(NDPluginDriverEnableCallbacksString, 1);
+    types.push_back(type);
+    ports.push_back(port);
+    plugins.push_back(pPlugin);
+    clients.push_back(pClient);
+    upstream = port;
+  }
+  if (plugins.empty()) {
+    fprintf(stderr, "plugin-bench: the chain is empty\n");
+    return 1;
+  }
+  if ((sinkType != "Client") && (sinkType != "Null")) {
+    fprintf(stderr, "plugin-bench: unknown sink %s\n", sinkType.c_str());
+    return 1;
+  }
+  BenchSink *pSink = new BenchSink(upstream.c_str());
+  AsynPortClientContainer *pNullClient = NULL;
+  if (sinkType == "Null") {
+    std::string port = "benchNull";
+    uniqueAsynPortName(port);
+    NDFileNull *pNull = new NDFileNull(port.c_str(), queueSize, blocking, upstream.c_str(), 0, 0, 0);
+    pNull->start();
+    pNullClient = new AsynPortClientContainer(port);
+    pNullClient->write(NDPluginDriverLatencyWindowString, 0);
+    pNullClient->write(NDPluginDriverEnableCallbacksString, 1);
+  }
+
+  // Fill the free list of the pool, so the arrays that are sent reuse initialized buffers
+  NDArrayPool *pPool = new NDArrayPool(0, 0);
+  std::vector<size_t> dims;
+  std::vector<NDArray*> prefill(queueSize * (int)plugins.size() + 4);
+  dims.push_back(sizeX);
+  dims.push_back(sizeY);
+  fillNDArraysFromPool(dims, dataType, prefill, pPool);
+  for (i=0; i<(int)prefill.size(); i++) prefill[i]->release();
+
+  // Send the arrays
+  epicsTimeStamp tStart, tNow, tEnd;
+  epicsTimeGetCurrent(&tStart);
+  for (i=0; i<numArrays; i++) {
+    if (rate > 0.) {
+      epicsTimeGetCurrent(&tNow);
+      double wait = i / rate - epicsTimeDiffInSeconds(&tNow, &tStart);
+      if (wait > 0.) epicsThreadSleep(wait);
+    }
+    NDArray *pArray = pPool->alloc(2, &dims[0], dataType, 0, NULL);
+    if (!pArray) {
+      fprintf(stderr, "plugin-bench: cannot allocate array %d\n", i);
+      return 1;
+    }
+    pArray->uniqueId = i + 1;
+    epicsTimeGetCurrent(&pArray->epicsTS);
+    pArray->timeStamp = pArray->epicsTS.secPastEpoch + pArray->epicsTS.nsec / 1e9;
+    pSource->send(pArray);
+    pArray->release();
+  }
+
+  // Wait until every array has reached the sink or been dropped
+  int received = 0, dropped = 0;
+  std::vector<int> droppedArrays(plugins.size());
+  while (1) {
+    received = pNullClient ? pNullClient->readInt(NDFileNullNumArraysString) : pSink->received();
+    dropped = 0;
+    for (i=0; i<(int)clients.size(); i++) {
+      droppedArrays[i] = clients[i]->readInt(NDPluginDriverDroppedArraysString) +
+                         clients[i]->readInt(NDPluginDriverExpiredArraysString);
+      dropped += droppedArrays[i];
+    }
+    if (pNullClient) dropped += pNullClient->readInt(NDPluginDriverDroppedArraysString);
+    epicsTimeGetCurrent(&tEnd);
+    if (received + dropped >= numArrays) break;
+    if (epicsTimeDiffInSeconds(&tEnd, &tStart) > timeout) break;
+    epicsThreadSleep(0.001);
+  }
+  double elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+  double arrayBytes = (double)NDArrayPool::requiredBytes(2, &dims[0], dataType);
+
+  printf("{\"chain\": \"%s\", \"sink\": \"%s\", \"blocking\": %d, \"queueSize\": %d, \"numThreads\": %d, "
+         "\"dataType\": \"%s\", \"sizeX\": %d, \"sizeY\": %d, \"rate\": %g, "
+         "\"sent\": %d, \"received\": %d, \"dropped\": [",
+         chainSpec.c_str(), sinkType.c_str(), blocking, queueSize, numThreads, typeName.c_str(),
+         (int)sizeX, (int)sizeY, rate, numArrays, received);
+  for (i=0; i<(int)droppedArrays.size(); i++) {
+    printf("%s{\"plugin\": \"%s\", \"arrays\": %d}", i ? ", " : "", types[i].c_str(), droppedArrays[i]);
+  }
+  printf("], \"complete\": %s, \"elapsed\": %.6f, \"arraysPerSecond\": %.3f, \"megabytesPerSecond\": %.3f, ",
+         (received + dropped >= numArrays) ? "true" : "false", elapsed,
+         received / elapsed, received * arrayBytes / elapsed / 1e6);
+  if (pNullClient) {
+    // The latency of the Null sink is measured from the epicsTS to the end of its processing
+    printf("\"latencyP50ms\": %.3f, \"latencyP99ms\": %.3f, \"latencyMaxms\": %.3f, "
+           "\"missing\": %d, \"outOfOrder\": %d}\n",
+           pNullClient->readDouble(NDPluginDriverLatencyP50String),
+           pNullClient->readDouble(NDPluginDriverLatencyP99String),
+           pNullClient->readDouble(NDPluginDriverLatencyMaxString),
+           pNullClient->readInt(NDFileNullMissingString), pNullClient->readInt(NDFileNullOutOfOrderString));
+  } else {
+    epicsMutexLock(pSink->mutex);
+    printf("\"latencyP50ms\": %.3f, \"latencyP99ms\": %.3f, \"latencyMaxms\": %.3f}\n",
+           pSink->latency.percentile(0.50) * 1e3, pSink->latency.percentile(0.99) * 1e3,
+           pSink->latency.maximum() * 1e3);
+    epicsMutexUnlock(pSink->mutex);
+  }
+
+  // The plugins are not deleted; the asyn ports they created cannot be removed
+  delete pSink;
+  return (received + dropped >= numArrays) ? 0 : 2;
+}
@@ -0,0 +1,1053 @@
+/*
+ * test_NDArrayPool.cpp
+ *
+ *  Tests of the NDArrayPool free lists and buffer allocation.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDConvertKernels.h>
+#include <epicsThread.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <set>
+#include <vector>
+
+/** Owner of wrapped memory that counts how often it is deleted */
+class CountingBufferOwner : public NDArrayBufferOwner {
+public:
+  CountingBufferOwner(int *pDeleted) : pDeleted_(pDeleted) {}
+  ~CountingBufferOwner() { (*pDeleted_)++; }
+private:
+  int *pDeleted_;
+};
+
+/** Memory provider that counts the buffers it has handed out */
+class CountingMemoryProvider : public NDMemoryProvider {
+public:
+  CountingMemoryProvider() : numAllocated(0), bytesAllocated(0) {}
+  void* allocate(size_t size)
+  {
+    numAllocated++;
+    bytesAllocated += size;
+    return malloc(size);
+  }
+  void free(void *pData, size_t size)
+  {
+    numAllocated--;
+    bytesAllocated -= size;
+    ::free(pData);
+  }
+  const char* name() { return "counting"; }
+  int numAllocated;
+  size_t bytesAllocated;
+};
+
+/** Device memory that is host memory, and counts the copies to and from it */
+class CountingDeviceMemory : public NDDeviceMemory {
+public:
+  CountingDeviceMemory() : numToDevice(0), numToHost(0), numCopyDevice(0), numSynchronize(0) {}
+  void* allocate(size_t size) { return malloc(size); }
+  void free(void *pData, size_t size) { ::free(pData); }
+  const char* name() { return "counting device"; }
+  void* createStream() { return this; }
+  void destroyStream(void *stream) {}
+  int toDevice(void *pDevice, const void *pHost, size_t size, void *stream)
+  {
+    numToDevice++;
+    memcpy(pDevice, pHost, size);
+    return ND_SUCCESS;
+  }
+  int toHost(void *pHost, const void *pDevice, size_t size, void *stream)
+  {
+    numToHost++;
+    memcpy(pHost, pDevice, size);
+    return ND_SUCCESS;
+  }
+  int copyDevice(void *pTo, const void *pFrom, size_t size, void *stream)
+  {
+    numCopyDevice++;
+    memcpy(pTo, pFrom, size);
+    return ND_SUCCESS;
+  }
+  int waitStream(void *stream, void *otherStream) { return ND_SUCCESS; }
+  int synchronize(void *stream) { numSynchronize++; return ND_SUCCESS; }
+  int numToDevice, numToHost, numCopyDevice, numSynchronize;
+};
+
+BOOST_AUTO_TEST_SUITE(NDArrayPoolTests)
+
+BOOST_AUTO_TEST_CASE(test_ReuseBySizeClass)
+{
+  NDArrayPool pool(0, 0);
+  size_t small[2] = {64, 64};
+  size_t large[2] = {1024, 1024};
+  NDArray *pSmall, *pLarge;
+
+  pSmall = pool.alloc(2, small, NDUInt16, 0, NULL);
+  pLarge = pool.alloc(2, large, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pSmall);
+  BOOST_REQUIRE(pLarge);
+  pSmall->release();
+  pLarge->release();
+  BOOST_CHECK_EQUAL(pool.numFree(), 2);
+
+  // Alternating sizes must reuse the two buffers without reallocating them
+  for (int i=0; i<10; i++) {
+    NDArray *pA = pool.alloc(2, small, NDUInt16, 0, NULL);
+    NDArray *pB = pool.alloc(2, large, NDUInt16, 0, NULL);
+    BOOST_CHECK(pA == pSmall);
+    BOOST_CHECK(pB == pLarge);
+    pA->release();
+    pB->release();
+  }
+  BOOST_CHECK_EQUAL(pool.numBuffers(), 2);
+  BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)(64*64*2 + 1024*1024*2));
+}
+
+BOOST_AUTO_TEST_CASE(test_ReferenceCount)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {16, 16};
+  NDArray *pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK_EQUAL(pool.numFree(), 0);
+  pArray->reserve();
+  pArray->release();
+  BOOST_CHECK_EQUAL(pool.numFree(), 0);
+  pArray->release();
+  BOOST_CHECK_EQUAL(pool.numFree(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Alignment)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {1000, 3};
+
+  BOOST_CHECK_EQUAL(pool.setAlignment(48), ND_ERROR);
+  BOOST_CHECK_EQUAL(pool.setAlignment(64), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pool.alignment(), (size_t)64);
+  BOOST_CHECK_EQUAL(pool.setAlignment(4096), ND_SUCCESS);
+
+  std::set<NDArray*> arrays;
+  for (int i=0; i<4; i++) {
+    NDArray *pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray);
+    BOOST_CHECK_EQUAL((uintptr_t)pArray->pData % 4096, (uintptr_t)0);
+    arrays.insert(pArray);
+  }
+  for (std::set<NDArray*>::iterator it=arrays.begin(); it!=arrays.end(); ++it) (*it)->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_MemoryProvider)
+{
+  CountingMemoryProvider provider;
+  NDArrayPool pool(0, 0, &provider);
+  size_t dims[2] = {100, 100};
+  size_t largerDims[2] = {200, 200};
+  NDArray *pArray = pool.alloc(2, dims, NDFloat32, 0, NULL);
+
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK_EQUAL(provider.numAllocated, 1);
+  BOOST_CHECK_EQUAL(provider.bytesAllocated, (size_t)(100*100*4));
+  memset(pArray->pData, 0, pArray->dataSize);
+  BOOST_CHECK_EQUAL(pool.setMemoryProvider(NULL), ND_ERROR);
+  pArray->release();
+
+  // The free buffer is too small, so it must be returned to the provider and replaced
+  pArray = pool.alloc(2, largerDims, NDFloat32, 0, NULL);
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK_EQUAL(provider.numAllocated, 1);
+  BOOST_CHECK_EQUAL(provider.bytesAllocated, (size_t)(200*200*4));
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_DeviceMemory)
+{
+  CountingDeviceMemory device;
+  NDArrayPool devicePool(0, 0, &device);
+  NDArrayPool hostPool(0, 0);
+  size_t dims[2] = {8, 6};
+  NDDimension_t viewDims[2];
+  NDArray *pHost, *pDevice, *pCopy, *pView, *pConverted;
+  epicsUInt16 *pData;
+  size_t i, x, y;
+
+  pHost = hostPool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pHost);
+  BOOST_CHECK(pHost->pDevice == NULL);
+  pData = (epicsUInt16 *)pHost->pData;
+  for (i=0; i<8*6; i++) pData[i] = (epicsUInt16)i;
+  pHost->uniqueId = 7;
+
+  // A copy from the pool of the device is in the memory of the device
+  pDevice = devicePool.copy(pHost, NULL, 1);
+  BOOST_REQUIRE(pDevice);
+  BOOST_CHECK(pDevice->pDevice == &device);
+  BOOST_CHECK_EQUAL(pDevice->uniqueId, 7);
+  BOOST_CHECK_EQUAL(device.numToDevice, 1);
+  BOOST_CHECK(device.numSynchronize >= 1);
+
+  // A copy from a host pool is in host memory, and waits for the stream of the device array
+  pCopy = hostPool.copy(pDevice, NULL, 1);
+  BOOST_REQUIRE(pCopy);
+  BOOST_CHECK(pCopy->pDevice == NULL);
+  BOOST_CHECK_EQUAL(device.numToHost, 1);
+  BOOST_CHECK_EQUAL(memcmp(pCopy->pData, pHost->pData, 8*6*sizeof(epicsUInt16)), 0);
+  pCopy->release();
+
+  // Copies on the device
+  pCopy = devicePool.copy(pDevice, NULL, 1);
+  BOOST_REQUIRE(pCopy);
+  BOOST_CHECK(pCopy->pDevice == &device);
+  BOOST_CHECK_EQUAL(device.numCopyDevice, 1);
+  pCopy->release();
+
+  // A view of a device array is on the device, and a strided one is only copied to the host
+  pDevice->initDimension(&viewDims[0], 3);
+  pDevice->initDimension(&viewDims[1], 4);
+  viewDims[0].offset = 2;
+  viewDims[1].offset = 1;
+  pView = hostPool.createView(pDevice, viewDims);
+  BOOST_REQUIRE(pView);
+  BOOST_CHECK(pView->pDevice == &device);
+  BOOST_CHECK(devicePool.copy(pView, NULL, 1) == NULL);
+  pCopy = hostPool.copy(pView, NULL, 1);
+  BOOST_REQUIRE(pCopy);
+  BOOST_CHECK(pCopy->pDevice == NULL);
+  pData = (epicsUInt16 *)pCopy->pData;
+  for (y=0; y<4; y++)
+    for (x=0; x<3; x++) BOOST_CHECK_EQUAL(pData[y*3 + x], (y+1)*8 + x+2);
+  pCopy->release();
+  pView->release();
+
+  // The host cannot convert the data of the device
+  BOOST_CHECK_EQUAL(hostPool.convert(pDevice, &pConverted, NDFloat32), ND_ERROR);
+  pDevice->release();
+  pHost->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_StridedView)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {8, 6};
+  NDDimension_t viewDims[2];
+  NDArray *pParent, *pView, *pContiguous;
+  epicsUInt16 *pData;
+  size_t x, y;
+
+  pParent = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pParent);
+  pData = (epicsUInt16 *)pParent->pData;
+  for (y=0; y<6; y++)
+    for (x=0; x<8; x++) pData[y*8 + x] = (epicsUInt16)(y*100 + x);
+
+  pParent->initDimension(&viewDims[0], 3);
+  pParent->initDimension(&viewDims[1], 4);
+  viewDims[0].offset = 2;
+  viewDims[1].offset = 1;
+  pView = pool.createView(pParent, viewDims);
+  BOOST_REQUIRE(pView);
+  BOOST_CHECK(pView->isView());
+  BOOST_CHECK(!pView->isContiguous());
+  BOOST_CHECK_EQUAL(pView->dims[0].offset, (size_t)2);
+  BOOST_CHECK_EQUAL(*(epicsUInt16 *)pView->pData, 102);
+
+  BOOST_REQUIRE_EQUAL(pool.makeContiguous(pView, &pContiguous), ND_SUCCESS);
+  BOOST_CHECK(pContiguous != pView);
+  BOOST_CHECK(pContiguous->isContiguous());
+  pData = (epicsUInt16 *)pContiguous->pData;
+  for (y=0; y<4; y++)
+    for (x=0; x<3; x++) BOOST_CHECK_EQUAL(pData[y*3 + x], (y+1)*100 + x+2);
+  pContiguous->release();
+
+  // The parent stays in use until both it and the view are released
+  pParent->release();
+  BOOST_CHECK_EQUAL(pool.numFree(), 1);
+  pView->release();
+  BOOST_CHECK_EQUAL(pool.numFree(), 3);
+
+  // A crop of complete rows is contiguous
+  pParent = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  pParent->initDimension(&viewDims[0], 8);
+  pParent->initDimension(&viewDims[1], 2);
+  viewDims[1].offset = 3;
+  pView = pool.createView(pParent, viewDims);
+  BOOST_REQUIRE(pView);
+  BOOST_CHECK(pView->isContiguous());
+  BOOST_REQUIRE_EQUAL(pool.makeContiguous(pView, &pContiguous), ND_SUCCESS);
+  BOOST_CHECK(pContiguous == pView);
+  pContiguous->release();
+  pView->release();
+  pParent->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertKernels)
+{
+  NDArrayPool pool(0, 0);
+  // An odd size so the scalar code handles the elements left over by the vector loops
+  size_t dims[1] = {1003};
+  NDDataType_t pairs[][2] = {{NDUInt16, NDFloat64}, {NDUInt16, NDFloat32},
+                             {NDUInt8,  NDUInt16},  {NDFloat64, NDUInt16},
+                             {NDFloat32, NDFloat16}, {NDFloat16, NDFloat32},
+                             {NDUInt10Packed, NDUInt16}, {NDUInt12Packed, NDUInt16}};
+  NDSimdLevel_t level = NDSimdLevel();
+  NDArrayInfo_t arrayInfo;
+  size_t i;
+
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(level));
+  for (size_t pair=0; pair<sizeof(pairs)/sizeof(pairs[0]); pair++) {
+    NDArray *pIn = pool.alloc(1, dims, pairs[pair][0], 0, NULL);
+    NDArray *pScalar, *pVector;
+    BOOST_REQUIRE(pIn);
+    pIn->getInfo(&arrayInfo);
+    if (NDPackedBits(pIn->dataType)) {
+      for (i=0; i<arrayInfo.totalBytes; i++) ((epicsUInt8 *)pIn->pData)[i] = (epicsUInt8)(i*151);
+    }
+    for (i=0; i<dims[0]; i++) {
+      switch (pIn->dataType) {
+        case NDUInt8:   ((epicsUInt8 *)pIn->pData)[i] = (epicsUInt8)(i*7); break;
+        case NDUInt16:  ((epicsUInt16 *)pIn->pData)[i] = (epicsUInt16)(i*65); break;
+        // Includes negative values and values above 65535 to check the saturation
+        case NDFloat64: ((epicsFloat64 *)pIn->pData)[i] = (i*97.3) - 1000.; break;
+        // Includes values that round, subnormals and values that overflow to infinity
+        case NDFloat32: ((epicsFloat32 *)pIn->pData)[i] = (i*0.37f - 100.f) * ((i % 3) ? 1.f : 1e-5f) * (i/4); break;
+        case NDFloat16: ((NDFloat16_t *)pIn->pData)[i].bits = (epicsUInt16)(i*67); break;
+        default: break;
+      }
+    }
+    NDSimdSetMaxLevel(NDSimdNone);
+    BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pScalar, pairs[pair][1]), ND_SUCCESS);
+    NDSimdSetMaxLevel(level);
+    BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pVector, pairs[pair][1]), ND_SUCCESS);
+    pScalar->getInfo(&arrayInfo);
+    BOOST_CHECK_EQUAL(memcmp(pScalar->pData, pVector->pData, arrayInfo.totalBytes), 0);
+    if (pairs[pair][0] == NDFloat64) {
+      BOOST_CHECK_EQUAL(((epicsUInt16 *)pVector->pData)[0], 0);
+      BOOST_CHECK_EQUAL(((epicsUInt16 *)pVector->pData)[1000], 65535);
+      BOOST_CHECK_EQUAL(((epicsUInt16 *)pVector->pData)[20], (epicsUInt16)(20*97.3 - 1000.));
+    }
+    if (pairs[pair][1] == NDFloat16) {
+      for (i=0; i<dims[0]; i++) {
+        epicsFloat32 value = ((epicsFloat32 *)pIn->pData)[i];
+        epicsFloat32 rounded = ((NDFloat16_t *)pVector->pData)[i];
+        if (fabs(value) < 65504.f) BOOST_CHECK_SMALL(rounded - value, fabs(value) / 2048.f + 3e-8f);
+      }
+    }
+    pIn->release();
+    pScalar->release();
+    pVector->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertFloat16)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {16, 8};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pHalf, *pBinned, *pBack;
+  NDArrayInfo_t arrayInfo;
+  epicsFloat32 *pData;
+  size_t i;
+
+  // Float16 elements are half the size of Float32
+  pIn = pool.alloc(2, dims, NDFloat32, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  BOOST_CHECK_EQUAL(NDArrayPool::requiredBytes(2, dims, NDFloat16), dims[0]*dims[1]*2);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsFloat32 *)pIn->pData;
+  // Multiples of 1/4 below 512 are exact in Float16
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (epicsFloat32)i / 4.f - 8.f;
+
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pHalf, NDFloat16), ND_SUCCESS);
+  pHalf->getInfo(&arrayInfo);
+  BOOST_CHECK_EQUAL(arrayInfo.bytesPerElement, (size_t)2);
+  BOOST_CHECK_EQUAL(arrayInfo.totalBytes, dims[0]*dims[1]*2);
+  BOOST_REQUIRE_EQUAL(pool.convert(pHalf, &pBack, NDFloat32), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(memcmp(pBack->pData, pIn->pData, dims[0]*dims[1]*sizeof(epicsFloat32)), 0);
+  pBack->release();
+
+  // Binning and scaling of Float16 arrays, converted element by element
+  pIn->initDimension(&outDims[0], 16);
+  pIn->initDimension(&outDims[1], 8);
+  outDims[0].binning = 2;
+  outDims[1].binning = 2;
+  BOOST_REQUIRE_EQUAL(pool.convert(pHalf, &pBinned, NDFloat16, outDims, 4.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pBinned->dims[0].size, (size_t)8);
+  BOOST_REQUIRE_EQUAL(pBinned->dims[1].size, (size_t)4);
+  BOOST_CHECK_EQUAL((epicsFloat32)((NDFloat16_t *)pBinned->pData)[0], (pData[0] + pData[1] + pData[16] + pData[17]) / 4.f);
+  BOOST_CHECK_EQUAL((epicsFloat32)((NDFloat16_t *)pBinned->pData)[9], (pData[34] + pData[35] + pData[50] + pData[51]) / 4.f);
+  pBinned->release();
+  BOOST_REQUIRE_EQUAL(pool.convert(pHalf, &pBinned, NDInt32, outDims), ND_SUCCESS);
+  // Each element is converted before it is added, as for the other types
+  BOOST_CHECK_EQUAL(((epicsInt32 *)pBinned->pData)[7], (epicsInt32)pData[14] + (epicsInt32)pData[15] +
+                                                       (epicsInt32)pData[30] + (epicsInt32)pData[31]);
+  pBinned->release();
+
+  // Values that do not fit round to the nearest even, overflow to infinity and underflow to subnormals
+  BOOST_CHECK_EQUAL(NDFloat32ToFloat16(1.f + 1.f/2048.f), 0x3c00);
+  BOOST_CHECK_EQUAL(NDFloat32ToFloat16(1.f + 3.f/2048.f), 0x3c02);
+  BOOST_CHECK_EQUAL(NDFloat32ToFloat16(70000.f), 0x7c00);
+  BOOST_CHECK_EQUAL(NDFloat32ToFloat16(-70000.f), 0xfc00);
+  BOOST_CHECK_EQUAL(NDFloat32ToFloat16(5.9604645e-8f), 0x0001);
+  BOOST_CHECK_EQUAL(NDFloat16ToFloat32(0x0001), 5.9604645e-8f);
+  BOOST_CHECK_EQUAL(NDFloat16ToFloat32(0x7bff), 65504.f);
+  pHalf->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertPacked)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {16, 8};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pPacked, *pBack, *pBinned, *pExpected, *pView;
+  NDArrayInfo_t arrayInfo;
+  epicsUInt16 *pData;
+  epicsUInt8 *pBytes;
+  size_t i;
+
+  // 2 UInt12Packed elements in 3 bytes, 4 UInt10Packed elements in 5 bytes
+  BOOST_CHECK_EQUAL(NDArrayPool::requiredBytes(2, dims, NDUInt12Packed), (size_t)192);
+  BOOST_CHECK_EQUAL(NDArrayPool::requiredBytes(2, dims, NDUInt10Packed), (size_t)160);
+  pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsUInt16 *)pIn->pData;
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (epicsUInt16)((i*293) % 4096);
+
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pPacked, NDUInt12Packed), ND_SUCCESS);
+  pPacked->getInfo(&arrayInfo);
+  BOOST_CHECK_EQUAL(arrayInfo.bitsPerElement, 12);
+  BOOST_CHECK_EQUAL(arrayInfo.totalBytes, (size_t)192);
+  // The elements are stored least significant bit first, as Mono12p
+  pBytes = (epicsUInt8 *)pPacked->pData;
+  BOOST_CHECK_EQUAL(pBytes[3], pData[2] & 0xff);
+  BOOST_CHECK_EQUAL(pBytes[4], (pData[2] >> 8) | ((pData[3] & 0xf) << 4));
+  BOOST_CHECK_EQUAL(pBytes[5], pData[3] >> 4);
+  BOOST_REQUIRE_EQUAL(pool.convert(pPacked, &pBack, NDUInt16), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(memcmp(pBack->pData, pIn->pData, dims[0]*dims[1]*sizeof(epicsUInt16)), 0);
+  pBack->release();
+
+  // Other conversions go through UInt16, also to a packed output
+  pIn->initDimension(&outDims[0], 16);
+  pIn->initDimension(&outDims[1], 8);
+  outDims[0].binning = 2;
+  outDims[1].binning = 2;
+  BOOST_REQUIRE_EQUAL(pool.convert(pPacked, &pBinned, NDFloat32, outDims, 4.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pExpected, NDFloat32, outDims, 4.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pBinned->dims[0].size, (size_t)8);
+  BOOST_CHECK_EQUAL(pBinned->dims[0].binning, 2);
+  BOOST_CHECK_EQUAL(memcmp(pBinned->pData, pExpected->pData, 8*4*sizeof(epicsFloat32)), 0);
+  pBinned->release();
+  pExpected->release();
+  pIn->initDimension(&outDims[0], 6);
+  pIn->initDimension(&outDims[1], 3);
+  outDims[0].offset = 5;
+  outDims[1].offset = 2;
+  BOOST_REQUIRE_EQUAL(pool.convert(pPacked, &pBinned, NDUInt10Packed, outDims), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pBinned->dataType, NDUInt10Packed);
+  BOOST_CHECK_EQUAL(pBinned->dims[0].offset, (size_t)5);
+  BOOST_REQUIRE_EQUAL(pool.convert(pBinned, &pBack, NDUInt16), ND_SUCCESS);
+  // Values above 1023 saturate
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pBack->pData)[0], (pData[37] < 1023) ? pData[37] : 1023);
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pBack->pData)[13], (pData[70] < 1023) ? pData[70] : 1023);
+  pBack->release();
+  pBinned->release();
+
+  // A view of a packed array must be of the whole array
+  pIn->initDimension(&outDims[0], 8);
+  pIn->initDimension(&outDims[1], 8);
+  BOOST_CHECK(pool.createView(pPacked, outDims) == NULL);
+  pIn->initDimension(&outDims[0], 16);
+  pView = pool.createView(pPacked, outDims);
+  BOOST_REQUIRE(pView);
+  BOOST_CHECK(pView->isContiguous());
+  pView->release();
+  pPacked->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Sparse)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {16, 8};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pSparse, *pDense, *pCopy, *pBinned, *pExpected, *pSparseExpected;
+  NDArrayInfo_t arrayInfo;
+  epicsUInt16 *pData;
+  size_t i;
+
+  pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsUInt16 *)pIn->pData;
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (i % 7 == 3) ? (epicsUInt16)(i*11) : 0;
+
+  // The events are the non-zero elements, whose values start at a multiple of 8 bytes
+  BOOST_REQUIRE_EQUAL(pool.makeSparse(pIn, &pSparse), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pSparse->sparse, 1);
+  BOOST_REQUIRE_EQUAL(pSparse->numEvents, (size_t)18);
+  BOOST_CHECK_EQUAL(pSparse->eventIndices()[1], (epicsUInt32)10);
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pSparse->eventValues())[1], 110);
+  BOOST_CHECK_EQUAL((char *)pSparse->eventValues() - (char *)pSparse->pData, 72);
+  BOOST_CHECK_EQUAL(NDSparseBytes(18, 2), (size_t)108);
+  pSparse->getInfo(&arrayInfo);
+  BOOST_CHECK_EQUAL(arrayInfo.totalBytes, (size_t)256);
+
+  // Densifying restores the array, and copies keep the events
+  BOOST_REQUIRE_EQUAL(pool.makeDense(pSparse, &pDense), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pDense->sparse, 0);
+  BOOST_CHECK_EQUAL(memcmp(pDense->pData, pIn->pData, arrayInfo.totalBytes), 0);
+  pDense->release();
+  pCopy = pool.copy(pSparse, NULL, 1);
+  BOOST_REQUIRE(pCopy);
+  BOOST_CHECK_EQUAL(pCopy->numEvents, (size_t)18);
+  BOOST_CHECK_EQUAL(memcmp(pCopy->pData, pSparse->pData, NDSparseBytes(18, 2)), 0);
+  pCopy->release();
+
+  // A region with binning and reversal of a sparse array is the sparse region of the dense array
+  pIn->initDimension(&outDims[0], 12);
+  pIn->initDimension(&outDims[1], 6);
+  outDims[0].offset = 3;
+  outDims[0].binning = 2;
+  outDims[0].reverse = 1;
+  outDims[1].offset = 1;
+  outDims[1].binning = 3;
+  BOOST_REQUIRE_EQUAL(pool.convert(pSparse, &pBinned, NDInt32, outDims, 2.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pExpected, NDInt32, outDims, 2.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.makeSparse(pExpected, &pSparseExpected), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pBinned->sparse, 1);
+  BOOST_CHECK_EQUAL(pBinned->dims[0].size, (size_t)6);
+  BOOST_CHECK_EQUAL(pBinned->dims[0].offset, (size_t)3);
+  BOOST_CHECK_EQUAL(pBinned->dims[1].binning, 3);
+  BOOST_REQUIRE_EQUAL(pBinned->numEvents, pSparseExpected->numEvents);
+  BOOST_CHECK_EQUAL(memcmp(pBinned->pData, pSparseExpected->pData,
+                           NDSparseBytes(pBinned->numEvents, sizeof(epicsInt32))), 0);
+  pSparseExpected->release();
+  pExpected->release();
+  pBinned->release();
+
+  // Sparse arrays have no views
+  pIn->initDimension(&outDims[0], 16);
+  pIn->initDimension(&outDims[1], 8);
+  BOOST_CHECK(pool.createView(pSparse, outDims) == NULL);
+  pSparse->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Stack)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[3] = {4, 3, 5};
+  NDDimension_t outDims[3];
+  NDArray *pStack, *pFrame, *pFrameView, *pCopy, *pConverted, *pView;
+  NDStackFrame_t stackFrame;
+  epicsUInt16 *pData;
+  size_t i;
+
+  pStack = pool.alloc(3, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pStack);
+  pData = (epicsUInt16 *)pStack->pData;
+  for (i=0; i<60; i++) pData[i] = (epicsUInt16)i;
+  for (i=0; i<5; i++) {
+    stackFrame.uniqueId = 100 + (int)i;
+    stackFrame.timeStamp = 0.5 * i;
+    stackFrame.epicsTS.secPastEpoch = (epicsUInt32)i;
+    stackFrame.epicsTS.nsec = 0;
+    pStack->stackFrames.push_back(stackFrame);
+  }
+  pStack->uniqueId = 100;
+
+  // A frame of the stack is a view of its part of the buffer, with the uniqueId and time stamps of the frame
+  pFrame = pool.stackFrame(pStack, 2);
+  BOOST_REQUIRE(pFrame);
+  BOOST_CHECK_EQUAL(pFrame->ndims, 2);
+  BOOST_CHECK_EQUAL(pFrame->dims[1].size, (size_t)3);
+  BOOST_CHECK_EQUAL(pFrame->pData, (void *)(pData + 24));
+  BOOST_CHECK_EQUAL(pFrame->uniqueId, 102);
+  BOOST_CHECK_EQUAL(pFrame->timeStamp, 1.0);
+  BOOST_CHECK(pFrame->stackFrames.empty());
+  BOOST_CHECK_EQUAL(pStack->getReferenceCount(), 2);
+  pFrameView = pool.stackFrame(pStack, 5);
+  BOOST_CHECK(pFrameView == NULL);
+
+  // Copies keep the frames, and a region of the slowest dimension keeps the frames in the region
+  pCopy = pool.copy(pStack, NULL, 1);
+  BOOST_REQUIRE(pCopy);
+  BOOST_CHECK_EQUAL(pCopy->stackFrames.size(), (size_t)5);
+  for (i=0; i<3; i++) pStack->initDimension(&outDims[i], dims[i]);
+  outDims[2].offset = 1;
+  outDims[2].size = 3;
+  outDims[2].reverse = 1;
+  BOOST_REQUIRE_EQUAL(pool.convert(pStack, &pConverted, NDFloat32, outDims), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pConverted->stackFrames.size(), (size_t)3);
+  BOOST_CHECK_EQUAL(pConverted->stackFrames[0].uniqueId, 103);
+  BOOST_CHECK_EQUAL(pConverted->stackFrames[2].uniqueId, 101);
+  pConverted->release();
+  outDims[2].reverse = 0;
+  pView = pool.createView(pStack, outDims);
+  BOOST_REQUIRE(pView);
+  BOOST_REQUIRE_EQUAL(pView->stackFrames.size(), (size_t)3);
+  BOOST_CHECK_EQUAL(pView->stackFrames[0].uniqueId, 101);
+  pFrameView = pool.stackFrame(pView, 1);
+  BOOST_REQUIRE(pFrameView);
+  BOOST_CHECK_EQUAL(pFrameView->uniqueId, 102);
+  BOOST_CHECK_EQUAL(pFrameView->pData, pFrame->pData);
+  pFrameView->release();
+  pView->release();
+
+  // Binning frames together makes an ordinary array
+  outDims[2].offset = 0;
+  outDims[2].size = 4;
+  outDims[2].binning = 2;
+  BOOST_REQUIRE_EQUAL(pool.convert(pStack, &pConverted, NDFloat32, outDims), ND_SUCCESS);
+  BOOST_CHECK(pConverted->stackFrames.empty());
+  pConverted->release();
+
+  // Releasing the frame releases the stack
+  pFrame->release();
+  BOOST_CHECK_EQUAL(pStack->getReferenceCount(), 1);
+  pCopy->release();
+  pStack->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertThreads)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {301, 257};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pSerial, *pThreaded;
+  NDArrayInfo_t arrayInfo;
+  epicsUInt16 *pData;
+  size_t i;
+
+  pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsUInt16 *)pIn->pData;
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (epicsUInt16)(i*13);
+
+  // Bin and reverse a region, with an odd number of output rows
+  pIn->initDimension(&outDims[0], 280);
+  pIn->initDimension(&outDims[1], 250);
+  outDims[0].offset = 7;
+  outDims[0].binning = 2;
+  outDims[1].offset = 3;
+  outDims[1].binning = 2;
+  outDims[1].reverse = 1;
+
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pSerial, NDFloat64, outDims), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.setConvertThreads(3, 0), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pool.convertThreads(), 3);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pThreaded, NDFloat64, outDims), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pThreaded->dims[1].size, (size_t)125);
+  pThreaded->getInfo(&arrayInfo);
+  BOOST_CHECK(memcmp(pSerial->pData, pThreaded->pData, arrayInfo.totalBytes) == 0);
+  pThreaded->release();
+
+  // The threads are not used for arrays below the minimum size, the result must be the same
+  BOOST_REQUIRE_EQUAL(pool.setConvertThreads(3, arrayInfo.totalBytes+1), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pThreaded, NDFloat64, outDims), ND_SUCCESS);
+  BOOST_CHECK(memcmp(pSerial->pData, pThreaded->pData, arrayInfo.totalBytes) == 0);
+  pThreaded->release();
+
+  BOOST_CHECK_EQUAL(pool.setConvertThreads(-1, 0), ND_ERROR);
+  BOOST_CHECK_EQUAL(pool.setConvertThreads(0, 0), ND_SUCCESS);
+  pSerial->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertScaled)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {64, 37};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pScratch, *pReference, *pScaled;
+  NDArrayInfo_t arrayInfo;
+  epicsUInt16 *pData;
+  double *pScratchData;
+  size_t i;
+
+  pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsUInt16 *)pIn->pData;
+  // Large values, so that the sum of a bin does not fit in the output type
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (epicsUInt16)(60000 + (i*7) % 5000);
+
+  // Bin 2x3 and reverse a region, then divide by the number of elements in a bin
+  pIn->initDimension(&outDims[0], 60);
+  pIn->initDimension(&outDims[1], 33);
+  outDims[0].offset = 3;
+  outDims[0].binning = 2;
+  outDims[1].offset = 1;
+  outDims[1].binning = 3;
+  outDims[1].reverse = 1;
+
+  // The reference is the conversion to Float64, the division and the conversion to the output type
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pScratch, NDFloat64, outDims), ND_SUCCESS);
+  pScratch->getInfo(&arrayInfo);
+  pScratchData = (double *)pScratch->pData;
+  for (i=0; i<arrayInfo.nElements; i++) pScratchData[i] /= 6.;
+  BOOST_REQUIRE_EQUAL(pool.convert(pScratch, &pReference, NDUInt16), ND_SUCCESS);
+
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pScaled, NDUInt16, outDims, 6.), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pScaled->dims[0].size, (size_t)30);
+  BOOST_REQUIRE_EQUAL(pScaled->dims[1].size, (size_t)11);
+  BOOST_CHECK_EQUAL(pScaled->dims[0].binning, 2);
+  pScaled->getInfo(&arrayInfo);
+  BOOST_CHECK(memcmp(pReference->pData, pScaled->pData, arrayInfo.totalBytes) == 0);
+  pScaled->release();
+
+  // The worker threads give the same result
+  BOOST_REQUIRE_EQUAL(pool.setConvertThreads(3, 0), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pScaled, NDUInt16, outDims, 6.), ND_SUCCESS);
+  BOOST_CHECK(memcmp(pReference->pData, pScaled->pData, arrayInfo.totalBytes) == 0);
+  pScaled->release();
+  BOOST_REQUIRE_EQUAL(pool.setConvertThreads(0, 0), ND_SUCCESS);
+
+  // Scaling without binning or a region
+  pIn->initDimension(&outDims[0], 64);
+  pIn->initDimension(&outDims[1], 37);
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pScaled, NDFloat32, outDims, 4.), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)pScaled->pData)[5], pData[5] / 4.f);
+  pScaled->release();
+
+  pReference->release();
+  pScratch->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertRowRange)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {50, 100};
+  NDDimension_t outDims[2];
+  NDArray *pIn, *pOut;
+  NDArrayInfo_t arrayInfo;
+  epicsUInt16 *pData;
+  size_t i;
+
+  pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pIn->getInfo(&arrayInfo);
+  pData = (epicsUInt16 *)pIn->pData;
+  for (i=0; i<arrayInfo.nElements; i++) pData[i] = (epicsUInt16)(i*3);
+
+  // A band of 64 whole rows is a contiguous range of the input
+  pIn->initDimension(&outDims[0], 50);
+  pIn->initDimension(&outDims[1], 64);
+  outDims[1].offset = 5;
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pOut, NDUInt16, outDims), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pOut->dims[1].size, (size_t)64);
+  BOOST_CHECK_EQUAL(pOut->dims[1].offset, (size_t)5);
+  pOut->getInfo(&arrayInfo);
+  BOOST_CHECK(memcmp(pOut->pData, pData + 5*50, arrayInfo.totalBytes) == 0);
+  pOut->release();
+
+  // The same band converted to another type
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pOut, NDFloat32, outDims), ND_SUCCESS);
+  pOut->getInfo(&arrayInfo);
+  for (i=0; i<arrayInfo.nElements; i++) {
+    if (((epicsFloat32 *)pOut->pData)[i] != pData[5*50 + i]) break;
+  }
+  BOOST_CHECK_EQUAL(i, arrayInfo.nElements);
+  pOut->release();
+
+  // A region that does not span whole rows still uses the element by element conversion
+  outDims[0].offset = 1;
+  outDims[0].size = 40;
+  BOOST_REQUIRE_EQUAL(pool.convert(pIn, &pOut, NDUInt16, outDims), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pOut->pData)[40], pData[6*50 + 1]);
+  pOut->release();
+  pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_PreAllocate)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {640, 480};
+  NDArray *pArray;
+
+  BOOST_REQUIRE_EQUAL(pool.preAllocate(4, 640*480*2), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pool.numBuffers(), 4);
+  BOOST_CHECK_EQUAL(pool.numFree(), 4);
+
+  // A second call reuses the free buffers
+  BOOST_REQUIRE_EQUAL(pool.preAllocate(4, 640*480*2), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pool.numBuffers(), 4);
+
+  // Frames of that size come from the free list
+  pArray = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK_EQUAL(pool.numBuffers(), 4);
+  BOOST_CHECK_EQUAL(pool.numFree(), 3);
+  pArray->release();
+
+  BOOST_CHECK_EQUAL(pool.preAllocate(1, 0), ND_ERROR);
+
+  // The pool limits still apply
+  NDArrayPool smallPool(2, 0);
+  BOOST_CHECK_EQUAL(smallPool.preAllocate(3, 1024), ND_ERROR);
+  BOOST_CHECK_EQUAL(smallPool.numFree(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_BufferOwner)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[2] = {64, 32};
+  std::vector<epicsUInt16> wrapped(64*32, 7);
+  NDArray *pArray, *pView;
+  NDDimension_t viewDims[2];
+  int deleted = 0;
+
+  pArray = pool.alloc(2, dims, NDUInt16, wrapped.size()*2, &wrapped[0], new CountingBufferOwner(&deleted));
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK(pArray->pData == &wrapped[0]);
+  BOOST_CHECK_EQUAL(pArray->dataSize, wrapped.size()*2);
+  // The wrapped memory is not counted as memory of the pool
+  BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)0);
+
+  // A view keeps the wrapped memory until it is released too
+  pArray->initDimension(&viewDims[0], 32);
+  pArray->initDimension(&viewDims[1], 32);
+  pView = pool.createView(pArray, viewDims);
+  BOOST_REQUIRE(pView);
+  pArray->release();
+  BOOST_CHECK_EQUAL(deleted, 0);
+  pView->release();
+  BOOST_CHECK_EQUAL(deleted, 1);
+
+  // The free array has no buffer, and the next frame gets a buffer of the pool
+  pArray = pool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pArray);
+  BOOST_CHECK(pArray->pData != &wrapped[0]);
+  BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)(64*32*2));
+  pArray->release();
+  BOOST_CHECK_EQUAL(deleted, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Stats)
+{
+  NDArrayPool pool(2, 0);
+  size_t dims[1] = {1000};
+  size_t bigDims[1] = {5000};
+  NDArrayPoolStats_t stats;
+  NDArray *pArray1, *pArray2;
+  size_t histTotal = 0;
+  int i;
+
+  pArray1 = pool.alloc(1, dims, NDUInt8, 0, NULL);
+  pArray2 = pool.alloc(1, dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray1 && pArray2);
+  // A third buffer exceeds maxBuffers
+  BOOST_CHECK(pool.alloc(1, dims, NDUInt8, 0, NULL) == NULL);
+  pArray2->release();
+  // Reuse the free buffer, then one that is too small
+  pArray2 = pool.alloc(1, dims, NDUInt8, 0, NULL);
+  pArray2->release();
+  pArray2 = pool.alloc(1, bigDims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray2);
+
+  pool.getStats(&stats);
+  BOOST_CHECK_EQUAL(stats.numAllocs, (size_t)5);
+  BOOST_CHECK_EQUAL(stats.newArrays, (size_t)2);
+  BOOST_CHECK_EQUAL(stats.newBuffers, (size_t)2);
+  BOOST_CHECK_EQUAL(stats.freeListHits, (size_t)1);
+  BOOST_CHECK_EQUAL(stats.reallocations, (size_t)1);
+  BOOST_CHECK_EQUAL(stats.bufferLimitFailures, (size_t)1);
+  BOOST_CHECK_EQUAL(stats.maxBuffersInUse, 2);
+  BOOST_CHECK_EQUAL(stats.maxMemorySize, (size_t)6000);
+  BOOST_CHECK(stats.minAllocTime <= stats.maxAllocTime);
+  for (i=0; i<ND_POOL_ALLOC_HIST_BINS; i++) histTotal += stats.allocTimeHist[i];
+  BOOST_CHECK_EQUAL(histTotal, stats.numAllocs);
+
+  pArray1->release();
+  pArray2->release();
+  pool.resetStats();
+  pool.getStats(&stats);
+  BOOST_CHECK_EQUAL(stats.numAllocs, (size_t)0);
+  BOOST_CHECK_EQUAL(stats.maxBuffersInUse, 0);
+  BOOST_CHECK_EQUAL(stats.maxMemorySize, (size_t)6000);
+}
+
+BOOST_AUTO_TEST_CASE(test_ConsumerQuota)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[1] = {1000};
+  NDPoolConsumer slow("slow"), fast("fast");
+  std::vector<NDPoolConsumerStats_t> consumers;
+  NDArray *pArrays[4];
+  int i;
+
+  slow.quota = 2;
+  for (i=0; i<4; i++) {
+    pArrays[i] = pool.alloc(1, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArrays[i]);
+  }
+  // The slow consumer reserves its quota and is refused the other arrays, which are not reserved
+  BOOST_CHECK_EQUAL(pArrays[0]->reserve(&slow), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pArrays[1]->reserve(&slow), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pArrays[2]->reserve(&slow), ND_ERROR);
+  BOOST_CHECK_EQUAL(pArrays[2]->getReferenceCount(), 1);
+  BOOST_CHECK_EQUAL(slow.held, 2);
+  // The quota of one consumer does not limit the others
+  for (i=0; i<4; i++) BOOST_CHECK_EQUAL(pArrays[i]->reserve(&fast), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(fast.held, 4);
+
+  pool.getConsumerStats(consumers);
+  BOOST_REQUIRE_EQUAL(consumers.size(), (size_t)2);
+  for (i=0; i<2; i++) {
+    if (consumers[i].name == "slow") {
+      BOOST_CHECK_EQUAL(consumers[i].held, 2);
+      BOOST_CHECK_EQUAL(consumers[i].quota, 2);
+      BOOST_CHECK_EQUAL(consumers[i].refused, (size_t)1);
+    } else {
+      BOOST_CHECK_EQUAL(consumers[i].name, "fast");
+      BOOST_CHECK_EQUAL(consumers[i].held, 4);
+      BOOST_CHECK_EQUAL(consumers[i].refused, (size_t)0);
+    }
+  }
+
+  // Releasing an array makes room for the next one
+  pArrays[0]->release(&slow);
+  BOOST_CHECK_EQUAL(pArrays[2]->reserve(&slow), ND_SUCCESS);
+  pArrays[1]->release(&slow);
+  pArrays[2]->release(&slow);
+  for (i=0; i<4; i++) pArrays[i]->release(&fast);
+  BOOST_CHECK_EQUAL(slow.held, 0);
+  BOOST_CHECK_EQUAL(fast.held, 0);
+  for (i=0; i<4; i++) {
+    BOOST_CHECK_EQUAL(pArrays[i]->getReferenceCount(), 1);
+    pArrays[i]->release();
+  }
+  BOOST_CHECK_EQUAL(pool.numFree(), 4);
+
+  pool.resetStats();
+  pool.getConsumerStats(consumers);
+  for (i=0; i<2; i++) {
+    BOOST_CHECK_EQUAL(consumers[i].maxHeld, 0);
+    BOOST_CHECK_EQUAL(consumers[i].refused, (size_t)0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_EvictionPolicy)
+{
+  NDPoolEviction_t policies[2] = {NDPoolEvictSmallest, NDPoolEvictLRU};
+  size_t remaining[2] = {2000, 1000};
+  size_t dimsA[1] = {1000}, dimsB[1] = {2000}, dimsC[1] = {6000}, dimsD[1] = {8000};
+  NDArrayPoolStats_t stats;
+  NDArray *pA, *pB, *pC, *pD;
+  int i;
+
+  for (i=0; i<2; i++) {
+    NDArrayPool pool(0, 10000);
+    BOOST_REQUIRE_EQUAL(pool.setEvictionPolicy(policies[i]), ND_SUCCESS);
+    pA = pool.alloc(1, dimsA, NDUInt8, 0, NULL);
+    pB = pool.alloc(1, dimsB, NDUInt8, 0, NULL);
+    pC = pool.alloc(1, dimsC, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pA && pB && pC);
+    // B has been free for longest, A is the smallest
+    pB->release();
+    pA->release();
+    pC->release();
+    // D reallocates the buffer of C, and one more buffer must be evicted to stay within maxMemory
+    pD = pool.alloc(1, dimsD, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pD);
+    BOOST_CHECK_EQUAL(pool.memorySize(), 8000 + remaining[i]);
+    pool.getStats(&stats);
+    BOOST_CHECK_EQUAL(stats.evictions, (size_t)1);
+    pD->release();
+  }
+  NDArrayPool pool(0, 0);
+  BOOST_CHECK_EQUAL(pool.setEvictionPolicy((NDPoolEviction_t)99), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_Trim)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[1] = {4096};
+  NDArrayPoolStats_t stats;
+  NDArray *pArray1, *pArray2;
+  int i;
+
+  pArray1 = pool.alloc(1, dims, NDUInt8, 0, NULL);
+  pArray2 = pool.alloc(1, dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray1 && pArray2);
+  pArray1->release();
+  // Buffers that are in use or were released recently are kept
+  BOOST_CHECK_EQUAL(pool.trim(100.), (size_t)0);
+  BOOST_CHECK_EQUAL(pool.trim(0.), (size_t)4096);
+  BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)4096);
+  pool.getStats(&stats);
+  BOOST_CHECK_EQUAL(stats.trimmedBuffers, (size_t)1);
+
+  // The trimmer thread frees the second buffer once it has been idle
+  BOOST_REQUIRE_EQUAL(pool.setTrimIdleTime(0.02), ND_SUCCESS);
+  pArray2->release();
+  for (i=0; (i<100) && (pool.memorySize() > 0); i++) epicsThreadSleep(0.01);
+  BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)0);
+  BOOST_CHECK_EQUAL(pool.setTrimIdleTime(-1.), ND_ERROR);
+}
+
+typedef struct {
+  const epicsUInt32 *pData;
+  size_t rowSize;
+  int rowsDone[101];
+  double sums[4];
+} StripeSum_t;
+
+static void sumStripe(void *pArg, size_t firstRow, size_t numRows, int stripe)
+{
+  StripeSum_t *pSum = (StripeSum_t *)pArg;
+  double sum = 0;
+  size_t row, i;
+
+  for (row=firstRow; row<firstRow+numRows; row++) {
+    for (i=0; i<pSum->rowSize; i++) sum += pSum->pData[row*pSum->rowSize + i];
+    pSum->rowsDone[row]++;
+  }
+  pSum->sums[stripe] = sum;
+}
+
+BOOST_AUTO_TEST_CASE(test_WorkerPoolStripes)
+{
+  NDWorkerPool workers("testStripes", 3);
+  std::vector<epicsUInt32> data(101*50);
+  StripeSum_t stripeSum;
+  double expected = 0, total;
+  size_t i;
+  int stripe;
+
+  for (i=0; i<data.size(); i++) {
+    data[i] = (epicsUInt32)(i % 1000);
+    expected += data[i];
+  }
+  stripeSum.pData = &data[0];
+  stripeSum.rowSize = 50;
+  for (int pass=0; pass<10; pass++) {
+    memset(stripeSum.rowsDone, 0, sizeof(stripeSum.rowsDone));
+    workers.runStripes(sumStripe, &stripeSum, 101, 4);
+    // Every row is in exactly one stripe, and the per-stripe sums reduce to the sum of the array
+    for (i=0; i<101; i++) BOOST_CHECK_EQUAL(stripeSum.rowsDone[i], 1);
+    total = 0;
+    for (stripe=0; stripe<4; stripe++) total += stripeSum.sums[stripe];
+    BOOST_CHECK_EQUAL(total, expected);
+  }
+  // There are never more stripes than rows
+  memset(stripeSum.rowsDone, 0, sizeof(stripeSum.rowsDone));
+  workers.runStripes(sumStripe, &stripeSum, 2, 4);
+  BOOST_CHECK_EQUAL(stripeSum.rowsDone[0], 1);
+  BOOST_CHECK_EQUAL(stripeSum.rowsDone[1], 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
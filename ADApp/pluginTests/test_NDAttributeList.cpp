@@ -0,0 +1,223 @@
+/*
+ * test_NDAttributeList.cpp
+ *
+ *  Tests of the NDAttributeList lookup and iteration.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDAttributeList.h>
+
+#include <string>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(NDAttributeListTests)
+
+BOOST_AUTO_TEST_CASE(test_FindAndOrder)
+{
+  NDAttributeList list;
+  std::vector<std::string> names;
+  NDAttribute *pAttribute;
+  char name[32];
+  int i, value;
+
+  // Enough attributes for the hash index to grow several times
+  for (i=0; i<200; i++) {
+    sprintf(name, "Attr%d", i);
+    names.push_back(name);
+    list.add(name, "", NDAttrInt32, &i);
+  }
+  BOOST_REQUIRE_EQUAL(list.count(), 200);
+  for (i=0; i<200; i++) {
+    pAttribute = list.find(names[i].c_str());
+    BOOST_REQUIRE(pAttribute);
+    pAttribute->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, i);
+  }
+  BOOST_CHECK(list.find("NotThere") == NULL);
+  // The search is case sensitive
+  BOOST_CHECK(list.find("attr1") == NULL);
+
+  // next() returns the attributes in the order they were added
+  pAttribute = NULL;
+  for (i=0; (pAttribute = list.next(pAttribute)); i++) {
+    BOOST_CHECK_EQUAL(std::string(pAttribute->getName()), names[i]);
+  }
+  BOOST_CHECK_EQUAL(i, 200);
+
+  // Replacing an attribute moves it to the end of the list
+  value = -1;
+  list.add(new NDAttribute("Attr5", "", NDAttrSourceDriver, "Driver", NDAttrInt32, &value));
+  BOOST_CHECK_EQUAL(list.count(), 200);
+  list.find("Attr5")->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, -1);
+
+  BOOST_CHECK_EQUAL(list.remove("Attr7"), ND_SUCCESS);
+  BOOST_CHECK(list.find("Attr7") == NULL);
+  BOOST_CHECK(list.find("Attr8") != NULL);
+  BOOST_CHECK_EQUAL(list.remove("Attr7"), ND_ERROR);
+
+  list.clear();
+  BOOST_CHECK_EQUAL(list.count(), 0);
+  BOOST_CHECK(list.find("Attr8") == NULL);
+  list.add("Attr8", "", NDAttrInt32, &i);
+  BOOST_CHECK(list.find("Attr8") != NULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_Copy)
+{
+  NDAttributeList listIn, listOut;
+  int i, value;
+  char name[32];
+
+  for (i=0; i<50; i++) {
+    sprintf(name, "Attr%d", i);
+    listIn.add(name, "", NDAttrInt32, &i);
+  }
+  listIn.copy(&listOut);
+  // Copying again updates the values of the attributes already in the output list
+  value = 99;
+  listIn.add("Attr3", "", NDAttrInt32, &value);
+  listIn.copy(&listOut);
+  BOOST_CHECK_EQUAL(listOut.count(), 50);
+  listOut.find("Attr3")->getValue(NDAttrInt32, &value);
+  BOOST_CHECK_EQUAL(value, 99);
+  listOut.find("Attr49")->getValue(NDAttrInt32, &value);
+  BOOST_CHECK_EQUAL(value, 49);
+}
+
+BOOST_AUTO_TEST_CASE(test_Recycle)
+{
+  NDAttributeList source;
+  NDAttributeList recycled(true);
+  NDAttribute *pInt, *pString;
+  std::string value;
+  int i = 1;
+  double d = 3.;
+
+  source.add("Int", "", NDAttrInt32, &i);
+  source.add("String", "", NDAttrString, (void *)"first value");
+  source.copy(&recycled);
+  pInt = recycled.find("Int");
+  pString = recycled.find("String");
+  BOOST_REQUIRE(pInt && pString);
+
+  // After clear() the same attribute objects are reused with the new values
+  recycled.clear();
+  BOOST_CHECK_EQUAL(recycled.count(), 0);
+  BOOST_CHECK(recycled.find("Int") == NULL);
+  i = 2;
+  source.add("Int", "", NDAttrInt32, &i);
+  source.add("String", "", NDAttrString, (void *)"second");
+  source.copy(&recycled);
+  BOOST_CHECK_EQUAL(recycled.count(), 2);
+  BOOST_CHECK(recycled.find("Int") == pInt);
+  BOOST_CHECK(recycled.find("String") == pString);
+  pInt->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, 2);
+  pString->getValue(value);
+  BOOST_CHECK_EQUAL(value, "second");
+  // The order of the list follows the order of the copy
+  BOOST_CHECK(recycled.next(NULL) == pInt);
+
+  // A spare of a different data type is not reused
+  recycled.clear();
+  recycled.add("Int", "", NDAttrFloat64, &d);
+  BOOST_CHECK(recycled.find("Int") != pInt);
+  recycled.add("String", "", NDAttrString, (void *)"third");
+  BOOST_CHECK(recycled.find("String") == pString);
+  recycled.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_Versions)
+{
+  NDAttributeList source, listOut(true);
+  NDAttribute *pInt, *pString;
+  size_t version;
+  int i = 1;
+  std::string value;
+
+  pInt = source.add("Int", "", NDAttrInt32, &i);
+  pString = source.add("String", "", NDAttrString, (void *)"first");
+  // Setting the same value keeps the version, a different one changes it
+  version = pInt->getVersion();
+  source.add("Int", "", NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(pInt->getVersion(), version);
+  i = 2;
+  source.add("Int", "", NDAttrInt32, &i);
+  BOOST_CHECK(pInt->getVersion() != version);
+  version = pString->getVersion();
+  pString->setValue(std::string("first"));
+  BOOST_CHECK_EQUAL(pString->getVersion(), version);
+
+  // A copy has the version of the original
+  source.copy(&listOut);
+  BOOST_CHECK_EQUAL(listOut.find("Int")->getVersion(), pInt->getVersion());
+  BOOST_CHECK_EQUAL(listOut.find("String")->getVersion(), pString->getVersion());
+
+  // A recycled attribute that was changed is copied again even if the source did not change
+  listOut.clear();
+  i = 3;
+  listOut.add("Int", "", NDAttrInt32, &i);
+  listOut.clear();
+  source.copy(&listOut);
+  listOut.find("Int")->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, 2);
+  listOut.find("String")->getValue(value);
+  BOOST_CHECK_EQUAL(value, "first");
+
+  // And a changed source is copied
+  pString->setValue(std::string("second"));
+  listOut.clear();
+  source.copy(&listOut);
+  listOut.find("String")->getValue(value);
+  BOOST_CHECK_EQUAL(value, "second");
+  BOOST_CHECK_EQUAL(listOut.find("String")->getVersion(), pString->getVersion());
+}
+
+BOOST_AUTO_TEST_CASE(test_Share)
+{
+  NDAttributeList *pSource = new NDAttributeList;
+  NDAttributeList shared1(true), shared2;
+  NDAttribute *pInt;
+  int i = 1;
+
+  pSource->add("Int", "", NDAttrInt32, &i);
+  pSource->add("String", "", NDAttrString, (void *)"value");
+  pInt = pSource->find("Int");
+  pSource->share(&shared1);
+  shared1.share(&shared2);
+  BOOST_CHECK(pSource->isShared() && shared1.isShared() && shared2.isShared());
+  BOOST_CHECK_EQUAL(shared2.count(), 2);
+  BOOST_CHECK(shared1.find("Int") == pInt);
+  BOOST_CHECK(shared2.next(NULL) == pInt);
+
+  // Modifying one list gives it a private copy and leaves the others unchanged
+  i = 2;
+  shared1.add("Int", "", NDAttrInt32, &i);
+  BOOST_CHECK(!shared1.isShared());
+  BOOST_CHECK(shared1.find("Int") != pInt);
+  BOOST_CHECK_EQUAL(shared1.count(), 2);
+  pSource->find("Int")->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, 1);
+  shared1.find("Int")->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, 2);
+
+  // Copying into a shared list does not modify the shared attributes
+  shared1.copy(&shared2);
+  BOOST_CHECK(!shared2.isShared());
+  pSource->find("Int")->getValue(NDAttrInt32, &i);
+  BOOST_CHECK_EQUAL(i, 1);
+
+  // The shared attributes survive the deletion of the list they came from
+  pSource->share(&shared2);
+  delete pSource;
+  BOOST_CHECK(shared2.find("Int") == pInt);
+  shared2.clear();
+  BOOST_CHECK_EQUAL(shared2.count(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+/*
+ * test_NDBayerKernels.cpp
+ *
+ *  Tests of the Bayer demosaicing of NDPluginColorConvert.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDConvertKernels.h>
+#include <NDBayerKernels.h>
+
+#include <vector>
+
+// The color of each pixel of each pattern: 0 red, 1 green, 2 blue
+static int siteColor(int pattern, size_t x, size_t y)
+{
+  static const char *layouts[4] = {"RGGB", "GBRG", "GRBG", "BGGR"};
+  char c = layouts[pattern][(y & 1)*2 + (x & 1)];
+  return (c == 'R') ? 0 : (c == 'G') ? 1 : 2;
+}
+
+static int average(int a, int b) { return (a + b + 1) >> 1; }
+
+// The interpolations NDBayerDemosaic() documents, pixel by pixel from the colors of the neighbours
+template <typename epicsType>
+static epicsType reference(const std::vector<epicsType>& in, int pattern, int edgeAware, size_t sizeX, size_t sizeY,
+                           size_t x, size_t y, int color)
+{
+  size_t l = (x == 0) ? 1 : x - 1, r = (x == sizeX - 1) ? sizeX - 2 : x + 1;
+  size_t u = (y == 0) ? 1 : y - 1, d = (y == sizeY - 1) ? sizeY - 2 : y + 1;
+  int c = in[y*sizeX + x], w = in[y*sizeX + l], e = in[y*sizeX + r], n = in[u*sizeX + x], s = in[d*sizeX + x];
+  int site = siteColor(pattern, x, y);
+
+  if (site == color) return (epicsType)c;
+  if (site == 1) return (epicsType)((siteColor(pattern, l, y) == color) ? average(w, e) : average(n, s));
+  if (color == 1) {
+    int h = average(w, e), v = average(n, s);
+    int gh = (w > e) ? w - e : e - w, gv = (n > s) ? n - s : s - n;
+    if (edgeAware && (gh < gv)) return (epicsType)h;
+    if (edgeAware && (gv < gh)) return (epicsType)v;
+    return (epicsType)average(h, v);
+  }
+  return (epicsType)average(average(in[u*sizeX + l], in[u*sizeX + r]),
+                            average(in[d*sizeX + l], in[d*sizeX + r]));
+}
+
+template <typename epicsType>
+static void checkDemosaic(NDDataType_t dataType, size_t sizeX, size_t sizeY, epicsType maxValue)
+{
+  std::vector<epicsType> in(sizeX*sizeY);
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t x, y, i;
+
+  // Values near the top of the range check that the averages do not overflow
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)(maxValue - (epicsType)((i*7919) % 97) * (maxValue / 97));
+  for (int pattern=NDBayerRGGB; pattern<=NDBayerBGGR; pattern++) {
+    for (int method=0; method<2; method++) {
+      // RGB1, interleaved, and RGB3, planes
+      std::vector<epicsType> rgb1(3*sizeX*sizeY), rgb3(3*sizeX*sizeY), scalar(3*sizeX*sizeY);
+      NDSimdSetMaxLevel(NDSimdNone);
+      BOOST_REQUIRE_EQUAL(NDBayerDemosaic(dataType, pattern, (NDBayerMethod_t)method, &in[0], sizeX, sizeY,
+                                          &scalar[0], &scalar[1], &scalar[2], 3, 3*sizeX, 0, sizeY), ND_SUCCESS);
+      NDSimdSetMaxLevel(level);
+      BOOST_REQUIRE_EQUAL(NDBayerDemosaic(dataType, pattern, (NDBayerMethod_t)method, &in[0], sizeX, sizeY,
+                                          &rgb1[0], &rgb1[1], &rgb1[2], 3, 3*sizeX, 0, sizeY), ND_SUCCESS);
+      // In 2 stripes
+      size_t half = sizeY / 2, plane = sizeX*sizeY;
+      for (int stripe=0; stripe<2; stripe++) {
+        BOOST_REQUIRE_EQUAL(NDBayerDemosaic(dataType, pattern, (NDBayerMethod_t)method, &in[0], sizeX, sizeY,
+                                            &rgb3[0], &rgb3[plane], &rgb3[2*plane], 1, sizeX,
+                                            stripe ? half : 0, stripe ? sizeY - half : half), ND_SUCCESS);
+      }
+      for (y=0; y<sizeY; y++) {
+        for (x=0; x<sizeX; x++) {
+          for (int color=0; color<3; color++) {
+            epicsType expected = reference(in, pattern, method, sizeX, sizeY, x, y, color);
+            BOOST_CHECK_EQUAL(scalar[(y*sizeX + x)*3 + color], expected);
+            BOOST_CHECK_EQUAL(rgb1[(y*sizeX + x)*3 + color], expected);
+            BOOST_CHECK_EQUAL(rgb3[color*plane + y*sizeX + x], expected);
+          }
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(NDBayerKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Demosaic)
+{
+  // Rows that are not a multiple of the vector width, and the smallest array
+  checkDemosaic<epicsUInt8>(NDUInt8, 77, 9, 255);
+  checkDemosaic<epicsUInt16>(NDUInt16, 77, 9, 65535);
+  checkDemosaic<epicsUInt16>(NDUInt16, 2, 2, 4095);
+  checkDemosaic<epicsInt16>(NDInt16, 21, 5, 32767);
+  checkDemosaic<epicsInt8>(NDInt8, 21, 5, 127);
+
+  std::vector<epicsUInt16> data(16);
+  BOOST_CHECK_EQUAL(NDBayerDemosaic(NDFloat32, NDBayerRGGB, NDBayerBilinear, &data[0], 2, 2,
+                                    &data[0], &data[4], &data[8], 1, 2, 0, 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDBayerDemosaic(NDUInt16, NDBayerRGGB, NDBayerBilinear, &data[0], 1, 2,
+                                    &data[0], &data[4], &data[8], 1, 1, 0, 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDBayerDemosaic(NDUInt16, 4, NDBayerBilinear, &data[0], 2, 2,
+                                    &data[0], &data[4], &data[8], 1, 2, 0, 2), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
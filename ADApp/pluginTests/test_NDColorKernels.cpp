@@ -0,0 +1,174 @@
+/*
+ * test_NDColorKernels.cpp
+ *
+ *  Tests of the color layout and YUV conversion kernels of NDPluginColorConvert.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDColorKernels.h>
+
+#include <vector>
+
+template <typename epicsType>
+static void checkLayout(size_t sizeX, size_t numRows)
+{
+  // Rows with padding check the strides
+  size_t inStride = 3*sizeX + 5, planeStride = sizeX + 3, i, x, row;
+  std::vector<epicsType> rgb1(inStride*numRows);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<rgb1.size(); i++) rgb1[i] = (epicsType)((i*37 + 11) % 251);
+  for (int simd=0; simd<2; simd++) {
+    std::vector<epicsType> red(planeStride*numRows), green(red), blue(red), back(rgb1.size());
+    NDSimdSetMaxLevel(simd ? level : NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDColorDeinterleave(sizeof(epicsType), &rgb1[0], inStride, &red[0], &green[0], &blue[0],
+                                            planeStride, sizeX, numRows), ND_SUCCESS);
+    for (row=0; row<numRows; row++) {
+      for (x=0; x<sizeX; x++) {
+        BOOST_CHECK_EQUAL(red[row*planeStride + x],   rgb1[row*inStride + 3*x]);
+        BOOST_CHECK_EQUAL(green[row*planeStride + x], rgb1[row*inStride + 3*x + 1]);
+        BOOST_CHECK_EQUAL(blue[row*planeStride + x],  rgb1[row*inStride + 3*x + 2]);
+      }
+    }
+    BOOST_REQUIRE_EQUAL(NDColorInterleave(sizeof(epicsType), &red[0], &green[0], &blue[0], planeStride, &back[0],
+                                          inStride, sizeX, numRows), ND_SUCCESS);
+    for (row=0; row<numRows; row++) {
+      for (x=0; x<3*sizeX; x++) BOOST_CHECK_EQUAL(back[row*inStride + x], rgb1[row*inStride + x]);
+    }
+  }
+  NDSimdSetMaxLevel(level);
+}
+
+static int referenceColor(double value)
+{
+  value = floor(value + 0.5);
+  return (value < 0) ? 0 : (value > 255) ? 255 : (int)value;
+}
+
+static void checkYUV(NDColorMode_t mode, size_t sizeX)
+{
+  size_t groupPixels = (mode == NDColorModeYUV444) ? 1 : (mode == NDColorModeYUV422) ? 2 : 4;
+  size_t groupBytes = (mode == NDColorModeYUV444) ? 3 : (mode == NDColorModeYUV422) ? 4 : 6;
+  size_t numRows = 3, rowBytes = sizeX/groupPixels*groupBytes, i, x, row;
+  std::vector<epicsUInt8> yuv(rowBytes*numRows);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  // Values near 0 and 255 check the saturation
+  for (i=0; i<yuv.size(); i++) yuv[i] = (epicsUInt8)((i*73 + 5) % 256);
+  for (int simd=0; simd<2; simd++) {
+    std::vector<epicsUInt8> planes(3*sizeX*numRows), rgb1(3*sizeX*numRows);
+    NDSimdSetMaxLevel(simd ? level : NDSimdNone);
+    // RGB2 planes and RGB1 pixels
+    BOOST_REQUIRE_EQUAL(NDColorYUVToRGB(mode, &yuv[0], rowBytes, &planes[0], &planes[sizeX], &planes[2*sizeX], 1,
+                                        3*sizeX, sizeX, numRows), ND_SUCCESS);
+    BOOST_REQUIRE_EQUAL(NDColorYUVToRGB(mode, &yuv[0], rowBytes, &rgb1[0], &rgb1[1], &rgb1[2], 3,
+                                        3*sizeX, sizeX, numRows), ND_SUCCESS);
+    for (row=0; row<numRows; row++) {
+      for (x=0; x<sizeX; x++) {
+        const epicsUInt8 *pGroup = &yuv[row*rowBytes + x/groupPixels*groupBytes];
+        size_t k = x % groupPixels;
+        int y = (mode == NDColorModeYUV444) ? pGroup[1] : (mode == NDColorModeYUV422) ? pGroup[1 + 2*k] :
+                pGroup[k + 1 + k/2];
+        double u = pGroup[0] - 128., v = pGroup[(mode == NDColorModeYUV411) ? 3 : 2] - 128.;
+        int color[3];
+        color[0] = referenceColor(y + 1.402*v);
+        color[1] = referenceColor(y - 0.344136*u - 0.714136*v);
+        color[2] = referenceColor(y + 1.772*u);
+        for (int c=0; c<3; c++) {
+          // The fixed-point coefficients and roundings are within 2 of the exact conversion
+          int plane = planes[row*3*sizeX + c*sizeX + x], pixel = rgb1[row*3*sizeX + 3*x + c];
+          BOOST_CHECK(abs(plane - color[c]) <= 2);
+          BOOST_CHECK_EQUAL(pixel, plane);
+        }
+      }
+    }
+    if (simd) {
+      std::vector<epicsUInt8> scalar(planes.size());
+      NDSimdSetMaxLevel(NDSimdNone);
+      NDColorYUVToRGB(mode, &yuv[0], rowBytes, &scalar[0], &scalar[sizeX], &scalar[2*sizeX], 1, 3*sizeX,
+                      sizeX, numRows);
+      for (i=0; i<planes.size(); i++) BOOST_CHECK_EQUAL(planes[i], scalar[i]);
+    }
+  }
+  NDSimdSetMaxLevel(level);
+}
+
+BOOST_AUTO_TEST_SUITE(NDColorKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Layout)
+{
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(NDSimdLevel()));
+  // Not a multiple of the pixels of a block, so the scalar remainder is used
+  checkLayout<epicsUInt8>(37, 3);
+  checkLayout<epicsUInt16>(37, 3);
+  checkLayout<epicsFloat32>(21, 2);
+  checkLayout<epicsFloat64>(9, 2);
+  checkLayout<epicsUInt8>(2, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_YUV)
+{
+  checkYUV(NDColorModeYUV444, 37);
+  checkYUV(NDColorModeYUV422, 70);
+  checkYUV(NDColorModeYUV411, 68);
+  checkYUV(NDColorModeYUV411, 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_FalseColor16)
+{
+  // A gray map, so the color is the position in the window
+  std::vector<unsigned char> map(3*256);
+  std::vector<epicsUInt32> table(ND_FALSE_COLOR_TABLE_SIZE);
+  size_t n = 1003, i;
+  std::vector<epicsUInt16> values(n);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<map.size(); i++) map[i] = (unsigned char)(i/3);
+  for (i=0; i<n; i++) values[i] = (epicsUInt16)((i*6553) % 65536);
+  BOOST_REQUIRE_EQUAL(NDColorFalseColorTable(&map[0], 0, 1000., 11200., &table[0]), ND_SUCCESS);
+  for (int simd=0; simd<2; simd++) {
+    std::vector<epicsUInt8> rgb1(3*n), planes(3*n);
+    NDSimdSetMaxLevel(simd ? level : NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDColorFalseColor16(&table[0], &values[0], &rgb1[0], &rgb1[1], &rgb1[2], 3, n), ND_SUCCESS);
+    BOOST_REQUIRE_EQUAL(NDColorFalseColor16(&table[0], &values[0], &planes[0], &planes[n], &planes[2*n], 1, n),
+                        ND_SUCCESS);
+    for (i=0; i<n; i++) {
+      int color = (values[i] <= 1000) ? 0 : (values[i] >= 11200) ? 255 :
+                  (int)floor((values[i] - 1000.) / 40. + 0.5);
+      for (int c=0; c<3; c++) {
+        BOOST_CHECK_EQUAL((int)rgb1[3*i + c], color);
+        BOOST_CHECK_EQUAL((int)planes[c*n + i], color);
+      }
+    }
+  }
+  NDSimdSetMaxLevel(level);
+
+  // Int16 values index the table by their bits
+  epicsInt16 signedValues[3] = {-100, 0, 100};
+  epicsUInt8 rgb1[9];
+  NDColorFalseColorTable(&map[0], 1, -100., 100., &table[0]);
+  NDColorFalseColor16(&table[0], signedValues, &rgb1[0], &rgb1[1], &rgb1[2], 3, 3);
+  BOOST_CHECK_EQUAL((int)rgb1[0], 0);
+  BOOST_CHECK_EQUAL((int)rgb1[3], 128);
+  BOOST_CHECK_EQUAL((int)rgb1[6], 255);
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  std::vector<epicsUInt8> in(64), out(64);
+
+  BOOST_CHECK_EQUAL(NDColorDeinterleave(3, &in[0], 3, &out[0], &out[1], &out[2], 1, 1, 1), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDColorInterleave(16, &in[0], &in[1], &in[2], 1, &out[0], 3, 1, 1), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDColorYUVToRGB(NDColorModeRGB1, &in[0], 4, &out[0], &out[1], &out[2], 3, 6, 2, 1), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDColorYUVToRGB(NDColorModeYUV422, &in[0], 6, &out[0], &out[1], &out[2], 3, 9, 3, 1),
+                    ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
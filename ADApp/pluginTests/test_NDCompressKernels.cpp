@@ -0,0 +1,171 @@
+/*
+ * test_NDCompressKernels.cpp
+ *
+ *  Tests of the shuffles and block compression of the compressed pre-trigger ring of NDPluginCircularBuff.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDCompressKernels.h>
+
+#include <vector>
+
+/* Compresses and decompresses a block, returns the compressed size */
+static size_t roundTrip(NDShuffle_t shuffle, size_t elementSize, const std::vector<epicsUInt8>& block)
+{
+  size_t n = block.size(), compressed = 0;
+  std::vector<epicsUInt8> scratch(n + 1), out(NDCompressBound(n)), back(n + 1, 0xA5);
+
+  BOOST_REQUIRE_EQUAL(NDCompressBlock(shuffle, elementSize, &block[0], n, &scratch[0], &out[0], out.size(),
+                                      &compressed), ND_SUCCESS);
+  BOOST_REQUIRE(compressed <= NDCompressBound(n));
+  BOOST_REQUIRE_EQUAL(NDDecompressBlock(elementSize, &out[0], compressed, &scratch[0], &back[0], n), ND_SUCCESS);
+  BOOST_CHECK(memcmp(&back[0], &block[0], n) == 0);
+  // Nothing is written after the block
+  BOOST_CHECK_EQUAL((int)back[n], 0xA5);
+  return compressed;
+}
+
+BOOST_AUTO_TEST_SUITE(NDCompressKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Shuffle)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  size_t elementSizes[4] = {1, 2, 4, 8}, e, i, b, k;
+
+  BOOST_TEST_MESSAGE("Compression " << NDCompressBackend() << ", SIMD level " << NDSimdLevelName(level));
+  for (int simd=0; simd<2; simd++) {
+    NDSimdSetMaxLevel(simd ? level : NDSimdNone);
+    for (e=0; e<4; e++) {
+      // Not a multiple of the element size, nor of the 16 elements of the SSE2 loop
+      size_t size = elementSizes[e], nBytes = 37*size + 3, n = nBytes/size;
+      std::vector<epicsUInt8> in(nBytes), shuffled(nBytes), back(nBytes);
+      for (i=0; i<nBytes; i++) in[i] = (epicsUInt8)(i*29 + 7);
+      BOOST_REQUIRE_EQUAL(NDShuffle(NDShuffleByte, size, &in[0], nBytes, &shuffled[0]), ND_SUCCESS);
+      for (i=0; i<n; i++)
+        for (b=0; b<size; b++) BOOST_CHECK_EQUAL((int)shuffled[b*n + i], (int)in[i*size + b]);
+      for (i=n*size; i<nBytes; i++) BOOST_CHECK_EQUAL((int)shuffled[i], (int)in[i]);
+      BOOST_REQUIRE_EQUAL(NDUnshuffle(NDShuffleByte, size, &shuffled[0], nBytes, &back[0]), ND_SUCCESS);
+      BOOST_CHECK(back == in);
+
+      // Bit k of byte b of element i is bit i%8 of byte i/8 of plane 8*b+k, for the first 32 elements
+      size_t m = n/8;
+      BOOST_REQUIRE_EQUAL(NDShuffle(NDShuffleBit, size, &in[0], nBytes, &shuffled[0]), ND_SUCCESS);
+      for (i=0; i<8*m; i++)
+        for (b=0; b<size; b++)
+          for (k=0; k<8; k++)
+            BOOST_CHECK_EQUAL((shuffled[(8*b + k)*m + i/8] >> (i%8)) & 1, (in[i*size + b] >> k) & 1);
+      for (i=8*m*size; i<nBytes; i++) BOOST_CHECK_EQUAL((int)shuffled[i], (int)in[i]);
+      BOOST_REQUIRE_EQUAL(NDUnshuffle(NDShuffleBit, size, &shuffled[0], nBytes, &back[0]), ND_SUCCESS);
+      BOOST_CHECK(back == in);
+    }
+  }
+  NDSimdSetMaxLevel(level);
+}
+
+BOOST_AUTO_TEST_CASE(test_RoundTrip)
+{
+  size_t n = 100000, i, compressed, byteCompressed;
+  std::vector<epicsUInt8> block(2*n);
+  epicsUInt16 *pValues = (epicsUInt16 *)&block[0];
+
+  // A dark 16-bit image, 3 bits of noise on a low background: the byte shuffle removes the high bytes, the bit
+  // shuffle also the constant bits of the low bytes
+  srand(1);
+  for (i=0; i<n; i++) pValues[i] = (epicsUInt16)(96 + rand() % 8);
+  byteCompressed = roundTrip(NDShuffleByte, 2, block);
+  compressed = roundTrip(NDShuffleBit, 2, block);
+  BOOST_TEST_MESSAGE("Dark image compressed to " << byteCompressed << " (byte shuffle), " << compressed <<
+                     " (bit shuffle) of " << block.size() << " bytes");
+  BOOST_CHECK(byteCompressed < block.size()*6/10);
+  BOOST_CHECK(compressed < block.size()/4);
+  BOOST_CHECK(roundTrip(NDShuffleNone, 2, block) > byteCompressed);
+
+  // Long runs, and matches that overlap the bytes they write
+  for (i=0; i<block.size(); i++) block[i] = (epicsUInt8)((i < 70000) ? 0 : (i % 3));
+  BOOST_CHECK(roundTrip(NDShuffleNone, 1, block) < 1000);
+
+  // Random data does not compress and is stored
+  for (i=0; i<block.size(); i++) block[i] = (epicsUInt8)rand();
+  BOOST_CHECK_EQUAL(roundTrip(NDShuffleBit, 1, block), block.size() + 1);
+
+  // Short blocks are literals only, and sizes that are not a multiple of the element size keep their tail
+  for (int shuffle=NDShuffleNone; shuffle<=NDShuffleBit; shuffle++) {
+    for (size_t size=1; size<40; size++) {
+      std::vector<epicsUInt8> shortBlock(size, 7);
+      roundTrip((NDShuffle_t)shuffle, 4, shortBlock);
+    }
+    std::vector<epicsUInt8> odd(1001, 3);
+    roundTrip((NDShuffle_t)shuffle, 8, odd);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  std::vector<epicsUInt8> in(1000, 1), scratch(1000), out(NDCompressBound(1000)), back(1000);
+  size_t compressed;
+
+  BOOST_CHECK_EQUAL(NDCompressBlock(NDShuffleByte, 2, &in[0], 1000, &scratch[0], &out[0], 1000, &compressed),
+                    ND_ERROR);
+  BOOST_CHECK_EQUAL(NDCompressBlock(NDShuffleByte, 2, &in[0], 1000, NULL, &out[0], out.size(), &compressed),
+                    ND_ERROR);
+  BOOST_CHECK_EQUAL(NDCompressBlock((NDShuffle_t)3, 2, &in[0], 1000, &scratch[0], &out[0], out.size(),
+                                    &compressed), ND_ERROR);
+  BOOST_REQUIRE_EQUAL(NDCompressBlock(NDShuffleByte, 2, &in[0], 1000, &scratch[0], &out[0], out.size(),
+                                      &compressed), ND_SUCCESS);
+  // The wrong size, a truncated block and an unknown mode are detected
+  BOOST_CHECK_EQUAL(NDDecompressBlock(2, &out[0], compressed, &scratch[0], &back[0], 999), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDDecompressBlock(2, &out[0], compressed - 1, &scratch[0], &back[0], 1000), ND_ERROR);
+  out[0] = 7;
+  BOOST_CHECK_EQUAL(NDDecompressBlock(2, &out[0], compressed, &scratch[0], &back[0], 1000), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_Bitshuffle)
+{
+  // 3 full blocks of 64 elements, a last block of 40 and 5 elements stored as they are
+  size_t n = 3*64 + 45, nBytes = 2*n, compressed, i;
+  std::vector<epicsUInt8> chunk(nBytes), scratch(2*64), out(NDBitshuffleLZ4Bound(2, 64, nBytes)), back(nBytes);
+  epicsUInt16 *pValues = (epicsUInt16 *)&chunk[0];
+
+  BOOST_CHECK_EQUAL(NDBitshuffleBlockSize(2, 0), 4096u);
+  BOOST_CHECK_EQUAL(NDBitshuffleBlockSize(8, 0), 1024u);
+  BOOST_CHECK_EQUAL(NDBitshuffleBlockSize(2, 64), 64u);
+  srand(2);
+  for (i=0; i<n; i++) pValues[i] = (epicsUInt16)(1000 + rand() % 16);
+  BOOST_REQUIRE_EQUAL(NDBitshuffleLZ4Compress(2, 64, &chunk[0], nBytes, &scratch[0], &out[0], out.size(),
+                                              &compressed), ND_SUCCESS);
+  BOOST_CHECK(compressed < nBytes);
+  // The header is big-endian: the size of the chunk and the bytes of a block
+  BOOST_CHECK_EQUAL((int)out[6], (int)(nBytes >> 8));
+  BOOST_CHECK_EQUAL((int)out[7], (int)(nBytes & 0xFF));
+  BOOST_CHECK_EQUAL((int)out[10], 0);
+  BOOST_CHECK_EQUAL((int)out[11], 128);
+  BOOST_CHECK(memcmp(&out[compressed - 10], &chunk[nBytes - 10], 10) == 0);
+  // The scratch a decompressor needs comes from the header, one block of 128 bytes and a byte
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4ScratchSize(&out[0], compressed, nBytes), 129u);
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4ScratchSize(&out[0], 11, nBytes), 0u);
+  BOOST_REQUIRE_EQUAL(NDBitshuffleLZ4Decompress(2, &out[0], compressed, &scratch[0], &back[0], nBytes), ND_SUCCESS);
+  BOOST_CHECK(back == chunk);
+
+  // Random data still fits in the bound, and the errors are detected
+  for (i=0; i<nBytes; i++) chunk[i] = (epicsUInt8)rand();
+  BOOST_REQUIRE_EQUAL(NDBitshuffleLZ4Compress(2, 64, &chunk[0], nBytes, &scratch[0], &out[0], out.size(),
+                                              &compressed), ND_SUCCESS);
+  BOOST_CHECK(compressed <= out.size());
+  BOOST_REQUIRE_EQUAL(NDBitshuffleLZ4Decompress(2, &out[0], compressed, &scratch[0], &back[0], nBytes), ND_SUCCESS);
+  BOOST_CHECK(back == chunk);
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4Decompress(2, &out[0], compressed - 1, &scratch[0], &back[0], nBytes), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4Decompress(2, &out[0], compressed, &scratch[0], &back[0], nBytes - 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4Compress(2, 60, &chunk[0], nBytes, &scratch[0], &out[0], out.size(),
+                                            &compressed), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDBitshuffleLZ4Compress(2, 64, &chunk[0], nBytes - 1, &scratch[0], &out[0], out.size(),
+                                            &compressed), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
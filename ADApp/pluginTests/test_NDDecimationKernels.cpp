@@ -0,0 +1,89 @@
+/*
+ * test_NDDecimationKernels.cpp
+ *
+ *  Tests of the display decimation of NDPluginAttrPlot.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <epicsMath.h>
+#include <NDDecimationKernels.h>
+
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(NDDecimationKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_MinMax)
+{
+  size_t n = 1000, nBuckets = 7, i, bucket;
+  std::vector<double> in(n), out(2*nBuckets);
+
+  for (i=0; i<n; i++) in[i] = sin(0.037*i) + ((i % 97 == 5) ? 3. : 0.);
+  BOOST_REQUIRE_EQUAL(NDDecimateMinMax(&in[0], n, nBuckets, &out[0]), 2*nBuckets);
+  for (bucket=0; bucket<nBuckets; bucket++) {
+    size_t first = bucket*n/nBuckets, end = (bucket + 1)*n/nBuckets, iMin = first, iMax = first;
+    for (i=first; i<end; i++) {
+      if (in[i] < in[iMin]) iMin = i;
+      if (in[i] > in[iMax]) iMax = i;
+    }
+    // In the order of the points
+    BOOST_CHECK_EQUAL(out[2*bucket], in[iMin < iMax ? iMin : iMax]);
+    BOOST_CHECK_EQUAL(out[2*bucket + 1], in[iMin < iMax ? iMax : iMin]);
+  }
+
+  // An increasing series gives the first and last point of each bucket
+  for (i=0; i<n; i++) in[i] = (double)i;
+  NDDecimateMinMax(&in[0], n, nBuckets, &out[0]);
+  for (bucket=0; bucket<nBuckets; bucket++) {
+    BOOST_CHECK_EQUAL(out[2*bucket], (double)(bucket*n/nBuckets));
+    BOOST_CHECK_EQUAL(out[2*bucket + 1], (double)((bucket + 1)*n/nBuckets - 1));
+  }
+
+  // NaN values are skipped, and a bucket of NaN values gives NaN
+  for (i=0; i<n; i++) in[i] = (i < 200) ? epicsNAN : (double)(i % 10);
+  NDDecimateMinMax(&in[0], n, 5, &out[0]);
+  BOOST_CHECK(isnan(out[0]) && isnan(out[1]));
+  BOOST_CHECK_EQUAL(out[2], 0.);
+  BOOST_CHECK_EQUAL(out[3], 9.);
+
+  // Short series are copied
+  BOOST_CHECK_EQUAL(NDDecimateMinMax(&in[500], 10, 5, &out[0]), 10);
+  for (i=0; i<10; i++) BOOST_CHECK_EQUAL(out[i], in[500 + i]);
+}
+
+BOOST_AUTO_TEST_CASE(test_LTTB)
+{
+  size_t n = 1000, nOut = 52, i, k;
+  std::vector<double> x(n), y(n);
+  std::vector<size_t> indices(nOut);
+
+  // A flat line with narrow spikes: each bucket with a spike keeps it
+  for (i=0; i<n; i++) {
+    x[i] = 2.*i;
+    y[i] = (i % 50 == 25) ? 10. : 0.;
+  }
+  BOOST_REQUIRE_EQUAL(NDDecimateLTTB(&x[0], &y[0], n, nOut, &indices[0]), nOut);
+  BOOST_CHECK_EQUAL(indices[0], 0);
+  BOOST_CHECK_EQUAL(indices[nOut - 1], n - 1);
+  for (k=1; k<nOut; k++) BOOST_CHECK(indices[k] > indices[k - 1]);
+  size_t spikes = 0;
+  for (k=0; k<nOut; k++) if (y[indices[k]] == 10.) spikes++;
+  BOOST_CHECK_EQUAL(spikes, 20);
+
+  // Without X values the indices are used, which gives the same points for equally spaced X values
+  std::vector<size_t> noX(nOut);
+  NDDecimateLTTB(NULL, &y[0], n, nOut, &noX[0]);
+  for (k=0; k<nOut; k++) BOOST_CHECK_EQUAL(noX[k], indices[k]);
+
+  // Short series keep all their points
+  BOOST_CHECK_EQUAL(NDDecimateLTTB(&x[0], &y[0], 10, 20, &indices[0]), 10);
+  for (k=0; k<10; k++) BOOST_CHECK_EQUAL(indices[k], k);
+  BOOST_CHECK_EQUAL(NDDecimateLTTB(&x[0], &y[0], n, 2, &indices[0]), 2);
+  BOOST_CHECK_EQUAL(indices[1], n - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,295 @@
+/*
+ * test_NDFFTEngine.cpp
+ *
+ *  Tests of the plan-based FFTs of NDPluginFFT.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDFFTEngine.h>
+#include <NDAttribute.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifndef M_PI
+  #define M_PI 3.14159265358979323846
+#endif
+
+// The DFT with exp(isign 2 pi i jk/n) of nX x nY points, x varying fastest
+static std::vector<double> naiveDFT(const std::vector<double> &in, size_t nX, size_t nY, int isign)
+{
+  std::vector<double> out(2*nX*nY);
+  for (size_t ky=0; ky<nY; ky++) {
+    for (size_t kx=0; kx<nX; kx++) {
+      double re = 0., im = 0.;
+      for (size_t y=0; y<nY; y++) {
+        for (size_t x=0; x<nX; x++) {
+          double theta = isign * 2. * M_PI * ((double)(kx*x % nX)/nX + (double)(ky*y % nY)/nY);
+          const double *p = &in[2*(y*nX + x)];
+          re += p[0]*cos(theta) - p[1]*sin(theta);
+          im += p[0]*sin(theta) + p[1]*cos(theta);
+        }
+      }
+      out[2*(ky*nX + kx)]     = re;
+      out[2*(ky*nX + kx) + 1] = im;
+    }
+  }
+  return out;
+}
+
+static void checkFFT(int rank, size_t nX, size_t nY, int isign)
+{
+  size_t dims[2] = {nX, nY}, i;
+  std::vector<double> data(2*nX*nY);
+
+  for (i=0; i<data.size(); i++) data[i] = sin(0.37*i) + (double)(i % 7);
+  std::vector<double> expected = naiveDFT(data, nX, nY, isign);
+  NDFFTPlan_t *pPlan = NDFFTPlanAcquire(rank, dims);
+  BOOST_REQUIRE(pPlan != NULL);
+  BOOST_REQUIRE_EQUAL(NDFFTExecute(pPlan, &data[0], isign), ND_SUCCESS);
+  NDFFTPlanRelease(pPlan);
+  for (i=0; i<data.size(); i++) {
+    BOOST_CHECK_SMALL(data[i] - expected[i], 1e-9 * nX * nY);
+  }
+}
+
+static void checkRealFFT(int rank, size_t nX, size_t nY, int isign)
+{
+  size_t dims[2] = {nX, nY}, half = nX/2 + 1, i, x, y;
+  std::vector<double> real(nX*nY), complex(2*nX*nY), out(2*half*nY);
+
+  for (i=0; i<real.size(); i++) {
+    real[i] = cos(0.29*i) + (double)(i % 5);
+    complex[2*i] = real[i];
+  }
+  std::vector<double> expected = naiveDFT(complex, nX, nY, isign);
+  NDFFTPlan_t *pPlan = NDFFTPlanAcquireReal(rank, dims);
+  BOOST_REQUIRE(pPlan != NULL);
+  BOOST_REQUIRE_EQUAL(NDFFTExecuteReal(pPlan, &real[0], &out[0], isign), ND_SUCCESS);
+  // A real plan does not do complex transforms
+  BOOST_CHECK_EQUAL(NDFFTExecute(pPlan, &complex[0], isign), ND_ERROR);
+  NDFFTPlanRelease(pPlan);
+  for (y=0; y<nY; y++) {
+    for (x=0; x<half; x++) {
+      BOOST_CHECK_SMALL(out[2*(y*half + x)]     - expected[2*(y*nX + x)],     1e-9 * nX * nY);
+      BOOST_CHECK_SMALL(out[2*(y*half + x) + 1] - expected[2*(y*nX + x) + 1], 1e-9 * nX * nY);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(NDFFTEngineTests)
+
+BOOST_AUTO_TEST_CASE(test_1D)
+{
+  BOOST_TEST_MESSAGE("FFT backend " << NDFFTBackend());
+  for (size_t n=1; n<=512; n*=2) {
+    checkFFT(1, n, 1, 1);
+    checkFFT(1, n, 1, -1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_2D)
+{
+  // Arrays that are not square check the order of the dimensions
+  checkFFT(2, 16, 8, 1);
+  checkFFT(2, 4, 32, -1);
+  checkFFT(2, 1, 8, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_AnySize)
+{
+  // Small primes, products with powers of 2, and primes above 64 that use Bluestein's algorithm
+  size_t sizes[] = {3, 5, 6, 7, 9, 12, 15, 45, 60, 100, 61, 67, 97, 134, 201, 1009};
+  for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+    checkFFT(1, sizes[i], 1, 1);
+    checkFFT(1, sizes[i], 1, -1);
+    checkRealFFT(1, sizes[i], 1, -1);
+    checkRealFFT(1, sizes[i], 1, 1);
+  }
+  checkFFT(2, 12, 5, 1);
+  checkFFT(2, 67, 3, -1);
+  checkRealFFT(2, 15, 6, 1);
+  checkRealFFT(2, 10, 7, -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Real)
+{
+  for (size_t n=1; n<=512; n*=2) {
+    checkRealFFT(1, n, 1, 1);
+    checkRealFFT(1, n, 1, -1);
+  }
+  checkRealFFT(2, 16, 8, 1);
+  checkRealFFT(2, 2, 16, -1);
+  checkRealFFT(2, 1, 4, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Passes)
+{
+  // The lines of each pass in uneven chunks, as threads would do them, give the same result
+  size_t dims[3] = {20, 12, 3}, i, line;
+  std::vector<double> real(20*12*3), complex(2*real.size());
+
+  for (i=0; i<real.size(); i++) real[i] = complex[2*i] = sin(0.13*i*i);
+  for (int isReal=0; isReal<2; isReal++) {
+    NDFFTPlan_t *pPlan = isReal ? NDFFTPlanAcquireReal(3, dims) : NDFFTPlanAcquire(3, dims);
+    BOOST_REQUIRE(pPlan != NULL);
+    std::vector<double> expected(isReal ? 2*11*12*3 : complex.size()), out(expected.size());
+    if (isReal) {
+      NDFFTExecuteReal(pPlan, &real[0], &expected[0], 1);
+    } else {
+      expected = complex;
+      NDFFTExecute(pPlan, &expected[0], 1);
+    }
+    for (int pass=0; pass<NDFFTPasses(pPlan); pass++) {
+      size_t lines = NDFFTPassLines(pPlan, pass), chunk = 1;
+      for (line=0; line<lines; line+=chunk, chunk=chunk%5 + 3) {
+        if (chunk > lines - line) chunk = lines - line;
+        BOOST_REQUIRE_EQUAL(NDFFTExecutePass(pPlan, pass, isReal ? &real[0] : &complex[0], &out[0], 1, line, chunk),
+                            ND_SUCCESS);
+      }
+      BOOST_CHECK_EQUAL(NDFFTExecutePass(pPlan, pass, &real[0], &out[0], 1, lines, 1), ND_ERROR);
+    }
+    for (i=0; i<expected.size(); i++) BOOST_CHECK_SMALL(out[i] - expected[i], 1e-9);
+    NDFFTPlanRelease(pPlan);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Inverse)
+{
+  size_t dims[1] = {256}, i;
+  std::vector<double> data(512), original;
+
+  for (i=0; i<data.size(); i++) data[i] = cos(0.11*i*i);
+  original = data;
+  NDFFTPlan_t *pPlan = NDFFTPlanAcquire(1, dims);
+  BOOST_REQUIRE(pPlan != NULL);
+  NDFFTExecute(pPlan, &data[0], 1);
+  NDFFTExecute(pPlan, &data[0], -1);
+  NDFFTPlanRelease(pPlan);
+  for (i=0; i<data.size(); i++) BOOST_CHECK_SMALL(data[i]/256. - original[i], 1e-12);
+}
+
+BOOST_AUTO_TEST_CASE(test_PlanCache)
+{
+  size_t dims[2] = {64, 32};
+
+  NDFFTPlan_t *pPlan = NDFFTPlanAcquire(2, dims);
+  BOOST_REQUIRE(pPlan != NULL);
+  // The same dimensions share the plan
+  NDFFTPlan_t *pSame = NDFFTPlanAcquire(2, dims);
+  BOOST_CHECK(pSame == pPlan);
+  NDFFTPlanRelease(pSame);
+  // The rank is part of the key
+  NDFFTPlan_t *p1D = NDFFTPlanAcquire(1, dims);
+  BOOST_CHECK(p1D != pPlan);
+  NDFFTPlanRelease(p1D);
+  // So is the type of the input
+  NDFFTPlan_t *pReal = NDFFTPlanAcquireReal(2, dims);
+  BOOST_CHECK(pReal != pPlan);
+  NDFFTPlanRelease(pReal);
+  // Plans that leave the cache stay valid while they are used
+  for (size_t n=1; n<=2*ND_FFT_CACHED_PLANS; n++) {
+    size_t other[1] = {(size_t)1 << n};
+    NDFFTPlan_t *pOther = NDFFTPlanAcquire(1, other);
+    BOOST_REQUIRE(pOther != NULL);
+    NDFFTPlanRelease(pOther);
+  }
+  std::vector<double> data(2*64*32, 1.);
+  BOOST_CHECK_EQUAL(NDFFTExecute(pPlan, &data[0], 1), ND_SUCCESS);
+  BOOST_CHECK_SMALL(data[0] - 64.*32., 1e-9);
+  BOOST_CHECK_SMALL(data[2], 1e-9);
+  NDFFTPlanRelease(pPlan);
+}
+
+BOOST_AUTO_TEST_CASE(test_Window)
+{
+  std::vector<double> window(16);
+
+  BOOST_REQUIRE_EQUAL(NDFFTWindow(NDFFTWindowHann, 16, &window[0]), ND_SUCCESS);
+  // The periodic window starts at 0, peaks at n/2 and is symmetric around it
+  BOOST_CHECK_SMALL(window[0], 1e-15);
+  BOOST_CHECK_CLOSE(window[8], 1., 1e-12);
+  BOOST_CHECK_CLOSE(window[4], 0.5, 1e-12);
+  for (size_t j=1; j<8; j++) BOOST_CHECK_CLOSE(window[j], window[16 - j], 1e-10);
+  BOOST_REQUIRE_EQUAL(NDFFTWindow(NDFFTWindowBlackman, 16, &window[0]), ND_SUCCESS);
+  BOOST_CHECK_SMALL(window[0], 1e-15);
+  BOOST_CHECK_CLOSE(window[8], 1., 1e-12);
+  NDFFTWindow(NDFFTWindowRectangular, 16, &window[0]);
+  BOOST_CHECK_EQUAL(window[5], 1.);
+  BOOST_CHECK_EQUAL(NDFFTWindow((NDFFTWindow_t)99, 16, &window[0]), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_Welch)
+{
+  // Segments of 24 points overlapping by 9, from a stream added in arrays of various sizes
+  size_t length = 24, overlap = 9, hop = length - overlap, nPoints = 500, numSegments = 4, i, j, k;
+  double sampleRate = 10.;
+  std::vector<double> stream(nPoints), window(length), psd(length/2 + 1);
+
+  for (i=0; i<nPoints; i++) stream[i] = sin(0.7*i) + 0.3*cos(2.1*i) + (double)(i % 3);
+  NDFFTWindow(NDFFTWindowHann, length, &window[0]);
+  double windowPower = 0.;
+  for (j=0; j<length; j++) windowPower += window[j]*window[j];
+  NDFFTWelch_t *pWelch = NDFFTWelchCreate(length, overlap, NDFFTWindowHann);
+  BOOST_REQUIRE(pWelch != NULL);
+
+  size_t added = 0, arraySize = 1, spectra = 0;
+  while (added < nPoints) {
+    size_t n = std::min(arraySize, nPoints - added), used = 0;
+    while (used < n) {
+      used += NDFFTWelchAdd(pWelch, &stream[added + used], n - used, numSegments);
+      if (NDFFTWelchSegments(pWelch) < numSegments) continue;
+      BOOST_REQUIRE_EQUAL(NDFFTWelchPSD(pWelch, sampleRate, &psd[0]), ND_SUCCESS);
+      // The reference averages the segments starting at hop*s
+      for (k=0; k<=length/2; k++) {
+        double sum = 0.;
+        for (size_t s=spectra*numSegments; s<(spectra + 1)*numSegments; s++) {
+          double re = 0., im = 0.;
+          for (j=0; j<length; j++) {
+            double x = stream[s*hop + j] * window[j], theta = -2. * M_PI * (double)(j*k % length) / length;
+            re += x*cos(theta);
+            im += x*sin(theta);
+          }
+          sum += re*re + im*im;
+        }
+        double expected = sum / numSegments / (sampleRate * windowPower) * (((k > 0) && (2*k < length)) ? 2. : 1.);
+        BOOST_CHECK_CLOSE(psd[k], expected, 1e-8);
+      }
+      spectra++;
+    }
+    added += n;
+    arraySize = (arraySize * 7) % 61 + 1;
+  }
+  // The segments of 500 points are the ones starting before 500 - 24
+  BOOST_CHECK_EQUAL(spectra, ((nPoints - length)/hop + 1) / numSegments);
+  BOOST_CHECK_EQUAL(NDFFTWelchPSD(pWelch, sampleRate, &psd[0]), (((nPoints - length)/hop + 1) % numSegments) ?
+                    ND_SUCCESS : ND_ERROR);
+  // After a reset the ring needs a full segment again
+  NDFFTWelchReset(pWelch);
+  BOOST_CHECK_EQUAL(NDFFTWelchAdd(pWelch, &stream[0], length - 1, numSegments), length - 1);
+  BOOST_CHECK_EQUAL(NDFFTWelchSegments(pWelch), 0u);
+  NDFFTWelchAdd(pWelch, &stream[0], 1, numSegments);
+  BOOST_CHECK_EQUAL(NDFFTWelchSegments(pWelch), 1u);
+  NDFFTWelchDestroy(pWelch);
+
+  BOOST_CHECK(NDFFTWelchCreate(16, 16, NDFFTWindowHann) == NULL);
+  BOOST_CHECK(NDFFTWelchCreate(0, 0, NDFFTWindowHann) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  size_t dims[4] = {8, 8, 8, 8};
+  size_t zero[1] = {0};
+
+  BOOST_CHECK(NDFFTPlanAcquire(0, dims) == NULL);
+  BOOST_CHECK(NDFFTPlanAcquire(ND_FFT_MAX_RANK + 1, dims) == NULL);
+  BOOST_CHECK(NDFFTPlanAcquire(1, zero) == NULL);
+  BOOST_CHECK(NDFFTPlanAcquireReal(1, zero) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -183,6 +183,138 @@ BOOST_AUTO_TEST_CASE(test_Capture)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_StripePaths)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const char *expected[] = {"/tmp/NDStripeA/testing_0.5", "/tmp/NDStripeB/testing_1.5", "/tmp/NDStripeA/testing_2.5"};
+
+  // Create a test array
+  std::vector<NDArray*>arrays(1);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Configure the HDF5 plugin to alternate between two directories, which are created
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 1);
+  hdf5->write(NDFileCreateDirString, 1);
+  hdf5->write(NDFileStripePathsString, " /tmp/NDStripeA ; /tmp/NDStripeB/");
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStripeNumPathsString), 2);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Write one frame to each of three files
+  for (int i = 0; i < 3; i++)
+  {
+    hdf5->write(NDFileNumCaptureString, 1);
+    hdf5->write(NDFileCaptureString, 1);
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[0]));
+    hdf5->unlock();
+    BOOST_CHECK_EQUAL(hdf5->readString(NDFullFileNameString), expected[i]);
+    BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStripeIndexString), i % 2);
+  }
+  HDF5FileReader fr(expected[1]);
+  BOOST_CHECK_EQUAL(fr.checkDatasetExists("/entry/data/data"), true);
+
+  // With no directories the files are in FilePath again
+  hdf5->write(NDFileStripePathsString, "");
+  hdf5->write(NDFileNumCaptureString, 1);
+  hdf5->write(NDFileCaptureString, 1);
+  hdf5->lock();
+  BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[0]));
+  hdf5->unlock();
+  BOOST_CHECK_EQUAL(hdf5->readString(NDFullFileNameString), "/tmp/testing_3.5");
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStripeIndexString), -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_ChunkAutoTune)
+{
+  // Frames of 4 columns and 6 rows of 4 bytes: rows of 16 bytes and frames of 96 bytes
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const int targets[]      = {960, 48, 8};
+  const int colChunks[]    = {4, 4, 2};
+  const int rowChunks[]    = {6, 3, 1};
+  const int framesChunks[] = {10, 1, 1};
+
+  std::vector<NDArray*>arrays(1);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  setup_hdf_stream();
+  hdf5->write(str_NDFileHDF5_chunkAutoTune, 1);
+  hdf5->processCallbacks(arrays[0]);
+
+  // Several frames in a chunk, chunks of rows of one frame, and chunks of part of a row
+  for (int i = 0; i < 3; i++)
+  {
+    hdf5->write(str_NDFileHDF5_chunkTargetBytes, targets[i]);
+    hdf5->write(NDFileNumCaptureString, 1);
+    hdf5->write(NDFileCaptureString, 1);
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[0]));
+    hdf5->unlock();
+    BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_nColChunks), colChunks[i]);
+    BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_nRowChunks), rowChunks[i]);
+    BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_nFramesChunks), framesChunks[i]);
+    BOOST_CHECK_GT(hdf5->readDouble(str_NDFileHDF5_chunkAchievedSpeed), 0.0);
+  }
+
+  // The Adapt mode doubles the target after the first file of a series
+  hdf5->write(str_NDFileHDF5_chunkAutoTune, 2);
+  hdf5->write(str_NDFileHDF5_chunkTargetBytes, 1048576);
+  hdf5->write(NDFileNumCaptureString, 1);
+  hdf5->write(NDFileCaptureString, 1);
+  hdf5->lock();
+  BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[0]));
+  hdf5->unlock();
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_chunkTargetBytes), 2097152);
+}
+
+BOOST_AUTO_TEST_CASE(test_ReadFile)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    populateAttributeList(arrays[i]->pAttributeList);
+  }
+
+  // Write a file of 10 frames in chunks of 3 frames
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 0);
+  hdf5->write(str_NDFileHDF5_nFramesChunks, 3);
+  hdf5->processCallbacks(arrays[0]);
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileNumCapturedString), 10);
+
+  // Read it back, a few frames ahead at a time
+  hdf5->write(str_NDFileHDF5_readAhead, 2);
+  hdf5->write(NDReadFileString, 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readNumFrames), 10);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readFrame), 10);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDDataTypeString), NDUInt16);
+  BOOST_CHECK_GT(hdf5->readDouble(str_NDFileHDF5_readSpeed), 0.0);
+
+  // A dataset that is not in the file is an error
+  hdf5->write(str_NDFileHDF5_readDataset, "/entry/data/none");
+  BOOST_CHECK_THROW(hdf5->write(NDReadFileString, 1), AsynException);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readNumFrames), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readFrame), 0);
+}
+
 BOOST_AUTO_TEST_CASE(test_DatasetLayout1)
 {
   size_t tmpdims[] = {10,10};
@@ -25,6 +25,7 @@
 #include "testingutilities.h"
 #include "HDF5FileReader.h"
 #include "NDFileHDF5AttributeDataset.h"
+#include "NDFileHDF5PackedAttributeDataset.h"
 
 BOOST_AUTO_TEST_CASE(test_AttributeOriginalDataset)
 {
@@ -739,3 +740,209 @@ BOOST_AUTO_TEST_CASE(test_AttributeDimensionalDataset)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(test_AttributeBatchedDataset)
+{
+  // Open an HDF5 file for testing
+  std::string filename = "/tmp/test_att.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  // Add a test group.
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  std::tr1::shared_ptr<NDFileHDF5AttributeDataset> adPtr;
+  int dimsize[3] = {3, 4, 5};
+  int chunking[3] = {1, 1, 1};
+
+  // Write 25 frames in batches of 10, so the last batch is only written on close
+  adPtr = std::tr1::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att1", NDAttrInt32));
+  adPtr->setDsetName("dset1");
+  adPtr->setParentGroupName(gname);
+  adPtr->setBatchSize(10);
+  adPtr->createDataset(4);
+  epicsInt32 val1 = 0;
+  for (epicsInt32 index = 0; index < 25; index++){
+    val1 = index * 3;
+    NDAttribute ndAttr("att1", "Test attribute 1", NDAttrSourceFunct, "test", NDAttrInt32, &val1);
+    // Flushing writes the buffer part way through a batch
+    BOOST_CHECK_EQUAL(adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, index == 12 ? 1 : 0), asynSuccess);
+  }
+  BOOST_CHECK_EQUAL(adPtr->closeAttributeDataset(), asynSuccess);
+
+  // Write 60 frames of a 3x4x5 dataset in batches of 7, which wrap around the extra dimensions
+  adPtr = std::tr1::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att2", NDAttrFloat64));
+  adPtr->setDsetName("dset2");
+  adPtr->setParentGroupName(gname);
+  adPtr->setBatchSize(7);
+  adPtr->createDataset(true, 3, dimsize, chunking);
+  epicsFloat64 val2 = 0.0;
+  for (int index = 0; index < 60; index++){
+    val2 = index + 0.5;
+    NDAttribute ndAttr("att2", "Test attribute 2", NDAttrSourceFunct, "test", NDAttrFloat64, &val2);
+    BOOST_CHECK_EQUAL(adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, 0), asynSuccess);
+  }
+  BOOST_CHECK_EQUAL(adPtr->closeAttributeDataset(), asynSuccess);
+
+  // Write index positions out of order and one position twice, the last value must be kept
+  adPtr = std::tr1::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att3", NDAttrInt32));
+  adPtr->setDsetName("dset3");
+  adPtr->setParentGroupName(gname);
+  adPtr->setBatchSize(10);
+  adPtr->createDataset(1);
+  hsize_t positions[5] = {2, 0, 1, 0, 4};
+  for (int index = 0; index < 5; index++){
+    hsize_t offsets[1] = {positions[index]};
+    epicsInt32 val3 = 100 + index;
+    NDAttribute ndAttr("att3", "Test attribute 3", NDAttrSourceFunct, "test", NDAttrInt32, &val3);
+    BOOST_CHECK_EQUAL(adPtr->writeAttributeDataset(hdf5::OnFrame, offsets, &ndAttr, 0, 0), asynSuccess);
+  }
+  BOOST_CHECK_EQUAL(adPtr->closeAttributeDataset(), asynSuccess);
+
+  H5Gclose(group);
+  H5Fclose(file);
+
+  HDF5FileReader fr(filename);
+  std::vector<hsize_t> dims = fr.getDatasetDimensions("/group/dset1");
+  BOOST_REQUIRE_EQUAL(dims.size(), 1);
+  BOOST_CHECK_EQUAL(dims[0], 25);
+  dims = fr.getDatasetDimensions("/group/dset2");
+  BOOST_REQUIRE_EQUAL(dims.size(), 5);
+  BOOST_CHECK_EQUAL(dims[0], 3);
+  BOOST_CHECK_EQUAL(dims[1], 4);
+  BOOST_CHECK_EQUAL(dims[2], 5);
+  dims = fr.getDatasetDimensions("/group/dset3");
+  BOOST_REQUIRE_EQUAL(dims.size(), 1);
+  BOOST_CHECK_EQUAL(dims[0], 5);
+
+  // Read the values back
+  file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(file, -1);
+  epicsInt32 ints[25];
+  hid_t dset = H5Dopen2(file, "/group/dset1", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(H5Dread(dset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ints), 0);
+  H5Dclose(dset);
+  for (int index = 0; index < 25; index++){
+    BOOST_CHECK_EQUAL(ints[index], index * 3);
+  }
+  epicsFloat64 doubles[60];
+  dset = H5Dopen2(file, "/group/dset2", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(H5Dread(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, doubles), 0);
+  H5Dclose(dset);
+  for (int index = 0; index < 60; index++){
+    BOOST_CHECK_EQUAL(doubles[index], index + 0.5);
+  }
+  dset = H5Dopen2(file, "/group/dset3", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(H5Dread(dset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ints), 0);
+  H5Dclose(dset);
+  BOOST_CHECK_EQUAL(ints[0], 103);
+  BOOST_CHECK_EQUAL(ints[1], 102);
+  BOOST_CHECK_EQUAL(ints[2], 100);
+  BOOST_CHECK_EQUAL(ints[3], 0);
+  BOOST_CHECK_EQUAL(ints[4], 104);
+  H5Fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_AttributePackedDataset)
+{
+  // Open an HDF5 file for testing
+  std::string filename = "/tmp/test_att_packed.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  // Pack an 8-bit, a 32-bit and a 64-bit value, so the members are padded in memory
+  epicsUInt8 val1 = 0;
+  epicsInt32 val2 = 0;
+  epicsFloat64 val3 = 0.0;
+  NDAttribute att1("att1", "Test attribute 1", NDAttrSourceFunct, "test1", NDAttrUInt8, &val1);
+  NDAttribute att2("att2", "Test attribute 2", NDAttrSourceFunct, "test2", NDAttrInt32, &val2);
+  NDAttribute att3("att3", "Test attribute 3", NDAttrSourceFunct, "test3", NDAttrFloat64, &val3);
+  NDAttribute att4("att4", "Test attribute 4", NDAttrSourceFunct, "test4", NDAttrString, (void *)"text");
+  BOOST_CHECK(NDFileHDF5PackedAttributeDataset::isPackable(&att1));
+  BOOST_CHECK(NDFileHDF5PackedAttributeDataset::isPackable(&att3));
+  BOOST_CHECK(!NDFileHDF5PackedAttributeDataset::isPackable(&att4));
+
+  // Write 25 frames in batches of 10, so the last batch is only written on close, and leave att2 out of
+  // frame 7, which must store 0
+  std::tr1::shared_ptr<NDFileHDF5PackedAttributeDataset> pdPtr(new NDFileHDF5PackedAttributeDataset(file, "NDAttributes"));
+  pdPtr->setParentGroupName(gname);
+  pdPtr->setBatchSize(10);
+  pdPtr->addMember(&att1);
+  pdPtr->addMember(&att2);
+  pdPtr->addMember(&att3);
+  BOOST_CHECK_EQUAL(pdPtr->getNumMembers(), 3);
+  BOOST_REQUIRE_EQUAL(pdPtr->createDataset(4), asynSuccess);
+  for (int index = 0; index < 25; index++){
+    NDAttributeList list;
+    val1 = (epicsUInt8)index;
+    val2 = index * 3;
+    val3 = index + 0.5;
+    list.add("att1", "Test attribute 1", NDAttrUInt8, &val1);
+    if (index != 7) list.add("att2", "Test attribute 2", NDAttrInt32, &val2);
+    list.add("att3", "Test attribute 3", NDAttrFloat64, &val3);
+    // Flushing writes the buffer part way through a batch
+    BOOST_CHECK_EQUAL(pdPtr->writeAttributeDataset(&list, index == 12 ? 1 : 0), asynSuccess);
+  }
+  BOOST_CHECK_EQUAL(pdPtr->closeAttributeDataset(), asynSuccess);
+  H5Gclose(group);
+  H5Fclose(file);
+
+  HDF5FileReader fr(filename);
+  std::vector<hsize_t> dims = fr.getDatasetDimensions("/group/NDAttributes");
+  BOOST_REQUIRE_EQUAL(dims.size(), 1);
+  BOOST_CHECK_EQUAL(dims[0], 25);
+
+  // Read the members back by name
+  file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(file, -1);
+  hid_t dset = H5Dopen2(file, "/group/NDAttributes", H5P_DEFAULT);
+  BOOST_REQUIRE_GT(dset, -1);
+  hid_t type = H5Dget_type(dset);
+  BOOST_CHECK_EQUAL(H5Tget_class(type), H5T_COMPOUND);
+  BOOST_CHECK_EQUAL(H5Tget_nmembers(type), 3);
+  // The file type has no padding
+  BOOST_CHECK_EQUAL(H5Tget_size(type), 13);
+  H5Tclose(type);
+
+  epicsInt32 ints[25];
+  hid_t memType = H5Tcreate(H5T_COMPOUND, sizeof(epicsInt32));
+  H5Tinsert(memType, "att2", 0, H5T_NATIVE_INT32);
+  BOOST_REQUIRE_GE(H5Dread(dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, ints), 0);
+  H5Tclose(memType);
+  epicsFloat64 doubles[25];
+  memType = H5Tcreate(H5T_COMPOUND, sizeof(epicsFloat64));
+  H5Tinsert(memType, "att3", 0, H5T_NATIVE_DOUBLE);
+  BOOST_REQUIRE_GE(H5Dread(dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, doubles), 0);
+  H5Tclose(memType);
+  epicsUInt8 bytes[25];
+  memType = H5Tcreate(H5T_COMPOUND, sizeof(epicsUInt8));
+  H5Tinsert(memType, "att1", 0, H5T_NATIVE_UINT8);
+  BOOST_REQUIRE_GE(H5Dread(dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, bytes), 0);
+  H5Tclose(memType);
+  for (int index = 0; index < 25; index++){
+    BOOST_CHECK_EQUAL(bytes[index], index);
+    BOOST_CHECK_EQUAL(ints[index], (index == 7) ? 0 : index * 3);
+    BOOST_CHECK_EQUAL(doubles[index], index + 0.5);
+  }
+
+  // The names of the members are stored in order
+  hid_t attr = H5Aopen(dset, "NDAttrNames", H5P_DEFAULT);
+  BOOST_REQUIRE_GT(attr, -1);
+  hid_t strType = H5Aget_type(attr);
+  size_t size = H5Tget_size(strType);
+  std::vector<char> names(3 * size);
+  BOOST_REQUIRE_GE(H5Aread(attr, strType, &names[0]), 0);
+  BOOST_CHECK_EQUAL(std::string(&names[0]), "att1");
+  BOOST_CHECK_EQUAL(std::string(&names[size]), "att2");
+  BOOST_CHECK_EQUAL(std::string(&names[2 * size]), "att3");
+  H5Tclose(strType);
+  H5Aclose(attr);
+  H5Dclose(dset);
+  H5Fclose(file);
+}
@@ -669,3 +669,157 @@ BOOST_AUTO_TEST_CASE(test_PluginExtraDimensions)
 
 }
 
+
+hsize_t getFileFrames(hid_t group, const std::string& dsetname)
+{
+  hsize_t dims[3] = {0, 0, 0};
+  hid_t dset = H5Dopen2(group, dsetname.c_str(), H5P_DEFAULT);
+  hid_t space = H5Dget_space(dset);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  H5Sclose(space);
+  H5Dclose(dset);
+  return dims[0];
+}
+
+BOOST_AUTO_TEST_CASE(test_BlockExtension)
+{
+  // Create ourselves an asyn user
+  asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+
+  // Open an HDF5 file for testing
+  std::string filename = "/tmp/test_dim3.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  // Add a test group.
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  // Now create a dataset of up to 20 frames (20x10x8) that is extended by 8 frames at a time
+  int rank = 3;
+  int dims[3] = {20, 10, 8};
+  NDFileHDF5Dataset *dataset = createTestDataset(rank, dims, pasynUser, group, "test_data");
+  dataset->setExtendBlock(8);
+  hsize_t framesize[3] = {1, 10, 8};
+
+  // The file holds whole blocks of frames while they are written.  As in the plugin,
+  // the dataset is extended before each frame is written.
+  for (int writes = 1; writes <= 11; writes++){
+    dataset->extendDataSet(0);
+    BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+    BOOST_REQUIRE_EQUAL(dataset->dims_[0], writes);
+    BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), (writes <= 8) ? 8 : 16);
+    // Only the writes that start a new block spend time extending the dataset
+    if (writes != 1 && writes != 9) BOOST_CHECK_EQUAL(dataset->getExtendTime(), 0.0);
+  }
+
+  // Closing shrinks the dataset to the frames that were written
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), 11);
+
+  // A block larger than the maximum size of the dataset is limited to it,
+  // and positions may be written in any order
+  dataset = createTestDataset(rank, dims, pasynUser, group, "test_data2");
+  dataset->setExtendBlock(64);
+  hsize_t offsets[1] = {5};
+  BOOST_REQUIRE_EQUAL(dataset->extendDataSet(0, offsets), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data2"), 20);
+  offsets[0] = 2;
+  BOOST_REQUIRE_EQUAL(dataset->extendDataSet(0, offsets), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data2"), 6);
+
+  H5Gclose(group);
+  H5Fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_PlaceFrame)
+{
+  // Create ourselves an asyn user
+  asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+
+  // Open an HDF5 file for testing
+  std::string filename = "/tmp/test_place.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  // Add a test group.
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  // Write the frames of rank 1 of 3 MPI ranks: frames 1, 4 and 7 of the dataset
+  int rank = 3;
+  int dims[3] = {20, 10, 8};
+  NDFileHDF5Dataset *dataset = createTestDataset(rank, dims, pasynUser, group, "test_data");
+  hsize_t framesize[3] = {1, 10, 8};
+  for (int frame = 1; frame < 9; frame += 3){
+    BOOST_REQUIRE_EQUAL(dataset->placeFrame(frame), asynSuccess);
+    BOOST_REQUIRE_EQUAL(dataset->offset_[0], frame);
+    BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+    BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), frame+1);
+  }
+  // An earlier frame does not shrink the dataset
+  BOOST_REQUIRE_EQUAL(dataset->placeFrame(0), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), 8);
+
+  // Frames cannot be placed in a dataset with extra dimensions
+  int dims4[4] = {3, 4, 10, 8};
+  dataset = createTestDataset(4, dims4, pasynUser, group, "test_data2");
+  BOOST_CHECK_EQUAL(dataset->placeFrame(1), asynError);
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+
+  H5Gclose(group);
+  H5Fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_WriteFrames)
+{
+  // Create ourselves an asyn user
+  asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+
+  // Open an HDF5 file for testing
+  std::string filename = "/tmp/test_frames.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  // Add a test group.
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  // Write a frame, then the frames of two frame stacks after it
+  int rank = 3;
+  int dims[3] = {20, 10, 8};
+  NDFileHDF5Dataset *dataset = createTestDataset(rank, dims, pasynUser, group, "test_data");
+  hsize_t framesize[3] = {1, 10, 8};
+  std::vector<char> frames(5*10*8, 1);
+  dataset->extendDataSet(0);
+  BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->writeFrames(&frames[0], H5T_NATIVE_INT8, 5, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->dims_[0], 6);
+  BOOST_REQUIRE_EQUAL(dataset->offset_[0], 5);
+  BOOST_REQUIRE_EQUAL(dataset->writeFrames(&frames[0], H5T_NATIVE_INT8, 3, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), 9);
+  // Frames written one at a time follow the stacks
+  dataset->extendDataSet(0);
+  BOOST_REQUIRE_EQUAL(dataset->offset_[0], 9);
+  BOOST_REQUIRE_EQUAL(dataset->writeFile(parr, H5T_NATIVE_INT8, dataspace, framesize), asynSuccess);
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+  BOOST_REQUIRE_EQUAL(getFileFrames(group, "test_data"), 10);
+
+  // Frames cannot be written together to a dataset with extra dimensions
+  int dims4[4] = {3, 4, 10, 8};
+  hsize_t framesize4[4] = {1, 1, 10, 8};
+  dataset = createTestDataset(4, dims4, pasynUser, group, "test_data2");
+  BOOST_CHECK_EQUAL(dataset->writeFrames(&frames[0], H5T_NATIVE_INT8, 2, framesize4), asynError);
+  BOOST_REQUIRE_EQUAL(dataset->closeDataset(), asynSuccess);
+
+  H5Gclose(group);
+  H5Fclose(file);
+}
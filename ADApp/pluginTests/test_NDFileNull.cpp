@@ -0,0 +1,112 @@
+/*
+ * test_NDFileNull.cpp
+ *
+ *  Tests of the measurements of the NDFileNull plugin.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "AsynPortClientContainer.h"
+#include <NDFileNull.h>
+
+struct NDFileNullTestFixture : public PluginTestFixture
+{
+  NDFileNull *null;
+  boost::shared_ptr<AsynPortClientContainer> client;
+
+  NDFileNullTestFixture()
+    : PluginTestFixture("simNullTest")
+  {
+    std::string testport = pluginPort("Null");
+    null = new NDFileNull(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 2000000);
+    client = connectClient(testport);
+    client->write(NDPluginDriverBlockingCallbacksString, 1);
+  }
+  ~NDFileNullTestFixture()
+  {
+    client.reset();
+    delete null;
+  }
+
+  void send(NDArray *pArray, int uniqueId)
+  {
+    pArray->uniqueId = uniqueId;
+    epicsTimeGetCurrent(&pArray->epicsTS);
+    process(null, pArray);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileNullTests, NDFileNullTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_Checksum)
+{
+  // The Adler-32 checksum of "Wikipedia", as zlib computes it
+  BOOST_CHECK_EQUAL(NDFileNull::checksum("Wikipedia", 9), 0x11E60398u);
+  BOOST_CHECK_EQUAL(NDFileNull::checksum("", 0), 1u);
+
+  // The checksum of more data than can be summed without the modulo
+  std::vector<unsigned char> data(100000, 0xff);
+  epicsUInt32 a = 1, b = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  BOOST_CHECK_EQUAL(NDFileNull::checksum(&data[0], data.size()), (b << 16) | a);
+
+  size_t dims[] = {9};
+  NDArray *pArray = arrayPool->alloc(1, dims, NDUInt8, 0, NULL);
+  memcpy(pArray->pData, "Wikipedia", 9);
+  client->write(NDFileNullChecksumEnableString, 1);
+  send(pArray, 1);
+  BOOST_CHECK_EQUAL((epicsUInt32)client->readInt(NDFileNullChecksumString), 0x11E60398u);
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_UniqueIds)
+{
+  size_t tmpdims[] = {100, 10};
+  std::vector<size_t> dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*> arrays(1);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+
+  // uniqueIds 3 and 4 are skipped, and 3 arrives after 5
+  send(arrays[0], 1);
+  send(arrays[0], 2);
+  send(arrays[0], 5);
+  send(arrays[0], 3);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullNumArraysString), 4);
+  BOOST_CHECK_CLOSE(client->readDouble(NDFileNullMBytesString), 4 * 2000 / 1e6, 1e-6);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullLastUniqueIdString), 5);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullMissingString), 2);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullOutOfOrderString), 1);
+  BOOST_CHECK_GE(client->readDouble(NDFileNullMeanLatencyString), 0.);
+
+  client->write(NDFileNullResetString, 1);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullResetString), 0);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullNumArraysString), 0);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullMissingString), 0);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullOutOfOrderString), 0);
+
+  // The first array after the reset does not count as a gap
+  send(arrays[0], 10);
+  send(arrays[0], 11);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullMissingString), 0);
+  BOOST_CHECK_EQUAL(client->readInt(NDFileNullLastUniqueIdString), 11);
+  arrays[0]->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+/*
+ * test_NDLatencyHistogram.cpp
+ *
+ *  Tests of the latency histograms of NDPluginDriver.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDLatencyHistogram.h>
+
+BOOST_AUTO_TEST_SUITE(NDLatencyHistogramTests)
+
+BOOST_AUTO_TEST_CASE(test_Percentiles)
+{
+  NDLatencyHistogram hist;
+  int i;
+
+  BOOST_CHECK_EQUAL(hist.count(), 0);
+  BOOST_CHECK_EQUAL(hist.percentile(0.5), 0.);
+  // 1 ms to 100 ms in 1 ms steps
+  for (i=1; i<=100; i++) hist.add(i * 1e-3);
+  BOOST_CHECK_EQUAL(hist.count(), 100);
+  BOOST_CHECK_CLOSE(hist.maximum(), 0.1, 1e-6);
+  // The bins are 2^(1/8) wide, so the percentiles are within 9%
+  BOOST_CHECK_CLOSE(hist.percentile(0.50), 0.050, 9.1);
+  BOOST_CHECK_CLOSE(hist.percentile(0.99), 0.099, 9.1);
+  BOOST_CHECK(hist.percentile(0.50) >= 0.050);
+  // The percentiles never exceed the maximum
+  BOOST_CHECK_CLOSE(hist.percentile(1.0), 0.1, 1e-6);
+  // Very short, negative and very long times go in the end bins
+  hist.add(-1.);
+  hist.add(1e-9);
+  hist.add(1e5);
+  BOOST_CHECK_EQUAL(hist.count(), 103);
+  BOOST_CHECK_CLOSE(hist.maximum(), 1e5, 1e-6);
+  BOOST_CHECK(hist.percentile(0.01) <= 1e-6);
+  hist.reset();
+  BOOST_CHECK_EQUAL(hist.count(), 0);
+  BOOST_CHECK_EQUAL(hist.maximum(), 0.);
+}
+
+BOOST_AUTO_TEST_CASE(test_RollingWindow)
+{
+  NDLatencyHistogram hist;
+  int i;
+
+  hist.setWindow(10);
+  for (i=0; i<10; i++) hist.add(1.);
+  BOOST_CHECK_EQUAL(hist.count(), 10);
+  // The next 10 values start a new histogram and the old values are still counted
+  for (i=0; i<10; i++) hist.add(1e-3);
+  BOOST_CHECK_EQUAL(hist.count(), 20);
+  BOOST_CHECK_CLOSE(hist.maximum(), 1., 1e-6);
+  // Then the first 10 values are forgotten
+  hist.add(1e-3);
+  BOOST_CHECK_EQUAL(hist.count(), 11);
+  BOOST_CHECK_CLOSE(hist.maximum(), 1e-3, 1e-6);
+  BOOST_CHECK_CLOSE(hist.percentile(0.99), 1e-3, 1e-6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
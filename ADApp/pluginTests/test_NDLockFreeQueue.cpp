@@ -0,0 +1,152 @@
+/*
+ * test_NDLockFreeQueue.cpp
+ *
+ *  Tests of the lock-free input queue of NDPluginDriver.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDLockFreeQueue.h>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+
+#include <vector>
+
+typedef struct {
+  int producer;
+  int sequence;
+} TestMessage_t;
+
+static const int numProducers = 4;
+static const int numConsumers = 3;
+static const int messagesPerProducer = 20000;
+
+struct QueueStress
+{
+  NDLockFreeQueue *pQueue;
+  int received[numProducers];     // Used by the consumers with the epicsAtomic functions
+  int lastSequence[numConsumers][numProducers];
+  int outOfOrder;
+  int numDone;
+  epicsEventId doneEvent;
+};
+
+static void producerTask(void *pvt)
+{
+  QueueStress *pStress = (QueueStress *)pvt;
+  static int nextProducer = 0;
+  int producer = epicsAtomicIncrIntT(&nextProducer) - 1;
+  producer %= numProducers;
+  for (int i=0; i<messagesPerProducer; i++) {
+    TestMessage_t msg = {producer, i};
+    pStress->pQueue->send(&msg, sizeof(msg));
+  }
+  epicsAtomicIncrIntT(&pStress->numDone);
+  epicsEventSignal(pStress->doneEvent);
+}
+
+static void consumerTask(void *pvt)
+{
+  QueueStress *pStress = (QueueStress *)pvt;
+  static int nextConsumer = 0;
+  int consumer = (epicsAtomicIncrIntT(&nextConsumer) - 1) % numConsumers;
+  TestMessage_t msg;
+  while (1) {
+    pStress->pQueue->receive(&msg, sizeof(msg));
+    if (msg.producer < 0) break;
+    // The messages of each producer arrive at each consumer in the order they were sent
+    if (msg.sequence <= pStress->lastSequence[consumer][msg.producer]) epicsAtomicIncrIntT(&pStress->outOfOrder);
+    pStress->lastSequence[consumer][msg.producer] = msg.sequence;
+    epicsAtomicIncrIntT(&pStress->received[msg.producer]);
+  }
+  epicsAtomicIncrIntT(&pStress->numDone);
+  epicsEventSignal(pStress->doneEvent);
+}
+
+BOOST_AUTO_TEST_SUITE(NDLockFreeQueueTests)
+
+BOOST_AUTO_TEST_CASE(test_Bounded)
+{
+  // The capacity is not a power of 2, so the queue has more slots than it accepts messages
+  NDLockFreeQueue queue(5, sizeof(TestMessage_t));
+  TestMessage_t msg;
+  int i;
+
+  BOOST_CHECK_EQUAL(queue.capacity(), 5);
+  BOOST_CHECK_EQUAL(queue.pending(), 0);
+  BOOST_CHECK_EQUAL(queue.tryReceive(&msg, sizeof(msg)), -1);
+  for (i=0; i<5; i++) {
+    msg.producer = 0;
+    msg.sequence = i;
+    BOOST_CHECK_EQUAL(queue.trySend(&msg, sizeof(msg)), 0);
+  }
+  BOOST_CHECK_EQUAL(queue.pending(), 5);
+  BOOST_CHECK_EQUAL(queue.trySend(&msg, sizeof(msg)), -1);
+  // Messages larger than the slots are rejected
+  char big[64];
+  BOOST_CHECK_EQUAL(queue.trySend(big, sizeof(big)), -1);
+
+  // Messages are received in order, and the slots are reused after they wrap around
+  for (int lap=0; lap<3; lap++) {
+    for (i=0; i<5; i++) {
+      BOOST_REQUIRE_EQUAL(queue.tryReceive(&msg, sizeof(msg)), (int)sizeof(msg));
+      BOOST_CHECK_EQUAL(msg.sequence, lap*5 + i);
+      msg.sequence = (lap+1)*5 + i;
+      BOOST_CHECK_EQUAL(queue.trySend(&msg, sizeof(msg)), 0);
+    }
+  }
+  BOOST_CHECK_EQUAL(queue.pending(), 5);
+  // A send with a timeout gives up if the queue stays full, and succeeds once there is room
+  BOOST_CHECK_EQUAL(queue.send(&msg, sizeof(msg), 0.01), -1);
+  BOOST_REQUIRE_EQUAL(queue.tryReceive(&msg, sizeof(msg)), (int)sizeof(msg));
+  BOOST_CHECK_EQUAL(queue.send(&msg, sizeof(msg), 0.01), 0);
+  BOOST_CHECK_EQUAL(queue.pending(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_MultipleProducersAndConsumers)
+{
+  QueueStress stress;
+  int i, total = 0;
+
+  stress.pQueue = new NDLockFreeQueue(8, sizeof(TestMessage_t));
+  for (i=0; i<numProducers; i++) stress.received[i] = 0;
+  for (i=0; i<numConsumers; i++) {
+    for (int j=0; j<numProducers; j++) stress.lastSequence[i][j] = -1;
+  }
+  stress.outOfOrder = 0;
+  stress.numDone = 0;
+  stress.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+
+  for (i=0; i<numConsumers; i++) {
+    epicsThreadMustCreate("NDLockFreeQueueConsumer", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium), consumerTask, &stress);
+  }
+  for (i=0; i<numProducers; i++) {
+    epicsThreadMustCreate("NDLockFreeQueueProducer", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium), producerTask, &stress);
+  }
+  while (epicsAtomicGetIntT(&stress.numDone) < numProducers) epicsEventWait(stress.doneEvent);
+  // Stop the consumers; they are blocked in receive() by now or soon will be
+  for (i=0; i<numConsumers; i++) {
+    TestMessage_t msg = {-1, 0};
+    stress.pQueue->send(&msg, sizeof(msg));
+  }
+  while (epicsAtomicGetIntT(&stress.numDone) < numProducers + numConsumers) epicsEventWait(stress.doneEvent);
+
+  for (i=0; i<numProducers; i++) {
+    BOOST_CHECK_EQUAL(stress.received[i], messagesPerProducer);
+    total += stress.received[i];
+  }
+  BOOST_CHECK_EQUAL(total, numProducers*messagesPerProducer);
+  BOOST_CHECK_EQUAL(stress.outOfOrder, 0);
+  BOOST_CHECK_EQUAL(stress.pQueue->pending(), 0);
+  epicsEventDestroy(stress.doneEvent);
+  delete stress.pQueue;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,250 @@
+/*
+ * test_NDPeakKernels.cpp
+ *
+ *  Tests of the summed-area tables, thresholding and connected components of NDPluginPeakFinder.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPeakKernels.h>
+
+#include <vector>
+
+/* Finds the peaks of an array in the stripes of NDPluginPeakFinder */
+static int findPeaks(NDDataType_t dataType, const void *pData, size_t sizeX, size_t sizeY, int stripes,
+                     const NDPeakThreshold_t &threshold, int minPixels, std::vector<NDPeak_t> &peaks)
+{
+  std::vector<double> sum((sizeX+1)*(sizeY+1)), squares((sizeX+1)*(sizeY+1));
+  std::vector<NDPeakSpan_t> spans;
+  size_t firstRow, numRows;
+  int stripe, status = ND_SUCCESS;
+
+  for (stripe=0; stripe<stripes; stripe++) {
+    firstRow = sizeY * stripe / stripes;
+    numRows = sizeY * (stripe + 1) / stripes - firstRow;
+    if (NDPeakSummedArea(dataType, pData, sizeX, firstRow, numRows, &sum[0], &squares[0]) != ND_SUCCESS)
+      return ND_ERROR;
+  }
+  for (stripe=1; stripe<stripes; stripe++) {
+    firstRow = sizeY * stripe / stripes;
+    numRows = sizeY * (stripe + 1) / stripes - firstRow;
+    NDPeakSummedAreaAdd(&sum[0], &squares[0], sizeX, firstRow, firstRow + numRows, 1);
+  }
+  for (stripe=1; stripe<stripes; stripe++) {
+    firstRow = sizeY * stripe / stripes;
+    numRows = sizeY * (stripe + 1) / stripes - firstRow;
+    if (numRows > 1) NDPeakSummedAreaAdd(&sum[0], &squares[0], sizeX, firstRow, firstRow + 1, numRows - 1);
+  }
+  for (stripe=0; stripe<stripes; stripe++) {
+    firstRow = sizeY * stripe / stripes;
+    numRows = sizeY * (stripe + 1) / stripes - firstRow;
+    if (NDPeakFindSpans(dataType, pData, sizeX, sizeY, &sum[0], &squares[0], &threshold, firstRow, numRows,
+                        100000, spans) != ND_SUCCESS) status = ND_ERROR;
+  }
+  NDPeakLabelSpans(spans, minPixels, 0, peaks);
+  return status;
+}
+
+/* A background of 100 with uniform noise of +-5 and Gaussian spots of sigma 1.2 */
+static std::vector<epicsUInt16> spots(size_t sizeX, size_t sizeY, int numSpots, const double *spotX,
+                                      const double *spotY, const double *amplitude)
+{
+  std::vector<epicsUInt16> data(sizeX*sizeY);
+  unsigned int seed = 12345;
+  size_t x, y;
+  int i;
+
+  for (y=0; y<sizeY; y++) {
+    for (x=0; x<sizeX; x++) {
+      double value;
+      seed = seed * 1103515245 + 12345;
+      value = 100. + ((seed >> 16) % 11) - 5.;
+      for (i=0; i<numSpots; i++) {
+        double dx = x - spotX[i], dy = y - spotY[i];
+        value += amplitude[i] * exp(-(dx*dx + dy*dy) / (2. * 1.2 * 1.2));
+      }
+      data[y*sizeX + x] = (epicsUInt16)(value + 0.5);
+    }
+  }
+  return data;
+}
+
+static NDPeakThreshold_t defaultThreshold()
+{
+  NDPeakThreshold_t threshold;
+
+  threshold.backgroundRadius = 5;
+  threshold.innerRadius = 2;
+  threshold.snr = 5.;
+  threshold.minSignal = 0.;
+  return threshold;
+}
+
+BOOST_AUTO_TEST_SUITE(NDPeakKernelsTests)
+
+BOOST_AUTO_TEST_CASE(summed_area_stripes_match_direct_sums)
+{
+  size_t sizeX = 13, sizeY = 10, x, y, xx, yy, i;
+  std::vector<epicsInt16> data(sizeX*sizeY);
+  std::vector<double> sum((sizeX+1)*(sizeY+1)), squares((sizeX+1)*(sizeY+1));
+  size_t first[3] = {0, 3, 6}, num[3] = {3, 3, 4};
+
+  for (i=0; i<data.size(); i++) data[i] = (epicsInt16)((int)((i*29) % 41) - 20);
+  for (i=0; i<3; i++) {
+    BOOST_REQUIRE_EQUAL(NDPeakSummedArea(NDInt16, &data[0], sizeX, first[i], num[i], &sum[0], &squares[0]),
+                        ND_SUCCESS);
+  }
+  for (i=1; i<3; i++) NDPeakSummedAreaAdd(&sum[0], &squares[0], sizeX, first[i], first[i]+num[i], 1);
+  for (i=1; i<3; i++) NDPeakSummedAreaAdd(&sum[0], &squares[0], sizeX, first[i], first[i]+1, num[i]-1);
+
+  for (y=0; y<=sizeY; y++) {
+    for (x=0; x<=sizeX; x++) {
+      double s = 0., q = 0.;
+      for (yy=0; yy<y; yy++) {
+        for (xx=0; xx<x; xx++) {
+          double v = data[yy*sizeX + xx];
+          s += v;
+          q += v*v;
+        }
+      }
+      BOOST_CHECK_EQUAL(sum[y*(sizeX+1) + x], s);
+      BOOST_CHECK_EQUAL(squares[y*(sizeX+1) + x], q);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(finds_spots_on_noisy_background)
+{
+  size_t sizeX = 128, sizeY = 96;
+  double spotX[3] = {20.3, 70.0, 101.6}, spotY[3] = {15.5, 48.2, 80.0}, amplitude[3] = {300., 800., 500.};
+  std::vector<epicsUInt16> data = spots(sizeX, sizeY, 3, spotX, spotY, amplitude);
+  std::vector<NDPeak_t> peaks;
+  int order[3] = {1, 2, 0};
+  int i;
+
+  BOOST_REQUIRE_EQUAL(findPeaks(NDUInt16, &data[0], sizeX, sizeY, 1, defaultThreshold(), 2, peaks), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(peaks.size(), 3u);
+  /* The brightest first */
+  for (i=0; i<3; i++) {
+    BOOST_CHECK_SMALL(peaks[i].centroidX - spotX[order[i]], 0.2);
+    BOOST_CHECK_SMALL(peaks[i].centroidY - spotY[order[i]], 0.2);
+    BOOST_CHECK(peaks[i].pixels >= 5);
+    BOOST_CHECK(peaks[i].sigmaX > 0.5 && peaks[i].sigmaX < 1.5);
+    BOOST_CHECK(peaks[i].max > 100. + 0.8*amplitude[order[i]]);
+  }
+  BOOST_CHECK(peaks[0].intensity > peaks[1].intensity);
+  BOOST_CHECK(peaks[1].intensity > peaks[2].intensity);
+}
+
+BOOST_AUTO_TEST_CASE(stripes_find_the_same_peaks)
+{
+  size_t sizeX = 64, sizeY = 61;
+  /* One spot is on the boundary of two of the stripes */
+  double spotX[4] = {10., 30.5, 50., 5.}, spotY[4] = {15., 20., 40.5, 58.}, amplitude[4] = {400., 600., 900., 200.};
+  std::vector<epicsUInt16> data = spots(sizeX, sizeY, 4, spotX, spotY, amplitude);
+  std::vector<NDPeak_t> peaks1, peaks;
+  int stripes;
+  size_t i;
+
+  BOOST_REQUIRE_EQUAL(findPeaks(NDUInt16, &data[0], sizeX, sizeY, 1, defaultThreshold(), 2, peaks1), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(peaks1.size(), 4u);
+  for (stripes=2; stripes<=7; stripes++) {
+    BOOST_REQUIRE_EQUAL(findPeaks(NDUInt16, &data[0], sizeX, sizeY, stripes, defaultThreshold(), 2, peaks),
+                        ND_SUCCESS);
+    BOOST_REQUIRE_EQUAL(peaks.size(), peaks1.size());
+    for (i=0; i<peaks.size(); i++) {
+      BOOST_CHECK_EQUAL(peaks[i].pixels, peaks1[i].pixels);
+      BOOST_CHECK_CLOSE(peaks[i].centroidX, peaks1[i].centroidX, 1e-9);
+      BOOST_CHECK_CLOSE(peaks[i].centroidY, peaks1[i].centroidY, 1e-9);
+      BOOST_CHECK_CLOSE(peaks[i].intensity, peaks1[i].intensity, 1e-9);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(flat_array_has_no_peaks)
+{
+  size_t sizeX = 40, sizeY = 30;
+  std::vector<epicsFloat32> data(sizeX*sizeY, 7.f);
+  std::vector<NDPeak_t> peaks;
+
+  BOOST_REQUIRE_EQUAL(findPeaks(NDFloat32, &data[0], sizeX, sizeY, 3, defaultThreshold(), 1, peaks), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(peaks.size(), 0u);
+}
+
+static NDPeakSpan_t span(int y, int x0, int x1)
+{
+  NDPeakSpan_t s;
+
+  s.y = y;
+  s.x0 = x0;
+  s.x1 = x1;
+  s.signal = x1 - x0 + 1;
+  s.sumX = (x0 + x1) * s.signal / 2.;
+  s.sumY = y * s.signal;
+  s.sumXX = s.sumYY = 0.;
+  s.max = 1.;
+  return s;
+}
+
+BOOST_AUTO_TEST_CASE(spans_join_diagonally_and_not_across_gaps)
+{
+  std::vector<NDPeakSpan_t> spans;
+  std::vector<NDPeak_t> peaks;
+
+  /* In row order: a diagonal of single pixels at x=0 to 2, which is one peak; a U shape at x=10 to 14 whose arms
+   * are joined by its last row, which is one peak; and runs at x=20 to 24 separated by a column gap of one pixel
+   * and by a row gap, which are three peaks */
+  spans.push_back(span(0, 0, 0));
+  spans.push_back(span(0, 10, 10));
+  spans.push_back(span(0, 14, 14));
+  spans.push_back(span(0, 20, 21));
+  spans.push_back(span(0, 23, 24));
+  spans.push_back(span(1, 1, 1));
+  spans.push_back(span(1, 10, 10));
+  spans.push_back(span(1, 14, 14));
+  spans.push_back(span(2, 2, 2));
+  spans.push_back(span(2, 10, 14));
+  spans.push_back(span(4, 20, 21));
+  NDPeakLabelSpans(spans, 1, 0, peaks);
+  BOOST_REQUIRE_EQUAL(peaks.size(), 5u);
+  BOOST_CHECK_EQUAL(peaks[0].pixels, 9.);
+  BOOST_CHECK_CLOSE(peaks[0].centroidX, 12., 1e-9);
+  BOOST_CHECK_EQUAL(peaks[1].pixels, 3.);
+  BOOST_CHECK_CLOSE(peaks[1].centroidY, 1., 1e-9);
+
+  /* The size limits */
+  NDPeakLabelSpans(spans, 3, 3, peaks);
+  BOOST_REQUIRE_EQUAL(peaks.size(), 1u);
+  BOOST_CHECK_EQUAL(peaks[0].pixels, 3.);
+}
+
+BOOST_AUTO_TEST_CASE(span_limit_and_data_type_errors)
+{
+  size_t sizeX = 20, sizeY = 4;
+  std::vector<epicsUInt8> data(sizeX*sizeY, 10);
+  std::vector<double> sum((sizeX+1)*(sizeY+1)), squares((sizeX+1)*(sizeY+1));
+  std::vector<NDPeakSpan_t> spans;
+  NDPeakThreshold_t threshold = defaultThreshold();
+  size_t x;
+
+  /* Isolated pixels in every other column of row 2 */
+  for (x=0; x<sizeX; x+=2) data[2*sizeX + x] = 250;
+  threshold.backgroundRadius = 3;
+  threshold.innerRadius = 0;
+  threshold.snr = 1.;
+  BOOST_REQUIRE_EQUAL(NDPeakSummedArea(NDUInt8, &data[0], sizeX, 0, sizeY, &sum[0], &squares[0]), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(NDPeakFindSpans(NDUInt8, &data[0], sizeX, sizeY, &sum[0], &squares[0], &threshold,
+                                    0, sizeY, 4, spans), ND_ERROR);
+  BOOST_CHECK_EQUAL(spans.size(), 4u);
+  spans.clear();
+  BOOST_CHECK_EQUAL(NDPeakFindSpans(NDUInt8, &data[0], sizeX, sizeY, &sum[0], &squares[0], &threshold,
+                                    0, sizeY, 100, spans), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(spans.size(), 10u);
+  BOOST_CHECK_EQUAL(NDPeakSummedArea(NDUInt12Packed, &data[0], sizeX, 0, sizeY, &sum[0], &squares[0]), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "testingutilities.h"
 
@@ -34,6 +35,15 @@ struct PluginFixture
     asynOctetClient *cbTrigA;
     asynOctetClient *cbTrigB;
     asynOctetClient *cbCalc;
+    asynInt32Client *cbCopyMode;
+    asynInt32Client *cbHeld;
+    asynInt32Client *cbCompress;
+    asynFloat64Client *cbRatio;
+    asynOctetClient *cbSpillFile;
+    asynInt32Client *cbMemoryDepth;
+    asynInt32Client *cbSpilled;
+    asynInt32Client *cbAsyncFlush;
+    asynInt32Client *cbFlushQueued;
 
     PluginFixture()
     {
@@ -67,10 +77,28 @@ struct PluginFixture
         cbTrigA = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerAString);
         cbTrigB = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerBString);
         cbCalc = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerCalcString);
+        cbCopyMode = new asynInt32Client(testport.c_str(), 0, NDCircBuffCopyModeString);
+        cbHeld = new asynInt32Client(testport.c_str(), 0, NDCircBuffHeldArraysString);
+        cbCompress = new asynInt32Client(testport.c_str(), 0, NDCircBuffCompressString);
+        cbRatio = new asynFloat64Client(testport.c_str(), 0, NDCircBuffCompressionRatioString);
+        cbSpillFile = new asynOctetClient(testport.c_str(), 0, NDCircBuffSpillFileString);
+        cbMemoryDepth = new asynInt32Client(testport.c_str(), 0, NDCircBuffMemoryDepthString);
+        cbSpilled = new asynInt32Client(testport.c_str(), 0, NDCircBuffSpilledArraysString);
+        cbAsyncFlush = new asynInt32Client(testport.c_str(), 0, NDCircBuffAsyncFlushString);
+        cbFlushQueued = new asynInt32Client(testport.c_str(), 0, NDCircBuffFlushQueuedString);
 
     }
     ~PluginFixture()
     {
+        delete cbFlushQueued;
+        delete cbAsyncFlush;
+        delete cbSpilled;
+        delete cbMemoryDepth;
+        delete cbSpillFile;
+        delete cbRatio;
+        delete cbCompress;
+        delete cbHeld;
+        delete cbCopyMode;
         delete cbCalc;
         delete cbTrigB;
         delete cbTrigA;
@@ -185,4 +213,192 @@ BOOST_AUTO_TEST_CASE(test_PreBufferOrder)
     BOOST_CHECK_EQUAL(3, ((uint8_t *)ds->arrays[3]->pData)[0]);
 }
 
+BOOST_AUTO_TEST_CASE(test_CopyMode)
+{
+    size_t gotbytes;
+    int held;
+    cbCalc->write("0", 2, &gotbytes);
+
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    size_t dims = 3;
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        memset(testArrays[i]->pData, i, 3);
+    }
+
+    // By default the pre-trigger ring holds the input arrays
+    cbProcess(testArrays[0]);
+    cbProcess(testArrays[1]);
+    cbHeld->read(&held);
+    BOOST_CHECK_EQUAL(held, 2);
+    BOOST_CHECK_EQUAL(testArrays[0]->getReferenceCount(), 2);
+
+    // In copy mode it keeps copies
+    cbCopyMode->write(NDCircBuffCopy);
+    cbProcess(testArrays[2]);
+    cbHeld->read(&held);
+    BOOST_CHECK_EQUAL(held, 2);
+    BOOST_CHECK_EQUAL(testArrays[2]->getReferenceCount(), 1);
+
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[3]);
+
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    BOOST_CHECK(ds->arrays[0] == testArrays[0]);
+    BOOST_CHECK(ds->arrays[1] == testArrays[1]);
+    BOOST_CHECK(ds->arrays[2] != testArrays[2]);
+    BOOST_CHECK_EQUAL(2, ((uint8_t *)ds->arrays[2]->pData)[0]);
+    BOOST_CHECK_EQUAL(3, ((uint8_t *)ds->arrays[3]->pData)[0]);
+}
+
+BOOST_AUTO_TEST_CASE(test_Compress)
+{
+    size_t gotbytes;
+    double ratio;
+    epicsInt32 value;
+    cbCalc->write("0", 2, &gotbytes);
+
+    cbCompress->write(NDCircBuffCompressBitLZ4);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    // Dark 16-bit images larger than one compressed block
+    size_t dims[2] = {1024, 300};
+    NDArray *testArrays[6];
+    for (int i = 0; i < 6; i++) {
+        testArrays[i] = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+        testArrays[i]->uniqueId = i;
+        epicsUInt16 *pData = (epicsUInt16 *)testArrays[i]->pData;
+        for (size_t j = 0; j < dims[0]*dims[1]; j++) pData[j] = (epicsUInt16)(100 + i + (j*7919)%5);
+        value = i;
+        testArrays[i]->pAttributeList->add("Frame", "", NDAttrInt32, &value);
+    }
+
+    // The ring wraps, keeping the last 3 arrays compressed, and does not hold the input arrays
+    for (int i = 0; i < 5; i++) {
+        cbProcess(testArrays[i]);
+    }
+    BOOST_CHECK_EQUAL(testArrays[0]->getReferenceCount(), 1);
+    cbRatio->read(&ratio);
+    BOOST_CHECK(ratio > 2.0);
+
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[5]);
+
+    // The flushed arrays are decompressed copies, oldest first, with their attributes
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        NDArray *pArray = ds->arrays[i];
+        BOOST_CHECK(pArray != testArrays[i + 2]);
+        BOOST_CHECK_EQUAL(pArray->uniqueId, i + 2);
+        BOOST_CHECK_EQUAL(pArray->dataType, NDUInt16);
+        BOOST_REQUIRE_EQUAL(pArray->ndims, 2);
+        BOOST_CHECK_EQUAL(pArray->dims[1].size, dims[1]);
+        BOOST_CHECK(memcmp(pArray->pData, testArrays[i + 2]->pData, dims[0]*dims[1]*sizeof(epicsUInt16)) == 0);
+        NDAttribute *pAttribute = pArray->pAttributeList->find("Frame");
+        BOOST_REQUIRE(pAttribute != NULL);
+        pAttribute->getValue(NDAttrInt32, &value);
+        BOOST_CHECK_EQUAL(value, i + 2);
+    }
+    BOOST_CHECK_EQUAL(5, ds->arrays[3]->uniqueId);
+    cbRatio->read(&ratio);
+    BOOST_CHECK_EQUAL(ratio, 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Spill)
+{
+    size_t gotbytes;
+    int spilled;
+    char spillFile[64];
+    cbCalc->write("0", 2, &gotbytes);
+
+    sprintf(spillFile, "/tmp/NDPluginCircularBuffTest%d", (int)getpid());
+    cbSpillFile->write(spillFile, strlen(spillFile) + 1, &gotbytes);
+    cbMemoryDepth->write(1);
+    cbPreTrigger->write(4);
+
+    size_t dims = 1000;
+    NDArray *testArrays[7];
+    for (int i = 0; i < 7; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        testArrays[i]->uniqueId = i;
+        memset(testArrays[i]->pData, i, dims);
+    }
+
+    // Uncompressed, then compressed, the ring keeps the last array in memory and spills the 3 before it
+    for (int compress = NDCircBuffCompressNone; compress <= NDCircBuffCompressLZ4; compress++) {
+        size_t first = ds->arrays.size();
+        cbCompress->write(compress);
+        cbControl->write(1);
+        for (int i = 0; i < 6; i++) {
+            cbProcess(testArrays[i]);
+        }
+        BOOST_CHECK_EQUAL(access(spillFile, F_OK), 0);
+        cbSpilled->read(&spilled);
+        BOOST_CHECK_EQUAL(spilled, 3);
+
+        cbSoftTrigger->write(1);
+        cbProcess(testArrays[6]);
+
+        // The spilled arrays are read back in order, then the one in memory
+        BOOST_REQUIRE_EQUAL(first + 5, ds->arrays.size());
+        for (int i = 0; i < 4; i++) {
+            NDArray *pArray = ds->arrays[first + i];
+            BOOST_CHECK_EQUAL(pArray->uniqueId, i + 2);
+            BOOST_CHECK_EQUAL((int)((uint8_t *)pArray->pData)[0], i + 2);
+            BOOST_CHECK_EQUAL((int)((uint8_t *)pArray->pData)[dims - 1], i + 2);
+        }
+        BOOST_CHECK_EQUAL(6, ds->arrays[first + 4]->uniqueId);
+        cbSpilled->read(&spilled);
+        BOOST_CHECK_EQUAL(spilled, 0);
+        cbControl->write(0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_AsyncFlush)
+{
+    size_t gotbytes;
+    int i, queued;
+    cbCalc->write("0", 2, &gotbytes);
+
+    cbAsyncFlush->write(1);
+    cbPreTrigger->write(5);
+    cbPostTrigger->write(4);
+
+    size_t dims = 100;
+    NDArray *testArrays[9];
+    for (i = 0; i < 9; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        testArrays[i]->uniqueId = i;
+        memset(testArrays[i]->pData, i, dims);
+    }
+
+    // Held, then compressed, the flush and the post-trigger arrays come out of the drain thread in order
+    for (int compress = NDCircBuffCompressNone; compress <= NDCircBuffCompressLZ4; compress++) {
+        size_t first = ds->arrays.size();
+        cbCompress->write(compress);
+        cbControl->write(1);
+        for (i = 0; i < 5; i++) {
+            cbProcess(testArrays[i]);
+        }
+        cbSoftTrigger->write(1);
+        for (i = 5; i < 9; i++) {
+            cbProcess(testArrays[i]);
+        }
+
+        for (i = 0; (i < 1000) && (ds->arrays.size() < first + 9); i++) epicsThreadSleep(0.001);
+        cbFlushQueued->read(&queued);
+        BOOST_CHECK_EQUAL(queued, 0);
+        BOOST_REQUIRE_EQUAL(first + 9, ds->arrays.size());
+        for (i = 0; i < 9; i++) {
+            NDArray *pArray = ds->arrays[first + i];
+            BOOST_CHECK_EQUAL(pArray->uniqueId, i);
+            BOOST_CHECK_EQUAL((int)((uint8_t *)pArray->pData)[dims - 1], i);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
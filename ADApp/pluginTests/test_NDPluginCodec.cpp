@@ -0,0 +1,148 @@
+/*
+ * test_NDPluginCodec.cpp
+ *
+ *  Tests of the compression and decompression of NDArrays by the NDPluginCodec plugin.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "AsynPortClientContainer.h"
+#include <NDPluginCodec.h>
+
+struct NDPluginCodecTestFixture : public PluginTestFixture
+{
+  NDPluginCodec *compressor;
+  NDPluginCodec *decompressor;
+  TestingPlugin *compressed;
+  TestingPlugin *decompressed;
+  boost::shared_ptr<AsynPortClientContainer> compressClient;
+  boost::shared_ptr<AsynPortClientContainer> decompressClient;
+
+  NDPluginCodecTestFixture()
+    : PluginTestFixture("simCodecTest")
+  {
+    std::string compressPort = pluginPort("Compress"), decompressPort = pluginPort("Decompress");
+
+    compressor = new NDPluginCodec(compressPort.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 2000000, 1);
+    decompressor = new NDPluginCodec(decompressPort.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 2000000, 1);
+    compressed = new TestingPlugin(compressPort.c_str(), 0);
+    decompressed = new TestingPlugin(decompressPort.c_str(), 0);
+    compressClient = connectClient(compressPort);
+    decompressClient = connectClient(decompressPort);
+    decompressClient->write(NDCodecModeString, NDCodecModeDecompress);
+  }
+  ~NDPluginCodecTestFixture()
+  {
+    compressClient.reset();
+    decompressClient.reset();
+    delete compressed;
+    delete decompressed;
+    delete compressor;
+    delete decompressor;
+  }
+
+  void send(NDPluginCodec *pPlugin, NDArray *pArray)
+  {
+    process(pPlugin, pArray);
+  }
+
+  // Compresses an array with the codec and decompresses it again, checking the arrays in between
+  void roundTrip(int codec, NDDataType_t dataType)
+  {
+    size_t tmpdims[] = {256, 64};
+    std::vector<size_t> dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+    std::vector<NDArray*> arrays(1);
+    NDArrayInfo_t arrayInfo;
+
+    fillNDArraysFromPool(dims, dataType, arrays, arrayPool);
+    arrays[0]->getInfo(&arrayInfo);
+    compressClient->write(NDCodecCompressorString, codec);
+    send(compressor, arrays[0]);
+    BOOST_REQUIRE_EQUAL(compressed->arrays.size(), (size_t)1);
+    // The plugin releases its last array when it sends the next one
+    NDArray *pCompressed = compressed->arrays.back();
+    pCompressed->reserve();
+    BOOST_CHECK_EQUAL(compressClient->readInt(NDCodecStatusString), NDCodecStatusSuccess);
+    BOOST_CHECK_EQUAL(pCompressed->codec.name, NDCodecName[codec]);
+    BOOST_CHECK_EQUAL(pCompressed->dataType, dataType);
+    BOOST_CHECK_EQUAL(pCompressed->dims[0].size, dims[0]);
+    BOOST_CHECK_EQUAL(pCompressed->dims[1].size, dims[1]);
+    BOOST_CHECK_GT(pCompressed->compressedSize, (size_t)0);
+    BOOST_CHECK_LT(pCompressed->compressedSize, arrayInfo.totalBytes);
+    BOOST_CHECK_GT(compressClient->readDouble(NDCodecCompFactorString), 1.0);
+
+    // An array that is already compressed is passed on as it is
+    send(compressor, pCompressed);
+    BOOST_CHECK_EQUAL(compressClient->readInt(NDCodecStatusString), NDCodecStatusWarning);
+    BOOST_REQUIRE_EQUAL(compressed->arrays.size(), (size_t)2);
+    BOOST_CHECK_EQUAL(compressed->arrays.back()->codec.name, pCompressed->codec.name);
+    BOOST_REQUIRE_EQUAL(compressed->arrays.back()->compressedSize, pCompressed->compressedSize);
+    BOOST_CHECK_EQUAL(memcmp(compressed->arrays.back()->pData, pCompressed->pData, pCompressed->compressedSize), 0);
+
+    send(decompressor, pCompressed);
+    BOOST_CHECK_EQUAL(decompressClient->readInt(NDCodecStatusString), NDCodecStatusSuccess);
+    BOOST_REQUIRE_EQUAL(decompressed->arrays.size(), (size_t)1);
+    NDArray *pOut = decompressed->arrays.back();
+    BOOST_CHECK(pOut->codec.empty());
+    BOOST_CHECK_EQUAL(pOut->compressedSize, (size_t)0);
+    BOOST_CHECK_EQUAL(pOut->dataType, dataType);
+    BOOST_CHECK_EQUAL(memcmp(pOut->pData, arrays[0]->pData, arrayInfo.totalBytes), 0);
+    pCompressed->release();
+    arrays[0]->release();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginCodecTests, NDPluginCodecTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_LZ4RoundTrip)
+{
+  roundTrip(NDCodecLZ4, NDUInt16);
+}
+
+BOOST_AUTO_TEST_CASE(test_BSLZ4RoundTrip)
+{
+  roundTrip(NDCodecBSLZ4, NDUInt32);
+}
+
+BOOST_AUTO_TEST_CASE(test_Parameters)
+{
+  BOOST_CHECK(NDPluginCodec::compressorSupported(NDCodecNone));
+  BOOST_CHECK(NDPluginCodec::compressorSupported(NDCodecLZ4));
+  BOOST_CHECK(NDPluginCodec::compressorSupported(NDCodecBSLZ4));
+  BOOST_CHECK(!NDPluginCodec::compressorSupported(NDCodecBSLZ4 + 1));
+
+  // Values out of range are refused and the old value is kept
+  compressClient->write(NDCodecCompressorString, NDCodecLZ4);
+  compressClient->write(NDCodecCompressorString, 99);
+  BOOST_CHECK_EQUAL(compressClient->readInt(NDCodecCompressorString), NDCodecLZ4);
+  compressClient->write(NDCodecJPEGQualityString, 0);
+  BOOST_CHECK_EQUAL(compressClient->readInt(NDCodecJPEGQualityString), 85);
+
+  // With no compressor the arrays are passed on unchanged
+  size_t tmpdims[] = {16, 16};
+  std::vector<size_t> dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*> arrays(1);
+  fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  compressClient->write(NDCodecCompressorString, NDCodecNone);
+  send(compressor, arrays[0]);
+  BOOST_REQUIRE_EQUAL(compressed->arrays.size(), (size_t)1);
+  BOOST_CHECK(compressed->arrays.back()->codec.empty());
+  BOOST_CHECK_EQUAL(memcmp(compressed->arrays.back()->pData, arrays[0]->pData, 16 * 16), 0);
+  arrays[0]->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,326 @@
+/*
+ * test_NDPluginDriver.cpp
+ *
+ *  Tests of the selection and queueing of the arrays in NDPluginDriver::driverCallback() and tryQueueArray().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include <NDPluginScatter.h>
+#include <NDPluginCodec.h>
+
+#define NUM_PLUGINS 2
+#define NUM_ARRAYS 12
+
+// A client that is not a plugin, which records the arrays it is passed and their reference counts at the time
+class RecordingClient : public asynGenericPointerClient
+{
+public:
+  RecordingClient(const char *portName)
+    : asynGenericPointerClient(portName, 0, NDArrayDataString)
+  {
+    registerInterruptUser(recordingCallback);
+  }
+  static void recordingCallback(void *drvPvt, asynUser *pasynUser, void *pointer)
+  {
+    RecordingClient *pClient = (RecordingClient *)drvPvt;
+    NDArray *pArray = (NDArray *)pointer;
+
+    pClient->arrays.push_back(pArray);
+    pClient->referenceCounts.push_back(pArray->getReferenceCount());
+  }
+  std::vector<NDArray*> arrays;
+  std::vector<int> referenceCounts;
+};
+
+/** Device memory that is host memory, for the device arrays that the plugins are passed */
+class HostDeviceMemory : public NDDeviceMemory {
+public:
+  void* allocate(size_t size) { return malloc(size); }
+  void free(void *pData, size_t size) { ::free(pData); }
+  const char* name() { return "host device"; }
+  void* createStream() { return this; }
+  void destroyStream(void *stream) {}
+  int toDevice(void *pDevice, const void *pHost, size_t size, void *stream)
+  {
+    memcpy(pDevice, pHost, size);
+    return ND_SUCCESS;
+  }
+  int toHost(void *pHost, const void *pDevice, size_t size, void *stream)
+  {
+    memcpy(pHost, pDevice, size);
+    return ND_SUCCESS;
+  }
+  int copyDevice(void *pTo, const void *pFrom, size_t size, void *stream)
+  {
+    memcpy(pTo, pFrom, size);
+    return ND_SUCCESS;
+  }
+  int waitStream(void *stream, void *otherStream) { return ND_SUCCESS; }
+  int synchronize(void *stream) { return ND_SUCCESS; }
+};
+
+// A plugin that supports none of the packed, sparse, strided or device arrays, which records the arrays that
+// prepareArray() gives it and compares their data with the expected array
+class PreparedArrayPlugin : public NDPluginDriver
+{
+public:
+  PreparedArrayPlugin(const char *portName, const char *NDArrayPort)
+    : NDPluginDriver(portName, 1, 1, NDArrayPort, 0, 1, 0, 0,
+                     asynGenericPointerMask, asynGenericPointerMask, 0, 1, 0, 2000000, 1),
+      pExpected(NULL)
+  {
+    connectToArrayPort();
+  }
+  void processCallbacks(NDArray *pArray)
+  {
+    NDArrayInfo_t arrayInfo, expectedInfo;
+
+    NDPluginDriver::beginProcessCallbacks(pArray);
+    pArray->getInfo(&arrayInfo);
+    dataTypes.push_back(pArray->dataType);
+    onDevice.push_back(pArray->pDevice != NULL);
+    contiguous.push_back(pArray->isContiguous());
+    if (pExpected) pExpected->getInfo(&expectedInfo);
+    sameData.push_back(pExpected && (arrayInfo.totalBytes == expectedInfo.totalBytes) &&
+                       (memcmp(pArray->pData, pExpected->pData, arrayInfo.totalBytes) == 0));
+  }
+  NDArrayPool* pool() { return this->pNDArrayPool; }
+  NDArray *pExpected;
+  std::vector<int> dataTypes;
+  std::vector<bool> onDevice;
+  std::vector<bool> contiguous;
+  std::vector<bool> sameData;
+};
+
+// NDPluginScatter has no processing of its own, so the plugins only count the arrays that driverCallback passes them
+struct NDPluginDriverTestFixture : public PluginTestFixture
+{
+  NDPluginScatter *plugins[NUM_PLUGINS];
+  boost::shared_ptr<AsynPortClientContainer> clients[NUM_PLUGINS];
+  std::vector<NDArray*> arrays;
+
+  NDPluginDriverTestFixture()
+    : PluginTestFixture("simDriverTest")
+  {
+    size_t tmpdims[] = {16};
+    std::vector<size_t> dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+    int i;
+
+    for (i=0; i<NUM_PLUGINS; i++) {
+      std::string testport = pluginPort("Driver");
+      plugins[i] = new NDPluginScatter(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+      clients[i] = connectClient(testport);
+      clients[i]->write(NDPluginDriverBlockingCallbacksString, 1);
+    }
+    arrays.resize(NUM_ARRAYS);
+    fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+    for (i=0; i<NUM_ARRAYS; i++) arrays[i]->uniqueId = i;
+  }
+  ~NDPluginDriverTestFixture()
+  {
+    int i;
+
+    for (i=0; i<NUM_ARRAYS; i++) arrays[i]->release();
+    for (i=0; i<NUM_PLUGINS; i++) {
+      clients[i].reset();
+      delete plugins[i];
+    }
+  }
+
+  // Passes an array to a plugin and returns true if the plugin processed it
+  bool processed(int plugin, NDArray *pArray, int *pAuxStatus=NULL)
+  {
+    int arrayCounter = clients[plugin]->readInt(NDArrayCounterString);
+    int auxStatus = callback(plugins[plugin], pArray, pAuxStatus ? *pAuxStatus : asynSuccess);
+    if (pAuxStatus) *pAuxStatus = auxStatus;
+    return clients[plugin]->readInt(NDArrayCounterString) != arrayCounter;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginDriverTests, NDPluginDriverTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_Decimate)
+{
+  std::vector<int> selected[NUM_PLUGINS];
+  int i, plugin, auxStatus;
+
+  // The plugins are passed the arrays in different orders, as when the upstream plugins have their own threads
+  for (plugin=0; plugin<NUM_PLUGINS; plugin++) {
+    clients[plugin]->write(NDPluginDriverDecimateString, 3);
+  }
+  for (i=0; i<NUM_ARRAYS; i++) {
+    if (processed(0, arrays[i])) selected[0].push_back(arrays[i]->uniqueId);
+  }
+  for (i=NUM_ARRAYS-1; i>=0; i--) {
+    if (processed(1, arrays[i])) selected[1].insert(selected[1].begin(), arrays[i]->uniqueId);
+  }
+  BOOST_REQUIRE_EQUAL(selected[0].size(), (size_t)(NUM_ARRAYS/3));
+  BOOST_CHECK_EQUAL_COLLECTIONS(selected[0].begin(), selected[0].end(), selected[1].begin(), selected[1].end());
+  for (i=0; i<(int)selected[0].size(); i++) BOOST_CHECK_EQUAL(selected[0][i], 3*i);
+
+  // A skipped array is not reported as refused for a full queue to a caller that asked not to drop it
+  auxStatus = asynOverflow;
+  BOOST_CHECK(!processed(0, arrays[1], &auxStatus));
+  BOOST_CHECK_EQUAL(auxStatus, asynSuccess);
+  auxStatus = asynOverflow;
+  BOOST_CHECK(processed(0, arrays[3], &auxStatus));
+  BOOST_CHECK_EQUAL(auxStatus, asynSuccess);
+
+  // Decimate=0 or 1 processes every array
+  clients[0]->write(NDPluginDriverDecimateString, 1);
+  for (i=0; i<NUM_ARRAYS; i++) BOOST_CHECK(processed(0, arrays[i]));
+}
+
+BOOST_AUTO_TEST_CASE(test_VetoExpression)
+{
+  std::vector<int> processedIds;
+  epicsInt32 hit;
+  int i, auxStatus;
+
+  // Arrays 10 and 11 have no PeakHit attribute, which vetoes them
+  for (i=0; i<10; i++) {
+    hit = i % 2;
+    arrays[i]->pAttributeList->add("PeakHit", "", NDAttrInt32, &hit);
+  }
+  clients[0]->write(NDPluginDriverVetoExpressionString, std::string("PeakHit == 0"));
+  BOOST_CHECK_EQUAL(clients[0]->readString(NDPluginDriverVetoErrorString), "");
+  for (i=0; i<NUM_ARRAYS; i++) {
+    if (processed(0, arrays[i])) processedIds.push_back(arrays[i]->uniqueId);
+    // The plugin without VetoExpression processes all of them
+    BOOST_CHECK(processed(1, arrays[i]));
+  }
+  BOOST_REQUIRE_EQUAL(processedIds.size(), (size_t)5);
+  for (i=0; i<(int)processedIds.size(); i++) BOOST_CHECK_EQUAL(processedIds[i], 2*i + 1);
+  BOOST_CHECK_EQUAL(clients[0]->readInt(NDPluginDriverVetoedArraysString), NUM_ARRAYS - 5);
+  BOOST_CHECK_EQUAL(clients[1]->readInt(NDPluginDriverVetoedArraysString), 0);
+
+  // A vetoed array is not reported as refused for a full queue to a caller that asked not to drop it
+  auxStatus = asynOverflow;
+  BOOST_CHECK(!processed(0, arrays[0], &auxStatus));
+  BOOST_CHECK_EQUAL(auxStatus, asynSuccess);
+  BOOST_CHECK_EQUAL(clients[0]->readInt(NDPluginDriverVetoedArraysString), NUM_ARRAYS - 4);
+
+  // An expression that does not compile vetoes nothing
+  clients[0]->write(NDPluginDriverVetoExpressionString, std::string("PeakHit =="));
+  BOOST_CHECK(clients[0]->readString(NDPluginDriverVetoErrorString) != "");
+  BOOST_CHECK(processed(0, arrays[0]));
+
+  // Nor does an empty one
+  clients[0]->write(NDPluginDriverVetoedArraysString, 0);
+  clients[0]->write(NDPluginDriverVetoExpressionString, std::string(""));
+  for (i=0; i<NUM_ARRAYS; i++) BOOST_CHECK(processed(0, arrays[i]));
+  BOOST_CHECK_EQUAL(clients[0]->readInt(NDPluginDriverVetoedArraysString), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_DirectQueue)
+{
+  std::string upstreamPort = pluginPort("Upstream");
+  std::string directPort = pluginPort("Direct"), deferredPort = pluginPort("Deferred");
+  NDPluginCodec *upstream;
+  NDPluginScatter *direct, *deferred;
+  boost::shared_ptr<AsynPortClientContainer> upstreamClient, directClient, deferredClient;
+  RecordingClient *recorder;
+  NDArray *pOutput;
+
+  // The upstream plugin passes the arrays on unchanged, with no compressor
+  upstream = new NDPluginCodec(upstreamPort.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 2000000, 1);
+  upstreamClient = connectClient(upstreamPort);
+  upstreamClient->write(NDArrayCallbacksString, 1);
+
+  // The client that is not a plugin is registered before the plugins
+  recorder = new RecordingClient(upstreamPort.c_str());
+
+  // The threads of the downstream plugins are not started, so the arrays stay in their queues.
+  // Only the one with the lock-free queue can be passed the arrays by tryQueueArray().
+  direct = new NDPluginScatter(directPort.c_str(), 10, 0, upstreamPort.c_str(), 0, 0, 0, 0, 2000000);
+  directClient = connectClient(directPort);
+  directClient->write(NDPluginDriverLockFreeQueueString, 1);
+  deferred = new NDPluginScatter(deferredPort.c_str(), 10, 0, upstreamPort.c_str(), 0, 0, 0, 0, 2000000);
+  deferredClient = connectClient(deferredPort);
+  deferredClient->write(NDPluginDriverLockFreeQueueString, 0);
+
+  process(upstream, arrays[0]);
+  BOOST_REQUIRE_EQUAL(recorder->arrays.size(), (size_t)1);
+  pOutput = recorder->arrays[0];
+
+  // The array was on the queue of the direct plugin before the deferred clients were called in the order they
+  // were registered, so the recorder saw every reference but that of the plugin with the message queue
+  BOOST_CHECK_EQUAL(recorder->referenceCounts[0], pOutput->getReferenceCount() - 1);
+
+  // driverCallback() updates QueueFree when it queues an array, tryQueueArray() leaves it to the plugin thread
+  BOOST_CHECK_EQUAL(directClient->readInt(NDPluginDriverQueueFreeString), 10);
+  BOOST_CHECK_EQUAL(deferredClient->readInt(NDPluginDriverQueueFreeString), 9);
+
+  // The started threads empty the queues, which the plugins wait for when they are deleted
+  direct->start();
+  deferred->start();
+  directClient.reset();
+  deferredClient.reset();
+  delete direct;
+  delete deferred;
+  delete recorder;
+  upstreamClient.reset();
+  delete upstream;
+}
+
+BOOST_AUTO_TEST_CASE(test_PrepareDeviceArray)
+{
+  HostDeviceMemory device;
+  NDArrayPool devicePool(0, 0, &device);
+  std::string testport = pluginPort("Prepare");
+  PreparedArrayPlugin *pPlugin;
+  boost::shared_ptr<AsynPortClientContainer> client;
+  size_t dims[2] = {16, 8};
+  NDArray *pIn, *pPacked, *pDevice;
+  epicsUInt16 *pData;
+  size_t i;
+
+  pPlugin = new PreparedArrayPlugin(testport.c_str(), dummy_port.c_str());
+  client = connectClient(testport);
+  client->write(NDPluginDriverBlockingCallbacksString, 1);
+
+  pIn = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pIn);
+  pData = (epicsUInt16 *)pIn->pData;
+  for (i=0; i<dims[0]*dims[1]; i++) pData[i] = (epicsUInt16)((i*293) % 4096);
+  BOOST_REQUIRE_EQUAL(arrayPool->convert(pIn, &pPacked, NDUInt12Packed), ND_SUCCESS);
+  pDevice = devicePool.copy(pPacked, NULL, 1);
+  BOOST_REQUIRE(pDevice);
+  BOOST_REQUIRE(pDevice->pDevice == &device);
+
+  // The host copy of the packed device array is unpacked too
+  pPlugin->pExpected = pIn;
+  callback(pPlugin, pDevice);
+  BOOST_REQUIRE_EQUAL(pPlugin->dataTypes.size(), (size_t)1);
+  BOOST_CHECK_EQUAL(pPlugin->dataTypes[0], (int)NDUInt16);
+  BOOST_CHECK(!pPlugin->onDevice[0]);
+  BOOST_CHECK(pPlugin->contiguous[0]);
+  BOOST_CHECK(pPlugin->sameData[0]);
+
+  // The host copy was released when it was unpacked, and the unpacked array after it was processed
+  BOOST_CHECK(pPlugin->pool()->numBuffers() > 0);
+  BOOST_CHECK_EQUAL(pPlugin->pool()->numFree(), pPlugin->pool()->numBuffers());
+
+  pDevice->release();
+  pPacked->release();
+  pIn->release();
+  client.reset();
+  delete pPlugin;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+/*
+ * test_NDPluginExecutor.cpp
+ *
+ *  Tests of the worker threads that plugins with UseExecutor=1 share.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginExecutor.h>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+
+struct ExecutorCounter
+{
+  NDPluginExecutor *pExecutor;
+  int numRun;             // Only modified with the epicsAtomic functions
+  int numJobs;
+  epicsEventId doneEvent;
+};
+
+static void countJob(void *pvt)
+{
+  ExecutorCounter *pCounter = (ExecutorCounter *)pvt;
+  if (epicsAtomicIncrIntT(&pCounter->numRun) == pCounter->numJobs) epicsEventSignal(pCounter->doneEvent);
+}
+
+typedef struct {
+  ExecutorCounter *pCounter;
+  int remaining;
+} ResubmitJob_t;
+
+static void resubmitJob(void *pvt)
+{
+  ResubmitJob_t *pJob = (ResubmitJob_t *)pvt;
+  ExecutorCounter *pCounter = pJob->pCounter;
+  // A job submitted from a worker goes on the queue of that worker
+  if (pJob->remaining-- > 0) {
+    pCounter->pExecutor->submit(resubmitJob, pJob);
+  }
+  countJob(pCounter);
+}
+
+static void sleepJob(void *pvt)
+{
+  epicsThreadSleep(0.001);
+  countJob(pvt);
+}
+
+BOOST_AUTO_TEST_SUITE(NDPluginExecutorTests)
+
+BOOST_AUTO_TEST_CASE(test_AllJobsRun)
+{
+  ExecutorCounter counter;
+  int i;
+
+  counter.pExecutor = new NDPluginExecutor("testExecutor", 4);
+  counter.numRun = 0;
+  counter.numJobs = 10000;
+  counter.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+  BOOST_CHECK_EQUAL(counter.pExecutor->numThreads(), 4);
+  for (i=0; i<counter.numJobs; i++) counter.pExecutor->submit(countJob, &counter);
+  epicsEventWait(counter.doneEvent);
+  BOOST_CHECK_EQUAL(epicsAtomicGetIntT(&counter.numRun), counter.numJobs);
+  delete counter.pExecutor;
+  epicsEventDestroy(counter.doneEvent);
+}
+
+BOOST_AUTO_TEST_CASE(test_JobsSubmitJobs)
+{
+  ExecutorCounter counter;
+  ResubmitJob_t jobs[8];
+  int i;
+
+  counter.pExecutor = new NDPluginExecutor("testExecutor", 3);
+  counter.numRun = 0;
+  counter.numJobs = 8*101;
+  counter.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+  for (i=0; i<8; i++) {
+    jobs[i].pCounter = &counter;
+    jobs[i].remaining = 100;
+    counter.pExecutor->submit(resubmitJob, &jobs[i]);
+  }
+  epicsEventWait(counter.doneEvent);
+  BOOST_CHECK_EQUAL(epicsAtomicGetIntT(&counter.numRun), counter.numJobs);
+  delete counter.pExecutor;
+  epicsEventDestroy(counter.doneEvent);
+}
+
+BOOST_AUTO_TEST_CASE(test_DestructorRunsQueuedJobs)
+{
+  ExecutorCounter counter;
+  int i;
+
+  counter.pExecutor = new NDPluginExecutor("testExecutor", 2);
+  counter.numRun = 0;
+  counter.numJobs = 50;
+  counter.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+  for (i=0; i<counter.numJobs; i++) counter.pExecutor->submit(sleepJob, &counter);
+  delete counter.pExecutor;
+  BOOST_CHECK_EQUAL(epicsAtomicGetIntT(&counter.numRun), counter.numJobs);
+  epicsEventDestroy(counter.doneEvent);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
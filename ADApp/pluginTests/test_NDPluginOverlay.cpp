@@ -256,5 +256,97 @@ BOOST_AUTO_TEST_CASE(basic_overlay_operation)
   }
 }
 
+BOOST_AUTO_TEST_CASE(in_place_overlay)
+{
+  // A cross at 500,500 of size 50 sets the pixel at its center, 525,525
+  overlayTestCaseStr *pStr = &overlayTestCaseStrs[0];
+  NDArray *pArray = pStr->pArrays[0];
+  size_t center = 525*1024 + 525;
+
+  Overlay->write(NDPluginOverlayUseString,       1,               pStr->overlayNum);
+  Overlay->write(NDPluginOverlayPositionXString, pStr->positionX, pStr->overlayNum);
+  Overlay->write(NDPluginOverlayPositionYString, pStr->positionY, pStr->overlayNum);
+  Overlay->write(NDPluginOverlaySizeXString,     pStr->sizeX,     pStr->overlayNum);
+  Overlay->write(NDPluginOverlaySizeYString,     pStr->sizeY,     pStr->overlayNum);
+  Overlay->write(NDPluginOverlayWidthXString,    pStr->widthX,    pStr->overlayNum);
+  Overlay->write(NDPluginOverlayWidthYString,    pStr->widthY,    pStr->overlayNum);
+  Overlay->write(NDPluginOverlayShapeString,     pStr->shape,     pStr->overlayNum);
+  Overlay->write(NDPluginOverlayDrawModeString,  pStr->drawMode,  pStr->overlayNum);
+  Overlay->write(NDPluginOverlayGreenString,     pStr->green,     pStr->overlayNum);
+  Overlay->write(NDArrayCallbacksString, 1);
+  // The test holds the reference that the queue would hold with non-blocking callbacks
+  Overlay->write(NDPluginDriverBlockingCallbacksString, 0);
+
+  // The array has another holder, so the overlay is drawn into a copy
+  pArray->reserve();
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  pArray->release();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), (size_t)1);
+  BOOST_CHECK(downstream_plugin->arrays.back() != pArray);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)downstream_plugin->arrays.back()->pData)[center], 255.);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)pArray->pData)[center], 0.);
+
+  // Now the plugin holds all of the references, so the overlay is drawn into the array itself
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), (size_t)2);
+  BOOST_CHECK_EQUAL(downstream_plugin->arrays.back(), pArray);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)pArray->pData)[center], 255.);
+
+  // With no overlay in use the array is passed on without being copied
+  Overlay->write(NDPluginOverlayUseString, 0, pStr->overlayNum);
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), (size_t)3);
+  BOOST_CHECK_EQUAL(downstream_plugin->arrays.back()->pData, pArray->pData);
+}
+BOOST_AUTO_TEST_CASE(time_stamp_text_overlay)
+{
+  NDArray *pArray = overlayTestCaseStrs[0].pArrays[0];
+  NDArrayInfo_t arrayInfo;
+
+  pArray->getInfo(&arrayInfo);
+  Overlay->write(NDPluginOverlayUseString,       1);
+  Overlay->write(NDPluginOverlayShapeString,     NDOverlayText);
+  Overlay->write(NDPluginOverlayDrawModeString,  NDOverlaySet);
+  Overlay->write(NDPluginOverlayPositionXString, 100);
+  Overlay->write(NDPluginOverlayPositionYString, 100);
+  Overlay->write(NDPluginOverlaySizeXString,     100);
+  Overlay->write(NDPluginOverlaySizeYString,     20);
+  Overlay->write(NDPluginOverlayFontString,      2);
+  Overlay->write(NDPluginOverlayGreenString,     255);
+  Overlay->write(NDPluginOverlayDisplayTextString, std::string("T"));
+  Overlay->write(NDPluginOverlayTimeStampFormatString, std::string("%S"));
+  Overlay->write(NDArrayCallbacksString, 1);
+
+  // Only the last digit of the time stamp text changes between these arrays
+  pArray->epicsTS.secPastEpoch = 1;
+  pArray->epicsTS.nsec = 0;
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  pArray->epicsTS.secPastEpoch = 2;
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), (size_t)2);
+  NDArray *pTimeStamped = downstream_plugin->arrays.back();
+  pTimeStamped->reserve();
+
+  // It must be drawn the same as the text of the second array is drawn from scratch
+  Overlay->write(NDPluginOverlayTimeStampFormatString, std::string(""));
+  Overlay->write(NDPluginOverlayDisplayTextString, std::string("T02"));
+  Overlay->lock();
+  Overlay->processCallbacks(pArray);
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), (size_t)3);
+  BOOST_CHECK_EQUAL(memcmp(downstream_plugin->arrays.back()->pData, pTimeStamped->pData, arrayInfo.totalBytes), 0);
+  BOOST_CHECK(memcmp(pArray->pData, pTimeStamped->pData, arrayInfo.totalBytes) != 0);
+  pTimeStamped->release();
+}
 
 BOOST_AUTO_TEST_SUITE_END() // Done!
@@ -260,4 +260,51 @@ BOOST_AUTO_TEST_CASE(basic_roi_operation)
 }
 
 
+BOOST_AUTO_TEST_CASE(multiple_rois)
+{
+  // Each ROI of a plugin is output on its own address
+  std::string testport("TS");
+  uniqueAsynPortName(testport);
+  boost::shared_ptr<ROIPluginWrapper> rois(new ROIPluginWrapper(testport.c_str(), 50, 1, driver->portName,
+                                                                0, 0, 0, 2000000, 1, 2));
+  TestingPlugin* downstream[2]; // leaked like downstream_plugin
+  int start[2][2] = {{0, 0}, {5, 5}};
+  int size[2][2]  = {{4, 2}, {3, 5}};
+  int addr;
+
+  rois->start();
+  rois->write(NDPluginDriverEnableCallbacksString, 1);
+  rois->write(NDPluginDriverBlockingCallbacksString, 1);
+  rois->write(NDArrayCallbacksString, 1);
+  for (addr=0; addr<2; addr++) {
+    downstream[addr] = new TestingPlugin(testport.c_str(), addr);
+    rois->write(NDPluginROIUseString,         1,                addr);
+    rois->write(NDPluginROIDim0MinString,     start[addr][0],   addr);
+    rois->write(NDPluginROIDim0SizeString,    size[addr][0],    addr);
+    rois->write(NDPluginROIDim0EnableString,  1,                addr);
+    rois->write(NDPluginROIDim0BinString,     1,                addr);
+    rois->write(NDPluginROIDim1MinString,     start[addr][1],   addr);
+    rois->write(NDPluginROIDim1SizeString,    size[addr][1],    addr);
+    rois->write(NDPluginROIDim1EnableString,  1,                addr);
+    rois->write(NDPluginROIDim1BinString,     1,                addr);
+  }
+
+  // The 10x10 input of the first test case
+  rois->lock();
+  BOOST_CHECK_NO_THROW(rois->processCallbacks(ROITestCaseStrs[0].pArrays[0]));
+  rois->unlock();
+
+  for (addr=0; addr<2; addr++) {
+    BOOST_MESSAGE("  ROI " << addr);
+    BOOST_REQUIRE_EQUAL(downstream[addr]->arrays.size(), 1);
+    BOOST_REQUIRE_EQUAL(downstream[addr]->arrays.back()->ndims, 2);
+    BOOST_CHECK_EQUAL(downstream[addr]->arrays.back()->dims[0].size, size[addr][0]);
+    BOOST_CHECK_EQUAL(downstream[addr]->arrays.back()->dims[1].size, size[addr][1]);
+    BOOST_CHECK_EQUAL(rois->readInt(NDArraySizeXString, addr), size[addr][0]);
+    BOOST_CHECK_EQUAL(rois->readInt(NDArraySizeYString, addr), size[addr][1]);
+  }
+  BOOST_CHECK(downstream[0]->arrays.back() != downstream[1]->arrays.back());
+}
+
+
 BOOST_AUTO_TEST_SUITE_END() // Done!
@@ -0,0 +1,149 @@
+/*
+ * test_NDPluginROIStat.cpp
+ *
+ *  Tests of the elements of the ellipse, annulus and mask ROIs of the NDPluginROIStat plugin.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include <NDPluginROIStat.h>
+
+#define ARRAY_SIZE 20
+
+// The elements of the array are all 1, so the total of an ROI is its number of elements
+struct NDPluginROIStatTestFixture : public PluginTestFixture
+{
+  NDPluginROIStat *roiStat;
+  boost::shared_ptr<AsynPortClientContainer> client;
+  boost::shared_ptr<asynInt8ArrayClient> maskClient;
+  NDArray *pArray;
+
+  NDPluginROIStatTestFixture()
+    : PluginTestFixture("simROIStatTest")
+  {
+    std::string testport = pluginPort("ROIStat");
+    size_t dims[2] = {ARRAY_SIZE, ARRAY_SIZE};
+
+    roiStat = new NDPluginROIStat(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 1, 0, 0, 0, 2000000, 1);
+    client = connectClient(testport);
+    maskClient = boost::shared_ptr<asynInt8ArrayClient>(new asynInt8ArrayClient(testport.c_str(), 0,
+                                                                                 NDPluginROIStatMaskString));
+    client->write(NDPluginROIStatUseString, 1);
+
+    pArray = arrayPool->alloc(2, dims, NDUInt8, 0, NULL);
+    memset(pArray->pData, 1, ARRAY_SIZE*ARRAY_SIZE);
+  }
+  ~NDPluginROIStatTestFixture()
+  {
+    pArray->release();
+    maskClient.reset();
+    client.reset();
+    delete roiStat;
+  }
+
+  void setRectangle(int minX, int minY, int sizeX, int sizeY)
+  {
+    client->write(NDPluginROIStatDim0MinString,  minX);
+    client->write(NDPluginROIStatDim1MinString,  minY);
+    client->write(NDPluginROIStatDim0SizeString, sizeX);
+    client->write(NDPluginROIStatDim1SizeString, sizeY);
+  }
+
+  void setAnnulus(double radiusMin, double radiusMax)
+  {
+    client->write(NDPluginROIStatShapeString, ROIShapeAnnulus);
+    client->write(NDPluginROIStatCenterXString, 10.);
+    client->write(NDPluginROIStatCenterYString, 10.);
+    client->write(NDPluginROIStatRadiusMinString, radiusMin);
+    client->write(NDPluginROIStatRadiusMaxString, radiusMax);
+  }
+
+  // Processes the array and returns the number of elements of the ROI, checking that its total agrees
+  int numElements()
+  {
+    int elements;
+
+    process(roiStat, pArray);
+    elements = client->readInt(NDPluginROIStatMaskElementsString);
+    BOOST_CHECK_EQUAL(client->readDouble(NDPluginROIStatTotalString), (double)elements);
+    return elements;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginROIStatTests, NDPluginROIStatTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_Rectangle)
+{
+  setRectangle(2, 3, 4, 5);
+  BOOST_CHECK_EQUAL(numElements(), 4*5);
+}
+
+BOOST_AUTO_TEST_CASE(test_Ellipse)
+{
+  // The elements of a 5x5 rectangle within 2.5 of its center: rows of 3, 5, 5, 5 and 3
+  setRectangle(0, 0, 5, 5);
+  client->write(NDPluginROIStatShapeString, ROIShapeEllipse);
+  BOOST_CHECK_EQUAL(numElements(), 21);
+
+  // The ellipse is in the rectangle after it is clipped to the array, so it is whole again
+  setRectangle(15, 15, 10, 10);
+  BOOST_CHECK_EQUAL(numElements(), 21);
+}
+
+BOOST_AUTO_TEST_CASE(test_Annulus)
+{
+  // Distances of 1 and sqrt(2) from the center; RadiusMin is in the annulus and RadiusMax is not
+  setAnnulus(1., 2.);
+  BOOST_CHECK_EQUAL(numElements(), 8);
+
+  // Distances of 2, sqrt(5) and sqrt(8), so the adjacent rings share no elements and together make the wider one
+  setAnnulus(2., 3.);
+  BOOST_CHECK_EQUAL(numElements(), 16);
+  setAnnulus(1., 3.);
+  BOOST_CHECK_EQUAL(numElements(), 8 + 16);
+
+  // The annulus is clipped to the array, not to the rectangle
+  client->write(NDPluginROIStatCenterXString, 0.);
+  BOOST_CHECK_EQUAL(numElements(), 14);
+}
+
+BOOST_AUTO_TEST_CASE(test_Mask)
+{
+  epicsInt8 mask[16];
+
+  // A 4x4 mask that selects the first two elements of its first row and the second one of its second row
+  memset(mask, 0, sizeof(mask));
+  mask[0] = mask[1] = mask[5] = 1;
+  maskClient->write(mask, 16);
+  client->write(NDPluginROIStatShapeString, ROIShapeMask);
+  setRectangle(0, 0, 4, 4);
+  BOOST_CHECK_EQUAL(numElements(), 3);
+
+  // Clipped to 2x2 at the corner of the array, the rows of the mask keep their length of 4
+  setRectangle(ARRAY_SIZE-2, ARRAY_SIZE-2, 4, 4);
+  BOOST_CHECK_EQUAL(numElements(), 3);
+  BOOST_CHECK_EQUAL(client->readInt(NDPluginROIStatDim0SizeString), 2);
+  // The next array has the same ROI, although the clipped size was written back
+  BOOST_CHECK_EQUAL(numElements(), 3);
+
+  // The elements the mask does not reach are outside the ROI
+  maskClient->write(mask, 2);
+  setRectangle(0, 0, 4, 4);
+  BOOST_CHECK_EQUAL(numElements(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,126 @@
+/*
+ * test_NDPluginStdArrays.cpp
+ *
+ *  Tests of the converted and downsampled waveforms of the NDPluginStdArrays plugin.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "AsynPortClientContainer.h"
+#include <NDPluginStdArrays.h>
+
+struct NDPluginStdArraysTestFixture : public PluginTestFixture
+{
+  NDPluginStdArrays *stdArrays;
+  boost::shared_ptr<AsynPortClientContainer> client;
+  boost::shared_ptr<asynInt16ArrayClient> int16Data;
+  boost::shared_ptr<asynFloat64ArrayClient> float64Data;
+  boost::shared_ptr<asynInt32ArrayClient> dimensions;
+
+  NDPluginStdArraysTestFixture()
+    : PluginTestFixture("simStdArraysTest")
+  {
+    std::string testport = pluginPort("StdArrays");
+
+    stdArrays = new NDPluginStdArrays(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 2000000, 1);
+    client = connectClient(testport);
+    int16Data = boost::shared_ptr<asynInt16ArrayClient>(new asynInt16ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString));
+    float64Data = boost::shared_ptr<asynFloat64ArrayClient>(new asynFloat64ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString));
+    dimensions = boost::shared_ptr<asynInt32ArrayClient>(new asynInt32ArrayClient(testport.c_str(), 0, NDDimensionsString));
+  }
+  ~NDPluginStdArraysTestFixture()
+  {
+    int16Data.reset();
+    float64Data.reset();
+    dimensions.reset();
+    client.reset();
+    delete stdArrays;
+  }
+
+  // Sends a 16x8 UInt16 image whose pixels are x + 16*y
+  void sendImage()
+  {
+    size_t dims[2] = {16, 8};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    int i;
+
+    for (i=0; i<16*8; i++) pData[i] = (epicsUInt16)i;
+    process(stdArrays, pArray);
+    pArray->release();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStdArraysTests, NDPluginStdArraysTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_ReadConverted)
+{
+  std::vector<epicsInt16> int16Values(256, -1);
+  std::vector<epicsFloat64> float64Values(256, -1.);
+  size_t nIn = 0;
+  int i;
+
+  sendImage();
+  BOOST_REQUIRE_EQUAL(int16Data->read(&int16Values[0], int16Values.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, (size_t)(16*8));
+  for (i=0; i<16*8; i++) BOOST_CHECK_EQUAL(int16Values[i], i);
+
+  // A second read, and a read of another type, return the same array
+  BOOST_REQUIRE_EQUAL(int16Data->read(&int16Values[0], int16Values.size(), &nIn), asynSuccess);
+  BOOST_CHECK_EQUAL(int16Values[127], 127);
+  BOOST_REQUIRE_EQUAL(float64Data->read(&float64Values[0], float64Values.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, (size_t)(16*8));
+  BOOST_CHECK_EQUAL(float64Values[100], 100.);
+
+  // Fewer elements than the array are read from its start
+  BOOST_REQUIRE_EQUAL(int16Data->read(&int16Values[0], 10, &nIn), asynSuccess);
+  BOOST_CHECK_EQUAL(nIn, (size_t)10);
+}
+
+BOOST_AUTO_TEST_CASE(test_Downsample)
+{
+  std::vector<epicsFloat64> values(256, -1.);
+  epicsInt32 dims[ND_ARRAY_MAX_DIMS];
+  size_t nIn = 0;
+
+  // Only 1, 2 and 4 are allowed
+  client->write(NDPluginStdArraysDownsampleString, 3);
+  BOOST_CHECK_EQUAL(client->readInt(NDPluginStdArraysDownsampleString), 1);
+  client->write(NDPluginStdArraysDownsampleString, 2);
+  BOOST_CHECK_EQUAL(client->readInt(NDPluginStdArraysDownsampleString), 2);
+
+  sendImage();
+  BOOST_REQUIRE_EQUAL(float64Data->read(&values[0], values.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, (size_t)(8*4));
+  // The bins are averaged in the UInt16 type of the image: (0 + 1 + 16 + 17) / 4, and the last bin
+  BOOST_CHECK_EQUAL(values[0], 8.);
+  BOOST_CHECK_EQUAL(values[8*4-1], 118.);
+
+  // The dimensions are those of the binned image
+  BOOST_REQUIRE_EQUAL(dimensions->read(dims, ND_ARRAY_MAX_DIMS, &nIn), asynSuccess);
+  BOOST_CHECK_EQUAL(dims[0], 8);
+  BOOST_CHECK_EQUAL(dims[1], 4);
+
+  client->write(NDPluginStdArraysDownsampleString, 1);
+  sendImage();
+  BOOST_REQUIRE_EQUAL(dimensions->read(dims, ND_ARRAY_MAX_DIMS, &nIn), asynSuccess);
+  BOOST_CHECK_EQUAL(dims[0], 16);
+  BOOST_CHECK_EQUAL(dims[1], 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
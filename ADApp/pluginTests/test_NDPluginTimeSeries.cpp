@@ -39,6 +39,15 @@ void TS_callback(void *userPvt, asynUser *pasynUser, void *pointer)
   callbackCount++;
 }
 
+// Keeps the arrays of signal 0, which the plugin publishes as views of its circular buffer
+static std::vector<NDArray*> heldArrays;
+static void TS_holdCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+{
+  NDArray *pArray = (NDArray *)pointer;
+  pArray->reserve();
+  heldArrays.push_back(pArray);
+}
+
 struct TimeSeriesPluginTestFixture
 {
   NDArrayPool *arrayPool;
@@ -52,6 +61,7 @@ struct TimeSeriesPluginTestFixture
   std::vector<size_t>dims_2d;
   std::vector<NDArray*>arrays_3d;
   std::vector<size_t>dims_3d;
+  std::string testport;
 
   static int testCase;
 
@@ -61,7 +71,8 @@ struct TimeSeriesPluginTestFixture
 
     // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers
     // (even if only one is ever instantiated at once), so we change it slightly for each test case.
-    std::string simport("simTS"), testport("TS");
+    std::string simport("simTS");
+    testport = "TS";
     uniqueAsynPortName(simport);
     uniqueAsynPortName(testport);
 
@@ -340,4 +351,58 @@ BOOST_AUTO_TEST_CASE(trigger_output_NDArray_circular_mode)
 }
 
 
+BOOST_AUTO_TEST_CASE(output_time_order_circular_mode)
+{
+  BOOST_MESSAGE("Checking that the output of Circular Mode is in time order and is not modified by later points");
+
+  std::vector<NDArray*> arrays(3);
+  fillNDArraysFromPool(dims_2d, NDFloat32, arrays, arrayPool);
+  // Signal s of time point t is 1000*s + t
+  for (size_t k = 0; k < arrays.size(); k++)
+  {
+    epicsFloat32 *pData = (epicsFloat32 *)arrays[k]->pData;
+    for (size_t t = 0; t < 20; t++)
+      for (size_t s = 0; s < 3; s++)
+        pData[t*3 + s] = (epicsFloat32)(1000*s + 20*k + t);
+  }
+  asynGenericPointerClient holdClient(testport.c_str(), 0, NDArrayDataString);
+  holdClient.registerInterruptUser(&TS_holdCallback);
+  heldArrays.clear();
+
+  BOOST_REQUIRE_NO_THROW(ts->write(TSAveragingTimeString, 0.001));
+  BOOST_REQUIRE_NO_THROW(ts->write(TSNumPointsString, 30));
+  BOOST_REQUIRE_EQUAL(ts->readInt(TSNumAverageString), 1);
+  BOOST_CHECK_NO_THROW(ts->write(NDArrayCallbacksString, 1));
+  BOOST_CHECK_NO_THROW(ts->write(TSAcquireModeString, 1)); // TSAcquireModeCircular=1
+  BOOST_CHECK_NO_THROW(ts->write(TSAcquireString, 1));
+
+  for (int i = 0; i < 2; i++)
+  {
+    ts->lock();
+    BOOST_CHECK_NO_THROW(ts->processCallbacks(arrays[i]));
+    ts->unlock();
+  }
+  BOOST_CHECK_EQUAL(ts->readInt(TSCurrentPointString), 10);
+  BOOST_CHECK_NO_THROW(ts->write(TSReadString, 1));
+  // The last array wraps around the buffer, so the held array must not see its points
+  ts->lock();
+  BOOST_CHECK_NO_THROW(ts->processCallbacks(arrays[2]));
+  ts->unlock();
+  BOOST_CHECK_NO_THROW(ts->write(TSReadString, 1));
+
+  BOOST_REQUIRE_EQUAL(heldArrays.size(), 2);
+  for (size_t k = 0; k < heldArrays.size(); k++)
+  {
+    BOOST_REQUIRE_EQUAL(heldArrays[k]->ndims, 1);
+    BOOST_REQUIRE_EQUAL(heldArrays[k]->dims[0].size, 30);
+    epicsFloat32 *pData = (epicsFloat32 *)heldArrays[k]->pData;
+    for (size_t t = 0; t < 30; t++)
+      BOOST_CHECK_EQUAL(pData[t], (epicsFloat32)(10 + 20*k + t));
+    heldArrays[k]->release();
+  }
+  heldArrays.clear();
+  for (size_t k = 0; k < arrays.size(); k++) arrays[k]->release();
+}
+
+
 BOOST_AUTO_TEST_SUITE_END() // Done!
@@ -0,0 +1,92 @@
+/*
+ * test_NDPluginTrace.cpp
+ *
+ *  Tests of the array tracing of NDPluginDriver.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginTrace.h>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+
+#include <string>
+
+static epicsEventId tracerDone;
+
+static void tracerTask(void *)
+{
+  int i;
+  for (i=0; i<10; i++) {
+    NDTraceRecord("TRACE2", NDTraceDequeue, i);
+    NDTraceRecord("TRACE2", NDTraceProcessBegin, i);
+    NDTraceRecord("TRACE2", NDTraceProcessEnd, i);
+  }
+  epicsEventSignal(tracerDone);
+}
+
+static std::string readFile(const char *fileName)
+{
+  std::string contents;
+  char buffer[4096];
+  size_t n;
+  FILE *fp = fopen(fileName, "r");
+
+  if (!fp) return contents;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) contents.append(buffer, n);
+  fclose(fp);
+  return contents;
+}
+
+static int countOf(const std::string &s, const char *pattern)
+{
+  int n = 0;
+  size_t pos = 0;
+  while ((pos = s.find(pattern, pos)) != std::string::npos) {
+    n++;
+    pos += strlen(pattern);
+  }
+  return n;
+}
+
+BOOST_AUTO_TEST_SUITE(NDPluginTraceTests)
+
+BOOST_AUTO_TEST_CASE(test_ChromeTrace)
+{
+  const char *fileName = "test_NDPluginTrace.json";
+  std::string trace;
+  int i;
+
+  // Nothing is recorded until tracing is enabled
+  NDTraceRecord("TRACE1", NDTraceEnqueue, 1000);
+  BOOST_REQUIRE_EQUAL(NDTraceEnable(1, 16), 0);
+  tracerDone = epicsEventMustCreate(epicsEventEmpty);
+  epicsThreadMustCreate("NDTraceTest", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium), tracerTask, 0);
+  for (i=0; i<5; i++) NDTraceRecord("TRACE1", NDTraceEnqueue, i);
+  epicsEventWait(tracerDone);
+  NDTraceEnable(0, 0);
+  NDTraceRecord("TRACE1", NDTraceEnqueue, 2000);
+  BOOST_REQUIRE_EQUAL(NDTraceDump(fileName), 0);
+
+  trace = readFile(fileName);
+  BOOST_CHECK_EQUAL(trace.compare(0, 15, "{\"traceEvents\":"), 0);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"name\":\"enqueue TRACE1\""), 5);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"uniqueId\":1000}"), 0);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"uniqueId\":2000}"), 0);
+  // The other thread kept only its last 16 events; the first is the end of a slice whose beginning was
+  // overwritten, which is not written
+  BOOST_CHECK_EQUAL(countOf(trace, "\"name\":\"TRACE2\""), 10);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"name\":\"dequeue TRACE2\""), 5);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"ph\":\"M\""), 2);
+  BOOST_CHECK_EQUAL(countOf(trace, "\"uniqueId\":9}"), 3);
+  remove(fileName);
+  epicsEventDestroy(tracerDone);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
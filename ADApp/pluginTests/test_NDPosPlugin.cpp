@@ -302,4 +302,117 @@ BOOST_AUTO_TEST_CASE(test_LoadingDataPoints)
   BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentQty), 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_DifferentDimensions)
+{
+  // The second set of positions has a dimension the first does not, and lacks one that it has
+  pos->write(str_NDPos_Filename, "<pos_layout>\
+  <dimensions><dimension name=\"x\"></dimension><dimension name=\"y\"></dimension></dimensions>\
+  <positions>\
+    <position x=\"0\" y=\"10\"></position>\
+    <position x=\"1\" y=\"11\"></position>\
+    <position x=\"2\" y=\"12\"></position>\
+    <position x=\"3\" y=\"13\"></position>\
+  </positions>\
+  </pos_layout>");
+  pos->write(str_NDPos_Filename, "<pos_layout>\
+  <dimensions><dimension name=\"z\"></dimension><dimension name=\"x\"></dimension></dimensions>\
+  <positions>\
+    <position z=\"20\" x=\"4\"></position>\
+    <position z=\"21\" x=\"5\"></position>\
+  </positions>\
+  </pos_layout>");
+  BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentQty), 6);
+
+  size_t tmpdims[] = {10,10};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(6);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_Mode, 0));
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_Running, 1));
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_ExpectedID, 0));
+  for (int i = 0; i < 6; i++)
+  {
+    arrays[i]->uniqueId = i;
+    pos->lock();
+    BOOST_CHECK_NO_THROW(pos->processCallbacks(arrays[i]));
+    pos->unlock();
+    NDArray *arrayPtr = (NDArray *)cbPtr;
+    NDAttribute *aPtr;
+    int val;
+    aPtr = arrayPtr->pAttributeList->find("x");
+    BOOST_REQUIRE(aPtr != NULL);
+    BOOST_CHECK_NO_THROW(aPtr->getValue(NDAttrInt32, &val));
+    BOOST_CHECK_EQUAL(val, i);
+    if (i < 4){
+      BOOST_CHECK(arrayPtr->pAttributeList->find("z") == NULL);
+      aPtr = arrayPtr->pAttributeList->find("y");
+      BOOST_REQUIRE(aPtr != NULL);
+      BOOST_CHECK_NO_THROW(aPtr->getValue(NDAttrInt32, &val));
+      BOOST_CHECK_EQUAL(val, 10 + i);
+    } else {
+      BOOST_CHECK(arrayPtr->pAttributeList->find("y") == NULL);
+      aPtr = arrayPtr->pAttributeList->find("z");
+      BOOST_REQUIRE(aPtr != NULL);
+      BOOST_CHECK_NO_THROW(aPtr->getValue(NDAttrInt32, &val));
+      BOOST_CHECK_EQUAL(val, 16 + i);
+    }
+    BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentQty), 5 - i);
+  }
+  BOOST_CHECK_EQUAL(pos->readString(str_NDPos_CurrentPos), "[x=5,z=21]");
+  for (int i = 0; i < 6; i++) arrays[i]->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_LoadingCSV)
+{
+  // Create a CSV points file, the first line names the dimensions
+  {
+    std::ofstream out("/tmp/valid_points.csv");
+    out << "# x and y of a 2x2 grid\nx,y\n0,0\n1,0\n\n0,1\n1,1\n";
+  }
+  {
+    std::ofstream out("/tmp/invalid_points.csv");
+    out << "x,y\n0,0\n1\n";
+  }
+  pos->write(str_NDPos_Filename, "/tmp/valid_points.csv");
+  BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_FileValid), 1);
+  BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentQty), 4);
+
+  // A line with too few values is an error, the positions before it are kept
+  BOOST_CHECK_THROW(pos->write(str_NDPos_Filename, "/tmp/invalid_points.csv"), AsynException);
+  BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_FileValid), 0);
+  BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentQty), 5);
+
+  size_t tmpdims[] = {10,10};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(4);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  int xvals[4] = {0,1,0,1};
+  int yvals[4] = {0,0,1,1};
+
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_Mode, 1));
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_Running, 1));
+  BOOST_CHECK_NO_THROW(pos->write(str_NDPos_ExpectedID, 0));
+  for (int i = 0; i < 4; i++)
+  {
+    arrays[i]->uniqueId = i;
+    pos->lock();
+    BOOST_CHECK_NO_THROW(pos->processCallbacks(arrays[i]));
+    pos->unlock();
+    NDArray *arrayPtr = (NDArray *)cbPtr;
+    NDAttribute *aPtr;
+    int val;
+    aPtr = arrayPtr->pAttributeList->find("x");
+    BOOST_REQUIRE(aPtr != NULL);
+    BOOST_CHECK_NO_THROW(aPtr->getValue(NDAttrInt32, &val));
+    BOOST_CHECK_EQUAL(val, xvals[i]);
+    aPtr = arrayPtr->pAttributeList->find("y");
+    BOOST_REQUIRE(aPtr != NULL);
+    BOOST_CHECK_NO_THROW(aPtr->getValue(NDAttrInt32, &val));
+    BOOST_CHECK_EQUAL(val, yvals[i]);
+    BOOST_CHECK_EQUAL(pos->readInt(str_NDPos_CurrentIndex), i + 1);
+  }
+  for (int i = 0; i < 4; i++) arrays[i]->release();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
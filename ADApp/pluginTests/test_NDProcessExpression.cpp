@@ -0,0 +1,110 @@
+/*
+ * test_NDProcessExpression.cpp
+ *
+ *  Tests of the per-element expressions of NDPluginProcess.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDProcessExpression.h>
+
+#include <string>
+#include <vector>
+
+// Evaluates an expression for one element
+static double evaluate(const char *text, double x, double b=0., double f=1., size_t i=0,
+                       const double *pNames=0)
+{
+  NDProcessExpression_t expression;
+  char error[100];
+  double result = 0.;
+
+  BOOST_REQUIRE_MESSAGE(NDProcessExpressionCompile(text, &expression, error, sizeof(error)) == ND_SUCCESS,
+                        text << ": " << error);
+  BOOST_REQUIRE_EQUAL(NDProcessExpressionEvaluate(&expression, &x, &b, &f, i, pNames, &result, 1), ND_SUCCESS);
+  return result;
+}
+
+static std::string compileError(const char *text)
+{
+  NDProcessExpression_t expression;
+  char error[100];
+
+  BOOST_CHECK_EQUAL(NDProcessExpressionCompile(text, &expression, error, sizeof(error)), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDProcessExpressionEvaluate(&expression, 0, 0, 0, 0, 0, 0, 0), ND_ERROR);
+  return error;
+}
+
+BOOST_AUTO_TEST_SUITE(NDProcessExpressionTests)
+
+BOOST_AUTO_TEST_CASE(test_Precedence)
+{
+  BOOST_CHECK_EQUAL(evaluate("1 + 2 * 3", 0.), 7.);
+  BOOST_CHECK_EQUAL(evaluate("(1 + 2) * 3", 0.), 9.);
+  BOOST_CHECK_EQUAL(evaluate("10 - 4 - 3", 0.), 3.);
+  BOOST_CHECK_EQUAL(evaluate("12 / 3 / 2", 0.), 2.);
+  BOOST_CHECK_EQUAL(evaluate("-x^2", 3.), -9.);
+  BOOST_CHECK_EQUAL(evaluate("2^3^2", 0.), 512.);
+  BOOST_CHECK_EQUAL(evaluate("2^-1", 0.), 0.5);
+  BOOST_CHECK_EQUAL(evaluate("1 < 2 == 1", 0.), 1.);
+  BOOST_CHECK_EQUAL(evaluate("x <= 3 && x >= 3", 3.), 1.);
+  BOOST_CHECK_EQUAL(evaluate("x != 3 || !x", 3.), 0.);
+  BOOST_CHECK_EQUAL(evaluate("x > 1 ? x > 2 ? 2 : 1 : 0", 1.5), 1.);
+  BOOST_CHECK_EQUAL(evaluate("1.5e2 + .5", 0.), 150.5);
+}
+
+BOOST_AUTO_TEST_CASE(test_Variables)
+{
+  double names[] = {4., 100.};
+
+  BOOST_CHECK_EQUAL(evaluate("(x - b) * f", 10., 3., 2.), 14.);
+  BOOST_CHECK_EQUAL(evaluate("(x - b) * f > thr ? x : 0", 10., 3., 2., 0, names), 10.);
+  BOOST_CHECK_EQUAL(evaluate("(x - b) * f > thr + limit ? x : 0", 10., 3., 2., 0, names), 0.);
+  BOOST_CHECK_EQUAL(evaluate("i", 0., 0., 1., 17), 17.);
+  BOOST_CHECK_EQUAL(evaluate("min(x, 2) + max(x, 2) + abs(-x) + floor(2.5) + pow(2, 3)", 5.), 22.);
+  BOOST_CHECK_CLOSE(evaluate("sqrt(x) + exp(0) + log(1)", 16.), 5., 1e-12);
+
+  // The attributes are numbered in the order they first appear
+  NDProcessExpression_t expression;
+  BOOST_REQUIRE_EQUAL(NDProcessExpressionCompile("Gain * x + Offset + Gain", &expression, 0, 0), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(expression.nNames, 2);
+  BOOST_CHECK_EQUAL(std::string(expression.names[0]), "Gain");
+  BOOST_CHECK_EQUAL(std::string(expression.names[1]), "Offset");
+}
+
+BOOST_AUTO_TEST_CASE(test_Blocks)
+{
+  // More elements than a block, without a background or flat field
+  size_t n = 3*ND_EXPRESSION_BLOCK + 5, i;
+  std::vector<double> x(n), out(n);
+  NDProcessExpression_t expression;
+
+  for (i=0; i<n; i++) x[i] = (double)(i % 50);
+  BOOST_REQUIRE_EQUAL(NDProcessExpressionCompile("(x - b) * f > 20 ? x + i : -1", &expression, 0, 0), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDProcessExpressionEvaluate(&expression, &x[0], 0, 0, 1000, 0, &out[0], n), ND_SUCCESS);
+  for (i=0; i<n; i++) BOOST_CHECK_EQUAL(out[i], (x[i] > 20) ? x[i] + 1000 + i : -1.);
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  BOOST_CHECK_EQUAL(compileError("x +"), "unexpected end of expression at character 4");
+  BOOST_CHECK_EQUAL(compileError("(x"), "expected ) at character 3");
+  BOOST_CHECK_EQUAL(compileError("x y"), "unexpected character at character 3");
+  BOOST_CHECK_EQUAL(compileError("foo(x)"), "unknown function at character 1");
+  BOOST_CHECK_EQUAL(compileError("min(x)"), "expected , at character 6");
+  BOOST_CHECK_EQUAL(compileError("x = 1"), "unexpected character at character 3");
+  BOOST_CHECK_EQUAL(compileError("a+b2+c+d+e+f2+g+h+k"), "too many attributes at character 19");
+  // Deeper than the stack of a program
+  std::string deep;
+  for (int i=0; i<ND_EXPRESSION_MAX_STACK; i++) deep += "x+(";
+  deep += "x";
+  for (int i=0; i<ND_EXPRESSION_MAX_STACK; i++) deep += ")";
+  BOOST_CHECK_EQUAL(compileError(deep.c_str()).substr(0, 28), "expression nested too deeply");
+  BOOST_CHECK_EQUAL(compileError(std::string(1000, '-').c_str()).substr(0, 28), "expression nested too deeply");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,233 @@
+/*
+ * test_NDProcessKernels.cpp
+ *
+ *  Tests of the vectorized correction kernels of NDPluginProcess.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDProcessKernels.h>
+
+#include <algorithm>
+#include <vector>
+
+// The corrections in the order and precision NDProcessCorrect() documents
+template <typename epicsType>
+static epicsType referenceCorrect(const NDProcessCorrection_t& c, epicsType value, epicsType background,
+                                  epicsType gain, epicsType bias)
+{
+  if (c.enableBackground) value -= background;
+  if (c.enableGain) value = value * gain + bias;
+  if (c.enableOffsetScale) value = (value + (epicsType)c.offset) * (epicsType)c.scale;
+  if (c.enableHighClip && (value > (epicsType)c.highClip)) value = (epicsType)c.highClip;
+  if (c.enableLowClip && (value < (epicsType)c.lowClip)) value = (epicsType)c.lowClip;
+  return value;
+}
+
+template <typename epicsType>
+static void checkCorrect(NDDataType_t dataType, const NDProcessCorrection_t& c)
+{
+  // Not a multiple of the vector width, so the scalar remainder is used
+  size_t n = 1003, i;
+  std::vector<epicsType> input(n), background(n), gain(n), bias(n);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<n; i++) {
+    input[i] = (epicsType)(100 + (i*37) % 900);
+    background[i] = (epicsType)(i % 50);
+    gain[i] = (i % 17 == 3) ? 0 : (epicsType)(0.5 + (i % 7) * 0.25);
+    bias[i] = (epicsType)(-(double)(i % 13));
+  }
+  std::vector<epicsType> scalar(input), vector(input);
+  NDSimdSetMaxLevel(NDSimdNone);
+  BOOST_REQUIRE_EQUAL(NDProcessCorrect(dataType, &c, &scalar[0], &background[0], &gain[0], &bias[0], n),
+                      ND_SUCCESS);
+  NDSimdSetMaxLevel(level);
+  BOOST_REQUIRE_EQUAL(NDProcessCorrect(dataType, &c, &vector[0], &background[0], &gain[0], &bias[0], n),
+                      ND_SUCCESS);
+  for (i=0; i<n; i++) {
+    epicsType reference = referenceCorrect(c, input[i], background[i], gain[i], bias[i]);
+    BOOST_CHECK_EQUAL(scalar[i], reference);
+    BOOST_CHECK_EQUAL(vector[i], reference);
+  }
+}
+
+static NDProcessCorrection_t allCorrections()
+{
+  NDProcessCorrection_t c;
+
+  c.enableBackground = 1;
+  c.enableGain = 1;
+  c.enableOffsetScale = 1;
+  c.offset = -50.;
+  c.scale = 0.3;
+  c.enableHighClip = 1;
+  c.highClip = 60000.;
+  c.enableLowClip = 1;
+  c.lowClip = 100.;
+  return c;
+}
+
+BOOST_AUTO_TEST_SUITE(NDProcessKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Float32)
+{
+  NDProcessCorrection_t c = allCorrections();
+
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(NDSimdLevel()));
+  checkCorrect<epicsFloat32>(NDFloat32, c);
+  // Each combination of corrections has its own kernel
+  for (int features=0; features<32; features++) {
+    c.enableBackground  = features & 1;
+    c.enableGain        = features & 2;
+    c.enableOffsetScale = features & 4;
+    c.enableHighClip    = features & 8;
+    c.enableLowClip     = features & 16;
+    checkCorrect<epicsFloat32>(NDFloat32, c);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Float64)
+{
+  NDProcessCorrection_t c = allCorrections();
+
+  checkCorrect<epicsFloat64>(NDFloat64, c);
+  c.enableGain = 0;
+  c.enableLowClip = 0;
+  checkCorrect<epicsFloat64>(NDFloat64, c);
+}
+
+BOOST_AUTO_TEST_CASE(test_GainMap)
+{
+  NDProcessCorrection_t c = allCorrections();
+  std::vector<epicsFloat32> values(8, 10.f), flat(8, 2.f), background(8, 3.f), gain(8), bias(8);
+
+  c.enableBackground = c.enableOffsetScale = c.enableHighClip = c.enableLowClip = 0;
+  flat[5] = 0.f;
+  BOOST_REQUIRE_EQUAL(NDProcessGainMap(NDFloat32, &flat[0], 0, 4., &gain[0], &bias[0], flat.size()), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(gain[0], 2.f);
+  BOOST_CHECK_EQUAL(bias[0], 0.f);
+  BOOST_REQUIRE_EQUAL(NDProcessCorrect(NDFloat32, &c, &values[0], 0, &gain[0], &bias[0], values.size()),
+                      ND_SUCCESS);
+  BOOST_CHECK_EQUAL(values[0], 20.f);
+  // Elements where the flat field is 0 become the scale
+  BOOST_CHECK_EQUAL(values[5], 4.f);
+  BOOST_CHECK_EQUAL(values[7], 20.f);
+
+  // The background folded into the bias map
+  values.assign(8, 10.f);
+  BOOST_REQUIRE_EQUAL(NDProcessGainMap(NDFloat32, &flat[0], &background[0], 4., &gain[0], &bias[0], flat.size()),
+                      ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDProcessCorrect(NDFloat32, &c, &values[0], 0, &gain[0], &bias[0], values.size()),
+                      ND_SUCCESS);
+  BOOST_CHECK_EQUAL(values[0], 14.f);
+  BOOST_CHECK_EQUAL(values[5], 4.f);
+
+  BOOST_CHECK_EQUAL(NDProcessGainMap(NDInt32, &flat[0], 0, 4., &gain[0], &bias[0], flat.size()), ND_ERROR);
+}
+
+template <typename epicsType, typename accType>
+static void checkAccumulate(NDDataType_t dataType, NDProcessAccType_t accumulator)
+{
+  // Not a multiple of the vector width, so the scalar remainder is used
+  size_t n = 1003, i;
+  std::vector<epicsType> first(n), second(n);
+  std::vector<accType> scalar(n), vector(n);
+  NDSimdLevel_t level = NDSimdLevel();
+  NDProcessAccOp_t operations[] = {NDProcessAccSet, NDProcessAccAdd, NDProcessAccAdd, NDProcessAccSubtract};
+  const epicsType *frames[] = {&first[0], &second[0], &second[0], &first[0]};
+
+  for (i=0; i<n; i++) {
+    first[i] = (epicsType)(60000 - (i*37) % 900);
+    second[i] = (epicsType)((i*101) % 65000);
+  }
+  for (int op=0; op<4; op++) {
+    NDSimdSetMaxLevel(NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDProcessAccumulate(dataType, frames[op], accumulator, &scalar[0], operations[op], n),
+                        ND_SUCCESS);
+    NDSimdSetMaxLevel(level);
+    BOOST_REQUIRE_EQUAL(NDProcessAccumulate(dataType, frames[op], accumulator, &vector[0], operations[op], n),
+                        ND_SUCCESS);
+  }
+  // The first frame has been subtracted again, the sums of 2 second frames are left
+  for (i=0; i<n; i++) {
+    BOOST_CHECK_EQUAL(scalar[i], (accType)2 * (accType)second[i]);
+    BOOST_CHECK_EQUAL(vector[i], (accType)2 * (accType)second[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Accumulate)
+{
+  checkAccumulate<epicsUInt16, epicsInt32>(NDUInt16, NDProcessAccInt32);
+  checkAccumulate<epicsUInt16, epicsInt64>(NDUInt16, NDProcessAccInt64);
+  checkAccumulate<epicsInt32, epicsInt64>(NDInt32, NDProcessAccInt64);
+  checkAccumulate<epicsFloat32, epicsFloat64>(NDFloat32, NDProcessAccFloat64);
+  checkAccumulate<epicsFloat64, epicsFloat64>(NDFloat64, NDProcessAccFloat64);
+}
+
+template <typename epicsType>
+static void checkTemporal(NDDataType_t dataType, int nFrames)
+{
+  // Not a multiple of the vector width, so the scalar remainder is used
+  size_t n = 203, offset = 5, i;
+  std::vector<std::vector<epicsType> > frames(nFrames, std::vector<epicsType>(n + offset));
+  std::vector<const void *> pFrames(nFrames);
+  NDSimdLevel_t level = NDSimdLevel();
+  NDProcessTemporalOp_t operations[] = {NDProcessTemporalMedian, NDProcessTemporalMin, NDProcessTemporalMax};
+  int k;
+
+  for (k=0; k<nFrames; k++) {
+    // Values above 32767 check the unsigned comparisons; repeated values check ties
+    for (i=0; i<n+offset; i++) frames[k][i] = (epicsType)(((i*7 + k*13) * (k+3)) % 251 * 250);
+    pFrames[k] = &frames[k][0];
+  }
+  for (int op=0; op<3; op++) {
+    std::vector<epicsType> scalar(n), vector(n), values(nFrames);
+    NDSimdSetMaxLevel(NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDProcessTemporal(dataType, operations[op], &pFrames[0], nFrames, offset, &scalar[0], n),
+                        ND_SUCCESS);
+    NDSimdSetMaxLevel(level);
+    BOOST_REQUIRE_EQUAL(NDProcessTemporal(dataType, operations[op], &pFrames[0], nFrames, offset, &vector[0], n),
+                        ND_SUCCESS);
+    for (i=0; i<n; i++) {
+      for (k=0; k<nFrames; k++) values[k] = frames[k][offset + i];
+      std::sort(values.begin(), values.end());
+      epicsType reference = (op == 0) ? values[(nFrames-1)/2] : (op == 1) ? values[0] : values[nFrames-1];
+      BOOST_CHECK_EQUAL(scalar[i], reference);
+      BOOST_CHECK_EQUAL(vector[i], reference);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Temporal)
+{
+  for (int nFrames=1; nFrames<=ND_PROCESS_MAX_TEMPORAL; nFrames++) {
+    checkTemporal<epicsUInt16>(NDUInt16, nFrames);
+    checkTemporal<epicsFloat32>(NDFloat32, nFrames);
+  }
+  checkTemporal<epicsInt32>(NDInt32, 5);
+  checkTemporal<epicsFloat64>(NDFloat64, 9);
+
+  std::vector<epicsUInt16> frame(10, 1), out(10);
+  const void *pFrames[ND_PROCESS_MAX_TEMPORAL+1];
+  for (int k=0; k<=ND_PROCESS_MAX_TEMPORAL; k++) pFrames[k] = &frame[0];
+  BOOST_CHECK_EQUAL(NDProcessTemporal(NDUInt16, NDProcessTemporalMedian, pFrames, 0, 0, &out[0], out.size()),
+                    ND_ERROR);
+  BOOST_CHECK_EQUAL(NDProcessTemporal(NDUInt16, NDProcessTemporalMedian, pFrames, ND_PROCESS_MAX_TEMPORAL+1, 0,
+                                      &out[0], out.size()), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_NoKernel)
+{
+  NDProcessCorrection_t c = allCorrections();
+  std::vector<epicsUInt16> values(10, 1);
+
+  BOOST_CHECK_EQUAL(NDProcessCorrect(NDUInt16, &c, &values[0], &values[0], &values[0], &values[0], values.size()),
+                    ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,214 @@
+/*
+ * test_NDRawFile.cpp
+ *
+ *  Tests of the raw array files, sidecar index and attribute file of NDFileRaw.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDRawFile.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct RawFixture
+{
+  NDArrayPool pool;
+  NDRawFile file;
+  std::string path;
+  std::vector<std::string> attributeNames;
+
+  RawFixture() : pool(0, 0)
+  {
+    char buffer[64];
+    sprintf(buffer, "/tmp/NDRawFileTest%d", (int)getpid());
+    path = buffer;
+    attributeNames.push_back("Gain");
+    attributeNames.push_back("Missing");
+  }
+
+  ~RawFixture()
+  {
+    file.close();
+    unlink(path.c_str());
+    unlink((path + ND_RAW_INDEX_SUFFIX).c_str());
+    unlink((path + ND_RAW_ATTRIBUTES_SUFFIX).c_str());
+  }
+
+  /** Allocates an array of nx*ny UInt16 whose elements count from first, with a Gain attribute */
+  NDArray *makeArray(size_t nx, size_t ny, int first, double gain)
+  {
+    size_t dims[2] = {nx, ny};
+    NDArray *pArray = pool.alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    for (size_t i=0; i<nx*ny; i++) pData[i] = (epicsUInt16)(first + i);
+    pArray->uniqueId = first;
+    pArray->timeStamp = first / 10.;
+    pArray->epicsTS.secPastEpoch = 1000 + first;
+    pArray->epicsTS.nsec = first;
+    pArray->pAttributeList->add("Gain", "", NDAttrFloat64, &gain);
+    return pArray;
+  }
+
+  /** Writes 5 arrays, with the data file opened with or without direct I/O, and checks the files */
+  void writeAndCheck(bool directIO, size_t nx, size_t ny)
+  {
+    std::vector<NDArray *> arrays;
+    NDRawIndex index;
+    std::vector<epicsUInt16> data(nx*ny);
+    size_t bytes = nx * ny * sizeof(epicsUInt16);
+    size_t padded = (bytes + ND_RAW_ALIGNMENT - 1) / ND_RAW_ALIGNMENT * ND_RAW_ALIGNMENT;
+    FILE *dataFile;
+    int i;
+
+    BOOST_REQUIRE_EQUAL(file.open(path.c_str(), attributeNames, 2, 1024*1024, directIO), ND_SUCCESS);
+    BOOST_CHECK(file.isOpen());
+    for (i=0; i<5; i++) {
+      arrays.push_back(makeArray(nx, ny, 100*i, 2.*i));
+      BOOST_REQUIRE_EQUAL(file.write(arrays[i]), ND_SUCCESS);
+      // The plugin releases the array as soon as writeFile returns
+      arrays[i]->release();
+    }
+    BOOST_REQUIRE_EQUAL(file.close(), ND_SUCCESS);
+    BOOST_CHECK(!file.isOpen());
+    BOOST_CHECK_EQUAL(file.bytesWritten(), (epicsUInt64)(4*padded + bytes));
+    // All of the arrays that were written directly have been released by the file
+    BOOST_CHECK_EQUAL(pool.numFree(), pool.numBuffers());
+
+    BOOST_REQUIRE_EQUAL(index.read((path + ND_RAW_INDEX_SUFFIX).c_str()), ND_SUCCESS);
+    BOOST_CHECK_EQUAL(index.header.alignment, (epicsUInt32)ND_RAW_ALIGNMENT);
+    BOOST_REQUIRE_EQUAL(index.attributeNames.size(), (size_t)2);
+    BOOST_CHECK_EQUAL(index.attributeNames[0], "Gain");
+    BOOST_REQUIRE_EQUAL(index.records.size(), (size_t)5);
+    BOOST_REQUIRE_EQUAL(index.attributeValues.size(), (size_t)10);
+    dataFile = fopen(path.c_str(), "rb");
+    BOOST_REQUIRE(dataFile != NULL);
+    for (i=0; i<5; i++) {
+      NDRawIndexRecord_t *pRecord = &index.records[i];
+      BOOST_CHECK_EQUAL(pRecord->offset, (epicsUInt64)(i*padded));
+      BOOST_CHECK_EQUAL(pRecord->bytes, (epicsUInt64)bytes);
+      BOOST_CHECK_EQUAL(pRecord->uniqueId, 100*i);
+      BOOST_CHECK_EQUAL(pRecord->dataType, (int)NDUInt16);
+      BOOST_CHECK_EQUAL(pRecord->ndims, 2);
+      BOOST_CHECK_EQUAL(pRecord->dims[0], (epicsUInt64)nx);
+      BOOST_CHECK_EQUAL(pRecord->dims[1], (epicsUInt64)ny);
+      BOOST_CHECK_EQUAL(pRecord->secPastEpoch, (epicsUInt32)(1000 + 100*i));
+      BOOST_CHECK_EQUAL(index.attributeValues[2*i], 2.*i);
+      BOOST_CHECK(isnan(index.attributeValues[2*i + 1]));
+      BOOST_REQUIRE_EQUAL(fseek(dataFile, (long)pRecord->offset, SEEK_SET), 0);
+      BOOST_REQUIRE_EQUAL(fread(&data[0], 1, bytes, dataFile), bytes);
+      BOOST_CHECK_EQUAL(data[0], (epicsUInt16)(100*i));
+      BOOST_CHECK_EQUAL(data[nx*ny - 1], (epicsUInt16)(100*i + nx*ny - 1));
+    }
+    fclose(dataFile);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDRawFileTests, RawFixture)
+
+BOOST_AUTO_TEST_CASE(test_Buffered)
+{
+  writeAndCheck(false, 100, 30);
+  BOOST_CHECK_EQUAL(file.numCopied(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_DirectIO)
+{
+  // Aligned arrays whose size is a multiple of the alignment are written without a copy
+  BOOST_REQUIRE_EQUAL(pool.setAlignment(ND_RAW_ALIGNMENT), ND_SUCCESS);
+  writeAndCheck(true, 1024, 4);
+  if (file.directIO()) BOOST_CHECK_EQUAL(file.numCopied(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_DirectIOCopy)
+{
+  // The arrays that cannot be written directly are copied
+  writeAndCheck(true, 100, 30);
+  if (file.directIO()) BOOST_CHECK_EQUAL(file.numCopied(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_PartialRecord)
+{
+  NDRawIndex index;
+  NDArray *pArray = makeArray(10, 10, 1, 1.);
+  FILE *indexFile;
+
+  BOOST_REQUIRE_EQUAL(file.open(path.c_str(), attributeNames, 1, 0, false), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(file.write(pArray), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(file.close(), ND_SUCCESS);
+  pArray->release();
+
+  // An IOC that stopped while writing a record leaves part of it at the end of the index
+  indexFile = fopen((path + ND_RAW_INDEX_SUFFIX).c_str(), "ab");
+  BOOST_REQUIRE(indexFile != NULL);
+  fwrite("partial", 7, 1, indexFile);
+  fclose(indexFile);
+  BOOST_REQUIRE_EQUAL(index.read((path + ND_RAW_INDEX_SUFFIX).c_str()), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(index.records.size(), (size_t)1);
+}
+
+BOOST_AUTO_TEST_CASE(test_RecordAttributes)
+{
+  NDRawIndex index;
+  NDRawAttributeBlock_t *pBlock;
+  NDRawAttribute_t *pAttribute;
+  const char *label = "dark";
+  size_t offset;
+  int i;
+
+  BOOST_REQUIRE_EQUAL(file.open(path.c_str(), attributeNames, 1, 0, false, true), ND_SUCCESS);
+  for (i=0; i<3; i++) {
+    NDArray *pArray = makeArray(10, 10, i, 1.5*i);
+    pArray->pAttributeList->add("Label", "", NDAttrString, (void *)label);
+    BOOST_REQUIRE_EQUAL(file.write(pArray), ND_SUCCESS);
+    pArray->release();
+  }
+  BOOST_REQUIRE_EQUAL(file.close(), ND_SUCCESS);
+
+  BOOST_REQUIRE_EQUAL(index.read((path + ND_RAW_INDEX_SUFFIX).c_str()), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(index.readAttributes((path + ND_RAW_ATTRIBUTES_SUFFIX).c_str()), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(index.attributeOffsets.size(), (size_t)3);
+  for (i=0; i<3; i++) {
+    offset = index.attributeOffsets[i];
+    pBlock = (NDRawAttributeBlock_t *)&index.attributeBlocks[offset];
+    BOOST_CHECK_EQUAL(pBlock->uniqueId, i);
+    BOOST_REQUIRE_EQUAL(pBlock->numAttributes, 2);
+    // All of the attributes are recorded, in the order of the list, not only those of the index
+    pAttribute = (NDRawAttribute_t *)(pBlock + 1);
+    BOOST_CHECK_EQUAL(std::string(pAttribute->name), "Gain");
+    BOOST_CHECK_EQUAL(pAttribute->dataType, (int)NDAttrFloat64);
+    BOOST_REQUIRE_EQUAL(pAttribute->valueSize, (int)sizeof(epicsFloat64));
+    BOOST_CHECK_EQUAL(*(epicsFloat64 *)(pAttribute + 1), 1.5*i);
+    pAttribute = (NDRawAttribute_t *)((char *)(pAttribute + 1) + sizeof(epicsFloat64));
+    BOOST_CHECK_EQUAL(std::string(pAttribute->name), "Label");
+    BOOST_CHECK_EQUAL(pAttribute->dataType, (int)NDAttrString);
+    BOOST_REQUIRE_EQUAL(pAttribute->valueSize, (int)strlen(label) + 1);
+    BOOST_CHECK_EQUAL(std::string((char *)(pAttribute + 1)), label);
+  }
+
+  // Without RecordAttributes a stale attribute file of the same name is removed
+  BOOST_REQUIRE_EQUAL(file.open(path.c_str(), attributeNames, 1, 0, false), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(file.close(), ND_SUCCESS);
+  BOOST_CHECK(access((path + ND_RAW_ATTRIBUTES_SUFFIX).c_str(), F_OK) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_NotAnIndex)
+{
+  NDRawIndex index;
+  FILE *dataFile = fopen(path.c_str(), "wb");
+
+  BOOST_REQUIRE(dataFile != NULL);
+  fwrite("not an index file", 17, 1, dataFile);
+  fclose(dataFile);
+  BOOST_CHECK_EQUAL(index.read(path.c_str()), ND_ERROR);
+  BOOST_CHECK_EQUAL(index.read("/nonexistent/NDRawFileTest.idx"), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+/*
+ * test_NDRemapKernels.cpp
+ *
+ *  Tests of the table-driven bilinear remapping of NDPluginRemap.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDRemapKernels.h>
+
+#include <algorithm>
+#include <vector>
+
+static NDRemapGeometry_t identity()
+{
+  NDRemapGeometry_t g;
+
+  g.angle = 0.;
+  g.scaleX = g.scaleY = 1.;
+  g.shiftX = g.shiftY = 0.;
+  g.centerX = g.centerY = 0.;
+  g.distortion = 0.;
+  return g;
+}
+
+template <typename epicsType>
+static void checkIdentity(NDDataType_t dataType)
+{
+  size_t sizeX = 37, sizeY = 11, i;
+  std::vector<epicsType> in(sizeX*sizeY), out(sizeX*sizeY);
+  NDRemapGeometry_t g = identity();
+  NDRemapTable_t table;
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)((i*37) % 120);
+  BOOST_REQUIRE_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, 1, sizeX, sizeX, sizeY, &table), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(dataType, &table, &in[0], &out[0], 1, sizeX, 0, sizeY, 0.), ND_SUCCESS);
+  NDRemapFreeTable(&table);
+  BOOST_CHECK(out == in);
+}
+
+BOOST_AUTO_TEST_SUITE(NDRemapKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Identity)
+{
+  checkIdentity<epicsInt8>(NDInt8);
+  checkIdentity<epicsUInt8>(NDUInt8);
+  checkIdentity<epicsInt16>(NDInt16);
+  checkIdentity<epicsUInt16>(NDUInt16);
+  checkIdentity<epicsInt32>(NDInt32);
+  checkIdentity<epicsUInt32>(NDUInt32);
+  checkIdentity<epicsFloat32>(NDFloat32);
+  checkIdentity<epicsFloat64>(NDFloat64);
+}
+
+BOOST_AUTO_TEST_CASE(test_Geometry)
+{
+  size_t sizeX = 5, sizeY = 4;
+  std::vector<epicsFloat64> in(sizeX*sizeY), out(sizeX*sizeY);
+  NDRemapGeometry_t g = identity();
+  NDRemapTable_t table;
+
+  // A linear ramp is reproduced exactly by the interpolation
+  for (size_t y=0; y<sizeY; y++)
+    for (size_t x=0; x<sizeX; x++) in[y*sizeX + x] = 10.*x + y;
+
+  // A shift of half a pixel interpolates between the neighbours; the first column comes from outside
+  g.shiftX = 0.5;
+  BOOST_REQUIRE_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, 1, sizeX, sizeX, sizeY, &table), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(NDFloat64, &table, &in[0], &out[0], 1, sizeX, 0, sizeY, -1.), ND_SUCCESS);
+  NDRemapFreeTable(&table);
+  BOOST_CHECK_EQUAL(out[0], -1.);
+  BOOST_CHECK_CLOSE(out[1], 5., 1e-9);
+  BOOST_CHECK_CLOSE(out[2*sizeX + 4], 37., 1e-9);
+
+  // 180 degrees about the center
+  g = identity();
+  g.angle = 180.;
+  BOOST_REQUIRE_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, 1, sizeX, sizeX, sizeY, &table), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(NDFloat64, &table, &in[0], &out[0], 1, sizeX, 0, sizeY, -1.), ND_SUCCESS);
+  NDRemapFreeTable(&table);
+  for (size_t i=0; i<in.size(); i++) BOOST_CHECK_CLOSE(out[i] + 1., in[in.size() - 1 - i] + 1., 1e-6);
+
+  // A magnification of 2 about the center halves the slope of the ramp
+  g = identity();
+  g.scaleX = 2.;
+  BOOST_REQUIRE_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, 1, sizeX, sizeX, sizeY, &table), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(NDFloat64, &table, &in[0], &out[0], 1, sizeX, 0, sizeY, -1.), ND_SUCCESS);
+  NDRemapFreeTable(&table);
+  BOOST_CHECK_CLOSE(out[0], 10., 1e-9);
+  BOOST_CHECK_CLOSE(out[4], 30., 1e-9);
+
+  g.scaleX = 0.;
+  BOOST_CHECK_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, 1, sizeX, sizeX, sizeY, &table), ND_ERROR);
+  g = identity();
+  BOOST_CHECK_EQUAL(NDRemapCreateTable(&g, 1, sizeY, 1, 1, 1, sizeY, &table), ND_ERROR);
+}
+
+template <typename epicsType>
+static void checkVector(NDDataType_t dataType, size_t xStride, size_t outXStride)
+{
+  // Not a multiple of the vector width, so the scalar remainder is used
+  size_t sizeX = 203, sizeY = 37, i;
+  size_t yStride = sizeX*xStride + 3, outYStride = sizeX*outXStride + 1;
+  std::vector<epicsType> in(yStride*sizeY);
+  std::vector<epicsType> scalar(outYStride*sizeY), vector(outYStride*sizeY);
+  NDRemapGeometry_t g = identity();
+  NDRemapTable_t table;
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)((i*7919) % 65521);
+  g.angle = 7.5;
+  g.scaleX = 1.1;
+  g.scaleY = 0.95;
+  g.shiftX = 3.25;
+  g.centerY = -4.;
+  g.distortion = 0.05;
+  BOOST_REQUIRE_EQUAL(NDRemapCreateTable(&g, sizeX, sizeY, xStride, yStride, sizeX, sizeY, &table), ND_SUCCESS);
+  NDSimdSetMaxLevel(NDSimdNone);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(dataType, &table, &in[0], &scalar[0], outXStride, outYStride, 0, sizeY, 77.),
+                      ND_SUCCESS);
+  NDSimdSetMaxLevel(level);
+  // In 2 parts, as the stripes of the plugin do
+  BOOST_REQUIRE_EQUAL(NDRemapApply(dataType, &table, &in[0], &vector[0], outXStride, outYStride, 0, 20, 77.),
+                      ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(NDRemapApply(dataType, &table, &in[0], &vector[0], outXStride, outYStride, 20, sizeY-20, 77.),
+                      ND_SUCCESS);
+  NDRemapFreeTable(&table);
+  BOOST_CHECK(scalar == vector);
+  // The rotation moves part of the output outside the input
+  BOOST_CHECK(std::count(scalar.begin(), scalar.end(), (epicsType)77) > 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Vector)
+{
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(NDSimdLevel()));
+  checkVector<epicsUInt16>(NDUInt16, 1, 1);
+  checkVector<epicsUInt16>(NDUInt16, 3, 1);
+  checkVector<epicsUInt16>(NDUInt16, 1, 3);
+  checkVector<epicsFloat32>(NDFloat32, 1, 1);
+  checkVector<epicsFloat32>(NDFloat32, 3, 1);
+  checkVector<epicsUInt8>(NDUInt8, 1, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
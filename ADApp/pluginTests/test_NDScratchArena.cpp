@@ -0,0 +1,91 @@
+/*
+ * test_NDScratchArena.cpp
+ *
+ *  Tests of the scratch arenas of NDPluginDriver.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDScratchArena.h>
+
+BOOST_AUTO_TEST_SUITE(NDScratchArenaTests)
+
+BOOST_AUTO_TEST_CASE(test_Alignment)
+{
+  NDScratchArena arena;
+  char *p1, *p2, *p3;
+
+  p1 = (char *)arena.alloc(1);
+  p2 = (char *)arena.alloc(100);
+  p3 = (char *)arena.alloc(0);
+  BOOST_REQUIRE(p1 && p2 && p3);
+  BOOST_CHECK_EQUAL((size_t)p1 % ND_SCRATCH_ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL((size_t)p2 % ND_SCRATCH_ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL((size_t)p3 % ND_SCRATCH_ALIGNMENT, 0u);
+  BOOST_CHECK(p1 != p2);
+  BOOST_CHECK(p2 != p3);
+  BOOST_CHECK_EQUAL(arena.used(), (size_t)4*ND_SCRATCH_ALIGNMENT);
+  memset(p2, 1, 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_ReuseAfterReset)
+{
+  NDScratchArena arena;
+  void *pFirst[2], *pSecond[2];
+  size_t capacity;
+
+  // The first frame does not fit, so the buffers are allocated separately
+  pFirst[0] = arena.alloc(1000);
+  pFirst[1] = arena.alloc(5000);
+  BOOST_REQUIRE(pFirst[0] && pFirst[1]);
+  BOOST_CHECK(arena.capacity() >= 6000);
+  // The reset grows the block to what the frame used
+  arena.reset();
+  BOOST_CHECK_EQUAL(arena.used(), 0u);
+  capacity = arena.capacity();
+  BOOST_CHECK(capacity >= 6000);
+  // The next frames of the same size come from the block at the same addresses
+  pFirst[0] = arena.alloc(1000);
+  pFirst[1] = arena.alloc(5000);
+  BOOST_CHECK_EQUAL(arena.capacity(), capacity);
+  arena.reset();
+  pSecond[0] = arena.alloc(1000);
+  pSecond[1] = arena.alloc(5000);
+  BOOST_CHECK_EQUAL(pSecond[0], pFirst[0]);
+  BOOST_CHECK_EQUAL(pSecond[1], pFirst[1]);
+  BOOST_CHECK_EQUAL(arena.capacity(), capacity);
+  // Smaller frames do not shrink the block
+  arena.reset();
+  BOOST_CHECK(arena.alloc(10) != NULL);
+  arena.reset();
+  BOOST_CHECK_EQUAL(arena.capacity(), capacity);
+}
+
+BOOST_AUTO_TEST_CASE(test_Growth)
+{
+  NDScratchArena arena;
+  char *p;
+  size_t capacity;
+
+  BOOST_REQUIRE(arena.alloc(4096));
+  arena.reset();
+  capacity = arena.capacity();
+  // A larger frame overflows the block, and the buffers are still usable
+  p = (char *)arena.alloc(4096);
+  BOOST_REQUIRE(p);
+  memset(p, 2, 4096);
+  p = (char *)arena.alloc(8192);
+  BOOST_REQUIRE(p);
+  memset(p, 3, 8192);
+  BOOST_CHECK(arena.capacity() > capacity);
+  arena.reset();
+  BOOST_CHECK_EQUAL(arena.capacity(), (size_t)4096+8192);
+  // A request too large to round up fails
+  BOOST_CHECK(arena.alloc((size_t)-1) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
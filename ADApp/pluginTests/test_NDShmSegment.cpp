@@ -0,0 +1,157 @@
+/*
+ * test_NDShmSegment.cpp
+ *
+ *  Tests of the shared memory segment that NDPluginShm publishes arrays through.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDShmSegment.h>
+
+#include <string.h>
+#include <string>
+
+struct ShmFixture
+{
+  NDShmSegment writer;
+  NDShmSegment reader;
+  NDArrayPool *pPool;
+  std::string name;
+
+  ShmFixture()
+  {
+    char buffer[64];
+    sprintf(buffer, "/NDShmSegmentTest%d", (int)getpid());
+    name = buffer;
+    BOOST_REQUIRE_EQUAL(writer.create(name.c_str(), 2, 1024*1024, 1024), ND_SUCCESS);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), ND_SUCCESS);
+    pPool = new NDArrayPool(0, 0, &writer);
+  }
+  ~ShmFixture()
+  {
+    // The writer releases the arrays it holds before the pool is deleted
+    writer.close();
+    reader.close();
+    delete pPool;
+  }
+  NDArray* allocArray(int uniqueId)
+  {
+    size_t dims[2] = {16, 8};
+    NDArray *pArray = pPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    for (int i=0; i<16*8; i++) pData[i] = (epicsUInt16)(i + uniqueId);
+    pArray->uniqueId = uniqueId;
+    return pArray;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDShmSegmentTests, ShmFixture)
+
+BOOST_AUTO_TEST_CASE(test_Allocate)
+{
+  size_t dataSize = writer.dataSize();
+  void *p1, *p2, *p3;
+
+  BOOST_CHECK_EQUAL(writer.dataFree(), dataSize);
+  p1 = writer.allocate(1000);
+  p2 = writer.allocate(1000);
+  p3 = writer.allocate(1000);
+  BOOST_REQUIRE(p1 && p2 && p3);
+  BOOST_CHECK(writer.contains(p1) && writer.contains(p3));
+  BOOST_CHECK_EQUAL(((size_t)p1) % 64, 0u);
+  BOOST_CHECK(!writer.contains(&dataSize));
+  // Freeing the blocks in any order merges them back into one
+  writer.free(p1, 1000);
+  writer.free(p3, 1000);
+  writer.free(p2, 1000);
+  BOOST_CHECK_EQUAL(writer.dataFree(), dataSize);
+  BOOST_CHECK(writer.allocate(dataSize) != NULL);
+  BOOST_CHECK(writer.allocate(1) == NULL);
+  // Readers cannot allocate
+  BOOST_CHECK(reader.allocate(1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_PublishAndRead)
+{
+  NDArray *pArray = allocArray(10);
+  NDArray *pOld = NULL;
+  NDShmSlot_t *pSlot;
+  NDShmAttribute_t *pAttribute;
+  epicsInt32 value = 42;
+  int numAttributes = 0;
+
+  pArray->pAttributeList->add("Value", "", NDAttrInt32, &value);
+  pArray->pAttributeList->add("Text", "", NDAttrString, (void *)"hello");
+  BOOST_CHECK(reader.acquire(0) == NULL);
+  BOOST_REQUIRE_EQUAL(writer.publish(pArray, &pOld), ND_SUCCESS);
+  BOOST_CHECK(pOld == NULL);
+  BOOST_CHECK_EQUAL(reader.numPublished(), 1);
+
+  pSlot = reader.acquire(0);
+  BOOST_REQUIRE(pSlot != NULL);
+  BOOST_CHECK_EQUAL(pSlot->uniqueId, 10);
+  BOOST_CHECK_EQUAL(pSlot->ndims, 2);
+  BOOST_CHECK_EQUAL(pSlot->dims[0].size, 16u);
+  BOOST_CHECK_EQUAL(pSlot->dataType, NDUInt16);
+  BOOST_CHECK_EQUAL(pSlot->dataBytes, 16*8*sizeof(epicsUInt16));
+  BOOST_CHECK_EQUAL(memcmp(reader.data(pSlot), pArray->pData, pSlot->dataBytes), 0);
+  for (pAttribute = reader.nextAttribute(pSlot, NULL); pAttribute;
+       pAttribute = reader.nextAttribute(pSlot, pAttribute)) {
+    if (strcmp(pAttribute->name, "Value") == 0) {
+      BOOST_CHECK_EQUAL(pAttribute->dataType, NDAttrInt32);
+      BOOST_CHECK_EQUAL(*(epicsInt32 *)reader.attributeValue(pAttribute), 42);
+    } else {
+      BOOST_CHECK_EQUAL(pAttribute->dataType, NDAttrString);
+      BOOST_CHECK_EQUAL((char *)reader.attributeValue(pAttribute), "hello");
+    }
+    numAttributes++;
+  }
+  BOOST_CHECK_EQUAL(numAttributes, 2);
+  reader.release(pSlot);
+}
+
+BOOST_AUTO_TEST_CASE(test_ReaderHoldsSlot)
+{
+  NDArray *pArrays[3];
+  NDArray *pOld = NULL;
+  NDShmSlot_t *pSlot;
+  int i;
+
+  for (i=0; i<3; i++) pArrays[i] = allocArray(i);
+  BOOST_REQUIRE_EQUAL(writer.publish(pArrays[0], &pOld), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(writer.publish(pArrays[1], &pOld), ND_SUCCESS);
+  pSlot = reader.acquire(0);
+  BOOST_REQUIRE(pSlot != NULL);
+  // Array 2 would reuse the slot of array 0, which the reader holds
+  BOOST_CHECK_EQUAL(writer.publish(pArrays[2], &pOld), ND_ERROR);
+  BOOST_CHECK(pOld == NULL);
+  BOOST_CHECK_EQUAL(pSlot->uniqueId, 0);
+  reader.release(pSlot);
+  BOOST_REQUIRE_EQUAL(writer.publish(pArrays[2], &pOld), ND_SUCCESS);
+  BOOST_CHECK(pOld == pArrays[0]);
+  pOld->release();
+  // Array 0 has been overwritten
+  BOOST_CHECK(reader.acquire(0) == NULL);
+  pSlot = reader.acquire(2);
+  BOOST_REQUIRE(pSlot != NULL);
+  BOOST_CHECK_EQUAL(pSlot->uniqueId, 2);
+  reader.release(pSlot);
+}
+
+BOOST_AUTO_TEST_CASE(test_NotInSegment)
+{
+  NDArrayPool pool(0, 0);
+  size_t dims[1] = {100};
+  NDArray *pArray = pool.alloc(1, dims, NDInt8, 0, NULL);
+  NDArray *pOld = NULL;
+
+  BOOST_CHECK_EQUAL(writer.publish(pArray, &pOld), ND_ERROR);
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
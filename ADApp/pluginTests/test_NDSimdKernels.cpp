@@ -0,0 +1,197 @@
+/*
+ * test_NDSimdKernels.cpp
+ *
+ *  Tests of the shared vectorized primitives against their scalar code and a reference.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDSimdKernels.h>
+
+#include <vector>
+
+// Calls a primitive with the scalar code and with the vector kernels, restoring the instruction set
+struct SimdLevels {
+  NDSimdLevel_t level;
+  SimdLevels() : level(NDSimdLevel()) {}
+  ~SimdLevels() { NDSimdSetMaxLevel(level); }
+  void scalar() { NDSimdSetMaxLevel(NDSimdNone); }
+  void vector() { NDSimdSetMaxLevel(level); }
+};
+
+template <typename inType, typename outType>
+static void checkNarrow(NDDataType_t dataTypeIn, NDDataType_t dataTypeOut, const std::vector<inType>& in,
+                        double minValue, double maxValue)
+{
+  SimdLevels levels;
+  std::vector<outType> scalar(in.size()), vector(in.size());
+  size_t i;
+
+  levels.scalar();
+  BOOST_REQUIRE_EQUAL(NDSimdNarrow(dataTypeIn, &in[0], dataTypeOut, &scalar[0], in.size()), ND_SUCCESS);
+  levels.vector();
+  BOOST_REQUIRE_EQUAL(NDSimdNarrow(dataTypeIn, &in[0], dataTypeOut, &vector[0], in.size()), ND_SUCCESS);
+  for (i=0; i<in.size(); i++) {
+    double value = (double)in[i];
+    double expected = (value != value) ? 0. : (value < minValue) ? minValue : (value > maxValue) ? maxValue : trunc(value);
+    BOOST_CHECK_EQUAL((double)scalar[i], expected);
+    BOOST_CHECK_EQUAL((double)vector[i], expected);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(NDSimdKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Stats)
+{
+  // Not a multiple of the vector width or the chunk size, with the extremes in different chunks
+  std::vector<epicsUInt16> data(2*4096 + 77);
+  SimdLevels levels;
+  NDSimdStats_t scalar, vector;
+  epicsUInt64 sum = 0, sumSquares = 0;
+  size_t i;
+
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(NDSimdLevel()));
+  for (i=0; i<data.size(); i++) data[i] = (epicsUInt16)(40000 + (i*131) % 25000);
+  data[4100] = 65535;
+  data[8000] = 65535;
+  data[33] = 7;
+  for (i=0; i<data.size(); i++) {
+    sum += data[i];
+    sumSquares += (epicsUInt64)data[i] * data[i];
+  }
+  levels.scalar();
+  BOOST_REQUIRE_EQUAL(NDSimdStats(NDUInt16, &data[0], data.size(), &scalar), ND_SUCCESS);
+  levels.vector();
+  BOOST_REQUIRE_EQUAL(NDSimdStats(NDUInt16, &data[0], data.size(), &vector), ND_SUCCESS);
+  NDSimdStats_t *results[] = {&scalar, &vector};
+  for (int r=0; r<2; r++) {
+    BOOST_CHECK_EQUAL(results[r]->min, 7);
+    BOOST_CHECK_EQUAL(results[r]->minIndex, 33);
+    BOOST_CHECK_EQUAL(results[r]->max, 65535);
+    BOOST_CHECK_EQUAL(results[r]->maxIndex, 4100);
+    BOOST_CHECK_EQUAL(results[r]->sum, sum);
+    BOOST_CHECK_EQUAL(results[r]->sumSquares, sumSquares);
+  }
+  BOOST_CHECK_EQUAL(NDSimdStats(NDInt32, &data[0], data.size(), &vector), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDSimdStats(NDUInt8, &data[0], 0, &vector), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_Narrow)
+{
+  std::vector<epicsUInt16> uint16(1003);
+  std::vector<epicsInt32> int32(1003);
+  std::vector<epicsFloat32> float32(1003);
+  size_t i;
+
+  for (i=0; i<uint16.size(); i++) {
+    uint16[i] = (epicsUInt16)((i*97) % 600);
+    int32[i] = (epicsInt32)(i*140009) - 70000000;
+    float32[i] = (epicsFloat32)i * 70.3f - 500.f;
+  }
+  int32[5] = 40000;
+  int32[6] = -40000;
+  int32[7] = 65535;
+  int32[8] = 0x7fffffff;
+  float32[3] = 254.99f;
+  float32[4] = 65535.5f;
+  float32[5] = nanf("");
+  float32[6] = 1.e30f;
+  float32[7] = -0.7f;
+  checkNarrow<epicsUInt16, epicsUInt8>(NDUInt16, NDUInt8, uint16, 0., 255.);
+  checkNarrow<epicsInt32, epicsUInt16>(NDInt32, NDUInt16, int32, 0., 65535.);
+  checkNarrow<epicsInt32, epicsInt16>(NDInt32, NDInt16, int32, -32768., 32767.);
+  checkNarrow<epicsFloat32, epicsUInt16>(NDFloat32, NDUInt16, float32, 0., 65535.);
+  checkNarrow<epicsFloat32, epicsUInt8>(NDFloat32, NDUInt8, float32, 0., 255.);
+
+  std::vector<epicsUInt8> out(10);
+  BOOST_CHECK_EQUAL(NDSimdNarrow(NDFloat64, &float32[0], NDUInt8, &out[0], out.size()), ND_ERROR);
+}
+
+template <typename epicsType>
+static void checkTranspose(size_t numColumns, size_t numRows)
+{
+  // Padded rows, so that the strides are not the row lengths
+  size_t inRowStride = numColumns + 3, outRowStride = numRows + 5;
+  std::vector<epicsType> in(numRows * inRowStride);
+  std::vector<epicsType> scalar(numColumns * outRowStride, 0), vector(numColumns * outRowStride, 0);
+  SimdLevels levels;
+  size_t i, r, c;
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)(i*2654435761u);
+  levels.scalar();
+  BOOST_REQUIRE_EQUAL(NDSimdTranspose(sizeof(epicsType), &in[0], inRowStride, &scalar[0], outRowStride,
+                                      numColumns, numRows), ND_SUCCESS);
+  levels.vector();
+  BOOST_REQUIRE_EQUAL(NDSimdTranspose(sizeof(epicsType), &in[0], inRowStride, &vector[0], outRowStride,
+                                      numColumns, numRows), ND_SUCCESS);
+  for (r=0; r<numRows; r++) {
+    for (c=0; c<numColumns; c++) {
+      BOOST_REQUIRE_EQUAL(scalar[c*outRowStride + r], in[r*inRowStride + c]);
+      BOOST_REQUIRE_EQUAL(vector[c*outRowStride + r], in[r*inRowStride + c]);
+    }
+  }
+  // The padding of the output is not written
+  BOOST_CHECK_EQUAL(vector[numRows], 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Transpose)
+{
+  // Sizes that are not multiples of the blocks or the tiles
+  checkTranspose<epicsUInt8>(131, 70);
+  checkTranspose<epicsUInt16>(131, 70);
+  checkTranspose<epicsUInt16>(8, 8);
+  checkTranspose<epicsUInt32>(67, 129);
+  checkTranspose<epicsUInt64>(5, 3);
+  checkTranspose<epicsUInt16>(1, 100);
+
+  epicsUInt8 data[6];
+  BOOST_CHECK_EQUAL(NDSimdTranspose(3, data, 1, data + 3, 1, 1, 1), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_LookupUInt8)
+{
+  std::vector<epicsUInt8> table(256), in(1000 + 13), scalar(in.size()), vector(in.size());
+  SimdLevels levels;
+  size_t i;
+
+  for (i=0; i<table.size(); i++) table[i] = (epicsUInt8)(255 - (i*3) % 256);
+  for (i=0; i<in.size(); i++) in[i] = (epicsUInt8)(i*37);
+  levels.scalar();
+  NDSimdLookupUInt8(&in[0], &table[0], &scalar[0], in.size());
+  levels.vector();
+  NDSimdLookupUInt8(&in[0], &table[0], &vector[0], in.size());
+  for (i=0; i<in.size(); i++) {
+    BOOST_CHECK_EQUAL(scalar[i], table[in[i]]);
+    BOOST_CHECK_EQUAL(vector[i], table[in[i]]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_LookupUInt16)
+{
+  // A table shorter than the range of the values, so that the larger values are clamped
+  std::vector<epicsUInt32> table(4000);
+  std::vector<epicsUInt16> in(1000 + 21);
+  std::vector<epicsUInt32> scalar(in.size()), vector(in.size());
+  SimdLevels levels;
+  size_t i;
+
+  for (i=0; i<table.size(); i++) table[i] = (epicsUInt32)(i*i + 1);
+  for (i=0; i<in.size(); i++) in[i] = (epicsUInt16)(i*67);
+  levels.scalar();
+  NDSimdLookupUInt16(&in[0], &table[0], table.size(), &scalar[0], in.size());
+  levels.vector();
+  NDSimdLookupUInt16(&in[0], &table[0], table.size(), &vector[0], in.size());
+  for (i=0; i<in.size(); i++) {
+    epicsUInt32 expected = table[(in[i] < table.size()) ? in[i] : table.size() - 1];
+    BOOST_CHECK_EQUAL(scalar[i], expected);
+    BOOST_CHECK_EQUAL(vector[i], expected);
+  }
+  NDSimdLookupUInt16(&in[0], &table[0], 0, &vector[0], in.size());
+  BOOST_CHECK_EQUAL(vector[10], 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+/*
+ * test_NDSpillFile.cpp
+ *
+ *  Tests of the memory-mapped file that NDPluginCircularBuff spills the older arrays of its pre-trigger ring to.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDSpillFile.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct SpillFixture
+{
+  NDSpillFile file;
+  std::string path;
+
+  SpillFixture()
+  {
+    char buffer[64];
+    sprintf(buffer, "/tmp/NDSpillFileTest%d", (int)getpid());
+    path = buffer;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDSpillFileTests, SpillFixture)
+
+BOOST_AUTO_TEST_CASE(test_WriteAndRead)
+{
+  std::vector<char> data;
+  int slot, pass;
+
+  BOOST_REQUIRE_EQUAL(file.open(path.c_str(), 4, 1000, 2), ND_SUCCESS);
+  BOOST_CHECK(file.isOpen());
+  BOOST_CHECK_EQUAL(file.numSlots(), 4);
+  BOOST_CHECK_EQUAL(file.slotSize(), (size_t)1000);
+  BOOST_CHECK_EQUAL(access(path.c_str(), F_OK), 0);
+
+  // More writes than can be queued, the later ones overwrite the slots of the first
+  for (pass=0; pass<3; pass++) {
+    for (slot=0; slot<4; slot++) {
+      data.assign(100*slot + pass + 1, (char)(10*pass + slot));
+      BOOST_REQUIRE_EQUAL(file.write(slot, data), ND_SUCCESS);
+      // The file takes the buffer
+      BOOST_CHECK(data.empty());
+    }
+  }
+  file.waitWrites();
+  for (slot=0; slot<4; slot++) {
+    const char *pData = (const char *)file.data(slot);
+    BOOST_REQUIRE(pData != NULL);
+    BOOST_CHECK_EQUAL(file.dataBytes(slot), (size_t)(100*slot + 3));
+    BOOST_CHECK_EQUAL((int)pData[0], 20 + slot);
+    BOOST_CHECK_EQUAL((int)pData[100*slot + 2], 20 + slot);
+  }
+
+  // The file is deleted when it is closed
+  file.close();
+  BOOST_CHECK(!file.isOpen());
+  BOOST_CHECK(access(path.c_str(), F_OK) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  std::vector<char> data(10);
+
+  BOOST_CHECK_EQUAL(file.write(0, data), ND_ERROR);
+  BOOST_CHECK_EQUAL(file.open(path.c_str(), 0, 1000, 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(file.open("/nonexistent/directory/spill", 4, 1000, 2), ND_ERROR);
+  BOOST_REQUIRE_EQUAL(file.open(path.c_str(), 2, 8, 1), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(file.write(2, data), ND_ERROR);
+  BOOST_CHECK_EQUAL(file.write(0, data), ND_ERROR);
+  BOOST_CHECK_EQUAL(data.size(), (size_t)10);
+  BOOST_CHECK(file.data(2) == NULL);
+  // Closing with writes queued discards them
+  data.resize(8);
+  BOOST_CHECK_EQUAL(file.write(1, data), ND_SUCCESS);
+  file.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
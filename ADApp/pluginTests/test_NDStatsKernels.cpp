@@ -0,0 +1,217 @@
+/*
+ * test_NDStatsKernels.cpp
+ *
+ *  Tests of the vectorized statistics kernels of NDPluginStats.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDFloat16.h>
+#include <NDStatsKernels.h>
+
+#include <vector>
+
+template <typename epicsType>
+static void referenceStats(const std::vector<epicsType>& data, NDStatsSums_t *pSums)
+{
+  size_t i;
+
+  pSums->min = pSums->max = data[0];
+  pSums->minIndex = pSums->maxIndex = 0;
+  pSums->shift = pSums->total = pSums->sumSquares = 0.;
+  for (i=0; i<data.size(); i++) {
+    double value = data[i];
+    if (value < pSums->min) {
+      pSums->min = value;
+      pSums->minIndex = i;
+    }
+    if (value > pSums->max) {
+      pSums->max = value;
+      pSums->maxIndex = i;
+    }
+    pSums->total += value;
+    pSums->sumSquares += value * value;
+  }
+}
+
+template <typename epicsType>
+static void checkStats(NDDataType_t dataType, const std::vector<epicsType>& data)
+{
+  NDSimdLevel_t level = NDSimdLevel();
+  NDStatsSums_t reference, scalar, vector;
+
+  referenceStats(data, &reference);
+  NDSimdSetMaxLevel(NDSimdNone);
+  BOOST_REQUIRE_EQUAL(NDStatsContiguous(dataType, &data[0], data.size(), &scalar), ND_SUCCESS);
+  NDSimdSetMaxLevel(level);
+  BOOST_REQUIRE_EQUAL(NDStatsContiguous(dataType, &data[0], data.size(), &vector), ND_SUCCESS);
+
+  NDStatsSums_t *results[] = {&scalar, &vector};
+  for (int r=0; r<2; r++) {
+    BOOST_CHECK_EQUAL(results[r]->min, reference.min);
+    BOOST_CHECK_EQUAL(results[r]->minIndex, reference.minIndex);
+    BOOST_CHECK_EQUAL(results[r]->max, reference.max);
+    BOOST_CHECK_EQUAL(results[r]->maxIndex, reference.maxIndex);
+    // The sums are small enough to be exact in double
+    BOOST_CHECK_EQUAL(results[r]->total, reference.total);
+    BOOST_CHECK_EQUAL(results[r]->sumSquares, reference.sumSquares);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(NDStatsKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_UInt16)
+{
+  // Not a multiple of the vector width or the chunk size, so the scalar remainders are used
+  std::vector<epicsUInt16> data(3*4096 + 1003);
+  size_t i;
+
+  BOOST_TEST_MESSAGE("SIMD level " << NDSimdLevelName(NDSimdLevel()));
+  for (i=0; i<data.size(); i++) data[i] = (epicsUInt16)(1000 + (i*65) % 20000);
+  // The extremes occur more than once and in different chunks; the first occurrence is reported
+  data[5000] = 65535;
+  data[9000] = 65535;
+  data[4097] = 3;
+  data[12000] = 3;
+  checkStats(NDUInt16, data);
+  // The first element is the minimum
+  data[0] = 0;
+  checkStats(NDUInt16, data);
+}
+
+BOOST_AUTO_TEST_CASE(test_UInt8)
+{
+  std::vector<epicsUInt8> data(2*4096 + 37);
+  size_t i;
+
+  for (i=0; i<data.size(); i++) data[i] = (epicsUInt8)(10 + (i*7) % 200);
+  data[6001] = 255;
+  data[8200] = 255;
+  data[17] = 1;
+  checkStats(NDUInt8, data);
+  // Fewer elements than one vector
+  std::vector<epicsUInt8> small(data.begin(), data.begin() + 20);
+  checkStats(NDUInt8, small);
+}
+
+BOOST_AUTO_TEST_CASE(test_NoKernel)
+{
+  std::vector<epicsFloat64> data(10, 1.);
+  NDStatsSums_t sums;
+
+  BOOST_CHECK_EQUAL(NDStatsContiguous(NDFloat64, &data[0], data.size(), &sums), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDStatsContiguous(NDUInt16, &data[0], 0, &sums), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_ShiftedRow)
+{
+  // A small variance on a large offset, which is lost if the squares of the values are summed
+  std::vector<epicsFloat64> data(3*4096 + 100);
+  NDStatsSums_t sums;
+  size_t i;
+
+  for (i=0; i<data.size(); i++) data[i] = 1.e9 + (i % 2);
+  NDStatsRow(&data[0], data.size(), NDStatsShift(&data[0]), &sums);
+  BOOST_CHECK_EQUAL(sums.shift, 1.e9);
+  BOOST_CHECK_EQUAL(sums.total, data.size()/2);
+  BOOST_CHECK_EQUAL(sums.sumSquares, data.size()/2);
+  BOOST_CHECK_EQUAL(sums.minIndex, 0);
+  BOOST_CHECK_EQUAL(sums.maxIndex, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Int32Row)
+{
+  // The sum does not fit in 32 bits
+  std::vector<epicsInt32> data(1000, 2000000000);
+  NDStatsSums_t sums;
+
+  data[10] = -7;
+  NDStatsRow(&data[0], data.size(), 0., &sums);
+  BOOST_CHECK_EQUAL(sums.total, 999. * 2000000000. - 7.);
+  BOOST_CHECK_EQUAL(sums.min, -7.);
+  BOOST_CHECK_EQUAL(sums.minIndex, 10);
+  BOOST_CHECK_EQUAL(sums.maxIndex, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_Float16Row)
+{
+  // Float16 elements are summed as floats, with the same results as the Float32 values they hold
+  std::vector<NDFloat16_t> data(5000);
+  std::vector<epicsFloat32> values(data.size());
+  NDStatsSums_t sums, expected;
+  size_t i;
+
+  for (i=0; i<data.size(); i++) {
+    data[i] = (epicsFloat32)(i % 97) * 0.25f - 3.f;
+    values[i] = data[i];
+  }
+  NDStatsRow(&data[0], data.size(), NDStatsShift(&data[0]), &sums);
+  NDStatsRow(&values[0], values.size(), NDStatsShift(&values[0]), &expected);
+  BOOST_CHECK_EQUAL(sums.shift, -3.);
+  BOOST_CHECK_EQUAL(sums.min, expected.min);
+  BOOST_CHECK_EQUAL(sums.max, expected.max);
+  BOOST_CHECK_EQUAL(sums.minIndex, expected.minIndex);
+  BOOST_CHECK_EQUAL(sums.maxIndex, expected.maxIndex);
+  BOOST_CHECK_EQUAL(sums.total, expected.total);
+  BOOST_CHECK_EQUAL(sums.sumSquares, expected.sumSquares);
+  BOOST_CHECK_EQUAL(NDStatsContiguous(NDFloat16, &data[0], data.size(), &sums), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_CountValues)
+{
+  // Not a multiple of the number of sub-histograms, with runs of equal values
+  std::vector<epicsInt16> data(1003);
+  double firstValue;
+  size_t nValues = NDStatsValueRange(NDInt16, &firstValue);
+  std::vector<epicsUInt32> counts(ND_STATS_SUB_HISTOGRAMS * nValues, 0);
+  size_t i;
+
+  BOOST_REQUIRE_EQUAL(nValues, 65536);
+  BOOST_CHECK_EQUAL(firstValue, -32768.);
+  for (i=0; i<data.size(); i++) data[i] = (epicsInt16)((i / 10) * 650 - 32768);
+  BOOST_REQUIRE_EQUAL(NDStatsCountValues(NDInt16, &data[0], data.size(), &counts[0]), ND_SUCCESS);
+  NDStatsMergeCounts(NDInt16, &counts[0]);
+  BOOST_CHECK_EQUAL(counts[0], 10);
+  BOOST_CHECK_EQUAL(counts[650], 10);
+  BOOST_CHECK_EQUAL(counts[100*650], 3);
+  BOOST_CHECK_EQUAL(counts[1], 0);
+
+  BOOST_CHECK_EQUAL(NDStatsValueRange(NDInt32, &firstValue), 0);
+  BOOST_CHECK_EQUAL(NDStatsCountValues(NDFloat32, &data[0], data.size(), &counts[0]), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_Quantiles)
+{
+  // 10 elements with the values 0 to 9, one per bin
+  std::vector<epicsUInt32> counts(10, 1);
+  double fractions[] = {0., 0.5, 0.99, 1.};
+  double values[4];
+
+  BOOST_REQUIRE_EQUAL(NDStatsQuantiles(&counts[0], counts.size(), 0., 1., 0, fractions, 4, values), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(values[0], 0.);
+  // The nearest rank of the median of 10 elements is 5, the value 4
+  BOOST_CHECK_EQUAL(values[1], 4.);
+  BOOST_CHECK_EQUAL(values[2], 9.);
+  BOOST_CHECK_EQUAL(values[3], 9.);
+
+  // With interpolation the elements are at the centres of their bins
+  BOOST_REQUIRE_EQUAL(NDStatsQuantiles(&counts[0], counts.size(), 100., 2., 1, fractions, 4, values), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(values[0], 101.);
+  BOOST_CHECK_EQUAL(values[1], 109.);
+
+  // Empty bins are skipped
+  counts.assign(10, 0);
+  counts[7] = 4;
+  BOOST_REQUIRE_EQUAL(NDStatsQuantiles(&counts[0], counts.size(), 0., 1., 0, fractions, 4, values), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(values[0], 7.);
+  BOOST_CHECK_EQUAL(values[3], 7.);
+
+  counts.assign(10, 0);
+  BOOST_CHECK_EQUAL(NDStatsQuantiles(&counts[0], counts.size(), 0., 1., 0, fractions, 4, values), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+/*
+ * test_NDTcpStream.cpp
+ *
+ *  Tests of the TCP connection that NDPluginTcpSend and NDTcpReceiver carry arrays over.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDTcpStream.h>
+
+#include <string.h>
+
+struct TcpStreamFixture
+{
+  NDTcpStream sender;
+  NDTcpStream receiver;
+  NDArrayPool *pPool;
+
+  TcpStreamFixture()
+  {
+    char server[64];
+    char peer[64];
+    BOOST_REQUIRE_EQUAL(receiver.listen(0), ND_SUCCESS);
+    BOOST_REQUIRE(receiver.listenPort() > 0);
+    sprintf(server, "127.0.0.1:%d", receiver.listenPort());
+    // The connection waits in the backlog of the listening socket until it is accepted
+    BOOST_REQUIRE_EQUAL(sender.connect(server), ND_SUCCESS);
+    BOOST_REQUIRE_EQUAL(receiver.accept(peer, sizeof(peer)), ND_SUCCESS);
+    pPool = new NDArrayPool(0, 0);
+  }
+  ~TcpStreamFixture()
+  {
+    sender.close();
+    receiver.close();
+    delete pPool;
+  }
+  NDArray* allocArray(int uniqueId)
+  {
+    size_t dims[2] = {16, 8};
+    NDArray *pArray = pPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    for (int i=0; i<16*8; i++) pData[i] = (epicsUInt16)(i + uniqueId);
+    pArray->uniqueId = uniqueId;
+    pArray->timeStamp = 12.5;
+    pArray->epicsTS.secPastEpoch = 1000;
+    pArray->epicsTS.nsec = 2000;
+    pArray->dims[0].offset = 4;
+    pArray->dims[1].binning = 2;
+    return pArray;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDTcpStreamTests, TcpStreamFixture)
+
+BOOST_AUTO_TEST_CASE(test_Credits)
+{
+  BOOST_CHECK(sender.connected());
+  BOOST_CHECK(receiver.connected());
+  BOOST_CHECK_EQUAL(sender.receiveCredits(0.), 0);
+  BOOST_REQUIRE_EQUAL(receiver.sendCredits(2), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(receiver.sendCredits(1), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(sender.receiveCredits(1.0), 3);
+  BOOST_CHECK_EQUAL(sender.receiveCredits(0.), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_SendArray)
+{
+  NDArray *pArray = allocArray(7);
+  NDArray *pReceived = NULL;
+  size_t sentBytes = 0, receivedBytes = 0;
+  epicsFloat64 gain = 2.5, value = 0.;
+  char text[64];
+
+  pArray->pAttributeList->add("Gain", "Detector gain", NDAttrFloat64, &gain);
+  pArray->pAttributeList->add("Name", "Detector name", NDAttrString, (void *)"sim");
+  BOOST_REQUIRE_EQUAL(sender.sendArray(pArray, &sentBytes), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(receiver.receiveArray(pPool, &pReceived, &receivedBytes), ND_SUCCESS);
+  BOOST_REQUIRE(pReceived != NULL);
+
+  BOOST_CHECK_EQUAL(sentBytes, receivedBytes);
+  BOOST_CHECK_EQUAL(pReceived->uniqueId, 7);
+  BOOST_CHECK_EQUAL(pReceived->timeStamp, 12.5);
+  BOOST_CHECK_EQUAL(pReceived->epicsTS.secPastEpoch, 1000u);
+  BOOST_CHECK_EQUAL(pReceived->epicsTS.nsec, 2000u);
+  BOOST_CHECK_EQUAL(pReceived->ndims, 2);
+  BOOST_CHECK_EQUAL(pReceived->dataType, NDUInt16);
+  BOOST_CHECK_EQUAL(pReceived->dims[0].size, 16u);
+  BOOST_CHECK_EQUAL(pReceived->dims[1].size, 8u);
+  BOOST_CHECK_EQUAL(pReceived->dims[0].offset, 4u);
+  BOOST_CHECK_EQUAL(pReceived->dims[1].binning, 2);
+  BOOST_CHECK_EQUAL(memcmp(pReceived->pData, pArray->pData, 16*8*sizeof(epicsUInt16)), 0);
+
+  BOOST_REQUIRE(pReceived->pAttributeList->find("Gain") != NULL);
+  pReceived->pAttributeList->find("Gain")->getValue(NDAttrFloat64, &value);
+  BOOST_CHECK_EQUAL(value, 2.5);
+  BOOST_REQUIRE(pReceived->pAttributeList->find("Name") != NULL);
+  pReceived->pAttributeList->find("Name")->getValue(NDAttrString, text, sizeof(text));
+  BOOST_CHECK_EQUAL(strcmp(text, "sim"), 0);
+
+  pReceived->release();
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_PoolFull)
+{
+  NDArray *pArray = allocArray(1);
+  NDArray *pReceived = NULL;
+  NDArrayPool smallPool(1, 0);
+  NDArray *pHeld;
+  size_t dims[2] = {16, 8};
+
+  // The only buffer of the pool is in use, so the array is read and discarded
+  pHeld = smallPool.alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_REQUIRE(pHeld != NULL);
+  BOOST_REQUIRE_EQUAL(sender.sendArray(pArray, NULL), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(sender.sendArray(pArray, NULL), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(receiver.receiveArray(&smallPool, &pReceived, NULL), ND_SUCCESS);
+  BOOST_CHECK(pReceived == NULL);
+
+  // The connection is still in step, so the next array is received once there is a buffer
+  pHeld->release();
+  BOOST_REQUIRE_EQUAL(receiver.receiveArray(&smallPool, &pReceived, NULL), ND_SUCCESS);
+  BOOST_REQUIRE(pReceived != NULL);
+  BOOST_CHECK_EQUAL(pReceived->uniqueId, 1);
+  pReceived->release();
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Close)
+{
+  NDArray *pReceived = NULL;
+
+  sender.close();
+  BOOST_CHECK(!sender.connected());
+  BOOST_CHECK_EQUAL(receiver.receiveArray(pPool, &pReceived, NULL), ND_ERROR);
+  BOOST_CHECK(pReceived == NULL);
+  BOOST_CHECK(!receiver.connected());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
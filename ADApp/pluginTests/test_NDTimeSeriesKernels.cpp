@@ -0,0 +1,86 @@
+/*
+ * test_NDTimeSeriesKernels.cpp
+ *
+ *  Tests of the averaging transposes of NDPluginTimeSeries.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDTimeSeriesKernels.h>
+
+#include <vector>
+
+template <typename epicsType>
+static void checkAverage(NDDataType_t dataType, size_t numSignals, size_t numAverage, size_t numPoints)
+{
+  // Input rows with more elements than signals and output rows with room after the points check the strides
+  size_t inRowStride = numSignals + 3, outRowStride = numPoints + 5, i, s, p, row;
+  std::vector<epicsType> in(inRowStride*numAverage*numPoints);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)((int)((i*37 + 11) % 201) - 80);
+  for (int simd=0; simd<2; simd++) {
+    std::vector<epicsType> out(outRowStride*numSignals, (epicsType)1);
+    NDSimdSetMaxLevel(simd ? level : NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDTimeSeriesAverage(dataType, &in[0], inRowStride, numSignals, numAverage, numPoints,
+                                            &out[0], outRowStride), ND_SUCCESS);
+    for (s=0; s<numSignals; s++) {
+      for (p=0; p<numPoints; p++) {
+        double sum = 0.;
+        for (row=p*numAverage; row<(p+1)*numAverage; row++) sum += (double)in[row*inRowStride + s];
+        BOOST_CHECK_EQUAL(out[s*outRowStride + p], (epicsType)(sum / numAverage));
+      }
+      // The elements after the points are not written
+      BOOST_CHECK_EQUAL(out[s*outRowStride + numPoints], (epicsType)1);
+    }
+  }
+  NDSimdSetMaxLevel(level);
+}
+
+BOOST_AUTO_TEST_SUITE(NDTimeSeriesKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Average)
+{
+  // More signals and points than a tile, and counts that are not multiples of the vectors
+  checkAverage<epicsInt8>(NDInt8, 70, 3, 130);
+  checkAverage<epicsUInt8>(NDUInt8, 5, 4, 9);
+  checkAverage<epicsInt16>(NDInt16, 32, 5, 100);
+  checkAverage<epicsUInt16>(NDUInt16, 32, 1, 100);
+  checkAverage<epicsInt32>(NDInt32, 67, 2, 65);
+  checkAverage<epicsUInt32>(NDUInt32, 3, 7, 11);
+  checkAverage<epicsFloat32>(NDFloat32, 33, 3, 70);
+  checkAverage<epicsFloat64>(NDFloat64, 9, 10, 20);
+  checkAverage<epicsFloat64>(NDFloat64, 9, 1, 20);
+}
+
+BOOST_AUTO_TEST_CASE(test_Accumulate)
+{
+  size_t numSignals = 11, numRows = 6, inRowStride = 13, i, s;
+  std::vector<epicsInt16> in(inRowStride*numRows);
+  std::vector<double> sums(numSignals, 0.5);
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsInt16)(i*101 - 3000);
+  BOOST_REQUIRE_EQUAL(NDTimeSeriesAccumulate(NDInt16, &in[0], inRowStride, numSignals, numRows, &sums[0]),
+                      ND_SUCCESS);
+  for (s=0; s<numSignals; s++) {
+    double expected = 0.5;
+    for (i=0; i<numRows; i++) expected += in[i*inRowStride + s];
+    BOOST_CHECK_EQUAL(sums[s], expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Errors)
+{
+  std::vector<epicsUInt8> in(16), out(16);
+  std::vector<double> sums(4);
+
+  BOOST_CHECK_EQUAL(NDTimeSeriesAverage(NDUInt8, &in[0], 4, 4, 0, 2, &out[0], 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDTimeSeriesAverage((NDDataType_t)99, &in[0], 4, 4, 1, 2, &out[0], 2), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDTimeSeriesAccumulate((NDDataType_t)99, &in[0], 4, 4, 1, &sums[0]), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
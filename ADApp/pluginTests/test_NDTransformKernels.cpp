@@ -0,0 +1,77 @@
+/*
+ * test_NDTransformKernels.cpp
+ *
+ *  Tests of the cache-blocked transposes of NDPluginTransform.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDConvertKernels.h>
+#include <NDTransformKernels.h>
+
+#include <vector>
+
+// The transpose NDTransformTranspose() documents, one element at a time
+template <typename epicsType>
+static void referenceTranspose(int pixelElements, const std::vector<epicsType>& in, size_t inRowStride,
+                               std::vector<epicsType>& out, size_t outRowStride, size_t xSize, size_t ySize,
+                               int reverseX, int reverseY)
+{
+  for (size_t X=0; X<xSize; X++) {
+    for (size_t Y=0; Y<ySize; Y++) {
+      size_t x = reverseX ? xSize - 1 - X : X;
+      size_t y = reverseY ? ySize - 1 - Y : Y;
+      for (int k=0; k<pixelElements; k++)
+        out[X*outRowStride + Y*pixelElements + k] = in[y*inRowStride + x*pixelElements + k];
+    }
+  }
+}
+
+template <typename epicsType>
+static void checkTranspose(int pixelElements, size_t xSize, size_t ySize)
+{
+  // Padded rows, as for the planes of RGB2
+  size_t inRowStride = xSize*pixelElements + 5, outRowStride = ySize*pixelElements + 3, i;
+  std::vector<epicsType> in(inRowStride*ySize);
+  NDSimdLevel_t level = NDSimdLevel();
+
+  for (i=0; i<in.size(); i++) in[i] = (epicsType)((i*7919) % 65521);
+  for (int reverse=0; reverse<4; reverse++) {
+    int reverseX = reverse & 1, reverseY = reverse & 2;
+    std::vector<epicsType> reference(outRowStride*xSize), scalar(reference), vector(reference);
+    referenceTranspose(pixelElements, in, inRowStride, reference, outRowStride, xSize, ySize, reverseX, reverseY);
+    NDSimdSetMaxLevel(NDSimdNone);
+    BOOST_REQUIRE_EQUAL(NDTransformTranspose(sizeof(epicsType), pixelElements, &in[0], inRowStride, &scalar[0],
+                                             outRowStride, xSize, ySize, reverseX, reverseY), ND_SUCCESS);
+    NDSimdSetMaxLevel(level);
+    BOOST_REQUIRE_EQUAL(NDTransformTranspose(sizeof(epicsType), pixelElements, &in[0], inRowStride, &vector[0],
+                                             outRowStride, xSize, ySize, reverseX, reverseY), ND_SUCCESS);
+    BOOST_CHECK(scalar == reference);
+    BOOST_CHECK(vector == reference);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(NDTransformKernelsTests)
+
+BOOST_AUTO_TEST_CASE(test_Transpose)
+{
+  // Sizes that are not multiples of the tile or of the 8x8 blocks, and a single row and column
+  size_t sizes[][2] = {{1, 1}, {1, 77}, {77, 1}, {8, 8}, {64, 64}, {203, 131}, {131, 203}};
+
+  for (size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+    checkTranspose<epicsUInt8>(1, sizes[s][0], sizes[s][1]);
+    checkTranspose<epicsUInt16>(1, sizes[s][0], sizes[s][1]);
+    checkTranspose<epicsFloat32>(1, sizes[s][0], sizes[s][1]);
+    checkTranspose<epicsFloat64>(1, sizes[s][0], sizes[s][1]);
+    checkTranspose<epicsUInt8>(3, sizes[s][0], sizes[s][1]);
+    checkTranspose<epicsUInt16>(3, sizes[s][0], sizes[s][1]);
+  }
+  std::vector<epicsUInt16> data(4);
+  BOOST_CHECK_EQUAL(NDTransformTranspose(2, 2, &data[0], 2, &data[0], 2, 2, 1, 0, 0), ND_ERROR);
+  BOOST_CHECK_EQUAL(NDTransformTranspose(3, 1, &data[0], 2, &data[0], 2, 2, 1, 0, 0), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,149 @@
+/*
+ * test_NDZarrStore.cpp
+ *
+ *  Tests of the Zarr version 3 stores of NDFileZarr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDZarrStore.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+/** Returns the contents of a file, or an empty string if it cannot be read */
+static std::string readWholeFile(const std::string& path)
+{
+  std::string contents;
+  char buffer[4096];
+  size_t nBytes;
+  FILE *file = fopen(path.c_str(), "rb");
+
+  if (file == NULL) return contents;
+  while ((nBytes = fread(buffer, 1, sizeof(buffer), file)) > 0) contents.append(buffer, nBytes);
+  fclose(file);
+  return contents;
+}
+
+struct ZarrFixture
+{
+  std::string path;
+  NDZarrCompression_t compression;
+
+  ZarrFixture()
+  {
+    char buffer[64];
+    sprintf(buffer, "/tmp/NDZarrStoreTest%d.zarr", (int)getpid());
+    path = buffer;
+    memset(&compression, 0, sizeof(compression));
+  }
+
+  ~ZarrFixture()
+  {
+    std::string command = "rm -rf " + path;
+    if (system(command.c_str()) != 0) printf("cannot remove %s\n", path.c_str());
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDZarrStoreTests, ZarrFixture)
+
+BOOST_AUTO_TEST_CASE(test_Json)
+{
+  std::string json;
+
+  NDZarrJsonString(json, "a \"b\"\\\n");
+  BOOST_CHECK_EQUAL(json, "\"a \\\"b\\\"\\\\\\u000a\"");
+  json.clear();
+  NDZarrJsonNumber(json, 1.5);
+  BOOST_CHECK_EQUAL(json, "1.5");
+  json.clear();
+  NDZarrJsonNumber(json, NAN);
+  BOOST_CHECK_EQUAL(json, "null");
+  BOOST_CHECK_EQUAL(NDZarrNodeName("Det/Temp\\1"), "Det_Temp_1");
+  BOOST_CHECK_EQUAL(NDZarrNodeName("..x"), "_.x");
+  BOOST_CHECK_EQUAL(NDZarrNodeName(""), "_");
+}
+
+BOOST_AUTO_TEST_CASE(test_ArrayMetadataAndChunks)
+{
+  NDZarrArray array;
+  std::vector<size_t> shape, chunkShape, chunkIndex;
+  std::vector<epicsUInt16> chunk(2*3*4);
+  std::vector<char> buffer;
+  std::string metadata;
+  size_t i;
+
+  shape.push_back(5); shape.push_back(7); shape.push_back(10);
+  chunkShape.push_back(2); chunkShape.push_back(3); chunkShape.push_back(4);
+  BOOST_REQUIRE_EQUAL(NDZarrWriteGroup(path, "{}"), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(array.create(path + "/data", NDUInt16, shape, chunkShape, compression, "{\"Gain\": 2}"),
+                      ND_SUCCESS);
+  BOOST_CHECK_EQUAL(array.chunkBytes(), (size_t)48);
+  BOOST_CHECK_EQUAL(array.elementSize(), (size_t)2);
+  BOOST_CHECK(readWholeFile(path + "/zarr.json").find("\"node_type\": \"group\"") != std::string::npos);
+  metadata = readWholeFile(path + "/data/zarr.json");
+  BOOST_CHECK(metadata.find("\"shape\": [5, 7, 10]") != std::string::npos);
+  BOOST_CHECK(metadata.find("\"chunk_shape\": [2, 3, 4]") != std::string::npos);
+  BOOST_CHECK(metadata.find("\"data_type\": \"uint16\"") != std::string::npos);
+  BOOST_CHECK(metadata.find("\"attributes\": {\"Gain\": 2}") != std::string::npos);
+
+  // The directories of a chunk are created when it is written
+  for (i=0; i<chunk.size(); i++) chunk[i] = (epicsUInt16)i;
+  chunkIndex.push_back(2); chunkIndex.push_back(1); chunkIndex.push_back(2);
+  BOOST_REQUIRE_EQUAL(array.writeChunk(chunkIndex, &chunk[0], buffer), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(readWholeFile(path + "/data/c/2/1/2").size(), (size_t)48);
+  BOOST_CHECK(readWholeFile(path + "/data/c/2/1/2") == std::string((const char *)&chunk[0], 48));
+  chunkIndex.pop_back();
+  BOOST_CHECK_EQUAL(array.writeChunk(chunkIndex, &chunk[0], buffer), ND_ERROR);
+
+  // The shape is rewritten with the frames that were written
+  shape[0] = 3;
+  BOOST_REQUIRE_EQUAL(array.setShape(shape), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(array.writeMetadata(), ND_SUCCESS);
+  BOOST_CHECK(readWholeFile(path + "/data/zarr.json").find("\"shape\": [3, 7, 10]") != std::string::npos);
+  shape.pop_back();
+  BOOST_CHECK_EQUAL(array.setShape(shape), ND_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(test_InvalidArrays)
+{
+  NDZarrArray array;
+  std::vector<size_t> shape(2, 4), chunkShape(2, 2);
+
+  chunkShape[1] = 0;
+  BOOST_CHECK_EQUAL(array.create(path + "/data", NDUInt8, shape, chunkShape, compression, "{}"), ND_ERROR);
+  chunkShape.pop_back();
+  BOOST_CHECK_EQUAL(array.create(path + "/data", NDUInt8, shape, chunkShape, compression, "{}"), ND_ERROR);
+}
+
+#ifdef ND_WITH_ZLIB
+BOOST_AUTO_TEST_CASE(test_Gzip)
+{
+  NDZarrArray array;
+  std::vector<size_t> shape(1, 1000), chunkIndex(1, 0);
+  std::vector<epicsFloat64> values(1000, 1.0);
+  std::vector<char> buffer;
+  std::string chunk;
+
+  compression.codec = NDZarrCodecGzip;
+  compression.level = 6;
+  BOOST_REQUIRE_EQUAL(array.create(path + "/values", NDFloat64, shape, shape, compression, "{}"), ND_SUCCESS);
+  BOOST_CHECK(readWholeFile(path + "/values/zarr.json").find("\"name\": \"gzip\"") != std::string::npos);
+  BOOST_REQUIRE_EQUAL(array.writeChunk(chunkIndex, &values[0], buffer), ND_SUCCESS);
+  chunk = readWholeFile(path + "/values/c/0");
+  // The gzip magic number, and much smaller than the 8000 bytes of the chunk
+  BOOST_REQUIRE(chunk.size() > 2);
+  BOOST_CHECK_EQUAL((unsigned char)chunk[0], 0x1f);
+  BOOST_CHECK_EQUAL((unsigned char)chunk[1], 0x8b);
+  BOOST_CHECK(chunk.size() < 200);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -106,3 +106,50 @@ void TestingPlugin::callback(NDArray *pArray)
 
 
 
+
+PluginTestFixture::PluginTestFixture(const std::string& driverPort)
+  : dummy_port(driverPort)
+{
+  arrayPool = new NDArrayPool(100, 0);
+
+  // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers (even if only one is
+  // ever instantiated at once), so change it slightly for each test case.
+  uniqueAsynPortName(dummy_port);
+  dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+  pasynUser = pasynManager->createAsynUser(0, 0);
+}
+
+PluginTestFixture::~PluginTestFixture()
+{
+  pasynManager->freeAsynUser(pasynUser);
+  delete dummy_driver;
+  delete arrayPool;
+}
+
+std::string PluginTestFixture::pluginPort(const std::string& name)
+{
+  std::string port(name);
+  uniqueAsynPortName(port);
+  return port;
+}
+
+boost::shared_ptr<AsynPortClientContainer> PluginTestFixture::connectClient(const std::string& port)
+{
+  boost::shared_ptr<AsynPortClientContainer> client(new AsynPortClientContainer(port));
+  client->write(NDPluginDriverEnableCallbacksString, 1);
+  return client;
+}
+
+void PluginTestFixture::process(NDPluginDriver *pPlugin, NDArray *pArray)
+{
+  pPlugin->lock();
+  pPlugin->processCallbacks(pArray);
+  pPlugin->unlock();
+}
+
+int PluginTestFixture::callback(NDPluginDriver *pPlugin, NDArray *pArray, int auxStatus)
+{
+  pasynUser->auxStatus = (asynStatus)auxStatus;
+  pPlugin->driverCallback(pasynUser, pArray);
+  return pasynUser->auxStatus;
+}
@@ -17,8 +17,14 @@
 #include <string>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
+
 #include <NDArray.h>
 #include <asynPortClient.h>
+#include <asynPortDriver.h>
+#include "AsynPortClientContainer.h"
+
+class NDPluginDriver;
 
 void fillNDArrays(const std::vector<size_t>& dimensions, NDDataType_t dataType, std::vector<NDArray*>& arrays);
 void fillNDArraysFromPool(const std::vector<size_t>& dimensions, NDDataType_t dataType, std::vector<NDArray*>& arrays, NDArrayPool *pNDArrayPool);
@@ -33,5 +39,30 @@ public:
   std::deque<NDArray *> arrays;
 };
 
+// Base class of the fixtures of the plugin tests, with the pool of the arrays and the upstream driver of the
+// plugins.  The upstream driver is never used; the arrays are sent by calling processCallbacks or driverCallback
+// of the plugins directly.
+struct PluginTestFixture
+{
+  NDArrayPool *arrayPool;
+  asynPortDriver *dummy_driver;
+  std::string dummy_port;
+
+  PluginTestFixture(const std::string& driverPort);
+  virtual ~PluginTestFixture();
+  // Returns a port name for a plugin that is unique to the test case
+  static std::string pluginPort(const std::string& name);
+  // Returns a client of the parameters of a plugin, which enables its callbacks
+  static boost::shared_ptr<AsynPortClientContainer> connectClient(const std::string& port);
+  // Calls processCallbacks of a plugin with its lock held, as its callback thread does
+  static void process(NDPluginDriver *pPlugin, NDArray *pArray);
+  // Passes an array to a plugin through driverCallback, as the upstream driver does, with the auxStatus of the
+  // caller, asynOverflow for a caller that does not want the array dropped for a full queue.  Returns the auxStatus
+  // that the plugin left, which is asynOverflow only if its queue was full.
+  int callback(NDPluginDriver *pPlugin, NDArray *pArray, int auxStatus=asynSuccess);
+
+private:
+  asynUser *pasynUser;
+};
 
 #endif /* ADAPP_PLUGINTESTS_TESTINGUTILITIES_H_ */
@@ -37,6 +37,22 @@ dbLoadRecords("NDFileHDF5.template",  "P=$(PREFIX),R=HDF1:,PORT=FileHDF1,ADDR=0,
 NDFileFITSConfigure("FileFITS1", $(QSIZE), 0, "$(PORT)", 0)
 dbLoadRecords("NDFileFITS.template",  "P=$(PREFIX),R=FITS1:,PORT=FileFITS1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 
+# Create a raw file streaming plugin, for the highest capture rates; NDRawToHDF5 converts its files to HDF5
+#NDFileRawConfigure("FileRaw1", $(QSIZE), 0, "$(PORT)", 0)
+#dbLoadRecords("NDFileRaw.template",   "P=$(PREFIX),R=Raw1:,PORT=FileRaw1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a driver that replays the recordings of NDFileRaw, set NDARRAY_PORT of the plugins to REPLAY1 to benchmark them
+#NDRawReplayConfigure("REPLAY1", 0, 0, 0, 0)
+#dbLoadRecords("NDRawReplay.template", "P=$(PREFIX),R=Replay1:,PORT=REPLAY1,ADDR=0,TIMEOUT=1")
+
+# Create a Zarr store saving plugin
+#NDFileZarrConfigure("FileZarr1", $(QSIZE), 0, "$(PORT)", 0)
+#dbLoadRecords("NDFileZarr.template",  "P=$(PREFIX),R=Zarr1:,PORT=FileZarr1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a null file plugin, which measures the throughput and latency of the arrays it receives
+#NDFileNullConfigure("FileNull1", $(QSIZE), 0, "$(PORT)", 0, 0, 0)
+#dbLoadRecords("NDFileNull.template",  "P=$(PREFIX),R=Null1:,PORT=FileNull1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
 # Create a Magick file saving plugin
 #NDFileMagickConfigure("FileMagick1", $(QSIZE), 0, "$(PORT)", 0)
 #dbLoadRecords("NDFileMagick.template","P=$(PREFIX),R=Magick1:,PORT=FileMagick1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
@@ -50,6 +66,13 @@ NDROIConfigure("ROI3", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
 dbLoadRecords("NDROI.template",       "P=$(PREFIX),R=ROI3:,  PORT=ROI3,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 NDROIConfigure("ROI4", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
 dbLoadRecords("NDROI.template",       "P=$(PREFIX),R=ROI4:,  PORT=ROI4,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+# One ROI plugin can also extract several ROIs in one pass, each published on its own address.
+# The last argument is the number of ROIs; NDROIN.template is loaded for each address after 0.
+#NDROIConfigure("ROIN", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5), 4)
+#dbLoadRecords("NDROI.template",       "P=$(PREFIX),R=ROIN:1:,PORT=ROIN,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#dbLoadRecords("NDROIN.template",      "P=$(PREFIX),R=ROIN:2:,PORT=ROIN,ADDR=1,TIMEOUT=1")
+#dbLoadRecords("NDROIN.template",      "P=$(PREFIX),R=ROIN:3:,PORT=ROIN,ADDR=2,TIMEOUT=1")
+#dbLoadRecords("NDROIN.template",      "P=$(PREFIX),R=ROIN:4:,PORT=ROIN,ADDR=3,TIMEOUT=1")
 
 # Create 8 ROIStat plugins
 NDROIStatConfigure("ROISTAT1", $(QSIZE), 0, "$(PORT)", 0, 8, 0, 0, 0, 0, $(MAX_THREADS=5))
@@ -83,6 +106,32 @@ dbLoadRecords("NDGatherN.template",   "P=$(PREFIX),R=Gather1:, N=6, PORT=GATHER1
 dbLoadRecords("NDGatherN.template",   "P=$(PREFIX),R=Gather1:, N=7, PORT=GATHER1,ADDR=6,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 dbLoadRecords("NDGatherN.template",   "P=$(PREFIX),R=Gather1:, N=8, PORT=GATHER1,ADDR=7,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 
+# Create a tile splitter and a tile gather plugin with 2 ports, to process the tiles of each array in parallel
+#NDTileSplitConfigure("TILESPLIT1", $(QSIZE), 0, "$(PORT)", 0, 0, 0)
+#dbLoadRecords("NDTileSplit.template",   "P=$(PREFIX),R=TileSplit1:,  PORT=TILESPLIT1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#NDTileGatherConfigure("TILEGATHER1", $(QSIZE), 0, 2, 0, 0)
+#dbLoadRecords("NDTileGather.template",   "P=$(PREFIX),R=TileGather1:, PORT=TILEGATHER1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#dbLoadRecords("NDGatherN.template",   "P=$(PREFIX),R=TileGather1:, N=1, PORT=TILEGATHER1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#dbLoadRecords("NDGatherN.template",   "P=$(PREFIX),R=TileGather1:, N=2, PORT=TILEGATHER1,ADDR=1,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a plugin that stacks 10 frames into each array, so that the plugins after it are called once for 10 frames
+#NDStackConfigure("STACK1", $(QSIZE), 0, "$(PORT)", 0, 0, 0)
+#dbLoadRecords("NDStack.template",   "P=$(PREFIX),R=Stack1:,  PORT=STACK1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a plugin that sends the arrays to an NDTcpReceiver in another IOC, and a receiver for arrays from another IOC
+#NDTcpSendConfigure("TCPSEND1", $(QSIZE), 0, "$(PORT)", 0, "otherhost:5064", 0, 0)
+#dbLoadRecords("NDTcpSend.template",   "P=$(PREFIX),R=TcpSend1:,  PORT=TCPSEND1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#NDTcpReceiverConfigure("TCPRECV1", 5064, 2, 0, 0)
+#dbLoadRecords("NDTcpReceiver.template",   "P=$(PREFIX),R=TcpRecv1:,  PORT=TCPRECV1,ADDR=0,TIMEOUT=1")
+
+# Create a plugin that compresses the arrays for the plugins after it, e.g. bslz4 for direct chunk writes of NDFileHDF5
+#NDCodecConfigure("CODEC1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
+#dbLoadRecords("NDCodec.template",    "P=$(PREFIX),R=Codec1:,  PORT=CODEC1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a plugin that compresses the arrays to JPEG in memory for web viewers, streamed as MJPEG at http://host:8080/
+#NDMJPEGConfigure("MJPEG1", 3, 0, "$(PORT)", 0, 8080, 0, 0)
+#dbLoadRecords("NDMJPEG.template",     "P=$(PREFIX),R=MJPEG1:,  PORT=MJPEG1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
 # Create 5 statistics plugins
 NDStatsConfigure("STATS1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
 dbLoadRecords("NDStats.template",     "P=$(PREFIX),R=Stats1:,  PORT=STATS1,ADDR=0,TIMEOUT=1,HIST_SIZE=256,XSIZE=$(XSIZE),YSIZE=$(YSIZE),NCHANS=$(NCHANS),NDARRAY_PORT=$(PORT)")
@@ -99,6 +148,14 @@ dbLoadRecords("NDStats.template",     "P=$(PREFIX),R=Stats5:,  PORT=STATS5,ADDR=
 NDTransformConfigure("TRANS1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
 dbLoadRecords("NDTransform.template", "P=$(PREFIX),R=Trans1:,  PORT=TRANS1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 
+# Create a remap plugin, for rotations by any angle, scaling and distortion correction
+NDRemapConfigure("REMAP1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
+dbLoadRecords("NDRemap.template", "P=$(PREFIX),R=Remap1:,  PORT=REMAP1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
+# Create a peak finder plugin, which outputs the peak table of each frame
+NDPeakFinderConfigure("PEAK1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0, $(MAX_THREADS=5))
+dbLoadRecords("NDPeakFinder.template", "P=$(PREFIX),R=Peak1:,  PORT=PEAK1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT),MAX_PEAKS=1000")
+
 # Create an overlay plugin with 8 overlays
 NDOverlayConfigure("OVER1", $(QSIZE), 0, "$(PORT)", 0, 8, 0, 0, 0, 0, $(MAX_THREADS=5))
 dbLoadRecords("NDOverlay.template", "P=$(PREFIX),R=Over1:, PORT=OVER1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
@@ -152,6 +209,38 @@ dbLoadRecords("$(AUTOSAVE)/asApp/Db/save_restoreStatus.db", "P=$(PREFIX)")
 # Must start PVA server if this is enabled
 #startPVAServer
 
+# Optional: set the number of threads shared by the plugins that have UseExecutor=Yes.
+# The default is one thread per CPU.
+#NDPluginExecutorConfigure(8)
+
+# Optional: keep the STATS1 threads on CPUs 2-3, away from the CPUs that serve the detector interrupts,
+# and run them with the SCHED_FIFO real-time policy at priority 50 (policy 0=default, 1=FIFO, 2=RR).
+# The real-time policies need the CAP_SYS_NICE capability or an rtprio limit.
+#NDPluginSetThreadAffinity("STATS1", "2-3")
+#NDPluginSetScheduler("STATS1", 1, 50)
+
+# Optional: run STATS2 in the thread of ROI1, which it gets its arrays from, without a queue in between.
+# Each port must get its arrays from the one before it.  Setting NDArrayPort of STATS2 ends the fusion.
+#NDPluginFuseChain("ROI1 STATS2")
+
+# Optional: trace the path of each array through the plugins, keeping the last 65536 events of each thread.
+# After a burst run NDTraceEnable(0) and NDTraceDump("trace.json"), and open the file with
+# chrome://tracing or ui.perfetto.dev.
+#NDTraceEnable(1, 65536)
+
+# After iocInit, NDPipelineReport prints the graph of the plugins with their rates, drops, queues, threads and
+# pools over a period in seconds, and shows the bottleneck.  With a file name it also writes the report as JSON,
+# for displays that poll the file.
+#NDPipelineReport("", 2)
+#NDPipelineReport("/tmp/$(PREFIX)pipeline.json", 2)
+
+# Optional: load NDPluginShm plugin, which publishes arrays to other processes in a 100 MB shared memory segment.
+# NDShmUseForPool makes the driver allocate its arrays in the segment, so they are published without copying;
+# it must be called before the driver allocates any arrays.
+#NDShmConfigure("SHM1", $(QSIZE), 0, "$(PORT)", 0, "/$(PORT)", 8, 100000000, 16384, 0, 0, 0, 0)
+#dbLoadRecords("NDShm.template",  "P=$(PREFIX),R=Shm1:, PORT=SHM1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#NDShmUseForPool("SHM1", "$(PORT)")
+
 # Optional: load NDPluginEdge plugin
 #NDEdgeConfigure("EDGE1", $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0)
 #dbLoadRecords("NDEdge.template",  "P=$(PREFIX),R=Edge1:, PORT=EDGE1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")